@@ -1,14 +1,15 @@
 import os
 import logging
+from concurrent.futures import ThreadPoolExecutor
 
 import cv2
 import numpy as np
 
 from classy import Class
 
-from Calc2D.TransferFunction import ComputeTransferFunctionList
+from Calc2D.TransferFunction import ComputeTransferFunctionList, TransferGrid
 from Calc2D.DataGeneration import GenerateGaussianData, GenerateSIData
-from Calc2D.DataPropagation import PropagateDatawithList
+from Calc2D.DataPropagation import PropagateDatawithGrid
 from Calc2D.rFourier import *
 from Calc2D.Database import Database
 from collections import namedtuple
@@ -18,6 +19,10 @@ import config
 ClSpectrum = namedtuple("Cls", ["l", "tCl"])
 PkSpectrum = namedtuple("Pkh", ["kh", "Pkh"])
 
+# CLASS runs of all clients (they release the GIL, so that they run
+# concurrently with each other and with the tornado event loop)
+class_pool = ThreadPoolExecutor(max_workers=config.MAX_CLASS_WORKERS)
+
 def normalize(real):
     """
     Given the `real` data, i.e. either a 2d array or a flattened 1d array
@@ -49,6 +54,8 @@ class Calculation(object):
 
         self.redshift = None # to be set later
         self.size = None # to be set later
+        self.TransferFunctionList = None # to be set later
+        self._transfer_grid = None # tabulated on demand, see `transfer_grid`
 
         self.krange = np.logspace(-4, 1, kbins)
 
@@ -61,12 +68,22 @@ class Calculation(object):
         self._resolution = resolution
         self.endshape = (resolution, resolution)
 
+    @property
+    def transfer_grid(self):
+        """
+        Transfer functions tabulated on the |k| values of the FFT grid for
+        all redshifts, computed on the first frame after the cosmological
+        parameters or the initial conditions have changed.
+        """
+        if self._transfer_grid is None:
+            self._transfer_grid = TransferGrid(self.TransferFunctionList, self.k)
+        return self._transfer_grid
+
     def getData(self, redshiftindex):
-        FValuenew = PropagateDatawithList(
-            k=self.k,
+        FValuenew = PropagateDatawithGrid(
             FValue=self.FValue,
             zredindex=redshiftindex,
-            transferFunctionlist=self.TransferFunctionList)
+            transferGrid=self.transfer_grid)
 
         Valuenew = dict()
         FValue_abs = np.abs(self.FValue)
@@ -102,15 +119,18 @@ class Calculation(object):
                                                                 maximum)
 
     def getTransferData(self, redshiftindex):
-        return {field: transfer_function[redshiftindex](self.krange) for field, transfer_function in self.TransferFunctionList.items()}, self.krange
+        return {field: self.transfer_krange(field, redshiftindex) for field in self.transfer_krange.table}, self.krange
 
     def setCosmologialParameters(self, cosmologicalParameters):
         self.cosmologicalParameters = cosmologicalParameters
 
-        # Calculate transfer functions
-        self.TransferFunctionList = ComputeTransferFunctionList(self.cosmologicalParameters, self.redshift)
-        # Calculate Cl's
-        self.tCl, self.mPk = self.calculate_spectra(self.cosmologicalParameters)
+        # Calculate Cl's and transfer functions at the same time
+        spectra = class_pool.submit(self.calculate_spectra, self.cosmologicalParameters)
+        self.TransferFunctionList = class_pool.submit(
+            ComputeTransferFunctionList, self.cosmologicalParameters, self.redshift).result()
+        self.transfer_krange = TransferGrid(self.TransferFunctionList, self.krange)
+        self._transfer_grid = None
+        self.tCl, self.mPk = spectra.result()
 
     def calculate_spectra(self, cosmo_params, force_recalc=False):
         settings = cosmo_params.copy()
@@ -123,8 +143,9 @@ class Calculation(object):
 
         database = Database(config.DATABASE_DIR, "spectra.dat")
 
-        if settings in database and not force_recalc:
-            data = database[settings]
+        data = None if force_recalc else database.get(settings)
+
+        if data is not None:
             ell = data["ell"]
             tt = data["tt"]
             kh = data["kh"]
@@ -151,8 +172,8 @@ class Calculation(object):
             "ell": data["ell"],
             "tt": data["tt"],
 
-            "kh": k,
-            "Pkh": Pk,
+            "kh": kh,
+            "Pkh": Pkh,
 
             "z_rec": z_rec,
             }
@@ -172,6 +193,7 @@ class Calculation(object):
                              SIlimit=None,
                              SI_ns=0.96):
         logging.info("Generating Initial Condition")
+        self._transfer_grid = None
 
         if initialDataType == "Gaussian":
             self.ValueE, self.FValue, self.k, self.kxE, self.kyE = GenerateGaussianData(
@@ -9,6 +9,13 @@ def PropagateDatawithList(k, FValue, zredindex, transferFunctionlist):
         result[field] = (transfer_function[zredindex](k.ravel()) * FValue.ravel()).reshape(FValue.shape)
     return result
 
+#uses the transfer functions tabulated once on the k-grid (see TransferFunction.TransferGrid)
+def PropagateDatawithGrid(FValue, zredindex, transferGrid):
+    result = {}
+    for field in transferGrid.table:
+        result[field] = transferGrid(field, zredindex) * FValue
+    return result
+
 #module with uses two dimensional interpolation and propagates all data at once (fastest but high memory consumption)
 def PropagateAllData(k,FValue,allzred,transferFunction):
 
@@ -1,58 +1,171 @@
-import pickle
 import os
-import logging
+import json
 import uuid
+import shutil
+import hashlib
+import logging
+
+import numpy as np
+
+import config
 
 class Database:
-    def __init__(self, directory, db_file="database.dat"):
+    """
+    Cache of computed results on disk, safe for several threads and
+    processes using the same directory.
+
+    Each record is a directory `<name>-<hash of the key>` holding one
+    `.npy` file per array and a `layout.json` file describing how to
+    rebuild the data (a dict, or a list of dicts, of arrays and numbers).
+    The arrays are opened with memory mapping, so that reading a record
+    does not copy it.
+
+    A record is written in a temporary directory which is then renamed,
+    so that readers only ever see complete records and two writers of the
+    same record cannot corrupt it. The modification time of `layout.json`
+    records the last use of the record: when the records of the directory
+    exceed `max_size` bytes, the least recently used ones are removed.
+    """
+    def __init__(self, directory, db_file="database.dat", max_size=None):
         self.directory = directory
-        self.db_file = db_file
+        # records of different databases in the same directory are told
+        # apart by the name of the database
+        self.name = os.path.splitext(db_file)[0]
+        self.max_size = config.DATABASE_MAX_SIZE if max_size is None else max_size
 
         if not os.path.isdir(directory):
             raise ValueError("'{}' is not a directory!".format(directory))
 
-        self.db_path = os.path.join(directory, db_file)
-        if not os.path.exists(self.db_path):
-            logging.info("No database found; Creating one at {}.".format(self.db_path))
-            with open(self.db_path, "w") as f:
-                pickle.dump(dict(), f)
+    def __hash_key(self, key):
+        """
+        Return a digest of `key`, a dict of parameters, which does not
+        depend on the order of its items or on the types of its sequences.
+        """
+        def canonical(value):
+            if isinstance(value, (tuple, list, np.ndarray)):
+                return [canonical(v) for v in value]
+            if isinstance(value, np.generic):
+                return value.item()
+            return value
+        text = json.dumps(sorted((str(k), canonical(v)) for k, v in key.items()))
+        return hashlib.sha1(text.encode("utf-8")).hexdigest()
+
+    def __record_path(self, key):
+        return os.path.join(self.directory, "{}-{}".format(self.name, self.__hash_key(key)))
+
+    def __write_record(self, path, data):
+        arrays = []
 
-        self.db = self.__read_database()
+        def store(value):
+            if isinstance(value, dict):
+                return {"dict": {k: store(v) for k, v in value.items()}}
+            if isinstance(value, (list, tuple)):
+                return {"list": [store(v) for v in value]}
+            if isinstance(value, np.ndarray):
+                filename = "{}.npy".format(len(arrays))
+                np.save(os.path.join(path, filename), value)
+                arrays.append(filename)
+                return {"array": filename}
+            if isinstance(value, np.generic):
+                return {"value": value.item()}
+            return {"value": value}
 
-    def __read_database(self):
-        with open(self.db_path) as f:
-            return pickle.load(f)
+        layout = store(data)
+        with open(os.path.join(path, "layout.json"), "w") as f:
+            json.dump(layout, f)
 
-    def __write_database(self):
-        with open(self.db_path, "w") as f:
-            pickle.dump(self.db, f)
+    def __read_record(self, path):
+        with open(os.path.join(path, "layout.json")) as f:
+            layout = json.load(f)
 
-    def __create_file(self, data):
-        filename = str(uuid.uuid4())
-        with open(os.path.join(self.directory, filename), "w") as f:
-            pickle.dump(data, f)
-        return filename
+        def load(node):
+            if "dict" in node:
+                return {k: load(v) for k, v in node["dict"].items()}
+            if "list" in node:
+                return [load(v) for v in node["list"]]
+            if "array" in node:
+                return np.load(os.path.join(path, node["array"]), mmap_mode="r")
+            return node["value"]
 
-    def __get_frozen_key(self, key):
-        return frozenset(key.items())
+        return load(layout)
+
+    def __remove(self, path):
+        """
+        Remove the record at `path`: it is first renamed, so that it
+        disappears at once for the readers, which keep access to the
+        arrays they have already mapped.
+        """
+        trash = os.path.join(self.directory, "trash-{}".format(uuid.uuid4()))
+        try:
+            os.rename(path, trash)
+        except OSError:
+            return # already removed by someone else
+        shutil.rmtree(trash, ignore_errors=True)
+
+    def __evict(self):
+        """
+        Remove the least recently used records until the records of all
+        databases in the directory fit into `max_size` bytes.
+        """
+        records = []
+        total_size = 0
+        for entry in os.listdir(self.directory):
+            if entry.startswith("tmp-") or entry.startswith("trash-"):
+                continue # being written or removed
+            path = os.path.join(self.directory, entry)
+            layout = os.path.join(path, "layout.json")
+            try:
+                last_use = os.path.getmtime(layout)
+                size = sum(os.path.getsize(os.path.join(path, f)) for f in os.listdir(path))
+            except OSError:
+                continue # not a record, or removed meanwhile
+            records.append((last_use, size, path))
+            total_size += size
+
+        for last_use, size, path in sorted(records):
+            if total_size <= self.max_size:
+                break
+            logging.info("Removing least recently used cache record {}".format(path))
+            self.__remove(path)
+            total_size -= size
+
+    def get(self, key, default=None):
+        """
+        Return the data stored for `key`, or `default` if there is none.
+        """
+        path = self.__record_path(key)
+        try:
+            data = self.__read_record(path)
+            os.utime(os.path.join(path, "layout.json"), None)
+        except (IOError, OSError):
+            return default
+        return data
 
     def __getitem__(self, key):
-        frozen_key = self.__get_frozen_key(key)
-        if frozen_key in self.db:
-            filename = self.db[frozen_key]
-            with open(os.path.join(self.directory, filename)) as f:
-                return pickle.load(f)
-        else:
+        data = self.get(key)
+        if data is None:
             raise KeyError("No data for key: {}".format(key))
+        return data
 
     def __setitem__(self, key, data):
-        frozen_key = self.__get_frozen_key(key)
-        self.db[frozen_key] = self.__create_file(data)
-        self.__write_database()
+        path = self.__record_path(key)
+        tmp_path = os.path.join(self.directory, "tmp-{}".format(uuid.uuid4()))
+        os.mkdir(tmp_path)
+        try:
+            self.__write_record(tmp_path, data)
+            os.rename(tmp_path, path)
+        except OSError as e:
+            # most likely, the record has been written meanwhile by someone else
+            logging.info("Could not store cache record {}: {}".format(path, e))
+            shutil.rmtree(tmp_path, ignore_errors=True)
+        except:
+            shutil.rmtree(tmp_path, ignore_errors=True)
+            raise
+        self.__evict()
 
     def __contains__(self, key):
         """
         Return whether `self` contains a record
         for the given `key`.
         """
-        return self.__get_frozen_key(key) in self.db
\ No newline at end of file
+        return os.path.exists(os.path.join(self.__record_path(key), "layout.json"))
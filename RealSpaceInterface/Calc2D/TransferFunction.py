@@ -18,8 +18,9 @@ def ComputeTransferData(settings, redshift):
     database_key.update({'redshift': tuple(redshift)})
 
     database = Database.Database(config.DATABASE_DIR)
-    if database_key in database:
-        return database[database_key], redshift
+    outputData = database.get(database_key)
+    if outputData is not None:
+        return outputData, redshift
     else:
         cosmo = Class()
         cosmo.set(settings)
@@ -62,3 +63,32 @@ def ComputeTransferFunctionList(cosmologicalParameters, redshift, kperdecade=200
             transfer_functions[field].append(interpolated_func)
 
     return transfer_functions
+
+
+class TransferGrid(object):
+    """
+    Transfer functions of all fields at all redshifts, tabulated once on
+    the wavenumbers `k` (an array of any shape, e.g. the 2D grid of |k|
+    returned by `GenerateSIData`), so that propagating a frame does not
+    evaluate any spline.
+
+    Each distinct value of `k` is evaluated only once: `table[field]` is a
+    contiguous array of shape (number of redshifts, number of distinct k),
+    and `inverse` (of the shape of `k`) gives the column of each point.
+    """
+    def __init__(self, transfer_functions, k):
+        k_unique, inverse = np.unique(np.ravel(k), return_inverse=True)
+        self.inverse = inverse.reshape(np.shape(k))
+        self.table = {}
+        for field, functions in transfer_functions.items():
+            table = np.empty((len(functions), k_unique.size))
+            for zredindex, function in enumerate(functions):
+                table[zredindex] = function(k_unique)
+            self.table[field] = table
+
+    def __call__(self, field, zredindex):
+        """
+        Return the transfer function of `field` at the redshift of index
+        `zredindex`, on the points of `k`.
+        """
+        return self.table[field][zredindex].take(self.inverse)
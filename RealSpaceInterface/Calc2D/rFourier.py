@@ -1,9 +1,26 @@
 import numpy as np
 import numpy.fft as fft
 
+import config
+
+# Use the multithreaded FFTs of pyFFTW or scipy.fft where available,
+# numpy.fft otherwise
+try:
+    import pyfftw
+    import pyfftw.interfaces.numpy_fft as fft_backend
+    pyfftw.interfaces.cache.enable()
+    FFT_OPTIONS = {"threads": config.FFT_THREADS}
+except ImportError:
+    try:
+        import scipy.fft as fft_backend
+        FFT_OPTIONS = {"workers": config.FFT_THREADS}
+    except ImportError:
+        fft_backend = np.fft
+        FFT_OPTIONS = {}
+
 def realFourier(step, Value):
     FValue = np.fft.fftshift(
-        np.fft.rfft2(Value), axes=(0))  #shifting only the x axes
+        fft_backend.rfft2(Value, **FFT_OPTIONS), axes=(0))  #shifting only the x axes
 
     kx = np.fft.fftshift(np.fft.fftfreq(Value.shape[0], d=step)) * 2 * np.pi
     ky = np.fft.rfftfreq(Value.shape[0], d=step) * 2 * np.pi
@@ -11,11 +28,11 @@ def realFourier(step, Value):
     return kx, ky, FValue
 
 def realInverseFourier(FValue):
-    return np.fft.irfft2(np.fft.ifftshift(
-        FValue, axes=(0)))  #shifting only on the x axes
+    return fft_backend.irfft2(np.fft.ifftshift(
+        FValue, axes=(0)), **FFT_OPTIONS)  #shifting only on the x axes
 
 
 def realInverseAllFourier(allFValue):
-    return np.fft.irfftn(
+    return fft_backend.irfftn(
         np.fft.ifftshift(allFValue, axes=(1)),
-        axes=(1, 2))  #shifting only on the x axes
+        axes=(1, 2), **FFT_OPTIONS)  #shifting only on the x axes
@@ -1,4 +1,5 @@
 import os
+import multiprocessing
 
 # Default port number to listen on. Can be overriden by passing a port number
 # as the first command line argument, e.g. `python tornadoserver.py 1234`
@@ -7,9 +8,20 @@ PORT = 7777
 # Directory to store previously computed transfer functions, spectra etc. in
 DATABASE_DIR = "cache"
 
+# Size in bytes above which the least recently used records of the cache
+# are removed
+DATABASE_MAX_SIZE = 2 * 1024**3
+
 # Maximum number of thread pool workers (only required for multi-user usage)
 MAX_THREADPOOL_WORKERS = 8
 
+# Maximum number of CLASS runs at the same time (each of them using all
+# the OpenMP threads)
+MAX_CLASS_WORKERS = 2
+
+# Number of threads of each FFT (used with pyFFTW or scipy.fft, if installed)
+FFT_THREADS = multiprocessing.cpu_count()
+
 # Path of colormap directory relative to the static directory from which
 # tornado serves static files
 COLORMAP_PATH = os.path.join("images", "colormaps")
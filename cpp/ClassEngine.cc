@@ -21,6 +21,8 @@
 #include<sstream>
 #include<numeric>
 #include<cassert>
+#include<map>
+#include<algorithm>
 
 //#define DBUG
 
@@ -62,20 +64,219 @@ template string str(const unsigned long &x);
 template string str(const long long &x);
 template string str(const unsigned long long &x);
 
+//-----------------------------------------
+// Parameter dependencies of the modules --
+//-----------------------------------------
+//As in python/classy.pyx (_MODULE_DEPENDENCIES and _PARAMETER_MODULE).
+
+//dependsOn[m][d]: the _init function of module m reads the structure of
+//module d (see their arguments in main.c). The transfer functions only read
+//the nonlinear structure when non-linear corrections are applied to the
+//sources, i.e. when 'non linear' is set.
+static const bool dependsOn[ClassStructures::NMODULES][ClassStructures::NMODULES]={
+  //ba th pt pm nl tr sp le
+  { 0, 0, 0, 0, 0, 0, 0, 0}, //background
+  { 1, 0, 0, 0, 0, 0, 0, 0}, //thermodynamics
+  { 1, 1, 0, 0, 0, 0, 0, 0}, //perturb
+  { 0, 0, 1, 0, 0, 0, 0, 0}, //primordial
+  { 1, 1, 1, 1, 0, 0, 0, 0}, //nonlinear
+  { 1, 1, 1, 0, 1, 0, 0, 0}, //transfer
+  { 1, 0, 1, 1, 1, 1, 0, 0}, //spectra
+  { 0, 0, 1, 0, 1, 0, 1, 0}  //lensing
+};
+
+//earliest module reading a parameter, following the sections of
+//input_read_parameters() in source/input.c: the primordial spectrum
+//parameters are only stored in the primordial structure (except 'r', which
+//can switch off tensor perturbations), the non-linear parameters other than
+//'non linear' itself only in the nonlinear structure, and each verbosity
+//parameter only concerns its own module. Any other parameter is assumed to be
+//read by the background module (full recomputation). NMODULES is returned
+//for the parameters which do not require running any module again.
+static int parameterModule(const string& name){
+
+  static const std::map<string,int> modules=[](){
+    std::map<string,int> m;
+    const char* primordial[]={"P_k_ini type","k_pivot","A_s","ln10^{10}A_s","sigma8","n_s",
+			      "alpha_s","n_t","alpha_t",
+			      "f_bi","n_bi","alpha_bi","f_cdi","n_cdi","alpha_cdi",
+			      "f_nid","n_nid","alpha_nid","f_niv","n_niv","alpha_niv",
+			      "k1","k2","P_{RR}^1","P_{RR}^2","P_{II}^1","P_{II}^2",
+			      "P_{RI}^1","|P_{RI}^2|","special iso",
+			      "potential","full_potential","phi_end","ln_aH_ratio","N_star",
+			      "inflation_behavior","command"};
+    for (size_t i=0;i<sizeof(primordial)/sizeof(primordial[0]);i++) m[primordial[i]]=ClassStructures::PRIMORDIAL;
+    const char* prefixes[]={"c","n","alpha"};
+    const char* ics[]={"ad","bi","cdi","nid","niv"};
+    for (int p=0;p<3;p++)
+      for (int i=0;i<5;i++)
+	for (int j=0;j<5;j++)
+	  if (i!=j) m[string(prefixes[p])+"_"+ics[i]+"_"+ics[j]]=ClassStructures::PRIMORDIAL;
+    const char* expansions[]={"V","H","PSR","R","HSR"};
+    for (int p=0;p<5;p++)
+      for (int i=0;i<5;i++) m[string(expansions[p])+"_"+str(i)]=ClassStructures::PRIMORDIAL;
+    for (int i=0;i<5;i++) m["Vparam"+str(i)]=ClassStructures::PRIMORDIAL;
+    for (int i=1;i<=10;i++) m["custom"+str(i)]=ClassStructures::PRIMORDIAL;
+    const char* nonlinear[]={"extrapolation_method","feedback model","eta_0","c_min","z_infinity"};
+    for (size_t i=0;i<sizeof(nonlinear)/sizeof(nonlinear[0]);i++) m[nonlinear[i]]=ClassStructures::NONLINEAR;
+    m["r"]=ClassStructures::PERTURB;
+    m["k_output_values_only"]=ClassStructures::PERTURB;
+    m["bessel_cache"]=ClassStructures::TRANSFER;
+    m["transfer_l_block_size"]=ClassStructures::TRANSFER;
+    m["background_verbose"]=ClassStructures::BACKGROUND;
+    m["thermodynamics_verbose"]=ClassStructures::THERMODYNAMICS;
+    m["perturbations_verbose"]=ClassStructures::PERTURB;
+    m["primordial_verbose"]=ClassStructures::PRIMORDIAL;
+    m["nonlinear_verbose"]=ClassStructures::NONLINEAR;
+    m["transfer_verbose"]=ClassStructures::TRANSFER;
+    m["spectra_verbose"]=ClassStructures::SPECTRA;
+    m["lensing_verbose"]=ClassStructures::LENSING;
+    m["input_verbose"]=ClassStructures::NMODULES;
+    m["output_verbose"]=ClassStructures::NMODULES;
+    return m;
+  }();
+
+  std::map<string,int>::const_iterator it=modules.find(name);
+  return (it==modules.end()) ? ClassStructures::BACKGROUND : it->second;
+}
+
+//---------------
+// ClassStructures --
+//----------------
+ClassStructures::ClassStructures(){
+  fc.size=0;
+  for (int m=0;m<NMODULES;m++) computed[m]=false;
+}
+
+ClassStructures::~ClassStructures(){
+  freeModulesFrom(BACKGROUND);
+  parser_free(&fc);
+}
+
+int
+ClassStructures::initModule(module m,ErrorMsg errmsg){
+
+  int status=_FAILURE_;
+
+  switch(m)
+    {
+    case BACKGROUND:
+      if ((status=background_init(&pr,&ba)) == _FAILURE_) strcpy(errmsg,ba.error_message);
+      break;
+    case THERMODYNAMICS:
+      if ((status=thermodynamics_init(&pr,&ba,&th)) == _FAILURE_) strcpy(errmsg,th.error_message);
+      break;
+    case PERTURB:
+      if ((status=perturb_init(&pr,&ba,&th,&pt)) == _FAILURE_) strcpy(errmsg,pt.error_message);
+      break;
+    case PRIMORDIAL:
+      if ((status=primordial_init(&pr,&pt,&pm)) == _FAILURE_) strcpy(errmsg,pm.error_message);
+      break;
+    case NONLINEAR:
+      if ((status=nonlinear_init(&pr,&ba,&th,&pt,&pm,&nl)) == _FAILURE_) strcpy(errmsg,nl.error_message);
+      break;
+    case TRANSFER:
+      if ((status=transfer_init(&pr,&ba,&th,&pt,&nl,&tr)) == _FAILURE_) strcpy(errmsg,tr.error_message);
+      break;
+    case SPECTRA:
+      if ((status=spectra_init(&pr,&ba,&pt,&pm,&nl,&tr,&sp)) == _FAILURE_) strcpy(errmsg,sp.error_message);
+      break;
+    case LENSING:
+      if ((status=lensing_init(&pr,&pt,&sp,&nl,&le)) == _FAILURE_) strcpy(errmsg,le.error_message);
+      break;
+    default:
+      sprintf(errmsg,"unknown module %d",(int)m);
+    }
+
+  computed[m]=(status==_SUCCESS_);
+  return status;
+}
+
+int
+ClassStructures::freeModule(module m){
+
+  int status=_SUCCESS_;
+  const char* errmsg=0;
+
+  if (!computed[m]) return _SUCCESS_;
+
+  switch(m)
+    {
+    case BACKGROUND:
+      if ((status=background_free(&ba)) == _FAILURE_) errmsg=ba.error_message;
+      break;
+    case THERMODYNAMICS:
+      if ((status=thermodynamics_free(&th)) == _FAILURE_) errmsg=th.error_message;
+      break;
+    case PERTURB:
+      if ((status=perturb_free(&pt)) == _FAILURE_) errmsg=pt.error_message;
+      break;
+    case PRIMORDIAL:
+      if ((status=primordial_free(&pm)) == _FAILURE_) errmsg=pm.error_message;
+      break;
+    case NONLINEAR:
+      if ((status=nonlinear_free(&nl)) == _FAILURE_) errmsg=nl.error_message;
+      break;
+    case TRANSFER:
+      if ((status=transfer_free(&tr)) == _FAILURE_) errmsg=tr.error_message;
+      break;
+    case SPECTRA:
+      if ((status=spectra_free(&sp)) == _FAILURE_) errmsg=sp.error_message;
+      break;
+    case LENSING:
+      if ((status=lensing_free(&le)) == _FAILURE_) errmsg=le.error_message;
+      break;
+    default:
+      break;
+    }
+
+  if (status == _FAILURE_) printf("\n\nError in freeing module %d \n=>%s\n",(int)m,errmsg);
+  //never freed twice
+  computed[m]=false;
+  return status;
+}
+
+size_t
+ClassStructures::memorySize(module m) const{
+
+  if (!computed[m]) return 0;
+
+  switch(m)
+    {
+    case BACKGROUND: return ba.memory_size;
+    case THERMODYNAMICS: return th.memory_size;
+    case PERTURB: return pt.memory_size;
+    case PRIMORDIAL: return pm.memory_size;
+    case NONLINEAR: return nl.memory_size;
+    case TRANSFER: return tr.memory_size;
+    case SPECTRA: return sp.memory_size;
+    case LENSING: return le.memory_size;
+    default: return 0;
+    }
+}
+
+int
+ClassStructures::freeModulesFrom(module first){
+  int status=_SUCCESS_;
+  for (int m=NMODULES-1;m>=first;m--)
+    if (freeModule(static_cast<module>(m)) == _FAILURE_) status=_FAILURE_;
+  return status;
+}
+
 //---------------
 // Constructors --
 //----------------
-ClassEngine::ClassEngine(const ClassParams& pars): cl(0),dofree(true){
+ClassEngine::ClassEngine(const ClassParams& pars): _s(new ClassStructures){
 
   //prepare fp structure
   size_t n=pars.size();
   //
-  parser_init(&fc,n,"pipo",_errmsg);
+  parser_init(&_s->fc,n,"pipo",_errmsg);
   
   //config
   for (size_t i=0;i<pars.size();i++){
-    strcpy(fc.name[i],pars.key(i).c_str());
-    strcpy(fc.value[i],pars.value(i).c_str());
+    strcpy(_s->fc.name[i],pars.key(i).c_str());
+    strcpy(_s->fc.value[i],pars.value(i).c_str());
     //store
     parNames.push_back(pars.key(i));
     //identify lmax
@@ -89,26 +290,25 @@ ClassEngine::ClassEngine(const ClassParams& pars): cl(0),dofree(true){
   assert(_lmax>0);
 
     //input
-  if (input_init(&fc,&pr,&ba,&th,&pt,&tr,&pm,&sp,&nl,&le,&op,_errmsg) == _FAILURE_) 
+  if (input_init(&_s->fc,&_s->pr,&_s->ba,&_s->th,&_s->pt,&_s->tr,&_s->pm,&_s->sp,&_s->nl,&_s->le,&_s->op,_errmsg) == _FAILURE_) 
     throw invalid_argument(_errmsg);
 
   //proetction parametres mal defini
   for (size_t i=0;i<pars.size();i++){
-    if (fc.read[i] !=_TRUE_) throw invalid_argument(string("invalid CLASS parameter: ")+fc.name[i]);
+    if (_s->fc.read[i] !=_TRUE_) throw invalid_argument(string("invalid CLASS parameter: ")+_s->fc.name[i]);
+    parValues.push_back(pars.value(i));
   }
 
   //calcul class
   computeCls();
-  
-  //cout <<"creating " << sp.ct_size << " arrays" <<endl;
-  cl=new double[sp.ct_size];
+
 
   //printFC();
 
 }
 
 
-ClassEngine::ClassEngine(const ClassParams& pars,const string & precision_file): cl(0),dofree(true){
+ClassEngine::ClassEngine(const ClassParams& pars,const string & precision_file): _s(new ClassStructures){
 
   struct file_content fc_precision;
   fc_precision.size = 0;
@@ -128,6 +328,8 @@ ClassEngine::ClassEngine(const ClassParams& pars,const string & precision_file):
   for (size_t i=0;i<pars.size();i++){
     strcpy(fc_input.name[i],pars.key(i).c_str());
     strcpy(fc_input.value[i],pars.value(i).c_str());
+    //store
+    parNames.push_back(pars.key(i));
     if (pars.key(i)=="l_max_scalars") {
       istringstream strstrm(pars.value(i));
       strstrm >> _lmax;
@@ -139,25 +341,24 @@ ClassEngine::ClassEngine(const ClassParams& pars,const string & precision_file):
 
 
   //concatenate both
-  if (parser_cat(&fc_input,&fc_precision,&fc,_errmsg) == _FAILURE_) throw invalid_argument(_errmsg);
+  if (parser_cat(&fc_input,&fc_precision,&_s->fc,_errmsg) == _FAILURE_) throw invalid_argument(_errmsg);
 
   //parser_free(&fc_input);
   parser_free(&fc_precision);
   
   //input
-  if (input_init(&fc,&pr,&ba,&th,&pt,&tr,&pm,&sp,&nl,&le,&op,_errmsg) == _FAILURE_) 
+  if (input_init(&_s->fc,&_s->pr,&_s->ba,&_s->th,&_s->pt,&_s->tr,&_s->pm,&_s->sp,&_s->nl,&_s->le,&_s->op,_errmsg) == _FAILURE_) 
     throw invalid_argument(_errmsg);
 
   //proetction parametres mal defini
   for (size_t i=0;i<pars.size();i++){
-    if (fc.read[i] !=_TRUE_) throw invalid_argument(string("invalid CLASS parameter: ")+fc.name[i]);
+    if (_s->fc.read[i] !=_TRUE_) throw invalid_argument(string("invalid CLASS parameter: ")+_s->fc.name[i]);
+    parValues.push_back(pars.value(i));
   }
 
   //calcul class
   computeCls();
-  
-  //cout <<"creating " << sp.ct_size << " arrays" <<endl;
-  cl=new double[sp.ct_size];
+
 
   //printFC();
 
@@ -173,9 +374,7 @@ ClassEngine::~ClassEngine()
 {
 
   //printFC();
-  dofree && freeStructs();
-
-  delete [] cl;
+  //the computed modules are freed with the structures
 
 }
 
@@ -183,15 +382,101 @@ ClassEngine::~ClassEngine()
 // Member functions --
 //-----------------
 bool ClassEngine::updateParValues(const std::vector<double>& par){
-  dofree && freeStructs();
+
+  //find the modules reading the parameters which changed since the last
+  //computation: they are computed again, as well as the modules depending on
+  //them and the ones which are not computed (e.g. after a failure)
+  //(the par vector gives the values of the first parameters of the engine)
+  if (par.size()>parNames.size()) {
+    printf("\n\nError in updateParValues \n=>%d values for %d parameters\n",(int)par.size(),(int)parNames.size());
+    return false;
+  }
+  bool recompute[ClassStructures::NMODULES]={false};
+  bool changed=false;
+  std::vector<string> values(parValues);
+  for (size_t i=0;i<par.size();i++) {
+    values[i]=str(par[i]);
+    if (values[i]!=parValues[i]) {
+      int m=parameterModule(parNames[i]);
+      if (m<ClassStructures::NMODULES) recompute[m]=true;
+      changed=true;
+    }
+  }
+
+  //with the low_memory profile, the perturbation sources (read by the
+  //nonlinear and transfer modules) and the transfer functions (read by the
+  //spectra module) are freed once used: they must then be computed again
+  //whenever a module reading them is (until nothing changes)
+  bool released[ClassStructures::NMODULES]={false};
+  released[ClassStructures::PERTURB]=_s->isComputed(ClassStructures::PERTURB) && (_s->pt.sources_released==_TRUE_);
+  released[ClassStructures::TRANSFER]=_s->isComputed(ClassStructures::TRANSFER) && (_s->tr.tables_released==_TRUE_);
+
+  bool needed=false;
+  bool grown=true;
+  while (grown) {
+    grown=false;
+    needed=false;
+    for (int m=0;m<ClassStructures::NMODULES;m++) {
+      ClassStructures::module mod=static_cast<ClassStructures::module>(m);
+      bool before=recompute[m];
+      if (!_s->isComputed(mod)) recompute[m]=true;
+      for (int d=0;d<m;d++){
+	if ((mod==ClassStructures::TRANSFER) && (d==ClassStructures::NONLINEAR) && (_s->nl.method==nl_none)) continue;
+	if (dependsOn[m][d] && recompute[d]) recompute[m]=true;
+      }
+      if (released[ClassStructures::PERTURB] && (mod==ClassStructures::PERTURB) &&
+	  (recompute[ClassStructures::NONLINEAR] || recompute[ClassStructures::TRANSFER])) recompute[m]=true;
+      if (released[ClassStructures::TRANSFER] && (mod==ClassStructures::TRANSFER) &&
+	  recompute[ClassStructures::SPECTRA]) recompute[m]=true;
+      grown = grown || (recompute[m]!=before);
+      needed = needed || recompute[m];
+    }
+  }
+#ifdef DBUG
+  for (int m=0;m<ClassStructures::NMODULES;m++)
+    cout << "update par values: module " << m << (recompute[m] ? " recomputed" : " reused") << endl;
+#endif
+
+  //same parameters: nothing to do
+  if (!changed && !needed) return true;
+
   for (size_t i=0;i<par.size();i++) {
-    double val=par[i];
-    strcpy(fc.value[i],str(val).c_str());
-    strcpy(fc.name[i],parNames[i].c_str());
+    strcpy(_s->fc.value[i],values[i].c_str());
+    strcpy(_s->fc.name[i],parNames[i].c_str());
 #ifdef DBUG
-    cout << "update par values #" << i << "\t" <<  val << "\t" << str(val).c_str() << endl;
+    cout << "update par values #" << i << "\t" <<  par[i] << "\t" << values[i] << endl;
 #endif
   }
+
+  //the input is read in temporary structures, such that the reused modules
+  //are not affected (and kept if it fails)
+  std::unique_ptr<ClassStructures> in(new ClassStructures);
+  if (input_init(&_s->fc,&in->pr,&in->ba,&in->th,&in->pt,&in->tr,&in->pm,&in->sp,&in->nl,&in->le,&in->op,_errmsg) == _FAILURE_) {
+    printf("\n\nError running input_init \n=>%s\n",_errmsg);
+    return false;
+  }
+  parValues=values;
+
+  //free the modules which are not reused (in reverse order), and replace
+  //their structures by the ones just filled by the input module. For reused
+  //modules, discard the new input instead.
+  for (int m=ClassStructures::NMODULES-1;m>=0;m--)
+    if (recompute[m]) _s->freeModule(static_cast<ClassStructures::module>(m));
+  input_free(recompute[ClassStructures::BACKGROUND] ? NULL : &in->ba,
+	     recompute[ClassStructures::PERTURB] ? NULL : &in->pt,
+	     recompute[ClassStructures::PRIMORDIAL] ? NULL : &in->pm,
+	     recompute[ClassStructures::NONLINEAR] ? NULL : &in->nl);
+  _s->pr=in->pr;
+  _s->op=in->op;
+  if (recompute[ClassStructures::BACKGROUND]) _s->ba=in->ba;
+  if (recompute[ClassStructures::THERMODYNAMICS]) _s->th=in->th;
+  if (recompute[ClassStructures::PERTURB]) _s->pt=in->pt;
+  if (recompute[ClassStructures::PRIMORDIAL]) _s->pm=in->pm;
+  if (recompute[ClassStructures::NONLINEAR]) _s->nl=in->nl;
+  if (recompute[ClassStructures::TRANSFER]) _s->tr=in->tr;
+  if (recompute[ClassStructures::SPECTRA]) _s->sp=in->sp;
+  if (recompute[ClassStructures::LENSING]) _s->le=in->le;
+
   int status=computeCls();
 #ifdef DBUG
   cout << "update par status=" << status << " succes=" << _SUCCESS_ << endl;
@@ -202,114 +487,12 @@ bool ClassEngine::updateParValues(const std::vector<double>& par){
 
 //print content of file_content
 void ClassEngine::printFC() {
-  printf("FILE_CONTENT SIZE=%d\n",fc.size);
-  for (int i=0;i<fc.size;i++) printf("%d : %s = %s\n",i,fc.name[i],fc.value[i]);
-
-
-}
-int ClassEngine::class_main(
-			    struct file_content *pfc,
-			    struct precision * ppr,
-			    struct background * pba,
-			    struct thermo * pth,
-			    struct perturbs * ppt,
-			    struct transfers * ptr,
-			    struct primordial * ppm,
-			    struct spectra * psp,
-			    struct nonlinear * pnl,
-			    struct lensing * ple,
-			    struct output * pop,
-			    ErrorMsg errmsg) {
-  
-
-  if (input_init(pfc,ppr,pba,pth,ppt,ptr,ppm,psp,pnl,ple,pop,errmsg) == _FAILURE_) {
-    printf("\n\nError running input_init_from_arguments \n=>%s\n",errmsg);
-    dofree=false;
-    return _FAILURE_;
-  }
-
-  if (background_init(ppr,pba) == _FAILURE_) {
-    printf("\n\nError running background_init \n=>%s\n",pba->error_message);
-    dofree=false;
-    return _FAILURE_;
-  }
+  printf("FILE_CONTENT SIZE=%d\n",_s->fc.size);
+  for (int i=0;i<_s->fc.size;i++) printf("%d : %s = %s\n",i,_s->fc.name[i],_s->fc.value[i]);
 
-  if (thermodynamics_init(ppr,pba,pth) == _FAILURE_) {
-    printf("\n\nError in thermodynamics_init \n=>%s\n",pth->error_message);
-    background_free(&ba);
-    dofree=false;
-    return _FAILURE_;
-  }
-
-  if (perturb_init(ppr,pba,pth,ppt) == _FAILURE_) {
-    printf("\n\nError in perturb_init \n=>%s\n",ppt->error_message);
-    thermodynamics_free(&th);
-    background_free(&ba);
-    dofree=false;
-    return _FAILURE_;
-  }
-
-  if (primordial_init(ppr,ppt,ppm) == _FAILURE_) {
-    printf("\n\nError in primordial_init \n=>%s\n",ppm->error_message);
-    perturb_free(&pt);
-    thermodynamics_free(&th);
-    background_free(&ba);
-    dofree=false;
-    return _FAILURE_;
-  }
-
-  if (nonlinear_init(ppr,pba,pth,ppt,ppm,pnl) == _FAILURE_)  {
-    printf("\n\nError in nonlinear_init \n=>%s\n",pnl->error_message);
-    primordial_free(&pm);
-    perturb_free(&pt);
-    thermodynamics_free(&th);
-    background_free(&ba);
-    dofree=false;
-    return _FAILURE_;
-  }
 
-  if (transfer_init(ppr,pba,pth,ppt,pnl,ptr) == _FAILURE_) {
-    printf("\n\nError in transfer_init \n=>%s\n",ptr->error_message);
-    nonlinear_free(&nl);
-    primordial_free(&pm);
-    perturb_free(&pt);
-    thermodynamics_free(&th);
-    background_free(&ba);
-    dofree=false;
-    return _FAILURE_;
-  }
-
-  if (spectra_init(ppr,pba,ppt,ppm,pnl,ptr,psp) == _FAILURE_) {
-    printf("\n\nError in spectra_init \n=>%s\n",psp->error_message);
-    transfer_free(&tr);
-    nonlinear_free(&nl);
-    primordial_free(&pm);
-    perturb_free(&pt);
-    thermodynamics_free(&th);
-    background_free(&ba);
-    dofree=false;
-    return _FAILURE_;
-  }
-
-  if (lensing_init(ppr,ppt,psp,pnl,ple) == _FAILURE_) {
-    printf("\n\nError in lensing_init \n=>%s\n",ple->error_message);
-    spectra_free(&sp);
-    transfer_free(&tr);
-    nonlinear_free(&nl);
-    primordial_free(&pm);
-    perturb_free(&pt);
-    thermodynamics_free(&th);
-    background_free(&ba);
-    dofree=false;
-    return _FAILURE_;
-  }
-
-
-  dofree=true;
-  return _SUCCESS_;
 }
 
-
 int ClassEngine::computeCls(){
 
 #ifdef DBUG
@@ -317,7 +500,17 @@ int ClassEngine::computeCls(){
   //printFC();
 #endif
 
-  int status=this->class_main(&fc,&pr,&ba,&th,&pt,&tr,&pm,&sp,&nl,&le,&op,_errmsg);
+  static const char* names[ClassStructures::NMODULES]={"background_init","thermodynamics_init","perturb_init","primordial_init",
+							"nonlinear_init","transfer_init","spectra_init","lensing_init"};
+  int status=_SUCCESS_;
+  for (int m=0;m<ClassStructures::NMODULES;m++){
+    ClassStructures::module mod=static_cast<ClassStructures::module>(m);
+    if (_s->isComputed(mod)) continue;
+    if ((status=_s->initModule(mod,_errmsg)) == _FAILURE_) {
+      printf("\n\nError in %s \n=>%s\n",names[m],_errmsg);
+      break;
+    }
+  }
 #ifdef DBUG
   cout <<"status=" << status << endl;
 #endif
@@ -325,93 +518,76 @@ int ClassEngine::computeCls(){
 
 }
 
-int
-ClassEngine::freeStructs(){
-  
-  
-  if (lensing_free(&le) == _FAILURE_) {
-    printf("\n\nError in spectra_free \n=>%s\n",le.error_message);
-    return _FAILURE_;
-  }
-  
-  if (nonlinear_free(&nl) == _FAILURE_) {
-    printf("\n\nError in nonlinear_free \n=>%s\n",nl.error_message);
-    return _FAILURE_;
-  }
-  
-  if (spectra_free(&sp) == _FAILURE_) {
-    printf("\n\nError in spectra_free \n=>%s\n",sp.error_message);
-    return _FAILURE_;
-  }
-    
-  if (primordial_free(&pm) == _FAILURE_) {
-    printf("\n\nError in primordial_free \n=>%s\n",pm.error_message);
-    return _FAILURE_;
-  }
-  
-  if (transfer_free(&tr) == _FAILURE_) {
-    printf("\n\nError in transfer_free \n=>%s\n",tr.error_message);
-    return _FAILURE_;
-  }
-
-  if (perturb_free(&pt) == _FAILURE_) {
-    printf("\n\nError in perturb_free \n=>%s\n",pt.error_message);
-    return _FAILURE_;
-  }
-
-  if (thermodynamics_free(&th) == _FAILURE_) {
-    printf("\n\nError in thermodynamics_free \n=>%s\n",th.error_message);
-    return _FAILURE_;
-  }
-
-  if (background_free(&ba) == _FAILURE_) {
-    printf("\n\nError in background_free \n=>%s\n",ba.error_message);
-    return _FAILURE_;
-  }
-
-  return _SUCCESS_;
-}
-
-double
-ClassEngine::getCl(Engine::cltype t,const long &l){
-
-  if (!dofree) throw out_of_range("no Cl available because CLASS failed");
-
-  if (output_total_cl_at_l(&sp,&le,&op,static_cast<double>(l),cl) == _FAILURE_){
-    cerr << ">>>fail getting Cl type=" << (int)t << " @l=" << l <<endl; 
-    throw out_of_range(sp.error_message);
-  }
-
-  double zecl=-1;
+void
+ClassEngine::clIndex(Engine::cltype t,int& index,double& factor) const{
 
+  const struct spectra* psp=&_s->sp;
   double tomuk=1e6*Tcmb();
   double tomuk2=tomuk*tomuk;
 
   switch(t)
     {
     case TT:
-      (sp.has_tt==_TRUE_) ? zecl=tomuk2*cl[sp.index_ct_tt] : throw invalid_argument("no ClTT available");
+      (psp->has_tt==_TRUE_) ? index=psp->index_ct_tt : throw invalid_argument("no ClTT available");
+      factor=tomuk2;
       break;
     case TE:
-      (sp.has_te==_TRUE_) ? zecl=tomuk2*cl[sp.index_ct_te] : throw invalid_argument("no ClTE available");
+      (psp->has_te==_TRUE_) ? index=psp->index_ct_te : throw invalid_argument("no ClTE available");
+      factor=tomuk2;
       break; 
     case EE:
-      (sp.has_ee==_TRUE_) ? zecl=tomuk2*cl[sp.index_ct_ee] : throw invalid_argument("no ClEE available");
+      (psp->has_ee==_TRUE_) ? index=psp->index_ct_ee : throw invalid_argument("no ClEE available");
+      factor=tomuk2;
       break;
     case BB:
-      (sp.has_bb==_TRUE_) ? zecl=tomuk2*cl[sp.index_ct_bb] : throw invalid_argument("no ClBB available");
+      (psp->has_bb==_TRUE_) ? index=psp->index_ct_bb : throw invalid_argument("no ClBB available");
+      factor=tomuk2;
       break;
     case PP:
-      (sp.has_pp==_TRUE_) ? zecl=cl[sp.index_ct_pp] : throw invalid_argument("no ClPhi-Phi available");
+      (psp->has_pp==_TRUE_) ? index=psp->index_ct_pp : throw invalid_argument("no ClPhi-Phi available");
+      factor=1.;
       break;
     case TP:
-      (sp.has_tp==_TRUE_) ? zecl=tomuk*cl[sp.index_ct_tp] : throw invalid_argument("no ClT-Phi available");
+      (psp->has_tp==_TRUE_) ? index=psp->index_ct_tp : throw invalid_argument("no ClT-Phi available");
+      factor=tomuk;
       break;
     case EP:
-      (sp.has_ep==_TRUE_) ? zecl=tomuk*cl[sp.index_ct_ep] : throw invalid_argument("no ClE-Phi available");
+      (psp->has_ep==_TRUE_) ? index=psp->index_ct_ep : throw invalid_argument("no ClE-Phi available");
+      factor=tomuk;
       break;
+    default:
+      throw invalid_argument("unknown Cl type");
     }
-  
+}
+
+void
+ClassEngine::getCls(const std::vector<Engine::cltype>& types,long lmin,long lmax,double* out) const{
+
+  if (!_s->isComputed(ClassStructures::LENSING)) throw out_of_range("no Cl available because CLASS failed");
+
+  size_t ntypes=types.size();
+  std::vector<int> index(ntypes);
+  std::vector<double> factor(ntypes);
+  for (size_t i=0;i<ntypes;i++) clIndex(types[i],index[i],factor[i]);
+
+  //all types at each l, in one call (the error message is local to this call)
+  int ct_size=_s->sp.ct_size;
+  std::vector<double> cls((lmax-lmin+1)*ct_size);
+  ErrorMsg errmsg;
+  if (output_total_cls_at_l_range(&_s->sp,&_s->le,lmin,lmax,&cls[0],errmsg) == _FAILURE_){
+    throw out_of_range(errmsg);
+  }
+
+  for (long l=lmin;l<=lmax;l++)
+    for (size_t i=0;i<ntypes;i++)
+      out[(l-lmin)*ntypes+i]=factor[i]*cls[(l-lmin)*ct_size+index[i]];
+}
+
+double
+ClassEngine::getCl(Engine::cltype t,const long &l) const{
+
+  double zecl=-1;
+  getCls(std::vector<Engine::cltype>(1,t),l,l,&zecl);
   return zecl;
 
 }
@@ -426,17 +602,20 @@ ClassEngine::getCls(const std::vector<unsigned>& lvec, //input
   clte.resize(lvec.size());
   clee.resize(lvec.size());
   clbb.resize(lvec.size());
-  
+  if (lvec.empty()) return;
+
+  //one call for the whole range of l
+  long lmin=*min_element(lvec.begin(),lvec.end());
+  long lmax=*max_element(lvec.begin(),lvec.end());
+  const Engine::cltype t[4]={ClassEngine::TT,ClassEngine::TE,ClassEngine::EE,ClassEngine::BB};
+  std::vector<double> cls((lmax-lmin+1)*4);
+  getCls(std::vector<Engine::cltype>(t,t+4),lmin,lmax,&cls[0]);
+
   for (size_t i=0;i<lvec.size();i++){
-    try{
-      cltt[i]=getCl(ClassEngine::TT,lvec[i]);
-      clte[i]=getCl(ClassEngine::TE,lvec[i]);
-      clee[i]=getCl(ClassEngine::EE,lvec[i]);
-      clbb[i]=getCl(ClassEngine::BB,lvec[i]);
-    }
-    catch(exception &e){
-      throw e;
-    }
+    cltt[i]=cls[(lvec[i]-lmin)*4];
+    clte[i]=cls[(lvec[i]-lmin)*4+1];
+    clee[i]=cls[(lvec[i]-lmin)*4+2];
+    clbb[i]=cls[(lvec[i]-lmin)*4+3];
   }
 
 }
@@ -451,44 +630,158 @@ ClassEngine::getLensing(const std::vector<unsigned>& lvec, //input
   clpp.resize(lvec.size());
   cltp.resize(lvec.size());
   clep.resize(lvec.size());
-  
+  if (lvec.empty()) return true;
+
+  //one call for the whole range of l
+  long lmin=*min_element(lvec.begin(),lvec.end());
+  long lmax=*max_element(lvec.begin(),lvec.end());
+  const Engine::cltype t[3]={ClassEngine::PP,ClassEngine::TP,ClassEngine::EP};
+  std::vector<double> cls((lmax-lmin+1)*3);
+  try{
+    getCls(std::vector<Engine::cltype>(t,t+3),lmin,lmax,&cls[0]);
+  }
+  catch(exception &e){
+    cout << "plantage!" << endl;
+    cout << __FILE__ << e.what() << endl;
+    return false;
+  }
+
   for (size_t i=0;i<lvec.size();i++){
-    try{
-      clpp[i]=getCl(ClassEngine::PP,lvec[i]);
-      cltp[i]=getCl(ClassEngine::TP,lvec[i]);
-      clep[i]=getCl(ClassEngine::EP,lvec[i]);
-    }
-    catch(exception &e){
-      cout << "plantage!" << endl;
-      cout << __FILE__ << e.what() << endl;
-      return false;
-    }
+    clpp[i]=cls[(lvec[i]-lmin)*3];
+    cltp[i]=cls[(lvec[i]-lmin)*3+1];
+    clep[i]=cls[(lvec[i]-lmin)*3+2];
   }
   return true;
 }
 
+void
+ClassEngine::backgroundAtZ(const std::vector<double>& z,std::vector<double>& table) const{
 
-double ClassEngine::get_f(double z)
-{
+  struct background* pba=&_s->ba;
+
+  if (!_s->isComputed(ClassStructures::BACKGROUND)) throw out_of_range("no background available because CLASS failed");
+
+  //checked here, such that the CLASS functions below cannot fail, and only
+  //read the background structure
+  for (size_t i=0;i<z.size();i++){
+    if ((z[i]<pba->z_table[pba->bt_size-1]) || (z[i]>pba->z_table[0]))
+      throw out_of_range("z="+str(z[i])+" out of the range of the background table");
+  }
+
+  table.resize(z.size()*pba->bg_size);
+
+  //the interval of the previous redshift is the starting point of the search
+  int last_index=0;
   double tau;
-  int index;
-  double *pvecback;
-  //transform redshift in conformal time
-  background_tau_of_z(&ba,z,&tau);
+  for (size_t i=0;i<z.size();i++){
+    //transform redshift in conformal time
+    background_tau_of_z(pba,z[i],&tau);
+    tau=max(pba->tau_table[0],min(pba->tau_table[pba->bt_size-1],tau));
+    background_at_tau(pba,tau,pba->long_info,pba->inter_closeby,&last_index,&table[i*pba->bg_size]);
+  }
+}
 
-  //pvecback must be allocated 
-  pvecback=(double *)malloc(ba.bg_size*sizeof(double));
+void ClassEngine::get_Hz(const std::vector<double>& z,std::vector<double>& Hz) const
+{
+  std::vector<double> table;
+  backgroundAtZ(z,table);
+  int bg_size=_s->ba.bg_size;
+  Hz.resize(z.size());
+  for (size_t i=0;i<z.size();i++) Hz[i]=table[i*bg_size+_s->ba.index_bg_H];
+}
 
-  //call to fill pvecback
-  background_at_tau(&ba,tau,ba.long_info,ba.inter_normal, &index, pvecback);
+void ClassEngine::get_Da(const std::vector<double>& z,std::vector<double>& Da) const
+{
+  std::vector<double> table;
+  backgroundAtZ(z,table);
+  int bg_size=_s->ba.bg_size;
+  Da.resize(z.size());
+  for (size_t i=0;i<z.size();i++) Da[i]=table[i*bg_size+_s->ba.index_bg_ang_distance];
+}
+
+void ClassEngine::get_Dv(const std::vector<double>& z,std::vector<double>& Dv) const
+{
+  std::vector<double> table;
+  backgroundAtZ(z,table);
+  int bg_size=_s->ba.bg_size;
+  Dv.resize(z.size());
+  for (size_t i=0;i<z.size();i++){
+    double H_z=table[i*bg_size+_s->ba.index_bg_H];
+    double D_ang=table[i*bg_size+_s->ba.index_bg_ang_distance];
+    Dv[i]=pow(pow(D_ang*(1+z[i]),2)*z[i]/H_z,1./3.);
+  }
+}
+
+void ClassEngine::get_f(const std::vector<double>& z,std::vector<double>& f) const
+{
+  std::vector<double> table;
+  backgroundAtZ(z,table);
+  int bg_size=_s->ba.bg_size;
+  f.resize(z.size());
+  for (size_t i=0;i<z.size();i++) f[i]=table[i*bg_size+_s->ba.index_bg_f];
+}
+
+void ClassEngine::get_Pk(const std::vector<double>& k,const std::vector<double>& z,std::vector<double>& pk,bool nonlinear) const
+{
+  struct nonlinear* pnl=&_s->nl;
 
+  if (!_s->isComputed(ClassStructures::NONLINEAR)) throw out_of_range("no P(k) available because CLASS failed");
+  if (_s->pt.has_pk_matter==_FALSE_) throw invalid_argument("no P(k) available: add mPk to the output");
+  if (nonlinear && (pnl->method==nl_none)) throw invalid_argument("no non-linear P(k) available: set 'non linear'");
 
+  //checked here, such that the CLASS function below cannot fail, and only
+  //reads the structures
+  double kmax=exp(pnl->ln_k[pnl->k_size-1]);
+  for (size_t i=0;i<k.size();i++){
+    if ((k[i]<0.) || (k[i]>kmax)) throw out_of_range("k="+str(k[i])+" out of [0,"+str(kmax)+"]");
+  }
+  for (size_t i=0;i<z.size();i++){
+    if ((z[i]<0.) || (z[i]>_s->pt.z_max_pk) || ((z[i]>0.) && (pnl->ln_tau_size==1)))
+      throw out_of_range("z="+str(z[i])+" out of [0,z_max_pk="+str(_s->pt.z_max_pk)+"]");
+  }
+
+  pk.resize(k.size()*z.size());
+  if (pk.empty()) return;
+
+  //same wavenumbers at each redshift
+  std::vector<double> kvec(k.size()*z.size());
+  for (size_t i=0;i<z.size();i++) std::copy(k.begin(),k.end(),kvec.begin()+i*k.size());
 
-  double f_z=pvecback[ba.index_bg_f];
+  if (nonlinear_pk_at_kvec_and_zvec(&_s->ba,&_s->pm,pnl,nonlinear ? pk_nonlinear : pk_linear,pnl->index_pk_m,
+				    &kvec[0],k.size(),const_cast<double*>(&z[0]),z.size(),&pk[0]) == _FAILURE_)
+    throw runtime_error(pnl->error_message);
+}
+
+std::vector<ClassEngine::ProfileEntry> ClassEngine::getProfile()
+{
+  struct class_profile_counters total;
+  int nthreads;
+  class_profile_get(NULL,NULL,0,&nthreads);
+  std::vector<struct class_profile_counters> threads(std::max(nthreads,1));
+  class_profile_get(&total,threads.data(),threads.size(),&nthreads);
+  nthreads=std::min(nthreads,int(threads.size()));
+
+  std::vector<ProfileEntry> profile;
+  for (int index=0;index<profile_size;index++){
+    if (total.calls[index]==0) continue;
+    ProfileEntry e;
+    e.name=class_profile_name(index);
+    e.calls=total.calls[index];
+    e.time=total.time[index];
+    for (int i=0;i<nthreads;i++) e.threadTime.push_back(threads[i].time[index]);
+    profile.push_back(e);
+  }
+  return profile;
+}
+
+double ClassEngine::get_f(double z)
+{
+  std::vector<double> f_z;
+  get_f(std::vector<double>(1,z),f_z);
 #ifdef DBUG
-  cout << "f_of_z= "<< f_z <<endl;
+  cout << "f_of_z= "<< f_z[0] <<endl;
 #endif
-  return f_z;
+  return f_z[0];
 }
 
 
@@ -499,15 +792,15 @@ double ClassEngine::get_sigma8(double z)
   double *pvecback;
   double sigma8 = 0.;
   //transform redshift in conformal time
-  background_tau_of_z(&ba,z,&tau);
+  background_tau_of_z(&_s->ba,z,&tau);
 
   //pvecback must be allocated 
-  pvecback=(double *)malloc(ba.bg_size*sizeof(double));
+  pvecback=(double *)malloc(_s->ba.bg_size*sizeof(double));
 
   //call to fill pvecback
-  background_at_tau(&ba,tau,ba.long_info,ba.inter_normal, &index, pvecback);
+  background_at_tau(&_s->ba,tau,_s->ba.long_info,_s->ba.inter_normal, &index, pvecback);
   //background_at_tau(pba,tau,pba->long_info,pba->inter_normal,&last_index,pvecback);
-  spectra_sigma(&ba,&pm,&sp,8./ba.h,z,&sigma8);
+  spectra_sigma(&_s->ba,&_s->pm,&_s->sp,8./_s->ba.h,z,&sigma8);
 
 #ifdef DBUG
   cout << "sigma_8= "<< sigma8 <<endl;
@@ -527,52 +820,21 @@ double ClassEngine::get_Az(double z)
 
 double ClassEngine::get_Dv(double z)
 {
-  double tau;
-  int index;
-  double *pvecback;
-  //transform redshift in conformal time
-  background_tau_of_z(&ba,z,&tau);
-
-  //pvecback must be allocated 
-  pvecback=(double *)malloc(ba.bg_size*sizeof(double));
-
-  //call to fill pvecback
-  background_at_tau(&ba,tau,ba.long_info,ba.inter_normal, &index, pvecback);
-
-
-  double H_z=pvecback[ba.index_bg_H];
-  double D_ang=pvecback[ba.index_bg_ang_distance];
+  std::vector<double> D_v;
+  get_Dv(std::vector<double>(1,z),D_v);
 #ifdef DBUG
-  cout << "H_z= "<< H_z <<endl;
-  cout << "D_ang= "<< D_ang <<endl;
-#endif
-  double D_v;
-
-  D_v=pow(D_ang*(1+z),2)*z/H_z;
-  D_v=pow(D_v,1./3.);
-#ifdef DBUG
-  cout << D_v << endl;
+  cout << D_v[0] << endl;
 #endif
-  return D_v;
+  return D_v[0];
 }
 
 double ClassEngine::get_Fz(double z)
 {
-  double tau;
-  int index;
-  double *pvecback;
-  //transform redshift in conformal time
-  background_tau_of_z(&ba,z,&tau);
-
-  //pvecback must be allocated 
-  pvecback=(double *)malloc(ba.bg_size*sizeof(double));
-
-  //call to fill pvecback
-  background_at_tau(&ba,tau,ba.long_info,ba.inter_normal, &index, pvecback);
-
+  std::vector<double> table;
+  backgroundAtZ(std::vector<double>(1,z),table);
 
-  double H_z=pvecback[ba.index_bg_H];
-  double D_ang=pvecback[ba.index_bg_ang_distance];
+  double H_z=table[_s->ba.index_bg_H];
+  double D_ang=table[_s->ba.index_bg_ang_distance];
 #ifdef DBUG
   cout << "H_z= "<< H_z <<endl;
   cout << "D_ang= "<< D_ang <<endl;
@@ -583,46 +845,19 @@ double ClassEngine::get_Fz(double z)
 
 double ClassEngine::get_Hz(double z)
 {
-  double tau;
-  int index;
-  double *pvecback;
-  //transform redshift in conformal time
-  background_tau_of_z(&ba,z,&tau);
-
-  //pvecback must be allocated 
-  pvecback=(double *)malloc(ba.bg_size*sizeof(double));
-
-  //call to fill pvecback
-  background_at_tau(&ba,tau,ba.long_info,ba.inter_normal, &index, pvecback);
-
-
-  double H_z=pvecback[ba.index_bg_H];
-
-  return(H_z);
+  std::vector<double> H_z;
+  get_Hz(std::vector<double>(1,z),H_z);
+  return(H_z[0]);
 
 }
 
 
 double ClassEngine::get_Da(double z)
 {
-  double tau;
-  int index;
-  double *pvecback;
-  //transform redshift in conformal time
-  background_tau_of_z(&ba,z,&tau);
-
-  //pvecback must be allocated 
-  pvecback=(double *)malloc(ba.bg_size*sizeof(double));
-
-  //call to fill pvecback
-  background_at_tau(&ba,tau,ba.long_info,ba.inter_normal, &index, pvecback);
-
-
-  double H_z=pvecback[ba.index_bg_H];
-  double D_ang=pvecback[ba.index_bg_ang_distance];
+  std::vector<double> D_ang;
+  get_Da(std::vector<double>(1,z),D_ang);
 #ifdef DBUG
-  cout << "H_z= "<< H_z <<endl;
-  cout << "D_ang= "<< D_ang <<endl;
+  cout << "D_ang= "<< D_ang[0] <<endl;
 #endif
-  return D_ang;
+  return D_ang[0];
 }
@@ -25,6 +25,7 @@
 #include<vector>
 #include<utility>
 #include<ostream>
+#include<memory>
 
 using std::string;
 
@@ -50,6 +51,10 @@ public:
   pars.push_back(make_pair(key,str(val)));
   return pars.size();
   }
+
+  //directory (which must exist) where the perturbation sources and the spherical Bessel functions
+  //are cached between models (see 'perturbations_cache' and 'bessel_cache' in explanatory.ini)
+  inline unsigned setCacheDirectory(const string& dir){add("perturbations_cache",dir); return add("bessel_cache",dir);}
   
   //accesors
   inline unsigned size() const {return pars.size();}
@@ -61,6 +66,49 @@ private:
   std::vector<std::pair<string,string> > pars;
 };
 
+//////////////////////////////////////////////////////////////////////////
+//CLASS structures of one model. The modules computed in them are recorded,
+//and freed (in reverse order of computation) by the destructor. Not copyable:
+//a ClassEngine owns its structures through a unique_ptr, and can be moved.
+class ClassStructures{
+public:
+  //modules, in the order in which they are computed (as in main.c)
+  enum module {BACKGROUND=0,THERMODYNAMICS,PERTURB,PRIMORDIAL,NONLINEAR,TRANSFER,SPECTRA,LENSING,NMODULES};
+
+  ClassStructures();
+  ~ClassStructures();
+  ClassStructures(const ClassStructures&)=delete;
+  ClassStructures& operator=(const ClassStructures&)=delete;
+
+  //run the _init function of module m (whose dependencies must be computed):
+  //_FAILURE_ returned if CLASS pb, with the message in errmsg
+  int initModule(module m,ErrorMsg errmsg);
+  //free module m if it is computed
+  int freeModule(module m);
+  //free all computed modules from m on
+  int freeModulesFrom(module m);
+
+  inline bool isComputed(module m) const {return computed[m];}
+  //bytes kept on the heap by the structure of module m (0 if not computed),
+  //after the tables freed by the low_memory profile
+  size_t memorySize(module m) const;
+
+  struct file_content fc;
+  struct precision pr;        /* for precision parameters */
+  struct background ba;       /* for cosmological background */
+  struct thermo th;           /* for thermodynamics */
+  struct perturbs pt;         /* for source functions */
+  struct transfers tr;        /* for transfer functions */
+  struct primordial pm;       /* for primordial spectra */
+  struct spectra sp;          /* for output spectra */
+  struct nonlinear nl;        /* for non-linear spectra */
+  struct lensing le;          /* for lensed spectra */
+  struct output op;           /* for output files */
+
+private:
+  bool computed[NMODULES];
+};
+
 ///////////////////////////////////////////////////////////////////////////
 class ClassEngine : public Engine
 {
@@ -72,12 +120,19 @@ public:
   ClassEngine(const ClassParams& pars);
   //with a class .pre file
   ClassEngine(const ClassParams& pars,const string & precision_file);
-  
+
+  //the CLASS structures are owned by a single engine
+  ClassEngine(const ClassEngine&)=delete;
+  ClassEngine& operator=(const ClassEngine&)=delete;
+  ClassEngine(ClassEngine&&)=default;
+  ClassEngine& operator=(ClassEngine&&)=default;
 
   // destructor
   ~ClassEngine();
 
   //modfiers: _FAILURE_ returned if CLASS pb:
+  //only the modules reading the parameters which changed since the previous
+  //call (and the modules depending on them) are computed again
   bool updateParValues(const std::vector<double>& par);
 
 
@@ -85,7 +140,7 @@ public:
   //don't call if FAILURE returned previously
   //throws std::execption if pb
 
-  double getCl(Engine::cltype t,const long &l);  
+  double getCl(Engine::cltype t,const long &l) const;
   void getCls(const std::vector<unsigned>& lVec, //input 
 	      std::vector<double>& cltt, 
 	      std::vector<double>& clte, 
@@ -99,8 +154,8 @@ public:
 	      std::vector<double>& clephi);
 
  //for BAO
-  inline double z_drag() const {return th.z_d;}
-  inline double rs_drag() const {return th.rs_d;} 
+  inline double z_drag() const {return _s->th.z_d;}
+  inline double rs_drag() const {return _s->th.rs_d;} 
   double get_Dv(double z);
 
   double get_Da(double z);
@@ -111,11 +166,50 @@ public:
   double get_Hz(double z);
   double get_Az(double z);
 
-  double getTauReio() const {return th.tau_reio;}
+  double getTauReio() const {return _s->th.tau_reio;}
+
+  //batched queries: const, and thread-safe on a computed engine (several
+  //threads can query the same results). The values are written in buffers
+  //given by the caller; throw std::exception if pb.
+
+  //C_l of the given types for all l in [lmin,lmax], in the units of getCl():
+  //out[(l-lmin)*types.size()+i] for types[i] ((lmax-lmin+1)*types.size() values)
+  void getCls(const std::vector<Engine::cltype>& types,long lmin,long lmax,double* out) const;
+
+  //at each redshift of z
+  void get_Hz(const std::vector<double>& z,std::vector<double>& Hz) const;
+  void get_Da(const std::vector<double>& z,std::vector<double>& Da) const;
+  void get_Dv(const std::vector<double>& z,std::vector<double>& Dv) const;
+  void get_f(const std::vector<double>& z,std::vector<double>& f) const;
+
+  //total matter power spectrum (linear or non-linear) in Mpc^3 for k in 1/Mpc:
+  //pk[iz*k.size()+ik] for z[iz] and k[ik]
+  void get_Pk(const std::vector<double>& k,const std::vector<double>& z,std::vector<double>& pk,bool nonlinear=false) const;
+
+  //profile of the module initializations and of the hot functions (see
+  //class_profile_get() in common.h): only filled if CLASS was compiled with
+  //-DCLASS_PROFILE, and process-wide, i.e. summed over all the engines since
+  //the last resetProfile(). One entry per function called at least once.
+  struct ProfileEntry{
+    string name;
+    long calls;
+    double time;                     //inclusive time (s), summed over threads
+    std::vector<double> threadTime;  //time spent by each thread
+  };
+  static bool profileEnabled() {return class_profile_is_enabled()==_TRUE_;}
+  static std::vector<ProfileEntry> getProfile();
+  static void resetProfile() {class_profile_reset();}
+
+  //memory kept by the structure of each module of this engine (see
+  //ClassStructures::memorySize()), and current and peak resident set size of
+  //the whole process, in bytes. With 'low_memory = yes', the tables of each
+  //module are freed as soon as the following modules have used them.
+  inline size_t memorySize(ClassStructures::module m) const {return _s->memorySize(m);}
+  static void residentMemory(size_t& rss,size_t& peak_rss) {class_memory_rss(&rss,&peak_rss);}
 
   //may need that
-  inline int numCls() const {return sp.ct_size;};
-  inline double Tcmb() const {return ba.T_cmb;}
+  inline int numCls() const {return _s->sp.ct_size;};
+  inline double Tcmb() const {return _s->ba.T_cmb;}
 
   inline int l_max_scalars() const {return _lmax;}
 
@@ -124,43 +218,22 @@ public:
 
 private:
   //structures class en commun
-  struct file_content fc;
-  struct precision pr;        /* for precision parameters */
-  struct background ba;       /* for cosmological background */
-  struct thermo th;           /* for thermodynamics */
-  struct perturbs pt;         /* for source functions */
-  struct transfers tr;        /* for transfer functions */
-  struct primordial pm;       /* for primordial spectra */
-  struct spectra sp;          /* for output spectra */
-  struct nonlinear nl;        /* for non-linear spectra */
-  struct lensing le;          /* for lensed spectra */
-  struct output op;           /* for output files */
+  std::unique_ptr<ClassStructures> _s;
 
   ErrorMsg _errmsg;            /* for error messages */
-  double * cl;
 
-  //helpers
-  bool dofree;
-  int freeStructs();
+  //index of a C_l type in the spectra, and factor converting it to the units of getCl()
+  void clIndex(Engine::cltype t,int& index,double& factor) const;
+  //background quantities at each redshift of z: table[iz*bg_size+index_bg]
+  void backgroundAtZ(const std::vector<double>& z,std::vector<double>& table) const;
 
-  //call once /model
+  //compute the modules which are not computed yet
   int computeCls();
 
-  int class_main(
-		 struct file_content *pfc,
-		 struct precision * ppr,
-		 struct background * pba,
-		 struct thermo * pth,
-		 struct perturbs * ppt,
-		 struct transfers * ptr,
-		 struct primordial * ppm,
-		 struct spectra * psp,
-		 struct nonlinear * pnl,
-		 struct lensing * ple,
-		 struct output * pop,
-		 ErrorMsg errmsg);
   //parnames
   std::vector<std::string> parNames;
+  //values of the parameters for which the modules were computed
+  std::vector<std::string> parValues;
 
 protected:
  
@@ -170,4 +243,3 @@ protected:
 
 ;
 #endif
-
@@ -0,0 +1,129 @@
+//--------------------------------------------------------------------------
+//
+// Description:
+// 	class EnginePool : see header file (EnginePool.hh) for description.
+//
+//------------------------------------------------------------------------
+//-----------------------
+// This Class's Header --
+//-----------------------
+#include "EnginePool.hh"
+//--------------------
+// C++
+//--------------------
+#include<exception>
+
+using namespace std;
+
+//---------------
+// Constructors --
+//----------------
+EnginePool::EnginePool(const ClassParams& pars,const std::vector<int>& threads):
+  _threads(threads),_engines(threads.size()),_stop(false){
+  start(pars,0);
+}
+
+EnginePool::EnginePool(const ClassParams& pars,const std::vector<int>& threads,const string & precision_file):
+  _threads(threads),_engines(threads.size()),_stop(false){
+  start(pars,&precision_file);
+}
+
+//--------------
+// Destructor --
+//--------------
+EnginePool::~EnginePool()
+{
+  stop();
+}
+
+//-----------------
+// Member functions --
+//-----------------
+void EnginePool::start(const ClassParams& pars,const string* precision_file){
+
+  if (_threads.empty()) throw invalid_argument("EnginePool needs at least one engine");
+
+  //the engines are created (and their first model computed) concurrently, in
+  //their own threads
+  std::vector<std::promise<void> > ready(_threads.size());
+  for (size_t i=0;i<_threads.size();i++)
+    _workers.push_back(std::thread(&EnginePool::work,this,i,std::cref(pars),precision_file,&ready[i]));
+
+  std::exception_ptr error;
+  for (size_t i=0;i<_threads.size();i++){
+    try{
+      ready[i].get_future().get();
+    }
+    catch(...){
+      if (!error) error=std::current_exception();
+    }
+  }
+  if (error) {
+    stop();
+    std::rethrow_exception(error);
+  }
+}
+
+void EnginePool::work(size_t i,const ClassParams& pars,const string* precision_file,std::promise<void>* ready){
+
+#ifdef _OPENMP
+  //number of threads of the parallel regions started from this thread
+  if (_threads[i]>0) omp_set_num_threads(_threads[i]);
+#endif
+
+  try{
+    if (precision_file)
+      _engines[i].reset(new ClassEngine(pars,*precision_file));
+    else
+      _engines[i].reset(new ClassEngine(pars));
+  }
+  catch(...){
+    ready->set_exception(std::current_exception());
+    return;
+  }
+  ready->set_value();
+
+  for (;;){
+    std::function<void(ClassEngine&)> task;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _cv.wait(lock,[this](){return _stop || !_queue.empty();});
+      if (_queue.empty()) return;
+      task=std::move(_queue.front());
+      _queue.pop_front();
+    }
+    task(*_engines[i]);
+  }
+}
+
+void EnginePool::push(const std::function<void(ClassEngine&)>& task){
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_stop) throw runtime_error("EnginePool is stopped");
+    _queue.push_back(task);
+  }
+  _cv.notify_one();
+}
+
+void EnginePool::stop(){
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop=true;
+  }
+  _cv.notify_all();
+  for (size_t i=0;i<_workers.size();i++)
+    if (_workers[i].joinable()) _workers[i].join();
+  _workers.clear();
+  _engines.clear();
+}
+
+std::future<std::vector<double> >
+EnginePool::submitCls(const std::vector<double>& par,
+		      const std::vector<Engine::cltype>& types,
+		      long lmin,long lmax){
+  return submit(par,[types,lmin,lmax](ClassEngine& engine){
+      std::vector<double> cls((lmax-lmin+1)*types.size());
+      engine.getCls(types,lmin,lmax,&cls[0]);
+      return cls;
+    });
+}
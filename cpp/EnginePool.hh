@@ -0,0 +1,96 @@
+//--------------------------------------------------------------------------
+//
+// Description:
+// 	class EnginePool :
+// several ClassEngine computing concurrently, each with its own number of
+// OpenMP threads, fed from a queue of parameter vectors
+//
+//------------------------------------------------------------------------
+
+#ifndef EnginePool_hh
+#define EnginePool_hh
+
+#include"ClassEngine.hh"
+
+//STD
+#include<string>
+#include<vector>
+#include<deque>
+#include<memory>
+#include<functional>
+#include<future>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<stdexcept>
+
+///////////////////////////////////////////////////////////////////////////
+//Each engine lives in its own thread, which sets the number of OpenMP
+//threads used by all the parallel regions of CLASS (omp_set_num_threads()
+//applies to the regions started from the calling thread only). Beyond
+//about 16 threads, the parallel loops of the perturbation, transfer and
+//spectra modules scale poorly: several engines with fewer threads each
+//give a better throughput. Each engine keeps the modules which do not
+//depend on the parameters changed since its previous model (see
+//ClassEngine::updateParValues).
+class EnginePool
+{
+
+public:
+  //one engine per entry of threads, computing with threads[i] OpenMP threads
+  //(all available threads if threads[i]<=0), all starting from pars
+  //(the submitted parameter vectors give the values of the first parameters
+  //of pars). Throws std::exception if an engine cannot be created.
+  EnginePool(const ClassParams& pars,const std::vector<int>& threads);
+  //with a class .pre file
+  EnginePool(const ClassParams& pars,const std::vector<int>& threads,const string & precision_file);
+
+  //the models still in the queue are computed before the engines are destroyed
+  ~EnginePool();
+
+  EnginePool(const EnginePool&)=delete;
+  EnginePool& operator=(const EnginePool&)=delete;
+
+  //queue a parameter vector: the first free engine computes it, then calls
+  //f(engine) and sets the future to its result. The future holds a
+  //std::runtime_error if CLASS fails for these parameters, or the exception
+  //thrown by f.
+  template<typename F>
+  std::future<typename std::result_of<F(ClassEngine&)>::type> submit(const std::vector<double>& par,F f){
+    typedef typename std::result_of<F(ClassEngine&)>::type R;
+    std::shared_ptr<std::packaged_task<R(ClassEngine&)> > task(new std::packaged_task<R(ClassEngine&)>(
+      [par,f](ClassEngine& engine) -> R {
+	if (!engine.updateParValues(par)) throw std::runtime_error("CLASS failed for these parameters");
+	return f(engine);
+      }));
+    std::future<R> result=task->get_future();
+    push([task](ClassEngine& engine){(*task)(engine);});
+    return result;
+  }
+
+  //the C_l of the given types for l in [lmin,lmax] (see ClassEngine::getCls)
+  std::future<std::vector<double> > submitCls(const std::vector<double>& par,
+					      const std::vector<Engine::cltype>& types,
+					      long lmin,long lmax);
+
+  inline size_t size() const {return _engines.size();}
+  inline int threads(size_t i) const {return _threads[i];}
+
+private:
+  void start(const ClassParams& pars,const string* precision_file);
+  void push(const std::function<void(ClassEngine&)>& task);
+  //thread of engine i
+  void work(size_t i,const ClassParams& pars,const string* precision_file,std::promise<void>* ready);
+  void stop();
+
+  std::vector<int> _threads;
+  std::vector<std::unique_ptr<ClassEngine> > _engines;
+  std::vector<std::thread> _workers;
+
+  std::deque<std::function<void(ClassEngine&)> > _queue;
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  bool _stop;
+};
+
+#endif
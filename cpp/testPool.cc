@@ -0,0 +1,65 @@
+
+//KLASS
+#include"EnginePool.hh"
+
+#include <iostream>
+#include<string>
+#include <stdexcept>
+#include <cstdlib>
+
+using namespace std;
+
+
+// example run: ./testPool [number of engines] [threads per engine] [number of models]
+// computes models around a fiducial one with a pool of engines, and prints
+// the TT spectrum at a few multipoles and the total time
+int main(int argc,char** argv){
+
+  size_t n_engines=(argc>1) ? atoi(argv[1]) : 2;
+  int n_threads=(argc>2) ? atoi(argv[2]) : 1;
+  int n_models=(argc>3) ? atoi(argv[3]) : 8;
+
+  const int l_max_scalars=1200;
+
+  //CLASS config: the parameter vectors give the first two parameters
+  ClassParams pars;
+  pars.add("omega_b",0.0220);
+  pars.add("A_s",2.42e-9);
+  pars.add("omega_cdm",0.1116);
+  pars.add("n_s",.96);
+  pars.add("tau_reio",0.09);
+  pars.add("output","tCl,pCl,lCl"); //pol +clphi
+  pars.add("l_max_scalars",l_max_scalars);
+  pars.add("lensing",true); //note boolean
+
+  try{
+    double start=omp_get_wtime();
+
+    EnginePool pool(pars,std::vector<int>(n_engines,n_threads));
+
+    //queue all models, then wait for the results
+    std::vector<Engine::cltype> types(1,Engine::TT);
+    std::vector<std::future<std::vector<double> > > results;
+    for (int i=0;i<n_models;i++){
+      std::vector<double> par;
+      par.push_back(0.0220*(1.+0.01*(i/2)));  //changes every other model: full computation
+      par.push_back(2.42e-9*(1.+0.02*i));     //only primordial and later modules
+      results.push_back(pool.submitCls(par,types,2,l_max_scalars));
+    }
+
+    cout.precision( 8 );
+    for (int i=0;i<n_models;i++){
+      std::vector<double> cltt=results[i].get();
+      cout << "model " << i << ": ClTT(l=10,200,1000)= " << cltt[8] << " " << cltt[198] << " " << cltt[998] << endl;
+    }
+
+    cout << n_models << " models with " << n_engines << " engine(s) of " << n_threads
+	 << " thread(s): " << omp_get_wtime()-start << " s" << endl;
+  }
+  catch (std::exception &e){
+    cout << "GIOSH" << e.what() << endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -392,12 +392,14 @@ void populateTS_2photon(double Trr[2][2], double *Trv[2], double *Tvr[2], double
    double R2p2s;
    unsigned b;
    double  RLya, Gammab, Pib, dbfact;
+   double  Trr00, Trr11, fact_3s3d, fact_4s4d;
 
-   double *Aup, *Adn;
+   /* Rates between virtual states: only the diffusion region is filled, all other bins must vanish.
+      They live on the stack since this function is called at every time step. */
+   double Aup[NVIRT], Adn[NVIRT];
    double A2p_up, A2p_dn;
 
-   Aup = create_1D_array(NVIRT);
-   Adn = create_1D_array(NVIRT);
+   for (b = 0; b < NVIRT; b++) Aup[b] = Adn[b] = 0.;
 
    RLya = 4.662899067555897e15 *H /nH/(1.-xe);   /*8 PI H/(3 nH x1s lambda_Lya^3) */
 
@@ -430,17 +432,32 @@ void populateTS_2photon(double Trr[2][2], double *Trv[2], double *Tvr[2], double
 
    /***** Two-photon transitions: populating Trv, Tvr and updating Trr ******/
 
+   /* The Boltzmann factors of the 3s,3d and 4s,4d levels do not depend on the bin, and dbfact
+      serves twice per bin; the diagonal elements are accumulated in local variables, so that this
+      loop carries no dependency through memory and can be vectorized by the compiler. */
+
+   fact_3s3d = exp(-E32/TR)/3.;
+   fact_4s4d = exp(-E42/TR)/3.;
+   Trr00 = Trr[0][0];
+   Trr11 = Trr[1][1];
+
    for (b = 0; b < NVIRT; b++) {
        dbfact = exp((twog->Eb_tab[b] - E21)/TR);
 
-       Trr[0][0] -= Tvr[0][b] = -twog->A2s_tab[b]/fabs(exp((twog->Eb_tab[b] - E21)/TR)-1.);
-       Trv[0][b]  = Tvr[0][b] *dbfact;
+       Tvr[0][b] = -twog->A2s_tab[b]/fabs(dbfact-1.);
+       Trv[0][b] = Tvr[0][b] *dbfact;
 
-       Trr[1][1] -= Tvr[1][b] = -exp(-E32/TR)/3. * twog->A3s3d_tab[b]/fabs(exp((twog->Eb_tab[b] - E31)/TR)-1.)
-                                -exp(-E42/TR)/3. * twog->A4s4d_tab[b]/fabs(exp((twog->Eb_tab[b] - E41)/TR)-1.);
+       Tvr[1][b] = -fact_3s3d * twog->A3s3d_tab[b]/fabs(exp((twog->Eb_tab[b] - E31)/TR)-1.)
+                   -fact_4s4d * twog->A4s4d_tab[b]/fabs(exp((twog->Eb_tab[b] - E41)/TR)-1.);
        Trv[1][b] = Tvr[1][b] *3.*dbfact;
+
+       Trr00 -= Tvr[0][b];
+       Trr11 -= Tvr[1][b];
    }
 
+   Trr[0][0] = Trr00;
+   Trr[1][1] = Trr11;
+
     /****** Tvv and sv. Accounting for DIFFUSION ******/
 
     populate_Diffusion(Aup, Adn, &A2p_up, &A2p_dn, TM, twog->Eb_tab, twog->A1s_tab);
@@ -453,6 +470,9 @@ void populateTS_2photon(double Trr[2][2], double *Trv[2], double *Tvr[2], double
 
       Gammab = -(Trv[0][b] + Trv[1][b]) + Aup[b] + Adn[b];    /* Inverse lifetime of virtual state b */
 
+      /* no coupling to neighboring bins outside of the diffusion region */
+      Tvv[1][b] = Tvv[2][b] = 0.;
+
       /*** Diffusion region ***/
       if (  (b >= NSUBLYA - NDIFF/2 && b < NSUBLYA - 1)
           ||(b > NSUBLYA && b < NSUBLYA + NDIFF/2)) {
@@ -487,9 +507,6 @@ void populateTS_2photon(double Trr[2][2], double *Trv[2], double *Tvr[2], double
           sv[b] = (1.-xe) * fplus[b];
        }
    }
-
-    free(Aup);
-    free(Adn);
 }
 
 /*********************************************************************
@@ -523,6 +540,32 @@ void solveTXeqB(double *diag, double *updiag, double *dndiag,
      free(gamma);
 }
 
+/*********************************************************************
+Same as solveTXeqB, for nrhs right-hand sides B[k] at once: the
+forward elimination of T is done once and applied to all of them.
+The solutions are obtained in place in X[k]. N must not exceed NVIRT.
+**********************************************************************/
+
+void solveTXeqB_multi(double *diag, double *updiag, double *dndiag,
+                      double **X, double **B, unsigned nrhs, unsigned N){
+     int i;
+     unsigned k;
+     double denom;
+     double alpha[NVIRT];   /* X[k][i] = gamma[k][i] - alpha[i] * X[k][i+1], gamma[k] stored in X[k] */
+
+     alpha[0] = updiag[0] / diag[0];
+     for (k = 0; k < nrhs; k++) X[k][0] = B[k][0] / diag[0];
+
+     for (i = 1; i < N; i++) {
+         denom = diag[i] - dndiag[i] * alpha[i-1];
+         alpha[i] = updiag[i] / denom;
+         for (k = 0; k < nrhs; k++) X[k][i] = (B[k][i] - dndiag[i] * X[k][i-1]) / denom;
+     }
+
+     for (i = N-2; i >= 0; i--)
+         for (k = 0; k < nrhs; k++) X[k][i] -= alpha[i] * X[k][i+1];
+}
+
 /**************************************************************************************************************
 Solves for the populations of the real (2s, 2p) and virtual states
 ***************************************************************************************************************/
@@ -530,8 +573,9 @@ Solves for the populations of the real (2s, 2p) and virtual states
 void solve_real_virt(double xr[2], double xv[NVIRT], double Trr[2][2], double *Trv[2], double *Tvr[2],
                      double *Tvv[3], double sr[2], double sv[NVIRT]){
 
-   double *Tvv_inv_Tvr[2];
-   double *Tvv_inv_sv;
+   double Tvv_inv_Tvr[2][NVIRT];
+   double Tvv_inv_sv[NVIRT];
+   double *X[3], *B[3];
    double Trr_new[2][2];
    double sr_new[2];
    unsigned i, j, b;
@@ -540,34 +584,37 @@ void solve_real_virt(double xr[2], double xv[NVIRT], double Trr[2][2], double *T
    unsigned NSUBDIFF;
    NSUBDIFF = NSUBLYA - NDIFF/2;     /* lowest bin of the diffusion region */
 
-   /** Allocate memory **/
-   for (i = 0; i < 2; i++) Tvv_inv_Tvr[i] = create_1D_array(NVIRT);
-   Tvv_inv_sv = create_1D_array(NVIRT);
-
+   /*** Computing Tvv^{-1}.Tvr and Tvv^{-1}.sv ***/
 
-   /*** Computing Tvv^{-1}.Tvr ***/
-
-   for (i = 0; i < 2; i++) {
-      for (b = 0; b < NSUBDIFF; b++)               Tvv_inv_Tvr[i][b] = Tvr[i][b]/Tvv[0][b];
-      for (b = NSUBLYA + NDIFF/2; b < NVIRT; b++)  Tvv_inv_Tvr[i][b] = Tvr[i][b]/Tvv[0][b];
-      solveTXeqB(Tvv[0]+NSUBDIFF, Tvv[2]+NSUBDIFF, Tvv[1]+NSUBDIFF, Tvv_inv_Tvr[i]+NSUBDIFF, Tvr[i]+NSUBDIFF, NDIFF);
+   /* Outside of the diffusion region Tvv is diagonal */
+   for (b = 0; b < NSUBDIFF; b++) {
+      Tvv_inv_Tvr[0][b] = Tvr[0][b]/Tvv[0][b];
+      Tvv_inv_Tvr[1][b] = Tvr[1][b]/Tvv[0][b];
+      Tvv_inv_sv[b]     = sv[b]/Tvv[0][b];
    }
-
-   /*** Trr_new = Trr - Trv.Tvv^{-1}.Tvr ***/
-   for (i = 0; i < 2; i++) for (j = 0; j < 2; j++) {
-          Trr_new[i][j] = Trr[i][j];
-          for (b = 0; b < NVIRT; b++) Trr_new[i][j] -= Trv[i][b]*Tvv_inv_Tvr[j][b];
+   for (b = NSUBLYA + NDIFF/2; b < NVIRT; b++) {
+      Tvv_inv_Tvr[0][b] = Tvr[0][b]/Tvv[0][b];
+      Tvv_inv_Tvr[1][b] = Tvr[1][b]/Tvv[0][b];
+      Tvv_inv_sv[b]     = sv[b]/Tvv[0][b];
    }
 
-   /*** Computing Tvv^{-1}.sv ***/
-   for (b = 0; b < NSUBDIFF; b++)               Tvv_inv_sv[b] = sv[b]/Tvv[0][b];
-   for (b = NSUBLYA + NDIFF/2; b < NVIRT; b++)  Tvv_inv_sv[b] = sv[b]/Tvv[0][b];
-   solveTXeqB(Tvv[0]+NSUBDIFF, Tvv[2]+NSUBDIFF, Tvv[1]+NSUBDIFF, Tvv_inv_sv+NSUBDIFF, sv+NSUBDIFF, NDIFF);
+   /* In the diffusion region, the three tridiagonal systems share the same matrix */
+   X[0] = Tvv_inv_Tvr[0]+NSUBDIFF;  B[0] = Tvr[0]+NSUBDIFF;
+   X[1] = Tvv_inv_Tvr[1]+NSUBDIFF;  B[1] = Tvr[1]+NSUBDIFF;
+   X[2] = Tvv_inv_sv+NSUBDIFF;      B[2] = sv+NSUBDIFF;
+   solveTXeqB_multi(Tvv[0]+NSUBDIFF, Tvv[2]+NSUBDIFF, Tvv[1]+NSUBDIFF, X, B, 3, NDIFF);
 
-   /*** sr_new = sr - Trv.Tvv^{-1}sv ***/
+   /*** Trr_new = Trr - Trv.Tvv^{-1}.Tvr and sr_new = sr - Trv.Tvv^{-1}sv, in a single pass ***/
    for (i = 0; i < 2; i++) {
+      for (j = 0; j < 2; j++) Trr_new[i][j] = Trr[i][j];
       sr_new[i] = sr[i];
-      for (b = 0; b < NVIRT; b++) sr_new[i] -= Trv[i][b]*Tvv_inv_sv[b];
+   }
+   for (b = 0; b < NVIRT; b++) {
+      for (i = 0; i < 2; i++) {
+         Trr_new[i][0] -= Trv[i][b]*Tvv_inv_Tvr[0][b];
+         Trr_new[i][1] -= Trv[i][b]*Tvv_inv_Tvr[1][b];
+         sr_new[i]     -= Trv[i][b]*Tvv_inv_sv[b];
+      }
    }
 
    /*** Solve 2 by 2 system Trr_new.xr = sr_new ***/
@@ -578,12 +625,6 @@ void solve_real_virt(double xr[2], double xv[NVIRT], double Trr[2][2], double *T
    /*** xv = Tvv^{-1}(sv - Tvr.xr) ***/
    for (b = 0; b < NVIRT; b++) xv[b] = Tvv_inv_sv[b] - Tvv_inv_Tvr[0][b]*xr[0] - Tvv_inv_Tvr[1][b]*xr[1];
 
-
-   /** Free memory **/
-   for (i = 0; i < 2; i++) free(Tvv_inv_Tvr[i]);
-   free(Tvv_inv_sv);
-
-
 }
 
 /*************************************************************************************************************
@@ -662,7 +703,7 @@ double rec_HMLA_2photon_dxedlna(double xe, double nH, double H, double TM, doubl
 
    double xr[2];
    double xv[NVIRT];
-   double xedot, Pib, feq;
+   double xedot, Pib, feq, expDtau;
    double fplus[NVIRT], fplus_Ly[3];
    unsigned b, i;
 
@@ -671,6 +712,7 @@ double rec_HMLA_2photon_dxedlna(double xe, double nH, double H, double TM, doubl
    double *Trv[2];
    double *Tvr[2];
    double *Tvv[3];
+   double Trv_data[2][NVIRT], Tvr_data[2][NVIRT], Tvv_data[3][NVIRT];   /* called at every time step: no heap allocation */
    double sr[2];
    double sv[NVIRT];
    double Dtau[NVIRT];
@@ -682,9 +724,9 @@ double rec_HMLA_2photon_dxedlna(double xe, double nH, double H, double TM, doubl
 
    double chi_ion_H;
 
-   for (i = 0; i < 2; i++) Trv[i] = create_1D_array(NVIRT);
-   for (i = 0; i < 2; i++) Tvr[i] = create_1D_array(NVIRT);
-   for (i = 0; i < 3; i++) Tvv[i] = create_1D_array(NVIRT);
+   for (i = 0; i < 2; i++) Trv[i] = Trv_data[i];
+   for (i = 0; i < 2; i++) Tvr[i] = Tvr_data[i];
+   for (i = 0; i < 3; i++) Tvv[i] = Tvv_data[i];
 
    /* Redshift photon occupation number from previous times and higher energy bins */
    fplus_from_fminus(fplus, fplus_Ly, logfminus_hist, logfminus_Ly_hist, TR,
@@ -728,14 +770,15 @@ double rec_HMLA_2photon_dxedlna(double xe, double nH, double H, double TM, doubl
 
    for (b = 0; b < NVIRT; b++) {
      if (Dtau[b] != 0) {
-         Pib = (1.-exp(-Dtau[b]))/Dtau[b];
+         expDtau = exp(-Dtau[b]);
+         Pib = (1.-expDtau)/Dtau[b];
          feq  = -xr[0]*Tvr[0][b] - xr[1]*Tvr[1][b];
          feq -= (b == 0       ?  xv[1]*Tvv[2][0]:
                    b == NVIRT-1 ?  xv[NVIRT-2]*Tvv[1][NVIRT-1]:
                    xv[b+1]*Tvv[2][b] + xv[b-1]*Tvv[1][b]);
          feq /= (1.-xe)*(1.-Pib)*Tvv[0][b];
 
-         logfminus_hist[b][iz] = log(fplus[b] + (feq - fplus[b])*(1.-exp(-Dtau[b])));
+         logfminus_hist[b][iz] = log(fplus[b] + (feq - fplus[b])*(1.-expDtau));
      }
      else logfminus_hist[b][iz] = log(fplus[b]);
    }
@@ -746,10 +789,6 @@ double rec_HMLA_2photon_dxedlna(double xe, double nH, double H, double TM, doubl
    logfminus_Ly_hist[2][iz] = log(xr[0]/(1.-xe)) - E42/TR;
 
 
-   for (i = 0; i < 2; i++) free(Trv[i]);
-   for (i = 0; i < 2; i++) free(Tvr[i]);
-   for (i = 0; i < 3; i++) free(Tvv[i]);
-
    return xedot/H;
 }
 
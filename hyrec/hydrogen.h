@@ -100,6 +100,7 @@ void populateTS_2photon(double Trr[2][2], double *Trv[2], double *Tvr[2], double
                         TWO_PHOTON_PARAMS *twog, double fplus[NVIRT], double fplus_Ly[], 
                         double Alpha[], double Beta[], double z);
 void solveTXeqB(double *diag, double *updiag, double *dndiag, double *X, double *B, unsigned N);
+void solveTXeqB_multi(double *diag, double *updiag, double *dndiag, double **X, double **B, unsigned nrhs, unsigned N);
 void solve_real_virt(double xr[2], double xv[NVIRT], double Trr[2][2], double *Trv[2], double *Tvr[2], 
                      double *Tvv[3], double sr[2], double sv[NVIRT]);
 void fplus_from_fminus(double fplus[NVIRT], double fplus_Ly[], double **logfminus_hist, double *logfminus_Ly_hist[], 
@@ -6,9 +6,11 @@
 #define __ARRAYS__
 
 #include "common.h"
+#include "parallel_timing.h"
 
 #define _SPLINE_NATURAL_ 0 /**< natural spline: ddy0=ddyn=0 */
 #define _SPLINE_EST_DERIV_ 1 /**< spline with estimation of first derivative on both edges */
+#define _SPLINE_TABLE_PARALLEL_SIZE_ 100000 /**< minimum number of elements of a table above which array_spline_table_lines() splits the columns between threads */
 
 /**
  * Boilerplate for C++
@@ -125,6 +127,18 @@ extern "C" {
 		       ErrorMsg errmsg
 		       );
 
+  int array_spline_table_lines_block(
+		       double * x,
+		       int x_size,
+		       double * y_array,
+		       int y_size,
+		       double * ddy_array,
+		       double * u,
+		       short spline_mode,
+		       int y_min,
+		       int y_max
+		       );
+
   int array_logspline_table_lines(
 				  double * x,
 				  int x_size,
@@ -242,6 +256,19 @@ int array_integrate_all_trapzd_or_spline(
 			       int result_size, /** from 1 to n_columns */
 			       ErrorMsg errmsg);
 
+  int array_interpolate_spline_columns(
+				       double * __restrict__ x_array,
+				       int n_lines,
+				       double * __restrict__ array,
+				       double * __restrict__ array_splined,
+				       int n_columns,
+				       double x,
+				       int * __restrict__ last_index,
+				       int * __restrict__ columns,
+				       int column_size,
+				       double * __restrict__ result,
+				       ErrorMsg errmsg);
+
   int array_search_bisect(
                        int n_lines,
                        double * __restrict__ array,
@@ -249,6 +276,25 @@ int array_integrate_all_trapzd_or_spline(
                        int * __restrict__ last_index,
                        ErrorMsg errmsg);
 
+  int array_search_hunt(
+                        int n_lines,
+                        double * __restrict__ array,
+                        double c,
+                        int * __restrict__ last_index,
+                        ErrorMsg errmsg);
+
+  int array_interpolate_spline_hunt(
+                                    double * __restrict__ x_array,
+                                    int n_lines,
+                                    double * __restrict__ array,
+                                    double * __restrict__ array_splined,
+                                    int n_columns,
+                                    double x,
+                                    int * __restrict__ last_index,
+                                    double * __restrict__ result,
+                                    int result_size, /** from 1 to n_columns */
+                                    ErrorMsg errmsg);
+
   int array_interpolate_linear(
 			       double * x_array,
 			       int n_lines,
@@ -428,6 +474,12 @@ int array_integrate_all_trapzd_or_spline(
                                 double * __restrict__ w_trapz,
                                 ErrorMsg errmsg);
 
+  int array_spline_weights(double * __restrict__ x,
+                           int n,
+                           int index_start_spline,
+                           double * __restrict__ w_spline,
+                           ErrorMsg errmsg);
+
   int array_trapezoidal_integral(double * __restrict__ integrand,
                                  int n,
                                  double * __restrict__ w_trapz,
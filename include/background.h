@@ -18,6 +18,30 @@ printf("-> %-30s Omega = %-15g , omega = %-15g\n",name,pba->Omega0_##type,pba->O
 
 enum spatial_curvature {flat,open,closed};
 
+/** list of possible methods for solving the long-range scalar field equation */
+
+enum lrs_phi_solver {lrs_phi_ridder,lrs_phi_newton};
+
+/** list of the functions of the longrange module instrumented when
+    compiling with -DLRS_COUNTERS (see lrs_counters_collect()) */
+
+enum lrs_counter_index {
+  lrs_counter_moments,              /**< background_lrs_moments() */
+  lrs_counter_phi_M,                /**< get_phi_M_lrs() */
+  lrs_counter_onset,                /**< instabilityOnset_lrs() */
+  lrs_counter_potential,            /**< potentialPrime(), i.e. the residual evaluations of the Ridder solver */
+  lrs_counter_potential_derivative, /**< potentialPrime_and_derivative(), i.e. the residual evaluations of the Newton solver */
+  lrs_counter_size
+};
+
+/** number of calls and time spent in the instrumented functions of the longrange module */
+
+struct lrs_counters {
+  short is_enabled;                 /**< _TRUE_ if the code was compiled with -DLRS_COUNTERS */
+  long int calls[lrs_counter_size]; /**< number of calls of each instrumented function */
+  double time[lrs_counter_size];    /**< time spent in each of them (s, including nested calls) */
+};
+
 /** list of possible parametrisations of the DE equation of state */
 
 enum equation_of_state {CLP,EDE};
@@ -89,6 +113,8 @@ struct background
   
   double Omega0_lrs; /**< \f$ \Omega_{0 lrs} \f$: scalar-sourced long-range interaction */
   double lrs_m_F_over_T0; /**< Ratio between vacuum fermion mass and its present-day temperature */
+  double lrs_T0_F; /**< Present-day fermion temperature (eV) */
+  double lrs_M_phi_sq; /**< Scalar vacuum mass squared in units of Mpc\f$^{-2}\f$ */
   
   double Omega0_ur; /**< \f$ \Omega_{0 \nu r} \f$: ultra-relativistic neutrinos */
 
@@ -149,6 +175,9 @@ struct background
   char * ncdm_psd_files;                /**< list of filenames for tabulated p-s-d */
   /* end of parameters for tabulated ncdm p-s-d */
 
+  FileName quadrature_cache_directory;  /**< if not empty, directory where the automatic q-samplings of ncdm and lrs
+                                             species are cached between runs (see get_qsampling_cached()) */
+
   //@}
 
   /** @name - related parameters */
@@ -214,6 +243,8 @@ struct background
   int index_bg_MTsq_over_Msq_lrs;    /**< for a long-range interaction, scalar thermal mass squared over its vacuum mass squared*/
   int index_bg_mT_over_T0_lrs;       /**< for a long-range interaction, effective fermion mass divided by its present temperature */
   int index_bg_lrs_a_over_aunstable; /**< scale factor over scale factor of long-range adiabatic instability onset*/
+  int index_bg_w_lrs_F;              /**< for a long-range interaction, equation of state p/rho of the fermions */
+  int index_bg_ca2_lrs_F;            /**< for a long-range interaction, adiabatic sound speed p'/rho' of the fermions (0 after nugget formation) */
 
   int index_bg_phi_scf;       /**< scalar field value */
   int index_bg_phi_prime_scf; /**< scalar field derivative wrt conformal time */
@@ -273,6 +304,22 @@ struct background
 
   //@}
 
+  /** @name - same tables resampled on uniform grids in \f$ \ln\tau \f$ and \f$ \ln(1+z) \f$, for lookups by index arithmetic */
+
+  //@{
+
+  short has_uniform_tables;  /**< _TRUE_ if the uniform tables below are allocated and used by background_at_tau() and background_tau_of_z() */
+  int bt_uniform_size;       /**< number of nodes in the uniform \f$ \ln\tau \f$ grid */
+  double lntau_uniform_min;  /**< \f$ \ln\tau \f$ at the first node */
+  double dlntau_uniform;     /**< spacing of the uniform \f$ \ln\tau \f$ grid */
+  double * background_uniform_table; /**< table background_uniform_table[index*2*pba->bg_size+pba->index_bg] with the values of all quantities, followed on the same row by background_uniform_table[index*2*pba->bg_size+pba->bg_size+pba->index_bg] with their derivatives \f$ d b_i / d\ln\tau \f$ times dlntau_uniform, for Hermite interpolation */
+  int zt_uniform_size;       /**< number of nodes in the uniform \f$ \ln(1+z) \f$ grid */
+  double lnz_uniform_min;    /**< \f$ \ln(1+z) \f$ at the first node */
+  double dlnz_uniform;       /**< spacing of the uniform \f$ \ln(1+z) \f$ grid */
+  double * tau_uniform_table; /**< table tau_uniform_table[2*index] with \f$ \tau \f$ and tau_uniform_table[2*index+1] with \f$ d\tau / d\ln(1+z) \f$ times dlnz_uniform */
+
+  //@}
+
 
   /** @name - all indices for the vector of background quantities to be integrated (=bi)
    *
@@ -370,6 +417,24 @@ struct background
   int q_size_lrs_bg;    /**< Size of the q_lrs_bg array */
   int q_size_lrs;    /**< Size of the q_lrs array */
   double factor_lrs; /**< Normalization factors for calculating energy density etc.*/
+  double lrs_compressed_error; /**< with the compressed perturbation sampling, largest relative error on rho, p, I_Mphi and their perturbations with respect to a fine reference sampling */
+
+  int lrs_phi_table_size;        /**< number of nodes of the phi_M(z) interpolation table (0 if the table is not used) */
+  double lrs_phi_table_lnz_max;  /**< upper edge of the table in ln(1+z) (the lower edge is ln(1+z)=0) */
+  double lrs_phi_table_step;     /**< uniform step of the table in ln(1+z) */
+  double * lrs_phi_table_lnphi;  /**< table of ln(-phi_M) on the uniform ln(1+z) grid */
+  double * lrs_phi_table_dd;     /**< second derivatives of ln(-phi_M) with respect to ln(1+z), for spline interpolation */
+
+  int lrs_phi_solver;           /**< method used for solving the scalar field equation (from precision structure) */
+  long int lrs_phi_solves;      /**< number of (non-analytic, non-tabulated) solutions of the scalar field equation */
+  long int lrs_phi_fevals;      /**< total number of residual evaluations for these solutions */
+
+  double lrs_a_unstable;              /**< scale factor over its present value at the onset of the adiabatic instability (_LRS_ALWAYS_STABLE_ if always stable) */
+  double lrs_mT_over_T0_unstable;     /**< with nuggets, effective fermion mass over its present temperature, frozen at instability onset */
+  double lrs_rho_unstable;            /**< with nuggets, total fermion+scalar energy density at instability onset */
+  double lrs_MTsq_over_Msq_unstable;  /**< with nuggets, scalar thermal mass squared over its vacuum mass squared at instability onset */
+
+  struct lrs_counters lrs_counters;   /**< calls of the longrange module functions up to the end of background_init() (with -DLRS_COUNTERS) */
 
   //@}
 
@@ -383,6 +448,12 @@ struct background
   short short_info;  /**< flag for calling background_at_eta and return little information */
   short normal_info; /**< flag for calling background_at_eta and return medium information */
   short long_info;   /**< flag for calling background_at_eta and return all information */
+  short derivs_info; /**< flag for calling background_functions from background_derivs and return only what the integration needs */
+
+  int bg_request_short;  /**< mask of optional computations (see enum background_request_flags) done by background_functions in short format */
+  int bg_request_normal; /**< same in normal format */
+  int bg_request_long;   /**< same in long format */
+  int bg_request_derivs; /**< same when called from background_derivs */
 
   short inter_normal;  /**< flag for calling background_at_eta and find position in interpolation table normally */
   short inter_closeby; /**< flag for calling background_at_eta and find position in interpolation table starting from previous position in previous call */
@@ -397,6 +468,10 @@ struct background
 
   ErrorMsg shooting_error; /**< Error message from shooting failed. */
 
+  struct background * shooting_previous; /**< during shooting, structure of the previous iteration, whose tables not depending on the unknown parameters can be reused (NULL otherwise). Set by input_init() and input_try_unknown_parameters(), not by input_default_params() */
+
+  size_t memory_size; /**< bytes kept on the heap by this structure at the end of background_init() (growth of class_memory_heap() during it) */
+
   short background_verbose; /**< flag regulating the amount of information sent to standard output (none if set to zero) */
 
   ErrorMsg error_message; /**< zone for writing error messages */
@@ -404,6 +479,20 @@ struct background
   //@}
 };
 
+/**
+ * optional computations of background_functions(), combined in the
+ * masks bg_request_short/normal/long/derivs set in background_indices().
+ * Densities, H and rho_tot are always computed; columns belonging to
+ * computations absent from the mask are left unchanged.
+ */
+
+enum background_request_flags {
+  bg_request_p        = 1<<0, /**< pressures, H', p_tot and Omega_r */
+  bg_request_p_prime  = 1<<1, /**< pseudo-pressures and p_tot_prime */
+  bg_request_lrs_pert = 1<<2, /**< lrs quantities only used by perturbations: thermal scalar mass, phi_M_prime, fluid coefficients (together with bg_request_p and bg_request_p_prime), and the associated consistency checks */
+  bg_request_long     = 1<<3  /**< rho_crit and Omega_m */
+};
+
 /**
  * temporary parameters and workspace passed to the background_derivs function
  */
@@ -459,12 +548,35 @@ extern "C" {
 			double * pvecback
 			);
 
+  int background_at_tau_columns(
+                                struct background *pba,
+                                double tau,
+                                int * columns,
+                                int column_size,
+                                double * pvecback
+                                );
+
   int background_tau_of_z(
                           struct background *pba,
                           double z,
                           double * tau
                           );
 
+  int background_uniform_table_init(
+                                    double * x_array,
+                                    int n_lines,
+                                    double * array,
+                                    double * array_splined,
+                                    int n_columns,
+                                    double x_offset,
+                                    double stepsize,
+                                    int * uniform_size,
+                                    double * lnx_min,
+                                    double * dlnx,
+                                    double ** uniform_table,
+                                    ErrorMsg error_message
+                                    );
+
   int background_functions(
 			   struct background *pba,
 			   double * pvecback_B,
@@ -517,6 +629,12 @@ extern "C" {
 			    struct background *pba
 			    );
 
+  int background_ncdm_init_species(
+                                   struct precision *ppr,
+                                   struct background *pba,
+                                   int k,
+                                   int filenum
+                                   );
 
   int background_ncdm_momenta(
                              double * qvec,
@@ -17,6 +17,7 @@
 #include "arrays.h"
 #include "dei_rkck.h"
 #include "parser.h"
+#include "parallel_timing.h"
 
 /* class modules */
 #include "common.h"
@@ -78,6 +78,7 @@ typedef char FileName[_FILENAMESIZE_];
 void class_protect_sprintf(char* dest, char* tpl,...);
 void class_protect_fprintf(FILE* dest, char* tpl,...);
 void* class_protect_memcpy(void* dest, void* from, size_t sz);
+void class_temporary_file_name(char * filename, char * tmpname);
 
 int get_number_of_titles(char * titlestring);
 
@@ -124,6 +125,21 @@ int get_number_of_titles(char * titlestring);
   }                                                                                                              \
 }
 
+/* same when several threads or tasks may fail at once: error_message_output is written by the first of them only, in a critical section */
+#define class_call_critical(function, error_message_from_function, error_message_output) {                       \
+  if (abort == _FALSE_) {                                                                                        \
+    if (function == _FAILURE_) {                                                                                 \
+      _Pragma("omp critical")                                                                                    \
+      {                                                                                                          \
+        if (abort == _FALSE_) {                                                                                  \
+          class_call_message(error_message_output,#function,error_message_from_function);                        \
+          abort=_TRUE_;                                                                                          \
+        }                                                                                                        \
+      }                                                                                                          \
+    }                                                                                                            \
+  }                                                                                                              \
+}
+
 
 
 
@@ -223,6 +239,128 @@ int get_number_of_titles(char * titlestring);
   return _FAILURE_;                                                                                              \
 }
 
+// Profiling
+/* Profiling of the module initializations and of the hot functions
+   (compile with -DCLASS_PROFILE, see class_profile_get()):
+   class_profile_start(index) at the beginning of a function and
+   class_profile_stop(index) before each of its successful returns, or
+   class_call_profile(index,...) instead of class_call(...) around a
+   call. The counters are private to each thread; without
+   -DCLASS_PROFILE, these macros cost nothing. */
+
+/** list of the profiled functions */
+enum class_profile_index {
+  profile_input_init,
+  profile_background_init,
+  profile_thermodynamics_init,
+  profile_perturb_init,
+  profile_primordial_init,
+  profile_nonlinear_init,
+  profile_transfer_init,
+  profile_spectra_init,
+  profile_lensing_init,
+  profile_perturb_derivs,                  /**< right-hand side of the perturbation equations */
+  profile_numjac,                          /**< numerical Jacobians of the stiff evolver (including their calls to the right-hand side) */
+  profile_background_at_tau,
+  profile_thermodynamics_at_z,
+  profile_lrs_moments,                     /**< background_lrs_moments() (the lrs entries are in the order of enum lrs_counter_index) */
+  profile_lrs_phi_M,                       /**< get_phi_M_lrs() */
+  profile_lrs_onset,                       /**< instabilityOnset_lrs() */
+  profile_lrs_potential,                   /**< potentialPrime() */
+  profile_lrs_potential_derivative,        /**< potentialPrime_and_derivative() */
+  profile_size
+};
+
+/** number of calls of the profiled functions and inclusive time spent in them, by one thread */
+struct class_profile_counters {
+  long int calls[profile_size];            /**< number of calls of each function */
+  double time[profile_size];               /**< time spent in each of them (s, including nested calls) */
+  struct class_profile_counters * next;    /**< counters of the next thread (list of all threads which called a profiled function) */
+};
+
+#ifdef CLASS_PROFILE
+extern struct class_profile_counters * class_profile_thread;
+#pragma omp threadprivate(class_profile_thread)
+#define class_profile_start(index) double class_profile_start_##index = class_profile_time()
+#define class_profile_stop(index) {                                                                              \
+  if (class_profile_thread == NULL)                                                                              \
+    class_profile_thread_init();                                                                                 \
+  class_profile_thread->calls[index]++;                                                                          \
+  class_profile_thread->time[index] += class_profile_time()-class_profile_start_##index;                         \
+}
+#else
+#define class_profile_start(index)
+#define class_profile_stop(index)
+#endif
+
+/* macro for calling function, timing it, and returning error if it failed */
+#define class_call_profile(index, function, error_message_from_function, error_message_output) {                 \
+  class_profile_start(index);                                                                                    \
+  class_call(function, error_message_from_function, error_message_output);                                       \
+  class_profile_stop(index);                                                                                     \
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+double class_profile_time();
+void class_profile_thread_init();
+short class_profile_is_enabled();
+const char * class_profile_name(int index);
+int class_profile_get(struct class_profile_counters * ptotal,
+                      struct class_profile_counters * pthreads,
+                      int thread_max,
+                      int * thread_num);
+void class_profile_reset();
+int class_profile_print(FILE * stream);
+#ifdef __cplusplus
+}
+#endif
+
+// Memory
+/* Memory accounting: class_memory_heap() returns the number of bytes
+   allocated on the heap and not yet freed by the whole process (0 if
+   the C library cannot tell), so that its growth during the
+   initialization of a module is the memory kept by the structure of
+   this module; class_memory_rss() returns the current and the peak
+   resident set size of the process. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+size_t class_memory_heap();
+size_t class_memory_growth(size_t heap_start);
+int class_memory_rss(size_t * rss, size_t * peak_rss);
+#ifdef __cplusplus
+}
+#endif
+
+// MPI
+/* Distribution of the loops over wavenumbers of perturb_init() and
+   transfer_init() over the processes of an MPI run, each of them
+   using OpenMP threads (compile with -D_MPI_ and an MPI compiler, see
+   MPIFLAG in the Makefile). Without it, there is a single process of
+   rank 0, which class_mpi_partition() gives all the tasks. */
+
+#ifdef _MPI_
+#include <mpi.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+int class_mpi_init(int * argc, char *** argv);
+int class_mpi_finalize();
+int class_mpi_rank();
+int class_mpi_size();
+int class_mpi_partition(int task_size, double * task_cost, int * task_rank, ErrorMsg error_message);
+int class_mpi_any(int * flag, ErrorMsg error_message);
+int class_mpi_sum(double * buffer, int count, ErrorMsg error_message);
+int class_mpi_allgather(double * send_buffer, int send_count, double * receive_buffer, int * receive_count, ErrorMsg error_message);
+#ifdef __cplusplus
+}
+#endif
+
 // IO
 /* macro for opening file and returning error if it failed */
 #define class_open(pointer, filename,	mode, error_output) {                                                      \
@@ -320,6 +458,23 @@ enum evolver_type {
   ndf15 /* stiff integrator */
 };
 
+/**
+ * list of methods for computing the lensed \f$ C_l \f$'s
+ */
+enum lensing_method {
+  lm_full_sky, /* full-sky correlation functions (see accurate_lensing) */
+  lm_flat_sky_fft /* same up to lensing_flat_l_switch, flat-sky limit computed with FFTLog above */
+};
+
+/**
+ * list of methods for computing sigma(R) and similar integrals of the
+ * linear power spectrum in the nonlinear module
+ */
+enum sigma_method {
+  sm_integration, /* separate integral over k for each radius */
+  sm_fftlog /* all radii at once with FFTLog */
+};
+
 /**
  * List of ways in which matter power spectrum P(k) can be defined.
  * The standard definition is the first one (delta_m_squared) but
@@ -8,12 +8,17 @@ struct generic_integrator_workspace
 
   int n;
 
+  /* all the vectors below are slices of a single buffer, each aligned
+     on _GI_ALIGNMENT_ bytes (see generic_integrator_reserve()) */
+  double * buffer;  /* the buffer */
+  int capacity;     /* largest n for which the buffer is large enough */
+
   double * yscal;
   double * y;
   double * dydx;
 
   double * yerr;
-  double * ytempo;
+  double * ytempo;  /* scratch vector, not used by the integrator itself (used by evolver_rk() for dy) */
 
   double * ak2;
   double * ak3;
@@ -24,6 +29,13 @@ struct generic_integrator_workspace
 
   double stepmin;
 
+  /* state of the integration with dense output (see generic_integrator_dense()) */
+  double * y_previous;     /* y at the beginning of the last step */
+  double * dydx_previous;  /* dy/dx at the beginning of the last step */
+  double x;                /* current position of the integrator */
+  double x_previous;       /* beginning of the last step */
+  double h_next;           /* size of the next step (0 before the first one) */
+
   /**
     * zone for writing error messages
     */
@@ -45,6 +57,11 @@ extern "C" {
 				    struct generic_integrator_workspace * pgi
 				    );
 
+  int generic_integrator_reserve(
+				 int n_dim,
+				 struct generic_integrator_workspace * pgi
+				 );
+
   int cleanup_generic_integrator(struct generic_integrator_workspace * pgi);
 
   int generic_integrator(int (*derivs)(double x,
@@ -60,6 +77,29 @@ extern "C" {
 			 double hmin,
 			 struct generic_integrator_workspace * pgi);
 
+  int generic_integrator_dense_init(int (*derivs)(double x,
+                                                  double y[],
+                                                  double yprime[],
+                                                  void * parameters_and_workspace,
+                                                  ErrorMsg error_message),
+                                    double x1,
+                                    double ystart[],
+                                    void * parameters_and_workspace_for_derivs,
+                                    struct generic_integrator_workspace * pgi);
+
+  int generic_integrator_dense(int (*derivs)(double x,
+                                             double y[],
+                                             double yprime[],
+                                             void * parameters_and_workspace,
+                                             ErrorMsg error_message),
+                               double x_out,
+                               double x_stop,
+                               double yout[],
+                               void * parameters_and_workspace_for_derivs,
+                               double eps,
+                               double hmin,
+                               struct generic_integrator_workspace * pgi);
+
   int rkqs(double *x,
 	   double htry,
 	   double eps,
@@ -83,6 +123,9 @@ extern "C" {
 
 #define dsign(a,b) ( (b) > 0. ? (a) : (-(a)) )
 
+#define _GI_ALIGNMENT_ 64   /**< alignment in bytes of the vectors of the integrator workspace (one cache line, and the width of the largest SIMD registers) */
+#define _GI_VECTORS_ 13     /**< number of vectors in the integrator workspace */
+
 #define _MAXSTP_ 100000
 #define _TINY_ 1.0e-30
 #define _SAFETY_ 0.9
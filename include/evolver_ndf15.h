@@ -4,6 +4,7 @@
 // #include "perturbations.h"
 #include "sparse.h"
 #define TINY 1e-50
+#define _NDF15_SPARSE_MIN_NEQ_ 16 /* Smallest number of equations for which the sparse jacobian and LU decomposition are used */
 /**************************************************************/
 
 struct jacobian{
@@ -31,6 +32,10 @@ struct jacobian{
 	sp_num *Numerical; /*Stores the LU decomposition.*/
 	int *Cp; /* Stores the column pointers of the spJ+spJ' sparsity pattern. */
 	int *Ci; /* Stores the row indices of the  spJ+spJ' sparsity pattern. */
+	int has_supplied_pattern; /* True if the caller of the evolver supplied a superset of the sparsity pattern. */
+	sp_mat *spS; /* Stores the supplied sparsity pattern (Ap and Ai only). */
+	int *supplied_col_group; /* Column grouping of spS, used until the numerical pattern is trusted. */
+	int max_supplied_group; /* Number of columngroups of spS -1 */
 };
 
 struct numjac_workspace{
@@ -52,6 +57,25 @@ struct numjac_workspace{
 	int * Rowmax;
 };
 
+/* Statistics of the calls to evolver_ndf15() made by one thread since
+   the last call to evolver_ndf15_statistics_collect(). */
+struct evolver_ndf15_statistics{
+	long calls;          /* Number of calls to evolver_ndf15() */
+	long allocations;    /* Number of times the workspace had to be (re)allocated */
+	long stepstat[6];    /* Sum of the stepstat[] vectors of the calls (see evolver_ndf15.c) */
+};
+
+/* Workspace of evolver_ndf15(), kept by each thread from one call to the
+   next and only reallocated when a call has more equations than all the
+   previous ones. */
+struct evolver_ndf15_workspace{
+	int neq_max;         /* Number of equations for which the workspace is allocated, 0 if not allocated */
+	void * buffer;       /* Vectors and backward differences used by evolver_ndf15() */
+	struct jacobian jac;
+	struct numjac_workspace nj_ws;
+	struct evolver_ndf15_statistics statistics;
+};
+
 /**
  * Boilerplate for C++
  */
@@ -63,9 +87,19 @@ extern "C" {
   int uninitialize_jacobian(struct jacobian *jac);
   int initialize_numjac_workspace(struct numjac_workspace * nj_ws,int neq, ErrorMsg error_message);
   int uninitialize_numjac_workspace(struct numjac_workspace * nj_ws);
+  int reset_jacobian(struct jacobian *jac, int neq);
+  int reset_numjac_workspace(struct numjac_workspace * nj_ws, int neq);
+  int evolver_ndf15_workspace_free();
+  int evolver_ndf15_statistics_init(struct evolver_ndf15_statistics * pstat);
+  int evolver_ndf15_statistics_collect(struct evolver_ndf15_statistics * pstat);
   int calc_C(struct jacobian *jac);
   int interp_from_dif(double tinterp,double tnew,double *ynew,double h,double **dif,int k, double *yinterp,
 		      double *ypinterp, double *yppinterp, int* index, int neq, int output);
+  int output_from_dif(int (*output)(double x,double y[],double dy[],int index_x,void * parameters_and_workspace,
+				    ErrorMsg error_message),
+		      double *t_vec, int first, int last, double tnew, double *ynew, double *f0, double h,
+		      double **dif, int k, double *yinterp, double *ypinterp, int neq,
+		      void * parameters_and_workspace_for_output, ErrorMsg error_message);
   int new_linearisation(struct jacobian *jac,double hinvGak,int neq, ErrorMsg error_message);
   int adjust_stepsize(double **dif, double abshdivabshlast, int neq,int k);
   void eqvec(double *datavec,double *emptyvec, int n);
@@ -113,6 +147,8 @@ int evolver_ndf15(
 		ErrorMsg error_message),
 	int (*print_variables)(double x, double y[], double dy[], void *parameters_and_workspace,
 		ErrorMsg error_message),
+	int (*sparsity_pattern)(int neq, int max_nonzero, int * Ap, int * Ai, int * has_pattern,
+		void * parameters_and_workspace, ErrorMsg error_message),
 	ErrorMsg error_message);
 
 
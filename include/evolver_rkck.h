@@ -1,5 +1,5 @@
-#ifndef __EVO__
-#define __EVO__
+#ifndef __EVO_RKCK__
+#define __EVO_RKCK__
 
 #include "dei_rkck.h"
 
@@ -43,8 +43,17 @@ extern "C" {
 					     double dy[],
 					     void * parameters_and_workspace,
 					     ErrorMsg error_message),
+		      int (*sparsity_pattern)(int neq,
+					      int max_nonzero,
+					      int * Ap,
+					      int * Ai,
+					      int * has_pattern,
+					      void * parameters_and_workspace,
+					      ErrorMsg error_message),
 		      ErrorMsg error_message);
 
+  int evolver_rk_workspace_free();
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,144 @@
+/**
+ * definitions for module fft.c
+ */
+
+#ifndef __FFT__
+#define __FFT__
+
+#include "common.h"
+
+/**
+ * Everything needed to compute the Hankel transforms
+ *
+ * \f[ g(y_j) = \int_0^\infty f(x) J_n(x y_j) x dx \f]
+ *
+ * of functions sampled on the logarithmic grid \f$ x_i = x_0
+ * e^{i\Delta}\f$ (\f$ 0 \leq i < N \f$), at the points \f$ y_j = y_0
+ * e^{j\Delta}\f$, with the FFTLog algorithm (Hamilton 2000,
+ * astro-ph/9905191): \f$ x^{2-q} f(x) \f$ is expanded in a discrete
+ * sum of power laws with a Fast Fourier Transform, each power law is
+ * transformed analytically, and the result is summed with a second
+ * Fast Fourier Transform.
+ */
+
+struct fft_hankel_plan {
+
+  int N;          /**< number of points (a power of two) */
+  int n;          /**< order of the Bessel function */
+  double q;       /**< power-law bias, must obey \f$ -n < q < 3/2 \f$ (\f$ -2 < q < 3/2 \f$, \f$ q \neq 0 \f$ for n=0) */
+  double dlnx;    /**< logarithmic step \f$ \Delta \f$ of both grids */
+  double x0;      /**< first point of the input grid */
+  double y0;      /**< first point of the output grid */
+
+  double * kernel;  /**< Fourier-space kernel, kernel[2*m] (real part) and kernel[2*m+1] (imaginary part), for 0 <= m < N */
+  double * twiddle; /**< \f$ e^{-2 i \pi m/N} \f$, twiddle[2*m] (real part) and twiddle[2*m+1] (imaginary part), for 0 <= m < N/2 */
+
+};
+
+/**
+ * Everything needed to compute the logarithmic convolutions
+ *
+ * \f[ g(y_j) = \int_0^\infty f(x) K(x y_j) \frac{dx}{x} \f]
+ *
+ * of functions sampled on the logarithmic grid \f$ x_i = x_0
+ * e^{i\Delta}\f$ (\f$ 0 \leq i < N \f$), at the points \f$ y_j = y_0
+ * e^{j\Delta}\f$, with the FFTLog algorithm, for one or several
+ * kernels K whose Mellin transforms \f$ \tilde{K}(s) =
+ * \int_0^\infty x^{s-1} K(x) dx \f$ are known analytically: \f$
+ * x^{-q} f(x) \f$ is expanded in a discrete sum of power laws, each
+ * power law is transformed with \f$ \tilde{K}(q+i\eta) \f$, and the
+ * result is summed with a second Fast Fourier Transform. The Hankel
+ * transforms of fft_hankel() are the particular case \f$ K=J_n \f$
+ * applied to \f$ x^2 f(x) \f$.
+ */
+
+struct fft_mellin_plan {
+
+  int N;          /**< number of points (a power of two) */
+  int kernel_num; /**< number of kernels */
+  double q;       /**< power-law bias, must lie in the strip of convergence of the Mellin transforms of the kernels */
+  double dlnx;    /**< logarithmic step \f$ \Delta \f$ of both grids */
+  double x0;      /**< first point of the input grid */
+  double y0;      /**< first point of the output grid */
+
+  double * kernel;  /**< Fourier-space kernels, kernel[2*(index_kernel*N+m)] (real part) and kernel[2*(index_kernel*N+m)+1] (imaginary part), for 0 <= m < N */
+  double * twiddle; /**< \f$ e^{-2 i \pi m/N} \f$, twiddle[2*m] (real part) and twiddle[2*m+1] (imaginary part), for 0 <= m < N/2 */
+
+};
+
+/**
+ * Boilerplate for C++
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  int fft_complex(
+                  double * data,
+                  int N,
+                  double * twiddle,
+                  ErrorMsg error_message
+                  );
+
+  int fft_hankel_plan_init(
+                           int N,
+                           int n,
+                           double q,
+                           double dlnx,
+                           double x0,
+                           double y0,
+                           struct fft_hankel_plan * pfhp,
+                           ErrorMsg error_message
+                           );
+
+  int fft_hankel_plan_free(
+                           struct fft_hankel_plan * pfhp
+                           );
+
+  int fft_hankel(
+                 struct fft_hankel_plan * pfhp,
+                 double * f1,
+                 double * f2,
+                 double * g1,
+                 double * g2,
+                 double * work,
+                 ErrorMsg error_message
+                 );
+
+  int fft_mellin_plan_init(
+                           int N,
+                           int kernel_num,
+                           double q,
+                           double dlnx,
+                           double x0,
+                           double y0,
+                           void (*lnmellin)(double re, double im, int index_kernel, void * parameters, double * lnre, double * lnim),
+                           void * parameters,
+                           struct fft_mellin_plan * pfmp,
+                           ErrorMsg error_message
+                           );
+
+  int fft_mellin_plan_free(
+                           struct fft_mellin_plan * pfmp
+                           );
+
+  int fft_mellin(
+                 struct fft_mellin_plan * pfmp,
+                 double * f,
+                 double * g,
+                 double * work,
+                 ErrorMsg error_message
+                 );
+
+  void fft_lngamma(
+                   double re,
+                   double im,
+                   double * lnre,
+                   double * lnim
+                   );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef __FILECACHE__
+#define __FILECACHE__
+
+/******************************************/
+/* Process-wide cache of numerical tables */
+/* read from data files                   */
+/******************************************/
+#include "common.h"
+#include <sys/stat.h>
+
+/**
+ * One cached file: all the numbers found in its data lines, in the
+ * order in which they appear. Entries are read-only once loaded.
+ */
+
+struct filecache_entry {
+  FileName filename;              /**< name of the file */
+  time_t mtime;                   /**< modification time of the file when it was read */
+  off_t file_size;                /**< size of the file when it was read */
+  double * numbers;               /**< numbers read in the file */
+  int size;                       /**< number of elements in numbers */
+  int references;                 /**< number of users which acquired the entry and did not release it yet */
+  short stale;                    /**< _TRUE_ if the file changed on disk since it was read (the entry is then freed at its last release) */
+  struct filecache_entry * next;  /**< next entry of the cache */
+};
+
+/**
+ * Boilerplate for C++
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  int filecache_acquire(char * filename,
+                        double ** numbers,
+                        int * size,
+                        ErrorMsg errmsg);
+
+  int filecache_release(double * numbers);
+
+  int filecache_clear();
+
+  int filecache_read_file(char * filename,
+                          double ** numbers,
+                          int * size,
+                          ErrorMsg errmsg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -6,6 +6,10 @@
 #define __HYPERSPHERICAL__
 
 #include "common.h"
+#include "parallel_timing.h"
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #define _HYPER_OVERFLOW_ 1e200
 #define _ONE_OVER_HYPER_OVERFLOW_ 1e-200
 #define _HYPER_SAFETY_ 1e-5
@@ -14,6 +18,8 @@
 #define _HYPER_CHUNK_ 16
 #define _TWO_OVER_THREE_ 0.666666666666666666666666666667e0
 #define _HIS_BYTE_ALIGNMENT_ 16
+#define _HIS_CACHE_FORMAT_ 1       /**< version of the format of the cache files of interpolation structures, to be increased whenever this format changes */
+#define _HIS_CACHE_HEADER_SIZE_ 8  /**< number of 8-byte words in the header of these files */
 
 typedef struct HypersphericalInterpolationStructure{
   int K;                 //Sign of the curvature, (0,-1,1)
@@ -57,6 +63,52 @@ extern "C" {
                                 ErrorMsg error_message);
 
   int hyperspherical_HIS_free(HyperInterpStruct *pHIS, ErrorMsg error_message);
+  int hyperspherical_HIS_create_cached(int K,
+                                       double beta,
+                                       int nl,
+                                       int *lvec,
+                                       double xmin,
+                                       double xmax,
+                                       double sampling,
+                                       int l_WKB,
+                                       double phiminabs,
+                                       HyperInterpStruct *pHIS,
+                                       char * cache_directory,
+                                       void ** map,
+                                       size_t * map_size,
+                                       ErrorMsg error_message);
+  int hyperspherical_HIS_cache_key(int K,
+                                   double beta,
+                                   int nl,
+                                   int *lvec,
+                                   double xmin,
+                                   double xmax,
+                                   double sampling,
+                                   int l_WKB,
+                                   double phiminabs,
+                                   unsigned long long * key,
+                                   ErrorMsg error_message);
+  int hyperspherical_HIS_free_cached(HyperInterpStruct *pHIS,
+                                     void * map,
+                                     size_t map_size,
+                                     ErrorMsg error_message);
+  int hyperspherical_HIS_copy(HyperInterpStruct *pHIS_in,
+                              HyperInterpStruct *pHIS_out,
+                              ErrorMsg error_message);
+  int hyperspherical_Hermite4_convolution(HyperInterpStruct *pHIS,
+                                          int nxi,
+                                          int lnum,
+                                          double * __restrict__ xinterp,
+                                          double * __restrict__ f,
+                                          double * __restrict__ w,
+                                          double * __restrict__ cscK,
+                                          double c_phi,
+                                          double c_phi_csc2,
+                                          double c_dphi,
+                                          double c_d2phi,
+                                          double *result,
+                                          double *last_radial,
+                                          ErrorMsg error_message);
   int hyperspherical_forwards_recurrence(int K,
                                          int lmax,
                                          double beta,
@@ -150,6 +202,14 @@ int hyperspherical_forwards_recurrence_chunk(int K,
                                           double *xmin,
                                           int *ignore2);
 
+  int hyperspherical_HIS_assign_chunk(HyperInterpStruct *pHIS,
+                                      int *lvec,
+                                      int index_recurrence_max,
+                                      int index_x_start,
+                                      int chunk,
+                                      double * __restrict__ sqrtK,
+                                      double * __restrict__ PhiL);
+
   size_t hyperspherical_HIS_size(int nl, int nx);
   int hyperspherical_update_pointers(HyperInterpStruct *pHIS_local,
                                      void * HIS_storage_shared);
@@ -151,6 +151,8 @@ struct fzerofun_workspace {
   double * target_value;
   int target_size;
   enum computation_stage required_computation_stage;
+  struct background ba_previous; /**< input part of the background structure of the previous shot, kept for the next one (see background_lrs_reuse()) */
+  short has_ba_previous;         /**< _TRUE_ if ba_previous holds the structure of a previous shot */
 };
 
 
@@ -300,6 +302,26 @@ extern "C" {
                           ErrorMsg errmsg
                           );
 
+  int input_perturbations_cache_files(
+                                      char * value,
+                                      unsigned long long * hash,
+                                      ErrorMsg errmsg
+                                      );
+
+  int input_perturbations_cache_key(
+                                    struct file_content * pfc,
+                                    unsigned long long * key,
+                                    unsigned long long * family_key,
+                                    ErrorMsg errmsg
+                                    );
+
+  int input_free(
+                 struct background *pba,
+                 struct perturbs *ppt,
+                 struct primordial *ppm,
+                 struct nonlinear *pnl
+                 );
+
 
 #ifdef __cplusplus
 }
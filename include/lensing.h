@@ -4,6 +4,9 @@
 #define __LENSING__
 
 #include "spectra.h"
+#include "fft.h"
+
+#define _LENSING_FLAT_TERMS_ 19 /**< number of terms in the correlation functions computed by lensing_flat_sky() */
 
 /**
  * Structure containing everything about lensed spectra that other modules need to know.
@@ -85,6 +88,8 @@ struct lensing {
 
   //@{
 
+  size_t memory_size; /**< bytes kept on the heap by this structure at the end of lensing_init() (growth of class_memory_heap() during it) */
+
   short lensing_verbose; /**< flag regulating the amount of information sent to standard output (none if set to zero) */
 
   ErrorMsg error_message; /**< zone for writing error messages */
@@ -92,6 +97,39 @@ struct lensing {
   //@}
 };
 
+/**
+ * Quadrature in \f$ \mu \f$ and Wigner d-functions at its nodes
+ * computed by the last call of lensing_lensed_cls(), together with
+ * the parameters they depend on. They are kept by the lensing module
+ * across runs, so that they are not computed again when only the
+ * unlensed spectra or the lensed multipoles change (e.g. in
+ * lensing_recompute(), or when the cosmology changes with the same
+ * l_max). The d-functions are only kept from the second run with the
+ * same parameters on, in the layout of the buffers of
+ * lensing_lensed_cls(), one block of ppr->lensing_mu_block_size values
+ * of \f$ \mu \f$ after the other.
+ */
+
+struct lensing_cache {
+
+  short has_quadrature;      /**< _TRUE_ if the quadrature fields are filled */
+
+  int accurate_lensing;      /**< precision parameters of the quadrature */
+  double tol_gauss_legendre;
+  int num_mu;                /**< number of values of \f$ \mu \f$, the last one being \f$ \mu=1 \f$ */
+  double * mu;               /**< mu[index_mu] */
+  double * w8;               /**< quadrature weights w8[index_mu], for index_mu < num_mu-1 */
+
+  short has_d;               /**< _TRUE_ if the d-functions are filled */
+
+  int l_unlensed_max;        /**< largest multipole of d11 and d1m1 (the parameters of the d-functions are set with the quadrature, even if has_d is _FALSE_) */
+  int l_max_full;            /**< largest multipole of the other d-functions */
+  int mu_block_size;         /**< number of values of \f$ \mu \f$ per block */
+  int d_num;                 /**< number of d-functions (4, 7, 9 or 12 depending on the lensed spectra) */
+  double * d;                /**< d-functions of all the blocks */
+
+};
+
 /*************************************************************************************************************/
 /* @cond INCLUDE_WITH_DOXYGEN */
 /*
@@ -119,6 +157,47 @@ extern "C" {
                    struct lensing * ple
                    );
 
+  int lensing_recompute(
+                        struct precision * ppr,
+                        struct spectra * psp,
+                        double * cl_pp,
+                        struct lensing * ple
+                        );
+
+  int lensing_unlensed_cls(
+                           struct spectra * psp,
+                           struct lensing * ple,
+                           double ** cl_tt,
+                           double ** cl_te,
+                           double ** cl_ee,
+                           double ** cl_bb,
+                           double ** cl_pp
+                           );
+
+  int lensing_lensed_cls(
+                         struct precision * ppr,
+                         struct lensing * ple,
+                         double * cl_tt,
+                         double * cl_te,
+                         double * cl_ee,
+                         double * cl_bb,
+                         double * cl_pp
+                         );
+
+  int lensing_cache_restore(
+                            struct precision * ppr,
+                            struct lensing * ple,
+                            int num_mu,
+                            int l_max_full,
+                            int d_num,
+                            struct lensing_cache * pcache,
+                            short * same_d
+                            );
+
+  int lensing_cache_store(
+                          struct lensing_cache * pcache
+                          );
+
   int lensing_indices(
 		      struct precision * ppr,
                       struct spectra * psp,
@@ -130,7 +209,9 @@ extern "C" {
                         double **d00,
                         double *w8,
                         int nmu,
-                        struct lensing * ple
+                        struct lensing * ple,
+                        int l_size,
+                        double * cl_lens
                         );
 
   int lensing_lensed_cl_te(
@@ -138,7 +219,9 @@ extern "C" {
                            double **d20,
                            double *w8,
                            int nmu,
-                           struct lensing * ple
+                           struct lensing * ple,
+                           int l_size,
+                           double * cl_lens
                            );
 
   int lensing_lensed_cl_ee_bb(
@@ -148,25 +231,49 @@ extern "C" {
 			      double **d2m2,
 			      double *w8,
 			      int nmu,
-			      struct lensing * ple
+			      struct lensing * ple,
+			      int l_size,
+			      double * cl_lens
 			      );
   int lensing_addback_cl_tt(
 			    struct lensing *ple,
+			    int l_size,
 			    double *cl_tt
 			    );
 
   int lensing_addback_cl_te(
 			    struct lensing *ple,
+			    int l_size,
 			    double *cl_te
 			    );
 
   int lensing_addback_cl_ee_bb(
 			    struct lensing *ple,
+			    int l_size,
 			    double *cl_ee,
 			    double *cl_bb
 			    );
 
 
+  int lensing_flat_sky(
+                       struct precision * ppr,
+                       struct lensing * ple,
+                       int l_min,
+                       int index_l_first,
+                       int index_l_last,
+                       double * cl_tt,
+                       double * cl_te,
+                       double * cl_ee,
+                       double * cl_bb,
+                       double * cl_pp
+                       );
+
+  int lensing_flat_sky_terms(
+                             double l,
+                             double sigma2,
+                             double * term
+                             );
+
   int lensing_X000(
                    double * mu,
                    int num_mu,
@@ -9,6 +9,62 @@
 #define SQR(x)  ((x)*(x))  // square of a number
 #define CUB(x)  ((x)*(x)*(x)) // cube of a number
 
+#define _LRS_PHI_TABLE_MIN_ 65     /**< initial number of nodes of the phi_M(z) table */
+#define _LRS_PHI_TABLE_MAX_ 16385  /**< maximum number of nodes of the phi_M(z) table */
+#define _LRS_PHI_TABLE_TOL_ 1e-10  /**< tolerance of the exact solution at the nodes of the phi_M(z) table */
+
+#define _LRS_NEWTON_MAX_IT_ 50     /**< maximum number of Newton iterations for the scalar field equation before falling back to Ridder */
+
+#define _LRS_COMPRESSED_CHECKS_ 64       /**< number of redshifts at which the compressed perturbation q-sampling is fitted */
+#define _LRS_COMPRESSED_ROWS_ 6         /**< number of integrands per redshift fitted by the compressed q-sampling */
+#define _LRS_COMPRESSED_CANDIDATES_ 400  /**< number of nodes of the reference rule among which the compressed q-sampling is selected */
+#define _LRS_COMPRESSED_MAX_ 32          /**< maximum number of momenta of the compressed q-sampling */
+
+#define _LRS_ALWAYS_STABLE_ 1e99       /**< scale factor at instability onset for a system that is always stable */
+#define _LRS_ONSET_X_MIN_ 1e-2         /**< smallest mT/T at which the instability onset is searched for */
+#define _LRS_ONSET_X_MAX_ 1e3          /**< largest mT/T at which the instability onset is searched for */
+#define _LRS_ONSET_X_STEP_ 1.02        /**< ratio between consecutive mT/T of the search for the instability onset */
+#define _LRS_ONSET_TOL_ 1e-10          /**< relative tolerance on mT/T at instability onset */
+#define _LRS_ONSET_MAX_IT_ 100         /**< maximum number of bisections for the instability onset */
+
+/* Instrumentation of the hot functions of the module (compile with
+   -DLRS_COUNTERS): LRS_COUNTER_START at the beginning of a function,
+   LRS_COUNTER_STOP(index) before each of its successful returns. The
+   counters are private to each thread, and added to a total by
+   lrs_counters_collect(). With -DCLASS_PROFILE, the same calls are
+   also recorded by the profiling layer of common.h, in the entry
+   profile_lrs_moments+index. */
+#ifdef LRS_COUNTERS
+extern struct lrs_counters lrs_thread_counters;
+#pragma omp threadprivate(lrs_thread_counters)
+#define LRS_COUNTER_RECORD(index) {                                       \
+    lrs_thread_counters.calls[index]++;                                 \
+    lrs_thread_counters.time[index] += lrs_counter_time()-lrs_counter_start; \
+  }
+#else
+#define LRS_COUNTER_RECORD(index)
+#endif
+#ifdef CLASS_PROFILE
+#define LRS_PROFILE_RECORD(index) {                                       \
+    if (class_profile_thread == NULL)                                   \
+      class_profile_thread_init();                                      \
+    class_profile_thread->calls[profile_lrs_moments+(index)]++;         \
+    class_profile_thread->time[profile_lrs_moments+(index)] += lrs_counter_time()-lrs_counter_start; \
+  }
+#else
+#define LRS_PROFILE_RECORD(index)
+#endif
+#if defined(LRS_COUNTERS) || defined(CLASS_PROFILE)
+#define LRS_COUNTER_START double lrs_counter_start = lrs_counter_time()
+#define LRS_COUNTER_STOP(index) {                                         \
+    LRS_COUNTER_RECORD(index)                                           \
+    LRS_PROFILE_RECORD(index)                                           \
+  }
+#else
+#define LRS_COUNTER_START
+#define LRS_COUNTER_STOP(index)
+#endif
+
 extern const double _eV4_to_rho_class;
 extern const double _J4_to_rho_class;
 extern const double _Mpc_times_eV;
@@ -20,18 +76,66 @@ struct background_parameters_and_redshift {
   double z;
 };
 
+/** flags selecting the moments computed by background_lrs_moments() */
+enum lrs_moment_flags {
+  lrs_mom_rho      = 1<<0,
+  lrs_mom_p        = 1<<1,
+  lrs_mom_I_Mphi   = 1<<2,
+  lrs_mom_pseudo_p = 1<<3,
+  lrs_mom_I1       = 1<<4,
+  lrs_mom_I2       = 1<<5
+};
+
+/** moments of the fermion distribution returned by background_lrs_moments() */
+struct lrs_moments {
+  double rho;      /**< energy density */
+  double p;        /**< pressure */
+  double I_Mphi;   /**< \integ d^3q m/T 1/eps f(q) */
+  double pseudo_p; /**< pseudo-pressure */
+  double I1;       /**< \integ d^3q m/T (2 eps^2 + (m/T)^2)/eps^3 f(q) */
+  double I2;       /**< \integ d^3q q^2/eps^3 f(q) */
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
+  // Phase-space distribution of the fermions undergoing long-range interactions
+  int background_lrs_distribution(void * pbadist, double q, double * f0);
+
   // Initialize the quadrature weights for the long-range interaction integrals
   int background_lrs_init(struct precision *ppr, struct background *pba);
 
-  // Compute various integrals of the fermion distribution
-  int background_lrs_momenta(double * qvec, double * wvec, int qsize,
+  // Copy the output of background_lrs_init() from a structure with the same lrs parameters
+  int background_lrs_reuse(struct background *pba, struct background *pba_previous, int * reused);
+
+  // Initialize the scalar field table and instability onset, which depend on the lrs parameters
+  int background_lrs_parameters_init(struct precision *ppr, struct background *pba);
+
+  // Compute the present density fraction of the lrs sector
+  int background_lrs_Omega0(struct background *pba);
+
+  // Evaluate the background of a batch of lrs parameter sets sharing a reference model
+  int background_lrs_batch(struct precision *ppr, struct background *pba, int point_size,
+                           double * g_over_M, double * M_phi, double * m_F,
+                           int z_size, double * z,
+                           double * Omega0_lrs, double * a_unstable, double * background);
+
+  // Compute one point of background_lrs_batch()
+  int background_lrs_batch_point(struct precision *ppr, struct background *pba,
+                                 struct background *pba_point, int z_size, double * z,
+                                 double * background);
+
+  // Build the compressed q-sampling of the perturbations from the background one
+  int background_lrs_compressed_qsampling(struct precision *ppr, struct background *pba,
+                                          struct background_parameters_for_distributions * pbadist);
+
+  // Tabulate the scalar field as a function of redshift
+  int background_lrs_phi_table_init(struct precision *ppr, struct background *pba);
+
+  // Compute various integrals of the fermion distribution in a single pass
+  int background_lrs_moments(double * qvec, double * wvec, int qsize,
 			     double m_over_T0, double factor, double z,
-			     double * rho, double * p,
-			     double * drho_dm_over_T0, double * pseudo_p,
-			     double * I1, double * I2);
+			     int moment_mask, struct lrs_moments * pmom);
 
   // Returns the effective fermion mass divided by its present day temperature
   double get_mT_over_T0_lrs(struct background * pba, double phi_M);
@@ -39,6 +143,25 @@ extern "C" {
   // Returns the scalar field times its mass solving the equations of motion
   int get_phi_M_lrs(struct background * pba, double z, double *phi_M);
 
+  // Solves the equations of motion of the scalar field (Newton or Ridder)
+  int background_lrs_solve_phi_M(struct background * pba, double z, double tol, double phi_M_guess, double *phi_M);
+
+  // Compute and store the instability onset and the quantities frozen at onset
+  int background_lrs_onset_init(struct background *pba);
+
+  // Stability criterion of the fermion-scalar system (positive if unstable)
+  int background_lrs_onset_criterion(struct background * pba, double mT_over_T, double g_m0_over_M,
+                                     double * T_over_m0, double * criterion);
+
+  // Fermion temperature over its vacuum mass for a given mT/T
+  int background_lrs_T_over_m0(double mT_over_T, double B, double * T_over_m0);
+
+  // Instrumentation counters (effective with -DLRS_COUNTERS)
+  double lrs_counter_time();
+  int lrs_counters_init(struct lrs_counters * pcounters);
+  int lrs_counters_collect(struct lrs_counters * pcounters);
+  int lrs_counters_print(char * name, struct lrs_counters * pcounters);
+
   // Returns the scale factor at adiabatic instability onset
   int instabilityOnset_lrs(struct background * pba, double * a_rel);
 #ifdef __cplusplus
@@ -2,6 +2,7 @@
 
 #include "primordial.h"
 #include "trigonometric_integrals.h"
+#include "fft.h"
 
 #ifndef __NONLINEAR__
 #define __NONLINEAR__
@@ -12,6 +13,11 @@
 
 #define _MAX_NUM_EXTRAPOLATION_ 100000
 
+#define _HMCODE_NFW_Y_MIN_ 1.e-2 /**< below this value of \f$ k r_s (1+c) \f$, the NFW window of HMcode is given by its expansion \f$ 1-(k r_s)^2 \langle r^2/r_s^2 \rangle/6 \f$ */
+#define _HMCODE_NFW_Y_MAX_ 1.e1  /**< above this value of \f$ k r_s (1+c) \f$, the NFW window of HMcode is computed directly instead of being interpolated in its table */
+#define _HMCODE_NFW_C_MIN_ 1.    /**< smallest concentration of the table of the NFW window of HMcode */
+#define _HMCODE_NFW_C_MAX_ 1.e2  /**< largest concentration of the table of the NFW window of HMcode */
+
 enum non_linear_method {nl_none,nl_halofit,nl_HMcode};
 enum pk_outputs {pk_linear,pk_nonlinear};
 
@@ -21,6 +27,7 @@ enum halofit_integral_type {halofit_integral_one, halofit_integral_two, halofit_
 
 enum hmcode_baryonic_feedback_model {nl_emu_dmonly, nl_owls_dmonly, nl_owls_ref, nl_owls_agn, nl_owls_dblim, nl_user_defined};
 enum out_sigmas {out_sigma,out_sigma_prime,out_sigma_disp};
+enum sigma_window {sw_top_hat, sw_top_hat_dlnR, sw_halofit_one, sw_halofit_two, sw_halofit_three};
 
 /**
  * Structure containing all information on non-linear spectra.
@@ -163,6 +170,9 @@ struct nonlinear {
   int index_tau_min_nl;        /**< index of smallest value of tau at which nonlinear corrections have been computed
                                     (so, for tau<tau_min_nl, the array nl_corr_density only contains some factors 1 */
 
+  struct fft_mellin_plan sigma_plan_halofit; /**< FFTLog plan of the three integrals of halofit, with sigma_method=sm_fftlog (only during nonlinear_init()) */
+  struct fft_mellin_plan sigma_plan_top_hat; /**< FFTLog plan of the table of sigma(R) of HMcode, with sigma_method=sm_fftlog (only during nonlinear_init()) */
+
   //@}
 
   /** @name - parameters for the pk_eq method */
@@ -187,6 +197,8 @@ struct nonlinear {
 
   //@{
 
+  size_t memory_size; /**< bytes kept on the heap by this structure at the end of nonlinear_init() (growth of class_memory_heap() during it) */
+
   short nonlinear_verbose;  	/**< amount of information written in standard output */
 
   ErrorMsg error_message; 	/**< zone for writing error messages */
@@ -222,10 +234,93 @@ struct nonlinear_workspace {
                                   * (power comes from Dolag et al. (2004) correction)
                                   * it is 1, if has_fld == _FALSE_ */
 
+  struct hmcode_nfw_table * nfw_table; /**< table of the NFW window shared by all the runs of the process (see nonlinear_hmcode_nfw_table_acquire()),
+                                          or NULL if the window is computed directly (hmcode_nfw_x_per_decade=0) */
+
   //@}
 
 };
 
+/**
+ * Table of the Fourier transform of the NFW density profile truncated
+ * at the virial radius (normalised to one at k=0), as a function of
+ * \f$ x = k r_s \f$ and of the concentration \f$ c = r_v/r_s \f$,
+ * on grids uniform in \f$ \ln x \f$ and \f$ \ln c \f$. Since it does
+ * not depend on the cosmology, it is computed once per process and
+ * resolution, and shared read-only by all later runs (see
+ * nonlinear_hmcode_nfw_table_acquire()).
+ */
+
+struct hmcode_nfw_table {
+
+  double x_per_decade; /**< number of points per decade in x */
+  double c_per_decade; /**< number of points per decade in c */
+
+  int x_size;          /**< number of values of x */
+  int c_size;          /**< number of values of c */
+  double lnx_min;      /**< first value of ln(x) */
+  double dlnx;         /**< step in ln(x) */
+  double lnc_min;      /**< first value of ln(c) */
+  double dlnc;         /**< step in ln(c) */
+
+  double * window;     /**< window[index_c*x_size+index_x] */
+
+  struct hmcode_nfw_table * next; /**< next table of the process (with another resolution) */
+
+};
+
+/**
+ * Growth table and dark energy correction of HMcode computed by the
+ * last run, together with all the inputs they depend on. They are
+ * kept by the nonlinear module across runs, so that they are not
+ * computed again when only parameters not affecting the background
+ * change (e.g. the baryonic feedback parameters eta_0 and c_min).
+ */
+
+struct hmcode_growth_cache {
+
+  short has_growth;              /**< _TRUE_ if the fields below are filled */
+
+  int n_hmcode_tables;           /**< size of the growth table */
+  double ainit_for_growtab;      /**< precision parameters used for the growth table */
+  double amax_for_growtab;
+  double z_infinity;             /**< redshift used for the dark energy correction */
+  short has_fld;                 /**< background parameters used for the dark energy correction */
+  double w0_fld;
+  double wa_fld;
+  double Omega0_m;
+  double Omega0_k;
+  double Omega0_de;
+  int bt_size;                   /**< number of lines of the background table used for these quantities */
+  int bg_size;                   /**< number of columns of the background table used for these quantities */
+  double * background_table;     /**< copy of this background table */
+
+  double * growtable;            /**< copy of the growth table */
+  double * ztable;               /**< copy of the corresponding redshifts */
+  double * tautable;             /**< copy of the corresponding conformal times */
+  double dark_energy_correction; /**< copy of the dark energy correction */
+
+};
+
+/**
+ * Table of integrals of the linear power spectrum times window
+ * functions, \f$ \int \frac{k^3 P(k)}{2\pi^2} W(kR) d\ln k \f$, for
+ * all values of R at once (computed with FFTLog by
+ * nonlinear_sigma_table_init()). For the top-hat window it contains
+ * \f$ \sigma^2(R) \f$, for the halofit windows the quantities sum1,
+ * sum2, sum3 of nonlinear_halofit_integrate().
+ */
+
+struct nonlinear_sigma_table {
+
+  int R_size;       /**< number of values of R */
+  int window_num;   /**< number of window functions */
+  double * lnR;     /**< logarithm of R */
+  double * value;   /**< integrals, value[index_R*window_num+index_window] */
+  double * ddvalue; /**< their second derivative with respect to ln(R), for spline interpolation */
+
+};
+
 /********************************************************************************/
 
 /* @cond INCLUDE_WITH_DOXYGEN */
@@ -298,6 +393,19 @@ extern "C" {
                                      double * out_pk_cb
                                      );
 
+  int nonlinear_pk_at_kvec_and_zvec(
+                                    struct background * pba,
+                                    struct primordial * ppm,
+                                    struct nonlinear * pnl,
+                                    enum pk_outputs pk_output,
+                                    int index_pk,
+                                    double * kvec,
+                                    int kvec_size,
+                                    double * zvec,
+                                    int zvec_size,
+                                    double * out_pk
+                                    );
+
   int nonlinear_sigmas_at_z(
                             struct precision * ppr,
                             struct background * pba,
@@ -309,6 +417,19 @@ extern "C" {
                             double * result
                             );
 
+  int nonlinear_sigmas_at_Rvec_and_zvec(
+                                        struct precision * ppr,
+                                        struct background * pba,
+                                        struct nonlinear * pnl,
+                                        int index_pk,
+                                        double * Rvec,
+                                        int Rvec_size,
+                                        double * zvec,
+                                        int zvec_size,
+                                        double * sigma_vec,
+                                        double * dsigma_dlnR_vec
+                                        );
+
   int nonlinear_pk_tilt_at_k_and_z(
                                     struct background * pba,
                                     struct primordial * ppm,
@@ -370,7 +491,6 @@ extern "C" {
                            int index_ic,
                            int index_tp,
                            int index_tau,
-                           double ** sources,
                            double * source);
 
   int nonlinear_pk_linear(
@@ -396,6 +516,44 @@ extern "C" {
                        double * result
                        );
 
+  int nonlinear_sigma_plan_init(
+                                struct nonlinear * pnl,
+                                int k_size,
+                                double k_per_decade,
+                                int window_num,
+                                enum sigma_window * window,
+                                struct fft_mellin_plan * pfmp
+                                );
+
+  int nonlinear_sigma_table_init(
+                                 struct nonlinear * pnl,
+                                 struct fft_mellin_plan * pfmp,
+                                 double * lnpk_l,
+                                 double * ddlnpk_l,
+                                 int k_size,
+                                 struct nonlinear_sigma_table * pst
+                                 );
+
+  int nonlinear_sigma_table_at_R(
+                                 struct nonlinear * pnl,
+                                 struct nonlinear_sigma_table * pst,
+                                 double R,
+                                 double * result
+                                 );
+
+  int nonlinear_sigma_table_free(
+                                 struct nonlinear_sigma_table * pst
+                                 );
+
+  void nonlinear_sigma_window_lnmellin(
+                                       double re,
+                                       double im,
+                                       int index_window,
+                                       void * parameters,
+                                       double * lnre,
+                                       double * lnim
+                                       );
+
   int nonlinear_sigma_at_z(
                            struct background * pba,
                            struct nonlinear * pnl,
@@ -432,6 +590,7 @@ extern "C" {
                                   int index_ia_ddsum,
                                   double R,
                                   enum halofit_integral_type type,
+                                  struct nonlinear_sigma_table * halofit_table,
                                   double * sum
                                   );
 
@@ -513,6 +672,57 @@ extern "C" {
                                   double *window_nfw
                                   );
 
+  int nonlinear_hmcode_nfw_table_acquire(
+                                         struct precision * ppr,
+                                         struct nonlinear * pnl,
+                                         struct hmcode_nfw_table ** ppnt
+                                         );
+
+  int nonlinear_hmcode_nfw_table_init(
+                                      struct nonlinear * pnl,
+                                      double x_per_decade,
+                                      double c_per_decade,
+                                      struct hmcode_nfw_table * pnt
+                                      );
+
+  void nonlinear_hmcode_nfw_table_weights(
+                                          struct hmcode_nfw_table * pnt,
+                                          int mass_size,
+                                          double * conc,
+                                          int * index_c,
+                                          double * weight_c,
+                                          double * series
+                                          );
+
+  int nonlinear_hmcode_window_nfw_table(
+                                        struct nonlinear * pnl,
+                                        struct hmcode_nfw_table * pnt,
+                                        int mass_size,
+                                        double k,
+                                        double * nu_eta,
+                                        double * r_virial,
+                                        double * conc,
+                                        int * index_c,
+                                        double * weight_c,
+                                        double * series,
+                                        double * window_nfw
+                                        );
+
+  int nonlinear_hmcode_growth_cache_restore(
+                                            struct precision * ppr,
+                                            struct background * pba,
+                                            struct nonlinear * pnl,
+                                            struct nonlinear_workspace * pnw,
+                                            short * found
+                                            );
+
+  int nonlinear_hmcode_growth_cache_store(
+                                          struct precision * ppr,
+                                          struct background * pba,
+                                          struct nonlinear * pnl,
+                                          struct nonlinear_workspace * pnw
+                                          );
+
   int nonlinear_hmcode_halomassfunction(
                                         double nu,
                                         double *hmf
@@ -44,6 +44,8 @@ struct output {
 
   enum file_format output_format; /**< which format for output files (definitions, order of columns, etc.) */
 
+  short write_npy; /**< flag for writing the tables in binary NumPy .npy files instead of text .dat files */
+
   short write_background; /**< flag for outputing background evolution in file */
   short write_thermodynamics; /**< flag for outputing thermodynamical evolution in file */
   short write_perturbations; /**< flag for outputing perturbations of selected wavenumber(s) in file(s) */
@@ -79,6 +81,15 @@ extern "C" {
                            double * cl
                            );
 
+  int output_total_cls_at_l_range(
+                                  struct spectra * psp,
+                                  struct lensing * ple,
+                                  int l_min,
+                                  int l_max,
+                                  double * cl,
+                                  ErrorMsg errmsg
+                                  );
+
   int output_init(
                   struct background * pba,
                   struct thermo * pth,
@@ -107,12 +118,32 @@ extern "C" {
                 enum pk_outputs pk_output
                 );
 
+  int output_pk_at_z(
+                     struct background * pba,
+                     struct perturbs * ppt,
+                     struct nonlinear * pnl,
+                     struct output * pop,
+                     enum pk_outputs pk_output,
+                     int index_pk,
+                     int index_z,
+                     char * type_suffix
+                     );
+
   int output_tk(
                 struct background * pba,
                 struct perturbs * ppt,
                 struct output * pop
                 );
 
+  int output_tk_at_z(
+                     struct background * pba,
+                     struct perturbs * ppt,
+                     struct output * pop,
+                     int index_z,
+                     char * titles,
+                     int number_of_titles
+                     );
+
   int output_background(
                         struct background * pba,
                         struct output * pop
@@ -170,11 +201,35 @@ extern "C" {
                           );
 
   int output_one_line_of_pk(
+                            struct output * pop,
                             FILE * tkfile,
                             double one_k,
                             double one_pk
                             );
 
+  int output_open_npy_file(
+                           struct output * pop,
+                           FILE ** npyfile,
+                           FileName filename,
+                           char titles[_MAXTITLESTRINGLENGTH_],
+                           int rows
+                           );
+
+  int output_print_npy_data(
+                            struct output * pop,
+                            FileName filename,
+                            char titles[_MAXTITLESTRINGLENGTH_],
+                            double * dataptr,
+                            int size_dataptr
+                            );
+
+  int output_one_value(
+                       struct output * pop,
+                       FILE * file,
+                       double value,
+                       short condition
+                       );
+
 #ifdef __cplusplus
 }
 #endif
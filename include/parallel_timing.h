@@ -0,0 +1,66 @@
+#ifndef __PARALLEL_TIMING__
+#define __PARALLEL_TIMING__
+
+/******************************************/
+/* Process-wide timing of the OpenMP      */
+/* parallel regions                       */
+/******************************************/
+#include "common.h"
+
+#define _PARALLEL_TIMING_MAX_REGIONS_ 64     /**< maximum number of distinct regions in the table */
+#define _PARALLEL_TIMING_NAME_LENGTH_ 64     /**< maximum length of a region name */
+
+/**
+ * Accumulated timings of one parallel region, over all its executions
+ * since the last parallel_timing_reset()
+ */
+
+struct parallel_timing_region {
+  char name[_PARALLEL_TIMING_NAME_LENGTH_]; /**< name of the region (function and loop) */
+  int calls;          /**< number of executions of the region */
+  int threads;        /**< largest number of threads of these executions */
+  double wall;        /**< sum of the wall-clock durations of the executions */
+  double busy_mean;   /**< sum over the executions of the mean time after which the threads were done with their share of the work */
+  double busy_max;    /**< sum over the executions of the largest of these times (the load-imbalance tail is busy_max/busy_mean) */
+};
+
+/**
+ * Timer of one execution of a parallel region: started before the
+ * region, updated by each thread when it is done with its share of the
+ * work, and stopped after the region
+ */
+
+struct parallel_timer {
+  short enabled;      /**< _TRUE_ if the timing was enabled when the timer was started */
+  double start;       /**< time at which the timer was started */
+  double busy_sum;    /**< sum over threads of the time after which they were done */
+  double busy_max;    /**< largest of these times */
+  int threads;        /**< number of threads which reported */
+};
+
+/**
+ * Boilerplate for C++
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+  void parallel_timing_enable(short enable);
+
+  void parallel_timing_reset();
+
+  int parallel_timing_get(struct parallel_timing_region * regions,
+                          int * region_num);
+
+  void parallel_timer_start(struct parallel_timer * ptimer);
+
+  void parallel_timer_thread_done(struct parallel_timer * ptimer);
+
+  void parallel_timer_stop(struct parallel_timer * ptimer,
+                           const char * name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
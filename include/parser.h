@@ -15,6 +15,9 @@ struct file_content {
   FileArg * name;  /**< list of (size) names */
   FileArg * value; /**< list of (size) values */
   short * read;    /**< set to _TRUE_ if this parameter is effectively read */
+  int * hash_table; /**< hash index of the names: for each of the (hash_size) slots, the index of a name in the list, or -1 if the slot is empty. Built by parser_find() at the first search (NULL before), after the names have been filled */
+  int hash_size;    /**< number of slots in hash_table (a power of two, at least twice the number of names) */
+  int hash_names;   /**< number of names indexed in hash_table */
 };
 
 /**************************************************************/
@@ -43,6 +46,18 @@ int parser_free(
 		struct file_content * pfc
 		);
 
+unsigned int parser_hash(
+			 char * name
+			 );
+
+int parser_find(
+		struct file_content * pfc,
+		char * name,
+		int * index,
+		int * multiple,
+		ErrorMsg errmsg
+		);
+
 int parser_read_line(
 		char * line,
 		int * is_data,
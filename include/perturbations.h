@@ -13,6 +13,10 @@
 
 #define _set_source_(index) ppt->sources[index_md][index_ic * ppt->tp_size[index_md] + index][index_tau * ppt->k_size[index_md] + index_k]
 
+#define _PERTURB_CACHE_FORMAT_ 3 /**< version of the format of the cache files of the source tables, to be increased whenever this format changes */
+
+#define _get_source_(ppt,index_md,index_ic_tp,index_tau_k) ((ppt)->sources_single_precision == _TRUE_ ? (double)(ppt)->sources_float[index_md][index_ic_tp][index_tau_k] : (ppt)->sources[index_md][index_ic_tp][index_tau_k])
+
 /**
  * flags for various approximation schemes
  * (tca = tight-coupling approximation,
@@ -87,6 +91,11 @@ enum selection_type {gaussian,tophat,dirac};
  */
 #define _MAX_NUMBER_OF_K_FILES_ 30
 
+/**
+ * maximum number of modes (scalars, vectors, tensors)
+ */
+#define _MAX_NUMBER_OF_MODES_ 3
+
 //@}
 
 
@@ -131,10 +140,12 @@ struct perturbs
   short has_perturbed_recombination;
   /** Neutrino contribution to tensors */
   enum tensor_methods tensor_method;  /**< way to treat neutrinos in tensor perturbations(neglect, approximate as massless, take exact equations) */
+  enum tensor_methods tensor_method_lrs;  /**< way to treat the lrs fermions in tensor perturbations (by default, as tensor_method) */
 
   short evolve_tensor_ur;             /**< will we evolve ur tensor perturbations (either because we have ur species, or we have ncdm species with massless approximation) ? */
   short evolve_tensor_ncdm;             /**< will we evolve ncdm tensor perturbations (if we have ncdm species and we use the exact method) ? */
   short evolve_tensor_lrs;             /**< will we evolve lrs tensor perturbations (if we have lrs species and we use the exact method) ? */
+  short tensor_lrs_in_ur;              /**< are the lrs fermions approximated as massless and included in the ur tensor hierarchy? */
 
   short has_cl_cmb_temperature;       /**< do we need \f$ C_l \f$'s for CMB temperature? */
   short has_cl_cmb_polarization;      /**< do we need \f$ C_l \f$'s for CMB polarization? */
@@ -176,6 +187,7 @@ struct perturbs
   int store_perturbations;  /**< Do we want to store perturbations? */
   int k_output_values_num;       /**< Number of perturbation outputs (default=0) */
   double k_output_values[_MAX_NUMBER_OF_K_FILES_];    /**< List of k values where perturbation output is requested. */
+  int k_output_values_only;      /**< if _TRUE_, only the wavenumbers in k_output_values are evolved, and no source function is computed (no spectra, no transfer functions) */
 
   double three_ceff2_ur;/**< 3 x effective squared sound speed for the ultrarelativistic perturbations */
   double three_cvis2_ur;/**< 3 x effective viscosity parameter for the ultrarelativistic perturbations */
@@ -368,6 +380,9 @@ struct perturbs
   double * tau_sampling;    /**< array of tau values */
   int tau_size;             /**< number of values in this array */
 
+  struct perturbs * grid_reference; /**< if not NULL, the k lists are copied from this structure, and the tau sampling is that of this structure rescaled
+                                         by the ratio of conformal ages, so that a batch of models share the same samplings (see perturb_init_batch()) */
+
   double selection_min_of_tau_min; /**< used in presence of selection functions (for matter density, cosmic shear...) */
   double selection_max_of_tau_max; /**< used in presence of selection functions (for matter density, cosmic shear...) */
 
@@ -389,6 +404,23 @@ struct perturbs
                          [index_ic * ppt->tp_size[index_md] + index_tp]
                          [index_tau * ppt->k_size + index_k] */
 
+  short sources_single_precision; /**< _TRUE_ once the source tables have been converted to single precision at the end of perturb_init() (if ppr->perturb_sources_single_precision is set):
+                                       they are then stored in sources_float and ddlate_sources_float, while the tables of sources, late_sources and ddlate_sources are freed.
+                                       Outside of this module, read them with _get_source_() */
+
+  float *** sources_float; /**< single-precision version of sources, with the same indices, used when sources_single_precision is _TRUE_ */
+
+  FileName cache_directory;     /**< if not empty, directory where the source tables are stored once computed, and from which they are read in later runs
+                                     with the same inputs instead of being computed (see perturb_sources_cache_read()) */
+  unsigned long long cache_key; /**< hash of the input parameters on which the sources may depend, computed by input_perturbations_cache_key() */
+  unsigned long long cache_family_key; /**< same hash without the parameters setting the range of wavenumbers: the cache files of a family share their sources at common wavenumbers (see perturb_sources_cache_extend()) */
+  void * sources_map;           /**< if not NULL, the source tables are not allocated, but point inside this read-only memory map of a cache file */
+  size_t sources_map_size;      /**< size of the memory map */
+  double * sources_block;       /**< if not NULL, the source tables are not allocated, but point inside this block, shared by a batch of models (see perturb_init_batch()) */
+
+  short low_memory;             /**< if _TRUE_, the source tables are freed with perturb_free_sources() as soon as the transfer and nonlinear modules have used them, unless the transfer functions in Fourier space are requested (input parameter 'low_memory') */
+  short sources_released;       /**< _TRUE_ once the source tables have been freed by perturb_free_sources(): they cannot be read any more, and the modules reading them can only be computed again after perturb_init() */
+
   //@}
 
   /** @name - arrays related to the interpolation table for sources at late times, corresponding to z < z_max_pk (used for Fourier transfer function and spectra output) */
@@ -411,6 +443,8 @@ struct perturbs
                                             [index_ic * ppt->tp_size[index_md] + index_tp]
                                             [index_tau * ppt->k_size + index_k] */
 
+  float *** ddlate_sources_float; /**< single-precision version of ddlate_sources, with the same indices, used when sources_single_precision is _TRUE_ */
+
   //@}
 
   /** @name - arrays storing the evolution of all sources for given k values, passed as k_output_values */
@@ -444,6 +478,20 @@ struct perturbs
 
   short perturbations_verbose; /**< flag regulating the amount of information sent to standard output (none if set to zero) */
 
+  struct lrs_counters lrs_counters; /**< calls of the longrange module functions during perturb_init(), summed over threads (with -DLRS_COUNTERS) */
+
+  long approx_switch_calls;       /**< calls to perturb_approximations() made while searching for approximation switches during perturb_init(), summed over threads */
+  long approx_switch_calls_saved; /**< calls to perturb_approximations() saved by the analytic switches and the tight-coupling schedule, with respect to a full bisection for each switch */
+  long vector_requests;           /**< perturbation vectors set up by perturb_vector_init() during perturb_init(), summed over threads */
+  long vector_allocations;        /**< allocations made for them (the vectors are kept by each thread and only reallocated when they grow) */
+
+  int switch_schedule_size;       /**< number of points in the tight-coupling switch schedule of the mode being evolved (0 if none) */
+  double switch_schedule_step;    /**< spacing in ln(k) of the grid of nodes of the schedule */
+  double * switch_schedule_lnk;   /**< ln(k) at each point of the schedule */
+  double * switch_schedule_lntau; /**< ln(tau) of the tight-coupling switch at each point of the schedule */
+
+  size_t memory_size; /**< bytes kept on the heap by this structure at the end of perturb_init() (growth of class_memory_heap() during it), minus those freed by perturb_free_sources() */
+
   ErrorMsg error_message; /**< zone for writing error messages */
 
   //@}
@@ -531,6 +579,32 @@ struct perturb_vector
 
 };
 
+/**
+ * Storage of the perturb_vector structures of a workspace. At an
+ * approximation switch, the new vector is filled from the previous
+ * one, so that two vectors are needed at the same time: they are the
+ * two slots of this structure, used in turn. The arrays of each slot
+ * are kept from one vector to the next (for the next wavenumber
+ * too), and are only reallocated when a vector needs more room than
+ * any previous one.
+ */
+
+struct perturb_vector_arena
+{
+  struct perturb_vector vector[2]; /**< the two slots */
+
+  double * y[2];               /**< storage of vector[i].y */
+  double * dy[2];              /**< storage of vector[i].dy */
+  int * used_in_sources[2];    /**< storage of vector[i].used_in_sources */
+  int pt_capacity[2];          /**< size of these three arrays */
+
+  int * l_max_ncdm[2];         /**< storage of vector[i].l_max_ncdm */
+  int * q_size_ncdm[2];        /**< storage of vector[i].q_size_ncdm */
+  int ncdm_capacity[2];        /**< size of these two arrays */
+
+  long requests;               /**< number of vectors handed out by perturb_vector_init() */
+  long allocations;            /**< number of (re)allocations of the arrays above */
+};
 
 /**
  * Workspace containing, among other things, the value at a given time
@@ -573,7 +647,11 @@ struct perturb_workspace
   double * pvecmetric;        /**< metric quantities */
   struct perturb_vector * pv; /**< pointer to vector of integrated
                                  perturbations and their
-                                 time-derivatives */
+                                 time-derivatives (one of the
+                                 slots of vector_arena, or NULL
+                                 between two wavenumbers) */
+
+  struct perturb_vector_arena vector_arena; /**< storage of the vectors pv */
 
   double delta_rho;		    /**< total density perturbation (gives delta Too) */
   double rho_plus_p_theta;	/**< total (rho+p)*theta perturbation (gives delta Toi) */
@@ -605,6 +683,8 @@ struct perturb_workspace
   double theta_lrs_F;	/**< velocity divergence theta of long-range interacting fermion */
   double shear_lrs_F;	/**< shear for long-range interacting fermion */
   double delta_phi_M_lrsad; /**< for a long-range interaction, scalar field perturbation times its vacuum mass in the adiabatic approximation (eV^2) */
+  short lrs_nugget_cdm_offset;     /**< in the lrs nugget approximation, is the nugget density contrast evolved as an offset to the CDM one? (see precision parameter lrs_nugget_cdm_offset) */
+  double lrs_nugget_theta_offset_a; /**< in that case, the (constant) difference between the nugget and CDM velocity divergences times a/a_0 [1/Mpc] */
 
   double delta_m;	/**< relative density perturbation of all non-relativistic species */
   double theta_m;	/**< velocity divergence theta of all non-relativistic species */
@@ -634,6 +714,17 @@ struct perturb_workspace
 
   //@}
 
+  /** @name - statistics of the integration */
+
+  //@{
+
+  int derivs_count; /**< number of calls to perturb_derivs() in the current approximation interval (printed if perturbations_verbose > 3) */
+
+  long approx_switch_calls;       /**< number of calls to perturb_approximations() in perturb_find_approximation_switches() */
+  long approx_switch_calls_saved; /**< number of these calls saved with respect to a full bisection for each switch */
+
+  //@}
+
   /** @name - approximations used at a given time */
 
   //@{
@@ -660,6 +751,21 @@ struct perturb_workspace
 
   int max_l_max;    /**< maximum l_max for any multipole */
   double * s_l;     /**< array of freestreaming coefficients \f$ s_l = \sqrt{1-K*(l^2-1)/k^2} \f$*/
+  double * s_l_minus; /**< array of hierarchy coefficients \f$ l s_l/(2l+1) \f$ */
+  double * s_l_plus;  /**< array of hierarchy coefficients \f$ (l+1) s_{l+1}/(2l+1) \f$ */
+
+  //@}
+
+  /** @name - lrs momentum-dependent quantities at a given time, filled by perturb_lrs_momentum_cache() */
+
+  //@{
+
+  double lrs_cache_a;              /**< scale factor at which the arrays below were computed (negative if none) */
+  double * lrs_epsilon;            /**< \f$ \epsilon = \sqrt{q^2+a^2 m_T^2} \f$ on the lrs momentum grid */
+  double * lrs_inv_epsilon;        /**< \f$ 1/\epsilon \f$ */
+  double * lrs_w_q2_epsilon;       /**< \f$ w_q q^2 \epsilon \f$ */
+  double * lrs_w_q4_over_epsilon;  /**< \f$ w_q q^4 / \epsilon \f$ */
+  double * lrs_mT_over_epsilon2;   /**< \f$ (a/a_0) m_T / \epsilon^2 \f$, coefficient of the scalar field perturbation in the fermion density and pressure */
 
   //@}
 
@@ -733,10 +839,74 @@ extern "C" {
                    struct perturbs * ppt
                    );
 
+  int perturb_free_sources(
+                           struct perturbs * ppt
+                           );
+
+  int perturb_free_source_tables(
+                                 struct perturbs * ppt
+                                 );
+
   int perturb_free(
                    struct perturbs * ppt
                    );
 
+  int perturb_prepare(
+                      struct precision * ppr,
+                      struct background * pba,
+                      struct thermo * pth,
+                      struct perturbs * ppt
+                      );
+
+  int perturb_sources_finalize(
+                               struct precision * ppr,
+                               struct background * pba,
+                               struct perturbs * ppt
+                               );
+
+  int perturb_init_batch(
+                         struct precision * ppr,
+                         struct background * pba,
+                         struct thermo * pth,
+                         struct perturbs * ppt,
+                         int batch_size
+                         );
+
+  int perturb_free_batch(
+                         struct perturbs * ppt,
+                         int batch_size
+                         );
+
+  int perturb_sources_to_single_precision(
+                                          struct perturbs * ppt
+                                          );
+
+  int perturb_sources_cache_read(
+                                 struct perturbs * ppt,
+                                 short * found
+                                 );
+
+  int perturb_sources_cache_stamp(
+                                  unsigned long long * stamp
+                                  );
+
+  int perturb_sources_cache_map(
+                                struct perturbs * ppt,
+                                char * filename,
+                                void ** map,
+                                size_t * map_size
+                                );
+
+  int perturb_sources_cache_extend(
+                                   struct perturbs * ppt,
+                                   short ** k_from_cache,
+                                   int * k_from_cache_size
+                                   );
+
+  int perturb_sources_cache_write(
+                                  struct perturbs * ppt
+                                  );
+
   int perturb_indices_of_perturbs(
                                   struct precision * ppr,
                                   struct background * pba,
@@ -750,6 +920,29 @@ extern "C" {
                                        struct thermo * pth,
                                        struct perturbs * ppt
                                        );
+
+  int perturb_timesampling_adaptive(
+                                    struct precision * ppr,
+                                    struct background * pba,
+                                    struct thermo * pth,
+                                    struct perturbs * ppt,
+                                    double tau_ini,
+                                    double * pvecback,
+                                    double * pvecthermo
+                                    );
+
+  int perturb_timesampling_kernels(
+                                   struct background * pba,
+                                   struct thermo * pth,
+                                   struct perturbs * ppt,
+                                   double tau,
+                                   int * last_index_back,
+                                   int * last_index_thermo,
+                                   double * pvecback,
+                                   double * pvecthermo,
+                                   double * kernel,
+                                   double * max_step_rate
+                                   );
   int perturb_get_k_list(
                          struct precision * ppr,
                          struct background * pba,
@@ -772,6 +965,25 @@ extern "C" {
                              struct perturb_workspace * ppw
                              );
 
+  int perturb_lrs_momentum_cache(
+                                 struct background * pba,
+                                 struct perturb_workspace * ppw
+                                 );
+
+  int perturb_hierarchy_coefficients(
+                                     struct perturb_workspace * ppw
+                                     );
+
+  int perturb_hierarchy_free_streaming(
+                                       double qk_div_epsilon,
+                                       double * y,
+                                       double * dy,
+                                       double * s_l_minus,
+                                       double * s_l_plus,
+                                       int l_min,
+                                       int l_max
+                                       );
+
   int perturb_solve(
                     struct precision * ppr,
                     struct background * pba,
@@ -788,6 +1000,26 @@ extern "C" {
                                struct perturbs * ppt
                                );
 
+  int perturb_task_schedule(
+                            struct precision * ppr,
+                            struct perturbs * ppt,
+                            int index_md,
+                            int * task_order,
+                            double * task_cost
+                            );
+
+  int perturb_sources_mpi_gather(
+                                 struct perturbs * ppt,
+                                 int index_md,
+                                 int * task_rank
+                                 );
+
+  int perturb_task_cost_store(
+                              struct perturbs * ppt,
+                              int index_md,
+                              double * task_cost
+                              );
+
   int perturb_find_approximation_number(
                                         struct precision * ppr,
                                         struct background * pba,
@@ -819,6 +1051,76 @@ extern "C" {
                                           int ** interval_approx
                                           );
 
+  int perturb_lrs_approximation_switch(
+                                       struct precision * ppr,
+                                       struct background * pba,
+                                       struct perturbs * ppt,
+                                       int index_md,
+                                       double k,
+                                       struct perturb_workspace * ppw,
+                                       int index_ap,
+                                       double tau_ini,
+                                       double tau_end,
+                                       double precision,
+                                       double * tau_switch,
+                                       short * has_switch
+                                       );
+
+  int perturb_lrs_background_crossing(
+                                      struct background * pba,
+                                      struct perturb_workspace * ppw,
+                                      int index_bg,
+                                      int a_power,
+                                      double threshold,
+                                      double tau_ini,
+                                      double tau_end,
+                                      double precision,
+                                      double * tau_cross,
+                                      ErrorMsg error_message
+                                      );
+
+  int perturb_analytic_approximation_switch(
+                                            struct precision * ppr,
+                                            struct background * pba,
+                                            struct thermo * pth,
+                                            struct perturbs * ppt,
+                                            int index_md,
+                                            double k,
+                                            struct perturb_workspace * ppw,
+                                            int index_ap,
+                                            double tau_ini,
+                                            double tau_end,
+                                            double * tau_switch,
+                                            short * has_switch
+                                            );
+
+  int perturb_switch_schedule_init(
+                                   struct precision * ppr,
+                                   struct background * pba,
+                                   struct thermo * pth,
+                                   struct perturbs * ppt,
+                                   int index_md,
+                                   struct perturb_workspace * ppw
+                                   );
+
+  int perturb_switch_schedule_free(
+                                   struct perturbs * ppt
+                                   );
+
+  int perturb_switch_schedule_bracket(
+                                      struct precision * ppr,
+                                      struct background * pba,
+                                      struct thermo * pth,
+                                      struct perturbs * ppt,
+                                      int index_md,
+                                      double k,
+                                      struct perturb_workspace * ppw,
+                                      int index_ap,
+                                      int flag_switched,
+                                      double * lower_bound,
+                                      double * upper_bound
+                                      );
+
   int perturb_vector_init(
                           struct precision * ppr,
                           struct background * pba,
@@ -832,10 +1134,42 @@ extern "C" {
                           int * pa_old
                           );
 
+  int perturb_lrs_copy_hierarchy(
+                                 struct perturb_vector * pv_old,
+                                 struct perturb_vector * pv_new
+                                 );
+
+  int perturb_lrs_l_max(
+                        struct precision * ppr,
+                        struct background * pba,
+                        struct perturb_vector * pv_old,
+                        int * l_max
+                        );
+
+  int perturb_lrs_truncation_checkpoints(
+                                         struct precision * ppr,
+                                         struct background * pba,
+                                         struct perturbs * ppt,
+                                         int index_md,
+                                         struct perturb_workspace * ppw,
+                                         int * interval_number,
+                                         double ** interval_limit,
+                                         int *** interval_approx
+                                         );
+
   int perturb_vector_free(
+                          struct perturb_workspace * ppw,
                           struct perturb_vector * pv
                           );
 
+  int perturb_vector_arena_reserve(
+                                   struct perturbs * ppt,
+                                   struct perturb_workspace * ppw,
+                                   struct perturb_vector * pv,
+                                   int pt_size,
+                                   int ncdm_size
+                                   );
+
   int perturb_initial_conditions(
                                  struct precision * ppr,
                                  struct background * pba,
@@ -905,6 +1239,24 @@ extern "C" {
                               ErrorMsg error_message
                               );
 
+  int perturb_sparsity_flag_hierarchy(
+                                      int * hierarchy,
+                                      int * multipole,
+                                      int index_first,
+                                      int l_max,
+                                      int id
+                                      );
+
+  int perturb_sparsity_pattern(
+                               int neq,
+                               int max_nonzero,
+                               int * Ap,
+                               int * Ai,
+                               int * has_pattern,
+                               void * parameters_and_workspace,
+                               ErrorMsg error_message
+                               );
+
   int perturb_derivs(
                      double tau,
                      double * y,
@@ -913,6 +1265,17 @@ extern "C" {
                      ErrorMsg error_message
                      );
 
+  int perturb_derivs_select(
+                            struct background * pba,
+                            struct perturbs * ppt,
+                            int (**derivs)(double tau,
+                                           double * y,
+                                           double * dy,
+                                           void * parameters_and_workspace,
+                                           ErrorMsg error_message),
+                            const char ** name
+                            );
+
   int perturb_tca_slip_and_shear(
                                  double * y,
                                  void * parameters_and_workspace,
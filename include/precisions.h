@@ -19,6 +19,16 @@ class_precision_parameter(back_integration_stepsize,double,7.e-3)
  * Tolerance of the background integration, giving the allowed relative integration error.
  */
 class_precision_parameter(tol_background_integration,double,1.e-2)
+/**
+ * If true, the background table is also resampled on uniform grids in
+ * \f$ \ln\tau \f$ and \f$ \ln(1+z) \f$, so that background_at_tau() and
+ * background_tau_of_z() find their interval by index arithmetic instead of a search.
+ */
+class_precision_parameter(background_uniform_tables,int,_TRUE_)
+/**
+ * Spacing of these uniform grids in \f$ \ln\tau \f$ and \f$ \ln(1+z) \f$.
+ */
+class_precision_parameter(back_uniform_stepsize,double,3.5e-3)
 /**
  * Tolerance of the deviation of \f$ \Omega_r \f$ from 1 for which to start integration:
  * The starting point of integration will be chosen,
@@ -96,11 +106,38 @@ class_precision_parameter(tol_lrs_newtonian,double,1.e-5)
  * long-range interacting fermion phase-space distributions during the background evolution.
  */
 class_precision_parameter(tol_lrs_bg,double,1.e-5)
+/**
+ * With the compressed q-sampling of the long-range interacting fermion
+ * perturbations (Quadrature strategy = 4), tolerance on the relative
+ * error of its energy density, pressure and I_Mphi (and of their
+ * adiabatic perturbations), over the range of mT/T covered by the run.
+ */
+class_precision_parameter(tol_lrs_compressed,double,3.e-3)
+/**
+ * Minimum number of momenta of the compressed q-sampling of the
+ * long-range interacting fermion perturbations.
+ */
+class_precision_parameter(lrs_compressed_q_size_min,int,3)
 /**
  * Tolerance on the initial deviation of long-range interacting fermion from being fully relativistic.
  * Using w = pressure/density, this quantifies the maximum deviation from 1/3. (for relativistic species)
  */
 class_precision_parameter(tol_lrs_initial_w,double,1.e-3)
+/**
+ * Tolerance on the relative interpolation error of the table of the
+ * long-range scalar field phi_M(z) (and of the effective fermion mass),
+ * built once in background_lrs_init(). The table is refined until the
+ * error at the mid-points is below this value. Set to zero to disable
+ * the table and solve the field equation at each call.
+ */
+class_precision_parameter(tol_lrs_phi_table,double,1.e-6)
+/**
+ * Method for solving the long-range scalar field equation when it is
+ * not tabulated: lrs_phi_newton (Newton iterations with analytic
+ * derivative and warm start, safeguarded by bisection and Ridder) or
+ * lrs_phi_ridder (Ridder method only).
+ */
+class_precision_parameter(lrs_phi_solver,int,lrs_phi_newton)
 
 
 /*
@@ -176,6 +213,9 @@ class_precision_parameter(recfast_x_H0_trigger_delta,double,0.05)  /**< Smoothin
 
 class_precision_parameter(recfast_H_frac,double,1.0e-3)  /**< from recfast 1.4, specifies the time at which the temperature evolution is calculated by the more precise equation */
 
+class_precision_parameter(recfast_dense_output,int,_TRUE_) /**< If true, the last regime of RECFAST (full evolution of H and He) is integrated with adaptive steps not limited by the sampling of the recombination table, which is filled by interpolation */
+class_precision_parameter(tol_recfast_dense_output,double,1.0e-6) /**< Tolerance of the relative integration error in this case */
+
 class_precision_parameter(reionization_z_start_max,double,50.0) /**< Maximum starting value in z for reionization */
 class_precision_parameter(reionization_sampling,double,5.0e-2)  /**< Sampling density in z during reionization */
 class_precision_parameter(reionization_optical_depth_tol,double,1.0e-4) /**< Relative tolerance on finding the user-given optical depth of reionization given a certain redshift of reionization */
@@ -183,6 +223,14 @@ class_precision_parameter(reionization_start_factor,double,8.0) /**< Searching o
 
 class_precision_parameter(thermo_rate_smoothing_radius,int,50) /**< Smoothing in redshift of the variation rate of \f$ \exp(-\kappa) \f$, g, and \f$ \frac{dg}{d\tau} \f$ that is used as a timescale afterwards */
 
+class_precision_parameter(thermo_direct_index,int,_TRUE_) /**< If true, thermodynamics_at_z() in normal mode finds its interval in the thermodynamics table from a precomputed index on a uniform grid in \f$ \ln(1+z) \f$ instead of a bisection */
+class_precision_parameter(thermo_direct_index_stepsize,double,1.0e-3) /**< Spacing of this uniform grid in \f$ \ln(1+z) \f$ */
+
+class_precision_parameter(energy_injection_table,int,_TRUE_) /**< If true, the energy injection rate from DM annihilation beyond the on-the-spot approximation is computed once on a uniform grid in \f$ \ln(1+z) \f$ and then interpolated */
+class_precision_parameter(energy_injection_table_stepsize,double,1.0e-2) /**< Spacing of this uniform grid in \f$ \ln(1+z) \f$ */
+
+class_precision_parameter(thermo_reuse_recombination,int,_TRUE_) /**< If true, the recombination history of the previous run is reused when none of its inputs changed, e.g. when only reionization parameters vary; then only the reionization history and the later thermodynamics quantities are recomputed */
+
 class_string_parameter(hyrec_Alpha_inf_file,"/hyrec/Alpha_inf.dat","Alpha_inf hyrec file") /**< File containing the alpha parameter of hyrec */
 class_string_parameter(hyrec_R_inf_file,"/hyrec/R_inf.dat","R_inf hyrec file") /**< File containing the R_inf parameter of hyrec */
 class_string_parameter(hyrec_two_photon_tables_file,"/hyrec/two_photon_tables.dat","two_photon_tables hyrec file") /**< File containing the two-photon interaction parameter of hyrec */
@@ -241,6 +289,8 @@ class_precision_parameter(l_max_ur,int,17)   /**< number of momenta in Boltzmann
 class_precision_parameter(l_max_idr,int,17)   /**< number of momenta in Boltzmann hierarchy for interacting dark radiation */
 class_precision_parameter(l_max_ncdm,int,17)   /**< number of momenta in Boltzmann hierarchy for relativistic neutrino/relics (scalar), at least 4 */
 class_precision_parameter(l_max_lrs,int,17)   /**< number of momenta in Boltzmann hierarchy for scalar-mediated long range interactions (scalar), at least 4 */
+class_precision_parameter(lrs_l_max_truncation_tol,double,0.)   /**< if positive, truncate the lrs hierarchy dynamically, dropping the multipoles smaller than this fraction of max(|psi_0|,|psi_1|,|psi_2|) in all momentum bins */
+class_precision_parameter(lrs_l_max_checkpoint_dlntau,double,0.5)   /**< spacing in ln(tau) of the checkpoints at which the dynamical lrs truncation is revised, in addition to approximation switches (0: approximation switches only) */
 class_precision_parameter(l_max_g_ten,int,5)     /**< number of momenta in Boltzmann hierarchy for photon temperature (tensor), at least 4 */
 class_precision_parameter(l_max_pol_g_ten,int,5) /**< number of momenta in Boltzmann hierarchy for photon polarization (tensor), at least 4 */
 
@@ -258,12 +308,49 @@ class_precision_parameter(perturb_integration_stepsize,double,0.5)
  */
 class_precision_parameter(perturb_sampling_stepsize,double,0.1)
 
+/**
+ * if positive, place the source sampling times with
+ * perturb_timesampling_adaptive() instead: each step is the largest
+ * one for which the estimated error of a linear interpolation of the
+ * visibility function, of its derivative and of \f$ e^{-\kappa} \f$
+ * (when CMB sources are requested) stays below this relative
+ * tolerance. Steps remain bounded by perturb_sampling_stepsize times
+ * the Hubble (or late ISW) timescale.
+ */
+class_precision_parameter(perturb_sampling_tol,double,0.)
+
+/**
+ * in perturb_timesampling_adaptive(), the interpolation error of each
+ * kernel is relative to its local value plus this fraction of its
+ * largest value within the next expansion time: the recombination and
+ * reionization windows are then each resolved relatively to their own
+ * amplitude, but not the times at which the universe is still opaque
+ */
+class_precision_parameter(perturb_sampling_kernel_floor,double,0.1)
+
 /**
  * control parameter for the precision of the perturbation integration,
  * IMPORTANT FOR SETTING THE STEPSIZE OF NDF15
  */
 class_precision_parameter(tol_perturb_integration,double,1.0e-5)
 
+/**
+ * if true, the OpenMP loop over initial conditions and wavenumbers in
+ * perturb_init() hands them out in order of decreasing cost, as
+ * measured in the previous run (longest-first scheduling); otherwise,
+ * and when no measurement is available, in order of decreasing k
+ */
+class_precision_parameter(perturb_schedule_by_cost,int,_TRUE_)
+
+/**
+ * if true, the source tables are converted to single precision at the
+ * end of perturb_init(), which halves the memory they take until
+ * perturb_free() (useful for many concurrent runs with large k and tau
+ * samplings); the stored sources then have a relative accuracy of
+ * about 1e-7
+ */
+class_precision_parameter(perturb_sources_single_precision,int,_FALSE_)
+
 /**
  * cutoff relevant for controlling stiffness in the PPF scheme. It is
  * neccessary for the Runge-Kutta evolver, but not for ndf15. However,
@@ -279,6 +366,21 @@ class_precision_parameter(c_gamma_k_H_square_max,double,1.0e3)
  */
 class_precision_parameter(tol_tau_approx,double,1.0e-10)
 
+/**
+ * number of wavenumbers per decade, on a fixed grid in ln(k), at which
+ * the time of the tight-coupling switch is found by a full bisection
+ * before evolving the perturbations; for the other wavenumbers, the
+ * switching time interpolated in ln(k) between the two surrounding
+ * nodes seeds the bisection with a narrow bracket (0 to disable)
+ */
+class_precision_parameter(perturb_switch_schedule_per_decade,int,4)
+
+/**
+ * initial relative half-width of the bracket around the interpolated
+ * tight-coupling switching time (widened until it contains the switch)
+ */
+class_precision_parameter(perturb_switch_schedule_bracket,double,1.0e-3)
+
 /**
  * method for switching off photon perturbations
  */
@@ -314,7 +416,13 @@ class_precision_parameter(ur_fluid_trigger_tau_over_tau_k,double,30.0)
 
 class_precision_parameter(ncdm_fluid_approximation,int,ncdmfa_CLASS) /**< method for non-cold dark matter fluid approximation */
 
-class_precision_parameter(lrs_fluid_approximation,int,lrsfa_none) /**< method for scalar-mediated long range interaction fluid approximation */
+/**
+ * method for scalar-mediated long range interaction fluid approximation
+ * (lrsfa_none by default; with lrsfa_CLASS and the trigger below, the
+ * P(k) of explanatory_lrs.ini agrees with that of the full hierarchy
+ * to 5e-4, in about half the time)
+ */
+class_precision_parameter(lrs_fluid_approximation,int,lrsfa_none)
 
 /**
  * when to switch off ncdm (massive neutrinos / non-cold
@@ -324,9 +432,10 @@ class_precision_parameter(ncdm_fluid_trigger_tau_over_tau_k,double,31.0)
 
 /**
  * when to switch off fluid approximation for long range
- * interacting fermion
+ * interacting fermion, if lrs_fluid_approximation is not lrsfa_none
+ * (later than for ncdm: with 32, the error on the P(k) reaches 2e-3)
  */
-class_precision_parameter(lrs_fluid_trigger_tau_over_tau_k,double,32.0)
+class_precision_parameter(lrs_fluid_trigger_tau_over_tau_k,double,60.0)
 
 /**
  * When to switch on lrs adiabatic approximation
@@ -334,6 +443,22 @@ class_precision_parameter(lrs_fluid_trigger_tau_over_tau_k,double,32.0)
  */
 class_precision_parameter(lrs_adiab_trigger_M_over_kH,double,1e2)
 
+/**
+ * In the lrs nugget approximation, nuggets are pressureless and
+ * follow the same equations as CDM. If this flag is set (and the
+ * model contains CDM), only the offset of their density contrast
+ * to the CDM one is evolved, its derivative being given
+ * analytically by the velocity offset at nugget formation, which
+ * decays as 1/a. Otherwise, their density and momentum are evolved.
+ */
+class_precision_parameter(lrs_nugget_cdm_offset,int,_TRUE_)
+
+/**
+ * The lrs fermions are neglected in tensor perturbations if
+ * Omega0_lrs is below this threshold, whatever the tensor method
+ */
+class_precision_parameter(tensor_lrs_Omega0_threshold,double,0.)
+
 /**
  * whether CMB source functions can be approximated as zero when
  * visibility function g(tau) is tiny
@@ -386,6 +511,8 @@ class_precision_parameter(hyper_nu_sampling_step,double,1000.0)  /**< open/close
 class_precision_parameter(hyper_phi_min_abs,double,1.0e-10)  /**< small value of Bessel function used in calculation of first point x (\f$ \Phi_l^{\nu}(x) \f$ equals hyper_phi_min_abs) */
 class_precision_parameter(hyper_x_tol,double,1.0e-4)  /**< tolerance parameter used to determine first value of x */
 class_precision_parameter(hyper_flat_approximation_nu,double,4000.0)  /**< value of nu below which the flat approximation is used to compute Bessel function */
+class_precision_parameter(hyper_flat_cache_xmax_step,double,0.05)  /**< flat case, when 'bessel_cache' is set: the largest x is rounded up to the next power of (1+hyper_flat_cache_xmax_step), so that models with nearby conformal ages share the same cached table */
+class_precision_parameter(hyper_curved_cache_size,int,0)  /**< open/closed cases: number of interpolation structures (one per value of nu) kept in memory by the process and reused by later runs with the same curvature sign, nu and x range (useful for closed models, where these do not depend on K); 0 to disable */
 
 class_precision_parameter(q_linstep,double,0.45)         /**< asymptotic linear sampling step in q
                                space, in units of \f$ 2\pi/r_a(\tau_rec) \f$
@@ -420,6 +547,21 @@ class_precision_parameter(q_numstep_transition,double,250.0) /**< number of step
                                  q_logstep_spline steps (transition
                                  must be smooth for spline) */
 
+class_precision_parameter(q_adaptive,int,_FALSE_) /**< if true, the sampling in q defined by the above parameters
+                                 is made coarser by a factor q_adaptive_coarsening, and then refined
+                                 only where the transfer functions need it (see transfer_q_adaptive_sampling()) */
+class_precision_parameter(q_adaptive_coarsening,double,4.0) /**< with q_adaptive, factor multiplying q_linstep,
+                                 q_logstep_spline and q_logstep_trapzd in the initial list */
+class_precision_parameter(q_adaptive_tol_cmb,double,0.1) /**< with q_adaptive, tolerated relative error on the integrand
+                                 of the CMB \f$ C_l \f$'s due to the sampling in q (each interval gets a share
+                                 proportional to its width). The estimate neglects the cancellations between
+                                 oscillations, hence the large value */
+class_precision_parameter(q_adaptive_tol_lss,double,0.01) /**< same for number count and lensing \f$ C_l \f$'s */
+class_precision_parameter(q_adaptive_l_step,int,4) /**< with q_adaptive, the error is estimated from one multipole
+                                 out of q_adaptive_l_step in the list of each type */
+class_precision_parameter(q_adaptive_max_level,int,4) /**< with q_adaptive, maximum number of refinement levels
+                                 (each one halves the intervals still too large) */
+
 class_precision_parameter(transfer_neglect_delta_k_S_t0,double,0.15) /**< for temperature source function T0 of scalar mode, range of k values (in 1/Mpc) taken into account in transfer function: for l < (k-delta_k)*tau0, ie for k > (l/tau0 + delta_k), the transfer function is set to zero */
 class_precision_parameter(transfer_neglect_delta_k_S_t1,double,0.04) /**< same for temperature source function T1 of scalar mode */
 class_precision_parameter(transfer_neglect_delta_k_S_t2,double,0.15) /**< same for temperature source function T2 of scalar mode */
@@ -433,6 +575,9 @@ class_precision_parameter(transfer_neglect_delta_k_T_e,double,0.25)  /**< same f
 class_precision_parameter(transfer_neglect_delta_k_T_b,double,0.1)  /**< same for polarization source function B of tensor mode */
 
 class_precision_parameter(transfer_neglect_late_source,double,400.0)  /**< value of l below which the CMB source functions can be neglected at late time, excepted when there is a Late ISW contribution */
+class_precision_parameter(transfer_fused_kernel,int,_TRUE_)  /**< flat case: if true, the line-of-sight integrals of the scalar temperature, E-polarisation, tensor temperature and number count rsd types are computed in a single pass with hyperspherical_Hermite4_convolution(), instead of first storing the radial function computed by transfer_radial_function() */
+class_precision_parameter(transfer_l_tile_size,int,0)  /**< if positive, each (mode, initial condition, type) of a wavenumber in transfer_compute_for_each_q() is cut in tiles of this number of multipoles, computed as OpenMP tasks that threads having finished their own wavenumbers can pick up; useful when there are few wavenumbers per thread (many cores, high l_max) */
+class_precision_parameter(transfer_compressed_storage,int,_TRUE_)  /**< if true, only the wavenumbers for which a transfer function cannot be neglected (l below l_max of its type, k within the computed range, l not much smaller than k times the distance to recombination, l<nu in closed models) are stored and integrated over in the spectra module; if false, all of them are stored, as zeros when negligible */
 
 class_precision_parameter(l_switch_limber,double,10.) /**< when to use the Limber approximation for project gravitational potential cl's */
 // For density Cl, we recommend not to use the Limber approximation
@@ -459,6 +604,8 @@ class_precision_parameter(selection_tophat_edge,double,0.1) /**< controls how sm
 
 class_precision_parameter(sigma_k_per_decade,double,80.) /**< logarithmic stepsize controlling the precision of integrals for sigma(R,k) and similar quantitites */
 
+class_type_parameter(sigma_method,int,enum sigma_method,sm_integration) /**< method for computing the sigma(R)-like integrals needed by halofit (at each step of the search for R_nl) and by HMcode (for its table of sigma(R)): 0 for a separate integral for each R, 1 for all R at once with FFTLog, in \f$ O(N \ln N) \f$ operations for N values of k */
+
 class_precision_parameter(nonlinear_min_k_max,double,20.0) /**< when
                                using an algorithm to compute nonlinear
                                corrections, like halofit or hmcode,
@@ -526,6 +673,13 @@ class_precision_parameter(nsteps_for_p1h_integral,int,256)
 class_precision_parameter(mmin_for_p1h_integral,double,1.e3)
 class_precision_parameter(mmax_for_p1h_integral,double,1.e18)
 
+/**
+ * parameters controlling the table of the NFW window in the 1-halo-power
+ * integral
+ */
+class_precision_parameter(hmcode_nfw_x_per_decade,double,100.) /**< number of points per decade in k r_s of the table of the NFW window, interpolated instead of computing sine and cosine integrals for each k and halo mass (0 to compute them directly) */
+class_precision_parameter(hmcode_nfw_c_per_decade,double,100.) /**< number of points per decade in concentration of the table of the NFW window */
+
 
 /*
  * Lensing precision parameters
@@ -534,6 +688,12 @@ class_precision_parameter(mmax_for_p1h_integral,double,1.e18)
 class_precision_parameter(accurate_lensing,int,_FALSE_) /**< switch between Gauss-Legendre quadrature integration and simple quadrature on a subdomain of angles */
 class_precision_parameter(num_mu_minus_lmax,int,70) /**< difference between num_mu and l_max, increase for more precision */
 class_precision_parameter(delta_l_max,int,500)/**< difference between l_max in unlensed and lensed spectra */
+class_precision_parameter(lensing_mu_block_size,int,16) /**< number of values of mu for which each thread stores the Wigner d-functions at a time in the lensing module */
+class_precision_parameter(lensing_d_cache_max_mb,double,256.) /**< largest size (in MB) of the table of Wigner d-functions kept by the lensing module, from the second run with the same l_max on, for the next runs and for lensing_recompute() (if larger, they are computed block after block by each thread as usual, and only the quadrature in mu is kept) */
+class_type_parameter(lensing_method,int,enum lensing_method,lm_full_sky) /**< method for computing the lensed \f$ C_l \f$'s: 0 for the full-sky correlation functions, 1 for the same below lensing_flat_l_switch and the flat-sky limit above, where the correlation functions and the lensed \f$ C_l \f$'s are Hankel transforms of each other computed with FFTLog in \f$ O(l_{max} \ln l_{max}) \f$ operations */
+class_precision_parameter(lensing_flat_l_switch,int,2000) /**< with lensing_method=1, multipole above which the lensed \f$ C_l \f$'s are computed in the flat-sky limit */
+class_precision_parameter(lensing_fft_sampling,double,2.) /**< with lensing_method=1, the logarithmic grids of the FFT's sample the oscillations of the Bessel functions at the largest multipole and angle with at least this number of points per period */
+class_precision_parameter(lensing_fft_sigma2_nodes,int,16) /**< with lensing_method=1, number of values of sigma2 at which the correlation functions are computed before interpolation */
 class_precision_parameter(tol_gauss_legendre,double,ppr->smallest_allowed_variation) /**< tolerance with which quadrature points are found: must be very small for an accurate integration (if not entered manually, set automatically to match machine precision) */
 
 #undef class_precision_parameter
@@ -196,6 +196,14 @@ struct primordial {
   double custom9;  /**< one parameter of the primordial computed in 'external_Pk' */
   double custom10; /**< one parameter of the primordial computed in 'external_Pk' */
 
+  int (*external_pk_function)(double * k,
+                              int k_size,
+                              double * pk_scalar,
+                              double * pk_tensor,
+                              void * parameters,
+                              ErrorMsg error_message); /**< if not NULL, function called in 'external_Pk' mode instead of 'command': it fills pk_scalar (and pk_tensor, NULL without tensors) at the k_size values of k of the primordial table; it can be set by the caller between input_init() and primordial_init() */
+  void * external_pk_parameters; /**< pointer passed to external_pk_function */
+
   //@}
 
   /** @name - pre-computed table of primordial spectra, and related quantities */
@@ -292,6 +300,8 @@ struct primordial {
 
   //@{
 
+  size_t memory_size; /**< bytes kept on the heap by this structure at the end of primordial_init() (growth of class_memory_heap() during it) */
+
   short primordial_verbose; /**< flag regulating the amount of information sent to standard output (none if set to zero) */
 
   //@}
@@ -300,6 +310,27 @@ struct primordial {
 
 };
 
+/**
+ * Table generated by the last external command run by
+ * primordial_external_spectrum_init(), kept across runs so that the
+ * command is not launched again when it is called with the same
+ * arguments.
+ */
+
+struct external_pk_cache {
+
+  short has_table;                        /**< _TRUE_ if the fields below are filled */
+
+  char command[2*_ARGUMENT_LENGTH_MAX_];  /**< command with its arguments */
+  short has_tensors;                      /**< _TRUE_ if the table contains the tensor spectrum */
+
+  int k_size;                             /**< number of lines of the table */
+  double * k;                             /**< wavenumbers k[index_k] */
+  double * pks;                           /**< scalar spectrum pks[index_k] */
+  double * pkt;                           /**< tensor spectrum pkt[index_k] (if has_tensors) */
+
+};
+
 struct primordial_inflation_parameters_and_workspace {
 
   struct primordial * ppm;
@@ -344,6 +375,15 @@ extern "C" {
                                double * pk
                                );
 
+  int primordial_spectrum_at_kvec(
+                                  struct primordial * ppm,
+                                  int index_md,
+                                  enum linear_or_logarithmic mode,
+                                  double * input,
+                                  int input_size,
+                                  double * output
+                                  );
+
   int primordial_init(
                       struct precision  * ppr,
                       struct perturbs   * ppt,
@@ -420,11 +460,18 @@ extern "C" {
                                    double * y_ini
                                    );
 
+  int primordial_inflation_background_at_k_ini(
+                                               struct primordial * ppm,
+                                               struct precision * ppr,
+                                               double * y_ini,
+                                               double * y_bg_ini
+                                               );
+
   int primordial_inflation_one_wavenumber(
                                           struct perturbs * ppt,
                                           struct primordial * ppm,
                                           struct precision * ppr,
-                                          double * y_ini,
+                                          double * y_bg_ini,
                                           int index_k
                                           );
 
@@ -504,6 +551,27 @@ extern "C" {
                                         struct primordial * ppm
                                         );
 
+  int primordial_external_spectrum_cache_restore(
+                                                 struct perturbs * ppt,
+                                                 struct primordial * ppm,
+                                                 char * command,
+                                                 int * k_size,
+                                                 double ** k,
+                                                 double ** pks,
+                                                 double ** pkt,
+                                                 short * found
+                                                 );
+
+  int primordial_external_spectrum_cache_store(
+                                               struct perturbs * ppt,
+                                               struct primordial * ppm,
+                                               char * command,
+                                               int k_size,
+                                               double * k,
+                                               double * pks,
+                                               double * pkt
+                                               );
+
   int primordial_output_titles(struct perturbs * ppt,
                                struct primordial * ppm,
                                char titles[_MAXTITLESTRINGLENGTH_]
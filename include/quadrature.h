@@ -2,6 +2,7 @@
 #define __QSS__
 
 #define _MIN_NUMBER_OF_LAGUERRE_POINTS_ 5
+#define _QSS_CACHE_PROBES_ 64 /**< number of momenta at which the distribution is evaluated to build the key of a cached q-sampling */
 
 /******************************************/
 /* Quadrature Sampling Strategy for CLASS */
@@ -10,7 +11,7 @@
 /******************************************/
 #include "common.h"
 
-enum ncdm_quadrature_method {qm_auto, qm_Laguerre, qm_trapz_indefinite, qm_trapz};
+enum ncdm_quadrature_method {qm_auto, qm_Laguerre, qm_trapz_indefinite, qm_trapz, qm_compressed};
 
 /* Structures for QSS */
 
@@ -41,6 +42,26 @@ typedef struct adaptive_integration_tree_node{
 			int (*function)(void * params_for_function, double q, double *f0),
 			void * params_for_function,
 			ErrorMsg errmsg);
+      int get_qsampling_cached(double *x,
+			       double *w,
+			       int *N,
+			       int N_max, double rtol,
+			       double *qvec,
+			       int qsiz,
+			       int (*test)(void * params_for_function, double q, double *psi),
+			       int (*function)(void * params_for_function, double q, double *f0),
+			       void * params_for_function,
+			       char * cache_directory,
+			       ErrorMsg errmsg);
+      int qsampling_cache_key(int N_max,
+			      double rtol,
+			      double *qvec,
+			      int qsiz,
+			      int (*test)(void * params_for_function, double q, double *psi),
+			      int (*function)(void * params_for_function, double q, double *f0),
+			      void * params_for_function,
+			      unsigned long long * key,
+			      ErrorMsg errmsg);
        int get_qsampling_manual(double *x,
 				double *w,
 				int N,
@@ -52,6 +73,20 @@ typedef struct adaptive_integration_tree_node{
 				void * params_for_function,
 				ErrorMsg errmsg);
 
+      int get_qsampling_empirical(double *x_in,
+				  double *w_in,
+				  int N_in,
+				  double *g,
+				  int R,
+				  double rtol,
+				  int N_min,
+				  int N_max,
+				  double *x,
+				  double *w,
+				  int *N,
+				  double *error,
+				  ErrorMsg errmsg);
+
       int sort_x_and_w(double *x, double *w, double *workx, double *workw, int startidx, int endidx);
       int get_leaf_x_and_w(qss_node *node, int *ind, double *x, double *w,int isindefinite);
       int reduce_tree(qss_node *node, int level);
@@ -5,6 +5,8 @@
 
 #include "transfer.h"
 
+#define _SELECTION_PAIR_NUM_MAX_ 1000 /**< maximum number of pairs of bins in non_diagonal_pairs */
+
 /**
  * Structure containing everything about anisotropy and Fourier power spectra that other modules need to know.
  *
@@ -31,6 +33,23 @@ struct spectra {
                    and number of bins minus one means all
                    correlations */
 
+  int non_diag_pair_num; /**< number of pairs of bins in non_diag_pair; when
+                            non-zero, the cross-correlation spectra of these
+                            pairs only are computed, instead of those set
+                            by non_diag */
+
+  int non_diag_pair[2*_SELECTION_PAIR_NUM_MAX_]; /**< bins (starting from 0) of each pair,
+                                                    non_diag_pair[2*index_pair] and
+                                                    non_diag_pair[2*index_pair+1] */
+
+  double non_diag_max_gap; /**< when positive, the cross-correlation spectra
+                              \f$ C_l^{dd} \f$ and \f$ C_l^{dl} \f$ of two bins whose
+                              selection functions are separated by more than
+                              this comoving distance (in Mpc) are not
+                              computed, provided that the number counts only
+                              include local contributions (density, rsd,
+                              doppler) */
+
   //@}
 
   /** @name - information on number of modes and pairs of initial conditions */
@@ -71,15 +90,22 @@ struct spectra {
   int index_ct_pp; /**< index for type \f$ C_l^{\phi\phi} \f$*/
   int index_ct_tp; /**< index for type \f$ C_l^{T\phi} \f$*/
   int index_ct_ep; /**< index for type \f$ C_l^{E\phi} \f$*/
-  int index_ct_dd; /**< first index for type \f$ C_l^{dd} \f$((d_size*d_size-(d_size-non_diag)*(d_size-non_diag-1)/2) values) */
+  int index_ct_dd; /**< first index for type \f$ C_l^{dd} \f$(dd_pair_num values) */
   int index_ct_td; /**< first index for type \f$ C_l^{Td} \f$(d_size values) */
   int index_ct_pd; /**< first index for type \f$ C_l^{pd} \f$(d_size values) */
-  int index_ct_ll; /**< first index for type \f$ C_l^{ll} \f$((d_size*d_size-(d_size-non_diag)*(d_size-non_diag-1)/2) values) */
+  int index_ct_ll; /**< first index for type \f$ C_l^{ll} \f$(ll_pair_num values) */
   int index_ct_tl; /**< first index for type \f$ C_l^{Tl} \f$(d_size values) */
-  int index_ct_dl; /**< first index for type \f$ C_l^{dl} \f$(d_size values) */
+  int index_ct_dl; /**< first index for type \f$ C_l^{dl} \f$(dl_pair_num values) */
 
   int d_size;      /**< number of bins for which density Cl's are computed */
 
+  int dd_pair_num; /**< number of pairs of bins for which \f$ C_l^{dd} \f$ is computed */
+  int * dd_pair;   /**< bins of each of these pairs, dd_pair[2*index_pair] <= dd_pair[2*index_pair+1], stored at index_ct = index_ct_dd+index_pair */
+  int ll_pair_num; /**< number of pairs of bins for which \f$ C_l^{ll} \f$ is computed */
+  int * ll_pair;   /**< bins of each of these pairs, ll_pair[2*index_pair] <= ll_pair[2*index_pair+1], stored at index_ct = index_ct_ll+index_pair */
+  int dl_pair_num; /**< number of pairs of bins for which \f$ C_l^{dl} \f$ is computed */
+  int * dl_pair;   /**< bins of each of these pairs, density bin dl_pair[2*index_pair] and lensing bin dl_pair[2*index_pair+1], stored at index_ct = index_ct_dl+index_pair */
+
   int ct_size; /**< number of \f$ C_l \f$ types requested */
 
   //@}
@@ -132,6 +158,8 @@ struct spectra {
                             deprecated functions are removed, it will
                             be possible to remove also this pointer. */
 
+  size_t memory_size; /**< bytes kept on the heap by this structure at the end of spectra_init() (growth of class_memory_heap() during it) */
+
   short spectra_verbose; /**< flag regulating the amount of information sent to standard output (none if set to zero) */
 
   ErrorMsg error_message; /**< zone for writing error messages */
@@ -175,6 +203,7 @@ extern "C" {
                    );
 
   int spectra_indices(
+                      struct precision * ppr,
                       struct background * pba,
                       struct perturbs * ppt,
                       struct transfers * ptr,
@@ -182,7 +211,16 @@ extern "C" {
                       struct spectra * psp
                       );
 
+  int spectra_bin_pairs(
+                        struct precision * ppr,
+                        struct background * pba,
+                        struct perturbs * ppt,
+                        struct transfers * ptr,
+                        struct spectra * psp
+                        );
+
   int spectra_cls(
+                  struct precision * ppr,
                   struct background * pba,
                   struct perturbs * ppt,
                   struct transfers * ptr,
@@ -191,22 +229,40 @@ extern "C" {
                   );
 
   int spectra_compute_cl(
-                         struct background * pba,
                          struct perturbs * ppt,
                          struct transfers * ptr,
-                         struct primordial * ppm,
                          struct spectra * psp,
                          int index_md,
                          int index_ic1,
                          int index_ic2,
                          int index_l,
-                         int cl_integrand_num_columns,
-                         double * cl_integrand,
-                         double * primordial_pk,
+                         double * cl_weight,
                          double * transfer_ic1,
                          double * transfer_ic2
                          );
 
+  int spectra_transfer_combinations(
+                                    struct perturbs * ppt,
+                                    struct transfers * ptr,
+                                    struct spectra * psp,
+                                    int index_md,
+                                    int index_ic,
+                                    int index_l,
+                                    int q_index_min,
+                                    int q_index_max,
+                                    double * transfer
+                                    );
+
+  double spectra_cl_integral(
+                             double * __restrict__ cl_weight,
+                             int q_index_min,
+                             int q_index_max,
+                             double * transfer1_a,
+                             double * transfer2_b,
+                             double * transfer1_b,
+                             double * transfer2_a
+                             );
+
   int spectra_k_and_tau(
                         struct background * pba,
                         struct perturbs * ppt,
@@ -4,6 +4,7 @@
 #define __THERMODYNAMICS__
 
 #include "background.h"
+#include "filecache.h"
 //#include "arrays.h"
 //#include "helium.h"
 //#include "hydrogen.h"
@@ -209,6 +210,18 @@ struct thermo
 
   //@}
 
+  /** @name - index of the table on a uniform grid in \f$ \ln(1+z) \f$, for finding intervals without a search */
+
+  //@{
+
+  short has_index_table;   /**< _TRUE_ if the index below is allocated and used by thermodynamics_at_z() */
+  int tt_index_size;       /**< number of nodes in the uniform \f$ \ln(1+z) \f$ grid */
+  double lnz_index_min;    /**< \f$ \ln(1+z) \f$ at the first node */
+  double dlnz_index;       /**< spacing of the uniform \f$ \ln(1+z) \f$ grid */
+  int * index_table;       /**< index_table[index] is the last line of z_table with a redshift smaller or equal to the one of node index */
+
+  //@}
+
 
   /** @name - characteristic quantities like redshift, conformal time and sound horizon at recombination */
 
@@ -273,6 +286,8 @@ struct thermo
 
   //@{
 
+  size_t memory_size; /**< bytes kept on the heap by this structure at the end of thermodynamics_init() (growth of class_memory_heap() during it) */
+
   short thermodynamics_verbose; /**< flag regulating the amount of information sent to standard output (none if set to zero) */
 
   ErrorMsg error_message; /**< zone for writing error messages */
@@ -372,6 +387,12 @@ struct recombination {
   double annihilation_f_halo; /**< takes the contribution of DM annihilation in halos into account*/
   double annihilation_z_halo; /**< characteristic redshift for DM annihilation in halos*/
 
+  short has_injection_table;  /**< _TRUE_ if thermodynamics_energy_injection() interpolates the table below */
+  int injection_table_size;   /**< number of points in this table, uniformly spaced in \f$ \ln(1+z) \f$ starting from z=0 */
+  double injection_dlnz;      /**< spacing of the table in \f$ \ln(1+z) \f$ */
+  double * injection_table;   /**< logarithm of the effective energy injection rate on this grid */
+  double * injection_ddtable; /**< its second derivative with respect to \f$ \ln(1+z) \f$, for spline interpolation */
+
   //@}
 
 };
@@ -479,6 +500,37 @@ struct thermodynamics_parameters_and_workspace {
 
 };
 
+/**
+ * Number of background and thermodynamics parameters on which the
+ * recombination history depends (besides the precision parameters
+ * and the background table), see thermodynamics_recombination_cache_key()
+ */
+
+#define _RECOMBINATION_CACHE_KEY_SIZE_ 25
+
+/**
+ * Recombination history computed by the last call to
+ * thermodynamics_init(), together with all the inputs it depends on.
+ * It is kept by the thermodynamics module across runs, so that the
+ * recombination is not solved again when only the reionization
+ * parameters (or parameters of later modules) change.
+ */
+
+struct recombination_cache {
+
+  short has_history;          /**< _TRUE_ if the fields below are filled */
+
+  struct precision pr;        /**< precision parameters used for this history */
+  double key[_RECOMBINATION_CACHE_KEY_SIZE_]; /**< background and thermodynamics parameters used for this history */
+  int bt_size;                /**< number of lines of the background table used for this history */
+  int bg_size;                /**< number of columns of the background table used for this history */
+  double * background_table;  /**< copy of this background table */
+
+  struct recombination reco;  /**< recombination history, owning a copy of its tables */
+  double n_e;                 /**< number of electrons today set by the recombination module */
+
+};
+
 /**************************************************************/
 /* @cond INCLUDE_WITH_DOXYGEN */
 /*
@@ -515,6 +567,11 @@ extern "C" {
                              struct reionization * preio
                              );
 
+  int thermodynamics_index_table_init(
+                                      struct precision * ppr,
+                                      struct thermo * pth
+                                      );
+
   int thermodynamics_helium_from_bbn(
 				     struct precision * ppr,
 				     struct background * pba,
@@ -539,6 +596,32 @@ extern "C" {
 				      ErrorMsg error_message
 				      );
 
+  int thermodynamics_energy_injection_table_init(
+                                                 struct precision * ppr,
+                                                 struct background * pba,
+                                                 struct recombination * preco,
+                                                 ErrorMsg error_message
+                                                 );
+
+  int thermodynamics_energy_injection_table_free(
+                                                 struct recombination * preco
+                                                 );
+
+  int thermodynamics_recombination_cache_restore(
+                                                 struct precision * ppr,
+                                                 struct background * pba,
+                                                 struct thermo * pth,
+                                                 struct recombination * preco,
+                                                 short * found
+                                                 );
+
+  int thermodynamics_recombination_cache_store(
+                                               struct precision * ppr,
+                                               struct background * pba,
+                                               struct thermo * pth,
+                                               struct recombination * preco
+                                               );
+
   int thermodynamics_reionization_function(
 					   double z,
 					   struct thermo * pth,
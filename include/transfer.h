@@ -24,6 +24,14 @@
           (_index_tt_in_range_(ptr->index_tt_nc_g1,   ppt->selection_num, ppt->has_nc_gr))  || \
           (_index_tt_in_range_(ptr->index_tt_nc_g2,   ppt->selection_num, ppt->has_nc_gr))  || \
           (_index_tt_in_range_(ptr->index_tt_nc_g3,   ppt->selection_num, ppt->has_nc_gr))
+/* macro: index of the row of transfer functions of mode index_md for a given initial condition, type and multipole */
+#define _transfer_row_(ptr,index_md,index_ic,index_tt,index_l) ((((index_ic) * (ptr)->tt_size[index_md] + (index_tt)) * (ptr)->l_size[index_md] + (index_l)))
+/* macro: test if the transfer function of a row is stored for index_q (otherwise it is zero) */
+#define _transfer_is_stored_(ptr,index_md,index_row,index_q) (((index_q) >= (ptr)->q_index_min[index_md][index_row]) && ((index_q) < (ptr)->q_index_max[index_md][index_row]))
+/* macro: stored transfer function of a row (can be assigned; only valid when _transfer_is_stored_() is true) */
+#define _transfer_stored_(ptr,index_md,index_row,index_q) ((ptr)->transfer[index_md][(ptr)->transfer_offset[index_md][index_row]+(index_q)])
+/* macro: transfer function of a row for any index_q */
+#define _transfer_value_(ptr,index_md,index_row,index_q) (_transfer_is_stored_(ptr,index_md,index_row,index_q) ? _transfer_stored_(ptr,index_md,index_row,index_q) : 0.)
 /* macro: bin number associated to particular redshift bin and selection function for non-integrated contributions*/
 #define _get_bin_nonintegrated_ncl_(index_tt)                                                      \
       if (_index_tt_in_range_(ptr->index_tt_density, ppt->selection_num, ppt->has_nc_density))     \
@@ -110,6 +118,10 @@ struct transfers {
   double * nz_evo_dlog_nz;    /**< log of tabulated values of evolution function */
   double * nz_evo_dd_dlog_nz; /**< second derivatives in splined log of evolution function */
 
+  FileName bessel_cache_directory; /**< if not empty, directory where the table of flat spherical Bessel functions is stored once computed, and from which it is read (memory-mapped) in later runs */
+
+  int l_block_size; /**< if positive and smaller than the number of multipoles, the transfer functions are not stored by transfer_init(): the spectra module computes them by blocks of l_block_size multipoles with transfer_compute_l_block(), and frees each block once its \f$ C_l \f$'s are known */
+
   //@}
 
   /** @name - flag stating whether we need transfer functions at all */
@@ -179,13 +191,29 @@ struct transfers {
 
   int index_q_flat_approximation; /**< index of the first q value using the flat rescaling approximation */
 
+  double q_adaptive_error_cmb; /**< with adaptive sampling in q, estimated relative error on the integrand of the \f$ C_l \f$'s of CMB types due to the sampling in q (see transfer_q_adaptive_sampling()) */
+
+  double q_adaptive_error_lss; /**< same for number count and lensing types */
+
   //@}
 
   /** @name - transfer functions */
 
   //@{
 
-  double ** transfer; /**< table of transfer functions for each mode, initial condition, type, multipole and wavenumber, with argument transfer[index_md][((index_ic * ptr->tt_size[index_md] + index_tt) * ptr->l_size[index_md] + index_l) * ptr->q_size + index_q] */
+  double ** transfer; /**< table of transfer functions for each mode, initial condition, type, multipole and wavenumber. Each row index_row = (index_ic * ptr->tt_size[index_md] + index_tt) * ptr->l_size[index_md] + index_l only stores the wavenumbers q_index_min[index_md][index_row] <= index_q < q_index_max[index_md][index_row], the transfer function being zero elsewhere: use the macros _transfer_row_(), _transfer_is_stored_(), _transfer_stored_() and _transfer_value_() to access it */
+
+  int ** q_index_min; /**< first index of wavenumber of the stored (non-negligible) part of each row of transfer functions, q_index_min[index_md][index_row] */
+
+  int ** q_index_max; /**< index of wavenumber following the last one of the stored part of each row, q_index_max[index_md][index_row] (equal to q_index_min for an empty row) */
+
+  long ** transfer_offset; /**< position in transfer[index_md] of the (possibly not stored) element index_q=0 of each row, transfer_offset[index_md][index_row], so that a stored element is transfer[index_md][transfer_offset[index_md][index_row]+index_q] */
+
+  long * transfer_size; /**< number of stored transfer functions for each mode */
+
+  struct transfer_stream * stream; /**< NULL when transfer_init() stores all transfer functions; otherwise, everything needed to compute them by blocks of multipoles (see l_block_size) */
+
+  short tables_released; /**< _TRUE_ once transfer_release_tables() has freed the transfer functions (low_memory profile, see ppt->low_memory): the spectra module can only be computed again after transfer_init() */
 
   //@}
 
@@ -195,6 +223,10 @@ struct transfers {
 
   short initialise_HIS_cache; /**< only true if we are using CLASS for setting up a cache of HIS structures */
 
+  int HIS_cache_hits; /**< number of values of nu for which the hyperspherical Bessel functions were found in the in-memory cache of previous runs (curved models) */
+
+  size_t memory_size; /**< bytes kept on the heap by this structure at the end of transfer_init() (growth of class_memory_heap() during it) */
+
   short transfer_verbose; /**< flag regulating the amount of information sent to standard output (none if set to zero) */
 
   ErrorMsg error_message; /**< zone for writing error messages */
@@ -202,6 +234,92 @@ struct transfers {
   //@}
 };
 
+/**
+ * Entry of the in-memory cache of hyperspherical interpolation
+ * structures of curved models (see transfer_HIS_cache_fetch()): the
+ * structure, and those arguments of hyperspherical_HIS_create() which
+ * are not stored in it.
+ */
+
+struct transfer_HIS_cache_entry {
+
+  HyperInterpStruct HIS; /**< interpolation structure */
+  double xmin;           /**< smallest x */
+  double xmax;           /**< largest x */
+  double sampling;       /**< number of points per approximate wavelength */
+  double phiminabs;      /**< value of hyper_phi_min_abs */
+  long last_use;         /**< time of last use (a counter), 0 for an empty entry */
+
+};
+
+/**
+ * Everything transfer_compute_l_block() needs to compute the transfer
+ * functions of a block of multipoles, kept by transfer_init() from
+ * the end of the initialization until transfer_free() when l_block_size
+ * is set.
+ */
+
+struct transfer_stream {
+
+  struct perturbs * ppt;     /**< perturbation structure the sources are taken from */
+  struct nonlinear * pnl;    /**< nonlinear structure (for freeing the sources) */
+  int ** tp_of_tt;           /**< correspondence between perturbation and transfer types */
+  int tau_size_max;          /**< maximum number of sampling times of the transfer sources */
+  double tau_rec;            /**< recombination time */
+  double tau0;               /**< conformal age */
+  double tau0_minus_tau_cut; /**< tau0 minus the time below which the CMB sources are cut */
+  double *** sources;        /**< perturbation sources, possibly with non-linear corrections */
+  double *** sources_spline; /**< their second derivatives with respect to k */
+  double * window;           /**< precomputed selection functions */
+  HyperInterpStruct BIS;     /**< flat spherical Bessel functions */
+  void * BIS_map;            /**< if not NULL, BIS was read from the cache and points inside this map */
+  size_t BIS_map_size;       /**< size of this map */
+
+};
+
+/**
+ * Tables of one redshift bin, shared by all the number count and
+ * lensing types of this bin in transfer_precompute_selection(): time
+ * samplings, selection function, and the background quantities
+ * needed by the window functions, evaluated once per time.
+ */
+
+struct transfer_selection_table {
+
+  /** @name - non-integrated contributions (density, rsd, doppler, gr) */
+
+  //@{
+
+  int tau_size;             /**< number of times in the selection function sampling */
+  double * tau0_minus_tau;  /**< sampled values of (tau0-tau) */
+  double * w_trapz;         /**< trapezoidal weights of this sampling */
+  double * selection;       /**< selection function W(tau) at these times */
+  double * a;               /**< scale factor at these times */
+  double * H;               /**< Hubble rate at these times */
+  double * H_prime;         /**< its conformal time derivative */
+  double * cotKgen;         /**< cotangent of (tau0-tau) generalized to curved space */
+  double * f_evo;           /**< source evolution factor (only when rsd or gr contributions are requested, zero otherwise) */
+
+  //@}
+
+  /** @name - integrated contributions (lensing, g4, g5) */
+
+  //@{
+
+  int tau_sources_size;             /**< number of times in the sampling of the sources */
+  double * tau0_minus_tau_sources;  /**< sampled values of (tau0-tau) for the sources */
+  double * w_trapz_sources;         /**< trapezoidal weights of this sampling */
+  double * selection_sources;       /**< selection function of the sources */
+  double * sinKgen_sources;         /**< sine of (tau0-tau) generalized to curved space, for the sources */
+  double * cotKgen_sources;         /**< cotangent of (tau0-tau) generalized to curved space, for the sources */
+  double * g5_sources;              /**< background-dependent factor of the g5 contribution for each source (only when gr contributions are requested) */
+  int tau_lensing_size;             /**< number of times in the lensing sampling, from the sources to today */
+  double * tau0_minus_tau_lensing;  /**< sampled values of (tau0-tau) for the lenses */
+
+  //@}
+
+};
+
 /**
  * Structure containing all the quantities that each thread needs to
  * know for computing transfer functions (but that can be forgotten
@@ -262,6 +380,12 @@ struct transfer_workspace {
 
   double tau0_minus_tau_cut; /**< critical value of (tau0-tau) in time cut approximation for the wavenumber at hand */
   short neglect_late_source; /**< flag stating whether we use the time cut approximation for the wavenumber at hand */
+
+  short use_fused_kernel; /**< copy of the precision parameter transfer_fused_kernel */
+
+  double * radial_scratch; /**< scratch space of size 6*tau_size_max for transfer_integrate() and transfer_radial_function(): radial function, Phi, dPhi, d2Phi, reversed chi and rescaling function */
+
+  struct transfer_workspace ** ptw_of_thread; /**< workspaces of all threads, indexed by thread number: a tile of multipoles computed by another thread than the owner of this workspace uses the scratch space of that thread */
 };
 
 /**
@@ -327,6 +451,56 @@ extern "C" {
                                     int sgnK
                                     );
 
+  int transfer_source_tau0_minus_tau_max(
+                                         struct precision * ppr,
+                                         struct background * pba,
+                                         struct perturbs * ppt,
+                                         struct transfers * ptr,
+                                         double tau_rec,
+                                         double tau0,
+                                         int index_md,
+                                         int index_tt,
+                                         double * tau0_minus_tau_max
+                                         );
+
+  int transfer_storage_init(
+                            struct precision * ppr,
+                            struct background * pba,
+                            struct perturbs * ppt,
+                            struct transfers * ptr,
+                            double tau_rec,
+                            int index_l_min,
+                            int index_l_max,
+                            HyperInterpStruct * pBIS
+                            );
+
+  int transfer_storage_free(
+                            struct transfers * ptr
+                            );
+
+  int transfer_compute_l_block(
+                               struct precision * ppr,
+                               struct background * pba,
+                               struct perturbs * ppt,
+                               struct transfers * ptr,
+                               int index_l_min,
+                               int index_l_max
+                               );
+
+  int transfer_release_perturbation_sources(
+                                            struct perturbs * ppt,
+                                            struct transfers * ptr
+                                            );
+
+  int transfer_release_tables(
+                              struct perturbs * ppt,
+                              struct transfers * ptr
+                              );
+
+  int transfer_stream_free(
+                           struct transfers * ptr
+                           );
+
   int transfer_perturbation_copy_sources_and_nl_corrections(
                                                             struct perturbs * ppt,
                                                             struct nonlinear * pnl,
@@ -337,6 +511,7 @@ extern "C" {
   int transfer_perturbation_source_spline(
                                           struct perturbs * ppt,
                                           struct transfers * ptr,
+                                          int ** tp_of_tt,
                                           double *** sources,
                                           double *** sources_spline
                                           );
@@ -378,6 +553,13 @@ extern "C" {
                              int sgnK
                              );
 
+  int transfer_get_index_q_flat_approximation(
+                                              struct precision * ppr,
+                                              struct transfers * ptr,
+                                              double K,
+                                              int sgnK
+                                              );
+
   int transfer_get_k_list(
                           struct perturbs * ppt,
                           struct transfers * ptr,
@@ -417,6 +599,72 @@ extern "C" {
                                int * tau_size
                                );
 
+  int transfer_compute_for_all_q(
+                                 struct precision * ppr,
+                                 struct background * pba,
+                                 struct perturbs * ppt,
+                                 struct transfers * ptr,
+                                 int ** tp_of_tt,
+                                 int tau_size_max,
+                                 double tau_rec,
+                                 double tau0,
+                                 double tau0_minus_tau_cut,
+                                 double *** sources,
+                                 double *** sources_spline,
+                                 double * window,
+                                 HyperInterpStruct * pBIS
+                                 );
+
+  int transfer_mpi_partition(
+                             struct perturbs * ppt,
+                             struct transfers * ptr,
+                             int * q_rank
+                             );
+
+  int transfer_mpi_gather(
+                          struct perturbs * ppt,
+                          struct transfers * ptr,
+                          int * q_rank
+                          );
+
+  int transfer_q_adaptive_sampling(
+                                   struct precision * ppr,
+                                   struct background * pba,
+                                   struct perturbs * ppt,
+                                   struct transfers * ptr,
+                                   int ** tp_of_tt,
+                                   int tau_size_max,
+                                   double tau_rec,
+                                   double tau0,
+                                   double tau0_minus_tau_cut,
+                                   double *** sources,
+                                   double *** sources_spline,
+                                   double * window,
+                                   HyperInterpStruct * pBIS
+                                   );
+
+  int transfer_q_adaptive_probe(
+                                struct precision * ppr,
+                                struct background * pba,
+                                struct perturbs * ppt,
+                                struct transfers * ptr,
+                                int ** tp_of_tt,
+                                int tau_size_max,
+                                double tau_rec,
+                                double tau0,
+                                double tau0_minus_tau_cut,
+                                double *** sources,
+                                double *** sources_spline,
+                                double * window,
+                                HyperInterpStruct * pBIS,
+                                double * q_probe,
+                                int q_probe_size,
+                                int probe_size,
+                                int * probe_md,
+                                int * probe_row,
+                                double ** values
+                                );
+
   int transfer_compute_for_each_q(
                                   struct precision * ppr,
                                   struct background * pba,
@@ -448,6 +696,7 @@ extern "C" {
                                    int index_type,
                                    double * sources,
                                    double * source_spline,
+                                   int * last_index,
                                    double * interpolated_sources
                                    );
 
@@ -538,6 +787,22 @@ extern "C" {
                                  double tau0,
                                  int bin);
 
+  int transfer_compute_for_l_tile(
+                                  struct precision * ppr,
+                                  struct background * pba,
+                                  struct perturbs * ppt,
+                                  struct transfers * ptr,
+                                  struct transfer_workspace * ptw,
+                                  int index_q,
+                                  int index_md,
+                                  int index_ic,
+                                  int index_tt,
+                                  int index_l_min,
+                                  int index_l_max,
+                                  double tau_rec,
+                                  radial_function_type radial_type
+                                  );
+
   int transfer_compute_for_each_l(
                                   struct transfer_workspace * ptw,
                                   struct precision * ppr,
@@ -587,15 +852,29 @@ extern "C" {
                       double l,
                       double q,
                       radial_function_type radial_type,
+                      int * last_index,
                       double * trsf
                       );
 
+  int transfer_limber_batch(
+                            struct transfers * ptr,
+                            struct transfer_workspace * ptw,
+                            int index_md,
+                            int index_q,
+                            int index_ic,
+                            int index_tt,
+                            radial_function_type radial_type,
+                            int * index_l_limber,
+                            int l_limber_size
+                            );
+
   int transfer_limber_interpolate(
                                   struct transfers * ptr,
                                   double * tau0_minus_tau,
                                   double * sources,
                                   int tau_size,
                                   double tau0_minus_tau_limber,
+                                  int * last_index,
                                   double * S
                                   );
 
@@ -688,6 +967,36 @@ extern "C" {
                           double tau0
                            );
 
+  int transfer_HIS_cache_resize(
+                                int size,
+                                ErrorMsg error_message
+                                );
+
+  int transfer_HIS_cache_free(
+                              ErrorMsg error_message
+                              );
+
+  int transfer_HIS_cache_fetch(
+                               struct transfers * ptr,
+                               struct transfer_workspace * ptw,
+                               double nu,
+                               int l_size,
+                               double xmin,
+                               double xmax,
+                               double sampling,
+                               double phiminabs,
+                               short * found
+                               );
+
+  int transfer_HIS_cache_store(
+                               struct transfers * ptr,
+                               struct transfer_workspace * ptw,
+                               double xmin,
+                               double xmax,
+                               double sampling,
+                               double phiminabs
+                               );
+
   int transfer_get_lmax(int (*get_xmin_generic)(int sgnK,
                                                 int l,
                                                 double nu,
@@ -716,6 +1025,22 @@ extern "C" {
                      double ** window
                      );
 
+  int transfer_selection_table_init(
+                                    struct precision * ppr,
+                                    struct background * pba,
+                                    struct perturbs * ppt,
+                                    struct transfers * ptr,
+                                    double tau_rec,
+                                    double tau0,
+                                    int bin,
+                                    double * pvecback,
+                                    struct transfer_selection_table * pst
+                                    );
+
+  int transfer_selection_table_free(
+                                    struct transfer_selection_table * pst
+                                    );
+
   int transfer_f_evo(
                    struct background* pba,
                    struct transfers * ptr,
@@ -18,11 +18,32 @@ int main(int argc, char **argv) {
   struct output op;           /* for output files */
   ErrorMsg errmsg;            /* for error messages */
 
+  /* in an MPI run (compiled with -D_MPI_), each process runs the whole
+     computation, sharing the loops over wavenumbers of the perturbation
+     and transfer modules with the others; only the first one prints
+     and writes the output files */
+  if (class_mpi_init(&argc,&argv) == _FAILURE_) {
+    printf("\n\nError running class_mpi_init\n");
+    return _FAILURE_;
+  }
+
   if (input_init_from_arguments(argc, argv,&pr,&ba,&th,&pt,&tr,&pm,&sp,&nl,&le,&op,errmsg) == _FAILURE_) {
     printf("\n\nError running input_init_from_arguments \n=>%s\n",errmsg);
     return _FAILURE_;
   }
 
+  if (class_mpi_rank() > 0) {
+    ba.background_verbose = 0;
+    th.thermodynamics_verbose = 0;
+    pt.perturbations_verbose = 0;
+    pm.primordial_verbose = 0;
+    nl.nonlinear_verbose = 0;
+    tr.transfer_verbose = 0;
+    sp.spectra_verbose = 0;
+    le.lensing_verbose = 0;
+    op.output_verbose = 0;
+  }
+
   if (background_init(&pr,&ba) == _FAILURE_) {
     printf("\n\nError running background_init \n=>%s\n",ba.error_message);
     return _FAILURE_;
@@ -63,11 +84,15 @@ int main(int argc, char **argv) {
     return _FAILURE_;
   }
 
-  if (output_init(&ba,&th,&pt,&pm,&tr,&sp,&nl,&le,&op) == _FAILURE_) {
+  if ((class_mpi_rank() == 0) && (output_init(&ba,&th,&pt,&pm,&tr,&sp,&nl,&le,&op) == _FAILURE_)) {
     printf("\n\nError in output_init \n=>%s\n",op.error_message);
     return _FAILURE_;
   }
 
+  /* with -DCLASS_PROFILE, print the calls of the profiled functions and the time spent in them */
+  if (class_mpi_rank() == 0)
+    class_profile_print(stdout);
+
   /****** all calculations done, now free the structures ******/
 
   if (lensing_free(&le) == _FAILURE_) {
@@ -110,6 +135,11 @@ int main(int argc, char **argv) {
     return _FAILURE_;
   }
 
+  if (class_mpi_finalize() == _FAILURE_) {
+    printf("\n\nError running class_mpi_finalize\n");
+    return _FAILURE_;
+  }
+
   return _SUCCESS_;
 
 }
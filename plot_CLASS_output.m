@@ -6,6 +6,8 @@ function plot_CLASS_output(datafiles,varargin)
 %  Thomas Tram, 12th of March 2014. thomas.tram@epfl.ch
 %  Small plot utility for plotting background, thermodynamics and
 %  perturbations files. (Compatibility with other files may be added later.)
+%  Binary .npy files (written with format = class npy) are mapped with
+%  memmapfile.
 %  Examples:
 %
 %    plot_CLASS_output('c:\class\test_background.dat')
@@ -73,29 +75,45 @@ for fileidx = 1:length(datafiles)
     linestyle = linestyles{mod(fileidx-1,length(linestyles))+1};
     datafile = datafiles{fileidx};
     
-    %Find column titles:
-    fid = fopen(datafile);
-    titleline = 0;
-    tline = fgetl(fid);
-    while tline(1)=='#'
-        titleline = titleline+1;
-        tline_old = tline;
+    [~,~,ext] = fileparts(datafile);
+    if strcmp(ext,'.npy')
+        %Binary file (format = class npy): the column titles are the
+        %field names in the header, followed by the records of doubles
+        fid = fopen(datafile,'r','l');
+        fread(fid,8,'uint8');
+        headerlength = fread(fid,1,'uint16');
+        header = fread(fid,[1 headerlength],'uint8=>char');
+        fclose(fid);
+        cellnames = regexp(header,'\(''((?:[^''\\]|\\.)*)'', ''[<>]f8''\)','tokens');
+        cellnames = regexprep(cellfun(@(c) c{1},cellnames,'UniformOutput',false),'\\(.)','$1');
+        rows = str2double(regexp(header,'''shape'': \((\d+),','tokens','once'));
+        m = memmapfile(datafile,'Offset',10+headerlength,'Format',{'double',[length(cellnames) rows],'x'});
+        data = m.Data.x';
+    else
+        %Find column titles:
+        fid = fopen(datafile);
+        titleline = 0;
         tline = fgetl(fid);
-    end
-    fclose(fid);
-    
-%     S=importdata(datafile);
-%     data = S.data;
-%    titlestring = S.textdata{titleline};
-    titlestring = tline_old;
-    S = importdata(datafile,' ',titleline);
-    data = S.data;
-    
-    %remove leading #
-    titlestring = titlestring(2:end);
-    colonidx = [find(titlestring==':'),length(titlestring)+1];
-    for j=1:(length(colonidx)-1)
-        cellnames{j} = strtrim(titlestring(colonidx(j)+1:colonidx(j+1)-3));
+        while tline(1)=='#'
+            titleline = titleline+1;
+            tline_old = tline;
+            tline = fgetl(fid);
+        end
+        fclose(fid);
+
+%         S=importdata(datafile);
+%         data = S.data;
+%        titlestring = S.textdata{titleline};
+        titlestring = tline_old;
+        S = importdata(datafile,' ',titleline);
+        data = S.data;
+
+        %remove leading #
+        titlestring = titlestring(2:end);
+        colonidx = [find(titlestring==':'),length(titlestring)+1];
+        for j=1:(length(colonidx)-1)
+            cellnames{j} = strtrim(titlestring(colonidx(j)+1:colonidx(j+1)-3));
+        end
     end
     
     %Determine independent variable:
@@ -10,6 +10,8 @@ DEF _MAX_NUMBER_OF_K_FILES_ = 30
 DEF _MAXTITLESTRINGLENGTH_ = 8000
 DEF _FILENAMESIZE_ = 256
 DEF _LINE_LENGTH_MAX_ = 1024
+DEF _LRS_COUNTER_SIZE_ = 5
+DEF _CLASS_PROFILE_SIZE_ = 18
 
 cdef extern from "class.h":
 
@@ -46,8 +48,19 @@ cdef extern from "class.h":
     cdef struct precision:
         ErrorMsg error_message
 
+    cdef struct lrs_counters_struct "lrs_counters":
+        short is_enabled
+        long calls[_LRS_COUNTER_SIZE_]
+        double time[_LRS_COUNTER_SIZE_]
+
+    cdef struct class_profile_counters:
+        long calls[_CLASS_PROFILE_SIZE_]
+        double time[_CLASS_PROFILE_SIZE_]
+        class_profile_counters * next
+
     cdef struct background:
         ErrorMsg error_message
+        size_t memory_size
         int bg_size
         int index_bg_ang_distance
         int index_bg_lum_distance
@@ -57,6 +70,10 @@ cdef extern from "class.h":
         int index_bg_D
         int index_bg_f
         int index_bg_Omega_m
+        int index_bg_rho_lrs
+        int index_bg_p_lrs
+        int index_bg_phi_M_lrs
+        int index_bg_mT_over_T0_lrs
         short long_info
         short inter_normal
         short  has_ncdm
@@ -93,9 +110,16 @@ cdef extern from "class.h":
         double H_eq
         double z_eq
         double tau_eq
+        short has_lrs
+        short has_log10_lrs
+        double Omega0_lrs
+        double lrs_a_unstable
+
+        lrs_counters_struct lrs_counters
 
     cdef struct thermo:
         ErrorMsg error_message
+        size_t memory_size
         int th_size
         int index_th_xe
         int index_th_Tb
@@ -129,6 +153,8 @@ cdef extern from "class.h":
 
     cdef struct perturbs:
         ErrorMsg error_message
+        size_t memory_size
+        short sources_released
         short has_scalars
         short has_vectors
         short has_tensors
@@ -166,11 +192,16 @@ cdef extern from "class.h":
         int * ic_size
         int index_md_scalars
 
+        lrs_counters_struct lrs_counters
+
     cdef struct transfers:
         ErrorMsg error_message
+        size_t memory_size
+        short tables_released
 
     cdef struct primordial:
         ErrorMsg error_message
+        size_t memory_size
         double k_pivot
         double A_s
         double n_s
@@ -199,9 +230,12 @@ cdef extern from "class.h":
         double phi_min
         double phi_max
         int lnk_size
+        int (*external_pk_function)(double*, int, double*, double*, void*, char*)
+        void * external_pk_parameters
 
     cdef struct spectra:
         ErrorMsg error_message
+        size_t memory_size
         int has_tt
         int has_te
         int has_ee
@@ -221,6 +255,12 @@ cdef extern from "class.h":
         int md_size
         int d_size
         int non_diag
+        int dd_pair_num
+        int * dd_pair
+        int ll_pair_num
+        int * ll_pair
+        int dl_pair_num
+        int * dl_pair
         int index_ct_tt
         int index_ct_te
         int index_ct_ee
@@ -240,6 +280,7 @@ cdef extern from "class.h":
         ErrorMsg error_message
 
     cdef struct lensing:
+        size_t memory_size
         int has_tt
         int has_ee
         int has_te
@@ -270,6 +311,7 @@ cdef extern from "class.h":
         ErrorMsg error_message
 
     cdef struct nonlinear:
+        size_t memory_size
         short has_pk_matter
         int method
         int ic_size
@@ -298,6 +340,9 @@ cdef extern from "class.h":
         FileArg * name
         FileArg * value
         short * read
+        int * hash_table
+        int hash_size
+        int hash_names
 
     void lensing_free(void*)
     void spectra_free(void*)
@@ -312,8 +357,15 @@ cdef extern from "class.h":
     cdef int _FALSE_
     cdef int _TRUE_
 
+    short class_profile_is_enabled()
+    const char * class_profile_name(int index)
+    int class_profile_get(class_profile_counters * ptotal, class_profile_counters * pthreads, int thread_max, int * thread_num)
+    void class_profile_reset()
+    int class_memory_rss(size_t * rss, size_t * peak_rss)
+
     int input_init(void*, void*, void*, void*, void*, void*, void*, void*, void*,
         void*, void*, char*)
+    int input_free(void*, void*, void*, void*)
     int background_init(void*,void*)
     int thermodynamics_init(void*,void*,void*)
     int perturb_init(void*,void*,void*,void*)
@@ -325,6 +377,8 @@ cdef extern from "class.h":
 
     int background_tau_of_z(void* pba, double z,double* tau)
     int background_at_tau(void* pba, double tau, short return_format, short inter_mode, int * last_index, double *pvecback)
+    int background_lrs_batch(void * ppr, void * pba, int point_size, double * g_over_M, double * M_phi, double * m_F,
+                             int z_size, double * z, double * Omega0_lrs, double * a_unstable, double * background)
     int background_output_titles(void * pba, char titles[_MAXTITLESTRINGLENGTH_])
     int background_output_data(void *pba, int number_of_titles, double *data)
 
@@ -341,6 +395,7 @@ cdef extern from "class.h":
 
     int spectra_cl_at_l(void* psp,double l,double * cl,double * * cl_md,double * * cl_md_ic)
     int lensing_cl_at_l(void * ple,int l,double * cl_lensed)
+    int lensing_recompute(void * ppr,void * psp,double * cl_pp,void * ple) nogil
 
     int spectra_pk_at_z(
         void * pba,
@@ -412,6 +467,18 @@ cdef extern from "class.h":
         int sigma_output,
         double * result)
 
+    int nonlinear_sigmas_at_Rvec_and_zvec(
+        void * ppr,
+        void * pba,
+        void * pnl,
+        int index_pk,
+        double * Rvec,
+        int Rvec_size,
+        double * zvec,
+        int zvec_size,
+        double * sigma_vec,
+        double * dsigma_dlnR_vec) nogil
+
     int nonlinear_pks_at_kvec_and_zvec(
         void * pba,
         void * pnl,
@@ -73,6 +73,96 @@ class CosmoComputationError(CosmoError):
     pass
 
 
+# Ordered list of the CLASS modules run by Class.compute(), as in main.c
+_MODULE_ORDER = ["background", "thermodynamics", "perturb", "primordial",
+                 "nonlinear", "transfer", "spectra", "lensing"]
+
+# Earliest module which reads each input parameter, following the sections of
+# input_read_parameters() in source/input.c: the primordial spectrum
+# parameters of section (d) are only stored in the primordial structure
+# (except 'r', which can switch off tensor perturbations), the non-linear
+# parameters of section (f) other than 'non linear' itself are only stored in
+# the nonlinear structure, and each verbosity parameter of section (g) only
+# concerns its own module. Any parameter absent from this dictionary
+# (cosmological, output, precision parameters...) is assumed to be read by
+# the background module, so that changing it triggers a full recomputation.
+# Parameters mapped to "input" or "output" do not require re-running any
+# module.
+_PARAMETER_MODULE = dict(
+    [(name, "primordial") for name in [
+        "P_k_ini type", "k_pivot", "A_s", "ln10^{10}A_s", "sigma8", "n_s",
+        "alpha_s", "n_t", "alpha_t",
+        "f_bi", "n_bi", "alpha_bi", "f_cdi", "n_cdi", "alpha_cdi",
+        "f_nid", "n_nid", "alpha_nid", "f_niv", "n_niv", "alpha_niv"]] +
+    [(prefix+"_"+pair, "primordial")
+        for prefix in ["c", "n", "alpha"]
+        for pair in ["ad_bi", "ad_cdi", "ad_nid", "ad_niv",
+                     "bi_ad", "bi_cdi", "bi_nid", "bi_niv",
+                     "cdi_ad", "cdi_bi", "cdi_nid", "cdi_niv",
+                     "nid_ad", "nid_bi", "nid_cdi", "nid_niv",
+                     "niv_ad", "niv_bi", "niv_cdi", "niv_nid"]] +
+    [(name, "primordial") for name in [
+        "k1", "k2", "P_{RR}^1", "P_{RR}^2", "P_{II}^1", "P_{II}^2",
+        "P_{RI}^1", "|P_{RI}^2|", "special iso",
+        "potential", "full_potential", "phi_end", "ln_aH_ratio", "N_star",
+        "inflation_behavior", "command"]] +
+    [(name+"_%d"%i, "primordial")
+        for name in ["V", "H", "PSR", "R", "HSR"] for i in range(5)] +
+    [("Vparam%d"%i, "primordial") for i in range(5)] +
+    [("custom%d"%i, "primordial") for i in range(1, 11)] +
+    [(name, "nonlinear") for name in [
+        "extrapolation_method", "feedback model", "eta_0", "c_min",
+        "z_infinity"]] +
+    [("r", "perturb"),
+     ("k_output_values_only", "perturb"),
+     ("bessel_cache", "transfer"),
+     ("transfer_l_block_size", "transfer"),
+     ("background_verbose", "background"),
+     ("thermodynamics_verbose", "thermodynamics"),
+     ("perturbations_verbose", "perturb"),
+     ("primordial_verbose", "primordial"),
+     ("nonlinear_verbose", "nonlinear"),
+     ("transfer_verbose", "transfer"),
+     ("spectra_verbose", "spectra"),
+     ("lensing_verbose", "lensing"),
+     ("input_verbose", "input"),
+     ("output_verbose", "output")])
+
+
+cdef int _external_pk_function(double * k, int k_size, double * pk_scalar,
+                               double * pk_tensor, void * parameters,
+                               char * error_message) with gil:
+    """
+    Call the python function passed to Class.set_external_pk() on the
+    wavenumbers of the primordial table, and copy its output in the
+    tables of the primordial module
+    """
+    cdef int index_k
+    cdef np.ndarray[DTYPE_t, ndim=1] pks
+    cdef np.ndarray[DTYPE_t, ndim=1] pkt
+    try:
+        kk = np.array(<double[:k_size]> k)
+        if pk_tensor == NULL:
+            pks = np.ascontiguousarray((<object>parameters)(kk), dtype='float64')
+        else:
+            result = (<object>parameters)(kk)
+            pks = np.ascontiguousarray(result[0], dtype='float64')
+            pkt = np.ascontiguousarray(result[1], dtype='float64')
+            if pkt.shape[0] != k_size:
+                raise ValueError("the tensor spectrum has %d values instead of %d" % (pkt.shape[0], k_size))
+            for index_k in range(k_size):
+                pk_tensor[index_k] = pkt[index_k]
+        if pks.shape[0] != k_size:
+            raise ValueError("the scalar spectrum has %d values instead of %d" % (pks.shape[0], k_size))
+        for index_k in range(k_size):
+            pk_scalar[index_k] = pks[index_k]
+    except Exception as e:
+        message = ("external P(k) function failed: %s" % e).encode()[:255]
+        strcpy(error_message, message)
+        return _FAILURE_
+    return _SUCCESS_
+
+
 cdef class Class:
     """
     Class wrapping, creates the glue between C and python
@@ -100,6 +190,10 @@ cdef class Class:
     cpdef int allocated # Flag to see if classy structs are allocated already
     cpdef object _pars # Dictionary of the parameters
     cpdef object ncp   # Keeps track of the structures initialized, in view of cleaning.
+    cpdef object _computed_pars # Parameters of the last successful computation
+    cpdef object _recompute_plan # Modules reused and recomputed by the last call to compute()
+    cpdef object _external_pk # Python function computing the primordial spectrum, or None
+    cpdef int _external_pk_changed # Flag to recompute the primordial spectrum after set_external_pk()
 
     # Defining two new properties to recover, respectively, the parameters used
     # or the age (set after computation). Follow this syntax if you want to
@@ -117,6 +211,9 @@ cdef class Class:
     property nonlinear_method:
         def __get__(self):
             return self.nl.method
+    property recompute_plan:
+        def __get__(self):
+            return self._recompute_plan
 
     def set_default(self):
         _pars = {
@@ -129,11 +226,16 @@ cdef class Class:
         self.computed = False
         self._pars = {}
         self.fc.size=0
+        self.fc.hash_table = NULL
         self.fc.filename = <char*>malloc(sizeof(char)*30)
         assert(self.fc.filename!=NULL)
         dumc = "NOFILE"
         sprintf(self.fc.filename,"%s",dumc)
         self.ncp = set()
+        self._computed_pars = {}
+        self._recompute_plan = {}
+        self._external_pk = None
+        self._external_pk_changed = False
         if default: self.set_default()
 
     def __dealloc__(self):
@@ -146,6 +248,7 @@ cdef class Class:
             free(self.fc.name)
             free(self.fc.value)
             free(self.fc.read)
+            free(self.fc.hash_table)
             free(self.fc.filename)
 
     # Set up the dictionary
@@ -161,6 +264,48 @@ cdef class Class:
         self.computed=False
         return True
 
+    def set_cache_directory(self, directory):
+        """
+        Cache the perturbation sources and the table of spherical Bessel
+        functions in directory (which must exist)
+
+        Later computations with the same parameters, apart from those of
+        the primordial spectrum, of the output files and of the verbosity,
+        read the sources from this directory instead of computing them
+        (see 'perturbations_cache' in explanatory.ini). The Bessel table
+        is shared by all models with the same multipoles and a similar
+        conformal age (see 'bessel_cache').
+
+        Parameters
+        ----------
+        directory : str
+            Path of the cache directory, or an empty string to disable the cache
+        """
+        return self.set(perturbations_cache=directory, bessel_cache=directory)
+
+    def set_external_pk(self, function):
+        """
+        Compute the primordial spectrum with a python function instead of
+        an external command
+
+        The function is called in the process, at each computation of the
+        primordial module, with the array of wavenumbers k (in 1/Mpc) of
+        the primordial table. It returns the array of P_s(k), or the tuple
+        (P_s(k), P_t(k)) when tensors are requested. This sets 'P_k_ini
+        type' to 'external_Pk'; the 'command' parameter is then not needed.
+
+        Parameters
+        ----------
+        function : callable or None
+            Function computing the primordial spectrum, or None to use
+            'command' again
+        """
+        self._external_pk = function
+        self._external_pk_changed = True
+        self.computed = False
+        if function is not None:
+            self.set({"P_k_ini type": "external_Pk"})
+
     def empty(self):
         self._pars = {}
         self.computed = False
@@ -174,7 +319,12 @@ cdef class Class:
             free(self.fc.name)
             free(self.fc.value)
             free(self.fc.read)
+            free(self.fc.hash_table)
         self.fc.size = len(self._pars)
+        # the hash index of the names is built by the parser at the first search
+        self.fc.hash_table = NULL
+        self.fc.hash_size = 0
+        self.fc.hash_names = 0
         self.fc.name = <FileArg*> malloc(sizeof(FileArg)*len(self._pars))
         assert(self.fc.name!=NULL)
 
@@ -197,26 +347,35 @@ cdef class Class:
             self.fc.read[i] = _FALSE_
             i+=1
 
-    # Called at the end of a run, to free memory
-    def struct_cleanup(self):
-        if(self.allocated != True):
-          return
-        if "lensing" in self.ncp:
+    # Free the structure of one of the computed modules
+    def _free_module(self, module):
+        if module == "lensing":
             lensing_free(&self.le)
-        if "spectra" in self.ncp:
+        elif module == "spectra":
             spectra_free(&self.sp)
-        if "transfer" in self.ncp:
+        elif module == "transfer":
             transfer_free(&self.tr)
-        if "nonlinear" in self.ncp:
+        elif module == "nonlinear":
             nonlinear_free(&self.nl)
-        if "primordial" in self.ncp:
+        elif module == "primordial":
             primordial_free(&self.pm)
-        if "perturb" in self.ncp:
+        elif module == "perturb":
             perturb_free(&self.pt)
-        if "thermodynamics" in self.ncp:
+        elif module == "thermodynamics":
             thermodynamics_free(&self.th)
-        if "background" in self.ncp:
+        elif module == "background":
             background_free(&self.ba)
+        self.ncp.discard(module)
+
+    # Called at the end of a run, to free memory
+    def struct_cleanup(self):
+        if(self.allocated != True):
+          return
+        for module in ["lensing", "spectra", "transfer", "nonlinear",
+                       "primordial", "perturb", "thermodynamics",
+                       "background"]:
+            if module in self.ncp:
+                self._free_module(module)
         self.allocated = False
         self.computed = False
 
@@ -268,6 +427,59 @@ cdef class Class:
                 level.append("input")
         return level
 
+    def _reusable_modules(self, level):
+        """
+        List the modules of the previous computation that can be kept as such
+
+        A module can be reused when it was computed with the same input as
+        the one it would receive now: none of the parameters changed since
+        the last successful computation is read by this module or by any
+        module before it (see the dictionary _PARAMETER_MODULE).
+
+        Parameters
+        ----------
+
+        level : list
+            list of all modules needed, as returned by _check_task_dependency
+
+        Returns
+        -------
+        reused : list
+            modules to keep, in the order in which they are computed
+        changed : list
+            names of the parameters which changed since the last computation
+
+        """
+        if not self.allocated:
+            return [], sorted(self._pars)
+        changed = sorted(
+            [key for key in self._pars if key not in self._computed_pars or
+             str(self._pars[key]) != str(self._computed_pars[key])] +
+            [key for key in self._computed_pars if key not in self._pars])
+        first = len(_MODULE_ORDER)
+        if self._external_pk_changed:
+            first = _MODULE_ORDER.index("primordial")
+        for key in changed:
+            module = _PARAMETER_MODULE.get(key, "background")
+            if module in _MODULE_ORDER:
+                first = min(first, _MODULE_ORDER.index(module))
+        for module in level:
+            if module in _MODULE_ORDER and module not in self.ncp:
+                first = min(first, _MODULE_ORDER.index(module))
+        # with 'low_memory', the perturbation sources (read by the nonlinear
+        # and transfer modules) and the transfer functions (read by the
+        # spectra module) are freed once used: they must then be computed
+        # again whenever a module reading them is
+        if ("perturb" in self.ncp and self.pt.sources_released and
+            first <= _MODULE_ORDER.index("transfer")):
+            first = min(first, _MODULE_ORDER.index("perturb"))
+        if ("transfer" in self.ncp and self.tr.tables_released and
+            first <= _MODULE_ORDER.index("spectra")):
+            first = min(first, _MODULE_ORDER.index("transfer"))
+        reused = [module for module in _MODULE_ORDER[:first]
+                  if module in level and module in self.ncp]
+        return reused, changed
+
     def _pars_check(self, key, value, contains=False, add=""):
         val = ""
         if key in self._pars:
@@ -314,6 +526,16 @@ cdef class Class:
 
         """
         cdef ErrorMsg errmsg
+        cdef precision pr_new
+        cdef background ba_new
+        cdef thermo th_new
+        cdef perturbs pt_new
+        cdef primordial pm_new
+        cdef nonlinear nl_new
+        cdef transfers tr_new
+        cdef spectra sp_new
+        cdef output op_new
+        cdef lensing le_new
 
         # Append to the list level all the modules necessary to compute.
         level = self._check_task_dependency(level)
@@ -325,9 +547,18 @@ cdef class Class:
         if self.computed and self.ncp.issuperset(level):
             return
 
-        # Check if already allocated to prevent memory leaks
-        if self.allocated:
-            self.struct_cleanup()
+        # Find which modules of a previous computation do not depend on the
+        # parameters changed since then, and can be kept as they are.
+        reused, changed = self._reusable_modules(level)
+        self._recompute_plan = {
+            "changed": changed,
+            "reused": reused,
+            "recomputed": [module for module in _MODULE_ORDER
+                           if module in level and module not in reused]}
+        if str(self._pars.get("input_verbose", 0)).strip() not in ["", "0"]:
+            print("Class.compute(): reusing %s, recomputing %s" % (
+                ", ".join(self._recompute_plan["reused"]) or "nothing",
+                ", ".join(self._recompute_plan["recomputed"]) or "nothing"))
 
         # Otherwise, proceed with the normal computation.
         self.computed = False
@@ -335,83 +566,118 @@ cdef class Class:
         # Equivalent of writing a parameter file
         self._fillparfile()
 
-        # self.ncp will contain the list of computed modules (under the form of
-        # a set, instead of a python list)
-        self.ncp=set()
-        # Up until the empty set, all modules are allocated
-        # (And then we successively keep track of the ones we allocate additionally)
-        self.allocated = True
-
         # --------------------------------------------------------------------
         # Check the presence for all CLASS modules in the list 'level'. If a
         # module is found in level, executure its "_init" method.
         # --------------------------------------------------------------------
         # The input module should raise a CosmoSevereError, because
         # non-understood parameters asked to the wrapper is a problematic
-        # situation.
-        if "input" in level:
-            if input_init(&self.fc, &self.pr, &self.ba, &self.th,
-                          &self.pt, &self.tr, &self.pm, &self.sp,
-                          &self.nl, &self.le, &self.op, errmsg) == _FAILURE_:
-                raise CosmoSevereError(errmsg)
-            self.ncp.add("input")
-            # This part is done to list all the unread parameters, for debugging
-            problem_flag = False
-            problematic_parameters = []
-            for i in range(self.fc.size):
-                if self.fc.read[i] == _FALSE_:
-                    problem_flag = True
-                    problematic_parameters.append(self.fc.name[i].decode())
-            if problem_flag:
-                raise CosmoSevereError(
-                    "Class did not read input parameter(s): %s\n" % ', '.join(
-                    problematic_parameters))
+        # situation. The input is read in temporary structures, such that the
+        # reused modules are not affected.
+        if input_init(&self.fc, &pr_new, &ba_new, &th_new,
+                      &pt_new, &tr_new, &pm_new, &sp_new,
+                      &nl_new, &le_new, &op_new, errmsg) == _FAILURE_:
+            raise CosmoSevereError(errmsg)
+        # This part is done to list all the unread parameters, for debugging
+        problem_flag = False
+        problematic_parameters = []
+        for i in range(self.fc.size):
+            if self.fc.read[i] == _FALSE_:
+                problem_flag = True
+                problematic_parameters.append(self.fc.name[i].decode())
+        if problem_flag:
+            input_free(&ba_new, &pt_new, &pm_new, &nl_new)
+            raise CosmoSevereError(
+                "Class did not read input parameter(s): %s\n" % ', '.join(
+                problematic_parameters))
+
+        # Free the modules which are not reused (in reverse order), and
+        # replace their structures by the ones just filled by the input
+        # module. For reused modules, discard the new input instead.
+        if self.allocated:
+            for module in ["lensing", "spectra", "transfer", "nonlinear",
+                           "primordial", "perturb", "thermodynamics",
+                           "background"]:
+                if module in self.ncp and module not in reused:
+                    self._free_module(module)
+        input_free(<void*>&ba_new if "background" in reused else NULL,
+                   <void*>&pt_new if "perturb" in reused else NULL,
+                   <void*>&pm_new if "primordial" in reused else NULL,
+                   <void*>&nl_new if "nonlinear" in reused else NULL)
+        if self._external_pk is not None:
+            pm_new.external_pk_function = _external_pk_function
+            pm_new.external_pk_parameters = <void*>self._external_pk
+        self.pr = pr_new
+        self.op = op_new
+        if "background" not in reused:
+            self.ba = ba_new
+        if "thermodynamics" not in reused:
+            self.th = th_new
+        if "perturb" not in reused:
+            self.pt = pt_new
+        if "primordial" not in reused:
+            self.pm = pm_new
+        if "nonlinear" not in reused:
+            self.nl = nl_new
+        if "transfer" not in reused:
+            self.tr = tr_new
+        if "spectra" not in reused:
+            self.sp = sp_new
+        if "lensing" not in reused:
+            self.le = le_new
+
+        # self.ncp will contain the list of computed modules (under the form of
+        # a set, instead of a python list)
+        self.ncp = set(["input"] + reused)
+        # Up until the empty set, all modules are allocated
+        # (And then we successively keep track of the ones we allocate additionally)
+        self.allocated = True
 
         # The following list of computation is straightforward. If the "_init"
         # methods fail, call `struct_cleanup` and raise a CosmoComputationError
         # with the error message from the faulty module of CLASS.
-        if "background" in level:
+        if "background" in level and "background" not in reused:
             if background_init(&(self.pr), &(self.ba)) == _FAILURE_:
                 self.struct_cleanup()
                 raise CosmoComputationError(self.ba.error_message)
             self.ncp.add("background")
 
-        if "thermodynamics" in level:
+        if "thermodynamics" in level and "thermodynamics" not in reused:
             if thermodynamics_init(&(self.pr), &(self.ba),
                                    &(self.th)) == _FAILURE_:
                 self.struct_cleanup()
                 raise CosmoComputationError(self.th.error_message)
             self.ncp.add("thermodynamics")
 
-        if "perturb" in level:
+        if "perturb" in level and "perturb" not in reused:
             if perturb_init(&(self.pr), &(self.ba),
                             &(self.th), &(self.pt)) == _FAILURE_:
                 self.struct_cleanup()
                 raise CosmoComputationError(self.pt.error_message)
             self.ncp.add("perturb")
 
-        if "primordial" in level:
+        if "primordial" in level and "primordial" not in reused:
             if primordial_init(&(self.pr), &(self.pt),
                                &(self.pm)) == _FAILURE_:
                 self.struct_cleanup()
                 raise CosmoComputationError(self.pm.error_message)
             self.ncp.add("primordial")
 
-        if "nonlinear" in level:
+        if "nonlinear" in level and "nonlinear" not in reused:
             if nonlinear_init(&self.pr, &self.ba, &self.th,
                               &self.pt, &self.pm, &self.nl) == _FAILURE_:
                 self.struct_cleanup()
                 raise CosmoComputationError(self.nl.error_message)
             self.ncp.add("nonlinear")
 
-        if "transfer" in level:
+        if "transfer" in level and "transfer" not in reused:
             if transfer_init(&(self.pr), &(self.ba), &(self.th),
                              &(self.pt), &(self.nl), &(self.tr)) == _FAILURE_:
                 self.struct_cleanup()
                 raise CosmoComputationError(self.tr.error_message)
             self.ncp.add("transfer")
 
-        if "spectra" in level:
+        if "spectra" in level and "spectra" not in reused:
             if spectra_init(&(self.pr), &(self.ba), &(self.pt),
                             &(self.pm), &(self.nl), &(self.tr),
                             &(self.sp)) == _FAILURE_:
@@ -419,7 +685,7 @@ cdef class Class:
                 raise CosmoComputationError(self.sp.error_message)
             self.ncp.add("spectra")
 
-        if "lensing" in level:
+        if "lensing" in level and "lensing" not in reused:
             if lensing_init(&(self.pr), &(self.pt), &(self.sp),
                             &(self.nl), &(self.le)) == _FAILURE_:
                 self.struct_cleanup()
@@ -427,6 +693,8 @@ cdef class Class:
             self.ncp.add("lensing")
 
         self.computed = True
+        self._computed_pars = self._pars.copy()
+        self._external_pk_changed = False
 
         # At this point, the cosmological instance contains everything needed. The
         # following functions are only to output the desired numbers
@@ -591,6 +859,46 @@ cdef class Class:
         free(lcl)
         return cl
 
+    def recompute_lensing(self, cl_pp=None, A_lens=1.):
+        """
+        recompute_lensing(cl_pp=None, A_lens=1.)
+
+        Recompute the lensed C_l from a new lensing potential spectrum,
+        without running the transfer and spectra modules again: the
+        unlensed CMB spectra are unchanged, and the quadrature and
+        d-functions of the lensing module are reused. The lensed C_l
+        returned afterwards by lensed_cl() are updated, while the 'pp'
+        spectrum itself is left untouched.
+
+        Parameters
+        ----------
+        cl_pp : numpy array, optional
+                Lensing potential C_l^phiphi for l=0...l_max (at least up
+                to the largest multipole of the unlensed spectra). The one
+                computed by CLASS is used if it is not passed.
+        A_lens : float, optional
+                Amplitude by which cl_pp is multiplied
+        """
+        cdef int lmax = self.le.l_unlensed_max
+        cdef np.ndarray[DTYPE_t, ndim=1] pp
+        cdef double * pp_data
+        cdef int status
+
+        if "lensing" not in self.ncp or not self.le.has_lensed_cls:
+            raise CosmoSevereError("No lensed Cl computed")
+
+        if cl_pp is None:
+            cl_pp = self.raw_cl(lmax)['pp']
+        if len(cl_pp) < lmax+1:
+            raise CosmoSevereError("cl_pp must be given up to l=%d"%lmax)
+        pp = np.ascontiguousarray(A_lens*np.asarray(cl_pp[:lmax+1]),dtype='float64')
+        pp_data = <double*> pp.data
+
+        with nogil:
+            status = lensing_recompute(&self.pr,&self.sp,pp_data,&self.le)
+        if status == _FAILURE_:
+            raise CosmoSevereError(self.le.error_message)
+
     def density_cl(self, lmax=-1, nofail=False):
         """
         density_cl(lmax=-1, nofail=False)
@@ -608,9 +916,11 @@ cdef class Class:
         -------
         cl : numpy array of numpy.ndarrays
             Array that contains the list (in this order) of self correlation of
-            1st bin, then successive correlations (set by non_diagonal) to the
-            following bins, then self correlation of 2nd bin, etc. The array
-            starts at index_ct_dd.
+            1st bin, then successive correlations (set by non_diagonal or
+            non_diagonal_pairs) to the following bins, then self correlation
+            of 2nd bin, etc. The array starts at index_ct_dd. Only the
+            computed pairs of bins are present: cl['pairs'][name] gives, for
+            each of them, the two bins (numbered from 0).
         """
         cdef int lmaxR
         cdef double *dcl = <double*> calloc(self.sp.ct_size,sizeof(double))
@@ -658,16 +968,22 @@ cdef class Class:
 
         cl = {}
 
-        # For density Cls, the size is bigger (different redshfit bins)
-        # computes the size, given the number of correlations needed to be computed
-        size = (self.sp.d_size*(self.sp.d_size+1)-(self.sp.d_size-self.sp.non_diag)*
-                (self.sp.d_size-1-self.sp.non_diag))/2;
+        # For density Cls, there is one spectrum per computed pair of
+        # redshift bins
+        size = {'dd': self.sp.dd_pair_num, 'll': self.sp.ll_pair_num, 'dl': self.sp.dl_pair_num}
+        cl['pairs'] = {}
         for elem in ['dd', 'll', 'dl']:
             if elem in spectra:
                 cl[elem] = {}
-                for index in range(size):
+                for index in range(size[elem]):
                     cl[elem][index] = np.zeros(
                         lmax+1, dtype=np.double)
+        if 'dd' in spectra:
+            cl['pairs']['dd'] = [(self.sp.dd_pair[2*index], self.sp.dd_pair[2*index+1]) for index in range(size['dd'])]
+        if 'll' in spectra:
+            cl['pairs']['ll'] = [(self.sp.ll_pair[2*index], self.sp.ll_pair[2*index+1]) for index in range(size['ll'])]
+        if 'dl' in spectra:
+            cl['pairs']['dl'] = [(self.sp.dl_pair[2*index], self.sp.dl_pair[2*index+1]) for index in range(size['dl'])]
         for elem in ['td', 'tl']:
             if elem in spectra:
                 cl[elem] = np.zeros(lmax+1, dtype=np.double)
@@ -676,13 +992,13 @@ cdef class Class:
             if spectra_cl_at_l(&self.sp, ell, dcl, cl_md, cl_md_ic) == _FAILURE_:
                 raise CosmoSevereError(self.sp.error_message)
             if 'dd' in spectra:
-                for index in range(size):
+                for index in range(size['dd']):
                     cl['dd'][index][ell] = dcl[self.sp.index_ct_dd+index]
             if 'll' in spectra:
-                for index in range(size):
+                for index in range(size['ll']):
                     cl['ll'][index][ell] = dcl[self.sp.index_ct_ll+index]
             if 'dl' in spectra:
-                for index in range(size):
+                for index in range(size['dl']):
                     cl['dl'][index][ell] = dcl[self.sp.index_ct_dl+index]
             if 'td' in spectra:
                 cl['td'][ell] = dcl[self.sp.index_ct_td]
@@ -1007,6 +1323,48 @@ cdef class Class:
 
         return sigma_cb
 
+    def get_sigma_grid(self, np.ndarray[DTYPE_t,ndim=1] R, np.ndarray[DTYPE_t,ndim=1] z, cb=False):
+        """
+        Gives sigma(R,z) and dsigma/dlnR(R,z) (total matter, or cdm+b if
+        cb=True) on a grid of radii R (in Mpc) and redshifts z, as two
+        arrays of shape (len(R),len(z)), with one call to
+        nonlinear_sigmas_at_Rvec_and_zvec(). This is much faster than
+        calling sigma() at each point. The GIL is released during the
+        computation.
+        """
+        cdef int index_pk
+        cdef int R_size = R.shape[0]
+        cdef int z_size = z.shape[0]
+        cdef np.ndarray[DTYPE_t, ndim=1] RR = np.ascontiguousarray(R,dtype='float64')
+        cdef np.ndarray[DTYPE_t, ndim=1] zz = np.ascontiguousarray(z,dtype='float64')
+        cdef np.ndarray[DTYPE_t, ndim=2] sigma = np.zeros((z_size,R_size),'float64')
+        cdef np.ndarray[DTYPE_t, ndim=2] dsigma = np.zeros((z_size,R_size),'float64')
+        cdef double * RR_data = <double*> RR.data
+        cdef double * zz_data = <double*> zz.data
+        cdef double * sigma_data = <double*> sigma.data
+        cdef double * dsigma_data = <double*> dsigma.data
+        cdef int status
+
+        if (self.pt.has_pk_matter == _FALSE_):
+            raise CosmoSevereError("No power spectrum computed. In order to get sigma(R,z) you must add mPk to the list of outputs.")
+
+        if cb:
+            if (self.nl.has_pk_cb == _FALSE_):
+                raise CosmoSevereError("sigma_cb not computed by CLASS (probably because there are no massive neutrinos)")
+            index_pk = self.nl.index_pk_cb
+        else:
+            index_pk = self.nl.index_pk_m
+
+        if (self.pt.k_max_for_pk < self.ba.h):
+            raise CosmoSevereError("In order to get sigma(R,z) you must set 'P_k_max_h/Mpc' to 1 or bigger, in order to have k_max > 1 h/Mpc.")
+
+        with nogil:
+            status = nonlinear_sigmas_at_Rvec_and_zvec(&self.pr,&self.ba,&self.nl,index_pk,RR_data,R_size,zz_data,z_size,sigma_data,dsigma_data)
+        if status == _FAILURE_:
+            raise CosmoSevereError(self.nl.error_message)
+
+        return sigma.T.copy(), dsigma.T.copy()
+
     # Gives effective logarithmic slope of P_L(k,z) (total matter) for a given (k,z)
     def pk_tilt(self,double k,double z):
         """
@@ -1633,6 +1991,189 @@ cdef class Class:
 
         return transfers
 
+    def lrs_counters(self):
+        """
+        Return the number of calls of the hot functions of the longrange
+        module, and the time spent in them (in s, including nested calls),
+        during the background and perturbation computations.
+
+        .. note::
+
+            the counters are only filled if CLASS was compiled with
+            -DLRS_COUNTERS (see the Makefile); otherwise 'enabled' is False.
+
+        Returns
+        -------
+        counters : dict
+                counters['background'] and counters['perturbations'] are
+                dictionaries with keys 'enabled', 'calls' and 'time', the
+                latter two being dictionaries indexed by function name.
+        """
+        names = ['background_lrs_moments', 'get_phi_M_lrs', 'instabilityOnset_lrs',
+                 'potentialPrime', 'potentialPrime_and_derivative']
+        counters = {}
+        for module, module_counters in (('background', self.ba.lrs_counters),
+                                        ('perturbations', self.pt.lrs_counters)):
+            counters[module] = {
+                'enabled': bool(module_counters['is_enabled']),
+                'calls': dict(zip(names, module_counters['calls'])),
+                'time': dict(zip(names, module_counters['time']))}
+        return counters
+
+    def profile(self):
+        """
+        Return the number of calls of the module initializations and of
+        the hot functions (perturbation equations, numerical Jacobians,
+        background and thermodynamics interpolations, longrange kernels),
+        and the time spent in them (in s, including nested calls).
+
+        .. note::
+
+            the profile is only filled if CLASS was compiled with
+            -DCLASS_PROFILE (see the Makefile); otherwise 'enabled' is
+            False. It is process-wide: it includes all the computations
+            done since the last call to reset_profile(), by all the
+            instances and threads.
+
+        Returns
+        -------
+        profile : dict
+                profile['calls'] and profile['time'] are dictionaries indexed
+                by function name, summed over threads; profile['threads'] is a
+                list with the same dictionaries for each thread.
+        """
+        cdef class_profile_counters total
+        cdef class_profile_counters * threads
+        cdef int thread_num, index, index_thread
+        class_profile_get(NULL, NULL, 0, &thread_num)
+        threads = <class_profile_counters*> malloc(max(thread_num, 1)*sizeof(class_profile_counters))
+        if threads == NULL:
+            raise MemoryError("Could not allocate the profile of the threads")
+        class_profile_get(&total, threads, thread_num, &thread_num)
+        names = [class_profile_name(index).decode() for index in range(_CLASS_PROFILE_SIZE_)]
+        profile = {
+            'enabled': bool(class_profile_is_enabled()),
+            'calls': dict(zip(names, total.calls)),
+            'time': dict(zip(names, total.time)),
+            'threads': [{'calls': dict(zip(names, threads[index_thread].calls)),
+                         'time': dict(zip(names, threads[index_thread].time))}
+                        for index_thread in range(thread_num)]}
+        free(threads)
+        return profile
+
+    def reset_profile(self):
+        """
+        Set the profile returned by profile() to zero
+        """
+        class_profile_reset()
+
+    def memory(self):
+        """
+        Return the memory kept by the structure of each computed module
+        (in bytes, after the tables freed with 'low_memory = yes'), and
+        the current and peak resident set size of the process.
+
+        Returns
+        -------
+        memory : dict
+                memory['modules'] is a dictionary indexed by module name;
+                memory['rss'] and memory['peak_rss'] are process-wide, and
+                include all the instances of the process.
+        """
+        cdef size_t rss, peak_rss
+        sizes = {"background": self.ba.memory_size,
+                 "thermodynamics": self.th.memory_size,
+                 "perturb": self.pt.memory_size,
+                 "primordial": self.pm.memory_size,
+                 "nonlinear": self.nl.memory_size,
+                 "transfer": self.tr.memory_size,
+                 "spectra": self.sp.memory_size,
+                 "lensing": self.le.memory_size}
+        class_memory_rss(&rss, &peak_rss)
+        return {'modules': dict([(module, sizes[module])
+                                 for module in _MODULE_ORDER if module in self.ncp]),
+                'rss': rss, 'peak_rss': peak_rss}
+
+    def lrs_batch(self, g_over_M, M_phi, m_F, z):
+        """
+        lrs_batch(g_over_M, M_phi, m_F, z)
+
+        Evaluate the background for a batch of lrs parameter sets, sharing
+        the precision parameters, the other species and the lrs momentum
+        sampling of the current model, which must have been computed up to
+        the background module at least. The points are computed in parallel
+        with OpenMP. Omega_Lambda absorbs the change in Omega0_lrs, while
+        h and the other parameters are kept fixed.
+
+        Parameters
+        ----------
+        g_over_M, M_phi, m_F : numpy arrays of same size
+                Coupling over scalar mass (1/eV), scalar mass (eV) and fermion
+                mass (eV) of each point, in log10 scale if the current model
+                was run with log10_lrs = yes
+        z : numpy array
+                Redshifts at which the background is returned
+
+        Returns
+        -------
+        batch : dict
+                batch['Omega0_lrs'] and batch['a_unstable'] have the size of
+                the parameter arrays; the background quantities 'H [1/Mpc]',
+                'comov. dist.', 'ang.diam.dist.', 'lum. dist.', '(.)rho_lrs',
+                '(.)p_lrs', 'phi_M_lrs' and 'mT_over_T0_lrs' have shape
+                (number of points, size of z).
+        """
+        cdef int point_size, z_size, index_point, index_z
+        cdef np.ndarray[DTYPE_t, ndim=1] g_arr, M_arr, m_arr, z_arr
+        cdef np.ndarray[DTYPE_t, ndim=1] Omega0_lrs, a_unstable
+        cdef np.ndarray[DTYPE_t, ndim=1] bg
+
+        if not "background" in self.ncp:
+            raise CosmoSevereError("lrs_batch requires a model computed up to the background module")
+        if not self.ba.has_lrs:
+            raise CosmoSevereError("lrs_batch requires a model with longrangescalar = yes")
+
+        g_arr = np.ascontiguousarray(g_over_M, dtype='float64').ravel()
+        M_arr = np.ascontiguousarray(M_phi, dtype='float64').ravel()
+        m_arr = np.ascontiguousarray(m_F, dtype='float64').ravel()
+        z_arr = np.ascontiguousarray(z, dtype='float64').ravel()
+        if self.ba.has_log10_lrs:
+            g_arr = 10.**g_arr
+            M_arr = 10.**M_arr
+            m_arr = 10.**m_arr
+        point_size = g_arr.shape[0]
+        z_size = z_arr.shape[0]
+        if M_arr.shape[0] != point_size or m_arr.shape[0] != point_size:
+            raise CosmoSevereError("g_over_M, M_phi and m_F should have the same size")
+        if z_size == 0:
+            raise CosmoSevereError("lrs_batch requires at least one redshift")
+
+        Omega0_lrs = np.zeros(point_size, 'float64')
+        a_unstable = np.zeros(point_size, 'float64')
+        bg = np.zeros(point_size*z_size*self.ba.bg_size, 'float64')
+
+        if point_size == 0:
+            return {'Omega0_lrs': Omega0_lrs, 'a_unstable': a_unstable}
+
+        if background_lrs_batch(&self.pr, &self.ba, point_size,
+                                &g_arr[0], &M_arr[0], &m_arr[0],
+                                z_size, &z_arr[0],
+                                &Omega0_lrs[0], &a_unstable[0], &bg[0]) == _FAILURE_:
+            raise CosmoSevereError(self.ba.error_message)
+
+        table = bg.reshape((point_size, z_size, self.ba.bg_size))
+        batch = {'Omega0_lrs': Omega0_lrs, 'a_unstable': a_unstable}
+        for name, index_bg in (('H [1/Mpc]', self.ba.index_bg_H),
+                               ('comov. dist.', self.ba.index_bg_conf_distance),
+                               ('ang.diam.dist.', self.ba.index_bg_ang_distance),
+                               ('lum. dist.', self.ba.index_bg_lum_distance),
+                               ('(.)rho_lrs', self.ba.index_bg_rho_lrs),
+                               ('(.)p_lrs', self.ba.index_bg_p_lrs),
+                               ('phi_M_lrs', self.ba.index_bg_phi_M_lrs),
+                               ('mT_over_T0_lrs', self.ba.index_bg_mT_over_T0_lrs)):
+            batch[name] = np.array(table[:, :, index_bg])
+        return batch
+
     def get_current_derived_parameters(self, names):
         """
         get_current_derived_parameters(names)
@@ -40,6 +40,8 @@ common_settings = {# we need to set the output field to something although
                    'output':'mPk',
                    # value of k we want to polot in [1/Mpc]
                    'k_output_values':k,
+                   # evolve only this k (no source functions, much faster)
+                   'k_output_values_only':'yes',
                    # LambdaCDM parameters
                    'h':0.67556,
                    'omega_b':0.022032,
@@ -90,8 +90,8 @@
  * @param pba           Input: pointer to background structure (containing pre-computed table)
  * @param tau           Input: value of conformal time
  * @param return_format Input: format of output vector (short, normal, long)
- * @param intermode     Input: interpolation mode (normal or closeby)
- * @param last_index    Input/Output: index of the previous/current point in the interpolation array (input only for closeby mode, output for both)
+ * @param intermode     Input: interpolation mode (normal or closeby), ignored when the uniform tables are used
+ * @param last_index    Input/Output: index of the previous/current point in the interpolation array (input only for closeby mode, output for both), untouched when the uniform tables are used
  * @param pvecback      Output: vector (assumed to be already allocated)
  * @return the error status
  */
@@ -111,6 +111,13 @@ int background_at_tau(
 
   /* size of output vector, controlled by input parameter return_format */
   int pvecback_size;
+  /* position in the uniform table and Hermite basis functions */
+  int index,i;
+  double u,t,h00,h10,h01,h11;
+  double * row;
+  double * next;
+
+  class_profile_start(profile_background_at_tau);
 
   /** - check that tau is in the pre-computed range */
 
@@ -136,7 +143,34 @@ int background_at_tau(
     }
   }
 
-  /** - interpolate from pre-computed table with array_interpolate()
+  /** - if the uniform table is available, find the interval by index
+      arithmetic in \f$ \ln\tau \f$ and use cubic Hermite
+      interpolation (intermode and last_index are then not used) */
+
+  if (pba->has_uniform_tables == _TRUE_) {
+
+    u = (log(tau)-pba->lntau_uniform_min)/pba->dlntau_uniform;
+    index = (int)u;
+    if (index > pba->bt_uniform_size-2) index = pba->bt_uniform_size-2;
+    if (index < 0) index = 0;
+    t = u-index;
+
+    h01 = t*t*(3.-2.*t);
+    h00 = 1.-h01;
+    h10 = t*(1.-t)*(1.-t);
+    h11 = t*t*(t-1.);
+
+    row = pba->background_uniform_table + index*2*pba->bg_size;
+    next = row + 2*pba->bg_size;
+
+    for (i=0; i<pvecback_size; i++)
+      pvecback[i] = h00*row[i] + h10*row[pba->bg_size+i] + h01*next[i] + h11*next[pba->bg_size+i];
+
+    class_profile_stop(profile_background_at_tau);
+    return _SUCCESS_;
+  }
+
+  /** - otherwise, interpolate from pre-computed table with array_interpolate()
       or array_interpolate_growing_closeby() (depending on
       interpolation mode) */
 
@@ -171,6 +205,85 @@ int background_at_tau(
                pba->error_message);
   }
 
+  class_profile_stop(profile_background_at_tau);
+  return _SUCCESS_;
+}
+
+/**
+ * Selected background quantities at given conformal time tau.
+ *
+ * Same as background_at_tau(), but only the quantities whose indices
+ * are listed in columns[] are interpolated, which is much cheaper when
+ * a caller needs two or three of the bg_size quantities. The
+ * interpolation coefficients of the bracketing interval are computed
+ * once, and applied to each requested column.
+ *
+ * @param pba         Input: pointer to background structure (containing pre-computed table)
+ * @param tau         Input: value of conformal time
+ * @param columns     Input: indices index_bg_* of the requested quantities
+ * @param column_size Input: number of requested quantities
+ * @param pvecback    Output: vector (assumed to be already allocated with size bg_size), in which only the requested elements are set
+ * @return the error status
+ */
+
+int background_at_tau_columns(
+                              struct background *pba,
+                              double tau,
+                              int * columns,
+                              int column_size,
+                              double * pvecback
+                              ) {
+
+  int index,i,last_index;
+  double u,t,h00,h10,h01,h11;
+  double * row;
+  double * next;
+
+  class_test(tau < pba->tau_table[0],
+             pba->error_message,
+             "out of range: tau=%e < tau_min=%e, you should decrease the precision parameter a_ini_over_a_today_default\n",tau,pba->tau_table[0]);
+
+  class_test(tau > pba->tau_table[pba->bt_size-1],
+             pba->error_message,
+             "out of range: tau=%e > tau_max=%e\n",tau,pba->tau_table[pba->bt_size-1]);
+
+  if (pba->has_uniform_tables == _TRUE_) {
+
+    u = (log(tau)-pba->lntau_uniform_min)/pba->dlntau_uniform;
+    index = (int)u;
+    if (index > pba->bt_uniform_size-2) index = pba->bt_uniform_size-2;
+    if (index < 0) index = 0;
+    t = u-index;
+
+    h01 = t*t*(3.-2.*t);
+    h00 = 1.-h01;
+    h10 = t*(1.-t)*(1.-t);
+    h11 = t*t*(t-1.);
+
+    row = pba->background_uniform_table + index*2*pba->bg_size;
+    next = row + 2*pba->bg_size;
+
+    for (i=0; i<column_size; i++)
+      pvecback[columns[i]] = h00*row[columns[i]] + h10*row[pba->bg_size+columns[i]]
+        + h01*next[columns[i]] + h11*next[pba->bg_size+columns[i]];
+
+    return _SUCCESS_;
+  }
+
+  class_call(array_interpolate_spline_columns(pba->tau_table,
+                                              pba->bt_size,
+                                              pba->background_table,
+                                              pba->d2background_dtau2_table,
+                                              pba->bg_size,
+                                              tau,
+                                              &last_index,
+                                              columns,
+                                              column_size,
+                                              pvecback,
+                                              pba->error_message),
+             pba->error_message,
+             pba->error_message);
+
   return _SUCCESS_;
 }
 
@@ -197,6 +310,10 @@ int background_tau_of_z(
 
   /* necessary for calling array_interpolate(), but never used */
   int last_index;
+  /* position in the uniform table and Hermite basis functions */
+  int index;
+  double u,t;
+  double * row;
 
   /** - check that \f$ z \f$ is in the pre-computed range */
   class_test(z < pba->z_table[pba->bt_size-1],
@@ -207,7 +324,24 @@ int background_tau_of_z(
              pba->error_message,
              "out of range: a=%e > a_max=%e\n",z,pba->z_table[0]);
 
-  /** - interpolate from pre-computed table with array_interpolate() */
+  /** - if the uniform table is available, find the interval by index
+      arithmetic in \f$ \ln(1+z) \f$ and use cubic Hermite interpolation */
+  if (pba->has_uniform_tables == _TRUE_) {
+
+    u = (log(1.+z)-pba->lnz_uniform_min)/pba->dlnz_uniform;
+    index = (int)u;
+    if (index > pba->zt_uniform_size-2) index = pba->zt_uniform_size-2;
+    if (index < 0) index = 0;
+    t = u-index;
+
+    row = pba->tau_uniform_table + 2*index;
+
+    *tau = (1.-t*t*(3.-2.*t))*row[0] + t*(1.-t)*(1.-t)*row[1] + t*t*(3.-2.*t)*row[2] + t*t*(t-1.)*row[3];
+
+    return _SUCCESS_;
+  }
+
+  /** - otherwise, interpolate from pre-computed table with array_interpolate() */
   class_call(array_interpolate_spline(
                                       pba->z_table,
                                       pba->bt_size,
@@ -225,6 +359,121 @@ int background_tau_of_z(
   return _SUCCESS_;
 }
 
+/**
+ * Resample a splined table on a uniform grid in \f$ \ln(x+x_{offset}) \f$.
+ *
+ * Each row of the output table contains the values of the n_columns
+ * quantities at one node, followed by their derivatives with respect
+ * to \f$ \ln(x+x_{offset}) \f$ multiplied by the grid spacing. Both are
+ * obtained exactly from the input cubic spline, so that a cubic
+ * Hermite interpolation between two rows only needs the fractional
+ * position inside the interval. The input abscissa may be growing or
+ * decreasing.
+ *
+ * @param x_array       Input: abscissa of the input table
+ * @param n_lines       Input: number of lines of the input table
+ * @param array         Input: input table array[index_x*n_columns+index_y]
+ * @param array_splined Input: second derivatives of the input table with respect to x
+ * @param n_columns     Input: number of columns of the input table
+ * @param x_offset      Input: the grid is uniform in \f$ \ln(x+x_{offset}) \f$
+ * @param stepsize      Input: maximum spacing of the uniform grid
+ * @param uniform_size  Output: number of nodes of the uniform grid
+ * @param lnx_min       Output: value of \f$ \ln(x+x_{offset}) \f$ at the first node
+ * @param dlnx          Output: spacing of the uniform grid
+ * @param uniform_table Output: pointer to the uniform table (allocated here, of size 2*n_columns*uniform_size)
+ * @param error_message Output: error message
+ * @return the error status
+ */
+
+int background_uniform_table_init(
+                                  double * x_array,
+                                  int n_lines,
+                                  double * array,
+                                  double * array_splined,
+                                  int n_columns,
+                                  double x_offset,
+                                  double stepsize,
+                                  int * uniform_size,
+                                  double * lnx_min,
+                                  double * dlnx,
+                                  double ** uniform_table,
+                                  ErrorMsg error_message
+                                  ) {
+
+  int index,i,inf,sup;
+  double lnx_first,lnx_last,lnx_max,x,x_lo,x_hi,h,a,b;
+  double * row;
+
+  class_test(n_lines < 2,
+             error_message,
+             "cannot resample a table with %d lines",n_lines);
+
+  class_test(stepsize <= 0.,
+             error_message,
+             "stepsize=%e should be positive",stepsize);
+
+  class_test((x_array[0]+x_offset <= 0.) || (x_array[n_lines-1]+x_offset <= 0.),
+             error_message,
+             "x+x_offset should be strictly positive");
+
+  lnx_first = log(x_array[0]+x_offset);
+  lnx_last = log(x_array[n_lines-1]+x_offset);
+  *lnx_min = MIN(lnx_first,lnx_last);
+  lnx_max = MAX(lnx_first,lnx_last);
+  x_lo = MIN(x_array[0],x_array[n_lines-1]);
+  x_hi = MAX(x_array[0],x_array[n_lines-1]);
+
+  *uniform_size = (int)ceil((lnx_max-*lnx_min)/stepsize)+1;
+  if (*uniform_size < 2) *uniform_size = 2;
+  *dlnx = (lnx_max-*lnx_min)/(*uniform_size-1);
+
+  class_alloc(*uniform_table,2*n_columns*(*uniform_size)*sizeof(double),error_message);
+
+  /* the nodes are sorted: each search for the bracketing interval starts from the previous one */
+  inf = -1;
+
+  for (index=0; index<*uniform_size; index++) {
+
+    row = *uniform_table + 2*n_columns*index;
+
+    /* the end points are taken exactly from the input table, to avoid rounding out of range */
+    if (index == 0)
+      x = (lnx_first < lnx_last) ? x_array[0] : x_array[n_lines-1];
+    else if (index == *uniform_size-1)
+      x = (lnx_first < lnx_last) ? x_array[n_lines-1] : x_array[0];
+    else
+      x = MAX(x_lo,MIN(x_hi,exp(*lnx_min+index*(*dlnx))-x_offset));
+
+    class_call(array_interpolate_spline_hunt(x_array,
+                                             n_lines,
+                                             array,
+                                             array_splined,
+                                             n_columns,
+                                             x,
+                                             &inf,
+                                             row,
+                                             n_columns,
+                                             error_message),
+               error_message,
+               error_message);
+
+    /* derivative of the same cubic spline in the interval [inf,sup] */
+    sup = inf+1;
+    h = x_array[sup]-x_array[inf];
+    b = (x-x_array[inf])/h;
+    a = 1.-b;
+
+    for (i=0; i<n_columns; i++) {
+      row[n_columns+i] = ((array[sup*n_columns+i]-array[inf*n_columns+i])/h
+                          + h/6.*((3.*b*b-1.)*array_splined[sup*n_columns+i]
+                                  -(3.*a*a-1.)*array_splined[inf*n_columns+i]))
+        *(x+x_offset)*(*dlnx);
+    }
+  }
+
+  return _SUCCESS_;
+}
+
 /**
  * Background quantities at given \f$ a \f$.
  *
@@ -282,7 +531,21 @@ int background_functions(
      Note: The scalar field contribution must be added in the end, as an exception!*/
   double dp_dloga;
   /* lrs quantities */
-  double T_lrs, I1_lrs, I2_lrs, a_rel_unstable_lrs;
+  double T_lrs=0., I1_lrs=0., I2_lrs=0., a_rel_unstable_lrs=0.;
+  struct lrs_moments mom_lrs;
+  int lrs_mask;
+  /* mask of optional computations requested by this format (see background_indices()) */
+  int request;
+
+  /** - deduce from the format which optional computations are needed */
+  if (return_format == pba->short_info)
+    request = pba->bg_request_short;
+  else if (return_format == pba->normal_info)
+    request = pba->bg_request_normal;
+  else if (return_format == pba->derivs_info)
+    request = pba->bg_request_derivs;
+  else
+    request = pba->bg_request_long;
 
   /** - initialize local variables */
   a = pvecback_B[pba->index_bi_a];
@@ -379,17 +642,24 @@ int background_functions(
                                          1./a_rel-1.,
                                          NULL,
                                          &rho_ncdm,
-                                         &p_ncdm,
+                                         (request & bg_request_p) ? &p_ncdm : NULL,
                                          NULL,
-                                         &pseudo_p_ncdm),
+                                         (request & bg_request_p_prime) ? &pseudo_p_ncdm : NULL),
                  pba->error_message,
                  pba->error_message);
 
+      if ((request & bg_request_p) == 0)
+        p_ncdm = 0.;
+      if ((request & bg_request_p_prime) == 0)
+        pseudo_p_ncdm = 0.;
+
       pvecback[pba->index_bg_rho_ncdm1+n_ncdm] = rho_ncdm;
       rho_tot += rho_ncdm;
-      pvecback[pba->index_bg_p_ncdm1+n_ncdm] = p_ncdm;
+      if (request & bg_request_p)
+        pvecback[pba->index_bg_p_ncdm1+n_ncdm] = p_ncdm;
       p_tot += p_ncdm;
-      pvecback[pba->index_bg_pseudo_p_ncdm1+n_ncdm] = pseudo_p_ncdm;
+      if (request & bg_request_p_prime)
+        pvecback[pba->index_bg_pseudo_p_ncdm1+n_ncdm] = pseudo_p_ncdm;
       /** See e.g. Eq. A6 in 1811.00904. */
       dp_dloga += (pseudo_p_ncdm - 5*p_ncdm);
 
@@ -430,19 +700,21 @@ int background_functions(
 
   /* Scalar-mediated long range interacting fermion */
   if (pba->has_lrs == _TRUE_) {
-    /* Compute scalar field and effective fermion mass */
-    double phi_M_lrs; // Scalar field times its mass (eV^2)
-    class_call(get_phi_M_lrs(pba, 1./a_rel-1., &phi_M_lrs),
-	       pba->error_message,
-	       pba->error_message);
-    double mT_over_T0_lrs = get_mT_over_T0_lrs(pba, phi_M_lrs);
-
-    /* Check for stability */
-    class_call(instabilityOnset_lrs(pba, &a_rel_unstable_lrs),
-	       pba->error_message,
-	       pba->error_message);
+    /* Check for stability (onset computed once in background_lrs_init()) */
+    a_rel_unstable_lrs = pba->lrs_a_unstable;
     pvecback[pba->index_bg_lrs_a_over_aunstable] = a_rel / a_rel_unstable_lrs;
 
+    /* Compute scalar field and effective fermion mass. After nugget
+       formation they are only needed for the thermal scalar mass. */
+    double phi_M_lrs = 0.; // Scalar field times its mass (eV^2)
+    double mT_over_T0_lrs = 0.;
+    if (pba->has_lrs_nuggets == _FALSE_ || a_rel < a_rel_unstable_lrs || (request & bg_request_lrs_pert)) {
+      class_call(get_phi_M_lrs(pba, 1./a_rel-1., &phi_M_lrs),
+                 pba->error_message,
+                 pba->error_message);
+      mT_over_T0_lrs = get_mT_over_T0_lrs(pba, phi_M_lrs);
+    }
+
     if (pba->has_lrs_nuggets == _FALSE_ || a_rel < a_rel_unstable_lrs){ // Stable
       pvecback[pba->index_bg_phi_M_lrs] = phi_M_lrs;
       pvecback[pba->index_bg_mT_over_T0_lrs] = mT_over_T0_lrs;
@@ -452,41 +724,53 @@ int background_functions(
       double rho_phi = _eV4_to_rho_class * 0.5 * SQR(phi_M_lrs);
       double p_phi = -rho_phi;
 
-      /* Fermion quantities */
+      /* Fermion quantities (only the moments needed by the requested format) */
       double rho_F, p_F, pseudo_p_F;
-      class_call(background_lrs_momenta(
+      lrs_mask = lrs_mom_rho;
+      if (request & bg_request_p)
+        lrs_mask |= lrs_mom_p;
+      if (request & bg_request_p_prime)
+        lrs_mask |= lrs_mom_pseudo_p | lrs_mom_I1 | lrs_mom_I2;
+      if (request & bg_request_lrs_pert)
+        lrs_mask |= lrs_mom_I1 | lrs_mom_I2;
+      class_call(background_lrs_moments(
 					pba->q_lrs_bg,
 					pba->w_lrs_bg,
 					pba->q_size_lrs_bg,
 					mT_over_T0_lrs,
 					pba->factor_lrs,
 					1./a_rel-1.,
-					&rho_F,
-					&p_F,
-					NULL,
-					&pseudo_p_F,
-					&I1_lrs,
-					&I2_lrs),
+					lrs_mask,
+					&mom_lrs),
 		 pba->error_message,
 		 pba->error_message);
+      rho_F = mom_lrs.rho;
+      p_F = mom_lrs.p;
+      pseudo_p_F = mom_lrs.pseudo_p;
+      I1_lrs = mom_lrs.I1;
+      I2_lrs = mom_lrs.I2;
       pvecback[pba->index_bg_rho_lrs_F] = rho_F;
-      pvecback[pba->index_bg_p_lrs_F] = p_F;
-    
+      if (request & bg_request_p)
+        pvecback[pba->index_bg_p_lrs_F] = p_F;
+
       //Introduce the pseudo-pressure (necessary for perturbations), see arXiv:1104.2935
-      pvecback[pba->index_bg_pseudo_p_lrs_F] = pseudo_p_F;
+      if (request & bg_request_p_prime)
+        pvecback[pba->index_bg_pseudo_p_lrs_F] = pseudo_p_F;
 
       // Fermion temperature (eV)
       T_lrs = pba->T_cmb*pba->lrs_T_F/a_rel*_k_B_/_eV_; 
 
       // Scalar thermal mass squared over its vacuum mass squared
-      pvecback[pba->index_bg_MTsq_over_Msq_lrs] = SQR(pba->lrs_g_over_M) * SQR(T_lrs) * I2_lrs; 
+      if (request & bg_request_lrs_pert)
+        pvecback[pba->index_bg_MTsq_over_Msq_lrs] = SQR(pba->lrs_g_over_M) * SQR(T_lrs) * I2_lrs;
 
       /* Add up scalar and fermion */
       pvecback[pba->index_bg_rho_lrs] = rho_phi + rho_F;
-      pvecback[pba->index_bg_p_lrs] = p_phi + p_F;
-    
-      rho_tot += pvecback[pba->index_bg_rho_lrs];
-      p_tot += pvecback[pba->index_bg_p_lrs];
+      if (request & bg_request_p)
+        pvecback[pba->index_bg_p_lrs] = p_phi + p_F;
+
+      rho_tot += rho_phi + rho_F;
+      p_tot += p_phi + p_F;
 
       /* Define the relativistic and non-relativistic contributions of fermions to rho as in ncdm */
       rho_r += 3.* p_F;
@@ -497,52 +781,28 @@ int background_functions(
 	SQR(pba->lrs_g_over_M * T_lrs * I1_lrs) / // (g/M * T * I_1)^2, dimensionless but internally everything in eV
 	(1 + SQR(pba->lrs_g_over_M * T_lrs) * I2_lrs); // 1+(g/M * T)^2 * I_2, dimensionles but internally everything in eV
     } else { // Unstable: nuggets have formed
+      // Fermion temperature (eV)
+      T_lrs = pba->T_cmb*pba->lrs_T_F/a_rel*_k_B_/_eV_;
+
       /* Compute the scalar thermal mass as if no nugget condensation had taken place.
 	 This is to make M_T diminish faster than H, necessary for the proper behaviour of
 	 the approximation lrsad2 */
-      class_call(background_lrs_momenta(
-					pba->q_lrs_bg,
-					pba->w_lrs_bg,
-					pba->q_size_lrs_bg,
-					mT_over_T0_lrs,
-					pba->factor_lrs,
-					1./a_rel-1.,
-					NULL,
-					NULL,
-					NULL,
-					NULL,
-					NULL,
-					&I2_lrs),
-		 pba->error_message,
-		 pba->error_message);
-
-      // Fermion temperature (eV)
-      T_lrs = pba->T_cmb*pba->lrs_T_F/a_rel*_k_B_/_eV_;
+      if (request & bg_request_lrs_pert) {
+        class_call(background_lrs_moments(
+                                          pba->q_lrs_bg,
+                                          pba->w_lrs_bg,
+                                          pba->q_size_lrs_bg,
+                                          mT_over_T0_lrs,
+                                          pba->factor_lrs,
+                                          1./a_rel-1.,
+                                          lrs_mom_I2,
+                                          &mom_lrs),
+                   pba->error_message,
+                   pba->error_message);
+        I2_lrs = mom_lrs.I2;
 
-      pvecback[pba->index_bg_MTsq_over_Msq_lrs] = SQR(pba->lrs_g_over_M) * SQR(T_lrs) * I2_lrs;
-      
-      // Compute the total energy density at the stable-unstable transition
-      class_call(get_phi_M_lrs(pba, 1./a_rel_unstable_lrs-1., &phi_M_lrs),
-		 pba->error_message,
-		 pba->error_message);
-      mT_over_T0_lrs = get_mT_over_T0_lrs(pba, phi_M_lrs);
-      double rho_phi = _eV4_to_rho_class * 0.5 * SQR(phi_M_lrs);
-      double rho_F;
-      class_call(background_lrs_momenta(
-					pba->q_lrs_bg,
-					pba->w_lrs_bg,
-					pba->q_size_lrs_bg,
-					mT_over_T0_lrs,
-					pba->factor_lrs,
-					1./a_rel_unstable_lrs-1.,
-					&rho_F,
-					NULL,
-					NULL,
-					NULL,
-					NULL,
-					NULL),
-		 pba->error_message,
-		 pba->error_message);
+        pvecback[pba->index_bg_MTsq_over_Msq_lrs] = SQR(pba->lrs_g_over_M) * SQR(T_lrs) * I2_lrs;
+      }
 
       // After nugget formation, the system behaves as dust
       pvecback[pba->index_bg_phi_M_lrs] = 0.;
@@ -550,8 +810,9 @@ int background_functions(
       pvecback[pba->index_bg_pseudo_p_lrs_F] = 0.;
       pvecback[pba->index_bg_p_lrs] = 0.;
 
-      pvecback[pba->index_bg_mT_over_T0_lrs] = mT_over_T0_lrs; // Keep this quantity frozen at instability onset, so that the computed density perturbations are continuous
-      pvecback[pba->index_bg_rho_lrs_F] = (rho_phi + rho_F) / CUB(a_rel / a_rel_unstable_lrs);
+      // Effective fermion mass and total energy density frozen at the stable-unstable transition
+      pvecback[pba->index_bg_mT_over_T0_lrs] = pba->lrs_mT_over_T0_unstable; // Keep this quantity frozen at instability onset, so that the computed density perturbations are continuous
+      pvecback[pba->index_bg_rho_lrs_F] = pba->lrs_rho_unstable / CUB(a_rel / a_rel_unstable_lrs);
       pvecback[pba->index_bg_rho_lrs] = pvecback[pba->index_bg_rho_lrs_F];
 
       rho_tot += pvecback[pba->index_bg_rho_lrs];
@@ -590,29 +851,33 @@ int background_functions(
       \f$ \rho_{class} = [8 \pi G \rho_{physical} / 3 c^2]\f$ */
   pvecback[pba->index_bg_H] = sqrt(rho_tot-pba->K/a/a);
 
-  /** - compute derivative of H with respect to conformal time */
-  pvecback[pba->index_bg_H_prime] = - (3./2.) * (rho_tot + p_tot) * a + pba->K/a;
-
   /* Total energy density*/
   pvecback[pba->index_bg_rho_tot] = rho_tot;
 
-  /* Total pressure */
-  pvecback[pba->index_bg_p_tot] = p_tot;
+  if (request & bg_request_p) {
+
+    /** - compute derivative of H with respect to conformal time */
+    pvecback[pba->index_bg_H_prime] = - (3./2.) * (rho_tot + p_tot) * a + pba->K/a;
+
+    /* Total pressure */
+    pvecback[pba->index_bg_p_tot] = p_tot;
+  }
 
   /* Derivative of total pressure w.r.t. conformal time */
-  pvecback[pba->index_bg_p_tot_prime] = a*pvecback[pba->index_bg_H]*dp_dloga;
-  if (pba->has_scf == _TRUE_){
+  if (request & bg_request_p_prime)
+    pvecback[pba->index_bg_p_tot_prime] = a*pvecback[pba->index_bg_H]*dp_dloga;
+  if ((pba->has_scf == _TRUE_) && (request & bg_request_p_prime)){
     /** The contribution of scf was not added to dp_dloga, add p_scf_prime here: */
     pvecback[pba->index_bg_p_prime_scf] = pvecback[pba->index_bg_phi_prime_scf]*
       (-pvecback[pba->index_bg_phi_prime_scf]*pvecback[pba->index_bg_H]/a-2./3.*pvecback[pba->index_bg_dV_scf]);
     pvecback[pba->index_bg_p_tot_prime] += pvecback[pba->index_bg_p_prime_scf];
   }
 
-  /* lrs-related quantities that depend on H */
-  if (pba->has_lrs ==_TRUE_){
+  /* lrs-related quantities that depend on H, only needed by the perturbations */
+  if ((pba->has_lrs ==_TRUE_) && (request & bg_request_lrs_pert)){
     /* phi_M_prime: scalar derivative wrt conformal time times its mass */
     if( (pba->has_lrs_nuggets == _TRUE_ && a_rel > a_rel_unstable_lrs) // Unstable, or...
-	|| SQR(pba->lrs_M_phi * _Mpc_times_eV) * (1 + pvecback[pba->index_bg_MTsq_over_Msq_lrs]) / SQR(pvecback[pba->index_bg_H]) <= 1. // This is to avoid the term hdot phidot oversourcing the perturbations in the (uninteresting) regime where M < H
+	|| pba->lrs_M_phi_sq * (1 + pvecback[pba->index_bg_MTsq_over_Msq_lrs]) / SQR(pvecback[pba->index_bg_H]) <= 1. // This is to avoid the term hdot phidot oversourcing the perturbations in the (uninteresting) regime where M < H
 	) 
       pvecback[pba->index_bg_phi_M_prime_lrs] = 0.;
     else      
@@ -621,38 +886,37 @@ int background_functions(
 	pvecback[pba->index_bg_H]* // phi_M_dot (eV^2/Mpc)
 	a_rel; //phi_M_prime (eV^2/Mpc)
 
+    /* Coefficients of the fermion fluid equations, tabulated here
+       rather than recomputed in each call to the perturbation
+       equations. After nugget formation the fermions are dust. */
+    if (pba->has_lrs_nuggets == _FALSE_ || a_rel < a_rel_unstable_lrs) {
+      double rho_F = pvecback[pba->index_bg_rho_lrs_F];
+      double p_F = pvecback[pba->index_bg_p_lrs_F];
+      double w_F = p_F/rho_F;
+      double phi_M_dot_over_H = pvecback[pba->index_bg_phi_M_prime_lrs]/(a*pvecback[pba->index_bg_H]); // [eV]
+      double mT_over_g_over_M = (pvecback[pba->index_bg_mT_over_T0_lrs]/pba->lrs_m_F_over_T0)*pba->lrs_m_F/pba->lrs_g_over_M; // [eV^2], finite even when mT vanishes
+      pvecback[pba->index_bg_w_lrs_F] = w_F;
+      pvecback[pba->index_bg_ca2_lrs_F] = w_F * (5.0 - pvecback[pba->index_bg_pseudo_p_lrs_F]/p_F +
+                                                 mT_over_g_over_M * phi_M_dot_over_H /(3*p_F/_eV4_to_rho_class) * pvecback[pba->index_bg_MTsq_over_Msq_lrs]) /
+        (3*(1 + w_F) + pvecback[pba->index_bg_phi_M_lrs] * phi_M_dot_over_H / (rho_F/_eV4_to_rho_class));
+    }
+    else {
+      pvecback[pba->index_bg_w_lrs_F] = 0.;
+      pvecback[pba->index_bg_ca2_lrs_F] = 0.;
+    }
+
     /* Check that M >> H */
     if( (pba->has_lrs_nuggets == _FALSE_ || a_rel < a_rel_unstable_lrs) // Stable, and...
 	&& T_lrs < pba->lrs_m_F // non-relativistic without the interaction
 	)
-      class_test(SQR(pba->lrs_M_phi * _Mpc_times_eV) * (1 + pvecback[pba->index_bg_MTsq_over_Msq_lrs]) / SQR(pvecback[pba->index_bg_H]) <= 100.,
+      class_test(pba->lrs_M_phi_sq * (1 + pvecback[pba->index_bg_MTsq_over_Msq_lrs]) / SQR(pvecback[pba->index_bg_H]) <= 100.,
 		 pba->error_message,
 		 "lrs: The effective scalar mass is smaller than 10*H for T_F/m0 = %e", T_lrs/pba->lrs_m_F);
 
     /* Check that nuggets are instantaneously formed */
     if( pba->has_lrs_nuggets == _TRUE_ && a_rel > a_rel_unstable_lrs){
-      // Compute scalar thermal mass at instability onset
-      class_call(background_lrs_momenta(
-					pba->q_lrs_bg,
-					pba->w_lrs_bg,
-					pba->q_size_lrs_bg,
-					pvecback[pba->index_bg_mT_over_T0_lrs],
-					pba->factor_lrs,
-					1./a_rel_unstable_lrs-1.,
-					NULL,
-					NULL,
-					NULL,
-					NULL,
-					NULL,
-					&I2_lrs),
-		 pba->error_message,
-		 pba->error_message);
-      // Fermion temperature (eV)
-      T_lrs = pba->T_cmb*pba->lrs_T_F/a_rel_unstable_lrs*_k_B_/_eV_;
-      // Scalar thermal mass squared over its vacuum mass squared
-      double MTsq_over_Msq = SQR(pba->lrs_g_over_M) * SQR(T_lrs) * I2_lrs;
-      
-      class_test(SQR(pba->lrs_M_phi * _Mpc_times_eV) * (1 + MTsq_over_Msq) / SQR(pvecback[pba->index_bg_H]) <= 1e10,
+      // Scalar thermal mass squared over its vacuum mass squared at instability onset
+      class_test(pba->lrs_M_phi_sq * (1 + pba->lrs_MTsq_over_Msq_unstable) / SQR(pvecback[pba->index_bg_H]) <= 1e10,
 		 pba->error_message,
 		 "lrs: You chose to treat nugget formation as instantaneous, but for this scalar mass they don't form instantaneously");
     }
@@ -665,10 +929,11 @@ int background_functions(
              "rho_crit = %e instead of strictly positive",rho_crit);
 
   /** - compute relativistic density to total density ratio */
-  pvecback[pba->index_bg_Omega_r] = rho_r / rho_crit;
+  if (request & bg_request_p)
+    pvecback[pba->index_bg_Omega_r] = rho_r / rho_crit;
 
   /** - compute other quantities in the exhaustive, redundant format */
-  if (return_format == pba->long_info) {
+  if (request & bg_request_long) {
 
     /** - store critical density */
     pvecback[pba->index_bg_rho_crit] = rho_crit;
@@ -811,6 +1076,17 @@ int background_init(
   double w_fld, dw_over_da, integral_fld;
   int filenum=0;
 
+  /* size of the heap at the beginning (see class_memory_heap()) */
+  size_t heap_start;
+
+  class_profile_start(profile_background_init);
+  heap_start = class_memory_heap();
+
+  /** - initialize the total of the longrange module counters (the
+      calls made by the input module since the last collection are
+      included) */
+  lrs_counters_init(&(pba->lrs_counters));
+
   /** - in verbose mode, provide some information */
   if (pba->background_verbose > 0) {
     printf("Running CLASS version %s\n",_VERSION_);
@@ -904,6 +1180,10 @@ int background_init(
 	       pba->q_size_lrs,
 	       rho_F_rel/rho_nu_rel);
 
+        if (pba->lrs_quadrature_strategy == qm_compressed)
+          printf("    compressed perturbation sampling: largest relative error on rho, p, I_Mphi and their perturbations = %e\n",
+                 pba->lrs_compressed_error);
+
         Neff += rho_F_rel/rho_nu_rel;
       }
 
@@ -966,10 +1246,27 @@ int background_init(
              pba->error_message,
              pba->error_message);
 
+  /* in verbose mode, inform the user about the cost of solving the lrs scalar field equation */
+  if ((pba->background_verbose > 1) && (pba->has_lrs == _TRUE_)) {
+    printf(" -> lrs scalar field equation solved %ld times (%s) with %ld residual evaluations",
+           pba->lrs_phi_solves,
+           pba->lrs_phi_solver == lrs_phi_newton ? "Newton" : "Ridder",
+           pba->lrs_phi_fevals);
+    if (pba->lrs_phi_solves > 0)
+      printf(" (%.2f per solution)",(double)pba->lrs_phi_fevals/(double)pba->lrs_phi_solves);
+    printf(", %d-point table\n",pba->lrs_phi_table_size);
+  }
+
+  lrs_counters_collect(&(pba->lrs_counters));
+  if ((pba->background_verbose > 1) && (pba->has_lrs == _TRUE_))
+    lrs_counters_print("background",&(pba->lrs_counters));
+
   class_call(background_output_budget(pba),
              pba->error_message,
              pba->error_message);
 
+  pba->memory_size = class_memory_growth(heap_start);
+  class_profile_stop(profile_background_init);
   return _SUCCESS_;
 
 }
@@ -1014,6 +1311,12 @@ int background_free_noinput(
   free(pba->background_table);
   free(pba->d2background_dtau2_table);
 
+  if (pba->has_uniform_tables == _TRUE_) {
+    free(pba->background_uniform_table);
+    free(pba->tau_uniform_table);
+    pba->has_uniform_tables = _FALSE_;
+  }
+
   return _SUCCESS_;
 }
 /**
@@ -1069,6 +1372,10 @@ int background_free_input(
     free(pba->q_lrs_bg);
     free(pba->w_lrs_bg);
     free(pba->dlnf0_dlnq_lrs);
+    if (pba->lrs_phi_table_size > 0) {
+      free(pba->lrs_phi_table_lnphi);
+      free(pba->lrs_phi_table_dd);
+    }
   }
 
   if (pba->Omega0_scf != 0.){
@@ -1097,6 +1404,9 @@ int background_indices(
   int index_bg;
   /* a running index for the vector of background quantities to be integrated */
   int index_bi;
+  /* names and request masks of the formats of background_functions(), for verbose output */
+  const char * format_name[4] = {"short:","normal:","long:","integration:"};
+  int format_request[4];
 
   /** - initialize all flags: which species are present? */
 
@@ -1209,6 +1519,8 @@ int background_indices(
   class_define_index(pba->index_bg_MTsq_over_Msq_lrs,pba->has_lrs,index_bg,1);
   class_define_index(pba->index_bg_mT_over_T0_lrs,pba->has_lrs,index_bg,1);
   class_define_index(pba->index_bg_lrs_a_over_aunstable,pba->has_lrs,index_bg,1);
+  class_define_index(pba->index_bg_w_lrs_F,pba->has_lrs,index_bg,1);
+  class_define_index(pba->index_bg_ca2_lrs_F,pba->has_lrs,index_bg,1);
 
   /* - index for ultra-relativistic neutrinos/species */
   class_define_index(pba->index_bg_rho_ur,pba->has_ur,index_bg,1);
@@ -1326,6 +1638,36 @@ int background_indices(
   pba->short_info=0;
   pba->normal_info=1;
   pba->long_info=2;
+  pba->derivs_info=3;
+
+  /* optional computations in background_functions() for each format:
+     the short format only returns a, H and H'; the normal and long
+     formats return all their columns; background_derivs() only needs
+     the densities (H and the sources of the growth factor and of the
+     integrated densities) */
+
+  pba->bg_request_short = bg_request_p;
+  pba->bg_request_normal = bg_request_p | bg_request_p_prime | bg_request_lrs_pert;
+  pba->bg_request_long = pba->bg_request_normal | bg_request_long;
+  pba->bg_request_derivs = 0;
+
+  format_request[0] = pba->bg_request_short;
+  format_request[1] = pba->bg_request_normal;
+  format_request[2] = pba->bg_request_long;
+  format_request[3] = pba->bg_request_derivs;
+
+  if (pba->background_verbose > 1) {
+    printf(" -> background_functions() computes, in addition to densities and H:\n");
+    for (index_bg=0; index_bg<4; index_bg++) {
+      printf("    %-13s%s%s%s%s%s\n",
+             format_name[index_bg],
+             (format_request[index_bg] == 0) ? "nothing else" : "",
+             (format_request[index_bg] & bg_request_p) ? "pressures " : "",
+             (format_request[index_bg] & bg_request_p_prime) ? "pressure_derivatives " : "",
+             (format_request[index_bg] & bg_request_lrs_pert) ? "lrs_perturbation_quantities " : "",
+             (format_request[index_bg] & bg_request_long) ? "derived_fractions " : "");
+    }
+  }
 
   pba->inter_normal=0;
   pba->inter_closeby=1;
@@ -1500,7 +1842,9 @@ int background_ncdm_test_function(
 
 /**
  * This function finds optimal quadrature weights for each ncdm
- * species
+ * species. The species are independent and initialized in parallel
+ * by background_ncdm_init_species(); the sampling of each species,
+ * hence the result, does not depend on the number of threads.
  *
  * @param ppr Input: precision structure
  * @param pba Input/Output: background structure
@@ -1511,12 +1855,10 @@ int background_ncdm_init(
                          struct background *pba
                          ) {
 
-  int index_q, k,tolexp,row,status,filenum;
-  double f0m2,f0m1,f0,f0p1,f0p2,dq,q,df0dq,tmp1,tmp2;
-  struct background_parameters_for_distributions pbadist;
-  FILE *psdfile;
-
-  pbadist.pba = pba;
+  int k,filenum;
+  int * file_index;
+  /* for the parallel region */
+  int abort;
 
   /* Allocate pointer arrays: */
   class_alloc(pba->q_ncdm, sizeof(double*)*pba->N_ncdm,pba->error_message);
@@ -1530,190 +1872,258 @@ int background_ncdm_init(
   class_alloc(pba->q_size_ncdm_bg,sizeof(int)*pba->N_ncdm,pba->error_message);
   class_alloc(pba->factor_ncdm,sizeof(double)*pba->N_ncdm,pba->error_message);
 
+  /* Position of each species in the list of p.s.d. files (-1 if the
+     distribution is not read from a file) */
+  class_alloc(file_index,sizeof(int)*pba->N_ncdm,pba->error_message);
   for(k=0, filenum=0; k<pba->N_ncdm; k++){
-    pbadist.n_ncdm = k;
-    pbadist.q = NULL;
-    pbadist.tablesize = 0;
-    /*Do we need to read in a file to interpolate the distribution function? */
     if ((pba->got_files!=NULL)&&(pba->got_files[k]==_TRUE_)){
-      psdfile = fopen(pba->ncdm_psd_files+filenum*_ARGUMENT_LENGTH_MAX_,"r");
-      class_test(psdfile == NULL,pba->error_message,
-                 "Could not open file %s!",pba->ncdm_psd_files+filenum*_ARGUMENT_LENGTH_MAX_);
-      // Find size of table:
-      for (row=0,status=2; status==2; row++){
-        status = fscanf(psdfile,"%lf %lf",&tmp1,&tmp2);
-      }
-      rewind(psdfile);
-      pbadist.tablesize = row-1;
-
-      /*Allocate room for interpolation table: */
-      class_alloc(pbadist.q,sizeof(double)*pbadist.tablesize,pba->error_message);
-      class_alloc(pbadist.f0,sizeof(double)*pbadist.tablesize,pba->error_message);
-      class_alloc(pbadist.d2f0,sizeof(double)*pbadist.tablesize,pba->error_message);
-      for (row=0; row<pbadist.tablesize; row++){
-        status = fscanf(psdfile,"%lf %lf",
-                        &pbadist.q[row],&pbadist.f0[row]);
-        //		printf("(q,f0) = (%g,%g)\n",pbadist.q[row],pbadist.f0[row]);
-      }
-      fclose(psdfile);
-      /* Call spline interpolation: */
-      class_call(array_spline_table_lines(pbadist.q,
-                                          pbadist.tablesize,
-                                          pbadist.f0,
-                                          1,
-                                          pbadist.d2f0,
-                                          _SPLINE_EST_DERIV_,
-                                          pba->error_message),
-                 pba->error_message,
-                 pba->error_message);
+      file_index[k] = filenum;
       filenum++;
     }
+    else {
+      file_index[k] = -1;
+    }
+  }
 
-    /* Handle perturbation qsampling: */
-    if (pba->ncdm_quadrature_strategy[k]==qm_auto){
-      /** Automatic q-sampling for this species */
-      class_alloc(pba->q_ncdm[k],_QUADRATURE_MAX_*sizeof(double),pba->error_message);
-      class_alloc(pba->w_ncdm[k],_QUADRATURE_MAX_*sizeof(double),pba->error_message);
-
-      class_call(get_qsampling(pba->q_ncdm[k],
-                               pba->w_ncdm[k],
-                               &(pba->q_size_ncdm[k]),
-                               _QUADRATURE_MAX_,
-                               ppr->tol_ncdm,
-                               pbadist.q,
-                               pbadist.tablesize,
-                               background_ncdm_test_function,
-                               background_ncdm_distribution,
-                               &pbadist,
-                               pba->error_message),
-                 pba->error_message,
-                 pba->error_message);
-      pba->q_ncdm[k]=realloc(pba->q_ncdm[k],pba->q_size_ncdm[k]*sizeof(double));
-      pba->w_ncdm[k]=realloc(pba->w_ncdm[k],pba->q_size_ncdm[k]*sizeof(double));
+  abort = _FALSE_;
 
+#pragma omp parallel                            \
+  shared(ppr,pba,file_index,abort)              \
+  private(k)
 
-      if (pba->background_verbose > 0)
-        printf("ncdm species i=%d sampled with %d points for purpose of perturbation integration\n",
-               k+1,
-               pba->q_size_ncdm[k]);
+  {
 
-      /* Handle background q_sampling: */
-      class_alloc(pba->q_ncdm_bg[k],_QUADRATURE_MAX_BG_*sizeof(double),pba->error_message);
-      class_alloc(pba->w_ncdm_bg[k],_QUADRATURE_MAX_BG_*sizeof(double),pba->error_message);
-
-      class_call(get_qsampling(pba->q_ncdm_bg[k],
-                               pba->w_ncdm_bg[k],
-                               &(pba->q_size_ncdm_bg[k]),
-                               _QUADRATURE_MAX_BG_,
-                               ppr->tol_ncdm_bg,
-                               pbadist.q,
-                               pbadist.tablesize,
-                               background_ncdm_test_function,
-                               background_ncdm_distribution,
-                               &pbadist,
-                               pba->error_message),
-                 pba->error_message,
-                 pba->error_message);
+#pragma omp for schedule (dynamic,1)
+
+    for(k=0; k<pba->N_ncdm; k++){
+
+      class_call_parallel(background_ncdm_init_species(ppr,pba,k,file_index[k]),
+                          pba->error_message,
+                          pba->error_message);
+
+#pragma omp flush(abort)
 
+    }
+
+  } /* end of parallel region */
 
-      pba->q_ncdm_bg[k]=realloc(pba->q_ncdm_bg[k],pba->q_size_ncdm_bg[k]*sizeof(double));
-      pba->w_ncdm_bg[k]=realloc(pba->w_ncdm_bg[k],pba->q_size_ncdm_bg[k]*sizeof(double));
+  free(file_index);
 
-      /** - in verbose mode, inform user of number of sampled momenta
-          for background quantities */
-      if (pba->background_verbose > 0)
+  if (abort == _TRUE_) return _FAILURE_;
+
+  /** - in verbose mode, inform user of number of sampled momenta,
+      in the order of the species */
+  if (pba->background_verbose > 0) {
+    for(k=0; k<pba->N_ncdm; k++){
+      if (pba->ncdm_quadrature_strategy[k]==qm_auto){
+        printf("ncdm species i=%d sampled with %d points for purpose of perturbation integration\n",
+               k+1,
+               pba->q_size_ncdm[k]);
         printf("ncdm species i=%d sampled with %d points for purpose of background integration\n",
                k+1,
                pba->q_size_ncdm_bg[k]);
-    }
-    else{
-      /** Manual q-sampling for this species. Same sampling used for both perturbation and background sampling, since this will usually be a high precision setting anyway */
-      pba->q_size_ncdm_bg[k] = pba->ncdm_input_q_size[k];
-      pba->q_size_ncdm[k] = pba->ncdm_input_q_size[k];
-      class_alloc(pba->q_ncdm_bg[k],pba->q_size_ncdm_bg[k]*sizeof(double),pba->error_message);
-      class_alloc(pba->w_ncdm_bg[k],pba->q_size_ncdm_bg[k]*sizeof(double),pba->error_message);
-      class_alloc(pba->q_ncdm[k],pba->q_size_ncdm[k]*sizeof(double),pba->error_message);
-      class_alloc(pba->w_ncdm[k],pba->q_size_ncdm[k]*sizeof(double),pba->error_message);
-      class_call(get_qsampling_manual(pba->q_ncdm[k],
-                                      pba->w_ncdm[k],
-                                      pba->q_size_ncdm[k],
-                                      pba->ncdm_qmax[k],
-                                      pba->ncdm_quadrature_strategy[k],
-                                      pbadist.q,
-                                      pbadist.tablesize,
-                                      background_ncdm_distribution,
-                                      &pbadist,
-                                      pba->error_message),
-                 pba->error_message,
-                 pba->error_message);
-      for (index_q=0; index_q<pba->q_size_ncdm[k]; index_q++) {
-        pba->q_ncdm_bg[k][index_q] = pba->q_ncdm[k][index_q];
-        pba->w_ncdm_bg[k][index_q] = pba->w_ncdm[k][index_q];
       }
-      /** - in verbose mode, inform user of number of sampled momenta
-          for background quantities */
-      if (pba->background_verbose > 0)
+      else{
         printf("ncdm species i=%d sampled with %d points for purpose of background andperturbation integration using the manual method\n",
                k+1,
                pba->q_size_ncdm[k]);
+      }
     }
+  }
 
-    class_alloc(pba->dlnf0_dlnq_ncdm[k],
-                pba->q_size_ncdm[k]*sizeof(double),
-                pba->error_message);
+  return _SUCCESS_;
+}
+
+/**
+ * Find the quadrature weights of one ncdm species, and the
+ * logarithmic derivative of its distribution at the sampled momenta.
+ * This only writes the arrays of species k, so that several species
+ * can be initialized at the same time.
+ *
+ * @param ppr      Input: precision structure
+ * @param pba      Input/Output: background structure
+ * @param k        Input: index of the ncdm species
+ * @param filenum  Input: index of its p.s.d. file in pba->ncdm_psd_files, if read from a file
+ * @return the error status
+ */
+
+int background_ncdm_init_species(
+                                 struct precision *ppr,
+                                 struct background *pba,
+                                 int k,
+                                 int filenum
+                                 ) {
+
+  int index_q,tolexp,row,status;
+  double f0m2,f0m1,f0,f0p1,f0p2,dq,q,df0dq,tmp1,tmp2;
+  struct background_parameters_for_distributions pbadist;
+  FILE *psdfile;
 
+  pbadist.pba = pba;
+
+  pbadist.n_ncdm = k;
+  pbadist.q = NULL;
+  pbadist.tablesize = 0;
+  /*Do we need to read in a file to interpolate the distribution function? */
+  if ((pba->got_files!=NULL)&&(pba->got_files[k]==_TRUE_)){
+    psdfile = fopen(pba->ncdm_psd_files+filenum*_ARGUMENT_LENGTH_MAX_,"r");
+    class_test(psdfile == NULL,pba->error_message,
+               "Could not open file %s!",pba->ncdm_psd_files+filenum*_ARGUMENT_LENGTH_MAX_);
+    // Find size of table:
+    for (row=0,status=2; status==2; row++){
+      status = fscanf(psdfile,"%lf %lf",&tmp1,&tmp2);
+    }
+    rewind(psdfile);
+    pbadist.tablesize = row-1;
+
+    /*Allocate room for interpolation table: */
+    class_alloc(pbadist.q,sizeof(double)*pbadist.tablesize,pba->error_message);
+    class_alloc(pbadist.f0,sizeof(double)*pbadist.tablesize,pba->error_message);
+    class_alloc(pbadist.d2f0,sizeof(double)*pbadist.tablesize,pba->error_message);
+    for (row=0; row<pbadist.tablesize; row++){
+      status = fscanf(psdfile,"%lf %lf",
+                      &pbadist.q[row],&pbadist.f0[row]);
+      //		printf("(q,f0) = (%g,%g)\n",pbadist.q[row],pbadist.f0[row]);
+    }
+    fclose(psdfile);
+    /* Call spline interpolation: */
+    class_call(array_spline_table_lines(pbadist.q,
+                                        pbadist.tablesize,
+                                        pbadist.f0,
+                                        1,
+                                        pbadist.d2f0,
+                                        _SPLINE_EST_DERIV_,
+                                        pba->error_message),
+               pba->error_message,
+               pba->error_message);
+  }
 
+  /* Handle perturbation qsampling: */
+  if (pba->ncdm_quadrature_strategy[k]==qm_auto){
+    /** Automatic q-sampling for this species */
+    class_alloc(pba->q_ncdm[k],_QUADRATURE_MAX_*sizeof(double),pba->error_message);
+    class_alloc(pba->w_ncdm[k],_QUADRATURE_MAX_*sizeof(double),pba->error_message);
+
+    class_call(get_qsampling_cached(pba->q_ncdm[k],
+                                    pba->w_ncdm[k],
+                                    &(pba->q_size_ncdm[k]),
+                                    _QUADRATURE_MAX_,
+                                    ppr->tol_ncdm,
+                                    pbadist.q,
+                                    pbadist.tablesize,
+                                    background_ncdm_test_function,
+                                    background_ncdm_distribution,
+                                    &pbadist,
+                                    pba->quadrature_cache_directory,
+                                    pba->error_message),
+               pba->error_message,
+               pba->error_message);
+    pba->q_ncdm[k]=realloc(pba->q_ncdm[k],pba->q_size_ncdm[k]*sizeof(double));
+    pba->w_ncdm[k]=realloc(pba->w_ncdm[k],pba->q_size_ncdm[k]*sizeof(double));
+
+    /* Handle background q_sampling: */
+    class_alloc(pba->q_ncdm_bg[k],_QUADRATURE_MAX_BG_*sizeof(double),pba->error_message);
+    class_alloc(pba->w_ncdm_bg[k],_QUADRATURE_MAX_BG_*sizeof(double),pba->error_message);
+
+    class_call(get_qsampling_cached(pba->q_ncdm_bg[k],
+                                    pba->w_ncdm_bg[k],
+                                    &(pba->q_size_ncdm_bg[k]),
+                                    _QUADRATURE_MAX_BG_,
+                                    ppr->tol_ncdm_bg,
+                                    pbadist.q,
+                                    pbadist.tablesize,
+                                    background_ncdm_test_function,
+                                    background_ncdm_distribution,
+                                    &pbadist,
+                                    pba->quadrature_cache_directory,
+                                    pba->error_message),
+               pba->error_message,
+               pba->error_message);
+
+
+    pba->q_ncdm_bg[k]=realloc(pba->q_ncdm_bg[k],pba->q_size_ncdm_bg[k]*sizeof(double));
+    pba->w_ncdm_bg[k]=realloc(pba->w_ncdm_bg[k],pba->q_size_ncdm_bg[k]*sizeof(double));
+  }
+  else{
+    /** Manual q-sampling for this species. Same sampling used for both perturbation and background sampling, since this will usually be a high precision setting anyway */
+    pba->q_size_ncdm_bg[k] = pba->ncdm_input_q_size[k];
+    pba->q_size_ncdm[k] = pba->ncdm_input_q_size[k];
+    class_alloc(pba->q_ncdm_bg[k],pba->q_size_ncdm_bg[k]*sizeof(double),pba->error_message);
+    class_alloc(pba->w_ncdm_bg[k],pba->q_size_ncdm_bg[k]*sizeof(double),pba->error_message);
+    class_alloc(pba->q_ncdm[k],pba->q_size_ncdm[k]*sizeof(double),pba->error_message);
+    class_alloc(pba->w_ncdm[k],pba->q_size_ncdm[k]*sizeof(double),pba->error_message);
+    class_call(get_qsampling_manual(pba->q_ncdm[k],
+                                    pba->w_ncdm[k],
+                                    pba->q_size_ncdm[k],
+                                    pba->ncdm_qmax[k],
+                                    pba->ncdm_quadrature_strategy[k],
+                                    pbadist.q,
+                                    pbadist.tablesize,
+                                    background_ncdm_distribution,
+                                    &pbadist,
+                                    pba->error_message),
+               pba->error_message,
+               pba->error_message);
     for (index_q=0; index_q<pba->q_size_ncdm[k]; index_q++) {
-      q = pba->q_ncdm[k][index_q];
-      class_call(background_ncdm_distribution(&pbadist,q,&f0),
-                 pba->error_message,pba->error_message);
+      pba->q_ncdm_bg[k][index_q] = pba->q_ncdm[k][index_q];
+      pba->w_ncdm_bg[k][index_q] = pba->w_ncdm[k][index_q];
+    }
+  }
 
-      //Loop to find appropriate dq:
-      for(tolexp=_PSD_DERIVATIVE_EXP_MIN_; tolexp<_PSD_DERIVATIVE_EXP_MAX_; tolexp++){
+  class_alloc(pba->dlnf0_dlnq_ncdm[k],
+              pba->q_size_ncdm[k]*sizeof(double),
+              pba->error_message);
 
-        if (index_q == 0){
-          dq = MIN((0.5-ppr->smallest_allowed_variation)*q,2*exp(tolexp)*(pba->q_ncdm[k][index_q+1]-q));
-        }
-        else if (index_q == pba->q_size_ncdm[k]-1){
-          dq = exp(tolexp)*2.0*(pba->q_ncdm[k][index_q]-pba->q_ncdm[k][index_q-1]);
-        }
-        else{
-          dq = exp(tolexp)*(pba->q_ncdm[k][index_q+1]-pba->q_ncdm[k][index_q-1]);
-        }
 
-        class_call(background_ncdm_distribution(&pbadist,q-2*dq,&f0m2),
-                   pba->error_message,pba->error_message);
-        class_call(background_ncdm_distribution(&pbadist,q+2*dq,&f0p2),
-                   pba->error_message,pba->error_message);
+  for (index_q=0; index_q<pba->q_size_ncdm[k]; index_q++) {
+    q = pba->q_ncdm[k][index_q];
+    class_call(background_ncdm_distribution(&pbadist,q,&f0),
+               pba->error_message,pba->error_message);
 
-        if (fabs((f0p2-f0m2)/f0)>sqrt(ppr->smallest_allowed_variation)) break;
+    //Loop to find appropriate dq:
+    for(tolexp=_PSD_DERIVATIVE_EXP_MIN_; tolexp<_PSD_DERIVATIVE_EXP_MAX_; tolexp++){
+
+      if (index_q == 0){
+        dq = MIN((0.5-ppr->smallest_allowed_variation)*q,2*exp(tolexp)*(pba->q_ncdm[k][index_q+1]-q));
+      }
+      else if (index_q == pba->q_size_ncdm[k]-1){
+        dq = exp(tolexp)*2.0*(pba->q_ncdm[k][index_q]-pba->q_ncdm[k][index_q-1]);
+      }
+      else{
+        dq = exp(tolexp)*(pba->q_ncdm[k][index_q+1]-pba->q_ncdm[k][index_q-1]);
       }
 
-      class_call(background_ncdm_distribution(&pbadist,q-dq,&f0m1),
+      class_call(background_ncdm_distribution(&pbadist,q-2*dq,&f0m2),
                  pba->error_message,pba->error_message);
-      class_call(background_ncdm_distribution(&pbadist,q+dq,&f0p1),
+      class_call(background_ncdm_distribution(&pbadist,q+2*dq,&f0p2),
                  pba->error_message,pba->error_message);
-      //5 point estimate of the derivative:
-      df0dq = (+f0m2-8*f0m1+8*f0p1-f0p2)/12.0/dq;
-      //printf("df0dq[%g] = %g. dlf=%g ?= %g. f0 =%g.\n",q,df0dq,q/f0*df0dq,
-      //Avoid underflow in extreme tail:
-      if (fabs(f0)==0.)
-        pba->dlnf0_dlnq_ncdm[k][index_q] = -q; /* valid for whatever f0 with exponential tail in exp(-q) */
-      else
-        pba->dlnf0_dlnq_ncdm[k][index_q] = q/f0*df0dq;
-    }
 
-    pba->factor_ncdm[k]=pba->deg_ncdm[k]*4*_PI_*pow(pba->T_cmb*pba->T_ncdm[k]*_k_B_,4)*8*_PI_*_G_
-      /3./pow(_h_P_/2./_PI_,3)/pow(_c_,7)*_Mpc_over_m_*_Mpc_over_m_;
-
-    /* If allocated, deallocate interpolation table:  */
-    if ((pba->got_files!=NULL)&&(pba->got_files[k]==_TRUE_)){
-      free(pbadist.q);
-      free(pbadist.f0);
-      free(pbadist.d2f0);
+      if (fabs((f0p2-f0m2)/f0)>sqrt(ppr->smallest_allowed_variation)) break;
     }
+
+    class_call(background_ncdm_distribution(&pbadist,q-dq,&f0m1),
+               pba->error_message,pba->error_message);
+    class_call(background_ncdm_distribution(&pbadist,q+dq,&f0p1),
+               pba->error_message,pba->error_message);
+    //5 point estimate of the derivative:
+    df0dq = (+f0m2-8*f0m1+8*f0p1-f0p2)/12.0/dq;
+    //printf("df0dq[%g] = %g. dlf=%g ?= %g. f0 =%g.\n",q,df0dq,q/f0*df0dq,
+    //Avoid underflow in extreme tail:
+    if (fabs(f0)==0.)
+      pba->dlnf0_dlnq_ncdm[k][index_q] = -q; /* valid for whatever f0 with exponential tail in exp(-q) */
+    else
+      pba->dlnf0_dlnq_ncdm[k][index_q] = q/f0*df0dq;
   }
 
+  pba->factor_ncdm[k]=pba->deg_ncdm[k]*4*_PI_*pow(pba->T_cmb*pba->T_ncdm[k]*_k_B_,4)*8*_PI_*_G_
+    /3./pow(_h_P_/2./_PI_,3)/pow(_c_,7)*_Mpc_over_m_*_Mpc_over_m_;
+
+  /* If allocated, deallocate interpolation table:  */
+  if ((pba->got_files!=NULL)&&(pba->got_files[k]==_TRUE_)){
+    free(pbadist.q);
+    free(pbadist.f0);
+    free(pbadist.d2f0);
+  }
 
   return _SUCCESS_;
 }
@@ -1910,6 +2320,9 @@ int background_solve(
   class_alloc(pvecback,pba->bg_size*sizeof(double),pba->error_message);
   bpaw.pvecback = pvecback;
 
+  /* the uniform tables are only used once they have been filled below */
+  pba->has_uniform_tables = _FALSE_;
+
   /** - allocate vector of quantities to be integrated */
   class_alloc(pvecback_integration,pba->bi_size*sizeof(double),pba->error_message);
 
@@ -2119,6 +2532,45 @@ int background_solve(
              pba->error_message,
              pba->error_message);
 
+  /** - resample the splined tables on uniform grids in \f$ \ln\tau \f$ and
+      \f$ \ln(1+z) \f$ with background_uniform_table_init(), so that
+      background_at_tau() and background_tau_of_z() do not need to
+      search the tables */
+  if (ppr->background_uniform_tables == _TRUE_) {
+
+    class_call(background_uniform_table_init(pba->tau_table,
+                                             pba->bt_size,
+                                             pba->background_table,
+                                             pba->d2background_dtau2_table,
+                                             pba->bg_size,
+                                             0.,
+                                             ppr->back_uniform_stepsize,
+                                             &(pba->bt_uniform_size),
+                                             &(pba->lntau_uniform_min),
+                                             &(pba->dlntau_uniform),
+                                             &(pba->background_uniform_table),
+                                             pba->error_message),
+               pba->error_message,
+               pba->error_message);
+
+    class_call(background_uniform_table_init(pba->z_table,
+                                             pba->bt_size,
+                                             pba->tau_table,
+                                             pba->d2tau_dz2_table,
+                                             1,
+                                             1.,
+                                             ppr->back_uniform_stepsize,
+                                             &(pba->zt_uniform_size),
+                                             &(pba->lnz_uniform_min),
+                                             &(pba->dlnz_uniform),
+                                             &(pba->tau_uniform_table),
+                                             pba->error_message),
+               pba->error_message,
+               pba->error_message);
+
+    pba->has_uniform_tables = _TRUE_;
+  }
+
   /** - compute remaining "related parameters" */
 
   /**  - so-called "effective neutrino number", computed at earliest
@@ -2202,6 +2654,7 @@ int background_initial_conditions(
 
   double rho_ncdm, p_ncdm, rho_ncdm_rel_tot=0.;
   double rho_lrs, p_lrs, rho_lrs_rel_tot=0.;
+  struct lrs_moments mom_lrs;
   double f,Omega_rad, rho_rad;
   int counter,is_early_enough,n_ncdm;
   double scf_lambda;
@@ -2267,20 +2720,18 @@ int background_initial_conditions(
 		 pba->error_message,
 		 pba->error_message); 
 
-      class_call(background_lrs_momenta(pba->q_lrs_bg,
+      class_call(background_lrs_moments(pba->q_lrs_bg,
 					pba->w_lrs_bg,
 					pba->q_size_lrs_bg,
 					get_mT_over_T0_lrs(pba, phi_M_lrs),
 					pba->factor_lrs,
 					pba->a_today/a-1.0,
-					&rho_lrs,
-					&p_lrs,
-					NULL,
-					NULL,
-					NULL,
-					NULL),
+					lrs_mom_rho | lrs_mom_p,
+					&mom_lrs),
 		 pba->error_message,
 		 pba->error_message);
+      rho_lrs = mom_lrs.rho;
+      p_lrs = mom_lrs.p;
       rho_lrs_rel_tot += 3.*p_lrs;
       if (fabs(p_lrs/rho_lrs-1./3.)>ppr->tol_lrs_initial_w)
 	is_early_enough = _FALSE_;
@@ -2687,7 +3138,7 @@ int background_derivs(
   pvecback = pbpaw->pvecback;
 
   /** - calculate functions of \f$ a \f$ with background_functions() */
-  class_call(background_functions(pba, y, pba->normal_info, pvecback),
+  class_call(background_functions(pba, y, pba->derivs_info, pvecback),
              pba->error_message,
              error_message);
 
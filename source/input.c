@@ -5,6 +5,8 @@
 
 #include "input.h"
 #include "longrange.h"
+#include <time.h>
+#include <sys/stat.h>
 
 /**
  * Use this routine to extract initial parameters from files 'xxx.ini'
@@ -216,6 +218,7 @@ int input_init(
   double xzero;
   int target_indices[_NUM_TARGETS_];
   double *dxdF, *x_inout;
+  double tstart, tstop;
 
   char string1[_ARGUMENT_LENGTH_MAX_];
   FILE * param_output;
@@ -225,6 +228,11 @@ int input_init(
 
   struct fzerofun_workspace fzw;
 
+  class_profile_start(profile_input_init);
+
+  /* no previous shot yet (see input_try_unknown_parameters()) */
+  pba->shooting_previous = NULL;
+
   /**
    * Before getting into the assignment of parameters,
    * and before the shooting, we want to already fix our precision parameters.
@@ -373,6 +381,14 @@ int input_init(
       //printf("%d, %d: %s\n",counter,index_target,target_namestrings[index_target]);
     }
 
+    fzw.has_ba_previous = _FALSE_;
+
+#ifdef _OPENMP
+    tstart = omp_get_wtime();
+#else
+    tstart = (double)clock()/CLOCKS_PER_SEC;
+#endif
+
     if (unknown_parameters_size == 1){
       if (input_verbose > 0) {
         fprintf(
@@ -446,8 +462,21 @@ int input_init(
       free(dxdF);
     }
 
+    /* the structure of the last shot is not needed anymore */
+    if (fzw.has_ba_previous == _TRUE_) {
+      class_call(background_free_input(&(fzw.ba_previous)),
+                 fzw.ba_previous.error_message,
+                 errmsg);
+    }
+
+#ifdef _OPENMP
+    tstop = omp_get_wtime();
+#else
+    tstop = (double)clock()/CLOCKS_PER_SEC;
+#endif
+
     if (input_verbose > 1) {
-      fprintf(stdout,"Shooting completed using %d function evaluations\n",fevals);
+      fprintf(stdout,"Shooting completed using %d function evaluations in %f s\n",fevals,tstop-tstart);
     }
 
 
@@ -513,7 +542,8 @@ int input_init(
              errmsg,
              errmsg);
 
-  if ((flag1 == _TRUE_) && ((strstr(string1,"y") != NULL) || (strstr(string1,"Y") != NULL))) {
+  /* (in an MPI run, only by the first process) */
+  if ((flag1 == _TRUE_) && ((strstr(string1,"y") != NULL) || (strstr(string1,"Y") != NULL)) && (class_mpi_rank() == 0)) {
 
     sprintf(param_output_name,"%s%s",pop->root,"parameters.ini");
     sprintf(param_unused_name,"%s%s",pop->root,"unused_parameters");
@@ -556,6 +586,7 @@ int input_init(
     }
   }
 
+  class_profile_stop(profile_input_init);
   return _SUCCESS_;
 
 }
@@ -623,6 +654,7 @@ int input_read_parameters(
   double scf_lambda;
   double fnu_factor;
   double * pointer1;
+  int * int_pointer1;
   char string1[_ARGUMENT_LENGTH_MAX_];
   char string2[_ARGUMENT_LENGTH_MAX_];
   double k1=0.;
@@ -646,6 +678,8 @@ int input_read_parameters(
   double sigma_B; /* Stefan-Boltzmann constant in \f$ W/m^2/K^4 = Kg/K^4/s^3 \f$*/
 
   double rho_ncdm;
+  /* for the parallel region */
+  int abort;
   double R0,R1,R2,R3,R4;
   double PSR0,PSR1,PSR2,PSR3,PSR4;
   double HSR0,HSR1,HSR2,HSR3,HSR4;
@@ -1102,6 +1136,9 @@ int input_read_parameters(
 
   }
 
+  /** - directory where the automatic q-samplings of ncdm and lrs species are cached */
+  class_read_string("quadrature_cache",pba->quadrature_cache_directory);
+
   /** - non-cold relics (ncdm) */
   class_read_int("N_ncdm",N_ncdm);
   if ((flag1 == _TRUE_) && (N_ncdm > 0)){
@@ -1194,24 +1231,34 @@ int input_read_parameters(
 
     /* We must calculate M from omega or vice versa if one of them is missing.
        If both are present, we must update the degeneracy parameter to
-       reflect the implicit normalization of the distribution function.*/
+       reflect the implicit normalization of the distribution function.
+       The species are independent, so this is done in parallel; the
+       total is summed afterwards in a fixed order. */
+    abort = _FALSE_;
+
+#pragma omp parallel for schedule (dynamic,1)   \
+  shared(ppr,pba,N_ncdm,abort,errmsg)           \
+  private(n,rho_ncdm,fnu_factor)
+
     for (n=0; n < N_ncdm; n++){
       if (pba->m_ncdm_in_eV[n] != 0.0){
         /* Case of only mass or mass and Omega/omega: */
         pba->M_ncdm[n] = pba->m_ncdm_in_eV[n]/_k_B_*_eV_/pba->T_ncdm[n]/pba->T_cmb;
-        class_call(background_ncdm_momenta(pba->q_ncdm_bg[n],
-                                           pba->w_ncdm_bg[n],
-                                           pba->q_size_ncdm_bg[n],
-                                           pba->M_ncdm[n],
-                                           pba->factor_ncdm[n],
-                                           0.,
-                                           NULL,
-                                           &rho_ncdm,
-                                           NULL,
-                                           NULL,
-                                           NULL),
-                   pba->error_message,
-                   errmsg);
+        class_call_parallel(background_ncdm_momenta(pba->q_ncdm_bg[n],
+                                                    pba->w_ncdm_bg[n],
+                                                    pba->q_size_ncdm_bg[n],
+                                                    pba->M_ncdm[n],
+                                                    pba->factor_ncdm[n],
+                                                    0.,
+                                                    NULL,
+                                                    &rho_ncdm,
+                                                    NULL,
+                                                    NULL,
+                                                    NULL),
+                            pba->error_message,
+                            errmsg);
+        if (abort == _TRUE_)
+          continue;
         if (pba->Omega0_ncdm[n] == 0.0){
           pba->Omega0_ncdm[n] = rho_ncdm/pba->H0/pba->H0;
         }
@@ -1227,12 +1274,18 @@ int input_read_parameters(
       }
       else{
         /* Case of only Omega/omega: */
-        class_call(background_ncdm_M_from_Omega(ppr,pba,n),
-                   pba->error_message,
-                   errmsg);
+        class_call_parallel(background_ncdm_M_from_Omega(ppr,pba,n),
+                            pba->error_message,
+                            errmsg);
         //printf("M_ncdm:%g\n",pba->M_ncdm[n]);
         pba->m_ncdm_in_eV[n] = _k_B_/_eV_*pba->T_ncdm[n]*pba->M_ncdm[n]*pba->T_cmb;
       }
+#pragma omp flush(abort)
+    }
+
+    if (abort == _TRUE_) return _FAILURE_;
+
+    for (n=0; n < N_ncdm; n++){
       pba->Omega0_ncdm_tot += pba->Omega0_ncdm[n];
       //printf("Adding %g to total Omega..\n",pba->Omega0_ncdm[n]);
     }
@@ -1321,6 +1374,9 @@ int input_read_parameters(
 
     // Compute the vacuum fermion mass over its *present day* temperature
     pba->lrs_m_F_over_T0 = pba->lrs_m_F * _eV_ / (_k_B_*pba->lrs_T_F*pba->T_cmb);
+    // Present-day fermion temperature and squared scalar mass in the units of the perturbation equations
+    pba->lrs_T0_F = pba->T_cmb*pba->lrs_T_F*_k_B_/_eV_;
+    pba->lrs_M_phi_sq = SQR(pba->lrs_M_phi * _Mpc_times_eV);
     
     // Init
     class_call(background_lrs_init(ppr, pba),
@@ -1328,66 +1384,9 @@ int input_read_parameters(
 	       errmsg);
 
     // Compute Omega_0
-    
-    /* Check for stability */
-    double a_rel_unstable_lrs;
-    class_call(instabilityOnset_lrs(pba, &a_rel_unstable_lrs),
+    class_call(background_lrs_Omega0(pba),
 	       pba->error_message,
-	       pba->error_message);
-
-    if (pba->has_lrs_nuggets == _FALSE_ || 1 < a_rel_unstable_lrs){ // Stable
-      double phi_M_lrs; // Present day scalar field times its mass (eV^2)
-      class_call(get_phi_M_lrs(pba, 0, &phi_M_lrs),
-		 pba->error_message,
-		 pba->error_message); 
-      double rho_phi = _eV4_to_rho_class * 0.5 * SQR(phi_M_lrs);
-
-      double rho_F; // Present day fermion energy density
-      class_call(background_lrs_momenta(
-					pba->q_lrs_bg,
-					pba->w_lrs_bg,
-					pba->q_size_lrs_bg,
-					get_mT_over_T0_lrs(pba, phi_M_lrs),
-					pba->factor_lrs,
-					0,
-					&rho_F,
-					NULL,
-					NULL,
-					NULL,
-					NULL,
-					NULL),
-		 pba->error_message,
-		 pba->error_message);
-
-      pba->Omega0_lrs = (rho_phi + rho_F)/SQR(pba->H0);
-    } else { // Unstable: nuggets have formed
-      double phi_M_lrs;
-      // Compute the total energy density at the stable-unstable transition
-      class_call(get_phi_M_lrs(pba, 1./a_rel_unstable_lrs-1., &phi_M_lrs),
-		 pba->error_message,
-		 pba->error_message);
-      double mT_over_T0_lrs = get_mT_over_T0_lrs(pba, phi_M_lrs);
-      double rho_phi = _eV4_to_rho_class * 0.5 * SQR(phi_M_lrs);
-      double rho_F;
-      class_call(background_lrs_momenta(
-					pba->q_lrs_bg,
-					pba->w_lrs_bg,
-					pba->q_size_lrs_bg,
-					mT_over_T0_lrs,
-					pba->factor_lrs,
-					1./a_rel_unstable_lrs-1.,
-					&rho_F,
-					NULL,
-					NULL,
-					NULL,
-					NULL,
-					NULL),
-		 pba->error_message,
-		 pba->error_message);
-
-      double rho_lrs = (rho_phi + rho_F) / CUB(1 / a_rel_unstable_lrs); // Redshift the energy-density as dust
-      pba->Omega0_lrs = rho_lrs/SQR(pba->H0);
-    }
+	       errmsg);
 
     Omega_tot += pba->Omega0_lrs;
 
@@ -2532,9 +2531,12 @@ int input_read_parameters(
   else if (ppm->primordial_spec_type == external_Pk) {
     class_call(parser_read_string(pfc, "command", &(string1), &(flag1), errmsg),
                errmsg, errmsg);
-    class_test(strlen(string1) == 0,
-               errmsg,
-               "You omitted to write a command for the external Pk");
+
+    /* the command may be omitted when a function ppm->external_pk_function
+       is passed after input_init(): an empty command is then only
+       rejected by the primordial module if no function was passed */
+    if (flag1 == _FALSE_)
+      string1[0] = '\0';
 
     ppm->command = (char *) malloc (strlen(string1) + 1);
     strcpy(ppm->command, string1);
@@ -2829,6 +2831,44 @@ int input_read_parameters(
         class_stop(errmsg,
                    "Input for non_diagonal is %d, while it is expected to be between 0 and %d\n",
                    psp->non_diag,ppt->selection_num-1);
+
+      /* explicit list of pairs of bins, replacing non_diagonal */
+      class_call(parser_read_list_of_integers(pfc,
+                                              "non_diagonal_pairs",
+                                              &(int1),
+                                              &(int_pointer1),
+                                              &flag1,
+                                              errmsg),
+                 errmsg,
+                 errmsg);
+
+      if (flag1 == _TRUE_) {
+        class_test(int1%2 != 0,
+                   errmsg,
+                   "non_diagonal_pairs should contain pairs of bin numbers, but it has an odd number (%d) of entries",int1);
+        class_test(int1/2 > _SELECTION_PAIR_NUM_MAX_,
+                   errmsg,
+                   "you asked for %d pairs of bins in non_diagonal_pairs, but the maximum is set to %d; increase _SELECTION_PAIR_NUM_MAX_ in include/spectra.h",
+                   int1/2,_SELECTION_PAIR_NUM_MAX_);
+        psp->non_diag = 0;
+        psp->non_diag_pair_num = 0;
+        for (i=0; i<int1/2; i++) {
+          class_test((int_pointer1[2*i] < 1) || (int_pointer1[2*i] > ppt->selection_num) ||
+                     (int_pointer1[2*i+1] < 1) || (int_pointer1[2*i+1] > ppt->selection_num),
+                     errmsg,
+                     "pair of bins (%d,%d) in non_diagonal_pairs: bins should be numbered between 1 and %d",
+                     int_pointer1[2*i],int_pointer1[2*i+1],ppt->selection_num);
+          /* auto-correlations are always computed */
+          if (int_pointer1[2*i] != int_pointer1[2*i+1]) {
+            psp->non_diag_pair[2*psp->non_diag_pair_num] = int_pointer1[2*i]-1;
+            psp->non_diag_pair[2*psp->non_diag_pair_num+1] = int_pointer1[2*i+1]-1;
+            psp->non_diag_pair_num++;
+          }
+        }
+        free(int_pointer1);
+      }
+
+      class_read_double("non_diagonal_max_gap",psp->non_diag_max_gap);
     }
 
     class_call(parser_read_string(pfc,
@@ -2953,14 +2993,18 @@ int input_read_parameters(
 
   if (flag1 == _TRUE_) {
 
+    if ((strstr(string1,"npy") != NULL) || (strstr(string1,"NPY") != NULL))
+      pop->write_npy = _TRUE_;
+
     if ((strstr(string1,"class") != NULL) || (strstr(string1,"CLASS") != NULL))
       pop->output_format = class_format;
     else {
       if ((strstr(string1,"camb") != NULL) || (strstr(string1,"CAMB") != NULL))
         pop->output_format = camb_format;
       else
-        class_stop(errmsg,
-                   "You wrote: format='%s'. Could not identify any of the possible formats ('class', 'CLASS', 'camb', 'CAMB')",string1);
+        class_test(pop->write_npy == _FALSE_,
+                   errmsg,
+                   "You wrote: format='%s'. Could not identify any of the possible formats ('class', 'CLASS', 'camb', 'CAMB', possibly followed by 'npy')",string1);
     }
   }
 
@@ -3093,9 +3137,24 @@ int input_read_parameters(
         ppt->tensor_method = tm_photons_only;
       if (strstr(string1,"massless") != NULL)
         ppt->tensor_method = tm_massless_approximation;
+  ppt->tensor_method_lrs = tm_massless_approximation;
       if (strstr(string1,"exact") != NULL)
         ppt->tensor_method = tm_exact;
     }
+
+    /** - ---> Treatment of the lrs fermions in tensor computation (by default, as the other species) */
+    ppt->tensor_method_lrs = ppt->tensor_method;
+    class_call(parser_read_string(pfc,"tensor method lrs",&string1,&flag1,errmsg),
+               errmsg,
+               errmsg);
+    if (flag1 == _TRUE_) {
+      if (strstr(string1,"photons") != NULL)
+        ppt->tensor_method_lrs = tm_photons_only;
+      if (strstr(string1,"massless") != NULL)
+        ppt->tensor_method_lrs = tm_massless_approximation;
+      if (strstr(string1,"exact") != NULL)
+        ppt->tensor_method_lrs = tm_exact;
+    }
   }
 
   /** - ---> derivatives of baryon sound speed only computed if some non-minimal tight-coupling schemes is requested */
@@ -3241,6 +3300,64 @@ int input_read_parameters(
     pop->write_perturbations = _TRUE_;
   }
 
+  /** - (i.3.a) shall we evolve only the wavenumbers in k_output_values? In that case, no source function is computed, and all the modules following the perturbation one are skipped */
+
+  class_call(parser_read_string(pfc,"k_output_values_only",&string1,&flag1,errmsg),
+             errmsg,
+             errmsg);
+
+  if ((flag1 == _TRUE_) && ((strstr(string1,"y") != NULL) || (strstr(string1,"Y") != NULL))) {
+
+    class_test(ppt->k_output_values_num == 0,
+               errmsg,
+               "you set 'k_output_values_only' to yes without giving any 'k_output_values'");
+
+    class_test(pnl->method != nl_none,
+               errmsg,
+               "'k_output_values_only' is not compatible with non-linear corrections, which need the full matter power spectrum");
+
+    ppt->k_output_values_only = _TRUE_;
+    ppt->has_perturbations = _TRUE_;
+
+    /* no source function, hence no spectrum and no transfer function */
+    ppt->has_cls = _FALSE_;
+    ppt->has_cl_cmb_temperature = _FALSE_;
+    ppt->has_cl_cmb_polarization = _FALSE_;
+    ppt->has_cl_cmb_lensing_potential = _FALSE_;
+    ppt->has_cl_number_count = _FALSE_;
+    ppt->has_cl_lensing_potential = _FALSE_;
+    ppt->has_pk_matter = _FALSE_;
+    ppt->has_density_transfers = _FALSE_;
+    ppt->has_velocity_transfers = _FALSE_;
+    ple->has_lensed_cls = _FALSE_;
+  }
+
+  /** - (i.3.b) directory where the source functions are cached between runs with the same inputs */
+
+  class_read_string("perturbations_cache",ppt->cache_directory);
+
+  /** - (i.3.c) directory where the table of flat spherical Bessel functions is cached between runs */
+
+  class_read_string("bessel_cache",ptr->bessel_cache_directory);
+
+  /** - (i.3.d) number of multipoles of the blocks of transfer functions computed by the spectra module, if they are not all stored */
+
+  class_read_int("transfer_l_block_size",ptr->l_block_size);
+
+  class_test(ptr->l_block_size < 0,
+             errmsg,
+             "transfer_l_block_size=%d should be positive (or zero for storing all transfer functions)",ptr->l_block_size);
+
+  /** - (i.3.e) shall we free the tables of each module as soon as the following modules have used them? The source functions are kept if the transfer functions in Fourier space are requested, since they are computed from them on demand */
+
+  class_call(parser_read_string(pfc,"low_memory",&string1,&flag1,errmsg),
+             errmsg,
+             errmsg);
+
+  if ((flag1 == _TRUE_) && ((strstr(string1,"y") != NULL) || (strstr(string1,"Y") != NULL))) {
+    ppt->low_memory = _TRUE_;
+  }
+
   /** - (i.4.) shall we write primordial spectra in a file? */
 
   class_call(parser_read_string(pfc,"write primordial",&string1,&flag1,errmsg),
@@ -3251,6 +3368,10 @@ int input_read_parameters(
 
     pop->write_primordial = _TRUE_;
 
+    class_test(ppt->k_output_values_only == _TRUE_,
+               errmsg,
+               "'k_output_values_only' is not compatible with 'write primordial', since the primordial spectra are not computed in that case");
+
   }
 
   /** - (i.5) special steps if we want Halofit with wa_fld non-zero:
@@ -3280,6 +3401,14 @@ int input_read_parameters(
                errmsg);
   }
 
+  /** - (i.6) key of the cache file of the source functions */
+
+  if (ppt->cache_directory[0] != '\0') {
+    class_call(input_perturbations_cache_key(pfc,&(ppt->cache_key),&(ppt->cache_family_key),errmsg),
+               errmsg,
+               errmsg);
+  }
+
   return _SUCCESS_;
 
 }
@@ -3356,6 +3485,7 @@ int input_default_params(
   pba->deg_ncdm = NULL;
   pba->ncdm_psd_parameters = NULL;
   pba->ncdm_psd_files = NULL;
+  pba->quadrature_cache_directory[0] = '\0';
 
   pba->Omega0_scf = 0.; /* Scalar field defaults */
   pba->attractor_ic_scf = _TRUE_;
@@ -3371,11 +3501,16 @@ int input_default_params(
   pba->lrs_g_F = 0;
   pba->lrs_T_F = 0.;
   pba->lrs_m_F_over_T0 = 0.;
+  pba->lrs_T0_F = 0.;
+  pba->lrs_M_phi_sq = 0.;
   pba->lrs_M_phi = 0.;
   pba->Omega0_lrs = 0.;
   pba->lrs_quadrature_strategy = 0;
   pba->lrs_input_q_size = -1;
   pba->lrs_qmax = 15.;
+  pba->lrs_phi_table_size = 0;
+  pba->lrs_phi_table_lnphi = NULL;
+  pba->lrs_phi_table_dd = NULL;
   pba->has_lrs = _FALSE_;
   ppt->has_lrs_phi_pt = _FALSE_;
   pba->has_lrs_nuggets = _FALSE_;
@@ -3495,6 +3630,11 @@ int input_default_params(
   ppt->has_Nbody_gauge_transfers = _FALSE_;
 
   ppt->k_output_values_num=0;
+  ppt->k_output_values_only = _FALSE_;
+  ppt->cache_directory[0] = '\0';
+  ppt->low_memory = _FALSE_;
+  ppt->cache_key = 0;
+  ppt->cache_family_key = 0;
   ppt->store_perturbations = _FALSE_;
 
   ppt->three_ceff2_ur=1.;
@@ -3585,6 +3725,8 @@ int input_default_params(
   ppm->custom8=0.;
   ppm->custom9=0.;
   ppm->custom10=0.;
+  ppm->external_pk_function=NULL;
+  ppm->external_pk_parameters=NULL;
 
   /** - nonlinear structure */
 
@@ -3603,6 +3745,8 @@ int input_default_params(
   ptr->lcmb_pivot=0.1;
   ptr->lcmb_tilt=0.;
   ptr->initialise_HIS_cache=_FALSE_;
+  ptr->bessel_cache_directory[0] = '\0';
+  ptr->l_block_size = 0;
   ptr->has_nz_analytic = _FALSE_;
   ptr->has_nz_file = _FALSE_;
   ptr->has_nz_evo_analytic = _FALSE_;
@@ -3612,6 +3756,8 @@ int input_default_params(
 
   psp->z_max_pk = pop->z_pk[0];
   psp->non_diag=0;
+  psp->non_diag_pair_num=0;
+  psp->non_diag_max_gap=-1.;
 
   /** - lensing structure */
 
@@ -3624,6 +3770,7 @@ int input_default_params(
   sprintf(pop->root,"output/");
   pop->write_header = _TRUE_;
   pop->output_format = class_format;
+  pop->write_npy = _FALSE_;
   pop->write_background = _FALSE_;
   pop->write_thermodynamics = _FALSE_;
   pop->write_perturbations = _FALSE_;
@@ -3862,6 +4009,13 @@ int input_try_unknown_parameters(double * unknown_parameter,
              errmsg,
              errmsg);
 
+  /* tables which do not depend on the unknown parameters are
+     taken from the previous shot, if any */
+  if (pfzw->has_ba_previous == _TRUE_)
+    ba.shooting_previous = &(pfzw->ba_previous);
+  else
+    ba.shooting_previous = NULL;
+
   class_call(input_read_parameters(&(pfzw->fc),
                                    &pr,
                                    &ba,
@@ -4052,7 +4206,16 @@ int input_try_unknown_parameters(double * unknown_parameter,
     class_call(thermodynamics_free(&th), th.error_message, errmsg);
   }
   if (pfzw->required_computation_stage >= cs_background){
-    class_call(background_free(&ba), ba.error_message, errmsg);
+    /* the input part of the structure is kept until the next
+       shot, which can reuse it, and the previous one is freed */
+    class_call(background_free_noinput(&ba), ba.error_message, errmsg);
+    if (pfzw->has_ba_previous == _TRUE_) {
+      class_call(background_free_input(&(pfzw->ba_previous)),
+                 pfzw->ba_previous.error_message,
+                 errmsg);
+    }
+    pfzw->ba_previous = ba;
+    pfzw->has_ba_previous = _TRUE_;
   }
 
   /** - Set filecontent to unread */
@@ -4086,6 +4249,8 @@ int input_get_guess(double *xguess,
   /* Cheat to read only known parameters: */
   pfzw->fc.size -= pfzw->target_size;
 
+  ba.shooting_previous = NULL;
+
   class_call(input_read_precisions(&(pfzw->fc),
                                    &pr,
                                    &ba,
@@ -4553,3 +4718,258 @@ int input_prepare_pk_eq(
   return _SUCCESS_;
 
 }
+
+/**
+ * Add to a hash (64-bit FNV-1a) the content of the files named in the
+ * value of an input parameter, for input_perturbations_cache_key().
+ *
+ * The value is split into words separated by commas, spaces or tabs
+ * (e.g. a list of file names, or a command followed by its
+ * arguments), and each word which is the name of a regular file (with
+ * a path relative to the working directory, as when the code opens
+ * it) contributes its size and its content. Other words are ignored.
+ *
+ * @param value  Input: value of the parameter
+ * @param hash   Input/Output: hash
+ * @param errmsg Input/Output: error message
+ * @return the error status
+ */
+
+int input_perturbations_cache_files(
+                                    char * value,
+                                    unsigned long long * hash,
+                                    ErrorMsg errmsg
+                                    ) {
+
+  FileArg word;
+  FILE * file;
+  struct stat st;
+  unsigned char buffer[4096];
+  size_t start,end,ib,nread;
+
+  for (start = 0; value[start] != '\0'; start = end) {
+
+    /* next word */
+    while ((value[start] == ',') || (value[start] == ' ') || (value[start] == '\t'))
+      start++;
+    for (end = start; (value[end] != '\0') && (value[end] != ',') && (value[end] != ' ') && (value[end] != '\t'); end++);
+
+    if ((end == start) || (end-start >= _ARGUMENT_LENGTH_MAX_))
+      continue;
+
+    memcpy(word,value+start,end-start);
+    word[end-start] = '\0';
+
+    if ((stat(word,&st) != 0) || (!S_ISREG(st.st_mode)))
+      continue;
+
+    file = fopen(word,"rb");
+    class_test(file == NULL,
+               errmsg,
+               "could not open %s to hash its content in the key of the perturbation cache",word);
+
+    *hash ^= (unsigned long long)st.st_size;
+    *hash *= 1099511628211ULL;
+
+    while ((nread = fread(buffer,1,sizeof(buffer),file)) > 0) {
+      for (ib = 0; ib < nread; ib++) {
+        *hash ^= buffer[ib];
+        *hash *= 1099511628211ULL;
+      }
+    }
+
+    fclose(file);
+  }
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * Hash (64-bit FNV-1a) of the input parameters on which the source
+ * functions of the perturbation module may depend, used to name their
+ * cache file (see perturb_sources_cache_read()).
+ *
+ * All entries of the file content are hashed (names and values,
+ * precision parameters included), in an order-independent way, except
+ * those which are known to affect only the primordial spectrum, the
+ * output files or the verbosity. Hence runs differing only by these
+ * parameters share the same sources. Like an unused parameter, any
+ * other difference leads to a different key, i.e. at worst to a
+ * recomputation. The content of the files named in the values (e.g.
+ * the phase-space distributions of ncdm species, or the script run by
+ * an external command) is hashed with them, see
+ * input_perturbations_cache_files(), and so is the build stamp of
+ * perturb_sources_cache_stamp(). Files which the code reads without
+ * being named in the input (e.g. the default BBN table) are only
+ * covered by this stamp.
+ *
+ * The family key is the same hash, without the parameters which only
+ * set the range of wavenumbers (and the redshifts of the Fourier
+ * spectra). Runs of the same family compute the same sources for
+ * their common wavenumbers, so that a run can take those of a
+ * previous one from its cache file (see perturb_sources_cache_extend()).
+ *
+ * @param pfc        Input: pointer to the file content
+ * @param key        Output: hash
+ * @param family_key Output: hash without the k range parameters
+ * @param errmsg     Input/Output: error message
+ * @return the error status
+ */
+
+int input_perturbations_cache_key(
+                                  struct file_content * pfc,
+                                  unsigned long long * key,
+                                  unsigned long long * family_key,
+                                  ErrorMsg errmsg
+                                  ) {
+
+  /* parameters which only affect the primordial spectrum, the output files or the verbosity */
+  const char * excluded[] = {"perturbations_cache","bessel_cache","transfer_l_block_size","low_memory",
+                             "A_s","ln10^{10}A_s","sigma8","n_s","alpha_s","k_pivot","n_t","alpha_t",
+                             "f_bi","n_bi","alpha_bi","f_cdi","n_cdi","alpha_cdi",
+                             "f_nid","n_nid","alpha_nid","f_niv","n_niv","alpha_niv",
+                             "root","headers","format",
+                             "write background","write thermodynamics","write primordial","write parameters","write warnings"};
+  /* parameters which only set the range of wavenumbers (and of redshifts for the Fourier spectra) */
+  const char * k_range[] = {"l_max_scalars","l_max_vectors","l_max_tensors","l_max_lss",
+                            "P_k_max_h/Mpc","P_k_max_1/Mpc","z_pk","z_max_pk"};
+  const char * ic_names[] = {"ad","bi","cdi","nid","niv"};
+  const char * cross_prefixes[] = {"c","n","alpha"};
+  int n_excluded = sizeof(excluded)/sizeof(excluded[0]);
+  int n_k_range = sizeof(k_range)/sizeof(k_range[0]);
+  int index,i,ic1,ic2,ip,is_excluded,is_k_range;
+  size_t ib,length;
+  unsigned long long hash,sum,family_sum,stamp;
+  FileArg cross_name;
+
+  sum = 0;
+  family_sum = 0;
+
+  for (index = 0; index < pfc->size; index++) {
+
+    is_excluded = _FALSE_;
+    is_k_range = _FALSE_;
+
+    for (i = 0; i < n_k_range; i++)
+      if (strcmp(pfc->name[index],k_range[i]) == 0)
+        is_k_range = _TRUE_;
+
+    for (i = 0; i < n_excluded; i++)
+      if (strcmp(pfc->name[index],excluded[i]) == 0)
+        is_excluded = _TRUE_;
+
+    /* cross-correlations between initial conditions, e.g. 'c_ad_cdi' */
+    for (ip = 0; ip < 3; ip++) {
+      for (ic1 = 0; ic1 < 5; ic1++) {
+        for (ic2 = 0; ic2 < 5; ic2++) {
+          if (ic1 != ic2) {
+            sprintf(cross_name,"%s_%s_%s",cross_prefixes[ip],ic_names[ic1],ic_names[ic2]);
+            if (strcmp(pfc->name[index],cross_name) == 0)
+              is_excluded = _TRUE_;
+          }
+        }
+      }
+    }
+
+    /* verbosity parameters */
+    length = strlen(pfc->name[index]);
+    if ((length > 8) && (strcmp(pfc->name[index]+length-8,"_verbose") == 0))
+      is_excluded = _TRUE_;
+
+    if (is_excluded == _TRUE_)
+      continue;
+
+    /* hash of 'name=value', summed over entries for independence on their order */
+    hash = 14695981039346656037ULL;
+    for (ib = 0; ib < strlen(pfc->name[index]); ib++) {
+      hash ^= (unsigned char)pfc->name[index][ib];
+      hash *= 1099511628211ULL;
+    }
+    hash ^= (unsigned char)'=';
+    hash *= 1099511628211ULL;
+    for (ib = 0; ib < strlen(pfc->value[index]); ib++) {
+      hash ^= (unsigned char)pfc->value[index][ib];
+      hash *= 1099511628211ULL;
+    }
+
+    /* content of the files named in the value */
+    class_call(input_perturbations_cache_files(pfc->value[index],&hash,errmsg),
+               errmsg,
+               errmsg);
+
+    sum += hash;
+    if (is_k_range == _FALSE_)
+      family_sum += hash;
+  }
+
+  /* build of the code and format of the cache files */
+  class_call(perturb_sources_cache_stamp(&stamp),
+             errmsg,
+             errmsg);
+
+  hash = sum;
+  hash ^= stamp;
+  hash *= 1099511628211ULL;
+
+  *key = hash;
+
+  hash = family_sum;
+  hash ^= stamp;
+  hash *= 1099511628211ULL;
+
+  *family_key = hash;
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * Free the arrays allocated by input_read_parameters() in structures
+ * which will not be passed to their own module (whose _free() function
+ * would otherwise take care of them). This happens in the python
+ * wrapper when the result of a previous run is reused for some
+ * modules. A NULL pointer means that the corresponding structure
+ * should be left untouched.
+ *
+ * @param pba Input: pointer to background structure (or NULL)
+ * @param ppt Input: pointer to perturbation structure (or NULL)
+ * @param ppm Input: pointer to primordial structure (or NULL)
+ * @param pnl Input: pointer to nonlinear structure (or NULL)
+ * @return the error status
+ */
+
+int input_free(
+               struct background *pba,
+               struct perturbs *ppt,
+               struct primordial *ppm,
+               struct nonlinear *pnl
+               ) {
+
+  if (pba != NULL) {
+    background_free_input(pba);
+  }
+
+  if (ppt != NULL) {
+    if (ppt->alpha_idm_dr != NULL)
+      free(ppt->alpha_idm_dr);
+    if (ppt->beta_idr != NULL)
+      free(ppt->beta_idr);
+  }
+
+  if (ppm != NULL) {
+    if (ppm->primordial_spec_type == external_Pk)
+      free(ppm->command);
+  }
+
+  if (pnl != NULL) {
+    if (pnl->has_pk_eq == _TRUE_) {
+      free(pnl->pk_eq_tau);
+      free(pnl->pk_eq_w_and_Omega);
+      free(pnl->pk_eq_ddw_and_ddOmega);
+    }
+  }
+
+  return _SUCCESS_;
+
+}
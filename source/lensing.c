@@ -12,12 +12,26 @@
  *
  * -# lensing_init() at the beginning (but after spectra_init())
  * -# lensing_cl_at_l() at any time for computing Cl_lensed at any l
+ * -# lensing_recompute() at any time for recomputing the lensed Cl's with another Cl_phiphi
  * -# lensing_free() at the end
  */
 
 #include "lensing.h"
 #include <time.h>
 
+/** quadrature and d-functions of the previous run (accessed within the critical section lensing_cache only) */
+static struct lensing_cache lensing_d_cache = {_FALSE_};
+
+static short lensing_cache_match_quadrature(struct precision * ppr,
+                                            struct lensing_cache * pcache,
+                                            int num_mu);
+
+static short lensing_cache_match_d(struct precision * ppr,
+                                   struct lensing * ple,
+                                   struct lensing_cache * pcache,
+                                   int l_max_full,
+                                   int d_num);
+
 /**
  * Anisotropy power spectra \f$ C_l\f$'s for all types, modes and initial conditions.
  * SO FAR: ONLY SCALAR
@@ -92,89 +106,38 @@ int lensing_init(
   /** Summary: */
   /** - Define local variables */
 
-  double * mu; /* mu[index_mu]: discretized values of mu
-                  between -1 and 1, roots of Legendre polynomial */
-  double * w8; /* Corresponding Gauss-Legendre quadrature weights */
-  double theta,delta_theta;
-
-  double ** d00;  /* dmn[index_mu][index_l] */
-  double ** d11;
-  double ** d2m2;
-  double ** d22 = NULL;
-  double ** d20 = NULL;
-  double ** d1m1;
-  double ** d31 = NULL;
-  double ** d40 = NULL;
-  double ** d3m1 = NULL;
-  double ** d3m3 = NULL;
-  double ** d4m2 = NULL;
-  double ** d4m4 = NULL;
-  double * buf_dxx; /* buffer */
-
-  double * Cgl;   /* Cgl[index_mu] */
-  double * Cgl2;  /* Cgl2[index_mu] */
-  double * sigma2; /* sigma[index_mu] */
-
-  double * ksi = NULL;  /* ksi[index_mu] */
-  double * ksiX = NULL;  /* ksiX[index_mu] */
-  double * ksip = NULL;  /* ksip[index_mu] */
-  double * ksim = NULL;  /* ksim[index_mu] */
-
-  double fac,fac1;
-  double X_000;
-  double X_p000;
-  double X_220;
-  double X_022;
-  double X_p022;
-  double X_121;
-  double X_132;
-  double X_242;
-
-  int num_mu,index_mu,icount;
-  int l;
-  double ll;
-  double * cl_unlensed;  /* cl_unlensed[index_ct] */
   double * cl_tt; /* unlensed  cl, to be filled to avoid repeated calls to spectra_cl_at_l */
-  double * cl_te = NULL; /* unlensed  cl, to be filled to avoid repeated calls to spectra_cl_at_l */
-  double * cl_ee = NULL; /* unlensed  cl, to be filled to avoid repeated calls to spectra_cl_at_l */
-  double * cl_bb = NULL; /* unlensed  cl, to be filled to avoid repeated calls to spectra_cl_at_l */
+  double * cl_te; /* unlensed  cl, to be filled to avoid repeated calls to spectra_cl_at_l */
+  double * cl_ee; /* unlensed  cl, to be filled to avoid repeated calls to spectra_cl_at_l */
+  double * cl_bb; /* unlensed  cl, to be filled to avoid repeated calls to spectra_cl_at_l */
   double * cl_pp; /* potential cl, to be filled to avoid repeated calls to spectra_cl_at_l */
 
-  double res,resX,lens;
-  double resp, resm, lensp, lensm;
-
-  double * sqrt1;
-  double * sqrt2;
-  double * sqrt3;
-  double * sqrt4;
-  double * sqrt5;
+  /* size of the heap at the beginning (see class_memory_heap()) */
+  size_t heap_start;
 
-  double ** cl_md_ic; /* array with argument
-                         cl_md_ic[index_md][index_ic1_ic2*psp->ct_size+index_ct] */
-
-  double ** cl_md;    /* array with argument
-                         cl_md[index_md][index_ct] */
-
-  int index_md;
-
-  /* Timing */
-  //double debut, fin;
-  //double cpu_time;
+  class_profile_start(profile_lensing_init);
+  heap_start = class_memory_heap();
 
   /** - check that we really want to compute at least one spectrum */
 
   if (ple->has_lensed_cls == _FALSE_) {
     if (ple->lensing_verbose > 0)
       printf("No lensing requested. Lensing module skipped.\n");
+    ple->memory_size = class_memory_growth(heap_start);
+    class_profile_stop(profile_lensing_init);
     return _SUCCESS_;
   }
   else {
     if (ple->lensing_verbose > 0) {
       printf("Computing lensed spectra ");
       if (ppr->accurate_lensing==_TRUE_)
-        printf("(accurate mode)\n");
+        printf("(accurate mode");
+      else
+        printf("(fast mode");
+      if (ppr->lensing_method == lm_flat_sky_fft)
+        printf(" up to l=%d, flat-sky FFT above)\n",ppr->lensing_flat_l_switch);
       else
-        printf("(fast mode)\n");
+        printf(")\n");
     }
   }
 
@@ -185,262 +148,138 @@ int lensing_init(
              ple->error_message,
              ple->error_message);
 
-  /** - put all precision variables hare; will be stored later in precision structure */
-  /** - Last element in \f$ \mu \f$ will be for \f$ \mu=1 \f$, needed for sigma2.
-      The rest will be chosen as roots of a Gauss-Legendre quadrature **/
-
-  if (ppr->accurate_lensing == _TRUE_) {
-    num_mu=(ple->l_unlensed_max+ppr->num_mu_minus_lmax); /* Must be even ?? CHECK */
-    num_mu += num_mu%2; /* Force it to be even */
-  } else {
-    /* Integrate correlation function difference on [0,pi/16] */
-    num_mu = (ple->l_unlensed_max * 2 )/16;
-  }
-  /** - allocate array of \f$ \mu \f$ values, as well as quadrature weights */
-
-  class_alloc(mu,
-              num_mu*sizeof(double),
-              ple->error_message);
-  /* Reserve last element of mu for mu=1, needed for sigma2 */
-  mu[num_mu-1] = 1.0;
-
-  class_alloc(w8,
-              (num_mu-1)*sizeof(double),
-              ple->error_message);
-
-  if (ppr->accurate_lensing == _TRUE_) {
-
-    //debut = omp_get_wtime();
-    class_call(quadrature_gauss_legendre(mu,
-                                         w8,
-                                         num_mu-1,
-                                         ppr->tol_gauss_legendre,
-                                         ple->error_message),
-               ple->error_message,
-               ple->error_message);
-    //fin = omp_get_wtime();
-    //cpu_time = (fin-debut);
-    //printf("time in quadrature_gauss_legendre=%4.3f s\n",cpu_time);
-
-  } else { /* Crude integration on [0,pi/16]: Riemann sum on theta */
-
-    delta_theta = _PI_/16. / (double)(num_mu-1);
-    for (index_mu=0;index_mu<num_mu-1;index_mu++) {
-      theta = (index_mu+1)*delta_theta;
-      mu[index_mu] = cos(theta);
-      w8[index_mu] = sin(theta)*delta_theta; /* We integrate on mu */
-    }
-  }
-
-  /** - Compute \f$ d^l_{mm'} (\mu) \f$*/
-
-  icount = 0;
-  class_alloc(d00,
-              num_mu*sizeof(double*),
-              ple->error_message);
-
-  class_alloc(d11,
-              num_mu*sizeof(double*),
-              ple->error_message);
-
-  class_alloc(d1m1,
-              num_mu*sizeof(double*),
-              ple->error_message);
-
-  class_alloc(d2m2,
-              num_mu*sizeof(double*),
-              ple->error_message);
-  icount += 4*num_mu*(ple->l_unlensed_max+1);
-
-  if(ple->has_te==_TRUE_) {
-
-    class_alloc(d20,
-                num_mu*sizeof(double*),
-                ple->error_message);
-
-    class_alloc(d3m1,
-                num_mu*sizeof(double*),
-                ple->error_message);
-
-    class_alloc(d4m2,
-                num_mu*sizeof(double*),
-                ple->error_message);
-    icount += 3*num_mu*(ple->l_unlensed_max+1);
-  }
-
-  if (ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_) {
-
-    class_alloc(d22,
-                num_mu*sizeof(double*),
-                ple->error_message);
-
-    class_alloc(d31,
-                num_mu*sizeof(double*),
-                ple->error_message);
-
-    class_alloc(d3m3,
-                num_mu*sizeof(double*),
-                ple->error_message);
+  /** - Locally store unlensed temperature \f$ cl_{tt}\f$ and potential \f$ cl_{pp}\f$ spectra **/
 
-    class_alloc(d40,
-                num_mu*sizeof(double*),
-                ple->error_message);
+  class_call(lensing_unlensed_cls(psp,ple,&cl_tt,&cl_te,&cl_ee,&cl_bb,&cl_pp),
+             ple->error_message,
+             ple->error_message);
 
-    class_alloc(d4m4,
-                num_mu*sizeof(double*),
-                ple->error_message);
-    icount += 5*num_mu*(ple->l_unlensed_max+1);
-  }
+  /** - compute the lensed spectra */
 
-  icount += 5*(ple->l_unlensed_max+1); /* for arrays sqrt1[l] to sqrt5[l] */
+  class_call(lensing_lensed_cls(ppr,ple,cl_tt,cl_te,cl_ee,cl_bb,cl_pp),
+             ple->error_message,
+             ple->error_message);
 
-  /** - Allocate main contiguous buffer **/
-  class_alloc(buf_dxx,
-              icount * sizeof(double),
-              ple->error_message);
+  free(cl_tt);
 
-  icount = 0;
-  for (index_mu=0; index_mu<num_mu; index_mu++) {
+  ple->memory_size = class_memory_growth(heap_start);
+  class_profile_stop(profile_lensing_init);
+  return _SUCCESS_;
 
-    d00[index_mu] = &(buf_dxx[icount+index_mu            * (ple->l_unlensed_max+1)]);
-    d11[index_mu] = &(buf_dxx[icount+(index_mu+num_mu)   * (ple->l_unlensed_max+1)]);
-    d1m1[index_mu]= &(buf_dxx[icount+(index_mu+2*num_mu) * (ple->l_unlensed_max+1)]);
-    d2m2[index_mu]= &(buf_dxx[icount+(index_mu+3*num_mu) * (ple->l_unlensed_max+1)]);
-  }
-  icount += 4*num_mu*(ple->l_unlensed_max+1);
+}
 
-  if (ple->has_te==_TRUE_) {
-    for (index_mu=0; index_mu<num_mu; index_mu++) {
-      d20[index_mu] = &(buf_dxx[icount+index_mu            * (ple->l_unlensed_max+1)]);
-      d3m1[index_mu]= &(buf_dxx[icount+(index_mu+num_mu)   * (ple->l_unlensed_max+1)]);
-      d4m2[index_mu]= &(buf_dxx[icount+(index_mu+2*num_mu) * (ple->l_unlensed_max+1)]);
-    }
-    icount += 3*num_mu*(ple->l_unlensed_max+1);
-  }
+/**
+ * This routine recomputes the lensed spectra of a lensing structure
+ * already initialized by lensing_init(), for another lensing
+ * potential spectrum (e.g. the one of the spectra module rescaled by
+ * a factor A_lens), the unlensed temperature and polarization spectra
+ * being unchanged. Since the quadrature in \f$ \mu \f$ and the Wigner
+ * d-functions are kept in the cache of lensing_lensed_cls(), only
+ * the correlation functions and the final quadrature are computed
+ * again. The other columns of the table (in particular the unlensed
+ * \f$ C_l^{\phi\phi}\f$) are not modified.
+ *
+ * @param ppr   Input: pointer to precision structure
+ * @param psp   Input: pointer to spectra structure (still allocated)
+ * @param cl_pp Input: lensing potential spectrum cl_pp[l] for 2 <= l <= ple->l_unlensed_max, or NULL to use the one of the spectra module
+ * @param ple   Input/Output: pointer to lensing structure
+ * @return the error status
+ */
 
-  if (ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_) {
+int lensing_recompute(
+                      struct precision * ppr,
+                      struct spectra * psp,
+                      double * cl_pp,
+                      struct lensing * ple
+                      ) {
+
+  double * cl_tt_unlensed;
+  double * cl_te_unlensed;
+  double * cl_ee_unlensed;
+  double * cl_bb_unlensed;
+  double * cl_pp_unlensed;
+  int l;
 
-    for (index_mu=0; index_mu<num_mu; index_mu++) {
-      d22[index_mu] = &(buf_dxx[icount+index_mu            * (ple->l_unlensed_max+1)]);
-      d31[index_mu] = &(buf_dxx[icount+(index_mu+num_mu)   * (ple->l_unlensed_max+1)]);
-      d3m3[index_mu]= &(buf_dxx[icount+(index_mu+2*num_mu) * (ple->l_unlensed_max+1)]);
-      d40[index_mu] = &(buf_dxx[icount+(index_mu+3*num_mu) * (ple->l_unlensed_max+1)]);
-      d4m4[index_mu]= &(buf_dxx[icount+(index_mu+4*num_mu) * (ple->l_unlensed_max+1)]);
-    }
-    icount += 5*num_mu*(ple->l_unlensed_max+1);
-  }
-
-  sqrt1 = &(buf_dxx[icount]);
-  icount += ple->l_unlensed_max+1;
-  sqrt2 = &(buf_dxx[icount]);
-  icount += ple->l_unlensed_max+1;
-  sqrt3 = &(buf_dxx[icount]);
-  icount += ple->l_unlensed_max+1;
-  sqrt4 = &(buf_dxx[icount]);
-  icount += ple->l_unlensed_max+1;
-  sqrt5 = &(buf_dxx[icount]);
-  icount += ple->l_unlensed_max+1;
-
-  //debut = omp_get_wtime();
-  class_call(lensing_d00(mu,num_mu,ple->l_unlensed_max,d00),
+  class_test(ple->has_lensed_cls == _FALSE_,
              ple->error_message,
-             ple->error_message);
+             "no lensed spectra were computed by lensing_init(), there is nothing to recompute");
 
-  class_call(lensing_d11(mu,num_mu,ple->l_unlensed_max,d11),
+  class_call(lensing_unlensed_cls(psp,ple,&cl_tt_unlensed,&cl_te_unlensed,&cl_ee_unlensed,&cl_bb_unlensed,&cl_pp_unlensed),
              ple->error_message,
              ple->error_message);
 
-  class_call(lensing_d1m1(mu,num_mu,ple->l_unlensed_max,d1m1),
-             ple->error_message,
-             ple->error_message);
+  if (cl_pp != NULL) {
+    for (l=2; l<=ple->l_unlensed_max; l++)
+      cl_pp_unlensed[l] = cl_pp[l];
+  }
 
-  class_call(lensing_d2m2(mu,num_mu,ple->l_unlensed_max,d2m2),
+  class_call(lensing_lensed_cls(ppr,ple,cl_tt_unlensed,cl_te_unlensed,cl_ee_unlensed,cl_bb_unlensed,cl_pp_unlensed),
              ple->error_message,
              ple->error_message);
-  //fin = omp_get_wtime();
-  //cpu_time = (fin-debut);
-  //printf("time in lensing_dxx=%4.3f s\n",cpu_time);
-
-
-  if (ple->has_te==_TRUE_) {
-
-    class_call(lensing_d20(mu,num_mu,ple->l_unlensed_max,d20),
-               ple->error_message,
-               ple->error_message);
-
-    class_call(lensing_d3m1(mu,num_mu,ple->l_unlensed_max,d3m1),
-               ple->error_message,
-               ple->error_message);
-
-    class_call(lensing_d4m2(mu,num_mu,ple->l_unlensed_max,d4m2),
-               ple->error_message,
-               ple->error_message);
 
-  }
-
-  if (ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_) {
-
-    class_call(lensing_d22(mu,num_mu,ple->l_unlensed_max,d22),
-               ple->error_message,
-               ple->error_message);
+  free(cl_tt_unlensed);
 
-    class_call(lensing_d31(mu,num_mu,ple->l_unlensed_max,d31),
-               ple->error_message,
-               ple->error_message);
+  return _SUCCESS_;
 
-    class_call(lensing_d3m3(mu,num_mu,ple->l_unlensed_max,d3m3),
-               ple->error_message,
-               ple->error_message);
+}
 
-    class_call(lensing_d40(mu,num_mu,ple->l_unlensed_max,d40),
-               ple->error_message,
-               ple->error_message);
+/**
+ * This routine reads the unlensed spectra needed by
+ * lensing_lensed_cls() in the spectra module, for all integer
+ * multipoles up to ple->l_unlensed_max. They are stored in a single
+ * array allocated here, starting at *cl_tt, which should be freed by
+ * the caller (the other pointers point inside it, or are NULL when
+ * the corresponding spectrum is not needed).
+ *
+ * @param psp   Input: pointer to spectra structure
+ * @param ple   Input: pointer to lensing structure
+ * @param cl_tt Output: unlensed \f$ C_l^{TT}\f$ (cl_tt[l])
+ * @param cl_te Output: unlensed \f$ C_l^{TE}\f$ (if ple->has_te)
+ * @param cl_ee Output: unlensed \f$ C_l^{EE}\f$ (if ple->has_ee or ple->has_bb)
+ * @param cl_bb Output: unlensed \f$ C_l^{BB}\f$ (if ple->has_ee or ple->has_bb)
+ * @param cl_pp Output: unlensed \f$ C_l^{\phi\phi}\f$
+ * @return the error status
+ */
 
-    class_call(lensing_d4m4(mu,num_mu,ple->l_unlensed_max,d4m4),
-               ple->error_message,
-               ple->error_message);
-  }
+int lensing_unlensed_cls(
+                         struct spectra * psp,
+                         struct lensing * ple,
+                         double ** cl_tt,
+                         double ** cl_te,
+                         double ** cl_ee,
+                         double ** cl_bb,
+                         double ** cl_pp
+                         ) {
 
-  /** - compute \f$ Cgl(\mu)\f$, \f$ Cgl2(\mu) \f$ and sigma2(\f$\mu\f$) */
+  double * cl_unlensed;  /* cl_unlensed[index_ct] */
 
-  class_alloc(Cgl,
-              num_mu*sizeof(double),
-              ple->error_message);
+  double ** cl_md_ic; /* array with argument
+                         cl_md_ic[index_md][index_ic1_ic2*psp->ct_size+index_ct] */
 
-  class_alloc(Cgl2,
-              num_mu*sizeof(double),
-              ple->error_message);
+  double ** cl_md;    /* array with argument
+                         cl_md[index_md][index_ct] */
 
-  class_alloc(sigma2,
-              (num_mu-1)*sizeof(double), /* Zero separation is omitted */
-              ple->error_message);
+  int index_md;
+  int l;
 
   class_alloc(cl_unlensed,
               psp->ct_size*sizeof(double),
               ple->error_message);
 
-
-  /** - Locally store unlensed temperature \f$ cl_{tt}\f$ and potential \f$ cl_{pp}\f$ spectra **/
-  class_alloc(cl_tt,
-              (ple->l_unlensed_max+1)*sizeof(double),
+  class_alloc(*cl_tt,
+              5*(ple->l_unlensed_max+1)*sizeof(double),
               ple->error_message);
+  *cl_pp = *cl_tt + (ple->l_unlensed_max+1);
+  *cl_te = NULL;
+  *cl_ee = NULL;
+  *cl_bb = NULL;
   if (ple->has_te==_TRUE_) {
-    class_alloc(cl_te,
-                (ple->l_unlensed_max+1)*sizeof(double),
-                ple->error_message);
+    *cl_te = *cl_pp + (ple->l_unlensed_max+1);
   }
   if (ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_) {
-    class_alloc(cl_ee,
-                (ple->l_unlensed_max+1)*sizeof(double),
-                ple->error_message);
-
-    class_alloc(cl_bb,
-                (ple->l_unlensed_max+1)*sizeof(double),
-                ple->error_message);
+    *cl_ee = *cl_pp + 2*(ple->l_unlensed_max+1);
+    *cl_bb = *cl_pp + 3*(ple->l_unlensed_max+1);
   }
-  class_alloc(cl_pp,
-              (ple->l_unlensed_max+1)*sizeof(double),
-              ple->error_message);
 
   class_alloc(cl_md_ic,
               psp->md_size*sizeof(double *),
@@ -469,14 +308,14 @@ int lensing_init(
     class_call(spectra_cl_at_l(psp,l,cl_unlensed,cl_md,cl_md_ic),
                psp->error_message,
                ple->error_message);
-    cl_tt[l] = cl_unlensed[ple->index_lt_tt];
-    cl_pp[l] = cl_unlensed[ple->index_lt_pp];
+    (*cl_tt)[l] = cl_unlensed[ple->index_lt_tt];
+    (*cl_pp)[l] = cl_unlensed[ple->index_lt_pp];
     if (ple->has_te==_TRUE_) {
-      cl_te[l] = cl_unlensed[ple->index_lt_te];
+      (*cl_te)[l] = cl_unlensed[ple->index_lt_te];
     }
     if (ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_) {
-      cl_ee[l] = cl_unlensed[ple->index_lt_ee];
-      cl_bb[l] = cl_unlensed[ple->index_lt_bb];
+      (*cl_ee)[l] = cl_unlensed[ple->index_lt_ee];
+      (*cl_bb)[l] = cl_unlensed[ple->index_lt_bb];
     }
   }
 
@@ -493,244 +332,720 @@ int lensing_init(
   free(cl_md_ic);
   free(cl_md);
 
-  /** - Compute sigma2\f$(\mu)\f$ and Cgl2(\f$\mu\f$) **/
+  free(cl_unlensed);
 
-  //debut = omp_get_wtime();
-#pragma omp parallel for                        \
-  private (index_mu,l)                          \
-  schedule (static)
-  for (index_mu=0; index_mu<num_mu; index_mu++) {
+  return _SUCCESS_;
 
-    Cgl[index_mu]=0;
-    Cgl2[index_mu]=0;
+}
+
+/**
+ * This routine computes the table of lensed anisotropy spectra \f$
+ * C_l^{X} \f$ of the lensing structure from the unlensed ones.
+ *
+ * The quadrature in \f$ \mu \f$ only depends on a few precision
+ * parameters and on ple->l_unlensed_max, and the Wigner d-functions at
+ * its nodes only on the same and on the types of spectra: both are
+ * kept in a cache shared by all the runs of the process (the
+ * d-functions only if they fit within ppr->lensing_d_cache_max_mb
+ * megabytes), so that they are not computed again by the next run or
+ * by lensing_recompute() when these parameters are unchanged.
+ *
+ * @param ppr   Input: pointer to precision structure
+ * @param ple   Input/Output: pointer to lensing structure, with the indices and tables of lensing_indices()
+ * @param cl_tt Input: unlensed \f$ C_l^{TT}\f$ (cl_tt[l])
+ * @param cl_te Input: unlensed \f$ C_l^{TE}\f$ (if ple->has_te)
+ * @param cl_ee Input: unlensed \f$ C_l^{EE}\f$ (if ple->has_ee or ple->has_bb)
+ * @param cl_bb Input: unlensed \f$ C_l^{BB}\f$ (if ple->has_ee or ple->has_bb)
+ * @param cl_pp Input: unlensed \f$ C_l^{\phi\phi}\f$
+ * @return the error status
+ */
 
-    for (l=2; l<=ple->l_unlensed_max; l++) {
+int lensing_lensed_cls(
+                       struct precision * ppr,
+                       struct lensing * ple,
+                       double * cl_tt,
+                       double * cl_te,
+                       double * cl_ee,
+                       double * cl_bb,
+                       double * cl_pp
+                       ) {
+
+  struct lensing_cache cache; /* quadrature and d-functions, possibly from a previous run */
+  double * mu; /* mu[index_mu]: discretized values of mu
+                  between -1 and 1, roots of Legendre polynomial */
+  double * w8; /* Corresponding Gauss-Legendre quadrature weights */
+  double theta,delta_theta;
 
-      Cgl[index_mu] += (2.*l+1.)*l*(l+1.)*
-        cl_pp[l]*d11[index_mu][l];
+  double ** d00;  /* dmn[index_mu][index_l], for the values of mu of one block */
+  double ** d11;
+  double ** d2m2;
+  double ** d22;
+  double ** d20;
+  double ** d1m1;
+  double ** d31;
+  double ** d40;
+  double ** d3m1;
+  double ** d3m3;
+  double ** d4m2;
+  double ** d4m4;
+  double * buf_dxx; /* buffer */
+  double ** d_rows; /* pointers to the rows of this buffer */
+  int d_num,index_d;
+  double * d_table;  /* d-functions of all the blocks, when they are kept in the cache (or NULL) */
+  short d_filled;    /* _TRUE_ if d_table was filled by a previous run */
+  short same_d;      /* _TRUE_ if the previous run needed the same d-functions */
+  long block_length; /* number of values of the d-functions of one block */
+  double * d11_one; /* d11[index_l] at mu=1 */
 
-      Cgl2[index_mu] += (2.*l+1.)*l*(l+1.)*
-        cl_pp[l]*d1m1[index_mu][l];
+  double * Cgl;   /* Cgl[index_mu] */
+  double * Cgl2;  /* Cgl2[index_mu] */
+  double * sigma2; /* sigma[index_mu] */
+  double Cgl_one; /* Cgl at mu=1 */
+
+  double * ksi;  /* ksi[index_mu] */
+  double * ksiX;  /* ksiX[index_mu] */
+  double * ksip;  /* ksip[index_mu] */
+  double * ksim;  /* ksim[index_mu] */
+
+  /* blocks of values of mu */
+  int mu_block_size,block_num,index_block,index_mu_min,mu_size;
+  double * cl_lens_block; /* contribution of each block to the lensed cl's,
+                             cl_lens_block[(index_block*ple->l_size+index_l)*ple->lt_size+index_lt] */
+  double * cl_block;
+  int index_l;
+  int abort;
+  struct parallel_timer timer;
 
-    }
+  /* multipoles computed with the full-sky method */
+  int l_max_full;  /* largest multipole of the unlensed spectra in the full-sky calculation */
+  int l_size_full; /* number of values of ple->l for which the lensed spectra are computed with the full-sky method */
 
-    Cgl[index_mu] /= 4.*_PI_;
-    Cgl2[index_mu] /= 4.*_PI_;
+  double fac,fac1;
+  double X_000;
+  double X_p000;
+  double X_220;
+  double X_022;
+  double X_p022;
+  double X_121;
+  double X_132;
+  double X_242;
+
+  int num_mu,index_mu;
+  int l;
+  double ll;
+  double res,resX,lens;
+  double resp, resm, lensp, lensm;
+
+  double * sqrt1;
+  double * sqrt2;
+  double * sqrt3;
+  double * sqrt4;
+  double * sqrt5;
 
+  /** - find the multipoles computed with the full-sky method: all of
+      them, or with the flat-sky FFT method, only those below
+      ppr->lensing_flat_l_switch. In the latter case, the full-sky
+      calculation only uses the unlensed temperature and polarization
+      spectra up to ppr->lensing_flat_l_switch + ppr->delta_l_max, and
+      the contribution of the higher multipoles is computed in the
+      flat-sky limit */
+
+  l_max_full = ple->l_unlensed_max;
+  l_size_full = ple->l_size;
+
+  if (ppr->lensing_method == lm_flat_sky_fft) {
+
+    class_test(ppr->lensing_flat_l_switch < 2,
+               ple->error_message,
+               "lensing_flat_l_switch=%d should be at least 2",ppr->lensing_flat_l_switch);
+
+    for (l_size_full=0; (l_size_full < ple->l_size) && (ple->l[l_size_full] <= ppr->lensing_flat_l_switch); l_size_full++);
+
+    if (l_size_full < ple->l_size)
+      l_max_full = MIN(ppr->lensing_flat_l_switch+ppr->delta_l_max,ple->l_unlensed_max);
   }
 
-  for (index_mu=0; index_mu<num_mu-1; index_mu++) {
-    /* Cgl(1.0) - Cgl(mu) */
-    sigma2[index_mu] = Cgl[num_mu-1] - Cgl[index_mu];
+  /** - put all precision variables hare; will be stored later in precision structure */
+  /** - Last element in \f$ \mu \f$ will be for \f$ \mu=1 \f$, needed for sigma2.
+      The rest will be chosen as roots of a Gauss-Legendre quadrature **/
+
+  if (ppr->accurate_lensing == _TRUE_) {
+    num_mu=(ple->l_unlensed_max+ppr->num_mu_minus_lmax); /* Must be even ?? CHECK */
+    num_mu += num_mu%2; /* Force it to be even */
+  } else {
+    /* Integrate correlation function difference on [0,pi/16] */
+    num_mu = (ple->l_unlensed_max * 2 )/16;
   }
-  //fin = omp_get_wtime();
-  //cpu_time = (fin-debut);
-  //printf("time in Cgl,Cgl2,sigma2=%4.3f s\n",cpu_time);
 
+  /** - take the quadrature (and possibly the d-functions) of a
+      previous run from the cache, see lensing_cache_restore() */
+
+  mu_block_size = ppr->lensing_mu_block_size;
+  block_num = (num_mu-1+mu_block_size-1)/mu_block_size;
+
+  d_num = 4;
+  if (ple->has_te==_TRUE_)
+    d_num += 3;
+  if (ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_)
+    d_num += 5;
+
+  class_call(lensing_cache_restore(ppr,ple,num_mu,l_max_full,d_num,&cache,&same_d),
+             ple->error_message,
+             ple->error_message);
+
+  if (cache.has_quadrature == _FALSE_) {
+
+    /** - allocate array of \f$ \mu \f$ values, as well as quadrature weights */
+
+    class_alloc(mu,
+                num_mu*sizeof(double),
+                ple->error_message);
+    /* Reserve last element of mu for mu=1, needed for sigma2 */
+    mu[num_mu-1] = 1.0;
 
-  /** - compute ksi, ksi+, ksi-, ksiX */
+    class_alloc(w8,
+                (num_mu-1)*sizeof(double),
+                ple->error_message);
 
-  /** - --> ksi is for TT **/
-  if (ple->has_tt==_TRUE_) {
+    if (ppr->accurate_lensing == _TRUE_) {
 
-    class_calloc(ksi,
-                 (num_mu-1),
-                 sizeof(double),
+      //debut = omp_get_wtime();
+      class_call(quadrature_gauss_legendre(mu,
+                                           w8,
+                                           num_mu-1,
+                                           ppr->tol_gauss_legendre,
+                                           ple->error_message),
+                 ple->error_message,
                  ple->error_message);
+      //fin = omp_get_wtime();
+      //cpu_time = (fin-debut);
+      //printf("time in quadrature_gauss_legendre=%4.3f s\n",cpu_time);
+
+    } else { /* Crude integration on [0,pi/16]: Riemann sum on theta */
+
+      delta_theta = _PI_/16. / (double)(num_mu-1);
+      for (index_mu=0;index_mu<num_mu-1;index_mu++) {
+        theta = (index_mu+1)*delta_theta;
+        mu[index_mu] = cos(theta);
+        w8[index_mu] = sin(theta)*delta_theta; /* We integrate on mu */
+      }
+    }
+
+    cache.accurate_lensing = ppr->accurate_lensing;
+    cache.tol_gauss_legendre = ppr->tol_gauss_legendre;
+    cache.num_mu = num_mu;
+    cache.mu = mu;
+    cache.w8 = w8;
+    cache.has_quadrature = _TRUE_;
   }
 
-  /** - --> ksiX is for TE **/
-  if (ple->has_te==_TRUE_) {
+  mu = cache.mu;
+  w8 = cache.w8;
+
+  /** - when the previous run needed the same d-functions, keep those
+      of all the blocks in the cache if they fit within
+      ppr->lensing_d_cache_max_mb megabytes (a single run does not
+      pay for filling this large table). Otherwise each thread
+      computes them block after block in its own buffer */
+
+  block_length = (long)mu_block_size*(2*(ple->l_unlensed_max+1)+(d_num-2)*(l_max_full+1));
+
+  if ((same_d == _FALSE_) ||
+      ((double)block_num*block_length*sizeof(double) > ppr->lensing_d_cache_max_mb*1024.*1024.)) {
+    if (cache.has_d == _TRUE_) {
+      free(cache.d);
+      cache.has_d = _FALSE_;
+    }
+    d_table = NULL;
+    d_filled = _FALSE_;
+  }
+  else {
+    if (cache.has_d == _FALSE_) {
+      class_alloc(cache.d,
+                  block_num*block_length*sizeof(double),
+                  ple->error_message);
+      d_filled = _FALSE_;
+    }
+    else {
+      d_filled = _TRUE_;
+    }
+    d_table = cache.d;
+  }
+
+  cache.l_unlensed_max = ple->l_unlensed_max;
+  cache.l_max_full = l_max_full;
+  cache.mu_block_size = mu_block_size;
+  cache.d_num = d_num;
+
+  class_alloc(sqrt1,
+              5*(ple->l_unlensed_max+1)*sizeof(double),
+              ple->error_message);
+  sqrt2 = sqrt1 + (ple->l_unlensed_max+1);
+  sqrt3 = sqrt2 + (ple->l_unlensed_max+1);
+  sqrt4 = sqrt3 + (ple->l_unlensed_max+1);
+  sqrt5 = sqrt4 + (ple->l_unlensed_max+1);
+
+  for (l=2;l<=ple->l_unlensed_max;l++) {
+
+    ll = (double)l;
+    sqrt1[l]=sqrt((ll+2)*(ll+1)*ll*(ll-1));
+    sqrt2[l]=sqrt((ll+2)*(ll-1));
+    sqrt3[l]=sqrt((ll+3)*(ll-2));
+    sqrt4[l]=sqrt((ll+4)*(ll+3)*(ll-2.)*(ll-3));
+    sqrt5[l]=sqrt(ll*(ll+1));
+  }
+
+  /** - Compute Cgl(\f$\mu=1\f$), needed for sigma2(\f$\mu\f$) = Cgl(1) - Cgl(\f$\mu\f$) */
+
+  class_alloc(d11_one,
+              (ple->l_unlensed_max+1)*sizeof(double),
+              ple->error_message);
+
+  class_call(lensing_d11(&(mu[num_mu-1]),1,ple->l_unlensed_max,&d11_one),
+             ple->error_message,
+             ple->error_message);
+
+  Cgl_one = 0.;
+  for (l=2; l<=ple->l_unlensed_max; l++) {
+    Cgl_one += (2.*l+1.)*l*(l+1.)*
+      cl_pp[l]*d11_one[l];
+  }
+  Cgl_one /= 4.*_PI_;
+
+  free(d11_one);
+
+  /** - Loop over blocks of ppr->lensing_mu_block_size values of
+      \f$ \mu \f$ (parallelized). For each block, compute the
+      \f$ d^l_{mm'} (\mu) \f$, Cgl(\f$\mu\f$), Cgl2(\f$\mu\f$),
+      sigma2(\f$\mu\f$) and the correlation functions ksi, ksi+, ksi-,
+      ksiX, and add their contribution to the quadrature giving the
+      lensed \f$ C_l\f$'s. The \f$ d^l_{mm'} (\mu) \f$ are only stored
+      for the values of \f$ \mu \f$ of one block in each thread, and the
+      contributions of each block are stored separately, then summed
+      in a fixed order: the result does not depend on the number of
+      threads. When the d-functions are kept in the cache, they are
+      read from (or, the first time, written to) d_table instead. */
+
+  class_calloc(cl_lens_block,
+               block_num*ple->l_size*ple->lt_size,
+               sizeof(double),
+               ple->error_message);
+
+  abort = _FALSE_;
+
+  parallel_timer_start(&timer);
+
+#pragma omp parallel                                                    \
+  shared(ppr,ple,mu,w8,num_mu,mu_block_size,block_num,d_num,cl_lens_block,l_max_full,l_size_full, \
+         d_table,d_filled,block_length,                                \
+         cl_tt,cl_te,cl_ee,cl_bb,cl_pp,sqrt1,sqrt2,sqrt3,sqrt4,sqrt5,Cgl_one,abort,timer) \
+  private(index_block,index_mu_min,mu_size,index_mu,index_d,l,ll,buf_dxx,d_rows, \
+          d00,d11,d1m1,d2m2,d22,d20,d31,d40,d3m1,d3m3,d4m2,d4m4,       \
+          Cgl,Cgl2,sigma2,ksi,ksiX,ksip,ksim,res,resX,resp,resm,lens,lensp,lensm, \
+          fac,fac1,X_000,X_p000,X_220,X_022,X_p022,X_121,X_132,X_242)
+  {
+
+    /** - --> unless they are all kept in d_table, each thread
+        allocates the \f$ d^l_{mm'} (\mu) \f$ of one
+        block: d00[index_mu][l], ... for 0 <= index_mu < ppr->lensing_mu_block_size.
+        Cgl and Cgl2 always include all the multipoles of
+        \f$ C_l^{\phi\phi}\f$: d11 and d1m1, stored first, go up to
+        ple->l_unlensed_max, and the others up to l_max_full */
+
+    buf_dxx = NULL;
+    if (d_table == NULL) {
+      class_alloc_parallel(buf_dxx,
+                           block_length*sizeof(double),
+                           ple->error_message);
+    }
+
+    class_alloc_parallel(d_rows,
+                         d_num*mu_block_size*sizeof(double*),
+                         ple->error_message);
+
+    class_alloc_parallel(Cgl,
+                         4*mu_block_size*sizeof(double),
+                         ple->error_message);
+
+    class_alloc_parallel(ksi,
+                         4*mu_block_size*sizeof(double),
+                         ple->error_message);
+
+    d00 = d11 = d1m1 = d2m2 = NULL;
+    d20 = d3m1 = d4m2 = NULL;
+    d22 = d31 = d3m3 = d40 = d4m4 = NULL;
+    Cgl2 = sigma2 = NULL;
+    ksiX = ksip = ksim = NULL;
+
+    if (abort == _FALSE_) {
+
+      Cgl2 = Cgl + mu_block_size;
+      sigma2 = Cgl2 + mu_block_size;
+      ksiX = ksi + mu_block_size;
+      ksip = ksiX + mu_block_size;
+      ksim = ksip + mu_block_size;
+    }
+
+#pragma omp for schedule (dynamic) nowait
+
+    for (index_block=0; index_block<block_num; index_block++) {
+
+#pragma omp flush(abort)
+
+      if (abort == _TRUE_) continue;
+
+      index_mu_min = index_block*mu_block_size;
+      mu_size = MIN(mu_block_size,num_mu-1-index_mu_min);
+
+      /** - --> point to the \f$ d^l_{mm'} (\mu) \f$ of this block */
+
+      if (d_table != NULL)
+        buf_dxx = d_table + (long)index_block*block_length;
+
+      for (index_d=0; index_d<2*mu_block_size; index_d++)
+        d_rows[index_d] = buf_dxx + (long)index_d*(ple->l_unlensed_max+1);
+      for (index_d=2*mu_block_size; index_d<d_num*mu_block_size; index_d++)
+        d_rows[index_d] = buf_dxx + (long)2*mu_block_size*(ple->l_unlensed_max+1)
+          + (long)(index_d-2*mu_block_size)*(l_max_full+1);
+
+      index_d = 0;
+      d11 = d_rows + (index_d++)*mu_block_size;
+      d1m1 = d_rows + (index_d++)*mu_block_size;
+      d00 = d_rows + (index_d++)*mu_block_size;
+      d2m2 = d_rows + (index_d++)*mu_block_size;
+      if (ple->has_te==_TRUE_) {
+        d20 = d_rows + (index_d++)*mu_block_size;
+        d3m1 = d_rows + (index_d++)*mu_block_size;
+        d4m2 = d_rows + (index_d++)*mu_block_size;
+      }
+      if (ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_) {
+        d22 = d_rows + (index_d++)*mu_block_size;
+        d31 = d_rows + (index_d++)*mu_block_size;
+        d3m3 = d_rows + (index_d++)*mu_block_size;
+        d40 = d_rows + (index_d++)*mu_block_size;
+        d4m4 = d_rows + (index_d++)*mu_block_size;
+      }
+
+      /** - --> compute \f$ d^l_{mm'} (\mu) \f$ for this block, unless they are already in d_table */
+
+      if (d_filled == _FALSE_) {
+
+        class_call_parallel(lensing_d00(mu+index_mu_min,mu_size,l_max_full,d00),
+                            ple->error_message,
+                            ple->error_message);
+
+        class_call_parallel(lensing_d11(mu+index_mu_min,mu_size,ple->l_unlensed_max,d11),
+                            ple->error_message,
+                            ple->error_message);
+
+        class_call_parallel(lensing_d1m1(mu+index_mu_min,mu_size,ple->l_unlensed_max,d1m1),
+                            ple->error_message,
+                            ple->error_message);
+
+        class_call_parallel(lensing_d2m2(mu+index_mu_min,mu_size,l_max_full,d2m2),
+                            ple->error_message,
+                            ple->error_message);
+
+        if (ple->has_te==_TRUE_) {
+
+          class_call_parallel(lensing_d20(mu+index_mu_min,mu_size,l_max_full,d20),
+                              ple->error_message,
+                              ple->error_message);
+
+          class_call_parallel(lensing_d3m1(mu+index_mu_min,mu_size,l_max_full,d3m1),
+                              ple->error_message,
+                              ple->error_message);
+
+          class_call_parallel(lensing_d4m2(mu+index_mu_min,mu_size,l_max_full,d4m2),
+                              ple->error_message,
+                              ple->error_message);
+        }
 
-    class_calloc(ksiX,
-                 (num_mu-1),
-                 sizeof(double),
-                 ple->error_message);
-  }
+        if (ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_) {
 
-  /** - --> ksip, ksim for EE, BB **/
-  if (ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_) {
+          class_call_parallel(lensing_d22(mu+index_mu_min,mu_size,l_max_full,d22),
+                              ple->error_message,
+                              ple->error_message);
 
-    class_calloc(ksip,
-                 (num_mu-1),
-                 sizeof(double),
-                 ple->error_message);
+          class_call_parallel(lensing_d31(mu+index_mu_min,mu_size,l_max_full,d31),
+                              ple->error_message,
+                              ple->error_message);
 
-    class_calloc(ksim,
-                 (num_mu-1),
-                 sizeof(double),
-                 ple->error_message);
-  }
+          class_call_parallel(lensing_d3m3(mu+index_mu_min,mu_size,l_max_full,d3m3),
+                              ple->error_message,
+                              ple->error_message);
 
-  for (l=2;l<=ple->l_unlensed_max;l++) {
+          class_call_parallel(lensing_d40(mu+index_mu_min,mu_size,l_max_full,d40),
+                              ple->error_message,
+                              ple->error_message);
 
-    ll = (double)l;
-    sqrt1[l]=sqrt((ll+2)*(ll+1)*ll*(ll-1));
-    sqrt2[l]=sqrt((ll+2)*(ll-1));
-    sqrt3[l]=sqrt((ll+3)*(ll-2));
-    sqrt4[l]=sqrt((ll+4)*(ll+3)*(ll-2.)*(ll-3));
-    sqrt5[l]=sqrt(ll*(ll+1));
-  }
+          class_call_parallel(lensing_d4m4(mu+index_mu_min,mu_size,l_max_full,d4m4),
+                              ple->error_message,
+                              ple->error_message);
+        }
+      }
 
+      if (abort == _TRUE_) continue;
 
-  //debut = omp_get_wtime();
-#pragma omp parallel for                                                \
-  private (index_mu,l,ll,res,resX,resp,resm,lens,lensp,lensm,           \
-           fac,fac1,X_000,X_p000,X_220,X_022,X_p022,X_121,X_132,X_242)	\
-  schedule (static)
+      /** - --> compute Cgl(\f$\mu\f$), Cgl2(\f$\mu\f$) and sigma2(\f$\mu\f$) */
 
-  for (index_mu=0;index_mu<num_mu-1;index_mu++) {
+      for (index_mu=0; index_mu<mu_size; index_mu++) {
 
-    for (l=2;l<=ple->l_unlensed_max;l++) {
+        Cgl[index_mu]=0;
+        Cgl2[index_mu]=0;
 
-      ll = (double)l;
+        for (l=2; l<=ple->l_unlensed_max; l++) {
 
-      fac = ll*(ll+1)/4.;
-      fac1 = (2*ll+1)/(4.*_PI_);
+          Cgl[index_mu] += (2.*l+1.)*l*(l+1.)*
+            cl_pp[l]*d11[index_mu][l];
 
-      /* In the following we will keep terms of the form (sigma2)^k*(Cgl2)^m
-         with k+m <= 2 */
+          Cgl2[index_mu] += (2.*l+1.)*l*(l+1.)*
+            cl_pp[l]*d1m1[index_mu][l];
 
-      X_000 = exp(-fac*sigma2[index_mu]);
-      X_p000 = -fac*X_000;
-      /* X_220 = 0.25*sqrt1[l] * exp(-(fac-0.5)*sigma2[index_mu]); */
-      X_220 = 0.25*sqrt1[l] * X_000; /* Order 0 */
-      /* next 5 lines useless, but avoid compiler warning 'may be used uninitialized' */
-      X_242=0.;
-      X_132=0.;
-      X_121=0.;
-      X_p022=0.;
-      X_022=0.;
+        }
 
-      if (ple->has_te==_TRUE_ || ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_) {
-        /* X_022 = exp(-(fac-1.)*sigma2[index_mu]); */
-        X_022 = X_000 * (1+sigma2[index_mu]*(1+0.5*sigma2[index_mu])); /* Order 2 */
-        X_p022 = -(fac-1.)*X_022; /* Old versions were missing the
-        minus sign in this line, which introduced a very small error
-        on the high-l C_l^TE lensed spectrum [credits for bug fix:
-        Selim Hotinli] */
+        Cgl[index_mu] /= 4.*_PI_;
+        Cgl2[index_mu] /= 4.*_PI_;
 
-        /* X_242 = 0.25*sqrt4[l] * exp(-(fac-5./2.)*sigma2[index_mu]); */
-        X_242 = 0.25*sqrt4[l] * X_000; /* Order 0 */
-        if (ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_) {
+        /* Cgl(1.0) - Cgl(mu) */
+        sigma2[index_mu] = Cgl_one - Cgl[index_mu];
+      }
 
-          /* X_121 = - 0.5*sqrt2[l] * exp(-(fac-2./3.)*sigma2[index_mu]);
-             X_132 = - 0.5*sqrt3[l] * exp(-(fac-5./3.)*sigma2[index_mu]); */
-          X_121 = -0.5*sqrt2[l] * X_000 * (1+2./3.*sigma2[index_mu]); /* Order 1 */
-          X_132 = -0.5*sqrt3[l] * X_000 * (1+5./3.*sigma2[index_mu]); /* Order 1 */
+      /** - --> compute ksi (for TT), ksiX (for TE), ksip and ksim (for EE, BB) */
+
+      for (index_mu=0; index_mu<4*mu_block_size; index_mu++)
+        ksi[index_mu] = 0.;
+
+      for (index_mu=0;index_mu<mu_size;index_mu++) {
+
+        for (l=2;l<=l_max_full;l++) {
+
+          ll = (double)l;
+
+          fac = ll*(ll+1)/4.;
+          fac1 = (2*ll+1)/(4.*_PI_);
+
+          /* In the following we will keep terms of the form (sigma2)^k*(Cgl2)^m
+             with k+m <= 2 */
+
+          X_000 = exp(-fac*sigma2[index_mu]);
+          X_p000 = -fac*X_000;
+          /* X_220 = 0.25*sqrt1[l] * exp(-(fac-0.5)*sigma2[index_mu]); */
+          X_220 = 0.25*sqrt1[l] * X_000; /* Order 0 */
+          /* next 5 lines useless, but avoid compiler warning 'may be used uninitialized' */
+          X_242=0.;
+          X_132=0.;
+          X_121=0.;
+          X_p022=0.;
+          X_022=0.;
+
+          if (ple->has_te==_TRUE_ || ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_) {
+            /* X_022 = exp(-(fac-1.)*sigma2[index_mu]); */
+            X_022 = X_000 * (1+sigma2[index_mu]*(1+0.5*sigma2[index_mu])); /* Order 2 */
+            X_p022 = -(fac-1.)*X_022; /* Old versions were missing the
+            minus sign in this line, which introduced a very small error
+            on the high-l C_l^TE lensed spectrum [credits for bug fix:
+            Selim Hotinli] */
+
+            /* X_242 = 0.25*sqrt4[l] * exp(-(fac-5./2.)*sigma2[index_mu]); */
+            X_242 = 0.25*sqrt4[l] * X_000; /* Order 0 */
+            if (ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_) {
+
+              /* X_121 = - 0.5*sqrt2[l] * exp(-(fac-2./3.)*sigma2[index_mu]);
+                 X_132 = - 0.5*sqrt3[l] * exp(-(fac-5./3.)*sigma2[index_mu]); */
+              X_121 = -0.5*sqrt2[l] * X_000 * (1+2./3.*sigma2[index_mu]); /* Order 1 */
+              X_132 = -0.5*sqrt3[l] * X_000 * (1+5./3.*sigma2[index_mu]); /* Order 1 */
+            }
+          }
+
+
+          if (ple->has_tt==_TRUE_) {
+
+            res = fac1*cl_tt[l];
+
+            lens = (X_000*X_000*d00[index_mu][l] +
+                    X_p000*X_p000*d1m1[index_mu][l]
+                    *Cgl2[index_mu]*8./(ll*(ll+1)) +
+                    (X_p000*X_p000*d00[index_mu][l] +
+                     X_220*X_220*d2m2[index_mu][l])
+                    *Cgl2[index_mu]*Cgl2[index_mu]);
+            if (ppr->accurate_lensing == _FALSE_) {
+              /* Remove unlensed correlation function */
+              lens -= d00[index_mu][l];
+            }
+            res *= lens;
+            ksi[index_mu] += res;
+          }
+
+          if (ple->has_te==_TRUE_) {
+
+            resX = fac1*cl_te[l];
+
+
+            lens = ( X_022*X_000*d20[index_mu][l] +
+                     Cgl2[index_mu]*2.*X_p000/sqrt5[l] *
+                     (X_121*d11[index_mu][l] + X_132*d3m1[index_mu][l]) +
+                     0.5 * Cgl2[index_mu] * Cgl2[index_mu] *
+                     ( ( 2.*X_p022*X_p000+X_220*X_220 ) *
+                       d20[index_mu][l] + X_220*X_242*d4m2[index_mu][l] ) );
+            if (ppr->accurate_lensing == _FALSE_) {
+              lens -= d20[index_mu][l];
+            }
+            resX *= lens;
+            ksiX[index_mu] += resX;
+          }
+
+          if (ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_) {
+
+            resp = fac1*(cl_ee[l]+cl_bb[l]);
+            resm = fac1*(cl_ee[l]-cl_bb[l]);
+
+            lensp = ( X_022*X_022*d22[index_mu][l] +
+                      2.*Cgl2[index_mu]*X_132*X_121*d31[index_mu][l] +
+                      Cgl2[index_mu]*Cgl2[index_mu] *
+                      ( X_p022*X_p022*d22[index_mu][l] +
+                        X_242*X_220*d40[index_mu][l] ) );
+
+            lensm = ( X_022*X_022*d2m2[index_mu][l] +
+                      Cgl2[index_mu] *
+                      ( X_121*X_121*d1m1[index_mu][l] +
+                        X_132*X_132*d3m3[index_mu][l] ) +
+                      0.5 * Cgl2[index_mu] * Cgl2[index_mu] *
+                      ( 2.*X_p022*X_p022*d2m2[index_mu][l] +
+                        X_220*X_220*d00[index_mu][l] +
+                        X_242*X_242*d4m4[index_mu][l] ) );
+            if (ppr->accurate_lensing == _FALSE_) {
+              lensp -= d22[index_mu][l];
+              lensm -= d2m2[index_mu][l];
+            }
+            resp *= lensp;
+            resm *= lensm;
+            ksip[index_mu] += resp;
+            ksim[index_mu] += resm;
+          }
         }
       }
 
+      /** - --> add the contribution of this block to the lensed \f$ C_l\f$'s */
 
       if (ple->has_tt==_TRUE_) {
-
-        res = fac1*cl_tt[l];
-
-        lens = (X_000*X_000*d00[index_mu][l] +
-                X_p000*X_p000*d1m1[index_mu][l]
-                *Cgl2[index_mu]*8./(ll*(ll+1)) +
-                (X_p000*X_p000*d00[index_mu][l] +
-                 X_220*X_220*d2m2[index_mu][l])
-                *Cgl2[index_mu]*Cgl2[index_mu]);
-        if (ppr->accurate_lensing == _FALSE_) {
-          /* Remove unlensed correlation function */
-          lens -= d00[index_mu][l];
-        }
-        res *= lens;
-        ksi[index_mu] += res;
+        class_call_parallel(lensing_lensed_cl_tt(ksi,d00,w8+index_mu_min,mu_size,ple,l_size_full,
+                                                 cl_lens_block+(long)index_block*ple->l_size*ple->lt_size),
+                            ple->error_message,
+                            ple->error_message);
       }
 
       if (ple->has_te==_TRUE_) {
+        class_call_parallel(lensing_lensed_cl_te(ksiX,d20,w8+index_mu_min,mu_size,ple,l_size_full,
+                                                 cl_lens_block+(long)index_block*ple->l_size*ple->lt_size),
+                            ple->error_message,
+                            ple->error_message);
+      }
 
-        resX = fac1*cl_te[l];
+      if (ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_) {
+        class_call_parallel(lensing_lensed_cl_ee_bb(ksip,ksim,d22,d2m2,w8+index_mu_min,mu_size,ple,l_size_full,
+                                                    cl_lens_block+(long)index_block*ple->l_size*ple->lt_size),
+                            ple->error_message,
+                            ple->error_message);
+      }
+    }
 
+    if (d_table == NULL)
+      free(buf_dxx);
+    free(d_rows);
+    free(Cgl);
+    free(ksi);
 
-        lens = ( X_022*X_000*d20[index_mu][l] +
-                 Cgl2[index_mu]*2.*X_p000/sqrt5[l] *
-                 (X_121*d11[index_mu][l] + X_132*d3m1[index_mu][l]) +
-                 0.5 * Cgl2[index_mu] * Cgl2[index_mu] *
-                 ( ( 2.*X_p022*X_p000+X_220*X_220 ) *
-                   d20[index_mu][l] + X_220*X_242*d4m2[index_mu][l] ) );
-        if (ppr->accurate_lensing == _FALSE_) {
-          lens -= d20[index_mu][l];
-        }
-        resX *= lens;
-        ksiX[index_mu] += resX;
-      }
+    parallel_timer_thread_done(&timer);
 
-      if (ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_) {
+  } /* end of parallel region */
 
-        resp = fac1*(cl_ee[l]+cl_bb[l]);
-        resm = fac1*(cl_ee[l]-cl_bb[l]);
-
-        lensp = ( X_022*X_022*d22[index_mu][l] +
-                  2.*Cgl2[index_mu]*X_132*X_121*d31[index_mu][l] +
-                  Cgl2[index_mu]*Cgl2[index_mu] *
-                  ( X_p022*X_p022*d22[index_mu][l] +
-                    X_242*X_220*d40[index_mu][l] ) );
-
-        lensm = ( X_022*X_022*d2m2[index_mu][l] +
-                  Cgl2[index_mu] *
-                  ( X_121*X_121*d1m1[index_mu][l] +
-                    X_132*X_132*d3m3[index_mu][l] ) +
-                  0.5 * Cgl2[index_mu] * Cgl2[index_mu] *
-                  ( 2.*X_p022*X_p022*d2m2[index_mu][l] +
-                    X_220*X_220*d00[index_mu][l] +
-                    X_242*X_242*d4m4[index_mu][l] ) );
-        if (ppr->accurate_lensing == _FALSE_) {
-          lensp -= d22[index_mu][l];
-          lensm -= d2m2[index_mu][l];
-        }
-        resp *= lensp;
-        resm *= lensm;
-        ksip[index_mu] += resp;
-        ksim[index_mu] += resm;
+  parallel_timer_stop(&timer,"lensing_lensed_cls: mu blocks");
+
+  if (abort == _TRUE_) return _FAILURE_;
+
+  /** - compute lensed \f$ C_l\f$'s by summing the contributions of all blocks */
+
+  for (index_l=0; index_l<l_size_full; index_l++) {
+    if (ple->has_tt==_TRUE_)
+      ple->cl_lens[index_l*ple->lt_size+ple->index_lt_tt] = 0.;
+    if (ple->has_te==_TRUE_)
+      ple->cl_lens[index_l*ple->lt_size+ple->index_lt_te] = 0.;
+    if (ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_) {
+      ple->cl_lens[index_l*ple->lt_size+ple->index_lt_ee] = 0.;
+      ple->cl_lens[index_l*ple->lt_size+ple->index_lt_bb] = 0.;
+    }
+    for (index_block=0; index_block<block_num; index_block++) {
+      cl_block = cl_lens_block+((long)index_block*ple->l_size+index_l)*ple->lt_size;
+      if (ple->has_tt==_TRUE_)
+        ple->cl_lens[index_l*ple->lt_size+ple->index_lt_tt] += cl_block[ple->index_lt_tt];
+      if (ple->has_te==_TRUE_)
+        ple->cl_lens[index_l*ple->lt_size+ple->index_lt_te] += cl_block[ple->index_lt_te];
+      if (ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_) {
+        ple->cl_lens[index_l*ple->lt_size+ple->index_lt_ee] += cl_block[ple->index_lt_ee];
+        ple->cl_lens[index_l*ple->lt_size+ple->index_lt_bb] += cl_block[ple->index_lt_bb];
       }
     }
   }
-  //fin = omp_get_wtime();
-  //cpu_time = (fin-debut);
-  //printf("time in ksi=%4.3f s\n",cpu_time);
 
+  free(cl_lens_block);
 
-  /** - compute lensed \f$ C_l\f$'s by integration */
-  //debut = omp_get_wtime();
-  if (ple->has_tt==_TRUE_) {
-    class_call(lensing_lensed_cl_tt(ksi,d00,w8,num_mu-1,ple),
-               ple->error_message,
-               ple->error_message);
-    if (ppr->accurate_lensing == _FALSE_) {
-      class_call(lensing_addback_cl_tt(ple,cl_tt),
+  /** - the d-functions are now in d_table: give the quadrature and d-functions back to the cache */
+
+  if (d_table != NULL)
+    cache.has_d = _TRUE_;
+
+  class_call(lensing_cache_store(&cache),
+             ple->error_message,
+             ple->error_message);
+
+  if (ppr->accurate_lensing == _FALSE_) {
+    if (ple->has_tt==_TRUE_) {
+      class_call(lensing_addback_cl_tt(ple,l_size_full,cl_tt),
                  ple->error_message,
                  ple->error_message);
     }
-  }
-
-  if (ple->has_te==_TRUE_) {
-    class_call(lensing_lensed_cl_te(ksiX,d20,w8,num_mu-1,ple),
-               ple->error_message,
-               ple->error_message);
-    if (ppr->accurate_lensing == _FALSE_) {
-      class_call(lensing_addback_cl_te(ple,cl_te),
+    if (ple->has_te==_TRUE_) {
+      class_call(lensing_addback_cl_te(ple,l_size_full,cl_te),
+                 ple->error_message,
+                 ple->error_message);
+    }
+    if (ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_) {
+      class_call(lensing_addback_cl_ee_bb(ple,l_size_full,cl_ee,cl_bb),
                  ple->error_message,
                  ple->error_message);
     }
   }
 
-  if (ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_) {
-
-    class_call(lensing_lensed_cl_ee_bb(ksip,ksim,d22,d2m2,w8,num_mu-1,ple),
+  /** - with the flat-sky FFT method, compute the remaining lensed
+      \f$ C_l\f$'s, and add to the other ones the contribution of the
+      unlensed multipoles above l_max_full, neglected in the full-sky
+      calculation (by linearity, it is the lensing correction computed
+      from these multipoles only) */
+
+  if (l_size_full < ple->l_size) {
+    /* start from the unlensed spectra (the table may contain the
+       lensed spectra of a previous call of lensing_recompute()) */
+    for (index_l=l_size_full; index_l<ple->l_size; index_l++) {
+      l = (int)ple->l[index_l];
+      if (ple->has_tt==_TRUE_)
+        ple->cl_lens[index_l*ple->lt_size+ple->index_lt_tt] = cl_tt[l];
+      if (ple->has_te==_TRUE_)
+        ple->cl_lens[index_l*ple->lt_size+ple->index_lt_te] = cl_te[l];
+      if (ple->has_ee==_TRUE_)
+        ple->cl_lens[index_l*ple->lt_size+ple->index_lt_ee] = cl_ee[l];
+      if (ple->has_bb==_TRUE_)
+        ple->cl_lens[index_l*ple->lt_size+ple->index_lt_bb] = cl_bb[l];
+    }
+    class_call(lensing_flat_sky(ppr,ple,2,l_size_full,ple->l_size,cl_tt,cl_te,cl_ee,cl_bb,cl_pp),
                ple->error_message,
                ple->error_message);
-    if (ppr->accurate_lensing == _FALSE_) {
-      class_call(lensing_addback_cl_ee_bb(ple,cl_ee,cl_bb),
+    if (l_max_full < ple->l_unlensed_max) {
+      class_call(lensing_flat_sky(ppr,ple,l_max_full+1,0,l_size_full,cl_tt,cl_te,cl_ee,cl_bb,cl_pp),
                  ple->error_message,
                  ple->error_message);
     }
   }
-  //fin=omp_get_wtime();
-  //cpu_time = (fin-debut);
-  //printf("time in final lensing computation=%4.3f s\n",cpu_time);
 
   /** - spline computed \f$ C_l\f$'s in view of interpolation */
 
@@ -745,55 +1060,11 @@ int lensing_init(
              ple->error_message);
 
   /** - Free lots of stuff **/
-  free(buf_dxx);
-
-  free(d00);
-  free(d11);
-  free(d1m1);
-  free(d2m2);
-  if (ple->has_te==_TRUE_) {
-    free(d20);
-    free(d3m1);
-    free(d4m2);
-  }
-  if (ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_) {
-    free(d22);
-    free(d31);
-    free(d3m3);
-    free(d40);
-    free(d4m4);
-  }
-
-  if (ple->has_tt==_TRUE_)
-    free(ksi);
-  if (ple->has_te==_TRUE_)
-    free(ksiX);
-  if (ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_) {
-    free(ksip);
-    free(ksim);
-  }
-  free(Cgl);
-  free(Cgl2);
-  free(sigma2);
-
-  free(mu);
-  free(w8);
-
-  free(cl_unlensed);
-  free(cl_tt);
-  if (ple->has_te==_TRUE_)
-    free(cl_te);
-  if (ple->has_ee==_TRUE_ || ple->has_bb==_TRUE_) {
-    free(cl_ee);
-    free(cl_bb);
-  }
-  free(cl_pp);
-  /** - Exit **/
+  free(sqrt1);
 
   return _SUCCESS_;
 
 }
-
 /**
  * This routine frees all the memory space allocated by lensing_init().
  *
@@ -821,6 +1092,149 @@ int lensing_free(
 
 }
 
+/**
+ * Take out of the cache the quadrature in \f$ \mu \f$ and the table of
+ * Wigner d-functions kept by a previous call of lensing_lensed_cls(),
+ * when they were computed with the same parameters. They are not
+ * copied: the cache is emptied, and the caller owns them until it
+ * gives them back with lensing_cache_store(). The parts which do not
+ * match are freed. The flag same_d tells whether the previous run
+ * needed the same d-functions, even if it did not keep them.
+ *
+ * @param ppr        Input: pointer to precision structure
+ * @param ple        Input: pointer to lensing structure
+ * @param num_mu     Input: number of values of \f$ \mu \f$ (including \f$ \mu=1 \f$)
+ * @param l_max_full Input: largest multipole of the d-functions other than d11 and d1m1
+ * @param d_num      Input: number of d-functions
+ * @param pcache     Output: quadrature (if pcache->has_quadrature) and d-functions (if pcache->has_d)
+ * @param same_d     Output: _TRUE_ if the previous run used the same quadrature and d-functions
+ * @return the error status
+ */
+
+int lensing_cache_restore(
+                          struct precision * ppr,
+                          struct lensing * ple,
+                          int num_mu,
+                          int l_max_full,
+                          int d_num,
+                          struct lensing_cache * pcache,
+                          short * same_d
+                          ) {
+
+#pragma omp critical (lensing_cache)
+  {
+    *pcache = lensing_d_cache;
+    lensing_d_cache.has_quadrature = _FALSE_;
+    lensing_d_cache.has_d = _FALSE_;
+  }
+
+  if ((pcache->has_quadrature == _TRUE_) &&
+      (lensing_cache_match_quadrature(ppr,pcache,num_mu) == _FALSE_)) {
+    free(pcache->mu);
+    free(pcache->w8);
+    pcache->has_quadrature = _FALSE_;
+  }
+
+  *same_d = ((pcache->has_quadrature == _TRUE_) &&
+             (lensing_cache_match_d(ppr,ple,pcache,l_max_full,d_num) == _TRUE_));
+
+  if ((pcache->has_d == _TRUE_) && (*same_d == _FALSE_)) {
+    free(pcache->d);
+    pcache->has_d = _FALSE_;
+  }
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * Give the quadrature and d-functions used by lensing_lensed_cls()
+ * back to the cache, replacing its previous content (if any, left by
+ * a concurrent run).
+ *
+ * @param pcache Input: quadrature and d-functions (then owned by the cache)
+ * @return the error status
+ */
+
+int lensing_cache_store(
+                        struct lensing_cache * pcache
+                        ) {
+
+#pragma omp critical (lensing_cache)
+  {
+    if (lensing_d_cache.has_quadrature == _TRUE_) {
+      free(lensing_d_cache.mu);
+      free(lensing_d_cache.w8);
+    }
+    if (lensing_d_cache.has_d == _TRUE_)
+      free(lensing_d_cache.d);
+
+    lensing_d_cache = *pcache;
+  }
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * Check whether a quadrature taken from the cache is the one needed
+ * with the current precision parameters.
+ *
+ * @param ppr    Input: pointer to precision structure
+ * @param pcache Input: content of the cache
+ * @param num_mu Input: number of values of \f$ \mu \f$
+ * @return _TRUE_ if it can be used
+ */
+
+static short lensing_cache_match_quadrature(
+                                            struct precision * ppr,
+                                            struct lensing_cache * pcache,
+                                            int num_mu
+                                            ) {
+
+  if ((pcache->accurate_lensing != ppr->accurate_lensing) ||
+      (pcache->num_mu != num_mu))
+    return _FALSE_;
+
+  if ((ppr->accurate_lensing == _TRUE_) &&
+      (pcache->tol_gauss_legendre != ppr->tol_gauss_legendre))
+    return _FALSE_;
+
+  return _TRUE_;
+
+}
+
+/**
+ * Check whether the d-functions of the previous run (computed at the
+ * nodes of a matching quadrature, and possibly kept in the cache) are
+ * the ones needed by the current run.
+ *
+ * @param ppr        Input: pointer to precision structure
+ * @param ple        Input: pointer to lensing structure
+ * @param pcache     Input: content of the cache
+ * @param l_max_full Input: largest multipole of the d-functions other than d11 and d1m1
+ * @param d_num      Input: number of d-functions
+ * @return _TRUE_ if it can be used
+ */
+
+static short lensing_cache_match_d(
+                                   struct precision * ppr,
+                                   struct lensing * ple,
+                                   struct lensing_cache * pcache,
+                                   int l_max_full,
+                                   int d_num
+                                   ) {
+
+  if ((pcache->l_unlensed_max != ple->l_unlensed_max) ||
+      (pcache->l_max_full != l_max_full) ||
+      (pcache->mu_block_size != ppr->lensing_mu_block_size) ||
+      (pcache->d_num != d_num))
+    return _FALSE_;
+
+  return _TRUE_;
+
+}
+
 /**
  * This routine defines indices and allocates tables in the lensing structure
  *
@@ -1032,13 +1446,16 @@ int lensing_indices(
 }
 
 /**
- * This routine computes the lensed power spectra by Gaussian quadrature
+ * This routine adds the contribution of a block of quadrature points
+ * to the lensed power spectra computed by Gaussian quadrature
  *
- * @param ksi  Input: Lensed correlation function (ksi[index_mu])
- * @param d00  Input: Legendre polynomials (\f$ d^l_{00}\f$[l][index_mu])
- * @param w8   Input: Legendre quadrature weights (w8[index_mu])
- * @param nmu  Input: Number of quadrature points (0<=index_mu<=nmu)
- * @param ple  Input/output: Pointer to the lensing structure
+ * @param ksi     Input: Lensed correlation function (ksi[index_mu])
+ * @param d00     Input: Legendre polynomials (\f$ d^l_{00}\f$[index_mu][l])
+ * @param w8      Input: Legendre quadrature weights (w8[index_mu])
+ * @param nmu     Input: Number of quadrature points of the block (0<=index_mu<nmu)
+ * @param ple     Input: Pointer to the lensing structure
+ * @param l_size  Input: Number of multipoles for which the contribution is computed (0<=index_l<l_size)
+ * @param cl_lens Input/output: Lensed power spectra, cl_lens[index_l*ple->lt_size+ple->index_lt_tt], to which the contribution is added
  * @return the error status
  */
 
@@ -1048,7 +1465,9 @@ int lensing_lensed_cl_tt(
                          double **d00,
                          double *w8,
                          int nmu,
-                         struct lensing * ple
+                         struct lensing * ple,
+                         int l_size,
+                         double * cl_lens
                          ) {
 
   double cle;
@@ -1056,16 +1475,12 @@ int lensing_lensed_cl_tt(
   int index_l;
 
   /** Integration by Gauss-Legendre quadrature. **/
-#pragma omp parallel for                        \
-  private (imu,index_l,cle)                     \
-  schedule (static)
-
-  for(index_l=0; index_l<ple->l_size; index_l++){
+  for(index_l=0; index_l<l_size; index_l++){
     cle=0;
     for (imu=0;imu<nmu;imu++) {
-      cle += ksi[imu]*d00[imu][(int)ple->l[index_l]]*w8[imu]; /* loop could be optimized */
+      cle += ksi[imu]*d00[imu][(int)ple->l[index_l]]*w8[imu];
     }
-    ple->cl_lens[index_l*ple->lt_size+ple->index_lt_tt]=cle*2.0*_PI_;
+    cl_lens[index_l*ple->lt_size+ple->index_lt_tt] += cle*2.0*_PI_;
   }
 
   return _SUCCESS_;
@@ -1076,17 +1491,19 @@ int lensing_lensed_cl_tt(
  * Used in case of fast (and BB inaccurate) integration of
  * correlation functions.
  *
- * @param ple   Input/output: Pointer to the lensing structure
- * @param cl_tt Input: Array of unlensed power spectrum
+ * @param ple    Input/output: Pointer to the lensing structure
+ * @param l_size Input: Number of multipoles for which the unlensed spectrum is added back (0<=index_l<l_size)
+ * @param cl_tt  Input: Array of unlensed power spectrum
  * @return the error status
  */
 
 int lensing_addback_cl_tt(
                           struct lensing * ple,
+                          int l_size,
                           double *cl_tt) {
   int index_l, l;
 
-  for (index_l=0; index_l<ple->l_size; index_l++) {
+  for (index_l=0; index_l<l_size; index_l++) {
     l = (int)ple->l[index_l];
     ple->cl_lens[index_l*ple->lt_size+ple->index_lt_tt] += cl_tt[l];
   }
@@ -1095,13 +1512,16 @@ int lensing_addback_cl_tt(
 }
 
 /**
- * This routine computes the lensed power spectra by Gaussian quadrature
+ * This routine adds the contribution of a block of quadrature points
+ * to the lensed power spectra computed by Gaussian quadrature
  *
- * @param ksiX Input: Lensed correlation function (ksiX[index_mu])
- * @param d20  Input: Wigner d-function (\f$ d^l_{20}\f$[l][index_mu])
- * @param w8   Input: Legendre quadrature weights (w8[index_mu])
- * @param nmu  Input: Number of quadrature points (0<=index_mu<=nmu)
- * @param ple  Input/output: Pointer to the lensing structure
+ * @param ksiX    Input: Lensed correlation function (ksiX[index_mu])
+ * @param d20     Input: Wigner d-function (\f$ d^l_{20}\f$[index_mu][l])
+ * @param w8      Input: Legendre quadrature weights (w8[index_mu])
+ * @param nmu     Input: Number of quadrature points of the block (0<=index_mu<nmu)
+ * @param ple     Input: Pointer to the lensing structure
+ * @param l_size  Input: Number of multipoles for which the contribution is computed (0<=index_l<l_size)
+ * @param cl_lens Input/output: Lensed power spectra, cl_lens[index_l*ple->lt_size+ple->index_lt_te], to which the contribution is added
  * @return the error status
  */
 
@@ -1111,7 +1531,9 @@ int lensing_lensed_cl_te(
                          double **d20,
                          double *w8,
                          int nmu,
-                         struct lensing * ple
+                         struct lensing * ple,
+                         int l_size,
+                         double * cl_lens
                          ) {
 
   double clte;
@@ -1119,16 +1541,12 @@ int lensing_lensed_cl_te(
   int index_l;
 
   /** Integration by Gauss-Legendre quadrature. **/
-#pragma omp parallel for                        \
-  private (imu,index_l,clte)                    \
-  schedule (static)
-
-  for(index_l=0; index_l < ple->l_size; index_l++){
+  for(index_l=0; index_l < l_size; index_l++){
     clte=0;
     for (imu=0;imu<nmu;imu++) {
-      clte += ksiX[imu]*d20[imu][(int)ple->l[index_l]]*w8[imu]; /* loop could be optimized */
+      clte += ksiX[imu]*d20[imu][(int)ple->l[index_l]]*w8[imu];
     }
-    ple->cl_lens[index_l*ple->lt_size+ple->index_lt_te]=clte*2.0*_PI_;
+    cl_lens[index_l*ple->lt_size+ple->index_lt_te] += clte*2.0*_PI_;
   }
 
   return _SUCCESS_;
@@ -1139,17 +1557,19 @@ int lensing_lensed_cl_te(
  * Used in case of fast (and BB inaccurate) integration of
  * correlation functions.
  *
- * @param ple   Input/output: Pointer to the lensing structure
- * @param cl_te Input: Array of unlensed power spectrum
+ * @param ple    Input/output: Pointer to the lensing structure
+ * @param l_size Input: Number of multipoles for which the unlensed spectrum is added back (0<=index_l<l_size)
+ * @param cl_te  Input: Array of unlensed power spectrum
  * @return the error status
  */
 
 int lensing_addback_cl_te(
                           struct lensing * ple,
+                          int l_size,
                           double *cl_te) {
   int index_l, l;
 
-  for (index_l=0; index_l<ple->l_size; index_l++) {
+  for (index_l=0; index_l<l_size; index_l++) {
     l = (int)ple->l[index_l];
     ple->cl_lens[index_l*ple->lt_size+ple->index_lt_te] += cl_te[l];
   }
@@ -1158,15 +1578,18 @@ int lensing_addback_cl_te(
 }
 
 /**
- * This routine computes the lensed power spectra by Gaussian quadrature
+ * This routine adds the contribution of a block of quadrature points
+ * to the lensed power spectra computed by Gaussian quadrature
  *
- * @param ksip Input: Lensed correlation function (ksi+[index_mu])
- * @param ksim Input: Lensed correlation function (ksi-[index_mu])
- * @param d22  Input: Wigner d-function (\f$ d^l_{22}\f$[l][index_mu])
- * @param d2m2 Input: Wigner d-function (\f$ d^l_{2-2}\f$[l][index_mu])
- * @param w8   Input: Legendre quadrature weights (w8[index_mu])
- * @param nmu  Input: Number of quadrature points (0<=index_mu<=nmu)
- * @param ple  Input/output: Pointer to the lensing structure
+ * @param ksip    Input: Lensed correlation function (ksi+[index_mu])
+ * @param ksim    Input: Lensed correlation function (ksi-[index_mu])
+ * @param d22     Input: Wigner d-function (\f$ d^l_{22}\f$[index_mu][l])
+ * @param d2m2    Input: Wigner d-function (\f$ d^l_{2-2}\f$[index_mu][l])
+ * @param w8      Input: Legendre quadrature weights (w8[index_mu])
+ * @param nmu     Input: Number of quadrature points of the block (0<=index_mu<nmu)
+ * @param ple     Input: Pointer to the lensing structure
+ * @param l_size  Input: Number of multipoles for which the contribution is computed (0<=index_l<l_size)
+ * @param cl_lens Input/output: Lensed power spectra, cl_lens[index_l*ple->lt_size+ple->index_lt_ee] and cl_lens[index_l*ple->lt_size+ple->index_lt_bb], to which the contribution is added
  * @return the error status
  */
 
@@ -1178,7 +1601,9 @@ int lensing_lensed_cl_ee_bb(
                             double **d2m2,
                             double *w8,
                             int nmu,
-                            struct lensing * ple
+                            struct lensing * ple,
+                            int l_size,
+                            double * cl_lens
                             ) {
 
   double clp, clm;
@@ -1186,18 +1611,14 @@ int lensing_lensed_cl_ee_bb(
   int index_l;
 
   /** Integration by Gauss-Legendre quadrature. **/
-#pragma omp parallel for                        \
-  private (imu,index_l,clp,clm)                 \
-  schedule (static)
-
-  for(index_l=0; index_l < ple->l_size; index_l++){
+  for(index_l=0; index_l < l_size; index_l++){
     clp=0; clm=0;
     for (imu=0;imu<nmu;imu++) {
-      clp += ksip[imu]*d22[imu][(int)ple->l[index_l]]*w8[imu]; /* loop could be optimized */
-      clm += ksim[imu]*d2m2[imu][(int)ple->l[index_l]]*w8[imu]; /* loop could be optimized */
+      clp += ksip[imu]*d22[imu][(int)ple->l[index_l]]*w8[imu];
+      clm += ksim[imu]*d2m2[imu][(int)ple->l[index_l]]*w8[imu];
     }
-    ple->cl_lens[index_l*ple->lt_size+ple->index_lt_ee]=(clp+clm)*_PI_;
-    ple->cl_lens[index_l*ple->lt_size+ple->index_lt_bb]=(clp-clm)*_PI_;
+    cl_lens[index_l*ple->lt_size+ple->index_lt_ee] += (clp+clm)*_PI_;
+    cl_lens[index_l*ple->lt_size+ple->index_lt_bb] += (clp-clm)*_PI_;
   }
 
   return _SUCCESS_;
@@ -1208,20 +1629,22 @@ int lensing_lensed_cl_ee_bb(
  * Used in case of fast (and BB inaccurate) integration of
  * correlation functions.
  *
- * @param ple   Input/output: Pointer to the lensing structure
- * @param cl_ee Input: Array of unlensed power spectrum
- * @param cl_bb Input: Array of unlensed power spectrum
+ * @param ple    Input/output: Pointer to the lensing structure
+ * @param l_size Input: Number of multipoles for which the unlensed spectrum is added back (0<=index_l<l_size)
+ * @param cl_ee  Input: Array of unlensed power spectrum
+ * @param cl_bb  Input: Array of unlensed power spectrum
  * @return the error status
  */
 
 int lensing_addback_cl_ee_bb(
                              struct lensing * ple,
+                             int l_size,
                              double * cl_ee,
                              double * cl_bb) {
 
   int index_l, l;
 
-  for (index_l=0; index_l<ple->l_size; index_l++) {
+  for (index_l=0; index_l<l_size; index_l++) {
     l = (int)ple->l[index_l];
     ple->cl_lens[index_l*ple->lt_size+ple->index_lt_ee] += cl_ee[l];
     ple->cl_lens[index_l*ple->lt_size+ple->index_lt_bb] += cl_bb[l];
@@ -1230,6 +1653,540 @@ int lensing_addback_cl_ee_bb(
 
 }
 
+/**
+ * This routine computes the lensed \f$ C_l\f$'s in the flat-sky
+ * limit, for the multipoles ple->l[index_l] with index_l_first <=
+ * index_l < index_l_last, and adds the lensing correction to the
+ * \f$ C_l\f$'s stored in ple->cl_lens. Only the unlensed
+ * multipoles l >= l_min contribute to this correction.
+ *
+ * In this limit, the Wigner functions \f$ d^l_{mm'}(\theta) \f$ become
+ * Bessel functions \f$ J_{m-m'}(L\theta) \f$ with \f$ L=l+1/2 \f$, the
+ * sums over l become integrals over L, and the integrals over \f$
+ * \mu \f$ become integrals over \f$ \theta \f$: the correlation
+ * functions are Hankel transforms of the \f$ C_l\f$'s and vice
+ * versa, computed with the FFTLog algorithm on logarithmic grids in L
+ * and \f$ \theta \f$, in \f$ O(N \ln N) \f$ operations instead of \f$
+ * O(l_{max}^2) \f$. The correlation functions also depend on \f$
+ * \theta \f$ through sigma2(\f$\theta\f$), in the exponentials of the
+ * \f$ X_{imn} \f$: they are transformed for
+ * ppr->lensing_fft_sigma2_nodes fixed values of sigma2 (the Chebyshev
+ * nodes between zero and its largest value), and interpolated at
+ * sigma2(\f$\theta\f$). As in the fast mode, only the lensing
+ * correction to the correlation functions is computed, and it is
+ * integrated over \f$ \theta < \pi/16 \f$.
+ *
+ * @param ppr            Input: pointer to precision structure
+ * @param ple            Input/output: pointer to lensing structure
+ * @param l_min          Input: smallest unlensed multipole contributing to the correction
+ * @param index_l_first  Input: first index of ple->l for which the correction is computed
+ * @param index_l_last   Input: last index of ple->l for which the correction is computed, plus one
+ * @param cl_tt          Input: unlensed \f$ C_l^{TT}\f$ (cl_tt[l])
+ * @param cl_te          Input: unlensed \f$ C_l^{TE}\f$ (if ple->has_te)
+ * @param cl_ee          Input: unlensed \f$ C_l^{EE}\f$ (if ple->has_ee or ple->has_bb)
+ * @param cl_bb          Input: unlensed \f$ C_l^{BB}\f$ (if ple->has_ee or ple->has_bb)
+ * @param cl_pp          Input: unlensed \f$ C_l^{\phi\phi}\f$
+ * @return the error status
+ */
+
+int lensing_flat_sky(
+                     struct precision * ppr,
+                     struct lensing * ple,
+                     int l_min,
+                     int index_l_first,
+                     int index_l_last,
+                     double * cl_tt,
+                     double * cl_te,
+                     double * cl_ee,
+                     double * cl_bb,
+                     double * cl_pp
+                     ) {
+
+  /* the terms of the correlation functions ksi, ksiX, ksi+ and ksi-
+     (in this order) are products of the unlensed spectrum, of a
+     function of l and sigma2 computed by lensing_flat_sky_terms(), of
+     a Bessel function of order term_n and of a power term_p of
+     Cgl2 */
+  int term_ksi[_LENSING_FLAT_TERMS_] = {0,0,0,0, 1,1,1,1,1, 2,2,2,2, 3,3,3,3,3,3};
+  int term_n[_LENSING_FLAT_TERMS_]   = {0,2,0,4, 2,0,4,2,6, 0,2,0,4, 4,2,6,4,0,8};
+  int term_p[_LENSING_FLAT_TERMS_]   = {0,1,2,2, 0,1,1,2,2, 0,1,2,2, 0,1,1,2,2,2};
+  short has_ksi[4];
+  /* pairs of terms with the same order, transformed together */
+  int pair_first[_LENSING_FLAT_TERMS_],pair_second[_LENSING_FLAT_TERMS_];
+  int pair_num,index_pair,index_term,n,other;
+
+  struct fft_hankel_plan plan_forward[5];
+  struct fft_hankel_plan plan_backward[3];
+
+  double theta_max,L_first,dlnL,span,dlnL_target,theta_first;
+  int N,index_L,index_theta,index_theta_max,index_L_min,index_L_max;
+  int l_max,l;
+  double L,lfrac,ll,taper,taper_width,x;
+
+  double * cl_grid;   /* unlensed spectra on the grid of L, cl_grid[index_ksi*N+index_L] */
+  double * f_pp;      /* l(l+1)C_l^phiphi/(2pi) on the grid of L */
+  double * Cgl;       /* Cgl on the grid of theta */
+  double * Cgl2;      /* Cgl2 on the grid of theta */
+  double * sigma2;    /* sigma2 on the grid of theta */
+  double * work;
+
+  int node_num,index_node;
+  double sigma2_max,den;
+  double scale[3];    /* powers of the largest |Cgl2| */
+  double * node;      /* values of sigma2 at the Chebyshev nodes */
+  double * bary;      /* interpolation coefficients bary[index_node*N+index_theta] */
+  double * ksi_node;  /* contribution of each node to the correlation functions,
+                         ksi_node[(index_node*4+index_ksi)*N+index_theta] */
+  double * ksi;       /* correlation functions times the window, ksi[index_ksi*N+index_theta] */
+  double * dcl;       /* lensing correction on the grid of L, dcl[index_L*4+index_ct] (tt, te, ee, bb) */
+  double * ddcl;
+  double * lnL;
+  double dcl_l[4];
+  int index_ksi,index_l,last_index;
+
+  /* workspace of each thread */
+  double * f;         /* f[index_term*N+index_L] */
+  double * g1;
+  double * g2;
+  double * fwork;
+  double term[_LENSING_FLAT_TERMS_];
+  double power;
+  int abort;
+  struct parallel_timer timer;
+
+  /** - logarithmic grids: L from L_first to
+      L_first*exp((N-1)*dlnL), and theta from
+      1/(L_first*exp((N-1)*dlnL)) to 1/L_first. They
+      cover the multipoles from 2 to l_max and the angles from
+      10^-2/l_max to theta_max with margins of one decade, and the step
+      samples the oscillations of \f$ J_n(l_{max}\theta_{max}) \f$ with
+      at least ppr->lensing_fft_sampling points per period. */
+
+  l_max = ple->l_unlensed_max;
+  theta_max = _PI_/16.;
+
+  L_first = 0.1/theta_max;
+  span = 2.*log(100.*l_max/L_first);
+  dlnL_target = _TWOPI_/(ppr->lensing_fft_sampling*l_max*theta_max);
+  for (N=2; N*dlnL_target < span; N*=2);
+  dlnL = span/(N-1);
+  theta_first = 1./(L_first*exp((N-1)*dlnL));
+
+  for (index_theta_max=0; theta_first*exp((index_theta_max+1)*dlnL) <= theta_max; index_theta_max++);
+
+  index_L_min = (int)(log(2.5/L_first)/dlnL);
+  index_L_max = MIN((int)(log((l_max+0.5)/L_first)/dlnL)+1,N-1);
+
+  if (ple->lensing_verbose > 1)
+    printf(" -> flat-sky lensing with FFT's of %d points and %d values of sigma2\n",N,ppr->lensing_fft_sigma2_nodes);
+
+  has_ksi[0] = ple->has_tt;
+  has_ksi[1] = ple->has_te;
+  has_ksi[2] = (ple->has_ee == _TRUE_ || ple->has_bb == _TRUE_) ? _TRUE_ : _FALSE_;
+  has_ksi[3] = has_ksi[2];
+
+  pair_num = 0;
+  for (n=0; n<=8; n+=2) {
+    other = -1;
+    for (index_term=0; index_term<_LENSING_FLAT_TERMS_; index_term++) {
+      if ((term_n[index_term] != n) || (has_ksi[term_ksi[index_term]] == _FALSE_))
+        continue;
+      if (other < 0) {
+        other = index_term;
+      }
+      else {
+        pair_first[pair_num] = other;
+        pair_second[pair_num] = index_term;
+        pair_num++;
+        other = -1;
+      }
+    }
+    if (other >= 0) {
+      pair_first[pair_num] = other;
+      pair_second[pair_num] = -1;
+      pair_num++;
+    }
+  }
+
+  /** - plans of the transforms from L to theta (orders 0 to 8) and
+      from theta to L (orders 0, 2 and 4) */
+
+  for (n=0; n<=8; n+=2) {
+    class_call(fft_hankel_plan_init(N,n,(n == 0) ? -1. : -0.5,dlnL,L_first,theta_first,&(plan_forward[n/2]),ple->error_message),
+               ple->error_message,
+               ple->error_message);
+  }
+  for (n=0; n<=4; n+=2) {
+    class_call(fft_hankel_plan_init(N,n,(n == 0) ? -1. : -0.5,dlnL,theta_first,L_first,&(plan_backward[n/2]),ple->error_message),
+               ple->error_message,
+               ple->error_message);
+  }
+
+  /** - unlensed spectra on the grid of L, interpolated linearly in
+      l=L-1/2, and tapered over the last delta_l_max/5 multipoles (all
+      of them for the lensing potential, only those above l_min for the
+      other ones) */
+
+  class_calloc(cl_grid,5*N,sizeof(double),ple->error_message);
+  f_pp = cl_grid+4*N;
+
+  taper_width = ppr->delta_l_max/5.;
+
+  for (index_L=index_L_min; index_L<=index_L_max; index_L++) {
+    L = L_first*exp(index_L*dlnL);
+    ll = L-0.5;
+    if ((ll < 2.) || (ll > l_max))
+      continue;
+    l = MIN((int)ll,l_max-1);
+    lfrac = ll-l;
+    taper = 1.;
+    if (ll > l_max-taper_width) {
+      taper = cos(0.5*_PI_*(ll-l_max+taper_width)/taper_width);
+      taper *= taper;
+    }
+    taper /= _TWOPI_;
+    f_pp[index_L] = taper*ll*(ll+1.)*((1.-lfrac)*cl_pp[l]+lfrac*cl_pp[l+1]);
+    if (ll < l_min-0.5)
+      continue;
+    if (has_ksi[0] == _TRUE_)
+      cl_grid[index_L] = taper*((1.-lfrac)*cl_tt[l]+lfrac*cl_tt[l+1]);
+    if (has_ksi[1] == _TRUE_)
+      cl_grid[N+index_L] = taper*((1.-lfrac)*cl_te[l]+lfrac*cl_te[l+1]);
+    if (has_ksi[2] == _TRUE_) {
+      cl_grid[2*N+index_L] = taper*((1.-lfrac)*(cl_ee[l]+cl_bb[l])+lfrac*(cl_ee[l+1]+cl_bb[l+1]));
+      cl_grid[3*N+index_L] = taper*((1.-lfrac)*(cl_ee[l]-cl_bb[l])+lfrac*(cl_ee[l+1]-cl_bb[l+1]));
+    }
+  }
+
+  /** - Cgl, Cgl2 and sigma2 on the grid of theta. Since the
+      smallest angle is much smaller than \f$ 1/l_{max} \f$, sigma2 is
+      the difference between Cgl at this angle and at theta. */
+
+  class_alloc(Cgl,3*N*sizeof(double),ple->error_message);
+  Cgl2 = Cgl+N;
+  sigma2 = Cgl2+N;
+  class_alloc(work,2*N*sizeof(double),ple->error_message);
+
+  class_call(fft_hankel(&(plan_forward[0]),f_pp,NULL,Cgl,NULL,work,ple->error_message),
+             ple->error_message,
+             ple->error_message);
+  class_call(fft_hankel(&(plan_forward[1]),f_pp,NULL,Cgl2,NULL,work,ple->error_message),
+             ple->error_message,
+             ple->error_message);
+
+  sigma2_max = 0.;
+  scale[1] = 0.;
+  for (index_theta=0; index_theta<=index_theta_max; index_theta++) {
+    sigma2[index_theta] = Cgl[0]-Cgl[index_theta];
+    sigma2_max = MAX(sigma2_max,sigma2[index_theta]);
+    scale[1] = MAX(scale[1],fabs(Cgl2[index_theta]));
+  }
+
+  /* the terms multiplied by Cgl2 are much larger than the others:
+     since they are transformed two by two as the real and imaginary
+     parts of a single complex function, they are rescaled by powers of
+     the largest Cgl2, in order to avoid that the rounding errors of
+     one term dominate the other */
+  scale[0] = 1.;
+  scale[2] = scale[1]*scale[1];
+
+  /** - Chebyshev nodes between 0 and the largest sigma2, and
+      coefficients of the barycentric interpolation formula at each
+      sigma2(theta) */
+
+  node_num = ppr->lensing_fft_sigma2_nodes;
+
+  class_alloc(node,node_num*sizeof(double),ple->error_message);
+  class_alloc(bary,node_num*N*sizeof(double),ple->error_message);
+
+  for (index_node=0; index_node<node_num; index_node++)
+    node[index_node] = 0.5*sigma2_max*(1.-cos(_PI_*(index_node+0.5)/node_num));
+
+  for (index_theta=0; index_theta<=index_theta_max; index_theta++) {
+    den = 0.;
+    for (index_node=0; index_node<node_num; index_node++) {
+      x = sigma2[index_theta]-node[index_node];
+      if (x == 0.)
+        break;
+      bary[index_node*N+index_theta] = (index_node%2 == 0 ? 1. : -1.)*sin(_PI_*(index_node+0.5)/node_num)/x;
+      den += bary[index_node*N+index_theta];
+    }
+    if (index_node < node_num) {
+      /* sigma2(theta) coincides with a node */
+      other = index_node;
+      for (index_node=0; index_node<node_num; index_node++)
+        bary[index_node*N+index_theta] = (index_node == other) ? 1. : 0.;
+    }
+    else {
+      for (index_node=0; index_node<node_num; index_node++)
+        bary[index_node*N+index_theta] /= den;
+    }
+  }
+
+  /** - for each node (in parallel), transform all the terms of the
+      correlation functions, and store their contribution
+      separately, so that the result does not depend on the number of
+      threads */
+
+  class_calloc(ksi_node,node_num*4*N,sizeof(double),ple->error_message);
+
+  abort = _FALSE_;
+
+  parallel_timer_start(&timer);
+
+#pragma omp parallel                                                    \
+  shared(ppr,ple,N,node_num,node,bary,ksi_node,cl_grid,Cgl2,plan_forward,pair_num,pair_first,pair_second, \
+         term_ksi,term_n,term_p,has_ksi,scale,index_L_min,index_L_max,index_theta_max,L_first,dlnL,abort,timer) \
+  private(index_node,index_pair,index_term,index_L,index_theta,L,ll,term,f,g1,g2,fwork,power)
+  {
+    class_alloc_parallel(f,(_LENSING_FLAT_TERMS_+4)*N*sizeof(double),ple->error_message);
+    g1 = f+_LENSING_FLAT_TERMS_*N;
+    g2 = g1+N;
+    fwork = g2+N;
+
+#pragma omp for schedule (dynamic) nowait
+
+    for (index_node=0; index_node<node_num; index_node++) {
+
+#pragma omp flush(abort)
+
+      if (abort == _TRUE_) continue;
+
+      /** - --> all the terms on the grid of L, for sigma2 at this node */
+      for (index_term=0; index_term<_LENSING_FLAT_TERMS_*N; index_term++)
+        f[index_term] = 0.;
+
+      for (index_L=index_L_min; index_L<=index_L_max; index_L++) {
+        L = L_first*exp(index_L*dlnL);
+        ll = L-0.5;
+        if (ll < 2.)
+          continue;
+        lensing_flat_sky_terms(ll,node[index_node],term);
+        for (index_term=0; index_term<_LENSING_FLAT_TERMS_; index_term++)
+          if (has_ksi[term_ksi[index_term]] == _TRUE_)
+            f[index_term*N+index_L] = cl_grid[term_ksi[index_term]*N+index_L]*term[index_term]*scale[term_p[index_term]];
+      }
+
+      /** - --> transform them two by two, and add them to the correlation functions */
+      for (index_pair=0; index_pair<pair_num; index_pair++) {
+
+        index_term = pair_first[index_pair];
+
+        class_call_parallel(fft_hankel(&(plan_forward[term_n[index_term]/2]),
+                                       f+index_term*N,
+                                       (pair_second[index_pair] < 0) ? NULL : f+pair_second[index_pair]*N,
+                                       g1,
+                                       g2,
+                                       fwork,
+                                       ple->error_message),
+                            ple->error_message,
+                            ple->error_message);
+
+        for (index_theta=0; index_theta<=index_theta_max; index_theta++) {
+          power = (term_p[index_term] == 0) ? 1. : ((term_p[index_term] == 1) ? Cgl2[index_theta]/scale[1] : Cgl2[index_theta]*Cgl2[index_theta]/scale[2]);
+          ksi_node[(index_node*4+term_ksi[index_term])*N+index_theta] += bary[index_node*N+index_theta]*power*g1[index_theta];
+        }
+
+        if (pair_second[index_pair] >= 0) {
+          index_term = pair_second[index_pair];
+          for (index_theta=0; index_theta<=index_theta_max; index_theta++) {
+            power = (term_p[index_term] == 0) ? 1. : ((term_p[index_term] == 1) ? Cgl2[index_theta]/scale[1] : Cgl2[index_theta]*Cgl2[index_theta]/scale[2]);
+            ksi_node[(index_node*4+term_ksi[index_term])*N+index_theta] += bary[index_node*N+index_theta]*power*g2[index_theta];
+          }
+        }
+      }
+    }
+
+    free(f);
+
+    parallel_timer_thread_done(&timer);
+
+  } /* end of parallel region */
+
+  parallel_timer_stop(&timer,"lensing_flat_sky: nodes");
+
+  if (abort == _TRUE_) return _FAILURE_;
+
+  /** - sum the contributions of the nodes, multiply by the measure
+      and by a window going smoothly to zero between theta_max/2 and
+      theta_max */
+
+  class_calloc(ksi,4*N,sizeof(double),ple->error_message);
+
+  for (index_ksi=0; index_ksi<4; index_ksi++) {
+    if (has_ksi[index_ksi] == _FALSE_)
+      continue;
+    for (index_theta=0; index_theta<=index_theta_max; index_theta++) {
+      for (index_node=0; index_node<node_num; index_node++)
+        ksi[index_ksi*N+index_theta] += ksi_node[(index_node*4+index_ksi)*N+index_theta];
+      x = theta_first*exp(index_theta*dlnL)/theta_max;
+      if (x > 0.5) {
+        taper = cos(_PI_*(x-0.5));
+        ksi[index_ksi*N+index_theta] *= taper*taper;
+      }
+      ksi[index_ksi*N+index_theta] *= (index_ksi < 2) ? _TWOPI_ : _PI_;
+    }
+  }
+
+  /** - transform back to the lensing corrections of the \f$ C_l\f$'s on the grid of L */
+
+  class_alloc(dcl,9*N*sizeof(double),ple->error_message);
+  ddcl = dcl+4*N;
+  lnL = ddcl+4*N;
+  g1 = ksi_node; /* reused for the four transforms, g1[index_ksi*N+index_L] */
+
+  if ((has_ksi[0] == _TRUE_) || (has_ksi[2] == _TRUE_)) {
+    class_call(fft_hankel(&(plan_backward[0]),ksi,ksi+2*N,g1,g1+2*N,work,ple->error_message),
+               ple->error_message,
+               ple->error_message);
+  }
+  if (has_ksi[1] == _TRUE_) {
+    class_call(fft_hankel(&(plan_backward[1]),ksi+N,NULL,g1+N,NULL,work,ple->error_message),
+               ple->error_message,
+               ple->error_message);
+  }
+  if (has_ksi[3] == _TRUE_) {
+    class_call(fft_hankel(&(plan_backward[2]),ksi+3*N,NULL,g1+3*N,NULL,work,ple->error_message),
+               ple->error_message,
+               ple->error_message);
+  }
+
+  /* dcl[(index_L-index_L_min)*4+index_ct], with index_ct = 0, 1, 2, 3 for TT, TE, EE, BB */
+  for (index_L=index_L_min; index_L<=index_L_max; index_L++) {
+    lnL[index_L-index_L_min] = log(L_first)+index_L*dlnL;
+    dcl[(index_L-index_L_min)*4] = (has_ksi[0] == _TRUE_) ? g1[index_L] : 0.;
+    dcl[(index_L-index_L_min)*4+1] = (has_ksi[1] == _TRUE_) ? g1[N+index_L] : 0.;
+    dcl[(index_L-index_L_min)*4+2] = (has_ksi[2] == _TRUE_) ? g1[2*N+index_L]+g1[3*N+index_L] : 0.;
+    dcl[(index_L-index_L_min)*4+3] = (has_ksi[2] == _TRUE_) ? g1[2*N+index_L]-g1[3*N+index_L] : 0.;
+  }
+
+  /** - interpolate the corrections at \f$ L=l+1/2 \f$ and add them to
+      the unlensed \f$ C_l\f$'s */
+
+  class_call(array_spline_table_lines(lnL,
+                                      index_L_max-index_L_min+1,
+                                      dcl,
+                                      4,
+                                      ddcl,
+                                      _SPLINE_EST_DERIV_,
+                                      ple->error_message),
+             ple->error_message,
+             ple->error_message);
+
+  last_index = 0;
+
+  for (index_l=index_l_first; index_l<index_l_last; index_l++) {
+
+    class_call(array_interpolate_spline(lnL,
+                                        index_L_max-index_L_min+1,
+                                        dcl,
+                                        ddcl,
+                                        4,
+                                        log(ple->l[index_l]+0.5),
+                                        &last_index,
+                                        dcl_l,
+                                        4,
+                                        ple->error_message),
+               ple->error_message,
+               ple->error_message);
+
+    if (ple->has_tt == _TRUE_)
+      ple->cl_lens[index_l*ple->lt_size+ple->index_lt_tt] += dcl_l[0];
+    if (ple->has_te == _TRUE_)
+      ple->cl_lens[index_l*ple->lt_size+ple->index_lt_te] += dcl_l[1];
+    if (ple->has_ee == _TRUE_)
+      ple->cl_lens[index_l*ple->lt_size+ple->index_lt_ee] += dcl_l[2];
+    if (ple->has_bb == _TRUE_)
+      ple->cl_lens[index_l*ple->lt_size+ple->index_lt_bb] += dcl_l[3];
+  }
+
+  /** - free everything */
+
+  for (n=0; n<=8; n+=2)
+    fft_hankel_plan_free(&(plan_forward[n/2]));
+  for (n=0; n<=4; n+=2)
+    fft_hankel_plan_free(&(plan_backward[n/2]));
+
+  free(cl_grid);
+  free(Cgl);
+  free(work);
+  free(node);
+  free(bary);
+  free(ksi_node);
+  free(ksi);
+  free(dcl);
+
+  return _SUCCESS_;
+}
+
+/**
+ * This routine computes, for one multipole and one value of sigma2,
+ * the functions of l and sigma2 entering the terms of the correlation
+ * functions in lensing_flat_sky(): they are the same combinations of
+ * the \f$ X_{imn} \f$ as in lensing_init(), minus one for the terms
+ * in which the unlensed correlation function is subtracted.
+ *
+ * @param l      Input: multipole (not necessarily an integer)
+ * @param sigma2 Input: value of sigma2
+ * @param term   Output: the _LENSING_FLAT_TERMS_ functions (in the order of lensing_flat_sky())
+ * @return the error status
+ */
+
+int lensing_flat_sky_terms(
+                           double l,
+                           double sigma2,
+                           double * term
+                           ) {
+
+  double fac,em1,a;
+  double X_000,X_p000,X_220,X_022,X_p022,X_121,X_132,X_242;
+
+  fac = l*(l+1.)/4.;
+
+  /* X_000*X_000-1, computed without cancellation */
+  em1 = expm1(-2.*fac*sigma2);
+  /* X_022 = X_000*(1+a) */
+  a = sigma2*(1.+0.5*sigma2);
+
+  X_000 = exp(-fac*sigma2);
+  X_p000 = -fac*X_000;
+  X_220 = 0.25*sqrt((l+2.)*(l+1.)*l*(l-1.))*X_000;
+  X_022 = X_000*(1.+a);
+  X_p022 = -(fac-1.)*X_022;
+  X_242 = 0.25*sqrt(MAX((l+4.)*(l+3.)*(l-2.)*(l-3.),0.))*X_000;
+  X_121 = -0.5*sqrt((l+2.)*(l-1.))*X_000*(1.+2./3.*sigma2);
+  X_132 = -0.5*sqrt(MAX((l+3.)*(l-2.),0.))*X_000*(1.+5./3.*sigma2);
+
+  /* ksi (TT) */
+  term[0] = em1;
+  term[1] = X_p000*X_p000*8./(l*(l+1.));
+  term[2] = X_p000*X_p000;
+  term[3] = X_220*X_220;
+
+  /* ksiX (TE) */
+  term[4] = em1*(1.+a)+a;
+  term[5] = 2.*X_p000*X_121/sqrt(l*(l+1.));
+  term[6] = 2.*X_p000*X_132/sqrt(l*(l+1.));
+  term[7] = 0.5*(2.*X_p022*X_p000+X_220*X_220);
+  term[8] = 0.5*X_220*X_242;
+
+  /* ksi+ (EE+BB) */
+  term[9] = em1*(1.+a)*(1.+a)+a*(2.+a);
+  term[10] = 2.*X_132*X_121;
+  term[11] = X_p022*X_p022;
+  term[12] = X_242*X_220;
+
+  /* ksi- (EE-BB) */
+  term[13] = term[9];
+  term[14] = X_121*X_121;
+  term[15] = X_132*X_132;
+  term[16] = X_p022*X_p022;
+  term[17] = 0.5*X_220*X_220;
+  term[18] = 0.5*X_242*X_242;
+
+  return _SUCCESS_;
+}
+
 /**
  * This routine computes the d00 term
  *
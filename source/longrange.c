@@ -2,6 +2,7 @@
  * Numerical module that computes the long-range interaction integrals
  */
 #include "longrange.h"
+#include <time.h>
 
 /* CLASS stores energy densities in units such that
    
@@ -116,10 +117,21 @@ int background_lrs_init(
                          struct background *pba
                          ) {
 
-  int index_q, tolexp,row,status,filenum;
+  int index_q, reused;
   double q, dlnf0_dlnq;
   struct background_parameters_for_distributions pbadist;
-  FILE *psdfile;
+  /* for the parallel region */
+  int abort;
+
+  /* While shooting, the samplings and tables of the previous
+     iteration are reused if the lrs parameters did not change */
+  if (pba->shooting_previous != NULL) {
+    class_call(background_lrs_reuse(pba, pba->shooting_previous, &reused),
+               pba->error_message,
+               pba->error_message);
+    if (reused == _TRUE_)
+      return _SUCCESS_;
+  }
 
   pbadist.pba = pba;
 
@@ -127,56 +139,79 @@ int background_lrs_init(
   pbadist.tablesize = 0;
 
   /* Handle perturbation qsampling: */
-  if (pba->lrs_quadrature_strategy==qm_auto){
-    /** Automatic q-sampling for this species */
-    class_alloc(pba->q_lrs,_QUADRATURE_MAX_*sizeof(double),pba->error_message);
-    class_alloc(pba->w_lrs,_QUADRATURE_MAX_*sizeof(double),pba->error_message);
-
-    class_call(get_qsampling(pba->q_lrs,
-			     pba->w_lrs,
-			     &(pba->q_size_lrs),
-			     _QUADRATURE_MAX_,
-			     ppr->tol_lrs,
-			     pbadist.q,
-			     pbadist.tablesize,
-			     background_lrs_test_function,
-			     background_lrs_distribution,
-			     &pbadist,
-			     pba->error_message),
-	       pba->error_message,
-	       pba->error_message);
-    pba->q_lrs=realloc(pba->q_lrs,pba->q_size_lrs*sizeof(double));
-    pba->w_lrs=realloc(pba->w_lrs,pba->q_size_lrs*sizeof(double));
+  if ((pba->lrs_quadrature_strategy==qm_auto) || (pba->lrs_quadrature_strategy==qm_compressed)){
+    /** Automatic q-sampling for this species (with qm_compressed, the
+        perturbation sampling is derived from the background one below).
+        The perturbation and background samplings are independent and
+        found in parallel. */
+    abort = _FALSE_;
 
+#pragma omp parallel sections                   \
+  shared(ppr,pba,pbadist,abort)
 
-    if (pba->background_verbose > 0)
-      printf("lrs species sampled with %d points for purpose of perturbation integration\n",
-	     pba->q_size_lrs);
+    {
 
-    /* Handle background q_sampling: */
-    class_alloc(pba->q_lrs_bg,_QUADRATURE_MAX_BG_*sizeof(double),pba->error_message);
-    class_alloc(pba->w_lrs_bg,_QUADRATURE_MAX_BG_*sizeof(double),pba->error_message);
-
-    class_call(get_qsampling(pba->q_lrs_bg,
-			     pba->w_lrs_bg,
-			     &(pba->q_size_lrs_bg),
-			     _QUADRATURE_MAX_BG_,
-			     ppr->tol_lrs_bg,
-			     pbadist.q,
-			     pbadist.tablesize,
-			     background_lrs_test_function,
-			     background_lrs_distribution,
-			     &pbadist,
-			     pba->error_message),
-	       pba->error_message,
-	       pba->error_message);
+#pragma omp section
+      {
+        if (pba->lrs_quadrature_strategy==qm_auto){
+          class_alloc_parallel(pba->q_lrs,_QUADRATURE_MAX_*sizeof(double),pba->error_message);
+          class_alloc_parallel(pba->w_lrs,_QUADRATURE_MAX_*sizeof(double),pba->error_message);
 
+          class_call_parallel(get_qsampling_cached(pba->q_lrs,
+                                                   pba->w_lrs,
+                                                   &(pba->q_size_lrs),
+                                                   _QUADRATURE_MAX_,
+                                                   ppr->tol_lrs,
+                                                   pbadist.q,
+                                                   pbadist.tablesize,
+                                                   background_lrs_test_function,
+                                                   background_lrs_distribution,
+                                                   &pbadist,
+                                                   pba->quadrature_cache_directory,
+                                                   pba->error_message),
+                              pba->error_message,
+                              pba->error_message);
+          if (abort == _FALSE_) {
+            pba->q_lrs=realloc(pba->q_lrs,pba->q_size_lrs*sizeof(double));
+            pba->w_lrs=realloc(pba->w_lrs,pba->q_size_lrs*sizeof(double));
+          }
+        }
+      }
 
-    pba->q_lrs_bg=realloc(pba->q_lrs_bg,pba->q_size_lrs_bg*sizeof(double));
-    pba->w_lrs_bg=realloc(pba->w_lrs_bg,pba->q_size_lrs_bg*sizeof(double));
+      /* Handle background q_sampling: */
+#pragma omp section
+      {
+        class_alloc_parallel(pba->q_lrs_bg,_QUADRATURE_MAX_BG_*sizeof(double),pba->error_message);
+        class_alloc_parallel(pba->w_lrs_bg,_QUADRATURE_MAX_BG_*sizeof(double),pba->error_message);
 
-    /** - in verbose mode, inform user of number of sampled momenta
-	for background quantities */
+        class_call_parallel(get_qsampling_cached(pba->q_lrs_bg,
+                                                 pba->w_lrs_bg,
+                                                 &(pba->q_size_lrs_bg),
+                                                 _QUADRATURE_MAX_BG_,
+                                                 ppr->tol_lrs_bg,
+                                                 pbadist.q,
+                                                 pbadist.tablesize,
+                                                 background_lrs_test_function,
+                                                 background_lrs_distribution,
+                                                 &pbadist,
+                                                 pba->quadrature_cache_directory,
+                                                 pba->error_message),
+                            pba->error_message,
+                            pba->error_message);
+        if (abort == _FALSE_) {
+          pba->q_lrs_bg=realloc(pba->q_lrs_bg,pba->q_size_lrs_bg*sizeof(double));
+          pba->w_lrs_bg=realloc(pba->w_lrs_bg,pba->q_size_lrs_bg*sizeof(double));
+        }
+      }
+
+    } /* end of parallel sections */
+
+    if (abort == _TRUE_) return _FAILURE_;
+
+    /** - in verbose mode, inform user of number of sampled momenta */
+    if ((pba->background_verbose > 0) && (pba->lrs_quadrature_strategy==qm_auto))
+      printf("lrs species sampled with %d points for purpose of perturbation integration\n",
+	     pba->q_size_lrs);
     if (pba->background_verbose > 0)
       printf("lrs species sampled with %d points for purpose of background integration\n",
 	     pba->q_size_lrs_bg);
@@ -212,6 +247,20 @@ int background_lrs_init(
 	     pba->q_size_lrs);
   }
 
+  /* Scalar field table and instability onset */
+  class_call(background_lrs_parameters_init(ppr, pba),
+             pba->error_message,
+             pba->error_message);
+
+  /* Compressed perturbation sampling, which depends on the range of
+     mT/T, hence on the scalar field and on the instability onset */
+  pba->lrs_compressed_error = 0.;
+  if (pba->lrs_quadrature_strategy==qm_compressed){
+    class_call(background_lrs_compressed_qsampling(ppr, pba, &pbadist),
+               pba->error_message,
+               pba->error_message);
+  }
+
   class_alloc(pba->dlnf0_dlnq_lrs,
 	      pba->q_size_lrs*sizeof(double),
 	      pba->error_message);
@@ -224,10 +273,648 @@ int background_lrs_init(
     pba->dlnf0_dlnq_lrs[index_q] = dlnf0_dlnq;
   }
 
+  return _SUCCESS_;
+}
+
+/**
+ * Copy the result of background_lrs_init() (momentum samplings,
+ * scalar field table and instability onset) from another background
+ * structure, if the lrs parameters of both structures are the
+ * same. This is used by the shooting in input_try_unknown_parameters(),
+ * whose unknown parameters (h, A_s, ...) never enter these
+ * quantities, and whose precision parameters stay the same at each
+ * iteration. The arrays are copied, so that the two structures can be
+ * freed independently.
+ *
+ * @param pba          Input/Output: background structure
+ * @param pba_previous Input: background structure of a previous iteration
+ * @param reused       Output: _TRUE_ if the result has been copied, _FALSE_ if the parameters differ
+ * @return the error status
+ */
+
+int background_lrs_reuse(
+                         struct background *pba,
+                         struct background *pba_previous,
+                         int * reused
+                         ) {
+
+  *reused = _FALSE_;
+
+  if ((pba_previous->has_lrs == _FALSE_) ||
+      (pba_previous->has_lrs_nuggets != pba->has_lrs_nuggets) ||
+      (pba_previous->lrs_m_F != pba->lrs_m_F) ||
+      (pba_previous->lrs_g_over_M != pba->lrs_g_over_M) ||
+      (pba_previous->lrs_M_phi != pba->lrs_M_phi) ||
+      (pba_previous->lrs_g_F != pba->lrs_g_F) ||
+      (pba_previous->lrs_T_F != pba->lrs_T_F) ||
+      (pba_previous->T_cmb != pba->T_cmb) ||
+      (pba_previous->lrs_quadrature_strategy != pba->lrs_quadrature_strategy) ||
+      (pba_previous->lrs_input_q_size != pba->lrs_input_q_size) ||
+      (pba_previous->lrs_qmax != pba->lrs_qmax))
+    return _SUCCESS_;
+
+  /* Momentum samplings */
+  pba->q_size_lrs = pba_previous->q_size_lrs;
+  pba->q_size_lrs_bg = pba_previous->q_size_lrs_bg;
+  class_alloc(pba->q_lrs,pba->q_size_lrs*sizeof(double),pba->error_message);
+  class_alloc(pba->w_lrs,pba->q_size_lrs*sizeof(double),pba->error_message);
+  class_alloc(pba->dlnf0_dlnq_lrs,pba->q_size_lrs*sizeof(double),pba->error_message);
+  class_alloc(pba->q_lrs_bg,pba->q_size_lrs_bg*sizeof(double),pba->error_message);
+  class_alloc(pba->w_lrs_bg,pba->q_size_lrs_bg*sizeof(double),pba->error_message);
+  memcpy(pba->q_lrs,pba_previous->q_lrs,pba->q_size_lrs*sizeof(double));
+  memcpy(pba->w_lrs,pba_previous->w_lrs,pba->q_size_lrs*sizeof(double));
+  memcpy(pba->dlnf0_dlnq_lrs,pba_previous->dlnf0_dlnq_lrs,pba->q_size_lrs*sizeof(double));
+  memcpy(pba->q_lrs_bg,pba_previous->q_lrs_bg,pba->q_size_lrs_bg*sizeof(double));
+  memcpy(pba->w_lrs_bg,pba_previous->w_lrs_bg,pba->q_size_lrs_bg*sizeof(double));
+  pba->factor_lrs = pba_previous->factor_lrs;
+  pba->lrs_compressed_error = pba_previous->lrs_compressed_error;
+
+  /* Scalar field solver and table */
+  pba->lrs_phi_solver = pba_previous->lrs_phi_solver;
+  pba->lrs_phi_solves = 0;
+  pba->lrs_phi_fevals = 0;
+  pba->lrs_phi_table_size = pba_previous->lrs_phi_table_size;
+  if (pba->lrs_phi_table_size > 0) {
+    pba->lrs_phi_table_lnz_max = pba_previous->lrs_phi_table_lnz_max;
+    pba->lrs_phi_table_step = pba_previous->lrs_phi_table_step;
+    class_alloc(pba->lrs_phi_table_lnphi,pba->lrs_phi_table_size*sizeof(double),pba->error_message);
+    class_alloc(pba->lrs_phi_table_dd,pba->lrs_phi_table_size*sizeof(double),pba->error_message);
+    memcpy(pba->lrs_phi_table_lnphi,pba_previous->lrs_phi_table_lnphi,pba->lrs_phi_table_size*sizeof(double));
+    memcpy(pba->lrs_phi_table_dd,pba_previous->lrs_phi_table_dd,pba->lrs_phi_table_size*sizeof(double));
+  }
+
+  /* Instability onset */
+  pba->lrs_a_unstable = pba_previous->lrs_a_unstable;
+  pba->lrs_mT_over_T0_unstable = pba_previous->lrs_mT_over_T0_unstable;
+  pba->lrs_rho_unstable = pba_previous->lrs_rho_unstable;
+  pba->lrs_MTsq_over_Msq_unstable = pba_previous->lrs_MTsq_over_Msq_unstable;
+
+  *reused = _TRUE_;
+
+  return _SUCCESS_;
+}
+
+/**
+ * Initialize the part of the lrs background which depends on the
+ * coupling and masses, but not on the momentum sampling: scalar field
+ * solver settings, scalar field table, and instability onset. This is
+ * called by background_lrs_init(), and again for each point by
+ * background_lrs_batch(), which keeps the q-sampling of the reference
+ * model.
+ *
+ * @param ppr Input: precision structure
+ * @param pba Input/Output: background structure
+ */
+
+int background_lrs_parameters_init(
+                                    struct precision *ppr,
+                                    struct background *pba
+                                    ) {
+
+  /* Settings and counters of the scalar field equation solver */
+  pba->lrs_phi_solver = ppr->lrs_phi_solver;
+  pba->lrs_phi_solves = 0;
+  pba->lrs_phi_fevals = 0;
+
   /* rho_class = 8piG/3 * rho_physical / Mpc^-2
      The 4pi (kB T0)^4 will appear in front of integrals*/
   pba->factor_lrs=4*_PI_*SQR(SQR(pba->T_cmb*pba->lrs_T_F*_k_B_)) * _J4_to_rho_class;
 
+  /* Tabulate the scalar field as a function of redshift, so that
+     get_phi_M_lrs() does not need to solve the field equation at
+     each call */
+  class_call(background_lrs_phi_table_init(ppr, pba),
+             pba->error_message,
+             pba->error_message);
+
+  /* Instability onset and quantities frozen at onset */
+  class_call(background_lrs_onset_init(pba),
+             pba->error_message,
+             pba->error_message);
+
+  return _SUCCESS_;
+}
+
+/**
+ * Compute the present fraction of the critical density in the lrs
+ * sector (scalar field plus fermions). Once nuggets have formed, the
+ * total density at the instability onset is redshifted as dust.
+ *
+ * @param pba Input/Output: background structure (sets pba->Omega0_lrs)
+ */
+
+int background_lrs_Omega0(
+                          struct background *pba
+                          ) {
+
+  double phi_M_lrs; // Present day scalar field times its mass (eV^2)
+  struct lrs_moments mom_lrs;
+
+  /* Check for stability (onset computed in background_lrs_onset_init()) */
+  if (pba->has_lrs_nuggets == _FALSE_ || 1 < pba->lrs_a_unstable){ // Stable
+    class_call(get_phi_M_lrs(pba, 0, &phi_M_lrs),
+               pba->error_message,
+               pba->error_message);
+
+    class_call(background_lrs_moments(pba->q_lrs_bg,
+                                      pba->w_lrs_bg,
+                                      pba->q_size_lrs_bg,
+                                      get_mT_over_T0_lrs(pba, phi_M_lrs),
+                                      pba->factor_lrs,
+                                      0,
+                                      lrs_mom_rho,
+                                      &mom_lrs),
+               pba->error_message,
+               pba->error_message);
+
+    pba->Omega0_lrs = (_eV4_to_rho_class * 0.5 * SQR(phi_M_lrs) + mom_lrs.rho)/SQR(pba->H0);
+  }
+  else { // Unstable: nuggets have formed
+    pba->Omega0_lrs = pba->lrs_rho_unstable / CUB(1 / pba->lrs_a_unstable)/SQR(pba->H0);
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Evaluate the background of a batch of lrs parameter sets (coupling,
+ * scalar mass, fermion mass), sharing everything that does not depend
+ * on them with a reference model that went through input_init() and
+ * background_init(): precision parameters, other species, and the
+ * momentum sampling of the lrs background.
+ *
+ * Each point is computed on a shallow copy of the reference
+ * background structure, with its own scalar field table, instability
+ * onset and background tables. The points are distributed over the
+ * OpenMP threads, each with its own workspace. The change in
+ * Omega0_lrs is compensated by Omega0_lambda, so that the reference
+ * must close its budget with a cosmological constant. No shooting is
+ * performed: parameters such as h are those of the reference. The
+ * thermodynamics depends on H(z) and is not computed here.
+ *
+ * @param ppr         Input: precision structure
+ * @param pba         Input: reference background structure
+ * @param point_size  Input: number of parameter sets
+ * @param g_over_M    Input: array of couplings over scalar mass (eV^-1), of size point_size
+ * @param M_phi       Input: array of scalar masses (eV), of size point_size
+ * @param m_F         Input: array of fermion masses (eV), of size point_size
+ * @param z_size      Input: number of redshifts
+ * @param z           Input: array of redshifts, of size z_size
+ * @param Omega0_lrs  Output: array of Omega0_lrs, of size point_size (must be already allocated)
+ * @param a_unstable  Output: array of scale factors at instability onset, of size point_size (must be already allocated)
+ * @param background  Output: background quantities at each point and redshift, with index
+ *                    [(index_point*z_size+index_z)*pba->bg_size+index_bg] (must be already allocated)
+ * @return the error status
+ */
+
+int background_lrs_batch(
+                         struct precision *ppr,
+                         struct background *pba,
+                         int point_size,
+                         double * g_over_M,
+                         double * M_phi,
+                         double * m_F,
+                         int z_size,
+                         double * z,
+                         double * Omega0_lrs,
+                         double * a_unstable,
+                         double * background
+                         ) {
+
+  int index_point;
+  int abort;
+  struct background * pba_point;
+
+  class_test(pba->has_lrs == _FALSE_,
+             pba->error_message,
+             "the reference model has no lrs species");
+
+  class_test((pba->Omega0_lambda == 0.) || (pba->has_fld == _TRUE_) || (pba->has_scf == _TRUE_),
+             pba->error_message,
+             "the budget of each point is closed with Omega0_lambda, which requires a reference model with a cosmological constant and without fluid or scalar field dark energy");
+
+  abort = _FALSE_;
+
+#pragma omp parallel                                                    \
+  shared(ppr,pba,point_size,g_over_M,M_phi,m_F,z_size,z,Omega0_lrs,a_unstable,background,abort) \
+  private(index_point,pba_point)
+
+  {
+    /* one workspace per thread */
+    class_alloc_parallel(pba_point,sizeof(struct background),pba->error_message);
+
+#pragma omp for schedule(dynamic,1)
+    for (index_point=0; index_point<point_size; index_point++) {
+
+      if (abort == _TRUE_)
+        continue;
+
+      *pba_point = *pba;
+      pba_point->background_verbose = 0;
+      pba_point->lrs_g_over_M = g_over_M[index_point];
+      pba_point->lrs_M_phi = M_phi[index_point];
+      pba_point->lrs_m_F = m_F[index_point];
+      pba_point->lrs_m_F_over_T0 = pba_point->lrs_m_F * _eV_ / (_k_B_*pba_point->lrs_T_F*pba_point->T_cmb);
+      pba_point->lrs_M_phi_sq = SQR(pba_point->lrs_M_phi * _Mpc_times_eV);
+
+      if (background_lrs_batch_point(ppr,
+                                     pba,
+                                     pba_point,
+                                     z_size,
+                                     z,
+                                     background+index_point*z_size*pba->bg_size) == _FAILURE_) {
+#pragma omp critical
+        {
+          if (abort == _FALSE_) {
+            class_build_error_string(pba->error_message,
+                                     "error at lrs batch point %d (g_over_M=%e, M_phi=%e, m_F=%e)\n=>%s",
+                                     index_point,g_over_M[index_point],M_phi[index_point],m_F[index_point],
+                                     pba_point->error_message);
+            abort = _TRUE_;
+          }
+        }
+        continue;
+      }
+
+      Omega0_lrs[index_point] = pba_point->Omega0_lrs;
+      a_unstable[index_point] = pba_point->lrs_a_unstable;
+    }
+
+    if (pba_point != NULL)
+      free(pba_point);
+
+  } /* end of parallel region */
+
+  if (abort == _TRUE_) return _FAILURE_;
+
+  return _SUCCESS_;
+}
+
+/**
+ * Compute one point of background_lrs_batch(), on a copy of the
+ * reference background structure with updated lrs parameters, and
+ * free the tables of this copy.
+ *
+ * @param ppr        Input: precision structure
+ * @param pba        Input: reference background structure
+ * @param pba_point  Input/Output: copy of the reference with the lrs parameters of this point
+ * @param z_size     Input: number of redshifts
+ * @param z          Input: array of redshifts
+ * @param background Output: background quantities at each redshift, of size z_size*pba->bg_size
+ * @return the error status
+ */
+
+int background_lrs_batch_point(
+                               struct precision *ppr,
+                               struct background *pba,
+                               struct background *pba_point,
+                               int z_size,
+                               double * z,
+                               double * background
+                               ) {
+
+  int index_z, last_index;
+  double tau;
+
+  /* the q-sampling is shared with the reference, only the scalar
+     field table and the onset are recomputed */
+  class_call(background_lrs_parameters_init(ppr, pba_point),
+             pba_point->error_message,
+             pba_point->error_message);
+
+  class_call(background_lrs_Omega0(pba_point),
+             pba_point->error_message,
+             pba_point->error_message);
+
+  pba_point->Omega0_lambda = pba->Omega0_lambda + pba->Omega0_lrs - pba_point->Omega0_lrs;
+
+  class_call(background_init(ppr, pba_point),
+             pba_point->error_message,
+             pba_point->error_message);
+
+  for (index_z=0; index_z<z_size; index_z++) {
+
+    class_call(background_tau_of_z(pba_point, z[index_z], &tau),
+               pba_point->error_message,
+               pba_point->error_message);
+
+    class_call(background_at_tau(pba_point,
+                                 tau,
+                                 pba_point->long_info,
+                                 pba_point->inter_normal,
+                                 &last_index,
+                                 background+index_z*pba_point->bg_size),
+               pba_point->error_message,
+               pba_point->error_message);
+  }
+
+  class_call(background_free_noinput(pba_point),
+             pba_point->error_message,
+             pba_point->error_message);
+
+  if (pba_point->lrs_phi_table_size > 0) {
+    free(pba_point->lrs_phi_table_lnphi);
+    free(pba_point->lrs_phi_table_dd);
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Builds the compressed q-sampling of the perturbations
+ * (lrs_quadrature_strategy == qm_compressed).
+ *
+ * Instead of a generic rule, a few momenta and weights are fitted to
+ * the integrals which the run actually needs: the energy density, the
+ * pressure and I_Mphi, and the same integrals weighted by
+ * dlnf0/dlnq (their perturbations for adiabatic initial conditions),
+ * on a grid of _LRS_COMPRESSED_CHECKS_ redshifts
+ * covering the values of mT/T met by the perturbations (from the
+ * ultra-relativistic regime down to today, or to the instability
+ * onset if nuggets form then). They are selected by
+ * get_qsampling_empirical() among the _LRS_COMPRESSED_CANDIDATES_
+ * nodes of a fine reference rule, until all these integrals agree
+ * with the reference within ppr->tol_lrs_compressed (with at least
+ * ppr->lrs_compressed_q_size_min momenta). The largest relative error
+ * is stored in pba->lrs_compressed_error.
+ *
+ * @param ppr     Input: precision structure
+ * @param pba     Input/Output: background structure
+ * @param pbadist Input: parameters of the distribution function
+ * @return the error status
+ */
+
+int background_lrs_compressed_qsampling(
+                                        struct precision *ppr,
+                                        struct background *pba,
+                                        struct background_parameters_for_distributions * pbadist
+                                        ) {
+
+  int index_q, index_z, n_cand, row;
+  double lnz_min, lnz_max, z, phi_M, mT, q2, eps;
+  double * q_cand;
+  double * w_cand;
+  double * dlnf0_dlnq;
+  double * g;
+  double * q;
+  double * w;
+
+  n_cand = _LRS_COMPRESSED_CANDIDATES_;
+
+  /** - fine reference rule */
+  class_alloc(q_cand,n_cand*sizeof(double),pba->error_message);
+  class_alloc(w_cand,n_cand*sizeof(double),pba->error_message);
+  class_call(get_qsampling_manual(q_cand,
+                                  w_cand,
+                                  n_cand,
+                                  pba->lrs_qmax,
+                                  qm_trapz_indefinite,
+                                  pbadist->q,
+                                  pbadist->tablesize,
+                                  background_lrs_distribution,
+                                  pbadist,
+                                  pba->error_message),
+             pba->error_message,
+             pba->error_message);
+
+  class_alloc(dlnf0_dlnq,n_cand*sizeof(double),pba->error_message);
+  for (index_q=0; index_q<n_cand; index_q++) {
+    class_call(background_lrs_derivative(pbadist,q_cand[index_q],&(dlnf0_dlnq[index_q])),
+               pba->error_message,pba->error_message);
+  }
+
+  /** - integrands of rho, p and I_Mphi (up to constant factors), and
+        of their adiabatic perturbations, at the values of mT/T
+        covered by the run */
+  lnz_min = 0.;
+  if (pba->has_lrs_nuggets == _TRUE_ && pba->lrs_a_unstable < 1.)
+    lnz_min = -log(pba->lrs_a_unstable);
+  lnz_max = MAX(lnz_min, log(pba->lrs_m_F_over_T0/1.e-5));
+
+  class_alloc(g,_LRS_COMPRESSED_ROWS_*_LRS_COMPRESSED_CHECKS_*n_cand*sizeof(double),pba->error_message);
+
+  for (index_z=0; index_z<_LRS_COMPRESSED_CHECKS_; index_z++) {
+    z = exp(lnz_min+(lnz_max-lnz_min)*index_z/(_LRS_COMPRESSED_CHECKS_-1.))-1.;
+    class_call(get_phi_M_lrs(pba, z, &phi_M),
+               pba->error_message,
+               pba->error_message);
+    mT = get_mT_over_T0_lrs(pba, phi_M)/(1.+z);
+
+    row = _LRS_COMPRESSED_ROWS_*index_z;
+    for (index_q=0; index_q<n_cand; index_q++) {
+      q2 = q_cand[index_q]*q_cand[index_q];
+      eps = sqrt(q2+mT*mT);
+      g[row*n_cand+index_q] = q2*eps;
+      g[(row+1)*n_cand+index_q] = q2*q2/eps;
+      g[(row+2)*n_cand+index_q] = q2/eps;
+      g[(row+3)*n_cand+index_q] = q2*eps*dlnf0_dlnq[index_q];
+      g[(row+4)*n_cand+index_q] = q2*q2/eps*dlnf0_dlnq[index_q];
+      g[(row+5)*n_cand+index_q] = q2/eps*dlnf0_dlnq[index_q];
+    }
+  }
+
+  /** - fitted rule */
+  class_alloc(q,_LRS_COMPRESSED_MAX_*sizeof(double),pba->error_message);
+  class_alloc(w,_LRS_COMPRESSED_MAX_*sizeof(double),pba->error_message);
+
+  class_call(get_qsampling_empirical(q_cand,
+                                     w_cand,
+                                     n_cand,
+                                     g,
+                                     _LRS_COMPRESSED_ROWS_*_LRS_COMPRESSED_CHECKS_,
+                                     ppr->tol_lrs_compressed,
+                                     ppr->lrs_compressed_q_size_min,
+                                     _LRS_COMPRESSED_MAX_,
+                                     q,
+                                     w,
+                                     &(pba->q_size_lrs),
+                                     &(pba->lrs_compressed_error),
+                                     pba->error_message),
+             pba->error_message,
+             pba->error_message);
+
+  class_alloc(pba->q_lrs,pba->q_size_lrs*sizeof(double),pba->error_message);
+  class_alloc(pba->w_lrs,pba->q_size_lrs*sizeof(double),pba->error_message);
+  for (index_q=0; index_q<pba->q_size_lrs; index_q++) {
+    pba->q_lrs[index_q] = q[index_q];
+    pba->w_lrs[index_q] = w[index_q];
+  }
+
+  free(q_cand);
+  free(w_cand);
+  free(dlnf0_dlnq);
+  free(g);
+  free(q);
+  free(w);
+
+  return _SUCCESS_;
+}
+
+/**
+ * Builds the table of the scalar field phi_M as a function of
+ * ln(1+z), between today and the redshift above which the analytic
+ * ultra-relativistic solution is used by get_phi_M_lrs().
+ *
+ * The table is sampled uniformly in ln(1+z) and stores ln(-phi_M),
+ * which is very smooth (it is a power law in both asymptotic
+ * regimes). Its size is doubled until the spline interpolation
+ * reproduces the exact solution at all mid-points, both for phi_M
+ * and for the effective fermion mass, within the relative tolerance
+ * ppr->tol_lrs_phi_table. Since the mid-points become the new nodes,
+ * no exact solution is wasted during refinement. If the tolerance
+ * cannot be reached with _LRS_PHI_TABLE_MAX_ nodes (or if phi_M
+ * vanishes somewhere), the table is not used and get_phi_M_lrs()
+ * falls back to the exact solution.
+ *
+ * @param ppr Input: precision structure
+ * @param pba Input/Output: background structure
+ */
+
+int background_lrs_phi_table_init(
+                                  struct precision *ppr,
+                                  struct background *pba
+                                  ) {
+
+  int n_interval, index, index_max, converged, usable;
+  double lnz_max, step, z, phi_exact, phi_interp, mT_exact, mT_interp, error, error_max;
+  double * lnz;
+  double * lnphi;
+  double * lnphi_new;
+  double * dd;
+  double * phi_mid;
+
+  pba->lrs_phi_table_size = 0;
+
+  if (ppr->tol_lrs_phi_table <= 0.)
+    return _SUCCESS_;
+
+  /** - find the redshift above which get_phi_M_lrs() uses the
+        analytic ultra-relativistic solution (see the conditions
+        there): m_F/T < max(1e-5, [1e-5 g_F/24 (g m_F/M)^2]^(1/3)) */
+  lnz_max = log(pba->lrs_m_F_over_T0/
+                MAX(1e-5, cbrt(1e-5*pba->lrs_g_F/24.*SQR(pba->lrs_g_over_M*pba->lrs_m_F))));
+
+  if (lnz_max <= 0.)
+    return _SUCCESS_;
+
+  /* a single workspace for the five temporary arrays, freed by free(lnz) on all returns */
+  class_alloc(lnz,5*_LRS_PHI_TABLE_MAX_*sizeof(double),pba->error_message);
+  lnphi = lnz+_LRS_PHI_TABLE_MAX_;
+  lnphi_new = lnphi+_LRS_PHI_TABLE_MAX_;
+  dd = lnphi_new+_LRS_PHI_TABLE_MAX_;
+  phi_mid = dd+_LRS_PHI_TABLE_MAX_;
+
+  /** - exact solution on the initial coarse grid, each node starting
+        from the solution at the previous one */
+  n_interval = _LRS_PHI_TABLE_MIN_-1;
+  usable = _TRUE_;
+  phi_exact = 0.;
+  for (index=0; index<=n_interval; index++) {
+    z = exp(lnz_max*index/n_interval)-1.;
+    class_call_except(background_lrs_solve_phi_M(pba, z, _LRS_PHI_TABLE_TOL_, phi_exact, &phi_exact),
+                      pba->error_message,
+                      pba->error_message,
+                      free(lnz));
+    if (phi_exact >= 0.) {
+      usable = _FALSE_;
+      break;
+    }
+    lnphi[index] = log(-phi_exact);
+  }
+
+  /** - refine until the interpolation error at mid-points is small enough */
+  converged = _FALSE_;
+  while ((usable == _TRUE_) && (converged == _FALSE_)) {
+
+    step = lnz_max/n_interval;
+    index_max = n_interval+1;
+    for (index=0; index<index_max; index++)
+      lnz[index] = index*step;
+
+    class_call_except(array_spline_table_lines(lnz,
+                                               index_max,
+                                               lnphi,
+                                               1,
+                                               dd,
+                                               _SPLINE_EST_DERIV_,
+                                               pba->error_message),
+                      pba->error_message,
+                      pba->error_message,
+                      free(lnz));
+
+    error_max = 0.;
+    for (index=0; index<n_interval; index++) {
+      z = exp((index+0.5)*step)-1.;
+
+      /* spline at the mid-point: a = b = 1/2 */
+      phi_interp = -exp(0.5*(lnphi[index]+lnphi[index+1])
+                        -(dd[index]+dd[index+1])*step*step/16.);
+
+      /* exact solution, starting from the interpolated one */
+      class_call_except(background_lrs_solve_phi_M(pba, z, _LRS_PHI_TABLE_TOL_, phi_interp, &phi_exact),
+                        pba->error_message,
+                        pba->error_message,
+                        free(lnz));
+      if (phi_exact >= 0.) {
+        usable = _FALSE_;
+        break;
+      }
+      phi_mid[index] = phi_exact;
+
+      mT_exact = get_mT_over_T0_lrs(pba, phi_exact);
+      mT_interp = get_mT_over_T0_lrs(pba, phi_interp);
+      error = MAX(fabs(phi_interp/phi_exact-1.), fabs(mT_interp/mT_exact-1.));
+      error_max = MAX(error_max, error);
+    }
+
+    if (usable == _FALSE_)
+      break;
+
+    if (error_max < ppr->tol_lrs_phi_table) {
+      converged = _TRUE_;
+    }
+    else if (2*n_interval+1 > _LRS_PHI_TABLE_MAX_) {
+      usable = _FALSE_;
+    }
+    else {
+      /* interleave old nodes and mid-points */
+      for (index=0; index<n_interval; index++) {
+        lnphi_new[2*index] = lnphi[index];
+        lnphi_new[2*index+1] = log(-phi_mid[index]);
+      }
+      lnphi_new[2*n_interval] = lnphi[n_interval];
+      n_interval *= 2;
+      for (index=0; index<=n_interval; index++)
+        lnphi[index] = lnphi_new[index];
+    }
+  }
+
+  if (usable == _TRUE_) {
+    pba->lrs_phi_table_size = n_interval+1;
+    pba->lrs_phi_table_lnz_max = lnz_max;
+    pba->lrs_phi_table_step = lnz_max/n_interval;
+    pba->lrs_phi_table_lnphi = malloc(pba->lrs_phi_table_size*sizeof(double));
+    pba->lrs_phi_table_dd = malloc(pba->lrs_phi_table_size*sizeof(double));
+    class_test_except((pba->lrs_phi_table_lnphi == NULL) || (pba->lrs_phi_table_dd == NULL),
+                      pba->error_message,
+                      free(lnz);free(pba->lrs_phi_table_lnphi);free(pba->lrs_phi_table_dd);pba->lrs_phi_table_size=0,
+                      "could not allocate the lrs scalar field table with %d nodes",pba->lrs_phi_table_size);
+    for (index=0; index<pba->lrs_phi_table_size; index++) {
+      pba->lrs_phi_table_lnphi[index] = lnphi[index];
+      pba->lrs_phi_table_dd[index] = dd[index];
+    }
+    if (pba->background_verbose > 1)
+      printf(" -> lrs scalar field tabulated with %d points up to z=%e (max. relative error %e)\n",
+             pba->lrs_phi_table_size,exp(lnz_max)-1.,error_max);
+  }
+  else {
+    if (pba->background_verbose > 1)
+      printf(" -> lrs scalar field could not be tabulated within tol_lrs_phi_table=%e, solving the field equation at each call instead\n",
+             ppr->tol_lrs_phi_table);
+  }
+
+  free(lnz);
+
   return _SUCCESS_;
 }
 
@@ -235,8 +922,11 @@ int background_lrs_init(
 /**
  * For a given long-range interacting species: given the quadrature weights, the mass
  * and the redshift, find background *fermion* quantities by a quick weighted
- * sum over.  Input parameters passed as NULL pointers are not
- * evaluated for speed-up
+ * sum over momenta. All requested moments are accumulated in a single
+ * pass, sharing 1/epsilon and 1/epsilon^3 between them. The loop body
+ * has no branches, so that it can be vectorized; the mask only selects
+ * whether the moments involving 1/epsilon^3 (pseudo_p, I1, I2) need to be
+ * accumulated at all. Moments that were not requested are set to zero.
  *
  * @param qvec             Input: sampled momenta
  * @param wvec             Input: quadrature weights
@@ -244,76 +934,77 @@ int background_lrs_init(
  * @param m_over_T0        Input: *effective* fermion mass divided by its *present day* temperature
  * @param factor           Input: normalization factor for the p.s.d.
  * @param z                Input: redshift
- * @param rho              Output: energy density
- * @param p                Output: pressure
- * @param I_MPhi           Output: \integ d^3q m/T 1/eps f(q)
-                           where eps^2 = q^2 + (m/T)^2 and q=p/T
- * @param pseudo_p         Output: pseudo-pressure used in perturbation module for fluid approx
- * @param I1               Output: \integ d^3q m/T (2 eps^2 + (m/T)^2)/eps^3 f(q)
- *                         where eps^2 = q^2 + (m/T)^2 and q=p/T
- * @param I2               Output: \integ d^3q q^2/eps^3 f(q)
+ * @param moment_mask      Input: bitwise OR of lrs_moment_flags selecting the moments to compute
+ * @param pmom             Output: structure containing the requested moments:
+ *                         rho:      energy density
+ *                         p:        pressure
+ *                         I_Mphi:   \integ d^3q m/T 1/eps f(q)
+ *                         pseudo_p: pseudo-pressure used in perturbation module for fluid approx
+ *                         I1:       \integ d^3q m/T (2 eps^2 + (m/T)^2)/eps^3 f(q)
+ *                         I2:       \integ d^3q q^2/eps^3 f(q)
  *                         where eps^2 = q^2 + (m/T)^2 and q=p/T
  */
 
-int background_lrs_momenta(
-                            /* Only calculate for non-NULL pointers: */
-                            double * qvec,
-                            double * wvec,
-                            int qsize,
-                            double m_over_T0,
-                            double factor,
-                            double z,
-                            double * rho, // density
-                            double * p,   // pressure
-                            double * I_Mphi,  
-                            double * pseudo_p,  // pseudo-p used in ncdm fluid approx
-			    double * I1,
-			    double * I2
-                            ) {
+int background_lrs_moments(
+                           double * qvec,
+                           double * wvec,
+                           int qsize,
+                           double m_over_T0,
+                           double factor,
+                           double z,
+                           int moment_mask,
+                           struct lrs_moments * pmom
+                           ) {
 
   int index_q;
-  double epsilon;
-  double q2;
-  double factor2;
-  /** Summary: */
-
-  /** - rescale normalization at given redshift */
-  factor2 = factor*SQR(SQR(1+z));
-
-  /** - initialize quantities */
-  if (rho!=NULL) *rho = 0.;
-  if (p!=NULL) *p = 0.;
-  if (I_Mphi!=NULL) *I_Mphi = 0.;
-  if (pseudo_p!=NULL) *pseudo_p = 0.;
-  if (I1!=NULL) *I1 = 0.;
-  if (I2!=NULL) *I2 = 0.;
-
-  /** - loop over momenta */
-  for (index_q=0; index_q<qsize; index_q++) {
+  double q2, w_q2, eps2, inv_eps, inv_eps3;
+  double factor2, mT, mT2;
+  double rho=0., p=0., I_Mphi=0., pseudo_p=0., I1=0., I2=0.;
+  LRS_COUNTER_START;
 
-    /* squared momentum */
-    q2 = qvec[index_q]*qvec[index_q];
+  /** - rescale normalization and mass at given redshift */
+  factor2 = factor*SQR(SQR(1.+z));
+  mT = m_over_T0/(1.+z);
+  mT2 = mT*mT;
 
-    /* energy */
-    epsilon = sqrt(q2+m_over_T0*m_over_T0/(1.+z)/(1.+z));
-
-    /* integrand of the various quantities */
-    if (rho!=NULL) *rho += q2 * epsilon*wvec[index_q];
-    if (p!=NULL) *p += q2 * q2/3./epsilon*wvec[index_q];
-    if (I_Mphi!=NULL) *I_Mphi += q2 * m_over_T0/(1.+z)/epsilon*wvec[index_q];
-    if (pseudo_p!=NULL) *pseudo_p += q2 * SQR(q2)/CUB(epsilon)/3.0*wvec[index_q];
-    if (I1!=NULL) *I1 += q2 * m_over_T0/(1.+z) * (2*SQR(epsilon) + SQR(m_over_T0/(1.+z))) / CUB(epsilon) * wvec[index_q];
-    if (I2!=NULL) *I2 += q2 * q2/CUB(epsilon) * wvec[index_q];
+  /** - loop over momenta */
+  if ((moment_mask & (lrs_mom_pseudo_p | lrs_mom_I1 | lrs_mom_I2)) == 0) {
+    /* only moments with 1/epsilon */
+    for (index_q=0; index_q<qsize; index_q++) {
+      q2 = qvec[index_q]*qvec[index_q];
+      w_q2 = q2*wvec[index_q];
+      eps2 = q2+mT2;
+      inv_eps = 1./sqrt(eps2);
+      rho += w_q2*eps2*inv_eps;
+      p += w_q2*q2*inv_eps;
+      I_Mphi += w_q2*inv_eps;
+    }
+  }
+  else {
+    for (index_q=0; index_q<qsize; index_q++) {
+      q2 = qvec[index_q]*qvec[index_q];
+      w_q2 = q2*wvec[index_q];
+      eps2 = q2+mT2;
+      inv_eps = 1./sqrt(eps2);
+      inv_eps3 = inv_eps*inv_eps*inv_eps;
+      rho += w_q2*eps2*inv_eps;
+      p += w_q2*q2*inv_eps;
+      I_Mphi += w_q2*inv_eps;
+      pseudo_p += w_q2*q2*q2*inv_eps3;
+      I1 += w_q2*(2.*eps2+mT2)*inv_eps3;
+      I2 += w_q2*q2*inv_eps3;
+    }
   }
 
-  /** - adjust normalization */
-  if (rho!=NULL) *rho *= factor2;
-  if (p!=NULL) *p *= factor2;
-  if (I_Mphi!=NULL) *I_Mphi *= 4*_PI_;
-  if (pseudo_p!=NULL) *pseudo_p *=factor2;
-  if (I1!=NULL) *I1 *= 4*_PI_;
-  if (I2!=NULL) *I2 *= 4*_PI_;
+  /** - adjust normalization and store requested moments */
+  pmom->rho = (moment_mask & lrs_mom_rho) ? rho*factor2 : 0.;
+  pmom->p = (moment_mask & lrs_mom_p) ? p*factor2/3. : 0.;
+  pmom->I_Mphi = (moment_mask & lrs_mom_I_Mphi) ? I_Mphi*mT*4*_PI_ : 0.;
+  pmom->pseudo_p = (moment_mask & lrs_mom_pseudo_p) ? pseudo_p*factor2/3. : 0.;
+  pmom->I1 = (moment_mask & lrs_mom_I1) ? I1*mT*4*_PI_ : 0.;
+  pmom->I2 = (moment_mask & lrs_mom_I2) ? I2*4*_PI_ : 0.;
 
+  LRS_COUNTER_STOP(lrs_counter_moments);
   return _SUCCESS_;
 }
 
@@ -338,38 +1029,81 @@ inline double get_mT_over_T0_lrs(struct background * pba, double phi_M){
 int potentialPrime(double phi_M, void *param, double *y, ErrorMsg error_message){
   struct background * pba;
   struct background_parameters_and_redshift * pbaz;
+  LRS_COUNTER_START;
   pbaz = param;
   pba = pbaz->pba;
 
   // We first compute \integ d^3p m/E f(p), in eV^3
   double I_Mphi;
-  class_call(background_lrs_momenta(pba->q_lrs_bg,
+  struct lrs_moments mom;
+  class_call(background_lrs_moments(pba->q_lrs_bg,
 				    pba->w_lrs_bg,
 				    pba->q_size_lrs_bg,
 				    get_mT_over_T0_lrs(pba, phi_M),
 				    pba->factor_lrs,
 				    pbaz->z,
-				    NULL,
-				    NULL,
-				    &I_Mphi,
-				    NULL,
-				    NULL,
-				    NULL),
+				    lrs_mom_I_Mphi,
+				    &mom),
              error_message,
              error_message);
+  I_Mphi = mom.I_Mphi;
   I_Mphi *= CUB(pba->T_cmb*pba->lrs_T_F*_k_B_ * (1+pbaz->z)); // Multiply by T^3 (in J)
   I_Mphi /= CUB(_eV_); // Convert to eV^3
   
   *y = phi_M +  pba->lrs_g_over_M * I_Mphi;
 
+  LRS_COUNTER_STOP(lrs_counter_potential);
+  return _SUCCESS_;
+}
+
+/**
+ * Same as potentialPrime(), but also returns the derivative of the
+ * residual with respect to phi_M. Since d I_Mphi / d(m/T) = I2, this
+ * derivative is 1 + (g/M)^2 T^2 I2 = 1 + M_T^2/M^2, which is always
+ * larger than one. Both moments are obtained from a single pass over
+ * momenta.
+ *
+ * @param phi_M  Input:  Scalar field times its mass (eV^2)
+ * @param param  Input:  Pointer to background_parameters_and_redshift struct
+ * @param y      Output: If zero, the scalar field satisfies the e.o.m
+ * @param dy     Output: derivative of y with respect to phi_M
+ */
+int potentialPrime_and_derivative(double phi_M, void *param, double *y, double *dy, ErrorMsg error_message){
+  struct background * pba;
+  struct background_parameters_and_redshift * pbaz;
+  struct lrs_moments mom;
+  double T;
+  LRS_COUNTER_START;
+  pbaz = param;
+  pba = pbaz->pba;
+
+  class_call(background_lrs_moments(pba->q_lrs_bg,
+				    pba->w_lrs_bg,
+				    pba->q_size_lrs_bg,
+				    get_mT_over_T0_lrs(pba, phi_M),
+				    pba->factor_lrs,
+				    pbaz->z,
+				    lrs_mom_I_Mphi | lrs_mom_I2,
+				    &mom),
+             error_message,
+             error_message);
+
+  T = pba->T_cmb*pba->lrs_T_F*_k_B_ * (1+pbaz->z) / _eV_; // Temperature (eV)
+
+  *y = phi_M + pba->lrs_g_over_M * mom.I_Mphi * CUB(T);
+  *dy = 1. + SQR(pba->lrs_g_over_M * T) * mom.I2;
+
+  LRS_COUNTER_STOP(lrs_counter_potential_derivative);
   return _SUCCESS_;
 }
 
 /**
  * Returns the scalar field times its mass solving the equations of motion.
  * Hubble friction is neglected (i.e., the scalar mass is assumed to be much
- * heavier than the Hubble scale), and the resulting trascendental equation
- * is solved with the Ridder method
+ * heavier than the Hubble scale). In the ultrarelativistic regime the
+ * analytic solution is used; otherwise the value is interpolated from the
+ * table built by background_lrs_phi_table_init() or, outside of the
+ * table, obtained from background_lrs_solve_phi_M()
  *
  * @param pba    Input: pointer to background structure
  * @param z      Input: redshift
@@ -378,32 +1112,140 @@ int potentialPrime(double phi_M, void *param, double *y, ErrorMsg error_message)
 int get_phi_M_lrs(struct background * pba, double z, double * phi_M){
   double m_F_over_T = pba->lrs_m_F_over_T0 / (1.+z);
   double T = pba->lrs_m_F / m_F_over_T; // Temperature (eV)
+  double lnz, x, a, b;
+  int index;
+  LRS_COUNTER_START;
+
   if(m_F_over_T < 1e-5 ||
      m_F_over_T/(pba->lrs_g_F/24. * SQR(pba->lrs_g_over_M*T)) < 1e-5){
     // Analytic result in the ultrarelativistic regime
     *phi_M = - pba->lrs_g_F/24. * pba->lrs_g_over_M * m_F_over_T * CUB(T) /
       (1 + pba->lrs_g_F/24. * SQR(pba->lrs_g_over_M) * SQR(T));
+    LRS_COUNTER_STOP(lrs_counter_phi_M);
     return _SUCCESS_;
   }
-  
+
+  lnz = log(1.+z);
+  if (pba->lrs_phi_table_size > 0 && lnz >= 0. && lnz <= pba->lrs_phi_table_lnz_max) {
+    // Spline interpolation on the uniform ln(1+z) grid: the interval is found by direct indexing
+    x = lnz/pba->lrs_phi_table_step;
+    index = MIN((int)x, pba->lrs_phi_table_size-2);
+    b = x - index;
+    a = 1. - b;
+    *phi_M = -exp(a * pba->lrs_phi_table_lnphi[index] + b * pba->lrs_phi_table_lnphi[index+1]
+                  + ((a*a*a-a) * pba->lrs_phi_table_dd[index] + (b*b*b-b) * pba->lrs_phi_table_dd[index+1])
+                  * pba->lrs_phi_table_step * pba->lrs_phi_table_step / 6.);
+
+    if(pba->lrs_m_F + pba->lrs_g_over_M * (*phi_M) < 0) // mTilde < 0 because of interpolation uncertainties
+      *phi_M = -pba->lrs_m_F/pba->lrs_g_over_M * (1-1e-7);
+
+    LRS_COUNTER_STOP(lrs_counter_phi_M);
+    return _SUCCESS_;
+  }
+
+  class_call(background_lrs_solve_phi_M(pba, z, 1e-5, 0., phi_M),
+             pba->error_message,pba->error_message);
+
+  LRS_COUNTER_STOP(lrs_counter_phi_M);
+  return _SUCCESS_;
+}
+
+/**
+ * Solves the transcendental equation of motion of the scalar field.
+ *
+ * With pba->lrs_phi_solver == lrs_phi_newton, Newton iterations with
+ * the analytic derivative of the residual are used, starting from the
+ * guess passed by the caller (e.g. the solution at a neighbouring
+ * redshift) or, if it is not inside the bracket, from the
+ * ultrarelativistic solution. The bracket [-m_F M/g, 0] is kept
+ * up-to-date from the sign of the (monotonic) residual, and a
+ * bisection step is taken whenever a Newton step would leave it. If
+ * Newton does not converge, or with pba->lrs_phi_solver ==
+ * lrs_phi_ridder, the Ridder method on the full bracket is used.
+ *
+ * The number of solutions and of residual evaluations are accumulated
+ * in pba->lrs_phi_solves and pba->lrs_phi_fevals.
+ *
+ * @param pba         Input: pointer to background structure
+ * @param z           Input: redshift
+ * @param tol         Input: tolerance on phi_M, relative to the size of the bracket [-m_F M/g, 0]
+ * @param phi_M_guess Input: starting guess of Newton iterations (ignored if not inside the bracket)
+ * @param phi_M       Output: scalar field times mass (eV^2)
+ */
+int background_lrs_solve_phi_M(struct background * pba, double z, double tol, double phi_M_guess, double * phi_M){
   double x2 = 0, x1=-pba->lrs_m_F/pba->lrs_g_over_M; // We know that -m0 <= g*phi <= 0. This ensures that the effective fermion mass will always be positive
   struct background_parameters_and_redshift bpaz;
   bpaz.pba = pba;
   bpaz.z = z;
 
+  double xtol = tol*MAX(fabs(x1),fabs(x2));
+  double x_low = x1, x_high = x2, x, dx, y, dy, T, m_F_over_T;
+  int iter, converged = _FALSE_;
+
   *phi_M = 0.;
   int fevals = 0;
-  class_call(class_fzero_ridder(potentialPrime,
-                                x1,
-                                x2,
-                                1e-5*MAX(fabs(x1),fabs(x2)),
-                                &bpaz,
-                                NULL,
-                                NULL,
-                                phi_M,
-                                &fevals,
-                                pba->error_message),
-             pba->error_message,pba->error_message);
+
+  if (pba->lrs_phi_solver == lrs_phi_newton) {
+
+    if (phi_M_guess < 0. && phi_M_guess > x1) {
+      x = phi_M_guess;
+    }
+    else {
+      // Ultrarelativistic solution, kept inside the bracket
+      m_F_over_T = pba->lrs_m_F_over_T0 / (1.+z);
+      T = pba->lrs_m_F / m_F_over_T; // Temperature (eV)
+      x = - pba->lrs_g_F/24. * pba->lrs_g_over_M * m_F_over_T * CUB(T) /
+        (1 + pba->lrs_g_F/24. * SQR(pba->lrs_g_over_M) * SQR(T));
+      if (x <= x1 || x >= x2)
+        x = 0.5*(x1+x2);
+    }
+
+    for (iter=0; iter < _LRS_NEWTON_MAX_IT_; iter++) {
+
+      class_call(potentialPrime_and_derivative(x, &bpaz, &y, &dy, pba->error_message),
+                 pba->error_message,pba->error_message);
+      fevals++;
+
+      // The residual is monotonically increasing: update the bracket
+      if (y < 0.)
+        x_low = x;
+      else
+        x_high = x;
+
+      dx = -y/dy;
+      if (x+dx <= x_low || x+dx >= x_high)
+        dx = 0.5*(x_low+x_high)-x; // bisection
+
+      x += dx;
+
+      if (fabs(dx) < xtol || x_high-x_low < xtol) {
+        converged = _TRUE_;
+        break;
+      }
+    }
+
+    if (converged == _TRUE_)
+      *phi_M = x;
+  }
+
+  if (converged == _FALSE_) {
+    int fevals_ridder = 0;
+    class_call(class_fzero_ridder(potentialPrime,
+                                  x1,
+                                  x2,
+                                  xtol,
+                                  &bpaz,
+                                  NULL,
+                                  NULL,
+                                  phi_M,
+                                  &fevals_ridder,
+                                  pba->error_message),
+               pba->error_message,pba->error_message);
+    fevals += fevals_ridder;
+  }
+
+  pba->lrs_phi_solves++;
+  pba->lrs_phi_fevals += fevals;
 
   if(pba->lrs_m_F + pba->lrs_g_over_M * (*phi_M) < 0) // mTilde < 0 because of round-off uncertainties
     *phi_M = -pba->lrs_m_F/pba->lrs_g_over_M * (1-1e-7);
@@ -420,136 +1262,327 @@ int get_phi_M_lrs(struct background * pba, double z, double * phi_M){
 }
 
 /**
- * Returns the scale factor at adiabatic instability onset.
- * Makes use of previously tabulated results
+ * Computes, once and for all, the scale factor at the onset of the
+ * adiabatic instability and, when nuggets are considered, the
+ * quantities frozen at that time which are needed by
+ * background_functions() and by the input module: effective fermion
+ * mass, total energy density and scalar thermal mass. These only
+ * depend on fixed parameters and on the background quadrature.
+ *
+ * @param pba Input/Output: background structure
+ */
+
+int background_lrs_onset_init(
+                              struct background *pba
+                              ) {
+
+  double z_unstable, phi_M, T;
+  struct lrs_moments mom;
+
+  class_call(instabilityOnset_lrs(pba, &(pba->lrs_a_unstable)),
+             pba->error_message,
+             pba->error_message);
+
+  pba->lrs_mT_over_T0_unstable = 0.;
+  pba->lrs_rho_unstable = 0.;
+  pba->lrs_MTsq_over_Msq_unstable = 0.;
+
+  if (pba->has_lrs_nuggets == _FALSE_ || pba->lrs_a_unstable >= _LRS_ALWAYS_STABLE_)
+    return _SUCCESS_;
+
+  z_unstable = 1./pba->lrs_a_unstable-1.;
+
+  class_call(get_phi_M_lrs(pba, z_unstable, &phi_M),
+             pba->error_message,
+             pba->error_message);
+  pba->lrs_mT_over_T0_unstable = get_mT_over_T0_lrs(pba, phi_M);
+
+  class_call(background_lrs_moments(pba->q_lrs_bg,
+                                    pba->w_lrs_bg,
+                                    pba->q_size_lrs_bg,
+                                    pba->lrs_mT_over_T0_unstable,
+                                    pba->factor_lrs,
+                                    z_unstable,
+                                    lrs_mom_rho | lrs_mom_I2,
+                                    &mom),
+             pba->error_message,
+             pba->error_message);
+
+  pba->lrs_rho_unstable = _eV4_to_rho_class * 0.5 * SQR(phi_M) + mom.rho;
+
+  // Fermion temperature (eV) and scalar thermal mass squared over its vacuum mass squared
+  T = pba->T_cmb*pba->lrs_T_F/pba->lrs_a_unstable*_k_B_/_eV_;
+  pba->lrs_MTsq_over_Msq_unstable = SQR(pba->lrs_g_over_M) * SQR(T) * mom.I2;
+
+  return _SUCCESS_;
+}
+
+/**
+ * Stability criterion of the fermion-scalar system, at a given
+ * mT/T along the background trajectory for a given g*m0/M.
+ *
+ * On scales larger than the scalar interaction range, the scalar
+ * field perturbation follows the local fermion density, and the
+ * scalar-mediated attraction acts as a negative pressure. Marginal
+ * stability is reached when the static response of the fermion gas
+ * to the scalar field compensates the scalar thermal mass, i.e. when
+ *
+ *   (g/M)^2 T^2 [I3 - I2] = 1,
+ *
+ * with I2 the integral returned by background_lrs_moments() and
+ * I3 = \integ d^3q (m/T)^4/(q^2 eps^3) f(q). The returned criterion
+ * is (g/M)^2 T^2 [I3 - I2] - 1, which is positive in the unstable
+ * regime. In the limit of large couplings, onset happens at the
+ * universal value mT/T ~ 1.216, where I3 = I2.
+ *
+ * @param pba          Input: pointer to background structure
+ * @param mT_over_T    Input: effective fermion mass over its temperature
+ * @param g_m0_over_M  Input: coupling times vacuum fermion mass over scalar mass
+ * @param T_over_m0    Output: fermion temperature over its vacuum mass at this mT/T
+ * @param criterion    Output: stability criterion (positive if unstable)
+ * @return the error status
+ */
+
+int background_lrs_onset_criterion(
+                                   struct background * pba,
+                                   double mT_over_T,
+                                   double g_m0_over_M,
+                                   double * T_over_m0,
+                                   double * criterion
+                                   ) {
+
+  int index_q;
+  double x2, x4, eps2, inv_eps, I3=0.;
+  struct lrs_moments mom;
+
+  class_call(background_lrs_moments(pba->q_lrs_bg,
+                                    pba->w_lrs_bg,
+                                    pba->q_size_lrs_bg,
+                                    mT_over_T,
+                                    pba->factor_lrs,
+                                    0,
+                                    lrs_mom_I_Mphi | lrs_mom_I2,
+                                    &mom),
+             pba->error_message,
+             pba->error_message);
+
+  x2 = SQR(mT_over_T);
+  x4 = SQR(x2);
+  for (index_q=0; index_q<pba->q_size_lrs_bg; index_q++) {
+    eps2 = SQR(pba->q_lrs_bg[index_q])+x2;
+    inv_eps = 1./sqrt(eps2);
+    I3 += pba->w_lrs_bg[index_q]*x4*CUB(inv_eps);
+  }
+  I3 *= 4*_PI_;
+
+  class_call(background_lrs_T_over_m0(mT_over_T, SQR(g_m0_over_M) * mom.I_Mphi, T_over_m0),
+             pba->error_message,
+             pba->error_message);
+
+  *criterion = SQR(g_m0_over_M * (*T_over_m0)) * (I3 - mom.I2) - 1.;
+
+  return _SUCCESS_;
+}
+
+/**
+ * Fermion temperature over its vacuum mass for a given mT/T along the
+ * background trajectory.
+ *
+ * The relationship between m0 and mT is given by the following system of equations
+ *  | M phi = -g/M T^3 I_Mphi
+ *  | mT = m0 + g phi
+ *  M/g (mT-m0) = -g/M T^3 I_Mphi
+ *  m0/T = mT/T + g^2/M^2 T^2 I_Mphi
+ *  m0/T = mT/T + g^2 m0^2/M^2 (T/m0)^2 I_Mphi
+ * Let x = T/m0
+ *  1 = mT/T x + g^2 m0^2/M^2 I_Mphi x^3
+ * Let A = mT/T, B = g^2 m0^2/M^2 I_Mphi
+ *  x^3 + A/B x - 1/B = 0
+ * We have to solve this cubic equation, which has a single real root.
+ *
+ * @param mT_over_T  Input: effective fermion mass over its temperature, A
+ * @param B          Input: (g m0/M)^2 I_Mphi
+ * @param T_over_m0  Output: fermion temperature over its vacuum mass
+ * @return the error status
+ */
+
+int background_lrs_T_over_m0(
+                             double mT_over_T,
+                             double B,
+                             double * T_over_m0
+                             ) {
+
+  double A = mT_over_T;
+
+  *T_over_m0 = cbrt(1/B) * (cbrt(0.5 + sqrt(0.25 + CUB(A/3)/B)) +
+                            cbrt(-CUB(A/3)/B / (0.5 + sqrt(0.25 + CUB(A/3)/B)))); // The second term is cbrt(0.5 - sqrt(0.25 + CUB(A/3)/B))
+
+  return _SUCCESS_;
+}
+
+/**
+ * Returns the scale factor at adiabatic instability onset. This is
+ * called once by background_lrs_onset_init(); other modules should
+ * read pba->lrs_a_unstable instead.
+ *
+ * The criterion of background_lrs_onset_criterion() is negative in
+ * the relativistic regime. It is scanned on a logarithmic grid in
+ * mT/T, and its first sign change is refined by bisection. If there
+ * is none, the system is always stable. Since the criterion only uses
+ * the background quadrature, any number lrs_g_F of fermionic degrees
+ * of freedom is supported.
  *
  * @param pba    Input: pointer to background structure
  * @param a_rel  Output: a/a_0
  */
 int instabilityOnset_lrs(struct background * pba, double * a_rel){
-  double mT_over_T;
-  
-  /* Interpolate to obtain mT/T at instability onset (mT is the effective fermion mass) */
-  
-  double min_g = 5, max_g = pow(10, 1.2),
-    max_log10g = 7; // Limits of the interpolation arrays
-  double min_log10g = log10(max_g);
-  double mT_over_T_lin[100], mT_over_T_log[100];
-  switch(pba->lrs_g_F){
-  case 1: {
-    double lin[100] = {-1.000000e+01, -1.000000e+01, -1.000000e+01, -1.000000e+01, -1.000000e+01, -1.000000e+01, -1.000000e+01, -1.000000e+01, -1.000000e+01, -1.000000e+01, -1.000000e+01, -1.000000e+01, -8.896817e+00, -5.362826e+00, -4.402384e+00, -3.884355e+00, -3.543687e+00, -3.296267e+00, -3.105417e+00, -2.952105e+00, -2.825294e+00, -2.718055e+00, -2.625783e+00, -2.545275e+00, -2.474219e+00, -2.410900e+00, -2.354011e+00, -2.302539e+00, -2.255681e+00, -2.212793e+00, -2.173351e+00, -2.136923e+00, -2.103150e+00, -2.071729e+00, -2.042405e+00, -2.014960e+00, -1.989205e+00, -1.964978e+00, -1.942138e+00, -1.920560e+00, -1.900136e+00, -1.880769e+00, -1.862375e+00, -1.844876e+00, -1.828205e+00, -1.812300e+00, -1.797108e+00, -1.782577e+00, -1.768664e+00, -1.755327e+00, -1.742529e+00, -1.730236e+00, -1.718417e+00, -1.707044e+00, -1.696090e+00, -1.685532e+00, -1.675346e+00, -1.665514e+00, -1.656014e+00, -1.646831e+00, -1.637948e+00, -1.629349e+00, -1.621020e+00, -1.612948e+00, -1.605121e+00, -1.597527e+00, -1.590156e+00, -1.582997e+00, -1.576040e+00, -1.569277e+00, -1.562700e+00, -1.556300e+00, -1.550071e+00, -1.544004e+00, -1.538094e+00, -1.532334e+00, -1.526718e+00, -1.521240e+00, -1.515896e+00, -1.510681e+00, 3.483726e+00, 3.295453e+00, 3.171182e+00, 3.075478e+00, 2.996803e+00, 2.929683e+00, 2.871017e+00, 2.818854e+00, 2.771873e+00, 2.729132e+00, 2.689934e+00, 2.653748e+00, 2.620154e+00, 2.588819e+00, 2.559471e+00, 2.531886e+00, 2.505876e+00, 2.481281e+00, 2.457967e+00, 2.435817e+00};
-    double log[100] = {2.435817e+00, 2.130462e+00, 1.947601e+00, 1.821151e+00, 1.727097e+00, 1.653929e+00, 1.595240e+00, 1.547104e+00, 1.506950e+00, 1.473007e+00, 1.444006e+00, 1.419010e+00, 1.397308e+00, 1.378350e+00, 1.361703e+00, 1.347019e+00, 1.334017e+00, 1.322464e+00, 1.312170e+00, 1.302972e+00, 1.294736e+00, 1.287346e+00, 1.280703e+00, 1.274721e+00, 1.269328e+00, 1.264459e+00, 1.260058e+00, 1.256076e+00, 1.252470e+00, 1.249201e+00, 1.246236e+00, 1.243544e+00, 1.241099e+00, 1.238878e+00, 1.236857e+00, 1.235020e+00, 1.233347e+00, 1.231824e+00, 1.230438e+00, 1.229174e+00, 1.228023e+00, 1.226974e+00, 1.226017e+00, 1.225144e+00, 1.224348e+00, 1.223622e+00, 1.222960e+00, 1.222355e+00, 1.221804e+00, 1.221300e+00, 1.220840e+00, 1.220420e+00, 1.220037e+00, 1.219687e+00, 1.219367e+00, 1.219075e+00, 1.218809e+00, 1.218565e+00, 1.218343e+00, 1.218140e+00, 1.217954e+00, 1.217784e+00, 1.217629e+00, 1.217488e+00, 1.217358e+00, 1.217240e+00, 1.217132e+00, 1.217033e+00, 1.216943e+00, 1.216861e+00, 1.216786e+00, 1.216717e+00, 1.216654e+00, 1.216596e+00, 1.216544e+00, 1.216496e+00, 1.216452e+00, 1.216412e+00, 1.216375e+00, 1.216347e+00, 1.216311e+00, 1.216283e+00, 1.216258e+00, 1.216234e+00, 1.216213e+00, 1.216193e+00, 1.216176e+00, 1.216159e+00, 1.216144e+00, 1.216131e+00, 1.216118e+00, 1.216107e+00, 1.216097e+00, 1.216087e+00, 1.216078e+00, 1.216070e+00, 1.216063e+00, 1.216057e+00, 1.216051e+00, 1.216045e+00};
-    memcpy(mT_over_T_lin, lin, sizeof(mT_over_T_lin));
-    memcpy(mT_over_T_log, log, sizeof(mT_over_T_log));
-    break; }
-  case 2: {
-    double lin[100] = {-2.966221e+00, -2.789834e+00, -2.649638e+00, -2.534669e+00, -2.438149e+00, -2.355622e+00, -1.000000e+01, -2.221136e+00, -2.165357e+00, -2.115454e+00, -2.070478e+00, -2.029683e+00, -1.992471e+00, -1.958358e+00, -1.926947e+00, -1.897909e+00, -1.870967e+00, -1.845888e+00, -1.822474e+00, -1.800554e+00, -1.779980e+00, -1.760626e+00, -1.742380e+00, -1.725144e+00, -1.708832e+00, -1.693366e+00, -1.678681e+00, -1.664713e+00, -1.651411e+00, -1.638724e+00, -1.626608e+00, -1.615025e+00, -1.603937e+00, -1.593312e+00, -1.583121e+00, -1.573335e+00, -1.563930e+00, -1.554884e+00, -1.546174e+00, -1.537782e+00, -1.529689e+00, -1.521880e+00, -1.514339e+00, 3.569901e+00, 3.277686e+00, 3.117022e+00, 3.000212e+00, 2.907280e+00, 2.829775e+00, 2.763202e+00, 2.704843e+00, 2.652911e+00, 2.606160e+00, 2.563685e+00, 2.524802e+00, 2.488984e+00, 2.455812e+00, 2.424949e+00, 2.396120e+00, 2.369095e+00, 2.343681e+00, 2.319717e+00, 2.297061e+00, 2.275594e+00, 2.255211e+00, 2.235820e+00, 2.217340e+00, 2.199700e+00, 2.182837e+00, 2.166694e+00, 2.151220e+00, 2.136370e+00, 2.122101e+00, 2.108377e+00, 2.095164e+00, 2.082429e+00, 2.070146e+00, 2.058288e+00, 2.046830e+00, 2.035752e+00, 2.025032e+00, 2.014652e+00, 2.004594e+00, 1.994842e+00, 1.985381e+00, 1.976197e+00, 1.967277e+00, 1.958609e+00, 1.950181e+00, 1.941983e+00, 1.934004e+00, 1.926236e+00, 1.918668e+00, 1.911294e+00, 1.904104e+00, 1.897092e+00, 1.890251e+00, 1.883574e+00, 1.877054e+00, 1.870686e+00};
-    double log[100] = {1.870686e+00, 1.764551e+00, 1.683380e+00, 1.619043e+00, 1.566738e+00, 1.523400e+00, 1.486961e+00, 1.455962e+00, 1.429339e+00, 1.406293e+00, 1.386212e+00, 1.368617e+00, 1.353125e+00, 1.339429e+00, 1.327277e+00, 1.316462e+00, 1.306810e+00, 1.298175e+00, 1.290433e+00, 1.283479e+00, 1.277222e+00, 1.271584e+00, 1.266497e+00, 1.261900e+00, 1.257743e+00, 1.253980e+00, 1.250570e+00, 1.247478e+00, 1.244672e+00, 1.242124e+00, 1.239809e+00, 1.237704e+00, 1.235790e+00, 1.234049e+00, 1.232463e+00, 1.231019e+00, 1.229704e+00, 1.228506e+00, 1.227414e+00, 1.226418e+00, 1.225510e+00, 1.224682e+00, 1.223927e+00, 1.223238e+00, 1.222609e+00, 1.222035e+00, 1.221511e+00, 1.221033e+00, 1.220597e+00, 1.220198e+00, 1.219834e+00, 1.219502e+00, 1.219198e+00, 1.218921e+00, 1.218668e+00, 1.218436e+00, 1.218225e+00, 1.218032e+00, 1.217856e+00, 1.217694e+00, 1.217547e+00, 1.217413e+00, 1.217290e+00, 1.217178e+00, 1.217075e+00, 1.216981e+00, 1.216895e+00, 1.216817e+00, 1.216746e+00, 1.216680e+00, 1.216621e+00, 1.216566e+00, 1.216516e+00, 1.216470e+00, 1.216429e+00, 1.216391e+00, 1.216361e+00, 1.216324e+00, 1.216295e+00, 1.216268e+00, 1.216244e+00, 1.216222e+00, 1.216202e+00, 1.216183e+00, 1.216166e+00, 1.216151e+00, 1.216137e+00, 1.216124e+00, 1.216112e+00, 1.216101e+00, 1.216091e+00, 1.216082e+00, 1.216074e+00, 1.216066e+00, 1.216059e+00, 1.216053e+00, 1.216047e+00, 1.216042e+00, 1.216037e+00, 1.216033e+00};
-    memcpy(mT_over_T_lin, lin, sizeof(mT_over_T_lin));
-    memcpy(mT_over_T_log, log, sizeof(mT_over_T_log));
-    break; }
-  case 3: {
-    double lin[100] = {-2.059731e+00, -2.011440e+00, -1.968163e+00, -1.929108e+00, -1.893648e+00, -1.861278e+00, -1.831586e+00, -1.804234e+00, -1.778939e+00, -1.755465e+00, -1.733611e+00, -1.713205e+00, -1.694101e+00, -1.676171e+00, -1.659305e+00, -1.643406e+00, -1.628388e+00, -1.614176e+00, -1.600705e+00, -1.587915e+00, -1.575752e+00, -1.564170e+00, -1.000000e+01, -1.542582e+00, -1.532503e+00, -1.522857e+00, -1.513616e+00, 3.444007e+00, 3.182213e+00, 3.024310e+00, 2.907559e+00, 2.814206e+00, 2.736271e+00, 2.669376e+00, 2.610824e+00, 2.558824e+00, 2.512116e+00, 2.469778e+00, 2.431113e+00, 2.395579e+00, 2.362748e+00, 2.332273e+00, 2.303870e+00, 2.277304e+00, 2.252377e+00, 2.228919e+00, 2.206789e+00, 2.185862e+00, 2.166030e+00, 2.147198e+00, 2.129285e+00, 2.112217e+00, 2.095929e+00, 2.080362e+00, 2.065465e+00, 2.051192e+00, 2.037499e+00, 2.024349e+00, 2.011707e+00, 1.999541e+00, 1.987823e+00, 1.976525e+00, 1.965624e+00, 1.955098e+00, 1.944925e+00, 1.935087e+00, 1.925566e+00, 1.916345e+00, 1.907411e+00, 1.898747e+00, 1.890342e+00, 1.882184e+00, 1.874260e+00, 1.866559e+00, 1.859073e+00, 1.851791e+00, 1.844705e+00, 1.837805e+00, 1.831086e+00, 1.824538e+00, 1.818155e+00, 1.811931e+00, 1.805859e+00, 1.799933e+00, 1.794148e+00, 1.788499e+00, 1.782980e+00, 1.777587e+00, 1.772315e+00, 1.767160e+00, 1.762118e+00, 1.757185e+00, 1.752357e+00, 1.747630e+00, 1.743002e+00, 1.738469e+00, 1.734029e+00, 1.729677e+00, 1.725411e+00, 1.721229e+00};
-    double log[100] = {1.721229e+00, 1.649278e+00, 1.591459e+00, 1.543972e+00, 1.504317e+00, 1.470767e+00, 1.442083e+00, 1.417345e+00, 1.395857e+00, 1.377079e+00, 1.360584e+00, 1.346030e+00, 1.333139e+00, 1.321683e+00, 1.311473e+00, 1.302349e+00, 1.294177e+00, 1.286844e+00, 1.280251e+00, 1.274314e+00, 1.268961e+00, 1.264127e+00, 1.259758e+00, 1.255805e+00, 1.252224e+00, 1.248978e+00, 1.246033e+00, 1.243360e+00, 1.240932e+00, 1.238726e+00, 1.236719e+00, 1.234894e+00, 1.233233e+00, 1.231720e+00, 1.230343e+00, 1.229088e+00, 1.227944e+00, 1.226902e+00, 1.225951e+00, 1.225085e+00, 1.224294e+00, 1.223573e+00, 1.222915e+00, 1.222314e+00, 1.221766e+00, 1.221265e+00, 1.220809e+00, 1.220392e+00, 1.220011e+00, 1.219663e+00, 1.219346e+00, 1.219055e+00, 1.218791e+00, 1.218549e+00, 1.218328e+00, 1.218126e+00, 1.217941e+00, 1.217773e+00, 1.217619e+00, 1.217478e+00, 1.217350e+00, 1.217232e+00, 1.217125e+00, 1.217027e+00, 1.216937e+00, 1.216855e+00, 1.216780e+00, 1.216712e+00, 1.216650e+00, 1.216592e+00, 1.216540e+00, 1.216493e+00, 1.216449e+00, 1.216409e+00, 1.216373e+00, 1.216339e+00, 1.216309e+00, 1.216281e+00, 1.216256e+00, 1.216233e+00, 1.216211e+00, 1.216192e+00, 1.216174e+00, 1.216158e+00, 1.216143e+00, 1.216130e+00, 1.216117e+00, 1.216106e+00, 1.216096e+00, 1.216086e+00, 1.216078e+00, 1.216070e+00, 1.216063e+00, 1.216056e+00, 1.216050e+00, 1.216045e+00, 1.216040e+00, 1.216035e+00, 1.216031e+00, 1.216027e+00};
-    memcpy(mT_over_T_lin, lin, sizeof(mT_over_T_lin));
-    memcpy(mT_over_T_log, log, sizeof(mT_over_T_log));
-    break; }
-  case 4: {
-    double lin[100] = {-1.802701e+00, -1.773790e+00, -1.747247e+00, -1.722777e+00, -1.700133e+00, -1.679107e+00, -1.659523e+00, -1.641231e+00, -1.624099e+00, -1.608016e+00, -1.592883e+00, -1.578614e+00, -1.565135e+00, -1.552377e+00, -1.540283e+00, -1.528798e+00, -1.517876e+00, 3.601566e+00, 3.213250e+00, 3.024606e+00, 2.892075e+00, 2.788875e+00, 2.704192e+00, 2.632417e+00, 2.570212e+00, 2.515414e+00, 2.466531e+00, 2.422485e+00, 2.382472e+00, 2.345873e+00, 2.312203e+00, 2.281072e+00, 2.252162e+00, 2.225212e+00, 2.200003e+00, 2.176351e+00, 2.154098e+00, 2.133109e+00, 2.113267e+00, 2.094471e+00, 2.076630e+00, 2.059667e+00, 2.043511e+00, 2.028101e+00, 2.013382e+00, 1.999303e+00, 1.985819e+00, 1.972892e+00, 1.960483e+00, 1.948560e+00, 1.937092e+00, 1.926051e+00, 1.915413e+00, 1.905154e+00, 1.895252e+00, 1.885687e+00, 1.876442e+00, 1.867499e+00, 1.858844e+00, 1.850460e+00, 1.842335e+00, 1.834456e+00, 1.826811e+00, 1.819390e+00, 1.812181e+00, 1.805176e+00, 1.798365e+00, 1.791740e+00, 1.785293e+00, 1.779016e+00, 1.772902e+00, 1.766945e+00, 1.761138e+00, 1.755475e+00, 1.749951e+00, 1.744560e+00, 1.739298e+00, 1.734159e+00, 1.729139e+00, 1.724233e+00, 1.719438e+00, 1.714749e+00, 1.710164e+00, 1.705677e+00, 1.701287e+00, 1.696989e+00, 1.692781e+00, 1.688660e+00, 1.684622e+00, 1.680666e+00, 1.676789e+00, 1.672987e+00, 1.669260e+00, 1.665604e+00, 1.662018e+00, 1.658499e+00, 1.655046e+00, 1.651656e+00, 1.648328e+00, 1.645060e+00};
-    double log[100] = {1.645060e+00, 1.588025e+00, 1.541123e+00, 1.501920e+00, 1.468727e+00, 1.440329e+00, 1.415827e+00, 1.394534e+00, 1.375920e+00, 1.359563e+00, 1.345127e+00, 1.332338e+00, 1.320970e+00, 1.310836e+00, 1.301779e+00, 1.293666e+00, 1.286385e+00, 1.279838e+00, 1.273942e+00, 1.268625e+00, 1.263824e+00, 1.259484e+00, 1.255556e+00, 1.251999e+00, 1.248774e+00, 1.245848e+00, 1.243192e+00, 1.240779e+00, 1.238587e+00, 1.236593e+00, 1.234779e+00, 1.233128e+00, 1.231625e+00, 1.230256e+00, 1.229009e+00, 1.227872e+00, 1.226836e+00, 1.225891e+00, 1.225030e+00, 1.224244e+00, 1.223527e+00, 1.222873e+00, 1.222276e+00, 1.221731e+00, 1.221234e+00, 1.220780e+00, 1.220365e+00, 1.219987e+00, 1.219641e+00, 1.219325e+00, 1.219037e+00, 1.218774e+00, 1.218533e+00, 1.218314e+00, 1.218113e+00, 1.217930e+00, 1.217762e+00, 1.217609e+00, 1.217469e+00, 1.217341e+00, 1.217225e+00, 1.217118e+00, 1.217021e+00, 1.216931e+00, 1.216850e+00, 1.216776e+00, 1.216708e+00, 1.216646e+00, 1.216589e+00, 1.216537e+00, 1.216490e+00, 1.216446e+00, 1.216407e+00, 1.216370e+00, 1.216337e+00, 1.216307e+00, 1.216280e+00, 1.216254e+00, 1.216231e+00, 1.216210e+00, 1.216191e+00, 1.216173e+00, 1.216157e+00, 1.216142e+00, 1.216129e+00, 1.216117e+00, 1.216105e+00, 1.216095e+00, 1.216086e+00, 1.216077e+00, 1.216069e+00, 1.216062e+00, 1.216056e+00, 1.216050e+00, 1.216044e+00, 1.216039e+00, 1.216035e+00, 1.216031e+00, 1.216027e+00, 1.216023e+00};
-    memcpy(mT_over_T_lin, lin, sizeof(mT_over_T_lin));
-    memcpy(mT_over_T_log, log, sizeof(mT_over_T_log));
-    break; }
-  case 5: {
-    double lin[100] = {-1.671396e+00, -1.650160e+00, -1.630453e+00, -1.612109e+00, -1.594983e+00, -1.578952e+00, -1.563910e+00, -1.549763e+00, -1.536430e+00, -1.523840e+00, -1.511930e+00, 3.296280e+00, 3.056096e+00, 2.901402e+00, 2.785367e+00, 2.692249e+00, 2.614526e+00, 2.547939e+00, 2.489815e+00, 2.438355e+00, 2.392283e+00, 2.350662e+00, 2.312778e+00, 2.278077e+00, 2.246120e+00, 2.216549e+00, 2.189073e+00, 2.163451e+00, 2.139479e+00, 2.116983e+00, 2.095818e+00, 2.075856e+00, 2.056987e+00, 2.039114e+00, 2.022153e+00, 2.006030e+00, 1.990678e+00, 1.976039e+00, 1.962058e+00, 1.948691e+00, 1.935892e+00, 1.923625e+00, 1.911853e+00, 1.900546e+00, 1.889674e+00, 1.879210e+00, 1.869131e+00, 1.859414e+00, 1.850038e+00, 1.840985e+00, 1.832237e+00, 1.823778e+00, 1.815592e+00, 1.807666e+00, 1.799987e+00, 1.792543e+00, 1.785322e+00, 1.778315e+00, 1.771510e+00, 1.764899e+00, 1.758473e+00, 1.752224e+00, 1.746145e+00, 1.740227e+00, 1.734465e+00, 1.728852e+00, 1.723382e+00, 1.718050e+00, 1.712849e+00, 1.707774e+00, 1.702822e+00, 1.697987e+00, 1.693265e+00, 1.688652e+00, 1.684143e+00, 1.679736e+00, 1.675426e+00, 1.671211e+00, 1.667087e+00, 1.663050e+00, 1.659099e+00, 1.655230e+00, 1.651440e+00, 1.647728e+00, 1.644089e+00, 1.640524e+00, 1.637028e+00, 1.633599e+00, 1.630237e+00, 1.626938e+00, 1.623702e+00, 1.620525e+00, 1.617407e+00, 1.614345e+00, 1.611338e+00, 1.608385e+00, 1.605484e+00, 1.602634e+00, 1.599833e+00, 1.597079e+00};
-    double log[100] = {1.597079e+00, 1.548627e+00, 1.508229e+00, 1.474095e+00, 1.444940e+00, 1.419817e+00, 1.398011e+00, 1.378966e+00, 1.362245e+00, 1.347499e+00, 1.334442e+00, 1.322843e+00, 1.312507e+00, 1.303274e+00, 1.295007e+00, 1.287589e+00, 1.280921e+00, 1.274918e+00, 1.269506e+00, 1.264620e+00, 1.260203e+00, 1.256208e+00, 1.252589e+00, 1.249309e+00, 1.246334e+00, 1.243633e+00, 1.241180e+00, 1.238951e+00, 1.236924e+00, 1.235080e+00, 1.233403e+00, 1.231875e+00, 1.230484e+00, 1.229216e+00, 1.228061e+00, 1.227008e+00, 1.226049e+00, 1.225173e+00, 1.224375e+00, 1.223646e+00, 1.222982e+00, 1.222375e+00, 1.221822e+00, 1.221317e+00, 1.220855e+00, 1.220434e+00, 1.220050e+00, 1.219699e+00, 1.219378e+00, 1.219085e+00, 1.218818e+00, 1.218573e+00, 1.218350e+00, 1.218146e+00, 1.217960e+00, 1.217790e+00, 1.217634e+00, 1.217492e+00, 1.217363e+00, 1.217244e+00, 1.217136e+00, 1.217037e+00, 1.216946e+00, 1.216864e+00, 1.216788e+00, 1.216719e+00, 1.216656e+00, 1.216598e+00, 1.216546e+00, 1.216497e+00, 1.216453e+00, 1.216413e+00, 1.216376e+00, 1.216343e+00, 1.216312e+00, 1.216284e+00, 1.216259e+00, 1.216235e+00, 1.216214e+00, 1.216194e+00, 1.216176e+00, 1.216160e+00, 1.216145e+00, 1.216131e+00, 1.216119e+00, 1.216107e+00, 1.216097e+00, 1.216087e+00, 1.216079e+00, 1.216071e+00, 1.216063e+00, 1.216057e+00, 1.216051e+00, 1.216045e+00, 1.216040e+00, 1.216035e+00, 1.216031e+00, 1.216027e+00, 1.216024e+00, 1.216021e+00};
-    memcpy(mT_over_T_lin, lin, sizeof(mT_over_T_lin));
-    memcpy(mT_over_T_log, log, sizeof(mT_over_T_log));
-    break; }
-  case 6: {
-    double lin[100] = {-1.589175e+00, -1.572062e+00, -1.556084e+00, -1.541126e+00, -1.527088e+00, -1.513885e+00, 3.320778e+00, 3.051891e+00, 2.886079e+00, 2.763858e+00, 2.666807e+00, 2.586410e+00, 2.517936e+00, 2.458452e+00, 2.406002e+00, 2.359212e+00, 2.317075e+00, 2.278830e+00, 2.243889e+00, 2.211785e+00, 2.182145e+00, 2.154660e+00, 2.129078e+00, 2.105185e+00, 2.082802e+00, 2.061775e+00, 2.041973e+00, 2.023282e+00, 2.005601e+00, 1.988844e+00, 1.972934e+00, 1.957802e+00, 1.943388e+00, 1.929639e+00, 1.916505e+00, 1.903943e+00, 1.891913e+00, 1.880380e+00, 1.869312e+00, 1.858678e+00, 1.848453e+00, 1.838611e+00, 1.829129e+00, 1.819987e+00, 1.811166e+00, 1.802649e+00, 1.794417e+00, 1.786458e+00, 1.778755e+00, 1.771298e+00, 1.764072e+00, 1.757067e+00, 1.750273e+00, 1.743679e+00, 1.737276e+00, 1.731056e+00, 1.725010e+00, 1.719131e+00, 1.713411e+00, 1.707844e+00, 1.702423e+00, 1.697143e+00, 1.691997e+00, 1.686981e+00, 1.682089e+00, 1.677316e+00, 1.672658e+00, 1.668111e+00, 1.663670e+00, 1.659332e+00, 1.655092e+00, 1.650948e+00, 1.646896e+00, 1.642932e+00, 1.639055e+00, 1.635260e+00, 1.631545e+00, 1.627908e+00, 1.624346e+00, 1.620856e+00, 1.617436e+00, 1.614085e+00, 1.610799e+00, 1.607577e+00, 1.604417e+00, 1.601318e+00, 1.598276e+00, 1.595291e+00, 1.592362e+00, 1.589485e+00, 1.586660e+00, 1.583886e+00, 1.581161e+00, 1.578483e+00, 1.575852e+00, 1.573266e+00, 1.570723e+00, 1.568224e+00, 1.565766e+00, 1.563348e+00};
-    double log[100] = {1.563348e+00, 1.520567e+00, 1.484563e+00, 1.453910e+00, 1.427569e+00, 1.404755e+00, 1.384868e+00, 1.367435e+00, 1.352082e+00, 1.338505e+00, 1.326456e+00, 1.315730e+00, 1.306156e+00, 1.297589e+00, 1.289908e+00, 1.283007e+00, 1.276797e+00, 1.271200e+00, 1.266150e+00, 1.261587e+00, 1.257460e+00, 1.253723e+00, 1.250338e+00, 1.247267e+00, 1.244480e+00, 1.241950e+00, 1.239651e+00, 1.237561e+00, 1.235659e+00, 1.233929e+00, 1.232355e+00, 1.230921e+00, 1.229614e+00, 1.228424e+00, 1.227339e+00, 1.226350e+00, 1.225448e+00, 1.224626e+00, 1.223875e+00, 1.223191e+00, 1.222566e+00, 1.221996e+00, 1.221475e+00, 1.221000e+00, 1.220567e+00, 1.220171e+00, 1.219809e+00, 1.219479e+00, 1.219177e+00, 1.218902e+00, 1.218650e+00, 1.218420e+00, 1.218210e+00, 1.218019e+00, 1.217843e+00, 1.217683e+00, 1.217537e+00, 1.217403e+00, 1.217281e+00, 1.217170e+00, 1.217068e+00, 1.216975e+00, 1.216890e+00, 1.216812e+00, 1.216741e+00, 1.216676e+00, 1.216616e+00, 1.216562e+00, 1.216513e+00, 1.216467e+00, 1.216426e+00, 1.216388e+00, 1.216358e+00, 1.216322e+00, 1.216293e+00, 1.216267e+00, 1.216242e+00, 1.216220e+00, 1.216200e+00, 1.216182e+00, 1.216165e+00, 1.216150e+00, 1.216136e+00, 1.216123e+00, 1.216111e+00, 1.216100e+00, 1.216090e+00, 1.216081e+00, 1.216073e+00, 1.216066e+00, 1.216059e+00, 1.216053e+00, 1.216047e+00, 1.216042e+00, 1.216037e+00, 1.216033e+00, 1.216029e+00, 1.216025e+00, 1.216022e+00, 1.216019e+00,};
-    memcpy(mT_over_T_lin, lin, sizeof(mT_over_T_lin));
-    memcpy(mT_over_T_log, log, sizeof(mT_over_T_log));
-    break; }
-  default:
-    class_test(_TRUE_,
-	       pba->error_message,
-	       "The instability onset temperature for g_F = %u is not encoded yet",
-	       pba->lrs_g_F);
-  }
 
+  int index_x, iter;
+  double g_m0_over_M, x_low, x_high, x_mid, T_over_m0, crit_mid;
+  LRS_COUNTER_START;
 
-  double g_m0_over_M = pba->lrs_g_over_M * pba->lrs_m_F;
-  double log10_g_m0_over_M = log10(g_m0_over_M);
-  if (g_m0_over_M < min_g){ // Always stable
-    *a_rel = 1e99;
-    return _SUCCESS_;
-  }
-  else if (g_m0_over_M < max_g){ // Interpolate linearly
-    // Points just before and after g_m0_over_M
-    int idx_low = 99 * (g_m0_over_M - min_g) / (max_g - min_g);
-    int idx_high = idx_low + 1;
-    double g_low = min_g + idx_low * (max_g - min_g)/99.;
-    double g_high = min_g + idx_high * (max_g - min_g)/99.;
-    
-    double delta = (g_m0_over_M - g_low) / (g_high - g_low);
-    mT_over_T = mT_over_T_lin[idx_low] + delta * (mT_over_T_lin[idx_high] - mT_over_T_lin[idx_low]);
-  } else if (log10_g_m0_over_M < max_log10g){ // Interpolate linearly
-    // Points just before and after log10_g_m0_over_M
-    int idx_low = 99 * (log10_g_m0_over_M - min_log10g) / (max_log10g - min_log10g);
-    int idx_high = idx_low + 1;
-    double log10g_low = min_log10g + idx_low * (max_log10g - min_log10g)/99.;
-    double log10g_high = min_log10g + idx_high * (max_log10g - min_log10g)/99.;
-    
-    double delta = (log10_g_m0_over_M - log10g_low) / (log10g_high - log10g_low);
-    mT_over_T = mT_over_T_log[idx_low] + delta * (mT_over_T_log[idx_high] - mT_over_T_log[idx_low]);
-  } else{
-    mT_over_T = mT_over_T_log[99];
+  class_test(pba->lrs_g_F < 1,
+             pba->error_message,
+             "The number of fermionic degrees of freedom should be positive, you passed g_F = %d",
+             pba->lrs_g_F);
+
+  g_m0_over_M = pba->lrs_g_over_M * pba->lrs_m_F;
+
+  /** - look for the first (i.e. earliest) mT/T where the criterion is positive */
+  x_high = _LRS_ONSET_X_MIN_;
+  class_call(background_lrs_onset_criterion(pba, x_high, g_m0_over_M, &T_over_m0, &crit_mid),
+             pba->error_message,
+             pba->error_message);
+
+  for (index_x=1; (crit_mid <= 0.) && (x_high < _LRS_ONSET_X_MAX_); index_x++) {
+    x_low = x_high;
+    x_high = _LRS_ONSET_X_MIN_ * pow(_LRS_ONSET_X_STEP_, index_x);
+    class_call(background_lrs_onset_criterion(pba, x_high, g_m0_over_M, &T_over_m0, &crit_mid),
+               pba->error_message,
+               pba->error_message);
   }
 
-  if (mT_over_T < 0){ // Always stable
-    *a_rel = 1e99;
+  if (crit_mid <= 0.) { // Always stable
+    *a_rel = _LRS_ALWAYS_STABLE_;
+    LRS_COUNTER_STOP(lrs_counter_onset);
     return _SUCCESS_;
   }
 
-  /* Convert mT_over_T to scale factor 
-     To this purpose, we have to compute m0/T given mT/T as a = (m0/T) / (m0/T0)
-     The relationship between m0 and mT is given by the following system of equations
-      | M phi = -g/M T^3 I_Mphi
-      | mT = m0 + g phi      
-      M/g (mT-m0) = -g/M T^3 I_Mphi
-      m0/T = mT/T + g^2/M^2 T^2 I_Mphi
-      m0/T = mT/T + g^2 m0^2/M^2 (T/m0)^2 I_Mphi
-     Let x = T/m0
-      1 = mT/T x + g^2 m0^2/M^2 I_Mphi x^3
-     Let A = mT/T, B = g^2 m0^2/M^2 I_Mphi
-      x^3 + A/B x - 1/B = 0
-     We have to solve this cubic equation     
-  */
+  class_test(index_x == 1,
+             pba->error_message,
+             "The lrs system is already unstable at mT/T = %e, below the range where the instability onset is searched for",
+             _LRS_ONSET_X_MIN_);
+
+  /** - refine the sign change by bisection */
+  for (iter=0; (iter < _LRS_ONSET_MAX_IT_) && (x_high-x_low > _LRS_ONSET_TOL_*x_high); iter++) {
+    x_mid = 0.5*(x_low+x_high);
+    class_call(background_lrs_onset_criterion(pba, x_mid, g_m0_over_M, &T_over_m0, &crit_mid),
+               pba->error_message,
+               pba->error_message);
+    if (crit_mid > 0.) {
+      x_high = x_mid;
+    }
+    else {
+      x_low = x_mid;
+    }
+  }
 
-  double I_Mphi;
-  class_call(background_lrs_momenta(pba->q_lrs_bg,
-				    pba->w_lrs_bg,
-				    pba->q_size_lrs_bg,
-				    mT_over_T,
-				    pba->factor_lrs,
-				    0,
-				    NULL,
-				    NULL,
-				    &I_Mphi,
-				    NULL,
-				    NULL,
-				    NULL),
+  /** - convert mT/T at onset to the scale factor, a = (m0/T) / (m0/T0) */
+  class_call(background_lrs_onset_criterion(pba, x_high, g_m0_over_M, &T_over_m0, &crit_mid),
              pba->error_message,
              pba->error_message);
-  
-  double A = mT_over_T;
-  double B = SQR(pba->lrs_g_over_M * pba->lrs_m_F) * I_Mphi;
-  double T_over_m0 = cbrt(1/B) * (cbrt(0.5 + sqrt(0.25 + CUB(A/3)/B)) +
-				cbrt(-CUB(A/3)/B / (0.5 + sqrt(0.25 + CUB(A/3)/B)))); // The second term is cbrt(0.5 - sqrt(0.25 + CUB(A/3)/B))
-  
+
   *a_rel = 1./T_over_m0 / pba->lrs_m_F_over_T0;
-  
+
+  LRS_COUNTER_STOP(lrs_counter_onset);
+  return _SUCCESS_;
+}
+
+#ifdef LRS_COUNTERS
+/** counters of the calling thread */
+struct lrs_counters lrs_thread_counters;
+#endif
+
+/**
+ * Time used by the instrumentation counters: wall-clock time with
+ * OpenMP, processor time otherwise.
+ */
+double lrs_counter_time(){
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+/**
+ * Initialize a total of instrumentation counters to zero.
+ *
+ * @param pcounters Output: counters
+ */
+int lrs_counters_init(struct lrs_counters * pcounters){
+  int index;
+
+#ifdef LRS_COUNTERS
+  pcounters->is_enabled = _TRUE_;
+#else
+  pcounters->is_enabled = _FALSE_;
+#endif
+  for (index=0; index<lrs_counter_size; index++) {
+    pcounters->calls[index] = 0;
+    pcounters->time[index] = 0.;
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Add the counters of the calling thread to a total, and reset them.
+ * In a parallel region, this must be called by each thread within a
+ * critical section.
+ *
+ * @param pcounters Input/Output: total of the counters
+ */
+int lrs_counters_collect(struct lrs_counters * pcounters){
+#ifdef LRS_COUNTERS
+  int index;
+
+  for (index=0; index<lrs_counter_size; index++) {
+    pcounters->calls[index] += lrs_thread_counters.calls[index];
+    pcounters->time[index] += lrs_thread_counters.time[index];
+    lrs_thread_counters.calls[index] = 0;
+    lrs_thread_counters.time[index] = 0.;
+  }
+#endif
+
+  return _SUCCESS_;
+}
+
+/**
+ * Print a total of instrumentation counters (nothing if the code was
+ * compiled without -DLRS_COUNTERS).
+ *
+ * @param name      Input: name of the module which collected the counters
+ * @param pcounters Input: counters
+ */
+int lrs_counters_print(char * name, struct lrs_counters * pcounters){
+  int index;
+  const char * function[lrs_counter_size] = {
+    "background_lrs_moments",
+    "get_phi_M_lrs",
+    "instabilityOnset_lrs",
+    "potentialPrime (Ridder)",
+    "potentialPrime_and_derivative (Newton)"};
+
+  if (pcounters->is_enabled == _FALSE_)
+    return _SUCCESS_;
+
+  printf(" -> lrs counters in %s:\n",name);
+  for (index=0; index<lrs_counter_size; index++)
+    printf("    %-40s %12ld calls, %e s\n",
+           function[index],
+           pcounters->calls[index],
+           pcounters->time[index]);
+
   return _SUCCESS_;
 }
@@ -13,6 +13,21 @@
 
 #include "nonlinear.h"
 
+/** process-wide list of tables of the NFW window, one per resolution (searched and extended within the critical section hmcode_nfw_table only, read-only once built) */
+static struct hmcode_nfw_table * nonlinear_nfw_table_first = NULL;
+
+/** HMcode growth table of the previous run (accessed within the critical section hmcode_growth_cache only) */
+static struct hmcode_growth_cache nonlinear_growth_cache = {_FALSE_};
+
+static short nonlinear_hmcode_growth_cache_match(struct precision * ppr,
+                                                 struct background * pba,
+                                                 struct nonlinear * pnl);
+
+static int nonlinear_hmcode_growth_cache_fill(struct precision * ppr,
+                                              struct background * pba,
+                                              struct nonlinear * pnl,
+                                              struct nonlinear_workspace * pnw);
+
 /**
  * Return the P(k,z) for a given redshift z and pk type (_m, _cb)
  * (linear if pk_output = pk_linear, nonlinear if pk_output = pk_nonlinear)
@@ -938,6 +953,215 @@ int nonlinear_pks_at_kvec_and_zvec(
   return _SUCCESS_;
 }
 
+/**
+ * Return P(k,z) for a list of values of k at each redshift of a list,
+ * for one pk type (_m, _cb), either linear or nonlinear depending on
+ * input. The result is identical to that of separate calls to
+ * nonlinear_pk_at_k_and_z() (including the extrapolation at k<kmin),
+ * but the interpolation in time is done once per redshift, the spline
+ * along k once per redshift, and the interpolation in k is vectorized
+ * over all wavenumbers of a given redshift.
+ *
+ * The wavenumbers can be passed in arbitrary order; when they are in
+ * ascending order for a given redshift, the search of the intervals
+ * of pnl->ln_k goes forward through the table instead of bisecting.
+ *
+ * If there are several initial conditions, this function is not
+ * designed to return individual contributions.
+ *
+ * @param pba         Input: pointer to background structure
+ * @param ppm         Input: pointer to primordial structure
+ * @param pnl         Input: pointer to nonlinear structure
+ * @param pk_output   Input: linear or nonlinear
+ * @param index_pk    Input: index of pk type (_m, _cb)
+ * @param kvec        Input: wavenumbers in 1/Mpc, kvec[index_zvec*kvec_size+index_kvec] (in [0:kmax])
+ * @param kvec_size   Input: number of wavenumbers for each redshift
+ * @param zvec        Input: array of redshifts in arbitrary order
+ * @param zvec_size   Input: size of array of redshifts
+ * @param out_pk      Output: P(k,z) in Mpc**3, out_pk[index_zvec*kvec_size+index_kvec] (already allocated)
+ * @return the error status
+ */
+
+int nonlinear_pk_at_kvec_and_zvec(
+                                  struct background * pba,
+                                  struct primordial * ppm,
+                                  struct nonlinear * pnl,
+                                  enum pk_outputs pk_output,
+                                  int index_pk,
+                                  double * kvec,
+                                  int kvec_size,
+                                  double * zvec,
+                                  int zvec_size,
+                                  double * out_pk
+                                  ) {
+
+  int index_zvec,index_kvec,index_k;
+  int inf,sup,mid;
+  short sorted;
+  double k,h,a,b;
+  double kmin,ln_kmax;
+  double * pk_primordial_k;
+  double * pk_primordial_kmin;
+  short has_pk_primordial_kmin = _FALSE_;
+  double * ln_pk_at_z;
+  double * ddln_pk_at_z;
+  double * ln_kvec;
+  double * pk_z;
+  int * index_kvec_k;
+
+  class_alloc(ln_pk_at_z,pnl->k_size*sizeof(double),pnl->error_message);
+  class_alloc(ddln_pk_at_z,pnl->k_size*sizeof(double),pnl->error_message);
+  class_alloc(ln_kvec,kvec_size*sizeof(double),pnl->error_message);
+  class_alloc(index_kvec_k,kvec_size*sizeof(int),pnl->error_message);
+  class_alloc(pk_primordial_k,pnl->ic_ic_size*sizeof(double),pnl->error_message);
+  class_alloc(pk_primordial_kmin,pnl->ic_ic_size*sizeof(double),pnl->error_message);
+
+  kmin = exp(pnl->ln_k[0]);
+  ln_kmax = pnl->ln_k[pnl->k_size-1];
+
+  for (index_zvec=0; index_zvec<zvec_size; index_zvec++) {
+
+    pk_z = out_pk+index_zvec*kvec_size;
+
+    /** - find the interval [ln_k[index_k],ln_k[index_k+1]] of each
+          wavenumber (index_k=-1 for k<kmin, which requires an
+          extrapolation). This step does not depend on z and is
+          skipped when the wavenumbers are the same as for the
+          previous redshift. */
+
+    if ((index_zvec == 0) ||
+        (memcmp(kvec+index_zvec*kvec_size,kvec+(index_zvec-1)*kvec_size,kvec_size*sizeof(double)) != 0)) {
+
+      sorted = _TRUE_;
+
+      for (index_kvec=0; index_kvec<kvec_size; index_kvec++) {
+
+        k = kvec[index_zvec*kvec_size+index_kvec];
+
+        class_test((k < 0.) || (k > exp(ln_kmax)),
+                   pnl->error_message,
+                   "k=%e out of bounds [%e:%e]",k,0.,exp(ln_kmax));
+
+        ln_kvec[index_kvec] = (k > kmin) ? log(k) : pnl->ln_k[0];
+
+        if ((index_kvec > 0) && (k < kvec[index_zvec*kvec_size+index_kvec-1]))
+          sorted = _FALSE_;
+      }
+
+      if (sorted == _TRUE_) {
+
+        /* walk forward through the table */
+        inf = 0;
+        for (index_kvec=0; index_kvec<kvec_size; index_kvec++) {
+          while ((inf < pnl->k_size-2) && (ln_kvec[index_kvec] >= pnl->ln_k[inf+1]))
+            inf++;
+          index_kvec_k[index_kvec] = inf;
+        }
+      }
+      else {
+
+        /* bisection, as in array_interpolate_spline() */
+        for (index_kvec=0; index_kvec<kvec_size; index_kvec++) {
+          inf = 0;
+          sup = pnl->k_size-1;
+          while (sup-inf > 1) {
+            mid = (int)(0.5*(inf+sup));
+            if (ln_kvec[index_kvec] < pnl->ln_k[mid]) {sup=mid;}
+            else {inf=mid;}
+          }
+          index_kvec_k[index_kvec] = inf;
+        }
+      }
+    }
+
+    /** - get ln(P(k)) at this redshift for the pre-computed
+          wavenumbers, and spline it along k (as in
+          nonlinear_pk_at_k_and_z()) */
+
+    class_call(nonlinear_pk_at_z(pba,
+                                 pnl,
+                                 logarithmic,
+                                 pk_output,
+                                 zvec[index_zvec],
+                                 index_pk,
+                                 ln_pk_at_z,
+                                 NULL),
+               pnl->error_message,
+               pnl->error_message);
+
+    class_call(array_spline_table_lines(pnl->ln_k,
+                                        pnl->k_size,
+                                        ln_pk_at_z,
+                                        1,
+                                        ddln_pk_at_z,
+                                        _SPLINE_NATURAL_,
+                                        pnl->error_message),
+               pnl->error_message,
+               pnl->error_message);
+
+    /** - interpolate at all wavenumbers at once */
+
+#pragma omp simd private(index_k,h,a,b)
+    for (index_kvec=0; index_kvec<kvec_size; index_kvec++) {
+
+      index_k = index_kvec_k[index_kvec];
+
+      h = pnl->ln_k[index_k+1]-pnl->ln_k[index_k];
+      b = (ln_kvec[index_kvec]-pnl->ln_k[index_k])/h;
+      a = 1.-b;
+
+      pk_z[index_kvec] = exp(a * ln_pk_at_z[index_k]
+                             + b * ln_pk_at_z[index_k+1]
+                             + ((a*a*a-a) * ddln_pk_at_z[index_k]
+                                + (b*b*b-b) * ddln_pk_at_z[index_k+1])*h*h/6.);
+    }
+
+    /** - deal with k=0 (P=0) and 0<k<kmin, extrapolated as P(k) =
+          P(kmin) * (k P_primordial(k)) / (kmin P_primordial(kmin)) */
+
+    for (index_kvec=0; index_kvec<kvec_size; index_kvec++) {
+
+      k = kvec[index_zvec*kvec_size+index_kvec];
+
+      if (k == 0.) {
+        pk_z[index_kvec] = 0.;
+      }
+      else if (k <= kmin) {
+
+        if (has_pk_primordial_kmin == _FALSE_) {
+          class_call(primordial_spectrum_at_k(ppm,
+                                              pnl->index_md_scalars,
+                                              linear,
+                                              kmin,
+                                              pk_primordial_kmin),
+                     ppm->error_message,
+                     pnl->error_message);
+          has_pk_primordial_kmin = _TRUE_;
+        }
+
+        class_call(primordial_spectrum_at_k(ppm,
+                                            pnl->index_md_scalars,
+                                            linear,
+                                            k,
+                                            pk_primordial_k),
+                   ppm->error_message,
+                   pnl->error_message);
+
+        pk_z[index_kvec] = exp(ln_pk_at_z[0])*(k*pk_primordial_k[0]/kmin/pk_primordial_kmin[0]);
+      }
+    }
+  }
+
+  free(ln_pk_at_z);
+  free(ddln_pk_at_z);
+  free(ln_kvec);
+  free(index_kvec_k);
+  free(pk_primordial_k);
+  free(pk_primordial_kmin);
+
+  return _SUCCESS_;
+}
+
 /**
  * Return the logarithmic slope of P(k,z) for a given (k,z), a given pk type (_m, _cb)
  * (computed with linear P_L if pk_output = pk_linear, nonlinear P_NL if pk_output = pk_nonlinear)
@@ -1010,6 +1234,9 @@ int nonlinear_pk_tilt_at_k_and_z(
  * sphere of radius R at redshift z, sigma(R,z), or other similar derived
  * quantitites, for one given pk type (_m, _cb).
  *
+ * For sigma(R,z) on a grid of many radii and redshifts, use instead
+ * nonlinear_sigmas_at_Rvec_and_zvec().
+ *
  * The integral is performed until the maximum value of k_max defined
  * in the perturbation module. Here there is not automatic checking
  * that k_max is large enough for the result to be well
@@ -1092,6 +1319,284 @@ int nonlinear_sigmas_at_z(
   return _SUCCESS_;
 }
 
+/**
+ * Compute sigma(R,z) and its logarithmic derivative dsigma/dlnR on a
+ * grid of radii and redshifts, for one given pk type (_m, _cb).
+ *
+ * This gives the same result as separate calls of
+ * nonlinear_sigmas_at_z(), but each P(k,z) is interpolated only once
+ * per redshift, and the work depending only on R is shared by all
+ * redshifts:
+ *
+ * - with sigma_method=sm_integration, the window functions at each
+ *   point of the integration grid of nonlinear_sigmas(), multiplied by
+ *   the weights of its spline integral (see array_spline_weights()),
+ *   are tabulated once for all radii. Each sigma(R_i,z_j) is then a
+ *   weighted sum over P(k,z_j),
+ * - with sigma_method=sm_fftlog, the FFTLog plan of
+ *   nonlinear_sigma_table_init() is prepared once, and each redshift
+ *   requires one table of sigma^2 (and of its derivative) for all
+ *   radii at once. The radii must then lie in the range inverse to the
+ *   range of k.
+ *
+ * As for nonlinear_sigmas_at_z(), the integrals stop at the maximum
+ * value of k of the nonlinear module, whose convergence is not
+ * checked.
+ *
+ * @param ppr             Input: pointer to precision structure
+ * @param pba             Input: pointer to background structure
+ * @param pnl             Input: pointer to nonlinear structure
+ * @param index_pk        Input: type of pk (_m, _cb)
+ * @param Rvec            Input: array of radii in Mpc, in arbitrary order
+ * @param Rvec_size       Input: size of array of radii
+ * @param zvec            Input: array of redshifts, in arbitrary order
+ * @param zvec_size       Input: size of array of redshifts
+ * @param sigma_vec       Output: sigma(R_i,z_j) in sigma_vec[index_zvec*Rvec_size+index_Rvec] (already allocated)
+ * @param dsigma_dlnR_vec Output: dsigma/dlnR(R_i,z_j), same indexing (already allocated, or NULL if not needed)
+ * @return the error status
+ */
+
+int nonlinear_sigmas_at_Rvec_and_zvec(
+                                      struct precision * ppr,
+                                      struct background * pba,
+                                      struct nonlinear * pnl,
+                                      int index_pk,
+                                      double * Rvec,
+                                      int Rvec_size,
+                                      double * zvec,
+                                      int zvec_size,
+                                      double * sigma_vec,
+                                      double * dsigma_dlnR_vec
+                                      ) {
+
+  int index_Rvec,index_zvec,index_k,window_num,integrand_size;
+  int last_index;
+  double k,t,x,W,W_prime,lnpk,sigma2,dsigma2;
+  double result[2];
+  double * out_pk;
+  double * ddout_pk;
+  double * lnk_grid;
+  double * pk_grid;
+  double * t_grid;
+  double * weight;
+  double * window;
+  double * window_R;
+  enum sigma_window sigma_window[2] = {sw_top_hat, sw_top_hat_dlnR};
+  struct fft_mellin_plan fmp;
+  struct nonlinear_sigma_table st;
+
+  window_num = (dsigma_dlnR_vec == NULL) ? 1 : 2;
+
+  /** - allocate temporary array for P(k,z) as a function of k */
+
+  class_alloc(out_pk, pnl->k_size*sizeof(double), pnl->error_message);
+  class_alloc(ddout_pk, pnl->k_size*sizeof(double), pnl->error_message);
+
+  switch (ppr->sigma_method) {
+
+    /** - with FFTLog: one plan for all redshifts, one table of
+          sigma^2 and dsigma^2/dlnR per redshift */
+
+  case sm_fftlog:
+
+    class_call(nonlinear_sigma_plan_init(pnl,
+                                         pnl->k_size,
+                                         ppr->sigma_k_per_decade,
+                                         window_num,
+                                         sigma_window,
+                                         &fmp),
+               pnl->error_message,
+               pnl->error_message);
+
+    for (index_zvec=0; index_zvec<zvec_size; index_zvec++) {
+
+      class_call(nonlinear_pk_at_z(pba,
+                                   pnl,
+                                   logarithmic,
+                                   pk_linear,
+                                   zvec[index_zvec],
+                                   index_pk,
+                                   out_pk,
+                                   NULL),
+                 pnl->error_message,
+                 pnl->error_message);
+
+      class_call(array_spline_table_columns(pnl->ln_k,
+                                            pnl->k_size,
+                                            out_pk,
+                                            1,
+                                            ddout_pk,
+                                            _SPLINE_EST_DERIV_,
+                                            pnl->error_message),
+                 pnl->error_message,
+                 pnl->error_message);
+
+      class_call(nonlinear_sigma_table_init(pnl,
+                                            &fmp,
+                                            out_pk,
+                                            ddout_pk,
+                                            pnl->k_size,
+                                            &st),
+                 pnl->error_message,
+                 pnl->error_message);
+
+      for (index_Rvec=0; index_Rvec<Rvec_size; index_Rvec++) {
+
+        class_call(nonlinear_sigma_table_at_R(pnl,
+                                              &st,
+                                              Rvec[index_Rvec],
+                                              result),
+                   pnl->error_message,
+                   pnl->error_message);
+
+        sigma_vec[index_zvec*Rvec_size+index_Rvec] = sqrt(result[0]);
+        if (dsigma_dlnR_vec != NULL)
+          dsigma_dlnR_vec[index_zvec*Rvec_size+index_Rvec] = result[1]/2./sqrt(result[0]);
+      }
+
+      class_call(nonlinear_sigma_table_free(&st),
+                 pnl->error_message,
+                 pnl->error_message);
+    }
+
+    fft_mellin_plan_free(&fmp);
+
+    break;
+
+    /** - with separate integrals: tabulate once the window functions
+          times the integration weights on the grid of nonlinear_sigmas(),
+          then sum them against P(k,z) for each redshift */
+
+  case sm_integration:
+
+    integrand_size=(int)(log(pnl->k[pnl->k_size-1]/pnl->k[0])/log(10.)*ppr->sigma_k_per_decade)+1;
+
+    class_alloc(lnk_grid, integrand_size*sizeof(double), pnl->error_message);
+    class_alloc(pk_grid, integrand_size*sizeof(double), pnl->error_message);
+    class_alloc(t_grid, integrand_size*sizeof(double), pnl->error_message);
+    class_alloc(weight, integrand_size*sizeof(double), pnl->error_message);
+    class_alloc(window, window_num*Rvec_size*integrand_size*sizeof(double), pnl->error_message);
+
+    /* the integral of nonlinear_sigmas() runs over t=1/(1+k) in ascending order */
+    for (index_k=0; index_k<integrand_size; index_k++) {
+      k = pnl->k[0]*pow(10.,index_k/ppr->sigma_k_per_decade);
+      lnk_grid[index_k] = log(k);
+      t_grid[integrand_size-1-index_k] = 1./(1.+k);
+    }
+
+    class_call(array_spline_weights(t_grid,
+                                    integrand_size,
+                                    0,
+                                    weight,
+                                    pnl->error_message),
+               pnl->error_message,
+               pnl->error_message);
+
+    for (index_k=0; index_k<integrand_size; index_k++) {
+
+      k = exp(lnk_grid[index_k]);
+      t = 1./(1.+k);
+      if (index_k == (integrand_size-1)) k *= 0.9999999; // as in nonlinear_sigmas()
+
+      for (index_Rvec=0; index_Rvec<Rvec_size; index_Rvec++) {
+
+        x = k*Rvec[index_Rvec];
+        if (x<0.01) {
+          W = 1.-x*x/10.;
+          W_prime = -0.2*x;
+        }
+        else {
+          W = 3./x/x/x*(sin(x)-x*cos(x));
+          W_prime = 3./x/x*sin(x)-9./x/x/x/x*(sin(x)-x*cos(x));
+        }
+
+        window_R = window+index_Rvec*window_num*integrand_size;
+        window_R[index_k] = weight[integrand_size-1-index_k]*k*k*k*W*W/(t*(1.-t))/(2.*_PI_*_PI_);
+        if (window_num == 2)
+          window_R[integrand_size+index_k] = weight[integrand_size-1-index_k]*k*k*k*2.*x*W*W_prime/(t*(1.-t))/(2.*_PI_*_PI_);
+      }
+    }
+
+    for (index_zvec=0; index_zvec<zvec_size; index_zvec++) {
+
+      class_call(nonlinear_pk_at_z(pba,
+                                   pnl,
+                                   logarithmic,
+                                   pk_linear,
+                                   zvec[index_zvec],
+                                   index_pk,
+                                   out_pk,
+                                   NULL),
+                 pnl->error_message,
+                 pnl->error_message);
+
+      class_call(array_spline_table_columns(pnl->ln_k,
+                                            pnl->k_size,
+                                            out_pk,
+                                            1,
+                                            ddout_pk,
+                                            _SPLINE_EST_DERIV_,
+                                            pnl->error_message),
+                 pnl->error_message,
+                 pnl->error_message);
+
+      last_index = 0;
+      pk_grid[0] = exp(out_pk[0]);
+      for (index_k=1; index_k<integrand_size; index_k++) {
+        class_call(array_interpolate_spline_hunt(pnl->ln_k,
+                                                 pnl->k_size,
+                                                 out_pk,
+                                                 ddout_pk,
+                                                 1,
+                                                 lnk_grid[index_k],
+                                                 &last_index,
+                                                 &lnpk,
+                                                 1,
+                                                 pnl->error_message),
+                   pnl->error_message,
+                   pnl->error_message);
+        pk_grid[index_k] = exp(lnpk);
+      }
+
+      for (index_Rvec=0; index_Rvec<Rvec_size; index_Rvec++) {
+
+        window_R = window+index_Rvec*window_num*integrand_size;
+
+        sigma2 = 0.;
+#pragma omp simd reduction(+:sigma2)
+        for (index_k=0; index_k<integrand_size; index_k++)
+          sigma2 += window_R[index_k]*pk_grid[index_k];
+
+        sigma_vec[index_zvec*Rvec_size+index_Rvec] = sqrt(sigma2);
+
+        if (window_num == 2) {
+          dsigma2 = 0.;
+#pragma omp simd reduction(+:dsigma2)
+          for (index_k=0; index_k<integrand_size; index_k++)
+            dsigma2 += window_R[integrand_size+index_k]*pk_grid[index_k];
+
+          dsigma_dlnR_vec[index_zvec*Rvec_size+index_Rvec] = dsigma2/2./sqrt(sigma2);
+        }
+      }
+    }
+
+    free(lnk_grid);
+    free(pk_grid);
+    free(t_grid);
+    free(weight);
+    free(window);
+
+    break;
+  }
+
+  /** - free allocated arrays */
+
+  free(out_pk);
+  free(ddout_pk);
+
+  return _SUCCESS_;
+}
+
 /**
  * Return the value of the non-linearity wavenumber k_nl for a given redshift z
  *
@@ -1209,6 +1714,9 @@ int nonlinear_init(
   double **lnpk_l;
   double **ddlnpk_l;
 
+  int index_tau_reverse;
+  int index_tau_failed;
+
   short nl_corr_not_computable_at_this_k = _FALSE_;
 
   double * pvecback;
@@ -1218,6 +1726,17 @@ int nonlinear_init(
   struct nonlinear_workspace nw;
   struct nonlinear_workspace * pnw;
 
+  int abort;
+
+  enum sigma_window halofit_windows[3];
+  enum sigma_window top_hat_window = sw_top_hat;
+
+  /* size of the heap at the beginning (see class_memory_heap()) */
+  size_t heap_start;
+
+  class_profile_start(profile_nonlinear_init);
+  heap_start = class_memory_heap();
+
   /** - preliminary tests */
 
   /** --> This module only makes sense for dealing with scalar
@@ -1226,6 +1745,8 @@ int nonlinear_init(
   if (ppt->has_scalars == _FALSE_) {
     pnl->method = nl_none;
     printf("No scalar modes requested. Nonlinear module skipped.\n");
+    pnl->memory_size = class_memory_growth(heap_start);
+    class_profile_stop(profile_nonlinear_init);
     return _SUCCESS_;
   }
 
@@ -1236,6 +1757,8 @@ int nonlinear_init(
   if ((pnl->has_pk_matter == _FALSE_) && (pnl->method == nl_none)) {
     if (pnl->nonlinear_verbose > 0)
       printf("No Fourier spectra nor nonlinear corrections requested. Nonlinear module skipped.\n");
+    pnl->memory_size = class_memory_growth(heap_start);
+    class_profile_stop(profile_nonlinear_init);
     return _SUCCESS_;
   }
   else {
@@ -1383,153 +1906,209 @@ int nonlinear_init(
 	if ((pnl->nonlinear_verbose > 0) && (pnl->method == nl_HMcode))
       printf("Computing non-linear matter power spectrum with HMcode \n");
 
-    /** --> allocate temporary arrays for spectra at each given time/redshift */
-
-    class_alloc(pk_nl,
-                pnl->k_size*sizeof(double),
-                pnl->error_message);
-
-    class_alloc(lnpk_l,
-                pnl->k_size*sizeof(double),
-                pnl->error_message);
+    /** --> Preliminary step specific to HMcode */
 
-    class_alloc(ddlnpk_l,
-                pnl->k_size*sizeof(double),
-                pnl->error_message);
+    if (pnl->method == nl_HMcode){
 
-    for (index_pk=0; index_pk<pnl->pk_size; index_pk++){
-      class_alloc(pk_nl[index_pk],pnl->k_size*sizeof(double),pnl->error_message);
-      class_alloc(lnpk_l[index_pk],pnl->k_size_extra*sizeof(double),pnl->error_message);
-      class_alloc(ddlnpk_l[index_pk],pnl->k_size_extra*sizeof(double),pnl->error_message);
+      class_call(nonlinear_hmcode_baryonic_feedback(pnl),
+                 pnl->error_message,
+                 pnl->error_message);
     }
 
-    /** --> Then go through preliminary steps specific to HMcode */
+    /** --> With sigma_method=sm_fftlog, prepare once the FFTLog plans
+            of the tables of sigma(R) (HMcode) or of the three
+            integrals of halofit, used at each time */
 
-    if (pnl->method == nl_HMcode){
+    if (ppr->sigma_method == sm_fftlog) {
 
-      pnw = &nw;
+      if (pnl->method == nl_halofit) {
 
-      class_call(nonlinear_hmcode_workspace_init(ppr,pba,pnl,pnw),
-                 pnl->error_message,
-                 pnl->error_message);
+        halofit_windows[halofit_integral_one] = sw_halofit_one;
+        halofit_windows[halofit_integral_two] = sw_halofit_two;
+        halofit_windows[halofit_integral_three] = sw_halofit_three;
 
-      class_call(nonlinear_hmcode_dark_energy_correction(ppr,pba,pnl,pnw),
-                 pnl->error_message,
-                 pnl->error_message);
+        class_call(nonlinear_sigma_plan_init(pnl,
+                                             pnl->k_size,
+                                             ppr->halofit_k_per_decade,
+                                             3,
+                                             halofit_windows,
+                                             &(pnl->sigma_plan_halofit)),
+                   pnl->error_message,
+                   pnl->error_message);
+      }
 
-      class_call(nonlinear_hmcode_baryonic_feedback(pnl),
-                 pnl->error_message,
-                 pnl->error_message);
+      if (pnl->method == nl_HMcode) {
+
+        class_call(nonlinear_sigma_plan_init(pnl,
+                                             pnl->k_size_extra,
+                                             ppr->sigma_k_per_decade,
+                                             1,
+                                             &top_hat_window,
+                                             &(pnl->sigma_plan_top_hat)),
+                   pnl->error_message,
+                   pnl->error_message);
+      }
     }
 
     /** --> Loop over decreasing time/growing redhsift. For each
             time/redshift, compute P_NL(k,z) using either Halofit or
-            HMcode */
+            HMcode. The values of time are shared between threads,
+            each with its own temporary arrays and HMcode workspace. */
 
-    /* this flag will become _TRUE_ at the minimum redshift such that
-       the non-lienar corrections cannot be consistently computed */
-    nl_corr_not_computable_at_this_k = _FALSE_;
+    /* this index will refer to the largest value of time at which the
+       non-linear corrections cannot be consistently computed (it
+       remains -1 if they can be computed at all times) */
+    index_tau_failed = -1;
 
-    /* this index will refer to the value of time corresponding to
-       that redhsift */
-    pnl->index_tau_min_nl = 0;
+    abort = _FALSE_;
 
-    for (index_tau = pnl->tau_size-1; index_tau>=0; index_tau--) {
+#pragma omp parallel                                                    \
+  shared(ppr,pba,ppt,ppm,pnl,abort,index_tau_failed)                    \
+  private(index_tau_reverse,index_tau,index_pk,index_k,pk_nl,lnpk_l,ddlnpk_l,nw,pnw,nl_corr_not_computable_at_this_k)
 
-      /* loop over index_pk, defined such that it is ensured
-       * that index_pk starts at index_pk_cb when neutrinos are
-       * included. This is necessary for hmcode, since the sigmatable
-       * needs to be filled for sigma_cb only. Thus, when HMcode
-       * evalutes P_m_nl, it needs both P_m_l and P_cb_l. */
+    {
 
-      for (index_pk=0; index_pk<pnl->pk_size; index_pk++) {
+      /** --> allocate temporary arrays for spectra at each given time/redshift */
 
-        /* get P_L(k) at this time */
-        class_call(nonlinear_pk_linear(
-                                       pba,
-                                       ppt,
-                                       ppm,
-                                       pnl,
-                                       index_pk,
-                                       index_tau,
-                                       pnl->k_size_extra,
-                                       lnpk_l[index_pk],
-                                       NULL
-                                       ),
-                   pnl->error_message,
-                   pnl->error_message);
+      class_alloc_parallel(pk_nl,pnl->pk_size*sizeof(double*),pnl->error_message);
+      class_alloc_parallel(lnpk_l,pnl->pk_size*sizeof(double*),pnl->error_message);
+      class_alloc_parallel(ddlnpk_l,pnl->pk_size*sizeof(double*),pnl->error_message);
 
-        /* spline P_L(k) at this time along k */
-        class_call(array_spline_table_columns(
-                                              pnl->ln_k,
-                                              pnl->k_size_extra,
-                                              lnpk_l[index_pk],
-                                              1,
-                                              ddlnpk_l[index_pk],
-                                              _SPLINE_NATURAL_,
-                                              pnl->error_message),
-                   pnl->error_message,
-                   pnl->error_message);
+      for (index_pk=0; index_pk<pnl->pk_size; index_pk++){
+        if (pk_nl != NULL) class_alloc_parallel(pk_nl[index_pk],pnl->k_size*sizeof(double),pnl->error_message);
+        if (lnpk_l != NULL) class_alloc_parallel(lnpk_l[index_pk],pnl->k_size_extra*sizeof(double),pnl->error_message);
+        if (ddlnpk_l != NULL) class_alloc_parallel(ddlnpk_l[index_pk],pnl->k_size_extra*sizeof(double),pnl->error_message);
+      }
 
-        /* if we are still in a range of time where P_NL(k) should be computable */
-        if (nl_corr_not_computable_at_this_k == _FALSE_) {
+      /** --> Then go through preliminary steps specific to HMcode */
 
-          /* get P_NL(k) at this time with Halofit */
-          if (pnl->method == nl_halofit) {
+      pnw = &nw;
 
-            class_call(nonlinear_halofit(
-                                         ppr,
-                                         pba,
-                                         ppt,
-                                         ppm,
-                                         pnl,
-                                         index_pk,
-                                         pnl->tau[index_tau],
-                                         pk_nl[index_pk],
-                                         lnpk_l[index_pk],
-                                         ddlnpk_l[index_pk],
-                                         &(pnl->k_nl[index_pk][index_tau]),
-                                         &nl_corr_not_computable_at_this_k),
-                       pnl->error_message,
-                       pnl->error_message);
+      if (pnl->method == nl_HMcode){
 
-          }
+        class_call_parallel(nonlinear_hmcode_workspace_init(ppr,pba,pnl,pnw),
+                            pnl->error_message,
+                            pnl->error_message);
+      }
+
+#pragma omp for schedule (dynamic)
+
+      for (index_tau_reverse = 0; index_tau_reverse < pnl->tau_size; index_tau_reverse++) {
+
+        index_tau = pnl->tau_size-1-index_tau_reverse;
+
+#pragma omp flush(abort,index_tau_failed)
+
+        /* times earlier than a problematic one will anyway receive
+           R_NL=1 below: no need to compute anything there */
+        if ((abort == _TRUE_) || (index_tau < index_tau_failed))
+          continue;
+
+        /* this flag will become _TRUE_ if the non-linear corrections
+           cannot be consistently computed at this time */
+        nl_corr_not_computable_at_this_k = _FALSE_;
+
+        /* loop over index_pk, defined such that it is ensured
+         * that index_pk starts at index_pk_cb when neutrinos are
+         * included. This is necessary for hmcode, since the sigmatable
+         * needs to be filled for sigma_cb only. Thus, when HMcode
+         * evalutes P_m_nl, it needs both P_m_l and P_cb_l. */
+
+        for (index_pk=0; index_pk<pnl->pk_size; index_pk++) {
+
+          /* by default, the non-linear scale is beyond the range of k */
+          pnl->k_nl[index_pk][index_tau] = pnl->k[pnl->k_size-1];
+
+          /* if we are still in a range of time where P_NL(k) should be computable */
+          if (nl_corr_not_computable_at_this_k == _FALSE_) {
+
+            /* get P_L(k) at this time */
+            class_call_parallel(nonlinear_pk_linear(
+                                                    pba,
+                                                    ppt,
+                                                    ppm,
+                                                    pnl,
+                                                    index_pk,
+                                                    index_tau,
+                                                    pnl->k_size_extra,
+                                                    lnpk_l[index_pk],
+                                                    NULL
+                                                    ),
+                                pnl->error_message,
+                                pnl->error_message);
+
+            /* spline P_L(k) at this time along k */
+            class_call_parallel(array_spline_table_columns(
+                                                           pnl->ln_k,
+                                                           pnl->k_size_extra,
+                                                           lnpk_l[index_pk],
+                                                           1,
+                                                           ddlnpk_l[index_pk],
+                                                           _SPLINE_NATURAL_,
+                                                           pnl->error_message),
+                                pnl->error_message,
+                                pnl->error_message);
+
+            /* get P_NL(k) at this time with Halofit */
+            if (pnl->method == nl_halofit) {
+
+              class_call_parallel(nonlinear_halofit(
+                                                    ppr,
+                                                    pba,
+                                                    ppt,
+                                                    ppm,
+                                                    pnl,
+                                                    index_pk,
+                                                    pnl->tau[index_tau],
+                                                    pk_nl[index_pk],
+                                                    lnpk_l[index_pk],
+                                                    ddlnpk_l[index_pk],
+                                                    &(pnl->k_nl[index_pk][index_tau]),
+                                                    &nl_corr_not_computable_at_this_k),
+                                  pnl->error_message,
+                                  pnl->error_message);
 
-          /* get P_NL(k) at this time with HMcode */
-          else if (pnl->method == nl_HMcode) {
-
-            /* (preliminary step: fill table of sigma's, only for _cb if there is both _cb and _m) */
-            if (index_pk == 0) {
-              class_call(nonlinear_hmcode_fill_sigtab(ppr,
-                                                      pba,
-                                                      ppt,
-                                                      ppm,
-                                                      pnl,
-                                                      index_tau,
-                                                      lnpk_l[index_pk],
-                                                      ddlnpk_l[index_pk],
-                                                      pnw),
-                         pnl->error_message, pnl->error_message);
             }
 
-            class_call(nonlinear_hmcode(ppr,
-                                        pba,
-                                        ppt,
-                                        ppm,
-                                        pnl,
-                                        index_pk,
-                                        index_tau,
-                                        pnl->tau[index_tau],
-                                        pk_nl[index_pk],
-                                        lnpk_l,
-                                        ddlnpk_l,
-                                        &(pnl->k_nl[index_pk][index_tau]),
-                                        &nl_corr_not_computable_at_this_k,
-                                        pnw),
-                       pnl->error_message,
-                       pnl->error_message);
+            /* get P_NL(k) at this time with HMcode */
+            else if (pnl->method == nl_HMcode) {
+
+              /* (preliminary step: fill table of sigma's, only for _cb if there is both _cb and _m) */
+              if (index_pk == 0) {
+                class_call_parallel(nonlinear_hmcode_fill_sigtab(ppr,
+                                                                 pba,
+                                                                 ppt,
+                                                                 ppm,
+                                                                 pnl,
+                                                                 index_tau,
+                                                                 lnpk_l[index_pk],
+                                                                 ddlnpk_l[index_pk],
+                                                                 pnw),
+                                    pnl->error_message, pnl->error_message);
+              }
+
+              class_call_parallel(nonlinear_hmcode(ppr,
+                                                   pba,
+                                                   ppt,
+                                                   ppm,
+                                                   pnl,
+                                                   index_pk,
+                                                   index_tau,
+                                                   pnl->tau[index_tau],
+                                                   pk_nl[index_pk],
+                                                   lnpk_l,
+                                                   ddlnpk_l,
+                                                   &(pnl->k_nl[index_pk][index_tau]),
+                                                   &nl_corr_not_computable_at_this_k,
+                                                   pnw),
+                                  pnl->error_message,
+                                  pnl->error_message);
+            }
           }
 
+          if (abort == _TRUE_)
+            break;
+
           /* infer and store R_NL=(P_NL/P_L)^1/2 */
           if (nl_corr_not_computable_at_this_k == _FALSE_) {
             for (index_k=0; index_k<pnl->k_size; index_k++) {
@@ -1537,58 +2116,104 @@ int nonlinear_init(
             }
           }
 
-          /* otherwise we met the first problematic value of time */
+          /* otherwise store R_NL=1 for that time */
           else {
-
-            /* store the index of that value */
-            pnl->index_tau_min_nl = MIN(pnl->tau_size-1,index_tau+1); //this MIN() ensures that index_tau_min_nl is never out of bounds
-
-            /* store R_NL=1 for that time */
             for (index_k=0; index_k<pnl->k_size; index_k++) {
               pnl->nl_corr_density[index_pk][index_tau * pnl->k_size + index_k] = 1.;
             }
+          }
 
-            /* send a warning to inform user about the corresponding value of redshift */
-            if (pnl->nonlinear_verbose > 0) {
-              class_alloc(pvecback,pba->bg_size*sizeof(double),pnl->error_message);
-              class_call(background_at_tau(pba,pnl->tau[index_tau],pba->short_info,pba->inter_normal,&last_index,pvecback),
-                         pba->error_message,
-                         pnl->error_message);
-              a = pvecback[pba->index_bg_a];
-              z = pba->a_today/a-1.;
-              fprintf(stdout,
-                      " -> [WARNING:] Non-linear corrections could not be computed at redshift z=%5.2f and higher.\n    This is because k_max is too small for the algorithm (Halofit or HMcode) to be able to compute the scale k_NL at this redshift.\n    If non-linear corrections at such high redshift really matter for you,\n    just try to increase one of the parameters P_k_max_h/Mpc or P_k_max_1/Mpc or halofit_min_k_max (the code will take the max of these parameters) until reaching desired z.\n",z);
-
-              free(pvecback);
-            }
+        } // end loop over index_pk
+
+        /* keep track of the latest problematic value of time */
+        if (nl_corr_not_computable_at_this_k == _TRUE_) {
+#pragma omp critical
+          {
+            index_tau_failed = MAX(index_tau_failed,index_tau);
           }
         }
 
-        /* if we are still in a range of time where P_NL(k) should NOT be computable */
-        else {
-          /* store R_NL=1 for that time */
-          for (index_k=0; index_k<pnl->k_size; index_k++) {
-            pnl->nl_corr_density[index_pk][index_tau * pnl->k_size + index_k] = 1.;
-          }
+      } //end loop over index_tau
 
-        }
+      /** --> free temporary arrays and nonlinear workspace */
+
+      if (pnl->method == nl_HMcode) {
+        class_call_parallel(nonlinear_hmcode_workspace_free(pnl,pnw),
+                            pnl->error_message,
+                            pnl->error_message);
+      }
+
+      for (index_pk=0; index_pk<pnl->pk_size; index_pk++){
+        if (pk_nl != NULL) free(pk_nl[index_pk]);
+        if (lnpk_l != NULL) free(lnpk_l[index_pk]);
+        if (ddlnpk_l != NULL) free(ddlnpk_l[index_pk]);
+      }
+
+      free(pk_nl);
+      free(lnpk_l);
+      free(ddlnpk_l);
 
-        /** --> fill the array of nonlinear power spectra (only if we
-            are at a late time where P(k) and T(k) are supposed to
-            be stored, i.e., such that z(tau < z_max_pk) */
+    } // end of parallel region
 
-        if (index_tau >= pnl->tau_size - pnl->ln_tau_size) {
+    if (ppr->sigma_method == sm_fftlog) {
+      if (pnl->method == nl_halofit)
+        fft_mellin_plan_free(&(pnl->sigma_plan_halofit));
+      if (pnl->method == nl_HMcode)
+        fft_mellin_plan_free(&(pnl->sigma_plan_top_hat));
+    }
+
+    if (abort == _TRUE_) return _FAILURE_;
 
-          index_tau_late = index_tau - (pnl->tau_size - pnl->ln_tau_size);
+    /** --> Once the first problematic value of time is met (going
+            backward in time), the non-linear corrections are not
+            computed at any earlier time: reproduce this with R_NL=1 */
+
+    pnl->index_tau_min_nl = 0;
 
+    if (index_tau_failed >= 0) {
+
+      /* store the index of the next value of time */
+      pnl->index_tau_min_nl = MIN(pnl->tau_size-1,index_tau_failed+1); //this MIN() ensures that index_tau_min_nl is never out of bounds
+
+      /* store R_NL=1 for all earlier times */
+      for (index_tau=0; index_tau<index_tau_failed; index_tau++) {
+        for (index_pk=0; index_pk<pnl->pk_size; index_pk++) {
+          pnl->k_nl[index_pk][index_tau] = pnl->k[pnl->k_size-1];
           for (index_k=0; index_k<pnl->k_size; index_k++) {
-            pnl->ln_pk_nl[index_pk][index_tau_late * pnl->k_size + index_k] = pnl->ln_pk_l[index_pk][index_tau_late * pnl->k_size + index_k] + 2.*log(pnl->nl_corr_density[index_pk][index_tau * pnl->k_size + index_k]);
+            pnl->nl_corr_density[index_pk][index_tau * pnl->k_size + index_k] = 1.;
           }
         }
+      }
+
+      /* send a warning to inform user about the corresponding value of redshift */
+      if (pnl->nonlinear_verbose > 0) {
+        class_alloc(pvecback,pba->bg_size*sizeof(double),pnl->error_message);
+        class_call(background_at_tau(pba,pnl->tau[index_tau_failed],pba->short_info,pba->inter_normal,&last_index,pvecback),
+                   pba->error_message,
+                   pnl->error_message);
+        a = pvecback[pba->index_bg_a];
+        z = pba->a_today/a-1.;
+        fprintf(stdout,
+                " -> [WARNING:] Non-linear corrections could not be computed at redshift z=%5.2f and higher.\n    This is because k_max is too small for the algorithm (Halofit or HMcode) to be able to compute the scale k_NL at this redshift.\n    If non-linear corrections at such high redshift really matter for you,\n    just try to increase one of the parameters P_k_max_h/Mpc or P_k_max_1/Mpc or halofit_min_k_max (the code will take the max of these parameters) until reaching desired z.\n",z);
+
+        free(pvecback);
+      }
+    }
+
+    /** --> fill the array of nonlinear power spectra (only at late
+            times where P(k) and T(k) are supposed to be stored, i.e.,
+            such that z(tau < z_max_pk) */
 
-      } // end loop over index_pk
-    } //end loop over index_tau
+    for (index_tau = pnl->tau_size - pnl->ln_tau_size; index_tau < pnl->tau_size; index_tau++) {
 
+      index_tau_late = index_tau - (pnl->tau_size - pnl->ln_tau_size);
+
+      for (index_pk=0; index_pk<pnl->pk_size; index_pk++) {
+        for (index_k=0; index_k<pnl->k_size; index_k++) {
+          pnl->ln_pk_nl[index_pk][index_tau_late * pnl->k_size + index_k] = pnl->ln_pk_l[index_pk][index_tau_late * pnl->k_size + index_k] + 2.*log(pnl->nl_corr_density[index_pk][index_tau * pnl->k_size + index_k]);
+        }
+      }
+    }
 
     /** --> spline the array of nonlinear power spectrum */
 
@@ -1606,27 +2231,6 @@ int nonlinear_init(
                    pnl->error_message);
       }
     }
-
-    /* --> free temporary arrays */
-
-    for (index_pk=0; index_pk<pnl->pk_size; index_pk++){
-      free(pk_nl[index_pk]);
-      free(lnpk_l[index_pk]);
-      free(ddlnpk_l[index_pk]);
-    }
-
-    free(pk_nl);
-    free(lnpk_l);
-    free(ddlnpk_l);
-
-    /** --> free the nonlinear workspace */
-
-    if (pnl->method == nl_HMcode) {
-
-      class_call(nonlinear_hmcode_workspace_free(pnl,pnw),
-                 pnl->error_message,
-                 pnl->error_message);
-    }
   }
 
   /** - if the nl_method could not be identified */
@@ -1635,6 +2239,8 @@ int nonlinear_init(
                "Your non-linear method variable is set to %d, out of the range defined in nonlinear.h",pnl->method);
   }
 
+  pnl->memory_size = class_memory_growth(heap_start);
+  class_profile_stop(profile_nonlinear_init);
   return _SUCCESS_;
 }
 
@@ -1655,7 +2261,9 @@ int nonlinear_free(
 
     free(pnl->k);
     free(pnl->ln_k);
-    free(pnl->ln_tau);
+    /* only allocated by nonlinear_get_tau_list() for several times */
+    if (pnl->ln_tau_size > 1)
+      free(pnl->ln_tau);
 
     for (index_pk=0; index_pk<pnl->pk_size; index_pk++) {
       free(pnl->ln_pk_ic_l[index_pk]);
@@ -1950,7 +2558,6 @@ int nonlinear_get_tau_list(
  * @param index_ic        Input: index of required ic value
  * @param index_tp        Input: index of required tp value
  * @param index_tau       Input: index of required tau value
- * @param sources         Input: array containing the original sources
  * @param source          Output: desired value of source
  * @return the error status
  */
@@ -1963,7 +2570,6 @@ int nonlinear_get_source(
                          int index_ic,
                          int index_tp,
                          int index_tau,
-                         double ** sources,
                          double * source
                          ) {
 
@@ -1973,7 +2579,7 @@ int nonlinear_get_source(
 
   /** - use precomputed values */
   if (index_k < pnl->k_size) {
-    *source = sources[index_ic * ppt->tp_size[pnl->index_md_scalars] + index_tp][index_tau * pnl->k_size + index_k];
+    *source = _get_source_(ppt,pnl->index_md_scalars,index_ic * ppt->tp_size[pnl->index_md_scalars] + index_tp,index_tau * pnl->k_size + index_k);
   }
   /** - extrapolate **/
   else {
@@ -1984,13 +2590,13 @@ int nonlinear_get_source(
      * --> Get last source and k, which are used in (almost) all methods
      */
     k_max = pnl->k[pnl->k_size-1];
-    source_max = sources[index_ic * ppt->tp_size[pnl->index_md_scalars] + index_tp][index_tau * pnl->k_size + pnl->k_size - 1];
+    source_max = _get_source_(ppt,pnl->index_md_scalars,index_ic * ppt->tp_size[pnl->index_md_scalars] + index_tp,index_tau * pnl->k_size + pnl->k_size - 1);
 
     /**
      * --> Get previous source and k, which are used in best methods
      */
     k_previous = pnl->k[pnl->k_size-2];
-    source_previous = sources[index_ic * ppt->tp_size[pnl->index_md_scalars] + index_tp][index_tau * pnl->k_size + pnl->k_size - 2];
+    source_previous = _get_source_(ppt,pnl->index_md_scalars,index_ic * ppt->tp_size[pnl->index_md_scalars] + index_tp,index_tau * pnl->k_size + pnl->k_size - 2);
 
     switch(pnl->extrapolation_method){
       /**
@@ -2132,7 +2738,7 @@ int nonlinear_pk_linear(
 
   /** - allocate temporary vector where the primordial spectrum will be stored */
 
-  class_alloc(primordial_pk,pnl->ic_ic_size*sizeof(double),pnl->error_message);
+  class_alloc(primordial_pk,k_size*pnl->ic_ic_size*sizeof(double),pnl->error_message);
 
   class_alloc(pk_ic,pnl->ic_ic_size*sizeof(double),pnl->error_message);
 
@@ -2146,15 +2752,16 @@ int nonlinear_pk_linear(
     class_stop(pnl->error_message,"P(k) is set neither to total matter nor to cold dark matter + baryons");
   }
 
+  /** - get primordial spectrum at all k values */
+
+  class_call(primordial_spectrum_at_kvec(ppm,pnl->index_md_scalars,logarithmic,pnl->ln_k,k_size,primordial_pk),
+             ppm->error_message,
+             pnl->error_message);
+
   /** - loop over k values */
 
   for (index_k=0; index_k<k_size; index_k++) {
 
-    /** --> get primordial spectrum */
-    class_call(primordial_spectrum_at_k(ppm,pnl->index_md_scalars,logarithmic,pnl->ln_k[index_k],primordial_pk),
-               ppm->error_message,
-               pnl->error_message);
-
     /** --> initialize a local variable for P_m(k) and P_cb(k) to zero */
     pk = 0.;
 
@@ -2181,14 +2788,13 @@ int nonlinear_pk_linear(
                                       index_ic1,
                                       index_tp,
                                       index_tau,
-                                      ppt->sources[pnl->index_md_scalars],
                                       &source_ic1),
                  pnl->error_message,
                  pnl->error_message);
 
       pk_ic[index_ic1_ic1] = 2.*_PI_*_PI_/exp(3.*pnl->ln_k[index_k])
         *source_ic1*source_ic1
-        *exp(primordial_pk[index_ic1_ic1]);
+        *exp(primordial_pk[index_k*pnl->ic_ic_size+index_ic1_ic1]);
 
       pk += pk_ic[index_ic1_ic1];
 
@@ -2214,7 +2820,6 @@ int nonlinear_pk_linear(
                                           index_ic1,
                                           index_tp,
                                           index_tau,
-                                          ppt->sources[pnl->index_md_scalars],
                                           &source_ic1),
                      pnl->error_message,
                      pnl->error_message);
@@ -2226,12 +2831,11 @@ int nonlinear_pk_linear(
                                           index_ic2,
                                           index_tp,
                                           index_tau,
-                                          ppt->sources[pnl->index_md_scalars],
                                           &source_ic2),
                      pnl->error_message,
                      pnl->error_message);
 
-          cosine_correlation = primordial_pk[index_ic1_ic2]*SIGN(source_ic1)*SIGN(source_ic2);
+          cosine_correlation = primordial_pk[index_k*pnl->ic_ic_size+index_ic1_ic2]*SIGN(source_ic1)*SIGN(source_ic2);
 
           pk_ic[index_ic1_ic2] = cosine_correlation * sqrt(pk_ic[index_ic1_ic1]*pk_ic[index_ic2_ic2]);
 
@@ -2324,17 +2928,17 @@ int nonlinear_sigmas(
       pk = exp(lnpk_l[0]);
     }
     else {
-      class_call(array_interpolate_spline(
-                                          pnl->ln_k,
-                                          k_size,
-                                          lnpk_l,
-                                          ddlnpk_l,
-                                          1,
-                                          log(k),
-                                          &last_index,
-                                          &lnpk,
-                                          1,
-                                          pnl->error_message),
+      class_call(array_interpolate_spline_hunt(
+                                               pnl->ln_k,
+                                               k_size,
+                                               lnpk_l,
+                                               ddlnpk_l,
+                                               1,
+                                               log(k),
+                                               &last_index,
+                                               &lnpk,
+                                               1,
+                                               pnl->error_message),
                  pnl->error_message,
                  pnl->error_message);
 
@@ -2407,28 +3011,333 @@ int nonlinear_sigmas(
              pnl->error_message,
              pnl->error_message);
 
-  /** - preperly normalize the final result */
+  /** - preperly normalize the final result */
+
+  switch (sigma_output) {
+
+  case out_sigma:
+    *result = sqrt(*result/(2.*_PI_*_PI_));
+    break;
+
+  case out_sigma_prime:
+    *result = *result/(2.*_PI_*_PI_);
+    break;
+
+  case out_sigma_disp:
+    *result = sqrt(*result/(2.*_PI_*_PI_*3.));
+    break;
+  }
+
+  /** - free allocated array */
+
+  free(array_for_sigma);
+
+  return _SUCCESS_;
+}
+
+/**
+ * Prepare the FFTLog plan of nonlinear_sigma_table_init() for some
+ * window functions: the integrand will be sampled with the same
+ * logarithmic step as in nonlinear_sigmas() between the first and
+ * last k of an array of size k_size, and padded with zeros to twice
+ * this range (rounded to a power of two).
+ *
+ * @param pnl          Input: pointer to nonlinear structure
+ * @param k_size       Input: number of values of k of the power spectra
+ * @param k_per_decade Input: logarithmic step (recommended: pass ppr->sigma_k_per_decade)
+ * @param window_num   Input: number of window functions
+ * @param window       Input: window functions (top-hat, giving sigma^2(R), or the three Gaussian windows of halofit)
+ * @param pfmp         Output: plan, to be freed with fft_mellin_plan_free()
+ * @return the error status
+ */
+
+int nonlinear_sigma_plan_init(
+                              struct nonlinear * pnl,
+                              int k_size,
+                              double k_per_decade,
+                              int window_num,
+                              enum sigma_window * window,
+                              struct fft_mellin_plan * pfmp
+                              ) {
+
+  int k_num,N,pad;
+  double dlnk,k0;
+
+  dlnk = log(10.)/k_per_decade;
+  k_num = (int)(log(pnl->k[k_size-1]/pnl->k[0])/dlnk)+1;
+
+  for (N=2; N<2*k_num; N*=2);
+  pad = (N-k_num)/2;
+  k0 = pnl->k[0]*exp(-pad*dlnk);
+
+  /* the bias q=1 keeps the round-off errors at the level of 1e-9 or
+     better over the whole table for the top-hat window, whose Mellin
+     transform converges for 0 < q < 4 (0 < q for the Gaussian
+     windows) */
+
+  class_call(fft_mellin_plan_init(N,
+                                  window_num,
+                                  1.,
+                                  dlnk,
+                                  k0,
+                                  1./(k0*exp((N-1)*dlnk)),
+                                  nonlinear_sigma_window_lnmellin,
+                                  window,
+                                  pfmp,
+                                  pnl->error_message),
+             pnl->error_message,
+             pnl->error_message);
+
+  return _SUCCESS_;
+}
+
+/**
+ * Tabulate integrals of the linear power spectrum times window
+ * functions,
+ *
+ * \f[ I(R) = \int \frac{k^3 P(k)}{2\pi^2} W(kR) d\ln k, \f]
+ *
+ * for all values of R at once, with the logarithmic convolutions of
+ * FFTLog (see fft_mellin()) in \f$ O(N \ln N) \f$ operations. The
+ * table covers the values of R inverse to the values of k.
+ *
+ * @param pnl      Input: pointer to nonlinear structure
+ * @param pfmp     Input: plan prepared by nonlinear_sigma_plan_init() for the same k_size
+ * @param lnpk_l   Input: logarithm of the linear power spectrum
+ * @param ddlnpk_l Input: its second derivative with respect to ln(k)
+ * @param k_size   Input: number of values of k of lnpk_l
+ * @param pst      Output: table, to be freed with nonlinear_sigma_table_free()
+ * @return the error status
+ */
+
+int nonlinear_sigma_table_init(
+                               struct nonlinear * pnl,
+                               struct fft_mellin_plan * pfmp,
+                               double * lnpk_l,
+                               double * ddlnpk_l,
+                               int k_size,
+                               struct nonlinear_sigma_table * pst
+                               ) {
+
+  int k_num,N,pad,i,index_k,index_R,index_window;
+  int last_index=0;
+  double lnk,lnpk;
+  double * f;
+  double * g;
+  double * work;
+
+  N = pfmp->N;
+  k_num = (int)(log(pnl->k[k_size-1]/pnl->k[0])/pfmp->dlnx)+1;
+  pad = (N-k_num)/2;
+
+  class_alloc(f,N*sizeof(double),pnl->error_message);
+  class_alloc(g,pfmp->kernel_num*N*sizeof(double),pnl->error_message);
+  class_alloc(work,4*N*sizeof(double),pnl->error_message);
+
+  /** - fill the integrand, zero outside the range of lnpk_l */
+
+  for (i=0; i<N; i++) {
+
+    index_k = i-pad;
+
+    if ((index_k < 0) || (index_k >= k_num)) {
+      f[i] = 0.;
+      continue;
+    }
+
+    lnk = MIN(pnl->ln_k[0]+index_k*pfmp->dlnx,pnl->ln_k[k_size-1]);
+
+    if (index_k == 0) {
+      lnpk = lnpk_l[0];
+    }
+    else {
+      class_call(array_interpolate_spline_hunt(
+                                               pnl->ln_k,
+                                               k_size,
+                                               lnpk_l,
+                                               ddlnpk_l,
+                                               1,
+                                               lnk,
+                                               &last_index,
+                                               &lnpk,
+                                               1,
+                                               pnl->error_message),
+                 pnl->error_message,
+                 pnl->error_message);
+    }
+
+    f[i] = exp(3.*lnk+lnpk)/(2.*_PI_*_PI_);
+  }
+
+  /** - logarithmic convolutions with the window functions */
+
+  class_call(fft_mellin(pfmp,f,g,work,pnl->error_message),
+             pnl->error_message,
+             pnl->error_message);
+
+  /** - keep the values R_j = 1/k_{N-1-j} for k_{N-1-j} in the range of lnpk_l, and spline them */
+
+  pst->R_size = k_num;
+  pst->window_num = pfmp->kernel_num;
+
+  class_alloc(pst->lnR,pst->R_size*sizeof(double),pnl->error_message);
+  class_alloc(pst->value,pst->R_size*pst->window_num*sizeof(double),pnl->error_message);
+  class_alloc(pst->ddvalue,pst->R_size*pst->window_num*sizeof(double),pnl->error_message);
+
+  for (index_R=0; index_R<pst->R_size; index_R++) {
+    i = N-pad-k_num+index_R;
+    pst->lnR[index_R] = log(pfmp->y0)+i*pfmp->dlnx;
+    for (index_window=0; index_window<pst->window_num; index_window++)
+      pst->value[index_R*pst->window_num+index_window] = g[index_window*N+i];
+  }
+
+  class_call(array_spline_table_lines(pst->lnR,
+                                      pst->R_size,
+                                      pst->value,
+                                      pst->window_num,
+                                      pst->ddvalue,
+                                      _SPLINE_EST_DERIV_,
+                                      pnl->error_message),
+             pnl->error_message,
+             pnl->error_message);
+
+  free(f);
+  free(g);
+  free(work);
+
+  return _SUCCESS_;
+}
+
+/**
+ * Interpolate a table prepared by nonlinear_sigma_table_init() at a
+ * given R.
+ *
+ * @param pnl    Input: pointer to nonlinear structure
+ * @param pst    Input: table
+ * @param R      Input: radius in Mpc
+ * @param result Output: integral for each window function at this radius (array of size pst->window_num)
+ * @return the error status
+ */
+
+int nonlinear_sigma_table_at_R(
+                               struct nonlinear * pnl,
+                               struct nonlinear_sigma_table * pst,
+                               double R,
+                               double * result
+                               ) {
+
+  int last_index;
+
+  class_test((log(R) < pst->lnR[0]) || (log(R) > pst->lnR[pst->R_size-1]),
+             pnl->error_message,
+             "R=%e Mpc is outside the range [%e, %e] Mpc of the table of sigma(R), which is inverse to the range of k",
+             R,exp(pst->lnR[0]),exp(pst->lnR[pst->R_size-1]));
+
+  class_call(array_interpolate_spline(pst->lnR,
+                                      pst->R_size,
+                                      pst->value,
+                                      pst->ddvalue,
+                                      pst->window_num,
+                                      log(R),
+                                      &last_index,
+                                      result,
+                                      pst->window_num,
+                                      pnl->error_message),
+             pnl->error_message,
+             pnl->error_message);
+
+  return _SUCCESS_;
+}
+
+/**
+ * Free the arrays of a table prepared by nonlinear_sigma_table_init().
+ *
+ * @param pst Input: table
+ * @return the error status
+ */
+
+int nonlinear_sigma_table_free(
+                               struct nonlinear_sigma_table * pst
+                               ) {
+
+  free(pst->lnR);
+  free(pst->value);
+  free(pst->ddvalue);
+
+  return _SUCCESS_;
+}
 
-  switch (sigma_output) {
+/**
+ * Logarithm of the Mellin transform \f$ \int_0^\infty x^{s-1} W(x) dx
+ * \f$ of the window functions of nonlinear_sigma_plan_init(), in the
+ * format expected by fft_mellin_plan_init():
+ *
+ * - top-hat, \f$ W = [3 (\sin x - x \cos x)/x^3]^2 \f$: \f$ \frac{9
+ *   \sqrt{\pi}}{4} \frac{\Gamma(s/2) \Gamma(2-s/2)}{\Gamma(5/2-s/2)
+ *   \Gamma(4-s/2)} \f$, for 0 < Re(s) < 4,
+ * - its logarithmic derivative \f$ x dW/dx \f$, giving \f$ d\sigma^2/d\ln
+ *   R \f$: -s times the previous one,
+ * - halofit, \f$ W = e^{-x^2} \f$, \f$ 2x^2 e^{-x^2} \f$ and \f$ 4
+ *   x^2 (1-x^2) e^{-x^2} \f$: \f$ \Gamma(s/2)/2 \f$, \f$ \Gamma(s/2+1)
+ *   \f$ and \f$ -s \Gamma(s/2+1) \f$, for 0 < Re(s).
+ *
+ * @param re           Input: real part of s
+ * @param im           Input: imaginary part of s
+ * @param index_window Input: index of the window function
+ * @param parameters   Input: array of enum sigma_window
+ * @param lnre         Output: real part of the logarithm
+ * @param lnim         Output: imaginary part of the logarithm
+ */
 
-  case out_sigma:
-    *result = sqrt(*result/(2.*_PI_*_PI_));
-    break;
+void nonlinear_sigma_window_lnmellin(
+                                     double re,
+                                     double im,
+                                     int index_window,
+                                     void * parameters,
+                                     double * lnre,
+                                     double * lnim
+                                     ) {
 
-  case out_sigma_prime:
-    *result = *result/(2.*_PI_*_PI_);
+  double lnre1,lnim1,lnre2,lnim2,lnre3,lnim3,lnre4,lnim4;
+
+  switch (((enum sigma_window *)parameters)[index_window]) {
+
+  case sw_top_hat:
+    fft_lngamma(0.5*re,0.5*im,&lnre1,&lnim1);
+    fft_lngamma(2.-0.5*re,-0.5*im,&lnre2,&lnim2);
+    fft_lngamma(2.5-0.5*re,-0.5*im,&lnre3,&lnim3);
+    fft_lngamma(4.-0.5*re,-0.5*im,&lnre4,&lnim4);
+    *lnre = log(9.*sqrt(_PI_)/4.)+lnre1+lnre2-lnre3-lnre4;
+    *lnim = lnim1+lnim2-lnim3-lnim4;
     break;
 
-  case out_sigma_disp:
-    *result = sqrt(*result/(2.*_PI_*_PI_*3.));
+  case sw_top_hat_dlnR:
+    fft_lngamma(0.5*re,0.5*im,&lnre1,&lnim1);
+    fft_lngamma(2.-0.5*re,-0.5*im,&lnre2,&lnim2);
+    fft_lngamma(2.5-0.5*re,-0.5*im,&lnre3,&lnim3);
+    fft_lngamma(4.-0.5*re,-0.5*im,&lnre4,&lnim4);
+    *lnre = log(9.*sqrt(_PI_)/4.)+lnre1+lnre2-lnre3-lnre4+0.5*log(re*re+im*im);
+    *lnim = lnim1+lnim2-lnim3-lnim4+atan2(-im,-re);
     break;
-  }
 
-  /** - free allocated array */
+  case sw_halofit_one:
+    fft_lngamma(0.5*re,0.5*im,&lnre1,&lnim1);
+    *lnre = lnre1-log(2.);
+    *lnim = lnim1;
+    break;
 
-  free(array_for_sigma);
+  case sw_halofit_two:
+    fft_lngamma(0.5*re+1.,0.5*im,&lnre1,&lnim1);
+    *lnre = lnre1;
+    *lnim = lnim1;
+    break;
 
-  return _SUCCESS_;
+  case sw_halofit_three:
+    fft_lngamma(0.5*re+1.,0.5*im,&lnre1,&lnim1);
+    *lnre = lnre1+0.5*log(re*re+im*im);
+    *lnim = lnim1+atan2(-im,-re);
+    break;
+  }
 }
 
 /**
@@ -2602,6 +3511,9 @@ int nonlinear_halofit(
 
   double * w_and_Omega;
 
+  struct nonlinear_sigma_table halofit_table_fftlog;
+  struct nonlinear_sigma_table * halofit_table = NULL;
+
   class_alloc(pvecback,pba->bg_size*sizeof(double),pnl->error_message);
 
   if ((pnl->has_pk_m == _TRUE_) && (index_pk == pnl->index_pk_m)) {
@@ -2700,17 +3612,17 @@ int nonlinear_halofit(
     }
     else {
 
-      class_call(array_interpolate_spline(
-                                          pnl->ln_k,
-                                          pnl->k_size,
-                                          lnpk_l,
-                                          ddlnpk_l,
-                                          1,
-                                          log(k_integrand),
-                                          &last_index,
-                                          &lnpk_integrand,
-                                          1,
-                                          pnl->error_message),
+      class_call(array_interpolate_spline_hunt(
+                                               pnl->ln_k,
+                                               pnl->k_size,
+                                               lnpk_l,
+                                               ddlnpk_l,
+                                               1,
+                                               log(k_integrand),
+                                               &last_index,
+                                               &lnpk_integrand,
+                                               1,
+                                               pnl->error_message),
                  pnl->error_message,
                  pnl->error_message);
     }
@@ -2720,6 +3632,24 @@ int nonlinear_halofit(
 
   }
 
+  /* with sigma_method=sm_fftlog, the three integrals are instead
+     tabulated once for all values of R, and interpolated at each step
+     of the bisection below */
+
+  if (ppr->sigma_method == sm_fftlog) {
+
+    halofit_table = &halofit_table_fftlog;
+
+    class_call(nonlinear_sigma_table_init(pnl,
+                                          &(pnl->sigma_plan_halofit),
+                                          lnpk_l,
+                                          ddlnpk_l,
+                                          pnl->k_size,
+                                          halofit_table),
+               pnl->error_message,
+               pnl->error_message);
+  }
+
   class_call(background_at_tau(pba,tau,pba->long_info,pba->inter_normal,&last_index,pvecback),
              pba->error_message,
              pnl->error_message);
@@ -2758,6 +3688,7 @@ int nonlinear_halofit(
                                          index_ia_ddsum,
                                          R,
                                          halofit_integral_one,
+                                         halofit_table,
                                          &sum1
                                          ),
              pnl->error_message,
@@ -2785,6 +3716,8 @@ int nonlinear_halofit(
     * nl_corr_not_computable_at_this_k = _TRUE_;
     free(pvecback);
     free(integrand_array);
+    if (halofit_table != NULL)
+      nonlinear_sigma_table_free(halofit_table);
     return _SUCCESS_;
   }
   else {
@@ -2816,6 +3749,7 @@ int nonlinear_halofit(
                                          index_ia_ddsum,
                                          R,
                                          halofit_integral_one,
+                                         halofit_table,
                                          &sum1
                                          ),
              pnl->error_message,
@@ -2846,6 +3780,7 @@ int nonlinear_halofit(
                                            index_ia_ddsum,
                                            rmid,
                                            halofit_integral_one,
+                                           halofit_table,
                                            &sum1
                                            ),
                pnl->error_message,
@@ -2889,6 +3824,7 @@ int nonlinear_halofit(
                                          index_ia_ddsum,
                                          rmid,
                                          halofit_integral_two,
+                                         halofit_table,
                                          &sum2
                                          ),
              pnl->error_message,
@@ -2905,6 +3841,7 @@ int nonlinear_halofit(
                                          index_ia_ddsum,
                                          rmid,
                                          halofit_integral_three,
+                                         halofit_table,
                                          &sum3
                                          ),
              pnl->error_message,
@@ -2983,6 +3920,13 @@ int nonlinear_halofit(
 
   free(pvecback);
   free(integrand_array);
+
+  if (halofit_table != NULL) {
+    class_call(nonlinear_sigma_table_free(halofit_table),
+               pnl->error_message,
+               pnl->error_message);
+  }
+
   return _SUCCESS_;
 }
 
@@ -3001,6 +3945,7 @@ int nonlinear_halofit(
  * @param index_ia_ddsum  Input: index for its spline
  * @param R               Input: radius
  * @param type            Input: which window function to use
+ * @param halofit_table   Input: if not NULL, table of nonlinear_sigma_table_init() for the three halofit windows, interpolated instead of integrating
  * @param sum             Output: result of the integral
  * @return the error status
  */
@@ -3016,12 +3961,22 @@ int nonlinear_halofit_integrate(
                                 int index_ia_ddsum,
                                 double R,
                                 enum halofit_integral_type type,
+                                struct nonlinear_sigma_table * halofit_table,
                                 double * sum
                                 ) {
 
   double k,pk,x2,integrand;
   int index_k;
   double anorm = 1./(2*pow(_PI_,2));
+  double sums[3];
+
+  if (halofit_table != NULL) {
+    class_call(nonlinear_sigma_table_at_R(pnl,halofit_table,R,sums),
+               pnl->error_message,
+               pnl->error_message);
+    *sum = sums[type];
+    return _SUCCESS_;
+  }
 
   for (index_k=0; index_k < integrand_size; index_k++) {
     k = integrand_array[index_k*ia_size + index_ia_k];
@@ -3154,6 +4109,12 @@ int nonlinear_hmcode(
   double * nu_arr;
 
   double * p1h_integrand;
+  double * nu_eta;
+  double * mass_hmf;
+  double * window_nfw_mass;
+  int * nfw_index_c = NULL;
+  double * nfw_weight_c = NULL;
+  double * nfw_series = NULL;
 
 
   /** include precision parameters that control the number of entries in the growth and sigma tables */
@@ -3273,28 +4234,28 @@ int nonlinear_hmcode(
     r_real[index_mass] = r;
     r_virial[index_mass] = r_real[index_mass]/pow(Delta_v, 1./3.);
 
-    class_call(array_interpolate_spline(pnw->rtab,
-                                        nsig,
-                                        pnw->stab,
-                                        pnw->ddstab,
-                                        1,
-                                        r,
-                                        &last_index,
-                                        &sig,
-                                        1,
-                                        pnl->error_message),
+    class_call(array_interpolate_spline_hunt(pnw->rtab,
+                                             nsig,
+                                             pnw->stab,
+                                             pnw->ddstab,
+                                             1,
+                                             r,
+                                             &last_index,
+                                             &sig,
+                                             1,
+                                             pnl->error_message),
                pnl->error_message, pnl->error_message);
 
-    class_call(array_interpolate_spline(pnw->rtab,
-                                        nsig,
-                                        pnw->stab,
-                                        pnw->ddstab,
-                                        1,
-                                        r*fraction,
-                                        &last_index,
-                                        &sigf,
-                                        1,
-                                        pnl->error_message),
+    class_call(array_interpolate_spline_hunt(pnw->rtab,
+                                             nsig,
+                                             pnw->stab,
+                                             pnw->ddstab,
+                                             1,
+                                             r*fraction,
+                                             &last_index,
+                                             &sigf,
+                                             1,
+                                             pnl->error_message),
                pnl->error_message, pnl->error_message);
 
     nu=delta_c/sig;
@@ -3462,33 +4423,80 @@ int nonlinear_hmcode(
   i++;
   index_ncol=i;
 
-  for (index_k = 0; index_k < pnl->k_size; index_k++){
+  /* the quantities depending only on the mass (nu^eta, and mass
+     times the halo mass function) are the same for all k: compute
+     them once, so that the loop over k below only evaluates the
+     window function */
+
+  class_alloc(p1h_integrand,index_cut*index_ncol*sizeof(double),pnl->error_message);
+  class_alloc(nu_eta,index_cut*sizeof(double),pnl->error_message);
+  class_alloc(mass_hmf,index_cut*sizeof(double),pnl->error_message);
 
-    class_alloc(p1h_integrand,index_cut*index_ncol*sizeof(double),pnl->error_message);
+  for (index_mass=0; index_mass<index_cut; index_mass++){
+    //get the value of the halo mass function
+    class_call(nonlinear_hmcode_halomassfunction(
+                                                 nu_arr[index_mass],
+                                                 &gst),
+               pnl->error_message, pnl->error_message);
+
+    nu_eta[index_mass] = pow(nu_arr[index_mass], eta);
+    mass_hmf[index_mass] = mass[index_mass]*gst;
+    p1h_integrand[index_mass*index_ncol+index_nu] = nu_arr[index_mass];
+  }
+
+  /* with the table of the NFW window, its interpolation weights in
+     the direction of the concentration also depend only on the mass */
+
+  class_alloc(window_nfw_mass,index_cut*sizeof(double),pnl->error_message);
+
+  if (pnw->nfw_table != NULL) {
+
+    class_alloc(nfw_index_c,index_cut*sizeof(int),pnl->error_message);
+    class_alloc(nfw_weight_c,4*index_cut*sizeof(double),pnl->error_message);
+    class_alloc(nfw_series,index_cut*sizeof(double),pnl->error_message);
+
+    nonlinear_hmcode_nfw_table_weights(pnw->nfw_table,
+                                       index_cut,
+                                       conc,
+                                       nfw_index_c,
+                                       nfw_weight_c,
+                                       nfw_series);
+  }
+
+  for (index_k = 0; index_k < pnl->k_size; index_k++){
 
     pk_lin = exp(lnpk_l[index_pk][index_k])*pow(pnl->k[index_k],3)*anorm; //convert P_k to Delta_k^2
 
-    for (index_mass=0; index_mass<index_cut; index_mass++){ //Calculates the integrand for the ph1 integral at all nu values
-      //get the nu^eta-value of the window
-      class_call(nonlinear_hmcode_window_nfw(
-                                             pnl,
-                                             pow(nu_arr[index_mass], eta)*pnl->k[index_k],
-                                             r_virial[index_mass],
-                                             conc[index_mass],
-                                             &window_nfw),
+    /* get the window at k nu^eta for all masses */
+    if (pnw->nfw_table != NULL) {
+      class_call(nonlinear_hmcode_window_nfw_table(pnl,
+                                                   pnw->nfw_table,
+                                                   index_cut,
+                                                   pnl->k[index_k],
+                                                   nu_eta,
+                                                   r_virial,
+                                                   conc,
+                                                   nfw_index_c,
+                                                   nfw_weight_c,
+                                                   nfw_series,
+                                                   window_nfw_mass),
                  pnl->error_message, pnl->error_message);
-      //get the value of the halo mass function
-      class_call(nonlinear_hmcode_halomassfunction(
-                                                   nu_arr[index_mass],
-                                                   &gst),
-                 pnl->error_message, pnl->error_message);
-
-      p1h_integrand[index_mass*index_ncol+index_nu] = nu_arr[index_mass];
+    }
+    else {
+      for (index_mass=0; index_mass<index_cut; index_mass++){
+        class_call(nonlinear_hmcode_window_nfw(
+                                               pnl,
+                                               nu_eta[index_mass]*pnl->k[index_k],
+                                               r_virial[index_mass],
+                                               conc[index_mass],
+                                               &(window_nfw_mass[index_mass])),
+                   pnl->error_message, pnl->error_message);
+      }
+    }
 
-      p1h_integrand[index_mass*index_ncol+index_y] = mass[index_mass]*gst*pow(window_nfw, 2.);
-      //if ((tau==pba->conformal_age) && (index_k == 0)) {
-      //fprintf(stdout, "%d %e %e\n", index_cut, p1h_integrand[index_mass*index_ncol+index_nu], p1h_integrand[index_mass*index_ncol+index_y]);
-      //}
+    for (index_mass=0; index_mass<index_cut; index_mass++){ //Calculates the integrand for the ph1 integral at all nu values
+      window_nfw = window_nfw_mass[index_mass];
+      p1h_integrand[index_mass*index_ncol+index_y] = mass_hmf[index_mass]*window_nfw*window_nfw;
     }
     class_call(array_spline(p1h_integrand,
                             index_ncol,
@@ -3531,8 +4539,16 @@ int nonlinear_hmcode(
     }
     if (pk_2h<0.) pk_2h=0.;
     pk_nl[index_k] = pow((pow(pk_1h, alpha) + pow(pk_2h, alpha)), (1./alpha))/pow(pnl->k[index_k],3)/anorm; //converted back to P_k
+  }
 
-    free(p1h_integrand);
+  free(p1h_integrand);
+  free(nu_eta);
+  free(mass_hmf);
+  free(window_nfw_mass);
+  if (pnw->nfw_table != NULL) {
+    free(nfw_index_c);
+    free(nfw_weight_c);
+    free(nfw_series);
   }
 
   // print parameter values
@@ -3575,7 +4591,10 @@ int nonlinear_hmcode(
 }
 
 /**
- * allocate and fill arrays of nonlinear workspace (currently used only by HMcode)
+ * allocate and fill arrays of nonlinear workspace (currently used only
+ * by HMcode): growth table and dark energy correction (taken from the
+ * previous run when the background is the same), and table of the NFW
+ * window
  *
  * @param ppr         Input: pointer to precision structure
  * @param pba         Input: pointer to background structure
@@ -3593,6 +4612,7 @@ int nonlinear_hmcode_workspace_init(
 
   int ng;
   int index_pk;
+  short found;
 
   /** - allocate arrays of the nonlinear workspace */
 
@@ -3618,12 +4638,39 @@ int nonlinear_hmcode_workspace_init(
         class_alloc(pnw->sigma_prime[index_pk],pnl->tau_size*sizeof(double),pnl->error_message);
   }
 
-  /** - fill table with scale independent growth factor */
+  /** - fill table with scale independent growth factor, and compute
+        the dark energy correction, unless they were computed by the
+        previous run with the same background */
 
-  class_call(nonlinear_hmcode_fill_growtab(ppr,pba,pnl,pnw),
+  class_call(nonlinear_hmcode_growth_cache_restore(ppr,pba,pnl,pnw,&found),
              pnl->error_message,
              pnl->error_message);
 
+  if (found == _FALSE_) {
+
+    class_call(nonlinear_hmcode_fill_growtab(ppr,pba,pnl,pnw),
+               pnl->error_message,
+               pnl->error_message);
+
+    class_call(nonlinear_hmcode_dark_energy_correction(ppr,pba,pnl,pnw),
+               pnl->error_message,
+               pnl->error_message);
+
+    class_call(nonlinear_hmcode_growth_cache_store(ppr,pba,pnl,pnw),
+               pnl->error_message,
+               pnl->error_message);
+  }
+
+  /** - get the table of the NFW window (computed only by the first run of the process) */
+
+  pnw->nfw_table = NULL;
+
+  if (ppr->hmcode_nfw_x_per_decade > 0.) {
+    class_call(nonlinear_hmcode_nfw_table_acquire(ppr,pnl,&(pnw->nfw_table)),
+               pnl->error_message,
+               pnl->error_message);
+  }
+
   return _SUCCESS_;
 }
 
@@ -3823,6 +4870,7 @@ int nonlinear_hmcode_fill_sigtab(
   double sig;
   double * sigtab;
   int i, index_r, index_sig, index_ddsig, index_n, nsig;
+  struct nonlinear_sigma_table st;
 
   rmin = ppr->rmin_for_sigtab/pba->h;
   rmax = ppr->rmax_for_sigtab/pba->h;
@@ -3839,19 +4887,39 @@ int nonlinear_hmcode_fill_sigtab(
 
   class_alloc((sigtab),(nsig*index_n*sizeof(double)),pnl->error_message);
 
+  /* with sigma_method=sm_fftlog, sigma(r) is computed for all r at once */
+  if (ppr->sigma_method == sm_fftlog) {
+    class_call(nonlinear_sigma_table_init(pnl,
+                                          &(pnl->sigma_plan_top_hat),
+                                          lnpk_l,
+                                          ddlnpk_l,
+                                          pnl->k_size_extra,
+                                          &st),
+               pnl->error_message,
+               pnl->error_message);
+  }
+
   for (i=0;i<nsig;i++){
     r=exp(log(rmin)+log(rmax/rmin)*i/(nsig-1));
 
-    class_call(nonlinear_sigmas(pnl,
-                                r,
-                                lnpk_l,
-                                ddlnpk_l,
-                                pnl->k_size_extra,
-                                ppr->sigma_k_per_decade,
-                                out_sigma,
-                                &sig),
-               pnl->error_message,
-               pnl->error_message);
+    if (ppr->sigma_method == sm_fftlog) {
+      class_call(nonlinear_sigma_table_at_R(pnl,&st,r,&sig),
+                 pnl->error_message,
+                 pnl->error_message);
+      sig = sqrt(sig);
+    }
+    else {
+      class_call(nonlinear_sigmas(pnl,
+                                  r,
+                                  lnpk_l,
+                                  ddlnpk_l,
+                                  pnl->k_size_extra,
+                                  ppr->sigma_k_per_decade,
+                                  out_sigma,
+                                  &sig),
+                 pnl->error_message,
+                 pnl->error_message);
+    }
 
     sigtab[i*index_n+index_r]=r;
     sigtab[i*index_n+index_sig]=sig;
@@ -3867,22 +4935,22 @@ int nonlinear_hmcode_fill_sigtab(
 						  pnl->error_message),
              pnl->error_message,
              pnl->error_message);
-  if (index_tau == pnl->tau_size-1){
-    for (i=0;i<nsig;i++){
-      pnw->rtab[i] = sigtab[i*index_n+index_r];
-      pnw->stab[i] = sigtab[i*index_n+index_sig];
-      pnw->ddstab[i] = sigtab[i*index_n+index_ddsig];
-    }
-  }
-  else{
-    for (i=0;i<nsig;i++){
-      pnw->stab[i] = sigtab[i*index_n+index_sig];
-      pnw->ddstab[i] = sigtab[i*index_n+index_ddsig];
-    }
+  /* rtab is the same at all times, but each thread has its own
+     workspace and may start at any time: always fill it */
+  for (i=0;i<nsig;i++){
+    pnw->rtab[i] = sigtab[i*index_n+index_r];
+    pnw->stab[i] = sigtab[i*index_n+index_sig];
+    pnw->ddstab[i] = sigtab[i*index_n+index_ddsig];
   }
 
   free(sigtab);
 
+  if (ppr->sigma_method == sm_fftlog) {
+    class_call(nonlinear_sigma_table_free(&st),
+               pnl->error_message,
+               pnl->error_message);
+  }
+
   return _SUCCESS_;
 }
 
@@ -3946,6 +5014,180 @@ int nonlinear_hmcode_fill_growtab(
   return _SUCCESS_;
 }
 
+/**
+ * Look for the growth table and dark energy correction of HMcode in
+ * the cache filled by the previous run with
+ * nonlinear_hmcode_growth_cache_store(). They are found when the
+ * precision parameters of the growth table, z_infinity and the
+ * background table are identical (so that parameters of later
+ * modules, or HMcode parameters like eta_0 and c_min, can change). In
+ * that case they are copied into the workspace.
+ *
+ * @param ppr   Input: pointer to precision structure
+ * @param pba   Input: pointer to background structure
+ * @param pnl   Input: pointer to nonlinear structure
+ * @param pnw   Output: pointer to nonlinear workspace
+ * @param found Output: _TRUE_ if the quantities were found in the cache
+ * @return the error status
+ */
+
+int nonlinear_hmcode_growth_cache_restore(
+                                          struct precision * ppr,
+                                          struct background * pba,
+                                          struct nonlinear * pnl,
+                                          struct nonlinear_workspace * pnw,
+                                          short * found
+                                          ) {
+
+  struct hmcode_growth_cache * pcache = &nonlinear_growth_cache;
+  int ng = ppr->n_hmcode_tables;
+
+  *found = _FALSE_;
+
+#pragma omp critical (hmcode_growth_cache)
+  {
+    if (nonlinear_hmcode_growth_cache_match(ppr,pba,pnl) == _TRUE_) {
+      memcpy(pnw->growtable,pcache->growtable,ng*sizeof(double));
+      memcpy(pnw->ztable,pcache->ztable,ng*sizeof(double));
+      memcpy(pnw->tautable,pcache->tautable,ng*sizeof(double));
+      pnw->dark_energy_correction = pcache->dark_energy_correction;
+      *found = _TRUE_;
+    }
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Store a copy of the growth table and dark energy correction just
+ * computed, together with their inputs, replacing the previous content
+ * of the cache.
+ *
+ * @param ppr Input: pointer to precision structure
+ * @param pba Input: pointer to background structure
+ * @param pnl Input: pointer to nonlinear structure
+ * @param pnw Input: pointer to nonlinear workspace
+ * @return the error status
+ */
+
+int nonlinear_hmcode_growth_cache_store(
+                                        struct precision * ppr,
+                                        struct background * pba,
+                                        struct nonlinear * pnl,
+                                        struct nonlinear_workspace * pnw
+                                        ) {
+
+  int status = _SUCCESS_;
+
+#pragma omp critical (hmcode_growth_cache)
+  {
+    status = nonlinear_hmcode_growth_cache_fill(ppr,pba,pnl,pnw);
+  }
+
+  return status;
+}
+
+/**
+ * Replace the content of the cache (called within the critical
+ * section hmcode_growth_cache).
+ *
+ * @param ppr Input: pointer to precision structure
+ * @param pba Input: pointer to background structure
+ * @param pnl Input: pointer to nonlinear structure
+ * @param pnw Input: pointer to nonlinear workspace
+ * @return the error status
+ */
+
+static int nonlinear_hmcode_growth_cache_fill(
+                                              struct precision * ppr,
+                                              struct background * pba,
+                                              struct nonlinear * pnl,
+                                              struct nonlinear_workspace * pnw
+                                              ) {
+
+  struct hmcode_growth_cache * pcache = &nonlinear_growth_cache;
+  int ng = ppr->n_hmcode_tables;
+
+  if (pcache->has_growth == _TRUE_) {
+    free(pcache->background_table);
+    free(pcache->growtable);
+    free(pcache->ztable);
+    free(pcache->tautable);
+    pcache->has_growth = _FALSE_;
+  }
+
+  class_alloc(pcache->background_table,pba->bt_size*pba->bg_size*sizeof(double),pnl->error_message);
+  class_alloc(pcache->growtable,ng*sizeof(double),pnl->error_message);
+  class_alloc(pcache->ztable,ng*sizeof(double),pnl->error_message);
+  class_alloc(pcache->tautable,ng*sizeof(double),pnl->error_message);
+
+  memcpy(pcache->background_table,pba->background_table,pba->bt_size*pba->bg_size*sizeof(double));
+  memcpy(pcache->growtable,pnw->growtable,ng*sizeof(double));
+  memcpy(pcache->ztable,pnw->ztable,ng*sizeof(double));
+  memcpy(pcache->tautable,pnw->tautable,ng*sizeof(double));
+
+  pcache->bt_size = pba->bt_size;
+  pcache->bg_size = pba->bg_size;
+  pcache->n_hmcode_tables = ng;
+  pcache->ainit_for_growtab = ppr->ainit_for_growtab;
+  pcache->amax_for_growtab = ppr->amax_for_growtab;
+  pcache->z_infinity = pnl->z_infinity;
+  pcache->has_fld = pba->has_fld;
+  pcache->w0_fld = pba->w0_fld;
+  pcache->wa_fld = pba->wa_fld;
+  pcache->Omega0_m = pba->Omega0_m;
+  pcache->Omega0_k = pba->Omega0_k;
+  pcache->Omega0_de = pba->Omega0_de;
+  pcache->dark_energy_correction = pnw->dark_energy_correction;
+
+  pcache->has_growth = _TRUE_;
+
+  return _SUCCESS_;
+}
+
+/**
+ * Check whether the cached growth table was computed with the same
+ * inputs as the current run (called within the critical section
+ * hmcode_growth_cache): the background table, and the background
+ * parameters read by nonlinear_hmcode_dark_energy_correction().
+ *
+ * @param ppr Input: pointer to precision structure
+ * @param pba Input: pointer to background structure
+ * @param pnl Input: pointer to nonlinear structure
+ * @return _TRUE_ if all inputs are identical
+ */
+
+static short nonlinear_hmcode_growth_cache_match(
+                                                 struct precision * ppr,
+                                                 struct background * pba,
+                                                 struct nonlinear * pnl
+                                                 ) {
+
+  struct hmcode_growth_cache * pcache = &nonlinear_growth_cache;
+
+  if (pcache->has_growth == _FALSE_)
+    return _FALSE_;
+
+  if ((pcache->n_hmcode_tables != ppr->n_hmcode_tables) ||
+      (pcache->ainit_for_growtab != ppr->ainit_for_growtab) ||
+      (pcache->amax_for_growtab != ppr->amax_for_growtab) ||
+      (pcache->z_infinity != pnl->z_infinity) ||
+      (pcache->has_fld != pba->has_fld) ||
+      (pcache->w0_fld != pba->w0_fld) ||
+      (pcache->wa_fld != pba->wa_fld) ||
+      (pcache->Omega0_m != pba->Omega0_m) ||
+      (pcache->Omega0_k != pba->Omega0_k) ||
+      (pcache->Omega0_de != pba->Omega0_de) ||
+      (pcache->bt_size != pba->bt_size) ||
+      (pcache->bg_size != pba->bg_size))
+    return _FALSE_;
+
+  if (memcmp(pcache->background_table,pba->background_table,pba->bt_size*pba->bg_size*sizeof(double)) != 0)
+    return _FALSE_;
+
+  return _TRUE_;
+}
+
 /**
  * This function finds the scale independent growth factor by
  * integrating the approximate relation d(lnD)/d(lna) =
@@ -4118,6 +5360,263 @@ int nonlinear_hmcode_window_nfw(
   return _SUCCESS_;
 }
 
+/**
+ * Get the table of the NFW window with the resolution set by the
+ * precision parameters hmcode_nfw_x_per_decade and
+ * hmcode_nfw_c_per_decade. The tables are computed at the first
+ * request and then kept until the end of the process, read-only, for
+ * all later runs (including runs in concurrent threads).
+ *
+ * @param ppr  Input: pointer to precision structure
+ * @param pnl  Input: pointer to nonlinear structure
+ * @param ppnt Output: pointer to the table
+ * @return the error status
+ */
+
+int nonlinear_hmcode_nfw_table_acquire(
+                                       struct precision * ppr,
+                                       struct nonlinear * pnl,
+                                       struct hmcode_nfw_table ** ppnt
+                                       ) {
+
+  struct hmcode_nfw_table * pnt;
+  int status = _SUCCESS_;
+
+#pragma omp critical (hmcode_nfw_table)
+  {
+    for (pnt = nonlinear_nfw_table_first; pnt != NULL; pnt = pnt->next) {
+      if ((pnt->x_per_decade == ppr->hmcode_nfw_x_per_decade) &&
+          (pnt->c_per_decade == ppr->hmcode_nfw_c_per_decade))
+        break;
+    }
+
+    if (pnt == NULL) {
+      pnt = malloc(sizeof(struct hmcode_nfw_table));
+      if (pnt == NULL) {
+        sprintf(pnl->error_message,"%s(L:%d) : could not allocate the table of the NFW window",__func__,__LINE__);
+        status = _FAILURE_;
+      }
+      else {
+        status = nonlinear_hmcode_nfw_table_init(pnl,
+                                                 ppr->hmcode_nfw_x_per_decade,
+                                                 ppr->hmcode_nfw_c_per_decade,
+                                                 pnt);
+        if (status == _SUCCESS_) {
+          pnt->next = nonlinear_nfw_table_first;
+          nonlinear_nfw_table_first = pnt;
+        }
+        else {
+          free(pnt);
+          pnt = NULL;
+        }
+      }
+    }
+  }
+
+  *ppnt = pnt;
+
+  return status;
+}
+
+/**
+ * Fill a table of the NFW window. The range of x covers the values
+ * between the small-x expansion (below _HMCODE_NFW_Y_MIN_) and the
+ * direct evaluation (above _HMCODE_NFW_Y_MAX_) for all concentrations
+ * in [_HMCODE_NFW_C_MIN_, _HMCODE_NFW_C_MAX_], with two extra points on
+ * each side for the four-point interpolation.
+ *
+ * @param pnl          Input: pointer to nonlinear structure (for error messages)
+ * @param x_per_decade Input: number of points per decade in x
+ * @param c_per_decade Input: number of points per decade in c
+ * @param pnt          Output: table
+ * @return the error status
+ */
+
+int nonlinear_hmcode_nfw_table_init(
+                                    struct nonlinear * pnl,
+                                    double x_per_decade,
+                                    double c_per_decade,
+                                    struct hmcode_nfw_table * pnt
+                                    ) {
+
+  int index_x,index_c;
+  double lnx_max,lnc_max,c;
+
+  pnt->x_per_decade = x_per_decade;
+  pnt->c_per_decade = c_per_decade;
+
+  pnt->dlnx = log(10.)/x_per_decade;
+  pnt->lnx_min = log(_HMCODE_NFW_Y_MIN_/(1.+_HMCODE_NFW_C_MAX_))-2.*pnt->dlnx;
+  lnx_max = log(_HMCODE_NFW_Y_MAX_/(1.+_HMCODE_NFW_C_MIN_));
+  pnt->x_size = (int)ceil((lnx_max-pnt->lnx_min)/pnt->dlnx)+3;
+
+  pnt->dlnc = log(10.)/c_per_decade;
+  pnt->lnc_min = log(_HMCODE_NFW_C_MIN_)-2.*pnt->dlnc;
+  lnc_max = log(_HMCODE_NFW_C_MAX_);
+  pnt->c_size = (int)ceil((lnc_max-pnt->lnc_min)/pnt->dlnc)+3;
+
+  class_alloc(pnt->window,pnt->x_size*pnt->c_size*sizeof(double),pnl->error_message);
+
+  for (index_c=0; index_c<pnt->c_size; index_c++) {
+    c = exp(pnt->lnc_min+index_c*pnt->dlnc);
+    for (index_x=0; index_x<pnt->x_size; index_x++) {
+      /* window at k r_s = x (k=x, r_v=c) */
+      class_call(nonlinear_hmcode_window_nfw(pnl,
+                                             exp(pnt->lnx_min+index_x*pnt->dlnx),
+                                             c,
+                                             c,
+                                             &(pnt->window[index_c*pnt->x_size+index_x])),
+                 pnl->error_message,
+                 pnl->error_message);
+    }
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Prepare the quantities of nonlinear_hmcode_window_nfw_table() that
+ * only depend on the concentration of each halo: the index and
+ * weights of the four-point interpolation in ln(c), and the
+ * coefficient \f$ \langle r^2/r_s^2 \rangle/6 \f$ of the small-x
+ * expansion.
+ *
+ * @param pnt       Input: table
+ * @param mass_size Input: number of halo masses
+ * @param conc      Input: concentration of each halo
+ * @param index_c   Output: index of the first of the four values of c used for each halo (-1 if c is outside the table)
+ * @param weight_c  Output: weights of these four values, weight_c[4*index_mass+i]
+ * @param series    Output: coefficient of the small-x expansion for each halo
+ */
+
+void nonlinear_hmcode_nfw_table_weights(
+                                        struct hmcode_nfw_table * pnt,
+                                        int mass_size,
+                                        double * conc,
+                                        int * index_c,
+                                        double * weight_c,
+                                        double * series
+                                        ) {
+
+  int index_mass,i;
+  double c,u,t;
+
+  for (index_mass=0; index_mass<mass_size; index_mass++) {
+
+    c = conc[index_mass];
+
+    series[index_mass] = (0.5*c*c-2.*c+3.*log(1.+c)-c/(1.+c))/(log(1.+c)-c/(1.+c))/6.;
+
+    if ((c < _HMCODE_NFW_C_MIN_) || (c > _HMCODE_NFW_C_MAX_)) {
+      index_c[index_mass] = -1;
+      continue;
+    }
+
+    u = (log(c)-pnt->lnc_min)/pnt->dlnc;
+    i = (int)u;
+    t = u-i;
+
+    /* Lagrange interpolation on the points i-1, i, i+1, i+2 */
+    index_c[index_mass] = i-1;
+    weight_c[4*index_mass]   = -t*(t-1.)*(t-2.)/6.;
+    weight_c[4*index_mass+1] = (t+1.)*(t-1.)*(t-2.)/2.;
+    weight_c[4*index_mass+2] = -(t+1.)*t*(t-2.)/2.;
+    weight_c[4*index_mass+3] = (t+1.)*t*(t-1.)/6.;
+  }
+}
+
+/**
+ * NFW window for all halo masses at a given wavenumber, as in
+ * nonlinear_hmcode_window_nfw() with the wavenumber multiplied by
+ * \f$ \nu^\eta \f$, but interpolated in the table (or given by its
+ * small-x expansion) instead of computing four sine and cosine
+ * integrals for each halo. The loop over masses is vectorized; the
+ * few halos outside the range of the table are computed directly.
+ *
+ * @param pnl        Input: pointer to nonlinear structure
+ * @param pnt        Input: table
+ * @param mass_size  Input: number of halo masses
+ * @param k          Input: wavenumber
+ * @param nu_eta     Input: \f$ \nu^\eta \f$ for each halo
+ * @param r_virial   Input: virial radius of each halo
+ * @param conc       Input: concentration of each halo
+ * @param index_c    Input: from nonlinear_hmcode_nfw_table_weights()
+ * @param weight_c   Input: from nonlinear_hmcode_nfw_table_weights()
+ * @param series     Input: from nonlinear_hmcode_nfw_table_weights()
+ * @param window_nfw Output: window function of each halo
+ * @return the error status
+ */
+
+int nonlinear_hmcode_window_nfw_table(
+                                      struct nonlinear * pnl,
+                                      struct hmcode_nfw_table * pnt,
+                                      int mass_size,
+                                      double k,
+                                      double * nu_eta,
+                                      double * r_virial,
+                                      double * conc,
+                                      int * index_c,
+                                      double * weight_c,
+                                      double * series,
+                                      double * window_nfw
+                                      ) {
+
+  int index_mass,i,j,n;
+  double x,u,t,wx0,wx1,wx2,wx3;
+  double * w;
+  double * wc;
+
+  n = pnt->x_size;
+
+#pragma omp simd private(x,u,i,j,t,wx0,wx1,wx2,wx3,w,wc)
+  for (index_mass=0; index_mass<mass_size; index_mass++) {
+
+    x = nu_eta[index_mass]*k*r_virial[index_mass]/conc[index_mass];
+
+    /* four-point interpolation in ln(x), indices clamped to the table
+       (the points outside are replaced below) */
+    u = (log(x)-pnt->lnx_min)/pnt->dlnx;
+    u = MAX(1.,MIN(u,n-3.));
+    i = (int)u;
+    t = u-i;
+
+    wx0 = -t*(t-1.)*(t-2.)/6.;
+    wx1 = (t+1.)*(t-1.)*(t-2.)/2.;
+    wx2 = -(t+1.)*t*(t-2.)/2.;
+    wx3 = (t+1.)*t*(t-1.)/6.;
+
+    j = MAX(index_c[index_mass],0);
+    wc = weight_c+4*index_mass;
+    w = pnt->window+j*n+i-1;
+
+    window_nfw[index_mass] =
+      wc[0]*(wx0*w[0]+wx1*w[1]+wx2*w[2]+wx3*w[3])
+      + wc[1]*(wx0*w[n]+wx1*w[n+1]+wx2*w[n+2]+wx3*w[n+3])
+      + wc[2]*(wx0*w[2*n]+wx1*w[2*n+1]+wx2*w[2*n+2]+wx3*w[2*n+3])
+      + wc[3]*(wx0*w[3*n]+wx1*w[3*n+1]+wx2*w[3*n+2]+wx3*w[3*n+3]);
+
+    if (x*(1.+conc[index_mass]) < _HMCODE_NFW_Y_MIN_)
+      window_nfw[index_mass] = 1.-x*x*series[index_mass];
+  }
+
+  for (index_mass=0; index_mass<mass_size; index_mass++) {
+
+    x = nu_eta[index_mass]*k*r_virial[index_mass]/conc[index_mass];
+
+    if ((index_c[index_mass] < 0) || (x*(1.+conc[index_mass]) > _HMCODE_NFW_Y_MAX_)) {
+      class_call(nonlinear_hmcode_window_nfw(pnl,
+                                             nu_eta[index_mass]*k,
+                                             r_virial[index_mass],
+                                             conc[index_mass],
+                                             &(window_nfw[index_mass])),
+                 pnl->error_message,
+                 pnl->error_message);
+    }
+  }
+
+  return _SUCCESS_;
+}
+
 /**
  * This is the Sheth-Tormen halo mass function (1999, MNRAS, 308, 119)
  *
@@ -8,6 +8,7 @@
  *
  * -# output_init() (must be called after spectra_init())
  * -# output_total_cl_at_l() (can be called even before output_init())
+ * -# output_total_cls_at_l_range() (idem)
  *
  * No memory needs to be deallocated after that,
  * hence there is no output_free() routine like in other modules.
@@ -90,6 +91,141 @@ int output_total_cl_at_l(
 
 }
 
+/**
+ * This routine evaluates the total \f$ C_l\f$'s (lensed if available,
+ * as output_total_cl_at_l()) for all types and for each multipole l
+ * of a range, in a single call.
+ *
+ * The lensed spectra are interpolated with a cursor moving along the
+ * table of multipoles. The ranges are checked before any
+ * interpolation, such that the structures are only read and errors
+ * are written in errmsg: several threads can call this function at
+ * the same time on the same structures.
+ *
+ * @param psp    Input: pointer to spectra structure
+ * @param ple    Input: pointer to lensing structure
+ * @param l_min  Input: first multipole
+ * @param l_max  Input: last multipole
+ * @param cl     Output: \f$ C_l\f$'s, cl[(l-l_min)*psp->ct_size+index_ct] (must be already allocated)
+ * @param errmsg Output: error message
+ * @return the error status
+ */
+
+int output_total_cls_at_l_range(
+                                struct spectra * psp,
+                                struct lensing * ple,
+                                int l_min,
+                                int l_max,
+                                double * cl,
+                                ErrorMsg errmsg
+                                ){
+
+  double ** cl_md_ic; /* array with argument
+                         cl_md_ic[index_md][index_ic1_ic2*psp->ct_size+index_ct] */
+
+  double ** cl_md;    /* array with argument
+                         cl_md[index_md][index_ct] */
+
+  double * cl_l;
+  int index_md,index_lt,l,last_index;
+
+  class_test(l_max < l_min,
+             errmsg,
+             "empty range of multipoles [%d,%d]",l_min,l_max);
+
+  if (ple->has_lensed_cls == _TRUE_) {
+
+    class_test((l_min < ple->l[0]) || (l_max > ple->l_lensed_max),
+               errmsg,
+               "you asked for lensed Cls for l in [%d,%d], they were computed only for l in [%d,%d], you should increase l_max_scalars or decrease the precision parameter delta_l_max",
+               l_min,l_max,(int)ple->l[0],ple->l_lensed_max);
+
+    last_index = -1;
+
+    for (l=l_min; l<=l_max; l++) {
+
+      cl_l = cl+(long)(l-l_min)*psp->ct_size;
+
+      class_call(array_interpolate_spline_hunt(ple->l,
+                                               ple->l_size,
+                                               ple->cl_lens,
+                                               ple->ddcl_lens,
+                                               ple->lt_size,
+                                               l,
+                                               &last_index,
+                                               cl_l,
+                                               ple->lt_size,
+                                               errmsg),
+                 errmsg,
+                 errmsg);
+
+      /* set to zero for the types such that l<l_max */
+      for (index_lt=0; index_lt<ple->lt_size; index_lt++)
+        if (l > ple->l_max_lt[index_lt])
+          cl_l[index_lt]=0.;
+    }
+  }
+  else {
+
+    /* spectra_cl_at_l() can only fail below the first multipole of the table */
+    class_test(l_min < psp->l[0],
+               errmsg,
+               "you asked for Cls at l=%d, they were computed only from l=%d",
+               l_min,(int)psp->l[0]);
+
+    class_alloc(cl_md_ic,
+                psp->md_size*sizeof(double *),
+                errmsg);
+
+    class_alloc(cl_md,
+                psp->md_size*sizeof(double *),
+                errmsg);
+
+    for (index_md = 0; index_md < psp->md_size; index_md++) {
+
+      if (psp->md_size > 1)
+
+        class_alloc(cl_md[index_md],
+                    psp->ct_size*sizeof(double),
+                    errmsg);
+
+      if (psp->ic_size[index_md] > 1)
+
+        class_alloc(cl_md_ic[index_md],
+                    psp->ic_ic_size[index_md]*psp->ct_size*sizeof(double),
+                    errmsg);
+    }
+
+    for (l=l_min; l<=l_max; l++) {
+
+      class_call(spectra_cl_at_l(psp,
+                                 (double)l,
+                                 cl+(long)(l-l_min)*psp->ct_size,
+                                 cl_md,
+                                 cl_md_ic),
+                 psp->error_message,
+                 errmsg);
+    }
+
+    for (index_md = 0; index_md < psp->md_size; index_md++) {
+
+      if (psp->md_size > 1)
+        free(cl_md[index_md]);
+
+      if (psp->ic_size[index_md] > 1)
+        free(cl_md_ic[index_md]);
+
+    }
+
+    free(cl_md_ic);
+    free(cl_md);
+
+  }
+
+  return _SUCCESS_;
+
+}
+
 /**
  * This routine writes the output in files.
  *
@@ -119,9 +255,13 @@ int output_init(
 
   /** Summary: */
 
+  /** - define local variables */
+
+  int abort;
+
   /** - check that we really want to output at least one file */
 
-  if ((ppt->has_cls == _FALSE_) && (ppt->has_pk_matter == _FALSE_) && (ppt->has_density_transfers == _FALSE_) && (ppt->has_velocity_transfers == _FALSE_) && (pop->write_background == _FALSE_) && (pop->write_thermodynamics == _FALSE_) && (pop->write_primordial == _FALSE_)) {
+  if ((ppt->has_cls == _FALSE_) && (ppt->has_pk_matter == _FALSE_) && (ppt->has_density_transfers == _FALSE_) && (ppt->has_velocity_transfers == _FALSE_) && (pop->write_background == _FALSE_) && (pop->write_thermodynamics == _FALSE_) && (pop->write_perturbations == _FALSE_) && (pop->write_primordial == _FALSE_)) {
     if (pop->output_verbose > 0)
       printf("No output files requested. Output module skipped.\n");
     return _SUCCESS_;
@@ -131,81 +271,134 @@ int output_init(
       printf("Writing output files in %s... \n",pop->root);
   }
 
-  /** - deal with all anisotropy power spectra \f$ C_l\f$'s */
+  /** - write the files in parallel: each group of files below is
+      written by one OpenMP task, and output_pk() and output_tk()
+      spawn in turn one task per redshift. Each task works with its
+      own copy of the output structure, so that errors are reported in
+      distinct strings; the first of them is copied into
+      pop->error_message by class_call_critical(). */
 
-  if (ppt->has_cls == _TRUE_) {
+  abort = _FALSE_;
 
-    class_call(output_cl(pba,ppt,psp,ple,pop),
-               pop->error_message,
-               pop->error_message);
-  }
+#pragma omp parallel shared(abort)
+  {
+#pragma omp single
+    {
 
-  /** - deal with all Fourier matter power spectra P(k)'s */
+      /** - deal with all anisotropy power spectra \f$ C_l\f$'s */
 
-  if (ppt->has_pk_matter == _TRUE_) {
+      if (ppt->has_cls == _TRUE_) {
 
-    class_call(output_pk(pba,ppt,pnl,pop,pk_linear),
-               pop->error_message,
-               pop->error_message);
+#pragma omp task shared(abort)
+        {
+          struct output op_task = *pop;
 
-    if (pnl->method != nl_none) {
+          class_call_critical(output_cl(pba,ppt,psp,ple,&op_task),
+                              op_task.error_message,
+                              pop->error_message);
+        }
+      }
 
-      class_call(output_pk(pba,ppt,pnl,pop,pk_nonlinear),
-                 pop->error_message,
-                 pop->error_message);
+      /** - deal with all Fourier matter power spectra P(k)'s */
 
-    }
-  }
+      if (ppt->has_pk_matter == _TRUE_) {
 
-  /** - deal with density and matter power spectra */
+#pragma omp task shared(abort)
+        {
+          struct output op_task = *pop;
 
-  if ((ppt->has_density_transfers == _TRUE_) || (ppt->has_velocity_transfers == _TRUE_)) {
+          class_call_critical(output_pk(pba,ppt,pnl,&op_task,pk_linear),
+                              op_task.error_message,
+                              pop->error_message);
+        }
 
-    class_call(output_tk(pba,ppt,pop),
-               pop->error_message,
-               pop->error_message);
+        if (pnl->method != nl_none) {
 
-  }
+#pragma omp task shared(abort)
+          {
+            struct output op_task = *pop;
 
-  /** - deal with background quantities */
+            class_call_critical(output_pk(pba,ppt,pnl,&op_task,pk_nonlinear),
+                                op_task.error_message,
+                                pop->error_message);
+          }
+        }
+      }
 
-  if (pop->write_background == _TRUE_) {
+      /** - deal with density and matter power spectra */
 
-    class_call(output_background(pba,pop),
-               pop->error_message,
-               pop->error_message);
+      if ((ppt->has_density_transfers == _TRUE_) || (ppt->has_velocity_transfers == _TRUE_)) {
 
-  }
+#pragma omp task shared(abort)
+        {
+          struct output op_task = *pop;
 
-  /** - deal with thermodynamics quantities */
+          class_call_critical(output_tk(pba,ppt,&op_task),
+                              op_task.error_message,
+                              pop->error_message);
+        }
+      }
 
-  if (pop->write_thermodynamics == _TRUE_) {
+      /** - deal with background quantities */
 
-    class_call(output_thermodynamics(pba,pth,pop),
-               pop->error_message,
-               pop->error_message);
+      if (pop->write_background == _TRUE_) {
 
-  }
+#pragma omp task shared(abort)
+        {
+          struct output op_task = *pop;
 
-  /** - deal with perturbation quantities */
+          class_call_critical(output_background(pba,&op_task),
+                              op_task.error_message,
+                              pop->error_message);
+        }
+      }
 
-  if (pop->write_perturbations == _TRUE_) {
+      /** - deal with thermodynamics quantities */
 
-    class_call(output_perturbations(pba,ppt,pop),
-               pop->error_message,
-               pop->error_message);
+      if (pop->write_thermodynamics == _TRUE_) {
 
-  }
+#pragma omp task shared(abort)
+        {
+          struct output op_task = *pop;
+
+          class_call_critical(output_thermodynamics(pba,pth,&op_task),
+                              op_task.error_message,
+                              pop->error_message);
+        }
+      }
 
-  /** - deal with primordial spectra */
+      /** - deal with perturbation quantities */
 
-  if (pop->write_primordial == _TRUE_) {
+      if (pop->write_perturbations == _TRUE_) {
 
-    class_call(output_primordial(ppt,ppm,pop),
-               pop->error_message,
-               pop->error_message);
+#pragma omp task shared(abort)
+        {
+          struct output op_task = *pop;
 
-  }
+          class_call_critical(output_perturbations(pba,ppt,&op_task),
+                              op_task.error_message,
+                              pop->error_message);
+        }
+      }
+
+      /** - deal with primordial spectra */
+
+      if (pop->write_primordial == _TRUE_) {
+
+#pragma omp task shared(abort)
+        {
+          struct output op_task = *pop;
+
+          class_call_critical(output_primordial(ppt,ppm,&op_task),
+                              op_task.error_message,
+                              pop->error_message);
+        }
+      }
+
+    } /* end of single region; all tasks are completed at the implicit barrier below */
+  } /* end of parallel region */
+
+  if (abort == _TRUE_) return _FAILURE_;
 
   return _SUCCESS_;
 
@@ -615,8 +808,98 @@ int output_pk(
 
   /** - define local variables */
 
+  int index_z;
+  int index_pk;
+  int abort;
+
+  char type_suffix[9];     // 6 is enough to write "pk_cb_nl" plus closing character \0
+
+  /** - check that all requested redshifts z_pk are consistent */
+
+  for (index_z = 0; index_z < pop->z_pk_num; index_z++) {
+
+    class_test((pop->z_pk[index_z] > ppt->z_max_pk),
+               pop->error_message,
+               "P(k,z) computed up to z=%f but requested at z=%f. Must increase z_max_pk in precision file.",ppt->z_max_pk,pop->z_pk[index_z]);
+  }
+
+  abort = _FALSE_;
+
+  /** - loop over pk type (_cb, _m) */
+
+  for (index_pk=0; index_pk<pnl->pk_size; index_pk++) {
+
+    if ((pnl->has_pk_m == _TRUE_) && (index_pk == pnl->index_pk_m)) {
+      if (pk_output == pk_linear)
+        sprintf(type_suffix,"pk");
+      else
+        sprintf(type_suffix,"pk_nl");
+    }
+    if ((pnl->has_pk_cb == _TRUE_) && (index_pk == pnl->index_pk_cb)) {
+      if (pk_output == pk_linear)
+        sprintf(type_suffix,"pk_cb");
+      else
+        sprintf(type_suffix,"pk_cb_nl");
+    }
+
+    /** - loop over z: the files of each redshift are written by a
+        separate task (executed immediately when this function is not
+        called from a parallel region) */
+
+    for (index_z = 0; index_z < pop->z_pk_num; index_z++) {
+
+#pragma omp task firstprivate(index_pk,index_z,type_suffix) shared(pba,ppt,pnl,pop,abort)
+      {
+        struct output op_task = *pop;
+
+        class_call_critical(output_pk_at_z(pba,ppt,pnl,&op_task,pk_output,index_pk,index_z,type_suffix),
+                            op_task.error_message,
+                            pop->error_message);
+      }
+
+    } /* end loop over index_z */
+
+  } /* end loop over index_pk */
+
+#pragma omp taskwait
+
+  if (abort == _TRUE_) return _FAILURE_;
+
+  return _SUCCESS_;
+}
+
+/**
+ * This routines writes the files for one type of Fourier matter power
+ * spectrum P(k) at one of the redshifts z_pk (the total spectrum, and
+ * if needed the contribution of each pair of initial conditions).
+ *
+ * @param pba         Input: pointer to background structure
+ * @param ppt         Input: pointer perturbation structure
+ * @param pnl         Input: pointer to nonlinear structure
+ * @param pop         Input: pointer to output structure
+ * @param pk_output   Input: pk_linear or pk_nonlinear
+ * @param index_pk    Input: index of the pk type (_cb, _m)
+ * @param index_z     Input: index of the redshift in pop->z_pk
+ * @param type_suffix Input: file name suffix of this pk type ("pk", "pk_cb_nl", ...)
+ */
+
+int output_pk_at_z(
+                   struct background * pba,
+                   struct perturbs * ppt,
+                   struct nonlinear * pnl,
+                   struct output * pop,
+                   enum pk_outputs pk_output,
+                   int index_pk,
+                   int index_z,
+                   char * type_suffix
+                   ) {
+
+  /** Summary: */
+
+  /** - define local variables */
+
   FILE ** out_pk_ic = NULL;  /* out_pk_ic[index_ic1_ic2] is a pointer to a file with P(k) for each pair of ic */
-  FILE * out_pk;             /* out_pk[index_pk] is a pointer to a file with total P(k) summed over ic */
+  FILE * out_pk;             /* out_pk is a pointer to a file with total P(k) summed over ic */
 
   double * ln_pk_ic = NULL;  /* array ln_pk_ic[index_k * pnl->ic_ic_size + index_ic1_ic2] */
   double * ln_pk;            /* array ln_pk[index_k] */
@@ -624,13 +907,10 @@ int output_pk(
   int index_ic1,index_ic2;
   int index_ic1_ic2=0;
   int index_k;
-  int index_z;
-  int index_pk;
 
   FileName file_name;
 
-  char redshift_suffix[7]; // 7 is enough to write "z%d_" as long as there are at most 10'000 bins
-  char type_suffix[9];     // 6 is enough to write "pk_cb_nl" plus closing character \0
+  char redshift_suffix[14]; // 14 is enough to write "z%d_" for any int
   char first_line[_LINE_LENGTH_MAX_];
   short do_ic = _FALSE_;
 
@@ -658,217 +938,185 @@ int output_pk(
                 pop->error_message);
   }
 
-  /** - loop over pk type (_cb, _m) */
-
-  for (index_pk=0; index_pk<pnl->pk_size; index_pk++) {
-
-    if ((pnl->has_pk_m == _TRUE_) && (index_pk == pnl->index_pk_m)) {
-      if (pk_output == pk_linear)
-        sprintf(type_suffix,"pk");
-      else
-        sprintf(type_suffix,"pk_nl");
-    }
-    if ((pnl->has_pk_cb == _TRUE_) && (index_pk == pnl->index_pk_cb)) {
-      if (pk_output == pk_linear)
-        sprintf(type_suffix,"pk_cb");
-      else
-        sprintf(type_suffix,"pk_cb_nl");
-    }
-
-    /** - loop over z */
-
-    for (index_z = 0; index_z < pop->z_pk_num; index_z++) {
-
-      /** - first, check that requested redshift z_pk is consistent */
-
-      class_test((pop->z_pk[index_z] > ppt->z_max_pk),
-                 pop->error_message,
-                 "P(k,z) computed up to z=%f but requested at z=%f. Must increase z_max_pk in precision file.",ppt->z_max_pk,pop->z_pk[index_z]);
-
-      if (pop->z_pk_num == 1)
-        redshift_suffix[0]='\0';
-      else
-        sprintf(redshift_suffix,"z%d_",index_z+1);
+  if (pop->z_pk_num == 1)
+    redshift_suffix[0]='\0';
+  else
+    sprintf(redshift_suffix,"z%d_",index_z+1);
 
-      /** - second, open only the relevant files and write a header in each of them */
+  /** - first, open only the relevant files and write a header in each of them */
 
-      sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,".dat");
+  sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,".dat");
 
-      class_call(output_open_pk_file(pba,
-                                     pnl,
-                                     pop,
-                                     &out_pk,
-                                     file_name,
-                                     "",
-                                     pop->z_pk[index_z]
-                                     ),
-                 pop->error_message,
-                 pop->error_message);
+  class_call(output_open_pk_file(pba,
+                                 pnl,
+                                 pop,
+                                 &out_pk,
+                                 file_name,
+                                 "",
+                                 pop->z_pk[index_z]
+                                 ),
+             pop->error_message,
+             pop->error_message);
 
-      if (do_ic == _TRUE_) {
+  if (do_ic == _TRUE_) {
 
-        for (index_ic1 = 0; index_ic1 < pnl->ic_size; index_ic1++) {
+    for (index_ic1 = 0; index_ic1 < pnl->ic_size; index_ic1++) {
 
-          for (index_ic2 = index_ic1; index_ic2 < pnl->ic_size; index_ic2++) {
+      for (index_ic2 = index_ic1; index_ic2 < pnl->ic_size; index_ic2++) {
 
-            if ((ppt->has_ad == _TRUE_) && (index_ic1 == ppt->index_ic_ad) && (index_ic2 == ppt->index_ic_ad)) {
-              sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_ad.dat");
-              strcpy(first_line,"for adiabatic (AD) mode ");
-            }
+        if ((ppt->has_ad == _TRUE_) && (index_ic1 == ppt->index_ic_ad) && (index_ic2 == ppt->index_ic_ad)) {
+          sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_ad.dat");
+          strcpy(first_line,"for adiabatic (AD) mode ");
+        }
 
-            if ((ppt->has_bi == _TRUE_) && (index_ic1 == ppt->index_ic_bi) && (index_ic2 == ppt->index_ic_bi)) {
-              sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_bi.dat");
-              strcpy(first_line,"for baryon isocurvature (BI) mode ");
-            }
+        if ((ppt->has_bi == _TRUE_) && (index_ic1 == ppt->index_ic_bi) && (index_ic2 == ppt->index_ic_bi)) {
+          sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_bi.dat");
+          strcpy(first_line,"for baryon isocurvature (BI) mode ");
+        }
 
-            if ((ppt->has_cdi == _TRUE_) && (index_ic1 == ppt->index_ic_cdi) && (index_ic2 == ppt->index_ic_cdi)) {
-              sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_cdi.dat");
-              strcpy(first_line,"for CDM isocurvature (CDI) mode ");
-            }
+        if ((ppt->has_cdi == _TRUE_) && (index_ic1 == ppt->index_ic_cdi) && (index_ic2 == ppt->index_ic_cdi)) {
+          sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_cdi.dat");
+          strcpy(first_line,"for CDM isocurvature (CDI) mode ");
+        }
 
-            if ((ppt->has_nid == _TRUE_) && (index_ic1 == ppt->index_ic_nid) && (index_ic2 == ppt->index_ic_nid)) {
-              sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_nid.dat");
-              strcpy(first_line,"for neutrino density isocurvature (NID) mode ");
-            }
+        if ((ppt->has_nid == _TRUE_) && (index_ic1 == ppt->index_ic_nid) && (index_ic2 == ppt->index_ic_nid)) {
+          sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_nid.dat");
+          strcpy(first_line,"for neutrino density isocurvature (NID) mode ");
+        }
 
-            if ((ppt->has_niv == _TRUE_) && (index_ic1 == ppt->index_ic_niv) && (index_ic2 == ppt->index_ic_niv)) {
-              sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_niv.dat");
-              strcpy(first_line,"for neutrino velocity isocurvature (NIV) mode ");
-            }
+        if ((ppt->has_niv == _TRUE_) && (index_ic1 == ppt->index_ic_niv) && (index_ic2 == ppt->index_ic_niv)) {
+          sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_niv.dat");
+          strcpy(first_line,"for neutrino velocity isocurvature (NIV) mode ");
+        }
 
-            if ((ppt->has_ad == _TRUE_) && (ppt->has_bi == _TRUE_) && (index_ic1 == ppt->index_ic_ad) && (index_ic2 == ppt->index_ic_bi)) {
-              sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_ad_bi.dat");
-              strcpy(first_line,"for cross ADxBI mode ");
-            }
+        if ((ppt->has_ad == _TRUE_) && (ppt->has_bi == _TRUE_) && (index_ic1 == ppt->index_ic_ad) && (index_ic2 == ppt->index_ic_bi)) {
+          sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_ad_bi.dat");
+          strcpy(first_line,"for cross ADxBI mode ");
+        }
 
-            if ((ppt->has_ad == _TRUE_) && (ppt->has_cdi == _TRUE_) && (index_ic1 == ppt->index_ic_ad) && (index_ic2 == ppt->index_ic_cdi)) {
-              sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_ad_cdi.dat");
-              strcpy(first_line,"for cross ADxCDI mode ");
-            }
+        if ((ppt->has_ad == _TRUE_) && (ppt->has_cdi == _TRUE_) && (index_ic1 == ppt->index_ic_ad) && (index_ic2 == ppt->index_ic_cdi)) {
+          sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_ad_cdi.dat");
+          strcpy(first_line,"for cross ADxCDI mode ");
+        }
 
-            if ((ppt->has_ad == _TRUE_) && (ppt->has_nid == _TRUE_) && (index_ic1 == ppt->index_ic_ad) && (index_ic2 == ppt->index_ic_nid)) {
-              sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_ad_nid.dat");
-              strcpy(first_line,"for scalar cross ADxNID mode ");
-            }
+        if ((ppt->has_ad == _TRUE_) && (ppt->has_nid == _TRUE_) && (index_ic1 == ppt->index_ic_ad) && (index_ic2 == ppt->index_ic_nid)) {
+          sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_ad_nid.dat");
+          strcpy(first_line,"for scalar cross ADxNID mode ");
+        }
 
-            if ((ppt->has_ad == _TRUE_) && (ppt->has_niv == _TRUE_) && (index_ic1 == ppt->index_ic_ad) && (index_ic2 == ppt->index_ic_niv)) {
-              sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_ad_niv.dat");
-              strcpy(first_line,"for cross ADxNIV mode ");
-            }
+        if ((ppt->has_ad == _TRUE_) && (ppt->has_niv == _TRUE_) && (index_ic1 == ppt->index_ic_ad) && (index_ic2 == ppt->index_ic_niv)) {
+          sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_ad_niv.dat");
+          strcpy(first_line,"for cross ADxNIV mode ");
+        }
 
-            if ((ppt->has_bi == _TRUE_) && (ppt->has_cdi == _TRUE_) && (index_ic1 == ppt->index_ic_bi) && (index_ic2 == ppt->index_ic_cdi)) {
-              sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_bi_cdi.dat");
-              strcpy(first_line,"for cross BIxCDI mode ");
-            }
+        if ((ppt->has_bi == _TRUE_) && (ppt->has_cdi == _TRUE_) && (index_ic1 == ppt->index_ic_bi) && (index_ic2 == ppt->index_ic_cdi)) {
+          sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_bi_cdi.dat");
+          strcpy(first_line,"for cross BIxCDI mode ");
+        }
 
-            if ((ppt->has_bi == _TRUE_) && (ppt->has_nid == _TRUE_) && (index_ic1 == ppt->index_ic_bi) && (index_ic2 == ppt->index_ic_nid)) {
-              sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_bi_nid.dat");
-              strcpy(first_line,"for cross BIxNID mode ");
-            }
+        if ((ppt->has_bi == _TRUE_) && (ppt->has_nid == _TRUE_) && (index_ic1 == ppt->index_ic_bi) && (index_ic2 == ppt->index_ic_nid)) {
+          sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_bi_nid.dat");
+          strcpy(first_line,"for cross BIxNID mode ");
+        }
 
-            if ((ppt->has_bi == _TRUE_) && (ppt->has_niv == _TRUE_) && (index_ic1 == ppt->index_ic_bi) && (index_ic2 == ppt->index_ic_niv)) {
-              sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_bi_niv.dat");
-              strcpy(first_line,"for cross BIxNIV mode ");
-            }
+        if ((ppt->has_bi == _TRUE_) && (ppt->has_niv == _TRUE_) && (index_ic1 == ppt->index_ic_bi) && (index_ic2 == ppt->index_ic_niv)) {
+          sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_bi_niv.dat");
+          strcpy(first_line,"for cross BIxNIV mode ");
+        }
 
-            if ((ppt->has_cdi == _TRUE_) && (ppt->has_nid == _TRUE_) && (index_ic1 == ppt->index_ic_cdi) && (index_ic2 == ppt->index_ic_nid)) {
-              sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_cdi_nid.dat");
-              strcpy(first_line,"for cross CDIxNID mode ");
-            }
+        if ((ppt->has_cdi == _TRUE_) && (ppt->has_nid == _TRUE_) && (index_ic1 == ppt->index_ic_cdi) && (index_ic2 == ppt->index_ic_nid)) {
+          sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_cdi_nid.dat");
+          strcpy(first_line,"for cross CDIxNID mode ");
+        }
 
-            if ((ppt->has_cdi == _TRUE_) && (ppt->has_niv == _TRUE_) && (index_ic1 == ppt->index_ic_cdi) && (index_ic2 == ppt->index_ic_niv)) {
-              sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_cdi_niv.dat");
-              strcpy(first_line,"for cross CDIxNIV mode ");
-            }
+        if ((ppt->has_cdi == _TRUE_) && (ppt->has_niv == _TRUE_) && (index_ic1 == ppt->index_ic_cdi) && (index_ic2 == ppt->index_ic_niv)) {
+          sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_cdi_niv.dat");
+          strcpy(first_line,"for cross CDIxNIV mode ");
+        }
 
-            if ((ppt->has_nid == _TRUE_) && (ppt->has_niv == _TRUE_) && (index_ic1 == ppt->index_ic_nid) && (index_ic2 == ppt->index_ic_niv)) {
-              sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_nid_niv.dat");
-              strcpy(first_line,"for cross NIDxNIV mode ");
-            }
+        if ((ppt->has_nid == _TRUE_) && (ppt->has_niv == _TRUE_) && (index_ic1 == ppt->index_ic_nid) && (index_ic2 == ppt->index_ic_niv)) {
+          sprintf(file_name,"%s%s%s%s",pop->root,redshift_suffix,type_suffix,"_nid_niv.dat");
+          strcpy(first_line,"for cross NIDxNIV mode ");
+        }
 
-            index_ic1_ic2 = index_symmetric_matrix(index_ic1,index_ic2,pnl->ic_size);
+        index_ic1_ic2 = index_symmetric_matrix(index_ic1,index_ic2,pnl->ic_size);
 
-            if (pnl->is_non_zero[index_ic1_ic2] == _TRUE_) {
+        if (pnl->is_non_zero[index_ic1_ic2] == _TRUE_) {
 
-              class_call(output_open_pk_file(pba,
-                                             pnl,
-                                             pop,
-                                             &(out_pk_ic[index_ic1_ic2]),
-                                             file_name,
-                                             first_line,
-                                             pop->z_pk[index_z]
-                                             ),
-                         pop->error_message,
-                         pop->error_message);
-            }
-          }
+          class_call(output_open_pk_file(pba,
+                                         pnl,
+                                         pop,
+                                         &(out_pk_ic[index_ic1_ic2]),
+                                         file_name,
+                                         first_line,
+                                         pop->z_pk[index_z]
+                                         ),
+                     pop->error_message,
+                     pop->error_message);
         }
       }
+    }
+  }
 
-      /** - third, compute P(k) for each k */
-
-      class_call(nonlinear_pk_at_z(pba,
-                                   pnl,
-                                   logarithmic,
-                                   pk_output,
-                                   pop->z_pk[index_z],
-                                   index_pk,
-                                   ln_pk,
-                                   ln_pk_ic
-                                   ),
-                 pnl->error_message,
-                 pop->error_message);
+  /** - second, compute P(k) for each k */
+
+  class_call(nonlinear_pk_at_z(pba,
+                               pnl,
+                               logarithmic,
+                               pk_output,
+                               pop->z_pk[index_z],
+                               index_pk,
+                               ln_pk,
+                               ln_pk_ic
+                               ),
+             pnl->error_message,
+             pop->error_message);
 
-      /** - fourth, write in files */
+  /** - third, write in files */
 
-      for (index_k=0; index_k<pnl->k_size; index_k++) {
+  for (index_k=0; index_k<pnl->k_size; index_k++) {
 
-        class_call(output_one_line_of_pk(out_pk,
-                                         exp(pnl->ln_k[index_k])/pba->h,
-                                         exp(ln_pk[index_k])*pow(pba->h,3)
-                                         ),
-                   pop->error_message,
-                   pop->error_message);
+    class_call(output_one_line_of_pk(pop,
+                                     out_pk,
+                                     exp(pnl->ln_k[index_k])/pba->h,
+                                     exp(ln_pk[index_k])*pow(pba->h,3)
+                                     ),
+               pop->error_message,
+               pop->error_message);
 
-        if (do_ic == _TRUE_) {
+    if (do_ic == _TRUE_) {
 
-          for (index_ic1_ic2 = 0; index_ic1_ic2 < pnl->ic_ic_size; index_ic1_ic2++) {
+      for (index_ic1_ic2 = 0; index_ic1_ic2 < pnl->ic_ic_size; index_ic1_ic2++) {
 
-            if (pnl->is_non_zero[index_ic1_ic2] == _TRUE_) {
+        if (pnl->is_non_zero[index_ic1_ic2] == _TRUE_) {
 
-              class_call(output_one_line_of_pk(out_pk_ic[index_ic1_ic2],
-                                               exp(pnl->ln_k[index_k])/pba->h,
-                                               exp(ln_pk_ic[index_k * pnl->ic_ic_size + index_ic1_ic2])*pow(pba->h,3)),
-                         pop->error_message,
-                         pop->error_message);
-            }
-          }
-        }
-      } /* end loop over k */
-
-      /** - fifth, close files */
-
-      fclose(out_pk);
-
-      if (do_ic == _TRUE_) {
-        for (index_ic1_ic2 = 0; index_ic1_ic2 < pnl->ic_ic_size; index_ic1_ic2++) {
-          if (pnl->is_non_zero[index_ic1_ic2] == _TRUE_) {
-            fclose(out_pk_ic[index_ic1_ic2]);
-          }
+          class_call(output_one_line_of_pk(pop,
+                                           out_pk_ic[index_ic1_ic2],
+                                           exp(pnl->ln_k[index_k])/pba->h,
+                                           exp(ln_pk_ic[index_k * pnl->ic_ic_size + index_ic1_ic2])*pow(pba->h,3)),
+                     pop->error_message,
+                     pop->error_message);
         }
       }
+    }
+  } /* end loop over k */
 
-    } /* end loop over index_z */
+  /** - fourth, close files and free arrays */
 
-  } /* end loop over index_pk */
+  fclose(out_pk);
 
-  /* free arrays and pointers */
-  free(ln_pk);
-  if (pk_output == pk_linear) {
+  if (do_ic == _TRUE_) {
+    for (index_ic1_ic2 = 0; index_ic1_ic2 < pnl->ic_ic_size; index_ic1_ic2++) {
+      if (pnl->is_non_zero[index_ic1_ic2] == _TRUE_) {
+        fclose(out_pk_ic[index_ic1_ic2]);
+      }
+    }
     free(ln_pk_ic);
     free(out_pk_ic);
   }
 
+  free(ln_pk);
+
   return _SUCCESS_;
 }
 
@@ -890,24 +1138,10 @@ int output_tk(
 
   /** - define local variables */
   char titles[_MAXTITLESTRINGLENGTH_]={0};
-  double * data;
-  int size_data, number_of_titles;
-
-  FILE * tkfile;
+  int number_of_titles;
 
-  int index_md;
-  int index_ic;
   int index_z;
-
-  double z;
-
-  FileName file_name;
-  char redshift_suffix[7]; // 7 is enough to write "z%d_" as long as there are at most 10'000 bins
-  char first_line[_LINE_LENGTH_MAX_];
-  char ic_suffix[4];   // 4 is enough to write "ad", "bi", "cdi", "nid", "niv", ...
-
-
-  index_md=ppt->index_md_scalars;
+  int abort;
 
   if (pop->output_format == camb_format) {
 
@@ -925,90 +1159,167 @@ int output_tk(
              pba->error_message,
              pop->error_message);
   number_of_titles = get_number_of_titles(titles);
-  size_data = number_of_titles*ppt->k_size[index_md];
 
-  class_alloc(data, sizeof(double)*ppt->ic_size[index_md]*size_data, pop->error_message);
+  /** - check that all requested redshifts z_pk are consistent */
 
   for (index_z = 0; index_z < pop->z_pk_num; index_z++) {
 
-    z = pop->z_pk[index_z];
-
-    /** - first, check that requested redshift z_pk is consistent */
-
     class_test((pop->z_pk[index_z] > ppt->z_max_pk),
                pop->error_message,
                "T_i(k,z) computed up to z=%f but requested at z=%f. Must increase z_max_pk in precision file.",ppt->z_max_pk,pop->z_pk[index_z]);
+  }
 
-    if (pop->z_pk_num == 1)
-      redshift_suffix[0]='\0';
-    else
-      sprintf(redshift_suffix,"z%d_",index_z+1);
-
-    /** - second, open only the relevant files, and write a heading in each of them */
-
-    class_call(perturb_output_data(pba,
-                                      ppt,
-                                      pop->output_format,
-                                      pop->z_pk[index_z],
-                                      number_of_titles,
-                                      data
-                                      ),
-               ppt->error_message,
-               pop->error_message);
+  abort = _FALSE_;
 
-    for (index_ic = 0; index_ic < ppt->ic_size[index_md]; index_ic++) {
+  /** - loop over z: the files of each redshift are written by a
+      separate task (executed immediately when this function is not
+      called from a parallel region) */
 
-      class_call(perturb_output_firstline_and_ic_suffix(ppt, index_ic, first_line, ic_suffix),
-                 ppt->error_message, pop->error_message);
+  for (index_z = 0; index_z < pop->z_pk_num; index_z++) {
 
-      if ((ppt->has_ad == _TRUE_) && (ppt->ic_size[index_md] == 1) )
-        sprintf(file_name,"%s%s%s",pop->root,redshift_suffix,"tk.dat");
-      else
-        sprintf(file_name,"%s%s%s%s%s",pop->root,redshift_suffix,"tk_",ic_suffix,".dat");
-
-      class_open(tkfile, file_name, "w", pop->error_message);
-
-      if (pop->write_header == _TRUE_) {
-        if (pop->output_format == class_format) {
-          fprintf(tkfile,"# Transfer functions T_i(k) %sat redshift z=%g\n",first_line,z);
-          fprintf(tkfile,"# for k=%g to %g h/Mpc,\n",ppt->k[index_md][0]/pba->h,ppt->k[index_md][ppt->k_size[index_md]-1]/pba->h);
-          fprintf(tkfile,"# number of wavenumbers equal to %d\n",ppt->k_size[index_md]);
-          if (ppt->has_density_transfers == _TRUE_) {
-            fprintf(tkfile,"# d_i   stands for (delta rho_i/rho_i)(k,z) with above normalization \n");
-            fprintf(tkfile,"# d_tot stands for (delta rho_tot/rho_tot)(k,z) with rho_Lambda NOT included in rho_tot\n");
-            fprintf(tkfile,"# (note that this differs from the transfer function output from CAMB/CMBFAST, which gives the same\n");
-            fprintf(tkfile,"#  quantities divided by -k^2 with k in Mpc^-1; use format=camb to match CAMB)\n");
-          }
-          if (ppt->has_velocity_transfers == _TRUE_) {
-            fprintf(tkfile,"# t_i   stands for theta_i(k,z) with above normalization \n");
-            fprintf(tkfile,"# t_tot stands for (sum_i [rho_i+p_i] theta_i)/(sum_i [rho_i+p_i]))(k,z)\n");
-          }
-          fprintf(tkfile,"#\n");
-        }
-        else if (pop->output_format == camb_format) {
+#pragma omp task firstprivate(index_z) shared(pba,ppt,pop,titles,number_of_titles,abort)
+    {
+      struct output op_task = *pop;
+
+      class_call_critical(output_tk_at_z(pba,ppt,&op_task,index_z,titles,number_of_titles),
+                          op_task.error_message,
+                          pop->error_message);
+    }
+  }
+
+#pragma omp taskwait
+
+  if (abort == _TRUE_) return _FAILURE_;
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * This routines writes the files of matter transfer functions
+ * \f$ T_i(k)\f$'s at one of the redshifts z_pk (one file per initial
+ * condition).
+ *
+ * @param pba              Input: pointer to background structure
+ * @param ppt              Input: pointer perturbation structure
+ * @param pop              Input: pointer to output structure
+ * @param index_z          Input: index of the redshift in pop->z_pk
+ * @param titles           Input: titles of the columns, as given by perturb_output_titles()
+ * @param number_of_titles Input: number of columns
+ */
+
+int output_tk_at_z(
+                   struct background * pba,
+                   struct perturbs * ppt,
+                   struct output * pop,
+                   int index_z,
+                   char * titles,
+                   int number_of_titles
+                   ) {
+
+  /** Summary: */
+
+  /** - define local variables */
+  double * data;
+  int size_data;
+
+  FILE * tkfile;
+
+  int index_md;
+  int index_ic;
+
+  double z;
+
+  FileName file_name;
+  char redshift_suffix[14]; // 14 is enough to write "z%d_" for any int
+  char first_line[_LINE_LENGTH_MAX_];
+  char ic_suffix[4];   // 4 is enough to write "ad", "bi", "cdi", "nid", "niv", ...
+
+  index_md=ppt->index_md_scalars;
+
+  size_data = number_of_titles*ppt->k_size[index_md];
+
+  class_alloc(data, sizeof(double)*ppt->ic_size[index_md]*size_data, pop->error_message);
+
+  z = pop->z_pk[index_z];
+
+  if (pop->z_pk_num == 1)
+    redshift_suffix[0]='\0';
+  else
+    sprintf(redshift_suffix,"z%d_",index_z+1);
 
-          fprintf(tkfile,"# Rescaled matter transfer functions [-T_i(k)/k^2] %sat redshift z=%g\n",first_line,z);
-          fprintf(tkfile,"# for k=%g to %g h/Mpc,\n",ppt->k[index_md][0]/pba->h,ppt->k[index_md][ppt->k_size[index_md]-1]/pba->h);
-          fprintf(tkfile,"# number of wavenumbers equal to %d\n",ppt->k_size[index_md]);
-          fprintf(tkfile,"# T_i   stands for (delta rho_i/rho_i)(k,z) with above normalization \n");
-          fprintf(tkfile,"# The rescaling factor [-1/k^2] with k in 1/Mpc is here to match the CMBFAST/CAMB output convention\n");
-          fprintf(tkfile,"#\n");
-          fprintf(tkfile,"#");
-          fprintf(tkfile,"\n");
+  /** - first, compute the transfer functions */
 
+  class_call(perturb_output_data(pba,
+                                 ppt,
+                                 pop->output_format,
+                                 pop->z_pk[index_z],
+                                 number_of_titles,
+                                 data
+                                 ),
+             ppt->error_message,
+             pop->error_message);
+
+  /** - second, open only the relevant files, and write a heading in each of them */
+
+  for (index_ic = 0; index_ic < ppt->ic_size[index_md]; index_ic++) {
+
+    class_call(perturb_output_firstline_and_ic_suffix(ppt, index_ic, first_line, ic_suffix),
+               ppt->error_message, pop->error_message);
+
+    if ((ppt->has_ad == _TRUE_) && (ppt->ic_size[index_md] == 1) )
+      sprintf(file_name,"%s%s%s",pop->root,redshift_suffix,"tk.dat");
+    else
+      sprintf(file_name,"%s%s%s%s%s",pop->root,redshift_suffix,"tk_",ic_suffix,".dat");
+
+    if (pop->write_npy == _TRUE_) {
+      class_call(output_print_npy_data(pop,file_name,titles,data+index_ic*size_data,size_data),
+                 pop->error_message,
+                 pop->error_message);
+      continue;
+    }
+
+    class_open(tkfile, file_name, "w", pop->error_message);
+
+    if (pop->write_header == _TRUE_) {
+      if (pop->output_format == class_format) {
+        fprintf(tkfile,"# Transfer functions T_i(k) %sat redshift z=%g\n",first_line,z);
+        fprintf(tkfile,"# for k=%g to %g h/Mpc,\n",ppt->k[index_md][0]/pba->h,ppt->k[index_md][ppt->k_size[index_md]-1]/pba->h);
+        fprintf(tkfile,"# number of wavenumbers equal to %d\n",ppt->k_size[index_md]);
+        if (ppt->has_density_transfers == _TRUE_) {
+          fprintf(tkfile,"# d_i   stands for (delta rho_i/rho_i)(k,z) with above normalization \n");
+          fprintf(tkfile,"# d_tot stands for (delta rho_tot/rho_tot)(k,z) with rho_Lambda NOT included in rho_tot\n");
+          fprintf(tkfile,"# (note that this differs from the transfer function output from CAMB/CMBFAST, which gives the same\n");
+          fprintf(tkfile,"#  quantities divided by -k^2 with k in Mpc^-1; use format=camb to match CAMB)\n");
+        }
+        if (ppt->has_velocity_transfers == _TRUE_) {
+          fprintf(tkfile,"# t_i   stands for theta_i(k,z) with above normalization \n");
+          fprintf(tkfile,"# t_tot stands for (sum_i [rho_i+p_i] theta_i)/(sum_i [rho_i+p_i]))(k,z)\n");
         }
+        fprintf(tkfile,"#\n");
       }
+      else if (pop->output_format == camb_format) {
 
-      output_print_data(tkfile,
-                        titles,
-                        data+index_ic*size_data,
-                        size_data);
-
-      /** - free memory and close files */
-      fclose(tkfile);
+        fprintf(tkfile,"# Rescaled matter transfer functions [-T_i(k)/k^2] %sat redshift z=%g\n",first_line,z);
+        fprintf(tkfile,"# for k=%g to %g h/Mpc,\n",ppt->k[index_md][0]/pba->h,ppt->k[index_md][ppt->k_size[index_md]-1]/pba->h);
+        fprintf(tkfile,"# number of wavenumbers equal to %d\n",ppt->k_size[index_md]);
+        fprintf(tkfile,"# T_i   stands for (delta rho_i/rho_i)(k,z) with above normalization \n");
+        fprintf(tkfile,"# The rescaling factor [-1/k^2] with k in 1/Mpc is here to match the CMBFAST/CAMB output convention\n");
+        fprintf(tkfile,"#\n");
+        fprintf(tkfile,"#");
+        fprintf(tkfile,"\n");
 
+      }
     }
 
+    output_print_data(tkfile,
+                      titles,
+                      data+index_ic*size_data,
+                      size_data);
+
+    /** - free memory and close files */
+    fclose(tkfile);
+
   }
 
   free(data);
@@ -1042,6 +1353,15 @@ int output_background(
              pop->error_message);
 
   sprintf(file_name,"%s%s",pop->root,"background.dat");
+
+  if (pop->write_npy == _TRUE_) {
+    class_call(output_print_npy_data(pop,file_name,titles,data,size_data),
+               pop->error_message,
+               pop->error_message);
+    free(data);
+    return _SUCCESS_;
+  }
+
   class_open(backfile,file_name,"w",pop->error_message);
 
   if (pop->write_header == _TRUE_) {
@@ -1094,6 +1414,15 @@ int output_thermodynamics(
              pop->error_message);
 
   sprintf(file_name,"%s%s",pop->root,"thermodynamics.dat");
+
+  if (pop->write_npy == _TRUE_) {
+    class_call(output_print_npy_data(pop,file_name,titles,data,size_data),
+               pop->error_message,
+               pop->error_message);
+    free(data);
+    return _SUCCESS_;
+  }
+
   class_open(thermofile,file_name,"w",pop->error_message);
 
   if (pop->write_header == _TRUE_) {
@@ -1151,40 +1480,73 @@ int output_perturbations(
       index_md = ppt->index_md_scalars;
       k = ppt->k[index_md][ppt->index_k_output_values[index_md*ppt->k_output_values_num+index_ikout]];
       sprintf(file_name,"%s%s%d%s",pop->root,"perturbations_k",index_ikout,"_s.dat");
-      class_open(out, file_name, "w", ppt->error_message);
-      fprintf(out,"#scalar perturbations for mode k = %.*e Mpc^(-1)\n",_OUTPUTPRECISION_,k);
-      output_print_data(out,
-                        ppt->scalar_titles,
-                        ppt->scalar_perturbations_data[index_ikout],
-                        ppt->size_scalar_perturbation_data[index_ikout]);
-
-      fclose(out);
+      if (pop->write_npy == _TRUE_) {
+        class_call(output_print_npy_data(pop,
+                                         file_name,
+                                         ppt->scalar_titles,
+                                         ppt->scalar_perturbations_data[index_ikout],
+                                         ppt->size_scalar_perturbation_data[index_ikout]),
+                   pop->error_message,
+                   pop->error_message);
+      }
+      else {
+        class_open(out, file_name, "w", ppt->error_message);
+        fprintf(out,"#scalar perturbations for mode k = %.*e Mpc^(-1)\n",_OUTPUTPRECISION_,k);
+        output_print_data(out,
+                          ppt->scalar_titles,
+                          ppt->scalar_perturbations_data[index_ikout],
+                          ppt->size_scalar_perturbation_data[index_ikout]);
+
+        fclose(out);
+      }
     }
     if (ppt->has_vectors == _TRUE_){
       index_md = ppt->index_md_vectors;
       k = ppt->k[index_md][ppt->index_k_output_values[index_md*ppt->k_output_values_num+index_ikout]];
       sprintf(file_name,"%s%s%d%s",pop->root,"perturbations_k",index_ikout,"_v.dat");
-      class_open(out, file_name, "w", ppt->error_message);
-      fprintf(out,"#vector perturbations for mode k = %.*e Mpc^(-1)\n",_OUTPUTPRECISION_,k);
-      output_print_data(out,
-                        ppt->vector_titles,
-                        ppt->vector_perturbations_data[index_ikout],
-                        ppt->size_vector_perturbation_data[index_ikout]);
-
-      fclose(out);
+      if (pop->write_npy == _TRUE_) {
+        class_call(output_print_npy_data(pop,
+                                         file_name,
+                                         ppt->vector_titles,
+                                         ppt->vector_perturbations_data[index_ikout],
+                                         ppt->size_vector_perturbation_data[index_ikout]),
+                   pop->error_message,
+                   pop->error_message);
+      }
+      else {
+        class_open(out, file_name, "w", ppt->error_message);
+        fprintf(out,"#vector perturbations for mode k = %.*e Mpc^(-1)\n",_OUTPUTPRECISION_,k);
+        output_print_data(out,
+                          ppt->vector_titles,
+                          ppt->vector_perturbations_data[index_ikout],
+                          ppt->size_vector_perturbation_data[index_ikout]);
+
+        fclose(out);
+      }
     }
     if (ppt->has_tensors == _TRUE_){
       index_md = ppt->index_md_tensors;
       k = ppt->k[index_md][ppt->index_k_output_values[index_md*ppt->k_output_values_num+index_ikout]];
       sprintf(file_name,"%s%s%d%s",pop->root,"perturbations_k",index_ikout,"_t.dat");
-      class_open(out, file_name, "w", ppt->error_message);
-      fprintf(out,"#tensor perturbations for mode k = %.*e Mpc^(-1)\n",_OUTPUTPRECISION_,k);
-      output_print_data(out,
-                        ppt->tensor_titles,
-                        ppt->tensor_perturbations_data[index_ikout],
-                        ppt->size_tensor_perturbation_data[index_ikout]);
-
-      fclose(out);
+      if (pop->write_npy == _TRUE_) {
+        class_call(output_print_npy_data(pop,
+                                         file_name,
+                                         ppt->tensor_titles,
+                                         ppt->tensor_perturbations_data[index_ikout],
+                                         ppt->size_tensor_perturbation_data[index_ikout]),
+                   pop->error_message,
+                   pop->error_message);
+      }
+      else {
+        class_open(out, file_name, "w", ppt->error_message);
+        fprintf(out,"#tensor perturbations for mode k = %.*e Mpc^(-1)\n",_OUTPUTPRECISION_,k);
+        output_print_data(out,
+                          ppt->tensor_titles,
+                          ppt->tensor_perturbations_data[index_ikout],
+                          ppt->size_tensor_perturbation_data[index_ikout]);
+
+        fclose(out);
+      }
     }
 
 
@@ -1219,6 +1581,14 @@ int output_primordial(
              ppm->error_message,
              pop->error_message);
 
+  if (pop->write_npy == _TRUE_) {
+    class_call(output_print_npy_data(pop,file_name,titles,data,size_data),
+               pop->error_message,
+               pop->error_message);
+    free(data);
+    return _SUCCESS_;
+  }
+
   class_open(out,file_name,"w",pop->error_message);
   if (pop->write_header == _TRUE_) {
     fprintf(out,"# Dimensionless primordial spectrum, equal to [k^3/2pi^2] P(k) \n");
@@ -1243,7 +1613,7 @@ int output_print_data(FILE *out,
   int colnum=1, number_of_titles;
   int index_title, index_tau;
   char thetitle[_MAXTITLESTRINGLENGTH_];
-  char *pch;
+  char *pch,*saveptr;
 
   /** Summary*/
 
@@ -1251,10 +1621,10 @@ int output_print_data(FILE *out,
   fprintf(out,"#");
 
   strcpy(thetitle,titles);
-  pch = strtok(thetitle,_DELIMITER_);
+  pch = strtok_r(thetitle,_DELIMITER_,&saveptr);
   while (pch != NULL){
     class_fprintf_columntitle(out, pch, _TRUE_, colnum);
-    pch = strtok(NULL,_DELIMITER_);
+    pch = strtok_r(NULL,_DELIMITER_,&saveptr);
   }
   fprintf(out,"\n");
 
@@ -1273,6 +1643,182 @@ int output_print_data(FILE *out,
 }
 
 
+/**
+ * This routine opens a binary file in the NumPy .npy format (version
+ * 1.0), and writes its header. The extension .dat of the file name,
+ * if any, is replaced by .npy. The file contains a one-dimensional
+ * array of (rows) records, with one double-precision field for each
+ * column title: once the data has been written record after record
+ * (e.g. with output_one_value()), numpy.load() (possibly with
+ * mmap_mode='r') returns a structured array whose fields are the
+ * columns, and the data starts at an offset equal to the size of the
+ * header, a multiple of 64 bytes.
+ *
+ * @param pop      Input: pointer to output structure
+ * @param npyfile  Output: returned pointer to file pointer
+ * @param filename Input/Output: name of the file (with the extension replaced)
+ * @param titles   Input: column titles, separated by _DELIMITER_
+ * @param rows     Input: number of records
+ * @return the error status
+ */
+
+int output_open_npy_file(
+                         struct output * pop,
+                         FILE ** npyfile,
+                         FileName filename,
+                         char titles[_MAXTITLESTRINGLENGTH_],
+                         int rows
+                         ) {
+
+  char thetitle[_MAXTITLESTRINGLENGTH_];
+  char * header;
+  char * pch;
+  char * saveptr;
+  char * pc;
+  int number_of_titles, header_length, length;
+  int one = 1;
+  char byte_order;
+
+  /** - replace the extension of the file name */
+
+  length = strlen(filename);
+  if ((length > 4) && (strcmp(filename+length-4,".dat") == 0))
+    filename[length-4] = '\0';
+  class_test(strlen(filename)+5 > _FILENAMESIZE_,
+             pop->error_message,
+             "file name %s.npy too long",filename);
+  strcat(filename,".npy");
+
+  number_of_titles = get_number_of_titles(titles);
+
+  class_test(number_of_titles == 0,
+             pop->error_message,
+             "no columns to write in %s",filename);
+
+  /** - write the header: a python dictionary with the description of
+      the fields (each title between quotes, with quotes and backslashes
+      escaped), padded with spaces and ended by a newline so that the
+      data starts at a multiple of 64 bytes */
+
+  byte_order = (*(char *)&one == 1) ? '<' : '>';
+
+  class_alloc(header,2*_MAXTITLESTRINGLENGTH_+16*number_of_titles+128,pop->error_message);
+
+  strcpy(header,"{'descr': [");
+  length = strlen(header);
+
+  strcpy(thetitle,titles);
+  pch = strtok_r(thetitle,_DELIMITER_,&saveptr);
+  while (pch != NULL) {
+    header[length++] = '(';
+    header[length++] = '\'';
+    for (pc = pch; *pc != '\0'; pc++) {
+      if ((*pc == '\'') || (*pc == '\\'))
+        header[length++] = '\\';
+      header[length++] = *pc;
+    }
+    length += sprintf(header+length,"', '%cf8'), ",byte_order);
+    pch = strtok_r(NULL,_DELIMITER_,&saveptr);
+  }
+
+  length += sprintf(header+length,"], 'fortran_order': False, 'shape': (%d,), }",rows);
+
+  header_length = length+1;
+  while ((10+header_length)%64 != 0)
+    header_length++;
+
+  class_test_except(header_length > 65535,
+                    pop->error_message,
+                    free(header),
+                    "header of %s too long for the .npy format",filename);
+
+  while (length < header_length-1)
+    header[length++] = ' ';
+  header[length++] = '\n';
+
+  class_open(*npyfile,filename,"wb",pop->error_message);
+
+  fwrite("\x93NUMPY",sizeof(char),6,*npyfile);
+  fputc(1,*npyfile);
+  fputc(0,*npyfile);
+  fputc(header_length & 0xff,*npyfile);
+  fputc(header_length >> 8,*npyfile);
+  fwrite(header,sizeof(char),header_length,*npyfile);
+
+  free(header);
+
+  return _SUCCESS_;
+}
+
+/**
+ * This routine writes a whole table (in the format used by
+ * output_print_data()) in a binary .npy file, see
+ * output_open_npy_file().
+ *
+ * @param pop          Input: pointer to output structure
+ * @param filename     Input: name of the file (extension .dat replaced by .npy)
+ * @param titles       Input: column titles, separated by _DELIMITER_
+ * @param dataptr      Input: table, with the columns varying fastest
+ * @param size_dataptr Input: size of the table
+ * @return the error status
+ */
+
+int output_print_npy_data(
+                          struct output * pop,
+                          FileName filename,
+                          char titles[_MAXTITLESTRINGLENGTH_],
+                          double * dataptr,
+                          int size_dataptr
+                          ) {
+
+  FILE * npyfile;
+  int number_of_titles;
+
+  number_of_titles = get_number_of_titles(titles);
+
+  class_test(number_of_titles == 0,
+             pop->error_message,
+             "no columns to write in %s",filename);
+
+  class_call(output_open_npy_file(pop,&npyfile,filename,titles,size_dataptr/number_of_titles),
+             pop->error_message,
+             pop->error_message);
+
+  fwrite(dataptr,sizeof(double),size_dataptr,npyfile);
+
+  fclose(npyfile);
+
+  return _SUCCESS_;
+}
+
+/**
+ * This routine writes one value in an output file, as text or in
+ * binary form depending on the format.
+ *
+ * @param pop       Input: pointer to output structure
+ * @param file      Input: file pointer
+ * @param value     Input: value to write
+ * @param condition Input: the value is written only if this is _TRUE_
+ * @return the error status
+ */
+
+int output_one_value(
+                     struct output * pop,
+                     FILE * file,
+                     double value,
+                     short condition
+                     ) {
+
+  if (condition == _TRUE_) {
+    if (pop->write_npy == _TRUE_)
+      fwrite(&value,sizeof(double),1,file);
+    else
+      class_fprintf_double(file,value,_TRUE_);
+  }
+
+  return _SUCCESS_;
+}
+
 /**
  * This routine opens one file where some \f$ C_l\f$'s will be written, and writes
  * a heading with some general information concerning its content.
@@ -1296,15 +1842,88 @@ int output_open_cl_file(
                         ) {
   /** Summary */
 
-  int index_d1,index_d2;
+  int index_d1,index_pair;
   int colnum = 1;
   char tmp[60]; //A fixed number here is ok, since it should just correspond to the largest string which is printed to tmp.
+  char titles[_MAXTITLESTRINGLENGTH_]={0};
+  char *pch,*saveptr;
+
+  /** - First we store the column titles, which depend on the format type
+      for the first ones */
+
+  class_store_columntitle(titles,"l",_TRUE_);
+
+  if (pop->output_format == class_format) {
+    class_store_columntitle(titles,"TT",psp->has_tt);
+    class_store_columntitle(titles,"EE",psp->has_ee);
+    class_store_columntitle(titles,"TE",psp->has_te);
+    class_store_columntitle(titles,"BB",psp->has_bb);
+    class_store_columntitle(titles,"phiphi",psp->has_pp);
+    class_store_columntitle(titles,"TPhi",psp->has_tp);
+    class_store_columntitle(titles,"Ephi",psp->has_ep);
+  }
+  else if (pop->output_format == camb_format) {
+    class_store_columntitle(titles,"TT",psp->has_tt);
+    class_store_columntitle(titles,"EE",psp->has_ee);
+    class_store_columntitle(titles,"BB",psp->has_bb);
+    class_store_columntitle(titles,"TE",psp->has_te);
+    class_store_columntitle(titles,"dd",psp->has_pp);
+    class_store_columntitle(titles,"dT",psp->has_tp);
+    class_store_columntitle(titles,"dE",psp->has_ep);
+  }
+
+  if (psp->has_dd == _TRUE_){
+    for (index_pair=0; index_pair<psp->dd_pair_num; index_pair++){
+      sprintf(tmp,"dens[%d]-dens[%d]",psp->dd_pair[2*index_pair]+1,psp->dd_pair[2*index_pair+1]+1);
+      class_store_columntitle(titles,tmp,_TRUE_);
+    }
+  }
+  if (psp->has_td == _TRUE_){
+    for (index_d1=0; index_d1<psp->d_size; index_d1++){
+      sprintf(tmp,"T-dens[%d]",index_d1+1);
+      class_store_columntitle(titles,tmp,_TRUE_);
+    }
+  }
+  if (psp->has_pd == _TRUE_){
+    for (index_d1=0; index_d1<psp->d_size; index_d1++){
+      sprintf(tmp,"phi-dens[%d]",index_d1+1);
+      class_store_columntitle(titles,tmp,_TRUE_);
+    }
+  }
+  if (psp->has_ll == _TRUE_){
+    for (index_pair=0; index_pair<psp->ll_pair_num; index_pair++){
+      sprintf(tmp,"lens[%d]-lens[%d]",psp->ll_pair[2*index_pair]+1,psp->ll_pair[2*index_pair+1]+1);
+      class_store_columntitle(titles,tmp,_TRUE_);
+    }
+  }
+  if (psp->has_tl == _TRUE_){
+    for (index_d1=0; index_d1<psp->d_size; index_d1++){
+      sprintf(tmp,"T-lens[%d]",index_d1+1);
+      class_store_columntitle(titles,tmp,_TRUE_);
+    }
+  }
+  if (psp->has_dl == _TRUE_){
+    for (index_pair=0; index_pair<psp->dl_pair_num; index_pair++){
+      sprintf(tmp,"dens[%d]-lens[%d]",psp->dl_pair[2*index_pair]+1,psp->dl_pair[2*index_pair+1]+1);
+      class_store_columntitle(titles,tmp,_TRUE_);
+    }
+  }
+
+  /** - In binary format, the titles are the names of the fields of the
+      .npy file, with one record for each l from 2 to lmax */
+
+  if (pop->write_npy == _TRUE_) {
+    class_call(output_open_npy_file(pop,clfile,filename,titles,lmax-1),
+               pop->error_message,
+               pop->error_message);
+    return _SUCCESS_;
+  }
 
   class_open(*clfile,filename,"w",pop->error_message);
 
   if (pop->write_header == _TRUE_) {
 
-    /** - First we deal with the entries that are dependent of format type */
+    /** - Otherwise we write a header, with entries dependent of format type */
 
     if (pop->output_format == class_format) {
       fprintf(*clfile,"# dimensionless %s\n",first_line);
@@ -1343,76 +1962,16 @@ int output_open_cl_file(
 
     fprintf(*clfile,"#\n");
 
-    if (0==1){
-      fprintf(*clfile,"#");
-      class_fprintf_columntitle(*clfile,"l",_TRUE_,colnum);
-    }
-    else{
-      fprintf(*clfile,"# 1:l ");
-      colnum++;
-    }
-    if (pop->output_format == class_format) {
-      class_fprintf_columntitle(*clfile,"TT",psp->has_tt,colnum);
-      class_fprintf_columntitle(*clfile,"EE",psp->has_ee,colnum);
-      class_fprintf_columntitle(*clfile,"TE",psp->has_te,colnum);
-      class_fprintf_columntitle(*clfile,"BB",psp->has_bb,colnum);
-      class_fprintf_columntitle(*clfile,"phiphi",psp->has_pp,colnum);
-      class_fprintf_columntitle(*clfile,"TPhi",psp->has_tp,colnum);
-      class_fprintf_columntitle(*clfile,"Ephi",psp->has_ep,colnum);
-    }
-    else if (pop->output_format == camb_format) {
-      class_fprintf_columntitle(*clfile,"TT",psp->has_tt,colnum);
-      class_fprintf_columntitle(*clfile,"EE",psp->has_ee,colnum);
-      class_fprintf_columntitle(*clfile,"BB",psp->has_bb,colnum);
-      class_fprintf_columntitle(*clfile,"TE",psp->has_te,colnum);
-      class_fprintf_columntitle(*clfile,"dd",psp->has_pp,colnum);
-      class_fprintf_columntitle(*clfile,"dT",psp->has_tp,colnum);
-      class_fprintf_columntitle(*clfile,"dE",psp->has_ep,colnum);
-    }
+    /** - Then the column titles, the first one (l) being narrower */
 
-    /** - Next deal with entries that are independent of format type */
+    fprintf(*clfile,"# 1:l ");
+    colnum++;
 
-    if (psp->has_dd == _TRUE_){
-      for (index_d1=0; index_d1<psp->d_size; index_d1++){
-        for (index_d2=index_d1; index_d2<=MIN(index_d1+psp->non_diag,psp->d_size-1); index_d2++){
-          sprintf(tmp,"dens[%d]-dens[%d]",index_d1+1,index_d2+1);
-          class_fprintf_columntitle(*clfile,tmp,_TRUE_,colnum);
-        }
-      }
-    }
-    if (psp->has_td == _TRUE_){
-      for (index_d1=0; index_d1<psp->d_size; index_d1++){
-        sprintf(tmp,"T-dens[%d]",index_d1+1);
-        class_fprintf_columntitle(*clfile,tmp,_TRUE_,colnum);
-      }
-    }
-    if (psp->has_pd == _TRUE_){
-      for (index_d1=0; index_d1<psp->d_size; index_d1++){
-        sprintf(tmp,"phi-dens[%d]",index_d1+1);
-        class_fprintf_columntitle(*clfile,tmp,_TRUE_,colnum);
-      }
-    }
-    if (psp->has_ll == _TRUE_){
-      for (index_d1=0; index_d1<psp->d_size; index_d1++){
-        for (index_d2=index_d1; index_d2<=MIN(index_d1+psp->non_diag,psp->d_size-1); index_d2++){
-          sprintf(tmp,"lens[%d]-lens[%d]",index_d1+1,index_d2+1);
-          class_fprintf_columntitle(*clfile,tmp,_TRUE_,colnum);
-        }
-      }
-    }
-    if (psp->has_tl == _TRUE_){
-      for (index_d1=0; index_d1<psp->d_size; index_d1++){
-        sprintf(tmp,"T-lens[%d]",index_d1+1);
-        class_fprintf_columntitle(*clfile,tmp,_TRUE_,colnum);
-      }
-    }
-    if (psp->has_dl == _TRUE_){
-      for (index_d1=0; index_d1<psp->d_size; index_d1++){
-        for (index_d2=MAX(index_d1-psp->non_diag,0); index_d2<=MIN(index_d1+psp->non_diag,psp->d_size-1); index_d2++) {
-          sprintf(tmp,"dens[%d]-lens[%d]",index_d1+1,index_d2+1);
-          class_fprintf_columntitle(*clfile,tmp,_TRUE_,colnum);
-        }
-      }
+    pch = strtok_r(titles,_DELIMITER_,&saveptr);
+    pch = strtok_r(NULL,_DELIMITER_,&saveptr);
+    while (pch != NULL){
+      class_fprintf_columntitle(*clfile,pch,_TRUE_,colnum);
+      pch = strtok_r(NULL,_DELIMITER_,&saveptr);
     }
     fprintf(*clfile,"\n");
   }
@@ -1448,31 +2007,31 @@ int output_one_line_of_cl(
 
   factor = l*(l+1)/2./_PI_;
 
-  fprintf(clfile," ");
-
-  if (0==1){
-    class_fprintf_int(clfile, (int)l, _TRUE_);
+  if (pop->write_npy == _TRUE_) {
+    output_one_value(pop, clfile, l, _TRUE_);
   }
-  else{
+  else {
+    fprintf(clfile," ");
     fprintf(clfile,"%4d ",(int)l);
   }
 
   if (pop->output_format == class_format) {
 
     for (index_ct=0; index_ct < ct_size; index_ct++) {
-      class_fprintf_double(clfile, factor*cl[index_ct], _TRUE_);
+      output_one_value(pop, clfile, factor*cl[index_ct], _TRUE_);
     }
-    fprintf(clfile,"\n");
+    if (pop->write_npy == _FALSE_)
+      fprintf(clfile,"\n");
   }
 
   if (pop->output_format == camb_format) {
-    class_fprintf_double(clfile, factor*pow(pba->T_cmb*1.e6,2)*cl[psp->index_ct_tt], psp->has_tt);
-    class_fprintf_double(clfile, factor*pow(pba->T_cmb*1.e6,2)*cl[psp->index_ct_ee], psp->has_ee);
-    class_fprintf_double(clfile, factor*pow(pba->T_cmb*1.e6,2)*cl[psp->index_ct_bb], psp->has_bb);
-    class_fprintf_double(clfile, factor*pow(pba->T_cmb*1.e6,2)*cl[psp->index_ct_te], psp->has_te);
-    class_fprintf_double(clfile, l*(l+1)*factor*cl[psp->index_ct_pp], psp->has_pp);
-    class_fprintf_double(clfile, sqrt(l*(l+1))*factor*pba->T_cmb*1.e6*cl[psp->index_ct_tp], psp->has_tp);
-    class_fprintf_double(clfile, sqrt(l*(l+1))*factor*pba->T_cmb*1.e6*cl[psp->index_ct_ep], psp->has_ep);
+    output_one_value(pop, clfile, factor*pow(pba->T_cmb*1.e6,2)*cl[psp->index_ct_tt], psp->has_tt);
+    output_one_value(pop, clfile, factor*pow(pba->T_cmb*1.e6,2)*cl[psp->index_ct_ee], psp->has_ee);
+    output_one_value(pop, clfile, factor*pow(pba->T_cmb*1.e6,2)*cl[psp->index_ct_bb], psp->has_bb);
+    output_one_value(pop, clfile, factor*pow(pba->T_cmb*1.e6,2)*cl[psp->index_ct_te], psp->has_te);
+    output_one_value(pop, clfile, l*(l+1)*factor*cl[psp->index_ct_pp], psp->has_pp);
+    output_one_value(pop, clfile, sqrt(l*(l+1))*factor*pba->T_cmb*1.e6*cl[psp->index_ct_tp], psp->has_tp);
+    output_one_value(pop, clfile, sqrt(l*(l+1))*factor*pba->T_cmb*1.e6*cl[psp->index_ct_ep], psp->has_ep);
     index_ct_rest = 0;
     if (psp->has_tt == _TRUE_)
       index_ct_rest++;
@@ -1490,10 +2049,11 @@ int output_one_line_of_cl(
       index_ct_rest++;
     /* Now print the remaining (if any) entries:*/
     for (index_ct=index_ct_rest; index_ct < ct_size; index_ct++) {
-      class_fprintf_double(clfile, factor*cl[index_ct], _TRUE_);
+      output_one_value(pop, clfile, factor*cl[index_ct], _TRUE_);
     }
 
-    fprintf(clfile,"\n");
+    if (pop->write_npy == _FALSE_)
+      fprintf(clfile,"\n");
 
   }
   return _SUCCESS_;
@@ -1525,6 +2085,19 @@ int output_open_pk_file(
                         ) {
 
   int colnum = 1;
+  char titles[_MAXTITLESTRINGLENGTH_]={0};
+
+  /** - in binary format, write a .npy header with one record for each k */
+
+  if (pop->write_npy == _TRUE_) {
+    class_store_columntitle(titles,"k (h/Mpc)",_TRUE_);
+    class_store_columntitle(titles,"P (Mpc/h)^3",_TRUE_);
+    class_call(output_open_npy_file(pop,pkfile,filename,titles,pnl->k_size),
+               pop->error_message,
+               pop->error_message);
+    return _SUCCESS_;
+  }
+
   class_open(*pkfile,filename,"w",pop->error_message);
 
   if (pop->write_header == _TRUE_) {
@@ -1547,6 +2120,7 @@ int output_open_pk_file(
 /**
  * This routine writes one line with k and P(k)
  *
+ * @param pop     Input: pointer to output structure
  * @param pkfile  Input: file pointer
  * @param one_k   Input: wavenumber
  * @param one_pk  Input: matter power spectrum
@@ -1554,11 +2128,18 @@ int output_open_pk_file(
  */
 
 int output_one_line_of_pk(
+                          struct output * pop,
                           FILE * pkfile,
                           double one_k,
                           double one_pk
                           ) {
 
+  if (pop->write_npy == _TRUE_) {
+    output_one_value(pop,pkfile,one_k,_TRUE_);
+    output_one_value(pop,pkfile,one_pk,_TRUE_);
+    return _SUCCESS_;
+  }
+
   fprintf(pkfile," ");
   class_fprintf_double(pkfile,one_k,_TRUE_);
   class_fprintf_double(pkfile,one_pk,_TRUE_);
@@ -26,6 +26,22 @@
 
 #include "perturbations.h"
 #include "longrange.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+/** wall-clock time spent on each pair of initial condition and wavenumber of each mode in the previous run, and size of these arrays (accessed within the critical section perturb_task_cost only) */
+static double * perturb_task_cost_previous[_MAX_NUMBER_OF_MODES_] = {NULL};
+static int perturb_task_cost_size[_MAX_NUMBER_OF_MODES_] = {0};
+
+static int perturb_compare_cost(const void * a, const void * b);
+
+static int perturb_sources_at_tau_single_precision(struct perturbs * ppt,
+                                                   int index_md,
+                                                   int index_ic,
+                                                   int index_tp,
+                                                   double tau,
+                                                   double * psource);
 
 /**
  * Source function \f$ S^{X} (k, \tau) \f$ at a given conformal time tau.
@@ -58,6 +74,19 @@ int perturb_sources_at_tau(
   int last_index;
   double logtau;
 
+  class_test(ppt->sources_released == _TRUE_,
+             ppt->error_message,
+             "the source functions were freed by the low_memory profile once used: set low_memory = no to read them afterwards");
+
+  /** - if the tables are stored in single precision, use the dedicated routine */
+
+  if (ppt->sources_single_precision == _TRUE_) {
+    class_call(perturb_sources_at_tau_single_precision(ppt,index_md,index_ic,index_tp,tau,psource),
+               ppt->error_message,
+               ppt->error_message);
+    return _SUCCESS_;
+  }
+
   logtau = log(tau);
 
   /** - interpolate in pre-computed table contained in ppt */
@@ -104,6 +133,118 @@ int perturb_sources_at_tau(
   return _SUCCESS_;
 }
 
+/**
+ * Same as perturb_sources_at_tau(), for source tables stored in single
+ * precision (see perturb_sources_to_single_precision()).
+ *
+ * Only the two time steps bracketing tau are involved in the
+ * interpolation: they are converted back to double precision, and
+ * passed to the same interpolation routines as in
+ * perturb_sources_at_tau(), so that both storage formats give the
+ * same result up to the rounding of the stored values.
+ *
+ * @param ppt        Input: pointer to perturbation structure containing interpolation tables
+ * @param index_md   Input: index of requested mode
+ * @param index_ic   Input: index of requested initial condition
+ * @param index_tp   Input: index of requested source function type
+ * @param tau        Input: any value of conformal time
+ * @param psource    Output: vector (already allocated) of source function as a function of k
+ * @return the error status
+ */
+
+static int perturb_sources_at_tau_single_precision(
+                                                   struct perturbs * ppt,
+                                                   int index_md,
+                                                   int index_ic,
+                                                   int index_tp,
+                                                   double tau,
+                                                   double * psource
+                                                   ) {
+
+  int index_ic_tp,index_k,index_tau_sources;
+  int inf,sup,mid,last_index;
+  int k_size;
+  double logtau;
+  double * rows;
+
+  index_ic_tp = index_ic * ppt->tp_size[index_md] + index_tp;
+  k_size = ppt->k_size[index_md];
+  logtau = log(tau);
+
+  /* rows[0..2*k_size-1]: sources at the two bracketing times; rows[2*k_size..4*k_size-1]: their second derivatives (late times only) */
+  class_alloc(rows,4*k_size*sizeof(double),ppt->error_message);
+
+  /** - linear interpolation at early times (z>z_max_pk) */
+
+  if ((logtau < ppt->ln_tau[0]) || (ppt->ln_tau_size <= 1)) {
+
+    inf = 0;
+    sup = ppt->tau_size-1;
+    while (sup-inf > 1) {
+      mid = (inf+sup)/2;
+      if (tau < ppt->tau_sampling[mid]) sup = mid;
+      else inf = mid;
+    }
+
+    for (index_k=0; index_k<k_size; index_k++) {
+      rows[index_k] = ppt->sources_float[index_md][index_ic_tp][inf*k_size+index_k];
+      rows[k_size+index_k] = ppt->sources_float[index_md][index_ic_tp][sup*k_size+index_k];
+    }
+
+    class_call(array_interpolate_two_bis(ppt->tau_sampling+inf,
+                                         1,
+                                         0,
+                                         rows,
+                                         k_size,
+                                         sup-inf+1,
+                                         tau,
+                                         psource,
+                                         k_size,
+                                         ppt->error_message),
+               ppt->error_message,
+               ppt->error_message);
+  }
+
+  /** - spline interpolation at late times (z<z_max_pk) */
+
+  else {
+
+    inf = 0;
+    sup = ppt->ln_tau_size-1;
+    while (sup-inf > 1) {
+      mid = (inf+sup)/2;
+      if (logtau < ppt->ln_tau[mid]) sup = mid;
+      else inf = mid;
+    }
+
+    index_tau_sources = ppt->tau_size-ppt->ln_tau_size+inf;
+
+    for (index_k=0; index_k<k_size; index_k++) {
+      rows[index_k] = ppt->sources_float[index_md][index_ic_tp][index_tau_sources*k_size+index_k];
+      rows[k_size+index_k] = ppt->sources_float[index_md][index_ic_tp][(index_tau_sources+1)*k_size+index_k];
+      rows[2*k_size+index_k] = ppt->ddlate_sources_float[index_md][index_ic_tp][inf*k_size+index_k];
+      rows[3*k_size+index_k] = ppt->ddlate_sources_float[index_md][index_ic_tp][sup*k_size+index_k];
+    }
+
+    class_call(array_interpolate_spline(ppt->ln_tau+inf,
+                                        2,
+                                        rows,
+                                        rows+2*k_size,
+                                        k_size,
+                                        logtau,
+                                        &last_index,
+                                        psource,
+                                        k_size,
+                                        ppt->error_message),
+               ppt->error_message,
+               ppt->error_message);
+  }
+
+  free(rows);
+
+  return _SUCCESS_;
+}
+
 /**
  * Function called by the output module or the wrappers, which returns all
  * the source functions \f$ S^{X} (k, \tau) \f$ at a given conformal
@@ -160,7 +301,7 @@ int perturb_output_data(
       for (index_tp=0; index_tp<ppt->tp_size[index_md]; index_tp++) {
         for (index_ic=0; index_ic<ppt->ic_size[index_md]; index_ic++) {
           tkfull[(index_k * ppt->ic_size[index_md] + index_ic) * ppt->tp_size[index_md] + index_tp]
-            = ppt->sources[index_md][index_ic * ppt->tp_size[index_md] + index_tp][(ppt->tau_size-1) * ppt->k_size[index_md] + index_k];
+            = _get_source_(ppt,index_md,index_ic * ppt->tp_size[index_md] + index_tp,(ppt->tau_size-1) * ppt->k_size[index_md] + index_k);
         }
       }
     }
@@ -478,12 +619,8 @@ int perturb_init(
   int index_ic;
   /* running index for wavenumbers */
   int index_k;
-  /* running index for type of perturbation */
-  int index_tp;
   /* pointer to one struct perturb_workspace per thread (one if no openmp) */
   struct perturb_workspace ** pppw;
-  /* background quantities */
-  double w_fld_ini, w_fld_0,dw_over_da_fld,integral_fld;
   /* number of threads (always one if no openmp) */
   int number_of_threads=1;
   /* index of the thread (always 0 if no openmp) */
@@ -502,205 +639,81 @@ int perturb_init(
 #ifdef _OPENMP
   /* instrumentation times */
   double tstart, tstop, tspent;
+  /* time spent by each thread in perturb_solve(), and total duration of the loop over wavenumbers */
+  double * thread_busy;
+  double tloop;
 #endif
+  struct parallel_timer timer;
 
-  /** - perform preliminary checks */
-
-  if (ppt->has_perturbations == _FALSE_) {
-    if (ppt->perturbations_verbose > 0)
-      printf("No sources requested. Perturbation module skipped.\n");
-    return _SUCCESS_;
-  }
-  else {
-    if (ppt->perturbations_verbose > 0)
-      printf("Computing sources\n");
-  }
-
-  class_test((ppt->gauge == synchronous) && (pba->has_cdm == _FALSE_),
-             ppt->error_message,
-             "In the synchronous gauge, it is not self-consistent to assume no CDM: the later is used to define the initial timelike hypersurface. You can either add a negligible amount of CDM or switch to newtonian gauge");
-
-  class_test ((ppr->tight_coupling_approximation < first_order_MB) ||
-              (ppr->tight_coupling_approximation > compromise_CLASS),
-              ppt->error_message,
-              "your tight_coupling_approximation is set to %d, out of range defined in perturbations.h",ppr->tight_coupling_approximation);
-
-  class_test ((ppr->radiation_streaming_approximation < rsa_null) ||
-              (ppr->radiation_streaming_approximation > rsa_none),
-              ppt->error_message,
-              "your radiation_streaming_approximation is set to %d, out of range defined in perturbations.h",ppr->radiation_streaming_approximation);
-
-  if (pba->has_idr == _TRUE_){
-    class_test ((ppr->idr_streaming_approximation < rsa_idr_none) ||
-                (ppr->idr_streaming_approximation > rsa_idr_MD),
-                ppt->error_message,
-                "your idr_radiation_streaming_approximation is set to %d, out of range defined in perturbations.h",ppr->idr_streaming_approximation);
-  }
-
-  if (pba->has_ur == _TRUE_) {
-
-    class_test ((ppr->ur_fluid_approximation < ufa_mb) ||
-                (ppr->ur_fluid_approximation > ufa_none),
-                ppt->error_message,
-                "your ur_fluid_approximation is set to %d, out of range defined in perturbations.h",ppr->ur_fluid_approximation);
-  }
-
-  if (pba->has_ncdm == _TRUE_) {
-
-    class_test ((ppr->ncdm_fluid_approximation < ncdmfa_mb) ||
-                (ppr->ncdm_fluid_approximation > ncdmfa_none),
-                ppt->error_message,
-                "your ncdm_fluid_approximation is set to %d, out of range defined in perturbations.h",ppr->ncdm_fluid_approximation);
-
-    if (ppt->has_nc_density == _TRUE_) {
-      if (ppt->perturbations_verbose > 0) {
-        fprintf(stdout," -> [WARNING:] You request the number count Cl's in presence of non-cold dark matter.\n    Like in all previous CLASS and CLASSgal versions, this will be inferred from the total matter density,\n    but it could make much more sense physically to compute it from the CDM+baryon density only.\n    To get the latter behavior you would just need to change one line in transfer.c:\n    search there for a comment starting with 'use here delta_cb'\n");
-      }
-    }
-
-  }
-
-  if (pba->has_lrs == _TRUE_) {
-
-    class_test ((ppr->lrs_fluid_approximation < lrsfa_mb) ||
-                (ppr->lrs_fluid_approximation > lrsfa_none),
-                ppt->error_message,
-                "your lrs_fluid_approximation is set to %d, out of range defined in perturbations.h",ppr->lrs_fluid_approximation);
-
-    if (ppt->has_nc_density == _TRUE_) {
-      if (ppt->perturbations_verbose > 0) {
-        fprintf(stdout," -> [WARNING:] You request the number count Cl's in presence of non-cold dark matter.\n    Like in all previous CLASS and CLASSgal versions, this will be inferred from the total matter density,\n    but it could make much more sense physically to compute it from the CDM+baryon density only.\n    To get the latter behavior you would just need to change one line in transfer.c:\n    search there for a comment starting with 'use here delta_cb'\n");
-      }
-    }
-
-  }
-
-  if (pba->has_fld == _TRUE_) {
-
-    /* check values of w_fld at initial time and today */
-    class_call(background_w_fld(pba,     0.,   &w_fld_ini,&dw_over_da_fld,&integral_fld), pba->error_message, ppt->error_message);
-    class_call(background_w_fld(pba,pba->a_today,&w_fld_0,&dw_over_da_fld,&integral_fld), pba->error_message, ppt->error_message);
+  /* number of pairs of initial conditions and wavenumbers, order in which they are handed out to threads, and measured cost of each of them */
+  int task_size;
+  int index_task;
+  int * task_order;
+  double * task_cost;
 
-    class_test(w_fld_ini >= 0.,
-               ppt->error_message,
-               "The fluid is meant to be negligible at early time, and unimportant for defining the initial conditions of other species. You are using parameters for which this assumption may break down, since at early times you have w_fld(a--->0) = %e >= 0",w_fld_ini);
+  /* MPI process of each pair, and number of pairs of this process */
+  int * task_rank;
+  int local_task_size;
+  int index_ikout;
 
-    if (pba->use_ppf == _FALSE_) {
+  /* statistics of the stiff evolver, summed over the threads */
+  struct evolver_ndf15_statistics ndf15_statistics;
 
-      class_test((w_fld_ini +1.0)*(w_fld_0+1.0) <= 0.0,
-                 ppt->error_message,
-                 "w crosses -1 between the infinite past and today, and this would lead to divergent perturbation equations for the fluid perturbations. Try to switch to PPF scheme: use_ppf = yes");
+  /* _TRUE_ if the source tables were read from the cache file of a previous run */
+  short sources_from_cache;
 
-      /* the next check is meaningful at least for w(a) = w0 + wa*(1-a/a0); for general formulas and with use_ppf=no, you may prefer to comment it out... */
-      class_test((w_fld_0 == -1.) && (dw_over_da_fld == 0.),
-                 ppt->error_message,
-                 "Your choice of a fluid with (w0,wa)=(-1,0) is not valid due to instabilities in the unphysical perturbations of such a fluid. Try instead with a plain cosmological constant or with PPF scheme: use_ppf = yes");
+  /* wavenumbers whose sources were read from the cache file of a previous run with another k range, and their number (over all modes, and for one mode) */
+  short ** k_from_cache;
+  int k_from_cache_size;
+  int k_from_cache_mode;
 
-    }
+  /* size of the heap at the beginning (see class_memory_heap()) */
+  size_t heap_start;
 
-  }
+  /* version of perturb_derivs() used for this configuration (only reported in verbose mode) */
+  int (*derivs)(double, double *, double *, void *, ErrorMsg);
+  const char * derivs_name;
 
-  if (pba->has_dcdm == _TRUE_) {
+  class_profile_start(profile_perturb_init);
+  heap_start = class_memory_heap();
 
-    class_test((ppt->has_cdi == _TRUE_) || (ppt->has_bi == _TRUE_) || (ppt->has_nid == _TRUE_) || (ppt->has_niv == _TRUE_),
-               ppt->error_message,
-               "Non-adiabatic initial conditions not coded in presence of decaying dark matter");
+  /** - perform preliminary checks, define all indices, the k and tau samplings, and allocate the source tables with perturb_prepare() */
 
-  }
+  ppt->grid_reference = NULL;
 
-  class_test(ppt->has_vectors == _TRUE_,
+  class_call(perturb_prepare(ppr,
+                             pba,
+                             pth,
+                             ppt),
              ppt->error_message,
-             "Vectors not coded yet");
-
-  if ((ppt->has_niv == _TRUE_) && (ppt->perturbations_verbose > 0)) {
-    printf("Warning: the niv initial conditions in CLASS (and also in CAMB) should still be double-checked: if you want to do it and send feedback, you are welcome!\n");
-  }
-
-  if (ppt->has_tensors == _TRUE_) {
-
-    ppt->evolve_tensor_ur = _FALSE_;
-    ppt->evolve_tensor_ncdm = _FALSE_;
-    ppt->evolve_tensor_lrs = _FALSE_;
-
-    switch (ppt->tensor_method) {
-
-    case (tm_photons_only):
-      break;
-
-    case (tm_massless_approximation):
-      if ((pba->has_ur == _TRUE_) || (pba->has_ncdm == _TRUE_) || (pba->has_lrs == _TRUE_))
-        ppt->evolve_tensor_ur = _TRUE_;
-      break;
+             ppt->error_message);
 
-    case (tm_exact):
-      if (pba->has_ur == _TRUE_)
-        ppt->evolve_tensor_ur = _TRUE_;
-      if (pba->has_ncdm == _TRUE_)
-        ppt->evolve_tensor_ncdm = _TRUE_;
-      if (pba->has_lrs == _TRUE_)
-        ppt->evolve_tensor_lrs = _TRUE_; // We have *NOT* implemented long-range interactions in tensor perturbations
-      break;
-    }
+  if (ppt->has_perturbations == _FALSE_) {
+    ppt->memory_size = class_memory_growth(heap_start);
+    class_profile_stop(profile_perturb_init);
+    return _SUCCESS_;
   }
 
-  class_test((pba->h > _h_BIG_) || (pba->h < _h_SMALL_),
-             ppt->error_message,
-             "Your value of pba->h=%e is out of the bounds [%e , %e] and could cause a crash of the perturbation ODE integration. If you want to force this barrier, you may comment it out in perturbation.c",
-             pba->h,
-             _h_SMALL_,
-             _h_BIG_);
-
-  class_test((pba->Omega0_b*pba->h*pba->h < _omegab_SMALL_) || (pba->Omega0_b*pba->h*pba->h > _omegab_BIG_),
-             ppt->error_message,
-             "Your value of omega_b=%e is out of the bounds [%e , %e] and could cause a crash of the perturbation ODE integration. If you want to force this barrier, you may comment it out in perturbation.c",
-             pba->Omega0_b*pba->h*pba->h,
-             _omegab_SMALL_,
-             _omegab_BIG_);
-
-  /** - initialize all indices and lists in perturbs structure using perturb_indices_of_perturbs() */
+  /** - if a cache directory is set, try to read the source tables computed by a previous run with the same inputs */
 
-  class_call(perturb_indices_of_perturbs(ppr,
-                                         pba,
-                                         pth,
-                                         ppt),
+  class_call(perturb_sources_cache_read(ppt,&sources_from_cache),
              ppt->error_message,
              ppt->error_message);
 
+  /** - otherwise, take the sources of the wavenumbers computed by a previous run of the same model with another k range, if any: only the other wavenumbers are evolved below */
 
-  if (ppt->z_max_pk > pth->z_rec) {
+  class_alloc(k_from_cache,ppt->md_size*sizeof(short *),ppt->error_message);
+  for (index_md = 0; index_md < ppt->md_size; index_md++)
+    class_calloc(k_from_cache[index_md],ppt->k_size[index_md],sizeof(short),ppt->error_message);
 
-    class_test(ppt->has_cmb == _TRUE_,
-               ppt->error_message,
-               "You requested a very high z_pk=%e, higher than z_rec=%e. This works very well when you don't ask for a calculation of the CMB source function(s). Remove any CMB from your output and try e.g. with 'output=mTk' or 'output=mTk,vTk'",
-               ppt->z_max_pk,
-               pth->z_rec);
+  k_from_cache_size = 0;
 
-    class_test(ppt->has_source_delta_m == _TRUE_,
+  if (sources_from_cache == _FALSE_) {
+    class_call(perturb_sources_cache_extend(ppt,k_from_cache,&k_from_cache_size),
                ppt->error_message,
-               "You requested a very high z_pk=%e, higher than z_rec=%e. This works very well when you ask only transfer functions, e.g. with 'output=mTk' or 'output=mTk,vTk'. But if you need the total matter (e.g. with 'mPk', 'dCl', etc.) there is an issue with the calculation of delta_m at very early times. By default, delta_m is a gauge-invariant variable (the density fluctuation in comoving gauge) and this quantity is hard to get accurately at very early times. The solution is to define delta_m as the density fluctuation in the current gauge, synchronous or newtonian. For the moment this must be done manually by commenting the line 'ppw->delta_m += 3. *ppw->pvecback[pba->index_bg_a]*ppw->pvecback[pba->index_bg_H] * ppw->theta_m/k2;' in perturb_sources(). In the future there will be an option for doing it in an easier way.",
-               ppt->z_max_pk,
-               pth->z_rec);
-
+               ppt->error_message);
   }
 
-
-
-  /** - define the common time sampling for all sources using
-      perturb_timesampling_for_sources() */
-
-  class_call(perturb_timesampling_for_sources(ppr,
-                                              pba,
-                                              pth,
-                                              ppt),
-             ppt->error_message,
-             ppt->error_message);
-
-  /** - if we want to store perturbations for given k values, write titles and allocate storage */
-
-  class_call(perturb_prepare_k_output(pba,ppt),
-             ppt->error_message,
-             ppt->error_message);
-
   /** - create an array of workspaces in multi-thread case */
 
 #ifdef _OPENMP
@@ -713,12 +726,38 @@ int perturb_init(
 
   class_alloc(pppw,number_of_threads * sizeof(struct perturb_workspace *),ppt->error_message);
 
+#ifdef _OPENMP
+  class_alloc(thread_busy,number_of_threads * sizeof(double),ppt->error_message);
+#endif
+
+  class_test(ppt->md_size > _MAX_NUMBER_OF_MODES_,
+             ppt->error_message,
+             "increase _MAX_NUMBER_OF_MODES_ to at least %d",ppt->md_size);
+
   /** - loop over modes (scalar, tensors, etc). For each mode: */
 
   for (index_md = 0; index_md < ppt->md_size; index_md++) {
 
-    if (ppt->perturbations_verbose > 1)
+    /* nothing to evolve if the sources were read from the cache */
+    if (sources_from_cache == _TRUE_)
+      break;
+
+    /* nor for this mode if all its wavenumbers were */
+    k_from_cache_mode = 0;
+    for (index_k = 0; index_k < ppt->k_size[index_md]; index_k++)
+      if (k_from_cache[index_md][index_k] == _TRUE_)
+        k_from_cache_mode++;
+
+    if (k_from_cache_mode == ppt->k_size[index_md])
+      continue;
+
+    if (ppt->perturbations_verbose > 1) {
       printf("Evolving mode %d/%d\n",index_md+1,ppt->md_size);
+      class_call(perturb_derivs_select(pba,ppt,&derivs,&derivs_name),
+                 ppt->error_message,
+                 ppt->error_message);
+      printf(" -> derivatives computed by %s()\n",derivs_name);
+    }
 
     abort = _FALSE_;
 
@@ -754,83 +793,182 @@ int perturb_init(
 
     if (abort == _TRUE_) return _FAILURE_;
 
-    /** - --> (c) loop over initial conditions and wavenumbers; for each of them, evolve perturbations and compute source functions with perturb_solve() */
+    /** - --> (b') find the tight-coupling switch for a few wavenumbers with perturb_switch_schedule_init(), to narrow its search for the others */
 
-    for (index_ic = 0; index_ic < ppt->ic_size[index_md]; index_ic++) {
+    class_call(perturb_switch_schedule_init(ppr,pba,pth,ppt,index_md,pppw[0]),
+               ppt->error_message,
+               ppt->error_message);
 
-      if (ppt->perturbations_verbose > 1) {
-        printf("Evolving ic %d/%d\n",index_ic+1,ppt->ic_size[index_md]);
-        printf("evolving %d wavenumbers\n",ppt->k_size[index_md]);
-      }
+    /** - --> (c) choose the order in which all pairs of initial conditions and wavenumbers (numbered index_ic*k_size+index_k) are handed out to the threads with perturb_task_schedule() */
+
+    task_size = ppt->ic_size[index_md]*ppt->k_size[index_md];
+
+    class_alloc(task_order,task_size*sizeof(int),ppt->error_message);
+    class_alloc(task_cost,task_size*sizeof(double),ppt->error_message);
+
+    class_call(perturb_task_schedule(ppr,ppt,index_md,task_order,task_cost),
+               ppt->error_message,
+               ppt->error_message);
+
+    /** - --> (c') in an MPI run, share the pairs among the processes according to their cost with class_mpi_partition(), keeping those whose perturbations are written in output (k_output_values) in the first process, which writes the files; each process only evolves its own pairs, in the same order */
+
+    class_alloc(task_rank,task_size*sizeof(int),ppt->error_message);
+
+    for (index_task = 0; index_task < task_size; index_task++)
+      task_rank[index_task] = -1;
+
+    for (index_ikout = 0; index_ikout < ppt->k_output_values_num; index_ikout++) {
+      index_k = ppt->index_k_output_values[index_md*ppt->k_output_values_num+index_ikout];
+      for (index_ic = 0; index_ic < ppt->ic_size[index_md]; index_ic++)
+        task_rank[index_ic*ppt->k_size[index_md]+index_k] = 0;
+    }
+
+    class_call(class_mpi_partition(task_size,task_cost,task_rank,ppt->error_message),
+               ppt->error_message,
+               ppt->error_message);
+
+    local_task_size = 0;
+    for (index_task = 0; index_task < task_size; index_task++)
+      if ((task_rank[task_order[index_task]] == class_mpi_rank()) &&
+          (k_from_cache[index_md][task_order[index_task] % ppt->k_size[index_md]] == _FALSE_))
+        task_order[local_task_size++] = task_order[index_task];
+
+    /* the measured costs of the pairs of other processes stay at zero, and are summed over the processes below */
+    for (index_task = 0; index_task < task_size; index_task++)
+      task_cost[index_task] = 0.;
+
+    /** - --> (d) loop over initial conditions and wavenumbers in a single parallel region; for each of them, evolve perturbations and compute source functions with perturb_solve() */
+
+    if (ppt->perturbations_verbose > 1) {
+      printf("Evolving %d ic\n",ppt->ic_size[index_md]);
+      printf("evolving %d wavenumbers\n",ppt->k_size[index_md]-k_from_cache_mode);
+    }
+
+    abort = _FALSE_;
 
-      abort = _FALSE_;
+#ifdef _OPENMP
+    tloop = omp_get_wtime();
+#endif
+
+    parallel_timer_start(&timer);
 
 #pragma omp parallel                                                    \
-  shared(pppw,ppr,pba,pth,ppt,index_md,index_ic,abort,number_of_threads) \
-  private(index_k,thread,tstart,tstop,tspent)                           \
+  shared(pppw,ppr,pba,pth,ppt,index_md,abort,number_of_threads,local_task_size,task_order,task_cost,thread_busy,timer) \
+  private(index_task,index_ic,index_k,thread,tstart,tstop,tspent)       \
   num_threads(number_of_threads)
 
-      {
+    {
 
 #ifdef _OPENMP
-        thread=omp_get_thread_num();
-        tspent=0.;
+      thread=omp_get_thread_num();
+      tspent=0.;
 #endif
 
-#pragma omp for schedule (dynamic)
+#pragma omp for schedule (dynamic) nowait
 
-        /* integrating backwards is slightly more optimal for parallel runs */
-        //for (index_k = 0; index_k < ppt->k_size; index_k++) {
-        for (index_k = ppt->k_size[index_md]-1; index_k >=0; index_k--) {
+      for (index_task = 0; index_task < local_task_size; index_task++) {
 
-          if ((ppt->perturbations_verbose > 2) && (abort == _FALSE_)) {
-            printf("evolving mode k=%e /Mpc  (%d/%d)",ppt->k[index_md][index_k],index_k+1,ppt->k_size[index_md]);
-            if (pba->sgnK != 0)
-              printf(" (for scalar modes, corresponds to nu=%e)",sqrt(ppt->k[index_md][index_k]*ppt->k[index_md][index_k]+pba->K)/sqrt(pba->sgnK*pba->K));
-            printf("\n");
-          }
+        index_ic = task_order[index_task] / ppt->k_size[index_md];
+        index_k = task_order[index_task] % ppt->k_size[index_md];
+
+        if ((ppt->perturbations_verbose > 2) && (abort == _FALSE_)) {
+          printf("evolving mode k=%e /Mpc  (%d/%d), ic %d/%d",ppt->k[index_md][index_k],index_k+1,ppt->k_size[index_md],index_ic+1,ppt->ic_size[index_md]);
+          if (pba->sgnK != 0)
+            printf(" (for scalar modes, corresponds to nu=%e)",sqrt(ppt->k[index_md][index_k]*ppt->k[index_md][index_k]+pba->K)/sqrt(pba->sgnK*pba->K));
+          printf("\n");
+        }
 
 #ifdef _OPENMP
-          tstart = omp_get_wtime();
+        tstart = omp_get_wtime();
 #endif
 
-          class_call_parallel(perturb_solve(ppr,
-                                            pba,
-                                            pth,
-                                            ppt,
-                                            index_md,
-                                            index_ic,
-                                            index_k,
-                                            pppw[thread]),
-                              ppt->error_message,
-                              ppt->error_message);
+        class_call_parallel(perturb_solve(ppr,
+                                          pba,
+                                          pth,
+                                          ppt,
+                                          index_md,
+                                          index_ic,
+                                          index_k,
+                                          pppw[thread]),
+                            ppt->error_message,
+                            ppt->error_message);
 
 #ifdef _OPENMP
-          tstop = omp_get_wtime();
+        tstop = omp_get_wtime();
+
+        tspent += tstop-tstart;
 
-          tspent += tstop-tstart;
+        task_cost[task_order[index_task]] = tstop-tstart;
 #endif
 
 #pragma omp flush(abort)
 
-        } /* end of loop over wavenumbers */
+      } /* end of loop over initial conditions and wavenumbers */
 
 #ifdef _OPENMP
-        if (ppt->perturbations_verbose>2)
-          printf("In %s: time spent in parallel region (loop over k's) = %e s for thread %d\n",
-                 __func__,tspent,omp_get_thread_num());
+      if (ppt->perturbations_verbose>2)
+        printf("In %s: time spent in parallel region (loop over k's) = %e s for thread %d\n",
+               __func__,tspent,omp_get_thread_num());
+
+      thread_busy[thread] = tspent;
 #endif
 
-      } /* end of parallel region */
+      parallel_timer_thread_done(&timer);
+
+    } /* end of parallel region */
+
+    parallel_timer_stop(&timer,"perturb_init: k loop");
+
+    class_call(class_mpi_any(&abort,ppt->error_message),
+               ppt->error_message,
+               ppt->error_message);
+
+    if (abort == _TRUE_) return _FAILURE_;
+
+    /** - --> (e) in an MPI run, gather the source functions of all processes with perturb_sources_mpi_gather() */
+
+    if (class_mpi_size() > 1) {
+      class_call(perturb_sources_mpi_gather(ppt,index_md,task_rank),
+                 ppt->error_message,
+                 ppt->error_message);
+      class_call(class_mpi_sum(task_cost,task_size,ppt->error_message),
+                 ppt->error_message,
+                 ppt->error_message);
+    }
+
+#ifdef _OPENMP
+    /* report the fraction of the duration of the loop during which each thread was busy */
+    tloop = omp_get_wtime()-tloop;
+
+    if ((ppt->perturbations_verbose > 1) && (tloop > 0.)) {
+      printf(" -> loop over %d wavenumbers and %d ic took %e s; thread utilization:",ppt->k_size[index_md],ppt->ic_size[index_md],tloop);
+      for (thread=0; thread<number_of_threads; thread++)
+        printf(" %.0f%%",100.*thread_busy[thread]/tloop);
+      printf("\n");
+    }
+
+    /* keep the cost of each task for scheduling the next run (unless some tasks were skipped, their cost being unknown) */
+    if (k_from_cache_mode == 0) {
+      class_call(perturb_task_cost_store(ppt,index_md,task_cost),
+                 ppt->error_message,
+                 ppt->error_message);
+    }
+#endif
 
-      if (abort == _TRUE_) return _FAILURE_;
+    free(task_order);
+    free(task_cost);
+    free(task_rank);
 
-    } /* end of loop over initial conditions */
+    class_call(perturb_switch_schedule_free(ppt),
+               ppt->error_message,
+               ppt->error_message);
 
     abort = _FALSE_;
 
+    evolver_ndf15_statistics_init(&ndf15_statistics);
+
 #pragma omp parallel                                \
-  shared(pppw,ppt,index_md,abort,number_of_threads) \
+  shared(pppw,ppt,index_md,abort,number_of_threads,ndf15_statistics) \
   private(thread)                                   \
   num_threads(number_of_threads)
 
@@ -840,147 +978,1586 @@ int perturb_init(
       thread=omp_get_thread_num();
 #endif
 
+      /* add the count of calls to perturb_approximations() in switch searches of this thread to the total */
+#pragma omp critical (approx_switch_calls)
+      {
+        ppt->approx_switch_calls += pppw[thread]->approx_switch_calls;
+        ppt->approx_switch_calls_saved += pppw[thread]->approx_switch_calls_saved;
+        ppt->vector_requests += pppw[thread]->vector_arena.requests;
+        ppt->vector_allocations += pppw[thread]->vector_arena.allocations;
+      }
+
       class_call_parallel(perturb_workspace_free(ppt,index_md,pppw[thread]),
                           ppt->error_message,
                           ppt->error_message);
 
+      /* release the workspaces that the evolvers kept for this thread, and add the statistics of the stiff one to the total */
+      evolver_ndf15_workspace_free();
+      evolver_rk_workspace_free();
+
+#pragma omp critical (ndf15_statistics)
+      evolver_ndf15_statistics_collect(&ndf15_statistics);
+
+      /* add the longrange module counters of this thread to the total */
+#pragma omp critical (lrs_counters)
+      lrs_counters_collect(&(ppt->lrs_counters));
+
     } /* end of parallel region */
 
     if (abort == _TRUE_) return _FAILURE_;
 
+    if ((ppt->perturbations_verbose > 1) && (ndf15_statistics.calls > 0)) {
+      printf(" -> stiff evolver: %ld calls, %ld workspace allocations, %ld steps (%ld failed), %ld derivative evaluations, %ld Jacobians, %ld LU decompositions for %ld linear solves\n",
+             ndf15_statistics.calls,
+             ndf15_statistics.allocations,
+             ndf15_statistics.stepstat[0],
+             ndf15_statistics.stepstat[1],
+             ndf15_statistics.stepstat[2],
+             ndf15_statistics.stepstat[3],
+             ndf15_statistics.stepstat[4],
+             ndf15_statistics.stepstat[5]);
+    }
+
   } /* end loop over modes */
 
   free(pppw);
 
-  /** - spline the source array with respect to the time variable */
+#ifdef _OPENMP
+  free(thread_busy);
+#endif
 
-  if (ppt->ln_tau_size > 1) {
+  for (index_md = 0; index_md < ppt->md_size; index_md++)
+    free(k_from_cache[index_md]);
+  free(k_from_cache);
 
-    for (index_md = 0; index_md < ppt->md_size; index_md++) {
+  /** - store the newly computed source tables in the cache directory, if any */
 
-      for (index_ic = 0; index_ic < ppt->ic_size[index_md]; index_ic++) {
+  if ((sources_from_cache == _FALSE_) && (class_mpi_rank() == 0)) {
+    class_call(perturb_sources_cache_write(ppt),
+               ppt->error_message,
+               ppt->error_message);
+  }
 
-        abort = _FALSE_;
+  /** - spline the source array with respect to the time variable, and finalize the source tables with perturb_sources_finalize() */
 
-#pragma omp parallel                                     \
-  shared(ppt,index_md,index_ic,abort,number_of_threads)  \
-  private(index_tp)                                      \
-  num_threads(number_of_threads)
+  class_call(perturb_sources_finalize(ppr,
+                                      pba,
+                                      ppt),
+             ppt->error_message,
+             ppt->error_message);
 
-        {
+  ppt->memory_size = class_memory_growth(heap_start);
+  class_profile_stop(profile_perturb_init);
+  return _SUCCESS_;
+}
 
-#pragma omp for schedule (dynamic)
+/**
+ * First part of perturb_init(): perform the preliminary checks,
+ * initialize all indices, define the k and tau samplings, and
+ * allocate the source tables (as well as the storage of the
+ * perturbations requested in k_output_values).
+ *
+ * If no perturbation is requested, return immediately with
+ * ppt->has_perturbations set to _FALSE_.
+ *
+ * @param ppr Input: pointer to precision structure
+ * @param pba Input: pointer to background structure
+ * @param pth Input: pointer to thermodynamics structure
+ * @param ppt Input/Output: perturbation structure
+ * @return the error status
+ */
 
-          for (index_tp = 0; index_tp < ppt->tp_size[index_md]; index_tp++) {
+int perturb_prepare(
+                    struct precision * ppr,
+                    struct background * pba,
+                    struct thermo * pth,
+                    struct perturbs * ppt
+                    ) {
 
-            class_call_parallel(array_spline_table_lines(ppt->ln_tau,
-                                                         ppt->ln_tau_size,
-                                                         ppt->late_sources[index_md][index_ic * ppt->tp_size[index_md] + index_tp],
-                                                         ppt->k_size[index_md],
-                                                         ppt->ddlate_sources[index_md][index_ic*ppt->tp_size[index_md] + index_tp],
-                                                         _SPLINE_EST_DERIV_,
-                                                         ppt->error_message),
-                                ppt->error_message,
-                                ppt->error_message);
+  /* background quantities */
+  double w_fld_ini, w_fld_0,dw_over_da_fld,integral_fld;
 
-          }
+  /** - initialize the total of the longrange module counters of all threads */
 
-        } /* end of parallel region */
+  lrs_counters_init(&(ppt->lrs_counters));
 
-        if (abort == _TRUE_) return _FAILURE_;
+  /** - initialize the count of calls to perturb_approximations() in switch searches, and the (empty) tight-coupling switch schedule */
 
-      } /* end of loop over initial condition */
+  ppt->approx_switch_calls = 0;
+  ppt->approx_switch_calls_saved = 0;
+  ppt->vector_requests = 0;
+  ppt->vector_allocations = 0;
+  ppt->switch_schedule_size = 0;
+  ppt->switch_schedule_step = 0.;
+  ppt->switch_schedule_lnk = NULL;
+  ppt->switch_schedule_lntau = NULL;
 
-    } /* end of loop over mode */
+  /** - the source tables are filled in double precision */
+
+  ppt->sources_single_precision = _FALSE_;
+  ppt->sources_map = NULL;
+  ppt->sources_block = NULL;
+  ppt->sources_released = _FALSE_;
+
+  /** - perform preliminary checks */
 
+  if (ppt->has_perturbations == _FALSE_) {
+    if (ppt->perturbations_verbose > 0)
+      printf("No sources requested. Perturbation module skipped.\n");
+    return _SUCCESS_;
+  }
+  else {
+    if (ppt->perturbations_verbose > 0)
+      printf("Computing sources\n");
   }
 
-  return _SUCCESS_;
-}
+  class_test((ppt->gauge == synchronous) && (pba->has_cdm == _FALSE_),
+             ppt->error_message,
+             "In the synchronous gauge, it is not self-consistent to assume no CDM: the later is used to define the initial timelike hypersurface. You can either add a negligible amount of CDM or switch to newtonian gauge");
 
-/**
- * Free all memory space allocated by perturb_init().
- *
- * To be called at the end of each run, only when no further calls to
- * perturb_sources_at_tau() are needed.
- *
- * @param ppt Input: perturbation structure to be freed
- * @return the error status
- */
+  class_test ((ppr->tight_coupling_approximation < first_order_MB) ||
+              (ppr->tight_coupling_approximation > compromise_CLASS),
+              ppt->error_message,
+              "your tight_coupling_approximation is set to %d, out of range defined in perturbations.h",ppr->tight_coupling_approximation);
 
-int perturb_free(
-                 struct perturbs * ppt
-                 ) {
+  class_test ((ppr->radiation_streaming_approximation < rsa_null) ||
+              (ppr->radiation_streaming_approximation > rsa_none),
+              ppt->error_message,
+              "your radiation_streaming_approximation is set to %d, out of range defined in perturbations.h",ppr->radiation_streaming_approximation);
 
-  int index_md,index_ic,index_tp;
-  int filenum;
+  if (pba->has_idr == _TRUE_){
+    class_test ((ppr->idr_streaming_approximation < rsa_idr_none) ||
+                (ppr->idr_streaming_approximation > rsa_idr_MD),
+                ppt->error_message,
+                "your idr_radiation_streaming_approximation is set to %d, out of range defined in perturbations.h",ppr->idr_streaming_approximation);
+  }
 
-  if (ppt->has_perturbations == _TRUE_) {
+  if (pba->has_ur == _TRUE_) {
 
-    for (index_md = 0; index_md < ppt->md_size; index_md++) {
+    class_test ((ppr->ur_fluid_approximation < ufa_mb) ||
+                (ppr->ur_fluid_approximation > ufa_none),
+                ppt->error_message,
+                "your ur_fluid_approximation is set to %d, out of range defined in perturbations.h",ppr->ur_fluid_approximation);
+  }
 
-      for (index_ic = 0; index_ic < ppt->ic_size[index_md]; index_ic++) {
+  if (pba->has_ncdm == _TRUE_) {
 
-        for (index_tp = 0; index_tp < ppt->tp_size[index_md]; index_tp++) {
+    class_test ((ppr->ncdm_fluid_approximation < ncdmfa_mb) ||
+                (ppr->ncdm_fluid_approximation > ncdmfa_none),
+                ppt->error_message,
+                "your ncdm_fluid_approximation is set to %d, out of range defined in perturbations.h",ppr->ncdm_fluid_approximation);
 
-          free(ppt->sources[index_md][index_ic*ppt->tp_size[index_md]+index_tp]);
-          if (ppt->ln_tau_size > 1)
-            free(ppt->ddlate_sources[index_md][index_ic*ppt->tp_size[index_md]+index_tp]);
+    if (ppt->has_nc_density == _TRUE_) {
+      if (ppt->perturbations_verbose > 0) {
+        fprintf(stdout," -> [WARNING:] You request the number count Cl's in presence of non-cold dark matter.\n    Like in all previous CLASS and CLASSgal versions, this will be inferred from the total matter density,\n    but it could make much more sense physically to compute it from the CDM+baryon density only.\n    To get the latter behavior you would just need to change one line in transfer.c:\n    search there for a comment starting with 'use here delta_cb'\n");
+      }
+    }
 
-        }
+  }
+
+  if (pba->has_lrs == _TRUE_) {
+
+    class_test ((ppr->lrs_fluid_approximation < lrsfa_mb) ||
+                (ppr->lrs_fluid_approximation > lrsfa_none),
+                ppt->error_message,
+                "your lrs_fluid_approximation is set to %d, out of range defined in perturbations.h",ppr->lrs_fluid_approximation);
+
+    if (ppt->has_nc_density == _TRUE_) {
+      if (ppt->perturbations_verbose > 0) {
+        fprintf(stdout," -> [WARNING:] You request the number count Cl's in presence of non-cold dark matter.\n    Like in all previous CLASS and CLASSgal versions, this will be inferred from the total matter density,\n    but it could make much more sense physically to compute it from the CDM+baryon density only.\n    To get the latter behavior you would just need to change one line in transfer.c:\n    search there for a comment starting with 'use here delta_cb'\n");
       }
+    }
 
-      free(ppt->sources[index_md]);
-      free(ppt->late_sources[index_md]);
-      free(ppt->ddlate_sources[index_md]);
+  }
 
-      free(ppt->k[index_md]);
+  if (pba->has_fld == _TRUE_) {
+
+    /* check values of w_fld at initial time and today */
+    class_call(background_w_fld(pba,     0.,   &w_fld_ini,&dw_over_da_fld,&integral_fld), pba->error_message, ppt->error_message);
+    class_call(background_w_fld(pba,pba->a_today,&w_fld_0,&dw_over_da_fld,&integral_fld), pba->error_message, ppt->error_message);
+
+    class_test(w_fld_ini >= 0.,
+               ppt->error_message,
+               "The fluid is meant to be negligible at early time, and unimportant for defining the initial conditions of other species. You are using parameters for which this assumption may break down, since at early times you have w_fld(a--->0) = %e >= 0",w_fld_ini);
+
+    if (pba->use_ppf == _FALSE_) {
+
+      class_test((w_fld_ini +1.0)*(w_fld_0+1.0) <= 0.0,
+                 ppt->error_message,
+                 "w crosses -1 between the infinite past and today, and this would lead to divergent perturbation equations for the fluid perturbations. Try to switch to PPF scheme: use_ppf = yes");
+
+      /* the next check is meaningful at least for w(a) = w0 + wa*(1-a/a0); for general formulas and with use_ppf=no, you may prefer to comment it out... */
+      class_test((w_fld_0 == -1.) && (dw_over_da_fld == 0.),
+                 ppt->error_message,
+                 "Your choice of a fluid with (w0,wa)=(-1,0) is not valid due to instabilities in the unphysical perturbations of such a fluid. Try instead with a plain cosmological constant or with PPF scheme: use_ppf = yes");
 
     }
 
-    free(ppt->tau_sampling);
-    if (ppt->ln_tau_size > 1)
-      free(ppt->ln_tau);
+  }
 
-    free(ppt->tp_size);
+  if (pba->has_dcdm == _TRUE_) {
+
+    class_test((ppt->has_cdi == _TRUE_) || (ppt->has_bi == _TRUE_) || (ppt->has_nid == _TRUE_) || (ppt->has_niv == _TRUE_),
+               ppt->error_message,
+               "Non-adiabatic initial conditions not coded in presence of decaying dark matter");
+
+  }
+
+  class_test(ppt->has_vectors == _TRUE_,
+             ppt->error_message,
+             "Vectors not coded yet");
+
+  if ((ppt->has_niv == _TRUE_) && (ppt->perturbations_verbose > 0)) {
+    printf("Warning: the niv initial conditions in CLASS (and also in CAMB) should still be double-checked: if you want to do it and send feedback, you are welcome!\n");
+  }
+
+  if (ppt->has_tensors == _TRUE_) {
+
+    ppt->evolve_tensor_ur = _FALSE_;
+    ppt->evolve_tensor_ncdm = _FALSE_;
+    ppt->evolve_tensor_lrs = _FALSE_;
+    ppt->tensor_lrs_in_ur = _FALSE_;
+
+    switch (ppt->tensor_method) {
+
+    case (tm_photons_only):
+      break;
+
+    case (tm_massless_approximation):
+      if ((pba->has_ur == _TRUE_) || (pba->has_ncdm == _TRUE_))
+        ppt->evolve_tensor_ur = _TRUE_;
+      break;
+
+    case (tm_exact):
+      if (pba->has_ur == _TRUE_)
+        ppt->evolve_tensor_ur = _TRUE_;
+      if (pba->has_ncdm == _TRUE_)
+        ppt->evolve_tensor_ncdm = _TRUE_;
+      break;
+    }
+
+    /* the lrs fermions have their own method (by default, the one
+       of the other species), and are neglected when there are only
+       photons or when their density is below a threshold. As
+       massless, they are included in the ur hierarchy, which is
+       independent of the species */
+    if ((pba->has_lrs == _TRUE_) &&
+        (ppt->tensor_method != tm_photons_only) &&
+        (pba->Omega0_lrs >= ppr->tensor_lrs_Omega0_threshold)) {
+
+      switch (ppt->tensor_method_lrs) {
+
+      case (tm_photons_only):
+        break;
+
+      case (tm_massless_approximation):
+        ppt->evolve_tensor_ur = _TRUE_;
+        ppt->tensor_lrs_in_ur = _TRUE_;
+        break;
+
+      case (tm_exact):
+        ppt->evolve_tensor_lrs = _TRUE_; // We have *NOT* implemented long-range interactions in tensor perturbations
+        break;
+      }
+    }
+  }
+
+  class_test((pba->h > _h_BIG_) || (pba->h < _h_SMALL_),
+             ppt->error_message,
+             "Your value of pba->h=%e is out of the bounds [%e , %e] and could cause a crash of the perturbation ODE integration. If you want to force this barrier, you may comment it out in perturbation.c",
+             pba->h,
+             _h_SMALL_,
+             _h_BIG_);
+
+  class_test((pba->Omega0_b*pba->h*pba->h < _omegab_SMALL_) || (pba->Omega0_b*pba->h*pba->h > _omegab_BIG_),
+             ppt->error_message,
+             "Your value of omega_b=%e is out of the bounds [%e , %e] and could cause a crash of the perturbation ODE integration. If you want to force this barrier, you may comment it out in perturbation.c",
+             pba->Omega0_b*pba->h*pba->h,
+             _omegab_SMALL_,
+             _omegab_BIG_);
+
+  /** - initialize all indices and lists in perturbs structure using perturb_indices_of_perturbs() */
+
+  class_call(perturb_indices_of_perturbs(ppr,
+                                         pba,
+                                         pth,
+                                         ppt),
+             ppt->error_message,
+             ppt->error_message);
+
+
+  if (ppt->z_max_pk > pth->z_rec) {
+
+    class_test(ppt->has_cmb == _TRUE_,
+               ppt->error_message,
+               "You requested a very high z_pk=%e, higher than z_rec=%e. This works very well when you don't ask for a calculation of the CMB source function(s). Remove any CMB from your output and try e.g. with 'output=mTk' or 'output=mTk,vTk'",
+               ppt->z_max_pk,
+               pth->z_rec);
+
+    class_test(ppt->has_source_delta_m == _TRUE_,
+               ppt->error_message,
+               "You requested a very high z_pk=%e, higher than z_rec=%e. This works very well when you ask only transfer functions, e.g. with 'output=mTk' or 'output=mTk,vTk'. But if you need the total matter (e.g. with 'mPk', 'dCl', etc.) there is an issue with the calculation of delta_m at very early times. By default, delta_m is a gauge-invariant variable (the density fluctuation in comoving gauge) and this quantity is hard to get accurately at very early times. The solution is to define delta_m as the density fluctuation in the current gauge, synchronous or newtonian. For the moment this must be done manually by commenting the line 'ppw->delta_m += 3. *ppw->pvecback[pba->index_bg_a]*ppw->pvecback[pba->index_bg_H] * ppw->theta_m/k2;' in perturb_sources(). In the future there will be an option for doing it in an easier way.",
+               ppt->z_max_pk,
+               pth->z_rec);
+
+  }
+
+
+
+  /** - define the common time sampling for all sources using
+      perturb_timesampling_for_sources() */
+
+  class_call(perturb_timesampling_for_sources(ppr,
+                                              pba,
+                                              pth,
+                                              ppt),
+             ppt->error_message,
+             ppt->error_message);
+
+  /** - if we want to store perturbations for given k values, write titles and allocate storage */
+
+  class_call(perturb_prepare_k_output(pba,ppt),
+             ppt->error_message,
+             ppt->error_message);
+
+  return _SUCCESS_;
+}
+
+/**
+ * Last part of perturb_init(), once the source tables are filled:
+ * spline the late sources with respect to log(tau), and if requested
+ * keep only a single-precision copy of the tables.
+ *
+ * @param ppr Input: pointer to precision structure
+ * @param pba Input: pointer to background structure
+ * @param ppt Input/Output: perturbation structure
+ * @return the error status
+ */
+
+int perturb_sources_finalize(
+                             struct precision * ppr,
+                             struct background * pba,
+                             struct perturbs * ppt
+                             ) {
+
+  int index_md;
+  int index_ic;
+  int index_tp;
+  int number_of_threads=1;
+  int abort;
+  struct parallel_timer timer;
+
+#ifdef _OPENMP
+#pragma omp parallel
+  {
+    number_of_threads = omp_get_num_threads();
+  }
+#endif
+
+  /** - spline the source array with respect to the time variable */
+
+  if (ppt->ln_tau_size > 1) {
+
+    for (index_md = 0; index_md < ppt->md_size; index_md++) {
+
+      for (index_ic = 0; index_ic < ppt->ic_size[index_md]; index_ic++) {
+
+        abort = _FALSE_;
+
+        parallel_timer_start(&timer);
+
+#pragma omp parallel                                     \
+  shared(ppt,index_md,index_ic,abort,number_of_threads,timer) \
+  private(index_tp)                                      \
+  num_threads(number_of_threads)
+
+        {
+
+#pragma omp for schedule (dynamic) nowait
+
+          for (index_tp = 0; index_tp < ppt->tp_size[index_md]; index_tp++) {
+
+            class_call_parallel(array_spline_table_lines(ppt->ln_tau,
+                                                         ppt->ln_tau_size,
+                                                         ppt->late_sources[index_md][index_ic * ppt->tp_size[index_md] + index_tp],
+                                                         ppt->k_size[index_md],
+                                                         ppt->ddlate_sources[index_md][index_ic*ppt->tp_size[index_md] + index_tp],
+                                                         _SPLINE_EST_DERIV_,
+                                                         ppt->error_message),
+                                ppt->error_message,
+                                ppt->error_message);
+
+          }
+
+          parallel_timer_thread_done(&timer);
+
+        } /* end of parallel region */
+
+        parallel_timer_stop(&timer,"perturb_sources_finalize: source loop");
+
+        if (abort == _TRUE_) return _FAILURE_;
+
+      } /* end of loop over initial condition */
+
+    } /* end of loop over mode */
+
+  }
+
+  /** - if requested, keep only a single-precision copy of the source tables */
+
+  if (ppr->perturb_sources_single_precision == _TRUE_) {
+    class_call(perturb_sources_to_single_precision(ppt),
+               ppt->error_message,
+               ppt->error_message);
+  }
+
+  if ((ppt->perturbations_verbose > 1) && (ppt->approx_switch_calls+ppt->approx_switch_calls_saved > 0))
+    printf(" -> approximation switches: %ld calls to perturb_approximations(), %ld saved by analytic switches and the tight-coupling schedule\n",
+           ppt->approx_switch_calls,
+           ppt->approx_switch_calls_saved);
+
+  if ((ppt->perturbations_verbose > 1) && (ppt->vector_requests > 0))
+    printf(" -> perturbation vectors: %ld set up, %ld allocations\n",
+           ppt->vector_requests,
+           ppt->vector_allocations);
+
+  if ((ppt->perturbations_verbose > 1) && (pba->has_lrs == _TRUE_))
+    lrs_counters_print("perturbations",&(ppt->lrs_counters));
+
+  return _SUCCESS_;
+}
+
+/**
+ * Initialize the perturbs structures of a batch of models sharing the
+ * same k and tau samplings, e.g. nearby cosmologies for Fisher
+ * derivatives.
+ *
+ * Each model comes with its own precision, background and
+ * thermodynamics structures (already initialized), and with the
+ * perturbs structure filled by the input module. The models must
+ * differ only by parameters which do not change the number and types
+ * of source functions (same modes, initial conditions, source types
+ * and k_output_values).
+ *
+ * The k lists of all models are those of the first one, and the tau
+ * sampling of each model is that of the first one multiplied by the
+ * ratio of their conformal ages (so that it ends exactly today). The
+ * source tables of all models are stored in a single block,
+ * ppt[0].sources_block, with indices
+ * [index_model][index_md][index_ic * tp_size + index_tp][index_tau * k_size + index_k],
+ * and ppt[index_model].sources[index_md][...] point inside it. All
+ * pairs of models and wavenumbers of a given mode are handed out to
+ * the threads in a single dynamic loop, model after model, and within
+ * each model the most expensive wavenumbers first (see
+ * perturb_task_schedule()), each thread using one workspace per model.
+ * Threads done with a model thus go on with the next one instead of
+ * waiting for the last wavenumbers, while consecutive tasks of a
+ * thread mostly read the background and thermodynamics tables of the
+ * same model (alternating models at each task made the batch slower
+ * than separate calls on a single core).
+ *
+ * The cache of source functions is not used in batch mode. The
+ * structures must be freed with perturb_free_batch().
+ *
+ * @param ppr        Input: array of batch_size precision structures
+ * @param pba        Input: array of batch_size background structures
+ * @param pth        Input: array of batch_size thermodynamics structures
+ * @param ppt        Input/Output: array of batch_size perturbation structures; errors are reported in ppt[0]
+ * @param batch_size Input: number of models
+ * @return the error status
+ */
+
+int perturb_init_batch(
+                       struct precision * ppr,
+                       struct background * pba,
+                       struct thermo * pth,
+                       struct perturbs * ppt,
+                       int batch_size
+                       ) {
+
+  int index_model;
+  int index_md;
+  int index_ic;
+  int index_ic_tp;
+  int index_k;
+  int number_of_threads=1;
+  int thread=0;
+  int abort;
+  size_t sz;
+  size_t model_size;
+  size_t offset;
+  double * block;
+  struct perturb_workspace ** pppw;
+
+  /* pairs of initial conditions and wavenumbers of a mode (identical for all models), in the order in which they are handed out to threads, and measured cost of each of them for the first model */
+  int task_size;
+  int index_task;
+  int * task_order;
+  double * task_cost;
+
+  /* statistics of the stiff evolver, summed over the threads */
+  struct evolver_ndf15_statistics ndf15_statistics;
+
+#ifdef _OPENMP
+  double tstart;
+  double tloop;
+#endif
+  struct parallel_timer timer;
+
+  class_test(batch_size < 1,
+             ppt->error_message,
+             "a batch should contain at least one model, not %d",batch_size);
+
+  /** - prepare each model with perturb_prepare(); all models but the first one take their samplings from the first one */
+
+  for (index_model = 0; index_model < batch_size; index_model++) {
+
+    ppt[index_model].grid_reference = (index_model == 0 ? NULL : ppt);
+
+    class_call(perturb_prepare(ppr+index_model,
+                               pba+index_model,
+                               pth+index_model,
+                               ppt+index_model),
+               ppt[index_model].error_message,
+               ppt->error_message);
+  }
+
+  /** - check that all models have source tables of the same size */
+
+  for (index_model = 1; index_model < batch_size; index_model++) {
+
+    class_test((ppt[index_model].has_perturbations != ppt->has_perturbations) ||
+               (ppt[index_model].md_size != ppt->md_size),
+               ppt->error_message,
+               "model %d of the batch does not request the same perturbations as model 0",index_model);
+
+    if (ppt->has_perturbations == _FALSE_)
+      continue;
+
+    for (index_md = 0; index_md < ppt->md_size; index_md++) {
+      class_test((ppt[index_model].ic_size[index_md] != ppt->ic_size[index_md]) ||
+                 (ppt[index_model].tp_size[index_md] != ppt->tp_size[index_md]),
+                 ppt->error_message,
+                 "model %d of the batch does not have the same initial conditions and source types as model 0 for mode %d",index_model,index_md);
+    }
+  }
+
+  if (ppt->has_perturbations == _FALSE_)
+    return _SUCCESS_;
+
+  class_test(ppt->md_size > _MAX_NUMBER_OF_MODES_,
+             ppt->error_message,
+             "increase _MAX_NUMBER_OF_MODES_ to at least %d",ppt->md_size);
+
+  /** - replace the source tables of all models by a single block */
+
+  model_size = 0;
+  for (index_md = 0; index_md < ppt->md_size; index_md++)
+    model_size += (size_t)ppt->ic_size[index_md]*ppt->tp_size[index_md]*ppt->k_size[index_md]*ppt->tau_size;
+
+  class_alloc(block,batch_size*model_size*sizeof(double),ppt->error_message);
+
+  for (index_model = 0; index_model < batch_size; index_model++) {
+
+    offset = index_model*model_size;
+    ppt[index_model].sources_block = block+offset;
+
+    for (index_md = 0; index_md < ppt->md_size; index_md++) {
+      for (index_ic_tp = 0; index_ic_tp < ppt->ic_size[index_md]*ppt->tp_size[index_md]; index_ic_tp++) {
+
+        free(ppt[index_model].sources[index_md][index_ic_tp]);
+        ppt[index_model].sources[index_md][index_ic_tp] = block+offset;
+        offset += ppt->k_size[index_md]*ppt->tau_size;
+
+        if (ppt[index_model].ln_tau_size > 1)
+          ppt[index_model].late_sources[index_md][index_ic_tp] = &(ppt[index_model].sources[index_md][index_ic_tp][(ppt->tau_size-ppt[index_model].ln_tau_size) * ppt->k_size[index_md]]);
+      }
+    }
+  }
+
+  /** - create one workspace per model and per thread */
+
+#ifdef _OPENMP
+#pragma omp parallel
+  {
+    number_of_threads = omp_get_num_threads();
+  }
+#endif
+
+  class_alloc(pppw,batch_size * number_of_threads * sizeof(struct perturb_workspace *),ppt->error_message);
+
+  sz = sizeof(struct perturb_workspace);
+
+  /** - loop over modes. For each mode: */
+
+  for (index_md = 0; index_md < ppt->md_size; index_md++) {
+
+    if (ppt->perturbations_verbose > 1)
+      printf("Evolving mode %d/%d for %d models\n",index_md+1,ppt->md_size,batch_size);
+
+    /** - --> (a) initialize the workspaces of all models with perturb_workspace_init() */
+
+    abort = _FALSE_;
+
+#pragma omp parallel                                                    \
+  shared(pppw,ppr,pba,pth,ppt,index_md,abort,number_of_threads,batch_size,sz) \
+  private(thread,index_model)                                           \
+  num_threads(number_of_threads)
+
+    {
+
+#ifdef _OPENMP
+      thread=omp_get_thread_num();
+#endif
+
+      for (index_model = 0; index_model < batch_size; index_model++) {
+
+        class_alloc_parallel(pppw[index_model*number_of_threads+thread],sz,ppt->error_message);
+
+        class_call_parallel(perturb_workspace_init(ppr+index_model,
+                                                   pba+index_model,
+                                                   pth+index_model,
+                                                   ppt+index_model,
+                                                   index_md,
+                                                   pppw[index_model*number_of_threads+thread]),
+                            ppt[index_model].error_message,
+                            ppt->error_message);
+      }
+
+    } /* end of parallel region */
+
+    if (abort == _TRUE_) return _FAILURE_;
+
+    /** - --> (a') build the tight-coupling switch schedule of each model with perturb_switch_schedule_init() */
+
+    for (index_model = 0; index_model < batch_size; index_model++) {
+      class_call(perturb_switch_schedule_init(ppr+index_model,
+                                              pba+index_model,
+                                              pth+index_model,
+                                              ppt+index_model,
+                                              index_md,
+                                              pppw[index_model*number_of_threads]),
+                 ppt[index_model].error_message,
+                 ppt->error_message);
+    }
+
+    /** - --> (b) order the pairs of initial conditions and wavenumbers as for the first model with perturb_task_schedule() */
+
+    task_size = ppt->ic_size[index_md]*ppt->k_size[index_md];
+
+    class_alloc(task_order,task_size*sizeof(int),ppt->error_message);
+    class_alloc(task_cost,task_size*sizeof(double),ppt->error_message);
+
+    class_call(perturb_task_schedule(ppr,ppt,index_md,task_order,NULL),
+               ppt->error_message,
+               ppt->error_message);
+
+    /** - --> (c) loop over all triplets of pair and model in a single parallel region, models varying slowest; for each of them, evolve perturbations and compute source functions with perturb_solve() */
+
+    abort = _FALSE_;
+
+#ifdef _OPENMP
+    tloop = omp_get_wtime();
+#endif
+
+    parallel_timer_start(&timer);
+
+#pragma omp parallel                                                    \
+  shared(pppw,ppr,pba,pth,ppt,index_md,abort,number_of_threads,batch_size,task_size,task_order,task_cost,timer) \
+  private(index_task,index_model,index_ic,index_k,thread,tstart)        \
+  num_threads(number_of_threads)
+
+    {
+
+#ifdef _OPENMP
+      thread=omp_get_thread_num();
+#endif
+
+#pragma omp for schedule (dynamic) nowait
+
+      for (index_task = 0; index_task < batch_size*task_size; index_task++) {
+
+        index_model = index_task / task_size;
+        index_ic = task_order[index_task % task_size] / ppt->k_size[index_md];
+        index_k = task_order[index_task % task_size] % ppt->k_size[index_md];
+
+#ifdef _OPENMP
+        tstart = omp_get_wtime();
+#endif
+
+        class_call_parallel(perturb_solve(ppr+index_model,
+                                          pba+index_model,
+                                          pth+index_model,
+                                          ppt+index_model,
+                                          index_md,
+                                          index_ic,
+                                          index_k,
+                                          pppw[index_model*number_of_threads+thread]),
+                            ppt[index_model].error_message,
+                            ppt->error_message);
+
+#ifdef _OPENMP
+        if (index_model == 0)
+          task_cost[task_order[index_task % task_size]] = omp_get_wtime()-tstart;
+#endif
+
+#pragma omp flush(abort)
+
+      } /* end of loop over pairs and models */
+
+      parallel_timer_thread_done(&timer);
+
+    } /* end of parallel region */
+
+    parallel_timer_stop(&timer,"perturb_init_batch: k loop");
+
+    if (abort == _TRUE_) return _FAILURE_;
+
+#ifdef _OPENMP
+    tloop = omp_get_wtime()-tloop;
+
+    if (ppt->perturbations_verbose > 1)
+      printf(" -> loop over %d models, %d wavenumbers and %d ic took %e s\n",batch_size,ppt->k_size[index_md],ppt->ic_size[index_md],tloop);
+
+    /* keep the cost of each task for scheduling the next run */
+    class_call(perturb_task_cost_store(ppt,index_md,task_cost),
+               ppt->error_message,
+               ppt->error_message);
+#endif
+
+    free(task_order);
+    free(task_cost);
+
+    for (index_model = 0; index_model < batch_size; index_model++) {
+      class_call(perturb_switch_schedule_free(ppt+index_model),
+                 ppt[index_model].error_message,
+                 ppt->error_message);
+    }
+
+    /** - --> (d) free the workspaces */
+
+    abort = _FALSE_;
+
+    evolver_ndf15_statistics_init(&ndf15_statistics);
+
+#pragma omp parallel                                                    \
+  shared(pppw,ppt,index_md,abort,number_of_threads,batch_size,ndf15_statistics) \
+  private(thread,index_model)                                           \
+  num_threads(number_of_threads)
+
+    {
+
+#ifdef _OPENMP
+      thread=omp_get_thread_num();
+#endif
+
+      for (index_model = 0; index_model < batch_size; index_model++) {
+
+#pragma omp critical (approx_switch_calls)
+        {
+          ppt[index_model].approx_switch_calls += pppw[index_model*number_of_threads+thread]->approx_switch_calls;
+          ppt[index_model].approx_switch_calls_saved += pppw[index_model*number_of_threads+thread]->approx_switch_calls_saved;
+          ppt[index_model].vector_requests += pppw[index_model*number_of_threads+thread]->vector_arena.requests;
+          ppt[index_model].vector_allocations += pppw[index_model*number_of_threads+thread]->vector_arena.allocations;
+        }
+
+        class_call_parallel(perturb_workspace_free(ppt+index_model,index_md,pppw[index_model*number_of_threads+thread]),
+                            ppt[index_model].error_message,
+                            ppt->error_message);
+      }
+
+      /* release the workspaces that the evolvers kept for this thread, and add the statistics of the stiff one to the total */
+      evolver_ndf15_workspace_free();
+      evolver_rk_workspace_free();
+
+#pragma omp critical (ndf15_statistics)
+      evolver_ndf15_statistics_collect(&ndf15_statistics);
+
+      /* add the longrange module counters of this thread to the total (of all models) */
+#pragma omp critical (lrs_counters)
+      lrs_counters_collect(&(ppt->lrs_counters));
+
+    } /* end of parallel region */
+
+    if (abort == _TRUE_) return _FAILURE_;
+
+    if ((ppt->perturbations_verbose > 1) && (ndf15_statistics.calls > 0)) {
+      printf(" -> stiff evolver: %ld calls, %ld workspace allocations, %ld steps (%ld failed), %ld derivative evaluations, %ld Jacobians, %ld LU decompositions for %ld linear solves\n",
+             ndf15_statistics.calls,
+             ndf15_statistics.allocations,
+             ndf15_statistics.stepstat[0],
+             ndf15_statistics.stepstat[1],
+             ndf15_statistics.stepstat[2],
+             ndf15_statistics.stepstat[3],
+             ndf15_statistics.stepstat[4],
+             ndf15_statistics.stepstat[5]);
+    }
+
+  } /* end loop over modes */
+
+  free(pppw);
+
+  /** - finalize the source tables of each model with perturb_sources_finalize() */
+
+  for (index_model = 0; index_model < batch_size; index_model++) {
+    class_call(perturb_sources_finalize(ppr+index_model,
+                                        pba+index_model,
+                                        ppt+index_model),
+               ppt[index_model].error_message,
+               ppt->error_message);
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Free the perturbs structures of a batch of models initialized by
+ * perturb_init_batch(), and the block of their source tables.
+ *
+ * @param ppt        Input: array of batch_size perturbation structures
+ * @param batch_size Input: number of models
+ * @return the error status
+ */
+
+int perturb_free_batch(
+                       struct perturbs * ppt,
+                       int batch_size
+                       ) {
+
+  int index_model;
+  double * block;
+
+  block = ppt->sources_block;
+
+  for (index_model = 0; index_model < batch_size; index_model++) {
+    class_call(perturb_free(ppt+index_model),
+               ppt[index_model].error_message,
+               ppt->error_message);
+  }
+
+  if ((ppt->has_perturbations == _TRUE_) && (block != NULL))
+    free(block);
+
+  return _SUCCESS_;
+}
+
+/**
+ * Free the source tables allocated by perturb_init() (or the memory
+ * map of the cache file they were read from), keeping the samplings
+ * and indices until perturb_free(). With the low_memory profile, this
+ * is called by the transfer or spectra module once the sources have
+ * been used, so that they do not stay in memory with the tables of
+ * the next modules. Any later access to the sources returns an error.
+ *
+ * The sources of a batch of models (see perturb_init_batch()) are not
+ * freed before perturb_free_batch().
+ *
+ * @param ppt Input/Output: perturbation structure
+ * @return the error status
+ */
+
+int perturb_free_sources(
+                         struct perturbs * ppt
+                         ) {
+
+  size_t heap_start,heap_end;
+
+  if ((ppt->has_perturbations == _FALSE_) || (ppt->sources_released == _TRUE_) || (ppt->sources_block != NULL))
+    return _SUCCESS_;
+
+  heap_start = class_memory_heap();
+
+  class_call(perturb_free_source_tables(ppt),
+             ppt->error_message,
+             ppt->error_message);
+
+  heap_end = class_memory_heap();
+  if (heap_start > heap_end)
+    ppt->memory_size -= MIN(ppt->memory_size,heap_start-heap_end);
+
+  if (ppt->perturbations_verbose > 1)
+    printf(" -> source functions freed (low_memory)\n");
+
+  return _SUCCESS_;
+}
+
+/**
+ * Free the source tables (called by perturb_free_sources() and
+ * perturb_free()), except those pointing inside a memory map or a
+ * block shared by a batch of models.
+ *
+ * @param ppt Input/Output: perturbation structure
+ * @return the error status
+ */
+
+int perturb_free_source_tables(
+                               struct perturbs * ppt
+                               ) {
+
+  int index_md,index_ic,index_tp;
+
+  for (index_md = 0; index_md < ppt->md_size; index_md++) {
+
+    for (index_ic = 0; index_ic < ppt->ic_size[index_md]; index_ic++) {
+
+      for (index_tp = 0; index_tp < ppt->tp_size[index_md]; index_tp++) {
+
+        if ((ppt->sources_map == NULL) && (ppt->sources_block == NULL))
+          free(ppt->sources[index_md][index_ic*ppt->tp_size[index_md]+index_tp]);
+        if (ppt->ln_tau_size > 1)
+          free(ppt->ddlate_sources[index_md][index_ic*ppt->tp_size[index_md]+index_tp]);
+
+      }
+    }
+
+    free(ppt->sources[index_md]);
+    free(ppt->late_sources[index_md]);
+    free(ppt->ddlate_sources[index_md]);
+
+    if (ppt->sources_single_precision == _TRUE_) {
+      for (index_ic = 0; index_ic < ppt->ic_size[index_md]; index_ic++) {
+        for (index_tp = 0; index_tp < ppt->tp_size[index_md]; index_tp++) {
+          free(ppt->sources_float[index_md][index_ic*ppt->tp_size[index_md]+index_tp]);
+          if (ppt->ln_tau_size > 1)
+            free(ppt->ddlate_sources_float[index_md][index_ic*ppt->tp_size[index_md]+index_tp]);
+        }
+      }
+      free(ppt->sources_float[index_md]);
+      free(ppt->ddlate_sources_float[index_md]);
+    }
+
+  }
+
+  free(ppt->sources);
+  free(ppt->late_sources);
+  free(ppt->ddlate_sources);
+
+  if (ppt->sources_map != NULL)
+    munmap(ppt->sources_map,ppt->sources_map_size);
+
+  if (ppt->sources_single_precision == _TRUE_) {
+    free(ppt->sources_float);
+    free(ppt->ddlate_sources_float);
+  }
+
+  ppt->sources = NULL;
+  ppt->late_sources = NULL;
+  ppt->ddlate_sources = NULL;
+  ppt->sources_float = NULL;
+  ppt->ddlate_sources_float = NULL;
+  ppt->sources_map = NULL;
+  ppt->sources_released = _TRUE_;
+
+  return _SUCCESS_;
+}
+
+/**
+ * Free all memory space allocated by perturb_init().
+ *
+ * To be called at the end of each run, only when no further calls to
+ * perturb_sources_at_tau() are needed.
+ *
+ * @param ppt Input: perturbation structure to be freed
+ * @return the error status
+ */
+
+int perturb_free(
+                 struct perturbs * ppt
+                 ) {
+
+  int index_md;
+  int filenum;
+
+  if (ppt->has_perturbations == _TRUE_) {
+
+    if (ppt->sources_released == _FALSE_) {
+      class_call(perturb_free_source_tables(ppt),
+                 ppt->error_message,
+                 ppt->error_message);
+    }
+
+    for (index_md = 0; index_md < ppt->md_size; index_md++)
+      free(ppt->k[index_md]);
+
+    free(ppt->tau_sampling);
+    if (ppt->ln_tau_size > 1)
+      free(ppt->ln_tau);
+
+    free(ppt->tp_size);
+
+    free(ppt->ic_size);
+
+    free(ppt->k);
+
+    free(ppt->k_size_cmb);
+
+    free(ppt->k_size_cl);
+
+    free(ppt->k_size);
+
+    if (ppt->alpha_idm_dr != NULL)
+      free(ppt->alpha_idm_dr);
+
+    if (ppt->beta_idr != NULL)
+      free(ppt->beta_idr);
+
+    /** Stuff related to perturbations output: */
+
+    /** - Free non-NULL pointers */
+    if (ppt->index_k_output_values != NULL)
+      free(ppt->index_k_output_values);
+
+    for (filenum = 0; filenum<_MAX_NUMBER_OF_K_FILES_; filenum++){
+      if (ppt->scalar_perturbations_data[filenum] != NULL)
+        free(ppt->scalar_perturbations_data[filenum]);
+      if (ppt->vector_perturbations_data[filenum] != NULL)
+        free(ppt->vector_perturbations_data[filenum]);
+      if (ppt->tensor_perturbations_data[filenum] != NULL)
+        free(ppt->tensor_perturbations_data[filenum]);
+    }
+
+  }
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * Replace the source tables by single-precision copies.
+ *
+ * Called at the end of perturb_init(), once the sources and their
+ * second derivatives at late times are known. This halves the memory
+ * kept by the perturbation module between perturb_init() and
+ * perturb_free(). The relative accuracy of the stored sources becomes
+ * about 1e-7, well below the tolerance of the integration. Later
+ * readers use _get_source_() and perturb_sources_at_tau(), which
+ * handle both storage formats.
+ *
+ * @param ppt Input/Output: perturbation structure
+ * @return the error status
+ */
+
+int perturb_sources_to_single_precision(
+                                        struct perturbs * ppt
+                                        ) {
+
+  int index_md,index_ic_tp,index_tau_k;
+
+  class_alloc(ppt->sources_float,ppt->md_size * sizeof(float **),ppt->error_message);
+  class_alloc(ppt->ddlate_sources_float,ppt->md_size * sizeof(float **),ppt->error_message);
+
+  for (index_md = 0; index_md < ppt->md_size; index_md++) {
+
+    class_alloc(ppt->sources_float[index_md],
+                ppt->ic_size[index_md] * ppt->tp_size[index_md] * sizeof(float *),
+                ppt->error_message);
+
+    class_alloc(ppt->ddlate_sources_float[index_md],
+                ppt->ic_size[index_md] * ppt->tp_size[index_md] * sizeof(float *),
+                ppt->error_message);
+
+    for (index_ic_tp = 0; index_ic_tp < ppt->ic_size[index_md] * ppt->tp_size[index_md]; index_ic_tp++) {
+
+      class_alloc(ppt->sources_float[index_md][index_ic_tp],
+                  ppt->k_size[index_md] * ppt->tau_size * sizeof(float),
+                  ppt->error_message);
+
+      for (index_tau_k = 0; index_tau_k < ppt->k_size[index_md] * ppt->tau_size; index_tau_k++)
+        ppt->sources_float[index_md][index_ic_tp][index_tau_k] = (float)ppt->sources[index_md][index_ic_tp][index_tau_k];
+
+      if ((ppt->sources_map == NULL) && (ppt->sources_block == NULL))
+        free(ppt->sources[index_md][index_ic_tp]);
+      ppt->sources[index_md][index_ic_tp] = NULL;
+
+      if (ppt->ln_tau_size > 1) {
+
+        class_alloc(ppt->ddlate_sources_float[index_md][index_ic_tp],
+                    ppt->k_size[index_md] * ppt->ln_tau_size * sizeof(float),
+                    ppt->error_message);
+
+        for (index_tau_k = 0; index_tau_k < ppt->k_size[index_md] * ppt->ln_tau_size; index_tau_k++)
+          ppt->ddlate_sources_float[index_md][index_ic_tp][index_tau_k] = (float)ppt->ddlate_sources[index_md][index_ic_tp][index_tau_k];
+
+        free(ppt->ddlate_sources[index_md][index_ic_tp]);
+        ppt->ddlate_sources[index_md][index_ic_tp] = NULL;
+        ppt->late_sources[index_md][index_ic_tp] = NULL;
+      }
+    }
+  }
+
+  if (ppt->sources_map != NULL) {
+    munmap(ppt->sources_map,ppt->sources_map_size);
+    ppt->sources_map = NULL;
+  }
+
+  ppt->sources_single_precision = _TRUE_;
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * Stamp of the build of the code which writes or reads the cache
+ * files of the source tables: hash (64-bit FNV-1a) of the version, of
+ * the format of the files, of the sizes of the stored types and of the
+ * date and time at which this file was compiled. It enters the key of
+ * input_perturbations_cache_key() and the header of the files, and a
+ * file with another stamp is never used. Since the Makefile does not
+ * track the dependencies between files, a modification of another
+ * module is only taken into account after 'make clean'.
+ *
+ * @param stamp Output: stamp
+ * @return the error status
+ */
+
+int perturb_sources_cache_stamp(
+                                unsigned long long * stamp
+                                ) {
+
+  const char * build = _VERSION_ " " __DATE__ " " __TIME__;
+  unsigned long long sizes[3] = {_PERTURB_CACHE_FORMAT_,sizeof(long long),sizeof(double)};
+  size_t ib;
+
+  *stamp = 14695981039346656037ULL;
+  for (ib = 0; ib < strlen(build); ib++) {
+    *stamp ^= (unsigned char)build[ib];
+    *stamp *= 1099511628211ULL;
+  }
+  for (ib = 0; ib < 3; ib++) {
+    *stamp ^= sizes[ib];
+    *stamp *= 1099511628211ULL;
+  }
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * Map a cache file of source tables in memory, and check that it was
+ * written for the same family of inputs (see
+ * input_perturbations_cache_key()), with the same modes, initial
+ * conditions, types and time sampling as the current run. The
+ * wavenumbers are not checked.
+ *
+ * The file holds a header (format, build stamp of
+ * perturb_sources_cache_stamp(), key, family key, number of modes,
+ * size of the time sampling, and for each mode the number of initial
+ * conditions, of types and of wavenumbers), the time sampling, the
+ * wavenumbers of each mode and finally the source tables.
+ *
+ * A missing, truncated or mismatching file (including one written by
+ * another build of the code) is not an error: *map is then set to
+ * NULL.
+ *
+ * @param ppt      Input: perturbation structure
+ * @param filename Input: name of the cache file
+ * @param map      Output: read-only map of the file, or NULL
+ * @param map_size Output: size of the map
+ * @return the error status
+ */
+
+int perturb_sources_cache_map(
+                              struct perturbs * ppt,
+                              char * filename,
+                              void ** map,
+                              size_t * map_size
+                              ) {
+
+  FILE * cachefile;
+  struct stat st;
+  int index_md,header_size;
+  size_t size;
+  long long * header;
+  double * values;
+  unsigned long long stamp;
+
+  *map = NULL;
+
+  class_call(perturb_sources_cache_stamp(&stamp),
+             ppt->error_message,
+             ppt->error_message);
+
+  header_size = 6 + 3*ppt->md_size;
+  size = header_size*sizeof(long long) + ppt->tau_size*sizeof(double);
+
+  cachefile = fopen(filename,"rb");
+  if (cachefile == NULL)
+    return _SUCCESS_;
+
+  if ((fstat(fileno(cachefile),&st) != 0) || ((size_t)st.st_size < size)) {
+    fclose(cachefile);
+    return _SUCCESS_;
+  }
+
+  *map = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fileno(cachefile),0);
+  fclose(cachefile);
+  if (*map == MAP_FAILED) {
+    *map = NULL;
+    return _SUCCESS_;
+  }
+  *map_size = st.st_size;
+
+  header = (long long *)(*map);
+  values = (double *)(header+header_size);
+
+  if ((header[0] != _PERTURB_CACHE_FORMAT_) ||
+      ((unsigned long long)header[1] != stamp) ||
+      ((unsigned long long)header[3] != ppt->cache_family_key) ||
+      (header[4] != ppt->md_size) ||
+      (header[5] != ppt->tau_size) ||
+      (memcmp(values,ppt->tau_sampling,ppt->tau_size*sizeof(double)) != 0)) {
+    munmap(*map,*map_size);
+    *map = NULL;
+    return _SUCCESS_;
+  }
+
+  for (index_md = 0; index_md < ppt->md_size; index_md++) {
+    if ((header[6+3*index_md] != ppt->ic_size[index_md]) ||
+        (header[7+3*index_md] != ppt->tp_size[index_md])) {
+      munmap(*map,*map_size);
+      *map = NULL;
+      return _SUCCESS_;
+    }
+    size += (header[8+3*index_md]
+             + ppt->ic_size[index_md]*ppt->tp_size[index_md]*header[8+3*index_md]*ppt->tau_size)*sizeof(double);
+  }
+
+  if (size != *map_size) {
+    munmap(*map,*map_size);
+    *map = NULL;
+  }
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * Try to read the source tables from the cache file of a previous run
+ * with the same inputs.
+ *
+ * Called by perturb_init() once the indices and the k and tau
+ * samplings are known. The cache file is named after ppt->cache_key, a
+ * hash of all the input parameters that may affect the sources, and
+ * ppt->cache_family_key. A file is used only if its sizes and its tau
+ * and k samplings match the current run exactly. The file is then
+ * mapped in memory read-only, and the source tables point inside the
+ * map instead of being allocated, so that concurrent runs of the same
+ * model share the same physical memory.
+ *
+ * A missing, truncated or mismatching file is not an error: *found is
+ * then set to _FALSE_, and the sources have to be computed (or partly
+ * taken from another file with perturb_sources_cache_extend()).
+ *
+ * @param ppt   Input/Output: perturbation structure
+ * @param found Output: _TRUE_ if the source tables were read
+ * @return the error status
+ */
+
+int perturb_sources_cache_read(
+                               struct perturbs * ppt,
+                               short * found
+                               ) {
+
+  FileName filename;
+  int index_md,index_ic_tp,header_size;
+  size_t map_size,offset;
+  void * map;
+  long long * header;
+  double * values;
+
+  *found = _FALSE_;
+
+  /* the sources are not cached when perturbations are written for a list of wavenumbers, since the latter have to be computed anyway */
+  if ((ppt->cache_directory[0] == '\0') || (ppt->k_output_values_num > 0))
+    return _SUCCESS_;
+
+  class_test(snprintf(filename,_FILENAMESIZE_,"%s/perturbations_%016llx_%016llx.dat",ppt->cache_directory,ppt->cache_family_key,ppt->cache_key) >= _FILENAMESIZE_,
+             ppt->error_message,
+             "the name of the cache file in %s is longer than _FILENAMESIZE_=%d",ppt->cache_directory,_FILENAMESIZE_);
+
+  class_call(perturb_sources_cache_map(ppt,filename,&map,&map_size),
+             ppt->error_message,
+             ppt->error_message);
+
+  if (map == NULL)
+    return _SUCCESS_;
+
+  /** - check that the key and the k samplings are those of the current run */
+  header_size = 6 + 3*ppt->md_size;
+  header = (long long *)map;
+  values = (double *)(header+header_size);
+
+  if ((unsigned long long)header[2] != ppt->cache_key) {
+    munmap(map,map_size);
+    return _SUCCESS_;
+  }
+
+  offset = ppt->tau_size;
+  for (index_md = 0; index_md < ppt->md_size; index_md++) {
+    if ((header[8+3*index_md] != ppt->k_size[index_md]) ||
+        (memcmp(values+offset,ppt->k[index_md],ppt->k_size[index_md]*sizeof(double)) != 0)) {
+      munmap(map,map_size);
+      return _SUCCESS_;
+    }
+    offset += ppt->k_size[index_md];
+  }
+
+  /** - replace the allocated source tables by pointers inside the map */
+  for (index_md = 0; index_md < ppt->md_size; index_md++) {
+    for (index_ic_tp = 0; index_ic_tp < ppt->ic_size[index_md]*ppt->tp_size[index_md]; index_ic_tp++) {
+
+      free(ppt->sources[index_md][index_ic_tp]);
+      ppt->sources[index_md][index_ic_tp] = values+offset;
+      offset += ppt->k_size[index_md]*ppt->tau_size;
+
+      if (ppt->ln_tau_size > 1)
+        ppt->late_sources[index_md][index_ic_tp] = &(ppt->sources[index_md][index_ic_tp][(ppt->tau_size-ppt->ln_tau_size) * ppt->k_size[index_md]]);
+    }
+  }
+
+  ppt->sources_map = map;
+  ppt->sources_map_size = map_size;
+
+  *found = _TRUE_;
+
+  if (ppt->perturbations_verbose > 0)
+    printf(" -> source functions read from %s\n",filename);
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * When no cache file matches the current run exactly, take the
+ * sources of as many wavenumbers as possible from a file of the same
+ * family, i.e. from a previous run which differed only by the range
+ * of wavenumbers (e.g. a smaller P_k_max_h/Mpc or l_max_scalars, or
+ * other z_pk). The k sampling of perturb_get_k_list() does not depend
+ * on these parameters below the smallest of the two maximum
+ * wavenumbers, so the two lists share most of their values, which
+ * are compared exactly. The sources of common wavenumbers are copied
+ * into the source tables of the current run, and only the other
+ * wavenumbers have to be evolved by perturb_init().
+ *
+ * Among the files of the family found in the cache directory, the
+ * one sharing the largest number of wavenumbers is used.
+ *
+ * @param ppt               Input/Output: perturbation structure
+ * @param k_from_cache      Output: k_from_cache[index_md][index_k] set to _TRUE_ for the wavenumbers read from the cache (allocated by the caller, initially _FALSE_)
+ * @param k_from_cache_size Output: number of these wavenumbers, summed over modes
+ * @return the error status
+ */
+
+int perturb_sources_cache_extend(
+                                 struct perturbs * ppt,
+                                 short ** k_from_cache,
+                                 int * k_from_cache_size
+                                 ) {
+
+  FileName prefix,filename,best_filename;
+  DIR * directory;
+  struct dirent * entry;
+  int index_md,index_ic_tp,index_tau,index_k,index_k_cache,header_size,k_cache_size,common,best_common,k_size;
+  size_t map_size,offset;
+  void * map;
+  long long * header;
+  double * values;
+  double * k_cache;
+  double * sources_cache;
+
+  *k_from_cache_size = 0;
+
+  if ((ppt->cache_directory[0] == '\0') || (ppt->k_output_values_num > 0))
+    return _SUCCESS_;
+
+  directory = opendir(ppt->cache_directory);
+  if (directory == NULL)
+    return _SUCCESS_;
+
+  header_size = 6 + 3*ppt->md_size;
+  sprintf(prefix,"perturbations_%016llx_",ppt->cache_family_key);
+  best_common = 0;
+
+  /** - find the file of the same family sharing most wavenumbers with the current run */
+  while ((entry = readdir(directory)) != NULL) {
+
+    if (strncmp(entry->d_name,prefix,strlen(prefix)) != 0)
+      continue;
+
+    class_test_except(snprintf(filename,_FILENAMESIZE_,"%s/%s",ppt->cache_directory,entry->d_name) >= _FILENAMESIZE_,
+                      ppt->error_message,
+                      closedir(directory),
+                      "the name of the cache file %s/%s is longer than _FILENAMESIZE_=%d",ppt->cache_directory,entry->d_name,_FILENAMESIZE_);
+
+    class_call(perturb_sources_cache_map(ppt,filename,&map,&map_size),
+               ppt->error_message,
+               ppt->error_message);
+
+    if (map == NULL)
+      continue;
+
+    header = (long long *)map;
+    values = (double *)(header+header_size);
+
+    /* both k lists are in growing order */
+    common = 0;
+    offset = ppt->tau_size;
+    for (index_md = 0; index_md < ppt->md_size; index_md++) {
+      k_cache = values+offset;
+      k_cache_size = header[8+3*index_md];
+      index_k_cache = 0;
+      for (index_k = 0; index_k < ppt->k_size[index_md]; index_k++) {
+        while ((index_k_cache < k_cache_size) && (k_cache[index_k_cache] < ppt->k[index_md][index_k]))
+          index_k_cache++;
+        if ((index_k_cache < k_cache_size) && (k_cache[index_k_cache] == ppt->k[index_md][index_k]))
+          common++;
+      }
+      offset += k_cache_size;
+    }
+
+    munmap(map,map_size);
+
+    if (common > best_common) {
+      best_common = common;
+      strcpy(best_filename,filename);
+    }
+  }
+
+  closedir(directory);
+
+  if (best_common == 0)
+    return _SUCCESS_;
+
+  /** - copy the sources of the common wavenumbers */
+  class_call(perturb_sources_cache_map(ppt,best_filename,&map,&map_size),
+             ppt->error_message,
+             ppt->error_message);
+
+  /* the file may have been removed in the meantime */
+  if (map == NULL)
+    return _SUCCESS_;
+
+  header = (long long *)map;
+  values = (double *)(header+header_size);
+
+  sources_cache = values + ppt->tau_size;
+  for (index_md = 0; index_md < ppt->md_size; index_md++)
+    sources_cache += header[8+3*index_md];
+
+  offset = ppt->tau_size;
+  for (index_md = 0; index_md < ppt->md_size; index_md++) {
+
+    k_cache = values+offset;
+    k_cache_size = header[8+3*index_md];
+    k_size = ppt->k_size[index_md];
+
+    index_k_cache = 0;
+    for (index_k = 0; index_k < k_size; index_k++) {
+      while ((index_k_cache < k_cache_size) && (k_cache[index_k_cache] < ppt->k[index_md][index_k]))
+        index_k_cache++;
+      if ((index_k_cache < k_cache_size) && (k_cache[index_k_cache] == ppt->k[index_md][index_k])) {
+        for (index_ic_tp = 0; index_ic_tp < ppt->ic_size[index_md]*ppt->tp_size[index_md]; index_ic_tp++) {
+          for (index_tau = 0; index_tau < ppt->tau_size; index_tau++) {
+            ppt->sources[index_md][index_ic_tp][index_tau*k_size+index_k] =
+              sources_cache[(size_t)index_ic_tp*k_cache_size*ppt->tau_size + index_tau*k_cache_size + index_k_cache];
+          }
+        }
+        k_from_cache[index_md][index_k] = _TRUE_;
+        (*k_from_cache_size)++;
+      }
+    }
+
+    offset += k_cache_size;
+    sources_cache += (size_t)ppt->ic_size[index_md]*ppt->tp_size[index_md]*k_cache_size*ppt->tau_size;
+  }
+
+  munmap(map,map_size);
+
+  if (ppt->perturbations_verbose > 0)
+    printf(" -> source functions of %d wavenumbers read from %s\n",*k_from_cache_size,best_filename);
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * Store the source tables in a cache file, in the format read by
+ * perturb_sources_cache_read().
+ *
+ * The file is written under a temporary name (unique to the process)
+ * and then renamed, so that concurrent runs never read a partially
+ * written file. Failing to write the cache is not an error.
+ *
+ * @param ppt Input: perturbation structure
+ * @return the error status
+ */
+
+int perturb_sources_cache_write(
+                                struct perturbs * ppt
+                                ) {
 
-    free(ppt->ic_size);
+  FileName filename,tmpname;
+  FILE * cachefile;
+  int index_md,index_ic_tp,header_size,status;
+  long long * header;
+  size_t written,expected;
+  unsigned long long stamp;
 
-    free(ppt->k);
+  if ((ppt->cache_directory[0] == '\0') || (ppt->k_output_values_num > 0))
+    return _SUCCESS_;
 
-    free(ppt->k_size_cmb);
+  class_test(snprintf(filename,_FILENAMESIZE_,"%s/perturbations_%016llx_%016llx.dat",ppt->cache_directory,ppt->cache_family_key,ppt->cache_key) >= _FILENAMESIZE_,
+             ppt->error_message,
+             "the name of the cache file in %s is longer than _FILENAMESIZE_=%d",ppt->cache_directory,_FILENAMESIZE_);
+  class_temporary_file_name(filename,tmpname);
 
-    free(ppt->k_size_cl);
+  class_call(perturb_sources_cache_stamp(&stamp),
+             ppt->error_message,
+             ppt->error_message);
 
-    free(ppt->k_size);
+  header_size = 6 + 3*ppt->md_size;
+  class_alloc(header,header_size*sizeof(long long),ppt->error_message);
 
-    free(ppt->sources);
-    free(ppt->late_sources);
-    free(ppt->ddlate_sources);
+  header[0] = _PERTURB_CACHE_FORMAT_;
+  header[1] = (long long)stamp;
+  header[2] = (long long)ppt->cache_key;
+  header[3] = (long long)ppt->cache_family_key;
+  header[4] = ppt->md_size;
+  header[5] = ppt->tau_size;
+  for (index_md = 0; index_md < ppt->md_size; index_md++) {
+    header[6+3*index_md] = ppt->ic_size[index_md];
+    header[7+3*index_md] = ppt->tp_size[index_md];
+    header[8+3*index_md] = ppt->k_size[index_md];
+  }
 
-    if (ppt->alpha_idm_dr != NULL)
-      free(ppt->alpha_idm_dr);
+  cachefile = fopen(tmpname,"wb");
+  if (cachefile != NULL) {
 
-    if (ppt->beta_idr != NULL)
-      free(ppt->beta_idr);
+    written = fwrite(header,sizeof(long long),header_size,cachefile);
+    expected = header_size;
 
-    /** Stuff related to perturbations output: */
+    written += fwrite(ppt->tau_sampling,sizeof(double),ppt->tau_size,cachefile);
+    expected += ppt->tau_size;
 
-    /** - Free non-NULL pointers */
-    if (ppt->index_k_output_values != NULL)
-      free(ppt->index_k_output_values);
+    for (index_md = 0; index_md < ppt->md_size; index_md++) {
+      written += fwrite(ppt->k[index_md],sizeof(double),ppt->k_size[index_md],cachefile);
+      expected += ppt->k_size[index_md];
+    }
 
-    for (filenum = 0; filenum<_MAX_NUMBER_OF_K_FILES_; filenum++){
-      if (ppt->scalar_perturbations_data[filenum] != NULL)
-        free(ppt->scalar_perturbations_data[filenum]);
-      if (ppt->vector_perturbations_data[filenum] != NULL)
-        free(ppt->vector_perturbations_data[filenum]);
-      if (ppt->tensor_perturbations_data[filenum] != NULL)
-        free(ppt->tensor_perturbations_data[filenum]);
+    for (index_md = 0; index_md < ppt->md_size; index_md++) {
+      for (index_ic_tp = 0; index_ic_tp < ppt->ic_size[index_md]*ppt->tp_size[index_md]; index_ic_tp++) {
+        written += fwrite(ppt->sources[index_md][index_ic_tp],sizeof(double),ppt->k_size[index_md]*ppt->tau_size,cachefile);
+        expected += ppt->k_size[index_md]*ppt->tau_size;
+      }
     }
 
+    status = fclose(cachefile);
+    if ((status != 0) || (written != expected) || (rename(tmpname,filename) != 0))
+      remove(tmpname);
   }
 
+  free(header);
+
   return _SUCCESS_;
 
 }
@@ -1228,12 +2805,10 @@ int perturb_indices_of_perturbs(
           ppt->has_source_delta_m = _TRUE_;
         }
         if (ppt->has_nc_rsd == _TRUE_) {
+          /* rsd is always defined for the total matter (see tp_of_tt in
+             transfer.c): theta_cb has no consumer downstream, so it is
+             neither allocated nor filled */
           ppt->has_source_theta_m = _TRUE_;
-          if ((pba->has_ncdm == _TRUE_) || (pba->has_lrs == _TRUE_))
-            /* we may not need theta_cb at all, rsd always defined for
-               the total matter, but at least this is made
-               available */
-            ppt->has_source_theta_cb = _TRUE_;
         }
 
         if (ppt->has_nc_lens == _TRUE_) {
@@ -1318,7 +2893,7 @@ int perturb_indices_of_perturbs(
       class_define_index(ppt->index_tp_k2gamma_Nb, ppt->has_source_k2gamma_Nb,index_type,1);
       ppt->tp_size[index_md] = index_type;
 
-      class_test(index_type == 0,
+      class_test((index_type == 0) && (ppt->k_output_values_only == _FALSE_),
                  ppt->error_message,
                  "inconsistent input: you asked for scalars, so you should have at least one non-zero scalar source type (temperature, polarization, lensing/gravitational potential, ...). Please adjust your input.");
 
@@ -1606,167 +3181,206 @@ int perturb_timesampling_for_sources(
                ppt->error_message);
   }
 
-  /** - (b) next sampling point = previous + ppr->perturb_sampling_stepsize * timescale_source, where:
-      - --> if CMB requested:
-      timescale_source1 = \f$ |g/\dot{g}| = |\dot{\kappa}-\ddot{\kappa}/\dot{\kappa}|^{-1} \f$;
-      timescale_source2 = \f$ |2\ddot{a}/a-(\dot{a}/a)^2|^{-1/2} \f$ (to sample correctly the late ISW effect; and
-      timescale_source=1/(1/timescale_source1+1/timescale_source2); repeat till today.
-      - --> if CMB not requested:
-      timescale_source = 1/aH; repeat till today.
-  */
-
-  counter = 1;
-  last_index_back = first_index_back;
-  last_index_thermo = first_index_thermo;
-  tau = tau_ini;
+  /** - (b) if perturb_sampling_tol is positive, place the next
+      sampling points with perturb_timesampling_adaptive() */
 
-  while (tau < pba->conformal_age) {
+  if (ppr->perturb_sampling_tol > 0.) {
 
-    class_call(background_at_tau(pba,
-                                 tau,
-                                 pba->short_info,
-                                 pba->inter_closeby,
-                                 &last_index_back,
-                                 pvecback),
-               pba->error_message,
+    class_call(perturb_timesampling_adaptive(ppr,pba,pth,ppt,tau_ini,pvecback,pvecthermo),
+               ppt->error_message,
                ppt->error_message);
+  }
+  else {
 
-    class_call(thermodynamics_at_z(pba,
-                                   pth,
-                                   1./pvecback[pba->index_bg_a]-1.,  /* redshift z=1/a-1 */
-                                   pth->inter_closeby,
-                                   &last_index_thermo,
-                                   pvecback,
-                                   pvecthermo),
-               pth->error_message,
-               ppt->error_message);
+    /** - (b) next sampling point = previous + ppr->perturb_sampling_stepsize * timescale_source, where:
+        - --> if CMB requested:
+        timescale_source1 = \f$ |g/\dot{g}| = |\dot{\kappa}-\ddot{\kappa}/\dot{\kappa}|^{-1} \f$;
+        timescale_source2 = \f$ |2\ddot{a}/a-(\dot{a}/a)^2|^{-1/2} \f$ (to sample correctly the late ISW effect; and
+        timescale_source=1/(1/timescale_source1+1/timescale_source2); repeat till today.
+        - --> if CMB not requested:
+        timescale_source = 1/aH; repeat till today.
+    */
 
-    if (ppt->has_cmb == _TRUE_) {
+    counter = 1;
+    last_index_back = first_index_back;
+    last_index_thermo = first_index_thermo;
+    tau = tau_ini;
 
-      /* variation rate of thermodynamics variables */
-      rate_thermo = pvecthermo[pth->index_th_rate];
+    while (tau < pba->conformal_age) {
 
-      /* variation rate of metric due to late ISW effect (important at late times) */
-      a_prime_over_a = pvecback[pba->index_bg_H] * pvecback[pba->index_bg_a];
-      a_primeprime_over_a = pvecback[pba->index_bg_H_prime] * pvecback[pba->index_bg_a]
-        + 2. * a_prime_over_a * a_prime_over_a;
-      rate_isw_squared = fabs(2.*a_primeprime_over_a-a_prime_over_a*a_prime_over_a);
+      class_call(background_at_tau(pba,
+                                   tau,
+                                   pba->short_info,
+                                   pba->inter_closeby,
+                                   &last_index_back,
+                                   pvecback),
+                 pba->error_message,
+                 ppt->error_message);
 
-      /* compute rate */
-      timescale_source = sqrt(rate_thermo*rate_thermo+rate_isw_squared);
-    }
-    else {
-      /* variation rate given by Hubble time */
-      a_prime_over_a = pvecback[pba->index_bg_H] * pvecback[pba->index_bg_a];
+      class_call(thermodynamics_at_z(pba,
+                                     pth,
+                                     1./pvecback[pba->index_bg_a]-1.,  /* redshift z=1/a-1 */
+                                     pth->inter_closeby,
+                                     &last_index_thermo,
+                                     pvecback,
+                                     pvecthermo),
+                 pth->error_message,
+                 ppt->error_message);
 
-      timescale_source = a_prime_over_a;
-    }
+      if (ppt->has_cmb == _TRUE_) {
 
-    /* check it is non-zero */
-    class_test(timescale_source == 0.,
-               ppt->error_message,
-               "null evolution rate, integration is diverging");
+        /* variation rate of thermodynamics variables */
+        rate_thermo = pvecthermo[pth->index_th_rate];
 
-    /* compute inverse rate */
-    timescale_source = 1./timescale_source;
+        /* variation rate of metric due to late ISW effect (important at late times) */
+        a_prime_over_a = pvecback[pba->index_bg_H] * pvecback[pba->index_bg_a];
+        a_primeprime_over_a = pvecback[pba->index_bg_H_prime] * pvecback[pba->index_bg_a]
+          + 2. * a_prime_over_a * a_prime_over_a;
+        rate_isw_squared = fabs(2.*a_primeprime_over_a-a_prime_over_a*a_prime_over_a);
 
-    class_test(fabs(ppr->perturb_sampling_stepsize*timescale_source/tau) < ppr->smallest_allowed_variation,
-               ppt->error_message,
-               "integration step =%e < machine precision : leads either to numerical error or infinite loop",ppr->perturb_sampling_stepsize*timescale_source);
+        /* compute rate */
+        timescale_source = sqrt(rate_thermo*rate_thermo+rate_isw_squared);
+      }
+      else {
+        /* variation rate given by Hubble time */
+        a_prime_over_a = pvecback[pba->index_bg_H] * pvecback[pba->index_bg_a];
 
-    tau = tau + ppr->perturb_sampling_stepsize*timescale_source;
-    counter++;
+        timescale_source = a_prime_over_a;
+      }
 
-  }
+      /* check it is non-zero */
+      class_test(timescale_source == 0.,
+                 ppt->error_message,
+                 "null evolution rate, integration is diverging");
 
-  /** - --> infer total number of time steps, ppt->tau_size */
-  ppt->tau_size = counter;
+      /* compute inverse rate */
+      timescale_source = 1./timescale_source;
 
-  /** - --> allocate array of time steps, ppt->tau_sampling[index_tau] */
-  class_alloc(ppt->tau_sampling,ppt->tau_size * sizeof(double),ppt->error_message);
+      class_test(fabs(ppr->perturb_sampling_stepsize*timescale_source/tau) < ppr->smallest_allowed_variation,
+                 ppt->error_message,
+                 "integration step =%e < machine precision : leads either to numerical error or infinite loop",ppr->perturb_sampling_stepsize*timescale_source);
 
-  /** - --> repeat the same steps, now filling the array with each tau value: */
+      tau = tau + ppr->perturb_sampling_stepsize*timescale_source;
+      counter++;
 
-  /** - --> (b.1.) first sampling point = when the universe stops being opaque */
+    }
 
-  counter = 0;
-  ppt->tau_sampling[counter]=tau_ini;
+    /** - --> infer total number of time steps, ppt->tau_size */
+    ppt->tau_size = counter;
 
-  /** - --> (b.2.) next sampling point = previous + ppr->perturb_sampling_stepsize * timescale_source, where
-      timescale_source1 = \f$ |g/\dot{g}| = |\dot{\kappa}-\ddot{\kappa}/\dot{\kappa}|^{-1} \f$;
-      timescale_source2 = \f$ |2\ddot{a}/a-(\dot{a}/a)^2|^{-1/2} \f$ (to sample correctly the late ISW effect; and
-      timescale_source=1/(1/timescale_source1+1/timescale_source2); repeat till today.
-      If CMB not requested:
-      timescale_source = 1/aH; repeat till today.  */
+    /** - --> allocate array of time steps, ppt->tau_sampling[index_tau] */
+    class_alloc(ppt->tau_sampling,ppt->tau_size * sizeof(double),ppt->error_message);
 
-  last_index_back = first_index_back;
-  last_index_thermo = first_index_thermo;
-  tau = tau_ini;
+    /** - --> repeat the same steps, now filling the array with each tau value: */
 
-  while (tau < pba->conformal_age) {
+    /** - --> (b.1.) first sampling point = when the universe stops being opaque */
 
-    class_call(background_at_tau(pba,
-                                 tau,
-                                 pba->short_info,
-                                 pba->inter_closeby,
-                                 &last_index_back,
-                                 pvecback),
-               pba->error_message,
-               ppt->error_message);
+    counter = 0;
+    ppt->tau_sampling[counter]=tau_ini;
 
-    class_call(thermodynamics_at_z(pba,
-                                   pth,
-                                   1./pvecback[pba->index_bg_a]-1.,  /* redshift z=1/a-1 */
-                                   pth->inter_closeby,
-                                   &last_index_thermo,
-                                   pvecback,
-                                   pvecthermo),
-               pth->error_message,
-               ppt->error_message);
+    /** - --> (b.2.) next sampling point = previous + ppr->perturb_sampling_stepsize * timescale_source, where
+        timescale_source1 = \f$ |g/\dot{g}| = |\dot{\kappa}-\ddot{\kappa}/\dot{\kappa}|^{-1} \f$;
+        timescale_source2 = \f$ |2\ddot{a}/a-(\dot{a}/a)^2|^{-1/2} \f$ (to sample correctly the late ISW effect; and
+        timescale_source=1/(1/timescale_source1+1/timescale_source2); repeat till today.
+        If CMB not requested:
+        timescale_source = 1/aH; repeat till today.  */
+
+    last_index_back = first_index_back;
+    last_index_thermo = first_index_thermo;
+    tau = tau_ini;
+
+    while (tau < pba->conformal_age) {
+
+      class_call(background_at_tau(pba,
+                                   tau,
+                                   pba->short_info,
+                                   pba->inter_closeby,
+                                   &last_index_back,
+                                   pvecback),
+                 pba->error_message,
+                 ppt->error_message);
 
-    if (ppt->has_cmb == _TRUE_) {
+      class_call(thermodynamics_at_z(pba,
+                                     pth,
+                                     1./pvecback[pba->index_bg_a]-1.,  /* redshift z=1/a-1 */
+                                     pth->inter_closeby,
+                                     &last_index_thermo,
+                                     pvecback,
+                                     pvecthermo),
+                 pth->error_message,
+                 ppt->error_message);
 
-      /* variation rate of thermodynamics variables */
-      rate_thermo = pvecthermo[pth->index_th_rate];
+      if (ppt->has_cmb == _TRUE_) {
 
-      /* variation rate of metric due to late ISW effect (important at late times) */
-      a_prime_over_a = pvecback[pba->index_bg_H] * pvecback[pba->index_bg_a];
-      a_primeprime_over_a = pvecback[pba->index_bg_H_prime] * pvecback[pba->index_bg_a]
-        + 2. * a_prime_over_a * a_prime_over_a;
-      rate_isw_squared = fabs(2.*a_primeprime_over_a-a_prime_over_a*a_prime_over_a);
+        /* variation rate of thermodynamics variables */
+        rate_thermo = pvecthermo[pth->index_th_rate];
 
-      /* compute rate */
-      timescale_source = sqrt(rate_thermo*rate_thermo+rate_isw_squared);
-    }
-    else {
-      a_prime_over_a = pvecback[pba->index_bg_H] * pvecback[pba->index_bg_a];
-      timescale_source = a_prime_over_a;
-    }
+        /* variation rate of metric due to late ISW effect (important at late times) */
+        a_prime_over_a = pvecback[pba->index_bg_H] * pvecback[pba->index_bg_a];
+        a_primeprime_over_a = pvecback[pba->index_bg_H_prime] * pvecback[pba->index_bg_a]
+          + 2. * a_prime_over_a * a_prime_over_a;
+        rate_isw_squared = fabs(2.*a_primeprime_over_a-a_prime_over_a*a_prime_over_a);
 
-    /* check it is non-zero */
-    class_test(timescale_source == 0.,
-               ppt->error_message,
-               "null evolution rate, integration is diverging");
+        /* compute rate */
+        timescale_source = sqrt(rate_thermo*rate_thermo+rate_isw_squared);
+      }
+      else {
+        a_prime_over_a = pvecback[pba->index_bg_H] * pvecback[pba->index_bg_a];
+        timescale_source = a_prime_over_a;
+      }
 
-    /* compute inverse rate */
-    timescale_source = 1./timescale_source;
+      /* check it is non-zero */
+      class_test(timescale_source == 0.,
+                 ppt->error_message,
+                 "null evolution rate, integration is diverging");
 
-    class_test(fabs(ppr->perturb_sampling_stepsize*timescale_source/tau) < ppr->smallest_allowed_variation,
-               ppt->error_message,
-               "integration step =%e < machine precision : leads either to numerical error or infinite loop",ppr->perturb_sampling_stepsize*timescale_source);
+      /* compute inverse rate */
+      timescale_source = 1./timescale_source;
 
-    tau = tau + ppr->perturb_sampling_stepsize*timescale_source;
-    counter++;
-    ppt->tau_sampling[counter]=tau;
+      class_test(fabs(ppr->perturb_sampling_stepsize*timescale_source/tau) < ppr->smallest_allowed_variation,
+                 ppt->error_message,
+                 "integration step =%e < machine precision : leads either to numerical error or infinite loop",ppr->perturb_sampling_stepsize*timescale_source);
 
-  }
+      tau = tau + ppr->perturb_sampling_stepsize*timescale_source;
+      counter++;
+      ppt->tau_sampling[counter]=tau;
 
-  /** - last sampling point = exactly today */
-  ppt->tau_sampling[counter] = pba->conformal_age;
+    }
+
+    /** - last sampling point = exactly today */
+    ppt->tau_sampling[counter] = pba->conformal_age;
+
+    if (ppt->perturbations_verbose > 1)
+      printf(" -> %d source sampling times\n",ppt->tau_size);
+  }
 
   free(pvecback);
   free(pvecthermo);
 
+  /** - in a batch of models sharing their samplings, use instead the
+      sampling of the reference model, rescaled by the ratio of
+      conformal ages (see perturb_init_batch()) */
+
+  if (ppt->grid_reference != NULL) {
+
+    ppt->tau_size = ppt->grid_reference->tau_size;
+
+    class_realloc(ppt->tau_sampling,
+                  ppt->tau_sampling,
+                  ppt->tau_size*sizeof(double),
+                  ppt->error_message);
+
+    for (index_tau=0; index_tau<ppt->tau_size-1; index_tau++)
+      ppt->tau_sampling[index_tau] = ppt->grid_reference->tau_sampling[index_tau]
+        * pba->conformal_age / ppt->grid_reference->tau_sampling[ppt->tau_size-1];
+
+    ppt->tau_sampling[ppt->tau_size-1] = pba->conformal_age;
+
+    class_test(ppt->tau_sampling[0] <= pth->tau_ini,
+               ppt->error_message,
+               "the time sampling of the reference model of the batch starts too early for this model, at tau=%e <= tau_ini=%e",ppt->tau_sampling[0],pth->tau_ini);
+  }
+
   /** - check the maximum redshift z_max_pk at which the Fourier
       transfer functions \f$ T_i(k,z)\f$ should be computable by
       interpolation. If it is equal to zero, only \f$ T_i(k,z=0)\f$
@@ -1784,67 +3398,340 @@ int perturb_timesampling_for_sources(
     ppt->ln_tau_size=1;
   }
 
-  /* if z_max_pk>0, store several values (with a comfortable margin above z_max_pk) in view of interpolation */
-  else{
-    /* find the first relevant value of tau (last value in the table tau_sampling before tau(z_max)) and infer the number of values of tau at which P(k) must be stored */
+  /* if z_max_pk>0, store several values (with a comfortable margin above z_max_pk) in view of interpolation */
+  else{
+    /* find the first relevant value of tau (last value in the table tau_sampling before tau(z_max)) and infer the number of values of tau at which P(k) must be stored */
+
+    class_call(background_tau_of_z(pba,ppt->z_max_pk,&tau_lower),
+               pba->error_message,
+               ppt->error_message);
+
+    index_tau=0;
+    class_test((tau_lower <= ppt->tau_sampling[index_tau]),
+               ppt->error_message,
+               "you asked for zmax=%e, i.e. taumin=%e, smaller than or equal to the first possible value =%e; it should be strictly bigger for a successfull interpolation",ppt->z_max_pk,tau_lower,ppt->tau_sampling[0]);
+
+    while (ppt->tau_sampling[index_tau] < tau_lower){
+      index_tau++;
+    }
+    index_tau --;
+    class_test(index_tau<0,
+               ppt->error_message,
+               "by construction, this should never happen, a bug must have been introduced somewhere");
+
+    /* whenever possible, take a few more values in to avoid boundary effects in the interpolation */
+    if (index_tau>0) index_tau--;
+    if (index_tau>0) index_tau--;
+    if (index_tau>0) index_tau--;
+    if (index_tau>0) index_tau--;
+    ppt->ln_tau_size=ppt->tau_size-index_tau;
+
+    /* allocate and fill array of log(tau) */
+    class_alloc(ppt->ln_tau,ppt->ln_tau_size * sizeof(double),ppt->error_message);
+
+    for (index_tau=0; index_tau<ppt->ln_tau_size; index_tau++) {
+      ppt->ln_tau[index_tau]=log(ppt->tau_sampling[index_tau-ppt->ln_tau_size+ppt->tau_size]);
+    }
+  }
+
+  /** - loop over modes, initial conditions and types. For each of
+      them, allocate array of source functions. */
+
+  for (index_md = 0; index_md < ppt->md_size; index_md++) {
+    for (index_ic = 0; index_ic < ppt->ic_size[index_md]; index_ic++) {
+      for (index_tp = 0; index_tp < ppt->tp_size[index_md]; index_tp++) {
+
+        class_alloc(ppt->sources[index_md][index_ic*ppt->tp_size[index_md]+index_tp],
+                    ppt->k_size[index_md] * ppt->tau_size * sizeof(double),
+                    ppt->error_message);
+
+        if (ppt->ln_tau_size > 1) {
+          /* late_sources is just a pointer to the end of sources (starting from the relevant time index) */
+          ppt->late_sources[index_md][index_ic*ppt->tp_size[index_md]+index_tp] = &(ppt->sources[index_md]
+                                                                                    [index_ic * ppt->tp_size[index_md] + index_tp]
+                                                                                    [(ppt->tau_size-ppt->ln_tau_size) * ppt->k_size[index_md]]);
+
+          class_alloc(ppt->ddlate_sources[index_md][index_ic*ppt->tp_size[index_md]+index_tp],
+                      ppt->k_size[index_md] * ppt->ln_tau_size * sizeof(double),
+                      ppt->error_message);
+        }
+      }
+    }
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Error-controlled time sampling of the source functions, used
+ * instead of the fixed steps of perturb_timesampling_for_sources()
+ * when perturb_sampling_tol is positive.
+ *
+ * The sources are built from the perturbations and from a few
+ * functions of time only: when CMB sources are requested, the
+ * visibility function, its derivative and \f$ e^{-\kappa} \f$. Each
+ * step is the largest one for which the error of a linear
+ * interpolation of these kernels at the middle of the step, relative
+ * to their value there plus a floor (see
+ * perturb_sampling_kernel_floor), is below perturb_sampling_tol. The
+ * recombination and reionization windows are then sampled as finely
+ * as they need, and the other times, where the sources only vary
+ * with the expansion, are sampled with steps of
+ * perturb_sampling_stepsize times the Hubble time (or the late ISW
+ * timescale), which also bound all steps. The number of times and the
+ * largest estimated error are printed if perturbations_verbose > 1.
+ *
+ * @param ppr        Input: pointer to precision structure
+ * @param pba        Input: pointer to background structure
+ * @param pth        Input: pointer to thermodynamics structure
+ * @param ppt        Input/Output: pointer to perturbation structure, in which tau_size and tau_sampling are set
+ * @param tau_ini    Input: first sampling time
+ * @param pvecback   Input: background vector (workspace)
+ * @param pvecthermo Input: thermodynamics vector (workspace)
+ * @return the error status
+ */
+
+int perturb_timesampling_adaptive(
+                                  struct precision * ppr,
+                                  struct background * pba,
+                                  struct thermo * pth,
+                                  struct perturbs * ppt,
+                                  double tau_ini,
+                                  double * pvecback,
+                                  double * pvecthermo
+                                  ) {
+
+  int kernel_size;
+  int index_kernel;
+  int index_z;
+  int index_table;
+  int tau_size_max;
+  int last_index_back=0;
+  int last_index_thermo=0;
+
+  double kernel_ini[3];
+  double kernel_mid[3];
+  double kernel_end[3];
+  double kernel_floor[3];
+  double tau;
+  double step;
+  double rate_ini;
+  double rate_mid;
+  double rate_end;
+  double error;
+  double error_max=0.;
+  double * table_tau;
+  double * table_kernel;
+
+  /** - the kernels: visibility function, its derivative and
+      \f$ e^{-\kappa} \f$, if CMB sources are requested; otherwise the
+      sources only vary with the expansion */
+
+  kernel_size = (ppt->has_cmb == _TRUE_) ? 3 : 0;
+
+  /** - tabulate the absolute value of the kernels in the order of
+      increasing conformal time, from the thermodynamics table (sorted
+      by increasing redshift), in view of the floors of the relative
+      errors */
+
+  class_alloc(table_tau,pth->tt_size*sizeof(double),ppt->error_message);
+  class_alloc(table_kernel,3*pth->tt_size*sizeof(double),ppt->error_message);
+
+  for (index_z=0; index_z<pth->tt_size; index_z++) {
+    index_table = pth->tt_size-1-index_z;
+    class_call(background_tau_of_z(pba,pth->z_table[index_z],&(table_tau[index_table])),
+               pba->error_message,
+               ppt->error_message);
+    table_kernel[3*index_table] = fabs(pth->thermodynamics_table[index_z*pth->th_size+pth->index_th_g]);
+    table_kernel[3*index_table+1] = fabs(pth->thermodynamics_table[index_z*pth->th_size+pth->index_th_dg]);
+    table_kernel[3*index_table+2] = fabs(pth->thermodynamics_table[index_z*pth->th_size+pth->index_th_exp_m_kappa]);
+  }
+  index_table = 0;
+
+  tau_size_max = 256;
+  class_alloc(ppt->tau_sampling,tau_size_max*sizeof(double),ppt->error_message);
+  ppt->tau_size = 1;
+  ppt->tau_sampling[0] = tau_ini;
+
+  tau = tau_ini;
+
+  class_call(perturb_timesampling_kernels(pba,pth,ppt,tau,&last_index_back,&last_index_thermo,
+                                          pvecback,pvecthermo,kernel_ini,&rate_ini),
+             ppt->error_message,
+             ppt->error_message);
+
+  step = ppr->perturb_sampling_stepsize/rate_ini;
+
+  while (tau < pba->conformal_age) {
+
+    /** - find the largest step, starting from the previous one, for
+        which the kernels are interpolated within the tolerance, and
+        which does not exceed the expansion timescale */
+
+    step = MIN(step,ppr->perturb_sampling_stepsize/rate_ini);
+
+    /** - floor of the relative error of each kernel: a fraction of its
+        largest value within one expansion time ahead, so that the
+        recombination and reionization windows are both resolved
+        relatively to their own amplitude, while the times at which
+        the universe is still opaque are not */
+
+    while ((index_table < pth->tt_size-1) && (table_tau[index_table+1] <= tau))
+      index_table++;
+
+    for (index_kernel=0; index_kernel<kernel_size; index_kernel++)
+      kernel_floor[index_kernel] = 0.;
+
+    for (index_z=index_table; (index_z<pth->tt_size) && (table_tau[index_z] <= tau+1./rate_ini); index_z++)
+      for (index_kernel=0; index_kernel<kernel_size; index_kernel++)
+        kernel_floor[index_kernel] = MAX(kernel_floor[index_kernel],table_kernel[3*index_z+index_kernel]);
+
+    for (index_kernel=0; index_kernel<kernel_size; index_kernel++)
+      kernel_floor[index_kernel] *= ppr->perturb_sampling_kernel_floor;
+
+    while (_TRUE_) {
+
+      step = MIN(step,pba->conformal_age-tau);
+
+      class_test(step/tau < ppr->smallest_allowed_variation,
+                 ppt->error_message,
+                 "source sampling step =%e < machine precision at tau=%e: decrease perturb_sampling_tol or increase perturb_sampling_kernel_floor",step,tau);
+
+      class_call(perturb_timesampling_kernels(pba,pth,ppt,tau+0.5*step,&last_index_back,&last_index_thermo,
+                                              pvecback,pvecthermo,kernel_mid,&rate_mid),
+                 ppt->error_message,
+                 ppt->error_message);
+
+      class_call(perturb_timesampling_kernels(pba,pth,ppt,tau+step,&last_index_back,&last_index_thermo,
+                                              pvecback,pvecthermo,kernel_end,&rate_end),
+                 ppt->error_message,
+                 ppt->error_message);
+
+      if (step > ppr->perturb_sampling_stepsize/MAX(rate_mid,rate_end)*(1.+ppr->smallest_allowed_variation)) {
+        step = ppr->perturb_sampling_stepsize/MAX(rate_mid,rate_end);
+        continue;
+      }
+
+      error = 0.;
+      for (index_kernel=0; index_kernel<kernel_size; index_kernel++)
+        error = MAX(error,
+                    fabs(kernel_mid[index_kernel]-0.5*(kernel_ini[index_kernel]+kernel_end[index_kernel]))
+                    /(fabs(kernel_mid[index_kernel])+kernel_floor[index_kernel]));
+
+      if (error <= ppr->perturb_sampling_tol)
+        break;
+
+      /* the error of a linear interpolation scales like the square of the step */
+      step *= MAX(0.2,0.9*sqrt(ppr->perturb_sampling_tol/error));
+    }
+
+    /** - accept the step, and try a larger one next time */
+
+    tau += step;
+
+    if (ppt->tau_size == tau_size_max) {
+      tau_size_max *= 2;
+      class_realloc(ppt->tau_sampling,ppt->tau_sampling,tau_size_max*sizeof(double),ppt->error_message);
+    }
+    ppt->tau_sampling[ppt->tau_size] = tau;
+    ppt->tau_size++;
+
+    error_max = MAX(error_max,error);
+
+    for (index_kernel=0; index_kernel<kernel_size; index_kernel++)
+      kernel_ini[index_kernel] = kernel_end[index_kernel];
+    rate_ini = rate_end;
+
+    if (error > 0.)
+      step *= MIN(2.,0.9*sqrt(ppr->perturb_sampling_tol/error));
+    else
+      step *= 2.;
+  }
+
+  /** - last sampling point = exactly today */
+  ppt->tau_sampling[ppt->tau_size-1] = pba->conformal_age;
+
+  free(table_tau);
+  free(table_kernel);
+
+  if (ppt->perturbations_verbose > 1)
+    printf(" -> %d source sampling times, largest estimated interpolation error %e\n",ppt->tau_size,error_max);
 
-    class_call(background_tau_of_z(pba,ppt->z_max_pk,&tau_lower),
-               pba->error_message,
-               ppt->error_message);
+  return _SUCCESS_;
+}
 
-    index_tau=0;
-    class_test((tau_lower <= ppt->tau_sampling[index_tau]),
-               ppt->error_message,
-               "you asked for zmax=%e, i.e. taumin=%e, smaller than or equal to the first possible value =%e; it should be strictly bigger for a successfull interpolation",ppt->z_max_pk,tau_lower,ppt->tau_sampling[0]);
+/**
+ * Kernels of the source functions and largest sampling rate at a given
+ * time, for perturb_timesampling_adaptive().
+ *
+ * @param pba               Input: pointer to background structure
+ * @param pth               Input: pointer to thermodynamics structure
+ * @param ppt               Input: pointer to perturbation structure
+ * @param tau               Input: conformal time
+ * @param last_index_back   Input/Output: index of the last background interpolation
+ * @param last_index_thermo Input/Output: index of the last thermodynamics interpolation
+ * @param pvecback          Input: background vector (workspace)
+ * @param pvecthermo        Input: thermodynamics vector (workspace)
+ * @param kernel            Output: visibility function, its derivative and \f$ e^{-\kappa} \f$ (if CMB sources are requested)
+ * @param max_step_rate     Output: rate of the expansion (aH, or the late ISW rate if larger), which bounds the step
+ * @return the error status
+ */
 
-    while (ppt->tau_sampling[index_tau] < tau_lower){
-      index_tau++;
-    }
-    index_tau --;
-    class_test(index_tau<0,
-               ppt->error_message,
-               "by construction, this should never happen, a bug must have been introduced somewhere");
+int perturb_timesampling_kernels(
+                                 struct background * pba,
+                                 struct thermo * pth,
+                                 struct perturbs * ppt,
+                                 double tau,
+                                 int * last_index_back,
+                                 int * last_index_thermo,
+                                 double * pvecback,
+                                 double * pvecthermo,
+                                 double * kernel,
+                                 double * max_step_rate
+                                 ) {
 
-    /* whenever possible, take a few more values in to avoid boundary effects in the interpolation */
-    if (index_tau>0) index_tau--;
-    if (index_tau>0) index_tau--;
-    if (index_tau>0) index_tau--;
-    if (index_tau>0) index_tau--;
-    ppt->ln_tau_size=ppt->tau_size-index_tau;
+  double a_prime_over_a;
+  double a_primeprime_over_a;
 
-    /* allocate and fill array of log(tau) */
-    class_alloc(ppt->ln_tau,ppt->ln_tau_size * sizeof(double),ppt->error_message);
+  class_call(background_at_tau(pba,
+                               tau,
+                               pba->short_info,
+                               pba->inter_normal,
+                               last_index_back,
+                               pvecback),
+             pba->error_message,
+             ppt->error_message);
 
-    for (index_tau=0; index_tau<ppt->ln_tau_size; index_tau++) {
-      ppt->ln_tau[index_tau]=log(ppt->tau_sampling[index_tau-ppt->ln_tau_size+ppt->tau_size]);
-    }
-  }
+  class_call(thermodynamics_at_z(pba,
+                                 pth,
+                                 1./pvecback[pba->index_bg_a]-1.,  /* redshift z=1/a-1 */
+                                 pth->inter_normal,
+                                 last_index_thermo,
+                                 pvecback,
+                                 pvecthermo),
+             pth->error_message,
+             ppt->error_message);
 
-  /** - loop over modes, initial conditions and types. For each of
-      them, allocate array of source functions. */
+  a_prime_over_a = pvecback[pba->index_bg_H] * pvecback[pba->index_bg_a];
 
-  for (index_md = 0; index_md < ppt->md_size; index_md++) {
-    for (index_ic = 0; index_ic < ppt->ic_size[index_md]; index_ic++) {
-      for (index_tp = 0; index_tp < ppt->tp_size[index_md]; index_tp++) {
+  *max_step_rate = a_prime_over_a;
 
-        class_alloc(ppt->sources[index_md][index_ic*ppt->tp_size[index_md]+index_tp],
-                    ppt->k_size[index_md] * ppt->tau_size * sizeof(double),
-                    ppt->error_message);
+  if (ppt->has_cmb == _TRUE_) {
 
-        if (ppt->ln_tau_size > 1) {
-          /* late_sources is just a pointer to the end of sources (starting from the relevant time index) */
-          ppt->late_sources[index_md][index_ic*ppt->tp_size[index_md]+index_tp] = &(ppt->sources[index_md]
-                                                                                    [index_ic * ppt->tp_size[index_md] + index_tp]
-                                                                                    [(ppt->tau_size-ppt->ln_tau_size) * ppt->k_size[index_md]]);
+    kernel[0] = pvecthermo[pth->index_th_g];
+    kernel[1] = pvecthermo[pth->index_th_dg];
+    kernel[2] = pvecthermo[pth->index_th_exp_m_kappa];
 
-          class_alloc(ppt->ddlate_sources[index_md][index_ic*ppt->tp_size[index_md]+index_tp],
-                      ppt->k_size[index_md] * ppt->ln_tau_size * sizeof(double),
-                      ppt->error_message);
-        }
-      }
-    }
+    /* variation rate of metric due to late ISW effect, as in perturb_timesampling_for_sources() */
+    a_primeprime_over_a = pvecback[pba->index_bg_H_prime] * pvecback[pba->index_bg_a]
+      + 2. * a_prime_over_a * a_prime_over_a;
+    *max_step_rate = MAX(*max_step_rate,sqrt(fabs(2.*a_primeprime_over_a-a_prime_over_a*a_prime_over_a)));
   }
 
+  class_test(*max_step_rate == 0.,
+             ppt->error_message,
+             "null evolution rate, integration is diverging");
+
   return _SUCCESS_;
 }
 
@@ -2383,9 +4270,15 @@ int perturb_get_k_list(
                   ppt->error_message);
   }
 
-  /** - If user asked for k_output_values, add those to all k lists: */
+  /** - If user asked for k_output_values, add those to all k lists (or, with
+      k_output_values_only, use them as the only values in these lists): */
   if (ppt->k_output_values_num > 0) {
 
+    if (ppt->k_output_values_only == _TRUE_) {
+      for (index_mode=0; index_mode<ppt->md_size; index_mode++)
+        ppt->k_size[index_mode] = 0;
+    }
+
     /* Allocate storage */
     class_alloc(ppt->index_k_output_values,sizeof(double)*ppt->md_size*ppt->k_output_values_num,ppt->error_message);
 
@@ -2427,6 +4320,12 @@ int perturb_get_k_list(
       ppt->k[index_mode] = tmp_k_list;
       ppt->k_size[index_mode] = newk_size;
 
+      if (ppt->k_output_values_only == _TRUE_) {
+        ppt->k_size_cl[index_mode] = newk_size;
+        ppt->k_size_cmb[index_mode] = newk_size;
+        continue;
+      }
+
       index_k = newk_size-1;
       while (ppt->k[index_mode][index_k] > k_max_cl[index_mode])
         index_k--;
@@ -2455,6 +4354,33 @@ int perturb_get_k_list(
      fclose(out);
   */
 
+  /** - in a batch of models sharing their samplings, replace the k lists by those of the reference model (see perturb_init_batch()) */
+
+  if (ppt->grid_reference != NULL) {
+
+    class_test((ppt->grid_reference->md_size != ppt->md_size) ||
+               (ppt->grid_reference->k_output_values_num != ppt->k_output_values_num),
+               ppt->error_message,
+               "the reference model of the batch does not have the same modes and k_output_values");
+
+    for (index_mode=0; index_mode<ppt->md_size; index_mode++) {
+
+      ppt->k_size[index_mode] = ppt->grid_reference->k_size[index_mode];
+      ppt->k_size_cl[index_mode] = ppt->grid_reference->k_size_cl[index_mode];
+      ppt->k_size_cmb[index_mode] = ppt->grid_reference->k_size_cmb[index_mode];
+
+      class_realloc(ppt->k[index_mode],
+                    ppt->k[index_mode],
+                    ppt->k_size[index_mode]*sizeof(double),
+                    ppt->error_message);
+
+      memcpy(ppt->k[index_mode],ppt->grid_reference->k[index_mode],ppt->k_size[index_mode]*sizeof(double));
+    }
+
+    if (ppt->k_output_values_num > 0)
+      memcpy(ppt->index_k_output_values,ppt->grid_reference->index_k_output_values,ppt->md_size*ppt->k_output_values_num*sizeof(int));
+  }
+
   /** - finally, find the global k_min and k_max for the ensemble of all modes 9scalars, vectors, tensors) */
 
   ppt->k_min = _HUGE_;
@@ -2513,6 +4439,14 @@ int perturb_workspace_init(
   int index_ap;
   int l;
 
+  /** - Initialize the count of calls to perturb_approximations() in switch searches */
+  ppw->approx_switch_calls = 0;
+  ppw->approx_switch_calls_saved = 0;
+
+  /** - Initialize the (empty) arena of perturbation vectors */
+  ppw->pv = NULL;
+  memset(&(ppw->vector_arena),0,sizeof(struct perturb_vector_arena));
+
   /** - Compute maximum l_max for any multipole */;
   if (_scalars_) {
     ppw->max_l_max = MAX(ppr->l_max_g, ppr->l_max_pol_g);
@@ -2536,6 +4470,15 @@ int perturb_workspace_init(
     ppw->s_l[l] = 1.0;
   }
 
+  /** - Allocate the coefficients of the free-streaming hierarchy
+      \f$ l s_l/(2l+1) \f$ and \f$ (l+1) s_{l+1}/(2l+1) \f$ used by
+      perturb_hierarchy_free_streaming(), and initialize them to their K=0 value. */
+  class_alloc(ppw->s_l_minus, sizeof(double)*(ppw->max_l_max+1),ppt->error_message);
+  class_alloc(ppw->s_l_plus, sizeof(double)*(ppw->max_l_max+1),ppt->error_message);
+  class_call(perturb_hierarchy_coefficients(ppw),
+             ppt->error_message,
+             ppt->error_message);
+
   /** - define indices of metric perturbations obeying constraint
       equations (this can be done once and for all, because the
       vector of metric perturbations is the same whatever the
@@ -2677,13 +4620,33 @@ int perturb_workspace_init(
 
   }
 
+  /** - in the lrs nugget approximation, evolve the nuggets as an
+      offset to CDM when possible */
+
+  ppw->lrs_nugget_cdm_offset = ((pba->has_lrs == _TRUE_) && (pba->has_lrs_nuggets == _TRUE_) &&
+                                (pba->has_cdm == _TRUE_) && (ppr->lrs_nugget_cdm_offset == _TRUE_));
+  ppw->lrs_nugget_theta_offset_a = 0.;
+
+  /** - allocate the lrs momentum cache, marked as empty until
+      perturb_lrs_momentum_cache() is first called */
+
+  ppw->lrs_cache_a = -1.;
+  ppw->lrs_epsilon = NULL;
+
+  if (pba->has_lrs == _TRUE_) {
+    class_alloc(ppw->lrs_epsilon,pba->q_size_lrs*sizeof(double),ppt->error_message);
+    class_alloc(ppw->lrs_inv_epsilon,pba->q_size_lrs*sizeof(double),ppt->error_message);
+    class_alloc(ppw->lrs_w_q2_epsilon,pba->q_size_lrs*sizeof(double),ppt->error_message);
+    class_alloc(ppw->lrs_w_q4_over_epsilon,pba->q_size_lrs*sizeof(double),ppt->error_message);
+    class_alloc(ppw->lrs_mT_over_epsilon2,pba->q_size_lrs*sizeof(double),ppt->error_message);
+  }
+
   return _SUCCESS_;
 }
 
 /**
- * Free the perturb_workspace structure (with the exception of the
- * perturb_vector '-->pv' field, which is freed separately in
- * perturb_vector_free).
+ * Free the perturb_workspace structure, including the storage of its
+ * perturb_vector structures.
  *
  * @param ppt        Input: pointer to the perturbation structure
  * @param index_md Input: index of mode under consideration (scalar/.../tensor)
@@ -2697,7 +4660,19 @@ int perturb_workspace_free (
                             struct perturb_workspace * ppw
                             ) {
 
+  int index_slot;
+
+  for (index_slot=0; index_slot<2; index_slot++) {
+    free(ppw->vector_arena.y[index_slot]);
+    free(ppw->vector_arena.dy[index_slot]);
+    free(ppw->vector_arena.used_in_sources[index_slot]);
+    free(ppw->vector_arena.l_max_ncdm[index_slot]);
+    free(ppw->vector_arena.q_size_ncdm[index_slot]);
+  }
+
   free(ppw->s_l);
+  free(ppw->s_l_minus);
+  free(ppw->s_l_plus);
   free(ppw->pvecback);
   free(ppw->pvecthermo);
   free(ppw->pvecmetric);
@@ -2713,11 +4688,132 @@ int perturb_workspace_free (
     }
   }
 
+  if (ppw->lrs_epsilon != NULL) {
+    free(ppw->lrs_epsilon);
+    free(ppw->lrs_inv_epsilon);
+    free(ppw->lrs_w_q2_epsilon);
+    free(ppw->lrs_w_q4_over_epsilon);
+    free(ppw->lrs_mT_over_epsilon2);
+  }
+
   free(ppw);
 
   return _SUCCESS_;
 }
 
+/**
+ * Fill the lrs momentum cache of the workspace at the time of
+ * ppw->pvecback.
+ *
+ * The fermion energy on the momentum grid, and its combinations with
+ * the quadrature weights entering the stress-energy integrals and the
+ * Boltzmann hierarchy, only depend on the background at this time. They
+ * are computed here once and shared by all the routines that loop over
+ * q_lrs at the same time. The cache is keyed on the scale factor, a
+ * monotonic function of tau available in all these routines; nothing
+ * is done if it already holds the values at the current a.
+ *
+ * @param pba        Input: pointer to background structure
+ * @param ppw        Input/Output: pointer to perturb_workspace structure, whose lrs cache is filled here
+ * @return the error status
+ */
+
+int perturb_lrs_momentum_cache(
+                               struct background * pba,
+                               struct perturb_workspace * ppw
+                               ) {
+
+  int index_q;
+  double a,mT,a2mT2,q,q2,epsilon,inv_epsilon;
+
+  a = ppw->pvecback[pba->index_bg_a];
+
+  if (a == ppw->lrs_cache_a)
+    return _SUCCESS_;
+
+  mT = ppw->pvecback[pba->index_bg_mT_over_T0_lrs];
+  a2mT2 = a*a*mT*mT;
+
+  for (index_q=0; index_q < pba->q_size_lrs; index_q++) {
+    q = pba->q_lrs[index_q];
+    q2 = q*q;
+    epsilon = sqrt(q2+a2mT2);
+    inv_epsilon = 1./epsilon;
+    ppw->lrs_epsilon[index_q] = epsilon;
+    ppw->lrs_inv_epsilon[index_q] = inv_epsilon;
+    ppw->lrs_w_q2_epsilon[index_q] = pba->w_lrs[index_q]*q2*epsilon;
+    ppw->lrs_w_q4_over_epsilon[index_q] = pba->w_lrs[index_q]*q2*q2*inv_epsilon;
+    ppw->lrs_mT_over_epsilon2[index_q] = a/pba->a_today*mT*inv_epsilon*inv_epsilon;
+  }
+
+  ppw->lrs_cache_a = a;
+
+  return _SUCCESS_;
+}
+
+/**
+ * Compute the coefficients of the free-streaming hierarchy from the
+ * current values of ppw->s_l. They only depend on k (through the
+ * curvature), and should be updated each time s_l is.
+ *
+ * @param ppw        Input/Output: pointer to perturb_workspace structure, whose s_l_minus and s_l_plus are filled here
+ * @return the error status
+ */
+
+int perturb_hierarchy_coefficients(
+                                   struct perturb_workspace * ppw
+                                   ) {
+
+  int l;
+
+  for (l=0; l<=ppw->max_l_max; l++) {
+    ppw->s_l_minus[l] = l*ppw->s_l[l]/(2.*l+1.);
+    ppw->s_l_plus[l] = (l < ppw->max_l_max) ? (l+1.)*ppw->s_l[l+1]/(2.*l+1.) : 0.;
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Free-streaming part of a Boltzmann hierarchy on a momentum grid,
+ * for multipoles l_min <= l < l_max of one momentum bin:
+ *
+ * \f$ \Psi_l' = q k/\epsilon \, [l s_l \Psi_{l-1} - (l+1) s_{l+1} \Psi_{l+1}]/(2l+1) \f$
+ *
+ * The multipoles of a given bin are contiguous in y and dy, and the
+ * coefficients are tabulated in s_l_minus and s_l_plus, so that this
+ * innermost loop of perturb_derivs() is a unit-stride loop without
+ * divisions that the compiler can vectorize.
+ *
+ * @param qk_div_epsilon Input: \f$ q k/\epsilon \f$ for this momentum bin
+ * @param y              Input: multipoles of this momentum bin (y[0] is l=0)
+ * @param dy             Output: their derivatives, filled for l_min <= l < l_max
+ * @param s_l_minus      Input: coefficients \f$ l s_l/(2l+1) \f$
+ * @param s_l_plus       Input: coefficients \f$ (l+1) s_{l+1}/(2l+1) \f$
+ * @param l_min          Input: first multipole
+ * @param l_max          Input: last multipole, not included (truncation is done by the caller)
+ * @return the error status
+ */
+
+int perturb_hierarchy_free_streaming(
+                                     double qk_div_epsilon,
+                                     double * restrict y,
+                                     double * restrict dy,
+                                     double * restrict s_l_minus,
+                                     double * restrict s_l_plus,
+                                     int l_min,
+                                     int l_max
+                                     ) {
+
+  int l;
+
+  for (l=l_min; l<l_max; l++) {
+    dy[l] = qk_div_epsilon*(s_l_minus[l]*y[l-1]-s_l_plus[l]*y[l+1]);
+  }
+
+  return _SUCCESS_;
+}
+
 /**
  * Solve the perturbation evolution for a given mode, initial
  * condition and wavenumber, and compute the corresponding source
@@ -2807,6 +4903,10 @@ int perturb_solve(
   extern int evolver_ndf15();
   int (*generic_evolver)();
 
+  /* function computing the derivatives (specialized to the configuration, see perturb_derivs_select()) */
+  int (*derivs)(double, double *, double *, void *, ErrorMsg);
+  const char * derivs_name;
+
 
   /* Related to the perturbation output */
   int (*perhaps_print_variables)();
@@ -2817,6 +4917,11 @@ int perturb_solve(
   ppw->last_index_thermo=0;
   ppw->inter_mode = pba->inter_normal;
 
+  /** - select the version of perturb_derivs() for this configuration with perturb_derivs_select() */
+  class_call(perturb_derivs_select(pba,ppt,&derivs,&derivs_name),
+             ppt->error_message,
+             ppt->error_message);
+
   /** - get wavenumber value */
   k = ppt->k[index_md][index_k];
 
@@ -2829,6 +4934,9 @@ int perturb_solve(
     for (l = 0; l<=ppw->max_l_max; l++){
       ppw->s_l[l] = sqrt(MAX(1.0-pba->K*(l*l-1.0)/k/k,0.));
     }
+    class_call(perturb_hierarchy_coefficients(ppw),
+               ppt->error_message,
+               ppt->error_message);
   }
 
   /** - maximum value of tau for which sources are calculated for this wavenumber */
@@ -3011,6 +5119,19 @@ int perturb_solve(
 
   free(interval_number_of);
 
+  /** - eventually add checkpoints for the dynamical truncation of the lrs hierarchy */
+
+  class_call(perturb_lrs_truncation_checkpoints(ppr,
+                                                pba,
+                                                ppt,
+                                                index_md,
+                                                ppw,
+                                                &interval_number,
+                                                &interval_limit,
+                                                &interval_approx),
+             ppt->error_message,
+             ppt->error_message);
+
   /** - fill the structure containing all fixed parameters, indices
       and workspaces needed by perturb_derivs */
 
@@ -3089,7 +5210,9 @@ int perturb_solve(
       generic_evolver = evolver_ndf15;
     }
 
-    class_call(generic_evolver(perturb_derivs,
+    ppw->derivs_count = 0;
+
+    class_call(generic_evolver(derivs,
                                interval_limit[index_interval],
                                interval_limit[index_interval+1],
                                ppw->pv->y,
@@ -3104,10 +5227,21 @@ int perturb_solve(
                                tau_actual_size,
                                perturb_sources,
                                perhaps_print_variables,
+                               perturb_sparsity_pattern,
                                ppt->error_message),
                ppt->error_message,
                ppt->error_message);
 
+    /** - --> (e) report the cost of the interval, useful for tuning the approximation triggers */
+
+    if (ppt->perturbations_verbose > 3) {
+      printf(" -> k=%e /Mpc, interval %d/%d, tau in [%e, %e], approximations {",
+             k,index_interval+1,interval_number,interval_limit[index_interval],interval_limit[index_interval+1]);
+      for (index_ap=0; index_ap<ppw->ap_size; index_ap++)
+        printf("%s%d",(index_ap == 0 ? "" : ","),ppw->approx[index_ap]);
+      printf("}: %d calls to perturb_derivs\n",ppw->derivs_count);
+    }
+
   }
 
   /** - if perturbations were printed in a file, close the file */
@@ -3128,18 +5262,225 @@ int perturb_solve(
 
   /** - free quantities allocated at the beginning of the routine */
 
-  class_call(perturb_vector_free(ppw->pv),
-             ppt->error_message,
-             ppt->error_message);
+  class_call(perturb_vector_free(ppw,ppw->pv),
+             ppt->error_message,
+             ppt->error_message);
+
+  for (index_interval=0; index_interval<interval_number; index_interval++)
+    free(interval_approx[index_interval]);
+
+  free(interval_approx);
+
+  free(interval_limit);
+
+  return _SUCCESS_;
+}
+
+/**
+ * Choose the order in which the pairs of initial conditions and
+ * wavenumbers of a given mode are handed out to the threads by the
+ * dynamic schedule of perturb_init(). Pairs are numbered
+ * index_ic*k_size+index_k.
+ *
+ * The cost of perturb_solve() grows with k (more time steps) by more
+ * than an order of magnitude across the k range, and depends on the
+ * approximation scheme of each wavenumber. Handing out the most
+ * expensive pairs first (longest-processing-time-first scheduling)
+ * avoids leaving a few long ones running alone at the end of the
+ * loop. The cost of each pair is taken from the previous run, stored
+ * by perturb_task_cost_store(), if it had the same number of
+ * initial conditions and wavenumbers for this mode. If no
+ * measurement is available, or if ppr->perturb_schedule_by_cost is
+ * false, the order is by decreasing k, alternating between initial
+ * conditions. The order has no impact on the results.
+ *
+ * @param ppr        Input: pointer to precision structure
+ * @param ppt        Input: pointer to the perturbation structure
+ * @param index_md   Input: index of mode under consideration
+ * @param task_order Output: indices of pairs in order of decreasing cost
+ * @param task_cost  Output: cost assumed for each pair (or NULL)
+ * @return the error status
+ */
+
+int perturb_task_schedule(
+                          struct precision * ppr,
+                          struct perturbs * ppt,
+                          int index_md,
+                          int * task_order,
+                          double * task_cost
+                          ) {
+
+  int index_task;
+  int task_size = ppt->ic_size[index_md]*ppt->k_size[index_md];
+  double * cost_and_index;
+  short has_cost = _FALSE_;
+
+  class_alloc(cost_and_index,2*task_size*sizeof(double),ppt->error_message);
+
+  if (ppr->perturb_schedule_by_cost == _TRUE_) {
+
+#pragma omp critical (perturb_task_cost)
+    {
+      if (perturb_task_cost_size[index_md] == task_size) {
+        for (index_task=0; index_task<task_size; index_task++)
+          cost_and_index[2*index_task] = perturb_task_cost_previous[index_md][index_task];
+        has_cost = _TRUE_;
+      }
+    }
+  }
+
+  /* without measurements, the cost is assumed to grow with k */
+  if (has_cost == _FALSE_) {
+    for (index_task=0; index_task<task_size; index_task++)
+      cost_and_index[2*index_task] = (double)(index_task % ppt->k_size[index_md]);
+  }
+
+  for (index_task=0; index_task<task_size; index_task++) {
+    cost_and_index[2*index_task+1] = (double)index_task;
+    if (task_cost != NULL)
+      task_cost[index_task] = cost_and_index[2*index_task];
+  }
+
+  qsort(cost_and_index,task_size,2*sizeof(double),perturb_compare_cost);
+
+  for (index_task=0; index_task<task_size; index_task++)
+    task_order[index_task] = (int)cost_and_index[2*index_task+1];
+
+  free(cost_and_index);
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * Keep the cost of each pair of initial condition and wavenumber of a
+ * given mode measured in this run, for scheduling the next run with
+ * perturb_task_schedule().
+ *
+ * @param ppt       Input: pointer to the perturbation structure
+ * @param index_md  Input: index of mode under consideration
+ * @param task_cost Input: cost of each pair
+ * @return the error status
+ */
+
+int perturb_task_cost_store(
+                            struct perturbs * ppt,
+                            int index_md,
+                            double * task_cost
+                            ) {
+
+  int task_size = ppt->ic_size[index_md]*ppt->k_size[index_md];
+  double * previous;
+
+#pragma omp critical (perturb_task_cost)
+  {
+    previous = realloc(perturb_task_cost_previous[index_md],task_size*sizeof(double));
+    if (previous != NULL) {
+      perturb_task_cost_previous[index_md] = previous;
+      memcpy(perturb_task_cost_previous[index_md],task_cost,task_size*sizeof(double));
+      perturb_task_cost_size[index_md] = task_size;
+    }
+  }
+
+  class_test(previous == NULL,
+             ppt->error_message,
+             "could not allocate the cost of %d pairs of initial conditions and wavenumbers",task_size);
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * In an MPI run, gather in every process the source functions of a
+ * given mode computed by all processes: each process sends the
+ * sources of its own pairs of initial conditions and wavenumbers (for
+ * all types and times), by increasing pair index, and copies those of
+ * the other processes in its source tables. The values are copied, so
+ * that the tables are the same as with a single process.
+ *
+ * @param ppt       Input/Output: pointer to the perturbation structure
+ * @param index_md  Input: index of mode under consideration
+ * @param task_rank Input: rank of the process which computed each pair (numbered index_ic*k_size+index_k)
+ * @return the error status
+ */
+
+int perturb_sources_mpi_gather(
+                               struct perturbs * ppt,
+                               int index_md,
+                               int * task_rank
+                               ) {
+
+  int task_size = ppt->ic_size[index_md]*ppt->k_size[index_md];
+  int k_size = ppt->k_size[index_md];
+  int tp_size = ppt->tp_size[index_md];
+  int pair_size = tp_size*ppt->tau_size;
+  int mpi_size = class_mpi_size();
+  int mpi_rank = class_mpi_rank();
+  int index_task,index_ic,index_k,index_tp,index_tau,rank;
+  int * receive_count;
+  double * send_buffer;
+  double * receive_buffer;
+  double * pointer;
+
+  class_calloc(receive_count,mpi_size,sizeof(int),ppt->error_message);
+  for (index_task = 0; index_task < task_size; index_task++)
+    receive_count[task_rank[index_task]] += pair_size;
+
+  class_alloc(send_buffer,MAX(receive_count[mpi_rank],1)*sizeof(double),ppt->error_message);
+  class_alloc(receive_buffer,(size_t)task_size*pair_size*sizeof(double),ppt->error_message);
+
+  pointer = send_buffer;
+  for (index_task = 0; index_task < task_size; index_task++) {
+    if (task_rank[index_task] != mpi_rank)
+      continue;
+    index_ic = index_task / k_size;
+    index_k = index_task % k_size;
+    for (index_tp = 0; index_tp < tp_size; index_tp++)
+      for (index_tau = 0; index_tau < ppt->tau_size; index_tau++)
+        *(pointer++) = ppt->sources[index_md][index_ic*tp_size+index_tp][index_tau*k_size+index_k];
+  }
+
+  class_call(class_mpi_allgather(send_buffer,receive_count[mpi_rank],receive_buffer,receive_count,ppt->error_message),
+             ppt->error_message,
+             ppt->error_message);
+
+  /* the blocks of the processes follow each other by increasing rank */
+  pointer = receive_buffer;
+  for (rank = 0; rank < mpi_size; rank++) {
+    for (index_task = 0; index_task < task_size; index_task++) {
+      if (task_rank[index_task] != rank)
+        continue;
+      index_ic = index_task / k_size;
+      index_k = index_task % k_size;
+      for (index_tp = 0; index_tp < tp_size; index_tp++)
+        for (index_tau = 0; index_tau < ppt->tau_size; index_tau++)
+          ppt->sources[index_md][index_ic*tp_size+index_tp][index_tau*k_size+index_k] = *(pointer++);
+    }
+  }
+
+  free(receive_count);
+  free(send_buffer);
+  free(receive_buffer);
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * Comparison of two (cost, index) pairs by decreasing cost, for qsort()
+ * in perturb_task_schedule(); ties are broken by decreasing index.
+ */
+
+static int perturb_compare_cost(const void * a, const void * b) {
 
-  for (index_interval=0; index_interval<interval_number; index_interval++)
-    free(interval_approx[index_interval]);
+  const double * pair_a = (const double *) a;
+  const double * pair_b = (const double *) b;
 
-  free(interval_approx);
+  if (pair_a[0] != pair_b[0])
+    return (pair_a[0] < pair_b[0]) ? 1 : -1;
 
-  free(interval_limit);
+  return (pair_a[1] < pair_b[1]) ? 1 : -1;
 
-  return _SUCCESS_;
 }
 
 /**
@@ -3418,6 +5759,9 @@ int perturb_find_approximation_switches(
   double next_tau_switch;
   int flag_ini;
   int num_switching_at_given_time;
+  short has_switch;
+  long full_bisection_calls,calls_before_search;
+  double width;
 
   /** - write in output arrays the initial time and approximation */
 
@@ -3467,8 +5811,76 @@ int perturb_find_approximation_switches(
 
         for (index_switch=0; index_switch<num_switch; index_switch++) {
 
+          /** - --> switching times of the lrs approximations are known without bisection */
+
+          class_call(perturb_lrs_approximation_switch(ppr,
+                                                      pba,
+                                                      ppt,
+                                                      index_md,
+                                                      k,
+                                                      ppw,
+                                                      index_ap,
+                                                      tau_min,
+                                                      tau_end,
+                                                      precision,
+                                                      &mid,
+                                                      &has_switch),
+                     ppt->error_message,
+                     ppt->error_message);
+
+          /** - --> so are those of the approximations triggered by tau*k only (and a fixed time) */
+
+          if ((has_switch == _FALSE_) && (num_switch == 1)) {
+            class_call(perturb_analytic_approximation_switch(ppr,
+                                                             pba,
+                                                             pth,
+                                                             ppt,
+                                                             index_md,
+                                                             k,
+                                                             ppw,
+                                                             index_ap,
+                                                             tau_min,
+                                                             tau_end,
+                                                             &mid,
+                                                             &has_switch),
+                       ppt->error_message,
+                       ppt->error_message);
+          }
+
+          /* number of steps of a full bisection, to count those saved */
+          full_bisection_calls = 0;
+          for (width = tau_end-tau_min; width > precision; width *= 0.5)
+            full_bisection_calls++;
+
+          if (has_switch == _TRUE_) {
+            ppw->approx_switch_calls_saved += full_bisection_calls;
+            unsorted_tau_switch[index_switch_tot]=mid;
+            index_switch_tot++;
+            tau_min=mid;
+            continue;
+          }
+
+          calls_before_search = ppw->approx_switch_calls;
+
           lower_bound=tau_min;
           upper_bound=tau_end;
+
+          /** - --> otherwise, bisection, starting from the bracket given by the tight-coupling schedule if any */
+
+          class_call(perturb_switch_schedule_bracket(ppr,
+                                                     pba,
+                                                     pth,
+                                                     ppt,
+                                                     index_md,
+                                                     k,
+                                                     ppw,
+                                                     index_ap,
+                                                     flag_ini+index_switch,
+                                                     &lower_bound,
+                                                     &upper_bound),
+                     ppt->error_message,
+                     ppt->error_message);
+
           mid = 0.5*(lower_bound+upper_bound);
 
           while (upper_bound - lower_bound > precision) {
@@ -3483,6 +5895,7 @@ int perturb_find_approximation_switches(
                                               ppw),
                        ppt->error_message,
                        ppt->error_message);
+            ppw->approx_switch_calls++;
 
             if (ppw->approx[index_ap] > flag_ini+index_switch) {
               upper_bound=mid;
@@ -3495,6 +5908,8 @@ int perturb_find_approximation_switches(
 
           }
 
+          ppw->approx_switch_calls_saved += full_bisection_calls - (ppw->approx_switch_calls - calls_before_search);
+
           unsorted_tau_switch[index_switch_tot]=mid;
           index_switch_tot++;
 
@@ -3579,98 +5994,616 @@ int perturb_find_approximation_switches(
                  interval_limit[index_switch],
                  num_switching_at_given_time);
 
-      if (ppt->perturbations_verbose>2) {
+      if (ppt->perturbations_verbose>2) {
+
+        if (_scalars_) {
+
+          if ((interval_approx[index_switch-1][ppw->index_ap_tca]==(int)tca_on) &&
+              (interval_approx[index_switch][ppw->index_ap_tca]==(int)tca_off))
+            fprintf(stdout,"Mode k=%e: will switch off tight-coupling approximation at tau=%e\n",k,interval_limit[index_switch]);
+          //fprintf(stderr,"Mode k=%e: will switch off tight-coupling approximation at tau=%e\n",k,interval_limit[index_switch]);  //TBC
+
+          if ((interval_approx[index_switch-1][ppw->index_ap_rsa]==(int)rsa_off) &&
+              (interval_approx[index_switch][ppw->index_ap_rsa]==(int)rsa_on))
+            fprintf(stdout,"Mode k=%e: will switch on radiation streaming approximation at tau=%e\n",k,interval_limit[index_switch]);
+
+          if (pba->has_idr == _TRUE_){
+            if ((interval_approx[index_switch-1][ppw->index_ap_rsa_idr]==(int)rsa_idr_off) &&
+                (interval_approx[index_switch][ppw->index_ap_rsa_idr]==(int)rsa_idr_on))
+              fprintf(stdout,"Mode k=%e: will switch on dark radiation streaming approximation at tau=%e\n",k,interval_limit[index_switch]);
+          }
+
+          if (pba->has_idm_dr == _TRUE_){
+            if ((interval_approx[index_switch-1][ppw->index_ap_tca_idm_dr]==(int)tca_idm_dr_on) &&
+                (interval_approx[index_switch][ppw->index_ap_tca_idm_dr]==(int)tca_idm_dr_off))
+              fprintf(stdout,"Mode k=%e: will switch off dark tight-coupling approximation at tau=%e\n",k,interval_limit[index_switch]);
+          }
+
+          if (pba->has_ur == _TRUE_) {
+            if ((interval_approx[index_switch-1][ppw->index_ap_ufa]==(int)ufa_off) &&
+                (interval_approx[index_switch][ppw->index_ap_ufa]==(int)ufa_on)) {
+              fprintf(stdout,"Mode k=%e: will switch on ur fluid approximation at tau=%e\n",k,interval_limit[index_switch]);
+            }
+          }
+          if (pba->has_ncdm == _TRUE_) {
+            if ((interval_approx[index_switch-1][ppw->index_ap_ncdmfa]==(int)ncdmfa_off) &&
+                (interval_approx[index_switch][ppw->index_ap_ncdmfa]==(int)ncdmfa_on)) {
+              fprintf(stdout,"Mode k=%e: will switch on ncdm fluid approximation at tau=%e\n",k,interval_limit[index_switch]);
+            }
+          }
+
+          if (pba->has_lrs == _TRUE_) {
+            if ((interval_approx[index_switch-1][ppw->index_ap_lrsfa]==(int)lrsfa_off) &&
+                (interval_approx[index_switch][ppw->index_ap_lrsfa]==(int)lrsfa_on)) {
+              fprintf(stdout,"Mode k=%e: will switch on lrs fluid approximation at tau=%e\n",k,interval_limit[index_switch]); 
+            }
+          
+            if (ppt->has_lrs_phi_pt == _TRUE_) {
+              if ((interval_approx[index_switch-1][ppw->index_ap_lrsad1]==(int)lrsad1_on || interval_approx[index_switch-1][ppw->index_ap_lrsad2]==(int)lrsad2_on) &&
+                  (interval_approx[index_switch][ppw->index_ap_lrsad2]==(int)lrsad2_off && interval_approx[index_switch][ppw->index_ap_lrsad2]==(int)lrsad2_off)) {
+                fprintf(stdout,"Mode k=%e: will switch off lrs adiabatic approximation at tau=%e\n",k,interval_limit[index_switch]);
+              }
+	      if ((interval_approx[index_switch-1][ppw->index_ap_lrsad1]==(int)lrsad1_off && interval_approx[index_switch-1][ppw->index_ap_lrsad2]==(int)lrsad2_off) &&
+                  (interval_approx[index_switch][ppw->index_ap_lrsad1]==(int)lrsad1_on || interval_approx[index_switch][ppw->index_ap_lrsad2]==(int)lrsad2_on)) {
+                fprintf(stdout,"Mode k=%e: will switch on lrs adiabatic approximation at tau=%e\n",k,interval_limit[index_switch]);
+              }
+            }
+
+	    if (pba->has_lrs_nuggets == _TRUE_) {
+              if ((interval_approx[index_switch-1][ppw->index_ap_lrsnug]==(int)lrsnug_off) &&
+                  (interval_approx[index_switch][ppw->index_ap_lrsnug]==(int)lrsnug_on)) {
+                fprintf(stdout,"Mode k=%e: will switch on lrs nugget approximation at tau=%e\n",k,interval_limit[index_switch]); 
+              }
+            }
+          }
+        }
+
+        if (_tensors_) {
+
+          if ((interval_approx[index_switch-1][ppw->index_ap_tca]==(int)tca_on) &&
+              (interval_approx[index_switch][ppw->index_ap_tca]==(int)tca_off))
+            fprintf(stdout,"Mode k=%e: will switch off tight-coupling approximation for tensors at tau=%e\n",k,interval_limit[index_switch]);
+
+          if ((interval_approx[index_switch-1][ppw->index_ap_rsa]==(int)rsa_off) &&
+              (interval_approx[index_switch][ppw->index_ap_rsa]==(int)rsa_on))
+            fprintf(stdout,"Mode k=%e: will switch on radiation streaming approximation for tensors at tau=%e\n",k,interval_limit[index_switch]);
+
+	  // We have *NOT* implemented long-range interactions in tensor perturbations
+        }
+      }
+    }
+
+    free(unsorted_tau_switch);
+
+    class_call(perturb_approximations(ppr,
+                                      pba,
+                                      pth,
+                                      ppt,
+                                      index_md,
+                                      k,
+                                      tau_end,
+                                      ppw),
+
+               ppt->error_message,
+               ppt->error_message);
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * For a given mode and wavenumber, return directly the switching time
+ * of the lrs approximations, which depend on tau only through
+ * background quantities. This avoids the generic bisection of
+ * perturb_find_approximation_switches(), where each step calls
+ * perturb_approximations().
+ *
+ * - lrsfa is switched on at tau = lrs_fluid_trigger_tau_over_tau_k/k;
+ * - lrsad1 (lrsad2) is switched on when \f$ a^2 M^2 \f$ (\f$ a^2 M_T^2 \f$)
+ *   exceeds \f$ k^2 \f$ lrs_adiab_trigger_M_over_kH\f$ ^2 \f$;
+ * - lrsnug is switched on when a exceeds the instability scale factor.
+ *
+ * The last three are found with perturb_lrs_background_crossing().
+ *
+ * @param ppr          Input: pointer to precision structure
+ * @param pba          Input: pointer to background structure
+ * @param ppt          Input: pointer to the perturbation structure
+ * @param index_md     Input: index of mode under consideration (scalar/.../tensor)
+ * @param k            Input: wavenumber
+ * @param ppw          Input/Output: pointer to perturb_workspace structure (pvecback is used as a workspace)
+ * @param index_ap     Input: index of the approximation under consideration
+ * @param tau_ini      Input: time at which the approximation is known to be off
+ * @param tau_end      Input: time at which the approximation is known to be on
+ * @param precision    Input: tolerance on the switching time
+ * @param tau_switch   Output: switching time
+ * @param has_switch   Output: _TRUE_ if tau_switch was computed, _FALSE_ if index_ap is not an lrs approximation
+ * @return the error status
+ */
+
+int perturb_lrs_approximation_switch(
+                                     struct precision * ppr,
+                                     struct background * pba,
+                                     struct perturbs * ppt,
+                                     int index_md,
+                                     double k,
+                                     struct perturb_workspace * ppw,
+                                     int index_ap,
+                                     double tau_ini,
+                                     double tau_end,
+                                     double precision,
+                                     double * tau_switch,
+                                     short * has_switch
+                                     ) {
+
+  double threshold;
+
+  *has_switch = _FALSE_;
+
+  if ((_scalars_ == _FALSE_) || (pba->has_lrs == _FALSE_))
+    return _SUCCESS_;
+
+  /* threshold on (a^2 M_phi^2) or (a^2 M_T^2), in 1/Mpc^2 */
+  threshold = SQR(ppr->lrs_adiab_trigger_M_over_kH*k/(pba->lrs_M_phi * _Mpc_times_eV));
+
+  if (index_ap == ppw->index_ap_lrsfa) {
+    *tau_switch = ppr->lrs_fluid_trigger_tau_over_tau_k/k;
+    *has_switch = _TRUE_;
+  }
+  else if ((ppt->has_lrs_phi_pt == _TRUE_) && (index_ap == ppw->index_ap_lrsad1)) {
+    class_call(perturb_lrs_background_crossing(pba,ppw,-1,2,threshold,tau_ini,tau_end,precision,tau_switch,ppt->error_message),
+               ppt->error_message,
+               ppt->error_message);
+    *has_switch = _TRUE_;
+  }
+  else if ((ppt->has_lrs_phi_pt == _TRUE_) && (index_ap == ppw->index_ap_lrsad2)) {
+    class_call(perturb_lrs_background_crossing(pba,ppw,pba->index_bg_MTsq_over_Msq_lrs,2,threshold,
+                                               tau_ini,tau_end,precision,tau_switch,ppt->error_message),
+               ppt->error_message,
+               ppt->error_message);
+    *has_switch = _TRUE_;
+  }
+  else if ((pba->has_lrs_nuggets == _TRUE_) && (index_ap == ppw->index_ap_lrsnug)) {
+    class_call(perturb_lrs_background_crossing(pba,ppw,pba->index_bg_lrs_a_over_aunstable,0,1.,
+                                               tau_ini,tau_end,precision,tau_switch,ppt->error_message),
+               ppt->error_message,
+               ppt->error_message);
+    *has_switch = _TRUE_;
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Find the first time after tau_ini at which the background quantity
+ * \f$ Q(\tau) = a^p \f$ background_table[index_bg] (or just
+ * \f$ a^p \f$ if index_bg is negative) exceeds a threshold.
+ *
+ * The background table, which is already sampled in tau, is scanned
+ * to bracket the crossing. Inside the bracket, Q scales nearly as a
+ * power of tau, so that a few false position steps in ln(Q) against
+ * ln(tau) reach the requested precision.
+ *
+ * @param pba          Input: pointer to background structure
+ * @param ppw          Input/Output: pointer to perturb_workspace structure (pvecback is used as a workspace)
+ * @param index_bg     Input: index of the background quantity, or -1
+ * @param a_power      Input: power p of the scale factor
+ * @param threshold    Input: threshold on Q
+ * @param tau_ini      Input: lower bound of the search, with Q(tau_ini) <= threshold
+ * @param tau_end      Input: upper bound of the search, with Q(tau_end) > threshold
+ * @param precision    Input: tolerance on the crossing time
+ * @param tau_cross    Output: crossing time
+ * @param error_message Output: error message
+ * @return the error status
+ */
+
+int perturb_lrs_background_crossing(
+                                    struct background * pba,
+                                    struct perturb_workspace * ppw,
+                                    int index_bg,
+                                    int a_power,
+                                    double threshold,
+                                    double tau_ini,
+                                    double tau_end,
+                                    double precision,
+                                    double * tau_cross,
+                                    ErrorMsg error_message
+                                    ) {
+
+  int index_tau,iteration,side;
+  short use_log;
+  double tau_lower,tau_upper,Q_lower,Q_upper,Q_cross;
+  double x_lower,x_upper,x_cross,x_previous,f_lower,f_upper,f_cross;
+
+  /** - Q at tau_ini, which is generally not a node of the table */
+  tau_lower = tau_ini;
+  class_call(background_at_tau(pba,tau_lower,pba->normal_info,pba->inter_normal,&(ppw->last_index_back),ppw->pvecback),
+             pba->error_message,
+             error_message);
+  Q_lower = pow(ppw->pvecback[pba->index_bg_a],a_power);
+  if (index_bg >= 0) Q_lower *= ppw->pvecback[index_bg];
+
+  /** - bracket the crossing with the nodes of the table */
+  index_tau = 0;
+  while ((index_tau < pba->bt_size) && (pba->tau_table[index_tau] <= tau_ini))
+    index_tau++;
+
+  tau_upper = tau_lower;
+  Q_upper = Q_lower;
+
+  for ( ; (index_tau < pba->bt_size) && (pba->tau_table[index_tau] < tau_end); index_tau++) {
+    tau_upper = pba->tau_table[index_tau];
+    Q_upper = pow(pba->background_table[index_tau*pba->bg_size+pba->index_bg_a],a_power);
+    if (index_bg >= 0) Q_upper *= pba->background_table[index_tau*pba->bg_size+index_bg];
+    if (Q_upper > threshold)
+      break;
+    tau_lower = tau_upper;
+    Q_lower = Q_upper;
+  }
+
+  if (Q_upper <= threshold) {
+    tau_upper = tau_end;
+    class_call(background_at_tau(pba,tau_upper,pba->normal_info,pba->inter_normal,&(ppw->last_index_back),ppw->pvecback),
+               pba->error_message,
+               error_message);
+    Q_upper = pow(ppw->pvecback[pba->index_bg_a],a_power);
+    if (index_bg >= 0) Q_upper *= ppw->pvecback[index_bg];
+  }
+
+  class_test((Q_lower > threshold) || (Q_upper <= threshold),
+             error_message,
+             "background quantity does not cross the threshold %e between tau=%e (%e) and tau=%e (%e)",
+             threshold,tau_lower,Q_lower,tau_upper,Q_upper);
+
+  /** - locate the crossing inside the bracket by false position (Illinois variant),
+      working with ln(Q) against ln(tau) since Q is close to a power law in tau */
+  use_log = ((Q_lower > 0.) && (tau_lower > 0.));
+  if (use_log == _TRUE_) {
+    x_lower = log(tau_lower);
+    x_upper = log(tau_upper);
+    f_lower = log(Q_lower/threshold);
+    f_upper = log(Q_upper/threshold);
+  }
+  else {
+    x_lower = tau_lower;
+    x_upper = tau_upper;
+    f_lower = Q_lower-threshold;
+    f_upper = Q_upper-threshold;
+  }
+
+  side = 0;
+  x_cross = x_lower;
+  for (iteration=0; iteration<_MAX_IT_; iteration++) {
+
+    x_previous = x_cross;
+    x_cross = x_lower - f_lower*(x_upper-x_lower)/(f_upper-f_lower);
+    *tau_cross = (use_log == _TRUE_ ? exp(x_cross) : x_cross);
+
+    if ((fabs(*tau_cross-(use_log == _TRUE_ ? exp(x_previous) : x_previous)) < precision) ||
+        (tau_upper-tau_lower < precision))
+      break;
+
+    class_call(background_at_tau(pba,*tau_cross,pba->normal_info,pba->inter_normal,&(ppw->last_index_back),ppw->pvecback),
+               pba->error_message,
+               error_message);
+    Q_cross = pow(ppw->pvecback[pba->index_bg_a],a_power);
+    if (index_bg >= 0) Q_cross *= ppw->pvecback[index_bg];
+    f_cross = (use_log == _TRUE_ ? log(Q_cross/threshold) : Q_cross-threshold);
+
+    if (f_cross > 0.) {
+      x_upper = x_cross;
+      f_upper = f_cross;
+      tau_upper = *tau_cross;
+      if (side == -1) f_lower /= 2.;
+      side = -1;
+    }
+    else {
+      x_lower = x_cross;
+      f_lower = f_cross;
+      tau_lower = *tau_cross;
+      if (side == 1) f_upper /= 2.;
+      side = 1;
+    }
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * For a given mode and wavenumber, return directly the switching time
+ * of the approximations whose criterion only involves tau*k and a
+ * fixed time computed by the thermodynamics module, which can be
+ * inverted analytically:
+ *
+ * - rsa is switched on at tau = MAX(radiation_streaming_trigger_tau_over_tau_k/k, tau_free_streaming);
+ * - rsa_idr is switched on at tau = MAX(idr_streaming_trigger_tau_over_tau_k/k, tau_idr_free_streaming);
+ * - ufa is switched on at tau = ur_fluid_trigger_tau_over_tau_k/k;
+ * - ncdmfa is switched on at tau = ncdm_fluid_trigger_tau_over_tau_k/k.
+ *
+ * If the result does not fall inside (tau_ini, tau_end), has_switch
+ * is left to _FALSE_ and the caller falls back to bisection.
+ *
+ * @param ppr          Input: pointer to precision structure
+ * @param pba          Input: pointer to background structure
+ * @param pth          Input: pointer to the thermodynamics structure
+ * @param ppt          Input: pointer to the perturbation structure
+ * @param index_md     Input: index of mode under consideration (scalar/.../tensor)
+ * @param k            Input: wavenumber
+ * @param ppw          Input: pointer to perturb_workspace structure containing index values
+ * @param index_ap     Input: index of the approximation under consideration
+ * @param tau_ini      Input: time at which the approximation is known to be off
+ * @param tau_end      Input: time at which the approximation is known to be on
+ * @param tau_switch   Output: switching time
+ * @param has_switch   Output: _TRUE_ if tau_switch was computed
+ * @return the error status
+ */
+
+int perturb_analytic_approximation_switch(
+                                          struct precision * ppr,
+                                          struct background * pba,
+                                          struct thermo * pth,
+                                          struct perturbs * ppt,
+                                          int index_md,
+                                          double k,
+                                          struct perturb_workspace * ppw,
+                                          int index_ap,
+                                          double tau_ini,
+                                          double tau_end,
+                                          double * tau_switch,
+                                          short * has_switch
+                                          ) {
+
+  double tau;
+
+  *has_switch = _FALSE_;
+
+  if (((_scalars_) || (_tensors_)) && (index_ap == ppw->index_ap_rsa))
+    tau = MAX(ppr->radiation_streaming_trigger_tau_over_tau_k/k,pth->tau_free_streaming);
+  else if ((_scalars_) && (pba->has_idr == _TRUE_) && (index_ap == ppw->index_ap_rsa_idr))
+    tau = MAX(ppr->idr_streaming_trigger_tau_over_tau_k/k,pth->tau_idr_free_streaming);
+  else if ((_scalars_) && (pba->has_ur == _TRUE_) && (index_ap == ppw->index_ap_ufa))
+    tau = ppr->ur_fluid_trigger_tau_over_tau_k/k;
+  else if ((_scalars_) && (pba->has_ncdm == _TRUE_) && (index_ap == ppw->index_ap_ncdmfa))
+    tau = ppr->ncdm_fluid_trigger_tau_over_tau_k/k;
+  else
+    return _SUCCESS_;
+
+  if ((tau > tau_ini) && (tau < tau_end)) {
+    *tau_switch = tau;
+    *has_switch = _TRUE_;
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Build the schedule of tight-coupling switching times of a given
+ * mode, before its wavenumbers are evolved: the switch is found by a
+ * full bisection at the nodes of a fixed grid in ln(k), with
+ * ppr->perturb_switch_schedule_per_decade nodes per decade of k
+ * (k = 10^(n/per_decade) Mpc^-1 for integer n), and stored as ln(tau)
+ * against ln(k). perturb_switch_schedule_bracket() interpolates this
+ * schedule to narrow the bisection for all wavenumbers.
+ *
+ * Only the nodes surrounding the k list are computed, but the grid and
+ * the search interval of each node (the whole background table) do
+ * not depend on this list: the switch found for a wavenumber only
+ * depends on the wavenumber itself, like without a schedule.
+ *
+ * Nodes for which tight-coupling is not switched off within the
+ * background table are not included.
+ *
+ * @param ppr          Input: pointer to precision structure
+ * @param pba          Input: pointer to background structure
+ * @param pth          Input: pointer to the thermodynamics structure
+ * @param ppt          Input/Output: pointer to the perturbation structure
+ * @param index_md     Input: index of mode under consideration (scalar/.../tensor)
+ * @param ppw          Input/Output: pointer to perturb_workspace structure, used as a workspace
+ * @return the error status
+ */
+
+int perturb_switch_schedule_init(
+                                 struct precision * ppr,
+                                 struct background * pba,
+                                 struct thermo * pth,
+                                 struct perturbs * ppt,
+                                 int index_md,
+                                 struct perturb_workspace * ppw
+                                 ) {
+
+  int n,n_min,n_max;
+  double step,lnk,k,lower_bound,upper_bound,mid;
+
+  ppt->switch_schedule_size = 0;
+  ppt->switch_schedule_step = 0.;
+  ppt->switch_schedule_lnk = NULL;
+  ppt->switch_schedule_lntau = NULL;
+
+  if ((ppr->perturb_switch_schedule_per_decade <= 0) || (ppt->k_size[index_md] < 1) || ((_scalars_ == _FALSE_) && (_tensors_ == _FALSE_)))
+    return _SUCCESS_;
+
+  /* nodes n_min <= n <= n_max, with the k list strictly below the last one */
+  step = log(10.)/ppr->perturb_switch_schedule_per_decade;
+  n_min = (int)floor(log(ppt->k[index_md][0])/step);
+  n_max = (int)floor(log(ppt->k[index_md][ppt->k_size[index_md]-1])/step)+1;
+
+  class_alloc(ppt->switch_schedule_lnk,(n_max-n_min+1)*sizeof(double),ppt->error_message);
+  class_alloc(ppt->switch_schedule_lntau,(n_max-n_min+1)*sizeof(double),ppt->error_message);
+  ppt->switch_schedule_step = step;
+
+  ppw->inter_mode = pba->inter_normal;
+
+  for (n=n_min; n<=n_max; n++) {
+
+    lnk = n*step;
+    k = exp(lnk);
+
+    lower_bound = pba->tau_table[0];
+    upper_bound = pba->tau_table[pba->bt_size-1];
+
+    /* keep only nodes for which tight-coupling is switched off inside [lower_bound, upper_bound] */
+    class_call(perturb_approximations(ppr,pba,pth,ppt,index_md,k,lower_bound,ppw),
+               ppt->error_message,
+               ppt->error_message);
+    ppw->approx_switch_calls++;
+    ppw->approx_switch_calls_saved--;
+    if (ppw->approx[ppw->index_ap_tca] != (int)tca_on)
+      continue;
+
+    class_call(perturb_approximations(ppr,pba,pth,ppt,index_md,k,upper_bound,ppw),
+               ppt->error_message,
+               ppt->error_message);
+    ppw->approx_switch_calls++;
+    ppw->approx_switch_calls_saved--;
+    if (ppw->approx[ppw->index_ap_tca] != (int)tca_off)
+      continue;
+
+    while (upper_bound - lower_bound > ppr->tol_tau_approx) {
+
+      mid = 0.5*(lower_bound+upper_bound);
+
+      class_call(perturb_approximations(ppr,pba,pth,ppt,index_md,k,mid,ppw),
+                 ppt->error_message,
+                 ppt->error_message);
+      ppw->approx_switch_calls++;
+      ppw->approx_switch_calls_saved--;
+
+      if (ppw->approx[ppw->index_ap_tca] == (int)tca_off)
+        upper_bound = mid;
+      else
+        lower_bound = mid;
+    }
+
+    ppt->switch_schedule_lnk[ppt->switch_schedule_size] = lnk;
+    ppt->switch_schedule_lntau[ppt->switch_schedule_size] = log(0.5*(lower_bound+upper_bound));
+    ppt->switch_schedule_size++;
+  }
+
+  if (ppt->switch_schedule_size < 2) {
+    class_call(perturb_switch_schedule_free(ppt),
+               ppt->error_message,
+               ppt->error_message);
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Free the tight-coupling switch schedule built by
+ * perturb_switch_schedule_init().
+ *
+ * @param ppt Input/Output: pointer to the perturbation structure
+ * @return the error status
+ */
+
+int perturb_switch_schedule_free(
+                                 struct perturbs * ppt
+                                 ) {
+
+  if (ppt->switch_schedule_lnk != NULL)
+    free(ppt->switch_schedule_lnk);
+  if (ppt->switch_schedule_lntau != NULL)
+    free(ppt->switch_schedule_lntau);
+
+  ppt->switch_schedule_size = 0;
+  ppt->switch_schedule_step = 0.;
+  ppt->switch_schedule_lnk = NULL;
+  ppt->switch_schedule_lntau = NULL;
+
+  return _SUCCESS_;
+}
+
+/**
+ * Narrow the bisection bracket of the tight-coupling switch for a
+ * given wavenumber, using the switching time interpolated from the
+ * schedule built by perturb_switch_schedule_init().
+ *
+ * Around the interpolated time tau_s, the times tau_s*(1 -/+ delta)
+ * are tested, starting from delta = ppr->perturb_switch_schedule_bracket
+ * and multiplying delta by 10 until the switch is bracketed. Each test
+ * moves one of the two bounds, which always remain a valid bracket:
+ * nothing is changed if k is not between two consecutive nodes of the
+ * schedule, or if index_ap is not the tight-coupling approximation.
+ *
+ * @param ppr           Input: pointer to precision structure
+ * @param pba           Input: pointer to background structure
+ * @param pth           Input: pointer to the thermodynamics structure
+ * @param ppt           Input: pointer to the perturbation structure
+ * @param index_md      Input: index of mode under consideration (scalar/.../tensor)
+ * @param k             Input: wavenumber
+ * @param ppw           Input/Output: pointer to perturb_workspace structure
+ * @param index_ap      Input: index of the approximation under consideration
+ * @param flag_switched Input: the approximation is switched when its value exceeds this one
+ * @param lower_bound   Input/Output: time before the switch
+ * @param upper_bound   Input/Output: time after the switch
+ * @return the error status
+ */
 
-        if (_scalars_) {
+int perturb_switch_schedule_bracket(
+                                    struct precision * ppr,
+                                    struct background * pba,
+                                    struct thermo * pth,
+                                    struct perturbs * ppt,
+                                    int index_md,
+                                    double k,
+                                    struct perturb_workspace * ppw,
+                                    int index_ap,
+                                    int flag_switched,
+                                    double * lower_bound,
+                                    double * upper_bound
+                                    ) {
 
-          if ((interval_approx[index_switch-1][ppw->index_ap_tca]==(int)tca_on) &&
-              (interval_approx[index_switch][ppw->index_ap_tca]==(int)tca_off))
-            fprintf(stdout,"Mode k=%e: will switch off tight-coupling approximation at tau=%e\n",k,interval_limit[index_switch]);
-          //fprintf(stderr,"Mode k=%e: will switch off tight-coupling approximation at tau=%e\n",k,interval_limit[index_switch]);  //TBC
+  int inf,sup,mid,side;
+  double lnk,tau_s,delta,tau;
 
-          if ((interval_approx[index_switch-1][ppw->index_ap_rsa]==(int)rsa_off) &&
-              (interval_approx[index_switch][ppw->index_ap_rsa]==(int)rsa_on))
-            fprintf(stdout,"Mode k=%e: will switch on radiation streaming approximation at tau=%e\n",k,interval_limit[index_switch]);
+  if ((ppt->switch_schedule_size < 2) || (index_ap != ppw->index_ap_tca))
+    return _SUCCESS_;
 
-          if (pba->has_idr == _TRUE_){
-            if ((interval_approx[index_switch-1][ppw->index_ap_rsa_idr]==(int)rsa_idr_off) &&
-                (interval_approx[index_switch][ppw->index_ap_rsa_idr]==(int)rsa_idr_on))
-              fprintf(stdout,"Mode k=%e: will switch on dark radiation streaming approximation at tau=%e\n",k,interval_limit[index_switch]);
-          }
+  lnk = log(k);
 
-          if (pba->has_idm_dr == _TRUE_){
-            if ((interval_approx[index_switch-1][ppw->index_ap_tca_idm_dr]==(int)tca_idm_dr_on) &&
-                (interval_approx[index_switch][ppw->index_ap_tca_idm_dr]==(int)tca_idm_dr_off))
-              fprintf(stdout,"Mode k=%e: will switch off dark tight-coupling approximation at tau=%e\n",k,interval_limit[index_switch]);
-          }
+  if ((lnk < ppt->switch_schedule_lnk[0]) || (lnk >= ppt->switch_schedule_lnk[ppt->switch_schedule_size-1]))
+    return _SUCCESS_;
 
-          if (pba->has_ur == _TRUE_) {
-            if ((interval_approx[index_switch-1][ppw->index_ap_ufa]==(int)ufa_off) &&
-                (interval_approx[index_switch][ppw->index_ap_ufa]==(int)ufa_on)) {
-              fprintf(stdout,"Mode k=%e: will switch on ur fluid approximation at tau=%e\n",k,interval_limit[index_switch]);
-            }
-          }
-          if (pba->has_ncdm == _TRUE_) {
-            if ((interval_approx[index_switch-1][ppw->index_ap_ncdmfa]==(int)ncdmfa_off) &&
-                (interval_approx[index_switch][ppw->index_ap_ncdmfa]==(int)ncdmfa_on)) {
-              fprintf(stdout,"Mode k=%e: will switch on ncdm fluid approximation at tau=%e\n",k,interval_limit[index_switch]);
-            }
-          }
+  /* interpolate ln(tau) linearly in ln(k) */
+  inf = 0;
+  sup = ppt->switch_schedule_size-1;
+  while (sup-inf > 1) {
+    mid = (inf+sup)/2;
+    if (lnk < ppt->switch_schedule_lnk[mid])
+      sup = mid;
+    else
+      inf = mid;
+  }
 
-          if (pba->has_lrs == _TRUE_) {
-            if ((interval_approx[index_switch-1][ppw->index_ap_lrsfa]==(int)lrsfa_off) &&
-                (interval_approx[index_switch][ppw->index_ap_lrsfa]==(int)lrsfa_on)) {
-              fprintf(stdout,"Mode k=%e: will switch on lrs fluid approximation at tau=%e\n",k,interval_limit[index_switch]); 
-            }
-          
-            if (ppt->has_lrs_phi_pt == _TRUE_) {
-              if ((interval_approx[index_switch-1][ppw->index_ap_lrsad1]==(int)lrsad1_on || interval_approx[index_switch-1][ppw->index_ap_lrsad2]==(int)lrsad2_on) &&
-                  (interval_approx[index_switch][ppw->index_ap_lrsad2]==(int)lrsad2_off && interval_approx[index_switch][ppw->index_ap_lrsad2]==(int)lrsad2_off)) {
-                fprintf(stdout,"Mode k=%e: will switch off lrs adiabatic approximation at tau=%e\n",k,interval_limit[index_switch]);
-              }
-	      if ((interval_approx[index_switch-1][ppw->index_ap_lrsad1]==(int)lrsad1_off && interval_approx[index_switch-1][ppw->index_ap_lrsad2]==(int)lrsad2_off) &&
-                  (interval_approx[index_switch][ppw->index_ap_lrsad1]==(int)lrsad1_on || interval_approx[index_switch][ppw->index_ap_lrsad2]==(int)lrsad2_on)) {
-                fprintf(stdout,"Mode k=%e: will switch on lrs adiabatic approximation at tau=%e\n",k,interval_limit[index_switch]);
-              }
-            }
+  /* only between two consecutive nodes of the grid, so that the result does not depend on the k list */
+  if (ppt->switch_schedule_lnk[sup]-ppt->switch_schedule_lnk[inf] > 1.5*ppt->switch_schedule_step)
+    return _SUCCESS_;
 
-	    if (pba->has_lrs_nuggets == _TRUE_) {
-              if ((interval_approx[index_switch-1][ppw->index_ap_lrsnug]==(int)lrsnug_off) &&
-                  (interval_approx[index_switch][ppw->index_ap_lrsnug]==(int)lrsnug_on)) {
-                fprintf(stdout,"Mode k=%e: will switch on lrs nugget approximation at tau=%e\n",k,interval_limit[index_switch]); 
-              }
-            }
-          }
-        }
+  tau_s = exp(ppt->switch_schedule_lntau[inf]
+              + (ppt->switch_schedule_lntau[sup]-ppt->switch_schedule_lntau[inf])
+              * (lnk-ppt->switch_schedule_lnk[inf])/(ppt->switch_schedule_lnk[sup]-ppt->switch_schedule_lnk[inf]));
 
-        if (_tensors_) {
+  for (delta = ppr->perturb_switch_schedule_bracket; delta < 1.; delta *= 10.) {
 
-          if ((interval_approx[index_switch-1][ppw->index_ap_tca]==(int)tca_on) &&
-              (interval_approx[index_switch][ppw->index_ap_tca]==(int)tca_off))
-            fprintf(stdout,"Mode k=%e: will switch off tight-coupling approximation for tensors at tau=%e\n",k,interval_limit[index_switch]);
+    for (side = -1; side <= 1; side += 2) {
 
-          if ((interval_approx[index_switch-1][ppw->index_ap_rsa]==(int)rsa_off) &&
-              (interval_approx[index_switch][ppw->index_ap_rsa]==(int)rsa_on))
-            fprintf(stdout,"Mode k=%e: will switch on radiation streaming approximation for tensors at tau=%e\n",k,interval_limit[index_switch]);
+      tau = tau_s*(1.+side*delta);
 
-	  // We have *NOT* implemented long-range interactions in tensor perturbations
-        }
-      }
-    }
+      if ((tau > *lower_bound) && (tau < *upper_bound)) {
 
-    free(unsorted_tau_switch);
+        class_call(perturb_approximations(ppr,pba,pth,ppt,index_md,k,tau,ppw),
+                   ppt->error_message,
+                   ppt->error_message);
+        ppw->approx_switch_calls++;
 
-    class_call(perturb_approximations(ppr,
-                                      pba,
-                                      pth,
-                                      ppt,
-                                      index_md,
-                                      k,
-                                      tau_end,
-                                      ppw),
+        if (ppw->approx[index_ap] > flag_switched)
+          *upper_bound = tau;
+        else
+          *lower_bound = tau;
+      }
+    }
 
-               ppt->error_message,
-               ppt->error_message);
+    if ((*lower_bound >= tau_s*(1.-delta)) && (*upper_bound <= tau_s*(1.+delta)))
+      break;
   }
 
   return _SUCCESS_;
@@ -3741,13 +6674,21 @@ int perturb_vector_init(
   int l;
   int n_ncdm,index_q,ncdm_l_size;
   double rho_plus_p_ncdm,rho_plus_p_lrs,q,q2,epsilon,a,factor;
+  int index_ap,lrs_size_old,lrs_size_new;
+  short is_checkpoint;
 
-  /** - allocate a new perturb_vector structure to which ppw-->pv will point at the end of the routine */
+  /** - take the slot of the workspace arena not used by ppw-->pv for
+      the new perturb_vector structure to which ppw-->pv will point at
+      the end of the routine */
 
-  class_alloc(ppv,sizeof(struct perturb_vector),ppt->error_message);
+  if (ppw->pv == &(ppw->vector_arena.vector[0]))
+    ppv = &(ppw->vector_arena.vector[1]);
+  else
+    ppv = &(ppw->vector_arena.vector[0]);
 
-  /** - initialize pointers to NULL (they will be allocated later if
-      needed), relevant for perturb_vector_free() */
+  ppw->vector_arena.requests++;
+
+  /** - initialize pointers to NULL (they will be set later if needed) */
   ppv->l_max_ncdm = NULL;
   ppv->q_size_ncdm = NULL;
 
@@ -3896,8 +6837,9 @@ int perturb_vector_init(
     if (pba->has_ncdm == _TRUE_) {
       ppv->index_pt_psi0_ncdm1 = index_pt; /* density of ultra-relativistic neutrinos/relics */
       ppv->N_ncdm = pba->N_ncdm;
-      class_alloc(ppv->l_max_ncdm,ppv->N_ncdm*sizeof(double),ppt->error_message);
-      class_alloc(ppv->q_size_ncdm,ppv->N_ncdm*sizeof(double),ppt->error_message);
+      class_call(perturb_vector_arena_reserve(ppt,ppw,ppv,0,ppv->N_ncdm),
+                 ppt->error_message,
+                 ppt->error_message);
 
       for(n_ncdm = 0; n_ncdm < pba->N_ncdm; n_ncdm++){
         // Set value of ppv->l_max_ncdm:
@@ -3937,14 +6879,24 @@ int perturb_vector_init(
 	// In the nugget approximation, hierarchy is cut at lmax = 1 and q dependence is integrated out
 	ppv->l_max_lrs = 1;
 	ppv->q_size_lrs = 1;
+	// As an offset to CDM, only the density contrast remains
+	if (ppw->lrs_nugget_cdm_offset == _TRUE_)
+	  ppv->l_max_lrs = 0;
       } else if(ppw->approx[ppw->index_ap_lrsfa] == (int)lrsfa_off){
         /* reject inconsistent values of the number of mutipoles in ultra relativistic fermion hierarchy */
         class_test(ppr->l_max_lrs < 4,
                    ppt->error_message,
                    "ppr->l_max_lrs should be at least 4, i.e. we must integrate at least over first four momenta of lrs perturbed phase-space distribution");
-        //Copy value from precision parameter:
+        //Copy value from precision parameter, or adapt it to the amplitude of the current hierarchy:
         ppv->l_max_lrs = ppr->l_max_lrs;
         ppv->q_size_lrs = pba->q_size_lrs;
+        if (pa_old != NULL) {
+          class_call(perturb_lrs_l_max(ppr,pba,ppw->pv,&(ppv->l_max_lrs)),
+                     ppt->error_message,
+                     ppt->error_message);
+          if ((ppt->perturbations_verbose>2) && (ppv->l_max_lrs != ppw->pv->l_max_lrs) && (ppw->pv->q_size_lrs == ppv->q_size_lrs))
+            fprintf(stdout,"Mode k=%e: lrs hierarchy resized from l_max=%d to %d at tau=%e\n",k,ppw->pv->l_max_lrs,ppv->l_max_lrs,tau);
+        }
       }
       else{
         // In the fluid approximation, hierarchy is cut at lmax = 2 and q dependence is integrated out:
@@ -4045,8 +6997,9 @@ int perturb_vector_init(
     if (ppt->evolve_tensor_ncdm == _TRUE_) {
       ppv->index_pt_psi0_ncdm1 = index_pt;
       ppv->N_ncdm = pba->N_ncdm;
-      class_alloc(ppv->l_max_ncdm,ppv->N_ncdm*sizeof(double),ppt->error_message);
-      class_alloc(ppv->q_size_ncdm,ppv->N_ncdm*sizeof(double),ppt->error_message);
+      class_call(perturb_vector_arena_reserve(ppt,ppw,ppv,0,ppv->N_ncdm),
+                 ppt->error_message,
+                 ppt->error_message);
 
       for(n_ncdm = 0; n_ncdm < pba->N_ncdm; n_ncdm++){
         // Set value of ppv->l_max_ncdm:
@@ -4090,9 +7043,9 @@ int perturb_vector_init(
   /** - allocate vectors for storing the values of all these
       quantities and their time-derivatives at a given time */
 
-  class_calloc(ppv->y,ppv->pt_size,sizeof(double),ppt->error_message);
-  class_alloc(ppv->dy,ppv->pt_size*sizeof(double),ppt->error_message);
-  class_alloc(ppv->used_in_sources,ppv->pt_size*sizeof(int),ppt->error_message);
+  class_call(perturb_vector_arena_reserve(ppt,ppw,ppv,ppv->pt_size,0),
+             ppt->error_message,
+             ppt->error_message);
 
   /** - specify which perturbations are needed in the evaluation of source terms */
 
@@ -4320,6 +7273,36 @@ int perturb_vector_init(
 
     if (_scalars_) {
 
+      /** - ---> (a.0.) at a checkpoint of the dynamical lrs truncation,
+          the approximation scheme is unchanged, and only the size of
+          the lrs hierarchy may differ: copy everything else index by
+          index, with an offset after the lrs hierarchy. */
+
+      is_checkpoint = _TRUE_;
+      for (index_ap=0; index_ap<ppw->ap_size; index_ap++)
+        if (pa_old[index_ap] != ppw->approx[index_ap])
+          is_checkpoint = _FALSE_;
+
+      if (is_checkpoint == _TRUE_) {
+
+        class_test(pba->has_lrs == _FALSE_,
+                   ppt->error_message,
+                   "at tau=%g: perturbation vector redefined without any approximation switch",tau);
+
+        lrs_size_old = (ppw->pv->l_max_lrs+1)*ppw->pv->q_size_lrs;
+        lrs_size_new = (ppv->l_max_lrs+1)*ppv->q_size_lrs;
+
+        for (index_pt=0; index_pt<ppw->pv->index_pt_psi0_lrs; index_pt++)
+          ppv->y[index_pt] = ppw->pv->y[index_pt];
+
+        class_call(perturb_lrs_copy_hierarchy(ppw->pv,ppv),
+                   ppt->error_message,
+                   ppt->error_message);
+
+        for (index_pt=ppw->pv->index_pt_psi0_lrs+lrs_size_old; index_pt<ppw->pv->pt_size; index_pt++)
+          ppv->y[index_pt+lrs_size_new-lrs_size_old] = ppw->pv->y[index_pt];
+      }
+
       /** - ---> (a.1.) check that the change of approximation scheme makes
           sense (note: before calling this routine there is already a
           check that we wish to change only one approximation flag at
@@ -4508,15 +7491,11 @@ int perturb_vector_init(
         }
         
         if (pba->has_lrs == _TRUE_) {
-          index_pt = 0;
-          for(index_q=0; index_q < ppv->q_size_lrs; index_q++){
-            for(l=0; l<=ppv->l_max_lrs;l++){
-              // This is correct with or without lrsfa/lrsnug, since ppv->lmax_lrs is set accordingly.
-              ppv->y[ppv->index_pt_psi0_lrs+index_pt] =
-                ppw->pv->y[ppw->pv->index_pt_psi0_lrs+index_pt];
-              index_pt++;
-            }
-          }
+          /* This is correct with or without lrsfa/lrsnug, and with a dynamical lrs
+             truncation, since ppv->l_max_lrs and ppv->q_size_lrs are updated. */
+          class_call(perturb_lrs_copy_hierarchy(ppw->pv,ppv),
+                     ppt->error_message,
+                     ppt->error_message);
 
           if (ppt->has_lrs_phi_pt == _TRUE_) 
             if(ppw->approx[ppw->index_ap_lrsad1] == (int)lrsad1_off && ppw->approx[ppw->index_ap_lrsad2] == (int)lrsad2_off
@@ -4596,14 +7575,11 @@ int perturb_vector_init(
         }
 
         if (pba->has_lrs == _TRUE_) {
-          index_pt = 0;
-          for(index_q=0; index_q < ppv->q_size_lrs; index_q++){
-            for(l=0; l<=ppv->l_max_lrs; l++){
-              ppv->y[ppv->index_pt_psi0_lrs+index_pt] =
-                ppw->pv->y[ppw->pv->index_pt_psi0_lrs+index_pt];
-              index_pt++;
-            }
-          }
+          /* This is correct with or without lrsfa/lrsnug, and with a dynamical lrs
+             truncation, since ppv->l_max_lrs and ppv->q_size_lrs are updated. */
+          class_call(perturb_lrs_copy_hierarchy(ppw->pv,ppv),
+                     ppt->error_message,
+                     ppt->error_message);
 
           if (ppt->has_lrs_phi_pt == _TRUE_) 
           if(ppw->approx[ppw->index_ap_lrsad1] == (int)lrsad1_off && ppw->approx[ppw->index_ap_lrsad2] == (int)lrsad2_off
@@ -4724,16 +7700,11 @@ int perturb_vector_init(
           }
 
           if (pba->has_lrs == _TRUE_) {
-            index_pt = 0;
-            for(index_q=0; index_q < ppv->q_size_lrs; index_q++){
-              for(l=0; l<=ppv->l_max_lrs; l++){
-                /* This is correct with or without lrsfa/lrsnug, since ppv->l_max_lrs and
-                   ppv->q_size_lrs is updated.*/
-                ppv->y[ppv->index_pt_psi0_lrs+index_pt] =
-                  ppw->pv->y[ppw->pv->index_pt_psi0_lrs+index_pt];
-                index_pt++;
-              }
-            }
+            /* This is correct with or without lrsfa/lrsnug, and with a dynamical lrs
+               truncation, since ppv->l_max_lrs and ppv->q_size_lrs are updated. */
+            class_call(perturb_lrs_copy_hierarchy(ppw->pv,ppv),
+                       ppt->error_message,
+                       ppt->error_message);
 
             if (ppt->has_lrs_phi_pt == _TRUE_)
             if(ppw->approx[ppw->index_ap_lrsad1] == (int)lrsad1_off && ppw->approx[ppw->index_ap_lrsad2] == (int)lrsad2_off
@@ -4838,16 +7809,11 @@ int perturb_vector_init(
           }
 
           if (pba->has_lrs == _TRUE_) {
-            index_pt = 0;
-            for(index_q=0; index_q < ppv->q_size_lrs; index_q++){
-              for(l=0; l<=ppv->l_max_lrs; l++){
-                /* This is correct with or without lrsfa/lrsnug, since ppv->l_max_lrs and
-                   ppv->q_size_lrs is updated.*/
-                ppv->y[ppv->index_pt_psi0_lrs+index_pt] =
-                  ppw->pv->y[ppw->pv->index_pt_psi0_lrs+index_pt];
-                index_pt++;
-              }
-            }
+            /* This is correct with or without lrsfa/lrsnug, and with a dynamical lrs
+               truncation, since ppv->l_max_lrs and ppv->q_size_lrs are updated. */
+            class_call(perturb_lrs_copy_hierarchy(ppw->pv,ppv),
+                       ppt->error_message,
+                       ppt->error_message);
 
             if (ppt->has_lrs_phi_pt == _TRUE_)
             if(ppw->approx[ppw->index_ap_lrsad1] == (int)lrsad1_off && ppw->approx[ppw->index_ap_lrsad2] == (int)lrsad2_off
@@ -4969,16 +7935,11 @@ int perturb_vector_init(
           }
 
           if (pba->has_lrs == _TRUE_) {
-            index_pt = 0;
-            for(index_q=0; index_q < ppv->q_size_lrs; index_q++){
-              for(l=0; l<=ppv->l_max_lrs; l++){
-                /* This is correct with or without lrsfa/lrsnug, since ppv->l_max_lrs and
-                   ppv->q_size_lrs is updated.*/
-                ppv->y[ppv->index_pt_psi0_lrs+index_pt] =
-                  ppw->pv->y[ppw->pv->index_pt_psi0_lrs+index_pt];
-                index_pt++;
-              }
-            }
+            /* This is correct with or without lrsfa/lrsnug, and with a dynamical lrs
+               truncation, since ppv->l_max_lrs and ppv->q_size_lrs are updated. */
+            class_call(perturb_lrs_copy_hierarchy(ppw->pv,ppv),
+                       ppt->error_message,
+                       ppt->error_message);
 
             if (ppt->has_lrs_phi_pt == _TRUE_)
             if(ppw->approx[ppw->index_ap_lrsad1] == (int)lrsad1_off && ppw->approx[ppw->index_ap_lrsad2] == (int)lrsad2_off
@@ -5136,16 +8097,11 @@ int perturb_vector_init(
           }
         
           if (pba->has_lrs == _TRUE_) {
-            index_pt = 0;
-            for(index_q=0; index_q < ppv->q_size_lrs; index_q++){
-              for(l=0; l<=ppv->l_max_lrs; l++){
-                /* This is correct with or without lrsfa/lrsnug, since ppv->l_max_lrs and
-                   ppv->q_size_lrs is updated.*/
-                ppv->y[ppv->index_pt_psi0_lrs+index_pt] =
-                  ppw->pv->y[ppw->pv->index_pt_psi0_lrs+index_pt];
-                index_pt++;
-              }
-            }
+            /* This is correct with or without lrsfa/lrsnug, and with a dynamical lrs
+               truncation, since ppv->l_max_lrs and ppv->q_size_lrs are updated. */
+            class_call(perturb_lrs_copy_hierarchy(ppw->pv,ppv),
+                       ppt->error_message,
+                       ppt->error_message);
 
             if (ppt->has_lrs_phi_pt == _TRUE_)
             if(ppw->approx[ppw->index_ap_lrsad1] == (int)lrsad1_off && ppw->approx[ppw->index_ap_lrsad2] == (int)lrsad2_off
@@ -5305,16 +8261,19 @@ int perturb_vector_init(
 	    else
 	      delta_phi_M = ppw->delta_phi_M_lrsad; // (see L4432)
 	  }
-	  double T_F = pba->T_cmb*pba->lrs_T_F/(a/pba->a_today)*_k_B_/_eV_; // [eV]
-		
+	  double T_F = pba->lrs_T0_F*pba->a_today/a; // [eV]
+
+          class_call(perturb_lrs_momentum_cache(pba,ppw),
+                     ppt->error_message,
+                     ppt->error_message);
+
           for(index_q=0; index_q < ppw->pv->q_size_lrs; index_q++){
             // Integrate over distributions:
             q = pba->q_lrs[index_q];
             q2 = q*q;
-            epsilon = sqrt(q2+a*a*ppw->pvecback[pba->index_bg_mT_over_T0_lrs]*ppw->pvecback[pba->index_bg_mT_over_T0_lrs]);
             ppv->y[ppv->index_pt_psi0_lrs] +=
-              pba->w_lrs[index_q]*q2*epsilon* (ppw->pv->y[index_pt]
-					       + a/pba->a_today * ppw->pvecback[pba->index_bg_mT_over_T0_lrs] / SQR(epsilon) * pba->lrs_g_over_M * delta_phi_M / T_F);
+              ppw->lrs_w_q2_epsilon[index_q]* (ppw->pv->y[index_pt]
+					       + ppw->lrs_mT_over_epsilon2[index_q] * pba->lrs_g_over_M * delta_phi_M / T_F);
 	    // The extra term is dimensionless, so we are safe
 
             ppv->y[ppv->index_pt_psi0_lrs+1] +=
@@ -5322,7 +8281,7 @@ int perturb_vector_init(
               ppw->pv->y[index_pt+1];
             
             ppv->y[ppv->index_pt_psi0_lrs+2] +=
-              pba->w_lrs[index_q]*q2*q2/epsilon*
+              ppw->lrs_w_q4_over_epsilon[index_q]*
               ppw->pv->y[index_pt+2];
             
             //Jump to next momentum bin in ppw->pv->y:
@@ -5456,16 +8415,11 @@ int perturb_vector_init(
 	      }
 	    }
           
-	    index_pt = 0;
-	    for(index_q=0; index_q < ppv->q_size_lrs; index_q++){
-	      for(l=0; l<=ppv->l_max_lrs; l++){
-		/* This is correct even with or without lrsfa/lrsnug, since ppv->l_max_lrs and
-		   ppv->q_size_lrs is updated.*/
-		ppv->y[ppv->index_pt_psi0_lrs+index_pt] =
-		  ppw->pv->y[ppw->pv->index_pt_psi0_lrs+index_pt];
-		index_pt++;
-	      }
-	    }
+            /* This is correct with or without lrsfa/lrsnug, and with a dynamical lrs
+               truncation, since ppv->l_max_lrs and ppv->q_size_lrs are updated. */
+            class_call(perturb_lrs_copy_hierarchy(ppw->pv,ppv),
+                       ppt->error_message,
+                       ppt->error_message);
 	  }
 	}
 
@@ -5592,16 +8546,11 @@ int perturb_vector_init(
 	      }
 	    }
           
-	    index_pt = 0;
-	    for(index_q=0; index_q < ppv->q_size_lrs; index_q++){
-	      for(l=0; l<=ppv->l_max_lrs; l++){
-		/* This is correct even with or without lrsfa/lrsnug, since ppv->l_max_lrs and
-		   ppv->q_size_lrs is updated.*/
-		ppv->y[ppv->index_pt_psi0_lrs+index_pt] =
-		  ppw->pv->y[ppw->pv->index_pt_psi0_lrs+index_pt];
-		index_pt++;
-	      }
-	    }
+            /* This is correct with or without lrsfa/lrsnug, and with a dynamical lrs
+               truncation, since ppv->l_max_lrs and ppv->q_size_lrs are updated. */
+            class_call(perturb_lrs_copy_hierarchy(ppw->pv,ppv),
+                       ppt->error_message,
+                       ppt->error_message);
           
 	    ppv->y[ppv->index_pt_phi_M_lrs] = ppw->delta_phi_M_lrsad; // (see L4432)
 	    ppv->y[ppv->index_pt_phi_M_prime_lrs] = 0; // (see L4432)
@@ -5746,16 +8695,11 @@ int perturb_vector_init(
 	      }
 	    }
           
-	    index_pt = 0;
-	    for(index_q=0; index_q < ppv->q_size_lrs; index_q++){
-	      for(l=0; l<=ppv->l_max_lrs; l++){
-		/* This is correct even with or without lrsfa/lrsnug, since ppv->l_max_lrs and
-		   ppv->q_size_lrs is updated.*/
-		ppv->y[ppv->index_pt_psi0_lrs+index_pt] =
-		  ppw->pv->y[ppw->pv->index_pt_psi0_lrs+index_pt];
-		index_pt++;
-	      }
-	    }
+            /* This is correct with or without lrsfa/lrsnug, and with a dynamical lrs
+               truncation, since ppv->l_max_lrs and ppv->q_size_lrs are updated. */
+            class_call(perturb_lrs_copy_hierarchy(ppw->pv,ppv),
+                       ppt->error_message,
+                       ppt->error_message);
           
 	}
 
@@ -5880,13 +8824,13 @@ int perturb_vector_init(
 	    }
 	  }
 
+	  /* density and momentum perturbations of the nuggets, continuous at nugget formation */
+	  double rho_delta_nug=0., rho_plus_p_theta_nug=0.;
+	  a = ppw->pvecback[pba->index_bg_a];
+
 	  if(ppw->approx[ppw->index_ap_lrsfa] == (int)lrsfa_off){
-	    a = ppw->pvecback[pba->index_bg_a];
 	    index_pt = ppw->pv->index_pt_psi0_lrs;
           
-	    for(l=0; l<=1; l++){
-	      ppv->y[ppv->index_pt_psi0_lrs+l] = 0.0;
-	    }	  
 	    factor = pba->factor_lrs*pow(pba->a_today/a,4);
 	    double delta_phi_M=0; // [eV]^2
 	    if (ppt->has_lrs_phi_pt == _TRUE_){
@@ -5895,32 +8839,51 @@ int perturb_vector_init(
 	      else
 		delta_phi_M = ppw->delta_phi_M_lrsad; // (see L4432)
 	    }
-	    double T_F = pba->T_cmb*pba->lrs_T_F/(a/pba->a_today)*_k_B_/_eV_; // [eV]
-		
+	    double T_F = pba->lrs_T0_F*pba->a_today/a; // [eV]
+
+	    class_call(perturb_lrs_momentum_cache(pba,ppw),
+		       ppt->error_message,
+		       ppt->error_message);
+
 	    for(index_q=0; index_q < ppw->pv->q_size_lrs; index_q++){
 	      // Integrate over distributions:
 	      q = pba->q_lrs[index_q];
 	      q2 = q*q;
-	      epsilon = sqrt(q2+a*a*ppw->pvecback[pba->index_bg_mT_over_T0_lrs]*ppw->pvecback[pba->index_bg_mT_over_T0_lrs]);
-	      ppv->y[ppv->index_pt_psi0_lrs] +=
-		pba->w_lrs[index_q]*q2*epsilon* (ppw->pv->y[index_pt]
-						 + a/pba->a_today * ppw->pvecback[pba->index_bg_mT_over_T0_lrs] / SQR(epsilon) * pba->lrs_g_over_M * delta_phi_M / T_F);
+	      rho_delta_nug +=
+		ppw->lrs_w_q2_epsilon[index_q]* (ppw->pv->y[index_pt]
+						 + ppw->lrs_mT_over_epsilon2[index_q] * pba->lrs_g_over_M * delta_phi_M / T_F);
 	      // The extra term is dimensionless, so we are safe
 
-	      ppv->y[ppv->index_pt_psi0_lrs+1] +=
+	      rho_plus_p_theta_nug +=
 		pba->w_lrs[index_q]*q2*q*
 		ppw->pv->y[index_pt+1];
             
 	      //Jump to next momentum bin in ppw->pv->y:
 	      index_pt += (ppw->pv->l_max_lrs+1);
 	    }
-	    ppv->y[ppv->index_pt_psi0_lrs] *=factor; // For nuggets we store delta_rho, not delta_rho/rho. This ensures the continuity of the stress-energy tensor
-	    ppv->y[ppv->index_pt_psi0_lrs+1] *=k*factor; // For nuggets we store (rho+p)*theta, not theta. This ensures the continuity of the stress-energy tensor
+	    rho_delta_nug *=factor;
+	    rho_plus_p_theta_nug *=k*factor;
           } else{
-	    ppv->y[ppv->index_pt_psi0_lrs + 0] =
-		  ppw->pv->y[ppw->pv->index_pt_psi0_lrs + 0] * ppw->pvecback[pba->index_bg_rho_lrs_F]; // For nuggets we store delta_rho, not delta_rho/rho. This ensures the continuity of the stress-energy tensor 
-	    ppv->y[ppv->index_pt_psi0_lrs + 1] =
-	      ppw->pv->y[ppw->pv->index_pt_psi0_lrs + 1] * (ppw->pvecback[pba->index_bg_rho_lrs_F] + ppw->pvecback[pba->index_bg_p_lrs_F]); // For nuggets we store (rho+p)*theta, not theta.  This ensures the continuity of the stress-energy tensor
+	    rho_delta_nug =
+	      ppw->pv->y[ppw->pv->index_pt_psi0_lrs + 0] * ppw->pvecback[pba->index_bg_rho_lrs_F];
+	    rho_plus_p_theta_nug =
+	      ppw->pv->y[ppw->pv->index_pt_psi0_lrs + 1] * (ppw->pvecback[pba->index_bg_rho_lrs_F] + ppw->pvecback[pba->index_bg_p_lrs_F]);
+	  }
+
+	  if (ppw->lrs_nugget_cdm_offset == _TRUE_) {
+	    /* Offsets of the density contrast and velocity divergence
+	       to the CDM ones. The density of the nuggets redshifts as
+	       dust from their formation on */
+	    double rho_nug = pba->lrs_rho_unstable / CUB(a/pba->a_today/pba->lrs_a_unstable);
+	    double theta_cdm = 0.;
+	    if (ppt->gauge == newtonian)
+	      theta_cdm = ppw->pv->y[ppw->pv->index_pt_theta_cdm];
+	    ppv->y[ppv->index_pt_psi0_lrs] = rho_delta_nug/rho_nug - ppw->pv->y[ppw->pv->index_pt_delta_cdm];
+	    ppw->lrs_nugget_theta_offset_a = (rho_plus_p_theta_nug/rho_nug - theta_cdm) * a/pba->a_today;
+	  }
+	  else {
+	    ppv->y[ppv->index_pt_psi0_lrs] = rho_delta_nug; // For nuggets we store delta_rho, not delta_rho/rho. This ensures the continuity of the stress-energy tensor
+	    ppv->y[ppv->index_pt_psi0_lrs+1] = rho_plus_p_theta_nug; // For nuggets we store (rho+p)*theta, not theta. This ensures the continuity of the stress-energy tensor
 	  }
 	}
       }      
@@ -6055,15 +9018,11 @@ int perturb_vector_init(
 
       if (ppt->evolve_tensor_lrs == _TRUE_){
         // We have *NOT* implemented long-range interactions in tensor perturbations
-        index_pt = 0;
-        for(index_q=0; index_q < ppv->q_size_lrs; index_q++){
-          for(l=0; l<=ppv->l_max_lrs;l++){
-            // This is correct with or without lrsfa/lrsnug, since ppv->lmax_lrs is set accordingly.
-            ppv->y[ppv->index_pt_psi0_lrs+index_pt] =
-              ppw->pv->y[ppw->pv->index_pt_psi0_lrs+index_pt];
-            index_pt++;
-          }
-        }
+        /* This is correct with or without lrsfa/lrsnug, and with a dynamical lrs
+           truncation, since ppv->l_max_lrs and ppv->q_size_lrs are updated. */
+        class_call(perturb_lrs_copy_hierarchy(ppw->pv,ppv),
+                   ppt->error_message,
+                   ppt->error_message);
       }
 
       /* -- case of switching off tight coupling
@@ -6094,7 +9053,7 @@ int perturb_vector_init(
 
     /** - --> (d) free the previous vector of perturbations */
 
-    class_call(perturb_vector_free(ppw->pv),
+    class_call(perturb_vector_free(ppw,ppw->pv),
                ppt->error_message,
                ppt->error_message);
 
@@ -6103,28 +9062,289 @@ int perturb_vector_init(
 
     ppw->pv = ppv;
 
-  }
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Copy the lrs hierarchy from one perturbation vector to another,
+ * with the same number of momentum bins but possibly a different
+ * l_max_lrs. Multipoles above the old l_max_lrs are set to zero, and
+ * those above the new one are dropped.
+ *
+ * @param pv_old Input: vector of perturbations before the switch
+ * @param pv_new Input/Output: vector of perturbations after the switch
+ * @return the error status
+ */
+
+int perturb_lrs_copy_hierarchy(
+                               struct perturb_vector * pv_old,
+                               struct perturb_vector * pv_new
+                               ) {
+
+  int index_q,l;
+  double * y_old;
+  double * y_new;
+
+  for (index_q=0; index_q < pv_new->q_size_lrs; index_q++) {
+
+    y_old = pv_old->y+pv_old->index_pt_psi0_lrs+index_q*(pv_old->l_max_lrs+1);
+    y_new = pv_new->y+pv_new->index_pt_psi0_lrs+index_q*(pv_new->l_max_lrs+1);
+
+    for (l=0; l<=pv_new->l_max_lrs; l++)
+      y_new[l] = (l <= pv_old->l_max_lrs) ? y_old[l] : 0.;
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Choose the truncation of the lrs hierarchy for a new perturbation
+ * vector, according to the amplitude of the multipoles in the current
+ * one (dynamical truncation, if ppr->lrs_l_max_truncation_tol > 0).
+ *
+ * Multipole l is considered significant if, in at least one momentum
+ * bin, \f$ |\psi_l| \f$ exceeds lrs_l_max_truncation_tol times the
+ * largest of \f$ |\psi_0|, |\psi_1|, |\psi_2| \f$ in that bin. The
+ * hierarchy is cut one multipole above the last significant one (but
+ * not below l=4). If the current truncation multipole is itself
+ * significant, the full hierarchy ppr->l_max_lrs is restored.
+ *
+ * @param ppr    Input: pointer to precision structure
+ * @param pba    Input: pointer to background structure
+ * @param pv_old Input: current vector of perturbations
+ * @param l_max  Input/Output: in input, ppr->l_max_lrs; in output, truncation of the new hierarchy
+ * @return the error status
+ */
+
+int perturb_lrs_l_max(
+                      struct precision * ppr,
+                      struct background * pba,
+                      struct perturb_vector * pv_old,
+                      int * l_max
+                      ) {
+
+  int index_q,l,l_significant;
+  double * psi;
+  double norm;
+
+  /** - only the full hierarchy of the previous vector can be used */
+  if ((ppr->lrs_l_max_truncation_tol <= 0.) ||
+      (pv_old->q_size_lrs != pba->q_size_lrs) ||
+      (pv_old->l_max_lrs < 3))
+    return _SUCCESS_;
+
+  l_significant = 2;
+
+  for (index_q=0; index_q < pv_old->q_size_lrs; index_q++) {
+
+    psi = pv_old->y+pv_old->index_pt_psi0_lrs+index_q*(pv_old->l_max_lrs+1);
+    norm = MAX(fabs(psi[0]),MAX(fabs(psi[1]),fabs(psi[2])));
+
+    for (l=pv_old->l_max_lrs; l>l_significant; l--) {
+      if (fabs(psi[l]) > ppr->lrs_l_max_truncation_tol*norm) {
+        l_significant = l;
+        break;
+      }
+    }
+  }
+
+  if (l_significant == pv_old->l_max_lrs)
+    *l_max = ppr->l_max_lrs;
+  else
+    *l_max = MIN(ppr->l_max_lrs,MAX(4,l_significant+1));
+
+  return _SUCCESS_;
+}
+
+/**
+ * For the dynamical truncation of the lrs hierarchy, split the
+ * intervals in which the full lrs hierarchy is integrated at
+ * checkpoints equally spaced in ln(tau), with spacing
+ * ppr->lrs_l_max_checkpoint_dlntau. At each checkpoint
+ * perturb_vector_init() is called with an unchanged approximation
+ * scheme, and can resize the hierarchy.
+ *
+ * @param ppr             Input: pointer to precision structure
+ * @param pba             Input: pointer to background structure
+ * @param ppt             Input: pointer to the perturbation structure
+ * @param index_md        Input: index of mode under consideration (scalar/.../tensor)
+ * @param ppw             Input: pointer to perturb_workspace structure containing index values and workspaces
+ * @param interval_number Input/Output: total number of intervals
+ * @param interval_limit  Input/Output: boundaries of the intervals (reallocated)
+ * @param interval_approx Input/Output: approximations in each interval (reallocated)
+ * @return the error status
+ */
+
+int perturb_lrs_truncation_checkpoints(
+                                       struct precision * ppr,
+                                       struct background * pba,
+                                       struct perturbs * ppt,
+                                       int index_md,
+                                       struct perturb_workspace * ppw,
+                                       int * interval_number,
+                                       double ** interval_limit,
+                                       int *** interval_approx
+                                       ) {
+
+  int index_interval,index_new,index_ap,new_number;
+  double tau_checkpoint,factor;
+  double * new_limit;
+  int ** new_approx;
+  short full_hierarchy;
+
+  if ((_scalars_ == _FALSE_) ||
+      (pba->has_lrs == _FALSE_) ||
+      (ppr->lrs_l_max_truncation_tol <= 0.) ||
+      (ppr->lrs_l_max_checkpoint_dlntau <= 0.))
+    return _SUCCESS_;
+
+  factor = exp(ppr->lrs_l_max_checkpoint_dlntau);
+
+  /** - count the new intervals (the last checkpoint of an interval is
+      at least half a spacing away from its end) */
+  new_number = 0;
+  for (index_interval=0; index_interval<*interval_number; index_interval++) {
+    new_number++;
+    full_hierarchy = (((*interval_approx)[index_interval][ppw->index_ap_lrsfa] == (int)lrsfa_off) &&
+                      ((pba->has_lrs_nuggets == _FALSE_) ||
+                       ((*interval_approx)[index_interval][ppw->index_ap_lrsnug] == (int)lrsnug_off)));
+    if ((full_hierarchy == _TRUE_) && ((*interval_limit)[index_interval] > 0.)) {
+      for (tau_checkpoint = (*interval_limit)[index_interval]*factor;
+           tau_checkpoint*sqrt(factor) < (*interval_limit)[index_interval+1];
+           tau_checkpoint *= factor)
+        new_number++;
+    }
+  }
+
+  if (new_number == *interval_number)
+    return _SUCCESS_;
+
+  /** - fill the new arrays */
+  class_alloc(new_limit,(new_number+1)*sizeof(double),ppt->error_message);
+  class_alloc(new_approx,new_number*sizeof(int*),ppt->error_message);
+
+  index_new = 0;
+  for (index_interval=0; index_interval<*interval_number; index_interval++) {
+
+    full_hierarchy = (((*interval_approx)[index_interval][ppw->index_ap_lrsfa] == (int)lrsfa_off) &&
+                      ((pba->has_lrs_nuggets == _FALSE_) ||
+                       ((*interval_approx)[index_interval][ppw->index_ap_lrsnug] == (int)lrsnug_off)));
+
+    tau_checkpoint = (*interval_limit)[index_interval];
+
+    do {
+      new_limit[index_new] = tau_checkpoint;
+      class_alloc(new_approx[index_new],ppw->ap_size*sizeof(int),ppt->error_message);
+      for (index_ap=0; index_ap<ppw->ap_size; index_ap++)
+        new_approx[index_new][index_ap] = (*interval_approx)[index_interval][index_ap];
+      index_new++;
+      tau_checkpoint *= factor;
+    } while ((full_hierarchy == _TRUE_) && (tau_checkpoint > 0.) &&
+             (tau_checkpoint*sqrt(factor) < (*interval_limit)[index_interval+1]));
+
+    free((*interval_approx)[index_interval]);
+  }
+  new_limit[new_number] = (*interval_limit)[*interval_number];
+
+  class_test(index_new != new_number,
+             ppt->error_message,
+             "bug in the lrs truncation checkpoints: %d intervals instead of %d",index_new,new_number);
+
+  free(*interval_limit);
+  free(*interval_approx);
+
+  *interval_number = new_number;
+  *interval_limit = new_limit;
+  *interval_approx = new_approx;
 
   return _SUCCESS_;
 }
 
 /**
- * Free the perturb_vector structure.
+ * Free the perturb_vector structure: its memory belongs to the arena
+ * of the workspace, and is kept for the next vectors (it is freed in
+ * perturb_workspace_free()); ppw-->pv is reset if it pointed to it.
  *
+ * @param ppw       Input/Output: pointer to the workspace owning the vector
  * @param pv        Input: pointer to perturb_vector structure to be freed
  * @return the error status
  */
 
 int perturb_vector_free(
+                        struct perturb_workspace * ppw,
                         struct perturb_vector * pv
                         ) {
 
-  if (pv->l_max_ncdm != NULL) free(pv->l_max_ncdm);
-  if (pv->q_size_ncdm != NULL) free(pv->q_size_ncdm);
-  free(pv->y);
-  free(pv->dy);
-  free(pv->used_in_sources);
-  free(pv);
+  if (ppw->pv == pv)
+    ppw->pv = NULL;
+
+  return _SUCCESS_;
+}
+
+/**
+ * Point the arrays of a perturb_vector structure, one of the slots of
+ * the arena of the workspace, to the storage of this slot, which is
+ * enlarged if needed. The vector y is set to zero.
+ *
+ * @param ppt       Input: pointer to the perturbation structure
+ * @param ppw       Input/Output: workspace containing the arena
+ * @param pv        Input/Output: slot of the arena
+ * @param pt_size   Input: size of y, dy and used_in_sources (not set if 0)
+ * @param ncdm_size Input: size of l_max_ncdm and q_size_ncdm (not set if 0)
+ * @return the error status
+ */
+
+int perturb_vector_arena_reserve(
+                                 struct perturbs * ppt,
+                                 struct perturb_workspace * ppw,
+                                 struct perturb_vector * pv,
+                                 int pt_size,
+                                 int ncdm_size
+                                 ) {
+
+  struct perturb_vector_arena * parena = &(ppw->vector_arena);
+  int slot = (int)(pv - parena->vector);
+
+  class_test((slot < 0) || (slot > 1),
+             ppt->error_message,
+             "the perturbation vector is not a slot of the workspace arena");
+
+  if (pt_size > 0) {
+
+    if (pt_size > parena->pt_capacity[slot]) {
+      free(parena->y[slot]);
+      free(parena->dy[slot]);
+      free(parena->used_in_sources[slot]);
+      class_alloc(parena->y[slot],pt_size*sizeof(double),ppt->error_message);
+      class_alloc(parena->dy[slot],pt_size*sizeof(double),ppt->error_message);
+      class_alloc(parena->used_in_sources[slot],pt_size*sizeof(int),ppt->error_message);
+      parena->pt_capacity[slot] = pt_size;
+      parena->allocations++;
+    }
+
+    pv->y = parena->y[slot];
+    pv->dy = parena->dy[slot];
+    pv->used_in_sources = parena->used_in_sources[slot];
+
+    memset(pv->y,0,pt_size*sizeof(double));
+  }
+
+  if (ncdm_size > 0) {
+
+    if (ncdm_size > parena->ncdm_capacity[slot]) {
+      free(parena->l_max_ncdm[slot]);
+      free(parena->q_size_ncdm[slot]);
+      class_alloc(parena->l_max_ncdm[slot],ncdm_size*sizeof(int),ppt->error_message);
+      class_alloc(parena->q_size_ncdm[slot],ncdm_size*sizeof(int),ppt->error_message);
+      parena->ncdm_capacity[slot] = ncdm_size;
+      parena->allocations++;
+    }
+
+    pv->l_max_ncdm = parena->l_max_ncdm[slot];
+    pv->q_size_ncdm = parena->q_size_ncdm[slot];
+  }
 
   return _SUCCESS_;
 }
@@ -6367,22 +9587,22 @@ int perturb_initial_conditions(struct precision * ppr,
       if(ppt->has_lrs_phi_pt == _TRUE_){
         if (ppw->approx[ppw->index_ap_lrsad1] == (int)lrsad1_off && ppw->approx[ppw->index_ap_lrsad2] == (int)lrsad2_off) {
 	  // Set the initial conditions at the potential minimum
-	  double T_F = pba->T_cmb*pba->lrs_T_F/(a/pba->a_today)*_k_B_/_eV_; // [eV]
+	  double T_F = pba->lrs_T0_F*pba->a_today/a; // [eV]
 	  double rhs = 0;
 	  double factor = pba->factor_lrs*pow(pba->a_today/a,4); // 4*pi*T_F^4 [rho_class]
-	  double q2;
 	  double a2 = a*a;
+	  class_call(perturb_lrs_momentum_cache(pba,ppw),
+		     ppt->error_message,
+		     ppt->error_message);
 	  for (index_q=0; index_q < ppw->pv->q_size_lrs; index_q ++) {
-	    q = pba->q_lrs[index_q];
-	    q2 = q*q;
-	    epsilon = sqrt(q2+ppw->pvecback[pba->index_bg_mT_over_T0_lrs]*ppw->pvecback[pba->index_bg_mT_over_T0_lrs]*a2);
-	    rhs += q2 * ppw->pvecback[pba->index_bg_mT_over_T0_lrs]*a/(epsilon*T_F) * pba->w_lrs[index_q]*ppw->pv->y[ppw->pv->index_pt_psi0_lrs];
+	    rhs += ppw->lrs_w_q2_epsilon[index_q]*ppw->lrs_mT_over_epsilon2[index_q];
 	  }
+	  rhs *= pba->a_today/T_F*ppw->pv->y[ppw->pv->index_pt_psi0_lrs];
 	  rhs *= factor;
 	  rhs /= _eV4_to_rho_class;
 	  rhs *= - pba->lrs_g_over_M;
             
-          ppw->pv->y[ppw->pv->index_pt_phi_M_lrs] = rhs / (k*k/a2/SQR(pba->lrs_M_phi * _Mpc_times_eV) + 1 + ppw->pvecback[pba->index_bg_MTsq_over_Msq_lrs]);
+          ppw->pv->y[ppw->pv->index_pt_phi_M_lrs] = rhs / (k*k/a2/pba->lrs_M_phi_sq + 1 + ppw->pvecback[pba->index_bg_MTsq_over_Msq_lrs]);
           ppw->pv->y[ppw->pv->index_pt_phi_M_prime_lrs] = 0.;
         }
       }
@@ -7117,14 +10337,14 @@ int perturb_approximations(
       }
     
       if (ppt->has_lrs_phi_pt == _TRUE_) {
-        if ( SQR(pba->lrs_M_phi * _Mpc_times_eV)/(SQR(k/ppw->pvecback[pba->index_bg_a])) >
+        if ( pba->lrs_M_phi_sq/(SQR(k/ppw->pvecback[pba->index_bg_a])) >
 	     SQR(ppr->lrs_adiab_trigger_M_over_kH)){
           ppw->approx[ppw->index_ap_lrsad1] = (int)lrsad1_on;
         }else{
           ppw->approx[ppw->index_ap_lrsad1] = (int)lrsad1_off;
         }
 	
-        if ( SQR(pba->lrs_M_phi * _Mpc_times_eV)*ppw->pvecback[pba->index_bg_MTsq_over_Msq_lrs]/
+        if ( pba->lrs_M_phi_sq*ppw->pvecback[pba->index_bg_MTsq_over_Msq_lrs]/
 	     (SQR(k/ppw->pvecback[pba->index_bg_a])) >  SQR(ppr->lrs_adiab_trigger_M_over_kH)){
           ppw->approx[ppw->index_ap_lrsad2] = (int)lrsad2_on;
         }else{
@@ -7644,7 +10864,7 @@ int perturb_total_stress_energy(
   double rho_plus_p_ncdm;
   double rho_plus_p_lrs;
   int index_q,n_ncdm,idx;
-  double epsilon,q,q2,cg2_ncdm,w_ncdm,rho_ncdm_bg,p_ncdm_bg,pseudo_p_ncdm,cg2_lrs,w_lrs,rho_lrs_bg,p_lrs_bg,pseudo_p_lrs;
+  double epsilon,q,q2,cg2_ncdm,w_ncdm,rho_ncdm_bg,p_ncdm_bg,pseudo_p_ncdm,cg2_lrs,rho_lrs_bg,p_lrs_bg;
   double w_fld,dw_over_da_fld,integral_fld;
   double gwncdm;
   double gwlrs;
@@ -7985,10 +11205,11 @@ int perturb_total_stress_energy(
       double phi_M_prime = ppw->pvecback[pba->index_bg_phi_M_prime_lrs]; // Background phi*M_prime [eV/Mpc]
       double phi_M_dot_over_H = phi_M_prime / a_prime_over_a; // Background phi*M_dot/H [eV]
       double g_over_M_mT = pba->lrs_g_over_M/((ppw->pvecback[pba->index_bg_mT_over_T0_lrs]/pba->lrs_m_F_over_T0)*pba->lrs_m_F); // [eV^-2]
-      double T_F = pba->T_cmb*pba->lrs_T_F/(a/pba->a_today)*_k_B_/_eV_; // [eV]
+      double T_F = pba->lrs_T0_F*pba->a_today/a; // [eV]
       
       /* Scalar field perturbation */
       double delta_phi_M=0;
+      double delta_phi_M_over_T_F;
       double delta_phi_M_prime=0;
 
       if (ppt->has_lrs_phi_pt == _TRUE_
@@ -8000,27 +11221,26 @@ int perturb_total_stress_energy(
           if(ppw->approx[ppw->index_ap_lrsfa] == (int)lrsfa_on){
             rho_lrs_bg = ppw->pvecback[pba->index_bg_rho_lrs_F];
             p_lrs_bg = ppw->pvecback[pba->index_bg_p_lrs_F];
-            pseudo_p_lrs = ppw->pvecback[pba->index_bg_pseudo_p_lrs_F];
-            w_lrs = p_lrs_bg/rho_lrs_bg;
             
             delta_phi_M = - rho_lrs_bg*y[ppw->pv->index_pt_psi0_lrs]/_eV4_to_rho_class * phi_M_dot_over_H * (1 + g_over_M_mT * phi_M) /
               (3*(rho_lrs_bg + p_lrs_bg)/_eV4_to_rho_class + phi_M * phi_M_dot_over_H) / //-g/(M mT) * (deltarho-3deltap) [eV^2]
-              (k2/a2/SQR(pba->lrs_M_phi * _Mpc_times_eV) + 1 + ppw->pvecback[pba->index_bg_MTsq_over_Msq_lrs]); // Everything here is dimensionless
+              (k2/a2/pba->lrs_M_phi_sq + 1 + ppw->pvecback[pba->index_bg_MTsq_over_Msq_lrs]); // Everything here is dimensionless
           } else{
             // Compute rhs
             double rhs = 0;
             factor = pba->factor_lrs*pow(pba->a_today/a,4);
+            class_call(perturb_lrs_momentum_cache(pba,ppw),
+                       ppt->error_message,
+                       ppt->error_message);
             for (index_q=0; index_q < ppw->pv->q_size_lrs; index_q ++) {
-              q = pba->q_lrs[index_q];
-              q2 = q*q;
-              epsilon = sqrt(q2+ppw->pvecback[pba->index_bg_mT_over_T0_lrs]*ppw->pvecback[pba->index_bg_mT_over_T0_lrs]*a2);
-              rhs += q2 * ppw->pvecback[pba->index_bg_mT_over_T0_lrs]*a/(epsilon*T_F) * pba->w_lrs[index_q]*y[ppw->pv->index_pt_psi0_lrs];
+              rhs += ppw->lrs_w_q2_epsilon[index_q]*ppw->lrs_mT_over_epsilon2[index_q];
             }
+            rhs *= pba->a_today/T_F*y[ppw->pv->index_pt_psi0_lrs];
             rhs *= factor;
             rhs /= _eV4_to_rho_class;
             rhs *= - pba->lrs_g_over_M;
             
-            delta_phi_M = rhs / (k2/a2/SQR(pba->lrs_M_phi * _Mpc_times_eV) + 1 + ppw->pvecback[pba->index_bg_MTsq_over_Msq_lrs]);
+            delta_phi_M = rhs / (k2/a2/pba->lrs_M_phi_sq + 1 + ppw->pvecback[pba->index_bg_MTsq_over_Msq_lrs]);
           }
           
           ppw->delta_phi_M_lrsad = delta_phi_M;
@@ -8035,13 +11255,9 @@ int perturb_total_stress_energy(
 	  // The perturbations are evolved integrated:
 	  rho_lrs_bg = ppw->pvecback[pba->index_bg_rho_lrs_F];
 	  p_lrs_bg = ppw->pvecback[pba->index_bg_p_lrs_F];
-	  pseudo_p_lrs = ppw->pvecback[pba->index_bg_pseudo_p_lrs_F];
         
 	  rho_plus_p_lrs = rho_lrs_bg + p_lrs_bg;
-	  w_lrs = p_lrs_bg/rho_lrs_bg;
-	  cg2_lrs = w_lrs * (5.0 - pseudo_p_lrs/p_lrs_bg +
-			     1/g_over_M_mT * phi_M_dot_over_H /(3*p_lrs_bg/_eV4_to_rho_class) * ppw->pvecback[pba->index_bg_MTsq_over_Msq_lrs]) /
-	    (3*(1 + w_lrs) + phi_M * phi_M_dot_over_H / (rho_lrs_bg/_eV4_to_rho_class)); // p_prime/rho_prime
+	  cg2_lrs = ppw->pvecback[pba->index_bg_ca2_lrs_F]; // p_prime/rho_prime
 	  if ((ppt->has_source_delta_lrs_F == _TRUE_) || (ppt->has_source_theta_lrs_F == _TRUE_) || (ppt->has_source_delta_m == _TRUE_)) {
 	    ppw->theta_lrs_F = y[idx+1];
 	    ppw->shear_lrs_F = y[idx+2];
@@ -8067,20 +11283,24 @@ int perturb_total_stress_energy(
 	  rho_plus_p_shear_lrs = 0.0;
 	  delta_p_lrs = 0.0;
 	  factor = pba->factor_lrs*pow(pba->a_today/a,4);
+	  delta_phi_M_over_T_F = pba->lrs_g_over_M * delta_phi_M / T_F;
+
+	  class_call(perturb_lrs_momentum_cache(pba,ppw),
+		     ppt->error_message,
+		     ppt->error_message);
 
 	  for (index_q=0; index_q < ppw->pv->q_size_lrs; index_q ++) {
 
 	    q = pba->q_lrs[index_q];
 	    q2 = q*q;
-	    epsilon = sqrt(q2+ppw->pvecback[pba->index_bg_mT_over_T0_lrs]*ppw->pvecback[pba->index_bg_mT_over_T0_lrs]*a2);
 
-	    rho_delta_lrs += q2*epsilon*pba->w_lrs[index_q]*(y[idx]
-							     + a/pba->a_today * ppw->pvecback[pba->index_bg_mT_over_T0_lrs] / SQR(epsilon) * pba->lrs_g_over_M * delta_phi_M / T_F);
+	    rho_delta_lrs += ppw->lrs_w_q2_epsilon[index_q]*(y[idx]
+							     + ppw->lrs_mT_over_epsilon2[index_q] * delta_phi_M_over_T_F);
 	    // The extra term is dimensionless, so we are safe
 	    rho_plus_p_theta_lrs += q2*q*pba->w_lrs[index_q]*y[idx+1];
-	    rho_plus_p_shear_lrs += q2*q2/epsilon*pba->w_lrs[index_q]*y[idx+2];
-	    delta_p_lrs += q2*q2/epsilon*pba->w_lrs[index_q]*(y[idx]
-							      - a/pba->a_today * ppw->pvecback[pba->index_bg_mT_over_T0_lrs] / SQR(epsilon) * pba->lrs_g_over_M * delta_phi_M / T_F);
+	    rho_plus_p_shear_lrs += ppw->lrs_w_q4_over_epsilon[index_q]*y[idx+2];
+	    delta_p_lrs += ppw->lrs_w_q4_over_epsilon[index_q]*(y[idx]
+							      - ppw->lrs_mT_over_epsilon2[index_q] * delta_phi_M_over_T_F);
 	    // The extra term is dimensionless, so we are safe
 
 	    //Jump to next momentum bin:
@@ -8115,18 +11335,31 @@ int perturb_total_stress_energy(
 	p_lrs_bg = ppw->pvecback[pba->index_bg_p_lrs_F];
         
 	rho_plus_p_lrs = rho_lrs_bg + p_lrs_bg;
-	if ((ppt->has_source_delta_lrs_F == _TRUE_) || (ppt->has_source_theta_lrs_F == _TRUE_) || (ppt->has_source_delta_m == _TRUE_)) {
-	  ppw->theta_lrs_F = y[idx+1] / (rho_plus_p_lrs); // For nuggets we store (rho+p)*theta, not theta. This ensures the continuity of the stress-energy tensor
+	if (ppw->lrs_nugget_cdm_offset == _TRUE_) {
+	  // Offset to CDM: we store delta_nug - delta_cdm, and theta_nug - theta_cdm is analytic
+	  ppw->theta_lrs_F = ppw->lrs_nugget_theta_offset_a * pba->a_today/a;
+	  if (ppt->gauge == newtonian)
+	    ppw->theta_lrs_F += y[ppw->pv->index_pt_theta_cdm];
 	  ppw->shear_lrs_F = 0.;
+	  ppw->delta_lrs_F = y[idx] + y[ppw->pv->index_pt_delta_cdm];
+	  ppw->delta_p_lrs_F = 0.;
+
+	  ppw->delta_rho += rho_lrs_bg*ppw->delta_lrs_F;
+	  ppw->rho_plus_p_theta += rho_plus_p_lrs*ppw->theta_lrs_F;
 	}
+	else {
+	  if ((ppt->has_source_delta_lrs_F == _TRUE_) || (ppt->has_source_theta_lrs_F == _TRUE_) || (ppt->has_source_delta_m == _TRUE_)) {
+	    ppw->theta_lrs_F = y[idx+1] / (rho_plus_p_lrs); // For nuggets we store (rho+p)*theta, not theta. This ensures the continuity of the stress-energy tensor
+	    ppw->shear_lrs_F = 0.;
+	  }
 
-	// Fermion density and pressure
-	ppw->delta_lrs_F = y[idx] / rho_lrs_bg; // For nuggets we store delta_rho, not delta_rho/rho. This ensures the continuity of the stress-energy tensor 
-	ppw->delta_p_lrs_F = 0.;
+	  // Fermion density and pressure
+	  ppw->delta_lrs_F = y[idx] / rho_lrs_bg; // For nuggets we store delta_rho, not delta_rho/rho. This ensures the continuity of the stress-energy tensor 
+	  ppw->delta_p_lrs_F = 0.;
         
-	ppw->delta_rho += y[idx]; // For nuggets we store delta_rho
-	ppw->rho_plus_p_theta += y[idx+1]; // For nuggets we store (rho+p)*theta
-	ppw->delta_p += 0;
+	  ppw->delta_rho += y[idx]; // For nuggets we store delta_rho
+	  ppw->rho_plus_p_theta += y[idx+1]; // For nuggets we store (rho+p)*theta
+	}
         
 	ppw->rho_plus_p_tot += rho_plus_p_lrs;
         
@@ -8146,21 +11379,21 @@ int perturb_total_stress_energy(
       if (ppt->has_lrs_phi_pt == _TRUE_
 	  && (pba->has_lrs_nuggets == _FALSE_ || ppw->approx[ppw->index_ap_lrsnug] == (int)lrsnug_off)){
 	if (ppt->gauge == synchronous){
-	  delta_rho_scf = 1./a2*phi_M_prime*delta_phi_M_prime / SQR(pba->lrs_M_phi * _Mpc_times_eV)
+	  delta_rho_scf = 1./a2*phi_M_prime*delta_phi_M_prime / pba->lrs_M_phi_sq
 	    + phi_M * delta_phi_M; // eV^4
-	  delta_p_scf = 1./a2*phi_M_prime*delta_phi_M_prime / SQR(pba->lrs_M_phi * _Mpc_times_eV)  
+	  delta_p_scf = 1./a2*phi_M_prime*delta_phi_M_prime / pba->lrs_M_phi_sq  
 	    - phi_M * delta_phi_M;
 	}
 	else{
 	  /* equation for psi */
 	  psi = y[ppw->pv->index_pt_phi] - 4.5 * (a2/k/k) * ppw->rho_plus_p_shear; // Dimensionless
         
-	  delta_rho_scf = 1./a2*phi_M_prime*delta_phi_M_prime / SQR(pba->lrs_M_phi * _Mpc_times_eV)
+	  delta_rho_scf = 1./a2*phi_M_prime*delta_phi_M_prime / pba->lrs_M_phi_sq
 	    + phi_M * delta_phi_M
-	    - 1./a2*SQR(phi_M_prime)*psi / SQR(pba->lrs_M_phi * _Mpc_times_eV); // [eV^4]
-	  delta_p_scf = 1./a2*phi_M_prime*delta_phi_M_prime / SQR(pba->lrs_M_phi * _Mpc_times_eV)  
+	    - 1./a2*SQR(phi_M_prime)*psi / pba->lrs_M_phi_sq; // [eV^4]
+	  delta_p_scf = 1./a2*phi_M_prime*delta_phi_M_prime / pba->lrs_M_phi_sq  
 	    - phi_M * delta_phi_M
-	    - 1./a2*SQR(phi_M_prime)*psi / SQR(pba->lrs_M_phi * _Mpc_times_eV); // [eV^4]
+	    - 1./a2*SQR(phi_M_prime)*psi / pba->lrs_M_phi_sq; // [eV^4]
 	}
       
 	ppw->delta_rho += delta_rho_scf * _eV4_to_rho_class;
@@ -8382,7 +11615,7 @@ int perturb_total_stress_energy(
 
       rho_relativistic = 0.;
 
-      if (ppt->tensor_method == tm_exact)
+      if ((ppt->tensor_method == tm_exact) && (pba->has_ur == _TRUE_))
         rho_relativistic += ppw->pvecback[pba->index_bg_rho_ur];
 
       if (ppt->tensor_method == tm_massless_approximation) {
@@ -8397,10 +11630,11 @@ int perturb_total_stress_energy(
           }
         }
 
-        if (pba->has_lrs == _TRUE_) {
-          /* (3 p_lrs_F) is the "relativistic" contribution to rho_lrs */
-          rho_relativistic += 3.*ppw->pvecback[pba->index_bg_p_lrs_F];
-        }
+      }
+
+      if (ppt->tensor_lrs_in_ur == _TRUE_) {
+        /* (3 p_lrs_F) is the "relativistic" contribution to rho_lrs */
+        rho_relativistic += 3.*ppw->pvecback[pba->index_bg_p_lrs_F];
       }
 
       ppw->gw_source += (-_SQRT6_*4*a2*rho_relativistic*
@@ -8451,13 +11685,13 @@ int perturb_total_stress_energy(
 
       factor = pba->factor_lrs*pow(pba->a_today/a,4);
 
-      for (index_q=0; index_q < ppw->pv->q_size_lrs; index_q ++) {
+      class_call(perturb_lrs_momentum_cache(pba,ppw),
+                 ppt->error_message,
+                 ppt->error_message);
 
-        q = pba->q_lrs[index_q];
-        q2 = q*q;
-        epsilon = sqrt(q2+ppw->pvecback[pba->index_bg_mT_over_T0_lrs]*ppw->pvecback[pba->index_bg_mT_over_T0_lrs]*a2);
+      for (index_q=0; index_q < ppw->pv->q_size_lrs; index_q ++) {
 
-        gwlrs += q2*q2/epsilon*pba->w_lrs[index_q]*(1./15.*y[idx]+2./21.*y[idx+2]+1./35.*y[idx+4]);
+        gwlrs += ppw->lrs_w_q4_over_epsilon[index_q]*(1./15.*y[idx]+2./21.*y[idx+2]+1./35.*y[idx+4]);
 
         //Jump to next momentum bin:
         idx+=(ppw->pv->l_max_lrs+1);
@@ -9152,8 +12386,8 @@ int perturb_print_variables(double tau,
   double q,q2,epsilon;
   /** - ncdm sector ends */
   /** - lrs sector begins */
-  double delta_lrs, theta_lrs, shear_lrs, delta_p_over_delta_rho_lrs;
-  double rho_lrs_bg, p_lrs_bg, pseudo_p_lrs, w_lrs;
+  double delta_lrs=0., theta_lrs=0., shear_lrs=0., delta_p_over_delta_rho_lrs=0.;
+  double rho_lrs_bg, p_lrs_bg;
   double rho_delta_lrs = 0.0;
   double rho_plus_p_theta_lrs = 0.0;
   double rho_plus_p_shear_lrs = 0.0;
@@ -9406,14 +12640,10 @@ int perturb_print_variables(double tau,
 
     if (pba->has_lrs == _TRUE_) {
       // Background quantities
-      double phi_M = ppw->pvecback[pba->index_bg_phi_M_lrs]; // Background phi*M [eV^2]
-      double phi_M_prime = ppw->pvecback[pba->index_bg_phi_M_prime_lrs]; // Background phi_prime [eV/Mpc]
-      double a_prime_over_a = pvecback[pba->index_bg_H] * pvecback[pba->index_bg_a];
-      double phi_M_dot_over_H = phi_M_prime / a_prime_over_a; // Background phi*M_dot/H [eV]
-      double g_over_M_mT = pba->lrs_g_over_M/((ppw->pvecback[pba->index_bg_mT_over_T0_lrs]/pba->lrs_m_F_over_T0)*pba->lrs_m_F); // [eV^-2]
-      double T_F = pba->T_cmb*pba->lrs_T_F/(a/pba->a_today)*_k_B_/_eV_; // [eV]
+      double T_F = pba->lrs_T0_F*pba->a_today/a; // [eV]
 
       double delta_phi_M=0;
+      double delta_phi_M_over_T_F;
       if (ppt->has_lrs_phi_pt == _TRUE_){
         if(ppw->approx[ppw->index_ap_lrsad1] == (int)lrsad1_off && ppw->approx[ppw->index_ap_lrsad2] == (int)lrsad2_off)
           delta_phi_M = y[ppw->pv->index_pt_phi_M_lrs];
@@ -9428,16 +12658,12 @@ int perturb_print_variables(double tau,
 	  // The perturbations are evolved integrated:
 	  rho_lrs_bg = pvecback[pba->index_bg_rho_lrs_F];
 	  p_lrs_bg = pvecback[pba->index_bg_p_lrs_F];
-	  pseudo_p_lrs = pvecback[pba->index_bg_pseudo_p_lrs_F];
-	  w_lrs = p_lrs_bg/rho_lrs_bg;
 
 	  delta_lrs = y[idx];
 	  theta_lrs = y[idx+1];
 	  shear_lrs = y[idx+2];
 	  //This is the adiabatic sound speed:
-	  delta_p_over_delta_rho_lrs = w_lrs * (5.0 - pseudo_p_lrs/p_lrs_bg +
-						1/g_over_M_mT * phi_M_dot_over_H /(3*p_lrs_bg/_eV4_to_rho_class) * ppw->pvecback[pba->index_bg_MTsq_over_Msq_lrs]) /
-	    (3*(1 + w_lrs) + phi_M * phi_M_dot_over_H / (rho_lrs_bg/_eV4_to_rho_class)); // p_prime/rho_prime
+	  delta_p_over_delta_rho_lrs = ppw->pvecback[pba->index_bg_ca2_lrs_F]; // p_prime/rho_prime
 	  idx += ppw->pv->l_max_lrs+1;
 	}
 	else{
@@ -9447,20 +12673,24 @@ int perturb_print_variables(double tau,
 	  rho_plus_p_shear_lrs = 0.0;
 	  delta_p_lrs = 0.0;
 	  factor = pba->factor_lrs*pow(pba->a_today/a,4);
-        
+	  delta_phi_M_over_T_F = pba->lrs_g_over_M * delta_phi_M / T_F;
+
+	  class_call(perturb_lrs_momentum_cache(pba,ppw),
+		     error_message,
+		     error_message);
+
 	  for (index_q=0; index_q < ppw->pv->q_size_lrs; index_q ++) {
 
 	    q = pba->q_lrs[index_q];
 	    q2 = q*q;
-	    epsilon = sqrt(q2+pvecback[pba->index_bg_mT_over_T0_lrs]*pvecback[pba->index_bg_mT_over_T0_lrs]*a2);
 
-	    rho_delta_lrs += q2*epsilon*pba->w_lrs[index_q]*(y[idx]
-							     + a/pba->a_today * ppw->pvecback[pba->index_bg_mT_over_T0_lrs] / SQR(epsilon) * pba->lrs_g_over_M * delta_phi_M / T_F);
+	    rho_delta_lrs += ppw->lrs_w_q2_epsilon[index_q]*(y[idx]
+							     + ppw->lrs_mT_over_epsilon2[index_q] * delta_phi_M_over_T_F);
 	    // The extra term is dimensionless, so we are safe
 	    rho_plus_p_theta_lrs += q2*q*pba->w_lrs[index_q]*y[idx+1];
-	    rho_plus_p_shear_lrs += q2*q2/epsilon*pba->w_lrs[index_q]*y[idx+2];
-	    delta_p_lrs += q2*q2/epsilon*pba->w_lrs[index_q]*(y[idx]
-							      - a/pba->a_today * ppw->pvecback[pba->index_bg_mT_over_T0_lrs] / SQR(epsilon) * pba->lrs_g_over_M * delta_phi_M / T_F);
+	    rho_plus_p_shear_lrs += ppw->lrs_w_q4_over_epsilon[index_q]*y[idx+2];
+	    delta_p_lrs += ppw->lrs_w_q4_over_epsilon[index_q]*(y[idx]
+							      - ppw->lrs_mT_over_epsilon2[index_q] * delta_phi_M_over_T_F);
 	    // The extra term is dimensionless, so we are safe
 
 	    //Jump to next momentum bin:
@@ -9483,11 +12713,17 @@ int perturb_print_variables(double tau,
 	// Nugget approximation: the perturbations are evolved integrated:
 	rho_lrs_bg = pvecback[pba->index_bg_rho_lrs_F];
 	p_lrs_bg = pvecback[pba->index_bg_p_lrs_F];
-	pseudo_p_lrs = pvecback[pba->index_bg_pseudo_p_lrs_F];
-	w_lrs = p_lrs_bg/rho_lrs_bg;
 
-	delta_lrs = y[idx] / rho_lrs_bg; // For nuggets we store delta_rho
-	theta_lrs = y[idx+1] / (rho_lrs_bg + p_lrs_bg); // For nuggets we store (rho+p)*theta
+	if (ppw->lrs_nugget_cdm_offset == _TRUE_) {
+	  delta_lrs = y[idx] + y[ppw->pv->index_pt_delta_cdm]; // Offset to CDM
+	  theta_lrs = ppw->lrs_nugget_theta_offset_a * pba->a_today/a;
+	  if (ppt->gauge == newtonian)
+	    theta_lrs += y[ppw->pv->index_pt_theta_cdm];
+	}
+	else {
+	  delta_lrs = y[idx] / rho_lrs_bg; // For nuggets we store delta_rho
+	  theta_lrs = y[idx+1] / (rho_lrs_bg + p_lrs_bg); // For nuggets we store (rho+p)*theta
+	}
 	shear_lrs = 0.;
 	//This is the adiabatic sound speed:
 	delta_p_over_delta_rho_lrs = 0.;
@@ -9789,18 +13025,8 @@ int perturb_print_variables(double tau,
 
     /* Scalar-mediated long range interaction */
     if (ppt->evolve_tensor_lrs == _TRUE_) {
-      // We have *NOT* implemented long-range interactions in tensor perturbations
-      // Background quantities
-      double g_over_M_mT = pba->lrs_g_over_M/((ppw->pvecback[pba->index_bg_mT_over_T0_lrs]/pba->lrs_m_F_over_T0)*pba->lrs_m_F); // [eV^-2]
-      double T_F = pba->T_cmb*pba->lrs_T_F/(a/pba->a_today)*_k_B_/_eV_; // [eV]
-      
-      double delta_phi_M=0;
-      if (ppt->has_lrs_phi_pt == _TRUE_
-	  && (pba->has_lrs_nuggets == _FALSE_ || ppw->approx[ppw->index_ap_lrsnug] == (int)lrsnug_off))
-        if(ppw->approx[ppw->index_ap_lrsad1] == (int)lrsad1_off && ppw->approx[ppw->index_ap_lrsad2] == (int)lrsad2_off)
-          delta_phi_M = y[ppw->pv->index_pt_phi_M_lrs];
-        else
-          delta_phi_M = ppw->delta_phi_M_lrsad;
+      // We have *NOT* implemented long-range interactions in tensor perturbations:
+      // there is no scalar field perturbation nor nugget approximation for tensors
       
       idx = ppw->pv->index_pt_psi0_lrs;
 
@@ -9809,23 +13035,20 @@ int perturb_print_variables(double tau,
       rho_plus_p_shear_lrs = 0.0;
       delta_p_lrs = 0.0;
       factor = pba->factor_lrs*pow(pba->a_today/a,4);
-      
+
+      class_call(perturb_lrs_momentum_cache(pba,ppw),
+                 error_message,
+                 error_message);
+
       for (index_q=0; index_q < ppw->pv->q_size_lrs; index_q ++) {
 
         q = pba->q_lrs[index_q];
         q2 = q*q;
-        epsilon = sqrt(q2+pvecback[pba->index_bg_mT_over_T0_lrs]*pvecback[pba->index_bg_mT_over_T0_lrs]*a2);
 
-        rho_delta_lrs += q2*epsilon*pba->w_lrs[index_q]*(y[idx]
-							 + a/pba->a_today * ppw->pvecback[pba->index_bg_mT_over_T0_lrs] / SQR(epsilon) * pba->lrs_g_over_M * delta_phi_M / T_F);
+        rho_delta_lrs += ppw->lrs_w_q2_epsilon[index_q]*y[idx];
 	rho_plus_p_theta_lrs += q2*q*pba->w_lrs[index_q]*y[idx+1];
-	if(pba->has_lrs_nuggets == _FALSE_ || ppw->approx[ppw->index_ap_lrsnug] == (int)lrsnug_off)
-	  rho_plus_p_shear_lrs += q2*q2/epsilon*pba->w_lrs[index_q]*y[idx+2];
-	else
-	  rho_plus_p_shear_lrs += 0.;
-        delta_p_lrs += q2*q2/epsilon*pba->w_lrs[index_q]*(y[idx]
-							   - a/pba->a_today * ppw->pvecback[pba->index_bg_mT_over_T0_lrs] / SQR(epsilon) * pba->lrs_g_over_M * delta_phi_M / T_F);
-	// The extra term is dimensionless, so we are safe
+	rho_plus_p_shear_lrs += ppw->lrs_w_q4_over_epsilon[index_q]*y[idx+2];
+        delta_p_lrs += ppw->lrs_w_q4_over_epsilon[index_q]*y[idx];
 
         //Jump to next momentum bin:
         idx+=(ppw->pv->l_max_lrs+1);
@@ -9863,33 +13086,213 @@ int perturb_print_variables(double tau,
 }
 
 /**
- * Compute derivative of all perturbations to be integrated
+ * Flag the multipoles l=0..l_max of one Boltzmann hierarchy (or of one
+ * momentum bin of a momentum-resolved hierarchy) stored contiguously
+ * from index_first, for perturb_sparsity_pattern().
  *
- * For each mode (scalar/vector/tensor) and each wavenumber k, this
- * function computes the derivative of all values in the vector of
- * perturbed variables to be integrated.
+ * @param hierarchy   Output: index of the hierarchy of each variable
+ * @param multipole   Output: multipole of each variable
+ * @param index_first Input: index of the multipole l=0
+ * @param l_max       Input: largest multipole
+ * @param id          Input: index of the hierarchy
+ * @return the error status
+ */
+
+int perturb_sparsity_flag_hierarchy(
+                                    int * hierarchy,
+                                    int * multipole,
+                                    int index_first,
+                                    int l_max,
+                                    int id
+                                    ) {
+  int l;
+
+  for (l=0; l<=l_max; l++) {
+    hierarchy[index_first+l] = id;
+    multipole[index_first+l] = l;
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Provide the sparsity pattern of the jacobian of perturb_derivs() to
+ * the stiff evolver.
  *
- * This is one of the few functions in the code which is passed to the generic_integrator() routine.
- * Since generic_integrator() should work with functions passed from various modules, the format of the arguments
- * is a bit special:
- * - fixed parameters and workspaces are passed through a generic pointer.
- *   generic_integrator() doesn't know what the content of this pointer is.
- * - errors are not written as usual in pth->error_message, but in a generic
- *   error_message passed in the list of arguments.
+ * This function is passed to the generic_evolver routine, which
+ * calls it once per integration interval (the approximation scheme,
+ * hence the layout of the vector of perturbations, is fixed inside an
+ * interval). It returns a pattern for scalar modes, in which the
+ * free-streaming Boltzmann hierarchies are integrated: photon
+ * temperature and polarization, decay radiation, ultra-relativistic
+ * species, interacting dark radiation, and each momentum bin of the
+ * ncdm species and of the lrs species. The pattern is conservative:
+ * all other variables, together with the multipoles l<=2 of each
+ * hierarchy (which enter the Einstein, scalar field and baryon
+ * equations), are treated as a dense block. The multipoles l>=3 of a
+ * given hierarchy only couple to their neighbours l-1 and l+1 in the
+ * same hierarchy. The evolver then perturbs together the columns of
+ * the multipoles l>=3 which share no row (CPR grouping), instead of
+ * all the columns separately, until it trusts the pattern that it
+ * deduces numerically.
  *
- * @param tau                      Input: conformal time
- * @param y                        Input: vector of perturbations
- * @param dy                       Output: vector of its derivatives (already allocated)
- * @param parameters_and_workspace Input/Output: in input, fixed parameters (e.g. indices); in output, background and thermo quantities evaluated at tau.
+ * @param neq                      Input: number of equations
+ * @param max_nonzero              Input: size of Ai
+ * @param Ap                       Output: column pointers of the pattern (compressed column format)
+ * @param Ai                       Output: row indices of the pattern
+ * @param has_pattern              Output: _TRUE_ if a pattern was written in Ap and Ai
+ * @param parameters_and_workspace Input: fixed parameters (e.g. indices)
  * @param error_message            Output: error message
+ * @return the error status
  */
 
-int perturb_derivs(double tau,
-                   double * y,
-                   double * dy,
-                   void * parameters_and_workspace,
-                   ErrorMsg error_message
-                   ) {
+int perturb_sparsity_pattern(
+                             int neq,
+                             int max_nonzero,
+                             int * Ap,
+                             int * Ai,
+                             int * has_pattern,
+                             void * parameters_and_workspace,
+                             ErrorMsg error_message
+                             ) {
+
+  struct perturb_parameters_and_workspace * pppaw;
+  struct background * pba;
+  struct perturbs * ppt;
+  struct perturb_workspace * ppw;
+  struct perturb_vector * pv;
+  int index_md;
+  int * hierarchy;
+  int * multipole;
+  int id,index_q,n_ncdm,idx;
+  int i,j,nz;
+  short coupled,is_sparse;
+
+  pppaw = parameters_and_workspace;
+  pba = pppaw->pba;
+  ppt = pppaw->ppt;
+  ppw = pppaw->ppw;
+  pv = ppw->pv;
+  index_md = pppaw->index_md;
+
+  *has_pattern = _FALSE_;
+
+  if (_scalars_ == _FALSE_)
+    return _SUCCESS_;
+
+  /** - flag the hierarchy and multipole of each variable (-1 for the dense block) */
+
+  class_alloc(hierarchy,neq*sizeof(int),error_message);
+  class_alloc(multipole,neq*sizeof(int),error_message);
+
+  for (i=0; i<neq; i++) {
+    hierarchy[i] = -1;
+    multipole[i] = -1;
+  }
+
+  id = 0;
+
+  if ((ppw->approx[ppw->index_ap_rsa] == (int)rsa_off) &&
+      (ppw->approx[ppw->index_ap_tca] == (int)tca_off)) {
+    perturb_sparsity_flag_hierarchy(hierarchy,multipole,pv->index_pt_delta_g,pv->l_max_g,id++);
+    perturb_sparsity_flag_hierarchy(hierarchy,multipole,pv->index_pt_pol0_g,pv->l_max_pol_g,id++);
+  }
+
+  if (pba->has_dr == _TRUE_) {
+    perturb_sparsity_flag_hierarchy(hierarchy,multipole,pv->index_pt_F0_dr,pv->l_max_dr,id++);
+  }
+
+  if ((pba->has_ur == _TRUE_) &&
+      (ppw->approx[ppw->index_ap_rsa] == (int)rsa_off) &&
+      (ppw->approx[ppw->index_ap_ufa] == (int)ufa_off)) {
+    perturb_sparsity_flag_hierarchy(hierarchy,multipole,pv->index_pt_delta_ur,pv->l_max_ur,id++);
+  }
+
+  if ((pba->has_idr == _TRUE_) &&
+      (ppt->idr_nature == idr_free_streaming) &&
+      (ppw->approx[ppw->index_ap_rsa_idr] == (int)rsa_idr_off) &&
+      ((pba->has_idm_dr == _FALSE_) || (ppw->approx[ppw->index_ap_tca_idm_dr] == (int)tca_idm_dr_off))) {
+    perturb_sparsity_flag_hierarchy(hierarchy,multipole,pv->index_pt_delta_idr,pv->l_max_idr,id++);
+  }
+
+  if ((pba->has_ncdm == _TRUE_) &&
+      (ppw->approx[ppw->index_ap_ncdmfa] == (int)ncdmfa_off)) {
+    idx = pv->index_pt_psi0_ncdm1;
+    for (n_ncdm=0; n_ncdm < pv->N_ncdm; n_ncdm++) {
+      for (index_q=0; index_q < pv->q_size_ncdm[n_ncdm]; index_q++) {
+        perturb_sparsity_flag_hierarchy(hierarchy,multipole,idx,pv->l_max_ncdm[n_ncdm],id++);
+        idx += pv->l_max_ncdm[n_ncdm]+1;
+      }
+    }
+  }
+
+  if ((pba->has_lrs == _TRUE_) && (pv->l_max_lrs >= 3)) {
+    for (index_q=0; index_q < pv->q_size_lrs; index_q++) {
+      perturb_sparsity_flag_hierarchy(hierarchy,multipole,pv->index_pt_psi0_lrs+index_q*(pv->l_max_lrs+1),pv->l_max_lrs,id++);
+    }
+  }
+
+  /** - loop over columns j (perturbed variable) and rows i (derivative) */
+
+  is_sparse = _TRUE_;
+  nz = 0;
+  Ap[0] = 0;
+  for (j=0; (j<neq) && (is_sparse == _TRUE_); j++) {
+    for (i=0; i<neq; i++) {
+
+      if ((multipole[i] < 3) && (multipole[j] < 3))
+        coupled = _TRUE_;
+      else
+        coupled = ((hierarchy[i] == hierarchy[j]) && (abs(multipole[i]-multipole[j]) <= 1));
+
+      if (coupled == _TRUE_) {
+        if (nz >= max_nonzero) {
+          is_sparse = _FALSE_;
+          break;
+        }
+        Ai[nz] = i;
+        nz++;
+      }
+    }
+    Ap[j+1] = nz;
+  }
+
+  free(hierarchy);
+  free(multipole);
+
+  *has_pattern = is_sparse;
+
+  return _SUCCESS_;
+}
+
+/**
+ * Body of perturb_derivs() and of its specialized versions (see
+ * perturb_derivs_select()): the gauge and the flags of the species
+ * are arguments, so that the compiler can remove the tests on them
+ * when they are constants.
+ */
+
+#ifdef __GNUC__
+#define perturb_derivs_inline static inline __attribute__((always_inline))
+#else
+#define perturb_derivs_inline static inline
+#endif
+
+perturb_derivs_inline int perturb_derivs_kernel(double tau,
+                                                double * y,
+                                                double * dy,
+                                                void * parameters_and_workspace,
+                                                ErrorMsg error_message,
+                                                const int gauge,
+                                                const short has_ncdm,
+                                                const short has_lrs,
+                                                const short has_idr,
+                                                const short has_idm_dr,
+                                                const short has_scf,
+                                                const short has_fld,
+                                                const short has_dcdm,
+                                                const short has_dr
+                                                ) {
   /** Summary: */
 
   /** - define local variables */
@@ -9954,6 +13357,8 @@ int perturb_derivs(double tau,
 
   double Sinv=0., dmu_idm_dr=0., dmu_idr=0., tca_slip_idm_dr=0.;
 
+  class_profile_start(profile_perturb_derivs);
+
   /** - rename the fields of the input structure (just to avoid heavy notations) */
 
   pppaw = parameters_and_workspace;
@@ -9973,6 +13378,8 @@ int perturb_derivs(double tau,
   pvecmetric = ppw->pvecmetric;
   pv = ppw->pv;
 
+  ppw->derivs_count++;
+
   /** - get background/thermo quantities in this point */
 
   class_call(background_at_tau(pba,
@@ -10014,7 +13421,7 @@ int perturb_derivs(double tau,
   a_prime_over_a = pvecback[pba->index_bg_H] * a;
   R = 4./3. * pvecback[pba->index_bg_rho_g]/pvecback[pba->index_bg_rho_b];
 
-  if((pba->has_idm_dr==_TRUE_)){
+  if((has_idm_dr==_TRUE_)){
     Sinv = 4./3. * pvecback[pba->index_bg_rho_idr]/ pvecback[pba->index_bg_rho_idm_dr];
     dmu_idm_dr = pvecthermo[pth->index_th_dmu_idm_dr];
     dmu_idr = pth->b_idr/pth->a_idm_dr*pba->Omega0_idr/pba->Omega0_idm_dr*dmu_idm_dr;
@@ -10044,7 +13451,7 @@ int perturb_derivs(double tau,
       theta_g = y[pv->index_pt_theta_g];
     }
 
-    if (pba->has_idr == _TRUE_){
+    if (has_idr == _TRUE_){
       if (ppw->approx[ppw->index_ap_rsa_idr] == (int)rsa_idr_off){
         delta_idr = y[pv->index_pt_delta_idr];
         theta_idr = y[pv->index_pt_theta_idr];
@@ -10111,7 +13518,7 @@ int perturb_derivs(double tau,
         - In the ufa_class approximation, the leading-order source term is (h_prime/2) in synchronous gauge,
         (-3 (phi_prime+psi_prime)) in newtonian gauge: we approximate the later by (-6 phi_prime) */
 
-    if (ppt->gauge == synchronous) {
+    if (gauge == synchronous) {
 
       metric_continuity = pvecmetric[ppw->index_mt_h_prime]/2.;
       metric_euler = 0.;
@@ -10120,7 +13527,7 @@ int perturb_derivs(double tau,
       metric_ufa_class = pvecmetric[ppw->index_mt_h_prime]/2.;
     }
 
-    if (ppt->gauge == newtonian) {
+    if (gauge == newtonian) {
 
       metric_continuity = -3.*pvecmetric[ppw->index_mt_phi_prime];
       metric_euler = k2*pvecmetric[ppw->index_mt_psi];
@@ -10136,7 +13543,7 @@ int perturb_derivs(double tau,
       theta_g = ppw->rsa_theta_g;
     }
 
-    if (pba->has_idr == _TRUE_){
+    if (has_idr == _TRUE_){
       if (ppw->approx[ppw->index_ap_rsa_idr] == (int)rsa_idr_on){
         delta_idr = ppw->rsa_delta_idr;
         theta_idr = ppw->rsa_theta_idr;
@@ -10286,7 +13693,7 @@ int perturb_derivs(double tau,
 
       /** - ----> newtonian gauge: cdm density and velocity */
 
-      if (ppt->gauge == newtonian) {
+      if (gauge == newtonian) {
         dy[pv->index_pt_delta_cdm] = -(y[pv->index_pt_theta_cdm]+metric_continuity); /* cdm density */
 
         dy[pv->index_pt_theta_cdm] = - a_prime_over_a*y[pv->index_pt_theta_cdm] + metric_euler; /* cdm velocity */
@@ -10294,20 +13701,20 @@ int perturb_derivs(double tau,
 
       /** - ----> synchronous gauge: cdm density only (velocity set to zero by definition of the gauge) */
 
-      if (ppt->gauge == synchronous) {
+      if (gauge == synchronous) {
         dy[pv->index_pt_delta_cdm] = -metric_continuity; /* cdm density */
       }
     }
 
     /** - ---> idr */
-    if (pba->has_idr == _TRUE_){
+    if (has_idr == _TRUE_){
       if (ppw->approx[ppw->index_ap_rsa_idr] == (int)rsa_idr_off) {
         dy[pv->index_pt_delta_idr] = -4./3.*(theta_idr + metric_continuity);
       }
     }
 
     /** - ---> idm_dr */
-    if (pba->has_idm_dr == _TRUE_){
+    if (has_idm_dr == _TRUE_){
 
       dy[pv->index_pt_delta_idm_dr] = -(y[pv->index_pt_theta_idm_dr]+metric_continuity); /* idm_dr density */
 
@@ -10346,7 +13753,7 @@ int perturb_derivs(double tau,
 
     /** - ---> dcdm and dr */
 
-    if (pba->has_dcdm == _TRUE_) {
+    if (has_dcdm == _TRUE_) {
 
       /** - ----> dcdm */
 
@@ -10358,7 +13765,7 @@ int perturb_derivs(double tau,
 
     /** - ---> dr */
 
-    if ((pba->has_dcdm == _TRUE_)&&(pba->has_dr == _TRUE_)) {
+    if ((has_dcdm == _TRUE_)&&(has_dr == _TRUE_)) {
 
 
       /* f = rho_dr*a^4/rho_crit_today. In CLASS density units
@@ -10399,7 +13806,7 @@ int perturb_derivs(double tau,
 
     /** - ---> fluid (fld) */
 
-    if (pba->has_fld == _TRUE_) {
+    if (has_fld == _TRUE_) {
 
       if (pba->use_ppf == _FALSE_){
 
@@ -10441,9 +13848,10 @@ int perturb_derivs(double tau,
       double phi_M_prime = ppw->pvecback[pba->index_bg_phi_M_prime_lrs]; // Background phi_prime [eV/Mpc]
       double phi_M_dot_over_H = phi_M_prime / a_prime_over_a; // Background phi*M_dot/H [eV]
       double g_over_M_mT = pba->lrs_g_over_M/((ppw->pvecback[pba->index_bg_mT_over_T0_lrs]/pba->lrs_m_F_over_T0)*pba->lrs_m_F); // [eV^-2]
-      double T_F = pba->T_cmb*pba->lrs_T_F/(a/pba->a_today)*_k_B_/_eV_; // [eV]
+      double T_F = pba->lrs_T0_F*pba->a_today/a; // [eV]
       rho_lrs_bg = pvecback[pba->index_bg_rho_lrs_F]; /* background density */
-      
+      p_lrs_bg = pvecback[pba->index_bg_p_lrs_F]; /* background pressure */
+
       if(ppw->approx[ppw->index_ap_lrsad1] == (int)lrsad1_off && ppw->approx[ppw->index_ap_lrsad2] == (int)lrsad2_off){
         /* Derivative of the field value */
         dy[pv->index_pt_phi_M_lrs] = y[pv->index_pt_phi_M_prime_lrs];
@@ -10453,20 +13861,20 @@ int perturb_derivs(double tau,
 	  dy[pv->index_pt_phi_M_prime_lrs] =
 	    - 2.*a_prime_over_a*y[pv->index_pt_phi_M_prime_lrs]
 	    - metric_continuity*pvecback[pba->index_bg_phi_M_prime_lrs] // metric_continuity = h'/2 in synchronous gauge
-	    - (k2 + a2*SQR(pba->lrs_M_phi*_Mpc_times_eV) + a2*SQR(pba->lrs_M_phi*_Mpc_times_eV)*ppw->pvecback[pba->index_bg_MTsq_over_Msq_lrs])*y[pv->index_pt_phi_M_lrs]
+	    - (k2 + a2*pba->lrs_M_phi_sq + a2*pba->lrs_M_phi_sq*ppw->pvecback[pba->index_bg_MTsq_over_Msq_lrs])*y[pv->index_pt_phi_M_lrs]
 	    - a2*SQR(pba->lrs_M_phi)*rho_lrs_bg*y[ppw->pv->index_pt_psi0_lrs]/_eV4_to_rho_class * phi_M_dot_over_H * ( 1 + g_over_M_mT * phi_M) /
 	    (3*(rho_lrs_bg + p_lrs_bg)/_eV4_to_rho_class + phi_M * phi_M_dot_over_H) * SQR(_Mpc_times_eV);// -a^2 M g/mT (deltarho-3deltap). The last factor convers eV^4 to eV^2/Mpc^2
 	} else{
 	  // Compute M^2*rhs over a^2
 	  double rhs = 0;
-	  double q2;
 	  double factor = pba->factor_lrs*pow(pba->a_today/a,4);
+	  class_call(perturb_lrs_momentum_cache(pba,ppw),
+		     error_message,
+		     error_message);
 	  for (index_q=0; index_q < ppw->pv->q_size_lrs; index_q ++) {
-	    q = pba->q_lrs[index_q];
-	    q2 = q*q;
-	    epsilon = sqrt(q2+ppw->pvecback[pba->index_bg_mT_over_T0_lrs]*ppw->pvecback[pba->index_bg_mT_over_T0_lrs]*a2);
-	    rhs += q2 * ppw->pvecback[pba->index_bg_mT_over_T0_lrs]*a/(epsilon*T_F) * pba->w_lrs[index_q]*y[ppw->pv->index_pt_psi0_lrs];
+	    rhs += ppw->lrs_w_q2_epsilon[index_q]*ppw->lrs_mT_over_epsilon2[index_q];
 	  }
+	  rhs *= pba->a_today/T_F*y[ppw->pv->index_pt_psi0_lrs];
 	  rhs *= factor;
 	  rhs /= _eV4_to_rho_class;
 	  rhs *= - SQR(pba->lrs_M_phi) * pba->lrs_g_over_M; // [eV^4]
@@ -10474,7 +13882,7 @@ int perturb_derivs(double tau,
 	  dy[pv->index_pt_phi_M_prime_lrs] =
 	    - 2.*a_prime_over_a*y[pv->index_pt_phi_M_prime_lrs]
 	    - metric_continuity*pvecback[pba->index_bg_phi_M_prime_lrs] // metric_continuity = h'/2 in synchronous gauge
-	    - (k2 + a2*SQR(pba->lrs_M_phi*_Mpc_times_eV) + a2*SQR(pba->lrs_M_phi*_Mpc_times_eV)*ppw->pvecback[pba->index_bg_MTsq_over_Msq_lrs])*y[pv->index_pt_phi_M_lrs]
+	    - (k2 + a2*pba->lrs_M_phi_sq + a2*pba->lrs_M_phi_sq*ppw->pvecback[pba->index_bg_MTsq_over_Msq_lrs])*y[pv->index_pt_phi_M_lrs]
             + a2 * rhs * SQR(_Mpc_times_eV);// The last factor convers eV^4 to eV^2/Mpc^2        
 	}
       }
@@ -10482,7 +13890,7 @@ int perturb_derivs(double tau,
 
     /** - ---> scalar field (scf) */
 
-    if (pba->has_scf == _TRUE_) {
+    if (has_scf == _TRUE_) {
 
       /** - ----> field value */
 
@@ -10496,11 +13904,11 @@ int perturb_derivs(double tau,
 
     }
     /** - ---> interacting dark radiation */
-    if (pba->has_idr == _TRUE_){
+    if (has_idr == _TRUE_){
 
       if (ppw->approx[ppw->index_ap_rsa_idr] == (int)rsa_idr_off) {
 
-        if ((pba->has_idm_dr == _FALSE_)||((pba->has_idm_dr == _TRUE_)&&(ppw->approx[ppw->index_ap_tca_idm_dr] == (int)tca_idm_dr_off))) {
+        if ((has_idm_dr == _FALSE_)||((has_idm_dr == _TRUE_)&&(ppw->approx[ppw->index_ap_tca_idm_dr] == (int)tca_idm_dr_off))) {
 
           /** - ----> idr velocity */
           if(ppt->idr_nature == idr_free_streaming)
@@ -10508,7 +13916,7 @@ int perturb_derivs(double tau,
           else
             dy[pv->index_pt_theta_idr] = k2/4. * y[pv->index_pt_delta_idr] + metric_euler;
 
-          if (pba->has_idm_dr == _TRUE_)
+          if (has_idm_dr == _TRUE_)
             dy[pv->index_pt_theta_idr] += dmu_idm_dr*(y[pv->index_pt_theta_idm_dr]-y[pv->index_pt_theta_idr]);
 
           if(ppt->idr_nature == idr_free_streaming){
@@ -10516,26 +13924,26 @@ int perturb_derivs(double tau,
             /** - ----> exact idr shear */
             l = 2;
             dy[pv->index_pt_shear_idr] = 0.5*(8./15.*(y[pv->index_pt_theta_idr]+metric_shear)-3./5.*k*s_l[3]/s_l[2]*y[pv->index_pt_shear_idr+1]);
-            if (pba->has_idm_dr == _TRUE_)
+            if (has_idm_dr == _TRUE_)
               dy[pv->index_pt_shear_idr]-= (ppt->alpha_idm_dr[l-2]*dmu_idm_dr + ppt->beta_idr[l-2]*dmu_idr)*y[pv->index_pt_shear_idr];
 
             /** - ----> exact idr l=3 */
             l = 3;
             dy[pv->index_pt_l3_idr] = k/(2.*l+1.)*(l*2.*s_l[l]*s_l[2]*y[pv->index_pt_shear_idr]-(l+1.)*s_l[l+1]*y[pv->index_pt_l3_idr+1]);
-            if (pba->has_idm_dr == _TRUE_)
+            if (has_idm_dr == _TRUE_)
               dy[pv->index_pt_l3_idr]-= (ppt->alpha_idm_dr[l-2]*dmu_idm_dr + ppt->beta_idr[l-2]*dmu_idr)*y[pv->index_pt_l3_idr];
 
             /** - ----> exact idr l>3 */
             for (l = 4; l < pv->l_max_idr; l++) {
               dy[pv->index_pt_delta_idr+l] = k/(2.*l+1)*(l*s_l[l]*y[pv->index_pt_delta_idr+l-1]-(l+1.)*s_l[l+1]*y[pv->index_pt_delta_idr+l+1]);
-              if (pba->has_idm_dr == _TRUE_)
+              if (has_idm_dr == _TRUE_)
                 dy[pv->index_pt_delta_idr+l]-= (ppt->alpha_idm_dr[l-2]*dmu_idm_dr + ppt->beta_idr[l-2]*dmu_idr)*y[pv->index_pt_delta_idr+l];
             }
 
             /** - ----> exact idr lmax_dr */
             l = pv->l_max_idr;
             dy[pv->index_pt_delta_idr+l] = k*(s_l[l]*y[pv->index_pt_delta_idr+l-1]-(1.+l)*cotKgen*y[pv->index_pt_delta_idr+l]);
-            if (pba->has_idm_dr == _TRUE_)
+            if (has_idm_dr == _TRUE_)
               dy[pv->index_pt_delta_idr+l]-= (ppt->alpha_idm_dr[l-2]*dmu_idm_dr + ppt->beta_idr[l-2]*dmu_idr)*y[pv->index_pt_delta_idr+l];
           }
         }
@@ -10633,7 +14041,7 @@ int perturb_derivs(double tau,
 
     /** - ---> non-cold dark matter (ncdm): massive neutrinos, WDM, etc. */
     //TBC: curvature in all ncdm
-    if (pba->has_ncdm == _TRUE_) {
+    if (has_ncdm == _TRUE_) {
 
       idx = pv->index_pt_psi0_ncdm1;
 
@@ -10748,9 +14156,8 @@ int perturb_derivs(double tau,
 
             /** - -----> ncdm l>3 for given momentum bin */
 
-            for(l=3; l<pv->l_max_ncdm[n_ncdm]; l++){
-              dy[idx+l] = qk_div_epsilon/(2.*l+1.0)*(l*s_l[l]*y[idx+(l-1)]-(l+1.)*s_l[l+1]*y[idx+(l+1)]);
-            }
+            l = pv->l_max_ncdm[n_ncdm];
+            perturb_hierarchy_free_streaming(qk_div_epsilon,y+idx,dy+idx,ppw->s_l_minus,ppw->s_l_plus,3,l);
 
             /** - -----> ncdm lmax for given momentum bin (truncation as in Ma and Bertschinger)
                 but with curvature taken into account a la arXiv:1305.3261 */
@@ -10767,7 +14174,7 @@ int perturb_derivs(double tau,
 
     /** - ---> Scalar-mediated long range interaction*/
     //TBC: curvature in all lrs
-    if (pba->has_lrs == _TRUE_) {
+    if (has_lrs == _TRUE_) {
       
       idx = pv->index_pt_psi0_lrs;
 
@@ -10792,17 +14199,13 @@ int perturb_derivs(double tau,
 	// Background quantities
 	double phi_M = ppw->pvecback[pba->index_bg_phi_M_lrs]; // Background phi*M [eV^2]
 	double phi_M_prime = ppw->pvecback[pba->index_bg_phi_M_prime_lrs]; // Background phi_prime [eV/Mpc]
-	double phi_M_dot_over_H = phi_M_prime / a_prime_over_a; // Background phi*M_dot/H [eV]
 	double g_over_M_mT = pba->lrs_g_over_M/((ppw->pvecback[pba->index_bg_mT_over_T0_lrs]/pba->lrs_m_F_over_T0)*pba->lrs_m_F); // [eV^-2]
-	double T_F = pba->T_cmb*pba->lrs_T_F/(a/pba->a_today)*_k_B_/_eV_; // [eV]
         
         rho_lrs_bg = pvecback[pba->index_bg_rho_lrs_F]; /* background density */
         p_lrs_bg = pvecback[pba->index_bg_p_lrs_F]; /* background pressure */
         pseudo_p_lrs = pvecback[pba->index_bg_pseudo_p_lrs_F]; /* pseudo-pressure (see CLASS IV paper) */
-        w_lrs = p_lrs_bg/rho_lrs_bg; /* equation of state parameter */
-        ca2_lrs = w_lrs * (5.0 - pseudo_p_lrs/p_lrs_bg +
-			   1/g_over_M_mT * phi_M_dot_over_H /(3*p_lrs_bg/_eV4_to_rho_class) * ppw->pvecback[pba->index_bg_MTsq_over_Msq_lrs]) /
-	  (3*(1 + w_lrs) + phi_M * phi_M_dot_over_H / (rho_lrs_bg/_eV4_to_rho_class));  /* adiabatic sound speed: p_prime/rho_prime */
+        w_lrs = ppw->pvecback[pba->index_bg_w_lrs_F]; /* equation of state parameter */
+        ca2_lrs = ppw->pvecback[pba->index_bg_ca2_lrs_F];  /* adiabatic sound speed: p_prime/rho_prime */
         
         /* c_eff is (delta p / delta rho) in the gauge under
            consideration (not in the gauge comoving with the
@@ -10879,7 +14282,9 @@ int perturb_derivs(double tau,
       else if (pba->has_lrs_nuggets == _FALSE_ || ppw->approx[ppw->index_ap_lrsnug] == (int)lrsnug_off) {
 
         /** - -----> loop over momentum */
-        double T0_F = pba->T_cmb*pba->lrs_T_F*_k_B_/_eV_; // [eV]
+        class_call(perturb_lrs_momentum_cache(pba,ppw),
+                   error_message,
+                   error_message);
 
         for (index_q=0; index_q < pv->q_size_lrs; index_q++) {
 
@@ -10887,8 +14292,8 @@ int perturb_derivs(double tau,
 
           dlnf0_dlnq = pba->dlnf0_dlnq_lrs[index_q];
           q = pba->q_lrs[index_q];
-          epsilon = sqrt(q*q+a2*pvecback[pba->index_bg_mT_over_T0_lrs]*pvecback[pba->index_bg_mT_over_T0_lrs]);
-          qk_div_epsilon = k*q/epsilon;
+          epsilon = ppw->lrs_epsilon[index_q];
+          qk_div_epsilon = k*q*ppw->lrs_inv_epsilon[index_q];
 
           /** - -----> lrs density for given momentum bin */
 
@@ -10898,7 +14303,7 @@ int perturb_derivs(double tau,
 
           dy[idx+1] = qk_div_epsilon/3.0*(y[idx] - 2*s_l[2]*y[idx+2])
             -epsilon*metric_euler/(3*q*k)*dlnf0_dlnq
-            -(1/3.)*a2*pvecback[pba->index_bg_mT_over_T0_lrs]*k/(q*epsilon)*pba->lrs_g_over_M*dlnf0_dlnq*delta_phi_M/SQR(pba->a_today)/T0_F;
+            -(1/3.)*a2*pvecback[pba->index_bg_mT_over_T0_lrs]*k/(q*epsilon)*pba->lrs_g_over_M*dlnf0_dlnq*delta_phi_M/SQR(pba->a_today)/pba->lrs_T0_F;
 
           /** - -----> lrs shear for given momentum bin */
 
@@ -10907,9 +14312,8 @@ int perturb_derivs(double tau,
 
           /** - -----> lrs l>3 for given momentum bin */
 
-          for(l=3; l<pv->l_max_lrs; l++){
-            dy[idx+l] = qk_div_epsilon/(2.*l+1.0)*(l*s_l[l]*y[idx+(l-1)]-(l+1.)*s_l[l+1]*y[idx+(l+1)]);
-          }
+          l = pv->l_max_lrs;
+          perturb_hierarchy_free_streaming(qk_div_epsilon,y+idx,dy+idx,ppw->s_l_minus,ppw->s_l_plus,3,l);
 
           /** - -----> lrs lmax for given momentum bin (truncation as in Ma and Bertschinger)
               but with curvature taken into account a la arXiv:1305.3261 */
@@ -10922,7 +14326,21 @@ int perturb_derivs(double tau,
         }
       }
 
-      /** - ----> third case: use CDM-like equation for nuggets */
+      /** - ----> third case: nuggets, evolved as an offset to CDM */
+
+      else if (ppw->lrs_nugget_cdm_offset == _TRUE_) {
+
+        /** - -----> offset of the density contrast to the CDM one:
+            since nuggets and CDM obey the same equations, it is only
+            sourced by the velocity offset, which decays as 1/a */
+        dy[idx] = -ppw->lrs_nugget_theta_offset_a * pba->a_today/a;
+
+	/** - -----> jump to next species */
+
+        idx += pv->l_max_lrs+1;
+      }
+
+      /** - ----> fourth case: use CDM-like equation for nuggets */
 
       else {
 	rho_lrs_bg = pvecback[pba->index_bg_rho_lrs_F]; /* background density */
@@ -10944,13 +14362,13 @@ int perturb_derivs(double tau,
 
     /** - ---> eta of synchronous gauge */
 
-    if (ppt->gauge == synchronous) {
+    if (gauge == synchronous) {
 
       dy[pv->index_pt_eta] = pvecmetric[ppw->index_mt_eta_prime];
 
     }
 
-    if (ppt->gauge == newtonian) {
+    if (gauge == newtonian) {
 
       dy[pv->index_pt_phi] = pvecmetric[ppw->index_mt_phi_prime];
 
@@ -10968,14 +14386,14 @@ int perturb_derivs(double tau,
 
     /** - --> baryon velocity */
 
-    if (ppt->gauge == synchronous) {
+    if (gauge == synchronous) {
 
       dy[pv->index_pt_theta_b] = -(1-3.*cb2)*a_prime_over_a*y[pv->index_pt_theta_b]
         - pvecthermo[pth->index_th_dkappa]*(_SQRT2_/4.*delta_g + y[pv->index_pt_theta_b]);
 
     }
 
-    else if (ppt->gauge == newtonian) {
+    else if (gauge == newtonian) {
 
       dy[pv->index_pt_theta_b] = -(1-3.*cb2)*a_prime_over_a*y[pv->index_pt_theta_b]
         - _SQRT2_/4.*pvecthermo[pth->index_th_dkappa]*(delta_g+2.*_SQRT2_*y[pv->index_pt_theta_b])
@@ -11002,7 +14420,7 @@ int perturb_derivs(double tau,
                        +10./7.*y[pv->index_pt_pol2_g]
                        -4./7.*y[pv->index_pt_pol0_g+4]);
 
-    if (ppt->gauge == synchronous) {
+    if (gauge == synchronous) {
 
       /* photon density (delta_g = F_0) */
       dy[pv->index_pt_delta_g] =
@@ -11017,7 +14435,7 @@ int perturb_derivs(double tau,
 
     }
 
-    else if (ppt->gauge == newtonian) {
+    else if (gauge == newtonian) {
 
       /* photon density (delta_g = F_0) */
       dy[pv->index_pt_delta_g] =
@@ -11080,13 +14498,13 @@ int perturb_derivs(double tau,
       }
     */
 
-    if (ppt->gauge == synchronous) {
+    if (gauge == synchronous) {
 
       /* Vector metric perturbation in synchronous gauge: */
       dy[pv->index_pt_hv_prime] = pvecmetric[ppw->index_mt_hv_prime_prime];
 
     }
-    else if (ppt->gauge == newtonian){
+    else if (gauge == newtonian){
 
       /* Vector metric perturbation in Newtonian gauge: */
       dy[pv->index_pt_V] = pvecmetric[ppw->index_mt_V_prime];
@@ -11237,9 +14655,8 @@ int perturb_derivs(double tau,
 
           /** - ----> ncdm l>0 for given momentum bin */
 
-          for(l=1; l<pv->l_max_ncdm[n_ncdm]; l++){
-            dy[idx+l] = qk_div_epsilon/(2.*l+1.0)*(l*s_l[l]*y[idx+(l-1)]-(l+1.)*s_l[l+1]*y[idx+(l+1)]);
-          }
+          l = pv->l_max_ncdm[n_ncdm];
+          perturb_hierarchy_free_streaming(qk_div_epsilon,y+idx,dy+idx,ppw->s_l_minus,ppw->s_l_plus,1,l);
 
           /** - ----> ncdm lmax for given momentum bin (truncation as in Ma and Bertschinger)
               but with curvature taken into account a la arXiv:1305.3261 */
@@ -11260,6 +14677,10 @@ int perturb_derivs(double tau,
 
       idx = pv->index_pt_psi0_lrs;
 
+      class_call(perturb_lrs_momentum_cache(pba,ppw),
+                 error_message,
+                 error_message);
+
       /** - ----> loop over momentum */
 
       for (index_q=0; index_q < pv->q_size_lrs; index_q++) {
@@ -11268,8 +14689,7 @@ int perturb_derivs(double tau,
 
         dlnf0_dlnq = pba->dlnf0_dlnq_lrs[index_q];
         q = pba->q_lrs[index_q];
-        epsilon = sqrt(q*q+a2*pvecback[pba->index_bg_mT_over_T0_lrs]*pvecback[pba->index_bg_mT_over_T0_lrs]);
-        qk_div_epsilon = k*q/epsilon;
+        qk_div_epsilon = k*q*ppw->lrs_inv_epsilon[index_q];
 
         /** - ----> lrs density for given momentum bin */
 
@@ -11277,9 +14697,8 @@ int perturb_derivs(double tau,
 
         /** - ----> lrs l>0 for given momentum bin */
 
-        for(l=1; l<pv->l_max_lrs; l++){
-          dy[idx+l] = qk_div_epsilon/(2.*l+1.0)*(l*s_l[l]*y[idx+(l-1)]-(l+1.)*s_l[l+1]*y[idx+(l+1)]);
-        }
+        l = pv->l_max_lrs;
+        perturb_hierarchy_free_streaming(qk_div_epsilon,y+idx,dy+idx,ppw->s_l_minus,ppw->s_l_plus,1,l);
 
         /** - ----> lrs lmax for given momentum bin (truncation as in Ma and Bertschinger)
             but with curvature taken into account a la arXiv:1305.3261 */
@@ -11300,9 +14719,139 @@ int perturb_derivs(double tau,
 
   }
 
+  class_profile_stop(profile_perturb_derivs);
+  return _SUCCESS_;
+}
+
+/**
+ * Compute derivative of all perturbations to be integrated
+ *
+ * For each mode (scalar/vector/tensor) and each wavenumber k, this
+ * function computes the derivative of all values in the vector of
+ * perturbed variables to be integrated.
+ *
+ * This is one of the few functions in the code which is passed to the generic_integrator() routine.
+ * Since generic_integrator() should work with functions passed from various modules, the format of the arguments
+ * is a bit special:
+ * - fixed parameters and workspaces are passed through a generic pointer.
+ *   generic_integrator() doesn't know what the content of this pointer is.
+ * - errors are not written as usual in pth->error_message, but in a generic
+ *   error_message passed in the list of arguments.
+ *
+ * @param tau                      Input: conformal time
+ * @param y                        Input: vector of perturbations
+ * @param dy                       Output: vector of its derivatives (already allocated)
+ * @param parameters_and_workspace Input/Output: in input, fixed parameters (e.g. indices); in output, background and thermo quantities evaluated at tau.
+ * @param error_message            Output: error message
+ */
+
+int perturb_derivs(double tau,
+                   double * y,
+                   double * dy,
+                   void * parameters_and_workspace,
+                   ErrorMsg error_message
+                   ) {
+
+  struct perturb_parameters_and_workspace * pppaw = parameters_and_workspace;
+  struct background * pba = pppaw->pba;
+
+  return perturb_derivs_kernel(tau,y,dy,parameters_and_workspace,error_message,
+                               pppaw->ppt->gauge,
+                               pba->has_ncdm,
+                               pba->has_lrs,
+                               pba->has_idr,
+                               pba->has_idm_dr,
+                               pba->has_scf,
+                               pba->has_fld,
+                               pba->has_dcdm,
+                               pba->has_dr);
+}
+
+/**
+ * Specialized versions of perturb_derivs() for the most common
+ * configurations: the gauge and the species which are present are
+ * constants, so that the compiler removes the tests on them and the
+ * code of the absent species. The rarer species (idr, idm_dr, scf, fld,
+ * dcdm, dr) are absent from all of them.
+ */
+
+#define perturb_derivs_specialized(name,gauge,has_ncdm,has_lrs)         \
+  static int name(double tau,                                           \
+                  double * y,                                           \
+                  double * dy,                                          \
+                  void * parameters_and_workspace,                      \
+                  ErrorMsg error_message) {                             \
+    return perturb_derivs_kernel(tau,y,dy,parameters_and_workspace,error_message, \
+                                 gauge,has_ncdm,has_lrs,                \
+                                 _FALSE_,_FALSE_,_FALSE_,_FALSE_,_FALSE_,_FALSE_); \
+  }
+
+perturb_derivs_specialized(perturb_derivs_synchronous,synchronous,_FALSE_,_FALSE_)
+perturb_derivs_specialized(perturb_derivs_synchronous_ncdm,synchronous,_TRUE_,_FALSE_)
+perturb_derivs_specialized(perturb_derivs_synchronous_lrs,synchronous,_FALSE_,_TRUE_)
+perturb_derivs_specialized(perturb_derivs_synchronous_ncdm_lrs,synchronous,_TRUE_,_TRUE_)
+perturb_derivs_specialized(perturb_derivs_newtonian,newtonian,_FALSE_,_FALSE_)
+perturb_derivs_specialized(perturb_derivs_newtonian_ncdm,newtonian,_TRUE_,_FALSE_)
+perturb_derivs_specialized(perturb_derivs_newtonian_lrs,newtonian,_FALSE_,_TRUE_)
+perturb_derivs_specialized(perturb_derivs_newtonian_ncdm_lrs,newtonian,_TRUE_,_TRUE_)
+
+/**
+ * Select the version of perturb_derivs() to be passed to the evolver:
+ * a specialized one if the configuration is one of the common ones,
+ * the generic perturb_derivs() otherwise. The results are the same.
+ *
+ * @param pba    Input: pointer to background structure
+ * @param ppt    Input: pointer to the perturbation structure
+ * @param derivs Output: the function computing the derivatives
+ * @param name   Output: name of this function (or NULL)
+ * @return the error status
+ */
+
+int perturb_derivs_select(
+                          struct background * pba,
+                          struct perturbs * ppt,
+                          int (**derivs)(double tau,
+                                         double * y,
+                                         double * dy,
+                                         void * parameters_and_workspace,
+                                         ErrorMsg error_message),
+                          const char ** name
+                          ) {
+
+  int index_kernel;
+
+  /* specialized versions, in the order (gauge, has_ncdm, has_lrs) of their index */
+  int (*kernel[8])(double, double *, double *, void *, ErrorMsg) = {
+    perturb_derivs_synchronous, perturb_derivs_synchronous_lrs,
+    perturb_derivs_synchronous_ncdm, perturb_derivs_synchronous_ncdm_lrs,
+    perturb_derivs_newtonian, perturb_derivs_newtonian_lrs,
+    perturb_derivs_newtonian_ncdm, perturb_derivs_newtonian_ncdm_lrs
+  };
+  const char * kernel_name[8] = {
+    "perturb_derivs_synchronous", "perturb_derivs_synchronous_lrs",
+    "perturb_derivs_synchronous_ncdm", "perturb_derivs_synchronous_ncdm_lrs",
+    "perturb_derivs_newtonian", "perturb_derivs_newtonian_lrs",
+    "perturb_derivs_newtonian_ncdm", "perturb_derivs_newtonian_ncdm_lrs"
+  };
+
+  *derivs = perturb_derivs;
+  *name = "perturb_derivs";
+
+  if ((pba->has_idr == _TRUE_) || (pba->has_idm_dr == _TRUE_) ||
+      (pba->has_scf == _TRUE_) || (pba->has_fld == _TRUE_) ||
+      (pba->has_dcdm == _TRUE_) || (pba->has_dr == _TRUE_) ||
+      ((ppt->gauge != synchronous) && (ppt->gauge != newtonian)))
+    return _SUCCESS_;
+
+  index_kernel = 4*(ppt->gauge == newtonian) + 2*(pba->has_ncdm == _TRUE_) + (pba->has_lrs == _TRUE_);
+
+  *derivs = kernel[index_kernel];
+  *name = kernel_name[index_kernel];
+
   return _SUCCESS_;
 }
 
+
 /**
  * Compute the baryon-photon slip (theta_g - theta_b)' and the photon
  * shear in the tight-coupling approximation
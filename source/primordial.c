@@ -16,14 +16,18 @@
 
 #include "primordial.h"
 
+/** table generated by the last external command (accessed within the critical section external_pk_cache only) */
+static struct external_pk_cache primordial_external_pk_cache = {_FALSE_};
+
 /**
  * Primordial spectra for arbitrary argument and for all initial conditions.
  *
  * This routine evaluates the primordial spectrum at a given value of k by
  * interpolating in the pre-computed table.
  *
- * When k is not in the pre-computed range but the spectrum can be found
- * analytically, it finds it. Otherwise returns an error.
+ * In the case of an analytic spectrum, it computes it directly instead
+ * (for any k), see primordial_spectrum_at_kvec(). Otherwise, when k
+ * is not in the pre-computed range, it returns an error.
  *
  * Can be called in two modes; linear or logarithmic:
  *
@@ -65,6 +69,15 @@ int primordial_spectrum_at_k(
   double lnk;
   int last_index;
 
+  /** - in the case of an analytic spectrum, direct computation */
+
+  if (ppm->primordial_spec_type == analytic_Pk) {
+    class_call(primordial_spectrum_at_kvec(ppm,index_md,mode,&input,1,output),
+               ppm->error_message,
+               ppm->error_message);
+    return _SUCCESS_;
+  }
+
   /** - infer ln(k) from input. In linear mode, reject negative value of input k value. */
 
   if (mode == linear) {
@@ -77,96 +90,162 @@ int primordial_spectrum_at_k(
     lnk = input;
   }
 
-  /** - if ln(k) is not in the interpolation range, return an error, unless
-      we are in the case of a analytic spectrum, for which a direct computation is possible */
+  /** - if ln(k) is not in the interpolation range, return an error */
 
-  if ((lnk > ppm->lnk[ppm->lnk_size-1]) || (lnk < ppm->lnk[0])) {
+  class_test((lnk > ppm->lnk[ppm->lnk_size-1]) || (lnk < ppm->lnk[0]),
+             ppm->error_message,
+             "k=%e out of range [%e : %e]",exp(lnk),exp(ppm->lnk[0]),exp(ppm->lnk[ppm->lnk_size-1]));
 
-    class_test(ppm->primordial_spec_type != analytic_Pk,
-               ppm->error_message,
-               "k=%e out of range [%e : %e]",exp(lnk),exp(ppm->lnk[0]),exp(ppm->lnk[ppm->lnk_size-1]));
+  /** - otherwise, interpolate in the pre-computed table */
 
-    /* direct computation */
+  class_call(array_interpolate_spline(
+                                      ppm->lnk,
+                                      ppm->lnk_size,
+                                      ppm->lnpk[index_md],
+                                      ppm->ddlnpk[index_md],
+                                      ppm->ic_ic_size[index_md],
+                                      lnk,
+                                      &last_index,
+                                      output,
+                                      ppm->ic_ic_size[index_md],
+                                      ppm->error_message),
+             ppm->error_message,
+             ppm->error_message);
 
-    for (index_ic1 = 0; index_ic1 < ppm->ic_size[index_md]; index_ic1++) {
-      for (index_ic2 = index_ic1; index_ic2 < ppm->ic_size[index_md]; index_ic2++) {
+  /* if mode==logarithmic, output is already in the correct format. Otherwise, apply necessary transformation. */
 
-        index_ic1_ic2 = index_symmetric_matrix(index_ic1,index_ic2,ppm->ic_size[index_md]);
+  if (mode == linear) {
 
+    for (index_ic1 = 0; index_ic1 < ppm->ic_size[index_md]; index_ic1++) {
+      index_ic1_ic2 = index_symmetric_matrix(index_ic1,index_ic1,ppm->ic_size[index_md]);
+      output[index_ic1_ic2]=exp(output[index_ic1_ic2]);
+    }
+    for (index_ic1 = 0; index_ic1 < ppm->ic_size[index_md]; index_ic1++) {
+      for (index_ic2 = index_ic1+1; index_ic2 < ppm->ic_size[index_md]; index_ic2++) {
+        index_ic1_ic2 = index_symmetric_matrix(index_ic1,index_ic2,ppm->ic_size[index_md]);
         if (ppm->is_non_zero[index_md][index_ic1_ic2] == _TRUE_) {
-
-          class_call(primordial_analytic_spectrum(ppm,
-                                                  index_md,
-                                                  index_ic1_ic2,
-                                                  exp(lnk),
-                                                  &(output[index_ic1_ic2])),
-                     ppm->error_message,
-                     ppm->error_message);
+          output[index_ic1_ic2] *= sqrt(output[index_symmetric_matrix(index_ic1,index_ic1,ppm->ic_size[index_md])]*
+                                        output[index_symmetric_matrix(index_ic2,index_ic2,ppm->ic_size[index_md])]);
         }
         else {
           output[index_ic1_ic2] = 0.;
         }
       }
     }
+  }
 
-    /* if mode==linear, output is already in the correct format. Otherwise, apply necessary transformation. */
+  return _SUCCESS_;
 
-    if (mode == logarithmic) {
+}
 
-      for (index_ic1 = 0; index_ic1 < ppm->ic_size[index_md]; index_ic1++) {
-        index_ic1_ic2 = index_symmetric_matrix(index_ic1,index_ic1,ppm->ic_size[index_md]);
-        output[index_ic1_ic2] = log(output[index_ic1_ic2]);
-      }
-      for (index_ic1 = 0; index_ic1 < ppm->ic_size[index_md]; index_ic1++) {
-        for (index_ic2 = index_ic1+1; index_ic2 < ppm->ic_size[index_md]; index_ic2++) {
-          index_ic1_ic2 = index_symmetric_matrix(index_ic1,index_ic2,ppm->ic_size[index_md]);
-          if (ppm->is_non_zero[index_md][index_ic1_ic2] == _TRUE_) {
-            output[index_ic1_ic2] /= sqrt(output[index_symmetric_matrix(index_ic1,index_ic1,ppm->ic_size[index_md])]*
-                                          output[index_symmetric_matrix(index_ic2,index_ic2,ppm->ic_size[index_md])]);
-          }
-        }
-      }
+/**
+ * Primordial spectra for an array of arguments and for all initial
+ * conditions, in the same two modes as primordial_spectrum_at_k().
+ *
+ * In the case of an analytic spectrum, the power law with running
+ * \f$ A (k/k_*)^{n-1+\alpha \ln(k/k_*)/2} \f$ of each mode and pair of
+ * initial conditions is evaluated directly, in a loop over k which
+ * the compiler can vectorize, without table or search. Otherwise,
+ * each k is interpolated in the pre-computed table with
+ * primordial_spectrum_at_k().
+ *
+ * @param ppm        Input: pointer to primordial structure
+ * @param index_md   Input: index of mode (scalar, tensor, ...)
+ * @param mode       Input: linear or logarithmic
+ * @param input      Input: array of wavenumbers in 1/Mpc (linear mode) or of their logarithms (logarithmic mode)
+ * @param input_size Input: size of this array
+ * @param output     Output: primordial spectra output[index_input*ppm->ic_ic_size[index_md]+index_ic1_ic2], in the format of primordial_spectrum_at_k() (must be already allocated)
+ * @return the error status
+ */
+
+int primordial_spectrum_at_kvec(
+                                struct primordial * ppm,
+                                int index_md,
+                                enum linear_or_logarithmic mode,
+                                double * input,
+                                int input_size,
+                                double * output
+                                ) {
+
+  int index_input;
+  int index_ic1,index_ic2,index_ic1_ic1,index_ic2_ic2,index_ic1_ic2;
+  int ic_size = ppm->ic_size[index_md];
+  int ic_ic_size = ppm->ic_ic_size[index_md];
+  double amplitude,tilt_minus_one,half_running,ln_k_pivot,x;
+
+  /** - other spectra are interpolated one k after the other */
+
+  if (ppm->primordial_spec_type != analytic_Pk) {
+    for (index_input=0; index_input<input_size; index_input++) {
+      class_call(primordial_spectrum_at_k(ppm,index_md,mode,input[index_input],output+index_input*ic_ic_size),
+                 ppm->error_message,
+                 ppm->error_message);
     }
+    return _SUCCESS_;
   }
 
-  /** - otherwise, interpolate in the pre-computed table */
+  if (mode == linear) {
+    for (index_input=0; index_input<input_size; index_input++) {
+      class_test(input[index_input]<=0.,
+                 ppm->error_message,
+                 "k = %e",input[index_input]);
+    }
+  }
 
-  else {
+  ln_k_pivot = log(ppm->k_pivot);
 
-    class_call(array_interpolate_spline(
-                                        ppm->lnk,
-                                        ppm->lnk_size,
-                                        ppm->lnpk[index_md],
-                                        ppm->ddlnpk[index_md],
-                                        ppm->ic_ic_size[index_md],
-                                        lnk,
-                                        &last_index,
-                                        output,
-                                        ppm->ic_ic_size[index_md],
-                                        ppm->error_message),
-               ppm->error_message,
-               ppm->error_message);
+  /** - analytic spectra: direct computation, for each pair of initial
+      conditions. The diagonal elements are written directly in
+      logarithmic form if needed */
 
-    /* if mode==logarithmic, output is already in the correct format. Otherwise, apply necessary transformation. */
+  for (index_ic1_ic2 = 0; index_ic1_ic2 < ic_ic_size; index_ic1_ic2++) {
 
-    if (mode == linear) {
+    if (ppm->is_non_zero[index_md][index_ic1_ic2] == _FALSE_) {
+      for (index_input=0; index_input<input_size; index_input++)
+        output[index_input*ic_ic_size+index_ic1_ic2] = 0.;
+      continue;
+    }
+
+    amplitude = ppm->amplitude[index_md][index_ic1_ic2];
+    tilt_minus_one = ppm->tilt[index_md][index_ic1_ic2]-1.;
+    half_running = 0.5*ppm->running[index_md][index_ic1_ic2];
 
-      for (index_ic1 = 0; index_ic1 < ppm->ic_size[index_md]; index_ic1++) {
-        index_ic1_ic2 = index_symmetric_matrix(index_ic1,index_ic1,ppm->ic_size[index_md]);
-        output[index_ic1_ic2]=exp(output[index_ic1_ic2]);
+    if (mode == linear) {
+#pragma omp simd private(x)
+      for (index_input=0; index_input<input_size; index_input++) {
+        x = log(input[index_input])-ln_k_pivot;
+        output[index_input*ic_ic_size+index_ic1_ic2] = amplitude*exp((tilt_minus_one + half_running*x)*x);
+      }
+    }
+    else {
+#pragma omp simd private(x)
+      for (index_input=0; index_input<input_size; index_input++) {
+        x = input[index_input]-ln_k_pivot;
+        output[index_input*ic_ic_size+index_ic1_ic2] = amplitude*exp((tilt_minus_one + half_running*x)*x);
       }
-      for (index_ic1 = 0; index_ic1 < ppm->ic_size[index_md]; index_ic1++) {
-        for (index_ic2 = index_ic1+1; index_ic2 < ppm->ic_size[index_md]; index_ic2++) {
-          index_ic1_ic2 = index_symmetric_matrix(index_ic1,index_ic2,ppm->ic_size[index_md]);
+    }
+  }
+
+  /** - in logarithmic mode, convert to the logarithms of the diagonal
+      elements and the cross-correlation angles */
+
+  if (mode == logarithmic) {
+    for (index_input=0; index_input<input_size; index_input++) {
+      for (index_ic1 = 0; index_ic1 < ic_size; index_ic1++) {
+        for (index_ic2 = index_ic1+1; index_ic2 < ic_size; index_ic2++) {
+          index_ic1_ic2 = index_symmetric_matrix(index_ic1,index_ic2,ic_size);
           if (ppm->is_non_zero[index_md][index_ic1_ic2] == _TRUE_) {
-            output[index_ic1_ic2] *= sqrt(output[index_symmetric_matrix(index_ic1,index_ic1,ppm->ic_size[index_md])]*
-                                          output[index_symmetric_matrix(index_ic2,index_ic2,ppm->ic_size[index_md])]);
-          }
-          else {
-            output[index_ic1_ic2] = 0.;
+            index_ic1_ic1 = index_symmetric_matrix(index_ic1,index_ic1,ic_size);
+            index_ic2_ic2 = index_symmetric_matrix(index_ic2,index_ic2,ic_size);
+            output[index_input*ic_ic_size+index_ic1_ic2] /= sqrt(output[index_input*ic_ic_size+index_ic1_ic1]*
+                                                                 output[index_input*ic_ic_size+index_ic2_ic2]);
           }
         }
       }
+      for (index_ic1 = 0; index_ic1 < ic_size; index_ic1++) {
+        index_ic1_ic1 = index_symmetric_matrix(index_ic1,index_ic1,ic_size);
+        output[index_input*ic_ic_size+index_ic1_ic1] = log(output[index_input*ic_ic_size+index_ic1_ic1]);
+      }
     }
   }
 
@@ -201,12 +280,20 @@ int primordial_init(
      (for correlated isocurvature modes) */
   //double cos_delta_k;
 
+  /* size of the heap at the beginning (see class_memory_heap()) */
+  size_t heap_start;
+
+  class_profile_start(profile_primordial_init);
+  heap_start = class_memory_heap();
+
   /** - check that we really need to compute the primordial spectra */
 
-  if (ppt->has_perturbations == _FALSE_) {
+  if ((ppt->has_perturbations == _FALSE_) || (ppt->k_output_values_only == _TRUE_)) {
     ppm->lnk_size=0;
     if (ppm->primordial_verbose > 0)
       printf("No perturbations requested. Primordial module skipped.\n");
+    ppm->memory_size = class_memory_growth(heap_start);
+    class_profile_stop(profile_primordial_init);
     return _SUCCESS_;
   }
   else {
@@ -535,6 +622,8 @@ int primordial_init(
 
   }
 
+  ppm->memory_size = class_memory_growth(heap_start);
+  class_profile_stop(profile_primordial_init);
   return _SUCCESS_;
 
 }
@@ -1576,7 +1665,11 @@ int primordial_inflation_analytic_spectra(
 
 /**
  * Routine with a loop over wavenumbers for the computation of the primordial
- * spectrum. For each wavenumber it calls primordial_inflation_one_wavenumber()
+ * spectrum. The background is first evolved once, with
+ * primordial_inflation_background_at_k_ini(), up to the initial time of
+ * each wavenumber; then, for each wavenumber, it calls
+ * primordial_inflation_one_wavenumber() in parallel, starting from the
+ * stored background values.
  *
  * @param ppt   Input: pointer to perturbation structure
  * @param ppm   Input/output: pointer to primordial structure
@@ -1592,6 +1685,7 @@ int primordial_inflation_spectra(
                                  double * y_ini
                                  ) {
   int index_k;
+  double * y_bg_ini;
 
   /* number of threads (always one if no openmp) */
   int number_of_threads=1;
@@ -1610,6 +1704,7 @@ int primordial_inflation_spectra(
   /* instrumentation times */
   double tstart, tstop, tspent;
 #endif
+  struct parallel_timer timer;
 
 #ifdef _OPENMP
 
@@ -1619,9 +1714,21 @@ int primordial_inflation_spectra(
   }
 #endif
 
+  /** - evolve the background once (serially) until the initial time
+      of each wavenumber, and store the background variables at each
+      of these times; the threads only need to read them */
+  class_alloc(y_bg_ini,ppm->lnk_size*ppm->in_bg_size*sizeof(double),ppm->error_message);
+
+  class_call_except(primordial_inflation_background_at_k_ini(ppm,ppr,y_ini,y_bg_ini),
+                    ppm->error_message,
+                    ppm->error_message,
+                    free(y_bg_ini));
+
   abort = _FALSE_;
 
-#pragma omp parallel shared(ppt,ppm,ppr,abort,y_ini) private(index_k,thread,tspent,tstart,tstop) num_threads(number_of_threads)
+  parallel_timer_start(&timer);
+
+#pragma omp parallel shared(ppt,ppm,ppr,abort,y_bg_ini,timer) private(index_k,thread,tspent,tstart,tstop) num_threads(number_of_threads)
 
   {
 
@@ -1630,7 +1737,7 @@ int primordial_inflation_spectra(
     tspent=0.;
 #endif
 
-#pragma omp for schedule (dynamic)
+#pragma omp for schedule (dynamic) nowait
 
     /* loop over Fourier wavenumbers */
     for (index_k=0; index_k < ppm->lnk_size; index_k++) {
@@ -1639,7 +1746,7 @@ int primordial_inflation_spectra(
       tstart = omp_get_wtime();
 #endif
 
-      class_call_parallel(primordial_inflation_one_wavenumber(ppt,ppm,ppr,y_ini,index_k),
+      class_call_parallel(primordial_inflation_one_wavenumber(ppt,ppm,ppr,y_bg_ini+index_k*ppm->in_bg_size,index_k),
                           ppm->error_message,
                           ppm->error_message);
 
@@ -1657,8 +1764,14 @@ int primordial_inflation_spectra(
              __func__,tspent,thread);
 #endif
 
+    parallel_timer_thread_done(&timer);
+
   } /* end of parallel zone */
 
+  parallel_timer_stop(&timer,"primordial_inflation_spectra: k loop");
+
+  free(y_bg_ini);
+
   if (abort == _TRUE_) return _FAILURE_;
 
   ppm->is_non_zero[ppt->index_md_scalars][ppt->index_ic_ad] = _TRUE_;
@@ -1668,6 +1781,160 @@ int primordial_inflation_spectra(
 
 }
 
+/**
+ * Evolve the background forward, starting from y_ini, until the initial
+ * time of the integration of perturbations for each wavenumber, i.e.
+ * until aH = k/ratio_min, and store the background variables at each of
+ * these times.
+ *
+ * This is equivalent to calling primordial_inflation_evolve_background()
+ * from y_ini for each wavenumber (with target _aH_, direction forward and
+ * conformal time), but the background is integrated only once. Since
+ * the time steps only depend on the current background variables, the
+ * steps taken before reaching each target are the same as in separate
+ * integrations. The last step towards each target is done with the
+ * same trapezoidal integral, applied to a copy of the running vector,
+ * so the integration continues from the last regular step.
+ *
+ * @param ppm      Input: pointer to primordial structure
+ * @param ppr      Input: pointer to precision structure
+ * @param y_ini    Input: initial conditions for the vector of background variables
+ * @param y_bg_ini Output: background variables at the initial time of each wavenumber, of size lnk_size*in_bg_size, already allocated
+ * @return the error status
+ */
+
+int primordial_inflation_background_at_k_ini(
+                                             struct primordial * ppm,
+                                             struct precision * ppr,
+                                             double * y_ini,
+                                             double * y_bg_ini
+                                             ) {
+
+  struct primordial_inflation_parameters_and_workspace pipaw;
+  struct generic_integrator_workspace gi;
+  double * y;
+  double * dy;
+  double * y_k;
+  double tau_start,tau_end,dtau,dtau_last;
+  double quantity,stop;
+  double V,dV,ddV,H,dH,ddH,dddH;
+  int index_k,index_bg;
+
+  pipaw.ppm = ppm;
+  pipaw.N = ppm->in_bg_size;
+  pipaw.integrate = forward;
+  pipaw.time = conformal;
+
+  class_alloc(y,ppm->in_bg_size*sizeof(double),ppm->error_message);
+  class_alloc(dy,ppm->in_bg_size*sizeof(double),ppm->error_message);
+
+  for (index_bg=0; index_bg<ppm->in_bg_size; index_bg++)
+    y[index_bg] = y_ini[index_bg];
+
+  class_call(initialize_generic_integrator(pipaw.N,&gi),
+             gi.error_message,
+             ppm->error_message);
+
+  /* at starting point, compute the stepsize dtau and the expected
+     value of aH after the next step (see
+     primordial_inflation_evolve_background()) */
+
+  tau_end = 0;
+
+  class_call(primordial_inflation_derivs(tau_end,y,dy,&pipaw,ppm->error_message),
+             ppm->error_message,
+             ppm->error_message);
+
+  if ((ppm->primordial_spec_type == inflation_V) || (ppm->primordial_spec_type == inflation_V_end))
+    dtau = ppr->primordial_inflation_bg_stepsize
+      *MIN(y[ppm->index_in_a]/dy[ppm->index_in_a],fabs(y[ppm->index_in_dphi]/dy[ppm->index_in_dphi]));
+  else
+    dtau = ppr->primordial_inflation_bg_stepsize*y[ppm->index_in_a]/dy[ppm->index_in_a];
+
+  quantity = dy[ppm->index_in_a] * (1.+ dy[ppm->index_in_a]/y[ppm->index_in_a] * dtau) / y[ppm->index_in_a];
+
+  /* the targets aH = k/ratio_min increase with k */
+
+  for (index_k=0; index_k < ppm->lnk_size; index_k++) {
+
+    stop = exp(ppm->lnk[index_k])/ppr->primordial_inflation_ratio_min;
+
+    /* loop over time steps, checking that there will be no overshooting */
+
+    while (quantity - stop < 0.) {
+
+      /* check that V(phi) or H(phi) do not take forbidden values
+         (negative or positive derivative) */
+
+      if ((ppm->primordial_spec_type == inflation_V) || (ppm->primordial_spec_type == inflation_V_end)) {
+        class_call(primordial_inflation_check_potential(ppm,y[ppm->index_in_phi],&V,&dV,&ddV),
+                   ppm->error_message,
+                   ppm->error_message);
+      }
+      else {
+        class_call(primordial_inflation_check_hubble(ppm,y[ppm->index_in_phi],&H,&dH,&ddH,&dddH),
+                   ppm->error_message,
+                   ppm->error_message);
+      }
+
+      /* take one time step */
+
+      tau_start = tau_end;
+
+      tau_end = tau_start + dtau;
+
+      class_test(fabs(dtau/tau_start) < ppr->smallest_allowed_variation,
+                 ppm->error_message,
+                 "integration step: relative change in time =%e < machine precision : leads either to numerical error or infinite loop",dtau/tau_start);
+
+      class_call(generic_integrator(primordial_inflation_derivs,
+                                    tau_start,
+                                    tau_end,
+                                    y,
+                                    &pipaw,
+                                    ppr->primordial_inflation_tol_integration,
+                                    ppr->smallest_allowed_variation,
+                                    &gi),
+                 gi.error_message,
+                 ppm->error_message);
+
+      /* recompute new value of next conformal time step */
+
+      class_call(primordial_inflation_derivs(tau_end,y,dy,&pipaw,ppm->error_message),
+                 ppm->error_message,
+                 ppm->error_message);
+
+      if ((ppm->primordial_spec_type == inflation_V) || (ppm->primordial_spec_type == inflation_V_end))
+        dtau = ppr->primordial_inflation_bg_stepsize
+          *MIN(y[ppm->index_in_a]/dy[ppm->index_in_a],fabs(y[ppm->index_in_dphi]/dy[ppm->index_in_dphi]));
+      else
+        dtau = ppr->primordial_inflation_bg_stepsize*y[ppm->index_in_a]/dy[ppm->index_in_a];
+
+      quantity = dy[ppm->index_in_a] * (1.+ dy[ppm->index_in_a]/y[ppm->index_in_a] * dtau) / y[ppm->index_in_a];
+    }
+
+    /* last step with a simple trapezoidal integral, bringing
+       approximately aH to its target, stored without modifying the
+       running vector */
+
+    y_k = y_bg_ini+index_k*ppm->in_bg_size;
+
+    dtau_last = (stop/(dy[ppm->index_in_a]/y[ppm->index_in_a])-1.)/(dy[ppm->index_in_a]/y[ppm->index_in_a]);
+
+    for (index_bg=0; index_bg<ppm->in_bg_size; index_bg++)
+      y_k[index_bg] = y[index_bg] + dy[index_bg]*dtau_last;
+  }
+
+  class_call(cleanup_generic_integrator(&gi),
+             gi.error_message,
+             ppm->error_message);
+
+  free(y);
+  free(dy);
+
+  return _SUCCESS_;
+}
+
 /**
  * Routine coordinating the computation of the primordial
  * spectrum for one wavenumber. It calls primordial_inflation_one_k() to
@@ -1677,7 +1944,7 @@ int primordial_inflation_spectra(
  * @param ppt     Input: pointer to perturbation structure
  * @param ppm     Input/output: pointer to primordial structure
  * @param ppr     Input: pointer to precision structure
- * @param y_ini   Input: initial conditions for the vector of background/perturbations, already allocated and filled
+ * @param y_bg_ini Input: background variables at the initial time of integration of perturbations for this wavenumber
  * @param index_k Input: index of wavenumber to be considered
  * @return the error status
  */
@@ -1686,7 +1953,7 @@ int primordial_inflation_one_wavenumber(
                                         struct perturbs * ppt,
                                         struct primordial * ppm,
                                         struct precision * ppr,
-                                        double * y_ini,
+                                        double * y_bg_ini,
                                         int index_k
                                         ) {
   double k;
@@ -1701,25 +1968,14 @@ int primordial_inflation_one_wavenumber(
   class_alloc(y,ppm->in_size*sizeof(double),ppm->error_message);
   class_alloc(dy,ppm->in_size*sizeof(double),ppm->error_message);
 
-  /** - initialize the background part of the running vector */
-  y[ppm->index_in_a] = y_ini[ppm->index_in_a];
-  y[ppm->index_in_phi] = y_ini[ppm->index_in_phi];
+  /** - initialize the background part of the running vector at the
+      relevant initial time for integrating perturbations (the
+      background has already been evolved until that time by
+      primordial_inflation_background_at_k_ini()) */
+  y[ppm->index_in_a] = y_bg_ini[ppm->index_in_a];
+  y[ppm->index_in_phi] = y_bg_ini[ppm->index_in_phi];
   if ((ppm->primordial_spec_type == inflation_V) || (ppm->primordial_spec_type == inflation_V_end))
-    y[ppm->index_in_dphi] = y_ini[ppm->index_in_dphi];
-
-  /** - evolve the background until the relevant initial time for
-      integrating perturbations */
-  class_call(primordial_inflation_evolve_background(ppm,
-                                                    ppr,
-                                                    y,
-                                                    dy,
-                                                    _aH_,
-                                                    k/ppr->primordial_inflation_ratio_min,
-                                                    _FALSE_,
-                                                    forward,
-                                                    conformal),
-             ppm->error_message,
-             ppm->error_message);
+    y[ppm->index_in_dphi] = y_bg_ini[ppm->index_in_dphi];
 
   /** - evolve the background/perturbation equations from this time and
       until some time after Horizon crossing */
@@ -3255,6 +3511,15 @@ int primordial_inflation_derivs(
  * and stores the tabulated values.
  * The sampling of the k's given by the external command is preserved.
  *
+ * If a function ppm->external_pk_function was passed instead (from C
+ * or from classy), no process is launched: the function fills the
+ * spectra directly at the k's of the table prepared by
+ * primordial_get_lnk_list(). The output of a command is kept in a cache
+ * (see primordial_external_spectrum_cache_restore()), so that running
+ * it again with the same arguments in the same process costs nothing;
+ * commands starting with "cat " are always run, since the file they
+ * read may have changed and reading it is cheap.
+ *
  * Author: Jesus Torrado (torradocacho@lorentz.leidenuniv.nl)
  * Date:   2013-12-20
  *
@@ -3278,98 +3543,148 @@ int primordial_external_spectrum_init(
   double this_k, this_pks, this_pkt;
   int status;
   int index_k;
-
-  /** - Initialization */
-  /* Prepare the data (with some initial size) */
-  n_data_guess = 100;
-  k   = (double *)malloc(n_data_guess*sizeof(double));
-  pks = (double *)malloc(n_data_guess*sizeof(double));
-  if (ppt->has_tensors == _TRUE_)
-    pkt = (double *)malloc(n_data_guess*sizeof(double));
-  /* Prepare the command */
-  /* If the command is just a "cat", no arguments need to be passed */
-  if(strncmp("cat ", ppm->command, 4) == 0) {
-    sprintf(arguments, " ");
+  short is_cat = _FALSE_;
+  short found = _FALSE_;
+
+  /** - If a function was passed, call it at the k's of the primordial table */
+  if (ppm->external_pk_function != NULL) {
+    n_data = ppm->lnk_size;
+    class_alloc(k,n_data*sizeof(double),ppm->error_message);
+    class_alloc(pks,n_data*sizeof(double),ppm->error_message);
+    if (ppt->has_tensors == _TRUE_)
+      class_alloc(pkt,n_data*sizeof(double),ppm->error_message);
+    for (index_k=0; index_k<n_data; index_k++)
+      k[index_k] = exp(ppm->lnk[index_k]);
+    if (ppm->primordial_verbose > 0)
+      printf(" -> calling the external Pk function\n");
+    class_call(ppm->external_pk_function(k,n_data,pks,pkt,ppm->external_pk_parameters,ppm->error_message),
+               ppm->error_message,
+               ppm->error_message);
   }
-  /* otherwise pass the list of arguments */
+
   else {
-    sprintf(arguments, " %g %g %g %g %g %g %g %g %g %g",
-            ppm->custom1, ppm->custom2, ppm->custom3, ppm->custom4, ppm->custom5,
-            ppm->custom6, ppm->custom7, ppm->custom8, ppm->custom9, ppm->custom10);
-  }
-  /* write the actual command in a string */
-  sprintf(command_with_arguments, "%s %s", ppm->command, arguments);
-  if (ppm->primordial_verbose > 0)
-    printf(" -> running: %s\n",command_with_arguments);
-
-  /** - Launch the command and retrieve the output */
-  /* Launch the process */
-  process = popen(command_with_arguments, "r");
-  class_test(process == NULL,
-             ppm->error_message,
-             "The program failed to set the environment for the external command. Maybe you ran out of memory.");
-  /* Read output and store it */
-  while (fgets(line, sizeof(line)-1, process) != NULL) {
-    if (ppt->has_tensors == _TRUE_) {
-      sscanf(line, "%lf %lf %lf", &this_k, &this_pks, &this_pkt);
+
+    class_test(strlen(ppm->command) == 0,
+               ppm->error_message,
+               "You omitted to write a command for the external Pk");
+
+    /** - Initialization */
+    /* Prepare the command */
+    /* If the command is just a "cat", no arguments need to be passed */
+    is_cat = (strncmp("cat ", ppm->command, 4) == 0) ? _TRUE_ : _FALSE_;
+    if (is_cat == _TRUE_) {
+      sprintf(arguments, " ");
     }
+    /* otherwise pass the list of arguments */
     else {
-      sscanf(line, "%lf %lf", &this_k, &this_pks);
+      sprintf(arguments, " %g %g %g %g %g %g %g %g %g %g",
+              ppm->custom1, ppm->custom2, ppm->custom3, ppm->custom4, ppm->custom5,
+              ppm->custom6, ppm->custom7, ppm->custom8, ppm->custom9, ppm->custom10);
     }
-    /* Standard technique in C: if too many data, double the size of the vectors */
-    /* (it is faster and safer that reallocating every new line) */
-    if((n_data+1) > n_data_guess) {
-      n_data_guess *= 2;
-      tmp = (double *)realloc(k,   n_data_guess*sizeof(double));
-      class_test(tmp == NULL,
-                 ppm->error_message,
-                 "Error allocating memory to read the external spectrum.\n");
-      k = tmp;
-      tmp = (double *)realloc(pks, n_data_guess*sizeof(double));
-      class_test(tmp == NULL,
+    /* write the actual command in a string */
+    sprintf(command_with_arguments, "%s %s", ppm->command, arguments);
+
+    /** - Look for the output of the same command in the cache */
+    if (is_cat == _FALSE_) {
+      class_call(primordial_external_spectrum_cache_restore(ppt,ppm,command_with_arguments,&n_data,&k,&pks,&pkt,&found),
                  ppm->error_message,
-                 "Error allocating memory to read the external spectrum.\n");
-      pks = tmp;
+                 ppm->error_message);
+    }
+
+    if ((found == _TRUE_) && (ppm->primordial_verbose > 0))
+      printf(" -> reusing the output of: %s\n",command_with_arguments);
+  }
+
+  if ((ppm->external_pk_function == NULL) && (found == _FALSE_)) {
+
+    /* Prepare the data (with some initial size) */
+    n_data_guess = 100;
+    k   = (double *)malloc(n_data_guess*sizeof(double));
+    pks = (double *)malloc(n_data_guess*sizeof(double));
+    if (ppt->has_tensors == _TRUE_)
+      pkt = (double *)malloc(n_data_guess*sizeof(double));
+    if (ppm->primordial_verbose > 0)
+      printf(" -> running: %s\n",command_with_arguments);
+
+    /** - Launch the command and retrieve the output */
+    /* Launch the process */
+    process = popen(command_with_arguments, "r");
+    class_test(process == NULL,
+               ppm->error_message,
+               "The program failed to set the environment for the external command. Maybe you ran out of memory.");
+    /* Read output and store it */
+    while (fgets(line, sizeof(line)-1, process) != NULL) {
       if (ppt->has_tensors == _TRUE_) {
-        tmp = (double *)realloc(pkt, n_data_guess*sizeof(double));
+        sscanf(line, "%lf %lf %lf", &this_k, &this_pks, &this_pkt);
+      }
+      else {
+        sscanf(line, "%lf %lf", &this_k, &this_pks);
+      }
+      /* Standard technique in C: if too many data, double the size of the vectors */
+      /* (it is faster and safer that reallocating every new line) */
+      if((n_data+1) > n_data_guess) {
+        n_data_guess *= 2;
+        tmp = (double *)realloc(k,   n_data_guess*sizeof(double));
+        class_test(tmp == NULL,
+                   ppm->error_message,
+                   "Error allocating memory to read the external spectrum.\n");
+        k = tmp;
+        tmp = (double *)realloc(pks, n_data_guess*sizeof(double));
         class_test(tmp == NULL,
                    ppm->error_message,
                    "Error allocating memory to read the external spectrum.\n");
-        pkt = tmp;
+        pks = tmp;
+        if (ppt->has_tensors == _TRUE_) {
+          tmp = (double *)realloc(pkt, n_data_guess*sizeof(double));
+          class_test(tmp == NULL,
+                     ppm->error_message,
+                     "Error allocating memory to read the external spectrum.\n");
+          pkt = tmp;
+        };
       };
-    };
-    /* Store */
-    k  [n_data]   = this_k;
-    pks[n_data]   = this_pks;
-    if (ppt->has_tensors == _TRUE_) {
-      pkt[n_data] = this_pkt;
+      /* Store */
+      k  [n_data]   = this_k;
+      pks[n_data]   = this_pks;
+      if (ppt->has_tensors == _TRUE_) {
+        pkt[n_data] = this_pkt;
+      }
+      n_data++;
+      /* Check ascending order of the k's */
+      if(n_data>1) {
+        class_test(k[n_data-1] <= k[n_data-2],
+                   ppm->error_message,
+                   "The k's are not strictly sorted in ascending order, "
+                   "as it is required for the calculation of the splines.\n");
+      }
     }
-    n_data++;
-    /* Check ascending order of the k's */
-    if(n_data>1) {
-      class_test(k[n_data-1] <= k[n_data-2],
+    /* Close the process */
+    status = pclose(process);
+    class_test(status != 0.,
+               ppm->error_message,
+               "The attempt to launch the external command was unsuccessful. "
+               "Try doing it by hand to check for errors.");
+
+    /** - Keep the output for the next runs with the same command */
+    if (is_cat == _FALSE_) {
+      class_call(primordial_external_spectrum_cache_store(ppt,ppm,command_with_arguments,n_data,k,pks,pkt),
                  ppm->error_message,
-                 "The k's are not strictly sorted in ascending order, "
-                 "as it is required for the calculation of the splines.\n");
+                 ppm->error_message);
     }
   }
-  /* Close the process */
-  status = pclose(process);
-  class_test(status != 0.,
-             ppm->error_message,
-             "The attempt to launch the external command was unsuccessful. "
-             "Try doing it by hand to check for errors.");
-  /* Test limits of the k's */
-  class_test(k[1] > ppt->k_min,
-             ppm->error_message,
-             "Your table for the primordial spectrum does not have "
-             "at least 2 points before the minimum value of k: %e . "
-             "The splines interpolation would not be safe.",ppt->k_min);
-  class_test(k[n_data-2] < ppt->k_max,
-             ppm->error_message,
-             "Your table for the primordial spectrum does not have "
-             "at least 2 points after the maximum value of k: %e . "
-             "The splines interpolation would not be safe.",ppt->k_max);
+
+  /* Test limits of the k's (those of the table of a function cover the needed range by construction) */
+  if (ppm->external_pk_function == NULL) {
+    class_test(k[1] > ppt->k_min,
+               ppm->error_message,
+               "Your table for the primordial spectrum does not have "
+               "at least 2 points before the minimum value of k: %e . "
+               "The splines interpolation would not be safe.",ppt->k_min);
+    class_test(k[n_data-2] < ppt->k_max,
+               ppm->error_message,
+               "Your table for the primordial spectrum does not have "
+               "at least 2 points after the maximum value of k: %e . "
+               "The splines interpolation would not be safe.",ppt->k_max);
+  }
 
   /** - Store the read results into CLASS structures */
   ppm->lnk_size = n_data;
@@ -3398,6 +3713,9 @@ int primordial_external_spectrum_init(
   };
   /** - Store values */
   for (index_k=0; index_k<ppm->lnk_size; index_k++) {
+    class_test((pks[index_k] <= 0.) || ((ppt->has_tensors == _TRUE_) && (pkt[index_k] <= 0.)),
+               ppm->error_message,
+               "The external primordial spectrum is not positive at k=%e",k[index_k]);
     ppm->lnk[index_k] = log(k[index_k]);
     ppm->lnpk[ppt->index_md_scalars][index_k] = log(pks[index_k]);
     if (ppt->has_tensors == _TRUE_)
@@ -3423,6 +3741,134 @@ int primordial_external_spectrum_init(
   return _SUCCESS_;
 }
 
+/**
+ * Look for the output of an external command in the cache filled by
+ * a previous run with primordial_external_spectrum_cache_store(). It
+ * is found when the command and its arguments are identical, and when
+ * the table contains the tensor spectrum if it is needed. In that case
+ * k, pks and pkt are allocated and filled with a copy of the table,
+ * like after reading the output of the command.
+ *
+ * @param ppt     Input: pointer to perturbation structure
+ * @param ppm     Input/output: pointer to primordial structure
+ * @param command Input: command with its arguments
+ * @param k_size  Output: number of lines of the table
+ * @param k       Output: wavenumbers (allocated here if found)
+ * @param pks     Output: scalar spectrum (allocated here if found)
+ * @param pkt     Output: tensor spectrum (allocated here if found and if there are tensors)
+ * @param found   Output: _TRUE_ if the table was found in the cache
+ * @return the error status
+ */
+
+int primordial_external_spectrum_cache_restore(
+                                               struct perturbs * ppt,
+                                               struct primordial * ppm,
+                                               char * command,
+                                               int * k_size,
+                                               double ** k,
+                                               double ** pks,
+                                               double ** pkt,
+                                               short * found
+                                               ) {
+
+  int status = _SUCCESS_;
+
+  *found = _FALSE_;
+
+#pragma omp critical (external_pk_cache)
+  {
+    if ((primordial_external_pk_cache.has_table == _TRUE_) &&
+        (strcmp(primordial_external_pk_cache.command,command) == 0) &&
+        ((ppt->has_tensors == _FALSE_) || (primordial_external_pk_cache.has_tensors == _TRUE_))) {
+
+      *k_size = primordial_external_pk_cache.k_size;
+      *k = (double *)malloc(*k_size*sizeof(double));
+      *pks = (double *)malloc(*k_size*sizeof(double));
+      if (ppt->has_tensors == _TRUE_)
+        *pkt = (double *)malloc(*k_size*sizeof(double));
+
+      if ((*k == NULL) || (*pks == NULL) || ((ppt->has_tensors == _TRUE_) && (*pkt == NULL))) {
+        sprintf(ppm->error_message,"%s(L:%d) : could not allocate the copy of the external spectrum",__func__,__LINE__);
+        status = _FAILURE_;
+      }
+      else {
+        memcpy(*k,primordial_external_pk_cache.k,*k_size*sizeof(double));
+        memcpy(*pks,primordial_external_pk_cache.pks,*k_size*sizeof(double));
+        if (ppt->has_tensors == _TRUE_)
+          memcpy(*pkt,primordial_external_pk_cache.pkt,*k_size*sizeof(double));
+        *found = _TRUE_;
+      }
+    }
+  }
+
+  return status;
+
+}
+
+/**
+ * Store a copy of the output of an external command, replacing the
+ * previous content of the cache.
+ *
+ * @param ppt     Input: pointer to perturbation structure
+ * @param ppm     Input/output: pointer to primordial structure
+ * @param command Input: command with its arguments
+ * @param k_size  Input: number of lines of the table
+ * @param k       Input: wavenumbers
+ * @param pks     Input: scalar spectrum
+ * @param pkt     Input: tensor spectrum (if there are tensors)
+ * @return the error status
+ */
+
+int primordial_external_spectrum_cache_store(
+                                             struct perturbs * ppt,
+                                             struct primordial * ppm,
+                                             char * command,
+                                             int k_size,
+                                             double * k,
+                                             double * pks,
+                                             double * pkt
+                                             ) {
+
+  int status = _SUCCESS_;
+  struct external_pk_cache * pcache = &primordial_external_pk_cache;
+
+#pragma omp critical (external_pk_cache)
+  {
+    if (pcache->has_table == _TRUE_) {
+      free(pcache->k);
+      free(pcache->pks);
+      if (pcache->has_tensors == _TRUE_)
+        free(pcache->pkt);
+      pcache->has_table = _FALSE_;
+    }
+
+    pcache->k = (double *)malloc(k_size*sizeof(double));
+    pcache->pks = (double *)malloc(k_size*sizeof(double));
+    pcache->pkt = (ppt->has_tensors == _TRUE_) ? (double *)malloc(k_size*sizeof(double)) : NULL;
+
+    if ((pcache->k == NULL) || (pcache->pks == NULL) || ((ppt->has_tensors == _TRUE_) && (pcache->pkt == NULL))) {
+      free(pcache->k);
+      free(pcache->pks);
+      free(pcache->pkt);
+      sprintf(ppm->error_message,"%s(L:%d) : could not allocate the cache of the external spectrum",__func__,__LINE__);
+      status = _FAILURE_;
+    }
+    else {
+      strcpy(pcache->command,command);
+      pcache->has_tensors = ppt->has_tensors;
+      pcache->k_size = k_size;
+      memcpy(pcache->k,k,k_size*sizeof(double));
+      memcpy(pcache->pks,pks,k_size*sizeof(double));
+      if (ppt->has_tensors == _TRUE_)
+        memcpy(pcache->pkt,pkt,k_size*sizeof(double));
+      pcache->has_table = _TRUE_;
+    }
+  }
+
+  return status;
+
+}
+
 int primordial_output_titles(struct perturbs * ppt,
                              struct primordial * ppm,
                              char titles[_MAXTITLESTRINGLENGTH_]
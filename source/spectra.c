@@ -271,12 +271,20 @@ int spectra_init(
 
   /** Summary: */
 
+  /* size of the heap at the beginning (see class_memory_heap()) */
+  size_t heap_start;
+
+  class_profile_start(profile_spectra_init);
+  heap_start = class_memory_heap();
+
   /** - check that we really want to compute at least one spectrum */
 
   if (ppt->has_cls == _FALSE_) {
     psp->md_size = 0;
     if (psp->spectra_verbose > 0)
       printf("No spectra requested. Spectra module skipped.\n");
+    psp->memory_size = class_memory_growth(heap_start);
+    class_profile_stop(profile_spectra_init);
     return _SUCCESS_;
   }
   else {
@@ -284,10 +292,14 @@ int spectra_init(
       printf("Computing unlensed harmonic spectra\n");
   }
 
+  class_test(ptr->tables_released == _TRUE_,
+             psp->error_message,
+             "the transfer functions were freed by the low_memory profile: compute them again first");
+
   /** - initialize indices and allocate some of the arrays in the
       spectra structure */
 
-  class_call(spectra_indices(pba,ppt,ptr,ppm,psp),
+  class_call(spectra_indices(ppr,pba,ppt,ptr,ppm,psp),
              psp->error_message,
              psp->error_message);
 
@@ -295,7 +307,7 @@ int spectra_init(
 
   if (ppt->has_cls == _TRUE_) {
 
-    class_call(spectra_cls(pba,ppt,ptr,ppm,psp),
+    class_call(spectra_cls(ppr,pba,ppt,ptr,ppm,psp),
                psp->error_message,
                psp->error_message);
 
@@ -314,6 +326,17 @@ int spectra_init(
 
   psp->pnl = pnl;
 
+  psp->memory_size = class_memory_growth(heap_start);
+
+  /** - with the low_memory profile, the transfer functions (and the
+      perturbation sources, if the transfer functions were computed
+      by blocks of multipoles) are not needed any more */
+
+  class_call(transfer_release_tables(ppt,ptr),
+             ptr->error_message,
+             psp->error_message);
+
+  class_profile_stop(profile_spectra_init);
   return _SUCCESS_;
 }
 
@@ -347,6 +370,11 @@ int spectra_free(
       free(psp->l_max);
       free(psp->cl);
       free(psp->ddcl);
+      if (psp->d_size > 0) {
+        free(psp->dd_pair);
+        free(psp->ll_pair);
+        free(psp->dl_pair);
+      }
     }
   }
 
@@ -364,6 +392,7 @@ int spectra_free(
 /**
  * This routine defines indices and allocates tables in the spectra structure
  *
+ * @param ppr  Input: pointer to precision structure
  * @param pba  Input: pointer to background structure
  * @param ppt  Input: pointer to perturbation structure
  * @param ptr  Input: pointer to transfers structure
@@ -373,6 +402,7 @@ int spectra_free(
  */
 
 int spectra_indices(
+                    struct precision * ppr,
                     struct background * pba,
                     struct perturbs * ppt,
                     struct transfers * ptr,
@@ -490,10 +520,17 @@ int spectra_indices(
     else
       psp->d_size=0;
 
+    /* pairs of bins for which the cross-correlation spectra are computed */
+    if (psp->d_size > 0) {
+      class_call(spectra_bin_pairs(ppr,pba,ppt,ptr,psp),
+                 psp->error_message,
+                 psp->error_message);
+    }
+
     if ((ppt->has_cl_number_count == _TRUE_) && (ppt->has_scalars == _TRUE_)) {
       psp->has_dd = _TRUE_;
       psp->index_ct_dd=index_ct;
-      index_ct+=(psp->d_size*(psp->d_size+1)-(psp->d_size-psp->non_diag)*(psp->d_size-1-psp->non_diag))/2;
+      index_ct+=psp->dd_pair_num;
     }
     else {
       psp->has_dd = _FALSE_;
@@ -530,7 +567,7 @@ int spectra_indices(
     if ((ppt->has_cl_lensing_potential == _TRUE_) && (ppt->has_scalars == _TRUE_)) {
       psp->has_ll = _TRUE_;
       psp->index_ct_ll=index_ct;
-      index_ct+=(psp->d_size*(psp->d_size+1)-(psp->d_size-psp->non_diag)*(psp->d_size-1-psp->non_diag))/2;
+      index_ct+=psp->ll_pair_num;
     }
     else {
       psp->has_ll = _FALSE_;
@@ -556,7 +593,7 @@ int spectra_indices(
     if ((ppt->has_cl_number_count == _TRUE_) && (ppt->has_cl_lensing_potential == _TRUE_) && (ppt->has_scalars == _TRUE_)) {
       psp->has_dl = _TRUE_;
       psp->index_ct_dl=index_ct;
-      index_ct += psp->d_size*psp->d_size - (psp->d_size-psp->non_diag)*(psp->d_size-1-psp->non_diag);
+      index_ct+=psp->dl_pair_num;
     }
     else {
       psp->has_dl = _FALSE_;
@@ -589,7 +626,7 @@ int spectra_indices(
 
       if (psp->has_dd == _TRUE_)
         for (index_ct=psp->index_ct_dd;
-             index_ct<psp->index_ct_dd+(psp->d_size*(psp->d_size+1)-(psp->d_size-psp->non_diag)*(psp->d_size-1-psp->non_diag))/2;
+             index_ct<psp->index_ct_dd+psp->dd_pair_num;
              index_ct++)
           psp->l_max_ct[ppt->index_md_scalars][index_ct] = ppt->l_lss_max;
 
@@ -607,7 +644,7 @@ int spectra_indices(
 
       if (psp->has_ll == _TRUE_)
         for (index_ct=psp->index_ct_ll;
-             index_ct<psp->index_ct_ll+(psp->d_size*(psp->d_size+1)-(psp->d_size-psp->non_diag)*(psp->d_size-1-psp->non_diag))/2;
+             index_ct<psp->index_ct_ll+psp->ll_pair_num;
              index_ct++)
           psp->l_max_ct[ppt->index_md_scalars][index_ct] = ppt->l_lss_max;
 
@@ -619,7 +656,7 @@ int spectra_indices(
 
       if (psp->has_dl == _TRUE_)
         for (index_ct=psp->index_ct_dl;
-             index_ct < psp->index_ct_dl+(psp->d_size*psp->d_size - (psp->d_size-psp->non_diag)*(psp->d_size-1-psp->non_diag));
+             index_ct<psp->index_ct_dl+psp->dl_pair_num;
              index_ct++)
           psp->l_max_ct[ppt->index_md_scalars][index_ct] = ppt->l_lss_max;
 
@@ -648,10 +685,168 @@ int spectra_indices(
 
 }
 
+/**
+ * This routine selects the pairs of bins for which the
+ * cross-correlation spectra \f$ C_l^{dd} \f$, \f$ C_l^{ll} \f$ and
+ * \f$ C_l^{dl} \f$ are computed, and allocates the tables dd_pair,
+ * ll_pair and dl_pair listing them (the auto-correlation of each bin
+ * is always computed).
+ *
+ * The candidate pairs are either those listed by the user in
+ * non_diag_pair, or all those separated by at most non_diag bins. When
+ * non_diag_max_gap is positive and the number counts only include
+ * local contributions (density, rsd, doppler), the candidates for
+ * \f$ C_l^{dd} \f$ whose selection functions (see
+ * transfer_selection_times()) are separated by more than this
+ * comoving distance are discarded, as well as the candidates for \f$
+ * C_l^{dl} \f$ whose density bin is entirely behind the sources of
+ * the lensing bin by more than this distance. These spectra are small
+ * but not exactly zero, especially at low l: this is an approximation
+ * left to the user.
+ *
+ * @param ppr  Input: pointer to precision structure
+ * @param pba  Input: pointer to background structure
+ * @param ppt  Input: pointer to perturbation structure
+ * @param ptr  Input: pointer to transfers structure
+ * @param psp  Input/output: pointer to spectra structure
+ * @return the error status
+ */
+
+int spectra_bin_pairs(
+                      struct precision * ppr,
+                      struct background * pba,
+                      struct perturbs * ppt,
+                      struct transfers * ptr,
+                      struct spectra * psp
+                      ) {
+
+  int index_d1,index_d2,index_pair;
+  int d_size;
+  short * is_candidate; /* is_candidate[index_d1*d_size+index_d2] */
+  short prune;
+  double * tau_min;
+  double * tau_max;
+  double tau_mean;
+
+  d_size = psp->d_size;
+
+  class_calloc(is_candidate,d_size*d_size,sizeof(short),psp->error_message);
+
+  /** - candidate pairs */
+
+  if (psp->non_diag_pair_num > 0) {
+    for (index_pair=0; index_pair<psp->non_diag_pair_num; index_pair++) {
+      index_d1 = psp->non_diag_pair[2*index_pair];
+      index_d2 = psp->non_diag_pair[2*index_pair+1];
+      class_test((index_d1 < 0) || (index_d1 >= d_size) || (index_d2 < 0) || (index_d2 >= d_size),
+                 psp->error_message,
+                 "pair of bins (%d,%d) in non_diagonal_pairs outside of the range [1,%d]",index_d1+1,index_d2+1,d_size);
+      is_candidate[index_d1*d_size+index_d2] = _TRUE_;
+      is_candidate[index_d2*d_size+index_d1] = _TRUE_;
+    }
+    for (index_d1=0; index_d1<d_size; index_d1++)
+      is_candidate[index_d1*d_size+index_d1] = _TRUE_;
+  }
+  else {
+    for (index_d1=0; index_d1<d_size; index_d1++)
+      for (index_d2=MAX(index_d1-psp->non_diag,0); index_d2<=MIN(index_d1+psp->non_diag,d_size-1); index_d2++)
+        is_candidate[index_d1*d_size+index_d2] = _TRUE_;
+  }
+
+  /** - time range of each selection function, if the candidates
+      must be pruned */
+
+  prune = ((psp->non_diag_max_gap > 0.) &&
+           (ppt->has_cl_number_count == _TRUE_) &&
+           (ppt->has_nc_lens == _FALSE_) &&
+           (ppt->has_nc_gr == _FALSE_));
+
+  tau_min = NULL;
+  tau_max = NULL;
+
+  if (prune == _TRUE_) {
+    class_alloc(tau_min,d_size*sizeof(double),psp->error_message);
+    class_alloc(tau_max,d_size*sizeof(double),psp->error_message);
+    for (index_d1=0; index_d1<d_size; index_d1++) {
+      class_call(transfer_selection_times(ppr,pba,ppt,ptr,index_d1,&(tau_min[index_d1]),&tau_mean,&(tau_max[index_d1])),
+                 ppt->error_message,
+                 psp->error_message);
+    }
+  }
+
+  /** - list of pairs for each type */
+
+  class_alloc(psp->dd_pair,2*d_size*d_size*sizeof(int),psp->error_message);
+  class_alloc(psp->ll_pair,2*d_size*d_size*sizeof(int),psp->error_message);
+  class_alloc(psp->dl_pair,2*d_size*d_size*sizeof(int),psp->error_message);
+
+  psp->dd_pair_num = 0;
+  psp->ll_pair_num = 0;
+  psp->dl_pair_num = 0;
+
+  for (index_d1=0; index_d1<d_size; index_d1++) {
+    for (index_d2=0; index_d2<d_size; index_d2++) {
+
+      if (is_candidate[index_d1*d_size+index_d2] == _FALSE_)
+        continue;
+
+      /* C_l^dd and C_l^ll: symmetric, pairs with index_d1 <= index_d2 */
+      if (index_d2 >= index_d1) {
+
+        if ((prune == _FALSE_) ||
+            (index_d2 == index_d1) ||
+            (MAX(tau_min[index_d1]-tau_max[index_d2],tau_min[index_d2]-tau_max[index_d1]) <= psp->non_diag_max_gap)) {
+          psp->dd_pair[2*psp->dd_pair_num] = index_d1;
+          psp->dd_pair[2*psp->dd_pair_num+1] = index_d2;
+          psp->dd_pair_num++;
+        }
+
+        psp->ll_pair[2*psp->ll_pair_num] = index_d1;
+        psp->ll_pair[2*psp->ll_pair_num+1] = index_d2;
+        psp->ll_pair_num++;
+      }
+
+      /* C_l^dl: density bin index_d1, lensing bin index_d2, which
+         probes all times after those of its sources */
+      if ((prune == _FALSE_) ||
+          (index_d2 == index_d1) ||
+          (tau_min[index_d2]-tau_max[index_d1] <= psp->non_diag_max_gap)) {
+        psp->dl_pair[2*psp->dl_pair_num] = index_d1;
+        psp->dl_pair[2*psp->dl_pair_num+1] = index_d2;
+        psp->dl_pair_num++;
+      }
+    }
+  }
+
+  free(is_candidate);
+  if (prune == _TRUE_) {
+    free(tau_min);
+    free(tau_max);
+  }
+
+  return _SUCCESS_;
+
+}
+
 /**
  * This routine computes a table of values for all harmonic spectra \f$ C_l \f$'s,
  * given the transfer functions and primordial spectra.
  *
+ * When the transfer module did not store the transfer functions (see
+ * l_block_size in the transfers structure), they are computed here by
+ * blocks of multipoles with transfer_compute_l_block(), and the
+ * \f$ C_l \f$'s of each block are computed before moving to the next
+ * one. Each \f$ C_l \f$ is the same integral over all wavenumbers in
+ * both cases, so the results do not depend on the block size.
+ *
+ * Each \f$ C_l \f$ is a spline integral over the same grid of
+ * wavenumbers, which is linear in the integrand: it is computed as a
+ * weighted sum, the weights combining the spline quadrature weights
+ * of array_spline_weights() with the primordial spectrum. They are
+ * computed once for each mode and pair of initial conditions, before
+ * the parallel loop over multipoles.
+ *
+ * @param ppr Input: pointer to precision structure
  * @param pba Input: pointer to background structure
  * @param ppt Input: pointer to perturbation structure
  * @param ptr Input: pointer to transfers structure
@@ -661,6 +856,7 @@ int spectra_indices(
  */
 
 int spectra_cls(
+                struct precision * ppr,
                 struct background * pba,
                 struct perturbs * ppt,
                 struct transfers * ptr,
@@ -675,13 +871,20 @@ int spectra_cls(
   int index_md;
   int index_ic1,index_ic2,index_ic1_ic2;
   int index_l;
+  int index_l_min,index_l_max,index_l_end,l_block_size;
   int index_ct;
-  int cl_integrand_num_columns;
+  int index_q,index_q_spline;
+  int index_tt,index_row;
+  int q_index_min,q_index_max;
+  int transfer_size;
+  int ic_ic_size_max;
+  double k;
 
-  double * cl_integrand; /* array with argument cl_integrand[index_k*cl_integrand_num_columns+1+psp->index_ct] */
-  double * transfer_ic1; /* array with argument transfer_ic1[index_tt] */
-  double * transfer_ic2; /* idem */
-  double * primordial_pk;  /* array with argument primordial_pk[index_ic_ic]*/
+  double * spline_weight; /* array with argument spline_weight[index_q] */
+  double * cl_weight;     /* array with argument cl_weight[index_q] */
+  double * primordial_pk; /* array with argument primordial_pk[(index_q-q_index_min)*psp->ic_ic_size[index_md]+index_ic_ic]*/
+  double * transfer_ic1;  /* array with argument transfer_ic1[index_tt*ptr->q_size+index_q] */
+  double * transfer_ic2;  /* idem */
 
   /* This code can be optionally compiled with the openmp option for parallel computation.
      Inside parallel regions, the use of the command "return" is forbidden.
@@ -694,6 +897,7 @@ int spectra_cls(
   /* instrumentation times */
   double tstart, tstop;
 #endif
+  struct parallel_timer timer;
 
   /** - allocate pointers to arrays where results will be stored */
 
@@ -709,127 +913,296 @@ int spectra_cls(
     psp->l[index_l] = (double)ptr->l[index_l];
   }
 
-  /** - loop over modes (scalar, tensors, etc). For each mode: */
+  /** - for each mode (scalar, tensors, etc), store the number of l
+      values and allocate arrays where results will be stored */
 
   for (index_md = 0; index_md < psp->md_size; index_md++) {
 
-    /** - --> (a) store number of l values for this mode */
-
     psp->l_size[index_md] = ptr->l_size[index_md];
 
-    /** - --> (b) allocate arrays where results will be stored */
-
     class_alloc(psp->cl[index_md],sizeof(double)*psp->l_size[index_md]*psp->ct_size*psp->ic_ic_size[index_md],psp->error_message);
     class_alloc(psp->ddcl[index_md],sizeof(double)*psp->l_size[index_md]*psp->ct_size*psp->ic_ic_size[index_md],psp->error_message);
-    cl_integrand_num_columns = 1+psp->ct_size*2; /* one for k, ct_size for each type, ct_size for each second derivative of each type */
+  }
 
-    /** - --> (c) loop over initial conditions */
+  class_alloc(spline_weight,ptr->q_size*sizeof(double),psp->error_message);
+  class_alloc(cl_weight,ptr->q_size*sizeof(double),psp->error_message);
+  ic_ic_size_max = 0;
+  for (index_md = 0; index_md < psp->md_size; index_md++)
+    ic_ic_size_max = MAX(ic_ic_size_max,psp->ic_ic_size[index_md]);
+  class_alloc(primordial_pk,ptr->q_size*ic_ic_size_max*sizeof(double),psp->error_message);
 
-    for (index_ic1 = 0; index_ic1 < psp->ic_size[index_md]; index_ic1++) {
-      for (index_ic2 = index_ic1; index_ic2 < psp->ic_size[index_md]; index_ic2++) {
-        index_ic1_ic2 = index_symmetric_matrix(index_ic1,index_ic2,psp->ic_size[index_md]);
+  /** - loop over blocks of multipoles: a single block with all of
+      them, unless the transfer functions must be computed by blocks
+      with transfer_compute_l_block() */
+
+  if (ptr->stream != NULL)
+    l_block_size = ptr->l_block_size;
+  else
+    l_block_size = ptr->l_size_max;
+
+  for (index_l_min = 0; index_l_min < ptr->l_size_max; index_l_min += l_block_size) {
+
+    index_l_max = MIN(index_l_min+l_block_size,ptr->l_size_max);
+
+    if (ptr->stream != NULL) {
+      class_call(transfer_compute_l_block(ppr,pba,ppt,ptr,index_l_min,index_l_max),
+                 ptr->error_message,
+                 psp->error_message);
+    }
+
+    /** - --> loop over modes. For each mode: */
+
+    for (index_md = 0; index_md < psp->md_size; index_md++) {
+
+      index_l_end = MIN(index_l_max,ptr->l_size[index_md]);
+
+      /** - ---> quadrature weights of the integral over k. In the
+          closed (K>0) case, it is a bad idea to spline over the
+          values of k corresponding to nu<nu_flat_approximation. In
+          this region, nu values are integer values, so the steps dq
+          and dk have some discrete jumps. This makes the spline
+          routine less accurate than a trapezoidal integral with finer
+          sampling. So, in the closed case, we set index_q_spline to
+          ptr->index_q_flat_approximation, to tell the integration
+          routine that below this index, it should treat the integral
+          as a trapezoidal one. For testing, one is free to set
+          index_q_spline to 0, to enforce spline integration
+          everywhere, or to (ptr->q_size-1), to enforce trapezoidal
+          integration everywhere. */
+
+      index_q_spline = 0;
+      if (pba->sgnK == 1) {
+        index_q_spline = ptr->index_q_flat_approximation;
+      }
+
+      class_call(array_spline_weights(ptr->k[index_md],
+                                      ptr->q_size,
+                                      index_q_spline,
+                                      spline_weight,
+                                      psp->error_message),
+                 psp->error_message,
+                 psp->error_message);
+
+      /* in the closed case, instead of an integral, we have a
+         discrete sum. In practice, this does not matter: the previous
+         weights do give a correct approximation of the discrete sum,
+         both in the trapezoidal and spline regions. The only error
+         comes from the first point: the previous weights assume a
+         weight for the first point which is too small compared to
+         what it would be in the an actual discrete sum. The line
+         below correct this problem in an exact way. */
+
+      if (pba->sgnK == 1) {
+        spline_weight[0] += ptr->q[0]/ptr->k[0][0]*sqrt(pba->K)/2.;
+      }
+
+      /* number of rows of the workspaces of spectra_compute_cl():
+         each transfer type, followed by the temperature and number
+         count combinations */
+      transfer_size = (ptr->tt_size[index_md]+1+psp->d_size)*ptr->q_size;
+
+      /** - ---> loop over initial conditions */
+
+      for (index_ic1 = 0; index_ic1 < psp->ic_size[index_md]; index_ic1++) {
+        for (index_ic2 = index_ic1; index_ic2 < psp->ic_size[index_md]; index_ic2++) {
+          index_ic1_ic2 = index_symmetric_matrix(index_ic1,index_ic2,psp->ic_size[index_md]);
+
+          /* non-diagonal coefficients should be computed only if non-zero correlation */
+          if (psp->is_non_zero[index_md][index_ic1_ic2] == _TRUE_) {
+
+            /** - ----> range of wavenumbers outside of which all the
+                transfer functions of this block of multipoles are
+                zero (see transfer_storage_init()) */
+
+            q_index_min = ptr->q_size;
+            q_index_max = 0;
+
+            for (index_tt=0; index_tt < ptr->tt_size[index_md]; index_tt++) {
+              for (index_l=index_l_min; index_l < index_l_end; index_l++) {
+                index_row = _transfer_row_(ptr,index_md,index_ic1,index_tt,index_l);
+                if (ptr->q_index_max[index_md][index_row] > ptr->q_index_min[index_md][index_row]) {
+                  q_index_min = MIN(q_index_min,ptr->q_index_min[index_md][index_row]);
+                  q_index_max = MAX(q_index_max,ptr->q_index_max[index_md][index_row]);
+                }
+                index_row = _transfer_row_(ptr,index_md,index_ic2,index_tt,index_l);
+                if (ptr->q_index_max[index_md][index_row] > ptr->q_index_min[index_md][index_row]) {
+                  q_index_min = MIN(q_index_min,ptr->q_index_min[index_md][index_row]);
+                  q_index_max = MAX(q_index_max,ptr->q_index_max[index_md][index_row]);
+                }
+              }
+            }
+
+            /** - ----> weights of the integrand: we must integrate
+
+                C_l = int [4 pi dk/k calP(k) Delta1_l(q) Delta2_l(q)]
+
+                where calP(k) is the dimensionless
+                power spectrum equal to a constant in the scale-invariant case,
+                and to P(k) = A_s k^(ns-1) otherwise and q=sqrt(k2+K) (scalars)
+                or sqrt(k2+2K) (vectors) or sqrt(k2+3K) (tensors)
+
+                In the literature, people often rewrite the integral in terms
+                of q and absorb the Jacobian of the change of variables in a redefinition of the primodial
+                spectrum. Let us illustrate this for scalars:
 
-        /* non-diagonal coefficients should be computed only if non-zero correlation */
-        if (psp->is_non_zero[index_md][index_ic1_ic2] == _TRUE_) {
+                dk/k = kdk/k2 = qdq/k2 = dq/q * (q/k)^2 = dq/q * [q2/(q2-K)] = q2dq * 1/[q(q2-K)]
 
-          /* initialize error management flag */
-          abort = _FALSE_;
+                This factor 1/[q(q2-K)] is commonly absorbed in the definition of calP. Then one would have
 
-          /* beginning of parallel region */
+                C_l = int [4 pi q2 dq {A_s k^(ns-1)/[q(q2-K)]} Delta1_l(q) Delta2_l(q)]
+
+                Sometimes in the literature, the factor (k2-3K)=(q2-4K) present
+                in the initial conditions of scalar transfer functions (if
+                normalized to curvature R=1) is also absorbed in the definition
+                of the power spectrum. Then the curvature power spectrum reads
+
+                calP = (q2-4K)/[q(q2-K)] * (k/k)^ns
+
+                In CLASS we prefer to define calP = (k/k)^ns like in the flat
+                case, to have the factor (q2-4K) in the initialk conditions,
+                and the factor 1/[q(q2-K)] doesn't need to be there since we
+                integrate over dk/k.
+
+                For tensors, the change of variable described above gives a slightly different result:
+
+                dk/k = kdk/k2 = qdq/k2 = dq/q * (q/k)^2 = dq/q * [q2/(q2-3K)] = q2dq * 1/[q(q2-3K)]
+
+                But for tensors there are extra curvature-related correction factors to
+                take into account. See the comments in the perturbation module,
+                related to initial conditions for tensors.
+            */
+
+            if (q_index_max > q_index_min) {
+              class_call(primordial_spectrum_at_kvec(ppm,
+                                                     index_md,
+                                                     linear,
+                                                     ptr->k[index_md]+q_index_min,
+                                                     q_index_max-q_index_min,
+                                                     primordial_pk),
+                         ppm->error_message,
+                         psp->error_message);
+            }
+
+            for (index_q=0; index_q < ptr->q_size; index_q++) {
+
+              if ((index_q < q_index_min) || (index_q >= q_index_max)) {
+                cl_weight[index_q] = 0.;
+                continue;
+              }
+
+              k = ptr->k[index_md][index_q];
+
+              /* above routine checks that k>0: no possible division by zero below */
+
+              cl_weight[index_q] = spline_weight[index_q] * 4. * _PI_ / k
+                * primordial_pk[(index_q-q_index_min)*psp->ic_ic_size[index_md]+index_ic1_ic2];
+            }
+
+            /* initialize error management flag */
+            abort = _FALSE_;
+
+            /* beginning of parallel region */
+
+            parallel_timer_start(&timer);
 
 #pragma omp parallel                                                    \
-  shared(ptr,ppm,index_md,psp,ppt,cl_integrand_num_columns,index_ic1,index_ic2,abort) \
-  private(tstart,cl_integrand,primordial_pk,transfer_ic1,transfer_ic2,index_l,tstop)
+  shared(ptr,index_md,psp,ppt,transfer_size,cl_weight,index_ic1,index_ic2,index_l_min,index_l_end,abort,timer) \
+  private(tstart,transfer_ic1,transfer_ic2,index_l,tstop)
 
-          {
+            {
 
 #ifdef _OPENMP
-            tstart = omp_get_wtime();
+              tstart = omp_get_wtime();
 #endif
 
-            class_alloc_parallel(cl_integrand,
-                                 ptr->q_size*cl_integrand_num_columns*sizeof(double),
-                                 psp->error_message);
-
-            class_alloc_parallel(primordial_pk,
-                                 psp->ic_ic_size[index_md]*sizeof(double),
-                                 psp->error_message);
+              class_alloc_parallel(transfer_ic1,
+                                   transfer_size*sizeof(double),
+                                   psp->error_message);
 
-            class_alloc_parallel(transfer_ic1,
-                                 ptr->tt_size[index_md]*sizeof(double),
-                                 psp->error_message);
+              class_alloc_parallel(transfer_ic2,
+                                   transfer_size*sizeof(double),
+                                   psp->error_message);
 
-            class_alloc_parallel(transfer_ic2,
-                                 ptr->tt_size[index_md]*sizeof(double),
-                                 psp->error_message);
+#pragma omp for schedule (dynamic) nowait
 
-#pragma omp for schedule (dynamic)
+              /** - ----> loop over l values of this block.
+                  For each l, compute the \f$ C_l\f$'s for all types (TT, TE, ...)
+                  by convolving primordial spectra with transfer  functions.
+                  This elementary task is assigned to spectra_compute_cl() */
 
-            /** - ---> loop over l values defined in the transfer module.
-                For each l, compute the \f$ C_l\f$'s for all types (TT, TE, ...)
-                by convolving primordial spectra with transfer  functions.
-                This elementary task is assigned to spectra_compute_cl() */
-
-            for (index_l=0; index_l < ptr->l_size[index_md]; index_l++) {
+              for (index_l=index_l_min; index_l < index_l_end; index_l++) {
 
 #pragma omp flush(abort)
 
-              class_call_parallel(spectra_compute_cl(pba,
-                                                     ppt,
-                                                     ptr,
-                                                     ppm,
-                                                     psp,
-                                                     index_md,
-                                                     index_ic1,
-                                                     index_ic2,
-                                                     index_l,
-                                                     cl_integrand_num_columns,
-                                                     cl_integrand,
-                                                     primordial_pk,
-                                                     transfer_ic1,
-                                                     transfer_ic2),
-                                  psp->error_message,
-                                  psp->error_message);
-
-            } /* end of loop over l */
+                class_call_parallel(spectra_compute_cl(ppt,
+                                                       ptr,
+                                                       psp,
+                                                       index_md,
+                                                       index_ic1,
+                                                       index_ic2,
+                                                       index_l,
+                                                       cl_weight,
+                                                       transfer_ic1,
+                                                       transfer_ic2),
+                                    psp->error_message,
+                                    psp->error_message);
+
+              } /* end of loop over l */
 
 #ifdef _OPENMP
-            tstop = omp_get_wtime();
-            if (psp->spectra_verbose > 1)
-              printf("In %s: time spent in parallel region (loop over l's) = %e s for thread %d\n",
-                     __func__,tstop-tstart,omp_get_thread_num());
+              tstop = omp_get_wtime();
+              if (psp->spectra_verbose > 1)
+                printf("In %s: time spent in parallel region (loop over l's) = %e s for thread %d\n",
+                       __func__,tstop-tstart,omp_get_thread_num());
 #endif
-            free(cl_integrand);
 
-            free(primordial_pk);
+              free(transfer_ic1);
 
-            free(transfer_ic1);
+              free(transfer_ic2);
 
-            free(transfer_ic2);
+              parallel_timer_thread_done(&timer);
 
-          } /* end of parallel region */
+            } /* end of parallel region */
 
-          if (abort == _TRUE_) return _FAILURE_;
+            parallel_timer_stop(&timer,"spectra_cls: l loop");
 
-        }
-        else {
+            if (abort == _TRUE_) return _FAILURE_;
 
-          /* set non-diagonal coefficients to zero if pair of ic's uncorrelated */
+          }
+          else {
+
+            /* set non-diagonal coefficients to zero if pair of ic's uncorrelated */
 
-          for (index_l=0; index_l < ptr->l_size[index_md]; index_l++) {
-            for (index_ct=0; index_ct<psp->ct_size; index_ct++) {
-              psp->cl[index_md]
-                [(index_l * psp->ic_ic_size[index_md] + index_ic1_ic2) * psp->ct_size + index_ct]
-                = 0.;
+            for (index_l=index_l_min; index_l < index_l_end; index_l++) {
+              for (index_ct=0; index_ct<psp->ct_size; index_ct++) {
+                psp->cl[index_md]
+                  [(index_l * psp->ic_ic_size[index_md] + index_ic1_ic2) * psp->ct_size + index_ct]
+                  = 0.;
+              }
             }
           }
         }
       }
     }
+  }
+
+  free(spline_weight);
+  free(cl_weight);
+  free(primordial_pk);
+
+  /** - free the last block of transfer functions */
+
+  if (ptr->stream != NULL) {
+    class_call(transfer_storage_free(ptr),
+               ptr->error_message,
+               psp->error_message);
+  }
 
-    /** - --> (d) now that for a given mode, all possible \f$ C_l\f$'s have been computed,
-        compute second derivative of the array in which they are stored,
-        in view of spline interpolation. */
+  /** - for each mode, now that all possible \f$ C_l\f$'s have been
+      computed, compute second derivative of the array in which they
+      are stored, in view of spline interpolation. */
+
+  for (index_md = 0; index_md < psp->md_size; index_md++) {
 
     class_call(array_spline_table_lines(psp->l,
                                         psp->l_size[index_md],
@@ -851,430 +1224,366 @@ int spectra_cls(
  * and multipole, but for all types (TT, TE...), by convolving the
  * transfer functions with the primordial spectra.
  *
- * @param pba           Input: pointer to background structure
+ * The transfer functions of this multipole are first copied, for each
+ * type, in an array contiguous in wavenumber (see
+ * spectra_transfer_combinations()). Each \f$ C_l\f$ is then a single
+ * pass over these arrays, weighted by cl_weight, which contains the
+ * quadrature weights, the primordial spectrum and the factor \f$ 4
+ * \pi/k \f$.
+ *
  * @param ppt           Input: pointer to perturbation structure
  * @param ptr           Input: pointer to transfers structure
- * @param ppm           Input: pointer to primordial structure
  * @param psp           Input/Output: pointer to spectra structure (result stored here)
  * @param index_md      Input: index of mode under consideration
  * @param index_ic1     Input: index of first initial condition in the correlator
  * @param index_ic2     Input: index of second initial condition in the correlator
  * @param index_l       Input: index of multipole under consideration
- * @param cl_integrand_num_columns Input: number of columns in cl_integrand
- * @param cl_integrand  Input: an allocated workspace
- * @param primordial_pk Input: table of primordial spectrum values
- * @param transfer_ic1  Input: table of transfer function values for first initial condition
- * @param transfer_ic2  Input: table of transfer function values for second initial condition
+ * @param cl_weight     Input: weight of each wavenumber in the integral over k, cl_weight[index_q]
+ * @param transfer_ic1  Input: an allocated workspace of (ptr->tt_size[index_md]+1+psp->d_size)*ptr->q_size values, for the first initial condition
+ * @param transfer_ic2  Input: idem for the second initial condition
  * @return the error status
  */
 
 int spectra_compute_cl(
-                       struct background * pba,
                        struct perturbs * ppt,
                        struct transfers * ptr,
-                       struct primordial * ppm,
                        struct spectra * psp,
                        int index_md,
                        int index_ic1,
                        int index_ic2,
                        int index_l,
-                       int cl_integrand_num_columns,
-                       double * cl_integrand,
-                       double * primordial_pk,
+                       double * cl_weight,
                        double * transfer_ic1,
                        double * transfer_ic2
                        ) {
 
-  int index_q;
   int index_tt;
   int index_ct;
   int index_d1,index_d2;
-  double k;
-  double clvalue;
+  int index_pair;
   int index_ic1_ic2;
-  double transfer_ic1_temp=0.;
-  double transfer_ic2_temp=0.;
-  double * transfer_ic1_nc=NULL;
-  double * transfer_ic2_nc=NULL;
-  double factor;
-  int index_q_spline=0;
+  int index_row1,index_row2;
+  int q_index_min,q_index_max;
+  int q_size;
+  double * transfer_ic1_temp;
+  double * transfer_ic2_temp;
+  double * transfer_ic1_nc;
+  double * transfer_ic2_nc;
+  double * cl;
 
   index_ic1_ic2 = index_symmetric_matrix(index_ic1,index_ic2,psp->ic_size[index_md]);
-
-  if (ppt->has_cl_number_count == _TRUE_) {
-    class_alloc(transfer_ic1_nc,psp->d_size*sizeof(double),psp->error_message);
-    class_alloc(transfer_ic2_nc,psp->d_size*sizeof(double),psp->error_message);
+  q_size = ptr->q_size;
+
+  /* range of wavenumbers outside of which all the transfer functions
+     of this multipole (for both initial conditions) are zero (see
+     transfer_storage_init()): there, the integrand vanishes */
+  q_index_min = ptr->q_size;
+  q_index_max = 0;
+
+  for (index_tt=0; index_tt < ptr->tt_size[index_md]; index_tt++) {
+    index_row1 = _transfer_row_(ptr,index_md,index_ic1,index_tt,index_l);
+    index_row2 = _transfer_row_(ptr,index_md,index_ic2,index_tt,index_l);
+    if (ptr->q_index_max[index_md][index_row1] > ptr->q_index_min[index_md][index_row1]) {
+      q_index_min = MIN(q_index_min,ptr->q_index_min[index_md][index_row1]);
+      q_index_max = MAX(q_index_max,ptr->q_index_max[index_md][index_row1]);
+    }
+    if (ptr->q_index_max[index_md][index_row2] > ptr->q_index_min[index_md][index_row2]) {
+      q_index_min = MIN(q_index_min,ptr->q_index_min[index_md][index_row2]);
+      q_index_max = MAX(q_index_max,ptr->q_index_max[index_md][index_row2]);
+    }
   }
 
-  for (index_q=0; index_q < ptr->q_size; index_q++) {
+  /* all spectra vanish by default (in particular C_l^BB of scalars,
+     C_l^pp of tensors, etc., and the multipoles for which all
+     transfer functions are zero) */
 
-    //q = ptr->q[index_q];
-    k = ptr->k[index_md][index_q];
+  cl = psp->cl[index_md] + (index_l * psp->ic_ic_size[index_md] + index_ic1_ic2) * psp->ct_size;
 
-    cl_integrand[index_q*cl_integrand_num_columns+0] = k;
+  for (index_ct=0; index_ct<psp->ct_size; index_ct++)
+    cl[index_ct] = 0.;
 
-    class_call(primordial_spectrum_at_k(ppm,index_md,linear,k,primordial_pk),
-               ppm->error_message,
-               psp->error_message);
+  if (q_index_max <= q_index_min)
+    return _SUCCESS_;
 
-    /* above routine checks that k>0: no possible division by zero below */
+  /* transfer functions of each type and their combinations, as
+     contiguous arrays over wavenumbers */
 
-    for (index_tt=0; index_tt < ptr->tt_size[index_md]; index_tt++) {
+  class_call(spectra_transfer_combinations(ppt,ptr,psp,index_md,index_ic1,index_l,q_index_min,q_index_max,transfer_ic1),
+             psp->error_message,
+             psp->error_message);
 
-      transfer_ic1[index_tt] =
-        ptr->transfer[index_md]
-        [((index_ic1 * ptr->tt_size[index_md] + index_tt)
-          * ptr->l_size[index_md] + index_l)
-         * ptr->q_size + index_q];
+  if (index_ic2 == index_ic1) {
+    transfer_ic2 = transfer_ic1;
+  }
+  else {
+    class_call(spectra_transfer_combinations(ppt,ptr,psp,index_md,index_ic2,index_l,q_index_min,q_index_max,transfer_ic2),
+               psp->error_message,
+               psp->error_message);
+  }
 
-      if (index_ic1 == index_ic2) {
-        transfer_ic2[index_tt] = transfer_ic1[index_tt];
-      }
-      else {
-        transfer_ic2[index_tt] = ptr->transfer[index_md]
-          [((index_ic2 * ptr->tt_size[index_md] + index_tt)
-            * ptr->l_size[index_md] + index_l)
-           * ptr->q_size + index_q];
-      }
+  transfer_ic1_temp = transfer_ic1 + ptr->tt_size[index_md]*q_size;
+  transfer_ic2_temp = transfer_ic2 + ptr->tt_size[index_md]*q_size;
+  transfer_ic1_nc = transfer_ic1_temp + q_size;
+  transfer_ic2_nc = transfer_ic2_temp + q_size;
+
+  /* integrals over wavenumbers. Cross-correlations between
+     different types are symmetrized between the two initial
+     conditions, except for those between redshift bins. */
+
+  if (psp->has_tt == _TRUE_)
+    cl[psp->index_ct_tt] = spectra_cl_integral(cl_weight,q_index_min,q_index_max,
+                                               transfer_ic1_temp,transfer_ic2_temp,
+                                               transfer_ic1_temp,transfer_ic2_temp);
+
+  if (psp->has_ee == _TRUE_)
+    cl[psp->index_ct_ee] = spectra_cl_integral(cl_weight,q_index_min,q_index_max,
+                                               transfer_ic1+ptr->index_tt_e*q_size,transfer_ic2+ptr->index_tt_e*q_size,
+                                               transfer_ic1+ptr->index_tt_e*q_size,transfer_ic2+ptr->index_tt_e*q_size);
+
+  if (psp->has_te == _TRUE_)
+    cl[psp->index_ct_te] = spectra_cl_integral(cl_weight,q_index_min,q_index_max,
+                                               transfer_ic1_temp,transfer_ic2+ptr->index_tt_e*q_size,
+                                               transfer_ic1+ptr->index_tt_e*q_size,transfer_ic2_temp);
+
+  if (_tensors_ && (psp->has_bb == _TRUE_))
+    cl[psp->index_ct_bb] = spectra_cl_integral(cl_weight,q_index_min,q_index_max,
+                                               transfer_ic1+ptr->index_tt_b*q_size,transfer_ic2+ptr->index_tt_b*q_size,
+                                               transfer_ic1+ptr->index_tt_b*q_size,transfer_ic2+ptr->index_tt_b*q_size);
+
+  if (_scalars_ && (psp->has_pp == _TRUE_))
+    cl[psp->index_ct_pp] = spectra_cl_integral(cl_weight,q_index_min,q_index_max,
+                                               transfer_ic1+ptr->index_tt_lcmb*q_size,transfer_ic2+ptr->index_tt_lcmb*q_size,
+                                               transfer_ic1+ptr->index_tt_lcmb*q_size,transfer_ic2+ptr->index_tt_lcmb*q_size);
+
+  if (_scalars_ && (psp->has_tp == _TRUE_))
+    cl[psp->index_ct_tp] = spectra_cl_integral(cl_weight,q_index_min,q_index_max,
+                                               transfer_ic1_temp,transfer_ic2+ptr->index_tt_lcmb*q_size,
+                                               transfer_ic1+ptr->index_tt_lcmb*q_size,transfer_ic2_temp);
+
+  if (_scalars_ && (psp->has_ep == _TRUE_))
+    cl[psp->index_ct_ep] = spectra_cl_integral(cl_weight,q_index_min,q_index_max,
+                                               transfer_ic1+ptr->index_tt_e*q_size,transfer_ic2+ptr->index_tt_lcmb*q_size,
+                                               transfer_ic1+ptr->index_tt_lcmb*q_size,transfer_ic2+ptr->index_tt_e*q_size);
+
+  if (_scalars_ && (psp->has_dd == _TRUE_)) {
+    for (index_pair=0; index_pair<psp->dd_pair_num; index_pair++) {
+      index_d1 = psp->dd_pair[2*index_pair];
+      index_d2 = psp->dd_pair[2*index_pair+1];
+      cl[psp->index_ct_dd+index_pair] = spectra_cl_integral(cl_weight,q_index_min,q_index_max,
+                                                            transfer_ic1_nc+index_d1*q_size,transfer_ic2_nc+index_d2*q_size,
+                                                            transfer_ic1_nc+index_d1*q_size,transfer_ic2_nc+index_d2*q_size);
     }
+  }
 
-    /* define combinations of transfer functions */
-
-    if (ppt->has_cl_cmb_temperature == _TRUE_) {
-
-      if (_scalars_) {
+  if (_scalars_ && (psp->has_td == _TRUE_)) {
+    for (index_d1=0; index_d1<psp->d_size; index_d1++) {
+      cl[psp->index_ct_td+index_d1] = spectra_cl_integral(cl_weight,q_index_min,q_index_max,
+                                                          transfer_ic1_temp,transfer_ic2_nc+index_d1*q_size,
+                                                          transfer_ic1_nc+index_d1*q_size,transfer_ic2_temp);
+    }
+  }
 
-        transfer_ic1_temp = transfer_ic1[ptr->index_tt_t0] + transfer_ic1[ptr->index_tt_t1] + transfer_ic1[ptr->index_tt_t2];
-        transfer_ic2_temp = transfer_ic2[ptr->index_tt_t0] + transfer_ic2[ptr->index_tt_t1] + transfer_ic2[ptr->index_tt_t2];
+  if (_scalars_ && (psp->has_pd == _TRUE_)) {
+    for (index_d1=0; index_d1<psp->d_size; index_d1++) {
+      cl[psp->index_ct_pd+index_d1] = spectra_cl_integral(cl_weight,q_index_min,q_index_max,
+                                                          transfer_ic1+ptr->index_tt_lcmb*q_size,transfer_ic2_nc+index_d1*q_size,
+                                                          transfer_ic1_nc+index_d1*q_size,transfer_ic2+ptr->index_tt_lcmb*q_size);
+    }
+  }
 
-      }
+  if (_scalars_ && (psp->has_ll == _TRUE_)) {
+    for (index_pair=0; index_pair<psp->ll_pair_num; index_pair++) {
+      index_d1 = psp->ll_pair[2*index_pair];
+      index_d2 = psp->ll_pair[2*index_pair+1];
+      cl[psp->index_ct_ll+index_pair] = spectra_cl_integral(cl_weight,q_index_min,q_index_max,
+                                                            transfer_ic1+(ptr->index_tt_lensing+index_d1)*q_size,transfer_ic2+(ptr->index_tt_lensing+index_d2)*q_size,
+                                                            transfer_ic1+(ptr->index_tt_lensing+index_d1)*q_size,transfer_ic2+(ptr->index_tt_lensing+index_d2)*q_size);
+    }
+  }
 
-      if (_vectors_) {
+  if (_scalars_ && (psp->has_tl == _TRUE_)) {
+    for (index_d1=0; index_d1<psp->d_size; index_d1++) {
+      cl[psp->index_ct_tl+index_d1] = spectra_cl_integral(cl_weight,q_index_min,q_index_max,
+                                                          transfer_ic1_temp,transfer_ic2+(ptr->index_tt_lensing+index_d1)*q_size,
+                                                          transfer_ic1+(ptr->index_tt_lensing+index_d1)*q_size,transfer_ic2_temp);
+    }
+  }
 
-        transfer_ic1_temp = transfer_ic1[ptr->index_tt_t1] + transfer_ic1[ptr->index_tt_t2];
-        transfer_ic2_temp = transfer_ic2[ptr->index_tt_t1] + transfer_ic2[ptr->index_tt_t2];
+  if (_scalars_ && (psp->has_dl == _TRUE_)) {
+    for (index_pair=0; index_pair<psp->dl_pair_num; index_pair++) {
+      index_d1 = psp->dl_pair[2*index_pair];
+      index_d2 = psp->dl_pair[2*index_pair+1];
+      cl[psp->index_ct_dl+index_pair] = spectra_cl_integral(cl_weight,q_index_min,q_index_max,
+                                                            transfer_ic1_nc+index_d1*q_size,transfer_ic2+(ptr->index_tt_lensing+index_d2)*q_size,
+                                                            transfer_ic1_nc+index_d1*q_size,transfer_ic2+(ptr->index_tt_lensing+index_d2)*q_size);
+    }
+  }
 
-      }
+  return _SUCCESS_;
 
-      if (_tensors_) {
+}
 
-        transfer_ic1_temp = transfer_ic1[ptr->index_tt_t2];
-        transfer_ic2_temp = transfer_ic2[ptr->index_tt_t2];
+/**
+ * This routine copies the transfer functions of a given mode, initial
+ * condition and multipole in an array contiguous in wavenumber for
+ * each type, and adds the combinations of types used by
+ * spectra_compute_cl(): the temperature (sum of the T0, T1 and T2
+ * contributions) and the number count (sum of the requested
+ * contributions) in each redshift bin.
+ *
+ * @param ppt          Input: pointer to perturbation structure
+ * @param ptr          Input: pointer to transfers structure
+ * @param psp          Input: pointer to spectra structure
+ * @param index_md     Input: index of mode under consideration
+ * @param index_ic     Input: index of initial condition
+ * @param index_l      Input: index of multipole under consideration
+ * @param q_index_min  Input: first wavenumber to fill
+ * @param q_index_max  Input: wavenumber following the last one to fill
+ * @param transfer     Output: transfer[index_tt*ptr->q_size+index_q] for each type, followed by the temperature at index_tt = ptr->tt_size[index_md] and the number count in each bin at index_tt = ptr->tt_size[index_md]+1+index_d
+ * @return the error status
+ */
 
-      }
-    }
+int spectra_transfer_combinations(
+                                  struct perturbs * ppt,
+                                  struct transfers * ptr,
+                                  struct spectra * psp,
+                                  int index_md,
+                                  int index_ic,
+                                  int index_l,
+                                  int q_index_min,
+                                  int q_index_max,
+                                  double * transfer
+                                  ) {
+
+  int index_tt,index_row,index_q,index_d;
+  int q_size;
+  double * temp;
+  double * nc;
+  double l_factor;
+
+  q_size = ptr->q_size;
+
+  for (index_tt=0; index_tt < ptr->tt_size[index_md]; index_tt++) {
+    index_row = _transfer_row_(ptr,index_md,index_ic,index_tt,index_l);
+    for (index_q=q_index_min; index_q<q_index_max; index_q++)
+      transfer[index_tt*q_size+index_q] = _transfer_value_(ptr,index_md,index_row,index_q);
+  }
 
-    if (ppt->has_cl_number_count == _TRUE_) {
+  /* define combinations of transfer functions */
 
-      for (index_d1=0; index_d1<psp->d_size; index_d1++) {
+#define _transfer_(index_tt) (transfer[(index_tt)*q_size+index_q])
 
-        transfer_ic1_nc[index_d1] = 0.;
-        transfer_ic2_nc[index_d1] = 0.;
+  temp = transfer + ptr->tt_size[index_md]*q_size;
 
-        if (ppt->has_nc_density == _TRUE_) {
-          transfer_ic1_nc[index_d1] += transfer_ic1[ptr->index_tt_density+index_d1];
-          transfer_ic2_nc[index_d1] += transfer_ic2[ptr->index_tt_density+index_d1];
-        }
+  if (ppt->has_cl_cmb_temperature == _TRUE_) {
 
-        if (ppt->has_nc_rsd     == _TRUE_) {
-          transfer_ic1_nc[index_d1]
-            += transfer_ic1[ptr->index_tt_rsd+index_d1]
-            + transfer_ic1[ptr->index_tt_d0+index_d1]
-            + transfer_ic1[ptr->index_tt_d1+index_d1];
-          transfer_ic2_nc[index_d1]
-            += transfer_ic2[ptr->index_tt_rsd+index_d1]
-            + transfer_ic2[ptr->index_tt_d0+index_d1]
-            + transfer_ic2[ptr->index_tt_d1+index_d1];
-        }
+    for (index_q=q_index_min; index_q<q_index_max; index_q++) {
 
-        if (ppt->has_nc_lens == _TRUE_) {
-          transfer_ic1_nc[index_d1] +=
-            psp->l[index_l]*(psp->l[index_l]+1.)*transfer_ic1[ptr->index_tt_nc_lens+index_d1];
-          transfer_ic2_nc[index_d1] +=
-            psp->l[index_l]*(psp->l[index_l]+1.)*transfer_ic2[ptr->index_tt_nc_lens+index_d1];
-        }
+      if (_scalars_) {
+        temp[index_q] = _transfer_(ptr->index_tt_t0) + _transfer_(ptr->index_tt_t1) + _transfer_(ptr->index_tt_t2);
+      }
 
-        if (ppt->has_nc_gr == _TRUE_) {
-          transfer_ic1_nc[index_d1]
-            += transfer_ic1[ptr->index_tt_nc_g1+index_d1]
-            + transfer_ic1[ptr->index_tt_nc_g2+index_d1]
-            + transfer_ic1[ptr->index_tt_nc_g3+index_d1]
-            + transfer_ic1[ptr->index_tt_nc_g4+index_d1]
-            + transfer_ic1[ptr->index_tt_nc_g5+index_d1];
-          transfer_ic2_nc[index_d1]
-            += transfer_ic2[ptr->index_tt_nc_g1+index_d1]
-            + transfer_ic2[ptr->index_tt_nc_g2+index_d1]
-            + transfer_ic2[ptr->index_tt_nc_g3+index_d1]
-            + transfer_ic2[ptr->index_tt_nc_g4+index_d1]
-            + transfer_ic2[ptr->index_tt_nc_g5+index_d1];
-        }
+      if (_vectors_) {
+        temp[index_q] = _transfer_(ptr->index_tt_t1) + _transfer_(ptr->index_tt_t2);
+      }
 
+      if (_tensors_) {
+        temp[index_q] = _transfer_(ptr->index_tt_t2);
       }
     }
+  }
 
-    /* integrand of Cl's */
-
-    /* note: we must integrate
-
-       C_l = int [4 pi dk/k calP(k) Delta1_l(q) Delta2_l(q)]
-
-       where calP(k) is the dimensionless
-       power spectrum equal to a constant in the scale-invariant case,
-       and to P(k) = A_s k^(ns-1) otherwise and q=sqrt(k2+K) (scalars)
-       or sqrt(k2+2K) (vectors) or sqrt(k2+3K) (tensors)
-
-       In the literature, people often rewrite the integral in terms
-       of q and absorb the Jacobian of the change of variables in a redefinition of the primodial
-       spectrum. Let us illustrate this for scalars:
-
-       dk/k = kdk/k2 = qdq/k2 = dq/q * (q/k)^2 = dq/q * [q2/(q2-K)] = q2dq * 1/[q(q2-K)]
-
-       This factor 1/[q(q2-K)] is commonly absorbed in the definition of calP. Then one would have
-
-       C_l = int [4 pi q2 dq {A_s k^(ns-1)/[q(q2-K)]} Delta1_l(q) Delta2_l(q)]
-
-       Sometimes in the literature, the factor (k2-3K)=(q2-4K) present
-       in the initial conditions of scalar transfer functions (if
-       normalized to curvature R=1) is also absorbed in the definition
-       of the power spectrum. Then the curvature power spectrum reads
-
-       calP = (q2-4K)/[q(q2-K)] * (k/k)^ns
+  if (ppt->has_cl_number_count == _TRUE_) {
 
-       In CLASS we prefer to define calP = (k/k)^ns like in the flat
-       case, to have the factor (q2-4K) in the initialk conditions,
-       and the factor 1/[q(q2-K)] doesn't need to be there since we
-       integrate over dk/k.
+    l_factor = psp->l[index_l]*(psp->l[index_l]+1.);
 
-       For tensors, the change of variable described above gives a slightly different result:
+    for (index_d=0; index_d<psp->d_size; index_d++) {
 
-       dk/k = kdk/k2 = qdq/k2 = dq/q * (q/k)^2 = dq/q * [q2/(q2-3K)] = q2dq * 1/[q(q2-3K)]
+      nc = temp + (1+index_d)*q_size;
 
-       But for tensors there are extra curvature-related correction factors to
-       take into account. See the comments in the perturbation module,
-       related to initial conditions for tensors.
+      for (index_q=q_index_min; index_q<q_index_max; index_q++) {
 
-    */
+        nc[index_q] = 0.;
 
-    factor = 4. * _PI_ / k;
-
-    if (psp->has_tt == _TRUE_)
-      cl_integrand[index_q*cl_integrand_num_columns+1+psp->index_ct_tt]=
-        primordial_pk[index_ic1_ic2]
-        * transfer_ic1_temp
-        * transfer_ic2_temp
-        * factor;
-
-    if (psp->has_ee == _TRUE_)
-      cl_integrand[index_q*cl_integrand_num_columns+1+psp->index_ct_ee]=
-        primordial_pk[index_ic1_ic2]
-        * transfer_ic1[ptr->index_tt_e]
-        * transfer_ic2[ptr->index_tt_e]
-        * factor;
-
-    if (psp->has_te == _TRUE_)
-      cl_integrand[index_q*cl_integrand_num_columns+1+psp->index_ct_te]=
-        primordial_pk[index_ic1_ic2]
-        * 0.5*(transfer_ic1_temp * transfer_ic2[ptr->index_tt_e] +
-               transfer_ic1[ptr->index_tt_e] * transfer_ic2_temp)
-        * factor;
-
-    if (_tensors_ && (psp->has_bb == _TRUE_))
-      cl_integrand[index_q*cl_integrand_num_columns+1+psp->index_ct_bb]=
-        primordial_pk[index_ic1_ic2]
-        * transfer_ic1[ptr->index_tt_b]
-        * transfer_ic2[ptr->index_tt_b]
-        * factor;
-
-    if (_scalars_ && (psp->has_pp == _TRUE_))
-      cl_integrand[index_q*cl_integrand_num_columns+1+psp->index_ct_pp]=
-        primordial_pk[index_ic1_ic2]
-        * transfer_ic1[ptr->index_tt_lcmb]
-        * transfer_ic2[ptr->index_tt_lcmb]
-        * factor;
-
-    if (_scalars_ && (psp->has_tp == _TRUE_))
-      cl_integrand[index_q*cl_integrand_num_columns+1+psp->index_ct_tp]=
-        primordial_pk[index_ic1_ic2]
-        * 0.5*(transfer_ic1_temp * transfer_ic2[ptr->index_tt_lcmb] +
-               transfer_ic1[ptr->index_tt_lcmb] * transfer_ic2_temp)
-        * factor;
-
-    if (_scalars_ && (psp->has_ep == _TRUE_))
-      cl_integrand[index_q*cl_integrand_num_columns+1+psp->index_ct_ep]=
-        primordial_pk[index_ic1_ic2]
-        * 0.5*(transfer_ic1[ptr->index_tt_e] * transfer_ic2[ptr->index_tt_lcmb] +
-               transfer_ic1[ptr->index_tt_lcmb] * transfer_ic2[ptr->index_tt_e])
-        * factor;
-
-    if (_scalars_ && (psp->has_dd == _TRUE_)) {
-      index_ct=0;
-      for (index_d1=0; index_d1<psp->d_size; index_d1++) {
-        for (index_d2=index_d1; index_d2<=MIN(index_d1+psp->non_diag,psp->d_size-1); index_d2++) {
-          cl_integrand[index_q*cl_integrand_num_columns+1+psp->index_ct_dd+index_ct]=
-            primordial_pk[index_ic1_ic2]
-            * transfer_ic1_nc[index_d1]
-            * transfer_ic2_nc[index_d2]
-            * factor;
-          index_ct++;
+        if (ppt->has_nc_density == _TRUE_) {
+          nc[index_q] += _transfer_(ptr->index_tt_density+index_d);
         }
-      }
-    }
-
-    if (_scalars_ && (psp->has_td == _TRUE_)) {
-      for (index_d1=0; index_d1<psp->d_size; index_d1++) {
-        cl_integrand[index_q*cl_integrand_num_columns+1+psp->index_ct_td+index_d1]=
-          primordial_pk[index_ic1_ic2]
-          * 0.5*(transfer_ic1_temp * transfer_ic2_nc[index_d1] +
-                 transfer_ic1_nc[index_d1] * transfer_ic2_temp)
-          * factor;
-      }
-    }
-
-    if (_scalars_ && (psp->has_pd == _TRUE_)) {
-      for (index_d1=0; index_d1<psp->d_size; index_d1++) {
-        cl_integrand[index_q*cl_integrand_num_columns+1+psp->index_ct_pd+index_d1]=
-          primordial_pk[index_ic1_ic2]
-          * 0.5*(transfer_ic1[ptr->index_tt_lcmb] * transfer_ic2_nc[index_d1] +
-                 transfer_ic1_nc[index_d1] * transfer_ic2[ptr->index_tt_lcmb])
-          * factor;
-      }
-    }
 
-    if (_scalars_ && (psp->has_ll == _TRUE_)) {
-      index_ct=0;
-      for (index_d1=0; index_d1<psp->d_size; index_d1++) {
-        for (index_d2=index_d1; index_d2<=MIN(index_d1+psp->non_diag,psp->d_size-1); index_d2++) {
-          cl_integrand[index_q*cl_integrand_num_columns+1+psp->index_ct_ll+index_ct]=
-            primordial_pk[index_ic1_ic2]
-            * transfer_ic1[ptr->index_tt_lensing+index_d1]
-            * transfer_ic2[ptr->index_tt_lensing+index_d2]
-            * factor;
-          index_ct++;
+        if (ppt->has_nc_rsd     == _TRUE_) {
+          nc[index_q]
+            += _transfer_(ptr->index_tt_rsd+index_d)
+            + _transfer_(ptr->index_tt_d0+index_d)
+            + _transfer_(ptr->index_tt_d1+index_d);
         }
-      }
-    }
 
-    if (_scalars_ && (psp->has_tl == _TRUE_)) {
-      for (index_d1=0; index_d1<psp->d_size; index_d1++) {
-        cl_integrand[index_q*cl_integrand_num_columns+1+psp->index_ct_tl+index_d1]=
-          primordial_pk[index_ic1_ic2]
-          * 0.5*(transfer_ic1_temp * transfer_ic2[ptr->index_tt_lensing+index_d1] +
-                 transfer_ic1[ptr->index_tt_lensing+index_d1] * transfer_ic2_temp)
-          * factor;
-      }
-    }
+        if (ppt->has_nc_lens == _TRUE_) {
+          nc[index_q] += l_factor*_transfer_(ptr->index_tt_nc_lens+index_d);
+        }
 
-    if (_scalars_ && (psp->has_dl == _TRUE_)) {
-      index_ct=0;
-      for (index_d1=0; index_d1<psp->d_size; index_d1++) {
-        for (index_d2=MAX(index_d1-psp->non_diag,0); index_d2<=MIN(index_d1+psp->non_diag,psp->d_size-1); index_d2++) {
-          cl_integrand[index_q*cl_integrand_num_columns+1+psp->index_ct_dl+index_ct]=
-            primordial_pk[index_ic1_ic2]
-            * transfer_ic1_nc[index_d1] * transfer_ic2[ptr->index_tt_lensing+index_d2]
-            * factor;
-          index_ct++;
+        if (ppt->has_nc_gr == _TRUE_) {
+          nc[index_q]
+            += _transfer_(ptr->index_tt_nc_g1+index_d)
+            + _transfer_(ptr->index_tt_nc_g2+index_d)
+            + _transfer_(ptr->index_tt_nc_g3+index_d)
+            + _transfer_(ptr->index_tt_nc_g4+index_d)
+            + _transfer_(ptr->index_tt_nc_g5+index_d);
         }
       }
     }
   }
 
-  for (index_ct=0; index_ct<psp->ct_size; index_ct++) {
-
-    /* treat null spectra (C_l^BB of scalars, C_l^pp of tensors, etc. */
-
-    if ((_scalars_ && (psp->has_bb == _TRUE_) && (index_ct == psp->index_ct_bb)) ||
-        (_tensors_ && (psp->has_pp == _TRUE_) && (index_ct == psp->index_ct_pp)) ||
-        (_tensors_ && (psp->has_tp == _TRUE_) && (index_ct == psp->index_ct_tp)) ||
-        (_tensors_ && (psp->has_ep == _TRUE_) && (index_ct == psp->index_ct_ep)) ||
-        (_tensors_ && (psp->has_dd == _TRUE_) && (index_ct == psp->index_ct_dd)) ||
-        (_tensors_ && (psp->has_td == _TRUE_) && (index_ct == psp->index_ct_td)) ||
-        (_tensors_ && (psp->has_pd == _TRUE_) && (index_ct == psp->index_ct_pd)) ||
-        (_tensors_ && (psp->has_ll == _TRUE_) && (index_ct == psp->index_ct_ll)) ||
-        (_tensors_ && (psp->has_tl == _TRUE_) && (index_ct == psp->index_ct_tl)) ||
-        (_tensors_ && (psp->has_dl == _TRUE_) && (index_ct == psp->index_ct_dl))
-        ) {
-
-      psp->cl[index_md]
-        [(index_l * psp->ic_ic_size[index_md] + index_ic1_ic2) * psp->ct_size + index_ct] = 0.;
+#undef _transfer_
 
-    }
-    /* for non-zero spectra, integrate over q */
-    else {
-
-      /* spline the integrand over the whole range of k's */
-
-      class_call(array_spline(cl_integrand,
-                              cl_integrand_num_columns,
-                              ptr->q_size,
-                              0,
-                              1+index_ct,
-                              1+psp->ct_size+index_ct,
-                              _SPLINE_EST_DERIV_,
-                              psp->error_message),
-                 psp->error_message,
-                 psp->error_message);
-
-      /* Technical point: we will now do a spline integral over the
-         whole range of k's, excepted in the closed (K>0) case. In
-         that case, it is a bad idea to spline over the values of k
-         corresponding to nu<nu_flat_approximation. In this region, nu
-         values are integer values, so the steps dq and dk have some
-         discrete jumps. This makes the spline routine less accurate
-         than a trapezoidal integral with finer sampling. So, in the
-         closed case, we set index_q_spline to
-         ptr->index_q_flat_approximation, to tell the integration
-         routine that below this index, it should treat the integral
-         as a trapezoidal one. For testing, one is free to set
-         index_q_spline to 0, to enforce spline integration
-         everywhere, or to (ptr->q_size-1), to enforce trapezoidal
-         integration everywhere. */
-
-      if (pba->sgnK == 1) {
-        index_q_spline = ptr->index_q_flat_approximation;
-      }
-
-      class_call(array_integrate_all_trapzd_or_spline(cl_integrand,
-                                                      cl_integrand_num_columns,
-                                                      ptr->q_size,
-                                                      index_q_spline,
-                                                      0,
-                                                      1+index_ct,
-                                                      1+psp->ct_size+index_ct,
-                                                      &clvalue,
-                                                      psp->error_message),
-                 psp->error_message,
-                 psp->error_message);
+  return _SUCCESS_;
 
-      /* in the closed case, instead of an integral, we have a
-         discrete sum. In practice, this does not matter: the previous
-         routine does give a correct approximation of the discrete
-         sum, both in the trapezoidal and spline regions. The only
-         error comes from the first point: the previous routine
-         assumes a weight for the first point which is too small
-         compared to what it would be in the an actual discrete
-         sum. The line below correct this problem in an exact way.
-      */
+}
 
-      if (pba->sgnK == 1) {
-        clvalue += cl_integrand[1+index_ct] * ptr->q[0]/ptr->k[0][0]*sqrt(pba->K)/2.;
-      }
+/**
+ * Weighted integral over wavenumbers of the product of the transfer
+ * functions of two types a and b, symmetrized between the two initial
+ * conditions 1 and 2:
+ *
+ * \f[ \sum_q w_q \frac{a_1(q) b_2(q) + b_1(q) a_2(q)}{2}. \f]
+ *
+ * When a=b or when the two initial conditions are the same (that is,
+ * when the same arrays are passed twice), this is a single product.
+ *
+ * @param cl_weight    Input: weights w_q
+ * @param q_index_min  Input: first wavenumber of the sum
+ * @param q_index_max  Input: wavenumber following the last one of the sum
+ * @param transfer1_a  Input: transfer function a_1
+ * @param transfer2_b  Input: transfer function b_2
+ * @param transfer1_b  Input: transfer function b_1
+ * @param transfer2_a  Input: transfer function a_2
+ * @return the integral
+ */
 
-      /* we have the correct C_l now. We can store it in the transfer structure. */
+double spectra_cl_integral(
+                           double * __restrict__ cl_weight,
+                           int q_index_min,
+                           int q_index_max,
+                           double * transfer1_a,
+                           double * transfer2_b,
+                           double * transfer1_b,
+                           double * transfer2_a
+                           ) {
 
-      psp->cl[index_md]
-        [(index_l * psp->ic_ic_size[index_md] + index_ic1_ic2) * psp->ct_size + index_ct]
-        = clvalue;
+  int index_q;
+  double result=0.;
 
-    }
+  if (((transfer1_a == transfer1_b) && (transfer2_a == transfer2_b)) ||
+      ((transfer1_a == transfer2_a) && (transfer1_b == transfer2_b))) {
+#pragma omp simd reduction(+:result)
+    for (index_q=q_index_min; index_q<q_index_max; index_q++)
+      result += cl_weight[index_q]*transfer1_a[index_q]*transfer2_b[index_q];
   }
-
-  if (ppt->has_cl_number_count == _TRUE_) {
-    free(transfer_ic1_nc);
-    free(transfer_ic2_nc);
+  else {
+#pragma omp simd reduction(+:result)
+    for (index_q=q_index_min; index_q<q_index_max; index_q++)
+      result += cl_weight[index_q]*0.5*(transfer1_a[index_q]*transfer2_b[index_q]+transfer1_b[index_q]*transfer2_a[index_q]);
   }
 
-  return _SUCCESS_;
-
+  return result;
 }
 
   /* deprecated functions (since v2.8) */
@@ -73,11 +73,32 @@
  */
 
 #include "thermodynamics.h"
+#include <time.h>
 
 #ifdef HYREC
 #include "hyrec.h"
 #endif
 
+/** recombination history of the previous run (accessed within the critical section recombination_cache only) */
+static struct recombination_cache thermodynamics_reco_cache = {_FALSE_};
+
+static void thermodynamics_recombination_cache_key(struct background * pba,
+                                                   struct thermo * pth,
+                                                   double * key);
+
+static short thermodynamics_recombination_cache_match(struct precision * ppr,
+                                                      struct background * pba,
+                                                      struct thermo * pth);
+
+static int thermodynamics_recombination_copy(struct recombination * preco_in,
+                                             struct recombination * preco_out,
+                                             ErrorMsg error_message);
+
+static int thermodynamics_recombination_cache_fill(struct precision * ppr,
+                                                   struct background * pba,
+                                                   struct thermo * pth,
+                                                   struct recombination * preco);
+
 /**
  * Thermodynamics quantities at given redshift z.
  *
@@ -109,6 +130,9 @@ int thermodynamics_at_z(
   /** - define local variables */
 
   double x0;
+  int index;
+
+  class_profile_start(profile_thermodynamics_at_z);
 
   /* - the fact that z is in the pre-computed range 0 <= z <= z_initial
      will be checked in the interpolation routines below. Before
@@ -236,7 +260,31 @@ int thermodynamics_at_z(
     /* in the "normal" case, use spline interpolation */
     else {
 
-      if (inter_mode == pth->inter_normal) {
+      /* in normal mode, when the table is indexed, start a close-by
+         search from the line stored for the node just below z (see
+         thermodynamics_index_table_init()) */
+      if ((inter_mode == pth->inter_normal) && (pth->has_index_table == _TRUE_)) {
+
+        index = (int)((log(1.+z)-pth->lnz_index_min)/pth->dlnz_index);
+        index = MAX(0,MIN(pth->tt_index_size-1,index));
+        *last_index = pth->index_table[index];
+
+        class_call(array_interpolate_spline_growing_closeby(
+                                                            pth->z_table,
+                                                            pth->tt_size,
+                                                            pth->thermodynamics_table,
+                                                            pth->d2thermodynamics_dz2_table,
+                                                            pth->th_size,
+                                                            z,
+                                                            last_index,
+                                                            pvecthermo,
+                                                            pth->th_size,
+                                                            pth->error_message),
+                   pth->error_message,
+                   pth->error_message);
+      }
+
+      else if (inter_mode == pth->inter_normal) {
 
         class_call(array_interpolate_spline(
                                             pth->z_table,
@@ -272,6 +320,7 @@ int thermodynamics_at_z(
       }
     }
   }
+  class_profile_stop(profile_thermodynamics_at_z);
   return _SUCCESS_;
 }
 
@@ -316,6 +365,8 @@ int thermodynamics_init(
   struct reionization reio;
   struct recombination * preco;
   struct reionization * preio;
+  /* whether the recombination history was found in the cache */
+  short found;
 
   double tau,tau_ini;
   double g_max;
@@ -329,9 +380,18 @@ int thermodynamics_init(
   int n, N_sub_steps;
   double dz_sub_step;
 
+  /* size of the heap at the beginning (see class_memory_heap()) */
+  size_t heap_start;
+
+  class_profile_start(profile_thermodynamics_init);
+  heap_start = class_memory_heap();
+
   if (pth->thermodynamics_verbose > 0)
     printf("Computing thermodynamics");
 
+  /* the index of the table is only used once it has been filled below */
+  pth->has_index_table = _FALSE_;
+
   /** - compute and check primordial Helium fraction  */
 
   /* Y_He */
@@ -431,10 +491,34 @@ int thermodynamics_init(
 
   /** - solve recombination and store values of \f$ z, x_e, d \kappa / d \tau, T_b, c_b^2 \f$ with thermodynamics_recombination() */
 
-  class_call_except(thermodynamics_recombination(ppr,pba,pth,preco,pvecback),
-                    pth->error_message,
-                    pth->error_message,
-                    free(pvecback));
+  /** - unless the same recombination history was computed by the previous run (see thermodynamics_recombination_cache_restore()) */
+
+  found = _FALSE_;
+
+  if (ppr->thermo_reuse_recombination == _TRUE_) {
+    class_call_except(thermodynamics_recombination_cache_restore(ppr,pba,pth,preco,&found),
+                      pth->error_message,
+                      pth->error_message,
+                      free(pvecback));
+  }
+
+  if (found == _TRUE_) {
+    if (pth->thermodynamics_verbose > 0)
+      printf(" -> reusing the recombination history of the previous run\n");
+  }
+  else {
+    class_call_except(thermodynamics_recombination(ppr,pba,pth,preco,pvecback),
+                      pth->error_message,
+                      pth->error_message,
+                      free(pvecback));
+
+    if (ppr->thermo_reuse_recombination == _TRUE_) {
+      class_call_except(thermodynamics_recombination_cache_store(ppr,pba,pth,preco),
+                        pth->error_message,
+                        pth->error_message,
+                        free(preco->recombination_table);thermodynamics_energy_injection_table_free(preco);free(pvecback));
+    }
+  }
 
   /** - if there is reionization, solve reionization and store values of \f$ z, x_e, d \kappa / d \tau, T_b, c_b^2 \f$ with thermodynamics_reionization()*/
 
@@ -442,7 +526,7 @@ int thermodynamics_init(
     class_call_except(thermodynamics_reionization(ppr,pba,pth,preco,preio,pvecback),
                       pth->error_message,
                       pth->error_message,
-                      free(preco->recombination_table);free(pvecback));
+                      free(preco->recombination_table);thermodynamics_energy_injection_table_free(preco);free(pvecback));
   }
   else {
     preio->rt_size=0;
@@ -996,6 +1080,15 @@ int thermodynamics_init(
              pth->error_message,
              pth->error_message);
 
+  /** - index the table on a uniform grid in \f$ \ln(1+z) \f$ with
+      thermodynamics_index_table_init(), so that thermodynamics_at_z()
+      does not need a bisection in normal mode */
+  if (ppr->thermo_direct_index == _TRUE_) {
+    class_call(thermodynamics_index_table_init(ppr,pth),
+               pth->error_message,
+               pth->error_message);
+  }
+
   /** - find maximum of g */
 
   index_tau=pth->tt_size-1;
@@ -1282,6 +1375,8 @@ int thermodynamics_init(
 
   free(pvecback);
 
+  pth->memory_size = class_memory_growth(heap_start);
+  class_profile_stop(profile_thermodynamics_init);
   return _SUCCESS_;
 }
 
@@ -1301,6 +1396,60 @@ int thermodynamics_free(
   free(pth->thermodynamics_table);
   free(pth->d2thermodynamics_dz2_table);
 
+  if (pth->has_index_table == _TRUE_) {
+    free(pth->index_table);
+    pth->has_index_table = _FALSE_;
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Index the thermodynamics table on a uniform grid in \f$ \ln(1+z) \f$.
+ *
+ * For each node of the grid, store the last line of pth->z_table
+ * with a redshift smaller or equal to the node. Any redshift is then
+ * at most a few lines above the line stored for the node just below
+ * it, so that thermodynamics_at_z() can start a close-by search from
+ * there instead of bisecting the whole table. This does not change
+ * the interpolated values.
+ *
+ * @param ppr Input: pointer to precision structure
+ * @param pth Input/Output: pointer to thermo structure (with z_table filled)
+ * @return the error status
+ */
+
+int thermodynamics_index_table_init(
+                                    struct precision * ppr,
+                                    struct thermo * pth
+                                    ) {
+
+  int index,index_z;
+  double lnz_max,z;
+
+  class_test(ppr->thermo_direct_index_stepsize <= 0.,
+             pth->error_message,
+             "thermo_direct_index_stepsize=%e should be positive",ppr->thermo_direct_index_stepsize);
+
+  pth->lnz_index_min = log(1.+pth->z_table[0]);
+  lnz_max = log(1.+pth->z_table[pth->tt_size-1]);
+
+  pth->tt_index_size = (int)ceil((lnz_max-pth->lnz_index_min)/ppr->thermo_direct_index_stepsize)+1;
+  if (pth->tt_index_size < 2) pth->tt_index_size = 2;
+  pth->dlnz_index = (lnz_max-pth->lnz_index_min)/(pth->tt_index_size-1);
+
+  class_alloc(pth->index_table,pth->tt_index_size*sizeof(int),pth->error_message);
+
+  index_z = 0;
+  for (index=0; index<pth->tt_index_size; index++) {
+    z = exp(pth->lnz_index_min+index*pth->dlnz_index)-1.;
+    while ((index_z < pth->tt_size-2) && (pth->z_table[index_z+1] <= z))
+      index_z++;
+    pth->index_table[index] = index_z;
+  }
+
+  pth->has_index_table = _TRUE_;
+
   return _SUCCESS_;
 }
 
@@ -1547,9 +1696,8 @@ int thermodynamics_helium_from_bbn(
                                    struct thermo * pth
                                    ) {
 
-  FILE * fA;
-  char line[_LINE_LENGTH_MAX_];
-  char * left;
+  double * bbn_table;
+  int bbn_table_size;
 
   int num_omegab=0;
   int num_deltaN=0;
@@ -1613,59 +1761,39 @@ int thermodynamics_helium_from_bbn(
      .....
   */
 
-  class_open(fA,ppr->sBBN_file, "r",pth->error_message);
-
-  /* go through each line */
-  while (fgets(line,_LINE_LENGTH_MAX_-1,fA) != NULL) {
-
-    /* eliminate blank spaces at beginning of line */
-    left=line;
-    while (left[0]==' ') {
-      left++;
-    }
-
-    /* check that the line is neither blank neither a comment. In
-       ASCII, left[0]>39 means that first non-blank character might
-       be the beginning of some data (it is not a newline, a #, a %,
-       etc.) */
-    if (left[0] > 39) {
-
-      /* if the line contains data, we must interpret it. If
-         (num_omegab, num_deltaN)=(0,0), the current line must contain
-         their values. Otherwise, it must contain (omegab, delatN,
-         YHe). */
-      if ((num_omegab==0) && (num_deltaN==0)) {
-
-        /* read (num_omegab, num_deltaN), infer size of arrays and allocate them */
-        class_test(sscanf(line,"%d %d",&num_omegab,&num_deltaN) != 2,
-                   pth->error_message,
-                   "could not read value of parameters (num_omegab,num_deltaN) in file %s\n",ppr->sBBN_file);
+  class_call(filecache_acquire(ppr->sBBN_file,&bbn_table,&bbn_table_size,pth->error_message),
+             pth->error_message,
+             pth->error_message);
 
-        class_alloc(omegab,num_omegab*sizeof(double),pth->error_message);
-        class_alloc(deltaN,num_deltaN*sizeof(double),pth->error_message);
-        class_alloc(YHe,num_omegab*num_deltaN*sizeof(double),pth->error_message);
-        class_alloc(ddYHe,num_omegab*num_deltaN*sizeof(double),pth->error_message);
-        class_alloc(YHe_at_deltaN,num_omegab*sizeof(double),pth->error_message);
-        class_alloc(ddYHe_at_deltaN,num_omegab*sizeof(double),pth->error_message);
-        array_line=0;
+  /* read (num_omegab, num_deltaN), infer size of arrays and allocate them */
+  class_test_except(bbn_table_size < 2,
+                    pth->error_message,
+                    filecache_release(bbn_table),
+                    "could not read value of parameters (num_omegab,num_deltaN) in file %s\n",ppr->sBBN_file);
 
-      }
-      else {
+  num_omegab = (int)bbn_table[0];
+  num_deltaN = (int)bbn_table[1];
 
-        /* read (omegab, deltaN, YHe) */
-        class_test(sscanf(line,"%lg %lg %lg",
-                          &(omegab[array_line%num_omegab]),
-                          &(deltaN[array_line/num_omegab]),
-                          &(YHe[array_line])
-                          ) != 3,
-                   pth->error_message,
-                   "could not read value of parameters (omegab,deltaN,YHe) in file %s\n",ppr->sBBN_file);
-        array_line ++;
-      }
-    }
+  class_test_except((num_omegab < 1) || (num_deltaN < 1) || (bbn_table_size != 2+3*num_omegab*num_deltaN),
+                    pth->error_message,
+                    filecache_release(bbn_table),
+                    "could not read value of parameters (omegab,deltaN,YHe) in file %s\n",ppr->sBBN_file);
+
+  class_alloc(omegab,num_omegab*sizeof(double),pth->error_message);
+  class_alloc(deltaN,num_deltaN*sizeof(double),pth->error_message);
+  class_alloc(YHe,num_omegab*num_deltaN*sizeof(double),pth->error_message);
+  class_alloc(ddYHe,num_omegab*num_deltaN*sizeof(double),pth->error_message);
+  class_alloc(YHe_at_deltaN,num_omegab*sizeof(double),pth->error_message);
+  class_alloc(ddYHe_at_deltaN,num_omegab*sizeof(double),pth->error_message);
+
+  /* read (omegab, deltaN, YHe) */
+  for (array_line=0; array_line<num_omegab*num_deltaN; array_line++) {
+    omegab[array_line%num_omegab] = bbn_table[2+3*array_line];
+    deltaN[array_line/num_omegab] = bbn_table[2+3*array_line+1];
+    YHe[array_line] = bbn_table[2+3*array_line+2];
   }
 
-  fclose(fA);
+  filecache_release(bbn_table);
 
   /** - spline in one dimension (along deltaN) */
   class_call(array_spline_table_lines(deltaN,
@@ -1848,9 +1976,33 @@ int thermodynamics_energy_injection(
   double factor,result;
   double nH0;
   double onthespot;
+  double lnz,a,b;
+  int index_z;
 
   if (preco->annihilation > 0) {
 
+    /** - if the effective rate has been tabulated, interpolate it with a cubic spline: the grid is uniform, so that the interval is found directly */
+
+    if (preco->has_injection_table == _TRUE_) {
+
+      lnz = log(1.+z);
+      index_z = (int)(lnz/preco->injection_dlnz);
+
+      if ((index_z >= 0) && (index_z < preco->injection_table_size-1)) {
+
+        b = lnz/preco->injection_dlnz - index_z;
+        a = 1.-b;
+
+        *energy_rate = exp(a*preco->injection_table[index_z]
+                           +b*preco->injection_table[index_z+1]
+                           +((a*a*a-a)*preco->injection_ddtable[index_z]
+                             +(b*b*b-b)*preco->injection_ddtable[index_z+1])
+                           *preco->injection_dlnz*preco->injection_dlnz/6.0);
+
+        return _SUCCESS_;
+      }
+    }
+
     if (preco->has_on_the_spot == _FALSE_) {
 
       /* number of hydrogen nuclei today in m**-3 */
@@ -1914,6 +2066,354 @@ int thermodynamics_energy_injection(
 
 }
 
+/**
+ * Tabulate the effective energy rate absorbed by the IGM, in the case
+ * where it is not given by the on-the-spot approximation. Each call to
+ * thermodynamics_energy_injection() then involves an integral over
+ * the on-the-spot rate at all higher redshifts. Since this rate
+ * only depends on redshift for a given model, it is computed once
+ * on a uniform grid in \f$ \ln(1+z) \f$ between z=0 and the initial
+ * redshift of the recombination module, and then interpolated in its
+ * logarithm by thermodynamics_energy_injection(). Outside of this
+ * range, the rate is still computed directly.
+ *
+ * @param ppr Input: pointer to precision structure
+ * @param pba Input: pointer to background structure
+ * @param preco Input/Output: pointer to recombination structure
+ * @param error_message Output: error message
+ * @return the error status
+ */
+
+int thermodynamics_energy_injection_table_init(
+                                               struct precision * ppr,
+                                               struct background * pba,
+                                               struct recombination * preco,
+                                               ErrorMsg error_message
+                                               ) {
+
+  int index_z;
+  double * lnz;
+  double energy_rate;
+
+  preco->has_injection_table = _FALSE_;
+
+  if ((ppr->energy_injection_table == _FALSE_) ||
+      (preco->annihilation <= 0) ||
+      (preco->has_on_the_spot == _TRUE_))
+    return _SUCCESS_;
+
+  preco->injection_table_size = (int)(log(1.+ppr->recfast_z_initial)/ppr->energy_injection_table_stepsize)+2;
+  preco->injection_dlnz = log(1.+ppr->recfast_z_initial)/(preco->injection_table_size-1);
+
+  class_alloc(lnz,preco->injection_table_size*sizeof(double),error_message);
+  class_alloc(preco->injection_table,preco->injection_table_size*sizeof(double),error_message);
+  class_alloc(preco->injection_ddtable,preco->injection_table_size*sizeof(double),error_message);
+
+  for (index_z=0; index_z<preco->injection_table_size; index_z++) {
+
+    lnz[index_z] = index_z*preco->injection_dlnz;
+
+    class_call(thermodynamics_energy_injection(ppr,pba,preco,exp(lnz[index_z])-1.,&energy_rate,error_message),
+               error_message,
+               error_message);
+
+    preco->injection_table[index_z] = log(energy_rate);
+  }
+
+  class_call(array_spline_table_lines(lnz,
+                                      preco->injection_table_size,
+                                      preco->injection_table,
+                                      1,
+                                      preco->injection_ddtable,
+                                      _SPLINE_EST_DERIV_,
+                                      error_message),
+             error_message,
+             error_message);
+
+  free(lnz);
+
+  preco->has_injection_table = _TRUE_;
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * Free the table of energy injection rates, if it was allocated by
+ * thermodynamics_energy_injection_table_init().
+ *
+ * @param preco Input: pointer to recombination structure
+ * @return the error status
+ */
+
+int thermodynamics_energy_injection_table_free(
+                                               struct recombination * preco
+                                               ) {
+
+  if (preco->has_injection_table == _TRUE_) {
+    free(preco->injection_table);
+    free(preco->injection_ddtable);
+    preco->has_injection_table = _FALSE_;
+  }
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * Look for the recombination history in the cache filled by the
+ * previous run with thermodynamics_recombination_cache_store(). It is
+ * found when the precision parameters, the background table and all
+ * the background and thermodynamics parameters read by
+ * thermodynamics_recombination() are identical. In that case the
+ * recombination structure is filled with a copy of the cached one,
+ * which then only needs to be freed as usual.
+ *
+ * @param ppr   Input: pointer to precision structure
+ * @param pba   Input: pointer to background structure
+ * @param pth   Input/Output: pointer to thermo structure
+ * @param preco Output: pointer to recombination structure
+ * @param found Output: _TRUE_ if the history was found in the cache
+ * @return the error status
+ */
+
+int thermodynamics_recombination_cache_restore(
+                                               struct precision * ppr,
+                                               struct background * pba,
+                                               struct thermo * pth,
+                                               struct recombination * preco,
+                                               short * found
+                                               ) {
+
+  int status = _SUCCESS_;
+
+  *found = _FALSE_;
+
+#pragma omp critical (recombination_cache)
+  {
+    if (thermodynamics_recombination_cache_match(ppr,pba,pth) == _TRUE_) {
+      status = thermodynamics_recombination_copy(&(thermodynamics_reco_cache.reco),preco,pth->error_message);
+      if (status == _SUCCESS_) {
+        pth->n_e = thermodynamics_reco_cache.n_e;
+        *found = _TRUE_;
+      }
+    }
+  }
+
+  return status;
+
+}
+
+/**
+ * Store a copy of the recombination history just computed, together
+ * with all its inputs, replacing the previous content of the cache.
+ *
+ * @param ppr   Input: pointer to precision structure
+ * @param pba   Input: pointer to background structure
+ * @param pth   Input: pointer to thermo structure
+ * @param preco Input: pointer to recombination structure
+ * @return the error status
+ */
+
+int thermodynamics_recombination_cache_store(
+                                             struct precision * ppr,
+                                             struct background * pba,
+                                             struct thermo * pth,
+                                             struct recombination * preco
+                                             ) {
+
+  int status = _SUCCESS_;
+
+#pragma omp critical (recombination_cache)
+  {
+    status = thermodynamics_recombination_cache_fill(ppr,pba,pth,preco);
+  }
+
+  return status;
+
+}
+
+/**
+ * Replace the content of the cache (called within the critical
+ * section recombination_cache).
+ *
+ * @param ppr   Input: pointer to precision structure
+ * @param pba   Input: pointer to background structure
+ * @param pth   Input: pointer to thermo structure
+ * @param preco Input: pointer to recombination structure
+ * @return the error status
+ */
+
+static int thermodynamics_recombination_cache_fill(
+                                                   struct precision * ppr,
+                                                   struct background * pba,
+                                                   struct thermo * pth,
+                                                   struct recombination * preco
+                                                   ) {
+
+  struct recombination_cache * pcache = &thermodynamics_reco_cache;
+
+  if (pcache->has_history == _TRUE_) {
+    free(pcache->background_table);
+    free(pcache->reco.recombination_table);
+    thermodynamics_energy_injection_table_free(&(pcache->reco));
+    pcache->has_history = _FALSE_;
+  }
+
+  class_call(thermodynamics_recombination_copy(preco,&(pcache->reco),pth->error_message),
+             pth->error_message,
+             pth->error_message);
+
+  class_alloc(pcache->background_table,pba->bt_size*pba->bg_size*sizeof(double),pth->error_message);
+  memcpy(pcache->background_table,pba->background_table,pba->bt_size*pba->bg_size*sizeof(double));
+  pcache->bt_size = pba->bt_size;
+  pcache->bg_size = pba->bg_size;
+
+  pcache->pr = *ppr;
+  thermodynamics_recombination_cache_key(pba,pth,pcache->key);
+  pcache->n_e = pth->n_e;
+
+  pcache->has_history = _TRUE_;
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * Fill the list of background and thermodynamics parameters read by
+ * thermodynamics_recombination() (with RECFAST or HyRec), in view of
+ * comparing them with the ones of the cached history.
+ *
+ * @param pba Input: pointer to background structure
+ * @param pth Input: pointer to thermo structure
+ * @param key Output: array of size _RECOMBINATION_CACHE_KEY_SIZE_
+ */
+
+static void thermodynamics_recombination_cache_key(
+                                                   struct background * pba,
+                                                   struct thermo * pth,
+                                                   double * key
+                                                   ) {
+
+  int i = 0;
+
+  key[i++] = pba->H0;
+  key[i++] = pba->h;
+  key[i++] = pba->a_today;
+  key[i++] = pba->T_cmb;
+  key[i++] = pba->Neff;
+  key[i++] = pba->Omega0_b;
+  key[i++] = pba->Omega0_cdm;
+  key[i++] = pba->Omega0_idm_dr;
+  key[i++] = pba->Omega0_k;
+  key[i++] = pba->Omega0_lambda;
+  key[i++] = pba->Omega0_fld;
+  key[i++] = pba->Omega0_lrs;
+  key[i++] = pba->Omega0_ncdm_tot;
+  key[i++] = pba->has_idm_dr;
+  key[i++] = pth->YHe;
+  key[i++] = pth->recombination;
+  key[i++] = pth->annihilation;
+  key[i++] = pth->annihilation_variation;
+  key[i++] = pth->annihilation_z;
+  key[i++] = pth->annihilation_zmax;
+  key[i++] = pth->annihilation_zmin;
+  key[i++] = pth->annihilation_f_halo;
+  key[i++] = pth->annihilation_z_halo;
+  key[i++] = pth->decay;
+  key[i++] = pth->has_on_the_spot;
+
+}
+
+/**
+ * Check whether the cached recombination history was computed with
+ * the same inputs as the current run (called within the critical
+ * section recombination_cache).
+ *
+ * @param ppr Input: pointer to precision structure
+ * @param pba Input: pointer to background structure
+ * @param pth Input: pointer to thermo structure
+ * @return _TRUE_ if all inputs are identical
+ */
+
+static short thermodynamics_recombination_cache_match(
+                                                      struct precision * ppr,
+                                                      struct background * pba,
+                                                      struct thermo * pth
+                                                      ) {
+
+  struct recombination_cache * pcache = &thermodynamics_reco_cache;
+  struct precision * ppr_cache = &(pcache->pr);
+  double key[_RECOMBINATION_CACHE_KEY_SIZE_];
+  int i;
+
+  if (pcache->has_history == _FALSE_)
+    return _FALSE_;
+
+  /** - compare all precision parameters */
+
+#define class_precision_parameter(NAME,TYPE,DEF_VALUE)  \
+  if (ppr->NAME != ppr_cache->NAME) return _FALSE_;
+#define class_string_parameter(NAME,DIR,STRING)         \
+  if (strcmp(ppr->NAME,ppr_cache->NAME) != 0) return _FALSE_;
+#define class_type_parameter(NAME,READ_TP,REAL_TP,DEF_VAL)      \
+  if (ppr->NAME != ppr_cache->NAME) return _FALSE_;
+#include "precisions.h"
+
+  if (ppr->smallest_allowed_variation != ppr_cache->smallest_allowed_variation)
+    return _FALSE_;
+
+  /** - compare background and thermodynamics parameters */
+
+  thermodynamics_recombination_cache_key(pba,pth,key);
+  for (i=0; i<_RECOMBINATION_CACHE_KEY_SIZE_; i++) {
+    if (key[i] != pcache->key[i])
+      return _FALSE_;
+  }
+
+  /** - compare the background evolution */
+
+  if ((pba->bt_size != pcache->bt_size) || (pba->bg_size != pcache->bg_size))
+    return _FALSE_;
+
+  if (memcmp(pba->background_table,pcache->background_table,pba->bt_size*pba->bg_size*sizeof(double)) != 0)
+    return _FALSE_;
+
+  return _TRUE_;
+
+}
+
+/**
+ * Copy a recombination structure, allocating new copies of its tables.
+ *
+ * @param preco_in      Input: pointer to recombination structure to copy
+ * @param preco_out     Output: pointer to new recombination structure
+ * @param error_message Output: error message
+ * @return the error status
+ */
+
+static int thermodynamics_recombination_copy(
+                                             struct recombination * preco_in,
+                                             struct recombination * preco_out,
+                                             ErrorMsg error_message
+                                             ) {
+
+  *preco_out = *preco_in;
+
+  class_alloc(preco_out->recombination_table,preco_in->re_size*preco_in->rt_size*sizeof(double),error_message);
+  memcpy(preco_out->recombination_table,preco_in->recombination_table,preco_in->re_size*preco_in->rt_size*sizeof(double));
+
+  if (preco_in->has_injection_table == _TRUE_) {
+    class_alloc(preco_out->injection_table,preco_in->injection_table_size*sizeof(double),error_message);
+    class_alloc(preco_out->injection_ddtable,preco_in->injection_table_size*sizeof(double),error_message);
+    memcpy(preco_out->injection_table,preco_in->injection_table,preco_in->injection_table_size*sizeof(double));
+    memcpy(preco_out->injection_ddtable,preco_in->injection_ddtable,preco_in->injection_table_size*sizeof(double));
+  }
+
+  return _SUCCESS_;
+
+}
+
 /**
  * This subroutine contains the reionization function \f$ X_e(z) \f$
  * (one for each scheme; so far, only the function corresponding to
@@ -2816,12 +3316,11 @@ int thermodynamics_reionization_sample(
              pba->error_message,
              pth->error_message);
 
-  class_call(background_at_tau(pba,
-                               tau,
-                               pba->short_info,
-                               pba->inter_normal,
-                               &last_index_back,
-                               pvecback),
+  class_call(background_at_tau_columns(pba,
+                                       tau,
+                                       &(pba->index_bg_H),
+                                       1,
+                                       pvecback),
              pba->error_message,
              pth->error_message);
 
@@ -2885,12 +3384,11 @@ int thermodynamics_reionization_sample(
                pba->error_message,
                pth->error_message);
 
-    class_call(background_at_tau(pba,
-                                 tau,
-                                 pba->short_info,
-                                 pba->inter_normal,
-                                 &last_index_back,
-                                 pvecback),
+    class_call(background_at_tau_columns(pba,
+                                         tau,
+                                         &(pba->index_bg_H),
+                                         1,
+                                         pvecback),
                pba->error_message,
                pth->error_message);
 
@@ -3140,14 +3638,22 @@ int thermodynamics_recombination_with_hyrec(
   double *xe_output, *Tm_output;
   int i,j,l,Nz,b;
   double z, xe, Tm, Hz;
-  FILE *fA;
-  FILE *fR;
+  double * Alpha_inf;
+  double * R_inf;
+  double * two_photon;
+  int Alpha_inf_size, R_inf_size, two_photon_size;
   double L2s1s_current;
   void * buffer;
   int buf_size;
   double tau;
-  int last_index_back;
   double w_fld,dw_over_da_fld,integral_fld;
+  double time_start,time_tables,time_history,time_stop;
+
+#ifdef _OPENMP
+  time_start = omp_get_wtime();
+#else
+  time_start = (double)clock()/CLOCKS_PER_SEC;
+#endif
 
   /** - Fill hyrec parameter structure */
 
@@ -3216,42 +3722,50 @@ int thermodynamics_recombination_with_hyrec(
   rate_table.DlogTR = rate_table.logTR_tab[1] - rate_table.logTR_tab[0];
   rate_table.DTM_TR = rate_table.TM_TR_tab[1] - rate_table.TM_TR_tab[0];
 
-  /* read in file */
+  /* get the content of the data files (parsed only once per process) */
+
+  class_call(filecache_acquire(ppr->hyrec_Alpha_inf_file,&Alpha_inf,&Alpha_inf_size,pth->error_message),
+             pth->error_message,
+             pth->error_message);
+  class_call(filecache_acquire(ppr->hyrec_R_inf_file,&R_inf,&R_inf_size,pth->error_message),
+             pth->error_message,
+             pth->error_message);
+  class_call(filecache_acquire(ppr->hyrec_two_photon_tables_file,&two_photon,&two_photon_size,pth->error_message),
+             pth->error_message,
+             pth->error_message);
 
-  class_open(fA,ppr->hyrec_Alpha_inf_file, "r",pth->error_message);
-  class_open(fR,ppr->hyrec_R_inf_file, "r",pth->error_message);
+  class_test(Alpha_inf_size < 2*NTR*NTM,
+             pth->error_message,
+             "Error reading hyrec data file %s",ppr->hyrec_Alpha_inf_file);
+  class_test(R_inf_size < NTR,
+             pth->error_message,
+             "Error reading hyrec data file %s",ppr->hyrec_R_inf_file);
+  class_test(two_photon_size < 5*NVIRT,
+             pth->error_message,
+             "Error reading hyrec data file %s",ppr->hyrec_two_photon_tables_file);
 
   for (i = 0; i < NTR; i++) {
     for (j = 0; j < NTM; j++) {
       for (l = 0; l <= 1; l++) {
-        if (fscanf(fA, "%le", &(rate_table.logAlpha_tab[l][j][i])) != 1)
-          class_stop(pth->error_message,"Error reading hyrec data file %s",ppr->hyrec_Alpha_inf_file);
-        rate_table.logAlpha_tab[l][j][i] = log(rate_table.logAlpha_tab[l][j][i]);
+        rate_table.logAlpha_tab[l][j][i] = log(Alpha_inf[(i*NTM+j)*2+l]);
       }
     }
-
-    if (fscanf(fR, "%le", &(rate_table.logR2p2s_tab[i])) !=1)
-      class_stop(pth->error_message,"Error reading hyrec data file %s",ppr->hyrec_R_inf_file);
-    rate_table.logR2p2s_tab[i] = log(rate_table.logR2p2s_tab[i]);
-
+    rate_table.logR2p2s_tab[i] = log(R_inf[i]);
   }
-  fclose(fA);
-  fclose(fR);
-
-  /* Read two-photon rate tables */
 
-  class_open(fA,ppr->hyrec_two_photon_tables_file, "r",pth->error_message);
+  /* two-photon rate tables */
 
   for (b = 0; b < NVIRT; b++) {
-    if ((fscanf(fA, "%le", &(twog_params.Eb_tab[b])) != 1) ||
-        (fscanf(fA, "%le", &(twog_params.A1s_tab[b])) != 1) ||
-        (fscanf(fA, "%le", &(twog_params.A2s_tab[b])) != 1) ||
-        (fscanf(fA, "%le", &(twog_params.A3s3d_tab[b])) != 1) ||
-        (fscanf(fA, "%le", &(twog_params.A4s4d_tab[b])) != 1))
-      class_stop(pth->error_message,"Error reading hyrec data file %s",ppr->hyrec_two_photon_tables_file);
+    twog_params.Eb_tab[b] = two_photon[5*b];
+    twog_params.A1s_tab[b] = two_photon[5*b+1];
+    twog_params.A2s_tab[b] = two_photon[5*b+2];
+    twog_params.A3s3d_tab[b] = two_photon[5*b+3];
+    twog_params.A4s4d_tab[b] = two_photon[5*b+4];
   }
 
-  fclose(fA);
+  filecache_release(Alpha_inf);
+  filecache_release(R_inf);
+  filecache_release(two_photon);
 
   /** - Normalize 2s--1s differential decay rate to L2s1s (can be set by user in hydrogen.h) */
   L2s1s_current = 0.;
@@ -3269,8 +3783,20 @@ int thermodynamics_recombination_with_hyrec(
   if (pth->thermodynamics_verbose > 0)
     printf(" -> calling HyRec version %s,\n",HYREC_VERSION);
 
+#ifdef _OPENMP
+  time_tables = omp_get_wtime();
+#else
+  time_tables = (double)clock()/CLOCKS_PER_SEC;
+#endif
+
   rec_build_history(&param, &rate_table, &twog_params, xe_output, Tm_output);
 
+#ifdef _OPENMP
+  time_history = omp_get_wtime();
+#else
+  time_history = (double)clock()/CLOCKS_PER_SEC;
+#endif
+
   if (pth->thermodynamics_verbose > 0)
     printf("    by Y. Ali-Haïmoud & C. Hirata\n");
 
@@ -3295,6 +3821,11 @@ int thermodynamics_recombination_with_hyrec(
   preco->annihilation_z_halo = pth->annihilation_z_halo;
   pth->n_e=preco->Nnow;
 
+  /* tabulated energy injection rate beyond the on-the-spot approximation */
+  class_call(thermodynamics_energy_injection_table_init(ppr,pba,preco,pth->error_message),
+             pth->error_message,
+             pth->error_message);
+
   /** - allocate memory for thermodynamics interpolation tables (size known in advance) and fill it */
 
   class_alloc(preco->recombination_table,preco->re_size*preco->rt_size*sizeof(double),pth->error_message);
@@ -3334,12 +3865,11 @@ int thermodynamics_recombination_with_hyrec(
                pba->error_message,
                pth->error_message);
 
-    class_call(background_at_tau(pba,
-                                 tau,
-                                 pba->short_info,
-                                 pba->inter_normal,
-                                 &last_index_back,
-                                 pvecback),
+    class_call(background_at_tau_columns(pba,
+                                         tau,
+                                         &(pba->index_bg_H),
+                                         1,
+                                         pvecback),
                pba->error_message,
                pth->error_message);
 
@@ -3384,6 +3914,17 @@ int thermodynamics_recombination_with_hyrec(
 
   free(buffer);
 
+#ifdef _OPENMP
+  time_stop = omp_get_wtime();
+#else
+  time_stop = (double)clock()/CLOCKS_PER_SEC;
+#endif
+
+  if (pth->thermodynamics_verbose > 1) {
+    printf("    HyRec timing: rate tables %f s, recombination history %f s, resampling %f s\n",
+           time_tables-time_start,time_history-time_tables,time_stop-time_history);
+  }
+
 #else
 
   class_stop(pth->error_message,
@@ -3464,6 +4005,9 @@ int thermodynamics_recombination_with_recfast(
   /* introduced by JL for smoothing the various steps */
   double x0_previous,x0_new,s,weight;
 
+  /* _TRUE_ once the integration with dense output of the last regime has started */
+  short has_dense_output = _FALSE_;
+
   /* contains all quantities relevant for the integration algorithm */
   struct generic_integrator_workspace gi;
 
@@ -3534,6 +4078,11 @@ int thermodynamics_recombination_with_recfast(
   preco->annihilation_f_halo = pth->annihilation_f_halo;
   preco->annihilation_z_halo = pth->annihilation_z_halo;
 
+  /* tabulated energy injection rate beyond the on-the-spot approximation */
+  class_call(thermodynamics_energy_injection_table_init(ppr,pba,preco,pth->error_message),
+             pth->error_message,
+             pth->error_message);
+
   /* quantities related to constants defined in thermodynamics.h */
   //n = preco->Nnow * pow((1.+z),3);
   Lalpha = 1./_L_H_alpha_;
@@ -3692,6 +4241,9 @@ int thermodynamics_recombination_with_recfast(
       rhs = exp(1.5*log(preco->CR*preco->Tnow/(1.+z)) - preco->CB1/(preco->Tnow*(1.+z)))/preco->Nnow;
       x_H0 = 0.5*(sqrt(pow(rhs,2)+4.*rhs) - rhs);
 
+      /* generic_integrator() below uses the same workspace */
+      has_dense_output = _FALSE_;
+
       class_call(generic_integrator(thermodynamics_derivs_with_recfast,
                                     zstart,
                                     zend,
@@ -3734,16 +4286,47 @@ int thermodynamics_recombination_with_recfast(
         x_H0 = 0.5*(sqrt(pow(rhs,2)+4.*rhs) - rhs);
       }
 
-      class_call(generic_integrator(thermodynamics_derivs_with_recfast,
-                                    zstart,
-                                    zend,
-                                    y,
-                                    &tpaw,
-                                    ppr->tol_thermo_integration,
-                                    ppr->smallest_allowed_variation,
-                                    &gi),
-                 gi.error_message,
-                 pth->error_message);
+      /* either one adaptive integration from the beginning of this
+         regime down to z=0, from which each step of the table is
+         interpolated with generic_integrator_dense(), or one
+         integration per step of the table */
+      if (ppr->recfast_dense_output == _TRUE_) {
+
+        if (has_dense_output == _FALSE_) {
+          class_call(generic_integrator_dense_init(thermodynamics_derivs_with_recfast,
+                                                   zstart,
+                                                   y,
+                                                   &tpaw,
+                                                   &gi),
+                     gi.error_message,
+                     pth->error_message);
+          has_dense_output = _TRUE_;
+        }
+
+        class_call(generic_integrator_dense(thermodynamics_derivs_with_recfast,
+                                            zend,
+                                            0.,
+                                            y,
+                                            &tpaw,
+                                            ppr->tol_recfast_dense_output,
+                                            ppr->smallest_allowed_variation,
+                                            &gi),
+                   gi.error_message,
+                   pth->error_message);
+      }
+      else {
+
+        class_call(generic_integrator(thermodynamics_derivs_with_recfast,
+                                      zstart,
+                                      zend,
+                                      y,
+                                      &tpaw,
+                                      ppr->tol_thermo_integration,
+                                      ppr->smallest_allowed_variation,
+                                      &gi),
+                   gi.error_message,
+                   pth->error_message);
+      }
 
       /* smoothed transition */
       if (ppr->recfast_x_H0_trigger - y[0] < ppr->recfast_x_H0_trigger_delta) {
@@ -3875,7 +4458,8 @@ int thermodynamics_derivs_with_recfast(
   double tau;
   double chi_heat;
   double chi_ion_H;
-  int last_index_back;
+  /* background quantities needed here */
+  int columns[2];
 
   ptpaw = parameters_and_workspace;
   ppr = ptpaw->ppr;
@@ -3883,6 +4467,9 @@ int thermodynamics_derivs_with_recfast(
   preco = ptpaw->preco;
   pvecback = ptpaw->pvecback;
 
+  columns[0] = pba->index_bg_H;
+  columns[1] = pba->index_bg_H_prime;
+
   x_H = y[0];
   x_He = y[1];
   x = x_H + preco->fHe * x_He;
@@ -3898,12 +4485,11 @@ int thermodynamics_derivs_with_recfast(
              pba->error_message,
              error_message);
 
-  class_call(background_at_tau(pba,
-                               tau,
-                               pba->short_info,
-                               pba->inter_normal,
-                               &last_index_back,
-                               pvecback),
+  class_call(background_at_tau_columns(pba,
+                                       tau,
+                                       columns,
+                                       2,
+                                       pvecback),
              pba->error_message,
              error_message);
 
@@ -4208,6 +4794,8 @@ int thermodynamics_merge_reco_and_reio(
 
   free(preco->recombination_table);
 
+  thermodynamics_energy_injection_table_free(preco);
+
   if (pth->reio_parametrization != reio_none)
     free(preio->reionization_table);
 
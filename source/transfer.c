@@ -69,22 +69,36 @@ int transfer_functions_at_q(
                             ) {
   /** Summary: */
 
-  /** - interpolate in pre-computed table using array_interpolate_two() */
-  class_call(array_interpolate_two(
-                                   ptr->q,
-                                   1,
-                                   0,
-                                   ptr->transfer[index_md]
-                                   +((index_ic * ptr->tt_size[index_md] + index_tt) * ptr->l_size[index_md] + index_l)
-                                   * ptr->q_size,
-                                   1,
-                                   ptr->q_size,
-                                   q,
-                                   transfer_function,
-                                   1,
-                                   ptr->error_message),
+  int index_row;
+  int inf,sup,mid;
+  double weight;
+
+  class_test(ptr->stream != NULL,
              ptr->error_message,
-             ptr->error_message);
+             "transfer functions are not stored when computed by blocks of multipoles (l_block_size)");
+
+  index_row = _transfer_row_(ptr,index_md,index_ic,index_tt,index_l);
+
+  /** - find the two neighbouring wavenumbers by bisection, like array_interpolate_two() */
+  inf = 0;
+  sup = ptr->q_size-1;
+
+  class_test((q < ptr->q[inf]) || (q > ptr->q[sup]),
+             ptr->error_message,
+             "q=%e out of the range [%e, %e] of computed transfer functions",q,ptr->q[inf],ptr->q[sup]);
+
+  while (sup-inf > 1) {
+    mid=(int)(0.5*(inf+sup));
+    if (q < ptr->q[mid]) {sup=mid;}
+    else {inf=mid;}
+  }
+
+  /** - interpolate linearly in the pre-computed table (in which only the non-negligible values are stored) */
+  weight = (q-ptr->q[inf])/(ptr->q[sup]-ptr->q[inf]);
+
+  *transfer_function =
+    _transfer_value_(ptr,index_md,index_row,inf) * (1.-weight)
+    + weight * _transfer_value_(ptr,index_md,index_row,sup);
 
   return _SUCCESS_;
 }
@@ -125,9 +139,6 @@ int transfer_init(
 
   /** - define local variables */
 
-  /* running index for wavenumbers */
-  int index_q;
-
   /* conformal time today */
   double tau0;
   /* conformal time at recombination */
@@ -151,9 +162,6 @@ int transfer_init(
   */
   double *** sources_spline;
 
-  /* pointer on workspace (one per thread if openmp) */
-  struct transfer_workspace * ptw;
-
   /** - array with the correspondence between the index of sources in
       the perturbation module and in the transfer module,
       tp_of_tt[index_md][index_tt]
@@ -165,19 +173,21 @@ int transfer_init(
   HyperInterpStruct BIS;
   double xmax;
 
-  /* This code can be optionally compiled with the openmp option for parallel computation.
-     Inside parallel regions, the use of the command "return" is forbidden.
-     For error management, instead of "return _FAILURE_", we will set the variable below
-     to "abort = _TRUE_". This will lead to a "return _FAILURE_" just after leaving the
-     parallel region. */
-  int abort;
+  /* if not NULL, the structure above was read from the cache and points inside this map */
+  void * BIS_map;
+  size_t BIS_map_size;
 
-#ifdef _OPENMP
+  /* size of the heap at the beginning (see class_memory_heap()) */
+  size_t heap_start;
 
-  /* instrumentation times */
-  double tstart, tstop, tspent;
+  class_profile_start(profile_transfer_init);
+  heap_start = class_memory_heap();
 
-#endif
+  ptr->tables_released = _FALSE_;
+
+  class_test(ppt->sources_released == _TRUE_,
+             ptr->error_message,
+             "the source functions were freed by the low_memory profile: compute the perturbations again first");
 
   /** - check whether any spectrum in harmonic space (i.e., any \f$C_l\f$'s) is actually requested */
 
@@ -185,6 +195,11 @@ int transfer_init(
     ptr->has_cls = _FALSE_;
     if (ptr->transfer_verbose > 0)
       printf("No harmonic space transfer functions to compute. Transfer module skipped.\n");
+    ptr->memory_size = class_memory_growth(heap_start);
+    class_call(transfer_release_perturbation_sources(ppt,ptr),
+               ptr->error_message,
+               ptr->error_message);
+    class_profile_stop(profile_transfer_init);
     return _SUCCESS_;
   }
   else
@@ -193,6 +208,8 @@ int transfer_init(
   if (ptr->transfer_verbose > 0)
     fprintf(stdout,"Computing transfers\n");
 
+  ptr->stream = NULL;
+
   /** - get number of modes (scalars, tensors...) */
 
   ptr->md_size = ppt->md_size;
@@ -230,23 +247,23 @@ int transfer_init(
              ptr->error_message,
              ptr->error_message);
 
-  /** - spline all the sources passed by the perturbation module with respect to k (in order to interpolate later at a given value of k) */
+  /** - allocate and fill array describing the correspondence between perturbation types and transfer types */
 
-  class_alloc(sources_spline,
-              ptr->md_size*sizeof(double**),
+  class_alloc(tp_of_tt,
+              ptr->md_size*sizeof(int*),
               ptr->error_message);
 
-  class_call(transfer_perturbation_source_spline(ppt,ptr,sources,sources_spline),
+  class_call(transfer_get_source_correspondence(ppt,ptr,tp_of_tt),
              ptr->error_message,
              ptr->error_message);
 
-  /** - allocate and fill array describing the correspondence between perturbation types and transfer types */
+  /** - spline with respect to k the sources used by some transfer type (in order to interpolate later at a given value of k) */
 
-  class_alloc(tp_of_tt,
-              ptr->md_size*sizeof(int*),
+  class_alloc(sources_spline,
+              ptr->md_size*sizeof(double**),
               ptr->error_message);
 
-  class_call(transfer_get_source_correspondence(ppt,ptr,tp_of_tt),
+  class_call(transfer_perturbation_source_spline(ppt,ptr,tp_of_tt,sources,sources_spline),
              ptr->error_message,
              ptr->error_message);
 
@@ -264,20 +281,40 @@ int transfer_init(
   if (pba->sgnK == -1)
     xmax *= (ptr->l[ptr->l_size_max-1]/ppr->hyper_flat_approximation_nu)/asinh(ptr->l[ptr->l_size_max-1]/ppr->hyper_flat_approximation_nu)*1.01;
 
-  class_call(hyperspherical_HIS_create(0,
-                                       1.,
-                                       ptr->l_size_max,
-                                       ptr->l,
-                                       ppr->hyper_x_min,
-                                       xmax,
-                                       ppr->hyper_sampling_flat,
-                                       ptr->l[ptr->l_size_max-1]+1,
-                                       ppr->hyper_phi_min_abs,
-                                       &BIS,
-                                       ptr->error_message),
+  /* with a cache, round xmax up on a logarithmic grid, so that models with nearby conformal ages share the same table */
+  if (ptr->bessel_cache_directory[0] != '\0')
+    xmax = exp(ceil(log(xmax)/log(1.+ppr->hyper_flat_cache_xmax_step))*log(1.+ppr->hyper_flat_cache_xmax_step));
+
+  class_call(hyperspherical_HIS_create_cached(0,
+                                              1.,
+                                              ptr->l_size_max,
+                                              ptr->l,
+                                              ppr->hyper_x_min,
+                                              xmax,
+                                              ppr->hyper_sampling_flat,
+                                              ptr->l[ptr->l_size_max-1]+1,
+                                              ppr->hyper_phi_min_abs,
+                                              &BIS,
+                                              ptr->bessel_cache_directory,
+                                              &BIS_map,
+                                              &BIS_map_size,
+                                              ptr->error_message),
              ptr->error_message,
              ptr->error_message);
 
+  if ((ptr->transfer_verbose > 1) && (BIS_map != NULL))
+    printf(" -> spherical Bessel functions read from the cache in %s\n",ptr->bessel_cache_directory);
+
+  /** - in curved models, size the in-memory cache of the hyperspherical Bessel functions of each nu with transfer_HIS_cache_resize() */
+
+  ptr->HIS_cache_hits = 0;
+
+  if (pba->sgnK != 0) {
+    class_call(transfer_HIS_cache_resize(ppr->hyper_curved_cache_size,ptr->error_message),
+               ptr->error_message,
+               ptr->error_message);
+  }
+
   /*
     fprintf(stderr,"tau:%d   l:%d   q:%d\n",
     ppt->tau_size,
@@ -304,119 +341,197 @@ int transfer_init(
              ptr->error_message,
              ptr->error_message);
 
-  /* (a.3.) workspace, allocated in a parallel zone since in openmp
-     version there is one workspace per thread */
+  /** - eventually refine the list of wavenumbers with transfer_q_adaptive_sampling() */
 
-  /* initialize error management flag */
-  abort = _FALSE_;
+  if (ppr->q_adaptive == _TRUE_) {
+    class_call(transfer_q_adaptive_sampling(ppr,
+                                            pba,
+                                            ppt,
+                                            ptr,
+                                            tp_of_tt,
+                                            tau_size_max,
+                                            tau_rec,
+                                            tau0,
+                                            tau0-pth->tau_cut,
+                                            sources,
+                                            sources_spline,
+                                            window,
+                                            &BIS),
+               ptr->error_message,
+               ptr->error_message);
+  }
 
-  /* beginning of parallel region */
-#pragma omp parallel                                                    \
-  shared(tau_size_max,ptr,ppr,pba,ppt,tp_of_tt,tau_rec,sources_spline,abort,BIS,tau0) \
-  private(ptw,index_q,tstart,tstop,tspent)
-  {
+  /** - if the transfer functions are computed by blocks of
+      multipoles in the spectra module, keep everything needed by
+      transfer_compute_l_block() in ptr->stream, and stop here */
+
+  if ((ptr->l_block_size > 0) && (ptr->l_block_size < ptr->l_size_max)) {
+
+    class_alloc(ptr->stream,sizeof(struct transfer_stream),ptr->error_message);
+
+    ptr->stream->ppt = ppt;
+    ptr->stream->pnl = pnl;
+    ptr->stream->tp_of_tt = tp_of_tt;
+    ptr->stream->tau_size_max = tau_size_max;
+    ptr->stream->tau_rec = tau_rec;
+    ptr->stream->tau0 = tau0;
+    ptr->stream->tau0_minus_tau_cut = tau0-pth->tau_cut;
+    ptr->stream->sources = sources;
+    ptr->stream->sources_spline = sources_spline;
+    ptr->stream->window = window;
+    ptr->stream->BIS = BIS;
+    ptr->stream->BIS_map = BIS_map;
+    ptr->stream->BIS_map_size = BIS_map_size;
+
+    ptr->q_index_min = NULL;
+    ptr->q_index_max = NULL;
+    ptr->transfer_offset = NULL;
+    ptr->transfer_size = NULL;
 
-#ifdef _OPENMP
-    tspent = 0.;
-#endif
+    if (ptr->transfer_verbose > 1)
+      printf(" -> transfer functions computed in the spectra module by blocks of %d multipoles\n",ptr->l_block_size);
 
-    /* allocate workspace */
+    ptr->memory_size = class_memory_growth(heap_start);
+    class_profile_stop(profile_transfer_init);
+    return _SUCCESS_;
+  }
 
-    ptw = NULL;
+  /** - find which transfer functions cannot be neglected, and allocate
+      the table of transfer functions for them only, using
+      transfer_storage_init() */
 
-    class_call_parallel(transfer_workspace_init(ptr,
-                                                ppr,
-                                                &ptw,
-                                                ppt->tau_size,
-                                                tau_size_max,
-                                                pba->K,
-                                                pba->sgnK,
-                                                tau0-pth->tau_cut,
-                                                &BIS),
-                        ptr->error_message,
-                        ptr->error_message);
+  class_call(transfer_storage_init(ppr,pba,ppt,ptr,tau_rec,0,ptr->l_size_max,&BIS),
+             ptr->error_message,
+             ptr->error_message);
 
-    /** - loop over all wavenumbers (parallelized).*/
-    /* For each wavenumber: */
+  /** - compute the transfer functions for all wavenumbers with transfer_compute_for_all_q() */
 
-#pragma omp for schedule (dynamic)
+  class_call(transfer_compute_for_all_q(ppr,
+                                        pba,
+                                        ppt,
+                                        ptr,
+                                        tp_of_tt,
+                                        tau_size_max,
+                                        tau_rec,
+                                        tau0,
+                                        tau0-pth->tau_cut,
+                                        sources,
+                                        sources_spline,
+                                        window,
+                                        &BIS),
+             ptr->error_message,
+             ptr->error_message);
 
-    for (index_q = 0; index_q < ptr->q_size; index_q++) {
+  /** - finally, free arrays allocated outside parallel zone */
+  free(window);
 
-#ifdef _OPENMP
-      tstart = omp_get_wtime();
-#endif
+  class_call(transfer_perturbation_sources_spline_free(ppt,ptr,sources_spline),
+             ptr->error_message,
+             ptr->error_message);
 
-      if (ptr->transfer_verbose > 2)
-        printf("Compute transfer for wavenumber [%d/%zu]\n",index_q,ptr->q_size-1);
+  class_call(transfer_perturbation_sources_free(ppt,pnl,ptr,sources),
+             ptr->error_message,
+             ptr->error_message);
 
-      /* Update interpolation structure: */
-      class_call_parallel(transfer_update_HIS(ppr,
-                                              ptr,
-                                              ptw,
-                                              index_q,
-                                              tau0),
-                          ptr->error_message,
-                          ptr->error_message);
+  class_call(transfer_free_source_correspondence(ptr,tp_of_tt),
+             ptr->error_message,
+             ptr->error_message);
 
-      class_call_parallel(transfer_compute_for_each_q(ppr,
-                                                      pba,
-                                                      ppt,
-                                                      ptr,
-                                                      tp_of_tt,
-                                                      index_q,
-                                                      tau_size_max,
-                                                      tau_rec,
-                                                      sources,
-                                                      sources_spline,
-                                                      window,
-                                                      ptw),
-                          ptr->error_message,
-                          ptr->error_message);
+  class_call(hyperspherical_HIS_free_cached(&BIS,BIS_map,BIS_map_size,ptr->error_message),
+             ptr->error_message,
+             ptr->error_message);
 
-#ifdef _OPENMP
-      tstop = omp_get_wtime();
+  if ((ptr->transfer_verbose > 1) && (pba->sgnK != 0) && (ppr->hyper_curved_cache_size > 0))
+    printf(" -> hyperspherical Bessel functions of %d values of nu reused from previous runs\n",ptr->HIS_cache_hits);
 
-      tspent += tstop-tstart;
-#endif
+  ptr->memory_size = class_memory_growth(heap_start);
 
-#pragma omp flush(abort)
+  /** - with the low_memory profile, the perturbation sources are not needed any more */
+  class_call(transfer_release_perturbation_sources(ppt,ptr),
+             ptr->error_message,
+             ptr->error_message);
 
-    } /* end of loop over wavenumber */
+  class_profile_stop(profile_transfer_init);
+  return _SUCCESS_;
+}
 
-    /* free workspace allocated inside parallel zone */
-    class_call_parallel(transfer_workspace_free(ptr,ptw),
-                        ptr->error_message,
-                        ptr->error_message);
+/**
+ * With the low_memory profile (see ppt->low_memory), free the source
+ * functions of the perturbation module once they have been used by
+ * the nonlinear module and by the transfer functions: by
+ * transfer_init(), or by spectra_init() when the transfer functions
+ * are computed by blocks of multipoles. They are kept when the
+ * transfer functions in Fourier space are requested, since these are
+ * computed from the sources on demand.
+ *
+ * @param ppt Input/Output: pointer to perturbation structure
+ * @param ptr Input: pointer to transfer structure
+ * @return the error status
+ */
 
-#ifdef _OPENMP
-    if (ptr->transfer_verbose>1)
-      printf("In %s: time spent in parallel region (loop over k's) = %e s for thread %d\n",
-             __func__,tspent,omp_get_thread_num());
-#endif
+int transfer_release_perturbation_sources(
+                                          struct perturbs * ppt,
+                                          struct transfers * ptr
+                                          ) {
 
-  } /* end of parallel region */
+  if ((ppt->low_memory == _FALSE_) || (ppt->has_density_transfers == _TRUE_) || (ppt->has_velocity_transfers == _TRUE_))
+    return _SUCCESS_;
 
-  if (abort == _TRUE_) return _FAILURE_;
+  class_call(perturb_free_sources(ppt),
+             ppt->error_message,
+             ptr->error_message);
 
-  /** - finally, free arrays allocated outside parallel zone */
-  free(window);
+  return _SUCCESS_;
+}
 
-  class_call(transfer_perturbation_sources_spline_free(ppt,ptr,sources_spline),
-             ptr->error_message,
-             ptr->error_message);
+/**
+ * With the low_memory profile, free the transfer functions once the
+ * spectra module has computed the \f$ C_l \f$'s from them (or, when
+ * they are computed by blocks of multipoles, everything kept for
+ * computing them), and then the perturbation sources if they were
+ * still needed for these blocks. The structure keeps its samplings
+ * and indices until transfer_free().
+ *
+ * @param ppt Input/Output: pointer to perturbation structure
+ * @param ptr Input/Output: pointer to transfer structure
+ * @return the error status
+ */
 
-  class_call(transfer_perturbation_sources_free(ppt,pnl,ptr,sources),
-             ptr->error_message,
-             ptr->error_message);
+int transfer_release_tables(
+                            struct perturbs * ppt,
+                            struct transfers * ptr
+                            ) {
 
-  class_call(transfer_free_source_correspondence(ptr,tp_of_tt),
+  size_t heap_start,heap_end;
+
+  if ((ppt->low_memory == _FALSE_) || (ptr->has_cls == _FALSE_) || (ptr->tables_released == _TRUE_))
+    return _SUCCESS_;
+
+  heap_start = class_memory_heap();
+
+  class_call(transfer_storage_free(ptr),
              ptr->error_message,
              ptr->error_message);
 
-  class_call(hyperspherical_HIS_free(&BIS,ptr->error_message),
+  if (ptr->stream != NULL) {
+    class_call(transfer_stream_free(ptr),
+               ptr->error_message,
+               ptr->error_message);
+  }
+
+  ptr->tables_released = _TRUE_;
+
+  heap_end = class_memory_heap();
+  if (heap_start > heap_end)
+    ptr->memory_size -= MIN(ptr->memory_size,heap_start-heap_end);
+
+  if (ptr->transfer_verbose > 1)
+    printf(" -> transfer functions freed (low_memory)\n");
+
+  class_call(transfer_release_perturbation_sources(ppt,ptr),
              ptr->error_message,
              ptr->error_message);
+
   return _SUCCESS_;
 }
 
@@ -438,9 +553,18 @@ int transfer_free(
 
   if (ptr->has_cls == _TRUE_) {
 
+    class_call(transfer_storage_free(ptr),
+               ptr->error_message,
+               ptr->error_message);
+
+    if (ptr->stream != NULL) {
+      class_call(transfer_stream_free(ptr),
+                 ptr->error_message,
+                 ptr->error_message);
+    }
+
     for (index_md = 0; index_md < ptr->md_size; index_md++) {
       free(ptr->l_size_tt[index_md]);
-      free(ptr->transfer[index_md]);
       free(ptr->k[index_md]);
     }
 
@@ -619,81 +743,414 @@ int transfer_indices_of_transfers(
              ptr->error_message,
              ptr->error_message);
 
-  /** - loop over modes (scalar, etc). For each mode: */
+  return _SUCCESS_;
 
-  for (index_md = 0; index_md < ptr->md_size; index_md++) {
+}
 
-    /** - allocate arrays of transfer functions, (ptr->transfer[index_md])[index_ic][index_tt][index_l][index_k] */
-    class_alloc(ptr->transfer[index_md],
-                ppt->ic_size[index_md] * ptr->tt_size[index_md] * ptr->l_size[index_md] * ptr->q_size * sizeof(double),
-                ptr->error_message);
+/**
+ * Find, for each mode, initial condition, type and multipole, the
+ * range of wavenumbers for which the transfer function cannot be
+ * neglected, and allocate the table of transfer functions
+ * ptr->transfer[index_md] with room for these values only.
+ *
+ * A transfer function is negligible (i.e. set to zero in
+ * transfer_compute_for_each_q()) when l is beyond l_max for its type,
+ * when k is beyond the largest k of the source functions, when
+ * transfer_can_be_neglected() says so, or when l>=nu in a closed
+ * model. In flat models, it is also exactly zero when the Bessel
+ * function j_l(k[tau0-tau]) vanishes (below x_min) over the whole
+ * time sampling of the source, and when the Limber time (l+1/2)/k is
+ * beyond this sampling (see transfer_integrate() and
+ * transfer_limber()): this removes small wavenumbers at large l, in
+ * particular for narrow number count windows far from the observer.
+ *
+ * All these conditions are known before computing anything: each row
+ * stores the wavenumbers from the first to the last non-negligible
+ * one, and the spectra module only integrates over the stored range.
+ *
+ * With transfer_compressed_storage set to false, all the wavenumbers
+ * of each row are stored, as in a dense table.
+ *
+ * Only the multipoles index_l_min <= index_l < index_l_max are stored
+ * (and then computed): the rows of other multipoles are empty. This
+ * is used by transfer_compute_l_block().
+ *
+ * @param ppr         Input: pointer to precision structure
+ * @param pba         Input: pointer to background structure
+ * @param ppt         Input: pointer to perturbation structure
+ * @param ptr         Input/Output: pointer to transfer structure
+ * @param tau_rec     Input: recombination time
+ * @param index_l_min Input: first index of multipole stored
+ * @param index_l_max Input: index of multipole following the last one stored
+ * @param pBIS        Input: flat spherical Bessel functions
+ * @return the error status
+ */
 
-  }
+int transfer_storage_init(
+                          struct precision * ppr,
+                          struct background * pba,
+                          struct perturbs * ppt,
+                          struct transfers * ptr,
+                          double tau_rec,
+                          int index_l_min,
+                          int index_l_max,
+                          HyperInterpStruct * pBIS
+                          ) {
+
+  int index_md,index_ic,index_tt,index_l,index_q,index_row,row_size;
+  short neglect;
+  long size;
+  double ra_rec;
+  double * tau0_minus_tau_max;
 
-  return _SUCCESS_;
+  ra_rec = (pba->conformal_age-tau_rec)*ptr->angular_rescaling;
 
-}
+  class_alloc(ptr->q_index_min,ptr->md_size * sizeof(int *),ptr->error_message);
+  class_alloc(ptr->q_index_max,ptr->md_size * sizeof(int *),ptr->error_message);
+  class_alloc(ptr->transfer_offset,ptr->md_size * sizeof(long *),ptr->error_message);
+  class_alloc(ptr->transfer_size,ptr->md_size * sizeof(long),ptr->error_message);
 
-int transfer_perturbation_copy_sources_and_nl_corrections(
-                                                          struct perturbs * ppt,
-                                                          struct nonlinear * pnl,
-                                                          struct transfers * ptr,
-                                                          double *** sources
-                                                          ) {
-  int index_md;
-  int index_ic;
-  int index_tp;
-  int index_k;
-  int index_tau;
+  /** - loop over modes (scalar, etc). For each mode: */
 
   for (index_md = 0; index_md < ptr->md_size; index_md++) {
 
-    class_alloc(sources[index_md],
-                ppt->ic_size[index_md]*ppt->tp_size[index_md]*sizeof(double*),
-                ptr->error_message);
+    row_size = ppt->ic_size[index_md] * ptr->tt_size[index_md] * ptr->l_size[index_md];
 
-    for (index_ic = 0; index_ic < ppt->ic_size[index_md]; index_ic++) {
+    class_alloc(ptr->q_index_min[index_md],row_size * sizeof(int),ptr->error_message);
+    class_alloc(ptr->q_index_max[index_md],row_size * sizeof(int),ptr->error_message);
+    class_alloc(ptr->transfer_offset[index_md],row_size * sizeof(long),ptr->error_message);
 
-      for (index_tp = 0; index_tp < ppt->tp_size[index_md]; index_tp++) {
+    size = 0;
 
-        if ((pnl->method != nl_none) && (_scalars_) &&
-            (((ppt->has_source_delta_m == _TRUE_) && (index_tp == ppt->index_tp_delta_m)) ||
-             ((ppt->has_source_delta_cb == _TRUE_) && (index_tp == ppt->index_tp_delta_cb)) ||
-             ((ppt->has_source_theta_m == _TRUE_) && (index_tp == ppt->index_tp_theta_m)) ||
-             ((ppt->has_source_theta_cb == _TRUE_) && (index_tp == ppt->index_tp_theta_cb)) ||
-             ((ppt->has_source_phi == _TRUE_) && (index_tp == ppt->index_tp_phi)) ||
-             ((ppt->has_source_phi_prime == _TRUE_) && (index_tp == ppt->index_tp_phi_prime)) ||
-             ((ppt->has_source_phi_plus_psi == _TRUE_) && (index_tp == ppt->index_tp_phi_plus_psi)) ||
-             ((ppt->has_source_psi == _TRUE_) && (index_tp == ppt->index_tp_psi)))) {
+    /* largest value of (tau0-tau) in the time sampling of each type */
+    class_alloc(tau0_minus_tau_max,ptr->tt_size[index_md] * sizeof(double),ptr->error_message);
 
-          class_alloc(sources[index_md][index_ic * ppt->tp_size[index_md] + index_tp],
-                      ppt->k_size[index_md]*ppt->tau_size*sizeof(double),
-                      ptr->error_message);
+    for (index_tt = 0; index_tt < ptr->tt_size[index_md]; index_tt++) {
+      class_call(transfer_source_tau0_minus_tau_max(ppr,
+                                                    pba,
+                                                    ppt,
+                                                    ptr,
+                                                    tau_rec,
+                                                    pba->conformal_age,
+                                                    index_md,
+                                                    index_tt,
+                                                    &(tau0_minus_tau_max[index_tt])),
+                 ptr->error_message,
+                 ptr->error_message);
+    }
 
-          for (index_tau=0; index_tau<ppt->tau_size; index_tau++) {
-            for (index_k=0; index_k<ppt->k_size[index_md]; index_k++) {
-              if (((ppt->has_source_delta_cb == _TRUE_) && (index_tp == ppt->index_tp_delta_cb)) ||
-                  ((ppt->has_source_theta_cb == _TRUE_) && (index_tp == ppt->index_tp_theta_cb))){
+    for (index_ic = 0; index_ic < ppt->ic_size[index_md]; index_ic++) {
+      for (index_tt = 0; index_tt < ptr->tt_size[index_md]; index_tt++) {
+        for (index_l = 0; index_l < ptr->l_size[index_md]; index_l++) {
+
+          index_row = _transfer_row_(ptr,index_md,index_ic,index_tt,index_l);
+
+          /** - find the range of non-negligible wavenumbers of each row */
+          if ((index_l < index_l_min) || (index_l >= index_l_max)) {
+            ptr->q_index_min[index_md][index_row] = 0;
+            ptr->q_index_max[index_md][index_row] = 0;
+          }
+          else if (ppr->transfer_compressed_storage == _FALSE_) {
+            ptr->q_index_min[index_md][index_row] = 0;
+            ptr->q_index_max[index_md][index_row] = ptr->q_size;
+          }
+          else {
+            ptr->q_index_min[index_md][index_row] = ptr->q_size;
+            ptr->q_index_max[index_md][index_row] = 0;
+
+            if (index_l < ptr->l_size_tt[index_md][index_tt]) {
+
+              for (index_q = 0; index_q < ptr->q_size; index_q++) {
+
+                /* same conditions as in transfer_compute_for_each_q() and transfer_compute_for_l_tile() */
+                if (ptr->k[index_md][index_q] > ppt->k[index_md][ppt->k_size_cl[index_md]-1])
+                  continue;
+
+                class_call(transfer_can_be_neglected(ppr,
+                                                     ppt,
+                                                     ptr,
+                                                     index_md,
+                                                     index_ic,
+                                                     index_tt,
+                                                     ra_rec,
+                                                     ptr->q[index_q],
+                                                     (double)ptr->l[index_l],
+                                                     &neglect),
+                           ptr->error_message,
+                           ptr->error_message);
+
+                if ((pba->sgnK == 1) && (ptr->l[index_l] >= (int)(ptr->q[index_q]/sqrt(pba->K)+0.2)))
+                  neglect = _TRUE_;
+
+                /* same expressions as in transfer_integrate() and transfer_limber() */
+                if ((pba->sgnK == 0) &&
+                    (pBIS->chi_at_phimin[index_l]/ptr->k[index_md][index_q] >= tau0_minus_tau_max[index_tt]) &&
+                    (((double)ptr->l[index_l]+0.5)/ptr->q[index_q] > tau0_minus_tau_max[index_tt]))
+                  neglect = _TRUE_;
+
+                if (neglect == _FALSE_) {
+                  ptr->q_index_min[index_md][index_row] = MIN(ptr->q_index_min[index_md][index_row],index_q);
+                  ptr->q_index_max[index_md][index_row] = index_q+1;
+                }
+              }
+            }
+
+            /* empty row */
+            if (ptr->q_index_max[index_md][index_row] <= ptr->q_index_min[index_md][index_row]) {
+              ptr->q_index_min[index_md][index_row] = 0;
+              ptr->q_index_max[index_md][index_row] = 0;
+            }
+          }
+
+          ptr->transfer_offset[index_md][index_row] = size - ptr->q_index_min[index_md][index_row];
+          size += ptr->q_index_max[index_md][index_row] - ptr->q_index_min[index_md][index_row];
+        }
+      }
+    }
+
+    free(tau0_minus_tau_max);
+
+    ptr->transfer_size[index_md] = size;
+
+    /** - allocate arrays of transfer functions */
+    class_alloc(ptr->transfer[index_md],
+                MAX(size,1) * sizeof(double),
+                ptr->error_message);
+
+    if ((ptr->transfer_verbose > 1) && (ptr->stream == NULL))
+      printf(" -> mode %d: storing %ld transfer functions out of %ld (%.1f%%)\n",
+             index_md,size,(long)row_size*ptr->q_size,100.*(double)size/((double)row_size*ptr->q_size));
+  }
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * Free the table of transfer functions allocated by
+ * transfer_storage_init(), if any.
+ *
+ * @param ptr Input/Output: pointer to transfer structure
+ * @return the error status
+ */
+
+int transfer_storage_free(
+                          struct transfers * ptr
+                          ) {
+
+  int index_md;
+
+  if (ptr->q_index_min == NULL)
+    return _SUCCESS_;
+
+  for (index_md = 0; index_md < ptr->md_size; index_md++) {
+    free(ptr->transfer[index_md]);
+    free(ptr->q_index_min[index_md]);
+    free(ptr->q_index_max[index_md]);
+    free(ptr->transfer_offset[index_md]);
+    ptr->transfer[index_md] = NULL;
+  }
+
+  free(ptr->q_index_min);
+  free(ptr->q_index_max);
+  free(ptr->transfer_offset);
+  free(ptr->transfer_size);
+
+  ptr->q_index_min = NULL;
+  ptr->q_index_max = NULL;
+  ptr->transfer_offset = NULL;
+  ptr->transfer_size = NULL;
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * Compute the transfer functions of the multipoles index_l_min <=
+ * index_l < index_l_max only, when transfer_init() did not compute
+ * them (see l_block_size). The transfer functions of the previous
+ * block are freed first, so that at most one block is stored at a
+ * time; they are stored and accessed exactly as if all multipoles
+ * had been computed, the rows of other multipoles being empty.
+ *
+ * Each block repeats the loop over wavenumbers of
+ * transfer_compute_for_all_q(), including the interpolation of the
+ * sources (and, in curved models, the hyperspherical Bessel functions
+ * not found in the cache of transfer_HIS_cache_fetch()): fewer and
+ * larger blocks are faster.
+ *
+ * @param ppr         Input: pointer to precision structure
+ * @param pba         Input: pointer to background structure
+ * @param ppt         Input: pointer to perturbation structure
+ * @param ptr         Input/Output: pointer to transfer structure
+ * @param index_l_min Input: first index of multipole
+ * @param index_l_max Input: index of multipole following the last one
+ * @return the error status
+ */
+
+int transfer_compute_l_block(
+                             struct precision * ppr,
+                             struct background * pba,
+                             struct perturbs * ppt,
+                             struct transfers * ptr,
+                             int index_l_min,
+                             int index_l_max
+                             ) {
+
+  class_test(ptr->stream == NULL,
+             ptr->error_message,
+             "all transfer functions were already computed by transfer_init()");
+
+  class_call(transfer_storage_free(ptr),
+             ptr->error_message,
+             ptr->error_message);
+
+  class_call(transfer_storage_init(ppr,
+                                   pba,
+                                   ppt,
+                                   ptr,
+                                   ptr->stream->tau_rec,
+                                   index_l_min,
+                                   index_l_max,
+                                   &(ptr->stream->BIS)),
+             ptr->error_message,
+             ptr->error_message);
+
+  class_call(transfer_compute_for_all_q(ppr,
+                                        pba,
+                                        ppt,
+                                        ptr,
+                                        ptr->stream->tp_of_tt,
+                                        ptr->stream->tau_size_max,
+                                        ptr->stream->tau_rec,
+                                        ptr->stream->tau0,
+                                        ptr->stream->tau0_minus_tau_cut,
+                                        ptr->stream->sources,
+                                        ptr->stream->sources_spline,
+                                        ptr->stream->window,
+                                        &(ptr->stream->BIS)),
+             ptr->error_message,
+             ptr->error_message);
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * Free everything kept in ptr->stream by transfer_init() for
+ * transfer_compute_l_block().
+ *
+ * @param ptr Input/Output: pointer to transfer structure
+ * @return the error status
+ */
+
+int transfer_stream_free(
+                         struct transfers * ptr
+                         ) {
+
+  free(ptr->stream->window);
+
+  class_call(transfer_perturbation_sources_spline_free(ptr->stream->ppt,ptr,ptr->stream->sources_spline),
+             ptr->error_message,
+             ptr->error_message);
+
+  class_call(transfer_perturbation_sources_free(ptr->stream->ppt,ptr->stream->pnl,ptr,ptr->stream->sources),
+             ptr->error_message,
+             ptr->error_message);
+
+  class_call(transfer_free_source_correspondence(ptr,ptr->stream->tp_of_tt),
+             ptr->error_message,
+             ptr->error_message);
+
+  class_call(hyperspherical_HIS_free_cached(&(ptr->stream->BIS),ptr->stream->BIS_map,ptr->stream->BIS_map_size,ptr->error_message),
+             ptr->error_message,
+             ptr->error_message);
+
+  free(ptr->stream);
+  ptr->stream = NULL;
+
+  return _SUCCESS_;
+
+}
+
+int transfer_perturbation_copy_sources_and_nl_corrections(
+                                                          struct perturbs * ppt,
+                                                          struct nonlinear * pnl,
+                                                          struct transfers * ptr,
+                                                          double *** sources
+                                                          ) {
+  int index_md;
+  int index_ic;
+  int index_tp;
+  int index_k;
+  int index_tau;
+
+  for (index_md = 0; index_md < ptr->md_size; index_md++) {
+
+    class_alloc(sources[index_md],
+                ppt->ic_size[index_md]*ppt->tp_size[index_md]*sizeof(double*),
+                ptr->error_message);
+
+    for (index_ic = 0; index_ic < ppt->ic_size[index_md]; index_ic++) {
+
+      for (index_tp = 0; index_tp < ppt->tp_size[index_md]; index_tp++) {
+
+        if ((pnl->method != nl_none) && (_scalars_) &&
+            (((ppt->has_source_delta_m == _TRUE_) && (index_tp == ppt->index_tp_delta_m)) ||
+             ((ppt->has_source_delta_cb == _TRUE_) && (index_tp == ppt->index_tp_delta_cb)) ||
+             ((ppt->has_source_theta_m == _TRUE_) && (index_tp == ppt->index_tp_theta_m)) ||
+             ((ppt->has_source_theta_cb == _TRUE_) && (index_tp == ppt->index_tp_theta_cb)) ||
+             ((ppt->has_source_phi == _TRUE_) && (index_tp == ppt->index_tp_phi)) ||
+             ((ppt->has_source_phi_prime == _TRUE_) && (index_tp == ppt->index_tp_phi_prime)) ||
+             ((ppt->has_source_phi_plus_psi == _TRUE_) && (index_tp == ppt->index_tp_phi_plus_psi)) ||
+             ((ppt->has_source_psi == _TRUE_) && (index_tp == ppt->index_tp_psi)))) {
+
+          class_alloc(sources[index_md][index_ic * ppt->tp_size[index_md] + index_tp],
+                      ppt->k_size[index_md]*ppt->tau_size*sizeof(double),
+                      ptr->error_message);
+
+          for (index_tau=0; index_tau<ppt->tau_size; index_tau++) {
+            for (index_k=0; index_k<ppt->k_size[index_md]; index_k++) {
+              if (((ppt->has_source_delta_cb == _TRUE_) && (index_tp == ppt->index_tp_delta_cb)) ||
+                  ((ppt->has_source_theta_cb == _TRUE_) && (index_tp == ppt->index_tp_theta_cb))){
                 sources[index_md]
                   [index_ic * ppt->tp_size[index_md] + index_tp]
                   [index_tau * ppt->k_size[index_md] + index_k] =
-                  ppt->sources[index_md]
-                  [index_ic * ppt->tp_size[index_md] + index_tp]
-                  [index_tau * ppt->k_size[index_md] + index_k]
+                  _get_source_(ppt,index_md,
+                               index_ic * ppt->tp_size[index_md] + index_tp,
+                               index_tau * ppt->k_size[index_md] + index_k)
                   * pnl->nl_corr_density[pnl->index_pk_cb][index_tau * ppt->k_size[index_md] + index_k];
               }
               else{
                 sources[index_md]
                   [index_ic * ppt->tp_size[index_md] + index_tp]
                   [index_tau * ppt->k_size[index_md] + index_k] =
-                  ppt->sources[index_md]
-                  [index_ic * ppt->tp_size[index_md] + index_tp]
-                  [index_tau * ppt->k_size[index_md] + index_k]
+                  _get_source_(ppt,index_md,
+                               index_ic * ppt->tp_size[index_md] + index_tp,
+                               index_tau * ppt->k_size[index_md] + index_k)
                   * pnl->nl_corr_density[pnl->index_pk_m][index_tau * ppt->k_size[index_md] + index_k];
               }
             }
           }
         }
+        else if (ppt->sources_single_precision == _TRUE_) {
+
+          /* the perturbation module only kept single-precision sources: make a double-precision copy */
+          class_alloc(sources[index_md][index_ic * ppt->tp_size[index_md] + index_tp],
+                      ppt->k_size[index_md]*ppt->tau_size*sizeof(double),
+                      ptr->error_message);
+
+          for (index_tau=0; index_tau<ppt->tau_size; index_tau++) {
+            for (index_k=0; index_k<ppt->k_size[index_md]; index_k++) {
+              sources[index_md]
+                [index_ic * ppt->tp_size[index_md] + index_tp]
+                [index_tau * ppt->k_size[index_md] + index_k] =
+                _get_source_(ppt,index_md,
+                             index_ic * ppt->tp_size[index_md] + index_tp,
+                             index_tau * ppt->k_size[index_md] + index_k);
+            }
+          }
+        }
         else {
           sources[index_md][index_ic * ppt->tp_size[index_md] + index_tp] =
             ppt->sources[index_md][index_ic * ppt->tp_size[index_md] + index_tp];
@@ -707,26 +1164,62 @@ int transfer_perturbation_copy_sources_and_nl_corrections(
 }
 
 
+/**
+ * Spline with respect to k the sources S(k,tau) needed by the
+ * transfer functions, i.e. those of the source types listed in
+ * tp_of_tt: the other ones (for instance the density and velocity
+ * sources kept for P(k) only) are never interpolated in k, and their
+ * pointer in sources_spline is left to NULL. The second derivatives
+ * have the same layout as the sources, and the columns of each type
+ * (one per time) are splined in parallel by
+ * array_spline_table_columns2().
+ *
+ * @param ppt            Input: pointer to perturbation structure
+ * @param ptr            Input: pointer to transfers structure
+ * @param tp_of_tt       Input: source type of each transfer type
+ * @param sources        Input: sources
+ * @param sources_spline Output: their second derivatives with respect to k (allocated here)
+ * @return the error status
+ */
+
 int transfer_perturbation_source_spline(
                                         struct perturbs * ppt,
                                         struct transfers * ptr,
+                                        int ** tp_of_tt,
                                         double *** sources,
                                         double *** sources_spline
                                         ) {
   int index_md;
   int index_ic;
   int index_tp;
+  int index_tt;
+  int splined=0,total=0;
+  short * tp_needed;
 
   for (index_md = 0; index_md < ptr->md_size; index_md++) {
 
-    class_alloc(sources_spline[index_md],
-                ppt->ic_size[index_md]*ppt->tp_size[index_md]*sizeof(double*),
-                ptr->error_message);
+    class_calloc(sources_spline[index_md],
+                 ppt->ic_size[index_md]*ppt->tp_size[index_md],
+                 sizeof(double*),
+                 ptr->error_message);
+
+    class_calloc(tp_needed,
+                 ppt->tp_size[index_md],
+                 sizeof(short),
+                 ptr->error_message);
+
+    for (index_tt = 0; index_tt < ptr->tt_size[index_md]; index_tt++)
+      tp_needed[tp_of_tt[index_md][index_tt]] = _TRUE_;
 
     for (index_ic = 0; index_ic < ppt->ic_size[index_md]; index_ic++) {
 
       for (index_tp = 0; index_tp < ppt->tp_size[index_md]; index_tp++) {
 
+        total++;
+
+        if (tp_needed[index_tp] == _FALSE_)
+          continue;
+
         class_alloc(sources_spline[index_md][index_ic * ppt->tp_size[index_md] + index_tp],
                     ppt->k_size[index_md]*ppt->tau_size*sizeof(double),
                     ptr->error_message);
@@ -741,10 +1234,16 @@ int transfer_perturbation_source_spline(
                    ptr->error_message,
                    ptr->error_message);
 
+        splined++;
       }
     }
+
+    free(tp_needed);
   }
 
+  if (ptr->transfer_verbose > 1)
+    printf(" -> %d of %d source functions splined along k\n",splined,total);
+
   return _SUCCESS_;
 
 }
@@ -762,15 +1261,16 @@ int transfer_perturbation_sources_free(
   for (index_md = 0; index_md < ptr->md_size; index_md++) {
     for (index_ic = 0; index_ic < ppt->ic_size[index_md]; index_ic++) {
       for (index_tp = 0; index_tp < ppt->tp_size[index_md]; index_tp++) {
-        if ((pnl->method != nl_none) && (_scalars_) &&
-            (((ppt->has_source_delta_m == _TRUE_) && (index_tp == ppt->index_tp_delta_m)) ||
-             ((ppt->has_source_theta_m == _TRUE_) && (index_tp == ppt->index_tp_theta_m)) ||
-             ((ppt->has_source_delta_cb == _TRUE_) && (index_tp == ppt->index_tp_delta_cb)) ||
-             ((ppt->has_source_theta_cb == _TRUE_) && (index_tp == ppt->index_tp_theta_cb)) ||
-             ((ppt->has_source_phi == _TRUE_) && (index_tp == ppt->index_tp_phi)) ||
-             ((ppt->has_source_phi_prime == _TRUE_) && (index_tp == ppt->index_tp_phi_prime)) ||
-             ((ppt->has_source_phi_plus_psi == _TRUE_) && (index_tp == ppt->index_tp_phi_plus_psi)) ||
-             ((ppt->has_source_psi == _TRUE_) && (index_tp == ppt->index_tp_psi)))) {
+        if ((ppt->sources_single_precision == _TRUE_) ||
+            ((pnl->method != nl_none) && (_scalars_) &&
+             (((ppt->has_source_delta_m == _TRUE_) && (index_tp == ppt->index_tp_delta_m)) ||
+              ((ppt->has_source_theta_m == _TRUE_) && (index_tp == ppt->index_tp_theta_m)) ||
+              ((ppt->has_source_delta_cb == _TRUE_) && (index_tp == ppt->index_tp_delta_cb)) ||
+              ((ppt->has_source_theta_cb == _TRUE_) && (index_tp == ppt->index_tp_theta_cb)) ||
+              ((ppt->has_source_phi == _TRUE_) && (index_tp == ppt->index_tp_phi)) ||
+              ((ppt->has_source_phi_prime == _TRUE_) && (index_tp == ppt->index_tp_phi_prime)) ||
+              ((ppt->has_source_phi_plus_psi == _TRUE_) && (index_tp == ppt->index_tp_phi_plus_psi)) ||
+              ((ppt->has_source_psi == _TRUE_) && (index_tp == ppt->index_tp_psi))))) {
 
           free(sources[index_md][index_ic * ppt->tp_size[index_md] + index_tp]);
         }
@@ -1029,6 +1529,7 @@ int transfer_get_q_list(
   double q_approximation;
   double last_step=0.;
   int last_index=0;
+  double q_linstep;
   double q_logstep_spline;
   double q_logstep_trapzd;
   int index_md;
@@ -1077,9 +1578,19 @@ int transfer_get_q_list(
 
   /* adjust the parameter governing the log step size to curvature */
 
+  q_linstep = ppr->q_linstep;
   q_logstep_spline = ppr->q_logstep_spline/pow(ptr->angular_rescaling,ppr->q_logstep_open);
   q_logstep_trapzd = ppr->q_logstep_trapzd;
 
+  /* with adaptive sampling, start from a coarser list, refined later
+     by transfer_q_adaptive_sampling(). In closed models, the integer
+     values of nu below the flat approximation are not coarsened. */
+
+  if (ppr->q_adaptive == _TRUE_) {
+    q_linstep *= ppr->q_adaptive_coarsening;
+    q_logstep_spline *= ppr->q_adaptive_coarsening;
+  }
+
   /* very conservative estimate of number of values */
 
   if (sgnK == 1) {
@@ -1087,7 +1598,7 @@ int transfer_get_q_list(
     q_approximation = MIN(ppr->hyper_flat_approximation_nu,(q_max/sqrt(K)));
 
     /* max contribution from integer nu values */
-    q_step = 1.+q_period*ppr->q_logstep_trapzd;
+    q_step = 1.+q_period*q_logstep_trapzd;
     q_size_max = 2*(int)(log(q_approximation/q_min)/log(q_step));
 
     q_step = q_period*ppr->q_linstep;
@@ -1097,7 +1608,7 @@ int transfer_get_q_list(
     q_step = 1.+q_period*ppr->q_logstep_spline;
     q_size_max += 2*(int)(log(q_max/q_approximation)/log(q_step));
 
-    q_step = q_period*ppr->q_linstep;
+    q_step = q_period*q_linstep;
     q_size_max += 2*(int)((q_max-q_approximation)/q_step);
 
   }
@@ -1107,7 +1618,7 @@ int transfer_get_q_list(
     q_step = 1.+q_period*ppr->q_logstep_spline;
     q_size_max = 5*(int)(log(q_max/q_min)/log(q_step));
 
-    q_step = q_period*ppr->q_linstep;
+    q_step = q_period*q_linstep;
     q_size_max += 5*(int)((q_max-q_min)/q_step);
 
   }
@@ -1139,14 +1650,14 @@ int transfer_get_q_list(
        q_period * q_logstep_spline
 
        - in the large q limit, it is linear with: (delta q) = q_period
-       * ppr->q_linstep
+       * q_linstep
        */
 
     if (sgnK<=0) {
 
       q = ptr->q[index_q-1]
-        + q_period * ppr->q_linstep * ptr->q[index_q-1]
-        / (ptr->q[index_q-1] + ppr->q_linstep/q_logstep_spline);
+        + q_period * q_linstep * ptr->q[index_q-1]
+        / (ptr->q[index_q-1] + q_linstep/q_logstep_spline);
 
     }
 
@@ -1182,7 +1693,7 @@ int transfer_get_q_list(
       }
       else {
 
-        q_step = q_period * ppr->q_linstep * ptr->q[index_q-1] / (ptr->q[index_q-1] + ppr->q_linstep/q_logstep_spline);
+        q_step = q_period * q_linstep * ptr->q[index_q-1] / (ptr->q[index_q-1] + q_linstep/q_logstep_spline);
 
         if (index_q-last_index < (int)ppr->q_numstep_transition)
           q = ptr->q[index_q-1] + (1-(double)(index_q-last_index)/ppr->q_numstep_transition) * last_step + (double)(index_q-last_index)/ppr->q_numstep_transition * q_step;
@@ -1217,18 +1728,13 @@ int transfer_get_q_list(
   /* in curved universe, check at which index the flat rescaling
      approximation will start being used */
 
-  if (sgnK != 0) {
+  class_call(transfer_get_index_q_flat_approximation(ppr,ptr,K,sgnK),
+             ptr->error_message,
+             ptr->error_message);
 
-    q_approximation = ppr->hyper_flat_approximation_nu * sqrt(sgnK*K);
-    for (ptr->index_q_flat_approximation=0;
-         ptr->index_q_flat_approximation < ptr->q_size-1;
-         ptr->index_q_flat_approximation++) {
-      if (ptr->q[ptr->index_q_flat_approximation] > q_approximation) break;
-    }
-    if (ptr->transfer_verbose > 1)
-      printf("Flat bessel approximation spares hyperspherical bessel computations for %zu wavenumebrs over a total of %zu\n",
-             ptr->q_size-ptr->index_q_flat_approximation,ptr->q_size);
-  }
+  if ((sgnK != 0) && (ptr->transfer_verbose > 1))
+    printf("Flat bessel approximation spares hyperspherical bessel computations for %zu wavenumebrs over a total of %zu\n",
+           ptr->q_size-ptr->index_q_flat_approximation,ptr->q_size);
 
   return _SUCCESS_;
 
@@ -1244,6 +1750,41 @@ int transfer_get_q_list(
  * @return the error status
  */
 
+/**
+ * In curved models, find the index of the first wavenumber of ptr->q
+ * for which the flat rescaling approximation of the hyperspherical
+ * Bessel functions is used.
+ *
+ * @param ppr     Input: pointer to precision structure
+ * @param ptr     Input/Output: pointer to transfers structure containing q's
+ * @param K       Input: spatial curvature (in absolute value)
+ * @param sgnK    Input: spatial curvature sign (open/closed/flat)
+ * @return the error status
+ */
+
+int transfer_get_index_q_flat_approximation(
+                                            struct precision * ppr,
+                                            struct transfers * ptr,
+                                            double K,
+                                            int sgnK
+                                            ) {
+
+  double q_approximation;
+
+  if (sgnK != 0) {
+
+    q_approximation = ppr->hyper_flat_approximation_nu * sqrt(sgnK*K);
+    for (ptr->index_q_flat_approximation=0;
+         ptr->index_q_flat_approximation < ptr->q_size-1;
+         ptr->index_q_flat_approximation++) {
+      if (ptr->q[ptr->index_q_flat_approximation] > q_approximation) break;
+    }
+  }
+
+  return _SUCCESS_;
+
+}
+
 int transfer_get_k_list(
                         struct perturbs * ppt,
                         struct transfers * ptr,
@@ -1678,26 +2219,976 @@ int transfer_source_tau_size(
   return _SUCCESS_;
 }
 
-int transfer_compute_for_each_q(
-                                struct precision * ppr,
-                                struct background * pba,
-                                struct perturbs * ppt,
-                                struct transfers * ptr,
-                                int ** tp_of_tt,
-                                int index_q,
-                                int tau_size_max,
-                                double tau_rec,
-                                double *** pert_sources,
-                                double *** pert_sources_spline,
-                                double * window,
-                                struct transfer_workspace * ptw
-                                ) {
-
-  /** Summary: */
+/**
+ * Find the largest value of (tau0-tau) in the time sampling of the
+ * transfer source of a given type, i.e. the value of
+ * tau0_minus_tau[0] set in transfer_sources(), without computing the
+ * source.
+ *
+ * @param ppr                Input: pointer to precision structure
+ * @param pba                Input: pointer to background structure
+ * @param ppt                Input: pointer to perturbation structure
+ * @param ptr                Input: pointer to transfers structure
+ * @param tau_rec            Input: recombination time
+ * @param tau0               Input: time today
+ * @param index_md           Input: index of the mode (scalar, tensor)
+ * @param index_tt           Input: index of transfer type
+ * @param tau0_minus_tau_max Output: largest value of (tau0-tau)
+ * @return the error status
+ */
 
-  /** - define local variables */
+int transfer_source_tau0_minus_tau_max(
+                                       struct precision * ppr,
+                                       struct background * pba,
+                                       struct perturbs * ppt,
+                                       struct transfers * ptr,
+                                       double tau_rec,
+                                       double tau0,
+                                       int index_md,
+                                       int index_tt,
+                                       double * tau0_minus_tau_max) {
 
-  /* running index for modes */
+  int tau_size;
+  int bin=0;
+  double * tau0_minus_tau;
+
+  class_call(transfer_source_tau_size(ppr,
+                                      pba,
+                                      ppt,
+                                      ptr,
+                                      tau_rec,
+                                      tau0,
+                                      index_md,
+                                      index_tt,
+                                      &tau_size),
+             ptr->error_message,
+             ptr->error_message);
+
+  /* lensing source: times before recombination are thrown away */
+  if (_scalars_ && (ppt->has_cl_cmb_lensing_potential == _TRUE_) && (index_tt == ptr->index_tt_lcmb)) {
+    *tau0_minus_tau_max = tau0 - ppt->tau_sampling[ppt->tau_size-tau_size];
+  }
+
+  /* number count and galaxy lensing sources: specific samplings */
+  else if (_scalars_ && ((_nonintegrated_ncl_) || (_integrated_ncl_))) {
+
+    class_alloc(tau0_minus_tau,tau_size*sizeof(double),ptr->error_message);
+
+    if (_nonintegrated_ncl_) {
+
+      _get_bin_nonintegrated_ncl_(index_tt)
+
+      class_call(transfer_selection_sampling(ppr,
+                                             pba,
+                                             ppt,
+                                             ptr,
+                                             bin,
+                                             tau0_minus_tau,
+                                             tau_size),
+                 ptr->error_message,
+                 ptr->error_message);
+    }
+    else {
+
+      _get_bin_integrated_ncl_(index_tt)
+
+      class_call(transfer_lensing_sampling(ppr,
+                                           pba,
+                                           ppt,
+                                           ptr,
+                                           bin,
+                                           tau0,
+                                           tau0_minus_tau,
+                                           tau_size),
+                 ptr->error_message,
+                 ptr->error_message);
+    }
+
+    *tau0_minus_tau_max = tau0_minus_tau[0];
+
+    free(tau0_minus_tau);
+  }
+
+  /* all other sources: full sampling of the perturbation module */
+  else {
+    *tau0_minus_tau_max = tau0 - ppt->tau_sampling[0];
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Compute the transfer functions of all wavenumbers of ptr->q (in
+ * parallel over wavenumbers), and store them in the table allocated by
+ * transfer_storage_init().
+ *
+ * @param ppr                Input: pointer to precision structure
+ * @param pba                Input: pointer to background structure
+ * @param ppt                Input: pointer to perturbation structure
+ * @param ptr                Input/Output: pointer to transfers structure
+ * @param tp_of_tt           Input: correspondence between perturbation and transfer types
+ * @param tau_size_max       Input: maximum number of sampling times of the transfer sources
+ * @param tau_rec            Input: recombination time
+ * @param tau0               Input: conformal age
+ * @param tau0_minus_tau_cut Input: tau0 minus the time below which the CMB sources are cut
+ * @param sources            Input: perturbation sources
+ * @param sources_spline     Input: their second derivatives with respect to k
+ * @param window             Input: precomputed selection functions
+ * @param pBIS               Input: flat spherical Bessel functions
+ * @return the error status
+ */
+
+int transfer_compute_for_all_q(
+                               struct precision * ppr,
+                               struct background * pba,
+                               struct perturbs * ppt,
+                               struct transfers * ptr,
+                               int ** tp_of_tt,
+                               int tau_size_max,
+                               double tau_rec,
+                               double tau0,
+                               double tau0_minus_tau_cut,
+                               double *** sources,
+                               double *** sources_spline,
+                               double * window,
+                               HyperInterpStruct * pBIS
+                               ) {
+
+  /* running index for wavenumbers */
+  int index_q;
+
+  /* pointer on workspace (one per thread if openmp) */
+  struct transfer_workspace * ptw;
+
+  /* workspaces of all threads, indexed by thread number */
+  struct transfer_workspace ** ptw_of_thread;
+  int number_of_threads=1;
+
+  /* This code can be optionally compiled with the openmp option for parallel computation.
+     Inside parallel regions, the use of the command "return" is forbidden.
+     For error management, instead of "return _FAILURE_", we will set the variable below
+     to "abort = _TRUE_". This will lead to a "return _FAILURE_" just after leaving the
+     parallel region. */
+  int abort;
+
+#ifdef _OPENMP
+
+  /* instrumentation times */
+  double tstart, tstop, tspent;
+
+#endif
+
+  struct parallel_timer timer;
+
+  /* in an MPI run, rank of the process computing each wavenumber (NULL if this process computes them all) */
+  int * q_rank = NULL;
+  int mpi_rank = class_mpi_rank();
+
+  /* (a.3.) workspace, allocated in a parallel zone since in openmp
+     version there is one workspace per thread */
+
+  /* initialize error management flag */
+  abort = _FALSE_;
+
+  /** - in an MPI run, share the wavenumbers among the processes with transfer_mpi_partition() */
+
+  if (class_mpi_size() > 1) {
+    class_alloc(q_rank,ptr->q_size*sizeof(int),ptr->error_message);
+    class_call(transfer_mpi_partition(ppt,ptr,q_rank),
+               ptr->error_message,
+               ptr->error_message);
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel
+  {
+    number_of_threads = omp_get_num_threads();
+  }
+#endif
+
+  class_calloc(ptw_of_thread,number_of_threads,sizeof(struct transfer_workspace *),ptr->error_message);
+
+  parallel_timer_start(&timer);
+
+  /* beginning of parallel region */
+#pragma omp parallel                                                    \
+  shared(tau_size_max,ptr,ppr,pba,ppt,tp_of_tt,tau_rec,sources,sources_spline,window,abort,pBIS,tau0,ptw_of_thread,timer,q_rank,mpi_rank) \
+  private(ptw,index_q,tstart,tstop,tspent)                              \
+  num_threads(number_of_threads)
+  {
+
+#ifdef _OPENMP
+    tspent = 0.;
+#endif
+
+    /* allocate workspace */
+
+    ptw = NULL;
+
+    class_call_parallel(transfer_workspace_init(ptr,
+                                                ppr,
+                                                &ptw,
+                                                ppt->tau_size,
+                                                tau_size_max,
+                                                pba->K,
+                                                pba->sgnK,
+                                                tau0_minus_tau_cut,
+                                                pBIS),
+                        ptr->error_message,
+                        ptr->error_message);
+
+#ifdef _OPENMP
+    /* make this workspace's scratch space available to the tiles of multipoles (see transfer_compute_for_each_q()) executed by this thread */
+    if (ptw != NULL) {
+      ptw_of_thread[omp_get_thread_num()] = ptw;
+      ptw->ptw_of_thread = ptw_of_thread;
+    }
+#endif
+
+    /** - loop over all wavenumbers (parallelized).*/
+    /* For each wavenumber: */
+
+#pragma omp for schedule (dynamic) nowait
+
+    for (index_q = 0; index_q < ptr->q_size; index_q++) {
+
+      /* wavenumbers of other processes */
+      if ((q_rank != NULL) && (q_rank[index_q] != mpi_rank))
+        continue;
+
+#ifdef _OPENMP
+      tstart = omp_get_wtime();
+#endif
+
+      if (ptr->transfer_verbose > 2)
+        printf("Compute transfer for wavenumber [%d/%zu]\n",index_q,ptr->q_size-1);
+
+      /* Update interpolation structure: */
+      class_call_parallel(transfer_update_HIS(ppr,
+                                              ptr,
+                                              ptw,
+                                              index_q,
+                                              tau0),
+                          ptr->error_message,
+                          ptr->error_message);
+
+      class_call_parallel(transfer_compute_for_each_q(ppr,
+                                                      pba,
+                                                      ppt,
+                                                      ptr,
+                                                      tp_of_tt,
+                                                      index_q,
+                                                      tau_size_max,
+                                                      tau_rec,
+                                                      sources,
+                                                      sources_spline,
+                                                      window,
+                                                      ptw),
+                          ptr->error_message,
+                          ptr->error_message);
+
+#ifdef _OPENMP
+      tstop = omp_get_wtime();
+
+      tspent += tstop-tstart;
+#endif
+
+#pragma omp flush(abort)
+
+    } /* end of loop over wavenumber */
+
+    parallel_timer_thread_done(&timer);
+
+    /* the tiles of multipoles of other threads may still use the scratch space of this workspace until all threads are done */
+#pragma omp barrier
+
+    /* free workspace allocated inside parallel zone */
+    class_call_parallel(transfer_workspace_free(ptr,ptw),
+                        ptr->error_message,
+                        ptr->error_message);
+
+#ifdef _OPENMP
+    if (ptr->transfer_verbose>1)
+      printf("In %s: time spent in parallel region (loop over k's) = %e s for thread %d\n",
+             __func__,tspent,omp_get_thread_num());
+#endif
+
+  } /* end of parallel region */
+
+  parallel_timer_stop(&timer,"transfer_compute_for_all_q: q loop");
+
+  free(ptw_of_thread);
+
+  /** - in an MPI run, gather the transfer functions of all processes with transfer_mpi_gather() */
+
+  if (q_rank != NULL) {
+
+    class_call(class_mpi_any(&abort,ptr->error_message),
+               ptr->error_message,
+               ptr->error_message);
+
+    if (abort == _FALSE_) {
+      class_call(transfer_mpi_gather(ppt,ptr,q_rank),
+                 ptr->error_message,
+                 ptr->error_message);
+    }
+
+    free(q_rank);
+  }
+
+  if (abort == _TRUE_) return _FAILURE_;
+
+  return _SUCCESS_;
+}
+
+/**
+ * In an MPI run, share the wavenumbers of the transfer functions among
+ * the processes with class_mpi_partition(). The cost of a wavenumber
+ * is taken as the number of transfer functions stored for it (over
+ * all modes, initial conditions, types and multipoles, see
+ * transfer_storage_init()), plus one for the interpolation of the
+ * sources and Bessel functions.
+ *
+ * @param ppt    Input: pointer to perturbation structure
+ * @param ptr    Input: pointer to transfers structure
+ * @param q_rank Output: rank of the process computing each wavenumber
+ * @return the error status
+ */
+
+int transfer_mpi_partition(
+                           struct perturbs * ppt,
+                           struct transfers * ptr,
+                           int * q_rank
+                           ) {
+
+  int index_md,index_row,row_size,index_q;
+  double * q_cost;
+
+  class_alloc(q_cost,ptr->q_size*sizeof(double),ptr->error_message);
+
+  for (index_q = 0; index_q < ptr->q_size; index_q++) {
+    q_cost[index_q] = 1.;
+    q_rank[index_q] = -1;
+  }
+
+  for (index_md = 0; index_md < ptr->md_size; index_md++) {
+    row_size = ppt->ic_size[index_md] * ptr->tt_size[index_md] * ptr->l_size[index_md];
+    for (index_row = 0; index_row < row_size; index_row++)
+      for (index_q = ptr->q_index_min[index_md][index_row]; index_q < ptr->q_index_max[index_md][index_row]; index_q++)
+        q_cost[index_q] += 1.;
+  }
+
+  class_call(class_mpi_partition(ptr->q_size,q_cost,q_rank,ptr->error_message),
+             ptr->error_message,
+             ptr->error_message);
+
+  free(q_cost);
+
+  return _SUCCESS_;
+}
+
+/**
+ * In an MPI run, gather in every process the transfer functions
+ * computed by all processes: each process sends the stored transfer
+ * functions of its own wavenumbers, by increasing wavenumber, mode and
+ * row, and copies those of the other processes in its table.
+ *
+ * @param ppt    Input: pointer to perturbation structure
+ * @param ptr    Input/Output: pointer to transfers structure
+ * @param q_rank Input: rank of the process which computed each wavenumber
+ * @return the error status
+ */
+
+int transfer_mpi_gather(
+                        struct perturbs * ppt,
+                        struct transfers * ptr,
+                        int * q_rank
+                        ) {
+
+  int mpi_size = class_mpi_size();
+  int mpi_rank = class_mpi_rank();
+  int index_md,index_row,index_q,rank,total_count;
+  int * row_size;
+  int * receive_count;
+  double * send_buffer;
+  double * receive_buffer;
+  double * pointer;
+
+  class_alloc(row_size,ptr->md_size*sizeof(int),ptr->error_message);
+  class_calloc(receive_count,mpi_size,sizeof(int),ptr->error_message);
+
+  for (index_md = 0; index_md < ptr->md_size; index_md++) {
+    row_size[index_md] = ppt->ic_size[index_md] * ptr->tt_size[index_md] * ptr->l_size[index_md];
+    for (index_row = 0; index_row < row_size[index_md]; index_row++)
+      for (index_q = ptr->q_index_min[index_md][index_row]; index_q < ptr->q_index_max[index_md][index_row]; index_q++)
+        receive_count[q_rank[index_q]]++;
+  }
+
+  total_count = 0;
+  for (rank = 0; rank < mpi_size; rank++)
+    total_count += receive_count[rank];
+
+  class_alloc(send_buffer,MAX(receive_count[mpi_rank],1)*sizeof(double),ptr->error_message);
+  class_alloc(receive_buffer,MAX(total_count,1)*sizeof(double),ptr->error_message);
+
+  pointer = send_buffer;
+  for (index_q = 0; index_q < ptr->q_size; index_q++) {
+    if (q_rank[index_q] != mpi_rank)
+      continue;
+    for (index_md = 0; index_md < ptr->md_size; index_md++)
+      for (index_row = 0; index_row < row_size[index_md]; index_row++)
+        if (_transfer_is_stored_(ptr,index_md,index_row,index_q))
+          *(pointer++) = _transfer_stored_(ptr,index_md,index_row,index_q);
+  }
+
+  class_call(class_mpi_allgather(send_buffer,receive_count[mpi_rank],receive_buffer,receive_count,ptr->error_message),
+             ptr->error_message,
+             ptr->error_message);
+
+  /* the blocks of the processes follow each other by increasing rank */
+  pointer = receive_buffer;
+  for (rank = 0; rank < mpi_size; rank++) {
+    for (index_q = 0; index_q < ptr->q_size; index_q++) {
+      if (q_rank[index_q] != rank)
+        continue;
+      for (index_md = 0; index_md < ptr->md_size; index_md++)
+        for (index_row = 0; index_row < row_size[index_md]; index_row++)
+          if (_transfer_is_stored_(ptr,index_md,index_row,index_q))
+            _transfer_stored_(ptr,index_md,index_row,index_q) = *(pointer++);
+    }
+  }
+
+  free(row_size);
+  free(receive_count);
+  free(send_buffer);
+  free(receive_buffer);
+
+  return _SUCCESS_;
+}
+
+
+/**
+ * Refine the list of wavenumbers ptr->q where the transfer functions
+ * need it (called when q_adaptive is true, in which case
+ * transfer_get_q_list() has built a list coarser by a factor
+ * q_adaptive_coarsening).
+ *
+ * The transfer functions of a subset of rows (every
+ * q_adaptive_l_step-th multipole of each mode, initial condition and
+ * type) are computed at all wavenumbers of the coarse list with
+ * transfer_q_adaptive_probe(). Then, at each level, they are computed
+ * at the middle of the intervals still to be refined (in closed
+ * models, only above the flat approximation: the integer values of nu
+ * below are those of the usual list). For each row, the difference between the
+ * trapezoidal integrals of \f$ \Delta_l(q)^2/q \f$ (the integrand of
+ * the \f$ C_l \f$'s) over the interval with and without the midpoint,
+ * relative to the integral over all q, estimates the error due to
+ * this interval. The midpoint is kept, and the two halves are
+ * refined further, when this error, maximized over rows, exceeds the
+ * tolerance times the relative width of the interval
+ * (q_adaptive_tol_cmb for CMB types, q_adaptive_tol_lss for number
+ * count and lensing types). This stops after q_adaptive_max_level
+ * levels.
+ *
+ * The estimated errors of all intervals are summed into
+ * ptr->q_adaptive_error_cmb and ptr->q_adaptive_error_lss (an upper
+ * bound on the relative error of each probed row); for intervals
+ * split at the last level, the error of each half is estimated as
+ * 1/8 of that of the whole interval.
+ *
+ * @param ppr                Input: pointer to precision structure
+ * @param pba                Input: pointer to background structure
+ * @param ppt                Input: pointer to perturbation structure
+ * @param ptr                Input/Output: pointer to transfers structure (q's and k's replaced)
+ * @param tp_of_tt           Input: correspondence between perturbation and transfer types
+ * @param tau_size_max       Input: maximum number of sampling times of the transfer sources
+ * @param tau_rec            Input: recombination time
+ * @param tau0               Input: conformal age
+ * @param tau0_minus_tau_cut Input: tau0 minus the time below which the CMB sources are cut
+ * @param sources            Input: perturbation sources
+ * @param sources_spline     Input: their second derivatives with respect to k
+ * @param window             Input: precomputed selection functions
+ * @param pBIS               Input: flat spherical Bessel functions
+ * @return the error status
+ */
+
+int transfer_q_adaptive_sampling(
+                                 struct precision * ppr,
+                                 struct background * pba,
+                                 struct perturbs * ppt,
+                                 struct transfers * ptr,
+                                 int ** tp_of_tt,
+                                 int tau_size_max,
+                                 double tau_rec,
+                                 double tau0,
+                                 double tau0_minus_tau_cut,
+                                 double *** sources,
+                                 double *** sources_spline,
+                                 double * window,
+                                 HyperInterpStruct * pBIS
+                                 ) {
+
+  int index_md,index_ic,index_tt,index_l,index_q,index_probe,index_mid,level;
+  int probe_size,l_step;
+  int * probe_md;
+  int * probe_row;
+  short * probe_is_lss;
+
+  /* current list: wavenumbers, probed transfer functions values[index_q][index_probe],
+     and for each interval [q[index_q],q[index_q+1]] a flag and the estimated errors */
+  int q_size,q_size_initial;
+  double * q;
+  double ** values;
+  short * refine;
+  double * error_cmb;
+  double * error_lss;
+
+  /* midpoints of the intervals to refine at a given level */
+  int mid_size;
+  double * q_mid;
+  int * interval_of_mid;
+  double ** values_mid;
+
+  /* next list */
+  int q_size_new;
+  double * q_new;
+  double ** values_new;
+  short * refine_new;
+  double * error_cmb_new;
+  double * error_lss_new;
+
+  double * norm;
+  double q_approximation=0.,q_range;
+  double h_left,h_right,f_left,f_right,f_mid,diff;
+  double err_cmb,err_lss;
+
+  if (pba->sgnK == 1)
+    q_approximation = ppr->hyper_flat_approximation_nu * sqrt(pba->K);
+
+  /** - choose the probed rows: every q_adaptive_l_step-th multipole
+      (and the last one) of each mode, initial condition and type */
+
+  l_step = MAX(ppr->q_adaptive_l_step,1);
+
+  probe_size = 0;
+  for (index_md = 0; index_md < ptr->md_size; index_md++)
+    for (index_ic = 0; index_ic < ppt->ic_size[index_md]; index_ic++)
+      for (index_tt = 0; index_tt < ptr->tt_size[index_md]; index_tt++)
+        for (index_l = 0; index_l < ptr->l_size_tt[index_md][index_tt]; index_l++)
+          if ((index_l % l_step == 0) || (index_l == ptr->l_size_tt[index_md][index_tt]-1))
+            probe_size++;
+
+  class_test(probe_size == 0,
+             ptr->error_message,
+             "no transfer function to probe for the adaptive sampling in q");
+
+  class_alloc(probe_md,probe_size*sizeof(int),ptr->error_message);
+  class_alloc(probe_row,probe_size*sizeof(int),ptr->error_message);
+  class_alloc(probe_is_lss,probe_size*sizeof(short),ptr->error_message);
+  class_alloc(norm,probe_size*sizeof(double),ptr->error_message);
+
+  index_probe = 0;
+  for (index_md = 0; index_md < ptr->md_size; index_md++) {
+    for (index_ic = 0; index_ic < ppt->ic_size[index_md]; index_ic++) {
+      for (index_tt = 0; index_tt < ptr->tt_size[index_md]; index_tt++) {
+        for (index_l = 0; index_l < ptr->l_size_tt[index_md][index_tt]; index_l++) {
+          if ((index_l % l_step == 0) || (index_l == ptr->l_size_tt[index_md][index_tt]-1)) {
+            probe_md[index_probe] = index_md;
+            probe_row[index_probe] = _transfer_row_(ptr,index_md,index_ic,index_tt,index_l);
+            if ((_scalars_) && ((_nonintegrated_ncl_) || (_integrated_ncl_)))
+              probe_is_lss[index_probe] = _TRUE_;
+            else
+              probe_is_lss[index_probe] = _FALSE_;
+            index_probe++;
+          }
+        }
+      }
+    }
+  }
+
+  /** - compute them at all wavenumbers of the initial list */
+
+  q_size = ptr->q_size;
+  q_size_initial = q_size;
+
+  class_alloc(q,q_size*sizeof(double),ptr->error_message);
+  class_alloc(values,q_size*sizeof(double*),ptr->error_message);
+  class_alloc(refine,(q_size-1)*sizeof(short),ptr->error_message);
+  class_calloc(error_cmb,q_size-1,sizeof(double),ptr->error_message);
+  class_calloc(error_lss,q_size-1,sizeof(double),ptr->error_message);
+
+  for (index_q = 0; index_q < q_size; index_q++) {
+    q[index_q] = ptr->q[index_q];
+    class_alloc(values[index_q],probe_size*sizeof(double),ptr->error_message);
+  }
+  for (index_q = 0; index_q < q_size-1; index_q++)
+    refine[index_q] = _TRUE_;
+
+  class_call(transfer_q_adaptive_probe(ppr,pba,ppt,ptr,tp_of_tt,tau_size_max,tau_rec,tau0,tau0_minus_tau_cut,
+                                       sources,sources_spline,window,pBIS,
+                                       q,q_size,probe_size,probe_md,probe_row,values),
+             ptr->error_message,
+             ptr->error_message);
+
+  q_range = q[q_size-1]-q[0];
+
+  /** - loop over refinement levels */
+
+  for (level = 0; level < ppr->q_adaptive_max_level; level++) {
+
+    /** - find the midpoints of the intervals to refine */
+
+    class_alloc(q_mid,q_size*sizeof(double),ptr->error_message);
+    class_alloc(interval_of_mid,q_size*sizeof(int),ptr->error_message);
+
+    mid_size = 0;
+    for (index_q = 0; index_q < q_size-1; index_q++) {
+      if (refine[index_q] == _FALSE_)
+        continue;
+      q_mid[mid_size] = 0.5*(q[index_q]+q[index_q+1]);
+      /* in closed models, the list of integer values of nu below the
+         flat approximation is kept: adding some of them makes the
+         trapezoidal sum of the spectra module less accurate */
+      if ((pba->sgnK == 1) && (q_mid[mid_size] < q_approximation)) {
+        refine[index_q] = _FALSE_;
+        continue;
+      }
+      interval_of_mid[mid_size] = index_q;
+      mid_size++;
+    }
+
+    if (mid_size == 0) {
+      free(q_mid);
+      free(interval_of_mid);
+      break;
+    }
+
+    /* the largest wavenumber is computed again, so that the probed list has the same q_max as the full one
+       (it sets the range of the Bessel functions in curved models) */
+    q_mid[mid_size] = q[q_size-1];
+
+    class_alloc(values_mid,(mid_size+1)*sizeof(double*),ptr->error_message);
+    for (index_mid = 0; index_mid <= mid_size; index_mid++)
+      class_alloc(values_mid[index_mid],probe_size*sizeof(double),ptr->error_message);
+
+    class_call(transfer_q_adaptive_probe(ppr,pba,ppt,ptr,tp_of_tt,tau_size_max,tau_rec,tau0,tau0_minus_tau_cut,
+                                         sources,sources_spline,window,pBIS,
+                                         q_mid,mid_size+1,probe_size,probe_md,probe_row,values_mid),
+               ptr->error_message,
+               ptr->error_message);
+
+    /** - for each row, the trapezoidal integral of Delta_l^2/q over the current list */
+
+    for (index_probe = 0; index_probe < probe_size; index_probe++) {
+      norm[index_probe] = 0.;
+      for (index_q = 0; index_q < q_size-1; index_q++)
+        norm[index_probe] += 0.5*(q[index_q+1]-q[index_q])
+          *(values[index_q][index_probe]*values[index_q][index_probe]/q[index_q]
+            +values[index_q+1][index_probe]*values[index_q+1][index_probe]/q[index_q+1]);
+    }
+
+    /** - estimate the error of each interval, and build the new list */
+
+    q_size_new = q_size+mid_size;
+
+    class_alloc(q_new,q_size_new*sizeof(double),ptr->error_message);
+    class_alloc(values_new,q_size_new*sizeof(double*),ptr->error_message);
+    class_alloc(refine_new,(q_size_new-1)*sizeof(short),ptr->error_message);
+    class_alloc(error_cmb_new,(q_size_new-1)*sizeof(double),ptr->error_message);
+    class_alloc(error_lss_new,(q_size_new-1)*sizeof(double),ptr->error_message);
+
+    q_size_new = 0;
+    index_mid = 0;
+
+    for (index_q = 0; index_q < q_size; index_q++) {
+
+      q_new[q_size_new] = q[index_q];
+      values_new[q_size_new] = values[index_q];
+      q_size_new++;
+
+      if (index_q == q_size-1)
+        break;
+
+      if ((index_mid < mid_size) && (interval_of_mid[index_mid] == index_q)) {
+
+        h_left = q_mid[index_mid]-q[index_q];
+        h_right = q[index_q+1]-q_mid[index_mid];
+
+        err_cmb = 0.;
+        err_lss = 0.;
+
+        for (index_probe = 0; index_probe < probe_size; index_probe++) {
+
+          if (norm[index_probe] <= 0.)
+            continue;
+
+          f_left = values[index_q][index_probe]*values[index_q][index_probe]/q[index_q];
+          f_right = values[index_q+1][index_probe]*values[index_q+1][index_probe]/q[index_q+1];
+          f_mid = values_mid[index_mid][index_probe]*values_mid[index_mid][index_probe]/q_mid[index_mid];
+
+          diff = fabs(0.5*h_left*(f_left+f_mid)+0.5*h_right*(f_mid+f_right)
+                      -0.5*(h_left+h_right)*(f_left+f_right))/norm[index_probe];
+
+          if (probe_is_lss[index_probe] == _TRUE_)
+            err_lss = MAX(err_lss,diff);
+          else
+            err_cmb = MAX(err_cmb,diff);
+        }
+
+        if ((err_cmb > ppr->q_adaptive_tol_cmb*(h_left+h_right)/q_range) ||
+            (err_lss > ppr->q_adaptive_tol_lss*(h_left+h_right)/q_range)) {
+
+          /* keep the midpoint, and refine both halves */
+          refine_new[q_size_new-1] = _TRUE_;
+          error_cmb_new[q_size_new-1] = err_cmb/8.;
+          error_lss_new[q_size_new-1] = err_lss/8.;
+
+          q_new[q_size_new] = q_mid[index_mid];
+          values_new[q_size_new] = values_mid[index_mid];
+          refine_new[q_size_new] = _TRUE_;
+          error_cmb_new[q_size_new] = err_cmb/8.;
+          error_lss_new[q_size_new] = err_lss/8.;
+          q_size_new++;
+        }
+        else {
+
+          /* the interval is accurate enough */
+          refine_new[q_size_new-1] = _FALSE_;
+          error_cmb_new[q_size_new-1] = err_cmb;
+          error_lss_new[q_size_new-1] = err_lss;
+          free(values_mid[index_mid]);
+        }
+
+        index_mid++;
+      }
+      else {
+        refine_new[q_size_new-1] = refine[index_q];
+        error_cmb_new[q_size_new-1] = error_cmb[index_q];
+        error_lss_new[q_size_new-1] = error_lss[index_q];
+      }
+    }
+
+    free(values_mid[mid_size]);
+    free(values_mid);
+    free(q_mid);
+    free(interval_of_mid);
+
+    free(q);
+    free(values);
+    free(refine);
+    free(error_cmb);
+    free(error_lss);
+
+    q_size = q_size_new;
+    q = q_new;
+    values = values_new;
+    refine = refine_new;
+    error_cmb = error_cmb_new;
+    error_lss = error_lss_new;
+  }
+
+  /** - sum the estimated errors of all intervals */
+
+  ptr->q_adaptive_error_cmb = 0.;
+  ptr->q_adaptive_error_lss = 0.;
+  for (index_q = 0; index_q < q_size-1; index_q++) {
+    ptr->q_adaptive_error_cmb += error_cmb[index_q];
+    ptr->q_adaptive_error_lss += error_lss[index_q];
+  }
+
+  /** - replace the list of wavenumbers, and infer the new k's */
+
+  free(ptr->q);
+  for (index_md = 0; index_md < ptr->md_size; index_md++)
+    free(ptr->k[index_md]);
+  free(ptr->k);
+
+  class_realloc(q,q,q_size*sizeof(double),ptr->error_message);
+  ptr->q = q;
+  ptr->q_size = q_size;
+
+  class_call(transfer_get_k_list(ppt,ptr,pba->K),
+             ptr->error_message,
+             ptr->error_message);
+
+  class_call(transfer_get_index_q_flat_approximation(ppr,ptr,pba->K,pba->sgnK),
+             ptr->error_message,
+             ptr->error_message);
+
+  if (ptr->transfer_verbose > 1)
+    printf(" -> adaptive sampling: %zu wavenumbers (%d in the initial list, %d rows probed), estimated relative error %e for CMB types and %e for number count and lensing types\n",
+           ptr->q_size,q_size_initial,probe_size,ptr->q_adaptive_error_cmb,ptr->q_adaptive_error_lss);
+
+  for (index_q = 0; index_q < q_size; index_q++)
+    free(values[index_q]);
+  free(values);
+  free(refine);
+  free(error_cmb);
+  free(error_lss);
+  free(norm);
+  free(probe_md);
+  free(probe_row);
+  free(probe_is_lss);
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * Compute the transfer functions of some rows at a list of
+ * wavenumbers, for transfer_q_adaptive_sampling(). This uses a copy
+ * of the transfers structure with the list q_probe and a table storing
+ * only these rows, so that transfer_compute_for_l_tile() skips all
+ * other multipoles.
+ *
+ * @param ppr                Input: pointer to precision structure
+ * @param pba                Input: pointer to background structure
+ * @param ppt                Input: pointer to perturbation structure
+ * @param ptr                Input: pointer to transfers structure
+ * @param tp_of_tt           Input: correspondence between perturbation and transfer types
+ * @param tau_size_max       Input: maximum number of sampling times of the transfer sources
+ * @param tau_rec            Input: recombination time
+ * @param tau0               Input: conformal age
+ * @param tau0_minus_tau_cut Input: tau0 minus the time below which the CMB sources are cut
+ * @param sources            Input: perturbation sources
+ * @param sources_spline     Input: their second derivatives with respect to k
+ * @param window             Input: precomputed selection functions
+ * @param pBIS               Input: flat spherical Bessel functions
+ * @param q_probe            Input: increasing list of wavenumbers
+ * @param q_probe_size       Input: its size
+ * @param probe_size         Input: number of rows
+ * @param probe_md           Input: mode of each row
+ * @param probe_row          Input: index of each row (see _transfer_row_())
+ * @param values             Output: transfer functions, values[index_q][index_probe] (allocated by the caller)
+ * @return the error status
+ */
+
+int transfer_q_adaptive_probe(
+                              struct precision * ppr,
+                              struct background * pba,
+                              struct perturbs * ppt,
+                              struct transfers * ptr,
+                              int ** tp_of_tt,
+                              int tau_size_max,
+                              double tau_rec,
+                              double tau0,
+                              double tau0_minus_tau_cut,
+                              double *** sources,
+                              double *** sources_spline,
+                              double * window,
+                              HyperInterpStruct * pBIS,
+                              double * q_probe,
+                              int q_probe_size,
+                              int probe_size,
+                              int * probe_md,
+                              int * probe_row,
+                              double ** values
+                              ) {
+
+  struct transfers tr;
+  int index_md,index_row,index_probe,index_q,row_size;
+  long size;
+
+  /* the copy shares all arrays of ptr, excepted those depending on the list of wavenumbers */
+  tr = *ptr;
+  tr.q = q_probe;
+  tr.q_size = q_probe_size;
+  tr.transfer_verbose = 0;
+
+  class_call(transfer_get_k_list(ppt,&tr,pba->K),
+             tr.error_message,
+             ptr->error_message);
+
+  class_call(transfer_get_index_q_flat_approximation(ppr,&tr,pba->K,pba->sgnK),
+             tr.error_message,
+             ptr->error_message);
+
+  class_alloc(tr.transfer,tr.md_size * sizeof(double *),ptr->error_message);
+  class_alloc(tr.q_index_min,tr.md_size * sizeof(int *),ptr->error_message);
+  class_alloc(tr.q_index_max,tr.md_size * sizeof(int *),ptr->error_message);
+  class_alloc(tr.transfer_offset,tr.md_size * sizeof(long *),ptr->error_message);
+  class_alloc(tr.transfer_size,tr.md_size * sizeof(long),ptr->error_message);
+
+  for (index_md = 0; index_md < tr.md_size; index_md++) {
+
+    row_size = ppt->ic_size[index_md] * tr.tt_size[index_md] * tr.l_size[index_md];
+
+    class_calloc(tr.q_index_min[index_md],row_size,sizeof(int),ptr->error_message);
+    class_calloc(tr.q_index_max[index_md],row_size,sizeof(int),ptr->error_message);
+    class_calloc(tr.transfer_offset[index_md],row_size,sizeof(long),ptr->error_message);
+
+    size = 0;
+    for (index_probe = 0; index_probe < probe_size; index_probe++) {
+      if (probe_md[index_probe] == index_md) {
+        index_row = probe_row[index_probe];
+        tr.q_index_max[index_md][index_row] = q_probe_size;
+        tr.transfer_offset[index_md][index_row] = size;
+        size += q_probe_size;
+      }
+    }
+
+    tr.transfer_size[index_md] = size;
+    class_alloc(tr.transfer[index_md],MAX(size,1) * sizeof(double),ptr->error_message);
+  }
+
+  class_call(transfer_compute_for_all_q(ppr,
+                                        pba,
+                                        ppt,
+                                        &tr,
+                                        tp_of_tt,
+                                        tau_size_max,
+                                        tau_rec,
+                                        tau0,
+                                        tau0_minus_tau_cut,
+                                        sources,
+                                        sources_spline,
+                                        window,
+                                        pBIS),
+             tr.error_message,
+             ptr->error_message);
+
+  for (index_q = 0; index_q < q_probe_size; index_q++)
+    for (index_probe = 0; index_probe < probe_size; index_probe++)
+      values[index_q][index_probe] = _transfer_stored_(&tr,probe_md[index_probe],probe_row[index_probe],index_q);
+
+  for (index_md = 0; index_md < tr.md_size; index_md++) {
+    free(tr.k[index_md]);
+    free(tr.transfer[index_md]);
+    free(tr.q_index_min[index_md]);
+    free(tr.q_index_max[index_md]);
+    free(tr.transfer_offset[index_md]);
+  }
+  free(tr.k);
+  free(tr.transfer);
+  free(tr.q_index_min);
+  free(tr.q_index_max);
+  free(tr.transfer_offset);
+  free(tr.transfer_size);
+
+  return _SUCCESS_;
+
+}
+
+int transfer_compute_for_each_q(
+                                struct precision * ppr,
+                                struct background * pba,
+                                struct perturbs * ppt,
+                                struct transfers * ptr,
+                                int ** tp_of_tt,
+                                int index_q,
+                                int tau_size_max,
+                                double tau_rec,
+                                double *** pert_sources,
+                                double *** pert_sources_spline,
+                                double * window,
+                                struct transfer_workspace * ptw
+                                ) {
+
+  /** Summary: */
+
+  /** - define local variables */
+
+  /* running index for modes */
   int index_md;
   /* running index for initial conditions */
   int index_ic;
@@ -1705,6 +3196,7 @@ int transfer_compute_for_each_q(
   int index_tt;
   /* running index for multipoles */
   int index_l;
+  int index_row;
 
   /** - we deal with workspaces, i.e. with contiguous memory zones (one
       per thread) containing various fields used by the integration
@@ -1726,19 +3218,22 @@ int transfer_compute_for_each_q(
      sources[index_tau] */
   double * sources;
 
-  /** - for a given l, maximum value of k such that we can convolve
-      the source with Bessel functions j_l(x) without reaching x_max */
-  double q_max_bessel;
-
   /* a value of index_type */
   int previous_type;
 
-  double l;
-
-  short neglect;
+  /* interpolation cursor in the list of k values of the sources */
+  int last_index;
 
   radial_function_type radial_type;
 
+#ifdef _OPENMP
+  /* first multipole index of a tile */
+  int index_l_min;
+
+  /* error flag of the tiles computed as tasks (inside which "return" is forbidden) */
+  int abort = _FALSE_;
+#endif
+
   /** - store the sources in the workspace and define all
       fields in this workspace */
   interpolated_sources = ptw->interpolated_sources;
@@ -1755,6 +3250,8 @@ int transfer_compute_for_each_q(
 
     if (ptr->k[index_md][index_q] <= ppt->k[index_md][ppt->k_size_cl[index_md]-1]) {
 
+      last_index = -1;
+
       /** - loop over initial conditions. */
       /* For each of them: */
 
@@ -1781,6 +3278,7 @@ int transfer_compute_for_each_q(
                                                     tp_of_tt[index_md][index_tt],
                                                     pert_sources[index_md][index_ic * ppt->tp_size[index_md] + tp_of_tt[index_md][index_tt]],
                                                     pert_sources_spline[index_md][index_ic * ppt->tp_size[index_md] + tp_of_tt[index_md][index_tt]],
+                                                    &last_index,
                                                     interpolated_sources),
                        ptr->error_message,
                        ptr->error_message);
@@ -1834,84 +3332,64 @@ int transfer_compute_for_each_q(
                      ptr->error_message,
                      ptr->error_message);
 
-          for (index_l = 0; index_l < ptr->l_size[index_md]; index_l++) {
+          /** - compute the transfer functions for all l, either at
+              once or by tiles of multipoles which idle threads can
+              pick up */
+#ifdef _OPENMP
+          if ((ppr->transfer_l_tile_size > 0) && (ptw->ptw_of_thread != NULL)) {
+
+            for (index_l_min = 0; index_l_min < ptr->l_size[index_md]; index_l_min += ppr->transfer_l_tile_size) {
+
+#pragma omp task firstprivate(index_l_min,index_md,index_ic,index_tt,radial_type) shared(ppr,pba,ppt,ptr,ptw,abort)
+              if (abort == _FALSE_) {
+                /* the tile reads the sources and radial coordinates of
+                   this workspace (which do not change until the
+                   taskwait below), but uses the scratch space of the
+                   thread executing it */
+                struct transfer_workspace tw_tile = *ptw;
+                tw_tile.radial_scratch = ptw->ptw_of_thread[omp_get_thread_num()]->radial_scratch;
+
+                class_call_parallel(transfer_compute_for_l_tile(ppr,
+                                                                pba,
+                                                                ppt,
+                                                                ptr,
+                                                                &tw_tile,
+                                                                index_q,
+                                                                index_md,
+                                                                index_ic,
+                                                                index_tt,
+                                                                index_l_min,
+                                                                MIN(index_l_min+ppr->transfer_l_tile_size,ptr->l_size[index_md]),
+                                                                tau_rec,
+                                                                radial_type),
+                                    ptr->error_message,
+                                    ptr->error_message);
+              }
+            }
+
+#pragma omp taskwait
 
-            l = (double)ptr->l[index_l];
+            if (abort == _TRUE_) return _FAILURE_;
+
+            continue;
+          }
+#endif
 
-            /* neglect transfer function when l is much smaller than k*tau0 */
-            class_call(transfer_can_be_neglected(ppr,
+          class_call(transfer_compute_for_l_tile(ppr,
+                                                 pba,
                                                  ppt,
                                                  ptr,
+                                                 ptw,
+                                                 index_q,
                                                  index_md,
                                                  index_ic,
                                                  index_tt,
-                                                 (pba->conformal_age-tau_rec)*ptr->angular_rescaling,
-                                                 ptr->q[index_q],
-                                                 l,
-                                                 &neglect),
-                       ptr->error_message,
-                       ptr->error_message);
-
-            /* for K>0 (closed), transfer functions only defined for l<nu */
-            if ((ptw->sgnK == 1) && (ptr->l[index_l] >= (int)(ptr->q[index_q]/sqrt(ptw->K)+0.2))) {
-              neglect = _TRUE_;
-            }
-            /* This would maybe go into transfer_can_be_neglected later: */
-            if ((ptw->sgnK != 0) && (index_l>=ptw->HIS.l_size) && (index_q < ptr->index_q_flat_approximation)) {
-              neglect = _TRUE_;
-            }
-            if (neglect == _TRUE_) {
-
-              ptr->transfer[index_md][((index_ic * ptr->tt_size[index_md] + index_tt)
-                                       * ptr->l_size[index_md] + index_l)
-                                      * ptr->q_size + index_q] = 0.;
-            }
-            else {
-
-              /* for a given l, maximum value of k such that we can
-                 convolve the source with Bessel functions j_l(x)
-                 without reaching x_max (this is relevant in the flat
-                 case when the bessels are computed with the old bessel
-                 module. otherwise this condition is guaranteed by the
-                 choice of proper xmax when computing bessels) */
-              if (ptw->sgnK == 0) {
-                q_max_bessel = ptw->pBIS->x[ptw->pBIS->x_size-1]/tau0_minus_tau[0];
-              }
-              else {
-                q_max_bessel = ptr->q[ptr->q_size-1];
-              }
-
-              /* neglect late time CMB sources when l is above threshold */
-              class_call(transfer_late_source_can_be_neglected(ppr,
-                                                               ppt,
-                                                               ptr,
-                                                               index_md,
-                                                               index_tt,
-                                                               l,
-                                                               &(ptw->neglect_late_source)),
-                         ptr->error_message,
-                         ptr->error_message);
-
-              /* compute the transfer function for this l */
-              class_call(transfer_compute_for_each_l(
-                                                     ptw,
-                                                     ppr,
-                                                     ppt,
-                                                     ptr,
-                                                     index_q,
-                                                     index_md,
-                                                     index_ic,
-                                                     index_tt,
-                                                     index_l,
-                                                     l,
-                                                     q_max_bessel,
-                                                     radial_type
-                                                     ),
-                         ptr->error_message,
-                         ptr->error_message);
-            }
-
-          } /* end of loop over l */
+                                                 0,
+                                                 ptr->l_size[index_md],
+                                                 tau_rec,
+                                                 radial_type),
+                     ptr->error_message,
+                     ptr->error_message);
 
         } /* end of loop over type */
 
@@ -1925,18 +3403,201 @@ int transfer_compute_for_each_q(
         for (index_tt = 0; index_tt < ptr->tt_size[index_md]; index_tt++) {
           for (index_l = 0; index_l < ptr->l_size[index_md]; index_l++) {
 
-            ptr->transfer[index_md][((index_ic * ptr->tt_size[index_md] + index_tt)
-                                     * ptr->l_size[index_md] + index_l)
-                                    * ptr->q_size + index_q] = 0.;
+            index_row = _transfer_row_(ptr,index_md,index_ic,index_tt,index_l);
+
+            if (_transfer_is_stored_(ptr,index_md,index_row,index_q))
+              _transfer_stored_(ptr,index_md,index_row,index_q) = 0.;
           }
         }
       }
     }
 
-  } /* end of loop over mode */
+  } /* end of loop over mode */
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * Compute the transfer functions of one wavenumber, mode, initial
+ * condition and type for the multipoles index_l_min <= index_l <
+ * index_l_max, once the sources and radial coordinates of this
+ * wavenumber and type are stored in the workspace.
+ *
+ * @param ppr         Input: pointer to precision structure
+ * @param pba         Input: pointer to background structure
+ * @param ppt         Input: pointer to perturbation structure
+ * @param ptr         Input/output: pointer to transfers structure (result stored there)
+ * @param ptw         Input: pointer to transfer workspace
+ * @param index_q     Input: index of wavenumber
+ * @param index_md    Input: index of mode
+ * @param index_ic    Input: index of initial condition
+ * @param index_tt    Input: index of type of transfer
+ * @param index_l_min Input: first multipole index of the tile
+ * @param index_l_max Input: multipole index following the last one of the tile
+ * @param tau_rec     Input: recombination time
+ * @param radial_type Input: type of radial (Bessel) functions to convolve with
+ * @return the error status
+ */
+
+int transfer_compute_for_l_tile(
+                                struct precision * ppr,
+                                struct background * pba,
+                                struct perturbs * ppt,
+                                struct transfers * ptr,
+                                struct transfer_workspace * ptw,
+                                int index_q,
+                                int index_md,
+                                int index_ic,
+                                int index_tt,
+                                int index_l_min,
+                                int index_l_max,
+                                double tau_rec,
+                                radial_function_type radial_type
+                                ) {
+
+  int index_l;
+  int index_row;
+  double l;
+  short neglect;
+  short use_limber;
+
+  /* multipoles for which the Limber approximation is used: they are
+     computed together at the end with transfer_limber_batch() */
+  int * index_l_limber;
+  int l_limber_size=0;
+
+  /** - for a given l, maximum value of k such that we can convolve
+      the source with Bessel functions j_l(x) without reaching x_max */
+  double q_max_bessel;
+
+  double * tau0_minus_tau = ptw->tau0_minus_tau;
+
+  class_alloc(index_l_limber,MAX(1,index_l_max-index_l_min)*sizeof(int),ptr->error_message);
+
+  for (index_l = index_l_min; index_l < index_l_max; index_l++) {
+
+    index_row = _transfer_row_(ptr,index_md,index_ic,index_tt,index_l);
+
+    /* nothing to do for the transfer functions found negligible in transfer_storage_init() */
+    if (!_transfer_is_stored_(ptr,index_md,index_row,index_q))
+      continue;
+
+    l = (double)ptr->l[index_l];
+
+    /* neglect transfer function when l is much smaller than k*tau0 */
+    class_call(transfer_can_be_neglected(ppr,
+                                         ppt,
+                                         ptr,
+                                         index_md,
+                                         index_ic,
+                                         index_tt,
+                                         (pba->conformal_age-tau_rec)*ptr->angular_rescaling,
+                                         ptr->q[index_q],
+                                         l,
+                                         &neglect),
+               ptr->error_message,
+               ptr->error_message);
+
+    /* for K>0 (closed), transfer functions only defined for l<nu */
+    if ((ptw->sgnK == 1) && (ptr->l[index_l] >= (int)(ptr->q[index_q]/sqrt(ptw->K)+0.2))) {
+      neglect = _TRUE_;
+    }
+    /* This would maybe go into transfer_can_be_neglected later: */
+    if ((ptw->sgnK != 0) && (index_l>=ptw->HIS.l_size) && (index_q < ptr->index_q_flat_approximation)) {
+      neglect = _TRUE_;
+    }
+    if (neglect == _TRUE_) {
+
+      _transfer_stored_(ptr,index_md,index_row,index_q) = 0.;
+    }
+    else {
+
+      /* for a given l, maximum value of k such that we can
+         convolve the source with Bessel functions j_l(x)
+         without reaching x_max (this is relevant in the flat
+         case when the bessels are computed with the old bessel
+         module. otherwise this condition is guaranteed by the
+         choice of proper xmax when computing bessels) */
+      if (ptw->sgnK == 0) {
+        q_max_bessel = ptw->pBIS->x[ptw->pBIS->x_size-1]/tau0_minus_tau[0];
+      }
+      else {
+        q_max_bessel = ptr->q[ptr->q_size-1];
+      }
+
+      /* neglect late time CMB sources when l is above threshold */
+      class_call(transfer_late_source_can_be_neglected(ppr,
+                                                       ppt,
+                                                       ptr,
+                                                       index_md,
+                                                       index_tt,
+                                                       l,
+                                                       &(ptw->neglect_late_source)),
+                 ptr->error_message,
+                 ptr->error_message);
+
+      /* defer the multipoles using the Limber approximation */
+      use_limber = _FALSE_;
+      if (index_l < ptr->l_size_tt[index_md][index_tt]) {
+        class_call(transfer_use_limber(ppr,
+                                       ppt,
+                                       ptr,
+                                       q_max_bessel,
+                                       index_md,
+                                       index_tt,
+                                       ptr->q[index_q],
+                                       l,
+                                       &use_limber),
+                   ptr->error_message,
+                   ptr->error_message);
+      }
+
+      if (use_limber == _TRUE_) {
+        index_l_limber[l_limber_size] = index_l;
+        l_limber_size++;
+        continue;
+      }
+
+      /* compute the transfer function for this l */
+      class_call(transfer_compute_for_each_l(
+                                             ptw,
+                                             ppr,
+                                             ppt,
+                                             ptr,
+                                             index_q,
+                                             index_md,
+                                             index_ic,
+                                             index_tt,
+                                             index_l,
+                                             l,
+                                             q_max_bessel,
+                                             radial_type
+                                             ),
+                 ptr->error_message,
+                 ptr->error_message);
+    }
+
+  }
+
+  /** - compute all the Limber multipoles in one sweep */
+  if (l_limber_size > 0) {
+    class_call(transfer_limber_batch(ptr,
+                                     ptw,
+                                     index_md,
+                                     index_q,
+                                     index_ic,
+                                     index_tt,
+                                     radial_type,
+                                     index_l_limber,
+                                     l_limber_size),
+               ptr->error_message,
+               ptr->error_message);
+  }
+
+  free(index_l_limber);
 
   return _SUCCESS_;
-
 }
 
 int transfer_radial_coordinates(
@@ -1992,6 +3653,7 @@ int transfer_radial_coordinates(
  * @param index_type            Input: index of type of source (in perturbation module)
  * @param pert_source           Input: array of sources
  * @param pert_source_spline    Input: array of second derivative of sources
+ * @param last_index            Input/Output: interpolation cursor in the list of k values of the perturbation module (see array_search_hunt()): index of the interval found at the previous call, or -1; updated to the interval containing the current k
  * @param interpolated_sources  Output: array of interpolated sources (filled here but allocated in transfer_init() to avoid numerous reallocation)
  * @return the error status
  */
@@ -2005,6 +3667,7 @@ int transfer_interpolate_sources(
                                  int index_type,
                                  double * pert_source,       /* array with argument pert_source[index_tau*ppt->k_size[index_md]+index_k] (must be allocated) */
                                  double * pert_source_spline, /* array with argument pert_source_spline[index_tau*ppt->k_size[index_md]+index_k] (must be allocated) */
+                                 int * last_index,
                                  double * interpolated_sources /* array with argument interpolated_sources[index_q*ppt->tau_size+index_tau] (must be allocated) */
                                  ) {
 
@@ -2021,18 +3684,28 @@ int transfer_interpolate_sources(
   /* variables used for spline interpolation algorithm */
   double h, a, b;
 
-  /** - interpolate at each k value using the usual
-      spline interpolation algorithm. */
+  /** - find the interval of k values containing the current k,
+      starting from the interval found in the previous call (below
+      the first value, extrapolate from the first interval) */
+
+  if (ptr->k[index_md][index_q] <= ppt->k[index_md][0]) {
+    *last_index = 0;
+  }
+  else {
+    class_call(array_search_hunt(ppt->k_size[index_md],
+                                 ppt->k[index_md],
+                                 ptr->k[index_md][index_q],
+                                 last_index,
+                                 ptr->error_message),
+               ptr->error_message,
+               ptr->error_message);
+  }
 
-  index_k = 0;
+  index_k = *last_index;
   h = ppt->k[index_md][index_k+1] - ppt->k[index_md][index_k];
 
-  while (((index_k+1) < ppt->k_size[index_md]) &&
-         (ppt->k[index_md][index_k+1] <
-          ptr->k[index_md][index_q])) {
-    index_k++;
-    h = ppt->k[index_md][index_k+1] - ppt->k[index_md][index_k];
-  }
+  /** - interpolate at each k value using the usual
+      spline interpolation algorithm. */
 
   class_test(h==0.,
              ptr->error_message,
@@ -2896,12 +4569,15 @@ int transfer_selection_compute(
   /* used for normalizing the selection to one */
   double norm;
 
-  /* used for calling background_at_tau() */
-  int last_index;
+  /* background quantities needed here, for calling background_at_tau_columns() */
+  int columns[2];
 
   /* running value of redshift */
   double z;
 
+  columns[0] = pba->index_bg_a;
+  columns[1] = pba->index_bg_H;
+
   if (tau_size > 1) {
 
     /* loop over time */
@@ -2911,12 +4587,11 @@ int transfer_selection_compute(
       tau = tau0 - tau0_minus_tau[index_tau];
 
       /* get background quantities at this time */
-      class_call(background_at_tau(pba,
-                                   tau,
-                                   pba->long_info,
-                                   pba->inter_normal,
-                                   &last_index,
-                                   pvecback),
+      class_call(background_at_tau_columns(pba,
+                                           tau,
+                                           columns,
+                                           2,
+                                           pvecback),
                  pba->error_message,
                  ptr->error_message);
 
@@ -3022,12 +4697,16 @@ int transfer_compute_for_each_l(
   /* whether to use the Limber approximation */
   short use_limber;
 
+  /* row of the transfer functions */
+  int index_row;
+
+  index_row = _transfer_row_(ptr,index_md,index_ic,index_tt,index_l);
+
   /** - return zero transfer function if l is above l_max */
   if (index_l >= ptr->l_size_tt[index_md][index_tt]) {
 
-    ptr->transfer[index_md][((index_ic * ptr->tt_size[index_md] + index_tt)
-                             * ptr->l_size[index_md] + index_l)
-                            * ptr->q_size + index_q] = 0.;
+    if (_transfer_is_stored_(ptr,index_md,index_row,index_q))
+      _transfer_stored_(ptr,index_md,index_row,index_q) = 0.;
     return _SUCCESS_;
   }
 
@@ -3058,6 +4737,7 @@ int transfer_compute_for_each_l(
                                l,
                                q,
                                radial_type,
+                               NULL,
                                &transfer_function),
                ptr->error_message,
                ptr->error_message);
@@ -3082,10 +4762,11 @@ int transfer_compute_for_each_l(
   }
 
   /** - store transfer function in transfer structure */
-  ptr->transfer[index_md][((index_ic * ptr->tt_size[index_md] + index_tt)
-                           * ptr->l_size[index_md] + index_l)
-                          * ptr->q_size + index_q]
-    = transfer_function;
+  class_test(!_transfer_is_stored_(ptr,index_md,index_row,index_q),
+             ptr->error_message,
+             "transfer function for l=%d, q=%e was wrongly found negligible in transfer_storage_init()",(int)l,q);
+
+  _transfer_stored_(ptr,index_md,index_row,index_q) = transfer_function;
 
   return _SUCCESS_;
 
@@ -3212,6 +4893,10 @@ int transfer_integrate(
 
   double x_turning_point;
 
+  /* coefficients of Phi, Phi/chi^2, dPhi and d2Phi in the radial function, for the fused kernel */
+  short has_fused_kernel;
+  double c_phi,c_phi_csc2,c_dphi,c_d2phi;
+
   /** - find minimum value of (tau0-tau) at which \f$ j_l(k[\tau_0-\tau]) \f$ is known, given that \f$ j_l(x) \f$ is sampled above some finite value \f$ x_{\min} \f$ (below which it can be approximated by zero) */
   //tau0_minus_tau_min_bessel = x_min_l/k; /* segmentation fault impossible, checked before that k != 0 */
   //printf("index_l=%d\n",index_l);
@@ -3298,8 +4983,78 @@ int transfer_integrate(
     }
   }
 
-  /** - Compute the radial function: */
-  class_alloc(radial_function,sizeof(double)*(index_tau_max+1),ptr->error_message);
+  /** - In the flat case, for the radial functions which are a
+      combination of Phi, Phi/chi^2 and their derivatives with constant
+      coefficients, interpolate the Bessel functions and sum over time
+      in a single pass with hyperspherical_Hermite4_convolution() */
+
+  if ((ptw->sgnK == 0) && (ptw->use_fused_kernel == _TRUE_)) {
+
+    has_fused_kernel = _TRUE_;
+    c_phi = 0.;
+    c_phi_csc2 = 0.;
+    c_dphi = 0.;
+    c_d2phi = 0.;
+
+    switch (radial_type){
+    case SCALAR_TEMPERATURE_0:
+      c_phi = 1.;
+      break;
+    case SCALAR_TEMPERATURE_1:
+      c_dphi = 1.;
+      break;
+    case SCALAR_TEMPERATURE_2:
+      c_phi = 0.5;
+      c_d2phi = 1.5;
+      break;
+    case SCALAR_POLARISATION_E:
+    case TENSOR_TEMPERATURE_2:
+      c_phi_csc2 = sqrt(3.0/8.0*(l+2.0)*(l+1.0)*l*(l-1.0));
+      break;
+    case NC_RSD:
+      c_d2phi = 1.;
+      break;
+    default:
+      has_fused_kernel = _FALSE_;
+    }
+
+    if (has_fused_kernel == _TRUE_) {
+
+      class_test(ptw->pBIS->x[ptw->pBIS->x_size-1] < ptw->chi[0],
+                 ptr->error_message,
+                 "Bessels need to be interpolated at %e, outside the range in which they have been computed (<%e). Increase their x_max.",
+                 ptw->chi[0],
+                 ptw->pBIS->x[ptw->pBIS->x_size-1]);
+
+      class_call(hyperspherical_Hermite4_convolution(ptw->pBIS,
+                                                     index_tau_max+1,
+                                                     index_l,
+                                                     ptw->chi,
+                                                     sources,
+                                                     w_trapz,
+                                                     ptw->cscKgen,
+                                                     c_phi,
+                                                     c_phi_csc2,
+                                                     c_dphi,
+                                                     c_d2phi,
+                                                     trsf,
+                                                     &bessel,
+                                                     ptr->error_message),
+                 ptr->error_message,
+                 ptr->error_message);
+
+      /* same correction as below */
+      if ((index_tau_max!=(ptw->tau_size-1))&&(index_tau_max==index_tau_max_Bessel)){
+        *trsf -= 0.5*(tau0_minus_tau[index_tau_max+1]-tau0_minus_tau_min_bessel)*
+          bessel*sources[index_tau_max];
+      }
+
+      return _SUCCESS_;
+    }
+  }
+
+  /** - Compute the radial function (in the scratch space of the workspace): */
+  radial_function = ptw->radial_scratch;
 
   class_call(transfer_radial_function(
                                       ptw,
@@ -3337,8 +5092,6 @@ int transfer_integrate(
       radial_function[index_tau_max]*sources[index_tau_max];
   }
 
-
-  free(radial_function);
   return _SUCCESS_;
 }
 
@@ -3357,6 +5110,7 @@ int transfer_integrate(
  * @param l              Input: multipole
  * @param q              Input: wavenumber
  * @param radial_type    Input: type of radial (Bessel) functions to convolve with
+ * @param last_index     Input/output: if not NULL, array of three indices in the time sampling, from which the source at each of the (up to three) Limber times is searched, updated to the indices found (see transfer_limber_interpolate())
  * @param trsf           Output: transfer function \f$ \Delta_l(k) \f$
  * @return the error status
  */
@@ -3369,6 +5123,7 @@ int transfer_limber(
                     double l,
                     double q,
                     radial_function_type radial_type,
+                    int * last_index,
                     double * trsf
                     ){
 
@@ -3411,6 +5166,7 @@ int transfer_limber(
                                            ptw->sources,
                                            ptw->tau_size,
                                            tau0_minus_tau_limber,
+                                           (last_index == NULL ? NULL : last_index+0),
                                            &S),
                ptr->error_message,
                ptr->error_message);
@@ -3445,6 +5201,7 @@ int transfer_limber(
                                            ptw->sources,
                                            ptw->tau_size,
                                            (l+1.5)/q,
+                                           (last_index == NULL ? NULL : last_index+0),
                                            &Sp),
                ptr->error_message,
                ptr->error_message);
@@ -3454,6 +5211,7 @@ int transfer_limber(
                                            ptw->sources,
                                            ptw->tau_size,
                                            (l-0.5)/q,
+                                           (last_index == NULL ? NULL : last_index+1),
                                            &Sm),
                ptr->error_message,
                ptr->error_message);
@@ -3477,6 +5235,7 @@ int transfer_limber(
                                            ptw->sources,
                                            ptw->tau_size,
                                            (l+2.5)/q,
+                                           (last_index == NULL ? NULL : last_index+0),
                                            &Sp),
                ptr->error_message,
                ptr->error_message);
@@ -3486,6 +5245,7 @@ int transfer_limber(
                                            ptw->sources,
                                            ptw->tau_size,
                                            (l-1.5)/q,
+                                           (last_index == NULL ? NULL : last_index+1),
                                            &Sm),
                ptr->error_message,
                ptr->error_message);
@@ -3495,6 +5255,7 @@ int transfer_limber(
                                            ptw->sources,
                                            ptw->tau_size,
                                            (l+0.5)/q,
+                                           (last_index == NULL ? NULL : last_index+2),
                                            &S),
                ptr->error_message,
                ptr->error_message);
@@ -3518,25 +5279,150 @@ int transfer_limber(
 
 }
 
+/**
+ * Compute with the Limber approximation the transfer functions of one
+ * wavenumber, mode, initial condition and type for a list of
+ * multipoles, and store them directly in the transfers structure.
+ *
+ * The multipoles are given in increasing order, so that the Limber
+ * times tau0-tau ~ (l+1/2)/q increase along the list: the index of
+ * each of them in the time sampling is found by hunting from the
+ * previous one, instead of scanning the whole sampling for each l.
+ *
+ * @param ptr            Input/output: pointer to transfers structure (result stored there)
+ * @param ptw            Input: pointer to transfer workspace structure
+ * @param index_md       Input: index of mode
+ * @param index_q        Input: index of wavenumber
+ * @param index_ic       Input: index of initial condition
+ * @param index_tt       Input: index of type of transfer
+ * @param radial_type    Input: type of radial (Bessel) functions to convolve with
+ * @param index_l_limber Input: indices of the multipoles, in increasing order
+ * @param l_limber_size  Input: number of multipoles
+ * @return the error status
+ */
+
+int transfer_limber_batch(
+                          struct transfers * ptr,
+                          struct transfer_workspace * ptw,
+                          int index_md,
+                          int index_q,
+                          int index_ic,
+                          int index_tt,
+                          radial_function_type radial_type,
+                          int * index_l_limber,
+                          int l_limber_size
+                          ){
+
+  int n,index_l;
+  int last_index[3];
+  double transfer_function;
+
+  /* the smallest Limber times are at the end of the time sampling */
+  last_index[0] = ptw->tau_size-2;
+  last_index[1] = ptw->tau_size-2;
+  last_index[2] = ptw->tau_size-2;
+
+  for (n = 0; n < l_limber_size; n++) {
+
+    index_l = index_l_limber[n];
+
+    class_call(transfer_limber(ptr,
+                               ptw,
+                               index_md,
+                               index_q,
+                               (double)ptr->l[index_l],
+                               ptr->q[index_q],
+                               radial_type,
+                               last_index,
+                               &transfer_function),
+               ptr->error_message,
+               ptr->error_message);
+
+    /* only multipoles stored for this wavenumber are passed by transfer_compute_for_l_tile() */
+    _transfer_stored_(ptr,index_md,_transfer_row_(ptr,index_md,index_ic,index_tt,index_l),index_q) = transfer_function;
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Interpolate the source (times tau0-tau) at a given value of tau0-tau,
+ * with a parabola through three neighbouring points.
+ *
+ * @param ptr                   Input: pointer to transfers structure
+ * @param tau0_minus_tau        Input: values of tau0-tau (decreasing)
+ * @param sources               Input: source at these values
+ * @param tau_size              Input: number of values
+ * @param tau0_minus_tau_limber Input: value at which we interpolate
+ * @param last_index            Input/output: if not NULL, index found in a previous call for a nearby value, from which the search starts (growing steps, then bisection), and updated here; if NULL, the search starts from the first point
+ * @param S                     Output: interpolated source
+ * @return the error status
+ */
+
 int transfer_limber_interpolate(
                                 struct transfers * ptr,
                                 double * tau0_minus_tau,
                                 double * sources,
                                 int tau_size,
                                 double tau0_minus_tau_limber,
+                                int * last_index,
                                 double * S
                                 ){
 
-  int index_tau;
+  int index_tau,inf,sup,mid,inc;
   double dS,ddS;
 
   /** - find  bracketing indices.
       index_tau must be at least 1 (so that index_tau-1 is at least 0)
       and at most tau_size-2 (so that index_tau+1 is at most tau_size-1).
+      It is the first index such that tau0_minus_tau[index_tau] <= tau0_minus_tau_limber,
+      or tau_size-2 if there is none.
   */
-  index_tau=1;
-  while ((tau0_minus_tau[index_tau] > tau0_minus_tau_limber) && (index_tau<tau_size-2))
-    index_tau++;
+  if ((last_index == NULL) || (tau_size < 4)) {
+    index_tau=1;
+    while ((tau0_minus_tau[index_tau] > tau0_minus_tau_limber) && (index_tau<tau_size-2))
+      index_tau++;
+  }
+  else {
+    /* the property (tau0_minus_tau[i] <= tau0_minus_tau_limber) or
+       (i == tau_size-2) is false below the index we look for and true
+       above: hunt for a false inf and a true sup starting from the
+       previous index, then bisect */
+    index_tau = MAX(1,MIN(tau_size-2,*last_index));
+    inc = 1;
+    if ((tau0_minus_tau[index_tau] <= tau0_minus_tau_limber) || (index_tau == tau_size-2)) {
+      /* hunt downward; inf=0 stands for a false property */
+      sup = index_tau;
+      inf = sup-inc;
+      while ((inf >= 1) && (tau0_minus_tau[inf] <= tau0_minus_tau_limber)) {
+        sup = inf;
+        inc *= 2;
+        inf = sup-inc;
+      }
+      inf = MAX(0,inf);
+    }
+    else {
+      /* hunt upward */
+      inf = index_tau;
+      sup = inf+inc;
+      while ((sup < tau_size-2) && (tau0_minus_tau[sup] > tau0_minus_tau_limber)) {
+        inf = sup;
+        inc *= 2;
+        sup = inf+inc;
+      }
+      sup = MIN(tau_size-2,sup);
+    }
+    /* bisect */
+    while (sup-inf > 1) {
+      mid = (inf+sup)/2;
+      if ((tau0_minus_tau[mid] <= tau0_minus_tau_limber) || (mid == tau_size-2))
+        sup = mid;
+      else
+        inf = mid;
+    }
+    index_tau = sup;
+    *last_index = index_tau;
+  }
 
   /** - interpolate by fitting a polynomial of order two; get source
       and its first two derivatives. Note that we are not
@@ -3821,11 +5707,13 @@ int transfer_radial_function(
   }
   absK_over_k2 =sqrt_absK_over_k*sqrt_absK_over_k;
 
-  class_alloc(Phi,sizeof(double)*x_size,ptr->error_message);
-  class_alloc(dPhi,sizeof(double)*x_size,ptr->error_message);
-  class_alloc(d2Phi,sizeof(double)*x_size,ptr->error_message);
-  class_alloc(chireverse,sizeof(double)*x_size,ptr->error_message);
-  class_alloc(rescale_function,sizeof(double)*x_size,ptr->error_message);
+  /* temporary arrays in the scratch space of the workspace, after the
+     radial function of transfer_integrate() */
+  Phi = ptw->radial_scratch+ptw->tau_size_max;
+  dPhi = ptw->radial_scratch+2*ptw->tau_size_max;
+  d2Phi = ptw->radial_scratch+3*ptw->tau_size_max;
+  chireverse = ptw->radial_scratch+4*ptw->tau_size_max;
+  rescale_function = ptw->radial_scratch+5*ptw->tau_size_max;
 
   if (ptw->sgnK == 0) {
     pHIS = ptw->pBIS;
@@ -4041,11 +5929,6 @@ int transfer_radial_function(
     break;
   }
 
-  free(Phi);
-  free(dPhi);
-  free(d2Phi);
-  free(chireverse);
-  free(rescale_function);
 
   return _SUCCESS_;
 }
@@ -4152,26 +6035,28 @@ int transfer_global_selection_read(
                                    struct transfers * ptr
                                    ) {
 
-  /* for reading selection function */
-  FILE * input_file;
-  int row,status;
-  double tmp1,tmp2;
+  /* for reading selection function: the files are parsed once per
+     process, and the numbers they contain are then served by the
+     file cache (see tools/filecache.c) */
+  double * nz_table;
+  int nz_table_size;
+  int row;
 
   ptr->nz_size = 0;
 
   if (ptr->has_nz_file == _TRUE_) {
 
-    input_file = fopen(ptr->nz_file_name,"r");
-    class_test(input_file == NULL,
+    class_call(filecache_acquire(ptr->nz_file_name,&nz_table,&nz_table_size,ptr->error_message),
                ptr->error_message,
-               "Could not open file %s!",ptr->nz_file_name);
+               ptr->error_message);
 
-    /* Find size of table */
-    for (row=0,status=2; status==2; row++){
-      status = fscanf(input_file,"%lf %lf",&tmp1,&tmp2);
-    }
-    rewind(input_file);
-    ptr->nz_size = row-1;
+    /* Find size of table: two columns (z, dN/dz) */
+    ptr->nz_size = nz_table_size/2;
+
+    class_test_except(ptr->nz_size < 2,
+                      ptr->error_message,
+                      filecache_release(nz_table),
+                      "could not read at least two lines (z,dN/dz) in file %s",ptr->nz_file_name);
 
     /* Allocate room for interpolation table */
     class_alloc(ptr->nz_z,sizeof(double)*ptr->nz_size,ptr->error_message);
@@ -4179,11 +6064,12 @@ int transfer_global_selection_read(
     class_alloc(ptr->nz_ddnz,sizeof(double)*ptr->nz_size,ptr->error_message);
 
     for (row=0; row<ptr->nz_size; row++){
-      status = fscanf(input_file,"%lf %lf",
-                      &ptr->nz_z[row],&ptr->nz_nz[row]);
+      ptr->nz_z[row] = nz_table[2*row];
+      ptr->nz_nz[row] = nz_table[2*row+1];
       //printf("%d: (z,dNdz) = (%g,%g)\n",row,ptr->nz_z[row],ptr->nz_nz[row]);
     }
-    fclose(input_file);
+
+    filecache_release(nz_table);
 
     /* Call spline interpolation: */
     class_call(array_spline_table_lines(ptr->nz_z,
@@ -4201,17 +6087,17 @@ int transfer_global_selection_read(
 
   if (ptr->has_nz_evo_file == _TRUE_) {
 
-    input_file = fopen(ptr->nz_evo_file_name,"r");
-    class_test(input_file == NULL,
+    class_call(filecache_acquire(ptr->nz_evo_file_name,&nz_table,&nz_table_size,ptr->error_message),
                ptr->error_message,
-               "Could not open file %s!",ptr->nz_evo_file_name);
+               ptr->error_message);
 
-    /* Find size of table */
-    for (row=0,status=2; status==2; row++){
-      status = fscanf(input_file,"%lf %lf",&tmp1,&tmp2);
-    }
-    rewind(input_file);
-    ptr->nz_evo_size = row-1;
+    /* Find size of table: two columns (z, dN/dz) */
+    ptr->nz_evo_size = nz_table_size/2;
+
+    class_test_except(ptr->nz_evo_size < 2,
+                      ptr->error_message,
+                      filecache_release(nz_table),
+                      "could not read at least two lines (z,dN/dz) in file %s",ptr->nz_evo_file_name);
 
     /* Allocate room for interpolation table */
     class_alloc(ptr->nz_evo_z,sizeof(double)*ptr->nz_evo_size,ptr->error_message);
@@ -4220,10 +6106,11 @@ int transfer_global_selection_read(
     class_alloc(ptr->nz_evo_dd_dlog_nz,sizeof(double)*ptr->nz_evo_size,ptr->error_message);
 
     for (row=0; row<ptr->nz_evo_size; row++){
-      status = fscanf(input_file,"%lf %lf",
-                      &ptr->nz_evo_z[row],&ptr->nz_evo_nz[row]);
+      ptr->nz_evo_z[row] = nz_table[2*row];
+      ptr->nz_evo_nz[row] = nz_table[2*row+1];
     }
-    fclose(input_file);
+
+    filecache_release(nz_table);
 
     /* infer dlog(dN/dz)/dz from dN/dz */
     ptr->nz_evo_dlog_nz[0] =
@@ -4281,6 +6168,7 @@ int transfer_workspace_init(
   (*ptw)->sgnK = sgnK;
   (*ptw)->tau0_minus_tau_cut = tau0_minus_tau_cut;
   (*ptw)->neglect_late_source = _FALSE_;
+  (*ptw)->use_fused_kernel = ppr->transfer_fused_kernel;
 
   class_alloc((*ptw)->interpolated_sources,perturb_tau_size*sizeof(double),ptr->error_message);
   class_alloc((*ptw)->sources,tau_size_max*sizeof(double),ptr->error_message);
@@ -4289,6 +6177,7 @@ int transfer_workspace_init(
   class_alloc((*ptw)->chi,tau_size_max*sizeof(double),ptr->error_message);
   class_alloc((*ptw)->cscKgen,tau_size_max*sizeof(double),ptr->error_message);
   class_alloc((*ptw)->cotKgen,tau_size_max*sizeof(double),ptr->error_message);
+  class_alloc((*ptw)->radial_scratch,6*tau_size_max*sizeof(double),ptr->error_message);
 
   return _SUCCESS_;
 }
@@ -4311,6 +6200,7 @@ int transfer_workspace_free(
   free(ptw->chi);
   free(ptw->cscKgen);
   free(ptw->cotKgen);
+  free(ptw->radial_scratch);
 
   free(ptw);
   return _SUCCESS_;
@@ -4330,6 +6220,7 @@ int transfer_update_HIS(
   double sqrt_absK;
   int l_size_max;
   int index_l_left,index_l_right;
+  short found;
 
   if (ptw->HIS_allocated == _TRUE_) {
     class_call(hyperspherical_HIS_free(&(ptw->HIS),ptr->error_message),
@@ -4413,20 +6304,32 @@ int transfer_update_HIS(
                "nu=%e when index_q=%d, q=%e, K=%e, sqrt(|K|)=%e; instead nu should always be strictly positive",
                nu,index_q,ptr->q[index_q],ptw->K,sqrt_absK);
 
-    class_call(hyperspherical_HIS_create(ptw->sgnK,
-                                         nu,
-                                         l_size_max,
-                                         ptr->l,
-                                         xmin,
-                                         xmax,
-                                         sampling,
-                                         ptr->l[l_size_max-1]+1,
-                                         ppr->hyper_phi_min_abs,
-                                         &(ptw->HIS),
-                                         ptr->error_message),
+    /* reuse the structure computed by a previous run for the same arguments, if it is still in the cache */
+    class_call(transfer_HIS_cache_fetch(ptr,ptw,nu,l_size_max,xmin,xmax,sampling,ppr->hyper_phi_min_abs,&found),
                ptr->error_message,
                ptr->error_message);
 
+    if (found == _FALSE_) {
+
+      class_call(hyperspherical_HIS_create(ptw->sgnK,
+                                           nu,
+                                           l_size_max,
+                                           ptr->l,
+                                           xmin,
+                                           xmax,
+                                           sampling,
+                                           ptr->l[l_size_max-1]+1,
+                                           ppr->hyper_phi_min_abs,
+                                           &(ptw->HIS),
+                                           ptr->error_message),
+                 ptr->error_message,
+                 ptr->error_message);
+
+      class_call(transfer_HIS_cache_store(ptr,ptw,xmin,xmax,sampling,ppr->hyper_phi_min_abs),
+                 ptr->error_message,
+                 ptr->error_message);
+    }
+
     ptw->HIS_allocated = _TRUE_;
 
   }
@@ -4434,6 +6337,242 @@ int transfer_update_HIS(
   return _SUCCESS_;
 }
 
+/* In-memory cache of the hyperspherical interpolation structures
+   computed by transfer_update_HIS() in curved models. It belongs to the
+   process rather than to a transfers structure, so that it survives
+   from one run to the next. It is shared by all threads (accessed in
+   critical sections). */
+
+static struct transfer_HIS_cache_entry * transfer_HIS_cache = NULL;
+static int transfer_HIS_cache_size = 0;
+static long transfer_HIS_cache_clock = 0;
+
+static int transfer_HIS_cache_empty(ErrorMsg error_message);
+
+/**
+ * Set the number of entries of the in-memory cache of hyperspherical
+ * interpolation structures. The cache is emptied if this number
+ * changes. The cache is shared by all the computations of the process,
+ * which may run concurrently (e.g. several classy instances in
+ * different threads), hence the critical section.
+ *
+ * @param size          Input: number of entries (0 to disable the cache)
+ * @param error_message Output: error message
+ * @return the error status
+ */
+
+int transfer_HIS_cache_resize(
+                              int size,
+                              ErrorMsg error_message
+                              ) {
+
+  int status = _SUCCESS_;
+
+#pragma omp critical (transfer_HIS_cache)
+  {
+    if (size != transfer_HIS_cache_size) {
+      status = transfer_HIS_cache_empty(error_message);
+      if ((status == _SUCCESS_) && (size > 0)) {
+        transfer_HIS_cache = calloc(size,sizeof(struct transfer_HIS_cache_entry));
+        if (transfer_HIS_cache == NULL) {
+          sprintf(error_message,"%s(L:%d): could not allocate the cache of %d hyperspherical interpolation structures",__func__,__LINE__,size);
+          status = _FAILURE_;
+        }
+        else {
+          transfer_HIS_cache_size = size;
+        }
+      }
+    }
+  }
+
+  return status;
+}
+
+/**
+ * Free all the entries of the in-memory cache of hyperspherical
+ * interpolation structures.
+ *
+ * @param error_message Output: error message
+ * @return the error status
+ */
+
+int transfer_HIS_cache_free(
+                            ErrorMsg error_message
+                            ) {
+
+  int status;
+
+#pragma omp critical (transfer_HIS_cache)
+  {
+    status = transfer_HIS_cache_empty(error_message);
+  }
+
+  return status;
+}
+
+/**
+ * Free all the entries of the cache (called within the critical
+ * section transfer_HIS_cache).
+ *
+ * @param error_message Output: error message
+ * @return the error status
+ */
+
+static int transfer_HIS_cache_empty(
+                                    ErrorMsg error_message
+                                    ) {
+
+  int index;
+
+  for (index = 0; index < transfer_HIS_cache_size; index++) {
+    if (transfer_HIS_cache[index].last_use > 0) {
+      class_call(hyperspherical_HIS_free(&(transfer_HIS_cache[index].HIS),error_message),
+                 error_message,
+                 error_message);
+    }
+  }
+
+  if (transfer_HIS_cache != NULL)
+    free(transfer_HIS_cache);
+
+  transfer_HIS_cache = NULL;
+  transfer_HIS_cache_size = 0;
+
+  return _SUCCESS_;
+}
+
+/**
+ * Look for an interpolation structure computed with the same arguments
+ * in the in-memory cache, and if found, copy it into the workspace.
+ *
+ * @param ptr        Input/Output: pointer to transfers structure (the number of hits is incremented)
+ * @param ptw        Input/Output: pointer to transfer workspace (HIS is filled if found)
+ * @param nu         Input: value of nu
+ * @param l_size     Input: number of multipoles
+ * @param xmin       Input: smallest x
+ * @param xmax       Input: largest x
+ * @param sampling   Input: sampling
+ * @param phiminabs  Input: hyper_phi_min_abs
+ * @param found      Output: _TRUE_ if the structure was found
+ * @return the error status
+ */
+
+int transfer_HIS_cache_fetch(
+                             struct transfers * ptr,
+                             struct transfer_workspace * ptw,
+                             double nu,
+                             int l_size,
+                             double xmin,
+                             double xmax,
+                             double sampling,
+                             double phiminabs,
+                             short * found
+                             ) {
+
+  int index,status;
+  struct transfer_HIS_cache_entry * pe;
+
+  *found = _FALSE_;
+  status = _SUCCESS_;
+
+  if (transfer_HIS_cache_size == 0)
+    return _SUCCESS_;
+
+#pragma omp critical (transfer_HIS_cache)
+  {
+    for (index = 0; index < transfer_HIS_cache_size; index++) {
+      pe = &(transfer_HIS_cache[index]);
+      if ((pe->last_use > 0) &&
+          (pe->HIS.K == ptw->sgnK) &&
+          (pe->HIS.beta == nu) &&
+          (pe->HIS.l_size == l_size) &&
+          (pe->xmin == xmin) &&
+          (pe->xmax == xmax) &&
+          (pe->sampling == sampling) &&
+          (pe->phiminabs == phiminabs) &&
+          (memcmp(pe->HIS.l,ptr->l,l_size*sizeof(int)) == 0)) {
+
+        status = hyperspherical_HIS_copy(&(pe->HIS),&(ptw->HIS),ptr->error_message);
+        pe->last_use = ++transfer_HIS_cache_clock;
+        ptr->HIS_cache_hits++;
+        *found = _TRUE_;
+        break;
+      }
+    }
+  }
+
+  class_test(status == _FAILURE_,
+             ptr->error_message,
+             "could not copy a hyperspherical interpolation structure from the cache");
+
+  return _SUCCESS_;
+}
+
+/**
+ * Store a copy of the interpolation structure of the workspace in the
+ * in-memory cache, in place of the least recently used entry.
+ *
+ * @param ptr        Input: pointer to transfers structure
+ * @param ptw        Input: pointer to transfer workspace (HIS has just been computed)
+ * @param xmin       Input: smallest x
+ * @param xmax       Input: largest x
+ * @param sampling   Input: sampling
+ * @param phiminabs  Input: hyper_phi_min_abs
+ * @return the error status
+ */
+
+int transfer_HIS_cache_store(
+                             struct transfers * ptr,
+                             struct transfer_workspace * ptw,
+                             double xmin,
+                             double xmax,
+                             double sampling,
+                             double phiminabs
+                             ) {
+
+  int index,index_lru;
+  struct transfer_HIS_cache_entry entry,evicted;
+
+  if (transfer_HIS_cache_size == 0)
+    return _SUCCESS_;
+
+  class_call(hyperspherical_HIS_copy(&(ptw->HIS),&(entry.HIS),ptr->error_message),
+             ptr->error_message,
+             ptr->error_message);
+
+  entry.xmin = xmin;
+  entry.xmax = xmax;
+  entry.sampling = sampling;
+  entry.phiminabs = phiminabs;
+
+#pragma omp critical (transfer_HIS_cache)
+  {
+    /* the cache may have been disabled by a concurrent run in the meantime */
+    if (transfer_HIS_cache_size == 0) {
+      evicted = entry;
+      evicted.last_use = 1;
+    }
+    else {
+      index_lru = 0;
+      for (index = 1; index < transfer_HIS_cache_size; index++)
+        if (transfer_HIS_cache[index].last_use < transfer_HIS_cache[index_lru].last_use)
+          index_lru = index;
+
+      evicted = transfer_HIS_cache[index_lru];
+      entry.last_use = ++transfer_HIS_cache_clock;
+      transfer_HIS_cache[index_lru] = entry;
+    }
+  }
+
+  if (evicted.last_use > 0) {
+    class_call(hyperspherical_HIS_free(&(evicted.HIS),ptr->error_message),
+               ptr->error_message,
+               ptr->error_message);
+  }
+
+  return _SUCCESS_;
+}
+
 int transfer_get_lmax(int (*get_xmin_generic)(int sgnK,
                                               int l,
                                               double nu,
@@ -4585,6 +6724,12 @@ int transfer_get_lmax(int (*get_xmin_generic)(int sgnK,
  *
  * All factors of k have to be added later (at least in the current version)
  *
+ * The time samplings, the selection function and the background
+ * quantities only depend on the redshift bin: they are first tabulated
+ * once per bin (bins in parallel) with
+ * transfer_selection_table_init(), and then combined into the window
+ * function of each type.
+ *
  * @param ppr                   Input: pointer to precision structure
  * @param pba                   Input: pointer to background structure
  * @param ppt                   Input: pointer to perturbation structure
@@ -4608,8 +6753,9 @@ int transfer_precompute_selection(
 
   /** - define local variables */
 
-  double* tau0_minus_tau;
-  double* w_trapz;
+  /* tables of each redshift bin */
+  struct transfer_selection_table * selection_table = NULL;
+  struct transfer_selection_table * pst;
 
   /* index running on time */
   int index_tau;
@@ -4617,444 +6763,613 @@ int transfer_precompute_selection(
   /* bin for computation of cl_density */
   int bin=0;
 
-  /* number of tau values */
-  int tau_size;
-
   /* for calling background_at_eta */
-  int last_index;
   double * pvecback = NULL;
 
   /* conformal time */
-  double tau, tau0;
+  double tau0;
 
   /* geometrical quantities */
-  double sinKgen_source=0.;
   double sinKgen_source_to_lens=0.;
-  double cotKgen_source=0.;
   double cscKgen_lens=0.;
 
   /* rescaling factor depending on the background at a given time */
   double rescaling=0.;
 
-  /* array of selection function values at different times */
-  double * selection;
-
-  /* array of time sampling for lensing source selection function */
-  double * tau0_minus_tau_lensing_sources;
-
-  /* trapezoidal weights for lensing source selection function */
-  double * w_trapz_lensing_sources;
-
-  /* index running on time in previous two arrays */
+  /* index running on time in the sampling of the sources */
   int index_tau_sources;
 
-  /* number of time values in previous two arrays */
-  int tau_sources_size;
-
-  /* source evolution factor */
-  double f_evo = 0.;
-
-
   /* Setup initial variables and arrays*/
   int index_md = ppt->index_md_scalars;
   int index_tt;
 
-  /* allocate temporary arrays for storing selections, weights, times, and output; and for calling background */
-  class_alloc(tau0_minus_tau,tau_size_max*sizeof(double),ptr->error_message);
-  class_alloc(selection,tau_size_max*sizeof(double),ptr->error_message);
-  class_alloc(w_trapz,tau_size_max*sizeof(double),ptr->error_message);
+  /* for parallel loops */
+  int abort;
+
   class_alloc((*window),tau_size_max*ptr->tt_size[index_md]*sizeof(double),ptr->error_message);
-  class_alloc(pvecback,pba->bg_size*sizeof(double),ptr->error_message);
 
   /* conformal time today */
   tau0 = pba->conformal_age;
 
-  /* Loop through different types to be precomputed */
-  for (index_tt = 0; index_tt < ptr->tt_size[index_md]; index_tt++) {
+  /* nothing else to do without number count or lensing types */
+  if ((ppt->has_nc_density == _FALSE_) &&
+      (ppt->has_nc_rsd == _FALSE_) &&
+      (ppt->has_nc_lens == _FALSE_) &&
+      (ppt->has_nc_gr == _FALSE_) &&
+      (ppt->has_cl_lensing_potential == _FALSE_))
+    return _SUCCESS_;
 
-    /* First set the corresponding tau size */
-    class_call(transfer_source_tau_size(ppr,
-                                    pba,
-                                    ppt,
-                                    ptr,
-                                    tau_rec,
-                                    tau0,
-                                    index_md,
-                                    index_tt,
-                                    &tau_size),
-           ptr->error_message,
-           ptr->error_message);
-
-    /* Start with non-integrated contributions */
-    if (_nonintegrated_ncl_) {
+  class_calloc(selection_table,ppt->selection_num,sizeof(struct transfer_selection_table),ptr->error_message);
 
-      _get_bin_nonintegrated_ncl_(index_tt)
+  abort = _FALSE_;
 
-      /* redefine the time sampling */
-      class_call(transfer_selection_sampling(ppr,
-                                             pba,
-                                             ppt,
-                                             ptr,
-                                             bin,
-                                             tau0_minus_tau,
-                                             tau_size),
-                 ptr->error_message,
-                 ptr->error_message);
+#pragma omp parallel                                                    \
+  shared(ppr,pba,ppt,ptr,tau_rec,tau_size_max,window,selection_table,tau0,index_md,abort) \
+  private(pvecback,pst,index_tt,index_tau,index_tau_sources)           \
+  firstprivate(bin,rescaling,sinKgen_source_to_lens,cscKgen_lens)
+  {
+
+    pvecback = NULL;
+
+    class_alloc_parallel(pvecback,pba->bg_size*sizeof(double),ptr->error_message);
+
+    /** - tabulate the samplings, selection function and background quantities of each bin */
+
+#pragma omp for schedule (dynamic)
+
+    for (bin = 0; bin < ppt->selection_num; bin++) {
+
+      class_call_parallel(transfer_selection_table_init(ppr,
+                                                        pba,
+                                                        ppt,
+                                                        ptr,
+                                                        tau_rec,
+                                                        tau0,
+                                                        bin,
+                                                        pvecback,
+                                                        &(selection_table[bin])),
+                          ptr->error_message,
+                          ptr->error_message);
+
+#pragma omp flush(abort)
+
+    }
 
-      class_test(tau0 - tau0_minus_tau[0] > ppt->tau_sampling[ppt->tau_size-1],
-                 ptr->error_message,
-                 "this should not happen, there was probably a rounding error, if this error occurred, then this must be coded more carefully");
+    /** - combine them into the window function of each type */
 
-      /* Compute trapezoidal weights for integration over tau */
-      class_call(array_trapezoidal_mweights(tau0_minus_tau,
-                                            tau_size,
-                                            w_trapz,
-                                            ptr->error_message),
-                 ptr->error_message,
-                 ptr->error_message);
+#pragma omp for schedule (dynamic)
 
-      /* compute values of selection function at sampled values of tau */
-      class_call(transfer_selection_compute(ppr,
-                                            pba,
-                                            ppt,
-                                            ptr,
-                                            selection,
-                                            tau0_minus_tau,
-                                            w_trapz,
-                                            tau_size,
-                                            pvecback,
-                                            tau0,
-                                            bin),
-                 ptr->error_message,
-                 ptr->error_message);
+    for (index_tt = 0; index_tt < ptr->tt_size[index_md]; index_tt++) {
 
-      /* loop over time and rescale */
-      for (index_tau = 0; index_tau < tau_size; index_tau++) {
-
-        /* conformal time */
-        tau = tau0 - tau0_minus_tau[index_tau];
-
-        /* geometrical quantity */
-        switch (pba->sgnK){
-        case 1:
-          cotKgen_source = sqrt(pba->K)
-            *cos(tau0_minus_tau[index_tau]*sqrt(pba->K))
-            /sin(tau0_minus_tau[index_tau]*sqrt(pba->K));
-          break;
-        case 0:
-          cotKgen_source = 1./(tau0_minus_tau[index_tau]);
-          break;
-        case -1:
-          cotKgen_source = sqrt(-pba->K)
-            *cosh(tau0_minus_tau[index_tau]*sqrt(-pba->K))
-            /sinh(tau0_minus_tau[index_tau]*sqrt(-pba->K));
-          break;
-        }
+      if (abort == _TRUE_) continue;
 
-        /* corresponding background quantities */
-        class_call(background_at_tau(pba,
-                                     tau,
-                                     pba->long_info,
-                                     pba->inter_normal,
-                                     &last_index,
-                                     pvecback),
-                   pba->error_message,
-                   ptr->error_message);
+      /* Start with non-integrated contributions */
+      if (_nonintegrated_ncl_) {
 
-        /* Source evolution, used by nCl doppler and nCl gravity terms */
+        _get_bin_nonintegrated_ncl_(index_tt)
 
-        if ((_index_tt_in_range_(ptr->index_tt_d0,      ppt->selection_num, ppt->has_nc_rsd)) ||
-            (_index_tt_in_range_(ptr->index_tt_d1,      ppt->selection_num, ppt->has_nc_rsd)) ||
-            (_index_tt_in_range_(ptr->index_tt_nc_g2,   ppt->selection_num, ppt->has_nc_gr)))
-          {
-            class_call(transfer_f_evo(pba,ptr,pvecback,last_index,cotKgen_source,&f_evo),
-                       ptr->error_message,
-                       ptr->error_message);
-            /* Error in old CLASS 2.6.3 : Number count evolution did not respect curvature */
-          }
+        pst = &(selection_table[bin]);
 
-        /* matter density source =  [- (dz/dtau) W(z)] * delta_m(k,tau)
-           = W(tau) delta_m(k,tau)
-           with
-           delta_m = total matter perturbation (defined in gauge-independent way, see arXiv 1307.1459)
-           W(z) = redshift space selection function = dN/dz
-           W(tau) = same wrt conformal time = dN/dtau
-           (in tau = tau_0, set source = 0 to avoid division by zero;
-           regulated anyway by Bessel).
-        */
+        /* loop over time and rescale */
+        for (index_tau = 0; index_tau < pst->tau_size; index_tau++) {
 
-        if (_index_tt_in_range_(ptr->index_tt_density, ppt->selection_num, ppt->has_nc_density))
-          rescaling = ptr->selection_bias[bin]*selection[index_tau];
+          /* matter density source =  [- (dz/dtau) W(z)] * delta_m(k,tau)
+             = W(tau) delta_m(k,tau)
+             with
+             delta_m = total matter perturbation (defined in gauge-independent way, see arXiv 1307.1459)
+             W(z) = redshift space selection function = dN/dz
+             W(tau) = same wrt conformal time = dN/dtau
+             (in tau = tau_0, set source = 0 to avoid division by zero;
+             regulated anyway by Bessel).
+          */
 
-        /* redshift space distortion source = - [- (dz/dtau) W(z)] * (k/H) * theta(k,tau) */
+          if (_index_tt_in_range_(ptr->index_tt_density, ppt->selection_num, ppt->has_nc_density))
+            rescaling = ptr->selection_bias[bin]*pst->selection[index_tau];
 
-        if (_index_tt_in_range_(ptr->index_tt_rsd,     ppt->selection_num, ppt->has_nc_rsd))
-          rescaling = selection[index_tau]/pvecback[pba->index_bg_H]/pvecback[pba->index_bg_a];
+          /* redshift space distortion source = - [- (dz/dtau) W(z)] * (k/H) * theta(k,tau) */
 
-        if (_index_tt_in_range_(ptr->index_tt_d0,      ppt->selection_num, ppt->has_nc_rsd))
-          rescaling = (f_evo-3.)*selection[index_tau]*pvecback[pba->index_bg_H]*pvecback[pba->index_bg_a];
+          if (_index_tt_in_range_(ptr->index_tt_rsd,     ppt->selection_num, ppt->has_nc_rsd))
+            rescaling = pst->selection[index_tau]/pst->H[index_tau]/pst->a[index_tau];
 
-        if (_index_tt_in_range_(ptr->index_tt_d1,      ppt->selection_num, ppt->has_nc_rsd))
+          if (_index_tt_in_range_(ptr->index_tt_d0,      ppt->selection_num, ppt->has_nc_rsd))
+            rescaling = (pst->f_evo[index_tau]-3.)*pst->selection[index_tau]*pst->H[index_tau]*pst->a[index_tau];
 
-          rescaling = selection[index_tau]*(1.
-                                            +pvecback[pba->index_bg_H_prime]
-                                            /pvecback[pba->index_bg_a]
-                                            /pvecback[pba->index_bg_H]
-                                            /pvecback[pba->index_bg_H]
-                                            +(2.-5.*ptr->selection_magnification_bias[bin])
-                                            // /tau0_minus_tau[index_tau] // in flat space
-                                            *cotKgen_source  // in general case
-                                            /pvecback[pba->index_bg_a]
-                                            /pvecback[pba->index_bg_H]
-                                            +5.*ptr->selection_magnification_bias[bin]
-                                            -f_evo
-                                            );
+          if (_index_tt_in_range_(ptr->index_tt_d1,      ppt->selection_num, ppt->has_nc_rsd))
 
-        if (_index_tt_in_range_(ptr->index_tt_nc_g1,   ppt->selection_num, ppt->has_nc_gr))
+            rescaling = pst->selection[index_tau]*(1.
+                                                   +pst->H_prime[index_tau]
+                                                   /pst->a[index_tau]
+                                                   /pst->H[index_tau]
+                                                   /pst->H[index_tau]
+                                                   +(2.-5.*ptr->selection_magnification_bias[bin])
+                                                   // /tau0_minus_tau[index_tau] // in flat space
+                                                   *pst->cotKgen[index_tau]  // in general case
+                                                   /pst->a[index_tau]
+                                                   /pst->H[index_tau]
+                                                   +5.*ptr->selection_magnification_bias[bin]
+                                                   -pst->f_evo[index_tau]
+                                                   );
+
+          if (_index_tt_in_range_(ptr->index_tt_nc_g1,   ppt->selection_num, ppt->has_nc_gr))
+
+            rescaling = pst->selection[index_tau];
+
+          if (_index_tt_in_range_(ptr->index_tt_nc_g2,   ppt->selection_num, ppt->has_nc_gr))
+
+            rescaling = -pst->selection[index_tau]*(3.
+                                                    +pst->H_prime[index_tau]
+                                                    /pst->a[index_tau]
+                                                    /pst->H[index_tau]
+                                                    /pst->H[index_tau]
+                                                    +(2.-5.*ptr->selection_magnification_bias[bin])
+                                                    // /tau0_minus_tau[index_tau]  // in flat space
+                                                    *pst->cotKgen[index_tau]  // in general case
+                                                    /pst->a[index_tau]
+                                                    /pst->H[index_tau]
+                                                    -pst->f_evo[index_tau]
+                                                    );
+
+          if (_index_tt_in_range_(ptr->index_tt_nc_g3,   ppt->selection_num, ppt->has_nc_gr))
+            rescaling = pst->selection[index_tau]/pst->a[index_tau]/pst->H[index_tau];
+
+          /* finally store in array */
+          (*window)[index_tt*tau_size_max+index_tau] = rescaling;
+        }
+      }
+      /* End non-integrated contribution */
 
-          rescaling = selection[index_tau];
+      /* Now deal with integrated contributions */
+      if (_integrated_ncl_) {
 
-        if (_index_tt_in_range_(ptr->index_tt_nc_g2,   ppt->selection_num, ppt->has_nc_gr))
+        _get_bin_integrated_ncl_(index_tt)
 
-          rescaling = -selection[index_tau]*(3.
-                                             +pvecback[pba->index_bg_H_prime]
-                                             /pvecback[pba->index_bg_a]
-                                             /pvecback[pba->index_bg_H]
-                                             /pvecback[pba->index_bg_H]
-                                             +(2.-5.*ptr->selection_magnification_bias[bin])
-                                             // /tau0_minus_tau[index_tau]  // in flat space
-                                             *cotKgen_source  // in general case
-                                             /pvecback[pba->index_bg_a]
-                                             /pvecback[pba->index_bg_H]
-                                             -f_evo
-                                             );
+        pst = &(selection_table[bin]);
 
-        if (_index_tt_in_range_(ptr->index_tt_nc_g3,   ppt->selection_num, ppt->has_nc_gr))
-          rescaling = selection[index_tau]/pvecback[pba->index_bg_a]/pvecback[pba->index_bg_H];
+        /* loop over time and rescale */
+        for (index_tau = 0; index_tau < pst->tau_lensing_size; index_tau++) {
+
+          /* lensing source =  - W(tau) (phi(k,tau) + psi(k,tau)) Heaviside(tau-tau_rec)
+             with
+             psi,phi = metric perturbation in newtonian gauge (phi+psi = Phi_A-Phi_H of Bardeen)
+             W = (tau-tau_rec)/(tau_0-tau)/(tau_0-tau_rec)
+             H(x) = Heaviside
+             (in tau = tau_0, set source = 0 to avoid division by zero;
+             regulated anyway by Bessel).
+          */
+
+          if (index_tau == pst->tau_lensing_size-1) {
+            rescaling=0.;
+          }
+          else {
+
+            rescaling = 0.;
+
+            switch (pba->sgnK){
+            case 1:
+              cscKgen_lens = sqrt(pba->K)/sin(sqrt(pba->K)*pst->tau0_minus_tau_lensing[index_tau]);
+              break;
+            case 0:
+              cscKgen_lens = 1./(pst->tau0_minus_tau_lensing[index_tau]);
+              break;
+            case -1:
+              cscKgen_lens = sqrt(-pba->K)/sinh(sqrt(-pba->K)*pst->tau0_minus_tau_lensing[index_tau]);
+              break;
+            }
+
+            for (index_tau_sources=0;
+                 index_tau_sources < pst->tau_sources_size;
+                 index_tau_sources++) {
+
+              /* condition for excluding from the sum the sources located in z=zero */
+              if ((pst->tau0_minus_tau_sources[index_tau_sources] > 0.) && (pst->tau0_minus_tau_sources[index_tau_sources]-pst->tau0_minus_tau_lensing[index_tau] > 0.)) {
+
+                switch (pba->sgnK){
+                case 1:
+                  sinKgen_source_to_lens = sin((pst->tau0_minus_tau_lensing[index_tau]-pst->tau0_minus_tau_sources[index_tau_sources])*sqrt(pba->K))/sqrt(pba->K);
+                  break;
+                case 0:
+                  sinKgen_source_to_lens = (pst->tau0_minus_tau_lensing[index_tau]-pst->tau0_minus_tau_sources[index_tau_sources]);
+                  break;
+                case -1:
+                  sinKgen_source_to_lens = sinh((pst->tau0_minus_tau_lensing[index_tau]-pst->tau0_minus_tau_sources[index_tau_sources])*sqrt(-pba->K))/sqrt(-pba->K);
+                  break;
+                }
+
+                if (_index_tt_in_range_(ptr->index_tt_lensing, ppt->selection_num, ppt->has_cl_lensing_potential)) {
+
+                  rescaling +=
+                    sinKgen_source_to_lens
+                    *cscKgen_lens
+                    /pst->sinKgen_sources[index_tau_sources]
+                    * pst->selection_sources[index_tau_sources]
+                    * pst->w_trapz_sources[index_tau_sources];
+                }
+
+                if (_index_tt_in_range_(ptr->index_tt_nc_lens, ppt->selection_num, ppt->has_nc_lens)) {
+
+                  rescaling -=
+                    (2.-5.*ptr->selection_magnification_bias[bin])/2.
+                    *sinKgen_source_to_lens
+                    *cscKgen_lens
+                    /pst->sinKgen_sources[index_tau_sources]
+                    * pst->selection_sources[index_tau_sources]
+                    * pst->w_trapz_sources[index_tau_sources];
+                }
+
+                if (_index_tt_in_range_(ptr->index_tt_nc_g4, ppt->selection_num, ppt->has_nc_gr)) {
+
+                  rescaling +=
+                    (2.-5.*ptr->selection_magnification_bias[bin])
+                    * pst->cotKgen_sources[index_tau_sources]
+                    * pst->selection_sources[index_tau_sources]
+                    * pst->w_trapz_sources[index_tau_sources];
+                }
+
+                /* the background at the time of each source has been evaluated once in transfer_selection_table_init() */
+                if (_index_tt_in_range_(ptr->index_tt_nc_g5, ppt->selection_num, ppt->has_nc_gr)) {
+
+                  rescaling +=
+                    pst->g5_sources[index_tau_sources]
+                    * pst->selection_sources[index_tau_sources]
+                    * pst->w_trapz_sources[index_tau_sources];
+                }
+              }
+            }
+          }
 
-        /* finally store in array */
-        (*window)[index_tt*tau_size_max+index_tau] = rescaling;
+          /* Finally store integrated result for later use */
+          (*window)[index_tt*tau_size_max+index_tau] = rescaling;
+        }
       }
+      /* End integrated contribution */
     }
-    /* End non-integrated contribution */
 
-    /* Now deal with integrated contributions */
-    if (_integrated_ncl_) {
+    free(pvecback);
 
-      _get_bin_integrated_ncl_(index_tt)
+  } /* end of parallel region */
 
-      /* dirac case */
-      if (ppt->selection == dirac) {
-        tau_sources_size=1;
-      }
-      /* other cases (gaussian, tophat...) */
-      else {
-        tau_sources_size=ppr->selection_sampling;
-      }
+  for (bin = 0; bin < ppt->selection_num; bin++) {
+    class_call(transfer_selection_table_free(&(selection_table[bin])),
+               ptr->error_message,
+               ptr->error_message);
+  }
+  free(selection_table);
 
-      class_alloc(tau0_minus_tau_lensing_sources,
-                  tau_sources_size*sizeof(double),
-                  ptr->error_message);
+  if (abort == _TRUE_) return _FAILURE_;
 
-      class_alloc(w_trapz_lensing_sources,
-                  tau_sources_size*sizeof(double),
-                  ptr->error_message);
+  return _SUCCESS_;
+}
 
-      /* time sampling for source selection function */
-      class_call(transfer_selection_sampling(ppr,
-                                             pba,
-                                             ppt,
-                                             ptr,
-                                             bin,
-                                             tau0_minus_tau_lensing_sources,
-                                             tau_sources_size),
-                 ptr->error_message,
-                 ptr->error_message);
+/**
+ * Tabulate everything that the window functions of one redshift bin
+ * need, for all types at once: time samplings, selection function,
+ * and background quantities, with one call to background_at_tau() per
+ * sampled time.
+ *
+ * @param ppr       Input: pointer to precision structure
+ * @param pba       Input: pointer to background structure
+ * @param ppt       Input: pointer to perturbation structure
+ * @param ptr       Input: pointer to transfers structure
+ * @param tau_rec   Input: recombination time
+ * @param tau0      Input: conformal time today
+ * @param bin       Input: index of the redshift bin
+ * @param pvecback  Input: allocated array of background values (for the calling thread)
+ * @param pst       Output: tables of this bin (entries not needed by the requested types are left NULL)
+ * @return the error status
+ */
 
-      /* Compute trapezoidal weights for integration over tau */
-      class_call(array_trapezoidal_mweights(tau0_minus_tau_lensing_sources,
-                                            tau_sources_size,
-                                            w_trapz_lensing_sources,
-                                            ptr->error_message),
-                 ptr->error_message,
-                 ptr->error_message);
+int transfer_selection_table_init(
+                                  struct precision * ppr,
+                                  struct background * pba,
+                                  struct perturbs * ppt,
+                                  struct transfers * ptr,
+                                  double tau_rec,
+                                  double tau0,
+                                  int bin,
+                                  double * pvecback,
+                                  struct transfer_selection_table * pst
+                                  ) {
 
-      /* compute values of selection function at sampled values of tau */
-      class_call(transfer_selection_compute(ppr,
-                                            pba,
-                                            ppt,
-                                            ptr,
-                                            selection,
-                                            tau0_minus_tau_lensing_sources,
-                                            w_trapz_lensing_sources,
-                                            tau_sources_size,
-                                            pvecback,
-                                            tau0,
-                                            bin),
-                 ptr->error_message,
-                 ptr->error_message);
+  int index_md = ppt->index_md_scalars;
+  int index_tt = -1;
+  int index_tau;
+  int last_index;
+  double tau;
+  double sqrtK;
+  double f_evo;
 
-      /* redefine the time sampling */
-      class_call(transfer_lensing_sampling(ppr,
+  /* one type per family, used for finding the size of the samplings of this bin */
+  if (ppt->has_nc_density == _TRUE_)
+    index_tt = ptr->index_tt_density+bin;
+  else if (ppt->has_nc_rsd == _TRUE_)
+    index_tt = ptr->index_tt_rsd+bin;
+  else if (ppt->has_nc_gr == _TRUE_)
+    index_tt = ptr->index_tt_nc_g1+bin;
+
+  /** - non-integrated contributions */
+  if (index_tt >= 0) {
+
+    class_call(transfer_source_tau_size(ppr,
+                                        pba,
+                                        ppt,
+                                        ptr,
+                                        tau_rec,
+                                        tau0,
+                                        index_md,
+                                        index_tt,
+                                        &(pst->tau_size)),
+               ptr->error_message,
+               ptr->error_message);
+
+    class_alloc(pst->tau0_minus_tau,pst->tau_size*sizeof(double),ptr->error_message);
+    class_alloc(pst->w_trapz,pst->tau_size*sizeof(double),ptr->error_message);
+    class_alloc(pst->selection,pst->tau_size*sizeof(double),ptr->error_message);
+    class_alloc(pst->a,pst->tau_size*sizeof(double),ptr->error_message);
+    class_alloc(pst->H,pst->tau_size*sizeof(double),ptr->error_message);
+    class_alloc(pst->H_prime,pst->tau_size*sizeof(double),ptr->error_message);
+    class_alloc(pst->cotKgen,pst->tau_size*sizeof(double),ptr->error_message);
+    class_alloc(pst->f_evo,pst->tau_size*sizeof(double),ptr->error_message);
+
+    /* redefine the time sampling */
+    class_call(transfer_selection_sampling(ppr,
                                            pba,
                                            ppt,
                                            ptr,
                                            bin,
-                                           tau0,
-                                           tau0_minus_tau,
-                                           tau_size),
-                 ptr->error_message,
-                 ptr->error_message);
+                                           pst->tau0_minus_tau,
+                                           pst->tau_size),
+               ptr->error_message,
+               ptr->error_message);
 
-      /* Compute trapezoidal weights for integration over tau */
-      class_call(array_trapezoidal_mweights(tau0_minus_tau,
-                                            tau_size,
-                                            w_trapz,
-                                            ptr->error_message),
-                 ptr->error_message,
-                 ptr->error_message);
+    class_test(tau0 - pst->tau0_minus_tau[0] > ppt->tau_sampling[ppt->tau_size-1],
+               ptr->error_message,
+               "this should not happen, there was probably a rounding error, if this error occurred, then this must be coded more carefully");
 
-      /* loop over time and rescale */
-      for (index_tau = 0; index_tau < tau_size; index_tau++) {
+    /* Compute trapezoidal weights for integration over tau */
+    class_call(array_trapezoidal_mweights(pst->tau0_minus_tau,
+                                          pst->tau_size,
+                                          pst->w_trapz,
+                                          ptr->error_message),
+               ptr->error_message,
+               ptr->error_message);
 
-        /* lensing source =  - W(tau) (phi(k,tau) + psi(k,tau)) Heaviside(tau-tau_rec)
-           with
-           psi,phi = metric perturbation in newtonian gauge (phi+psi = Phi_A-Phi_H of Bardeen)
-           W = (tau-tau_rec)/(tau_0-tau)/(tau_0-tau_rec)
-           H(x) = Heaviside
-           (in tau = tau_0, set source = 0 to avoid division by zero;
-           regulated anyway by Bessel).
-        */
+    /* compute values of selection function at sampled values of tau */
+    class_call(transfer_selection_compute(ppr,
+                                          pba,
+                                          ppt,
+                                          ptr,
+                                          pst->selection,
+                                          pst->tau0_minus_tau,
+                                          pst->w_trapz,
+                                          pst->tau_size,
+                                          pvecback,
+                                          tau0,
+                                          bin),
+               ptr->error_message,
+               ptr->error_message);
 
-        if (index_tau == tau_size-1) {
-          rescaling=0.;
-        }
-        else {
+    for (index_tau = 0; index_tau < pst->tau_size; index_tau++) {
 
-          rescaling = 0.;
+      /* conformal time */
+      tau = tau0 - pst->tau0_minus_tau[index_tau];
 
-          for (index_tau_sources=0;
-               index_tau_sources < tau_sources_size;
-               index_tau_sources++) {
+      /* geometrical quantity */
+      switch (pba->sgnK){
+      case 1:
+        pst->cotKgen[index_tau] = sqrt(pba->K)
+          *cos(pst->tau0_minus_tau[index_tau]*sqrt(pba->K))
+          /sin(pst->tau0_minus_tau[index_tau]*sqrt(pba->K));
+        break;
+      case 0:
+        pst->cotKgen[index_tau] = 1./(pst->tau0_minus_tau[index_tau]);
+        break;
+      case -1:
+        pst->cotKgen[index_tau] = sqrt(-pba->K)
+          *cosh(pst->tau0_minus_tau[index_tau]*sqrt(-pba->K))
+          /sinh(pst->tau0_minus_tau[index_tau]*sqrt(-pba->K));
+        break;
+      }
 
-            switch (pba->sgnK){
-            case 1:
-              sinKgen_source = sin(tau0_minus_tau_lensing_sources[index_tau_sources]*sqrt(pba->K))/sqrt(pba->K);
-              sinKgen_source_to_lens = sin((tau0_minus_tau[index_tau]-tau0_minus_tau_lensing_sources[index_tau_sources])*sqrt(pba->K))/sqrt(pba->K);
-              cotKgen_source = cos(tau0_minus_tau_lensing_sources[index_tau_sources]*sqrt(pba->K))/sinKgen_source;
-              cscKgen_lens = sqrt(pba->K)/sin(sqrt(pba->K)*tau0_minus_tau[index_tau]);
-              break;
-            case 0:
-              sinKgen_source = tau0_minus_tau_lensing_sources[index_tau_sources];
-              sinKgen_source_to_lens = (tau0_minus_tau[index_tau]-tau0_minus_tau_lensing_sources[index_tau_sources]);
-              cotKgen_source = 1./(tau0_minus_tau_lensing_sources[index_tau_sources]);
-              cscKgen_lens = 1./(tau0_minus_tau[index_tau]);
-              break;
-            case -1:
-              sinKgen_source = sinh(tau0_minus_tau_lensing_sources[index_tau_sources]*sqrt(-pba->K))/sqrt(-pba->K);
-              sinKgen_source_to_lens = sinh((tau0_minus_tau[index_tau]-tau0_minus_tau_lensing_sources[index_tau_sources])*sqrt(-pba->K))/sqrt(-pba->K);
-              cotKgen_source = cosh(tau0_minus_tau_lensing_sources[index_tau_sources]*sqrt(-pba->K))/sinKgen_source;
-              cscKgen_lens = sqrt(-pba->K)/sinh(sqrt(-pba->K)*tau0_minus_tau[index_tau]);
-              break;
-            }
+      /* corresponding background quantities */
+      class_call(background_at_tau(pba,
+                                   tau,
+                                   pba->long_info,
+                                   pba->inter_normal,
+                                   &last_index,
+                                   pvecback),
+                 pba->error_message,
+                 ptr->error_message);
 
-            /* condition for excluding from the sum the sources located in z=zero */
-            if ((tau0_minus_tau_lensing_sources[index_tau_sources] > 0.) && (tau0_minus_tau_lensing_sources[index_tau_sources]-tau0_minus_tau[index_tau] > 0.)) {
+      pst->a[index_tau] = pvecback[pba->index_bg_a];
+      pst->H[index_tau] = pvecback[pba->index_bg_H];
+      pst->H_prime[index_tau] = pvecback[pba->index_bg_H_prime];
 
-              if (_index_tt_in_range_(ptr->index_tt_lensing, ppt->selection_num, ppt->has_cl_lensing_potential)) {
+      /* Source evolution, used by nCl doppler and nCl gravity terms */
+      pst->f_evo[index_tau] = 0.;
+      if ((ppt->has_nc_rsd == _TRUE_) || (ppt->has_nc_gr == _TRUE_)) {
+        class_call(transfer_f_evo(pba,ptr,pvecback,last_index,pst->cotKgen[index_tau],&(pst->f_evo[index_tau])),
+                   ptr->error_message,
+                   ptr->error_message);
+        /* Error in old CLASS 2.6.3 : Number count evolution did not respect curvature */
+      }
+    }
+  }
 
-                rescaling +=
-                  //  *(tau0_minus_tau[index_tau]-tau0_minus_tau_lensing_sources[index_tau_sources])
-                  //  /tau0_minus_tau[index_tau]
-                  //  /tau0_minus_tau_lensing_sources[index_tau_sources]
-                  sinKgen_source_to_lens
-                  *cscKgen_lens
-                  /sinKgen_source
-                  * selection[index_tau_sources]
-                  * w_trapz_lensing_sources[index_tau_sources];
-              }
+  /** - integrated contributions */
+  index_tt = -1;
+  if (ppt->has_cl_lensing_potential == _TRUE_)
+    index_tt = ptr->index_tt_lensing+bin;
+  else if (ppt->has_nc_lens == _TRUE_)
+    index_tt = ptr->index_tt_nc_lens+bin;
+  else if (ppt->has_nc_gr == _TRUE_)
+    index_tt = ptr->index_tt_nc_g4+bin;
 
-              if (_index_tt_in_range_(ptr->index_tt_nc_lens, ppt->selection_num, ppt->has_nc_lens)) {
-
-                rescaling -=
-                  (2.-5.*ptr->selection_magnification_bias[bin])/2.
-                  //  *(tau0_minus_tau[index_tau]-tau0_minus_tau_lensing_sources[index_tau_sources])
-                  //  /tau0_minus_tau[index_tau]
-                  //  /tau0_minus_tau_lensing_sources[index_tau_sources]
-                  *sinKgen_source_to_lens
-                  *cscKgen_lens
-                  /sinKgen_source
-                  * selection[index_tau_sources]
-                  * w_trapz_lensing_sources[index_tau_sources];
-              }
+  if (index_tt >= 0) {
 
-              if (_index_tt_in_range_(ptr->index_tt_nc_g4, ppt->selection_num, ppt->has_nc_gr)) {
+    /* dirac case */
+    if (ppt->selection == dirac) {
+      pst->tau_sources_size=1;
+    }
+    /* other cases (gaussian, tophat...) */
+    else {
+      pst->tau_sources_size=ppr->selection_sampling;
+    }
 
-                rescaling +=
-                  (2.-5.*ptr->selection_magnification_bias[bin])
-                  // /tau0_minus_tau_lensing_sources[index_tau_sources]
-                  * cotKgen_source
-                  * selection[index_tau_sources]
-                  * w_trapz_lensing_sources[index_tau_sources];
+    class_alloc(pst->tau0_minus_tau_sources,pst->tau_sources_size*sizeof(double),ptr->error_message);
+    class_alloc(pst->w_trapz_sources,pst->tau_sources_size*sizeof(double),ptr->error_message);
+    class_alloc(pst->selection_sources,pst->tau_sources_size*sizeof(double),ptr->error_message);
+    class_alloc(pst->sinKgen_sources,pst->tau_sources_size*sizeof(double),ptr->error_message);
+    class_alloc(pst->cotKgen_sources,pst->tau_sources_size*sizeof(double),ptr->error_message);
+    class_alloc(pst->g5_sources,pst->tau_sources_size*sizeof(double),ptr->error_message);
 
-              }
+    /* time sampling for source selection function */
+    class_call(transfer_selection_sampling(ppr,
+                                           pba,
+                                           ppt,
+                                           ptr,
+                                           bin,
+                                           pst->tau0_minus_tau_sources,
+                                           pst->tau_sources_size),
+               ptr->error_message,
+               ptr->error_message);
 
-              if (_index_tt_in_range_(ptr->index_tt_nc_g5, ppt->selection_num, ppt->has_nc_gr)) {
+    /* Compute trapezoidal weights for integration over tau */
+    class_call(array_trapezoidal_mweights(pst->tau0_minus_tau_sources,
+                                          pst->tau_sources_size,
+                                          pst->w_trapz_sources,
+                                          ptr->error_message),
+               ptr->error_message,
+               ptr->error_message);
 
-                /* background quantities at time tau_lensing_source */
+    /* compute values of selection function at sampled values of tau */
+    class_call(transfer_selection_compute(ppr,
+                                          pba,
+                                          ppt,
+                                          ptr,
+                                          pst->selection_sources,
+                                          pst->tau0_minus_tau_sources,
+                                          pst->w_trapz_sources,
+                                          pst->tau_sources_size,
+                                          pvecback,
+                                          tau0,
+                                          bin),
+               ptr->error_message,
+               ptr->error_message);
 
-                class_call(background_at_tau(pba,
-                                             tau0-tau0_minus_tau_lensing_sources[index_tau_sources],
-                                             pba->long_info,
-                                             pba->inter_normal,
-                                             &last_index,
-                                             pvecback),
-                           pba->error_message,
-                           ptr->error_message);
+    for (index_tau = 0; index_tau < pst->tau_sources_size; index_tau++) {
 
-                /* Source evolution at time tau_lensing_source */
+      switch (pba->sgnK){
+      case 1:
+        sqrtK = sqrt(pba->K);
+        pst->sinKgen_sources[index_tau] = sin(pst->tau0_minus_tau_sources[index_tau]*sqrtK)/sqrtK;
+        pst->cotKgen_sources[index_tau] = cos(pst->tau0_minus_tau_sources[index_tau]*sqrtK)/pst->sinKgen_sources[index_tau];
+        break;
+      case 0:
+        pst->sinKgen_sources[index_tau] = pst->tau0_minus_tau_sources[index_tau];
+        pst->cotKgen_sources[index_tau] = 1./(pst->tau0_minus_tau_sources[index_tau]);
+        break;
+      case -1:
+        sqrtK = sqrt(-pba->K);
+        pst->sinKgen_sources[index_tau] = sinh(pst->tau0_minus_tau_sources[index_tau]*sqrtK)/sqrtK;
+        pst->cotKgen_sources[index_tau] = cosh(pst->tau0_minus_tau_sources[index_tau]*sqrtK)/pst->sinKgen_sources[index_tau];
+        break;
+      }
 
-                class_call(transfer_f_evo(pba,ptr,pvecback,last_index,cotKgen_source,&f_evo),
-                           ptr->error_message,
-                           ptr->error_message);
+      pst->g5_sources[index_tau] = 0.;
 
+      /* sources located in z=zero are excluded from the sums */
+      if ((ppt->has_nc_gr == _TRUE_) && (pst->tau0_minus_tau_sources[index_tau] > 0.)) {
 
-                rescaling +=
-                  (1.
-                   + pvecback[pba->index_bg_H_prime]
-                   /pvecback[pba->index_bg_a]
-                   /pvecback[pba->index_bg_H]
-                   /pvecback[pba->index_bg_H]
-                   + (2.-5.*ptr->selection_magnification_bias[bin])
-                   //  /tau0_minus_tau_lensing_sources[index_tau_sources]
-                   * cotKgen_source
-                   /pvecback[pba->index_bg_a]
-                   /pvecback[pba->index_bg_H]
-                   + 5.*ptr->selection_magnification_bias[bin]
-                   - f_evo)
-                  * selection[index_tau_sources]
-                  * w_trapz_lensing_sources[index_tau_sources];
-              }
-            }
-          }
-        }
+        /* background quantities at time tau_lensing_source */
+        class_call(background_at_tau(pba,
+                                     tau0-pst->tau0_minus_tau_sources[index_tau],
+                                     pba->long_info,
+                                     pba->inter_normal,
+                                     &last_index,
+                                     pvecback),
+                   pba->error_message,
+                   ptr->error_message);
 
-        /* Finally store integrated result for later use */
-        (*window)[index_tt*tau_size_max+index_tau] = rescaling;
-      }
+        /* Source evolution at time tau_lensing_source */
+        class_call(transfer_f_evo(pba,ptr,pvecback,last_index,pst->cotKgen_sources[index_tau],&f_evo),
+                   ptr->error_message,
+                   ptr->error_message);
 
-      /* deallocate temporary arrays */
-      free(tau0_minus_tau_lensing_sources);
-      free(w_trapz_lensing_sources);
+        pst->g5_sources[index_tau] =
+          (1.
+           + pvecback[pba->index_bg_H_prime]
+           /pvecback[pba->index_bg_a]
+           /pvecback[pba->index_bg_H]
+           /pvecback[pba->index_bg_H]
+           + (2.-5.*ptr->selection_magnification_bias[bin])
+           //  /tau0_minus_tau_lensing_sources[index_tau_sources]
+           * pst->cotKgen_sources[index_tau]
+           /pvecback[pba->index_bg_a]
+           /pvecback[pba->index_bg_H]
+           + 5.*ptr->selection_magnification_bias[bin]
+           - f_evo);
+      }
     }
-    /* End integrated contribution */
+
+    /* time sampling of the lenses */
+    class_call(transfer_source_tau_size(ppr,
+                                        pba,
+                                        ppt,
+                                        ptr,
+                                        tau_rec,
+                                        tau0,
+                                        index_md,
+                                        index_tt,
+                                        &(pst->tau_lensing_size)),
+               ptr->error_message,
+               ptr->error_message);
+
+    class_alloc(pst->tau0_minus_tau_lensing,pst->tau_lensing_size*sizeof(double),ptr->error_message);
+
+    class_call(transfer_lensing_sampling(ppr,
+                                         pba,
+                                         ppt,
+                                         ptr,
+                                         bin,
+                                         tau0,
+                                         pst->tau0_minus_tau_lensing,
+                                         pst->tau_lensing_size),
+               ptr->error_message,
+               ptr->error_message);
   }
 
-  /* deallocate temporary arrays */
-  free(selection);
-  free(tau0_minus_tau);
-  free(w_trapz);
-  free(pvecback);
+  return _SUCCESS_;
+}
+
+/**
+ * Free the tables of one redshift bin allocated by
+ * transfer_selection_table_init() (a bin whose tables were only
+ * partially allocated can be freed as well).
+ *
+ * @param pst  Input: tables of one bin
+ * @return the error status
+ */
+
+int transfer_selection_table_free(
+                                  struct transfer_selection_table * pst
+                                  ) {
+
+  free(pst->tau0_minus_tau);
+  free(pst->w_trapz);
+  free(pst->selection);
+  free(pst->a);
+  free(pst->H);
+  free(pst->H_prime);
+  free(pst->cotKgen);
+  free(pst->f_evo);
+  free(pst->tau0_minus_tau_sources);
+  free(pst->w_trapz_sources);
+  free(pst->selection_sources);
+  free(pst->sinKgen_sources);
+  free(pst->cotKgen_sources);
+  free(pst->g5_sources);
+  free(pst->tau0_minus_tau_lensing);
+
   return _SUCCESS_;
 }
 
@@ -0,0 +1,101 @@
+"""
+Compare two JSON files written by test_benchmark (see test/test_benchmark.c),
+typically for two versions of CLASS run on the same machine, and flag the
+regressions: modules of a configuration whose wall-clock time, CPU time or
+peak memory grew by more than a relative threshold. Timings shorter than a
+minimum duration (in both files) are ignored, as they are dominated by noise.
+
+Usage: python compare_benchmark.py reference.json new.json [--threshold 0.1]
+                                   [--memory-threshold 0.1] [--min-time 0.05]
+
+The exit status is 1 if a regression (or a configuration which does not
+succeed any more) is found, 0 otherwise.
+"""
+from __future__ import print_function
+import argparse
+import json
+import sys
+
+
+def compare(reference, new, threshold, memory_threshold, min_time):
+    """
+    Print the comparison of each configuration and module present in both
+    results, and return the list of regressions
+    """
+    regressions = []
+    for name, ref_configuration in reference["configurations"].items():
+        if name not in new["configurations"]:
+            print("%s: absent from the new results" % name)
+            continue
+        new_configuration = new["configurations"][name]
+        if ref_configuration["status"] != "success":
+            print("%s: reference failed, new %s" % (name, new_configuration["status"]))
+            continue
+        if new_configuration["status"] != "success":
+            print("%s: REGRESSION, new results failed" % name)
+            regressions.append((name, "status", "failure"))
+            continue
+        if ref_configuration.get("threads") != new_configuration.get("threads"):
+            print("%s: warning, %s threads in the reference and %s in the new results" % (
+                name, ref_configuration.get("threads"), new_configuration.get("threads")))
+        modules = list(ref_configuration["modules"].keys()) + ["total"]
+        print(name)
+        for module in modules:
+            if module == "total":
+                ref_measure = ref_configuration["total"]
+                new_measure = new_configuration["total"]
+            elif module in new_configuration["modules"]:
+                ref_measure = ref_configuration["modules"][module]
+                new_measure = new_configuration["modules"][module]
+            else:
+                continue
+            flags = []
+            for quantity in ["wall", "cpu"]:
+                if max(ref_measure[quantity], new_measure[quantity]) < min_time:
+                    continue
+                ratio = new_measure[quantity]/max(ref_measure[quantity], 1.e-12)
+                if ratio > 1.+threshold:
+                    flags.append("%s x%.2f" % (quantity, ratio))
+                    regressions.append((name, module, quantity))
+            ratio_rss = float(new_measure["peak_rss_kb"])/max(ref_measure["peak_rss_kb"], 1)
+            if ratio_rss > 1.+memory_threshold:
+                flags.append("peak memory x%.2f" % ratio_rss)
+                regressions.append((name, module, "peak_rss_kb"))
+            print("  %-20s wall %10.4f -> %10.4f s, cpu %10.4f -> %10.4f s, peak memory %8d -> %8d kB%s" % (
+                module, ref_measure["wall"], new_measure["wall"],
+                ref_measure["cpu"], new_measure["cpu"],
+                ref_measure["peak_rss_kb"], new_measure["peak_rss_kb"],
+                "   REGRESSION: "+", ".join(flags) if flags else ""))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Flag performance regressions between two test_benchmark results")
+    parser.add_argument("reference", help="JSON file of the reference version")
+    parser.add_argument("new", help="JSON file of the new version")
+    parser.add_argument("--threshold", type=float, default=0.1,
+                        help="largest relative increase of the times (default 0.1)")
+    parser.add_argument("--memory-threshold", type=float, default=0.1,
+                        help="largest relative increase of the peak memory (default 0.1)")
+    parser.add_argument("--min-time", type=float, default=0.05,
+                        help="times below this value (s) are not compared (default 0.05)")
+    args = parser.parse_args()
+
+    with open(args.reference) as f:
+        reference = json.load(f)
+    with open(args.new) as f:
+        new = json.load(f)
+
+    print("reference %s, new %s" % (reference.get("version"), new.get("version")))
+    regressions = compare(reference, new, args.threshold, args.memory_threshold, args.min_time)
+
+    if regressions:
+        print("%d regression(s) beyond the thresholds" % len(regressions))
+        return 1
+    print("no regression beyond the thresholds")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
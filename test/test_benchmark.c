@@ -0,0 +1,393 @@
+/** @file test_benchmark.c
+ *
+ * Performance regression benchmark: run a fixed matrix of
+ * configurations (LCDM, long-range scalar of explanatory_lrs.ini,
+ * massive neutrinos, high-l lensing, number counts, HMcode, and the
+ * reference precisions cl_ref.pre and pk_ref.pre) and record, for
+ * input_init() and for the _init function of each module, the
+ * wall-clock time, the CPU time of all threads and the peak resident
+ * memory of the process. Each configuration is run in its own process,
+ * so that its peak memory does not depend on the previous ones. With
+ * several repetitions, the shortest times are kept, and the peak memory
+ * is the one of the first repetition (the next ones would include the
+ * caches filled by the first one).
+ *
+ * The results are printed, and written in JSON format, to be compared
+ * between two versions with test/compare_benchmark.py. Run it from the
+ * root directory of CLASS (the configurations read the .ini and .pre
+ * files there).
+ *
+ * Usage: ./test_benchmark [output.json] [number of repetitions] [configuration ...]
+ * (all configurations by default)
+ */
+
+#include "class.h"
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+/* modules, in the order in which they are computed */
+enum benchmark_module {
+  bm_input,
+  bm_background,
+  bm_thermodynamics,
+  bm_perturbations,
+  bm_primordial,
+  bm_nonlinear,
+  bm_transfer,
+  bm_spectra,
+  bm_lensing,
+  bm_size
+};
+
+char * benchmark_module_name[bm_size] = {"input_init","background_init","thermodynamics_init",
+                                         "perturb_init","primordial_init","nonlinear_init",
+                                         "transfer_init","spectra_init","lensing_init"};
+
+/* one configuration of the matrix */
+struct benchmark_configuration {
+  char * name;
+  char * ini;              /* input file (NULL if none) */
+  char * pre;              /* precision file (NULL for the default precision) */
+  char * parameters[16];   /* other parameters: name, value, name, value, ..., NULL */
+};
+
+struct benchmark_configuration benchmark_matrix[] = {
+  {"lcdm",NULL,NULL,
+   {"output","tCl,pCl,lCl,mPk","lensing","yes",NULL}},
+  {"lrs","explanatory_lrs.ini",NULL,
+   {NULL}},
+  {"massive_neutrinos",NULL,NULL,
+   {"output","tCl,pCl,lCl,mPk","lensing","yes","N_ur","2.0328","N_ncdm","1","m_ncdm","0.06",NULL}},
+  {"lensing_high_l",NULL,NULL,
+   {"output","tCl,pCl,lCl","lensing","yes","l_max_scalars","5000",NULL}},
+  {"number_counts",NULL,NULL,
+   {"output","nCl,sCl","selection","gaussian","selection_mean","0.5,1.0,1.5","selection_width","0.1",
+    "non_diagonal","2","l_max_lss","500",NULL}},
+  {"hmcode",NULL,NULL,
+   {"output","mPk","non linear","hmcode","P_k_max_h/Mpc","10","z_max_pk","3",NULL}},
+  {"cl_ref",NULL,"cl_ref.pre",
+   {"output","tCl,pCl,lCl","lensing","yes",NULL}},
+  {"pk_ref",NULL,"pk_ref.pre",
+   {"output","mPk","P_k_max_h/Mpc","10",NULL}}
+};
+
+/* measures of one module */
+struct benchmark_measure {
+  double wall;        /* wall-clock time (s) */
+  double cpu;         /* CPU time of all threads (s) */
+  long peak_rss;      /* peak resident memory of the process at the end of the module (kB) */
+};
+
+/* results of one configuration, sent by the process which runs it */
+struct benchmark_result {
+  int status;
+  ErrorMsg error_message;
+  int threads;
+  struct benchmark_measure measure[bm_size];
+};
+
+/* wall-clock time (s) */
+double benchmark_time() {
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+/* user and system time of all threads of the process (s), and its peak resident memory (kB) */
+void benchmark_usage(double * cpu, long * peak_rss) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF,&usage);
+  *cpu = usage.ru_utime.tv_sec+1.e-6*usage.ru_utime.tv_usec+usage.ru_stime.tv_sec+1.e-6*usage.ru_stime.tv_usec;
+  *peak_rss = usage.ru_maxrss;
+}
+
+int benchmark_run(struct benchmark_configuration * pbc, int repeat, struct benchmark_result * pbr);
+
+int main(int argc, char **argv) {
+
+  int configuration_size = sizeof(benchmark_matrix)/sizeof(benchmark_matrix[0]);
+  int index_configuration,index_argument,index_module,selected,repeat=1,first=_TRUE_;
+  char * json_name = "benchmark.json";
+  int pipe_fd[2];
+  pid_t pid;
+  ssize_t bytes;
+  struct benchmark_result result;
+  struct benchmark_measure total;
+  FILE * json;
+
+  if (argc > 1)
+    json_name = argv[1];
+  if (argc > 2)
+    repeat = atoi(argv[2]);
+
+  json = fopen(json_name,"w");
+  if (json == NULL) {
+    printf("\n\nError: could not open %s\n",json_name);
+    return _FAILURE_;
+  }
+
+  fprintf(json,"{\n");
+  fprintf(json,"  \"version\": \"%s\",\n",_VERSION_);
+  fprintf(json,"  \"repetitions\": %d,\n",repeat);
+  fprintf(json,"  \"configurations\": {\n");
+
+  for (index_configuration=0; index_configuration<configuration_size; index_configuration++) {
+
+    /* only the configurations given in argument, if any */
+    selected = (argc <= 3);
+    for (index_argument=3; index_argument<argc; index_argument++)
+      if (strcmp(argv[index_argument],benchmark_matrix[index_configuration].name) == 0)
+        selected = _TRUE_;
+    if (selected == _FALSE_)
+      continue;
+
+    /* run the configuration in a child process, which sends back its results
+       (this process never starts OpenMP threads, which would not survive fork()) */
+    if (pipe(pipe_fd) != 0) {
+      printf("\n\nError: could not create a pipe\n");
+      return _FAILURE_;
+    }
+
+    pid = fork();
+
+    if (pid < 0) {
+      printf("\n\nError: could not fork\n");
+      return _FAILURE_;
+    }
+
+    if (pid == 0) {
+      close(pipe_fd[0]);
+      benchmark_run(&(benchmark_matrix[index_configuration]),repeat,&result);
+      bytes = write(pipe_fd[1],&result,sizeof(struct benchmark_result));
+      close(pipe_fd[1]);
+      _exit(bytes == sizeof(struct benchmark_result) ? 0 : 1);
+    }
+
+    close(pipe_fd[1]);
+    bytes = read(pipe_fd[0],&result,sizeof(struct benchmark_result));
+    close(pipe_fd[0]);
+    waitpid(pid,NULL,0);
+
+    if (bytes != sizeof(struct benchmark_result)) {
+      result.status = _FAILURE_;
+      result.threads = 0;
+      sprintf(result.error_message,"the benchmark process stopped before sending its results");
+    }
+
+    /* sum over modules */
+    total.wall = 0.;
+    total.cpu = 0.;
+    total.peak_rss = 0;
+    if (result.status == _SUCCESS_) {
+      for (index_module=0; index_module<bm_size; index_module++) {
+        total.wall += result.measure[index_module].wall;
+        total.cpu += result.measure[index_module].cpu;
+        total.peak_rss = MAX(total.peak_rss,result.measure[index_module].peak_rss);
+      }
+    }
+
+    /* human-readable summary */
+    printf("%s: ",benchmark_matrix[index_configuration].name);
+    if (result.status == _FAILURE_) {
+      printf("failed\n=>%s\n",result.error_message);
+    }
+    else {
+      printf("%g s wall, %g s CPU, peak memory %ld kB (%d threads)\n",total.wall,total.cpu,total.peak_rss,result.threads);
+      for (index_module=0; index_module<bm_size; index_module++)
+        printf(" %-20s %10.4f s wall, %10.4f s CPU, peak memory %8ld kB\n",
+               benchmark_module_name[index_module],
+               result.measure[index_module].wall,
+               result.measure[index_module].cpu,
+               result.measure[index_module].peak_rss);
+    }
+
+    /* machine-readable output */
+    fprintf(json,"%s    \"%s\": {\n",(first == _TRUE_) ? "" : ",\n",benchmark_matrix[index_configuration].name);
+    first = _FALSE_;
+    if (result.status == _FAILURE_) {
+      fprintf(json,"      \"status\": \"failure\"\n");
+    }
+    else {
+      fprintf(json,"      \"status\": \"success\",\n");
+      fprintf(json,"      \"threads\": %d,\n",result.threads);
+      fprintf(json,"      \"modules\": {\n");
+      for (index_module=0; index_module<bm_size; index_module++)
+        fprintf(json,"        \"%s\": {\"wall\": %.6f, \"cpu\": %.6f, \"peak_rss_kb\": %ld}%s\n",
+                benchmark_module_name[index_module],
+                result.measure[index_module].wall,
+                result.measure[index_module].cpu,
+                result.measure[index_module].peak_rss,
+                (index_module < bm_size-1) ? "," : "");
+      fprintf(json,"      },\n");
+      fprintf(json,"      \"total\": {\"wall\": %.6f, \"cpu\": %.6f, \"peak_rss_kb\": %ld}\n",
+              total.wall,total.cpu,total.peak_rss);
+    }
+    fprintf(json,"    }");
+    fflush(json);
+  }
+
+  fprintf(json,"\n  }\n");
+  fprintf(json,"}\n");
+  fclose(json);
+
+  printf(" -> written %s\n",json_name);
+
+  return _SUCCESS_;
+}
+
+/**
+ * Compute one configuration repeat times, keeping for each module the
+ * shortest times and the peak memory of the first repetition
+ */
+
+int benchmark_run(struct benchmark_configuration * pbc, int repeat, struct benchmark_result * pbr) {
+
+  struct file_content fc,fc_parameters,fc_file,fc_tmp;
+  struct precision pr;
+  struct background ba;
+  struct thermo th;
+  struct perturbs pt;
+  struct transfers tr;
+  struct primordial pm;
+  struct spectra sp;
+  struct nonlinear nl;
+  struct lensing le;
+  struct output op;
+  char * files[2];
+  int index_parameter,parameter_size,index_file,index_repeat,index_module,status=_SUCCESS_;
+  double wall,cpu,cpu_start;
+  long peak_rss;
+
+  pbr->status = _FAILURE_;
+  strcpy(pbr->error_message,"");
+#ifdef _OPENMP
+  pbr->threads = omp_get_max_threads();
+#else
+  pbr->threads = 1;
+#endif
+  for (index_module=0; index_module<bm_size; index_module++) {
+    pbr->measure[index_module].wall = 1.e100;
+    pbr->measure[index_module].cpu = 1.e100;
+    pbr->measure[index_module].peak_rss = 0;
+  }
+
+  /* parameters of the configuration, followed by those of its input and precision files */
+  for (parameter_size=0; pbc->parameters[2*parameter_size] != NULL; parameter_size++);
+
+  fc_parameters.size = 0;
+  if (parameter_size > 0) {
+    class_call(parser_init(&fc_parameters,parameter_size,"benchmark",pbr->error_message),
+               pbr->error_message,
+               pbr->error_message);
+    for (index_parameter=0; index_parameter<parameter_size; index_parameter++) {
+      strcpy(fc_parameters.name[index_parameter],pbc->parameters[2*index_parameter]);
+      strcpy(fc_parameters.value[index_parameter],pbc->parameters[2*index_parameter+1]);
+    }
+  }
+
+  files[0] = pbc->ini;
+  files[1] = pbc->pre;
+  fc = fc_parameters;
+  for (index_file=0; index_file<2; index_file++) {
+    if (files[index_file] == NULL)
+      continue;
+    class_call(parser_read_file(files[index_file],&fc_file,pbr->error_message),
+               pbr->error_message,
+               pbr->error_message);
+    class_call(parser_cat(&fc,&fc_file,&fc_tmp,pbr->error_message),
+               pbr->error_message,
+               pbr->error_message);
+    parser_free(&fc);
+    parser_free(&fc_file);
+    fc = fc_tmp;
+  }
+
+  for (index_repeat=0; (index_repeat<repeat) && (status == _SUCCESS_); index_repeat++) {
+
+    for (index_module=0; (index_module<bm_size) && (status == _SUCCESS_); index_module++) {
+
+      wall = benchmark_time();
+      benchmark_usage(&cpu_start,&peak_rss);
+
+      switch (index_module) {
+      case bm_input:
+        if ((status = input_init(&fc,&pr,&ba,&th,&pt,&tr,&pm,&sp,&nl,&le,&op,pbr->error_message)) == _SUCCESS_) {
+          ba.background_verbose = 0;
+          th.thermodynamics_verbose = 0;
+          pt.perturbations_verbose = 0;
+          pm.primordial_verbose = 0;
+          nl.nonlinear_verbose = 0;
+          tr.transfer_verbose = 0;
+          sp.spectra_verbose = 0;
+          le.lensing_verbose = 0;
+        }
+        break;
+      case bm_background:
+        if ((status = background_init(&pr,&ba)) == _FAILURE_)
+          strcpy(pbr->error_message,ba.error_message);
+        break;
+      case bm_thermodynamics:
+        if ((status = thermodynamics_init(&pr,&ba,&th)) == _FAILURE_)
+          strcpy(pbr->error_message,th.error_message);
+        break;
+      case bm_perturbations:
+        if ((status = perturb_init(&pr,&ba,&th,&pt)) == _FAILURE_)
+          strcpy(pbr->error_message,pt.error_message);
+        break;
+      case bm_primordial:
+        if ((status = primordial_init(&pr,&pt,&pm)) == _FAILURE_)
+          strcpy(pbr->error_message,pm.error_message);
+        break;
+      case bm_nonlinear:
+        if ((status = nonlinear_init(&pr,&ba,&th,&pt,&pm,&nl)) == _FAILURE_)
+          strcpy(pbr->error_message,nl.error_message);
+        break;
+      case bm_transfer:
+        if ((status = transfer_init(&pr,&ba,&th,&pt,&nl,&tr)) == _FAILURE_)
+          strcpy(pbr->error_message,tr.error_message);
+        break;
+      case bm_spectra:
+        if ((status = spectra_init(&pr,&ba,&pt,&pm,&nl,&tr,&sp)) == _FAILURE_)
+          strcpy(pbr->error_message,sp.error_message);
+        break;
+      case bm_lensing:
+        if ((status = lensing_init(&pr,&pt,&sp,&nl,&le)) == _FAILURE_)
+          strcpy(pbr->error_message,le.error_message);
+        break;
+      }
+
+      wall = benchmark_time()-wall;
+      benchmark_usage(&cpu,&peak_rss);
+      cpu -= cpu_start;
+
+      pbr->measure[index_module].wall = MIN(pbr->measure[index_module].wall,wall);
+      pbr->measure[index_module].cpu = MIN(pbr->measure[index_module].cpu,cpu);
+      if (index_repeat == 0)
+        pbr->measure[index_module].peak_rss = peak_rss;
+    }
+
+    if (status == _FAILURE_)
+      break;
+
+    if ((lensing_free(&le) == _FAILURE_) ||
+        (spectra_free(&sp) == _FAILURE_) ||
+        (transfer_free(&tr) == _FAILURE_) ||
+        (nonlinear_free(&nl) == _FAILURE_) ||
+        (primordial_free(&pm) == _FAILURE_) ||
+        (perturb_free(&pt) == _FAILURE_) ||
+        (thermodynamics_free(&th) == _FAILURE_) ||
+        (background_free(&ba) == _FAILURE_)) {
+      sprintf(pbr->error_message,"could not free the structures");
+      status = _FAILURE_;
+    }
+  }
+
+  parser_free(&fc);
+
+  pbr->status = status;
+
+  return status;
+}
@@ -0,0 +1,318 @@
+/** @file test_concurrent_instances.c
+ *
+ * Run several independent CLASS computations (from background_init()
+ * to lensing_init(), as Class.compute() in classy) concurrently, each in
+ * its own POSIX thread using a given number of OpenMP threads, like
+ * several classy instances in a python thread pool. Each model is first
+ * computed alone, then all of them at the same time, and the C_l and
+ * sigma8 of the two runs are compared. The wall-clock times are
+ * printed, as well as the largest relative difference. The test fails
+ * if a computation fails or if this difference is not zero.
+ *
+ * When computed alone, the models are computed one after the other in
+ * the same structures, which are not reset in between, like those of a
+ * Class instance in classy over several calls to compute(). Without
+ * input files, two different models are used: HALOFIT with P(k) at
+ * several redshifts, then plain LCDM with P(k) at z=0.
+ *
+ * Usage: ./test_concurrent_instances [OpenMP threads per instance] [model1.ini model2.ini ...]
+ */
+
+#include "class.h"
+#include <pthread.h>
+
+/* wall-clock time (s) */
+double concurrent_instances_time() {
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+/* structures of one computation */
+struct concurrent_structures {
+  struct precision pr;
+  struct background ba;
+  struct thermo th;
+  struct perturbs pt;
+  struct primordial pm;
+  struct nonlinear nl;
+  struct transfers tr;
+  struct spectra sp;
+  struct lensing le;
+  struct output op;
+};
+
+/* input and results of one computation */
+struct concurrent_instance {
+  char * ini;           /* input file */
+  struct concurrent_structures * structures; /* structures in which it is computed */
+  int threads;          /* number of OpenMP threads (0: default) */
+  int status;           /* error status */
+  ErrorMsg error_message;
+  int l_max;            /* C_l for l <= l_max, 0 if there are no C_l */
+  int ct_size;
+  double * cl;          /* cl[l*ct_size+index_ct] */
+  double sigma8;        /* 0 if there is no P(k) */
+  double time;          /* wall-clock time of the computation */
+};
+
+/* compute one model and keep its C_l and sigma8 */
+void * concurrent_instance_run(void * parameters) {
+
+  struct concurrent_instance * pci = parameters;
+  struct precision * ppr = &(pci->structures->pr);
+  struct background * pba = &(pci->structures->ba);
+  struct thermo * pth = &(pci->structures->th);
+  struct perturbs * ppt = &(pci->structures->pt);
+  struct primordial * ppm = &(pci->structures->pm);
+  struct nonlinear * pnl = &(pci->structures->nl);
+  struct transfers * ptr = &(pci->structures->tr);
+  struct spectra * psp = &(pci->structures->sp);
+  struct lensing * ple = &(pci->structures->le);
+  struct output * pop = &(pci->structures->op);
+  char * arguments[2];
+  double ** cl_md;
+  double ** cl_md_ic;
+  double start;
+  int l,index_md;
+
+  pci->status = _FAILURE_;
+  pci->l_max = 0;
+  pci->cl = NULL;
+  pci->sigma8 = 0.;
+
+#ifdef _OPENMP
+  if (pci->threads > 0)
+    omp_set_num_threads(pci->threads);
+#endif
+
+  arguments[0] = "test_concurrent_instances";
+  arguments[1] = pci->ini;
+
+  start = concurrent_instances_time();
+
+  if (input_init_from_arguments(2,arguments,ppr,pba,pth,ppt,ptr,ppm,psp,pnl,ple,pop,pci->error_message) == _FAILURE_)
+    return NULL;
+
+  pba->background_verbose = 0;
+  pth->thermodynamics_verbose = 0;
+  ppt->perturbations_verbose = 0;
+  ppm->primordial_verbose = 0;
+  pnl->nonlinear_verbose = 0;
+  ptr->transfer_verbose = 0;
+  psp->spectra_verbose = 0;
+  ple->lensing_verbose = 0;
+
+  if (background_init(ppr,pba) == _FAILURE_) {
+    strcpy(pci->error_message,pba->error_message);
+    return NULL;
+  }
+  if (thermodynamics_init(ppr,pba,pth) == _FAILURE_) {
+    strcpy(pci->error_message,pth->error_message);
+    return NULL;
+  }
+  if (perturb_init(ppr,pba,pth,ppt) == _FAILURE_) {
+    strcpy(pci->error_message,ppt->error_message);
+    return NULL;
+  }
+  if (primordial_init(ppr,ppt,ppm) == _FAILURE_) {
+    strcpy(pci->error_message,ppm->error_message);
+    return NULL;
+  }
+  if (nonlinear_init(ppr,pba,pth,ppt,ppm,pnl) == _FAILURE_) {
+    strcpy(pci->error_message,pnl->error_message);
+    return NULL;
+  }
+  if (transfer_init(ppr,pba,pth,ppt,pnl,ptr) == _FAILURE_) {
+    strcpy(pci->error_message,ptr->error_message);
+    return NULL;
+  }
+  if (spectra_init(ppr,pba,ppt,ppm,pnl,ptr,psp) == _FAILURE_) {
+    strcpy(pci->error_message,psp->error_message);
+    return NULL;
+  }
+  if (lensing_init(ppr,ppt,psp,pnl,ple) == _FAILURE_) {
+    strcpy(pci->error_message,ple->error_message);
+    return NULL;
+  }
+
+  pci->time = concurrent_instances_time()-start;
+
+  if (ppt->has_cls == _TRUE_) {
+    pci->l_max = psp->l_max_tot;
+    pci->ct_size = psp->ct_size;
+    pci->cl = calloc((pci->l_max+1)*pci->ct_size,sizeof(double));
+    cl_md = malloc(psp->md_size*sizeof(double*));
+    cl_md_ic = malloc(psp->md_size*sizeof(double*));
+    for (index_md=0; index_md<psp->md_size; index_md++) {
+      cl_md[index_md] = malloc(psp->ct_size*sizeof(double));
+      cl_md_ic[index_md] = malloc(psp->ct_size*psp->ic_ic_size[index_md]*sizeof(double));
+    }
+    for (l=2; l<=pci->l_max; l++) {
+      if (spectra_cl_at_l(psp,(double)l,pci->cl+l*pci->ct_size,cl_md,cl_md_ic) == _FAILURE_) {
+        strcpy(pci->error_message,psp->error_message);
+        return NULL;
+      }
+    }
+    for (index_md=0; index_md<psp->md_size; index_md++) {
+      free(cl_md[index_md]);
+      free(cl_md_ic[index_md]);
+    }
+    free(cl_md);
+    free(cl_md_ic);
+  }
+
+  if (ppt->has_pk_matter == _TRUE_)
+    pci->sigma8 = pnl->sigma8[pnl->index_pk_m];
+
+  if ((lensing_free(ple) == _FAILURE_) ||
+      (spectra_free(psp) == _FAILURE_) ||
+      (transfer_free(ptr) == _FAILURE_) ||
+      (nonlinear_free(pnl) == _FAILURE_) ||
+      (primordial_free(ppm) == _FAILURE_) ||
+      (perturb_free(ppt) == _FAILURE_) ||
+      (thermodynamics_free(pth) == _FAILURE_) ||
+      (background_free(pba) == _FAILURE_)) {
+    sprintf(pci->error_message,"could not free the structures");
+    return NULL;
+  }
+
+  pci->status = _SUCCESS_;
+
+  return NULL;
+}
+
+/* built-in models, used without input files */
+char * concurrent_instances_models[] = {
+  "output = mPk\nnon linear = halofit\nz_pk = 0,1,2\n",
+  "output = mPk\n"
+};
+
+int main(int argc, char **argv) {
+
+  int threads,instance_size,index_instance,index_run,index;
+  struct concurrent_instance * instances[2];
+  struct concurrent_structures * serial_structures;
+  struct concurrent_structures * concurrent_structures;
+  pthread_t * pthreads;
+  double start,t_serial=0.,t_concurrent,diff,max_diff=0.;
+  struct concurrent_instance * pserial;
+  struct concurrent_instance * pconcurrent;
+  char ** ini;
+  short built_in;
+  FILE * file;
+  int descriptor;
+
+  if (argc < 2) {
+    printf("Usage: %s [OpenMP threads per instance] [model1.ini model2.ini ...]\n",argv[0]);
+    return _FAILURE_;
+  }
+
+  threads = atoi(argv[1]);
+
+  built_in = (argc == 2 ? _TRUE_ : _FALSE_);
+  if (built_in == _TRUE_) {
+    instance_size = sizeof(concurrent_instances_models)/sizeof(char*);
+    ini = malloc(instance_size*sizeof(char*));
+    for (index_instance=0; index_instance<instance_size; index_instance++) {
+      ini[index_instance] = malloc(_FILENAMESIZE_);
+      strcpy(ini[index_instance],"/tmp/test_concurrent_instances_XXXXXX.ini");
+      descriptor = mkstemps(ini[index_instance],4);
+      if ((descriptor == -1) || ((file = fdopen(descriptor,"w")) == NULL)) {
+        printf("\n\nError: could not create %s\n",ini[index_instance]);
+        return _FAILURE_;
+      }
+      fputs(concurrent_instances_models[index_instance],file);
+      fclose(file);
+    }
+  }
+  else {
+    instance_size = argc-2;
+    ini = argv+2;
+  }
+
+  /* the serial run computes all models in the same structures */
+  serial_structures = calloc(1,sizeof(struct concurrent_structures));
+  concurrent_structures = calloc(instance_size,sizeof(struct concurrent_structures));
+
+  for (index_run=0; index_run<2; index_run++) {
+    instances[index_run] = calloc(instance_size,sizeof(struct concurrent_instance));
+    for (index_instance=0; index_instance<instance_size; index_instance++) {
+      instances[index_run][index_instance].ini = ini[index_instance];
+      instances[index_run][index_instance].threads = threads;
+      instances[index_run][index_instance].structures = (index_run == 0 ? serial_structures : &(concurrent_structures[index_instance]));
+    }
+  }
+  pthreads = malloc(instance_size*sizeof(pthread_t));
+
+  /* one model after the other */
+  for (index_instance=0; index_instance<instance_size; index_instance++) {
+    pserial = &(instances[0][index_instance]);
+    concurrent_instance_run(pserial);
+    if (pserial->status == _FAILURE_) {
+      printf("\n\nError in the computation of %s\n=>%s\n",pserial->ini,pserial->error_message);
+      return _FAILURE_;
+    }
+    t_serial += pserial->time;
+  }
+
+  /* all models at the same time */
+  start = concurrent_instances_time();
+  for (index_instance=0; index_instance<instance_size; index_instance++) {
+    if (pthread_create(&(pthreads[index_instance]),NULL,concurrent_instance_run,&(instances[1][index_instance])) != 0) {
+      printf("\n\nError: could not create thread %d\n",index_instance);
+      return _FAILURE_;
+    }
+  }
+  for (index_instance=0; index_instance<instance_size; index_instance++)
+    pthread_join(pthreads[index_instance],NULL);
+  t_concurrent = concurrent_instances_time()-start;
+
+  for (index_instance=0; index_instance<instance_size; index_instance++) {
+    pserial = &(instances[0][index_instance]);
+    pconcurrent = &(instances[1][index_instance]);
+    if (pconcurrent->status == _FAILURE_) {
+      printf("\n\nError in the concurrent computation of %s\n=>%s\n",pconcurrent->ini,pconcurrent->error_message);
+      return _FAILURE_;
+    }
+    diff = 0.;
+    for (index=0; index<(pserial->l_max+1)*pserial->ct_size; index++) {
+      if (pserial->cl[index] != pconcurrent->cl[index])
+        diff = MAX(diff,fabs(pconcurrent->cl[index]/pserial->cl[index]-1.));
+    }
+    if (pserial->sigma8 != pconcurrent->sigma8)
+      diff = MAX(diff,fabs(pconcurrent->sigma8/pserial->sigma8-1.));
+    printf("%s: alone %g s, concurrently %g s, largest relative difference %e\n",
+           pserial->ini,pserial->time,pconcurrent->time,diff);
+    max_diff = MAX(max_diff,diff);
+  }
+
+  printf("%d instances with %d OpenMP thread(s) each: one after the other %g s, concurrently %g s, largest relative difference %e\n",
+         instance_size,threads,t_serial,t_concurrent,max_diff);
+
+  for (index_run=0; index_run<2; index_run++) {
+    for (index_instance=0; index_instance<instance_size; index_instance++)
+      free(instances[index_run][index_instance].cl);
+    free(instances[index_run]);
+  }
+  free(pthreads);
+  free(serial_structures);
+  free(concurrent_structures);
+
+  if (built_in == _TRUE_) {
+    for (index_instance=0; index_instance<instance_size; index_instance++) {
+      remove(ini[index_instance]);
+      free(ini[index_instance]);
+    }
+    free(ini);
+  }
+
+  if (max_diff != 0.) {
+    printf("\n\nError: the concurrent computations differ from the serial ones\n");
+    return _FAILURE_;
+  }
+
+  return _SUCCESS_;
+}
@@ -0,0 +1,162 @@
+/** @file test_external_pk.c
+ *
+ * Compute the primordial spectrum in 'external_Pk' mode three times:
+ * running the command of the input file, running it again (the table
+ * is then taken from the cache of the primordial module), and with a
+ * function passed through ppm->external_pk_function instead of the
+ * command. The function implements the spectrum of the example command
+ * external_Pk/generate_Pk_example.py, A_s (k/k_pivot)^(n_s-1) with
+ * k_pivot=custom1, A_s=custom2, n_s=custom3. The timings are printed,
+ * as well as the largest relative difference of P(k) with the first
+ * run.
+ *
+ * Usage: ./test_external_pk model.ini (with P_k_ini type = external_Pk
+ * and command = python external_Pk/generate_Pk_example.py)
+ */
+
+#include "class.h"
+
+/* wall-clock time (s) */
+double external_pk_time() {
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+/* power-law spectrum of external_Pk/generate_Pk_example.py */
+int external_pk_power_law(double * k,
+                          int k_size,
+                          double * pk_scalar,
+                          double * pk_tensor,
+                          void * parameters,
+                          ErrorMsg error_message) {
+
+  struct primordial * ppm = parameters;
+  int index_k;
+
+  for (index_k=0; index_k<k_size; index_k++)
+    pk_scalar[index_k] = ppm->custom2*pow(k[index_k]/ppm->custom1,ppm->custom3-1.);
+
+  return _SUCCESS_;
+}
+
+int main(int argc, char **argv) {
+
+  struct precision pr;        /* for precision parameters */
+  struct background ba;       /* for cosmological background */
+  struct thermo th;           /* for thermodynamics */
+  struct perturbs pt;         /* for source functions */
+  struct transfers tr;        /* for transfer functions */
+  struct primordial pm;       /* for primordial spectra */
+  struct spectra sp;          /* for output spectra */
+  struct nonlinear nl;        /* for non-linear spectra */
+  struct lensing le;          /* for lensed spectra */
+  struct output op;           /* for output files */
+  ErrorMsg errmsg;            /* for error messages */
+
+  int k_size=1000,index_k,index_run;
+  double * pk_reference;
+  char * command;
+  double k,pk,start,t_run[3],max_diff[3];
+  char * run_name[3] = {"command","command again (cache)","function"};
+
+  if (argc < 2) {
+    printf("Usage: %s model.ini\n",argv[0]);
+    return _FAILURE_;
+  }
+
+  if (input_init_from_arguments(argc,argv,&pr,&ba,&th,&pt,&tr,&pm,&sp,&nl,&le,&op,errmsg) == _FAILURE_) {
+    printf("\n\nError running input_init_from_arguments \n=>%s\n",errmsg);
+    return _FAILURE_;
+  }
+
+  if ((pm.primordial_spec_type != external_Pk) || (strncmp("cat ",pm.command,4) == 0)) {
+    printf("\n\nThis test requires an external_Pk primordial spectrum generated by a command (not cat)\n");
+    return _FAILURE_;
+  }
+
+  if (background_init(&pr,&ba) == _FAILURE_) {
+    printf("\n\nError running background_init \n=>%s\n",ba.error_message);
+    return _FAILURE_;
+  }
+
+  if (thermodynamics_init(&pr,&ba,&th) == _FAILURE_) {
+    printf("\n\nError in thermodynamics_init \n=>%s\n",th.error_message);
+    return _FAILURE_;
+  }
+
+  if (perturb_init(&pr,&ba,&th,&pt) == _FAILURE_) {
+    printf("\n\nError in perturb_init \n=>%s\n",pt.error_message);
+    return _FAILURE_;
+  }
+
+  pm.primordial_verbose = 0;
+  pk_reference = malloc(k_size*sizeof(double));
+
+  /* primordial_free() frees the command read by input_init() */
+  command = malloc(strlen(pm.command)+1);
+  strcpy(command,pm.command);
+
+  for (index_run=0; index_run<3; index_run++) {
+
+    pm.command = malloc(strlen(command)+1);
+    strcpy(pm.command,command);
+
+    if (index_run == 2) {
+      pm.external_pk_function = external_pk_power_law;
+      pm.external_pk_parameters = &pm;
+    }
+
+    start = external_pk_time();
+
+    if (primordial_init(&pr,&pt,&pm) == _FAILURE_) {
+      printf("\n\nError in primordial_init \n=>%s\n",pm.error_message);
+      return _FAILURE_;
+    }
+
+    t_run[index_run] = external_pk_time()-start;
+
+    max_diff[index_run] = 0.;
+    for (index_k=0; index_k<k_size; index_k++) {
+      k = pt.k_min*pow(pt.k_max/pt.k_min,(double)index_k/(k_size-1));
+      if (primordial_spectrum_at_k(&pm,pt.index_md_scalars,linear,k,&pk) == _FAILURE_) {
+        printf("\n\nError in primordial_spectrum_at_k \n=>%s\n",pm.error_message);
+        return _FAILURE_;
+      }
+      if (index_run == 0)
+        pk_reference[index_k] = pk;
+      max_diff[index_run] = MAX(max_diff[index_run],fabs(pk/pk_reference[index_k]-1.));
+    }
+
+    if (primordial_free(&pm) == _FAILURE_) {
+      printf("\n\nError in primordial_free \n=>%s\n",pm.error_message);
+      return _FAILURE_;
+    }
+
+    printf("%-22s: primordial_init() took %g s, largest relative difference with the first run %e\n",
+           run_name[index_run],t_run[index_run],max_diff[index_run]);
+  }
+
+  free(pk_reference);
+  free(command);
+
+  if (perturb_free(&pt) == _FAILURE_) {
+    printf("\n\nError in perturb_free \n=>%s\n",pt.error_message);
+    return _FAILURE_;
+  }
+
+  if (thermodynamics_free(&th) == _FAILURE_) {
+    printf("\n\nError in thermodynamics_free \n=>%s\n",th.error_message);
+    return _FAILURE_;
+  }
+
+  if (background_free(&ba) == _FAILURE_) {
+    printf("\n\nError in background_free \n=>%s\n",ba.error_message);
+    return _FAILURE_;
+  }
+
+  return _SUCCESS_;
+
+}
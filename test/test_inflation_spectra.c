@@ -0,0 +1,127 @@
+/** @file test_inflation_spectra.c
+ *
+ * Time the numerical computation of the primordial spectrum from
+ * inflation (types 'inflation_V', 'inflation_H' and 'inflation_V_end'),
+ * by calling primordial_init() repeatedly. The average time is printed,
+ * as well as the scalar and tensor spectra at the pivot scale.
+ *
+ * Usage: ./test_inflation_spectra model.ini [number of repetitions]
+ */
+
+#include "class.h"
+
+/* wall-clock time (s) */
+double inflation_spectra_time() {
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+int main(int argc, char **argv) {
+
+  struct precision pr;        /* for precision parameters */
+  struct background ba;       /* for cosmological background */
+  struct thermo th;           /* for thermodynamics */
+  struct perturbs pt;         /* for source functions */
+  struct transfers tr;        /* for transfer functions */
+  struct primordial pm;       /* for primordial spectra */
+  struct spectra sp;          /* for output spectra */
+  struct nonlinear nl;        /* for non-linear spectra */
+  struct lensing le;          /* for lensed spectra */
+  struct output op;           /* for output files */
+  ErrorMsg errmsg;            /* for error messages */
+
+  char * arguments[2];
+  int repeat=10,index_repeat;
+  double pk_scalar,pk_tensor,start,t_primordial=0.;
+
+  if (argc < 2) {
+    printf("Usage: %s model.ini [number of repetitions]\n",argv[0]);
+    return _FAILURE_;
+  }
+  if (argc > 2)
+    repeat = atoi(argv[2]);
+
+  arguments[0] = argv[0];
+  arguments[1] = argv[1];
+
+  if (input_init_from_arguments(2,arguments,&pr,&ba,&th,&pt,&tr,&pm,&sp,&nl,&le,&op,errmsg) == _FAILURE_) {
+    printf("\n\nError running input_init_from_arguments \n=>%s\n",errmsg);
+    return _FAILURE_;
+  }
+
+  if (((pm.primordial_spec_type != inflation_V) &&
+       (pm.primordial_spec_type != inflation_H) &&
+       (pm.primordial_spec_type != inflation_V_end)) ||
+      (pm.behavior != numerical)) {
+    printf("\n\nThis test requires a primordial spectrum computed numerically from inflation\n");
+    return _FAILURE_;
+  }
+
+  if (background_init(&pr,&ba) == _FAILURE_) {
+    printf("\n\nError running background_init \n=>%s\n",ba.error_message);
+    return _FAILURE_;
+  }
+
+  if (thermodynamics_init(&pr,&ba,&th) == _FAILURE_) {
+    printf("\n\nError in thermodynamics_init \n=>%s\n",th.error_message);
+    return _FAILURE_;
+  }
+
+  if (perturb_init(&pr,&ba,&th,&pt) == _FAILURE_) {
+    printf("\n\nError in perturb_init \n=>%s\n",pt.error_message);
+    return _FAILURE_;
+  }
+
+  pm.primordial_verbose = 0;
+
+  for (index_repeat=0; index_repeat<repeat; index_repeat++) {
+
+    start = inflation_spectra_time();
+
+    if (primordial_init(&pr,&pt,&pm) == _FAILURE_) {
+      printf("\n\nError in primordial_init \n=>%s\n",pm.error_message);
+      return _FAILURE_;
+    }
+
+    t_primordial += inflation_spectra_time()-start;
+
+    if (primordial_spectrum_at_k(&pm,pt.index_md_scalars,linear,pm.k_pivot,&pk_scalar) == _FAILURE_) {
+      printf("\n\nError in primordial_spectrum_at_k \n=>%s\n",pm.error_message);
+      return _FAILURE_;
+    }
+
+    if (primordial_spectrum_at_k(&pm,pt.index_md_tensors,linear,pm.k_pivot,&pk_tensor) == _FAILURE_) {
+      printf("\n\nError in primordial_spectrum_at_k \n=>%s\n",pm.error_message);
+      return _FAILURE_;
+    }
+
+    if (primordial_free(&pm) == _FAILURE_) {
+      printf("\n\nError in primordial_free \n=>%s\n",pm.error_message);
+      return _FAILURE_;
+    }
+  }
+
+  printf("%d wavenumbers: primordial_init() took %g s\n",pm.lnk_size,t_primordial/repeat);
+  printf("  P_R(k_pivot) = %.10e, P_h(k_pivot) = %.10e\n",pk_scalar,pk_tensor);
+
+  if (perturb_free(&pt) == _FAILURE_) {
+    printf("\n\nError in perturb_free \n=>%s\n",pt.error_message);
+    return _FAILURE_;
+  }
+
+  if (thermodynamics_free(&th) == _FAILURE_) {
+    printf("\n\nError in thermodynamics_free \n=>%s\n",th.error_message);
+    return _FAILURE_;
+  }
+
+  if (background_free(&ba) == _FAILURE_) {
+    printf("\n\nError in background_free \n=>%s\n",ba.error_message);
+    return _FAILURE_;
+  }
+
+  return _SUCCESS_;
+
+}
@@ -0,0 +1,136 @@
+/** @file test_interpolation_cursor.c
+ *
+ * Microbenchmark of the interpolation cursor of the arrays tool: for
+ * a growing and a decreasing table, and for sorted, slowly varying and
+ * random sequences of abscissae, compare the cost of
+ * array_interpolate_spline() (full bisection at each call) with
+ * array_interpolate_spline_hunt() (search starting from the interval
+ * of the previous call). The timings are printed, as well as the
+ * number of calls for which the two interpolated values or intervals
+ * differ (which should be zero).
+ *
+ * Usage: ./test_interpolation_cursor [number of lines] [number of calls]
+ */
+
+#include "common.h"
+#include "arrays.h"
+
+/* wall-clock time (s) */
+double cursor_time() {
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+int main(int argc, char **argv) {
+
+  ErrorMsg error_message;
+
+  int n_lines=3000,n_calls=1000000,n_columns=3;
+  int index_x,index_call,index_column,index_order,index_sequence;
+  int last_index_bisect,last_index_hunt,mismatch;
+  double *x_array,*array,*array_splined,*x_call,*result_bisect,*result_hunt;
+  double x_min,x_max,u,start,t_bisect,t_hunt;
+  char * order_name[2] = {"growing table","decreasing table"};
+  char * sequence_name[3] = {"sorted","slowly varying","random"};
+
+  if (argc > 1)
+    n_lines = atoi(argv[1]);
+  if (argc > 2)
+    n_calls = atoi(argv[2]);
+
+  x_array = malloc(n_lines*sizeof(double));
+  array = malloc(n_lines*n_columns*sizeof(double));
+  array_splined = malloc(n_lines*n_columns*sizeof(double));
+  x_call = malloc(n_calls*sizeof(double));
+  result_bisect = malloc(n_calls*n_columns*sizeof(double));
+  result_hunt = malloc(n_calls*n_columns*sizeof(double));
+
+  for (index_order=0; index_order<2; index_order++) {
+
+    /* non-uniform table, growing or decreasing */
+    for (index_x=0; index_x<n_lines; index_x++) {
+      u = (double)index_x/(n_lines-1);
+      x_array[(index_order == 0) ? index_x : n_lines-1-index_x] = exp(10.*u*u)-1.;
+    }
+    for (index_x=0; index_x<n_lines; index_x++) {
+      for (index_column=0; index_column<n_columns; index_column++)
+        array[index_x*n_columns+index_column] = sin((index_column+1.)*log(1.+x_array[index_x]));
+    }
+
+    if (array_spline_table_lines(x_array,n_lines,array,n_columns,array_splined,_SPLINE_NATURAL_,error_message) == _FAILURE_) {
+      printf("\n\nError in array_spline_table_lines \n=>%s\n",error_message);
+      return _FAILURE_;
+    }
+
+    x_min = MIN(x_array[0],x_array[n_lines-1]);
+    x_max = MAX(x_array[0],x_array[n_lines-1]);
+
+    for (index_sequence=0; index_sequence<3; index_sequence++) {
+
+      srand(1);
+      for (index_call=0; index_call<n_calls; index_call++) {
+        if (index_sequence == 0)
+          u = (double)index_call/(n_calls-1);
+        else if (index_sequence == 1)
+          u = 0.5+0.5*sin(20.*_PI_*index_call/n_calls);
+        else
+          u = (double)rand()/RAND_MAX;
+        x_call[index_call] = MAX(x_min,MIN(x_max,exp(10.*u)-1.));
+      }
+
+      start = cursor_time();
+      for (index_call=0; index_call<n_calls; index_call++) {
+        if (array_interpolate_spline(x_array,n_lines,array,array_splined,n_columns,x_call[index_call],
+                                     &last_index_bisect,result_bisect+index_call*n_columns,n_columns,error_message) == _FAILURE_) {
+          printf("\n\nError in array_interpolate_spline \n=>%s\n",error_message);
+          return _FAILURE_;
+        }
+      }
+      t_bisect = cursor_time()-start;
+
+      last_index_hunt = -1;
+      start = cursor_time();
+      for (index_call=0; index_call<n_calls; index_call++) {
+        if (array_interpolate_spline_hunt(x_array,n_lines,array,array_splined,n_columns,x_call[index_call],
+                                          &last_index_hunt,result_hunt+index_call*n_columns,n_columns,error_message) == _FAILURE_) {
+          printf("\n\nError in array_interpolate_spline_hunt \n=>%s\n",error_message);
+          return _FAILURE_;
+        }
+      }
+      t_hunt = cursor_time()-start;
+
+      /* compare the values, and the intervals found by the two searches */
+      mismatch = 0;
+      last_index_hunt = -1;
+      for (index_call=0; index_call<n_calls; index_call++) {
+        array_search_bisect(n_lines,x_array,x_call[index_call],&last_index_bisect,error_message);
+        array_search_hunt(n_lines,x_array,x_call[index_call],&last_index_hunt,error_message);
+        if (last_index_hunt != last_index_bisect)
+          mismatch++;
+        else {
+          for (index_column=0; index_column<n_columns; index_column++) {
+            if (result_hunt[index_call*n_columns+index_column] != result_bisect[index_call*n_columns+index_column]) {
+              mismatch++;
+              break;
+            }
+          }
+        }
+      }
+
+      printf("%s, %s abscissae: bisection %g s, cursor %g s (speed-up %.2f), %d mismatch(es) in %d calls\n",
+             order_name[index_order],sequence_name[index_sequence],t_bisect,t_hunt,t_bisect/t_hunt,mismatch,n_calls);
+    }
+  }
+
+  free(x_array);
+  free(array);
+  free(array_splined);
+  free(x_call);
+  free(result_bisect);
+  free(result_hunt);
+
+  return _SUCCESS_;
+}
@@ -0,0 +1,245 @@
+/** @file test_lensing_recompute.c
+ *
+ * Recompute the lensed C_l's for a lensing potential spectrum
+ * rescaled by a factor A_lens with lensing_recompute(), and compare
+ * with a full run in which the lensing potential is rescaled by
+ * sqrt(A_lens) in the transfer module (with lcmb_rescale). The
+ * timings of lensing_init() (first and second run, the latter keeping
+ * the d-functions in the cache if they fit) and of lensing_recompute()
+ * are printed, as well as the largest difference of the lensed C_l's.
+ *
+ * Usage: ./test_lensing_recompute model.ini [A_lens]
+ */
+
+#include "class.h"
+
+/* wall-clock time (s) */
+double lensing_recompute_time() {
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+int main(int argc, char **argv) {
+
+  struct precision pr;        /* for precision parameters */
+  struct background ba;       /* for cosmological background */
+  struct thermo th;           /* for thermodynamics */
+  struct perturbs pt;         /* for source functions */
+  struct transfers tr;        /* for transfer functions */
+  struct primordial pm;       /* for primordial spectra */
+  struct spectra sp;          /* for output spectra */
+  struct nonlinear nl;        /* for non-linear spectra */
+  struct lensing le;          /* for lensed spectra */
+  struct output op;           /* for output files */
+  ErrorMsg errmsg;            /* for error messages */
+
+  char * arguments[2];
+  double A_lens=1.1;
+  double * cl_tt;
+  double * cl_te;
+  double * cl_ee;
+  double * cl_bb;
+  double * cl_pp;
+  double * cl_recomputed;
+  int index_l,index_lt,l;
+  int lt_list[4];
+  int lt_num=0;
+  double start,t_first,t_second,t_recompute,max_diff;
+
+  if (argc < 2) {
+    printf("Usage: %s model.ini [A_lens]\n",argv[0]);
+    return _FAILURE_;
+  }
+  if (argc > 2)
+    A_lens = atof(argv[2]);
+
+  arguments[0] = argv[0];
+  arguments[1] = argv[1];
+
+  if (input_init_from_arguments(2,arguments,&pr,&ba,&th,&pt,&tr,&pm,&sp,&nl,&le,&op,errmsg) == _FAILURE_) {
+    printf("\n\nError running input_init_from_arguments \n=>%s\n",errmsg);
+    return _FAILURE_;
+  }
+
+  if (background_init(&pr,&ba) == _FAILURE_) {
+    printf("\n\nError running background_init \n=>%s\n",ba.error_message);
+    return _FAILURE_;
+  }
+
+  if (thermodynamics_init(&pr,&ba,&th) == _FAILURE_) {
+    printf("\n\nError in thermodynamics_init \n=>%s\n",th.error_message);
+    return _FAILURE_;
+  }
+
+  if (perturb_init(&pr,&ba,&th,&pt) == _FAILURE_) {
+    printf("\n\nError in perturb_init \n=>%s\n",pt.error_message);
+    return _FAILURE_;
+  }
+
+  if (primordial_init(&pr,&pt,&pm) == _FAILURE_) {
+    printf("\n\nError in primordial_init \n=>%s\n",pm.error_message);
+    return _FAILURE_;
+  }
+
+  if (nonlinear_init(&pr,&ba,&th,&pt,&pm,&nl) == _FAILURE_) {
+    printf("\n\nError in nonlinear_init \n=>%s\n",nl.error_message);
+    return _FAILURE_;
+  }
+
+  if (transfer_init(&pr,&ba,&th,&pt,&nl,&tr) == _FAILURE_) {
+    printf("\n\nError in transfer_init \n=>%s\n",tr.error_message);
+    return _FAILURE_;
+  }
+
+  if (spectra_init(&pr,&ba,&pt,&pm,&nl,&tr,&sp) == _FAILURE_) {
+    printf("\n\nError in spectra_init \n=>%s\n",sp.error_message);
+    return _FAILURE_;
+  }
+
+  if (le.has_lensed_cls == _FALSE_) {
+    printf("\n\nThis test requires lensed C_l's in the output\n");
+    return _FAILURE_;
+  }
+
+  le.lensing_verbose = 0;
+
+  /* first run, filling the cache */
+  start = lensing_recompute_time();
+
+  if (lensing_init(&pr,&pt,&sp,&nl,&le) == _FAILURE_) {
+    printf("\n\nError in lensing_init \n=>%s\n",le.error_message);
+    return _FAILURE_;
+  }
+
+  t_first = lensing_recompute_time()-start;
+
+  if (lensing_free(&le) == _FAILURE_) {
+    printf("\n\nError in lensing_free \n=>%s\n",le.error_message);
+    return _FAILURE_;
+  }
+
+  /* second run, reusing the cache */
+  start = lensing_recompute_time();
+
+  if (lensing_init(&pr,&pt,&sp,&nl,&le) == _FAILURE_) {
+    printf("\n\nError in lensing_init \n=>%s\n",le.error_message);
+    return _FAILURE_;
+  }
+
+  t_second = lensing_recompute_time()-start;
+
+  /* rescaled lensing potential */
+  if (lensing_unlensed_cls(&sp,&le,&cl_tt,&cl_te,&cl_ee,&cl_bb,&cl_pp) == _FAILURE_) {
+    printf("\n\nError in lensing_unlensed_cls \n=>%s\n",le.error_message);
+    return _FAILURE_;
+  }
+  for (l=2; l<=le.l_unlensed_max; l++)
+    cl_pp[l] *= A_lens;
+
+  start = lensing_recompute_time();
+
+  if (lensing_recompute(&pr,&sp,cl_pp,&le) == _FAILURE_) {
+    printf("\n\nError in lensing_recompute \n=>%s\n",le.error_message);
+    return _FAILURE_;
+  }
+
+  t_recompute = lensing_recompute_time()-start;
+
+  if (le.has_tt == _TRUE_) lt_list[lt_num++] = le.index_lt_tt;
+  if (le.has_te == _TRUE_) lt_list[lt_num++] = le.index_lt_te;
+  if (le.has_ee == _TRUE_) lt_list[lt_num++] = le.index_lt_ee;
+  if (le.has_bb == _TRUE_) lt_list[lt_num++] = le.index_lt_bb;
+
+  cl_recomputed = malloc(le.l_size*le.lt_size*sizeof(double));
+  for (index_l=0; index_l<le.l_size*le.lt_size; index_l++)
+    cl_recomputed[index_l] = le.cl_lens[index_l];
+
+  /* full run with the lensing potential rescaled in the transfer module */
+  if ((lensing_free(&le) == _FAILURE_) ||
+      (spectra_free(&sp) == _FAILURE_) ||
+      (transfer_free(&tr) == _FAILURE_)) {
+    printf("\n\nError in lensing_free, spectra_free or transfer_free\n");
+    return _FAILURE_;
+  }
+
+  tr.lcmb_rescale *= sqrt(A_lens);
+
+  if (transfer_init(&pr,&ba,&th,&pt,&nl,&tr) == _FAILURE_) {
+    printf("\n\nError in transfer_init \n=>%s\n",tr.error_message);
+    return _FAILURE_;
+  }
+
+  if (spectra_init(&pr,&ba,&pt,&pm,&nl,&tr,&sp) == _FAILURE_) {
+    printf("\n\nError in spectra_init \n=>%s\n",sp.error_message);
+    return _FAILURE_;
+  }
+
+  if (lensing_init(&pr,&pt,&sp,&nl,&le) == _FAILURE_) {
+    printf("\n\nError in lensing_init \n=>%s\n",le.error_message);
+    return _FAILURE_;
+  }
+
+  /* the BB and TE spectra cross zero: normalize each difference by the largest value of the spectrum */
+  max_diff = 0.;
+  for (index_lt=0; index_lt<lt_num; index_lt++) {
+    double cl_max = 0., diff = 0.;
+    for (index_l=0; index_l<le.l_size; index_l++) {
+      cl_max = MAX(cl_max,fabs(le.cl_lens[index_l*le.lt_size+lt_list[index_lt]]));
+      diff = MAX(diff,fabs(cl_recomputed[index_l*le.lt_size+lt_list[index_lt]]-le.cl_lens[index_l*le.lt_size+lt_list[index_lt]]));
+    }
+    max_diff = MAX(max_diff,diff/cl_max);
+  }
+
+  printf("lensing_init(): %g s (first run), %g s (second run)\n",t_first,t_second);
+  printf("lensing_recompute() with A_lens=%g: %g s, largest difference with a full run %e (relative to the largest C_l)\n",
+         A_lens,t_recompute,max_diff);
+
+  free(cl_tt);
+  free(cl_recomputed);
+
+  if (lensing_free(&le) == _FAILURE_) {
+    printf("\n\nError in lensing_free \n=>%s\n",le.error_message);
+    return _FAILURE_;
+  }
+
+  if (spectra_free(&sp) == _FAILURE_) {
+    printf("\n\nError in spectra_free \n=>%s\n",sp.error_message);
+    return _FAILURE_;
+  }
+
+  if (transfer_free(&tr) == _FAILURE_) {
+    printf("\n\nError in transfer_free \n=>%s\n",tr.error_message);
+    return _FAILURE_;
+  }
+
+  if (nonlinear_free(&nl) == _FAILURE_) {
+    printf("\n\nError in nonlinear_free \n=>%s\n",nl.error_message);
+    return _FAILURE_;
+  }
+
+  if (primordial_free(&pm) == _FAILURE_) {
+    printf("\n\nError in primordial_free \n=>%s\n",pm.error_message);
+    return _FAILURE_;
+  }
+
+  if (perturb_free(&pt) == _FAILURE_) {
+    printf("\n\nError in perturb_free \n=>%s\n",pt.error_message);
+    return _FAILURE_;
+  }
+
+  if (thermodynamics_free(&th) == _FAILURE_) {
+    printf("\n\nError in thermodynamics_free \n=>%s\n",th.error_message);
+    return _FAILURE_;
+  }
+
+  if (background_free(&ba) == _FAILURE_) {
+    printf("\n\nError in background_free \n=>%s\n",ba.error_message);
+    return _FAILURE_;
+  }
+
+  return _SUCCESS_;
+
+}
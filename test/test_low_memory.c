@@ -0,0 +1,256 @@
+/** @file test_low_memory.c
+ *
+ * Memory taken by each module, with and without the low_memory
+ * profile: run a few configurations twice, with low_memory = no and
+ * yes, each run in its own process so that its peak resident set size
+ * is its own. For each module, the memory kept by its structure at the
+ * end of the run (memory_size, after the tables freed by the
+ * low_memory profile) is printed, as well as the resident set size at
+ * the end of the run and its peak (the profile lowers the former: the
+ * peak is reached in transfer_init(), while the source functions are
+ * still in use), and the largest relative difference between the
+ * C_l's of the two runs, which should vanish.
+ *
+ * Usage: ./test_low_memory [configuration ...]
+ * (by default, all configurations)
+ */
+
+#include "class.h"
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define _LOW_MEMORY_L_NUM_ 8      /* number of multipoles at which the C_l's are compared */
+#define _LOW_MEMORY_CT_MAX_ 64    /* largest number of types of C_l's compared */
+
+/* one configuration, given by its parameters: name, value, name, value, ..., NULL */
+struct low_memory_configuration {
+  char * name;
+  char * parameters[24];
+};
+
+struct low_memory_configuration low_memory_matrix[] = {
+  {"lcdm",
+   {"output","tCl,pCl,lCl,mPk","lensing","yes","l_max_scalars","3000",
+    "non linear","halofit","P_k_max_h/Mpc","10",NULL}},
+  {"blocks",
+   {"output","tCl,pCl,lCl","lensing","yes","l_max_scalars","3000","transfer_l_block_size","200",NULL}},
+  {"number_counts",
+   {"output","nCl,sCl","selection","gaussian","selection_mean","0.5,1.0,1.5","selection_width","0.1",
+    "non_diagonal","2","l_max_lss","500",NULL}}
+};
+
+/* results of one run, sent by the process which does it */
+struct low_memory_result {
+  int status;
+  ErrorMsg error_message;
+  size_t memory_size[8];         /* memory kept by the structure of each module, in the order of class.c */
+  size_t rss;                    /* resident set size at the end of the run, before the structures are freed */
+  size_t peak_rss;               /* peak resident set size of the run */
+  int ct_size;
+  double cl[_LOW_MEMORY_L_NUM_][_LOW_MEMORY_CT_MAX_];
+};
+
+int low_memory_run(struct low_memory_configuration * pconf, short low_memory, struct low_memory_result * presult);
+
+int main(int argc, char **argv) {
+
+  int configuration_size = sizeof(low_memory_matrix)/sizeof(low_memory_matrix[0]);
+  int index_configuration,index_argument,index_run,index_module,index_l,index_ct,selected;
+  int status = _SUCCESS_;
+  int pipe_fd[2];
+  pid_t pid;
+  ssize_t bytes,read_bytes;
+  struct low_memory_result result[2];
+  double diff,norm,max_diff;
+  const char * module_name[8] = {"background","thermodynamics","perturb","primordial",
+                                 "nonlinear","transfer","spectra","lensing"};
+
+  for (index_configuration=0; index_configuration<configuration_size; index_configuration++) {
+
+    /* only the configurations given in argument, if any */
+    selected = (argc <= 1);
+    for (index_argument=1; index_argument<argc; index_argument++)
+      if (strcmp(argv[index_argument],low_memory_matrix[index_configuration].name) == 0)
+        selected = _TRUE_;
+    if (selected == _FALSE_)
+      continue;
+
+    for (index_run=0; index_run<2; index_run++) {
+
+      /* run the configuration in a child process, which sends back its results */
+      if (pipe(pipe_fd) != 0) {
+        printf("\n\nError: could not create a pipe\n");
+        return _FAILURE_;
+      }
+
+      pid = fork();
+
+      if (pid < 0) {
+        printf("\n\nError: could not fork\n");
+        return _FAILURE_;
+      }
+
+      if (pid == 0) {
+        close(pipe_fd[0]);
+        low_memory_run(&(low_memory_matrix[index_configuration]),index_run,&(result[index_run]));
+        bytes = write(pipe_fd[1],&(result[index_run]),sizeof(struct low_memory_result));
+        close(pipe_fd[1]);
+        _exit(bytes == sizeof(struct low_memory_result) ? 0 : 1);
+      }
+
+      close(pipe_fd[1]);
+      bytes = 0;
+      while (bytes < (ssize_t)sizeof(struct low_memory_result)) {
+        read_bytes = read(pipe_fd[0],(char*)&(result[index_run])+bytes,sizeof(struct low_memory_result)-bytes);
+        if (read_bytes <= 0)
+          break;
+        bytes += read_bytes;
+      }
+      close(pipe_fd[0]);
+      waitpid(pid,NULL,0);
+
+      if (bytes != sizeof(struct low_memory_result)) {
+        result[index_run].status = _FAILURE_;
+        sprintf(result[index_run].error_message,"the process stopped before sending its results");
+      }
+    }
+
+    printf("%s:\n",low_memory_matrix[index_configuration].name);
+
+    if ((result[0].status == _FAILURE_) || (result[1].status == _FAILURE_)) {
+      printf("  failed: %s\n",(result[0].status == _FAILURE_) ? result[0].error_message : result[1].error_message);
+      status = _FAILURE_;
+      continue;
+    }
+
+    printf("  %-16s %14s %14s\n","memory (MB)","low_memory=no","low_memory=yes");
+    for (index_module=0; index_module<8; index_module++)
+      printf("  %-16s %14.2f %14.2f\n",module_name[index_module],
+             result[0].memory_size[index_module]/1048576.,result[1].memory_size[index_module]/1048576.);
+    printf("  %-16s %14.2f %14.2f\n","RSS",result[0].rss/1048576.,result[1].rss/1048576.);
+    printf("  %-16s %14.2f %14.2f\n","peak RSS",result[0].peak_rss/1048576.,result[1].peak_rss/1048576.);
+
+    /* largest difference of the C_l's, relative to the largest value of each type */
+    max_diff = 0.;
+    for (index_ct=0; index_ct<result[0].ct_size; index_ct++) {
+      norm = 0.;
+      diff = 0.;
+      for (index_l=0; index_l<_LOW_MEMORY_L_NUM_; index_l++) {
+        norm = MAX(norm,fabs(result[0].cl[index_l][index_ct]));
+        diff = MAX(diff,fabs(result[1].cl[index_l][index_ct]-result[0].cl[index_l][index_ct]));
+      }
+      if (norm > 0.)
+        max_diff = MAX(max_diff,diff/norm);
+    }
+    printf("  largest relative difference of the C_l's: %e\n",max_diff);
+
+    if ((max_diff > 0.) || (result[0].ct_size != result[1].ct_size)) {
+      printf("  -> the C_l's differ\n");
+      status = _FAILURE_;
+    }
+  }
+
+  return status;
+}
+
+/**
+ * Run one configuration, with or without the low_memory profile, and
+ * record the memory of each module, the peak resident set size and a
+ * few C_l's.
+ */
+
+int low_memory_run(struct low_memory_configuration * pconf, short low_memory, struct low_memory_result * presult) {
+
+  struct file_content fc;
+  struct precision pr;
+  struct background ba;
+  struct thermo th;
+  struct perturbs pt;
+  struct transfers tr;
+  struct primordial pm;
+  struct spectra sp;
+  struct nonlinear nl;
+  struct lensing le;
+  struct output op;
+  int index_parameter,parameter_size,index_l,index_ct,l_max;
+  double * cl;
+
+  presult->status = _FAILURE_;
+  presult->ct_size = 0;
+  strcpy(presult->error_message,"");
+
+  parameter_size = 0;
+  while (pconf->parameters[2*parameter_size] != NULL)
+    parameter_size++;
+
+  class_call(parser_init(&fc,parameter_size+1,"low_memory",presult->error_message),
+             presult->error_message,
+             presult->error_message);
+  for (index_parameter=0; index_parameter<parameter_size; index_parameter++) {
+    strcpy(fc.name[index_parameter],pconf->parameters[2*index_parameter]);
+    strcpy(fc.value[index_parameter],pconf->parameters[2*index_parameter+1]);
+  }
+  strcpy(fc.name[parameter_size],"low_memory");
+  strcpy(fc.value[parameter_size],(low_memory == _TRUE_) ? "yes" : "no");
+
+  class_call(input_init(&fc,&pr,&ba,&th,&pt,&tr,&pm,&sp,&nl,&le,&op,presult->error_message),
+             presult->error_message,
+             presult->error_message);
+
+  ba.background_verbose = 0;
+  th.thermodynamics_verbose = 0;
+  pt.perturbations_verbose = 0;
+  pm.primordial_verbose = 0;
+  nl.nonlinear_verbose = 0;
+  tr.transfer_verbose = 0;
+  sp.spectra_verbose = 0;
+  le.lensing_verbose = 0;
+
+  class_call(background_init(&pr,&ba),ba.error_message,presult->error_message);
+  class_call(thermodynamics_init(&pr,&ba,&th),th.error_message,presult->error_message);
+  class_call(perturb_init(&pr,&ba,&th,&pt),pt.error_message,presult->error_message);
+  class_call(primordial_init(&pr,&pt,&pm),pm.error_message,presult->error_message);
+  class_call(nonlinear_init(&pr,&ba,&th,&pt,&pm,&nl),nl.error_message,presult->error_message);
+  class_call(transfer_init(&pr,&ba,&th,&pt,&nl,&tr),tr.error_message,presult->error_message);
+  class_call(spectra_init(&pr,&ba,&pt,&pm,&nl,&tr,&sp),sp.error_message,presult->error_message);
+  class_call(lensing_init(&pr,&pt,&sp,&nl,&le),le.error_message,presult->error_message);
+
+  presult->memory_size[0] = ba.memory_size;
+  presult->memory_size[1] = th.memory_size;
+  presult->memory_size[2] = pt.memory_size;
+  presult->memory_size[3] = pm.memory_size;
+  presult->memory_size[4] = nl.memory_size;
+  presult->memory_size[5] = tr.memory_size;
+  presult->memory_size[6] = sp.memory_size;
+  presult->memory_size[7] = le.memory_size;
+  class_call(class_memory_rss(&(presult->rss),&(presult->peak_rss)),
+             presult->error_message,
+             presult->error_message);
+
+  /* total unlensed C_l's at a few multipoles */
+  presult->ct_size = MIN(sp.ct_size,_LOW_MEMORY_CT_MAX_);
+  l_max = sp.l_max_tot;
+  class_alloc(cl,sp.ct_size*sizeof(double),presult->error_message);
+  for (index_l=0; index_l<_LOW_MEMORY_L_NUM_; index_l++) {
+    class_call(spectra_cl_at_l(&sp,2+(double)(l_max-2)*index_l/(_LOW_MEMORY_L_NUM_-1),cl,NULL,NULL),
+               sp.error_message,
+               presult->error_message);
+    for (index_ct=0; index_ct<presult->ct_size; index_ct++)
+      presult->cl[index_l][index_ct] = cl[index_ct];
+  }
+  free(cl);
+
+  class_call(lensing_free(&le),le.error_message,presult->error_message);
+  class_call(spectra_free(&sp),sp.error_message,presult->error_message);
+  class_call(transfer_free(&tr),tr.error_message,presult->error_message);
+  class_call(nonlinear_free(&nl),nl.error_message,presult->error_message);
+  class_call(primordial_free(&pm),pm.error_message,presult->error_message);
+  class_call(perturb_free(&pt),pt.error_message,presult->error_message);
+  class_call(thermodynamics_free(&th),th.error_message,presult->error_message);
+  class_call(background_free(&ba),ba.error_message,presult->error_message);
+  parser_free(&fc);
+
+  presult->status = _SUCCESS_;
+
+  return _SUCCESS_;
+}
@@ -0,0 +1,386 @@
+/** @file test_lrs_bench.c
+ *
+ * Micro-benchmarks of the longrange module: momentum integrals,
+ * scalar field solution, instability onset and a full background_init()
+ * with a long-range scalar. The timings are printed and written in
+ * JSON format to <root>lrs_bench.json, so that they can be compared
+ * between versions.
+ *
+ * Usage: ./test_lrs_bench model.ini [model.pre]
+ * (the model must have longrangescalar = yes)
+ */
+
+#include "class.h"
+#include "longrange.h"
+
+/* minimum duration of each timing loop (s) */
+#define _LRS_BENCH_MIN_TIME_ 0.2
+/* number of redshifts in the benchmark grid */
+#define _LRS_BENCH_Z_SIZE_ 256
+/* momentum sampling sizes used to measure the scaling with q_size_lrs_bg */
+#define _LRS_BENCH_Q_SIZES_ 6
+
+struct lrs_bench_timing {
+  long int calls;      /**< number of calls in the timing loop */
+  double ns_per_call;  /**< time per call (ns) */
+};
+
+/* the result of each call is accumulated here, so that the compiler does not skip them */
+double lrs_bench_checksum = 0.;
+
+int lrs_bench_moments(struct background * pba, double * q, double * w, int q_size,
+                      double * z, int z_size, struct lrs_bench_timing * ptiming);
+int lrs_bench_phi_M(struct background * pba, double * z, int z_size,
+                    struct lrs_bench_timing * ptiming, double * fevals_per_solve);
+int lrs_bench_onset(struct background * pba, struct lrs_bench_timing * ptiming);
+int lrs_bench_background_init(struct precision * ppr, struct background * pba,
+                              struct lrs_bench_timing * ptiming);
+int lrs_bench_print_timing(FILE * json, char * name, struct lrs_bench_timing * ptiming);
+
+int main(int argc, char **argv) {
+
+  struct precision pr;        /* for precision parameters */
+  struct background ba;       /* for cosmological background */
+  struct thermo th;           /* for thermodynamics */
+  struct perturbs pt;         /* for source functions */
+  struct transfers tr;        /* for transfer functions */
+  struct primordial pm;       /* for primordial spectra */
+  struct spectra sp;          /* for output spectra */
+  struct nonlinear nl;        /* for non-linear spectra */
+  struct lensing le;          /* for lensed spectra */
+  struct output op;           /* for output files */
+  ErrorMsg errmsg;            /* for error messages */
+
+  struct lrs_bench_timing moments, phi_table, phi_ridder, phi_newton, onset, bg_init;
+  struct lrs_bench_timing moments_q[_LRS_BENCH_Q_SIZES_], bg_init_q[_LRS_BENCH_Q_SIZES_];
+  double fevals_ridder, fevals_newton, fevals_table;
+  int q_sizes[_LRS_BENCH_Q_SIZES_] = {4, 8, 16, 32, 64, 128};
+  double z[_LRS_BENCH_Z_SIZE_];
+  double *q_bg, *w_bg;
+  double *q, *w;
+  int q_size_bg, phi_table_size, index_z, index_q_size;
+  enum lrs_phi_solver phi_solver;
+  char filename[_FILENAMESIZE_];
+  FILE * json;
+  struct background_parameters_for_distributions pbadist;
+
+  if (input_init_from_arguments(argc, argv,&pr,&ba,&th,&pt,&tr,&pm,&sp,&nl,&le,&op,errmsg) == _FAILURE_) {
+    printf("\n\nError running input_init_from_arguments \n=>%s\n",errmsg);
+    return _FAILURE_;
+  }
+
+  if (ba.has_lrs == _FALSE_) {
+    printf("\n\nThis benchmark requires a model with longrangescalar = yes\n");
+    return _FAILURE_;
+  }
+
+  ba.background_verbose = 0;
+
+  /* redshift grid, logarithmic in 1+z */
+  for (index_z=0; index_z<_LRS_BENCH_Z_SIZE_; index_z++)
+    z[index_z] = exp(log(1.e4)*index_z/(_LRS_BENCH_Z_SIZE_-1.))-1.;
+
+  /** - momentum integrals with the background sampling of the model */
+  if (lrs_bench_moments(&ba,ba.q_lrs_bg,ba.w_lrs_bg,ba.q_size_lrs_bg,z,_LRS_BENCH_Z_SIZE_,&moments) == _FAILURE_) {
+    printf("\n\nError in lrs_bench_moments \n=>%s\n",ba.error_message);
+    return _FAILURE_;
+  }
+
+  /** - scalar field: interpolation in the table, then solution of the
+      field equation at each call with both solvers */
+  phi_table_size = ba.lrs_phi_table_size;
+  phi_solver = ba.lrs_phi_solver;
+
+  if (lrs_bench_phi_M(&ba,z,_LRS_BENCH_Z_SIZE_,&phi_table,&fevals_table) == _FAILURE_) {
+    printf("\n\nError in lrs_bench_phi_M \n=>%s\n",ba.error_message);
+    return _FAILURE_;
+  }
+
+  ba.lrs_phi_table_size = 0;
+
+  ba.lrs_phi_solver = lrs_phi_ridder;
+  if (lrs_bench_phi_M(&ba,z,_LRS_BENCH_Z_SIZE_,&phi_ridder,&fevals_ridder) == _FAILURE_) {
+    printf("\n\nError in lrs_bench_phi_M \n=>%s\n",ba.error_message);
+    return _FAILURE_;
+  }
+
+  ba.lrs_phi_solver = lrs_phi_newton;
+  if (lrs_bench_phi_M(&ba,z,_LRS_BENCH_Z_SIZE_,&phi_newton,&fevals_newton) == _FAILURE_) {
+    printf("\n\nError in lrs_bench_phi_M \n=>%s\n",ba.error_message);
+    return _FAILURE_;
+  }
+
+  ba.lrs_phi_table_size = phi_table_size;
+  ba.lrs_phi_solver = phi_solver;
+
+  /** - instability onset */
+  if (lrs_bench_onset(&ba,&onset) == _FAILURE_) {
+    printf("\n\nError in lrs_bench_onset \n=>%s\n",ba.error_message);
+    return _FAILURE_;
+  }
+
+  /** - full background */
+  if (lrs_bench_background_init(&pr,&ba,&bg_init) == _FAILURE_) {
+    printf("\n\nError in lrs_bench_background_init \n=>%s\n",ba.error_message);
+    return _FAILURE_;
+  }
+
+  /** - scaling with the size of the background momentum sampling,
+      using trapezoidal samplings (in 1/(1+q)) of increasing size in place of the
+      one of the model */
+  pbadist.pba = &ba;
+  pbadist.q = NULL;
+  pbadist.tablesize = 0;
+
+  q_bg = ba.q_lrs_bg;
+  w_bg = ba.w_lrs_bg;
+  q_size_bg = ba.q_size_lrs_bg;
+
+  for (index_q_size=0; index_q_size<_LRS_BENCH_Q_SIZES_; index_q_size++) {
+
+    class_alloc(q,q_sizes[index_q_size]*sizeof(double),errmsg);
+    class_alloc(w,q_sizes[index_q_size]*sizeof(double),errmsg);
+
+    if (get_qsampling_manual(q,w,q_sizes[index_q_size],ba.lrs_qmax,qm_trapz_indefinite,NULL,0,
+                             background_lrs_distribution,&pbadist,errmsg) == _FAILURE_) {
+      printf("\n\nError in get_qsampling_manual \n=>%s\n",errmsg);
+      return _FAILURE_;
+    }
+
+    ba.q_lrs_bg = q;
+    ba.w_lrs_bg = w;
+    ba.q_size_lrs_bg = q_sizes[index_q_size];
+
+    if (lrs_bench_moments(&ba,q,w,q_sizes[index_q_size],z,_LRS_BENCH_Z_SIZE_,&(moments_q[index_q_size])) == _FAILURE_) {
+      printf("\n\nError in lrs_bench_moments \n=>%s\n",ba.error_message);
+      return _FAILURE_;
+    }
+
+    if (lrs_bench_background_init(&pr,&ba,&(bg_init_q[index_q_size])) == _FAILURE_) {
+      printf("\n\nError in lrs_bench_background_init \n=>%s\n",ba.error_message);
+      return _FAILURE_;
+    }
+
+    free(q);
+    free(w);
+  }
+
+  ba.q_lrs_bg = q_bg;
+  ba.w_lrs_bg = w_bg;
+  ba.q_size_lrs_bg = q_size_bg;
+
+  /** - human-readable summary */
+  printf("lrs benchmark (g_over_M=%e 1/eV, M_phi=%e eV, m_F=%e eV, q_size_lrs_bg=%d, %d threads)\n",
+         ba.lrs_g_over_M,ba.lrs_M_phi,ba.lrs_m_F,ba.q_size_lrs_bg,omp_get_max_threads());
+  printf(" background_lrs_moments (all moments)   %12.1f ns/call\n",moments.ns_per_call);
+  printf(" get_phi_M_lrs (table)                  %12.1f ns/call\n",phi_table.ns_per_call);
+  printf(" get_phi_M_lrs (Ridder)                 %12.1f ns/call, %.2f residual evaluations/solve\n",
+         phi_ridder.ns_per_call,fevals_ridder);
+  printf(" get_phi_M_lrs (Newton)                 %12.1f ns/call, %.2f residual evaluations/solve\n",
+         phi_newton.ns_per_call,fevals_newton);
+  printf(" instabilityOnset_lrs                   %12.1f ns/call\n",onset.ns_per_call);
+  printf(" background_init                        %12.1f ns/call\n",bg_init.ns_per_call);
+  for (index_q_size=0; index_q_size<_LRS_BENCH_Q_SIZES_; index_q_size++)
+    printf(" q_size_lrs_bg=%3d: background_lrs_moments %12.1f ns/call, background_init %12.1f ns/call\n",
+           q_sizes[index_q_size],moments_q[index_q_size].ns_per_call,bg_init_q[index_q_size].ns_per_call);
+
+  /** - machine-readable output */
+  sprintf(filename,"%slrs_bench.json",op.root);
+  class_open(json,filename,"w",errmsg);
+
+  fprintf(json,"{\n");
+  fprintf(json,"  \"parameters\": {\"lrs_g_over_M\": %.10e, \"lrs_M_phi\": %.10e, \"lrs_m_F\": %.10e, \"lrs_T_F\": %.10e, \"lrs_g_F\": %d},\n",
+          ba.lrs_g_over_M,ba.lrs_M_phi,ba.lrs_m_F,ba.lrs_T_F,ba.lrs_g_F);
+  fprintf(json,"  \"q_size_lrs_bg\": %d,\n",ba.q_size_lrs_bg);
+  fprintf(json,"  \"z_size\": %d,\n",_LRS_BENCH_Z_SIZE_);
+  fprintf(json,"  \"threads\": %d,\n",omp_get_max_threads());
+  lrs_bench_print_timing(json,"background_lrs_moments",&moments);
+  lrs_bench_print_timing(json,"get_phi_M_lrs_table",&phi_table);
+  lrs_bench_print_timing(json,"get_phi_M_lrs_ridder",&phi_ridder);
+  fprintf(json,"  \"ridder_evaluations_per_solve\": %.4f,\n",fevals_ridder);
+  lrs_bench_print_timing(json,"get_phi_M_lrs_newton",&phi_newton);
+  fprintf(json,"  \"newton_evaluations_per_solve\": %.4f,\n",fevals_newton);
+  lrs_bench_print_timing(json,"instabilityOnset_lrs",&onset);
+  lrs_bench_print_timing(json,"background_init",&bg_init);
+  fprintf(json,"  \"q_size_scaling\": [\n");
+  for (index_q_size=0; index_q_size<_LRS_BENCH_Q_SIZES_; index_q_size++)
+    fprintf(json,"    {\"q_size_lrs_bg\": %d, \"background_lrs_moments_ns_per_call\": %.2f, \"background_init_ns_per_call\": %.2f}%s\n",
+            q_sizes[index_q_size],moments_q[index_q_size].ns_per_call,bg_init_q[index_q_size].ns_per_call,
+            (index_q_size<_LRS_BENCH_Q_SIZES_-1) ? "," : "");
+  fprintf(json,"  ],\n");
+  fprintf(json,"  \"checksum\": %.10e\n",lrs_bench_checksum);
+  fprintf(json,"}\n");
+
+  fclose(json);
+
+  printf(" -> written %s\n",filename);
+
+  /****** all calculations done, now free the structures ******/
+
+  if (background_free_input(&ba) == _FAILURE_) {
+    printf("\n\nError in background_free_input \n=>%s\n",ba.error_message);
+    return _FAILURE_;
+  }
+
+  return _SUCCESS_;
+
+}
+
+/**
+ * Time background_lrs_moments() with all moments requested, on a
+ * grid of redshifts along the background trajectory.
+ */
+
+int lrs_bench_moments(struct background * pba, double * q, double * w, int q_size,
+                      double * z, int z_size, struct lrs_bench_timing * ptiming) {
+
+  int index_z, repeat, n_repeat;
+  double phi_M, start, time;
+  double * mT_over_T0;
+  struct lrs_moments mom;
+
+  class_alloc(mT_over_T0,z_size*sizeof(double),pba->error_message);
+
+  for (index_z=0; index_z<z_size; index_z++) {
+    class_call(get_phi_M_lrs(pba,z[index_z],&phi_M),
+               pba->error_message,
+               pba->error_message);
+    mT_over_T0[index_z] = get_mT_over_T0_lrs(pba,phi_M);
+  }
+
+  n_repeat = 1;
+  do {
+    start = omp_get_wtime();
+    for (repeat=0; repeat<n_repeat; repeat++) {
+      for (index_z=0; index_z<z_size; index_z++) {
+        class_call(background_lrs_moments(q,w,q_size,mT_over_T0[index_z],pba->factor_lrs,z[index_z],
+                                          lrs_mom_rho | lrs_mom_p | lrs_mom_I_Mphi | lrs_mom_pseudo_p | lrs_mom_I1 | lrs_mom_I2,
+                                          &mom),
+                   pba->error_message,
+                   pba->error_message);
+        lrs_bench_checksum += mom.rho;
+      }
+    }
+    time = omp_get_wtime()-start;
+    n_repeat *= 2;
+  } while (time < _LRS_BENCH_MIN_TIME_);
+
+  ptiming->calls = (long int)n_repeat/2*z_size;
+  ptiming->ns_per_call = time/ptiming->calls*1.e9;
+
+  free(mT_over_T0);
+
+  return _SUCCESS_;
+}
+
+/**
+ * Time get_phi_M_lrs() on a grid of redshifts, and count the residual
+ * evaluations per solution of the field equation (zero if the table
+ * is used).
+ */
+
+int lrs_bench_phi_M(struct background * pba, double * z, int z_size,
+                    struct lrs_bench_timing * ptiming, double * fevals_per_solve) {
+
+  int index_z, repeat, n_repeat;
+  double phi_M, start, time;
+
+  n_repeat = 1;
+  do {
+    pba->lrs_phi_solves = 0;
+    pba->lrs_phi_fevals = 0;
+    start = omp_get_wtime();
+    for (repeat=0; repeat<n_repeat; repeat++) {
+      for (index_z=0; index_z<z_size; index_z++) {
+        class_call(get_phi_M_lrs(pba,z[index_z],&phi_M),
+                   pba->error_message,
+                   pba->error_message);
+        lrs_bench_checksum += phi_M;
+      }
+    }
+    time = omp_get_wtime()-start;
+    n_repeat *= 2;
+  } while (time < _LRS_BENCH_MIN_TIME_);
+
+  ptiming->calls = (long int)n_repeat/2*z_size;
+  ptiming->ns_per_call = time/ptiming->calls*1.e9;
+
+  if (pba->lrs_phi_solves > 0)
+    *fevals_per_solve = (double)pba->lrs_phi_fevals/pba->lrs_phi_solves;
+  else
+    *fevals_per_solve = 0.;
+
+  return _SUCCESS_;
+}
+
+/**
+ * Time instabilityOnset_lrs().
+ */
+
+int lrs_bench_onset(struct background * pba, struct lrs_bench_timing * ptiming) {
+
+  int repeat, n_repeat;
+  double a_unstable, start, time;
+
+  n_repeat = 1;
+  do {
+    start = omp_get_wtime();
+    for (repeat=0; repeat<n_repeat; repeat++) {
+      class_call(instabilityOnset_lrs(pba,&a_unstable),
+                 pba->error_message,
+                 pba->error_message);
+      lrs_bench_checksum += a_unstable;
+    }
+    time = omp_get_wtime()-start;
+    n_repeat *= 2;
+  } while (time < _LRS_BENCH_MIN_TIME_);
+
+  ptiming->calls = (long int)n_repeat/2;
+  ptiming->ns_per_call = time/ptiming->calls*1.e9;
+
+  return _SUCCESS_;
+}
+
+/**
+ * Time a full background_init(), followed by background_free_noinput().
+ */
+
+int lrs_bench_background_init(struct precision * ppr, struct background * pba,
+                              struct lrs_bench_timing * ptiming) {
+
+  int repeat, n_repeat;
+  double start, time;
+
+  n_repeat = 1;
+  do {
+    start = omp_get_wtime();
+    for (repeat=0; repeat<n_repeat; repeat++) {
+      class_call(background_init(ppr,pba),
+                 pba->error_message,
+                 pba->error_message);
+      lrs_bench_checksum += pba->conformal_age;
+      class_call(background_free_noinput(pba),
+                 pba->error_message,
+                 pba->error_message);
+    }
+    time = omp_get_wtime()-start;
+    n_repeat *= 2;
+  } while (time < _LRS_BENCH_MIN_TIME_);
+
+  ptiming->calls = (long int)n_repeat/2;
+  ptiming->ns_per_call = time/ptiming->calls*1.e9;
+
+  return _SUCCESS_;
+}
+
+/**
+ * Write one timing as a JSON member.
+ */
+
+int lrs_bench_print_timing(FILE * json, char * name, struct lrs_bench_timing * ptiming) {
+
+  fprintf(json,"  \"%s\": {\"calls\": %ld, \"ns_per_call\": %.2f},\n",
+          name,ptiming->calls,ptiming->ns_per_call);
+
+  return _SUCCESS_;
+}
@@ -0,0 +1,168 @@
+/** @file test_perturbations_batch.c
+ *
+ * Compute the source functions of several models with
+ * perturb_init_batch(), and compare with separate calls of
+ * perturb_init(): the timings of both are printed, as well as the
+ * largest difference between the sources of the first model. These
+ * have the same k and tau samplings in both cases, hence should be
+ * identical: the test fails otherwise.
+ *
+ * Usage: ./test_perturbations_batch model1.ini model2.ini [model3.ini ...]
+ */
+
+#include "class.h"
+
+/* wall-clock time (s) */
+double batch_time() {
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+int main(int argc, char **argv) {
+
+  struct precision * pr;      /* for precision parameters */
+  struct background * ba;     /* for cosmological background */
+  struct thermo * th;         /* for thermodynamics */
+  struct perturbs * pt;       /* for source functions, computed in batch */
+  struct perturbs * pt_single;/* for source functions, computed separately */
+  struct transfers tr;        /* for transfer functions */
+  struct primordial pm;       /* for primordial spectra */
+  struct spectra sp;          /* for output spectra */
+  struct nonlinear nl;        /* for non-linear spectra */
+  struct lensing le;          /* for lensed spectra */
+  struct output op;           /* for output files */
+  struct precision pr_tmp;
+  struct background ba_tmp;
+  struct thermo th_tmp;
+  ErrorMsg errmsg;            /* for error messages */
+
+  char * arguments[2];
+  int batch_size,index_model,index_md,index_ic_tp,index_tau_k;
+  double t_batch,t_single,diff,max_diff,max_source;
+  double start;
+
+  if (argc < 3) {
+    printf("Usage: %s model1.ini model2.ini [model3.ini ...]\n",argv[0]);
+    return _FAILURE_;
+  }
+
+  batch_size = argc-1;
+
+  pr = malloc(batch_size*sizeof(struct precision));
+  ba = malloc(batch_size*sizeof(struct background));
+  th = malloc(batch_size*sizeof(struct thermo));
+  pt = malloc(batch_size*sizeof(struct perturbs));
+  pt_single = malloc(batch_size*sizeof(struct perturbs));
+
+  /* read each model twice, once for each perturbation structure */
+  for (index_model = 0; index_model < batch_size; index_model++) {
+
+    arguments[0] = argv[0];
+    arguments[1] = argv[index_model+1];
+
+    if (input_init_from_arguments(2,arguments,&(pr[index_model]),&(ba[index_model]),&(th[index_model]),&(pt[index_model]),&tr,&pm,&sp,&nl,&le,&op,errmsg) == _FAILURE_) {
+      printf("\n\nError running input_init_from_arguments for %s\n=>%s\n",arguments[1],errmsg);
+      return _FAILURE_;
+    }
+
+    if (input_init_from_arguments(2,arguments,&pr_tmp,&ba_tmp,&th_tmp,&(pt_single[index_model]),&tr,&pm,&sp,&nl,&le,&op,errmsg) == _FAILURE_) {
+      printf("\n\nError running input_init_from_arguments for %s\n=>%s\n",arguments[1],errmsg);
+      return _FAILURE_;
+    }
+
+    if (background_init(&(pr[index_model]),&(ba[index_model])) == _FAILURE_) {
+      printf("\n\nError running background_init \n=>%s\n",ba[index_model].error_message);
+      return _FAILURE_;
+    }
+
+    if (thermodynamics_init(&(pr[index_model]),&(ba[index_model]),&(th[index_model])) == _FAILURE_) {
+      printf("\n\nError in thermodynamics_init \n=>%s\n",th[index_model].error_message);
+      return _FAILURE_;
+    }
+  }
+
+  /* all models at once */
+  start = batch_time();
+
+  if (perturb_init_batch(pr,ba,th,pt,batch_size) == _FAILURE_) {
+    printf("\n\nError in perturb_init_batch \n=>%s\n",pt[0].error_message);
+    return _FAILURE_;
+  }
+
+  t_batch = batch_time()-start;
+
+  /* one model after the other */
+  start = batch_time();
+
+  for (index_model = 0; index_model < batch_size; index_model++) {
+    if (perturb_init(&(pr[index_model]),&(ba[index_model]),&(th[index_model]),&(pt_single[index_model])) == _FAILURE_) {
+      printf("\n\nError in perturb_init \n=>%s\n",pt_single[index_model].error_message);
+      return _FAILURE_;
+    }
+  }
+
+  t_single = batch_time()-start;
+
+  /* the first model has the same samplings in both cases */
+  max_diff = 0.;
+  max_source = 0.;
+
+  if (pt[0].has_perturbations == _TRUE_) {
+    for (index_md = 0; index_md < pt[0].md_size; index_md++) {
+      for (index_ic_tp = 0; index_ic_tp < pt[0].ic_size[index_md]*pt[0].tp_size[index_md]; index_ic_tp++) {
+        for (index_tau_k = 0; index_tau_k < pt[0].tau_size*pt[0].k_size[index_md]; index_tau_k++) {
+          diff = fabs(_get_source_(&(pt[0]),index_md,index_ic_tp,index_tau_k)
+                      -_get_source_(&(pt_single[0]),index_md,index_ic_tp,index_tau_k));
+          max_diff = MAX(max_diff,diff);
+          max_source = MAX(max_source,fabs(_get_source_(&(pt_single[0]),index_md,index_ic_tp,index_tau_k)));
+        }
+      }
+    }
+  }
+
+  printf("%d models: perturb_init_batch() took %g s, separate perturb_init() calls took %g s\n",
+         batch_size,t_batch,t_single);
+  printf("largest difference between the sources of the first model: %e (largest source: %e)\n",
+         max_diff,max_source);
+
+  if (max_diff != 0.) {
+    printf("\n\nError: the sources of the first model differ between perturb_init_batch() and perturb_init()\n");
+    return _FAILURE_;
+  }
+
+  /* free everything */
+  if (perturb_free_batch(pt,batch_size) == _FAILURE_) {
+    printf("\n\nError in perturb_free_batch \n=>%s\n",pt[0].error_message);
+    return _FAILURE_;
+  }
+
+  for (index_model = 0; index_model < batch_size; index_model++) {
+
+    if (perturb_free(&(pt_single[index_model])) == _FAILURE_) {
+      printf("\n\nError in perturb_free \n=>%s\n",pt_single[index_model].error_message);
+      return _FAILURE_;
+    }
+
+    if (thermodynamics_free(&(th[index_model])) == _FAILURE_) {
+      printf("\n\nError in thermodynamics_free \n=>%s\n",th[index_model].error_message);
+      return _FAILURE_;
+    }
+
+    if (background_free(&(ba[index_model])) == _FAILURE_) {
+      printf("\n\nError in background_free \n=>%s\n",ba[index_model].error_message);
+      return _FAILURE_;
+    }
+  }
+
+  free(pr);
+  free(ba);
+  free(th);
+  free(pt);
+  free(pt_single);
+
+  return _SUCCESS_;
+
+}
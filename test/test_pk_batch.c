@@ -0,0 +1,218 @@
+/** @file test_pk_batch.c
+ *
+ * Evaluate P(k,z) at many points with nonlinear_pk_at_kvec_and_zvec(),
+ * once with wavenumbers in ascending order and once with the same
+ * wavenumbers shuffled, and compare with separate calls of
+ * nonlinear_pk_at_k_and_z(): the timings of the three are printed, as
+ * well as the largest relative difference with the separate calls.
+ *
+ * Usage: ./test_pk_batch model.ini [number of k per z] [number of z]
+ */
+
+#include "class.h"
+
+/* wall-clock time (s) */
+double pk_batch_time() {
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+int main(int argc, char **argv) {
+
+  struct precision pr;        /* for precision parameters */
+  struct background ba;       /* for cosmological background */
+  struct thermo th;           /* for thermodynamics */
+  struct perturbs pt;         /* for source functions */
+  struct transfers tr;        /* for transfer functions */
+  struct primordial pm;       /* for primordial spectra */
+  struct spectra sp;          /* for output spectra */
+  struct nonlinear nl;        /* for non-linear spectra */
+  struct lensing le;          /* for lensed spectra */
+  struct output op;           /* for output files */
+  ErrorMsg errmsg;            /* for error messages */
+
+  char * arguments[2];
+  int k_size=1000,z_size=100;
+  int index_k,index_z,index_swap;
+  enum pk_outputs pk_output;
+  double *kvec,*kvec_shuffled,*zvec,*pk_single,*pk_sorted,*pk_shuffled;
+  double kmin,kmax,z_max,swap,diff_sorted,diff_shuffled;
+  double t_single,t_sorted,t_shuffled,start;
+
+  if (argc < 2) {
+    printf("Usage: %s model.ini [number of k per z] [number of z]\n",argv[0]);
+    return _FAILURE_;
+  }
+  if (argc > 2)
+    k_size = atoi(argv[2]);
+  if (argc > 3)
+    z_size = atoi(argv[3]);
+
+  arguments[0] = argv[0];
+  arguments[1] = argv[1];
+
+  if (input_init_from_arguments(2,arguments,&pr,&ba,&th,&pt,&tr,&pm,&sp,&nl,&le,&op,errmsg) == _FAILURE_) {
+    printf("\n\nError running input_init_from_arguments \n=>%s\n",errmsg);
+    return _FAILURE_;
+  }
+
+  if (background_init(&pr,&ba) == _FAILURE_) {
+    printf("\n\nError running background_init \n=>%s\n",ba.error_message);
+    return _FAILURE_;
+  }
+
+  if (thermodynamics_init(&pr,&ba,&th) == _FAILURE_) {
+    printf("\n\nError in thermodynamics_init \n=>%s\n",th.error_message);
+    return _FAILURE_;
+  }
+
+  if (perturb_init(&pr,&ba,&th,&pt) == _FAILURE_) {
+    printf("\n\nError in perturb_init \n=>%s\n",pt.error_message);
+    return _FAILURE_;
+  }
+
+  if (primordial_init(&pr,&pt,&pm) == _FAILURE_) {
+    printf("\n\nError in primordial_init \n=>%s\n",pm.error_message);
+    return _FAILURE_;
+  }
+
+  if (nonlinear_init(&pr,&ba,&th,&pt,&pm,&nl) == _FAILURE_) {
+    printf("\n\nError in nonlinear_init \n=>%s\n",nl.error_message);
+    return _FAILURE_;
+  }
+
+  if (pt.has_pk_matter == _FALSE_) {
+    printf("\n\nThis test requires mPk in the output\n");
+    return _FAILURE_;
+  }
+
+  pk_output = (nl.method == nl_none) ? pk_linear : pk_nonlinear;
+
+  kvec = malloc(k_size*z_size*sizeof(double));
+  kvec_shuffled = malloc(k_size*z_size*sizeof(double));
+  zvec = malloc(z_size*sizeof(double));
+  pk_single = malloc(k_size*z_size*sizeof(double));
+  pk_sorted = malloc(k_size*z_size*sizeof(double));
+  pk_shuffled = malloc(k_size*z_size*sizeof(double));
+
+  /* wavenumbers covering the whole range (including the extrapolation
+     below kmin), different for each z as in redshift-space
+     likelihoods */
+  kmin = exp(nl.ln_k[0]);
+  kmax = exp(nl.ln_k[nl.k_size-1]);
+  z_max = (nl.ln_tau_size > 1) ? pt.z_max_pk : 0.;
+
+  srand(1);
+  for (index_z=0; index_z<z_size; index_z++) {
+    zvec[index_z] = z_max*(double)(z_size-1-index_z)/MAX(z_size-1,1);
+    for (index_k=0; index_k<k_size; index_k++) {
+      kvec[index_z*k_size+index_k] = 0.1*kmin*pow(10.*kmax/kmin,(double)index_k/(k_size-1))/(1.+0.01*index_z);
+      kvec[index_z*k_size+index_k] = MIN(kvec[index_z*k_size+index_k],kmax);
+      kvec_shuffled[index_z*k_size+index_k] = kvec[index_z*k_size+index_k];
+    }
+    for (index_k=k_size-1; index_k>0; index_k--) {
+      index_swap = rand()%(index_k+1);
+      swap = kvec_shuffled[index_z*k_size+index_k];
+      kvec_shuffled[index_z*k_size+index_k] = kvec_shuffled[index_z*k_size+index_swap];
+      kvec_shuffled[index_z*k_size+index_swap] = swap;
+    }
+  }
+
+  /* one point after the other */
+  start = pk_batch_time();
+
+  for (index_z=0; index_z<z_size; index_z++) {
+    for (index_k=0; index_k<k_size; index_k++) {
+      if (nonlinear_pk_at_k_and_z(&ba,&pm,&nl,pk_output,kvec[index_z*k_size+index_k],zvec[index_z],nl.index_pk_m,
+                                  &(pk_single[index_z*k_size+index_k]),NULL) == _FAILURE_) {
+        printf("\n\nError in nonlinear_pk_at_k_and_z \n=>%s\n",nl.error_message);
+        return _FAILURE_;
+      }
+    }
+  }
+
+  t_single = pk_batch_time()-start;
+
+  /* all points at once, sorted */
+  start = pk_batch_time();
+
+  if (nonlinear_pk_at_kvec_and_zvec(&ba,&pm,&nl,pk_output,nl.index_pk_m,kvec,k_size,zvec,z_size,pk_sorted) == _FAILURE_) {
+    printf("\n\nError in nonlinear_pk_at_kvec_and_zvec \n=>%s\n",nl.error_message);
+    return _FAILURE_;
+  }
+
+  t_sorted = pk_batch_time()-start;
+
+  /* all points at once, shuffled */
+  start = pk_batch_time();
+
+  if (nonlinear_pk_at_kvec_and_zvec(&ba,&pm,&nl,pk_output,nl.index_pk_m,kvec_shuffled,k_size,zvec,z_size,pk_shuffled) == _FAILURE_) {
+    printf("\n\nError in nonlinear_pk_at_kvec_and_zvec \n=>%s\n",nl.error_message);
+    return _FAILURE_;
+  }
+
+  t_shuffled = pk_batch_time()-start;
+
+  /* the shuffled result is compared with the separate calls through
+     the sorted one, which has the same wavenumbers at each z */
+  diff_sorted = 0.;
+  diff_shuffled = 0.;
+
+  for (index_z=0; index_z<z_size; index_z++) {
+    for (index_k=0; index_k<k_size; index_k++) {
+      diff_sorted = MAX(diff_sorted,fabs(pk_sorted[index_z*k_size+index_k]/pk_single[index_z*k_size+index_k]-1.));
+    }
+    for (index_k=0; index_k<k_size; index_k++) {
+      for (index_swap=0; index_swap<k_size; index_swap++) {
+        if (kvec[index_z*k_size+index_swap] == kvec_shuffled[index_z*k_size+index_k]) {
+          diff_shuffled = MAX(diff_shuffled,fabs(pk_shuffled[index_z*k_size+index_k]/pk_single[index_z*k_size+index_swap]-1.));
+          break;
+        }
+      }
+    }
+  }
+
+  printf("%d points: separate nonlinear_pk_at_k_and_z() calls took %g s\n",k_size*z_size,t_single);
+  printf("  nonlinear_pk_at_kvec_and_zvec(), sorted k:   %g s (speed-up %.1f), largest relative difference %e\n",
+         t_sorted,t_single/t_sorted,diff_sorted);
+  printf("  nonlinear_pk_at_kvec_and_zvec(), shuffled k: %g s (speed-up %.1f), largest relative difference %e\n",
+         t_shuffled,t_single/t_shuffled,diff_shuffled);
+
+  free(kvec);
+  free(kvec_shuffled);
+  free(zvec);
+  free(pk_single);
+  free(pk_sorted);
+  free(pk_shuffled);
+
+  if (nonlinear_free(&nl) == _FAILURE_) {
+    printf("\n\nError in nonlinear_free \n=>%s\n",nl.error_message);
+    return _FAILURE_;
+  }
+
+  if (primordial_free(&pm) == _FAILURE_) {
+    printf("\n\nError in primordial_free \n=>%s\n",pm.error_message);
+    return _FAILURE_;
+  }
+
+  if (perturb_free(&pt) == _FAILURE_) {
+    printf("\n\nError in perturb_free \n=>%s\n",pt.error_message);
+    return _FAILURE_;
+  }
+
+  if (thermodynamics_free(&th) == _FAILURE_) {
+    printf("\n\nError in thermodynamics_free \n=>%s\n",th.error_message);
+    return _FAILURE_;
+  }
+
+  if (background_free(&ba) == _FAILURE_) {
+    printf("\n\nError in background_free \n=>%s\n",ba.error_message);
+    return _FAILURE_;
+  }
+
+  return _SUCCESS_;
+
+}
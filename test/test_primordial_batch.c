@@ -0,0 +1,184 @@
+/** @file test_primordial_batch.c
+ *
+ * Evaluate an analytic primordial spectrum at many wavenumbers in
+ * three ways: by spline interpolation in the table of the primordial
+ * module (as primordial_spectrum_at_k() did before analytic spectra
+ * were computed directly), with separate calls of
+ * primordial_spectrum_at_k(), and with one call of
+ * primordial_spectrum_at_kvec(). The timings are printed, as well as
+ * the largest relative difference with the interpolated values.
+ *
+ * Usage: ./test_primordial_batch model.ini [number of k] [number of repetitions]
+ */
+
+#include "class.h"
+
+/* wall-clock time (s) */
+double primordial_batch_time() {
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+int main(int argc, char **argv) {
+
+  struct precision pr;        /* for precision parameters */
+  struct background ba;       /* for cosmological background */
+  struct thermo th;           /* for thermodynamics */
+  struct perturbs pt;         /* for source functions */
+  struct transfers tr;        /* for transfer functions */
+  struct primordial pm;       /* for primordial spectra */
+  struct spectra sp;          /* for output spectra */
+  struct nonlinear nl;        /* for non-linear spectra */
+  struct lensing le;          /* for lensed spectra */
+  struct output op;           /* for output files */
+  ErrorMsg errmsg;            /* for error messages */
+
+  char * arguments[2];
+  int k_size=10000,repeat=100,index_repeat;
+  int index_k,index_md,index_ic,index_diag,ic_ic_size,last_index;
+  double *kvec,*pk_table,*pk_single,*pk_batch;
+  double lnk_min,lnk_max,start,t_table,t_single,t_batch,diff_single,diff_batch;
+
+  if (argc < 2) {
+    printf("Usage: %s model.ini [number of k] [number of repetitions]\n",argv[0]);
+    return _FAILURE_;
+  }
+  if (argc > 2)
+    k_size = atoi(argv[2]);
+  if (argc > 3)
+    repeat = atoi(argv[3]);
+
+  arguments[0] = argv[0];
+  arguments[1] = argv[1];
+
+  if (input_init_from_arguments(2,arguments,&pr,&ba,&th,&pt,&tr,&pm,&sp,&nl,&le,&op,errmsg) == _FAILURE_) {
+    printf("\n\nError running input_init_from_arguments \n=>%s\n",errmsg);
+    return _FAILURE_;
+  }
+
+  if (pm.primordial_spec_type != analytic_Pk) {
+    printf("\n\nThis test requires an analytic primordial spectrum\n");
+    return _FAILURE_;
+  }
+
+  if (background_init(&pr,&ba) == _FAILURE_) {
+    printf("\n\nError running background_init \n=>%s\n",ba.error_message);
+    return _FAILURE_;
+  }
+
+  if (thermodynamics_init(&pr,&ba,&th) == _FAILURE_) {
+    printf("\n\nError in thermodynamics_init \n=>%s\n",th.error_message);
+    return _FAILURE_;
+  }
+
+  if (perturb_init(&pr,&ba,&th,&pt) == _FAILURE_) {
+    printf("\n\nError in perturb_init \n=>%s\n",pt.error_message);
+    return _FAILURE_;
+  }
+
+  if (primordial_init(&pr,&pt,&pm) == _FAILURE_) {
+    printf("\n\nError in primordial_init \n=>%s\n",pm.error_message);
+    return _FAILURE_;
+  }
+
+  /* wavenumbers inside the table (whose ends are left out, where the
+     spline interpolation is least accurate) */
+  lnk_min = pm.lnk[1];
+  lnk_max = pm.lnk[pm.lnk_size-2];
+
+  for (index_md=0; index_md<pm.md_size; index_md++) {
+
+    ic_ic_size = pm.ic_ic_size[index_md];
+
+    kvec = malloc(k_size*sizeof(double));
+    pk_table = malloc(k_size*ic_ic_size*sizeof(double));
+    pk_single = malloc(k_size*ic_ic_size*sizeof(double));
+    pk_batch = malloc(k_size*ic_ic_size*sizeof(double));
+
+    for (index_k=0; index_k<k_size; index_k++)
+      kvec[index_k] = exp(lnk_min+(lnk_max-lnk_min)*index_k/(k_size-1));
+
+    /* interpolation in the table (logarithmic output) */
+    start = primordial_batch_time();
+    for (index_repeat=0; index_repeat<repeat; index_repeat++) {
+      for (index_k=0; index_k<k_size; index_k++) {
+        if (array_interpolate_spline(pm.lnk,pm.lnk_size,pm.lnpk[index_md],pm.ddlnpk[index_md],ic_ic_size,
+                                     log(kvec[index_k]),&last_index,pk_table+index_k*ic_ic_size,ic_ic_size,errmsg) == _FAILURE_) {
+          printf("\n\nError in array_interpolate_spline \n=>%s\n",errmsg);
+          return _FAILURE_;
+        }
+      }
+    }
+    t_table = (primordial_batch_time()-start)/repeat;
+
+    /* one k after the other */
+    start = primordial_batch_time();
+    for (index_repeat=0; index_repeat<repeat; index_repeat++) {
+      for (index_k=0; index_k<k_size; index_k++) {
+        if (primordial_spectrum_at_k(&pm,index_md,logarithmic,log(kvec[index_k]),pk_single+index_k*ic_ic_size) == _FAILURE_) {
+          printf("\n\nError in primordial_spectrum_at_k \n=>%s\n",pm.error_message);
+          return _FAILURE_;
+        }
+      }
+    }
+    t_single = (primordial_batch_time()-start)/repeat;
+
+    /* all k at once */
+    start = primordial_batch_time();
+    for (index_repeat=0; index_repeat<repeat; index_repeat++) {
+      if (primordial_spectrum_at_kvec(&pm,index_md,linear,kvec,k_size,pk_batch) == _FAILURE_) {
+        printf("\n\nError in primordial_spectrum_at_kvec \n=>%s\n",pm.error_message);
+        return _FAILURE_;
+      }
+    }
+    t_batch = (primordial_batch_time()-start)/repeat;
+
+    /* compare the logarithms of the diagonal elements */
+    diff_single = 0.;
+    diff_batch = 0.;
+    for (index_k=0; index_k<k_size; index_k++) {
+      for (index_ic=0; index_ic<pm.ic_size[index_md]; index_ic++) {
+        index_diag = index_k*ic_ic_size+index_symmetric_matrix(index_ic,index_ic,pm.ic_size[index_md]);
+        diff_single = MAX(diff_single,fabs(pk_single[index_diag]-pk_table[index_diag]));
+        diff_batch = MAX(diff_batch,fabs(log(pk_batch[index_diag])-pk_table[index_diag]));
+      }
+    }
+
+    printf("mode %d, %d points: interpolation in the table took %g s\n",index_md,k_size,t_table);
+    printf("  primordial_spectrum_at_k():    %g s (speed-up %.1f), largest relative difference %e\n",
+           t_single,t_table/t_single,diff_single);
+    printf("  primordial_spectrum_at_kvec(): %g s (speed-up %.1f), largest relative difference %e\n",
+           t_batch,t_table/t_batch,diff_batch);
+
+    free(kvec);
+    free(pk_table);
+    free(pk_single);
+    free(pk_batch);
+  }
+
+  if (primordial_free(&pm) == _FAILURE_) {
+    printf("\n\nError in primordial_free \n=>%s\n",pm.error_message);
+    return _FAILURE_;
+  }
+
+  if (perturb_free(&pt) == _FAILURE_) {
+    printf("\n\nError in perturb_free \n=>%s\n",pt.error_message);
+    return _FAILURE_;
+  }
+
+  if (thermodynamics_free(&th) == _FAILURE_) {
+    printf("\n\nError in thermodynamics_free \n=>%s\n",th.error_message);
+    return _FAILURE_;
+  }
+
+  if (background_free(&ba) == _FAILURE_) {
+    printf("\n\nError in background_free \n=>%s\n",ba.error_message);
+    return _FAILURE_;
+  }
+
+  return _SUCCESS_;
+
+}
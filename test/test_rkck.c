@@ -0,0 +1,158 @@
+/** @file test_rkck.c
+ *
+ * Microbenchmark of the Runge-Kutta integrator: for several numbers of
+ * equations, integrate a set of harmonic oscillators with different
+ * frequencies, with generic_integrator() over one interval (as in the
+ * background and recombination modules, a new workspace at each
+ * integration), and with evolver_rk() over many output times (as in the
+ * perturbation module, whose workspace is kept from one call to the
+ * next). The time per step and per equation is printed (the number of
+ * steps being that of calls to the derivatives divided by six), as well
+ * as the largest difference with the exact solution.
+ *
+ * Usage: ./test_rkck [number of repetitions]
+ */
+
+#include "common.h"
+#include "evolver_rkck.h"
+
+#define _RKCK_TEST_X_SIZE_ 100   /* number of output times of evolver_rk() */
+
+/* number of calls to the derivatives, the unit of work of the benchmark */
+long rkck_test_derivs_calls = 0;
+
+/* wall-clock time (s) */
+double rkck_test_time() {
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+/* frequency of the oscillator of the equations 2*index and 2*index+1 */
+double rkck_test_omega(int index, int n) {
+  return 1.+(double)index/n;
+}
+
+/* system of equations: its size, and the squares of the frequencies */
+struct rkck_test_system {
+  int n;
+  double * omega2;
+};
+
+/* y[2i]'' = -omega_i^2 y[2i], as cheap as possible, so that the time of the integrator itself dominates */
+int rkck_test_derivs(double x, double * y, double * dy, void * parameters, ErrorMsg error_message) {
+
+  struct rkck_test_system * psys = parameters;
+  int index;
+
+  for (index=0; index<psys->n/2; index++) {
+    dy[2*index] = y[2*index+1];
+    dy[2*index+1] = -psys->omega2[index]*y[2*index];
+  }
+
+  rkck_test_derivs_calls++;
+
+  return _SUCCESS_;
+}
+
+int rkck_test_timescale(double x, void * parameters, double * timescale, ErrorMsg error_message) {
+  *timescale = 1.;
+  return _SUCCESS_;
+}
+
+int rkck_test_output(double x, double * y, double * dy, int index_x, void * parameters, ErrorMsg error_message) {
+  return _SUCCESS_;
+}
+
+/* largest difference between y and the exact solution at x, starting from y[2i]=1, y[2i+1]=0 at x_ini */
+double rkck_test_error(double * y, int n, double x, double x_ini) {
+
+  int index;
+  double omega,error=0.;
+
+  for (index=0; index<n/2; index++) {
+    omega = rkck_test_omega(index,n);
+    error = MAX(error,fabs(y[2*index]-cos(omega*(x-x_ini))));
+    error = MAX(error,fabs(y[2*index+1]+omega*sin(omega*(x-x_ini))));
+  }
+
+  return error;
+}
+
+int main(int argc, char **argv) {
+
+  ErrorMsg error_message;
+  struct generic_integrator_workspace gi;
+  struct rkck_test_system sys;
+
+  int sizes[6] = {4,16,64,256,1024,4096};
+  int repeat=20,index_repeat,index_size,index,n;
+  double x_ini=1.,x_end=21.,start,time,error;
+  double *y,*x_sampling;
+  long calls;
+
+  if (argc > 1)
+    repeat = atoi(argv[1]);
+
+  class_alloc(x_sampling,_RKCK_TEST_X_SIZE_*sizeof(double),error_message);
+  for (index=0; index<_RKCK_TEST_X_SIZE_; index++)
+    x_sampling[index] = x_ini+(x_end-x_ini)*(index+1)/_RKCK_TEST_X_SIZE_;
+
+  printf("%-20s %6s %12s %14s %12s\n","integrator","n","steps","ns/step/eq","error");
+
+  for (index_size=0; index_size<6; index_size++) {
+
+    n = sizes[index_size];
+    class_alloc(y,n*sizeof(double),error_message);
+    class_alloc(sys.omega2,n/2*sizeof(double),error_message);
+    sys.n = n;
+    for (index=0; index<n/2; index++)
+      sys.omega2[index] = rkck_test_omega(index,n)*rkck_test_omega(index,n);
+
+    /* generic_integrator() over the whole interval */
+    rkck_test_derivs_calls = 0;
+    start = rkck_test_time();
+    for (index_repeat=0; index_repeat<repeat; index_repeat++) {
+      for (index=0; index<n; index++)
+        y[index] = (index%2 == 0) ? 1. : 0.;
+      class_call(initialize_generic_integrator(n,&gi),gi.error_message,error_message);
+      class_call(generic_integrator(rkck_test_derivs,x_ini,x_end,y,&sys,1.e-10,0.,&gi),
+                 gi.error_message,
+                 error_message);
+      class_call(cleanup_generic_integrator(&gi),gi.error_message,error_message);
+    }
+    time = rkck_test_time()-start;
+    calls = rkck_test_derivs_calls/repeat;
+    error = rkck_test_error(y,n,x_end,x_ini);
+    printf("%-20s %6d %12ld %14.3f %12.3e\n","generic_integrator",n,calls/6,
+           time/repeat/(calls/6)/n*1.e9,error);
+
+    /* evolver_rk() with outputs, which takes one step per timescale */
+    rkck_test_derivs_calls = 0;
+    start = rkck_test_time();
+    for (index_repeat=0; index_repeat<repeat; index_repeat++) {
+      for (index=0; index<n; index++)
+        y[index] = (index%2 == 0) ? 1. : 0.;
+      class_call(evolver_rk(rkck_test_derivs,x_ini,x_end,y,NULL,n,&sys,1.e-10,1.e-15,
+                            rkck_test_timescale,0.1,x_sampling,_RKCK_TEST_X_SIZE_,
+                            rkck_test_output,NULL,NULL,error_message),
+                 error_message,
+                 error_message);
+    }
+    time = rkck_test_time()-start;
+    calls = rkck_test_derivs_calls/repeat;
+    error = rkck_test_error(y,n,x_end,x_ini);
+    printf("%-20s %6d %12ld %14.3f %12.3e\n","evolver_rk",n,calls/6,
+           time/repeat/(calls/6)/n*1.e9,error);
+
+    free(y);
+    free(sys.omega2);
+  }
+
+  evolver_rk_workspace_free();
+  free(x_sampling);
+
+  return _SUCCESS_;
+}
@@ -0,0 +1,185 @@
+/** @file test_sigma_grid.c
+ *
+ * Evaluate sigma(R,z) and dsigma/dlnR on a grid of radii and
+ * redshifts with nonlinear_sigmas_at_Rvec_and_zvec(), and compare
+ * with separate calls of nonlinear_sigmas_at_z(): the timings of both
+ * are printed, as well as the largest relative differences.
+ *
+ * Usage: ./test_sigma_grid model.ini [number of R] [number of z]
+ */
+
+#include "class.h"
+
+/* wall-clock time (s) */
+double sigma_grid_time() {
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+int main(int argc, char **argv) {
+
+  struct precision pr;        /* for precision parameters */
+  struct background ba;       /* for cosmological background */
+  struct thermo th;           /* for thermodynamics */
+  struct perturbs pt;         /* for source functions */
+  struct transfers tr;        /* for transfer functions */
+  struct primordial pm;       /* for primordial spectra */
+  struct spectra sp;          /* for output spectra */
+  struct nonlinear nl;        /* for non-linear spectra */
+  struct lensing le;          /* for lensed spectra */
+  struct output op;           /* for output files */
+  ErrorMsg errmsg;            /* for error messages */
+
+  char * arguments[2];
+  int R_size=100,z_size=50;
+  int index_R,index_z;
+  double *Rvec,*zvec,*sigma_single,*dsigma_single,*sigma_grid,*dsigma_grid;
+  double R_min,R_max,z_max,diff_sigma,diff_dsigma;
+  double t_single,t_grid,start;
+
+  if (argc < 2) {
+    printf("Usage: %s model.ini [number of R] [number of z]\n",argv[0]);
+    return _FAILURE_;
+  }
+  if (argc > 2)
+    R_size = atoi(argv[2]);
+  if (argc > 3)
+    z_size = atoi(argv[3]);
+
+  arguments[0] = argv[0];
+  arguments[1] = argv[1];
+
+  if (input_init_from_arguments(2,arguments,&pr,&ba,&th,&pt,&tr,&pm,&sp,&nl,&le,&op,errmsg) == _FAILURE_) {
+    printf("\n\nError running input_init_from_arguments \n=>%s\n",errmsg);
+    return _FAILURE_;
+  }
+
+  if (background_init(&pr,&ba) == _FAILURE_) {
+    printf("\n\nError running background_init \n=>%s\n",ba.error_message);
+    return _FAILURE_;
+  }
+
+  if (thermodynamics_init(&pr,&ba,&th) == _FAILURE_) {
+    printf("\n\nError in thermodynamics_init \n=>%s\n",th.error_message);
+    return _FAILURE_;
+  }
+
+  if (perturb_init(&pr,&ba,&th,&pt) == _FAILURE_) {
+    printf("\n\nError in perturb_init \n=>%s\n",pt.error_message);
+    return _FAILURE_;
+  }
+
+  if (primordial_init(&pr,&pt,&pm) == _FAILURE_) {
+    printf("\n\nError in primordial_init \n=>%s\n",pm.error_message);
+    return _FAILURE_;
+  }
+
+  if (nonlinear_init(&pr,&ba,&th,&pt,&pm,&nl) == _FAILURE_) {
+    printf("\n\nError in nonlinear_init \n=>%s\n",nl.error_message);
+    return _FAILURE_;
+  }
+
+  if (pt.has_pk_matter == _FALSE_) {
+    printf("\n\nThis test requires mPk in the output\n");
+    return _FAILURE_;
+  }
+
+  Rvec = malloc(R_size*sizeof(double));
+  zvec = malloc(z_size*sizeof(double));
+  sigma_single = malloc(R_size*z_size*sizeof(double));
+  dsigma_single = malloc(R_size*z_size*sizeof(double));
+  sigma_grid = malloc(R_size*z_size*sizeof(double));
+  dsigma_grid = malloc(R_size*z_size*sizeof(double));
+
+  /* radii of cluster-count likelihoods, from 0.5 to 30 Mpc/h, within
+     the range inverse to the range of k */
+  R_min = MAX(0.5/ba.h,2./exp(nl.ln_k[nl.k_size-1]));
+  R_max = MIN(30./ba.h,0.5/exp(nl.ln_k[0]));
+  z_max = (nl.ln_tau_size > 1) ? pt.z_max_pk : 0.;
+
+  for (index_R=0; index_R<R_size; index_R++)
+    Rvec[index_R] = R_min*pow(R_max/R_min,(double)index_R/MAX(R_size-1,1));
+  for (index_z=0; index_z<z_size; index_z++)
+    zvec[index_z] = z_max*(double)index_z/MAX(z_size-1,1);
+
+  /* one point after the other */
+  start = sigma_grid_time();
+
+  for (index_z=0; index_z<z_size; index_z++) {
+    for (index_R=0; index_R<R_size; index_R++) {
+      if ((nonlinear_sigmas_at_z(&pr,&ba,&nl,Rvec[index_R],zvec[index_z],nl.index_pk_m,out_sigma,
+                                 &(sigma_single[index_z*R_size+index_R])) == _FAILURE_) ||
+          (nonlinear_sigmas_at_z(&pr,&ba,&nl,Rvec[index_R],zvec[index_z],nl.index_pk_m,out_sigma_prime,
+                                 &(dsigma_single[index_z*R_size+index_R])) == _FAILURE_)) {
+        printf("\n\nError in nonlinear_sigmas_at_z \n=>%s\n",nl.error_message);
+        return _FAILURE_;
+      }
+      /* out_sigma_prime gives dsigma^2/dR */
+      dsigma_single[index_z*R_size+index_R] *= Rvec[index_R]/2./sigma_single[index_z*R_size+index_R];
+    }
+  }
+
+  t_single = sigma_grid_time()-start;
+
+  /* all points at once */
+  start = sigma_grid_time();
+
+  if (nonlinear_sigmas_at_Rvec_and_zvec(&pr,&ba,&nl,nl.index_pk_m,Rvec,R_size,zvec,z_size,sigma_grid,dsigma_grid) == _FAILURE_) {
+    printf("\n\nError in nonlinear_sigmas_at_Rvec_and_zvec \n=>%s\n",nl.error_message);
+    return _FAILURE_;
+  }
+
+  t_grid = sigma_grid_time()-start;
+
+  diff_sigma = 0.;
+  diff_dsigma = 0.;
+
+  for (index_z=0; index_z<z_size; index_z++) {
+    for (index_R=0; index_R<R_size; index_R++) {
+      diff_sigma = MAX(diff_sigma,fabs(sigma_grid[index_z*R_size+index_R]/sigma_single[index_z*R_size+index_R]-1.));
+      diff_dsigma = MAX(diff_dsigma,fabs(dsigma_grid[index_z*R_size+index_R]/dsigma_single[index_z*R_size+index_R]-1.));
+    }
+  }
+
+  printf("%d x %d points: separate nonlinear_sigmas_at_z() calls took %g s\n",R_size,z_size,t_single);
+  printf("  nonlinear_sigmas_at_Rvec_and_zvec(): %g s (speed-up %.1f), largest relative difference %e (sigma), %e (dsigma/dlnR)\n",
+         t_grid,t_single/t_grid,diff_sigma,diff_dsigma);
+
+  free(Rvec);
+  free(zvec);
+  free(sigma_single);
+  free(dsigma_single);
+  free(sigma_grid);
+  free(dsigma_grid);
+
+  if (nonlinear_free(&nl) == _FAILURE_) {
+    printf("\n\nError in nonlinear_free \n=>%s\n",nl.error_message);
+    return _FAILURE_;
+  }
+
+  if (primordial_free(&pm) == _FAILURE_) {
+    printf("\n\nError in primordial_free \n=>%s\n",pm.error_message);
+    return _FAILURE_;
+  }
+
+  if (perturb_free(&pt) == _FAILURE_) {
+    printf("\n\nError in perturb_free \n=>%s\n",pt.error_message);
+    return _FAILURE_;
+  }
+
+  if (thermodynamics_free(&th) == _FAILURE_) {
+    printf("\n\nError in thermodynamics_free \n=>%s\n",th.error_message);
+    return _FAILURE_;
+  }
+
+  if (background_free(&ba) == _FAILURE_) {
+    printf("\n\nError in background_free \n=>%s\n",ba.error_message);
+    return _FAILURE_;
+  }
+
+  return _SUCCESS_;
+
+}
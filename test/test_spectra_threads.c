@@ -0,0 +1,189 @@
+/** @file test_spectra_threads.c
+ *
+ * Benchmark of the convolution of the transfer functions with the
+ * primordial spectrum in spectra_init(): the transfer functions are
+ * computed once, then spectra_init() is called repeatedly with 1, 2,
+ * 4, ... threads up to the maximum number of threads. The timings are
+ * printed, as well as the largest relative difference of the
+ * unlensed C_l's with the single-thread run.
+ *
+ * Usage: ./test_spectra_threads model.ini [number of repetitions]
+ */
+
+#include "class.h"
+
+/* wall-clock time (s) */
+double spectra_threads_time() {
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+int main(int argc, char **argv) {
+
+  struct precision pr;        /* for precision parameters */
+  struct background ba;       /* for cosmological background */
+  struct thermo th;           /* for thermodynamics */
+  struct perturbs pt;         /* for source functions */
+  struct transfers tr;        /* for transfer functions */
+  struct primordial pm;       /* for primordial spectra */
+  struct spectra sp;          /* for output spectra */
+  struct nonlinear nl;        /* for non-linear spectra */
+  struct lensing le;          /* for lensed spectra */
+  struct output op;           /* for output files */
+  ErrorMsg errmsg;            /* for error messages */
+
+  char * arguments[2];
+  int repeat=10,index_repeat;
+  int thread_num=1,thread_num_max=1;
+  int index_md,index_cl,cl_size;
+  double ** cl_reference;
+  double start,t_spectra,t_single=0.,max_diff;
+
+  if (argc < 2) {
+    printf("Usage: %s model.ini [number of repetitions]\n",argv[0]);
+    return _FAILURE_;
+  }
+  if (argc > 2)
+    repeat = atoi(argv[2]);
+
+  arguments[0] = argv[0];
+  arguments[1] = argv[1];
+
+  if (input_init_from_arguments(2,arguments,&pr,&ba,&th,&pt,&tr,&pm,&sp,&nl,&le,&op,errmsg) == _FAILURE_) {
+    printf("\n\nError running input_init_from_arguments \n=>%s\n",errmsg);
+    return _FAILURE_;
+  }
+
+  if (background_init(&pr,&ba) == _FAILURE_) {
+    printf("\n\nError running background_init \n=>%s\n",ba.error_message);
+    return _FAILURE_;
+  }
+
+  if (thermodynamics_init(&pr,&ba,&th) == _FAILURE_) {
+    printf("\n\nError in thermodynamics_init \n=>%s\n",th.error_message);
+    return _FAILURE_;
+  }
+
+  if (perturb_init(&pr,&ba,&th,&pt) == _FAILURE_) {
+    printf("\n\nError in perturb_init \n=>%s\n",pt.error_message);
+    return _FAILURE_;
+  }
+
+  if (primordial_init(&pr,&pt,&pm) == _FAILURE_) {
+    printf("\n\nError in primordial_init \n=>%s\n",pm.error_message);
+    return _FAILURE_;
+  }
+
+  if (nonlinear_init(&pr,&ba,&th,&pt,&pm,&nl) == _FAILURE_) {
+    printf("\n\nError in nonlinear_init \n=>%s\n",nl.error_message);
+    return _FAILURE_;
+  }
+
+  if (transfer_init(&pr,&ba,&th,&pt,&nl,&tr) == _FAILURE_) {
+    printf("\n\nError in transfer_init \n=>%s\n",tr.error_message);
+    return _FAILURE_;
+  }
+
+  if ((pt.has_cls == _FALSE_) || (tr.stream != NULL)) {
+    printf("\n\nThis test requires C_l's in the output, with all transfer functions stored (no l_block_size)\n");
+    return _FAILURE_;
+  }
+
+  sp.spectra_verbose = 0;
+
+#ifdef _OPENMP
+  thread_num_max = omp_get_max_threads();
+#endif
+
+  cl_reference = malloc(pt.md_size*sizeof(double*));
+
+  for (thread_num=1; ; thread_num=MIN(2*thread_num,thread_num_max)) {
+
+#ifdef _OPENMP
+    omp_set_num_threads(thread_num);
+#endif
+
+    t_spectra = 0.;
+    max_diff = 0.;
+
+    for (index_repeat=0; index_repeat<repeat; index_repeat++) {
+
+      start = spectra_threads_time();
+
+      if (spectra_init(&pr,&ba,&pt,&pm,&nl,&tr,&sp) == _FAILURE_) {
+        printf("\n\nError in spectra_init \n=>%s\n",sp.error_message);
+        return _FAILURE_;
+      }
+
+      t_spectra += spectra_threads_time()-start;
+
+      for (index_md=0; index_md<sp.md_size; index_md++) {
+        cl_size = sp.l_size[index_md]*sp.ic_ic_size[index_md]*sp.ct_size;
+        if ((thread_num == 1) && (index_repeat == 0)) {
+          cl_reference[index_md] = malloc(cl_size*sizeof(double));
+          for (index_cl=0; index_cl<cl_size; index_cl++)
+            cl_reference[index_md][index_cl] = sp.cl[index_md][index_cl];
+        }
+        for (index_cl=0; index_cl<cl_size; index_cl++) {
+          if (cl_reference[index_md][index_cl] != 0.)
+            max_diff = MAX(max_diff,fabs(sp.cl[index_md][index_cl]/cl_reference[index_md][index_cl]-1.));
+        }
+      }
+
+      if (spectra_free(&sp) == _FAILURE_) {
+        printf("\n\nError in spectra_free \n=>%s\n",sp.error_message);
+        return _FAILURE_;
+      }
+    }
+
+    t_spectra /= repeat;
+    if (thread_num == 1)
+      t_single = t_spectra;
+
+    printf("%d thread(s): spectra_init() took %g s (speed-up %.2f), largest relative difference with 1 thread %e\n",
+           thread_num,t_spectra,t_single/t_spectra,max_diff);
+
+    if (thread_num == thread_num_max)
+      break;
+  }
+
+  for (index_md=0; index_md<pt.md_size; index_md++)
+    free(cl_reference[index_md]);
+  free(cl_reference);
+
+  if (transfer_free(&tr) == _FAILURE_) {
+    printf("\n\nError in transfer_free \n=>%s\n",tr.error_message);
+    return _FAILURE_;
+  }
+
+  if (nonlinear_free(&nl) == _FAILURE_) {
+    printf("\n\nError in nonlinear_free \n=>%s\n",nl.error_message);
+    return _FAILURE_;
+  }
+
+  if (primordial_free(&pm) == _FAILURE_) {
+    printf("\n\nError in primordial_free \n=>%s\n",pm.error_message);
+    return _FAILURE_;
+  }
+
+  if (perturb_free(&pt) == _FAILURE_) {
+    printf("\n\nError in perturb_free \n=>%s\n",pt.error_message);
+    return _FAILURE_;
+  }
+
+  if (thermodynamics_free(&th) == _FAILURE_) {
+    printf("\n\nError in thermodynamics_free \n=>%s\n",th.error_message);
+    return _FAILURE_;
+  }
+
+  if (background_free(&ba) == _FAILURE_) {
+    printf("\n\nError in background_free \n=>%s\n",ba.error_message);
+    return _FAILURE_;
+  }
+
+  return _SUCCESS_;
+
+}
@@ -0,0 +1,141 @@
+/** @file test_spline_tables.c
+ *
+ * Microbenchmark of the spline of tables along their lines: for
+ * several shapes (number of lines x number of columns), time
+ * array_spline_table_lines() and array_logspline_table_lines() with 1,
+ * 2, ... up to the maximum number of threads, and compare their
+ * results with the column-by-column spline of the transposed table by
+ * array_spline_table_columns(). The timings are printed, as well as the
+ * largest difference with the reference, relative to the largest
+ * second derivative of the table.
+ *
+ * Usage: ./test_spline_tables [number of repetitions]
+ */
+
+#include "common.h"
+#include "arrays.h"
+
+/* wall-clock time (s) */
+double spline_tables_time() {
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+/* largest difference between the tables a and b of size n, relative
+   to the largest element of a */
+double spline_tables_difference(double * a, double * b, int n) {
+
+  int index;
+  double diff=0.,scale=0.;
+
+  for (index=0; index<n; index++) {
+    diff = MAX(diff,fabs(a[index]-b[index]));
+    scale = MAX(scale,fabs(a[index]));
+  }
+
+  return (scale > 0.) ? diff/scale : diff;
+}
+
+int main(int argc, char **argv) {
+
+  ErrorMsg error_message;
+
+  int shapes[5][2] = {{20000,20},{5000,40},{500,500},{150,600},{100,3000}};
+  int repeat=10,index_repeat,index_shape,index_log,index_x,index_y,x_size,y_size;
+  int number_of_threads=1,threads;
+  double *x,*lnx,*y,*y_t,*ddy,*ddy_t,*ddy_ref;
+  double start,t_lines,diff;
+  char * spline_name[2] = {"array_spline_table_lines   ","array_logspline_table_lines"};
+
+  if (argc > 1)
+    repeat = atoi(argv[1]);
+
+#ifdef _OPENMP
+  number_of_threads = omp_get_max_threads();
+#endif
+
+  for (index_shape=0; index_shape<5; index_shape++) {
+
+    x_size = shapes[index_shape][0];
+    y_size = shapes[index_shape][1];
+
+    x = malloc(x_size*sizeof(double));
+    lnx = malloc(x_size*sizeof(double));
+    y = malloc(x_size*y_size*sizeof(double));
+    y_t = malloc(x_size*y_size*sizeof(double));
+    ddy = malloc(x_size*y_size*sizeof(double));
+    ddy_t = malloc(x_size*y_size*sizeof(double));
+    ddy_ref = malloc(x_size*y_size*sizeof(double));
+
+    /* non-uniform abscissae, positive table */
+    for (index_x=0; index_x<x_size; index_x++) {
+      x[index_x] = exp(10.*index_x/(x_size-1)+(double)index_x*index_x/x_size/x_size);
+      lnx[index_x] = log(x[index_x]);
+      for (index_y=0; index_y<y_size; index_y++)
+        y[index_x*y_size+index_y] = exp(2.+sin((index_y+1.)*log(x[index_x])));
+    }
+
+    for (index_log=0; index_log<2; index_log++) {
+
+      /* reference: transposed table (of logarithms), splined column by column */
+      for (index_x=0; index_x<x_size; index_x++) {
+        for (index_y=0; index_y<y_size; index_y++) {
+          if (index_log == 0)
+            y_t[index_y*x_size+index_x] = y[index_x*y_size+index_y];
+          else
+            y_t[index_y*x_size+index_x] = log(y[index_x*y_size+index_y]);
+        }
+      }
+      if (array_spline_table_columns((index_log == 0) ? x : lnx,x_size,y_t,y_size,ddy_t,_SPLINE_EST_DERIV_,error_message) == _FAILURE_) {
+        printf("\n\nError in array_spline_table_columns \n=>%s\n",error_message);
+        return _FAILURE_;
+      }
+      for (index_x=0; index_x<x_size; index_x++) {
+        for (index_y=0; index_y<y_size; index_y++)
+          ddy_ref[index_x*y_size+index_y] = ddy_t[index_y*x_size+index_x];
+      }
+
+      for (threads=1; threads<=number_of_threads; threads++) {
+
+#ifdef _OPENMP
+        omp_set_num_threads(threads);
+#endif
+
+        start = spline_tables_time();
+        for (index_repeat=0; index_repeat<repeat; index_repeat++) {
+          if (index_log == 0) {
+            if (array_spline_table_lines(x,x_size,y,y_size,ddy,_SPLINE_EST_DERIV_,error_message) == _FAILURE_) {
+              printf("\n\nError in array_spline_table_lines \n=>%s\n",error_message);
+              return _FAILURE_;
+            }
+          }
+          else {
+            if (array_logspline_table_lines(x,x_size,y,y_size,ddy,_SPLINE_EST_DERIV_,error_message) == _FAILURE_) {
+              printf("\n\nError in array_logspline_table_lines \n=>%s\n",error_message);
+              return _FAILURE_;
+            }
+          }
+        }
+        t_lines = (spline_tables_time()-start)/repeat;
+
+        diff = spline_tables_difference(ddy_ref,ddy,x_size*y_size);
+
+        printf("%5d x %4d, %s, %2d thread(s): %g s, largest relative difference with column-by-column spline %e\n",
+               x_size,y_size,spline_name[index_log],threads,t_lines,diff);
+      }
+    }
+
+    free(x);
+    free(lnx);
+    free(y);
+    free(y_t);
+    free(ddy);
+    free(ddy_t);
+    free(ddy_ref);
+  }
+
+  return _SUCCESS_;
+}
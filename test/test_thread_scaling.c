@@ -0,0 +1,397 @@
+/** @file test_thread_scaling.c
+ *
+ * Thread-scaling benchmark of the OpenMP parallel regions: run a few
+ * configurations, together covering the main parallel regions (loops
+ * over wavenumbers of the perturbation, transfer and inflation
+ * modules, loop over multipoles of the spectra module, full-sky and
+ * flat-sky loops of the lensing module, hyperspherical Bessel
+ * functions, splines of large tables), with each number of threads of
+ * a list, and record for each region (see tools/parallel_timing.c) the
+ * wall-clock time and the load-imbalance tail, i.e. the ratio between
+ * the maximum and the mean over threads of the time after which they
+ * were done with their share of the work.
+ *
+ * Each run is done in its own process, so that the caches filled by
+ * one run do not shorten the next ones. The report gives, for each
+ * region, the time, speed-up, parallel efficiency (speed-up divided by
+ * the number of threads, relative to the smallest number of threads of
+ * the list) and imbalance for each number of threads, and flags the
+ * regions whose efficiency falls below 50% (except the very short ones,
+ * dominated by the overheads). It is printed, and written
+ * in JSON format. Run it from the root directory of CLASS.
+ *
+ * Usage: ./test_thread_scaling [output.json] [numbers of threads, e.g. 1,2,4,8] [configuration ...]
+ * (by default, powers of two up to the number of processors, and all configurations)
+ */
+
+#include "class.h"
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define _SCALING_THREADS_MAX_ 32        /* maximum length of the list of numbers of threads */
+#define _SCALING_EFFICIENCY_MIN_ 0.5    /* regions with a smaller parallel efficiency are flagged */
+#define _SCALING_TIME_MIN_ 0.01         /* ... unless their reference time (s) is smaller than this, their timing being then dominated by the overheads */
+
+/* one configuration, given by its parameters: name, value, name, value, ..., NULL */
+struct scaling_configuration {
+  char * name;
+  char * parameters[24];
+};
+
+struct scaling_configuration scaling_matrix[] = {
+  {"lcdm",
+   {"output","tCl,pCl,lCl,mPk","lensing","yes","l_max_scalars","3000","lensing_method","1",
+    "non linear","halofit","P_k_max_h/Mpc","10",NULL}},
+  {"curved",
+   {"output","tCl,pCl","Omega_k","0.05",NULL}},
+  {"inflation",
+   {"output","tCl,mPk","modes","s,t","P_k_ini type","inflation_V",NULL}},
+  {"number_counts",
+   {"output","nCl,sCl","selection","gaussian","selection_mean","0.5,1.0,1.5","selection_width","0.1",
+    "non_diagonal","2","l_max_lss","500",NULL}}
+};
+
+/* results of one run, sent by the process which does it */
+struct scaling_result {
+  int status;
+  ErrorMsg error_message;
+  double wall;                   /* duration of the whole run (s) */
+  int region_num;
+  struct parallel_timing_region region[_PARALLEL_TIMING_MAX_REGIONS_];
+};
+
+int scaling_run(struct scaling_configuration * psc, int threads, struct scaling_result * psr);
+
+/* the region of a given name in the results of a run, or NULL if it was not executed */
+struct parallel_timing_region * scaling_region_find(char * name, struct scaling_result * psr) {
+  int index_region;
+  for (index_region=0; index_region<psr->region_num; index_region++)
+    if (strcmp(psr->region[index_region].name,name) == 0)
+      return &(psr->region[index_region]);
+  return NULL;
+}
+
+int scaling_report(FILE * json, int first, char * name, int thread_num, int * threads, struct scaling_result * result);
+
+int main(int argc, char **argv) {
+
+  int configuration_size = sizeof(scaling_matrix)/sizeof(scaling_matrix[0]);
+  int index_configuration,index_argument,index_threads,selected,first=_TRUE_;
+  int thread_num=0,threads[_SCALING_THREADS_MAX_],processors=1;
+  char * json_name = "thread_scaling.json";
+  char * list;
+  int pipe_fd[2];
+  pid_t pid;
+  ssize_t bytes,read_bytes;
+  struct scaling_result * result;
+  FILE * json;
+
+#ifdef _OPENMP
+  processors = omp_get_num_procs();
+#endif
+
+  if (argc > 1)
+    json_name = argv[1];
+
+  /* numbers of threads */
+  if (argc > 2) {
+    for (list=strtok(argv[2],","); (list != NULL) && (thread_num < _SCALING_THREADS_MAX_); list=strtok(NULL,",")) {
+      threads[thread_num] = atoi(list);
+      if (threads[thread_num] < 1) {
+        printf("\n\nError: wrong number of threads %s\n",list);
+        return _FAILURE_;
+      }
+      thread_num++;
+    }
+  }
+  else {
+    for (threads[0]=1,thread_num=1; (2*threads[thread_num-1] <= MAX(processors,2)) && (thread_num < _SCALING_THREADS_MAX_); thread_num++)
+      threads[thread_num] = 2*threads[thread_num-1];
+  }
+
+  for (index_threads=0; index_threads<thread_num; index_threads++)
+    if (threads[index_threads] > processors)
+      printf("Warning: %d threads on %d processors, the timings with more threads than processors are not meaningful\n",
+             threads[index_threads],processors);
+
+  result = malloc(thread_num*sizeof(struct scaling_result));
+  if (result == NULL) {
+    printf("\n\nError: could not allocate the results\n");
+    return _FAILURE_;
+  }
+
+  json = fopen(json_name,"w");
+  if (json == NULL) {
+    printf("\n\nError: could not open %s\n",json_name);
+    return _FAILURE_;
+  }
+
+  fprintf(json,"{\n");
+  fprintf(json,"  \"version\": \"%s\",\n",_VERSION_);
+  fprintf(json,"  \"processors\": %d,\n",processors);
+  fprintf(json,"  \"efficiency_min\": %g,\n",_SCALING_EFFICIENCY_MIN_);
+  fprintf(json,"  \"configurations\": {\n");
+
+  for (index_configuration=0; index_configuration<configuration_size; index_configuration++) {
+
+    /* only the configurations given in argument, if any */
+    selected = (argc <= 3);
+    for (index_argument=3; index_argument<argc; index_argument++)
+      if (strcmp(argv[index_argument],scaling_matrix[index_configuration].name) == 0)
+        selected = _TRUE_;
+    if (selected == _FALSE_)
+      continue;
+
+    for (index_threads=0; index_threads<thread_num; index_threads++) {
+
+      /* run the configuration in a child process, which sends back its results
+         (this process never starts OpenMP threads, which would not survive fork()) */
+      if (pipe(pipe_fd) != 0) {
+        printf("\n\nError: could not create a pipe\n");
+        return _FAILURE_;
+      }
+
+      pid = fork();
+
+      if (pid < 0) {
+        printf("\n\nError: could not fork\n");
+        return _FAILURE_;
+      }
+
+      if (pid == 0) {
+        close(pipe_fd[0]);
+        scaling_run(&(scaling_matrix[index_configuration]),threads[index_threads],&(result[index_threads]));
+        bytes = write(pipe_fd[1],&(result[index_threads]),sizeof(struct scaling_result));
+        close(pipe_fd[1]);
+        _exit(bytes == sizeof(struct scaling_result) ? 0 : 1);
+      }
+
+      close(pipe_fd[1]);
+      bytes = 0;
+      while (bytes < (ssize_t)sizeof(struct scaling_result)) {
+        read_bytes = read(pipe_fd[0],(char*)&(result[index_threads])+bytes,sizeof(struct scaling_result)-bytes);
+        if (read_bytes <= 0)
+          break;
+        bytes += read_bytes;
+      }
+      close(pipe_fd[0]);
+      waitpid(pid,NULL,0);
+
+      if (bytes != sizeof(struct scaling_result)) {
+        result[index_threads].status = _FAILURE_;
+        sprintf(result[index_threads].error_message,"the benchmark process stopped before sending its results");
+      }
+    }
+
+    scaling_report(json,first,scaling_matrix[index_configuration].name,thread_num,threads,result);
+    first = _FALSE_;
+  }
+
+  fprintf(json,"\n  }\n");
+  fprintf(json,"}\n");
+  fclose(json);
+  free(result);
+
+  printf(" -> written %s\n",json_name);
+
+  return _SUCCESS_;
+}
+
+/**
+ * Print the scaling of each region of one configuration, and write it
+ * in the JSON file. The reference of the speed-ups is the first run
+ * (smallest number of threads) in which the region was executed.
+ */
+
+int scaling_report(FILE * json, int first, char * name, int thread_num, int * threads, struct scaling_result * result) {
+
+  int index_threads,index_region,index_other,index_reference,flagged,first_region=_TRUE_;
+  struct parallel_timing_region * pregion, * preference;
+  double speedup,efficiency,imbalance;
+
+  printf("\n%s\n",name);
+  fprintf(json,"%s    \"%s\": {\n",(first == _TRUE_) ? "" : ",\n",name);
+
+  for (index_threads=0; index_threads<thread_num; index_threads++) {
+    if (result[index_threads].status == _FAILURE_) {
+      printf("failed with %d threads\n=>%s\n",threads[index_threads],result[index_threads].error_message);
+      fprintf(json,"      \"status\": \"failure\"\n    }");
+      return _FAILURE_;
+    }
+  }
+
+  fprintf(json,"      \"status\": \"success\",\n");
+  fprintf(json,"      \"threads\": [");
+  for (index_threads=0; index_threads<thread_num; index_threads++)
+    fprintf(json,"%s%d",(index_threads == 0) ? "" : ", ",threads[index_threads]);
+  fprintf(json,"],\n");
+  fprintf(json,"      \"total_wall\": [");
+  for (index_threads=0; index_threads<thread_num; index_threads++)
+    fprintf(json,"%s%.6f",(index_threads == 0) ? "" : ", ",result[index_threads].wall);
+  fprintf(json,"],\n");
+  fprintf(json,"      \"regions\": {\n");
+
+  printf(" %-42s %8s %6s %12s %8s %10s %9s\n","region","threads","calls","wall (s)","speed-up","efficiency","imbalance");
+
+  /* the regions in the order of the run with the smallest number of threads, then those executed only with more threads */
+  for (index_threads=0; index_threads<thread_num; index_threads++) {
+    for (index_region=0; index_region<result[index_threads].region_num; index_region++) {
+
+      pregion = &(result[index_threads].region[index_region]);
+
+      /* skip the regions already reported with the previous runs */
+      index_reference = -1;
+      for (index_other=0; (index_other<index_threads) && (index_reference < 0); index_other++)
+        if (scaling_region_find(pregion->name,result+index_other) != NULL)
+          index_reference = index_other;
+      if (index_reference >= 0)
+        continue;
+
+      preference = pregion;
+      flagged = _FALSE_;
+
+      fprintf(json,"%s        \"%s\": [",(first_region == _TRUE_) ? "" : ",\n",pregion->name);
+      first_region = _FALSE_;
+
+      for (index_other=index_threads; index_other<thread_num; index_other++) {
+
+        pregion = scaling_region_find(preference->name,result+index_other);
+
+        if (pregion == NULL) {
+          printf(" %-42s %8d %6s\n",preference->name,threads[index_other],"-");
+          continue;
+        }
+
+        speedup = (pregion->wall > 0.) ? preference->wall/pregion->wall : 0.;
+        efficiency = speedup*threads[index_threads]/threads[index_other];
+        imbalance = (pregion->busy_mean > 0.) ? pregion->busy_max/pregion->busy_mean : 1.;
+
+        printf(" %-42s %8d %6d %12.6f %8.2f %9.0f%% %9.2f%s\n",
+               pregion->name,
+               threads[index_other],
+               pregion->calls,
+               pregion->wall,
+               speedup,
+               100.*efficiency,
+               imbalance,
+               ((efficiency < _SCALING_EFFICIENCY_MIN_) && (preference->wall >= _SCALING_TIME_MIN_)) ? "   LOW EFFICIENCY" : "");
+
+        if ((efficiency < _SCALING_EFFICIENCY_MIN_) && (preference->wall >= _SCALING_TIME_MIN_))
+          flagged = _TRUE_;
+
+        fprintf(json,"%s\n          {\"threads\": %d, \"calls\": %d, \"wall\": %.6f, \"busy_mean\": %.6f, \"busy_max\": %.6f, \"speedup\": %.4f, \"efficiency\": %.4f, \"imbalance\": %.4f}",
+                (index_other == index_threads) ? "" : ",",
+                threads[index_other],
+                pregion->calls,
+                pregion->wall,
+                pregion->busy_mean,
+                pregion->busy_max,
+                speedup,
+                efficiency,
+                imbalance);
+      }
+
+      fprintf(json,"\n        ]");
+
+      if (flagged == _TRUE_)
+        printf(" -> %s: parallel efficiency below %.0f%%\n",preference->name,100.*_SCALING_EFFICIENCY_MIN_);
+    }
+  }
+
+  fprintf(json,"\n      }\n    }");
+  fflush(json);
+
+  return _SUCCESS_;
+}
+
+/**
+ * Compute one configuration with a given number of threads, timing
+ * the parallel regions
+ */
+
+int scaling_run(struct scaling_configuration * psc, int threads, struct scaling_result * psr) {
+
+  struct file_content fc;
+  struct precision pr;
+  struct background ba;
+  struct thermo th;
+  struct perturbs pt;
+  struct transfers tr;
+  struct primordial pm;
+  struct spectra sp;
+  struct nonlinear nl;
+  struct lensing le;
+  struct output op;
+  int index_parameter,parameter_size;
+
+  psr->status = _FAILURE_;
+  psr->region_num = 0;
+  psr->wall = 0.;
+  strcpy(psr->error_message,"");
+
+#ifdef _OPENMP
+  omp_set_num_threads(threads);
+  psr->wall = omp_get_wtime();
+#endif
+
+  parameter_size = 0;
+  while (psc->parameters[2*parameter_size] != NULL)
+    parameter_size++;
+
+  class_call(parser_init(&fc,parameter_size,"scaling",psr->error_message),
+             psr->error_message,
+             psr->error_message);
+  for (index_parameter=0; index_parameter<parameter_size; index_parameter++) {
+    strcpy(fc.name[index_parameter],psc->parameters[2*index_parameter]);
+    strcpy(fc.value[index_parameter],psc->parameters[2*index_parameter+1]);
+  }
+
+  parallel_timing_reset();
+  parallel_timing_enable(_TRUE_);
+
+  class_call(input_init(&fc,&pr,&ba,&th,&pt,&tr,&pm,&sp,&nl,&le,&op,psr->error_message),
+             psr->error_message,
+             psr->error_message);
+
+  ba.background_verbose = 0;
+  th.thermodynamics_verbose = 0;
+  pt.perturbations_verbose = 0;
+  pm.primordial_verbose = 0;
+  nl.nonlinear_verbose = 0;
+  tr.transfer_verbose = 0;
+  sp.spectra_verbose = 0;
+  le.lensing_verbose = 0;
+
+  class_call(background_init(&pr,&ba),ba.error_message,psr->error_message);
+  class_call(thermodynamics_init(&pr,&ba,&th),th.error_message,psr->error_message);
+  class_call(perturb_init(&pr,&ba,&th,&pt),pt.error_message,psr->error_message);
+  class_call(primordial_init(&pr,&pt,&pm),pm.error_message,psr->error_message);
+  class_call(nonlinear_init(&pr,&ba,&th,&pt,&pm,&nl),nl.error_message,psr->error_message);
+  class_call(transfer_init(&pr,&ba,&th,&pt,&nl,&tr),tr.error_message,psr->error_message);
+  class_call(spectra_init(&pr,&ba,&pt,&pm,&nl,&tr,&sp),sp.error_message,psr->error_message);
+  class_call(lensing_init(&pr,&pt,&sp,&nl,&le),le.error_message,psr->error_message);
+
+  parallel_timing_enable(_FALSE_);
+
+#ifdef _OPENMP
+  psr->wall = omp_get_wtime()-psr->wall;
+#endif
+
+  class_call(parallel_timing_get(psr->region,&(psr->region_num)),
+             psr->error_message,
+             psr->error_message);
+
+  class_call(lensing_free(&le),le.error_message,psr->error_message);
+  class_call(spectra_free(&sp),sp.error_message,psr->error_message);
+  class_call(transfer_free(&tr),tr.error_message,psr->error_message);
+  class_call(nonlinear_free(&nl),nl.error_message,psr->error_message);
+  class_call(primordial_free(&pm),pm.error_message,psr->error_message);
+  class_call(perturb_free(&pt),pt.error_message,psr->error_message);
+  class_call(thermodynamics_free(&th),th.error_message,psr->error_message);
+  class_call(background_free(&ba),ba.error_message,psr->error_message);
+  parser_free(&fc);
+
+  psr->status = _SUCCESS_;
+
+  return _SUCCESS_;
+}
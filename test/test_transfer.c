@@ -104,17 +104,14 @@ int main(int argc, char **argv) {
 
           /* use this to plot a single type : */
 
-          transfer = tr.transfer[index_mode]
-            [((index_ic * tr.tt_size[index_mode] + index_type)
-              * tr.l_size[index_mode] + index_l)
-             * tr.q_size + index_q];
+          transfer = _transfer_value_(&tr,index_mode,_transfer_row_(&tr,index_mode,index_ic,index_type,index_l),index_q);
 
           /* or use this to plot the full temperature transfer function: */
           /*
           transfer =
-            tr.transfer[index_mode][((index_ic * tr.tt_size[index_mode] + tr.index_tt_t0) * tr.l_size[index_mode] + index_l) * tr.q_size + index_q] +
-            tr.transfer[index_mode][((index_ic * tr.tt_size[index_mode] + tr.index_tt_t1) * tr.l_size[index_mode] + index_l) * tr.q_size + index_q] +
-            tr.transfer[index_mode][((index_ic * tr.tt_size[index_mode] + tr.index_tt_t2) * tr.l_size[index_mode] + index_l) * tr.q_size + index_q];
+            _transfer_value_(&tr,index_mode,_transfer_row_(&tr,index_mode,index_ic,tr.index_tt_t0,index_l),index_q) +
+            _transfer_value_(&tr,index_mode,_transfer_row_(&tr,index_mode,index_ic,tr.index_tt_t1,index_l),index_q) +
+            _transfer_value_(&tr,index_mode,_transfer_row_(&tr,index_mode,index_ic,tr.index_tt_t2,index_l),index_q);
           */
 
           if (transfer != 0.) {
@@ -0,0 +1,178 @@
+/** @file test_transfer_kernel.c
+ *
+ * Microbenchmark of the line-of-sight integral of the transfer module
+ * in the flat case: for each radial function type, compare the current
+ * path (interpolation of Phi_l and its derivatives into temporary
+ * arrays, combination into a radial function, then
+ * array_trapezoidal_convolution()) with the fused kernel
+ * hyperspherical_Hermite4_convolution(). The timings of both are
+ * printed, as well as the largest relative difference between the two
+ * integrals.
+ *
+ * Usage: ./test_transfer_kernel [number of repetitions]
+ */
+
+#include "common.h"
+#include "arrays.h"
+#include "hyperspherical.h"
+
+/* wall-clock time (s) */
+double kernel_time() {
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+int main(int argc, char **argv) {
+
+  HyperInterpStruct BIS;
+  ErrorMsg error_message;
+
+  int l_size=60,tau_size=2000,k_size=40,repeat=5;
+  int *lvec;
+  int index_l,index_k,index_tau,index_type,index_repeat;
+  double tau0=14000.,k,l,scale;
+  double *tau,*w,*source,*chi,*chireverse,*csc;
+  double *Phi,*dPhi,*d2Phi,*radial;
+  double result_old,result_fused,last_radial,norm;
+  double t_old,t_fused,start,max_diff;
+  double c_phi,c_phi_csc2,c_dphi,c_d2phi;
+  const char * type_name[4] = {"T0","T1","T2","E"};
+
+  if (argc > 1)
+    repeat = atoi(argv[1]);
+
+  /* same multipoles and Bessel sampling as in a default run */
+  lvec = malloc(sizeof(int)*l_size);
+  for (index_l=0; index_l<l_size; index_l++)
+    lvec[index_l] = 2+index_l*index_l;
+
+  if (hyperspherical_HIS_create(0,1.,l_size,lvec,1.e-5,6000.,8.,lvec[l_size-1]+1,1.e-10,&BIS,error_message) == _FAILURE_) {
+    printf("\n\nError in hyperspherical_HIS_create \n=>%s\n",error_message);
+    return _FAILURE_;
+  }
+
+  tau = malloc(sizeof(double)*tau_size);
+  w = malloc(sizeof(double)*tau_size);
+  source = malloc(sizeof(double)*tau_size);
+  chi = malloc(sizeof(double)*tau_size);
+  chireverse = malloc(sizeof(double)*tau_size);
+  csc = malloc(sizeof(double)*tau_size);
+  Phi = malloc(sizeof(double)*tau_size);
+  dPhi = malloc(sizeof(double)*tau_size);
+  d2Phi = malloc(sizeof(double)*tau_size);
+  radial = malloc(sizeof(double)*tau_size);
+
+  /* a time sampling denser near recombination, and a smooth source peaked there */
+  for (index_tau=0; index_tau<tau_size; index_tau++) {
+    tau[index_tau] = 1.+(tau0-2.)*pow((double)index_tau/(tau_size-1),2);
+    source[index_tau] = exp(-pow((tau[index_tau]-280.)/20.,2))+1.e-3*exp(-tau[index_tau]/tau0);
+  }
+
+  if (array_trapezoidal_weights(tau,tau_size,w,error_message) == _FAILURE_) {
+    printf("\n\nError in array_trapezoidal_weights \n=>%s\n",error_message);
+    return _FAILURE_;
+  }
+
+  for (index_type=0; index_type<4; index_type++) {
+
+    t_old = 0.;
+    t_fused = 0.;
+    max_diff = 0.;
+
+    for (index_repeat=0; index_repeat<repeat; index_repeat++) {
+      for (index_k=0; index_k<k_size; index_k++) {
+
+        k = 1.e-4*pow(0.4/1.e-4,(double)index_k/(k_size-1));
+
+        for (index_tau=0; index_tau<tau_size; index_tau++) {
+          chi[index_tau] = k*(tau0-tau[index_tau]);
+          chireverse[tau_size-1-index_tau] = chi[index_tau];
+          csc[index_tau] = 1./chi[index_tau];
+        }
+
+        for (index_l=0; index_l<l_size; index_l++) {
+
+          l = (double)lvec[index_l];
+          c_phi = 0.;
+          c_phi_csc2 = 0.;
+          c_dphi = 0.;
+          c_d2phi = 0.;
+
+          /** - current path, as in transfer_radial_function() */
+          start = kernel_time();
+
+          switch (index_type) {
+          case 0:
+            hyperspherical_Hermite4_interpolation_vector_Phi(&BIS,tau_size,index_l,chireverse,Phi,error_message);
+            for (index_tau=0; index_tau<tau_size; index_tau++)
+              radial[index_tau] = Phi[tau_size-1-index_tau];
+            c_phi = 1.;
+            break;
+          case 1:
+            hyperspherical_Hermite4_interpolation_vector_dPhi(&BIS,tau_size,index_l,chireverse,dPhi,error_message);
+            for (index_tau=0; index_tau<tau_size; index_tau++)
+              radial[index_tau] = dPhi[tau_size-1-index_tau];
+            c_dphi = 1.;
+            break;
+          case 2:
+            hyperspherical_Hermite4_interpolation_vector_Phid2Phi(&BIS,tau_size,index_l,chireverse,Phi,d2Phi,error_message);
+            for (index_tau=0; index_tau<tau_size; index_tau++)
+              radial[index_tau] = 0.5*Phi[tau_size-1-index_tau]+1.5*d2Phi[tau_size-1-index_tau];
+            c_phi = 0.5;
+            c_d2phi = 1.5;
+            break;
+          case 3:
+            scale = sqrt(3.0/8.0*(l+2.0)*(l+1.0)*l*(l-1.0));
+            hyperspherical_Hermite4_interpolation_vector_Phi(&BIS,tau_size,index_l,chireverse,Phi,error_message);
+            for (index_tau=0; index_tau<tau_size; index_tau++)
+              radial[index_tau] = scale*Phi[tau_size-1-index_tau]*csc[index_tau]*csc[index_tau];
+            c_phi_csc2 = scale;
+            break;
+          }
+
+          array_trapezoidal_convolution(source,radial,tau_size,w,&result_old,error_message);
+
+          t_old += kernel_time()-start;
+
+          /** - fused kernel */
+          start = kernel_time();
+
+          if (hyperspherical_Hermite4_convolution(&BIS,tau_size,index_l,chi,source,w,csc,
+                                                  c_phi,c_phi_csc2,c_dphi,c_d2phi,
+                                                  &result_fused,&last_radial,error_message) == _FAILURE_) {
+            printf("\n\nError in hyperspherical_Hermite4_convolution \n=>%s\n",error_message);
+            return _FAILURE_;
+          }
+
+          t_fused += kernel_time()-start;
+
+          norm = MAX(fabs(result_old),1.e-10);
+          max_diff = MAX(max_diff,fabs(result_fused-result_old)/norm);
+        }
+      }
+    }
+
+    printf("%s: current path %g s, fused kernel %g s (speed-up %.2f), largest relative difference %e\n",
+           type_name[index_type],t_old,t_fused,t_old/t_fused,max_diff);
+  }
+
+  free(tau);
+  free(w);
+  free(source);
+  free(chi);
+  free(chireverse);
+  free(csc);
+  free(Phi);
+  free(dPhi);
+  free(d2Phi);
+  free(radial);
+  free(lvec);
+
+  hyperspherical_HIS_free(&BIS,error_message);
+
+  return _SUCCESS_;
+
+}
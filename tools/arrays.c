@@ -546,6 +546,28 @@ int array_spline_table_line_to_line(
   return _SUCCESS_;
  }
 
+/**
+ * Spline the columns of the table y_array[index_x*y_size+index_y]
+ * along x, i.e. compute the second derivatives ddy_array (same layout).
+ *
+ * All columns share the same abscissae, so that their tridiagonal
+ * systems are solved together by array_spline_table_lines_block(): each
+ * step of the forward and backward sweeps updates a whole line of the
+ * table, in SIMD lanes. Wide tables (at least
+ * _SPLINE_TABLE_PARALLEL_SIZE_ elements) are further split into
+ * contiguous blocks of columns, one for each thread. Called from within
+ * a parallel region, the function runs on a single thread (unless
+ * nested parallelism is enabled).
+ *
+ * @param x           Input: vector of size x_size
+ * @param x_size      Input: number of lines
+ * @param y_array     Input: array of size x_size*y_size
+ * @param y_size      Input: number of columns
+ * @param ddy_array   Output: array of size x_size*y_size
+ * @param spline_mode Input: _SPLINE_NATURAL_ or _SPLINE_EST_DERIV_
+ * @param errmsg      Output: error message
+ * @return the error status
+ */
 int array_spline_table_lines(
 			     double * x, /* vector of size x_size */
 			     int x_size,
@@ -557,157 +579,239 @@ int array_spline_table_lines(
 			     ErrorMsg errmsg
 			     ) {
 
-  double * p;
-  double * qn;
-  double * un;
   double * u;
-  double sig;
-  int index_x;
-  int index_y;
-  double dy_first;
-  double dy_last;
+  short parallel;
+  struct parallel_timer timer;
+
+  if (x_size==2) spline_mode = _SPLINE_NATURAL_; // in the case of only 2 x-values, only the natural spline method is appropriate, for _SPLINE_EST_DERIV_ at least 3 x-values are needed.
+
+  if ((spline_mode != _SPLINE_NATURAL_) && (spline_mode != _SPLINE_EST_DERIV_)) {
+    sprintf(errmsg,"%s(L:%d) Spline mode not identified: %d",__func__,__LINE__,spline_mode);
+    return _FAILURE_;
+  }
 
   u = malloc((x_size-1) * y_size * sizeof(double));
-  p = malloc(y_size * sizeof(double));
-  qn = malloc(y_size * sizeof(double));
-  un = malloc(y_size * sizeof(double));
 
   if (u == NULL) {
     sprintf(errmsg,"%s(L:%d) Cannot allocate u",__func__,__LINE__);
     return _FAILURE_;
   }
-  if (p == NULL) {
-    sprintf(errmsg,"%s(L:%d) Cannot allocate p",__func__,__LINE__);
-    return _FAILURE_;
-  }
-  if (qn == NULL) {
-    sprintf(errmsg,"%s(L:%d) Cannot allocate qn",__func__,__LINE__);
-    return _FAILURE_;
-  }
-  if (un == NULL) {
-    sprintf(errmsg,"%s(L:%d) Cannot allocate un",__func__,__LINE__);
-    return _FAILURE_;
+
+  /* only the tables large enough to be split between threads are timed */
+  parallel = ((y_size > 1) && ((long)x_size*y_size >= _SPLINE_TABLE_PARALLEL_SIZE_));
+
+  if (parallel == _TRUE_)
+    parallel_timer_start(&timer);
+
+#pragma omp parallel if (parallel)
+  {
+#ifdef _OPENMP
+    int y_min = (int)(((long)y_size*omp_get_thread_num())/omp_get_num_threads());
+    int y_max = (int)(((long)y_size*(omp_get_thread_num()+1))/omp_get_num_threads());
+#else
+    int y_min = 0;
+    int y_max = y_size;
+#endif
+
+    array_spline_table_lines_block(x,x_size,y_array,y_size,ddy_array,u,spline_mode,y_min,y_max);
+
+    if (parallel == _TRUE_)
+      parallel_timer_thread_done(&timer);
   }
 
-  if (x_size==2) spline_mode = _SPLINE_NATURAL_; // in the case of only 2 x-values, only the natural spline method is appropriate, for _SPLINE_EST_DERIV_ at least 3 x-values are needed.
+  if (parallel == _TRUE_)
+    parallel_timer_stop(&timer,"array_spline_table_lines");
 
-  index_x=0;
+  free(u);
+
+  return _SUCCESS_;
+ }
+
+/**
+ * Spline the block of columns y_min <= index_y < y_max of the table
+ * y_array[index_x*y_size+index_y], for array_spline_table_lines(). Each
+ * element goes through the same operations as in a column-by-column
+ * solution, the loops over the columns of a line being vectorized.
+ *
+ * @param x           Input: vector of size x_size
+ * @param x_size      Input: number of lines (at least 2, at least 3 for _SPLINE_EST_DERIV_)
+ * @param y_array     Input: array of size x_size*y_size
+ * @param y_size      Input: number of columns
+ * @param ddy_array   Output: array of size x_size*y_size, filled in the block of columns
+ * @param u           Input: work space of size (x_size-1)*y_size
+ * @param spline_mode Input: _SPLINE_NATURAL_ or _SPLINE_EST_DERIV_
+ * @param y_min       Input: first column of the block
+ * @param y_max       Input: last column of the block plus one
+ * @return the error status
+ */
+int array_spline_table_lines_block(
+                                   double * x,
+                                   int x_size,
+                                   double * y_array,
+                                   int y_size,
+                                   double * ddy_array,
+                                   double * u,
+                                   short spline_mode,
+                                   int y_min,
+                                   int y_max
+                                   ) {
+
+  double * y_prev2;
+  double * y_prev;
+  double * y_line;
+  double * y_next;
+  double * y_next2;
+  double * ddy_prev;
+  double * ddy_line;
+  double * ddy_next;
+  double * u_prev;
+  double * u_line;
+  double sig;
+  double dx_prev;
+  double dx_next;
+  double dx_tot;
+  int index_x;
+  int index_y;
+
+  /* first line */
+
+  ddy_line = ddy_array;
+  u_line = u;
 
   if (spline_mode == _SPLINE_NATURAL_) {
-    for (index_y=0; index_y < y_size; index_y++) {
-      ddy_array[index_x*y_size+index_y] = u[index_x*y_size+index_y] = 0.0;
+#pragma omp simd
+    for (index_y=y_min; index_y < y_max; index_y++) {
+      ddy_line[index_y] = u_line[index_y] = 0.0;
     }
   }
   else {
-    if (spline_mode == _SPLINE_EST_DERIV_) {
+    y_line = y_array;
+    y_next = y_array + y_size;
+    y_next2 = y_array + 2*y_size;
 
-      for (index_y=0; index_y < y_size; index_y++) {
+#pragma omp simd
+    for (index_y=y_min; index_y < y_max; index_y++) {
 
-	dy_first =
-	  ((x[2]-x[0])*(x[2]-x[0])*
-	   (y_array[1*y_size+index_y]-y_array[0*y_size+index_y])-
-	   (x[1]-x[0])*(x[1]-x[0])*
-	   (y_array[2*y_size+index_y]-y_array[0*y_size+index_y]))/
-	  ((x[2]-x[0])*(x[1]-x[0])*(x[2]-x[1]));
-
-	ddy_array[index_x*y_size+index_y] = -0.5;
+      double dy_first =
+        ((x[2]-x[0])*(x[2]-x[0])*
+         (y_next[index_y]-y_line[index_y])-
+         (x[1]-x[0])*(x[1]-x[0])*
+         (y_next2[index_y]-y_line[index_y]))/
+        ((x[2]-x[0])*(x[1]-x[0])*(x[2]-x[1]));
 
-	u[index_x*y_size+index_y] =
-	  (3./(x[1] -  x[0]))*
-	  ((y_array[1*y_size+index_y]-y_array[0*y_size+index_y])/
-	   (x[1] - x[0])-dy_first);
+      ddy_line[index_y] = -0.5;
 
-      }
-    }
-    else {
-      sprintf(errmsg,"%s(L:%d) Spline mode not identified: %d",__func__,__LINE__,spline_mode);
-      return _FAILURE_;
+      u_line[index_y] =
+        (3./(x[1] -  x[0]))*
+        ((y_next[index_y]-y_line[index_y])/
+         (x[1] - x[0])-dy_first);
     }
   }
 
+  /* forward sweep */
 
   for (index_x=1; index_x < x_size-1; index_x++) {
 
-    sig = (x[index_x] - x[index_x-1])/(x[index_x+1] - x[index_x-1]);
+    y_prev = y_array + (index_x-1)*y_size;
+    y_line = y_prev + y_size;
+    y_next = y_line + y_size;
+    ddy_prev = ddy_array + (index_x-1)*y_size;
+    ddy_line = ddy_prev + y_size;
+    u_prev = u + (index_x-1)*y_size;
+    u_line = u_prev + y_size;
 
-    for (index_y=0; index_y < y_size; index_y++) {
+    sig = (x[index_x] - x[index_x-1])/(x[index_x+1] - x[index_x-1]);
+    dx_prev = x[index_x] - x[index_x-1];
+    dx_next = x[index_x+1] - x[index_x];
+    dx_tot = x[index_x+1] - x[index_x-1];
 
-      p[index_y] = sig * ddy_array[(index_x-1)*y_size+index_y] + 2.0;
+#pragma omp simd
+    for (index_y=y_min; index_y < y_max; index_y++) {
 
-      ddy_array[index_x*y_size+index_y] = (sig-1.0)/p[index_y];
+      double p = sig * ddy_prev[index_y] + 2.0;
 
-      u[index_x*y_size+index_y] =
-	(y_array[(index_x+1)*y_size+index_y] - y_array[index_x*y_size+index_y])
-	/ (x[index_x+1] - x[index_x])
-	- (y_array[index_x*y_size+index_y] - y_array[(index_x-1)*y_size+index_y])
-	/ (x[index_x] - x[index_x-1]);
+      ddy_line[index_y] = (sig-1.0)/p;
 
-      u[index_x*y_size+index_y] = (6.0 * u[index_x*y_size+index_y] /
-				   (x[index_x+1] - x[index_x-1])
-				   - sig * u[(index_x-1)*y_size+index_y]) / p[index_y];
+      u_line[index_y] = (6.0 * ((y_next[index_y] - y_line[index_y]) / dx_next
+                                - (y_line[index_y] - y_prev[index_y]) / dx_prev) / dx_tot
+                         - sig * u_prev[index_y]) / p;
     }
-
   }
 
-  if (spline_mode == _SPLINE_NATURAL_) {
+  /* last line */
 
-    for (index_y=0; index_y < y_size; index_y++) {
-      qn[index_y]=un[index_y]=0.0;
-    }
+  index_x = x_size-1;
+  y_line = y_array + index_x*y_size;
+  ddy_prev = ddy_array + (index_x-1)*y_size;
+  ddy_line = ddy_prev + y_size;
+  u_prev = u + (index_x-1)*y_size;
 
+  if (spline_mode == _SPLINE_NATURAL_) {
+#pragma omp simd
+    for (index_y=y_min; index_y < y_max; index_y++) {
+      ddy_line[index_y] = 0.0;
+    }
   }
   else {
-    if (spline_mode == _SPLINE_EST_DERIV_) {
+    y_prev = y_line - y_size;
+    y_prev2 = y_line - 2*y_size;
 
-      for (index_y=0; index_y < y_size; index_y++) {
+#pragma omp simd
+    for (index_y=y_min; index_y < y_max; index_y++) {
 
-	dy_last =
-	  ((x[x_size-3]-x[x_size-1])*(x[x_size-3]-x[x_size-1])*
-	   (y_array[(x_size-2)*y_size+index_y]-y_array[(x_size-1)*y_size+index_y])-
-	   (x[x_size-2]-x[x_size-1])*(x[x_size-2]-x[x_size-1])*
-	   (y_array[(x_size-3)*y_size+index_y]-y_array[(x_size-1)*y_size+index_y]))/
-	  ((x[x_size-3]-x[x_size-1])*(x[x_size-2]-x[x_size-1])*(x[x_size-3]-x[x_size-2]));
+      double dy_last =
+        ((x[x_size-3]-x[x_size-1])*(x[x_size-3]-x[x_size-1])*
+         (y_prev[index_y]-y_line[index_y])-
+         (x[x_size-2]-x[x_size-1])*(x[x_size-2]-x[x_size-1])*
+         (y_prev2[index_y]-y_line[index_y]))/
+        ((x[x_size-3]-x[x_size-1])*(x[x_size-2]-x[x_size-1])*(x[x_size-3]-x[x_size-2]));
 
-	qn[index_y]=0.5;
+      double qn = 0.5;
 
-	un[index_y]=
-	  (3./(x[x_size-1] - x[x_size-2]))*
-	  (dy_last-(y_array[(x_size-1)*y_size+index_y] - y_array[(x_size-2)*y_size+index_y])/
-	   (x[x_size-1] - x[x_size-2]));
+      double un =
+        (3./(x[x_size-1] - x[x_size-2]))*
+        (dy_last-(y_line[index_y] - y_prev[index_y])/
+         (x[x_size-1] - x[x_size-2]));
 
-      }
-    }
-    else {
-      sprintf(errmsg,"%s(L:%d) Spline mode not identified: %d",__func__,__LINE__,spline_mode);
-      return _FAILURE_;
+      ddy_line[index_y] = (un - qn * u_prev[index_y]) / (qn * ddy_prev[index_y] + 1.0);
     }
   }
 
-  index_x=x_size-1;
-
-  for (index_y=0; index_y < y_size; index_y++) {
-    ddy_array[index_x*y_size+index_y] =
-      (un[index_y] - qn[index_y] * u[(index_x-1)*y_size+index_y]) /
-      (qn[index_y] * ddy_array[(index_x-1)*y_size+index_y] + 1.0);
-  }
+  /* back-substitution */
 
   for (index_x=x_size-2; index_x >= 0; index_x--) {
-    for (index_y=0; index_y < y_size; index_y++) {
 
-      ddy_array[index_x*y_size+index_y] = ddy_array[index_x*y_size+index_y] *
-	ddy_array[(index_x+1)*y_size+index_y] + u[index_x*y_size+index_y];
+    ddy_line = ddy_array + index_x*y_size;
+    ddy_next = ddy_line + y_size;
+    u_line = u + index_x*y_size;
 
+#pragma omp simd
+    for (index_y=y_min; index_y < y_max; index_y++) {
+      ddy_line[index_y] = ddy_line[index_y] * ddy_next[index_y] + u_line[index_y];
     }
   }
 
-  free(qn);
-  free(un);
-  free(p);
-  free(u);
-
   return _SUCCESS_;
- }
+}
 
+/**
+ * Spline the logarithm of the columns of the table
+ * y_array[index_x*y_size+index_y] as a function of log(x): compute the
+ * second derivatives ddlny_array of ln(y) with respect to ln(x) (same
+ * layout).
+ *
+ * The logarithms of x and of the table are taken once and passed to
+ * array_spline_table_lines(), instead of being recomputed at each use.
+ *
+ * @param x           Input: vector of size x_size
+ * @param x_size      Input: number of lines
+ * @param y_array     Input: array of size x_size*y_size (positive elements)
+ * @param y_size      Input: number of columns
+ * @param ddlny_array Output: array of size x_size*y_size
+ * @param spline_mode Input: _SPLINE_NATURAL_ or _SPLINE_EST_DERIV_
+ * @param errmsg      Output: error message
+ * @return the error status
+ */
 int array_logspline_table_lines(
 			     double * x, /* vector of size x_size */
 			     int x_size,
@@ -719,155 +823,36 @@ int array_logspline_table_lines(
 			     ErrorMsg errmsg
 			     ) {
 
-  double * p;
-  double * qn;
-  double * un;
-  double * u;
-  double sig;
+  double * lnx;
+  double * lny_array;
   int index_x;
-  int index_y;
-  double dy_first;
-  double dy_last;
+  int index;
+  int status;
 
-  u = malloc((x_size-1) * y_size * sizeof(double));
-  p = malloc(y_size * sizeof(double));
-  qn = malloc(y_size * sizeof(double));
-  un = malloc(y_size * sizeof(double));
-  if (u == NULL) {
-    sprintf(errmsg,"%s(L:%d) Cannot allocate u",__func__,__LINE__);
-    return _FAILURE_;
-  }
-  if (p == NULL) {
-    sprintf(errmsg,"%s(L:%d) Cannot allocate p",__func__,__LINE__);
-    return _FAILURE_;
-  }
-  if (qn == NULL) {
-    sprintf(errmsg,"%s(L:%d) Cannot allocate qn",__func__,__LINE__);
+  lnx = malloc(x_size * sizeof(double));
+  lny_array = malloc(x_size * y_size * sizeof(double));
+
+  if (lnx == NULL) {
+    sprintf(errmsg,"%s(L:%d) Cannot allocate lnx",__func__,__LINE__);
     return _FAILURE_;
   }
-  if (un == NULL) {
-    sprintf(errmsg,"%s(L:%d) Cannot allocate un",__func__,__LINE__);
+  if (lny_array == NULL) {
+    sprintf(errmsg,"%s(L:%d) Cannot allocate lny_array",__func__,__LINE__);
     return _FAILURE_;
   }
 
-  if (x_size==2) spline_mode = _SPLINE_NATURAL_; // in the case of only 2 x-values, only the natural spline method is appropriate, for _SPLINE_EST_DERIV_ at least 3 x-values are needed.
-
-  index_x=0;
-
-  if (spline_mode == _SPLINE_NATURAL_) {
-    for (index_y=0; index_y < y_size; index_y++) {
-      ddlny_array[index_x*y_size+index_y] = u[index_x*y_size+index_y] = 0.0;
-    }
-  }
-  else {
-    if (spline_mode == _SPLINE_EST_DERIV_) {
-
-      for (index_y=0; index_y < y_size; index_y++) {
-
-	dy_first =
-	  ((log(x[2])-log(x[0]))*(log(x[2])-log(x[0]))*
-	   (log(y_array[1*y_size+index_y])-log(y_array[0*y_size+index_y]))-
-	   (log(x[1])-log(x[0]))*(log(x[1])-log(x[0]))*
-	   (log(y_array[2*y_size+index_y])-log(y_array[0*y_size+index_y])))/
-	  ((log(x[2])-log(x[0]))*(log(x[1])-log(x[0]))*(log(x[2])-log(x[1])));
-
-	ddlny_array[index_x*y_size+index_y] = -0.5;
-
-	u[index_x*y_size+index_y] =
-	  (3./(log(x[1]) - log(x[0])))*
-	  ((log(y_array[1*y_size+index_y])-log(y_array[0*y_size+index_y]))/
-	   (log(x[1]) - log(x[0]))-dy_first);
-
-      }
-    }
-    else {
-      sprintf(errmsg,"%s(L:%d) Spline mode not identified: %d",__func__,__LINE__,spline_mode);
-      return _FAILURE_;
-    }
-  }
-
-
-  for (index_x=1; index_x < x_size-1; index_x++) {
-
-    sig = (log(x[index_x]) - log(x[index_x-1]))/(log(x[index_x+1]) - log(x[index_x-1]));
-
-    for (index_y=0; index_y < y_size; index_y++) {
-
-      p[index_y] = sig * ddlny_array[(index_x-1)*y_size+index_y] + 2.0;
-
-      ddlny_array[index_x*y_size+index_y] = (sig-1.0)/p[index_y];
-
-      u[index_x*y_size+index_y] =
-	(log(y_array[(index_x+1)*y_size+index_y]) - log(y_array[index_x*y_size+index_y]))
-	/ (log(x[index_x+1]) - log(x[index_x]))
-	- (log(y_array[index_x*y_size+index_y]) - log(y_array[(index_x-1)*y_size+index_y]))
-	/ (log(x[index_x]) - log(x[index_x-1]));
-
-      u[index_x*y_size+index_y] = (6.0 * u[index_x*y_size+index_y] /
-				   (log(x[index_x+1]) - log(x[index_x-1]))
-				   - sig * u[(index_x-1)*y_size+index_y]) / p[index_y];
-    }
-
-  }
-
-  if (spline_mode == _SPLINE_NATURAL_) {
-
-    for (index_y=0; index_y < y_size; index_y++) {
-      qn[index_y]=un[index_y]=0.0;
-    }
-
-  }
-  else {
-    if (spline_mode == _SPLINE_EST_DERIV_) {
-
-      for (index_y=0; index_y < y_size; index_y++) {
-
-	dy_last =
-	  ((log(x[x_size-3])-log(x[x_size-1]))*(log(x[x_size-3])-log(x[x_size-1]))*
-	   (log(y_array[(x_size-2)*y_size+index_y])-log(y_array[(x_size-1)*y_size+index_y]))-
-	   (log(x[x_size-2])-log(x[x_size-1]))*(log(x[x_size-2])-log(x[x_size-1]))*
-	   (log(y_array[(x_size-3)*y_size+index_y])-log(y_array[(x_size-1)*y_size+index_y])))/
-	  ((log(x[x_size-3])-log(x[x_size-1]))*(log(x[x_size-2])-log(x[x_size-1]))*(log(x[x_size-3])-log(x[x_size-2])));
+  for (index_x=0; index_x < x_size; index_x++)
+    lnx[index_x] = log(x[index_x]);
 
-	qn[index_y]=0.5;
+  for (index=0; index < x_size*y_size; index++)
+    lny_array[index] = log(y_array[index]);
 
-	un[index_y]=
-	  (3./(log(x[x_size-1]) - log(x[x_size-2])))*
-	  (dy_last-(log(y_array[(x_size-1)*y_size+index_y]) - log(y_array[(x_size-2)*y_size+index_y]))/
-	   (log(x[x_size-1]) - log(x[x_size-2])));
+  status = array_spline_table_lines(lnx,x_size,lny_array,y_size,ddlny_array,spline_mode,errmsg);
 
-      }
-    }
-    else {
-      sprintf(errmsg,"%s(L:%d) Spline mode not identified: %d",__func__,__LINE__,spline_mode);
-      return _FAILURE_;
-    }
-  }
+  free(lnx);
+  free(lny_array);
 
-  index_x=x_size-1;
-
-
-  for (index_y=0; index_y < y_size; index_y++) {
-    ddlny_array[index_x*y_size+index_y] =
-      (un[index_y] - qn[index_y] * u[(index_x-1)*y_size+index_y]) /
-      (qn[index_y] * ddlny_array[(index_x-1)*y_size+index_y] + 1.0);
-  }
-
-  for (index_x=x_size-2; index_x >= 0; index_x--) {
-    for (index_y=0; index_y < y_size; index_y++) {
-
-      ddlny_array[index_x*y_size+index_y] = ddlny_array[index_x*y_size+index_y] *
-	ddlny_array[(index_x+1)*y_size+index_y] + u[index_x*y_size+index_y];
-
-    }
-  }
-
-  free(qn);
-  free(un);
-  free(p);
-  free(u);
-
-  return _SUCCESS_;
+  return status;
  }
 
 int array_spline_table_columns(
@@ -1061,6 +1046,7 @@ int array_spline_table_columns2(
   int index_y;
   double dy_first;
   double dy_last;
+  struct parallel_timer timer;
 
   u = malloc((x_size-1) * y_size * sizeof(double));
   p = malloc(y_size * sizeof(double));
@@ -1085,12 +1071,14 @@ int array_spline_table_columns2(
 
   if (x_size==2) spline_mode = _SPLINE_NATURAL_; // in the case of only 2 x-values, only the natural spline method is appropriate, for _SPLINE_EST_DERIV_ 3 x-values are needed.
 
+  parallel_timer_start(&timer);
+
 #pragma omp parallel                                                \
-  shared(x,x_size,y_array,y_size,ddy_array,spline_mode,p,qn,un,u)   \
+  shared(x,x_size,y_array,y_size,ddy_array,spline_mode,p,qn,un,u,timer) \
   private(index_y,index_x,sig,dy_first,dy_last)
   {
 
-#pragma omp for schedule (dynamic)
+#pragma omp for schedule (dynamic) nowait
 
     for (index_y=0; index_y < y_size; index_y++) {
 
@@ -1171,7 +1159,12 @@ int array_spline_table_columns2(
 
       }
     }
+
+    parallel_timer_thread_done(&timer);
   }
+
+  parallel_timer_stop(&timer,"array_spline_table_columns2");
+
   free(qn);
   free(p);
   free(u);
@@ -1760,6 +1753,72 @@ int array_interpolate_spline(
   return _SUCCESS_;
 }
 
+ /**
+  * interpolate to get y_i(x) for a list of columns only, when x and
+  * y_i are in different arrays and x is growing. The coefficients of
+  * the spline in the bracketing interval are computed once for all
+  * columns, and the interpolated value of column columns[i] is written
+  * in result[columns[i]] (other elements of result are not touched).
+  *
+  * Called by background_at_tau_columns().
+  */
+int array_interpolate_spline_columns(
+                                     double * __restrict__ x_array,
+                                     int n_lines,
+                                     double * __restrict__ array,
+                                     double * __restrict__ array_splined,
+                                     int n_columns,
+                                     double x,
+                                     int * __restrict__ last_index,
+                                     int * __restrict__ columns,
+                                     int column_size,
+                                     double * __restrict__ result,
+                                     ErrorMsg errmsg) {
+
+  int inf,sup,mid,i,index_y;
+  double h,a,b,ca,cb;
+
+  inf=0;
+  sup=n_lines-1;
+
+  if (x < x_array[inf]) {
+    sprintf(errmsg,"%s(L:%d) : x=%e < x_min=%e",__func__,__LINE__,x,x_array[inf]);
+    return _FAILURE_;
+  }
+
+  if (x > x_array[sup]) {
+    sprintf(errmsg,"%s(L:%d) : x=%e > x_max=%e",__func__,__LINE__,x,x_array[sup]);
+    return _FAILURE_;
+  }
+
+  while (sup-inf > 1) {
+
+    mid=(int)(0.5*(inf+sup));
+    if (x < x_array[mid]) {sup=mid;}
+    else {inf=mid;}
+
+  }
+
+  *last_index = inf;
+
+  h = x_array[sup] - x_array[inf];
+  b = (x-x_array[inf])/h;
+  a = 1-b;
+  ca = (a*a*a-a)*h*h/6.;
+  cb = (b*b*b-b)*h*h/6.;
+
+  for (i=0; i<column_size; i++) {
+    index_y = columns[i];
+    result[index_y] =
+      a * array[inf*n_columns+index_y] +
+      b * array[sup*n_columns+index_y] +
+      ca * array_splined[inf*n_columns+index_y] +
+      cb * array_splined[sup*n_columns+index_y];
+  }
+
+  return _SUCCESS_;
+}
+
  /**
   * Get the y[i] for which y[i]>c
   *
@@ -1826,6 +1885,172 @@ int array_search_bisect(
   return _SUCCESS_;
 }
 
+ /**
+  * Get the index inf such that c lies between array[inf] and
+  * array[inf+1], for a monotonic (growing or decreasing) array,
+  * starting from the result of a previous search.
+  *
+  * The integer pointed by last_index is an interpolation cursor: if it
+  * contains a valid interval index (between 0 and n_lines-2), the search
+  * starts there, hunts in the direction of c with steps doubling at each
+  * iteration, and finishes with a bisection. Otherwise (e.g. if it has
+  * been set to -1 before the first call) the whole array is bisected.
+  * The result is the same as with array_search_bisect(), and is
+  * written back in *last_index, so that successive calls with close or
+  * sorted values of c cost O(1) to O(log(distance)).
+  *
+  * Called by array_interpolate_spline_hunt(); transfer_interpolate_sources().
+  */
+int array_search_hunt(
+                      int n_lines,
+                      double * __restrict__ array,
+                      double c,
+                      int * __restrict__ last_index,
+                      ErrorMsg errmsg) {
+
+  int inf,sup,mid,inc;
+  short increasing;
+
+  increasing = (array[0] < array[n_lines-1]) ? _TRUE_ : _FALSE_;
+
+  if (increasing == _TRUE_) {
+
+    if (c < array[0]) {
+      sprintf(errmsg,"%s(L:%d) : c=%e < y_min=%e",__func__,__LINE__,c,array[0]);
+      return _FAILURE_;
+    }
+
+    if (c > array[n_lines-1]) {
+      sprintf(errmsg,"%s(L:%d) : c=%e > y_max=%e",__func__,__LINE__,c,array[n_lines-1]);
+      return _FAILURE_;
+    }
+  }
+
+  else {
+
+    if (c < array[n_lines-1]) {
+      sprintf(errmsg,"%s(L:%d) : x=%e < x_min=%e",__func__,__LINE__,c,array[n_lines-1]);
+      return _FAILURE_;
+    }
+
+    if (c > array[0]) {
+      sprintf(errmsg,"%s(L:%d) : x=%e > x_max=%e",__func__,__LINE__,c,array[0]);
+      return _FAILURE_;
+    }
+  }
+
+  /* below, a point i is "below c" if array[i] <= c for a growing
+     array, or array[i] >= c for a decreasing one; we look for the
+     last point below c, excluding the last point of the array */
+
+  if ((*last_index >= 0) && (*last_index <= n_lines-2)) {
+
+    inc = 1;
+
+    if ((increasing == _TRUE_) ? (array[*last_index] <= c) : (array[*last_index] >= c)) {
+
+      /* hunt upward */
+      inf = *last_index;
+      sup = inf+inc;
+      while ((sup < n_lines-1) && ((increasing == _TRUE_) ? (array[sup] <= c) : (array[sup] >= c))) {
+        inf = sup;
+        inc *= 2;
+        sup = inf+inc;
+      }
+      sup = MIN(sup,n_lines-1);
+    }
+
+    else {
+
+      /* hunt downward */
+      sup = *last_index;
+      inf = sup-inc;
+      while ((inf > 0) && ((increasing == _TRUE_) ? (array[inf] > c) : (array[inf] < c))) {
+        sup = inf;
+        inc *= 2;
+        inf = sup-inc;
+      }
+      inf = MAX(inf,0);
+    }
+  }
+
+  else {
+
+    inf=0;
+    sup=n_lines-1;
+  }
+
+  /* bisect */
+
+  if (increasing == _TRUE_) {
+    while (sup-inf > 1) {
+      mid=(int)(0.5*(inf+sup));
+      if (c < array[mid]) {sup=mid;}
+      else {inf=mid;}
+    }
+  }
+  else {
+    while (sup-inf > 1) {
+      mid=(int)(0.5*(inf+sup));
+      if (c > array[mid]) {sup=mid;}
+      else {inf=mid;}
+    }
+  }
+
+  *last_index = inf;
+
+  return _SUCCESS_;
+}
+
+ /**
+  * interpolate to get y_i(x), when x and y_i are in different arrays,
+  * starting the search of the interval from the cursor *last_index
+  * (see array_search_hunt()). Gives the same result as
+  * array_interpolate_spline(), at a lower cost when the successive
+  * values of x are sorted or close to each other.
+  *
+  * Called by background_uniform_table_init(); nonlinear_sigmas(); nonlinear_sigmas_fft(); nonlinear_halofit(); nonlinear_hmcode().
+  */
+int array_interpolate_spline_hunt(
+                                  double * __restrict__ x_array,
+                                  int n_lines,
+                                  double * __restrict__ array,
+                                  double * __restrict__ array_splined,
+                                  int n_columns,
+                                  double x,
+                                  int * __restrict__ last_index,
+                                  double * __restrict__ result,
+                                  int result_size, /** from 1 to n_columns */
+                                  ErrorMsg errmsg) {
+
+  int inf,sup,i;
+  double h,a,b;
+
+  class_call(array_search_hunt(n_lines,
+                               x_array,
+                               x,
+                               last_index,
+                               errmsg),
+             errmsg,
+             errmsg);
+
+  inf = *last_index;
+  sup = inf+1;
+
+  h = x_array[sup] - x_array[inf];
+  b = (x-x_array[inf])/h;
+  a = 1-b;
+
+  for (i=0; i<result_size; i++)
+    *(result+i) =
+      a * *(array+inf*n_columns+i) +
+      b * *(array+sup*n_columns+i) +
+      ((a*a*a-a)* *(array_splined+inf*n_columns+i) +
+       (b*b*b-b)* *(array_splined+sup*n_columns+i))*h*h/6.;
+
+  return _SUCCESS_;
+}
+
  /**
   * interpolate to get y_i(x), when x and y_i are in different arrays
   *
@@ -3154,6 +3379,133 @@ int array_trapezoidal_mweights(
   return _SUCCESS_;
 }
 
+/**
+ * Compute quadrature weights equivalent to a spline integration:
+ * for any function f() known on the grid x (in growing order), the sum
+ * of w_spline[i]*f(x[i]) is equal (up to rounding errors) to the
+ * integral obtained by calling array_spline() with the
+ * _SPLINE_EST_DERIV_ boundary conditions, followed by
+ * array_integrate_all_trapzd_or_spline(). This is possible because the
+ * second derivatives of the spline are linear in f(): the weights are
+ * obtained by solving once the transposed tridiagonal system of the
+ * spline, after which each integral over the same grid is a simple
+ * scalar product.
+ *
+ * @param x                     Input: Grid points on which f() is known.
+ * @param n                     Input: number of grid points (at least 3).
+ * @param index_start_spline    Input: the integration is trapezoidal below this index, and uses the spline above.
+ * @param w_spline              Output: Weights of the spline integration.
+ * @return the error status
+ */
+
+int array_spline_weights(
+                         double * __restrict__ x,
+                         int n,
+                         int index_start_spline,
+                         double * __restrict__ w_spline,
+                         ErrorMsg errmsg
+                         ) {
+
+  int i;
+  double * h;     /* h[i] = x[i+1]-x[i] */
+  double * z;     /* solution of the transposed system, of which the right-hand side is the weight of each second derivative in the integral */
+  double * c;     /* modified coefficients of the Thomas algorithm */
+  double h0,h1,a,b,e,p;
+
+  if (n < 3) {
+    sprintf(errmsg,"%s(L:%d) n=%d, while routine needs n >= 3",__func__,__LINE__,n);
+    return _FAILURE_;
+  }
+
+  if ((index_start_spline<0) || (index_start_spline>=n)) {
+    sprintf(errmsg,"%s(L:%d) index_start_spline outside of range",__func__,__LINE__);
+    return _FAILURE_;
+  }
+
+  h = malloc(3*n*sizeof(double));
+  if (h == NULL) {
+    sprintf(errmsg,"%s(L:%d) Cannot allocate h",__func__,__LINE__);
+    return _FAILURE_;
+  }
+  z = h+n;
+  c = z+n;
+
+  for (i=0; i<n-1; i++)
+    h[i] = x[i+1]-x[i];
+
+  /** - trapezoidal part of the weights, and weights of the second
+      derivatives in array_integrate_all_trapzd_or_spline() */
+
+  for (i=0; i<n; i++) {
+    w_spline[i] = 0.;
+    z[i] = 0.;
+  }
+
+  for (i=0; i<n-1; i++) {
+    w_spline[i] += 0.5*h[i];
+    w_spline[i+1] += 0.5*h[i];
+    if (i >= index_start_spline) {
+      z[i] += h[i]*h[i]*h[i]/24.;
+      z[i+1] += h[i]*h[i]*h[i]/24.;
+    }
+  }
+
+  /** - the second derivatives ddy of array_spline() obey A ddy = B y,
+      with A tridiagonal: first line ddy[0]+0.5*ddy[1], line i
+      sig*ddy[i-1]+2*ddy[i]+(1-sig)*ddy[i+1] with sig =
+      h[i-1]/(h[i-1]+h[i]), last line 0.5*ddy[n-2]+ddy[n-1]. Solve the
+      transposed system A^T z = z in place with the Thomas algorithm
+      (the sub-diagonal of A^T is the super-diagonal of A and vice
+      versa). */
+
+  c[0] = h[0]/(h[0]+h[1]);            /* (A^T)[0][1] = A[1][0] = sig_1, divided by (A^T)[0][0] = 1 */
+  for (i=1; i<n; i++) {
+    a = (i == 1) ? 0.5 : 1.-h[i-2]/(h[i-2]+h[i-1]);   /* (A^T)[i][i-1] = A[i-1][i] */
+    b = (i < n-2) ? h[i]/(h[i]+h[i+1]) : 0.5;          /* (A^T)[i][i+1] = A[i+1][i] */
+    p = ((i < n-1) ? 2. : 1.) - a*c[i-1];
+    c[i] = b/p;
+    z[i] = (z[i]-a*z[i-1])/p;
+  }
+  for (i=n-2; i>=0; i--)
+    z[i] -= c[i]*z[i+1];
+
+  /** - add the spline part of the weights, B^T z */
+
+  /* first line: 3/h0 ((y1-y0)/h0 - dy_first), with dy_first the
+     derivative of the parabola through the first three points */
+  h0 = h[0];
+  h1 = h[0]+h[1];
+  a = h1/(h0*(h1-h0));                /* coefficient of (y1-y0) in dy_first */
+  b = -h0/(h1*(h1-h0));               /* coefficient of (y2-y0) in dy_first */
+  e = 3./h0*z[0];
+  w_spline[1] += e*(1./h0-a);
+  w_spline[2] -= e*b;
+  w_spline[0] -= e*(1./h0-a-b);
+
+  /* line i: 6/(x[i+1]-x[i-1]) ((y[i+1]-y[i])/h[i] - (y[i]-y[i-1])/h[i-1]) */
+  for (i=1; i<n-1; i++) {
+    e = 6./(h[i-1]+h[i])*z[i];
+    w_spline[i+1] += e/h[i];
+    w_spline[i-1] += e/h[i-1];
+    w_spline[i] -= e*(1./h[i]+1./h[i-1]);
+  }
+
+  /* last line: 3/h0 (dy_last - (y[n-1]-y[n-2])/h0), with dy_last the
+     derivative of the parabola through the last three points */
+  h0 = -h[n-2];                       /* x[n-2]-x[n-1] */
+  h1 = -h[n-2]-h[n-3];                /* x[n-3]-x[n-1] */
+  a = h1/(h0*(h1-h0));                /* coefficient of (y[n-2]-y[n-1]) in dy_last */
+  b = -h0/(h1*(h1-h0));               /* coefficient of (y[n-3]-y[n-1]) in dy_last */
+  e = 3./h[n-2]*z[n-1];
+  w_spline[n-2] += e*(a+1./h[n-2]);
+  w_spline[n-3] += e*b;
+  w_spline[n-1] -= e*(a+1./h[n-2]+b);
+
+  free(h);
+
+  return _SUCCESS_;
+}
+
 /**
  * Compute integral of function using trapezoidal method.
  *
@@ -1,4 +1,10 @@
 #include "common.h"
+#include <unistd.h>
+#include <time.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <sys/resource.h>
 
 void class_protect_sprintf(char* dest, char* tpl,...) {
   va_list args;
@@ -20,6 +26,26 @@ void* class_protect_memcpy(void* dest, void* from, size_t sz) {
   return memcpy(dest, from,sz);
 }
 
+/**
+ * Name of a temporary file in which filename can be written before
+ * being renamed: filename followed by the process id and a counter
+ * incremented at each call, so that the name is unique to the call,
+ * even when several computations run concurrently in threads of the
+ * same process (e.g. several classy instances).
+ *
+ * @param filename Input: name of the final file
+ * @param tmpname  Output: name of the temporary file
+ */
+void class_temporary_file_name(char * filename, char * tmpname) {
+  static long counter = 0;
+  long number;
+
+#pragma omp atomic capture
+  number = ++counter;
+
+  sprintf(tmpname,"%s.%ld.%ld",filename,(long)getpid(),number);
+}
+
 int get_number_of_titles(char * titlestring){
   int i;
   int number_of_titles=0;
@@ -30,3 +56,480 @@ int get_number_of_titles(char * titlestring){
   }
   return number_of_titles;
 }
+
+/**
+ * Profiling of the module initializations and of the hot functions.
+ *
+ * With -DCLASS_PROFILE, each thread which calls a profiled function
+ * (see class_profile_start() and class_profile_stop() in common.h)
+ * gets its own counters, allocated at its first call and added to a
+ * process-wide list, so that the counters are updated without any
+ * synchronisation, and remain readable after the end of the thread.
+ * The counters of all runs of the process (including concurrent ones)
+ * are added, until class_profile_reset() is called.
+ */
+
+#ifdef CLASS_PROFILE
+/** counters of the calling thread (NULL before its first profiled call) */
+struct class_profile_counters * class_profile_thread = NULL;
+#endif
+
+/** list of the counters of all threads (accessed within the critical section class_profile only) */
+static struct class_profile_counters * class_profile_first = NULL;
+
+/**
+ * Time used by the profiling: wall-clock time with OpenMP, processor
+ * time otherwise.
+ */
+double class_profile_time() {
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+/**
+ * Allocate the counters of the calling thread, and add them to the
+ * list of all threads (called at the first profiled call of each
+ * thread). The process stops if they cannot be allocated.
+ */
+void class_profile_thread_init() {
+#ifdef CLASS_PROFILE
+  class_profile_thread = calloc(1,sizeof(struct class_profile_counters));
+  if (class_profile_thread == NULL) {
+    fprintf(stderr,"%s: cannot allocate the profiling counters\n",__func__);
+    exit(_FAILURE_);
+  }
+#pragma omp critical (class_profile)
+  {
+    class_profile_thread->next = class_profile_first;
+    class_profile_first = class_profile_thread;
+  }
+#endif
+}
+
+/**
+ * @return _TRUE_ if the code was compiled with -DCLASS_PROFILE
+ */
+short class_profile_is_enabled() {
+#ifdef CLASS_PROFILE
+  return _TRUE_;
+#else
+  return _FALSE_;
+#endif
+}
+
+/**
+ * Name of a profiled function.
+ *
+ * @param index Input: index in enum class_profile_index
+ * @return the name, or NULL if index is out of range
+ */
+const char * class_profile_name(int index) {
+  static const char * name[profile_size] = {
+    "input_init",
+    "background_init",
+    "thermodynamics_init",
+    "perturb_init",
+    "primordial_init",
+    "nonlinear_init",
+    "transfer_init",
+    "spectra_init",
+    "lensing_init",
+    "perturb_derivs",
+    "numjac",
+    "background_at_tau",
+    "thermodynamics_at_z",
+    "background_lrs_moments",
+    "get_phi_M_lrs",
+    "instabilityOnset_lrs",
+    "potentialPrime",
+    "potentialPrime_and_derivative"};
+
+  if ((index < 0) || (index >= profile_size))
+    return NULL;
+  return name[index];
+}
+
+/**
+ * Read the profiling counters (all zero without -DCLASS_PROFILE). The
+ * counters of threads still running are read while they may be
+ * updated, so that they can be slightly behind.
+ *
+ * @param ptotal     Output: sum of the counters of all threads (or NULL)
+ * @param pthreads   Output: array of thread_max counters, filled with those of the first threads (or NULL)
+ * @param thread_max Input: size of pthreads
+ * @param thread_num Output: number of threads which called a profiled function (or NULL)
+ * @return the error status
+ */
+int class_profile_get(struct class_profile_counters * ptotal,
+                      struct class_profile_counters * pthreads,
+                      int thread_max,
+                      int * thread_num) {
+
+  struct class_profile_counters * pcounters;
+  int index,index_thread=0;
+
+  if (ptotal != NULL)
+    memset(ptotal,0,sizeof(struct class_profile_counters));
+
+#pragma omp critical (class_profile)
+  {
+    for (pcounters=class_profile_first; pcounters != NULL; pcounters=pcounters->next, index_thread++) {
+      for (index=0; index<profile_size; index++) {
+        if (ptotal != NULL) {
+          ptotal->calls[index] += pcounters->calls[index];
+          ptotal->time[index] += pcounters->time[index];
+        }
+        if ((pthreads != NULL) && (index_thread < thread_max)) {
+          pthreads[index_thread].calls[index] = pcounters->calls[index];
+          pthreads[index_thread].time[index] = pcounters->time[index];
+          pthreads[index_thread].next = NULL;
+        }
+      }
+    }
+  }
+
+  if (thread_num != NULL)
+    *thread_num = index_thread;
+
+  return _SUCCESS_;
+}
+
+/**
+ * Set the profiling counters of all threads to zero (to be called
+ * when no profiled function is running).
+ */
+void class_profile_reset() {
+
+  struct class_profile_counters * pcounters;
+
+#pragma omp critical (class_profile)
+  {
+    for (pcounters=class_profile_first; pcounters != NULL; pcounters=pcounters->next) {
+      memset(pcounters->calls,0,profile_size*sizeof(long int));
+      memset(pcounters->time,0,profile_size*sizeof(double));
+    }
+  }
+}
+
+/**
+ * Print the profiling counters summed over threads, and the time of
+ * each thread (nothing without -DCLASS_PROFILE).
+ *
+ * @param stream Input: where to print
+ * @return the error status
+ */
+int class_profile_print(FILE * stream) {
+
+  struct class_profile_counters total;
+  struct class_profile_counters * pthreads;
+  int index,index_thread,thread_num;
+
+  if (class_profile_is_enabled() == _FALSE_)
+    return _SUCCESS_;
+
+  class_profile_get(NULL,NULL,0,&thread_num);
+  pthreads = malloc(MAX(thread_num,1)*sizeof(struct class_profile_counters));
+  if (pthreads == NULL)
+    return _FAILURE_;
+  class_profile_get(&total,pthreads,thread_num,&thread_num);
+
+  fprintf(stream,"Profile (%d threads; inclusive times, summed over threads):\n",thread_num);
+  for (index=0; index<profile_size; index++) {
+    if (total.calls[index] == 0)
+      continue;
+    fprintf(stream,"  %-32s %12ld calls, %12.6f s, per thread:",class_profile_name(index),total.calls[index],total.time[index]);
+    for (index_thread=0; index_thread<thread_num; index_thread++)
+      fprintf(stream," %.3f",pthreads[index_thread].time[index]);
+    fprintf(stream,"\n");
+  }
+
+  free(pthreads);
+
+  return _SUCCESS_;
+}
+
+/**
+ * Memory accounting.
+ *
+ * The allocation macros (class_alloc(), class_calloc(), ...) cannot
+ * see the matching calls to free(), so the memory in use is measured
+ * from the allocator itself: the difference of class_memory_heap()
+ * before and after the initialization of a module is the memory kept
+ * by its structure (concurrent runs in the same process are included,
+ * as for the profiling counters).
+ */
+
+/**
+ * @return the number of bytes allocated on the heap and not freed (0 if unknown)
+ */
+size_t class_memory_heap() {
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ >= 33)))
+  struct mallinfo2 info;
+  info = mallinfo2();
+  return info.uordblks+info.hblkhd;
+#else
+  return 0;
+#endif
+}
+
+/**
+ * @param heap_start Input: value of class_memory_heap() at the beginning of a computation
+ * @return the growth of the heap since then (0 if it shrank)
+ */
+size_t class_memory_growth(size_t heap_start) {
+  size_t heap;
+  heap = class_memory_heap();
+  return (heap > heap_start) ? heap-heap_start : 0;
+}
+
+/**
+ * Resident set size of the process.
+ *
+ * @param rss      Output: current resident set size in bytes (0 if unknown, or NULL)
+ * @param peak_rss Output: largest resident set size since the start of the process in bytes (or NULL)
+ * @return the error status
+ */
+int class_memory_rss(size_t * rss, size_t * peak_rss) {
+
+  struct rusage usage;
+  FILE * statm;
+  unsigned long size,resident;
+
+  if (rss != NULL) {
+    *rss = 0;
+    statm = fopen("/proc/self/statm","r");
+    if (statm != NULL) {
+      if (fscanf(statm,"%lu %lu",&size,&resident) == 2)
+        *rss = (size_t)resident*sysconf(_SC_PAGESIZE);
+      fclose(statm);
+    }
+  }
+
+  if (peak_rss != NULL) {
+    *peak_rss = 0;
+    if (getrusage(RUSAGE_SELF,&usage) == 0)
+      *peak_rss = (size_t)usage.ru_maxrss*1024;
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * MPI processes.
+ *
+ * In an MPI run (compiled with -D_MPI_), each process runs the whole
+ * computation, except for the loops over wavenumbers of
+ * perturb_init() and transfer_init(): their tasks are shared among the
+ * processes by class_mpi_partition(), and the results gathered by
+ * class_mpi_allgather(), so that every process ends up with the same
+ * tables as a run with a single process. All MPI calls are made
+ * outside of the OpenMP parallel regions.
+ */
+
+/**
+ * Start MPI (nothing to do without MPI).
+ *
+ * @param argc Input/Output: pointer to the number of arguments of main()
+ * @param argv Input/Output: pointer to the arguments of main()
+ * @return the error status
+ */
+int class_mpi_init(int * argc, char *** argv) {
+#ifdef _MPI_
+  int provided;
+  if (MPI_Init_thread(argc,argv,MPI_THREAD_FUNNELED,&provided) != MPI_SUCCESS)
+    return _FAILURE_;
+#endif
+  return _SUCCESS_;
+}
+
+/**
+ * Stop MPI (nothing to do without MPI).
+ *
+ * @return the error status
+ */
+int class_mpi_finalize() {
+#ifdef _MPI_
+  if (MPI_Finalize() != MPI_SUCCESS)
+    return _FAILURE_;
+#endif
+  return _SUCCESS_;
+}
+
+/**
+ * @return the rank of this process (0 without MPI, or before class_mpi_init())
+ */
+int class_mpi_rank() {
+  int rank = 0;
+#ifdef _MPI_
+  int initialized;
+  MPI_Initialized(&initialized);
+  if (initialized)
+    MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+#endif
+  return rank;
+}
+
+/**
+ * @return the number of processes (1 without MPI, or before class_mpi_init())
+ */
+int class_mpi_size() {
+  int size = 1;
+#ifdef _MPI_
+  int initialized;
+  MPI_Initialized(&initialized);
+  if (initialized)
+    MPI_Comm_size(MPI_COMM_WORLD,&size);
+#endif
+  return size;
+}
+
+/**
+ * Comparison of two (cost, index) pairs by decreasing cost, for qsort()
+ * in class_mpi_partition(); ties are broken by increasing index.
+ */
+static int class_mpi_compare_cost(const void * a, const void * b) {
+
+  const double * pair_a = (const double *) a;
+  const double * pair_b = (const double *) b;
+
+  if (pair_a[0] != pair_b[0])
+    return (pair_a[0] < pair_b[0]) ? 1 : -1;
+
+  return (pair_a[1] < pair_b[1]) ? -1 : 1;
+}
+
+/**
+ * Share tasks of known (estimated) cost among the processes: the tasks
+ * given a rank in input stay with it, and the others are given, by
+ * decreasing cost, to the process with the smallest total cost so far
+ * (the ties going to the smallest rank). Since it only depends on its
+ * arguments, all processes find the same partition.
+ *
+ * @param task_size     Input: number of tasks
+ * @param task_cost     Input: cost of each task
+ * @param task_rank     Input/Output: rank of the process of each task (in input, -1 if not imposed)
+ * @param error_message Output: error message
+ * @return the error status
+ */
+int class_mpi_partition(int task_size, double * task_cost, int * task_rank, ErrorMsg error_message) {
+
+  int size = class_mpi_size();
+  int index_task,task,rank,best;
+  double * load;
+  double * cost_and_index;
+
+  class_calloc(load,size,sizeof(double),error_message);
+  class_alloc(cost_and_index,2*MAX(task_size,1)*sizeof(double),error_message);
+
+  for (index_task=0; index_task<task_size; index_task++) {
+    if (task_rank[index_task] >= 0) {
+      class_test(task_rank[index_task] >= size,
+                 error_message,
+                 "task %d imposed to the process of rank %d, out of %d processes",index_task,task_rank[index_task],size);
+      load[task_rank[index_task]] += task_cost[index_task];
+    }
+    cost_and_index[2*index_task] = task_cost[index_task];
+    cost_and_index[2*index_task+1] = (double)index_task;
+  }
+
+  qsort(cost_and_index,task_size,2*sizeof(double),class_mpi_compare_cost);
+
+  for (index_task=0; index_task<task_size; index_task++) {
+    task = (int)cost_and_index[2*index_task+1];
+    if (task_rank[task] >= 0)
+      continue;
+    best = 0;
+    for (rank=1; rank<size; rank++)
+      if (load[rank] < load[best])
+        best = rank;
+    task_rank[task] = best;
+    load[best] += task_cost[task];
+  }
+
+  free(cost_and_index);
+  free(load);
+
+  return _SUCCESS_;
+}
+
+/**
+ * Tell all processes if a flag is set in any of them, e.g. the error
+ * flag of a loop shared among the processes, so that they all stop
+ * before the next collective operation.
+ *
+ * @param flag          Input/Output: flag of this process, then true if it is true in any process
+ * @param error_message Output: error message (set if the flag was only set in another process)
+ * @return the error status
+ */
+int class_mpi_any(int * flag, ErrorMsg error_message) {
+#ifdef _MPI_
+  int any;
+  class_test(MPI_Allreduce(flag,&any,1,MPI_INT,MPI_LOR,MPI_COMM_WORLD) != MPI_SUCCESS,
+             error_message,
+             "MPI_Allreduce failed");
+  if ((*flag == 0) && (any != 0))
+    sprintf(error_message,"failure in another MPI process");
+  *flag = any;
+#endif
+  return _SUCCESS_;
+}
+
+/**
+ * Sum a table over all processes (nothing to do without MPI).
+ *
+ * @param buffer        Input/Output: table of this process, then sum of the tables of all processes
+ * @param count         Input: size of the table
+ * @param error_message Output: error message
+ * @return the error status
+ */
+int class_mpi_sum(double * buffer, int count, ErrorMsg error_message) {
+#ifdef _MPI_
+  class_test(MPI_Allreduce(MPI_IN_PLACE,buffer,count,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD) != MPI_SUCCESS,
+             error_message,
+             "MPI_Allreduce failed");
+#endif
+  return _SUCCESS_;
+}
+
+/**
+ * Gather in every process the tables of all processes, one after the
+ * other by increasing rank (without MPI, the table is just copied).
+ *
+ * @param send_buffer    Input: table of this process
+ * @param send_count     Input: its size
+ * @param receive_buffer Output: tables of all processes
+ * @param receive_count  Input: size of the table of each process
+ * @param error_message  Output: error message
+ * @return the error status
+ */
+int class_mpi_allgather(double * send_buffer, int send_count, double * receive_buffer, int * receive_count, ErrorMsg error_message) {
+
+#ifdef _MPI_
+  int size = class_mpi_size();
+  int rank;
+  int * displacement;
+
+  class_alloc(displacement,size*sizeof(int),error_message);
+  displacement[0] = 0;
+  for (rank=1; rank<size; rank++)
+    displacement[rank] = displacement[rank-1]+receive_count[rank-1];
+
+  class_test(MPI_Allgatherv(send_buffer,send_count,MPI_DOUBLE,
+                            receive_buffer,receive_count,displacement,MPI_DOUBLE,
+                            MPI_COMM_WORLD) != MPI_SUCCESS,
+             error_message,
+             "MPI_Allgatherv failed");
+
+  free(displacement);
+#else
+  class_test(send_count != receive_count[0],
+             error_message,
+             "%d values sent, %d expected",send_count,receive_count[0]);
+  memcpy(receive_buffer,send_buffer,send_count*sizeof(double));
+#endif
+
+  return _SUCCESS_;
+}
@@ -10,43 +10,68 @@ int initialize_generic_integrator(
 
   /** - Allocate workspace dynamically */
 
+  pgi->buffer = NULL;
+  pgi->capacity = 0;
+
+  class_call(generic_integrator_reserve(n_dim,pgi),
+	     pgi->error_message,
+	     pgi->error_message);
+
+  return _SUCCESS_;
+}
+
+/**
+ * Set the dimension of the system integrated with an initialized
+ * workspace, enlarging its buffer if needed. The workspace can thus be
+ * kept from one integration to the next (see evolver_rk()), without
+ * any allocation when the dimension does not grow.
+ *
+ * All the vectors are slices of a single buffer, each of them starting
+ * on a multiple of _GI_ALIGNMENT_ bytes, so that the stages of rkck()
+ * are contiguous and the loops over their elements can be vectorized.
+ *
+ * @param n_dim Input: dimension of the system
+ * @param pgi   Input/Output: initialized workspace
+ * @return the error status
+ */
+int generic_integrator_reserve(
+			       int n_dim,
+			       struct generic_integrator_workspace * pgi){
+
+  int stride;
+  double * slice;
+
   pgi->n = n_dim;
 
-  class_alloc(pgi->yscal,
-	      sizeof(double)*n_dim,
-	      pgi->error_message);
-  class_alloc(pgi->y,
-	      sizeof(double)*n_dim,
-	      pgi->error_message);
-  class_alloc(pgi->dydx,
-	      sizeof(double)*n_dim,
-	      pgi->error_message);
-
-  class_alloc(pgi->yerr,
-	      sizeof(double)*n_dim,
-	      pgi->error_message);
-  class_alloc(pgi->ytempo,
-	      sizeof(double)*n_dim,
-	      pgi->error_message);
-
-  class_alloc(pgi->ak2,
-	      sizeof(double)*n_dim,
-	      pgi->error_message);
-  class_alloc(pgi->ak3,
-	      sizeof(double)*n_dim,
-	      pgi->error_message);
-  class_alloc(pgi->ak4,
-	      sizeof(double)*n_dim,
-	      pgi->error_message);
-  class_alloc(pgi->ak5,
-	      sizeof(double)*n_dim,
-	      pgi->error_message);
-  class_alloc(pgi->ak6,
-	      sizeof(double)*n_dim,
-	      pgi->error_message);
-  class_alloc(pgi->ytemp,
-	      sizeof(double)*n_dim,
-	      pgi->error_message);
+  if (n_dim <= pgi->capacity)
+    return _SUCCESS_;
+
+  /* number of doubles of each slice, rounded up to a multiple of the alignment */
+  stride = ((n_dim*sizeof(double)+_GI_ALIGNMENT_-1)/_GI_ALIGNMENT_)*_GI_ALIGNMENT_/sizeof(double);
+
+  free(pgi->buffer);
+  pgi->capacity = 0;
+
+  class_test(posix_memalign((void**)&(pgi->buffer),_GI_ALIGNMENT_,_GI_VECTORS_*stride*sizeof(double)) != 0,
+	     pgi->error_message,
+	     "could not allocate %d vectors of size %d",_GI_VECTORS_,n_dim);
+
+  pgi->capacity = stride;
+
+  slice = pgi->buffer;
+  pgi->y = slice; slice += stride;
+  pgi->dydx = slice; slice += stride;
+  pgi->ak2 = slice; slice += stride;
+  pgi->ak3 = slice; slice += stride;
+  pgi->ak4 = slice; slice += stride;
+  pgi->ak5 = slice; slice += stride;
+  pgi->ak6 = slice; slice += stride;
+  pgi->ytemp = slice; slice += stride;
+  pgi->yerr = slice; slice += stride;
+  pgi->yscal = slice; slice += stride;
+  pgi->ytempo = slice; slice += stride;
+  pgi->y_previous = slice; slice += stride;
+  pgi->dydx_previous = slice;
 
   return _SUCCESS_;
 }
@@ -59,19 +84,9 @@ int initialize_generic_integrator(
  */
 int cleanup_generic_integrator(struct generic_integrator_workspace * pgi){
 
-  free(pgi->yscal);
-  free(pgi->y);
-  free(pgi->dydx);
-
-  free(pgi->yerr);
-  free(pgi->ytempo);
-
-  free(pgi->ak2);
-  free(pgi->ak3);
-  free(pgi->ak4);
-  free(pgi->ak5);
-  free(pgi->ak6);
-  free(pgi->ytemp);
+  free(pgi->buffer);
+  pgi->buffer = NULL;
+  pgi->capacity = 0;
 
   return _SUCCESS_;
 }
@@ -88,17 +103,21 @@ int generic_integrator(int (*derivs)(double x, double y[], double yprime[], void
 {
   int nstp,i;
   double x,hnext,hdid,h,h1;
+  const int n=pgi->n;
+  double * y=pgi->y;
+  double * dydx=pgi->dydx;
+  double * yscal=pgi->yscal;
 
   h1=x2-x1;
   x=x1;
   h=dsign(h1,x2-x1);
-  for (i=0;i<pgi->n;i++) pgi->y[i]=ystart[i];
+  for (i=0;i<n;i++) y[i]=ystart[i];
   for (nstp=1;nstp<=_MAXSTP_;nstp++) {
     class_call((*derivs)(x,pgi->y,pgi->dydx,parameters_and_workspace_for_derivs, pgi->error_message),
 	       pgi->error_message,
 	       pgi->error_message);
-    for (i=0;i<pgi->n;i++)
-      pgi->yscal[i]=fabs(pgi->y[i])+fabs(pgi->dydx[i]*h)+_TINY_;
+    for (i=0;i<n;i++)
+      yscal[i]=fabs(y[i])+fabs(dydx[i]*h)+_TINY_;
     if ((x+h-x2)*(x+h-x1) > 0.0) h=x2-x;
     class_call(rkqs(&x,
 		    h,
@@ -111,7 +130,7 @@ int generic_integrator(int (*derivs)(double x, double y[], double yprime[], void
 	       pgi->error_message,
 	       pgi->error_message);
     if ((x-x2)*(x2-x1) >= 0.0) {
-      for (i=0;i<pgi->n;i++) ystart[i]=pgi->y[i];
+      for (i=0;i<n;i++) ystart[i]=y[i];
       return _SUCCESS_;
     }
     class_test(fabs(hnext/x1) <= hmin,
@@ -129,6 +148,123 @@ int generic_integrator(int (*derivs)(double x, double y[], double yprime[], void
 
 }
 
+/**
+ * Start an integration with dense output at x1, with initial
+ * conditions ystart. The integration is then carried on by
+ * successive calls to generic_integrator_dense().
+ */
+int generic_integrator_dense_init(int (*derivs)(double x, double y[], double yprime[], void * parameters_and_workspace, ErrorMsg error_message),
+				  double x1,
+				  double ystart[],
+				  void * parameters_and_workspace_for_derivs,
+				  struct generic_integrator_workspace * pgi)
+{
+  int i;
+
+  pgi->x=x1;
+  pgi->x_previous=x1;
+  pgi->h_next=0.;
+  for (i=0;i<pgi->n;i++) pgi->y[i]=ystart[i];
+  class_call((*derivs)(x1,pgi->y,pgi->dydx,parameters_and_workspace_for_derivs, pgi->error_message),
+	     pgi->error_message,
+	     pgi->error_message);
+  for (i=0;i<pgi->n;i++) {
+    pgi->y_previous[i]=pgi->y[i];
+    pgi->dydx_previous[i]=pgi->dydx[i];
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Integration with dense output: return in yout the solution at
+ * x_out. The adaptive steps are not limited by the requested output
+ * points, only by x_stop, the end of the whole integration; the
+ * solution between the two ends of a step is obtained by cubic
+ * Hermite interpolation, using the values and derivatives at both
+ * ends. Successive values of x_out must go in the direction of x_stop.
+ */
+int generic_integrator_dense(int (*derivs)(double x, double y[], double yprime[], void * parameters_and_workspace, ErrorMsg error_message),
+			     double x_out,
+			     double x_stop,
+			     double yout[],
+			     void * parameters_and_workspace_for_derivs,
+			     double eps,
+			     double hmin,
+			     struct generic_integrator_workspace * pgi)
+{
+  int nstp,i;
+  double direction,h,hdid,hnext,t,h00,h10,h01,h11;
+
+  direction=dsign(1.,x_stop-pgi->x_previous);
+
+  class_test((x_out-x_stop)*direction > 0.,
+	     pgi->error_message,
+	     "requested output at x=%g beyond the end of the integration x=%g",x_out,x_stop);
+
+  /** - step until x_out is inside the last step */
+  for (nstp=1; (x_out-pgi->x)*direction > 0.; nstp++) {
+
+    class_test(nstp > _MAXSTP_,
+	       pgi->error_message,
+	       "Too many integration steps needed before x=%g,\n the system of equations is probably buggy or featuring a discontinuity",x_out);
+
+    h=pgi->h_next;
+    if (h == 0.) h=x_out-pgi->x;
+    if ((pgi->x+h-x_stop)*direction > 0.) h=x_stop-pgi->x;
+
+    for (i=0;i<pgi->n;i++) {
+      pgi->yscal[i]=fabs(pgi->y[i])+fabs(pgi->dydx[i]*h)+_TINY_;
+      pgi->y_previous[i]=pgi->y[i];
+      pgi->dydx_previous[i]=pgi->dydx[i];
+    }
+    pgi->x_previous=pgi->x;
+
+    class_call(rkqs(&(pgi->x),
+		    h,
+		    eps,
+		    &hdid,
+		    &hnext,
+		    derivs,
+		    parameters_and_workspace_for_derivs,
+		    pgi),
+	       pgi->error_message,
+	       pgi->error_message);
+
+    class_call((*derivs)(pgi->x,pgi->y,pgi->dydx,parameters_and_workspace_for_derivs, pgi->error_message),
+	       pgi->error_message,
+	       pgi->error_message);
+
+    class_test(fabs(hnext/pgi->x_previous) <= hmin,
+	       pgi->error_message,
+	       "Step size too small: step:%g, minimum:%g, at x=%g",
+	       fabs(hnext/pgi->x_previous),
+	       hmin,
+	       pgi->x_previous);
+
+    pgi->h_next=hnext;
+  }
+
+  /** - cubic Hermite interpolation inside the last step */
+  h=pgi->x-pgi->x_previous;
+
+  if (h == 0.) {
+    for (i=0;i<pgi->n;i++) yout[i]=pgi->y[i];
+    return _SUCCESS_;
+  }
+
+  t=(x_out-pgi->x_previous)/h;
+  h01=t*t*(3.-2.*t);
+  h00=1.-h01;
+  h10=t*(1.-t)*(1.-t)*h;
+  h11=t*t*(t-1.)*h;
+
+  for (i=0;i<pgi->n;i++)
+    yout[i]=h00*pgi->y_previous[i]+h10*pgi->dydx_previous[i]+h01*pgi->y[i]+h11*pgi->dydx[i];
+
+  return _SUCCESS_;
+}
+
 int rkqs(double *x, double htry, double eps,
 	 double *hdid, double *hnext,
 	 int (*derivs)(double, double [], double [], void * parameters_and_workspace, ErrorMsg error_message),
@@ -138,6 +274,9 @@ int rkqs(double *x, double htry, double eps,
 
   int i;
   double errmax,h,htemp,xnew;
+  const int n=pgi->n;
+  const double * yerr=pgi->yerr;
+  const double * yscal=pgi->yscal;
 
   h=htry;
   for (;;) {
@@ -145,7 +284,7 @@ int rkqs(double *x, double htry, double eps,
 	       pgi->error_message,
 	       pgi->error_message);
     errmax=0.0;
-    for (i=0;i<pgi->n;i++) errmax=MAX(errmax,fabs(pgi->yerr[i]/pgi->yscal[i]));
+    for (i=0;i<n;i++) errmax=MAX(errmax,fabs(yerr[i]/yscal[i]));
     errmax /= eps;
     if (errmax <= 1.0) break;
     htemp=_SAFETY_*h*pow(errmax,_PSHRNK_);
@@ -158,11 +297,17 @@ int rkqs(double *x, double htry, double eps,
   if (errmax > _ERRCON_) *hnext=_SAFETY_*h*pow(errmax,_PGROW_);
   else *hnext=5.0*h;
   *x += (*hdid=h);
-  for (i=0;i<pgi->n;i++) pgi->y[i]=pgi->ytemp[i];
+  memcpy(pgi->y,pgi->ytemp,n*sizeof(double));
 
   return _SUCCESS_;
 }
 
+/**
+ * One Cash-Karp Runge-Kutta step. The stages are combined with
+ * AXPY-like loops over restrict-qualified slices of the workspace
+ * buffer (see generic_integrator_reserve()), which the compiler can
+ * vectorize.
+ */
 int rkck(
 	 double x,
 	 double h,
@@ -171,68 +316,76 @@ int rkck(
 	 struct generic_integrator_workspace * pgi)
 {
   int i;
-
-  for (i=0;i<pgi->n;i++)
-    pgi->ytemp[i]=pgi->y[i]+_RKCK_b21_*h*pgi->dydx[i];
+  const int n=pgi->n;
+  const double * __restrict__ y=pgi->y;
+  const double * __restrict__ dydx=pgi->dydx;
+  double * __restrict__ ak2=pgi->ak2;
+  double * __restrict__ ak3=pgi->ak3;
+  double * __restrict__ ak4=pgi->ak4;
+  double * __restrict__ ak5=pgi->ak5;
+  double * __restrict__ ak6=pgi->ak6;
+  double * __restrict__ ytemp=pgi->ytemp;
+  double * __restrict__ yerr=pgi->yerr;
+
+  for (i=0;i<n;i++)
+    ytemp[i]=y[i]+_RKCK_b21_*h*dydx[i];
 
   class_call((*derivs)(x+_RKCK_a2_*h,
-		       pgi->ytemp,
-		       pgi->ak2,
+		       ytemp,
+		       ak2,
 		       parameters_and_workspace_for_derivs,
 		       pgi->error_message),
 	     pgi->error_message,
 	     pgi->error_message);
 
-  for (i=0;i<pgi->n;i++)
-    pgi->ytemp[i]=pgi->y[i]+h*(_RKCK_b31_*pgi->dydx[i]+_RKCK_b32_*pgi->ak2[i]);
+  for (i=0;i<n;i++)
+    ytemp[i]=y[i]+h*(_RKCK_b31_*dydx[i]+_RKCK_b32_*ak2[i]);
 
   class_call((*derivs)(x+_RKCK_a3_*h,
-		       pgi->ytemp,
-		       pgi->ak3,
+		       ytemp,
+		       ak3,
 		       parameters_and_workspace_for_derivs,
 		       pgi->error_message),
 	     pgi->error_message,
 	     pgi->error_message);
 
-  for (i=0;i<pgi->n;i++)
-    pgi->ytemp[i]=pgi->y[i]+h*(_RKCK_b41_*pgi->dydx[i]+_RKCK_b42_*pgi->ak2[i]+_RKCK_b43_*pgi->ak3[i]);
+  for (i=0;i<n;i++)
+    ytemp[i]=y[i]+h*(_RKCK_b41_*dydx[i]+_RKCK_b42_*ak2[i]+_RKCK_b43_*ak3[i]);
 
   class_call((*derivs)(x+_RKCK_a4_*h,
-		       pgi->ytemp,
-		       pgi->ak4,
+		       ytemp,
+		       ak4,
 		       parameters_and_workspace_for_derivs,
 		       pgi->error_message),
 	     pgi->error_message,
 	     pgi->error_message);
 
-  for (i=0;i<pgi->n;i++)
-    pgi->ytemp[i]=pgi->y[i]+h*(_RKCK_b51_*pgi->dydx[i]+_RKCK_b52_*pgi->ak2[i]+_RKCK_b53_*pgi->ak3[i]+_RKCK_b54_*pgi->ak4[i]);
+  for (i=0;i<n;i++)
+    ytemp[i]=y[i]+h*(_RKCK_b51_*dydx[i]+_RKCK_b52_*ak2[i]+_RKCK_b53_*ak3[i]+_RKCK_b54_*ak4[i]);
 
   class_call((*derivs)(x+_RKCK_a5_*h,
-		       pgi->ytemp,
-		       pgi->ak5,parameters_and_workspace_for_derivs,
+		       ytemp,
+		       ak5,parameters_and_workspace_for_derivs,
 		       pgi->error_message),
 	     pgi->error_message,
 	     pgi->error_message);
 
-  for (i=0;i<pgi->n;i++)
-    pgi->ytemp[i]=pgi->y[i]+h*(_RKCK_b61_*pgi->dydx[i]+_RKCK_b62_*pgi->ak2[i]+_RKCK_b63_*pgi->ak3[i]+_RKCK_b64_*pgi->ak4[i]+_RKCK_b65_*pgi->ak5[i]);
+  for (i=0;i<n;i++)
+    ytemp[i]=y[i]+h*(_RKCK_b61_*dydx[i]+_RKCK_b62_*ak2[i]+_RKCK_b63_*ak3[i]+_RKCK_b64_*ak4[i]+_RKCK_b65_*ak5[i]);
 
   class_call((*derivs)(x+_RKCK_a6_*h,
-		       pgi->ytemp,
-		       pgi->ak6,
+		       ytemp,
+		       ak6,
 		       parameters_and_workspace_for_derivs,
 		       pgi->error_message),
 	     pgi->error_message,
 	     pgi->error_message);
 
-  for (i=0;i<pgi->n;i++)
-    pgi->ytemp[i]=pgi->y[i]+h*(_RKCK_c1_*pgi->dydx[i]+_RKCK_c3_*pgi->ak3[i]+_RKCK_c4_*pgi->ak4[i]+_RKCK_c6_*pgi->ak6[i]);
+  for (i=0;i<n;i++)
+    ytemp[i]=y[i]+h*(_RKCK_c1_*dydx[i]+_RKCK_c3_*ak3[i]+_RKCK_c4_*ak4[i]+_RKCK_c6_*ak6[i]);
 
-  for (i=0;i<pgi->n;i++)
-    pgi->yerr[i]=h*(_RKCK_dc1_*pgi->dydx[i]+_RKCK_dc3_*pgi->ak3[i]+_RKCK_dc4_*pgi->ak4[i]+_RKCK_dc5_*pgi->ak5[i]+_RKCK_dc6_*pgi->ak6[i]);
+  for (i=0;i<n;i++)
+    yerr[i]=h*(_RKCK_dc1_*dydx[i]+_RKCK_dc3_*ak3[i]+_RKCK_dc4_*ak4[i]+_RKCK_dc5_*ak5[i]+_RKCK_dc6_*ak6[i]);
 
   return _SUCCESS_;
 }
-
-
@@ -26,6 +26,13 @@
 	Newton iterations fail to converge fast enough. This feature makes the
 	solver competitive even for non-stiff problems.
 
+	All the vectors and matrices used by the evolver are kept in a workspace
+	private to each thread (see evolver_ndf15_workspace_prepare), which is
+	only reallocated when the number of equations exceeds the one of all the
+	previous calls. Hence, successive calls for different intervals or
+	wavenumbers do not allocate memory. evolver_ndf15_workspace_free releases
+	the workspace of the calling thread.
+
 	Statistics is saved in the stepstat[6] vector. The entries are:
 	stepstat[0] = Successful steps.
 	stepstat[1] = Failed steps.
@@ -34,7 +41,11 @@
 	stepstat[4] = Number of LU decompositions.
 	stepstat[5] = Number of linear solves.
 	If ppt->perturbations_verbose > 2, this statistic is printed at the end of
-	each call to evolver.
+	each call to evolver. It is also summed over the calls made by each thread,
+	and the sum is returned by evolver_ndf15_statistics_collect. The ratio of
+	linear solves to LU decompositions measures how often a decomposition is
+	reused over Newton iterations and steps with unchanged stepsize, order and
+	Jacobian.
 
 	Sparsity:
 	When the number of equations becomes high, too much times is spent on solving
@@ -49,6 +60,22 @@
 	will stop constructing the sparse matrix and set jac->use_sparse=_FALSE_. The sparse
 	matrix is stored in the compressed column format. (See sparse.h).
 
+	A module which knows the structure of its equations may nevertheless pass a
+	(*sparsity_pattern) routine. It is called once per call to the evolver, and may
+	fill Ap[0..neq] and Ai[0..max_nonzero-1] with a compressed column superset of the
+	non-zero entries of the jacobian (rows sorted inside each column, diagonal always
+	included). numjac then groups the columns of this pattern, so that one function
+	evaluation perturbs many columns at once even before the numerical pattern is
+	trusted. The entries are then computed directly in the storage of the supplied
+	pattern, without filling the dense jacobian, so that the cost of a jacobian
+	grows with the number of non-zero entries rather than with neq*neq. The sparse
+	method is selected when neq >= _NDF15_SPARSE_MIN_NEQ_.
+	The entries of the supplied pattern which turn out to vanish are still
+	dropped from the sparse matrix, so the LU decomposition is unaffected. Couplings
+	left out of the pattern only degrade the Newton iterations, not the accuracy of
+	the solution. If the routine is NULL or sets *has_pattern to _FALSE_, every column
+	is perturbed separately until the pattern is trusted.
+
 	In the sparse case, we also do partial pivoting, but with diagonal preference. The
 	structure of the equations are nearly optimal for the LU decomposition, so we don't
 	want to mess it up by too many row permutations if we can avoid it. This is also why
@@ -59,6 +86,109 @@
 //#include "perturbations.h"
 #include "sparse.h"
 
+/** workspace of the calling thread, see evolver_ndf15_workspace_prepare() */
+static struct evolver_ndf15_workspace evolver_ndf15_thread_workspace;
+#pragma omp threadprivate(evolver_ndf15_thread_workspace)
+
+/**
+ * Make the workspace of the calling thread ready for a call to
+ * evolver_ndf15() with neq equations: allocate it if it is smaller
+ * than neq, and reset the Jacobian to its initial state (so that the
+ * result of a call does not depend on the previous ones).
+ *
+ * @param pws           Input/Output: workspace of the calling thread
+ * @param neq           Input: number of equations
+ * @param error_message Output: error message
+ * @return the error status
+ */
+
+static int evolver_ndf15_workspace_prepare(struct evolver_ndf15_workspace * pws,
+                                           int neq,
+                                           ErrorMsg error_message){
+  int neqp=neq+1;
+
+  if (neq > pws->neq_max){
+
+    class_call(evolver_ndf15_workspace_free(),error_message,error_message);
+
+    class_alloc(pws->buffer,
+                (15+7)*neqp*sizeof(double)
+                +neqp*sizeof(int),
+                error_message);
+
+    class_call(initialize_jacobian(&(pws->jac),neq,error_message),error_message,error_message);
+    class_call(initialize_numjac_workspace(&(pws->nj_ws),neq,error_message),error_message,error_message);
+
+    pws->neq_max = neq;
+    pws->statistics.allocations++;
+  }
+
+  reset_jacobian(&(pws->jac),neq);
+  reset_numjac_workspace(&(pws->nj_ws),neq);
+
+  return _SUCCESS_;
+}
+
+/**
+ * Free the workspace of the calling thread (it is allocated again by
+ * the next call to evolver_ndf15()). In a parallel region, this must
+ * be called by each thread which called the evolver.
+ *
+ * @return the error status
+ */
+
+int evolver_ndf15_workspace_free(){
+  struct evolver_ndf15_workspace * pws = &evolver_ndf15_thread_workspace;
+
+  if (pws->neq_max > 0){
+    free(pws->buffer);
+    uninitialize_jacobian(&(pws->jac));
+    uninitialize_numjac_workspace(&(pws->nj_ws));
+    pws->neq_max = 0;
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Set a total of statistics of evolver_ndf15() to zero.
+ *
+ * @param pstat Output: total of the statistics
+ * @return the error status
+ */
+
+int evolver_ndf15_statistics_init(struct evolver_ndf15_statistics * pstat){
+  int ii;
+
+  pstat->calls = 0;
+  pstat->allocations = 0;
+  for(ii=0;ii<6;ii++) pstat->stepstat[ii] = 0;
+
+  return _SUCCESS_;
+}
+
+/**
+ * Add the statistics of the calls to evolver_ndf15() made by the
+ * calling thread to a total, and reset them. In a parallel region,
+ * this must be called by each thread within a critical section.
+ *
+ * @param pstat Input/Output: total of the statistics
+ * @return the error status
+ */
+
+int evolver_ndf15_statistics_collect(struct evolver_ndf15_statistics * pstat){
+  struct evolver_ndf15_statistics * pthread = &(evolver_ndf15_thread_workspace.statistics);
+  int ii;
+
+  pstat->calls += pthread->calls;
+  pstat->allocations += pthread->allocations;
+  for(ii=0;ii<6;ii++) pstat->stepstat[ii] += pthread->stepstat[ii];
+
+  evolver_ndf15_statistics_init(pthread);
+
+  return _SUCCESS_;
+}
+
 int evolver_ndf15(
 		  int (*derivs)(double x,double * y,double * dy,
 				void * parameters_and_workspace, ErrorMsg error_message),
@@ -81,6 +211,8 @@ int evolver_ndf15(
 				ErrorMsg error_message),
 		  int (*print_variables)(double x, double y[], double dy[], void *parameters_and_workspace,
 					 ErrorMsg error_message),
+		  int (*sparsity_pattern)(int neq, int max_nonzero, int * Ap, int * Ai, int * has_pattern,
+					  void * parameters_and_workspace, ErrorMsg error_message),
 		  ErrorMsg error_message){
 
   /* Constants: */
@@ -96,35 +228,32 @@ int evolver_ndf15(
   /* Storage: */
   double *f0,*y,*wt,*ddfddt,*pred,*ynew,*invwt,*rhs,*psi,*difkp1,*del,*yinterp;
   double *tempvec1,*tempvec2,*ypinterp,*yppinterp;
-  double **dif;
-  struct jacobian jac;
-  struct numjac_workspace nj_ws;
+  double *dif[8];
 
   /* Method variables: */
   double t,t0,tfinal,tnew=0;
   double rh,htspan,absh,hmin,hmax,h,tdel;
   double abshlast,hinvGak,minnrm,oldnrm=0.,newnrm;
   double err,hopt,errkm1,hkm1,errit,rate=0.,temp,errkp1,hkp1,maxtmp;
-  int k,klast,nconhk,iter,next,kopt,tdir;
+  int k,klast,nconhk,iter,next,next_last,kopt,tdir;
 
   /* Misc: */
   int stepstat[6],nfenj,j,ii,jj, numidx, neqp=neq+1;
   int verbose=0;
 
-  /** Allocate memory . */
+  /** Get the workspace of this thread, allocated for at least neq equations. */
 
+  struct evolver_ndf15_workspace * pws = &evolver_ndf15_thread_workspace;
+  struct jacobian * jac;
+  struct numjac_workspace * nj_ws;
   void * buffer;
-  int buffer_size;
 
-  buffer_size=
-    15*neqp*sizeof(double)
-    +neqp*sizeof(int)
-    +neqp*sizeof(double*)
-    +(7*neq+1)*sizeof(double);
+  class_call(evolver_ndf15_workspace_prepare(pws,neq,error_message),
+             error_message,error_message);
 
-  class_alloc(buffer,
-	      buffer_size,
-	      error_message);
+  buffer = pws->buffer;
+  jac = &(pws->jac);
+  nj_ws = &(pws->nj_ws);
 
   f0       =(double*)buffer;
   wt       =f0+neqp;
@@ -142,19 +271,20 @@ int evolver_ndf15(
   tempvec1 =yppinterp+neqp;
   tempvec2 =tempvec1+neqp;
 
-  interpidx=(int*)(tempvec2+neqp);
-
-  dif      =(double**)(interpidx+neqp);
-  dif[1]   =(double*)(dif+neqp);
-  for(j=2;j<=neq;j++) dif[j] = dif[j-1]+7; /* Set row pointers... */
+  /* The backward differences are stored by order: dif[j][1..neq] is the
+     difference of order j of the whole vector, so that the loops over the
+     components are contiguous. */
   dif[0] = NULL;
-  /* for (ii=0;ii<(7*neq+1);ii++) dif[1][ii]=0.; */
-  for (j=1; j<=neq; j++) {
-    for (ii=1;ii<=7;ii++) {
+  dif[1] = tempvec2+neqp;
+  for(j=2;j<=7;j++) dif[j] = dif[j-1]+neqp; /* Set row pointers... */
+  for (j=1; j<=7; j++) {
+    for (ii=1;ii<=neq;ii++) {
       dif[j][ii]=0.;
     }
   }
 
+  interpidx=(int*)(dif[7]+neqp);
+
   /* 	class_alloc(f0,sizeof(double)*neqp,error_message); */
   /* 	class_alloc(wt,sizeof(double)*neqp,error_message); */
   /* 	class_alloc(ddfddt,sizeof(double)*neqp,error_message); */
@@ -182,11 +312,15 @@ int evolver_ndf15(
   /*Set pointers:*/
   ynew = y_inout-1; /* This way y_inout is always up to date. */
 
-  /*Initialize the jacobian:*/
-  class_call(initialize_jacobian(&jac,neq,error_message),error_message,error_message);
-
-  /* Initialize workspace for numjac: */
-  class_call(initialize_numjac_workspace(&nj_ws,neq,error_message),error_message,error_message);
+  /* Group the columns of the sparsity pattern supplied by the caller, if any: */
+  if ((sparsity_pattern != NULL) && (jac->use_sparse == _TRUE_)){
+    class_call((*sparsity_pattern)(neq,jac->max_nonzero,jac->spS->Ap,jac->spS->Ai,&(jac->has_supplied_pattern),
+				   parameters_and_workspace_for_derivs,error_message),
+	       error_message,error_message);
+    if (jac->has_supplied_pattern == _TRUE_){
+      jac->max_supplied_group = column_grouping(jac->spS,jac->supplied_col_group,jac->col_wi);
+    }
+  }
 
   /* Initialize some method parameters:*/
   for(ii=0;ii<5;ii++){
@@ -236,9 +370,9 @@ int evolver_ndf15(
 
 
   nfenj=0;
-  class_call(numjac((*derivs),t,y,f0,&jac,&nj_ws,abstol,neq,
-		    &nfenj,parameters_and_workspace_for_derivs,error_message),
-	     error_message,error_message);
+  class_call_profile(profile_numjac,numjac((*derivs),t,y,f0,jac,nj_ws,abstol,neq,
+				    &nfenj,parameters_and_workspace_for_derivs,error_message),
+		     error_message,error_message);
   stepstat[3] += 1;
   stepstat[2] += nfenj;
   Jcurrent = _TRUE_; /* True */
@@ -265,10 +399,21 @@ int evolver_ndf15(
   stepstat[2] += 1;
 
   /*I assume that a full jacobi matrix is always calculated in the beginning...*/
-  for(ii=1;ii<=neq;ii++){
-    ddfddt[ii]=0.0;
+  if (jac->use_sparse){
+    /* ...and that its sparse copy holds all its non-zero entries: */
+    for(ii=1;ii<=neq;ii++) ddfddt[ii]=0.0;
     for(jj=1;jj<=neq;jj++){
-      ddfddt[ii]+=(jac.dfdy[ii][jj])*f0[jj];
+      for(ii=jac->spJ->Ap[jj-1];ii<jac->spJ->Ap[jj];ii++){
+	ddfddt[jac->spJ->Ai[ii]+1]+=(jac->xjac[ii])*f0[jj];
+      }
+    }
+  }
+  else{
+    for(ii=1;ii<=neq;ii++){
+      ddfddt[ii]=0.0;
+      for(jj=1;jj<=neq;jj++){
+	ddfddt[ii]+=(jac->dfdy[ii][jj])*f0[jj];
+      }
     }
   }
 
@@ -288,11 +433,11 @@ int evolver_ndf15(
   klast = k;
   abshlast = absh;
 
-  for(ii=1;ii<=neq;ii++) dif[ii][1] = h*f0[ii];
+  for(ii=1;ii<=neq;ii++) dif[1][ii] = h*f0[ii];
 
   hinvGak = h*invGa[k-1];
   nconhk = 0; 	/*steps taken with current h and k*/
-  class_call(new_linearisation(&jac,hinvGak,neq,error_message),
+  class_call(new_linearisation(jac,hinvGak,neq,error_message),
 	     error_message,error_message);
   stepstat[4] += 1;
   havrate = _FALSE_; /*false*/
@@ -328,7 +473,7 @@ int evolver_ndf15(
       adjust_stepsize(dif,(absh/abshlast),neq,k);
       hinvGak = h * invGa[k-1];
       nconhk = 0;
-      class_call(new_linearisation(&jac,hinvGak,neq,error_message),
+      class_call(new_linearisation(jac,hinvGak,neq,error_message),
 		 error_message,error_message);
       stepstat[4] += 1;
       havrate = _FALSE_;
@@ -340,10 +485,10 @@ int evolver_ndf15(
       while(gotynew==_FALSE_){
 	/*Compute the constant terms in the equation for ynew.
 	  Next FOR lop is just: psi = matmul(dif(:,1:k),(G(1:k) * invGa(k)))*/
-	for(ii=1;ii<=neq;ii++){
-	  psi[ii] = 0.0;
-	  for(jj=1;jj<=k;jj++){
-	    psi[ii] += dif[ii][jj]*G[jj-1]*invGa[k-1];
+	for(ii=1;ii<=neq;ii++) psi[ii] = 0.0;
+	for(jj=1;jj<=k;jj++){
+	  for(ii=1;ii<=neq;ii++){
+	    psi[ii] += dif[jj][ii]*G[jj-1]*invGa[k-1];
 	  }
 	}
 	/* Predict a solution at t+h. */
@@ -352,10 +497,10 @@ int evolver_ndf15(
 	  tnew = tfinal; /*Hit end point exactly. */
 	}
 	h = tnew - t; 		 /* Purify h. */
-	for(ii=1;ii<=neq;ii++){
-	  pred[ii] = y[ii];
-	  for(jj=1;jj<=k;jj++){
-	    pred[ii] +=dif[ii][jj];
+	for(ii=1;ii<=neq;ii++) pred[ii] = y[ii];
+	for(jj=1;jj<=k;jj++){
+	  for(ii=1;ii<=neq;ii++){
+	    pred[ii] +=dif[jj][ii];
 	  }
 	}
 	eqvec(pred,ynew,neq);
@@ -387,12 +532,12 @@ int evolver_ndf15(
 	  }
 
 	  /*Solve the linear system A*x=del by using the LU decomposition stored in jac.*/
-	  if (jac.use_sparse){
-	    sp_lusolve(jac.Numerical, rhs+1, del+1);
+	  if (jac->use_sparse){
+	    sp_lusolve(jac->Numerical, rhs+1, del+1);
 	  }
 	  else{
 	    eqvec(rhs,del,neq);
-	    lubksb(jac.LU,neq,jac.luidx,del);
+	    lubksb(jac->LU,neq,jac->luidx,del);
 	  }
 
 	  stepstat[5]+=1;
@@ -451,7 +596,7 @@ int evolver_ndf15(
 	    class_call((*derivs)(t,y+1,f0+1,parameters_and_workspace_for_derivs,error_message),
 		       error_message,error_message);
 	    nfenj=0;
-	    class_call(numjac((*derivs),t,y,f0,&jac,&nj_ws,abstol,neq,
+	    class_call_profile(profile_numjac,numjac((*derivs),t,y,f0,jac,nj_ws,abstol,neq,
 			      &nfenj,parameters_and_workspace_for_derivs,error_message),
 		       error_message,error_message);
 	    stepstat[3] += 1;
@@ -473,7 +618,7 @@ int evolver_ndf15(
 	    nconhk = 0;
 	  }
 	  /* A new linearisation is needed in both cases */
-	  class_call(new_linearisation(&jac,hinvGak,neq,error_message),
+	  class_call(new_linearisation(jac,hinvGak,neq,error_message),
 		     error_message,error_message);
 	  stepstat[4] += 1;
 	  havrate = _FALSE_;
@@ -501,7 +646,7 @@ int evolver_ndf15(
 	  if (k > 1){
 	    errkm1 = 0.0;
 	    for(jj=1;jj<=neq;jj++){
-	      errkm1 = MAX(errkm1,fabs((dif[jj][k]+difkp1[jj])*invwt[jj]));
+	      errkm1 = MAX(errkm1,fabs((dif[k][jj]+difkp1[jj])*invwt[jj]));
 	    }
 	    errkm1 = errkm1*erconst[k-2];
 	    hkm1 = absh * MAX(0.1, 0.769*pow((rtol/errkm1),(1.0/k)));
@@ -522,7 +667,7 @@ int evolver_ndf15(
 	adjust_stepsize(dif,(absh/abshlast),neq,k);
 	hinvGak = h * invGa[k-1];
 	nconhk = 0;
-	class_call(new_linearisation(&jac,hinvGak,neq,error_message),
+	class_call(new_linearisation(jac,hinvGak,neq,error_message),
 		   error_message,error_message);
 	stepstat[4] += 1;
 	havrate = _FALSE_;
@@ -536,39 +681,22 @@ int evolver_ndf15(
 
     /* Update dif: */
     for(jj=1;jj<=neq;jj++){
-      dif[jj][k+2] = difkp1[jj] - dif[jj][k+1];
-      dif[jj][k+1] = difkp1[jj];
+      dif[k+2][jj] = difkp1[jj] - dif[k+1][jj];
+      dif[k+1][jj] = difkp1[jj];
     }
     for(j=k;j>=1;j--){
       for(ii=1;ii<=neq;ii++){
-	dif[ii][j] += dif[ii][j+1];
+	dif[j][ii] += dif[j+1][ii];
       }
     }
     /** Output **/
-    while ((next<tres)&&(tdir * (tnew - t_vec[next]) >= 0.0)){
-      /* Do we need to write output? */
-      if (tnew==t_vec[next]){
-	class_call((*output)(t_vec[next],ynew+1,f0+1,next,parameters_and_workspace_for_derivs,error_message),
-		   error_message,error_message);
-// MODIFICATION BY LUC
-// All print_variables have been moved to the end of time step
-/*
-	if (print_variables != NULL){
-	  class_call((*print_variables)(t_vec[next],ynew+1,f0+1,
-					parameters_and_workspace_for_derivs,error_message),
-		     error_message,error_message);
-	}
-*/
-      }
-      else {
-	/*Interpolate if we have overshot sample values*/
-	interp_from_dif(t_vec[next],tnew,ynew,h,dif,k,yinterp,ypinterp,yppinterp,interpidx,neq,2);
-
-	class_call((*output)(t_vec[next],yinterp+1,ypinterp+1,next,parameters_and_workspace_for_derivs,
-			     error_message),error_message,error_message);
-
-      }
-      next++;
+    /* All the output points covered by this step are written at once: */
+    for(next_last=next; (next_last<tres)&&(tdir * (tnew - t_vec[next_last]) >= 0.0); next_last++);
+    if (next_last > next){
+      class_call(output_from_dif(output,t_vec,next,next_last,tnew,ynew,f0,h,dif,k,yinterp,ypinterp,neq,
+				 parameters_and_workspace_for_derivs,error_message),
+		 error_message,error_message);
+      next = next_last;
     }
     /** End of output **/
     if (done==_TRUE_) {
@@ -589,7 +717,7 @@ int evolver_ndf15(
       if (k > 1){
 	errkm1 = 0.0;
 	for(jj=1;jj<=neq;jj++){
-	  errkm1 = MAX(errkm1,fabs(dif[jj][k]*invwt[jj]));
+	  errkm1 = MAX(errkm1,fabs(dif[k][jj]*invwt[jj]));
 	}
 	errkm1 = errkm1*erconst[k-2];
 	temp = 1.3*pow((errkm1/rtol),(1.0/k));
@@ -607,7 +735,7 @@ int evolver_ndf15(
       if (k < maxk){
 	errkp1 = 0.0;
 	for(jj=1;jj<=neq;jj++){
-	  errkp1 = MAX(errkp1,fabs(dif[jj][k+2]*invwt[jj]));
+	  errkp1 = MAX(errkp1,fabs(dif[k+2][jj]*invwt[jj]));
 	}
 	errkp1 = errkp1*erconst[k];
 	temp = 1.4*pow((errkp1/rtol),(1.0/(k+2.0)));
@@ -675,9 +803,10 @@ int evolver_ndf15(
 	   stepstat[2],stepstat[3],stepstat[4],stepstat[5]);
   }
 
-  /** Deallocate memory */
+  /** Keep the statistics of this call; the workspace is kept for the next call */
 
-  free(buffer);
+  pws->statistics.calls++;
+  for(ii=0;ii<6;ii++) pws->statistics.stepstat[ii] += stepstat[ii];
 
   /* 	free(f0); */
   /* 	free(wt); */
@@ -699,8 +828,6 @@ int evolver_ndf15(
   /* 	free(dif[1]); */
   /* 	free(dif); */
 
-  uninitialize_jacobian(&jac);
-  uninitialize_numjac_workspace(&nj_ws);
   return _SUCCESS_;
 
 } /*End of program*/
@@ -787,8 +914,8 @@ int interp_from_difold(double tinterp,double tnew,double *ynew,double h,double *
   if (k==1){
     for(i=1;i<=neq;i++){
       if(index[i]==_TRUE_){
-	yinterp[i] = ynew[i] + dif[i][1] * s;
-	if (output>1) ypinterp[i] = dif[i][1]/h;
+	yinterp[i] = ynew[i] + dif[1][i] * s;
+	if (output>1) ypinterp[i] = dif[1][i]/h;
 	if (output>2) yppinterp[i] = 0; /* No good estimate can be made of the second derivative */
       }
     }
@@ -804,7 +931,7 @@ int interp_from_difold(double tinterp,double tnew,double *ynew,double h,double *
 	  prodm=1.0;
 	  factor*=j;
 	  for(m=0;m<j;m++) prodm*=(m+s);
-	  sumj+=dif[i][j]/factor*prodm;
+	  sumj+=dif[j][i]/factor*prodm;
 	}
 	yinterp[i] = ynew[i]+sumj;
 	/* Now the first derivative: */
@@ -821,7 +948,7 @@ int interp_from_difold(double tinterp,double tnew,double *ynew,double h,double *
 	      }
 	      suml+=prodm;
 	    }
-	    sumj+=dif[i][j]/factor*suml;
+	    sumj+=dif[j][i]/factor*suml;
 	  }
 	  ypinterp[i] = sumj/h;
 	}
@@ -847,7 +974,7 @@ int interp_from_difold(double tinterp,double tnew,double *ynew,double h,double *
 	      }
 	      suml+=sump;
 	    }
-	    sumj+=dif[i][j]/factor*suml;
+	    sumj+=dif[j][i]/factor*suml;
 	  }
 	  yppinterp[i] = sumj/(h*h);
 	}
@@ -857,7 +984,8 @@ int interp_from_difold(double tinterp,double tnew,double *ynew,double h,double *
   return _SUCCESS_;
 }
 
-/* Subroutine that interpolates from information stored in dif */
+/* Subroutine that interpolates from information stored in dif. If mask is
+   NULL, all the components are interpolated in contiguous loops. */
 int interp_from_dif(double tinterp,
                     double tnew,
                     double *ynew,
@@ -890,13 +1018,30 @@ int interp_from_dif(double tinterp,
     vecdy[j] = prod*sumfrac/(h*fact);
   }
 
+  if (mask == NULL){
+    for (index_x=1; index_x<=neq; index_x++){
+      yinterp[index_x] = 0.;
+      ypinterp[index_x] = 0.;
+    }
+    for (j=0; j<k; j++){
+      for (index_x=1; index_x<=neq; index_x++){
+        yinterp[index_x] += vecy[j]*dif[j+1][index_x];
+        ypinterp[index_x] += vecdy[j]*dif[j+1][index_x];
+      }
+    }
+    for (index_x=1; index_x<=neq; index_x++){
+      yinterp[index_x] = ynew[index_x] + yinterp[index_x];
+    }
+    return _SUCCESS_;
+  }
+
   for (index_x=1; index_x<=neq; index_x++){
     if (mask[index_x]==_TRUE_){
       sumtmp = 0;
       sumtmp2 = 0;
       for (j=0; j<k; j++){
-        sumtmp += vecy[j]*dif[index_x][j+1];
-        sumtmp2 += vecdy[j]*dif[index_x][j+1];
+        sumtmp += vecy[j]*dif[j+1][index_x];
+        sumtmp2 += vecdy[j]*dif[j+1][index_x];
       }
       yinterp[index_x] = ynew[index_x] + sumtmp;
       ypinterp[index_x] = sumtmp2;
@@ -905,10 +1050,49 @@ int interp_from_dif(double tinterp,
   return _SUCCESS_;
 }
 
+/* Subroutine that writes all the output points t_vec[first..last-1] covered
+   by the last step, ending at tnew: the solution is interpolated from dif at
+   each of them (or taken from ynew and f0 at tnew itself), and passed to
+   (*output). */
+int output_from_dif(int (*output)(double x,double y[],double dy[],int index_x,void * parameters_and_workspace,
+				  ErrorMsg error_message),
+		    double *t_vec,
+		    int first,
+		    int last,
+		    double tnew,
+		    double *ynew,
+		    double *f0,
+		    double h,
+		    double **dif,
+		    int k,
+		    double *yinterp,
+		    double *ypinterp,
+		    int neq,
+		    void * parameters_and_workspace_for_output,
+		    ErrorMsg error_message){
+  int index_t;
+
+  for (index_t=first; index_t<last; index_t++){
+    if (t_vec[index_t]==tnew){
+      class_call((*output)(t_vec[index_t],ynew+1,f0+1,index_t,parameters_and_workspace_for_output,error_message),
+		 error_message,error_message);
+    }
+    else{
+      /*Interpolate if we have overshot sample values*/
+      interp_from_dif(t_vec[index_t],tnew,ynew,h,dif,k,yinterp,ypinterp,NULL,NULL,neq,2);
+
+      class_call((*output)(t_vec[index_t],yinterp+1,ypinterp+1,index_t,parameters_and_workspace_for_output,
+			   error_message),error_message,error_message);
+    }
+  }
+  return _SUCCESS_;
+}
+
 int adjust_stepsize(double **dif, double abshdivabshlast, int neq,int k){
   double mydifU[5][5]={{-1,-2,-3,-4,-5},{0,1,3,6,10},{0,0,-1,-4,-10},{0,0,0,1,5},{0,0,0,0,-1}};
   double tempvec[5];
   double mydifRU[5][5];
+  double sum;
   int ii,jj,kk;
 
   for(ii=1;ii<=5;ii++) mydifRU[0][ii-1] = -ii*abshdivabshlast;
@@ -929,15 +1113,16 @@ int adjust_stepsize(double **dif, double abshdivabshlast, int neq,int k){
     }
   }
 
-  for(ii=0;ii<neq;ii++){
+  for(ii=1;ii<=neq;ii++){
     for(kk=0;kk<k;kk++){
-      /* Save the k first values of the i'th row of dif */
-      tempvec[kk] = dif[ii+1][kk+1];
+      /* Save the k first differences of the i'th component */
+      tempvec[kk] = dif[kk+1][ii];
     }
     for(jj=0;jj<k;jj++){
       /* Now do the matrix multiplication: */
-      dif[ii+1][jj+1] = 0.0;
-      for(kk=0;kk<k;kk++) dif[ii+1][jj+1] += tempvec[kk]*mydifRU[kk][jj];
+      sum = 0.0;
+      for(kk=0;kk<k;kk++) sum += tempvec[kk]*mydifRU[kk][jj];
+      dif[jj+1][ii] = sum;
     }
   }
   return _SUCCESS_;
@@ -1206,6 +1391,8 @@ int numjac(
   double Fdiff_absrm,Fdiff_new;
   double **dFdy,*fac;
   int *Ap=NULL, *Ai=NULL;
+  int *Sp=NULL, *Si=NULL, supplied_sparse, first, last, entry;
+  double *Sx=NULL, value;
 
   dFdy = jac->dfdy; /* Assign pointer to dfdy directly for easier notation. */
   fac = jac->jacvec;
@@ -1213,6 +1400,15 @@ int numjac(
     Ap = jac->spJ->Ap;
     Ai = jac->spJ->Ai;
   }
+  /* With a supplied pattern and the sparse method, the entries are computed
+     in the storage of the supplied pattern (spS->Ax) and never in dFdy: */
+  supplied_sparse = ((jac->use_sparse)&&(jac->repeated_pattern < jac->trust_sparse)&&
+		     (jac->has_supplied_pattern == _TRUE_));
+  if (supplied_sparse){
+    Sp = jac->spS->Ap;
+    Si = jac->spS->Ai;
+    Sx = jac->spS->Ax;
+  }
 
   /* Set new_jacobian flag: */
   jac->new_jacobian = _TRUE_;
@@ -1275,6 +1471,18 @@ int numjac(
       }
     }
   }
+  else if (jac->has_supplied_pattern == _TRUE_){
+    /* Normal calculation, but perturb together the columns which are
+       independent according to the supplied pattern: */
+    colmax = jac->max_supplied_group+1;
+    for(j=1;j<=colmax;j++){
+      group = j-1;
+      for(i=1;i<=neq;i++){
+	nj_ws->ydel_Fdel[i][j] = y[i];
+	if(jac->supplied_col_group[i-1]==group) nj_ws->ydel_Fdel[i][j] +=nj_ws->del[i];
+      }
+    }
+  }
   else{
     /*printf("\n Normal calculation..."); */
     /*Normal calculation: */
@@ -1328,6 +1536,56 @@ int numjac(
       nj_ws->absFdelRm[j+1] = fabs(nj_ws->ydel_Fdel[nj_ws->Rowmax[j+1]][group+1]);
     }
   }
+  else if (supplied_sparse){
+    /* Grouped columns and sparse storage: only the rows of the supplied
+       pattern are read from the column of the corresponding group. */
+    for(j=1;j<=neq;j++){
+      group = jac->supplied_col_group[j-1];
+      Fdiff_new = 0.0;
+      Fdiff_absrm = 0.0;
+      nj_ws->Rowmax[j] = j;
+      nj_ws->Difmax[j] = 0.0;
+      for(nz=Sp[j-1];nz<Sp[j];nz++){
+	row = Si[nz]+1;
+	Fdiff_absrm = MAX(fabs(Fdiff_new),Fdiff_absrm);
+	Fdiff_new = nj_ws->ydel_Fdel[row][group+1] - fval[row];
+	Sx[nz] = Fdiff_new/nj_ws->del[j];
+	if(fabs(Fdiff_new)>=Fdiff_absrm){
+	  nj_ws->Rowmax[j] = row;
+	  nj_ws->Difmax[j] = fabs(Fdiff_new);
+	}
+      }
+      nj_ws->absFdelRm[j] = fabs(nj_ws->ydel_Fdel[nj_ws->Rowmax[j]][group+1]);
+    }
+  }
+  else if (jac->has_supplied_pattern == _TRUE_){
+    /* Normal case with grouped columns: only the rows of the supplied
+       pattern are read from the column of the corresponding group, the
+       other entries of dFdy vanish. */
+    Ap = jac->spS->Ap;
+    Ai = jac->spS->Ai;
+    for(j=1;j<=neq;j++){
+      group = jac->supplied_col_group[j-1];
+      for(i=1;i<=neq;i++) dFdy[i][j] = 0.0;
+      Fdiff_new = 0.0;
+      Fdiff_absrm = 0.0;
+      nj_ws->Rowmax[j] = j;
+      nj_ws->Difmax[j] = 0.0;
+      for(nz=Ap[j-1];nz<Ap[j];nz++){
+	row = Ai[nz]+1;
+	Fdiff_absrm = MAX(fabs(Fdiff_new),Fdiff_absrm);
+	Fdiff_new = nj_ws->ydel_Fdel[row][group+1] - fval[row];
+	dFdy[row][j] = Fdiff_new/nj_ws->del[j];
+	if(fabs(Fdiff_new)>=Fdiff_absrm){
+	  nj_ws->Rowmax[j] = row;
+	  nj_ws->Difmax[j] = fabs(Fdiff_new);
+	}
+      }
+      nj_ws->absFdelRm[j] = fabs(nj_ws->ydel_Fdel[nj_ws->Rowmax[j]][group+1]);
+    }
+    Ap = jac->spJ->Ap;
+    Ai = jac->spJ->Ai;
+  }
   else{
     /*Normal case:*/
     for(j=1;j<=neq;j++){
@@ -1413,6 +1671,9 @@ int numjac(
 	    if ((jac->use_sparse)&&(jac->repeated_pattern >= jac->trust_sparse)){
 	      for(i=Ap[j-1];i<Ap[j];i++) jac->xjac[i]=nj_ws->tmp[Ai[i]+1];
 	    }
+	    else if (supplied_sparse){
+	      for(i=Sp[j-1];i<Sp[j];i++) Sx[i]=nj_ws->tmp[Si[i]+1];
+	    }
 	    else{
 	      for(i=1;i<=neq;i++) dFdy[i][j]=nj_ws->tmp[i];
 	    }
@@ -1436,15 +1697,32 @@ int numjac(
   }
   /* If use_sparse is true but I still don't trust the sparsity pattern, go through the full calculated jacobi-
      matrix, deduce the sparsity pattern, compare with the old pattern, and write the new sparse Jacobi matrix.
-     If I do this cleverly, I only have to walk through the jacobian once, and I don't need any local storage.*/
+     If I do this cleverly, I only have to walk through the jacobian once, and I don't need any local storage.
+     With a supplied pattern, only its entries are walked through (the others vanish). */
 
   if ((jac->use_sparse)&&(jac->repeated_pattern < jac->trust_sparse)){
     nz=0; /*Number of non-zeros */
     Ap[0]=0; /*<-Always is.. */
     pattern_broken = _FALSE_;
     for(j=1;j<=neq;j++){
-      for(i=1;i<=neq;i++){
-	if ((i==j)||(fabs(dFdy[i][j])!=0.0)){
+      if (supplied_sparse){
+	first = Sp[j-1];
+	last = Sp[j];
+      }
+      else{
+	first = 1;
+	last = neq+1;
+      }
+      for(entry=first;entry<last;entry++){
+	if (supplied_sparse){
+	  i = Si[entry]+1;
+	  value = Sx[entry];
+	}
+	else{
+	  i = entry;
+	  value = dFdy[i][j];
+	}
+	if ((i==j)||(fabs(value)!=0.0)){
 	  /* Diagonal or non-zero index found. */
 	  if (nz>=jac->max_nonzero){
 	    /* Too many non-zero points to take advantage of sparsity.*/
@@ -1488,7 +1766,7 @@ int numjac(
 	  /* Write row_number: */
 	  Ai[nz] = i-1;
 	  /* Write value: */
-	  jac->xjac[nz] = dFdy[i][j];
+	  jac->xjac[nz] = value;
 	  nz++;
 	}
       }
@@ -1496,6 +1774,13 @@ int numjac(
       if (jac->use_sparse==_FALSE_) break;
       Ap[j]=nz;
     }
+    if ((jac->use_sparse==_FALSE_)&&(supplied_sparse)){
+      /* The dense method takes over: write the supplied entries in dFdy. */
+      for(j=1;j<=neq;j++){
+	for(i=1;i<=neq;i++) dFdy[i][j] = 0.0;
+	for(entry=Sp[j-1];entry<Sp[j];entry++) dFdy[Si[entry]+1][j] = Sx[entry];
+      }
+    }
     if (jac->use_sparse==_TRUE_){
       if ((jac->has_pattern==_TRUE_)&&(pattern_broken==_FALSE_)){
 	/*New jacobian fitted into the current sparsity pattern:*/
@@ -1516,7 +1801,7 @@ int numjac(
 int initialize_jacobian(struct jacobian *jac, int neq, ErrorMsg error_message){
   int i;
 
-  if (neq>15){
+  if (neq>=_NDF15_SPARSE_MIN_NEQ_){
     jac->use_sparse = 1;
   }
   else{
@@ -1531,6 +1816,7 @@ int initialize_jacobian(struct jacobian *jac, int neq, ErrorMsg error_message){
   /* Number of times a pattern is repeated before we trust it. */
   jac->has_grouping = 0;
   jac->has_pattern = 0;
+  jac->has_supplied_pattern = 0;
   jac->sparse_stuff_initialized=0;
 
   /*Setup memory for the pointers of the dense method:*/
@@ -1571,6 +1857,56 @@ int initialize_jacobian(struct jacobian *jac, int neq, ErrorMsg error_message){
     class_call(sp_mat_alloc(&jac->spJ, neq, neq, jac->max_nonzero,
 			    error_message),error_message,error_message);
 
+    class_alloc(jac->supplied_col_group,sizeof(int)*neq,error_message);
+
+    class_call(sp_mat_alloc(&jac->spS, neq, neq, jac->max_nonzero,
+			    error_message),error_message,error_message);
+
+  }
+
+  reset_jacobian(jac,neq);
+  return _SUCCESS_;
+}
+
+/* Set up a jacobian allocated by initialize_jacobian for at least neq
+   equations for a new problem with neq equations: set the dimensions and
+   row pointers, and forget the experience gained in the previous calls. */
+int reset_jacobian(struct jacobian *jac, int neq){
+  int i;
+
+  if ((neq>=_NDF15_SPARSE_MIN_NEQ_)&&(jac->sparse_stuff_initialized)){
+    jac->use_sparse = 1;
+  }
+  else{
+    jac->use_sparse = 0;
+  }
+  jac->max_nonzero = (int)(MAX(3*neq,0.20*neq*neq));
+  jac->cnzmax = 12*jac->max_nonzero/5;
+
+  jac->repeated_pattern = 0;
+  jac->trust_sparse = 4;
+  jac->has_grouping = 0;
+  jac->has_pattern = 0;
+  jac->has_supplied_pattern = 0;
+
+  for(i=2;i<=neq;i++) jac->dfdy[i] = jac->dfdy[i-1]+neq;
+  for(i=2;i<=neq;i++) jac->LU[i] = jac->LU[i-1]+neq;
+
+  if (jac->sparse_stuff_initialized){
+    jac->spJ->ncols = neq;
+    jac->spJ->nrows = neq;
+    jac->spJ->maxnz = jac->max_nonzero;
+    jac->spS->ncols = neq;
+    jac->spS->nrows = neq;
+    jac->spS->maxnz = jac->max_nonzero;
+    jac->Numerical->n = neq;
+    jac->Numerical->L->ncols = neq;
+    jac->Numerical->L->nrows = neq;
+    jac->Numerical->L->maxnz = neq*(neq+1)/2;
+    jac->Numerical->U->ncols = neq;
+    jac->Numerical->U->nrows = neq;
+    jac->Numerical->U->maxnz = neq*(neq+1)/2;
+    for (i=1;i<neq;i++) jac->Numerical->xi[i] = jac->Numerical->xi[i-1]+neq;
   }
 
   /* Initialize jacvec to sqrt(eps):*/
@@ -1595,13 +1931,15 @@ int uninitialize_jacobian(struct jacobian *jac){
     free(jac->Cp);
     free(jac->Ci);
     sp_mat_free(jac->spJ);
+    free(jac->supplied_col_group);
+    sp_mat_free(jac->spS);
     sp_num_free(jac->Numerical);
   }
   return _SUCCESS_;
 }
 
 int initialize_numjac_workspace(struct numjac_workspace * nj_ws,int neq, ErrorMsg error_message){
-  int i,neqp=neq+1;
+  int neqp=neq+1;
   /* Allocate vectors and matrices: */
 
   class_alloc(nj_ws->yscale,sizeof(double)*neqp,error_message);
@@ -1618,7 +1956,7 @@ int initialize_numjac_workspace(struct numjac_workspace * nj_ws,int neq, ErrorMs
   class_alloc(nj_ws->ydel_Fdel,sizeof(double*)*(neq+1),error_message); /* Allocate vector of pointers to rows of matrix.*/
   class_alloc(nj_ws->ydel_Fdel[1],sizeof(double)*(neq*neq+1),error_message);
   nj_ws->ydel_Fdel[0] = NULL;
-  for(i=2;i<=neq;i++) nj_ws->ydel_Fdel[i] = nj_ws->ydel_Fdel[i-1]+neq; /* Set row pointers... */
+  reset_numjac_workspace(nj_ws,neq); /* Set row pointers... */
 
   class_alloc(nj_ws->logj,sizeof(int)*neqp,error_message);
   class_alloc(nj_ws->Rowmax,sizeof(int)*neqp,error_message);
@@ -1627,6 +1965,14 @@ int initialize_numjac_workspace(struct numjac_workspace * nj_ws,int neq, ErrorMs
   return _SUCCESS_;
 }
 
+/* Set up a numjac workspace allocated for at least neq equations for a
+   problem with neq equations. */
+int reset_numjac_workspace(struct numjac_workspace * nj_ws, int neq){
+  int i;
+  for(i=2;i<=neq;i++) nj_ws->ydel_Fdel[i] = nj_ws->ydel_Fdel[i-1]+neq;
+  return _SUCCESS_;
+}
+
 int uninitialize_numjac_workspace(struct numjac_workspace * nj_ws){
   /* Deallocate vectors and matrices: */
   free(nj_ws->yscale);
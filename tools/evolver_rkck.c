@@ -1,5 +1,28 @@
 #include "evolver_rkck.h"
 
+/** workspace of generic_integrator() kept by the calling thread between the calls to evolver_rk() */
+static struct generic_integrator_workspace evolver_rk_thread_workspace;
+#pragma omp threadprivate(evolver_rk_thread_workspace)
+
+/**
+ * Free the workspace which evolver_rk() kept for the calling thread
+ * (to be called by each thread at the end of a parallel region in
+ * which it called evolver_rk()). Its vectors are only enlarged from
+ * one call to the next, so that the successive wavenumbers do not
+ * allocate memory.
+ *
+ * @return the error status
+ */
+
+int evolver_rk_workspace_free(){
+
+  if (evolver_rk_thread_workspace.buffer != NULL)
+    cleanup_generic_integrator(&evolver_rk_thread_workspace);
+
+  return _SUCCESS_;
+}
+
+
 int evolver_rk(int (*derivs)(double x,
 				  double * y,
 				  double * dy,
@@ -31,11 +54,20 @@ int evolver_rk(int (*derivs)(double x,
 					   double dy[],
 					   void * parameters_and_workspace,
 					   ErrorMsg error_message),
+		    int (*sparsity_pattern)(int neq,
+					    int max_nonzero,
+					    int * Ap,
+					    int * Ai,
+					    int * has_pattern,
+					    void * parameters_and_workspace,
+					    ErrorMsg error_message),
 		    ErrorMsg error_message) {
 
+  /* sparsity_pattern belongs to the generic evolver interface, but is only used by evolver_ndf15 */
+
   int next_index_x;
   double x1,x2=0.,timestep,timescale;
-  struct generic_integrator_workspace gi;
+  struct generic_integrator_workspace * pgi;
   double * dy;
   short call_output;
 
@@ -47,11 +79,22 @@ int evolver_rk(int (*derivs)(double x,
 
   while (x_sampling[next_index_x] < x_ini) next_index_x++;
 
-  class_call(initialize_generic_integrator(y_size, &gi),
-	     gi.error_message,
-	     error_message);
+  /* the workspace of the integrator is kept by each thread from one
+     call to the next, and only enlarged when y_size grows */
+  pgi = &evolver_rk_thread_workspace;
 
-  class_alloc(dy,y_size*sizeof(double),error_message);
+  if (pgi->buffer == NULL) {
+    class_call(initialize_generic_integrator(y_size, pgi),
+	       pgi->error_message,
+	       error_message);
+  }
+  else {
+    class_call(generic_integrator_reserve(y_size, pgi),
+	       pgi->error_message,
+	       error_message);
+  }
+
+  dy = pgi->ytempo;
 
   x1=x_ini;
 
@@ -114,8 +157,8 @@ int evolver_rk(int (*derivs)(double x,
 				  parameters_and_workspace_for_derivs,
 				  tolerance,
 				  x1*minimum_variation,
-				  &gi),
-	       gi.error_message,
+				  pgi),
+	       pgi->error_message,
 	       error_message);
 
     if (call_output == _TRUE_) {
@@ -167,12 +210,6 @@ int evolver_rk(int (*derivs)(double x,
 	       error_message,
 	       error_message);
 
-  class_call(cleanup_generic_integrator(&gi),
-	     gi.error_message,
-	     error_message);
-
-  free(dy);
-
   return _SUCCESS_;
 
 }
@@ -0,0 +1,506 @@
+/**
+ * Module with tools for Fast Fourier Transforms and for the FFTLog
+ * algorithm computing Hankel transforms of functions sampled on a
+ * logarithmic grid
+ */
+
+#include "fft.h"
+
+/**
+ * In-place Fast Fourier Transform \f$ Z_m = \sum_j z_j e^{-2 i \pi
+ * m j/N} \f$ (radix 2, no normalization).
+ *
+ * @param data          Input/output: the complex numbers, data[2*j] (real part) and data[2*j+1] (imaginary part)
+ * @param N             Input: number of complex numbers (a power of two)
+ * @param twiddle       Input: \f$ e^{-2 i \pi m/N} \f$ for 0 <= m < N/2, stored like data
+ * @param error_message Output: error message
+ * @return the error status
+ */
+
+int fft_complex(
+                double * data,
+                int N,
+                double * twiddle,
+                ErrorMsg error_message
+                ) {
+
+  int i,j,bit,len,half,step,start,k;
+  double tmp,wre,wim,ure,uim,vre,vim;
+
+  class_test((N < 2) || ((N & (N-1)) != 0),
+             error_message,
+             "the number of points N=%d should be a power of two",N);
+
+  /** - reorder the data in bit-reversed order */
+  for (i=1,j=0; i<N; i++) {
+    for (bit=N>>1; j & bit; bit>>=1)
+      j ^= bit;
+    j ^= bit;
+    if (i < j) {
+      tmp = data[2*i]; data[2*i] = data[2*j]; data[2*j] = tmp;
+      tmp = data[2*i+1]; data[2*i+1] = data[2*j+1]; data[2*j+1] = tmp;
+    }
+  }
+
+  /** - butterflies of increasing length */
+  for (len=2; len<=N; len<<=1) {
+    half = len>>1;
+    step = N/len;
+    for (start=0; start<N; start+=len) {
+      for (k=0; k<half; k++) {
+        wre = twiddle[2*k*step];
+        wim = twiddle[2*k*step+1];
+        i = start+k;
+        j = i+half;
+        ure = data[2*i];
+        uim = data[2*i+1];
+        vre = data[2*j]*wre-data[2*j+1]*wim;
+        vim = data[2*j]*wim+data[2*j+1]*wre;
+        data[2*i] = ure+vre;
+        data[2*i+1] = uim+vim;
+        data[2*j] = ure-vre;
+        data[2*j+1] = uim-vim;
+      }
+    }
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Prepare the Hankel transforms of order n between the grids \f$ x_i
+ * = x_0 e^{i\Delta}\f$ and \f$ y_j = y_0 e^{j\Delta}\f$: compute the
+ * Fourier-space kernel
+ *
+ * \f[ u_m = \frac{1}{N} 2^{\nu_m-1} \frac{\Gamma((n+\nu_m)/2)}{\Gamma((n-\nu_m)/2+1)} (x_0 y_0)^{-i \eta_m} \f]
+ *
+ * with \f$ \nu_m = q + i \eta_m \f$, \f$ \eta_m = 2\pi m/(N\Delta) \f$.
+ *
+ * The transform assumes that \f$ x^{2-q} f(x) \f$ is periodic in \f$
+ * \ln x \f$: the periodic images of the input function contribute
+ * to the output in proportion to \f$ e^{\pm q N \Delta} \f$, and
+ * negative values of q suppress the images at large x, which would
+ * otherwise contaminate the output at small y. For n=0, the kernel
+ * with \f$ -2 < q < 0 \f$ is the analytic continuation of the
+ * Mellin transform of \f$ J_0 \f$, i.e. the Mellin transform of \f$
+ * J_0-1 \f$: fft_hankel() then adds back \f$ \int_0^\infty f(x) x
+ * dx \f$, computed with the trapezoidal rule in \f$ \ln x \f$.
+ *
+ * @param N             Input: number of points (a power of two)
+ * @param n             Input: order of the Bessel function
+ * @param q             Input: power-law bias, with \f$ -n < q < 3/2 \f$ (\f$ -2 < q < 3/2 \f$ and \f$ q \neq 0 \f$ for n=0)
+ * @param dlnx          Input: logarithmic step of both grids
+ * @param x0            Input: first point of the input grid
+ * @param y0            Input: first point of the output grid
+ * @param pfhp          Output: plan, to be freed with fft_hankel_plan_free()
+ * @param error_message Output: error message
+ * @return the error status
+ */
+
+int fft_hankel_plan_init(
+                         int N,
+                         int n,
+                         double q,
+                         double dlnx,
+                         double x0,
+                         double y0,
+                         struct fft_hankel_plan * pfhp,
+                         ErrorMsg error_message
+                         ) {
+
+  int m,mm;
+  double eta,lnre1,lnim1,lnre2,lnim2,lnre,lnim;
+
+  class_test((N < 2) || ((N & (N-1)) != 0),
+             error_message,
+             "the number of points N=%d should be a power of two",N);
+
+  class_test((q <= ((n == 0) ? -2 : -n)) || (q >= 1.5) || ((n == 0) && (q == 0.)),
+             error_message,
+             "the bias q=%g of a Hankel transform of order %d should obey %d < q < 3/2 (and q!=0 for n=0)",q,n,(n == 0) ? -2 : -n);
+
+  pfhp->N = N;
+  pfhp->n = n;
+  pfhp->q = q;
+  pfhp->dlnx = dlnx;
+  pfhp->x0 = x0;
+  pfhp->y0 = y0;
+
+  class_alloc(pfhp->kernel,2*N*sizeof(double),error_message);
+  class_alloc(pfhp->twiddle,N*sizeof(double),error_message);
+
+  for (m=0; m<N/2; m++) {
+    pfhp->twiddle[2*m] = cos(_TWOPI_*m/N);
+    pfhp->twiddle[2*m+1] = -sin(_TWOPI_*m/N);
+  }
+
+  /** - kernel for 0 <= m <= N/2; the other values follow from the
+      symmetry \f$ u_{N-m} = u_m^* \f$, which guarantees that real
+      functions have real transforms */
+  for (m=0; m<=N/2; m++) {
+
+    eta = _TWOPI_*m/(N*dlnx);
+
+    fft_lngamma(0.5*(n+q),0.5*eta,&lnre1,&lnim1);
+    fft_lngamma(0.5*(n-q)+1.,-0.5*eta,&lnre2,&lnim2);
+
+    lnre = (q-1.)*log(2.)+lnre1-lnre2-log((double)N);
+    lnim = eta*log(2.)+lnim1-lnim2-eta*log(x0*y0);
+
+    pfhp->kernel[2*m] = exp(lnre)*cos(lnim);
+    pfhp->kernel[2*m+1] = exp(lnre)*sin(lnim);
+  }
+
+  /* the Nyquist frequency contributes as the average of +N/2 and -N/2 */
+  pfhp->kernel[N+1] = 0.;
+
+  for (m=N/2+1; m<N; m++) {
+    mm = N-m;
+    pfhp->kernel[2*m] = pfhp->kernel[2*mm];
+    pfhp->kernel[2*m+1] = -pfhp->kernel[2*mm+1];
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Free the arrays of a plan prepared by fft_hankel_plan_init().
+ *
+ * @param pfhp Input: plan
+ * @return the error status
+ */
+
+int fft_hankel_plan_free(
+                         struct fft_hankel_plan * pfhp
+                         ) {
+
+  free(pfhp->kernel);
+  free(pfhp->twiddle);
+
+  return _SUCCESS_;
+}
+
+/**
+ * Hankel transform of one or two real functions with the same
+ * plan. Since the transform is real-linear, two functions are
+ * transformed at the cost of one: they are stored as the real and
+ * imaginary parts of the same complex array.
+ *
+ * @param pfhp          Input: plan prepared by fft_hankel_plan_init()
+ * @param f1            Input: first function, f1[i] = \f$ f_1(x_i) \f$
+ * @param f2            Input: second function (or NULL)
+ * @param g1            Output: transform of the first function, g1[j] = \f$ g_1(y_j) \f$
+ * @param g2            Output: transform of the second function (not used if f2 is NULL)
+ * @param work          Input: workspace of 2*N doubles
+ * @param error_message Output: error message
+ * @return the error status
+ */
+
+int fft_hankel(
+               struct fft_hankel_plan * pfhp,
+               double * f1,
+               double * f2,
+               double * g1,
+               double * g2,
+               double * work,
+               ErrorMsg error_message
+               ) {
+
+  int N,i,m;
+  double x2mq,ym,re,im;
+  double integral1=0.,integral2=0.;
+
+  N = pfhp->N;
+
+  /** - multiply the input by \f$ x^{2-q} \f$ */
+  for (i=0; i<N; i++) {
+    x2mq = exp((2.-pfhp->q)*(log(pfhp->x0)+i*pfhp->dlnx));
+    work[2*i] = x2mq*f1[i];
+    work[2*i+1] = (f2 == NULL) ? 0. : x2mq*f2[i];
+  }
+
+  /** - for the transform of \f$ J_0-1 \f$, compute the integral to be added back */
+  if ((pfhp->n == 0) && (pfhp->q < 0.)) {
+    for (i=0; i<N; i++) {
+      x2mq = exp(pfhp->q*(log(pfhp->x0)+i*pfhp->dlnx));
+      integral1 += x2mq*work[2*i];
+      integral2 += x2mq*work[2*i+1];
+    }
+    integral1 *= pfhp->dlnx;
+    integral2 *= pfhp->dlnx;
+  }
+
+  /** - expand in power laws, and transform each of them */
+  class_call(fft_complex(work,N,pfhp->twiddle,error_message),
+             error_message,
+             error_message);
+
+  for (m=0; m<N; m++) {
+    re = work[2*m]*pfhp->kernel[2*m]-work[2*m+1]*pfhp->kernel[2*m+1];
+    im = work[2*m]*pfhp->kernel[2*m+1]+work[2*m+1]*pfhp->kernel[2*m];
+    work[2*m] = re;
+    work[2*m+1] = im;
+  }
+
+  /** - sum the transforms, and multiply by \f$ y^{-q} \f$ */
+  class_call(fft_complex(work,N,pfhp->twiddle,error_message),
+             error_message,
+             error_message);
+
+  for (i=0; i<N; i++) {
+    ym = exp(-pfhp->q*(log(pfhp->y0)+i*pfhp->dlnx));
+    g1[i] = ym*work[2*i]+integral1;
+    if (f2 != NULL)
+      g2[i] = ym*work[2*i+1]+integral2;
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Prepare the logarithmic convolutions with one or several kernels K
+ * between the grids \f$ x_i = x_0 e^{i\Delta}\f$ and \f$ y_j = y_0
+ * e^{j\Delta}\f$: compute the Fourier-space kernels
+ *
+ * \f[ u_m = \frac{1}{N} \tilde{K}(\nu_m) (x_0 y_0)^{-i \eta_m} \f]
+ *
+ * with \f$ \nu_m = q + i \eta_m \f$, \f$ \eta_m = 2\pi m/(N\Delta)
+ * \f$, and \f$ \tilde{K} \f$ the Mellin transform of K.
+ *
+ * As for the Hankel transforms, \f$ x^{-q} f(x) \f$ is assumed to be
+ * periodic in \f$ \ln x \f$: the periodic images of the input
+ * function are multiplied by \f$ e^{\pm q N \Delta} \f$, so q should
+ * be chosen such that they are suppressed by the kernels, and the
+ * input should be padded with zeros.
+ *
+ * @param N             Input: number of points (a power of two)
+ * @param kernel_num    Input: number of kernels
+ * @param q             Input: power-law bias, in the strip of convergence of all \f$ \tilde{K} \f$
+ * @param dlnx          Input: logarithmic step of both grids
+ * @param x0            Input: first point of the input grid
+ * @param y0            Input: first point of the output grid
+ * @param lnmellin      Input: function returning the real and imaginary parts of \f$ \ln \tilde{K}(s) \f$ for s = re + i im and a given index of kernel
+ * @param parameters    Input: parameters passed to lnmellin
+ * @param pfmp          Output: plan, to be freed with fft_mellin_plan_free()
+ * @param error_message Output: error message
+ * @return the error status
+ */
+
+int fft_mellin_plan_init(
+                         int N,
+                         int kernel_num,
+                         double q,
+                         double dlnx,
+                         double x0,
+                         double y0,
+                         void (*lnmellin)(double re, double im, int index_kernel, void * parameters, double * lnre, double * lnim),
+                         void * parameters,
+                         struct fft_mellin_plan * pfmp,
+                         ErrorMsg error_message
+                         ) {
+
+  int m,mm,index_kernel;
+  double eta,lnre,lnim;
+  double * kernel;
+
+  class_test((N < 2) || ((N & (N-1)) != 0),
+             error_message,
+             "the number of points N=%d should be a power of two",N);
+
+  pfmp->N = N;
+  pfmp->kernel_num = kernel_num;
+  pfmp->q = q;
+  pfmp->dlnx = dlnx;
+  pfmp->x0 = x0;
+  pfmp->y0 = y0;
+
+  class_alloc(pfmp->kernel,2*N*kernel_num*sizeof(double),error_message);
+  class_alloc(pfmp->twiddle,N*sizeof(double),error_message);
+
+  for (m=0; m<N/2; m++) {
+    pfmp->twiddle[2*m] = cos(_TWOPI_*m/N);
+    pfmp->twiddle[2*m+1] = -sin(_TWOPI_*m/N);
+  }
+
+  for (index_kernel=0; index_kernel<kernel_num; index_kernel++) {
+
+    kernel = pfmp->kernel+2*N*index_kernel;
+
+    /** - kernel for 0 <= m <= N/2, and by symmetry \f$ u_{N-m} = u_m^*
+        \f$ above, for real kernels */
+    for (m=0; m<=N/2; m++) {
+
+      eta = _TWOPI_*m/(N*dlnx);
+
+      lnmellin(q,eta,index_kernel,parameters,&lnre,&lnim);
+
+      lnre -= log((double)N);
+      lnim -= eta*log(x0*y0);
+
+      kernel[2*m] = exp(lnre)*cos(lnim);
+      kernel[2*m+1] = exp(lnre)*sin(lnim);
+    }
+
+    /* the Nyquist frequency contributes as the average of +N/2 and -N/2 */
+    kernel[N+1] = 0.;
+
+    for (m=N/2+1; m<N; m++) {
+      mm = N-m;
+      kernel[2*m] = kernel[2*mm];
+      kernel[2*m+1] = -kernel[2*mm+1];
+    }
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Free the arrays of a plan prepared by fft_mellin_plan_init().
+ *
+ * @param pfmp Input: plan
+ * @return the error status
+ */
+
+int fft_mellin_plan_free(
+                         struct fft_mellin_plan * pfmp
+                         ) {
+
+  free(pfmp->kernel);
+  free(pfmp->twiddle);
+
+  return _SUCCESS_;
+}
+
+/**
+ * Logarithmic convolutions of a real function with all the kernels of
+ * a plan. The expansion in power laws is done once. Since the
+ * convolutions are real, those with two kernels are summed at the
+ * cost of one, as the real and imaginary parts of the same complex
+ * array.
+ *
+ * @param pfmp          Input: plan prepared by fft_mellin_plan_init()
+ * @param f             Input: function, f[i] = \f$ f(x_i) \f$
+ * @param g             Output: convolutions, g[index_kernel*N+j] = \f$ g(y_j) \f$ for each kernel
+ * @param work          Input: workspace of 4*N doubles
+ * @param error_message Output: error message
+ * @return the error status
+ */
+
+int fft_mellin(
+               struct fft_mellin_plan * pfmp,
+               double * f,
+               double * g,
+               double * work,
+               ErrorMsg error_message
+               ) {
+
+  int N,i,m,index_kernel;
+  double ym;
+  double * coef;
+  double * sum;
+  double * kernel1;
+  double * kernel2;
+
+  N = pfmp->N;
+  coef = work;
+  sum = work+2*N;
+
+  /** - multiply the input by \f$ x^{-q} \f$, and expand in power laws */
+  for (i=0; i<N; i++) {
+    coef[2*i] = exp(-pfmp->q*(log(pfmp->x0)+i*pfmp->dlnx))*f[i];
+    coef[2*i+1] = 0.;
+  }
+
+  class_call(fft_complex(coef,N,pfmp->twiddle,error_message),
+             error_message,
+             error_message);
+
+  /** - for each pair of kernels, transform each power law, and sum the
+      transforms: the result is \f$ y^q g_1 + i y^q g_2 \f$ */
+  for (index_kernel=0; index_kernel<pfmp->kernel_num; index_kernel+=2) {
+
+    kernel1 = pfmp->kernel+2*N*index_kernel;
+    kernel2 = (index_kernel+1 < pfmp->kernel_num) ? kernel1+2*N : NULL;
+
+    for (m=0; m<N; m++) {
+      sum[2*m] = coef[2*m]*kernel1[2*m]-coef[2*m+1]*kernel1[2*m+1];
+      sum[2*m+1] = coef[2*m]*kernel1[2*m+1]+coef[2*m+1]*kernel1[2*m];
+      if (kernel2 != NULL) {
+        sum[2*m] -= coef[2*m]*kernel2[2*m+1]+coef[2*m+1]*kernel2[2*m];
+        sum[2*m+1] += coef[2*m]*kernel2[2*m]-coef[2*m+1]*kernel2[2*m+1];
+      }
+    }
+
+    class_call(fft_complex(sum,N,pfmp->twiddle,error_message),
+               error_message,
+               error_message);
+
+    /** - multiply by \f$ y^{-q} \f$ */
+    for (i=0; i<N; i++) {
+      ym = exp(-pfmp->q*(log(pfmp->y0)+i*pfmp->dlnx));
+      g[index_kernel*N+i] = ym*sum[2*i];
+      if (kernel2 != NULL)
+        g[(index_kernel+1)*N+i] = ym*sum[2*i+1];
+    }
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Logarithm of the Gamma function of a complex number of positive
+ * real part: the argument is shifted to large values with the
+ * recurrence \f$ \Gamma(z+1) = z \Gamma(z) \f$, where the Stirling
+ * series is accurate to machine precision. The imaginary part of the
+ * result is only defined modulo \f$ 2\pi \f$.
+ *
+ * @param re    Input: real part of z
+ * @param im    Input: imaginary part of z
+ * @param lnre  Output: real part of \f$ \ln \Gamma(z) \f$
+ * @param lnim  Output: imaginary part of \f$ \ln \Gamma(z) \f$
+ */
+
+void fft_lngamma(
+                 double re,
+                 double im,
+                 double * lnre,
+                 double * lnim
+                 ) {
+
+  double shift_re=0.,shift_im=0.;
+  double mod2,lnz_re,lnz_im,inv_re,inv_im,inv2_re,inv2_im,ser_re,ser_im,tmp;
+  const double coef[5] = {1./12.,-1./360.,1./1260.,-1./1680.,1./1188.};
+  int k;
+
+  /** - \f$ \ln\Gamma(z) = \ln\Gamma(z+K) - \sum_{k<K} \ln(z+k) \f$ */
+  while (re*re+im*im < 100.) {
+    shift_re += 0.5*log(re*re+im*im);
+    shift_im += atan2(im,re);
+    re += 1.;
+  }
+
+  /** - Stirling series for \f$ \ln\Gamma(z+K) \f$ */
+  lnz_re = 0.5*log(re*re+im*im);
+  lnz_im = atan2(im,re);
+
+  mod2 = re*re+im*im;
+  inv_re = re/mod2;
+  inv_im = -im/mod2;
+  inv2_re = inv_re*inv_re-inv_im*inv_im;
+  inv2_im = 2.*inv_re*inv_im;
+
+  /* Horner scheme in 1/z^2, then multiplication by 1/z */
+  ser_re = coef[4];
+  ser_im = 0.;
+  for (k=3; k>=0; k--) {
+    tmp = ser_re*inv2_re-ser_im*inv2_im+coef[k];
+    ser_im = ser_re*inv2_im+ser_im*inv2_re;
+    ser_re = tmp;
+  }
+  tmp = ser_re*inv_re-ser_im*inv_im;
+  ser_im = ser_re*inv_im+ser_im*inv_re;
+  ser_re = tmp;
+
+  *lnre = (re-0.5)*lnz_re-im*lnz_im-re+0.5*log(_TWOPI_)+ser_re-shift_re;
+  *lnim = (re-0.5)*lnz_im+im*lnz_re-im+ser_im-shift_im;
+}
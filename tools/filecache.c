@@ -0,0 +1,274 @@
+/******************************************/
+/* Process-wide cache of numerical tables */
+/* read from data files                   */
+/******************************************/
+
+/**
+ * The data files of CLASS (HyRec rate tables, BBN helium table, ...)
+ * do not depend on the model, but used to be parsed again for each
+ * model. filecache_acquire() parses each file once per process, and
+ * returns a pointer to a read-only array of the numbers it contains,
+ * which can be shared by all the CLASS runs of the process, including
+ * runs in concurrent threads. Each user must call filecache_release()
+ * when it does not need the array anymore. Released entries are kept
+ * for the next user (so that loops over models parse each file only
+ * once), until filecache_clear() is called. If a file changes on disk,
+ * it is read again, and the old entry is freed when its last user
+ * releases it.
+ */
+
+#include "filecache.h"
+
+#define _FILECACHE_LINE_MAX_ 1024 /**< maximum length of a line in a data file */
+
+/** first entry of the process-wide cache (accessed within the critical section filecache only) */
+static struct filecache_entry * filecache_first = NULL;
+
+static int filecache_acquire_locked(char * filename,
+                                    struct stat * pst,
+                                    double ** numbers,
+                                    int * size,
+                                    ErrorMsg errmsg);
+
+static void filecache_free_entry(struct filecache_entry * pentry);
+
+/**
+ * Get the numbers contained in a data file, from the cache if the
+ * file has already been read and did not change since.
+ *
+ * @param filename Input: name of the file
+ * @param numbers  Output: pointer to the (read-only) array of numbers, until filecache_release()
+ * @param size     Output: number of elements of this array
+ * @param errmsg   Output: error message
+ * @return the error status
+ */
+
+int filecache_acquire(char * filename,
+                      double ** numbers,
+                      int * size,
+                      ErrorMsg errmsg) {
+
+  struct stat st;
+  int status;
+
+  class_test(stat(filename,&st) != 0,
+             errmsg,
+             "could not open %s",filename);
+
+  class_test(strlen(filename) >= _FILENAMESIZE_,
+             errmsg,
+             "file name %s is too long for the file cache",filename);
+
+#pragma omp critical (filecache)
+  {
+    status = filecache_acquire_locked(filename,&st,numbers,size,errmsg);
+  }
+
+  return status;
+}
+
+/**
+ * Find or create the cache entry of a file (called within the
+ * critical section filecache).
+ *
+ * @param filename Input: name of the file
+ * @param pst      Input: status of the file (modification time and size)
+ * @param numbers  Output: pointer to the array of numbers
+ * @param size     Output: number of elements of this array
+ * @param errmsg   Output: error message
+ * @return the error status
+ */
+
+static int filecache_acquire_locked(char * filename,
+                                    struct stat * pst,
+                                    double ** numbers,
+                                    int * size,
+                                    ErrorMsg errmsg) {
+
+  struct filecache_entry * pentry;
+  struct filecache_entry ** pprevious;
+
+  /** - look for a valid entry, and mark the entries of this file as
+        stale if it changed on disk */
+  pprevious = &filecache_first;
+  while (*pprevious != NULL) {
+    pentry = *pprevious;
+    if ((pentry->stale == _FALSE_) && (strcmp(pentry->filename,filename) == 0)) {
+      if ((pentry->mtime == pst->st_mtime) && (pentry->file_size == pst->st_size)) {
+        pentry->references++;
+        *numbers = pentry->numbers;
+        *size = pentry->size;
+        return _SUCCESS_;
+      }
+      pentry->stale = _TRUE_;
+      if (pentry->references == 0) {
+        *pprevious = pentry->next;
+        filecache_free_entry(pentry);
+        continue;
+      }
+    }
+    pprevious = &(pentry->next);
+  }
+
+  /** - otherwise read the file and add an entry */
+  class_alloc(pentry,sizeof(struct filecache_entry),errmsg);
+
+  class_call_except(filecache_read_file(filename,&(pentry->numbers),&(pentry->size),errmsg),
+                    errmsg,
+                    errmsg,
+                    free(pentry));
+
+  strcpy(pentry->filename,filename);
+  pentry->mtime = pst->st_mtime;
+  pentry->file_size = pst->st_size;
+  pentry->references = 1;
+  pentry->stale = _FALSE_;
+  pentry->next = filecache_first;
+  filecache_first = pentry;
+
+  *numbers = pentry->numbers;
+  *size = pentry->size;
+
+  return _SUCCESS_;
+}
+
+/**
+ * Release an array obtained with filecache_acquire().
+ *
+ * @param numbers Input: the array
+ * @return the error status (_FAILURE_ if the array does not belong to the cache)
+ */
+
+int filecache_release(double * numbers) {
+
+  struct filecache_entry * pentry;
+  struct filecache_entry ** pprevious;
+  int status = _FAILURE_;
+
+#pragma omp critical (filecache)
+  {
+    pprevious = &filecache_first;
+    while (*pprevious != NULL) {
+      pentry = *pprevious;
+      if ((pentry->numbers == numbers) && (pentry->references > 0)) {
+        pentry->references--;
+        if ((pentry->stale == _TRUE_) && (pentry->references == 0)) {
+          *pprevious = pentry->next;
+          filecache_free_entry(pentry);
+        }
+        status = _SUCCESS_;
+        break;
+      }
+      pprevious = &(pentry->next);
+    }
+  }
+
+  return status;
+}
+
+/**
+ * Free all the entries of the cache which are not in use.
+ *
+ * @return the error status
+ */
+
+int filecache_clear() {
+
+  struct filecache_entry * pentry;
+  struct filecache_entry ** pprevious;
+
+#pragma omp critical (filecache)
+  {
+    pprevious = &filecache_first;
+    while (*pprevious != NULL) {
+      pentry = *pprevious;
+      if (pentry->references == 0) {
+        *pprevious = pentry->next;
+        filecache_free_entry(pentry);
+      }
+      else {
+        pprevious = &(pentry->next);
+      }
+    }
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Free one entry of the cache.
+ *
+ * @param pentry Input: the entry
+ */
+
+static void filecache_free_entry(struct filecache_entry * pentry) {
+
+  free(pentry->numbers);
+  free(pentry);
+}
+
+/**
+ * Read all the numbers contained in the data lines of a file, without
+ * any caching. Lines whose first non-blank character cannot start a
+ * number (blank lines, lines starting with #, %, ...) are comments.
+ *
+ * @param filename Input: name of the file
+ * @param numbers  Output: newly allocated array of numbers
+ * @param size     Output: number of elements of this array
+ * @param errmsg   Output: error message
+ * @return the error status
+ */
+
+int filecache_read_file(char * filename,
+                        double ** numbers,
+                        int * size,
+                        ErrorMsg errmsg) {
+
+  FILE * file;
+  char line[_FILECACHE_LINE_MAX_];
+  char * left;
+  char * end;
+  double value;
+  int size_max;
+
+  class_open(file,filename,"r",errmsg);
+
+  size_max = 1024;
+  *size = 0;
+  class_alloc(*numbers,size_max*sizeof(double),errmsg);
+
+  /* go through each line */
+  while (fgets(line,_FILECACHE_LINE_MAX_-1,file) != NULL) {
+
+    /* eliminate blank spaces at beginning of line */
+    left = line;
+    while ((left[0] == ' ') || (left[0] == '\t')) {
+      left++;
+    }
+
+    /* as in the previous readers of these files: in ASCII,
+       left[0]>39 means that the line might contain data */
+    if (left[0] <= 39)
+      continue;
+
+    for (;;) {
+      value = strtod(left,&end);
+      if (end == left)
+        break;
+      if (*size == size_max) {
+        size_max *= 2;
+        *numbers = realloc(*numbers,size_max*sizeof(double));
+        class_test(*numbers == NULL,
+                   errmsg,
+                   "could not reallocate the numbers of %s",filename);
+      }
+      (*numbers)[*size] = value;
+      (*size)++;
+      left = end;
+    }
+  }
+
+  fclose(file);
+
+  return _SUCCESS_;
+}
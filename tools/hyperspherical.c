@@ -29,7 +29,8 @@ int hyperspherical_HIS_create(int K,
   double *sqrtK, *one_over_sqrtK,*PhiL;
   int j, k, l, nx, lmax, l_recurrence_max;
   int abort;
-  int current_chunk, index_x;
+  int current_chunk, index_x, l_zero;
+  struct parallel_timer timer;
 
   beta2 = beta*beta;
   lmax = lvec[nl-1];
@@ -134,13 +135,16 @@ int hyperspherical_HIS_create(int K,
 
   abort = _FALSE_;
 
+  parallel_timer_start(&timer);
+
 #pragma omp parallel                                                    \
-  shared(nx,pHIS,xfwd,K,l_recurrence_max,beta,sqrtK,one_over_sqrtK,lvec,nl,xfwdidx,abort,error_message) \
-  private(j,PhiL,k,l,current_chunk,index_x)                           \
+  shared(nx,pHIS,xfwd,K,l_recurrence_max,beta,sqrtK,one_over_sqrtK,lvec,nl,xfwdidx,abort,error_message,timer) \
+  private(j,PhiL,k,l,current_chunk,index_x,l_zero)                      \
   firstprivate(lmax)
   {
     class_alloc_parallel(PhiL,(lmax+2)*sizeof(double)*_HYPER_CHUNK_,error_message);
 
+    l_zero = -1;
     if ((K == 1) && ((int)(beta+0.2) == (lmax+1))) {
       /** Take care of special case lmax = beta-1.
           The routine below will try to compute
@@ -148,35 +152,19 @@ int hyperspherical_HIS_create(int K,
           the purpose is to calculate the derivative
           Phi'_{lmax}, and the formula is correct if we set Phi_{lmax+1} = 0.
       */
-      PhiL[lmax+1] = 0.0;
+      l_zero = lmax+1;
       lmax--;
     }
 
-#pragma omp for schedule (dynamic)              \
+    /** Both recurrences work on chunks of _HYPER_CHUNK_ values of x
+        advanced in lockstep, PhiL[l*current_chunk+index_x] containing
+        Phi_l at x[j+index_x]. Each thread takes whole chunks. */
 
+#pragma omp for schedule (dynamic)
 
-    for (j=0; j<MIN(nx,xfwdidx); j++){
+    for (j=0; j<MIN(nx,xfwdidx); j+=_HYPER_CHUNK_){
       //Use backwards method:
-      hyperspherical_backwards_recurrence(K,
-                                          MIN(l_recurrence_max,lmax)+1,
-                                          beta,
-                                          pHIS->x[j],
-                                          pHIS->sinK[j],
-                                          pHIS->cotK[j],
-                                          sqrtK,
-                                          one_over_sqrtK,
-                                          PhiL);
-      //We have now populated PhiL at x, assign Phi and dPhi for all l in lvec:
-      for (k=0; k<=index_recurrence_max; k++){
-        l = lvec[k];
-        pHIS->phi[k*nx+j] = PhiL[l];
-        pHIS->dphi[k*nx+j] = l*pHIS->cotK[j]*PhiL[l]-sqrtK[l+1]*PhiL[l+1];
-      }
-    }
-    /**
-    for (j=0; j<MIN(nx,xfwdidx); j+= _HYPER_CHUNK_){
       current_chunk = MIN(_HYPER_CHUNK_,MIN(nx,xfwdidx)-j);
-      //Use backwards method:
       hyperspherical_backwards_recurrence_chunk(K,
                                                 MIN(l_recurrence_max,lmax)+1,
                                                 beta,
@@ -187,23 +175,17 @@ int hyperspherical_HIS_create(int K,
                                                 sqrtK,
                                                 one_over_sqrtK,
                                                 PhiL);
+      if (l_zero >= 0)
+        for (index_x=0; index_x<current_chunk; index_x++)
+          PhiL[l_zero*current_chunk+index_x] = 0.0;
+
       //We have now populated PhiL at x, assign Phi and dPhi for all l in lvec:
-      for (k=0; k<=index_recurrence_max; k++){
-        l = lvec[k];
-        for (index_x=0; index_x<current_chunk; index_x++){
-          pHIS->phi[k*nx+j+index_x] = PhiL[l*current_chunk+index_x];
-          pHIS->dphi[k*nx+j+index_x] = l*pHIS->cotK[j+index_x]*
-            PhiL[l*current_chunk+index_x]-
-            sqrtK[l+1]*PhiL[(l+1)*current_chunk+index_x];
-        }
-      }
+      hyperspherical_HIS_assign_chunk(pHIS,lvec,index_recurrence_max,j,current_chunk,sqrtK,PhiL);
     }
 
-    */
-
-#pragma omp for schedule (dynamic)              \
+#pragma omp for schedule (dynamic) nowait
 
-    for (j=xfwdidx; j<nx; j+=_HYPER_CHUNK_){
+    for (j=MAX(xfwdidx,0); j<nx; j+=_HYPER_CHUNK_){
       //Use forwards method:
       current_chunk = MIN(_HYPER_CHUNK_,nx-j);
       hyperspherical_forwards_recurrence_chunk(K,
@@ -216,20 +198,20 @@ int hyperspherical_HIS_create(int K,
                                                sqrtK,
                                                one_over_sqrtK,
                                                PhiL);
+      if (l_zero >= 0)
+        for (index_x=0; index_x<current_chunk; index_x++)
+          PhiL[l_zero*current_chunk+index_x] = 0.0;
 
       //We have now populated PhiL at x, assign Phi and dPhi for all l in lvec:
-      for (k=0; k<=index_recurrence_max; k++){
-        l = lvec[k];
-        for (index_x=0; index_x<current_chunk; index_x++){
-          pHIS->phi[k*nx+j+index_x] = PhiL[l*current_chunk+index_x];
-          pHIS->dphi[k*nx+j+index_x] = l*pHIS->cotK[j+index_x]*
-            PhiL[l*current_chunk+index_x]-
-            sqrtK[l+1]*PhiL[(l+1)*current_chunk+index_x];
-        }
-      }
+      hyperspherical_HIS_assign_chunk(pHIS,lvec,index_recurrence_max,j,current_chunk,sqrtK,PhiL);
     }
     free(PhiL);
+
+    parallel_timer_thread_done(&timer);
   }
+
+  parallel_timer_stop(&timer,"hyperspherical_HIS_create");
+
   if (abort == _TRUE_) return _FAILURE_;
 
   free(sqrtK);
@@ -244,6 +226,36 @@ int hyperspherical_HIS_create(int K,
   return _SUCCESS_;
 }
 
+/**
+ * Copy Phi_l and compute dPhi_l for all l in lvec (up to
+ * index_recurrence_max) from the output PhiL of one of the chunked
+ * recurrences, for the chunk of x values starting at index_x_start.
+ */
+int hyperspherical_HIS_assign_chunk(HyperInterpStruct *pHIS,
+                                    int *lvec,
+                                    int index_recurrence_max,
+                                    int index_x_start,
+                                    int chunk,
+                                    double * __restrict__ sqrtK,
+                                    double * __restrict__ PhiL){
+  int k, l, index_x;
+  int nx = pHIS->x_size;
+  double * __restrict__ cotK = pHIS->cotK+index_x_start;
+
+  for (k=0; k<=index_recurrence_max; k++){
+    l = lvec[k];
+    double * __restrict__ phi = pHIS->phi+k*nx+index_x_start;
+    double * __restrict__ dphi = pHIS->dphi+k*nx+index_x_start;
+    const double * __restrict__ phi_l = PhiL+l*chunk;
+    const double * __restrict__ phi_l1 = PhiL+(l+1)*chunk;
+    for (index_x=0; index_x<chunk; index_x++){
+      phi[index_x] = phi_l[index_x];
+      dphi[index_x] = l*cotK[index_x]*phi_l[index_x]-sqrtK[l+1]*phi_l1[index_x];
+    }
+  }
+  return _SUCCESS_;
+}
+
 size_t hyperspherical_HIS_size(int nl, int nx){
   return(sizeof(int)*nl+sizeof(double)*nl+3*sizeof(double)*nx+2*sizeof(double)*nx*nl);
 }
@@ -280,6 +292,520 @@ int hyperspherical_HIS_free(HyperInterpStruct *pHIS,
   return _SUCCESS_;
 }
 
+/**
+ * Same as hyperspherical_HIS_create(), but the structure is stored in,
+ * and when possible read from, a file in cache_directory. This is
+ * meant for the flat-space table of spherical Bessel functions, which
+ * depends only on the list of multipoles, the x range and precision
+ * parameters, and is hence the same for many runs.
+ *
+ * The file name is built from a hash of all the arguments (see
+ * hyperspherical_HIS_cache_key()). A file with the right header and
+ * size is mapped in memory read-only, and the arrays of pHIS point
+ * inside the map, so that several processes computing at the same
+ * time share one physical copy. In that case *map is set to the
+ * address of the map, and the structure must be released with
+ * hyperspherical_HIS_free_cached(). If cache_directory is NULL or
+ * empty, or if the file is missing or does not match, the structure is
+ * computed (and then stored, failing to write the file not being an
+ * error), and *map is set to NULL.
+ *
+ * Arguments are those of hyperspherical_HIS_create(), plus:
+ *
+ * @param cache_directory Input: directory of the cache files, or empty string
+ * @param map             Output: address of the map, or NULL if the structure was allocated
+ * @param map_size        Output: size of the map
+ */
+
+int hyperspherical_HIS_create_cached(int K,
+                                     double beta,
+                                     int nl,
+                                     int *lvec,
+                                     double xmin,
+                                     double xmax,
+                                     double sampling,
+                                     int l_WKB,
+                                     double phiminabs,
+                                     HyperInterpStruct *pHIS,
+                                     char * cache_directory,
+                                     void ** map,
+                                     size_t * map_size,
+                                     ErrorMsg error_message){
+
+  unsigned long long key;
+  FileName filename, tmpname;
+  FILE * cachefile;
+  struct stat st;
+  long long header[_HIS_CACHE_HEADER_SIZE_];
+  double * values;
+  size_t size,written,expected;
+  int nx,status;
+
+  *map = NULL;
+  *map_size = 0;
+
+  if ((cache_directory == NULL) || (cache_directory[0] == '\0'))
+    return hyperspherical_HIS_create(K,beta,nl,lvec,xmin,xmax,sampling,l_WKB,phiminabs,pHIS,error_message);
+
+  class_call(hyperspherical_HIS_cache_key(K,beta,nl,lvec,xmin,xmax,sampling,l_WKB,phiminabs,&key,error_message),
+             error_message,
+             error_message);
+
+  sprintf(filename,"%s/bessel_%016llx.dat",cache_directory,key);
+
+  /** - try to map the cache file: header, then the arrays of
+        doubles, then the list of multipoles */
+  cachefile = fopen(filename,"rb");
+  if (cachefile != NULL) {
+    if ((fread(header,sizeof(long long),_HIS_CACHE_HEADER_SIZE_,cachefile) == _HIS_CACHE_HEADER_SIZE_) &&
+        (header[0] == _HIS_CACHE_FORMAT_) &&
+        ((unsigned long long)header[1] == key) &&
+        (header[2] == K) &&
+        (header[3] == nl) &&
+        (header[4] > 1)) {
+
+      nx = (int)header[4];
+      size = _HIS_CACHE_HEADER_SIZE_*sizeof(long long)+(nl+3*nx+2*nx*nl)*sizeof(double)+nl*sizeof(int);
+
+      if ((fstat(fileno(cachefile),&st) == 0) && ((size_t)st.st_size == size)) {
+        *map = mmap(NULL,size,PROT_READ,MAP_PRIVATE,fileno(cachefile),0);
+        if (*map == MAP_FAILED) {
+          *map = NULL;
+        }
+        else {
+          values = (double *)((long long *)(*map)+_HIS_CACHE_HEADER_SIZE_);
+          pHIS->K = K;
+          pHIS->l_size = nl;
+          pHIS->x_size = nx;
+          pHIS->trig_order = (int)header[5];
+          memcpy(&(pHIS->beta),&(header[6]),sizeof(double));
+          memcpy(&(pHIS->delta_x),&(header[7]),sizeof(double));
+          pHIS->chi_at_phimin = values;
+          pHIS->x = pHIS->chi_at_phimin+nl;
+          pHIS->sinK = pHIS->x+nx;
+          pHIS->cotK = pHIS->sinK+nx;
+          pHIS->phi = pHIS->cotK+nx;
+          pHIS->dphi = pHIS->phi+nx*nl;
+          pHIS->l = (int *)(pHIS->dphi+nx*nl);
+
+          /* the hash could in principle collide: check the multipoles */
+          if (memcmp(pHIS->l,lvec,nl*sizeof(int)) != 0) {
+            munmap(*map,size);
+            *map = NULL;
+          }
+          else {
+            *map_size = size;
+          }
+        }
+      }
+    }
+    fclose(cachefile);
+  }
+
+  if (*map != NULL)
+    return _SUCCESS_;
+
+  /** - otherwise compute the structure, and store it. The file is
+        written under a temporary name (unique to the process) and then
+        renamed, so that concurrent runs never read a partially written
+        file. */
+  class_call(hyperspherical_HIS_create(K,beta,nl,lvec,xmin,xmax,sampling,l_WKB,phiminabs,pHIS,error_message),
+             error_message,
+             error_message);
+
+  nx = pHIS->x_size;
+
+  header[0] = _HIS_CACHE_FORMAT_;
+  header[1] = (long long)key;
+  header[2] = K;
+  header[3] = nl;
+  header[4] = nx;
+  header[5] = pHIS->trig_order;
+  memcpy(&(header[6]),&(pHIS->beta),sizeof(double));
+  memcpy(&(header[7]),&(pHIS->delta_x),sizeof(double));
+
+  class_temporary_file_name(filename,tmpname);
+  cachefile = fopen(tmpname,"wb");
+  if (cachefile != NULL) {
+    written = fwrite(header,sizeof(long long),_HIS_CACHE_HEADER_SIZE_,cachefile);
+    written += fwrite(pHIS->chi_at_phimin,sizeof(double),nl,cachefile);
+    written += fwrite(pHIS->x,sizeof(double),nx,cachefile);
+    written += fwrite(pHIS->sinK,sizeof(double),nx,cachefile);
+    written += fwrite(pHIS->cotK,sizeof(double),nx,cachefile);
+    written += fwrite(pHIS->phi,sizeof(double),nx*nl,cachefile);
+    written += fwrite(pHIS->dphi,sizeof(double),nx*nl,cachefile);
+    written += fwrite(pHIS->l,sizeof(int),nl,cachefile);
+    expected = _HIS_CACHE_HEADER_SIZE_+nl+3*nx+2*nx*nl+nl;
+    status = fclose(cachefile);
+    if ((status != 0) || (written != expected) || (rename(tmpname,filename) != 0))
+      remove(tmpname);
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Hash (64-bit FNV-1a) of the arguments of hyperspherical_HIS_create(),
+ * which determine the resulting structure.
+ *
+ * Arguments are those of hyperspherical_HIS_create(), plus:
+ *
+ * @param key    Output: hash
+ */
+
+int hyperspherical_HIS_cache_key(int K,
+                                 double beta,
+                                 int nl,
+                                 int *lvec,
+                                 double xmin,
+                                 double xmax,
+                                 double sampling,
+                                 int l_WKB,
+                                 double phiminabs,
+                                 unsigned long long * key,
+                                 ErrorMsg error_message){
+
+  unsigned long long hash = 14695981039346656037ULL;
+  int format = _HIS_CACHE_FORMAT_;
+  int j;
+
+  /* a small macro, to hash the bytes of any variable */
+#define _HIS_HASH_(var) do {                                    \
+    unsigned char * bytes = (unsigned char *)&(var);            \
+    size_t ib;                                                  \
+    for (ib=0; ib<sizeof(var); ib++) {                          \
+      hash ^= bytes[ib];                                        \
+      hash *= 1099511628211ULL;                                 \
+    }                                                           \
+  } while(0)
+
+  _HIS_HASH_(format);
+  _HIS_HASH_(K);
+  _HIS_HASH_(beta);
+  _HIS_HASH_(nl);
+  for (j=0; j<nl; j++)
+    _HIS_HASH_(lvec[j]);
+  _HIS_HASH_(xmin);
+  _HIS_HASH_(xmax);
+  _HIS_HASH_(sampling);
+  _HIS_HASH_(l_WKB);
+  _HIS_HASH_(phiminabs);
+
+#undef _HIS_HASH_
+
+  *key = hash;
+
+  return _SUCCESS_;
+}
+
+/**
+ * Free a structure returned by hyperspherical_HIS_create_cached():
+ * unmap the file if it was read from the cache, free the arrays
+ * otherwise.
+ *
+ * @param pHIS          Input: structure
+ * @param map           Input: address of the map, or NULL
+ * @param map_size      Input: size of the map
+ * @param error_message Output: error message
+ */
+
+int hyperspherical_HIS_free_cached(HyperInterpStruct *pHIS,
+                                   void * map,
+                                   size_t map_size,
+                                   ErrorMsg error_message){
+
+  if (map != NULL) {
+    class_test(munmap(map,map_size) != 0,
+               error_message,
+               "could not unmap the cached Bessel interpolation structure");
+  }
+  else {
+    class_call(hyperspherical_HIS_free(pHIS,error_message),
+               error_message,
+               error_message);
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Copy a Hyperspherical Interpolation Structure into a newly
+ * allocated one (to be freed with hyperspherical_HIS_free()).
+ *
+ * @param pHIS_in       Input: structure to copy
+ * @param pHIS_out      Output: copy
+ * @param error_message Output: error message
+ */
+
+int hyperspherical_HIS_copy(HyperInterpStruct *pHIS_in,
+                            HyperInterpStruct *pHIS_out,
+                            ErrorMsg error_message){
+
+  int nl = pHIS_in->l_size;
+  int nx = pHIS_in->x_size;
+
+  *pHIS_out = *pHIS_in;
+
+  class_alloc(pHIS_out->l, sizeof(int)*nl,error_message);
+  class_alloc(pHIS_out->chi_at_phimin,sizeof(double)*nl,error_message);
+  class_alloc(pHIS_out->x,sizeof(double)*nx,error_message);
+  class_alloc(pHIS_out->sinK,sizeof(double)*nx,error_message);
+  class_alloc(pHIS_out->cotK,sizeof(double)*nx,error_message);
+  class_alloc(pHIS_out->phi,sizeof(double)*nx*nl,error_message);
+  class_alloc(pHIS_out->dphi,sizeof(double)*nx*nl,error_message);
+
+  memcpy(pHIS_out->l,pHIS_in->l,sizeof(int)*nl);
+  memcpy(pHIS_out->chi_at_phimin,pHIS_in->chi_at_phimin,sizeof(double)*nl);
+  memcpy(pHIS_out->x,pHIS_in->x,sizeof(double)*nx);
+  memcpy(pHIS_out->sinK,pHIS_in->sinK,sizeof(double)*nx);
+  memcpy(pHIS_out->cotK,pHIS_in->cotK,sizeof(double)*nx);
+  memcpy(pHIS_out->phi,pHIS_in->phi,sizeof(double)*nx*nl);
+  memcpy(pHIS_out->dphi,pHIS_in->dphi,sizeof(double)*nx*nl);
+
+  return _SUCCESS_;
+}
+
+/**
+ * Values of Phi and its first three derivatives at the node i, computed
+ * as in hermite4_interpolation_csource.h. The squared cosecant is
+ * computed as cot^2+K (valid for K=0 and K=-1) to avoid divisions.
+ */
+
+static inline void hyperspherical_Hermite4_node(const double * __restrict__ Phi_l,
+                                                const double * __restrict__ dPhi_l,
+                                                const double * __restrict__ cotK,
+                                                int i,
+                                                double lxlp1,
+                                                double K,
+                                                double Kmbeta2,
+                                                const int do_d2,
+                                                const int do_d3,
+                                                double * __restrict__ y){
+
+  double cot,csc2;
+
+  y[0] = Phi_l[i];
+  y[1] = dPhi_l[i];
+
+  if (do_d2) {
+    cot = cotK[i];
+    csc2 = cot*cot+K;
+    y[2] = -2*y[1]*cot+y[0]*(lxlp1*csc2+Kmbeta2);
+    if (do_d3) {
+      y[3] = -2*cot*y[2]-2*y[0]*lxlp1*cot*csc2+y[1]*(Kmbeta2+(2+lxlp1)*csc2);
+    }
+  }
+}
+
+/**
+ * Coefficients of the cubic Hermite polynomials in z = (x-x_{i-1})/deltax
+ * giving Phi, dPhi and d2Phi in an interval, from the values ym and yp
+ * at its left and right nodes.
+ */
+
+static inline void hyperspherical_Hermite4_coefficients(const double * __restrict__ ym,
+                                                        const double * __restrict__ yp,
+                                                        double deltax,
+                                                        const int do_phi,
+                                                        const int do_dphi,
+                                                        const int do_d2phi,
+                                                        double * __restrict__ a){
+
+  if (do_phi) {
+    a[0] = ym[0];
+    a[1] = ym[1]*deltax;
+    a[2] = -2*ym[1]*deltax-yp[1]*deltax-3*ym[0]+3*yp[0];
+    a[3] = ym[1]*deltax+yp[1]*deltax+2*ym[0]-2*yp[0];
+  }
+
+  if (do_dphi) {
+    a[4] = ym[1];
+    a[5] = ym[2]*deltax;
+    a[6] = -2*ym[2]*deltax-yp[2]*deltax-3*ym[1]+3*yp[1];
+    a[7] = ym[2]*deltax+yp[2]*deltax+2*ym[1]-2*yp[1];
+  }
+
+  if (do_d2phi) {
+    a[8] = ym[2];
+    a[9] = ym[3]*deltax;
+    a[10] = -2*ym[3]*deltax-yp[3]*deltax-3*ym[2]+3*yp[2];
+    a[11] = ym[3]*deltax+yp[3]*deltax+2*ym[2]-2*yp[2];
+  }
+}
+
+/**
+ * Loop body of hyperspherical_Hermite4_convolution(). The flags are
+ * compile-time constants at each call site, so that each instance is a
+ * straight-line loop computing only the needed functions. As in
+ * hermite4_interpolation_csource.h, the coefficients of an interval are
+ * reused as long as consecutive points fall in it, and the values at a
+ * node shared by two consecutive intervals are computed once.
+ */
+
+static inline void hyperspherical_Hermite4_convolution_loop(HyperInterpStruct *pHIS,
+                                                            int nxi,
+                                                            int lnum,
+                                                            double * __restrict__ xinterp,
+                                                            double * __restrict__ f,
+                                                            double * __restrict__ w,
+                                                            double * __restrict__ cscK,
+                                                            double c_phi,
+                                                            double c_phi_csc2,
+                                                            double c_dphi,
+                                                            double c_d2phi,
+                                                            double *result,
+                                                            double *last_radial,
+                                                            const int do_phi,
+                                                            const int do_dphi,
+                                                            const int do_d2phi,
+                                                            const int do_csc){
+
+  const double * __restrict__ xvec = pHIS->x;
+  const double * __restrict__ cotK = pHIS->cotK;
+  const double * __restrict__ Phi_l = pHIS->phi+lnum*pHIS->x_size;
+  const double * __restrict__ dPhi_l = pHIS->dphi+lnum*pHIS->x_size;
+  const int nx = pHIS->x_size;
+  const double deltax = pHIS->delta_x;
+  const double one_over_deltax = 1./pHIS->delta_x;
+  const double xmin = xvec[0];
+  const double xmax = xvec[nx-1];
+  const double lxlp1 = pHIS->l[lnum]*(pHIS->l[lnum]+1.0);
+  const double K = pHIS->K;
+  const double Kmbeta2 = K-pHIS->beta*pHIS->beta;
+  const int do_d2 = (do_dphi || do_d2phi);
+  const int do_d3 = do_d2phi;
+  double sum=0.,radial=0.;
+  double a[12]={0.},ym[4]={0.},yp[4]={0.};
+  double left_border=xmax,right_border=xmin,x,z;
+  int j,idx,idx_current=-1;
+
+  for (j=0; j<nxi; j++){
+
+    x = xinterp[j];
+
+    /* outside the interpolation region, all functions vanish */
+    if ((x < xmin) || (x > xmax)) {
+      radial = 0.;
+      continue;
+    }
+
+    if ((x < left_border) || (x > right_border)) {
+
+      idx = (int)((x-xmin)*one_over_deltax)+1;
+      idx = MIN(nx-1,idx);
+
+      /* when moving to a neighbouring interval, one node is shared */
+      if (idx == idx_current-1) {
+        memcpy(yp,ym,4*sizeof(double));
+        hyperspherical_Hermite4_node(Phi_l,dPhi_l,cotK,idx-1,lxlp1,K,Kmbeta2,do_d2,do_d3,ym);
+      }
+      else if (idx == idx_current+1) {
+        memcpy(ym,yp,4*sizeof(double));
+        hyperspherical_Hermite4_node(Phi_l,dPhi_l,cotK,idx,lxlp1,K,Kmbeta2,do_d2,do_d3,yp);
+      }
+      else {
+        hyperspherical_Hermite4_node(Phi_l,dPhi_l,cotK,idx-1,lxlp1,K,Kmbeta2,do_d2,do_d3,ym);
+        hyperspherical_Hermite4_node(Phi_l,dPhi_l,cotK,idx,lxlp1,K,Kmbeta2,do_d2,do_d3,yp);
+      }
+
+      hyperspherical_Hermite4_coefficients(ym,yp,deltax,do_phi,do_dphi,do_d2phi,a);
+      idx_current = idx;
+      left_border = xvec[idx-1];
+      right_border = xvec[idx];
+    }
+
+    z = (x-left_border)*one_over_deltax;
+
+    radial = 0.;
+    if (do_phi)
+      radial += (do_csc ? c_phi+c_phi_csc2*cscK[j]*cscK[j] : c_phi)*(a[0]+z*(a[1]+z*(a[2]+z*a[3])));
+    if (do_dphi)
+      radial += c_dphi*(a[4]+z*(a[5]+z*(a[6]+z*a[7])));
+    if (do_d2phi)
+      radial += c_d2phi*(a[8]+z*(a[9]+z*(a[10]+z*a[11])));
+
+    sum += f[j]*w[j]*radial;
+  }
+
+  *result = sum;
+  *last_radial = radial;
+}
+
+/**
+ * Fused line-of-sight kernel: compute in a single pass the weighted sum
+ *
+ * \f$ I = \sum_j f_j w_j R(x_j) \f$, with
+ * \f$ R = (c_\Phi + c_{\Phi csc} \csc_j^2) \Phi_l(x_j) + c_{d\Phi} \Phi_l'(x_j) + c_{d^2\Phi} \Phi_l''(x_j) \f$,
+ *
+ * where Phi, dPhi and d2Phi are interpolated exactly as in
+ * hyperspherical_Hermite4_interpolation_vector_PhidPhid2Phi(), without
+ * storing them. This is the integral over time of a source function
+ * times a radial function, with trapezoidal weights w, of the
+ * transfer module. The points can be in increasing or decreasing
+ * order; the more sorted they are, the faster.
+ *
+ * Only for open and flat structures (K = -1 or 0).
+ *
+ * @param pHIS          Input: interpolation structure
+ * @param nxi           Input: number of points
+ * @param lnum          Input: index of the multipole in the structure
+ * @param xinterp       Input: points x_j
+ * @param f             Input: values f_j (the source function)
+ * @param w             Input: weights w_j
+ * @param cscK          Input: values csc_j (only used if c_phi_csc2 is non-zero)
+ * @param c_phi         Input: coefficient of Phi
+ * @param c_phi_csc2    Input: coefficient of Phi csc^2
+ * @param c_dphi        Input: coefficient of dPhi
+ * @param c_d2phi       Input: coefficient of d2Phi
+ * @param result        Output: the weighted sum I
+ * @param last_radial   Output: the value of R at the last point
+ * @param error_message Output: error message
+ * @return the error status
+ */
+
+int hyperspherical_Hermite4_convolution(HyperInterpStruct *pHIS,
+                                        int nxi,
+                                        int lnum,
+                                        double * __restrict__ xinterp,
+                                        double * __restrict__ f,
+                                        double * __restrict__ w,
+                                        double * __restrict__ cscK,
+                                        double c_phi,
+                                        double c_phi_csc2,
+                                        double c_dphi,
+                                        double c_d2phi,
+                                        double *result,
+                                        double *last_radial,
+                                        ErrorMsg error_message){
+
+  class_test(pHIS->K == 1,
+             error_message,
+             "the fused kernel does not handle closed models");
+
+  /** - dispatch to a loop body specialised for the functions actually
+      needed, so that the compiler sees no branch inside the loop */
+  if ((c_dphi == 0.) && (c_d2phi == 0.)) {
+    if (c_phi_csc2 != 0.)
+      hyperspherical_Hermite4_convolution_loop(pHIS,nxi,lnum,xinterp,f,w,cscK,c_phi,c_phi_csc2,c_dphi,c_d2phi,result,last_radial,_TRUE_,_FALSE_,_FALSE_,_TRUE_);
+    else
+      hyperspherical_Hermite4_convolution_loop(pHIS,nxi,lnum,xinterp,f,w,cscK,c_phi,c_phi_csc2,c_dphi,c_d2phi,result,last_radial,_TRUE_,_FALSE_,_FALSE_,_FALSE_);
+  }
+  else if ((c_phi == 0.) && (c_phi_csc2 == 0.) && (c_d2phi == 0.)) {
+    hyperspherical_Hermite4_convolution_loop(pHIS,nxi,lnum,xinterp,f,w,cscK,c_phi,c_phi_csc2,c_dphi,c_d2phi,result,last_radial,_FALSE_,_TRUE_,_FALSE_,_FALSE_);
+  }
+  else if ((c_dphi == 0.) && (c_phi_csc2 == 0.)) {
+    if (c_phi != 0.)
+      hyperspherical_Hermite4_convolution_loop(pHIS,nxi,lnum,xinterp,f,w,cscK,c_phi,c_phi_csc2,c_dphi,c_d2phi,result,last_radial,_TRUE_,_FALSE_,_TRUE_,_FALSE_);
+    else
+      hyperspherical_Hermite4_convolution_loop(pHIS,nxi,lnum,xinterp,f,w,cscK,c_phi,c_phi_csc2,c_dphi,c_d2phi,result,last_radial,_FALSE_,_FALSE_,_TRUE_,_FALSE_);
+  }
+  else {
+    hyperspherical_Hermite4_convolution_loop(pHIS,nxi,lnum,xinterp,f,w,cscK,c_phi,c_phi_csc2,c_dphi,c_d2phi,result,last_radial,_TRUE_,_TRUE_,_TRUE_,_TRUE_);
+  }
+
+  return _SUCCESS_;
+}
+
 int hyperspherical_Hermite_interpolation_vector(HyperInterpStruct *pHIS,
                                                 int nxi,
                                                 int lnum,
@@ -504,10 +1030,13 @@ int hyperspherical_forwards_recurrence_chunk(int K,
       (cotK[index_x]-beta/tan(beta*x[index_x]))*one_over_sqrtK[1];
   }
   for (l=2; l<=lmax; l++){
+    double * __restrict__ phi_l = PhiL+l*chunk;
+    const double * __restrict__ phi_l1 = PhiL+(l-1)*chunk;
+    const double * __restrict__ phi_l2 = PhiL+(l-2)*chunk;
+    const double c1 = (2*l-1)*one_over_sqrtK[l];
+    const double c2 = sqrtK[l-1]*one_over_sqrtK[l];
     for (index_x=0; index_x<chunk; index_x++)
-      PhiL[l*chunk+index_x] =
-        ((2*l-1)*cotK[index_x]*PhiL[(l-1)*chunk+index_x]-
-         PhiL[(l-2)*chunk+index_x]*sqrtK[l-1])*one_over_sqrtK[l];
+      phi_l[index_x] = c1*cotK[index_x]*phi_l1[index_x]-c2*phi_l2[index_x];
   }
   return _SUCCESS_;
 }
@@ -601,6 +1130,16 @@ int hyperspherical_backwards_recurrence(int K,
   return _SUCCESS_;
 }
 
+/**
+ * Backwards recurrence for a chunk of x values advanced in lockstep:
+ * the starting values at lmax come from the continued fraction at each
+ * x, then each step in l updates the whole chunk in an inner loop over
+ * x which the compiler can vectorize. As in the scalar version, the
+ * overflow test is only done every _HYPER_BLOCK_ steps, but for each x
+ * separately, so that the rescaling of one x never affects the others.
+ *
+ * PhiL[l*chunk+index_x] contains Phi_l(x[index_x]) on output.
+ */
 int hyperspherical_backwards_recurrence_chunk(int K,
                                               int lmax,
                                               double beta,
@@ -613,12 +1152,14 @@ int hyperspherical_backwards_recurrence_chunk(int K,
                                               double * __restrict__ PhiL){
   double phi0, phi1, phipr1;
   int l, k, isign;
-  int funcreturn = _FAILURE_;
+  int funcreturn;
   int index_x;
-  double scalevec[_HYPER_CHUNK_]={0};
+  int rescale;
+  double scalevec[_HYPER_CHUNK_];
 
   for (index_x=0; index_x<chunk; index_x++){
     if (K==1){
+      funcreturn = _FAILURE_;
       if (beta > 1.5*lmax) {
         funcreturn = get_CF1(K,lmax,beta,cotK[index_x], &phipr1, &isign);
       }
@@ -640,21 +1181,33 @@ int hyperspherical_backwards_recurrence_chunk(int K,
   }
   for (l=lmax-2; l>=0; l--){
     //Use recurrence Phi_{l} = --Phi_{l+1} + -- Phi_{l+2}
+    double * __restrict__ phi_l = PhiL+l*chunk;
+    const double * __restrict__ phi_l1 = PhiL+(l+1)*chunk;
+    const double * __restrict__ phi_l2 = PhiL+(l+2)*chunk;
+    const double c1 = (2*l+3)*one_over_sqrtK[l+1];
+    const double c2 = sqrtK[l+2]*one_over_sqrtK[l+1];
     for (index_x=0; index_x<chunk; index_x++){
-      PhiL[l*chunk+index_x] = one_over_sqrtK[l+1]*
-        ((2*l+3)*cotK[index_x]*PhiL[(l+1)*chunk+index_x]-
-         sqrtK[l+2]*PhiL[(l+2)*chunk+index_x]);
+      phi_l[index_x] = c1*cotK[index_x]*phi_l1[index_x]-c2*phi_l2[index_x];
     }
 
-    if (fabs(PhiL[l*chunk])>_HYPER_OVERFLOW_){
-      //Rescale whole Phi vector until this point.
-      //Create scale vector:
-      for (index_x=0; index_x<chunk; index_x++)
-        scalevec[index_x] = fabs(1.0/PhiL[l*chunk+index_x]);
-      //Now do the scaling: (We do it this way to access elements in order)
-      for (k=l; k<=lmax; k++){
-        for (index_x=0; index_x<chunk; index_x++){
-          PhiL[k*chunk+index_x] *= scalevec[index_x];
+    if ((l%_HYPER_BLOCK_) == 0){
+      //Rescale, for each x separately, the part of the Phi vector computed so far:
+      rescale = _FALSE_;
+      for (index_x=0; index_x<chunk; index_x++){
+        if (fabs(phi_l[index_x])>_HYPER_OVERFLOW_){
+          scalevec[index_x] = _ONE_OVER_HYPER_OVERFLOW_;
+          rescale = _TRUE_;
+        }
+        else{
+          scalevec[index_x] = 1.0;
+        }
+      }
+      if (rescale == _TRUE_){
+        //We do it this way to access elements in order:
+        for (k=l; k<=lmax; k++){
+          for (index_x=0; index_x<chunk; index_x++){
+            PhiL[k*chunk+index_x] *= scalevec[index_x];
+          }
         }
       }
     }
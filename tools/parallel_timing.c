@@ -0,0 +1,190 @@
+/******************************************/
+/* Process-wide timing of the OpenMP      */
+/* parallel regions                       */
+/******************************************/
+
+/**
+ * To decide how many threads to give to each run, one needs to know
+ * how each parallel region of CLASS scales with the number of threads.
+ * The main regions are instrumented with a parallel_timer: the master
+ * thread starts it before the region, each thread calls
+ * parallel_timer_thread_done() when it is done with its share of the
+ * work (before the barrier closing the region), and the master thread
+ * stops it after the region, which adds the measures to a process-wide
+ * table indexed by the name of the region.
+ *
+ * For each region, the table holds the number of executions, the
+ * wall-clock time, and the mean and maximum over threads of the time
+ * after which they were done: their ratio is the load-imbalance tail
+ * (1 for a perfectly balanced loop).
+ *
+ * The timing is disabled by default, in which case the timers cost one
+ * test each. It is enabled with parallel_timing_enable(), read with
+ * parallel_timing_get(), and used by test/test_thread_scaling.c.
+ * Concurrent runs in the same process add their measures to the same
+ * table.
+ */
+
+#include "parallel_timing.h"
+#include <time.h>
+
+/** _TRUE_ if the parallel regions are timed */
+static short parallel_timing_enabled = _FALSE_;
+
+/** table of the timed regions (accessed within the critical section parallel_timing only) */
+static struct parallel_timing_region parallel_timing_table[_PARALLEL_TIMING_MAX_REGIONS_];
+
+/** number of regions in the table */
+static int parallel_timing_size = 0;
+
+/** wall-clock time (s) */
+static double parallel_timing_time() {
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+/**
+ * Enable or disable the timing of the parallel regions (the timers
+ * started before the change keep their state).
+ *
+ * @param enable Input: _TRUE_ or _FALSE_
+ */
+
+void parallel_timing_enable(short enable) {
+  parallel_timing_enabled = enable;
+}
+
+/**
+ * Empty the table of the timed regions.
+ */
+
+void parallel_timing_reset() {
+#pragma omp critical (parallel_timing)
+  {
+    parallel_timing_size = 0;
+  }
+}
+
+/**
+ * Copy the table of the timed regions, in the order in which they were
+ * first executed.
+ *
+ * @param regions    Output: array of at least _PARALLEL_TIMING_MAX_REGIONS_ elements
+ * @param region_num Output: number of regions copied
+ * @return the error status
+ */
+
+int parallel_timing_get(struct parallel_timing_region * regions,
+                        int * region_num) {
+#pragma omp critical (parallel_timing)
+  {
+    memcpy(regions,parallel_timing_table,parallel_timing_size*sizeof(struct parallel_timing_region));
+    *region_num = parallel_timing_size;
+  }
+  return _SUCCESS_;
+}
+
+/**
+ * Start the timer of one execution of a parallel region (to be called
+ * before the region). Regions nested in another parallel region (even
+ * with a single thread) are not timed: their time is part of the
+ * enclosing region.
+ *
+ * @param ptimer Output: the timer
+ */
+
+void parallel_timer_start(struct parallel_timer * ptimer) {
+
+  ptimer->enabled = parallel_timing_enabled;
+#ifdef _OPENMP
+  if (omp_get_level() > 0)
+    ptimer->enabled = _FALSE_;
+#endif
+
+  if (ptimer->enabled == _FALSE_)
+    return;
+
+  ptimer->busy_sum = 0.;
+  ptimer->busy_max = 0.;
+  ptimer->threads = 0;
+  ptimer->start = parallel_timing_time();
+}
+
+/**
+ * Record that the calling thread is done with its share of the work of
+ * the region (to be called once by each thread, before the barrier
+ * closing the region, hence after loops with a nowait clause).
+ *
+ * @param ptimer Input/Output: the timer of the region
+ */
+
+void parallel_timer_thread_done(struct parallel_timer * ptimer) {
+
+  double busy;
+
+  if (ptimer->enabled == _FALSE_)
+    return;
+
+  busy = parallel_timing_time()-ptimer->start;
+
+#pragma omp critical (parallel_timer)
+  {
+    ptimer->busy_sum += busy;
+    ptimer->busy_max = MAX(ptimer->busy_max,busy);
+    ptimer->threads++;
+  }
+}
+
+/**
+ * Stop the timer of a region (to be called after the region), and add
+ * its measures to the entry of the table with the same name. The
+ * measures are dropped if the table is full.
+ *
+ * @param ptimer Input: the timer of the region
+ * @param name   Input: name of the region
+ */
+
+void parallel_timer_stop(struct parallel_timer * ptimer,
+                         const char * name) {
+
+  double wall;
+  int index_region;
+  struct parallel_timing_region * pregion;
+
+  if (ptimer->enabled == _FALSE_)
+    return;
+
+  wall = parallel_timing_time()-ptimer->start;
+
+#pragma omp critical (parallel_timing)
+  {
+    for (index_region=0; index_region<parallel_timing_size; index_region++)
+      if (strcmp(parallel_timing_table[index_region].name,name) == 0)
+        break;
+
+    if ((index_region == parallel_timing_size) && (parallel_timing_size < _PARALLEL_TIMING_MAX_REGIONS_)) {
+      pregion = &(parallel_timing_table[parallel_timing_size++]);
+      strncpy(pregion->name,name,_PARALLEL_TIMING_NAME_LENGTH_-1);
+      pregion->name[_PARALLEL_TIMING_NAME_LENGTH_-1] = '\0';
+      pregion->calls = 0;
+      pregion->threads = 0;
+      pregion->wall = 0.;
+      pregion->busy_mean = 0.;
+      pregion->busy_max = 0.;
+    }
+
+    if (index_region < parallel_timing_size) {
+      pregion = &(parallel_timing_table[index_region]);
+      pregion->calls++;
+      pregion->threads = MAX(pregion->threads,ptimer->threads);
+      pregion->wall += wall;
+      if (ptimer->threads > 0) {
+        pregion->busy_mean += ptimer->busy_sum/ptimer->threads;
+        pregion->busy_max += ptimer->busy_max;
+      }
+    }
+  }
+}
@@ -63,6 +63,12 @@ int parser_init(
     class_alloc(pfc->read,size*sizeof(short),errmsg);
   }
 
+  /* the names are filled by the caller: the hash index is built at the
+     first search */
+  pfc->hash_table = NULL;
+  pfc->hash_size = 0;
+  pfc->hash_names = 0;
+
   return _SUCCESS_;
 }
 
@@ -75,6 +81,109 @@ int parser_free(
     free(pfc->value);
     free(pfc->read);
     free(pfc->filename);
+    free(pfc->hash_table);
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Hash of a parameter name (FNV-1a).
+ *
+ * @param name Input: name of the parameter
+ * @return the hash
+ */
+
+unsigned int parser_hash(
+                         char * name
+                         ) {
+
+  unsigned int hash = 2166136261u;
+
+  for (; *name != '\0'; name++) {
+    hash ^= (unsigned char)(*name);
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+/**
+ * Search a parameter name in the file_content structure, through the
+ * hash index of the names. The index is an open-addressing table with
+ * linear probing; it is built at the first search, or rebuilt if more
+ * names than those indexed are now in the structure. Since the names
+ * are inserted in the order of the list, the first name met along the
+ * probe sequence is the first occurence in the list, and any further
+ * occurence lies along the same sequence. Names beyond pfc->size
+ * (temporarily hidden by the caller) are ignored.
+ *
+ * The names should not be modified after the first search, except by
+ * calling parser_free() and parser_init() again.
+ *
+ * @param pfc      Input/output: pointer to file_content structure
+ * @param name     Input: name of the parameter
+ * @param index    Output: index of the first occurence of the name in the list, or -1 if absent
+ * @param multiple Output: _TRUE_ if the name occurs more than once
+ * @param errmsg   Output: error message
+ * @return the error status
+ */
+
+int parser_find(
+                struct file_content * pfc,
+                char * name,
+                int * index,
+                int * multiple,
+                ErrorMsg errmsg
+                ) {
+
+  int i;
+  unsigned int slot;
+
+  * index = -1;
+  * multiple = _FALSE_;
+
+  if (pfc->size <= 0)
+    return _SUCCESS_;
+
+  /** - build the hash index if needed */
+
+  if ((pfc->hash_table == NULL) || (pfc->size > pfc->hash_names)) {
+
+    free(pfc->hash_table);
+
+    pfc->hash_size = 1;
+    while (pfc->hash_size < 2*pfc->size)
+      pfc->hash_size *= 2;
+
+    class_alloc(pfc->hash_table,pfc->hash_size*sizeof(int),errmsg);
+
+    for (slot=0; slot < pfc->hash_size; slot++)
+      pfc->hash_table[slot] = -1;
+
+    for (i=0; i < pfc->size; i++) {
+      slot = parser_hash(pfc->name[i]) & (pfc->hash_size-1);
+      while (pfc->hash_table[slot] != -1)
+        slot = (slot+1) & (pfc->hash_size-1);
+      pfc->hash_table[slot] = i;
+    }
+
+    pfc->hash_names = pfc->size;
+  }
+
+  /** - follow the probe sequence of the name until an empty slot */
+
+  slot = parser_hash(name) & (pfc->hash_size-1);
+
+  while (pfc->hash_table[slot] != -1) {
+    i = pfc->hash_table[slot];
+    if ((i < pfc->size) && (strcmp(pfc->name[i],name) == 0)) {
+      if (* index == -1)
+        * index = i;
+      else
+        * multiple = _TRUE_;
+    }
+    slot = (slot+1) & (pfc->hash_size-1);
   }
 
   return _SUCCESS_;
@@ -176,7 +285,7 @@ int parser_read_int(
 		    ErrorMsg errmsg
 		    ) {
   int index;
-  int i;
+  int multiple;
 
   /* intialize the 'found' flag to false */
 
@@ -184,13 +293,13 @@ int parser_read_int(
 
   /* search parameter */
 
-  index=0;
-  while ((index < pfc->size) && (strcmp(pfc->name[index],name) != 0))
-    index++;
+  class_call(parser_find(pfc,name,&index,&multiple,errmsg),
+             errmsg,
+             errmsg);
 
   /* if parameter not found, return with 'found' flag still equal to false */
 
-  if (index == pfc->size)
+  if (index == -1)
     return _SUCCESS_;
 
   /* read parameter value. If this fails, return an error */
@@ -208,11 +317,9 @@ int parser_read_int(
   /* check for multiple entries of the same parameter. If another occurence is found,
      return an error. */
 
-  for (i=index+1; i < pfc->size; i++) {
-    class_test(strcmp(pfc->name[i],name) == 0,
-	       errmsg,
-	       "multiple entry of parameter '%s' in file '%s'\n",name,pfc->filename);
-  }
+  class_test(multiple == _TRUE_,
+             errmsg,
+             "multiple entry of parameter '%s' in file '%s'\n",name,pfc->filename);
 
   /* if everything proceeded normally, return with 'found' flag equal to true */
 
@@ -228,7 +335,7 @@ int parser_read_double(
 		       ErrorMsg errmsg
 		       ) {
   int index;
-  int i;
+  int multiple;
 
   /* intialize the 'found' flag to false */
 
@@ -236,13 +343,13 @@ int parser_read_double(
 
   /* search parameter */
 
-  index=0;
-  while ((index < pfc->size) && (strcmp(pfc->name[index],name) != 0))
-    index++;
+  class_call(parser_find(pfc,name,&index,&multiple,errmsg),
+             errmsg,
+             errmsg);
 
   /* if parameter not found, return with 'found' flag still equal to false */
 
-  if (index == pfc->size)
+  if (index == -1)
     return _SUCCESS_;
 
   /* read parameter value. If this fails, return an error */
@@ -260,11 +367,9 @@ int parser_read_double(
   /* check for multiple entries of the same parameter. If another occurence is found,
      return an error. */
 
-  for (i=index+1; i < pfc->size; i++) {
-    class_test(strcmp(pfc->name[i],name) == 0,
-	       errmsg,
-	       "multiple entry of parameter '%s' in file '%s'\n",name,pfc->filename);
-  }
+  class_test(multiple == _TRUE_,
+             errmsg,
+             "multiple entry of parameter '%s' in file '%s'\n",name,pfc->filename);
 
   /* if everything proceeded normally, return with 'found' flag equal to true */
 
@@ -281,7 +386,7 @@ int parser_read_double_and_position(
 		       ErrorMsg errmsg
 		       ) {
   int index;
-  int i;
+  int multiple;
 
   /* intialize the 'found' flag to false */
 
@@ -289,13 +394,13 @@ int parser_read_double_and_position(
 
   /* search parameter */
 
-  index=0;
-  while ((index < pfc->size) && (strcmp(pfc->name[index],name) != 0))
-    index++;
+  class_call(parser_find(pfc,name,&index,&multiple,errmsg),
+             errmsg,
+             errmsg);
 
   /* if parameter not found, return with 'found' flag still equal to false */
 
-  if (index == pfc->size)
+  if (index == -1)
     return _SUCCESS_;
 
   /* read parameter value. If this fails, return an error */
@@ -313,11 +418,9 @@ int parser_read_double_and_position(
   /* check for multiple entries of the same parameter. If another occurence is found,
      return an error. */
 
-  for (i=index+1; i < pfc->size; i++) {
-    class_test(strcmp(pfc->name[i],name) == 0,
-	       errmsg,
-	       "multiple entry of parameter '%s' in file '%s'\n",name,pfc->filename);
-  }
+  class_test(multiple == _TRUE_,
+             errmsg,
+             "multiple entry of parameter '%s' in file '%s'\n",name,pfc->filename);
 
   /* if everything proceeded normally, return with 'found' flag equal to true */
 
@@ -335,7 +438,7 @@ int parser_read_string(
 		       ErrorMsg errmsg
 		       ) {
   int index;
-  int i;
+  int multiple;
 
   /* intialize the 'found' flag to false */
 
@@ -343,13 +446,13 @@ int parser_read_string(
 
   /* search parameter */
 
-  index=0;
-  while ((index < pfc->size) && (strcmp(pfc->name[index],name) != 0))
-    index++;
+  class_call(parser_find(pfc,name,&index,&multiple,errmsg),
+             errmsg,
+             errmsg);
 
   /* if parameter not found, return with 'found' flag still equal to false */
 
-  if (index == pfc->size)
+  if (index == -1)
     return _SUCCESS_;
 
   /* read parameter value. */
@@ -365,11 +468,9 @@ int parser_read_string(
   /* check for multiple entries of the same parameter. If another occurence is found,
      return an error. */
 
-  for (i=index+1; i < pfc->size; i++) {
-    class_test(strcmp(pfc->name[i],name) == 0,
-	       errmsg,
-	       "multiple entry of parameter '%s' in file '%s'\n",name,pfc->filename);
-  }
+  class_test(multiple == _TRUE_,
+             errmsg,
+             "multiple entry of parameter '%s' in file '%s'\n",name,pfc->filename);
 
   /* if everything proceeded normally, return with 'found' flag equal to true */
 
@@ -386,6 +487,7 @@ int parser_read_list_of_doubles(
 				ErrorMsg errmsg
 				) {
   int index;
+  int multiple;
   int i;
 
   char * string;
@@ -400,13 +502,13 @@ int parser_read_list_of_doubles(
 
   /* search parameter */
 
-  index=0;
-  while ((index < pfc->size) && (strcmp(pfc->name[index],name) != 0))
-    index++;
+  class_call(parser_find(pfc,name,&index,&multiple,errmsg),
+             errmsg,
+             errmsg);
 
   /* if parameter not found, return with 'found' flag still equal to false */
 
-  if (index == pfc->size)
+  if (index == -1)
     return _SUCCESS_;
 
   /* count number of comas and compute size = number of comas + 1 */
@@ -455,11 +557,9 @@ int parser_read_list_of_doubles(
   /* check for multiple entries of the same parameter. If another occurence is found,
      return an error. */
 
-  for (i=index+1; i < pfc->size; i++) {
-    class_test(strcmp(pfc->name[i],name) == 0,
-	       errmsg,
-	       "multiple entry of parameter '%s' in file '%s'\n",name,pfc->filename);
-  }
+  class_test(multiple == _TRUE_,
+             errmsg,
+             "multiple entry of parameter '%s' in file '%s'\n",name,pfc->filename);
 
   /* if everything proceeded normally, return with 'found' flag equal to true */
 
@@ -476,6 +576,7 @@ int parser_read_list_of_integers(
 				 ErrorMsg errmsg
 				 ) {
   int index;
+  int multiple;
   int i;
 
   char * string;
@@ -490,13 +591,13 @@ int parser_read_list_of_integers(
 
   /* search parameter */
 
-  index=0;
-  while ((index < pfc->size) && (strcmp(pfc->name[index],name) != 0))
-    index++;
+  class_call(parser_find(pfc,name,&index,&multiple,errmsg),
+             errmsg,
+             errmsg);
 
   /* if parameter not found, return with 'found' flag still equal to false */
 
-  if (index == pfc->size)
+  if (index == -1)
     return _SUCCESS_;
 
   /* count number of comas and compute size = number of comas + 1 */
@@ -545,11 +646,9 @@ int parser_read_list_of_integers(
   /* check for multiple entries of the same parameter. If another occurence is found,
      return an error. */
 
-  for (i=index+1; i < pfc->size; i++) {
-    class_test(strcmp(pfc->name[i],name) == 0,
-	       errmsg,
-	       "multiple entry of parameter '%s' in file '%s'\n",name,pfc->filename);
-  }
+  class_test(multiple == _TRUE_,
+             errmsg,
+             "multiple entry of parameter '%s' in file '%s'\n",name,pfc->filename);
 
   /* if everything proceeded normally, return with 'found' flag equal to true */
 
@@ -566,6 +665,7 @@ int parser_read_list_of_strings(
 				ErrorMsg errmsg
 				) {
   int index;
+  int multiple;
   int i;
 
   char * string;
@@ -580,13 +680,13 @@ int parser_read_list_of_strings(
 
   /* search parameter */
 
-  index=0;
-  while ((index < pfc->size) && (strcmp(pfc->name[index],name) != 0))
-    index++;
+  class_call(parser_find(pfc,name,&index,&multiple,errmsg),
+             errmsg,
+             errmsg);
 
   /* if parameter not found, return with 'found' flag still equal to false */
 
-  if (index == pfc->size)
+  if (index == -1)
     return _SUCCESS_;
 
   /* count number of comas and compute size = number of comas + 1 */
@@ -629,11 +729,9 @@ int parser_read_list_of_strings(
   /* check for multiple entries of the same parameter. If another occurence is
      found,
      return an error. */
-  for (i=index+1; i < pfc->size; i++) {
-    class_test(strcmp(pfc->name[i],name) == 0,
-	       errmsg,
-	       "multiple entry of parameter '%s' in file '%s'\n",name,pfc->filename);
-  }
+  class_test(multiple == _TRUE_,
+             errmsg,
+             "multiple entry of parameter '%s' in file '%s'\n",name,pfc->filename);
   /* if everything proceeded normally, return with 'found' flag equal to true */
   return _SUCCESS_;
 }
@@ -672,6 +770,9 @@ int parser_cat(
   class_alloc(pfc3->value,pfc3->size*sizeof(FileArg),errmsg);
   class_alloc(pfc3->name,pfc3->size*sizeof(FileArg),errmsg);
   class_alloc(pfc3->read,pfc3->size*sizeof(short),errmsg);
+  pfc3->hash_table = NULL;
+  pfc3->hash_size = 0;
+  pfc3->hash_names = 0;
 
   for (i=0; i < pfc1->size; i++) {
     strcpy(pfc3->value[i],pfc1->value[i]);
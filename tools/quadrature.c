@@ -22,6 +22,8 @@ int get_qsampling_manual(double *x,
   switch (method){ 
   case (qm_auto) :
     return _FAILURE_;
+  case (qm_compressed) :
+    class_stop(errmsg,"the compressed quadrature strategy is only available for the long-range interacting fermion");
   case (qm_Laguerre) :
     /* Allocate storage for Laguerre coefficients: */
     class_alloc(b,N*sizeof(double),errmsg);
@@ -356,6 +358,347 @@ int get_qsampling(double *x,
   return _SUCCESS_;
 }
 
+/**
+ * Same as get_qsampling(), but the resulting abscissas and weights are
+ * stored in, and when possible read from, a file in cache_directory.
+ * This is useful when the same distribution is sampled in many runs
+ * (e.g. along a Monte Carlo chain), since the adaptive search is by
+ * far the most expensive part of the q-sampling.
+ *
+ * The file name is built from a hash of everything the result depends
+ * on (see qsampling_cache_key()), so that a file can never be used for
+ * another distribution or tolerance. If cache_directory is NULL or
+ * empty, this is just get_qsampling(). If the cache file is missing or
+ * unreadable, the sampling is recomputed; failing to write the cache is
+ * not an error.
+ *
+ * Arguments are those of get_qsampling(), plus:
+ *
+ * @param cache_directory Input: directory of the cache files, or empty string
+ */
+
+int get_qsampling_cached(double *x,
+			 double *w,
+			 int *N,
+			 int N_max,
+			 double rtol,
+			 double *qvec,
+			 int qsiz,
+			 int (*test)(void * params_for_function, double q, double *psi),
+			 int (*function)(void * params_for_function, double q, double *f0),
+			 void * params_for_function,
+			 char * cache_directory,
+			 ErrorMsg errmsg) {
+
+  unsigned long long key;
+  FileName filename, tmpname;
+  FILE * cachefile;
+  int i,n,status;
+
+  if ((cache_directory == NULL) || (cache_directory[0] == '\0'))
+    return get_qsampling(x,w,N,N_max,rtol,qvec,qsiz,test,function,params_for_function,errmsg);
+
+  class_call(qsampling_cache_key(N_max,rtol,qvec,qsiz,test,function,params_for_function,&key,errmsg),
+	     errmsg,
+	     errmsg);
+
+  sprintf(filename,"%s/qsampling_%016llx.dat",cache_directory,key);
+
+  /** - try to read the cache file */
+  cachefile = fopen(filename,"r");
+  if (cachefile != NULL) {
+    status = fscanf(cachefile,"%*[^\n]\n%d",&n);
+    if ((status == 1) && (n > 0) && (n <= N_max)) {
+      for (i=0; i<n; i++) {
+	if (fscanf(cachefile,"%lf %lf",&x[i],&w[i]) != 2)
+	  break;
+      }
+      if (i == n) {
+	*N = n;
+	fclose(cachefile);
+	return _SUCCESS_;
+      }
+    }
+    fclose(cachefile);
+  }
+
+  /** - otherwise compute the sampling, and store it. The file is
+        written under a temporary name (unique to this call) and then
+        renamed, so that concurrent runs never read a
+        partially written file. */
+  class_call(get_qsampling(x,w,N,N_max,rtol,qvec,qsiz,test,function,params_for_function,errmsg),
+	     errmsg,
+	     errmsg);
+
+  class_temporary_file_name(filename,tmpname);
+  cachefile = fopen(tmpname,"w");
+  if (cachefile != NULL) {
+    fprintf(cachefile,"# CLASS q-sampling: N, then q and w\n%d\n",*N);
+    for (i=0; i<*N; i++)
+      fprintf(cachefile,"%.17e %.17e\n",x[i],w[i]);
+    status = fclose(cachefile);
+    if ((status != 0) || (rename(tmpname,filename) != 0))
+      remove(tmpname);
+  }
+
+  return _SUCCESS_;
+}
+
+/**
+ * Hash (64-bit FNV-1a) of the inputs determining the result of
+ * get_qsampling(): the maximum number of points, the tolerance, the
+ * table of momenta of a tabulated distribution, and the values of the
+ * distribution and of the test function on a fixed set of momenta.
+ * Hashing the function values rather than the parameters of the
+ * distribution makes the key valid for any f0(q), including one read
+ * from a file.
+ *
+ * @param N_max               Input: maximum number of points
+ * @param rtol                Input: tolerance
+ * @param qvec                Input: momenta of tabulated distribution, or NULL
+ * @param qsiz                Input: size of qvec
+ * @param test                Input: test function
+ * @param function            Input: distribution function
+ * @param params_for_function Input: parameters of the two functions
+ * @param key                 Output: hash
+ * @param errmsg              Input/Output: error message
+ * @return the error status
+ */
+
+int qsampling_cache_key(int N_max,
+			double rtol,
+			double *qvec,
+			int qsiz,
+			int (*test)(void * params_for_function, double q, double *psi),
+			int (*function)(void * params_for_function, double q, double *f0),
+			void * params_for_function,
+			unsigned long long * key,
+			ErrorMsg errmsg) {
+
+  unsigned long long hash = 14695981039346656037ULL;
+  double values[3];
+  int i;
+
+  /* a small macro, to hash the bytes of any variable */
+#define _QSS_HASH_(var) do {						\
+    unsigned char * bytes = (unsigned char *)&(var);			\
+    size_t ib;								\
+    for (ib=0; ib<sizeof(var); ib++) {					\
+      hash ^= bytes[ib];						\
+      hash *= 1099511628211ULL;						\
+    }									\
+  } while(0)
+
+  _QSS_HASH_(N_max);
+  _QSS_HASH_(rtol);
+  _QSS_HASH_(qsiz);
+  for (i=0; i<qsiz; i++)
+    _QSS_HASH_(qvec[i]);
+
+  /* momenta from 1e-3 to about 200, beyond the range relevant for any sampling */
+  for (i=0; i<_QSS_CACHE_PROBES_; i++) {
+    values[0] = 1.e-3*exp(12.2*i/(_QSS_CACHE_PROBES_-1.));
+    class_test((*function)(params_for_function,values[0],&values[1]) == _FAILURE_,
+	       errmsg,
+	       "could not evaluate distribution function at q=%e",values[0]);
+    class_test((*test)(params_for_function,values[0],&values[2]) == _FAILURE_,
+	       errmsg,
+	       "could not evaluate test function at q=%e",values[0]);
+    _QSS_HASH_(values);
+  }
+
+#undef _QSS_HASH_
+
+  *key = hash;
+
+  return _SUCCESS_;
+}
+
+/**
+ * Empirical quadrature: selects a few nodes among those of a fine
+ * reference rule, with new weights, such that a given family of
+ * integrands is integrated as by the reference rule.
+ *
+ * The integrands are given by their values g[r*N_in+j] at the nodes of
+ * the reference rule. Nodes are added greedily: the next one is the
+ * node where the weighted residual integrand is largest, and the
+ * weights are then fitted by least squares to the relative integrals
+ * of all integrands (nodes which get a negative weight are dropped
+ * for good). The selection stops as soon as all integrals are
+ * reproduced within rtol and N_min nodes are used, or when N_max
+ * nodes are used.
+ *
+ * @param x_in   Input: nodes of the reference rule
+ * @param w_in   Input: weights of the reference rule
+ * @param N_in   Input: number of nodes of the reference rule
+ * @param g      Input: integrands at the reference nodes, R rows of N_in values
+ * @param R      Input: number of integrands (none of them can integrate to zero)
+ * @param rtol   Input: relative tolerance on the integrals
+ * @param N_min  Input: minimum number of nodes
+ * @param N_max  Input: maximum number of nodes (size of x and w)
+ * @param x      Output: selected nodes, in increasing order
+ * @param w      Output: corresponding weights
+ * @param N      Output: number of selected nodes
+ * @param error  Output: largest relative error on the integrals
+ * @param errmsg Input/Output: error message
+ * @return the error status
+ */
+
+int get_qsampling_empirical(double *x_in,
+			    double *w_in,
+			    int N_in,
+			    double *g,
+			    int R,
+			    double rtol,
+			    int N_min,
+			    int N_max,
+			    double *x,
+			    double *w,
+			    int *N,
+			    double *error,
+			    ErrorMsg errmsg) {
+
+  int r,i,j,k,n,best,has_negative;
+  double ref,score,best_score,proj,norm;
+  double *a, *q, *rr, *c, *res;
+  int *selected, *status;
+
+  class_alloc(a,R*N_in*sizeof(double),errmsg);
+  class_alloc(q,R*N_max*sizeof(double),errmsg);
+  class_alloc(rr,N_max*N_max*sizeof(double),errmsg);
+  class_alloc(c,N_max*sizeof(double),errmsg);
+  class_alloc(res,R*sizeof(double),errmsg);
+  class_alloc(selected,N_max*sizeof(int),errmsg);
+  /* status: 0 = available, 1 = selected, -1 = dropped */
+  class_calloc(status,N_in,sizeof(int),errmsg);
+
+  /** - integrands normalised to a unit integral */
+  for (r=0; r<R; r++) {
+    ref = 0.;
+    for (j=0; j<N_in; j++)
+      ref += w_in[j]*g[r*N_in+j];
+    class_test(ref == 0.,
+	       errmsg,
+	       "integrand %d has a vanishing integral",r);
+    for (j=0; j<N_in; j++)
+      a[r*N_in+j] = g[r*N_in+j]/ref;
+    res[r] = 1.;
+  }
+
+  n = 0;
+  *error = 1.;
+
+  while (n < N_max) {
+
+    /** - add the node where the residual integrand is largest */
+    best = -1;
+    best_score = 0.;
+    for (j=0; j<N_in; j++) {
+      if (status[j] != 0)
+	continue;
+      score = 0.;
+      for (r=0; r<R; r++)
+	score += a[r*N_in+j]*res[r];
+      score *= w_in[j];
+      if (score > best_score) {
+	best_score = score;
+	best = j;
+      }
+    }
+    if (best < 0)
+      break;
+    selected[n++] = best;
+    status[best] = 1;
+
+    /** - least-squares weights (modified Gram-Schmidt QR), dropping
+	  the nodes with negative weights */
+    do {
+      for (k=0; k<n; k++) {
+	for (r=0; r<R; r++)
+	  q[r*N_max+k] = a[r*N_in+selected[k]];
+	for (i=0; i<k; i++) {
+	  proj = 0.;
+	  for (r=0; r<R; r++)
+	    proj += q[r*N_max+i]*q[r*N_max+k];
+	  rr[i*N_max+k] = proj;
+	  for (r=0; r<R; r++)
+	    q[r*N_max+k] -= proj*q[r*N_max+i];
+	}
+	norm = 0.;
+	for (r=0; r<R; r++)
+	  norm += q[r*N_max+k]*q[r*N_max+k];
+	rr[k*N_max+k] = sqrt(norm);
+	class_test(rr[k*N_max+k] <= 0.,
+		   errmsg,
+		   "degenerate integrands in the empirical quadrature");
+	for (r=0; r<R; r++)
+	  q[r*N_max+k] /= rr[k*N_max+k];
+      }
+      for (k=0; k<n; k++) {
+	c[k] = 0.;
+	for (r=0; r<R; r++)
+	  c[k] += q[r*N_max+k];
+      }
+      for (k=n-1; k>=0; k--) {
+	w[k] = c[k];
+	for (i=k+1; i<n; i++)
+	  w[k] -= rr[k*N_max+i]*w[i];
+	w[k] /= rr[k*N_max+k];
+      }
+
+      has_negative = _FALSE_;
+      for (k=0, i=0; k<n; k++) {
+	if (w[k] < 0.) {
+	  status[selected[k]] = -1;
+	  has_negative = _TRUE_;
+	}
+	else {
+	  selected[i++] = selected[k];
+	}
+      }
+      n = i;
+    } while ((has_negative == _TRUE_) && (n > 0));
+
+    /** - residuals */
+    *error = 0.;
+    for (r=0; r<R; r++) {
+      res[r] = 1.;
+      for (k=0; k<n; k++)
+	res[r] -= a[r*N_in+selected[k]]*w[k];
+      *error = MAX(*error,fabs(res[r]));
+    }
+
+    if ((n >= N_min) && (*error < rtol))
+      break;
+  }
+
+  class_test(n == 0,
+	     errmsg,
+	     "the empirical quadrature could not select any node");
+
+  /** - output nodes in increasing order */
+  for (k=0; k<n; k++) {
+    i = k;
+    for (j=k+1; j<n; j++)
+      if (x_in[selected[j]] < x_in[selected[i]])
+	i = j;
+    j = selected[i]; selected[i] = selected[k]; selected[k] = j;
+    proj = w[i]; w[i] = w[k]; w[k] = proj;
+    x[k] = x_in[selected[k]];
+  }
+  *N = n;
+
+  free(a);
+  free(q);
+  free(rr);
+  free(c);
+  free(res);
+  free(selected);
+  free(status);
+
+  return _SUCCESS_;
+}
+
 int sort_x_and_w(double *x, double *w, double *workx, double *workw, int startidx, int endidx){
   int i,top=endidx,bot=startidx;
   double pivot;